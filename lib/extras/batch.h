@@ -0,0 +1,73 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_EXTRAS_BATCH_H_
+#define LIB_EXTRAS_BATCH_H_
+
+// Helpers for encoding or decoding batches of files on several threads.
+
+#include <jxl/parallel_runner.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+
+namespace jxl {
+namespace extras {
+
+// Parallel runner that forwards to another runner, one call at a time, so
+// that concurrent encoders or decoders can share a runner that is not
+// re-entrant.
+struct SerializedRunner {
+  JxlParallelRunner runner;
+  void* runner_opaque;
+  std::mutex mutex;
+
+  static JxlParallelRetCode Run(void* runner_opaque, void* jpegxl_opaque,
+                                JxlParallelRunInit init,
+                                JxlParallelRunFunction func,
+                                uint32_t start_range, uint32_t end_range) {
+    SerializedRunner* self = static_cast<SerializedRunner*>(runner_opaque);
+    std::lock_guard<std::mutex> lock(self->mutex);
+    return self->runner(self->runner_opaque, jpegxl_opaque, init, func,
+                        start_range, end_range);
+  }
+};
+
+// Bounds the total size of the images that are being encoded or decoded.
+class ByteBudget {
+ public:
+  explicit ByteBudget(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+  // Waits until `bytes` fit in the budget, or no other file is in flight.
+  void Acquire(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&] {
+      return in_flight_ == 0 ||
+             (in_flight_ <= max_bytes_ && bytes <= max_bytes_ - in_flight_);
+    });
+    in_flight_ += bytes;
+  }
+
+  void Release(size_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      in_flight_ -= bytes;
+    }
+    cv_.notify_all();
+  }
+
+ private:
+  const size_t max_bytes_;
+  size_t in_flight_ = 0;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+}  // namespace extras
+}  // namespace jxl
+
+#endif  // LIB_EXTRAS_BATCH_H_
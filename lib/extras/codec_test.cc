@@ -7,6 +7,7 @@
 
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <algorithm>
 #include <sstream>
@@ -15,10 +16,18 @@
 #include <vector>
 
 #include "lib/extras/dec/decode.h"
+#include "lib/extras/dec/exr.h"
+#include "lib/extras/dec/gif.h"
+#include "lib/extras/dec/jxl.h"
 #include "lib/extras/dec/pgx.h"
 #include "lib/extras/dec/pnm.h"
+#if JPEGXL_ENABLE_APNG
+#include "lib/extras/enc/apng.h"
+#endif
 #include "lib/extras/enc/encode.h"
+#include "lib/extras/enc/jxl.h"
 #include "lib/extras/packed_image_convert.h"
+#include "lib/jxl/base/file_io.h"
 #include "lib/jxl/base/random.h"
 #include "lib/jxl/color_management.h"
 #include "lib/jxl/enc_butteraugli_comparator.h"
@@ -346,6 +355,50 @@ TEST(CodecTest, TestRoundTrip) {
   }
 }
 
+#if JPEGXL_ENABLE_EXR && !defined(ADDRESS_SANITIZER) && \
+    !defined(MEMORY_SANITIZER) && !defined(THREAD_SANITIZER)
+TEST(CodecTest, EXRThreads) {
+  ThreadPoolForTests pool(4);
+  TestImageParams params;
+  params.codec = Codec::kEXR;
+  // Many 16-line blocks of the default ZIP compression.
+  params.xsize = 70;
+  params.ysize = 300;
+  params.bits_per_sample = 32;
+  params.is_gray = false;
+  params.add_alpha = true;
+  params.big_endian = false;
+  params.add_extra_channels = false;
+  PackedPixelFile ppf_in;
+  CreateTestImage(params, &ppf_in);
+
+  std::vector<uint8_t> bitstreams[2];
+  for (size_t i = 0; i < 2; ++i) {
+    auto encoder = Encoder::FromExtension(".exr");
+    ASSERT_TRUE(encoder.get());
+    encoder->SetOption("num_threads", i == 0 ? "0" : "4");
+    EncodedImage encoded;
+    ASSERT_TRUE(encoder->Encode(ppf_in, &encoded, i == 0 ? nullptr : &pool));
+    ASSERT_EQ(1, encoded.bitstreams.size());
+    bitstreams[i] = std::move(encoded.bitstreams[0]);
+  }
+  EXPECT_EQ(bitstreams[0], bitstreams[1]);
+
+  for (int num_threads : {0, 4}) {
+    EXRDecompressParams dparams;
+    dparams.num_threads = num_threads;
+    PackedPixelFile ppf_out;
+    ASSERT_TRUE(DecodeImageEXR(Span<const uint8_t>(bitstreams[0]),
+                               ColorHints(), &ppf_out,
+                               /*constraints=*/nullptr, &dparams));
+    ASSERT_EQ(1, ppf_out.frames.size());
+    VerifySameImage(ppf_in.frames[0].color, ppf_in.info.bits_per_sample,
+                    ppf_out.frames[0].color, ppf_out.info.bits_per_sample,
+                    /*lossless=*/true);
+  }
+}
+#endif
+
 TEST(CodecTest, LosslessPNMRoundtrip) {
   ThreadPoolForTests pool(12);
 
@@ -570,6 +623,284 @@ TEST(CodecTest, TestWideGamut) {
 
 TEST(CodecTest, TestPNM) { TestCodecPNM(); }
 
+// Compares the rectangles of the chunked input of `bytes` with the planes
+// decoded by DecodeImagePNM.
+void TestChunkedPNM(const std::string& bytes, const char* extension) {
+  const Span<const uint8_t> span(reinterpret_cast<const uint8_t*>(bytes.data()),
+                                 bytes.size());
+  PackedPixelFile expected;
+  ASSERT_TRUE(DecodeImagePNM(span, ColorHints(), &expected));
+  const std::string path = ::testing::TempDir() + "chunked_pnm" + extension;
+  ASSERT_TRUE(WriteFile(bytes, path));
+
+  ChunkedPNMDecoder decoder;
+  PackedPixelFile ppf;
+  ASSERT_TRUE(decoder.Init(path.c_str(), ColorHints(), &ppf));
+  EXPECT_TRUE(ppf.frames.empty());
+  EXPECT_EQ(expected.info.xsize, ppf.info.xsize);
+  EXPECT_EQ(expected.info.ysize, ppf.info.ysize);
+  EXPECT_EQ(expected.info.num_extra_channels, ppf.info.num_extra_channels);
+  const JxlChunkedFrameInputSource source = decoder.GetInputSource();
+  const PackedFrame& frame = expected.frames[0];
+  JxlPixelFormat format;
+  source.get_color_channels_pixel_format(source.opaque, &format);
+  EXPECT_EQ(frame.color.format.num_channels, format.num_channels);
+  EXPECT_EQ(frame.color.format.data_type, format.data_type);
+  EXPECT_EQ(frame.color.format.endianness, format.endianness);
+
+  const size_t x0 = 1;
+  const size_t y0 = 1;
+  const size_t xsize = frame.color.xsize - 2;
+  const size_t ysize = frame.color.ysize - 2;
+  const auto verify = [&](const PackedImage& image, const void* buffer,
+                          size_t row_offset) {
+    ASSERT_NE(nullptr, buffer);
+    const size_t pixel_size = image.pixel_stride();
+    for (size_t y = 0; y < ysize; ++y) {
+      const uint8_t* row = static_cast<const uint8_t*>(buffer) + y * row_offset;
+      const uint8_t* expected_row =
+          static_cast<const uint8_t*>(image.pixels()) +
+          (y0 + y) * image.stride + x0 * pixel_size;
+      EXPECT_EQ(0, memcmp(expected_row, row, xsize * pixel_size));
+    }
+    source.release_buffer(source.opaque, buffer);
+  };
+  size_t row_offset;
+  const void* buffer = source.get_color_channel_data_at(
+      source.opaque, x0, y0, xsize, ysize, &row_offset);
+  verify(frame.color, buffer, row_offset);
+  const size_t num_alpha = expected.info.alpha_bits != 0 ? 1 : 0;
+  for (size_t i = 0; i < frame.extra_channels.size(); ++i) {
+    buffer = source.get_extra_channel_data_at(source.opaque, num_alpha + i, x0,
+                                              y0, xsize, ysize, &row_offset);
+    verify(frame.extra_channels[i], buffer, row_offset);
+  }
+}
+
+TEST(CodecTest, ChunkedPNMDecoder) {
+  Rng rng(0);
+  const auto random_bytes = [&](size_t size) {
+    std::string bytes(size, 0);
+    for (char& c : bytes) c = static_cast<char>(rng.UniformU(0, 256));
+    return bytes;
+  };
+  // In place.
+  TestChunkedPNM("P6\n5 4\n65535\n" + random_bytes(5 * 4 * 3 * 2), ".ppm");
+  // Interleaved extra channel.
+  TestChunkedPNM(
+      "P7\nWIDTH 5\nHEIGHT 4\nDEPTH 3\nMAXVAL 255\n"
+      "TUPLTYPE GRAYSCALE_ALPHA\nTUPLTYPE Depth\nENDHDR\n" +
+          random_bytes(5 * 4 * 3),
+      ".pam");
+  // Bottom to top.
+  std::string pfm = "PF\n5 4\n-1.0\n";
+  for (size_t i = 0; i < 5 * 4 * 3; ++i) {
+    const float f = rng.UniformF(0.0f, 1.0f);
+    pfm.append(reinterpret_cast<const char*>(&f), sizeof(f));
+  }
+  TestChunkedPNM(pfm, ".pfm");
+}
+
+#if JPEGXL_ENABLE_GIF
+TEST(CodecTest, StreamGIFFrames) {
+  const PaddedBytes orig = jxl::test::ReadTestData("jxl/traffic_light.gif");
+  PackedPixelFile expected;
+  ASSERT_TRUE(DecodeImageGIF(Span<const uint8_t>(orig), ColorHints(),
+                             &expected));
+
+  PackedPixelFile ppf;
+  JXLCompressParams params;
+  params.distance = 0;
+  JXLFrameEncoder encoder(params, ppf);
+  size_t num_frames = 0;
+  const auto on_frame = [&](PackedFrame&& frame) -> Status {
+    EXPECT_EQ(expected.info.xsize, ppf.info.xsize);
+    EXPECT_EQ(expected.info.alpha_bits, ppf.info.alpha_bits);
+    JXL_ASSERT(num_frames < expected.frames.size());
+    const PackedImage& color = expected.frames[num_frames++].color;
+    EXPECT_EQ(color.pixels_size, frame.color.pixels_size);
+    EXPECT_EQ(0, memcmp(color.pixels(), frame.color.pixels(),
+                        color.pixels_size));
+    return encoder.AddFrame(std::move(frame));
+  };
+  ASSERT_TRUE(DecodeImageGIF(Span<const uint8_t>(orig), ColorHints(), &ppf,
+                             /*constraints=*/nullptr, on_frame));
+  EXPECT_TRUE(ppf.frames.empty());
+  EXPECT_EQ(expected.frames.size(), num_frames);
+  std::vector<uint8_t> compressed;
+  ASSERT_TRUE(encoder.Finish(&compressed));
+
+  PackedPixelFile decoded;
+  ASSERT_TRUE(DecodeImageJXL(compressed.data(), compressed.size(),
+                             JXLDecompressParams(), /*decoded_bytes=*/nullptr,
+                             &decoded));
+  EXPECT_EQ(expected.frames.size(), decoded.frames.size());
+}
+#endif
+
+TEST(CodecTest, BatchRoundtrip) {
+  const size_t kNumFiles = 5;
+  const auto make_params = [](size_t index) {
+    TestImageParams params;
+    params.codec = Codec::kPNM;
+    params.xsize = 20 + index;
+    params.ysize = 10;
+    params.bits_per_sample = 8;
+    params.is_gray = false;
+    params.add_alpha = false;
+    params.big_endian = false;
+    params.add_extra_channels = false;
+    return params;
+  };
+  std::vector<std::vector<uint8_t>> compressed(kNumFiles);
+  JXLCompressParams cparams;
+  cparams.distance = 0;
+  // A budget of about one image, so that the workers have to wait.
+  const size_t max_bytes = 25 * 10 * 3;
+  EXPECT_EQ(0, EncodeBatchJXL(
+                   cparams, kNumFiles, /*num_workers=*/3, max_bytes,
+                   [&](size_t index, PackedPixelFile* ppf,
+                       std::vector<uint8_t>* /*jpeg_bytes*/) {
+                     CreateTestImage(make_params(index), ppf);
+                     return true;
+                   },
+                   [&](size_t index, const std::vector<uint8_t>& bytes) {
+                     compressed[index] = bytes;
+                     return true;
+                   }));
+
+  JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(make_params(0).PixelFormat());
+  // Not vector<bool>, whose elements the workers can't set concurrently.
+  std::vector<uint8_t> written(kNumFiles, 0);
+  EXPECT_EQ(0, DecodeBatchJXL(
+                   dparams, kNumFiles, /*num_workers=*/3, max_bytes,
+                   [&](size_t index, std::vector<uint8_t>* bytes) {
+                     *bytes = compressed[index];
+                     return true;
+                   },
+                   [&](size_t index, const PackedPixelFile& ppf) {
+                     PackedPixelFile expected;
+                     CreateTestImage(make_params(index), &expected);
+                     JXL_ASSERT(ppf.frames.size() == 1);
+                     VerifySameImage(expected.frames[0].color,
+                                     expected.info.bits_per_sample,
+                                     ppf.frames[0].color,
+                                     ppf.info.bits_per_sample,
+                                     /*lossless=*/true);
+                     written[index] = 1;
+                     return true;
+                   }));
+  for (size_t i = 0; i < kNumFiles; ++i) EXPECT_EQ(1, written[i]);
+}
+
+TEST(CodecTest, PackedImageView) {
+  TestImageParams params;
+  params.codec = Codec::kPNM;
+  params.xsize = 20;
+  params.ysize = 10;
+  params.bits_per_sample = 8;
+  params.is_gray = false;
+  params.add_alpha = false;
+  params.big_endian = false;
+  params.add_extra_channels = false;
+  PackedPixelFile expected;
+  CreateTestImage(params, &expected);
+  const PackedImage& color = expected.frames[0].color;
+
+  // Rows with padding that no alignment of the format gives.
+  const size_t stride = color.stride + 5;
+  std::vector<uint8_t> buffer(stride * color.ysize);
+  for (size_t y = 0; y < color.ysize; ++y) {
+    memcpy(&buffer[y * stride],
+           static_cast<const uint8_t*>(color.pixels()) + y * color.stride,
+           color.stride);
+  }
+  bool released = false;
+  std::vector<uint8_t> compressed;
+  {
+    PackedPixelFile ppf;
+    CreateTestImage(params, &ppf);
+    ppf.frames[0].color =
+        PackedImage(color.xsize, color.ysize, color.format, buffer.data(),
+                    stride, [&](void* pixels) {
+                      EXPECT_EQ(buffer.data(), pixels);
+                      released = true;
+                    });
+    EXPECT_EQ(buffer.data(), ppf.frames[0].color.pixels());
+    EXPECT_EQ(stride * color.ysize, ppf.frames[0].color.pixels_size);
+    JXLCompressParams cparams;
+    cparams.distance = 0;
+    ASSERT_TRUE(
+        EncodeImageJXL(cparams, ppf, /*jpeg_bytes=*/nullptr, &compressed));
+    EXPECT_FALSE(released);
+  }
+  EXPECT_TRUE(released);
+
+  JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(color.format);
+  PackedPixelFile decoded;
+  ASSERT_TRUE(DecodeImageJXL(compressed.data(), compressed.size(), dparams,
+                             /*decoded_bytes=*/nullptr, &decoded));
+  ASSERT_EQ(1, decoded.frames.size());
+  VerifySameImage(color, expected.info.bits_per_sample,
+                  decoded.frames[0].color, decoded.info.bits_per_sample,
+                  /*lossless=*/true);
+}
+
+TEST(CodecTest, TiledEncoding) {
+  TestImageParams params;
+  params.codec = Codec::kPNM;
+  params.xsize = 70;
+  params.ysize = 50;
+  params.bits_per_sample = 8;
+  params.is_gray = false;
+  params.add_alpha = true;
+  params.big_endian = false;
+  params.add_extra_channels = false;
+  PackedPixelFile ppf;
+  CreateTestImage(params, &ppf);
+  JXLCompressParams cparams;
+  cparams.distance = 0;
+  cparams.tile_size = 32;
+  std::vector<uint8_t> compressed;
+  ASSERT_TRUE(
+      EncodeImageJXL(cparams, ppf, /*jpeg_bytes=*/nullptr, &compressed));
+
+  // The index box is the last one, with 3 x 2 tiles.
+  const size_t index_size = 8 + 6 * 24;
+  ASSERT_GT(compressed.size(), 8 + index_size);
+  const uint8_t* index = &compressed[compressed.size() - index_size];
+  EXPECT_EQ(0, memcmp(index - 4, "tidx", 4));
+  const auto read_u32 = [](const uint8_t* p) {
+    return (uint32_t{p[0]} << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+  };
+  EXPECT_EQ(32u, read_u32(index));
+  EXPECT_EQ(6u, read_u32(index + 4));
+  // The last tile.
+  EXPECT_EQ(64u, read_u32(index + 8 + 5 * 24));
+  EXPECT_EQ(32u, read_u32(index + 8 + 5 * 24 + 4));
+  EXPECT_EQ(6u, read_u32(index + 8 + 5 * 24 + 8));
+  EXPECT_EQ(18u, read_u32(index + 8 + 5 * 24 + 12));
+  // The tiles after the first one start with their jxlp box.
+  const uint8_t* offset = index + 8 + 24 + 16;
+  const size_t second_tile = (uint64_t{read_u32(offset)} << 32) |
+                             read_u32(offset + 4);
+  ASSERT_LT(second_tile + 8, compressed.size());
+  EXPECT_EQ(0, memcmp(&compressed[second_tile + 4], "jxlp", 4));
+
+  // The decoder composes the tiles into the image.
+  JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(ppf.frames[0].color.format);
+  PackedPixelFile decoded;
+  ASSERT_TRUE(DecodeImageJXL(compressed.data(), compressed.size(), dparams,
+                             /*decoded_bytes=*/nullptr, &decoded));
+  ASSERT_EQ(1, decoded.frames.size());
+  VerifySameImage(ppf.frames[0].color, ppf.info.bits_per_sample,
+                  decoded.frames[0].color, decoded.info.bits_per_sample,
+                  /*lossless=*/true);
+}
+
 TEST(CodecTest, FormatNegotiation) {
   const std::vector<JxlPixelFormat> accepted_formats = {
       {/*num_channels=*/4,
@@ -640,6 +971,69 @@ TEST(CodecTest, EncodeToPNG) {
                   decoded_ppf.info.bits_per_sample);
 }
 
+#if JPEGXL_ENABLE_APNG
+TEST(CodecTest, EncodeToPNGInParallel) {
+  ThreadPoolForTests pool(4);
+  const PaddedBytes original_png = jxl::test::ReadTestData(
+      "external/wesaturate/500px/tmshre_riaphotographs_srgb8.png");
+  PackedPixelFile ppf;
+  ASSERT_TRUE(extras::DecodeBytes(Span<const uint8_t>(original_png),
+                                  ColorHints(), &ppf));
+  const PackedImage& color = ppf.frames.front().color;
+
+  std::unique_ptr<Encoder> png_encoder = Encoder::FromExtension(".png");
+  ASSERT_THAT(png_encoder, NotNull());
+  png_encoder->SetOption("parallel_deflate", "1");
+  EncodedImage encoded_png;
+  ASSERT_TRUE(png_encoder->Encode(ppf, &encoded_png, &pool));
+  ASSERT_THAT(encoded_png.bitstreams, SizeIs(1));
+  PackedPixelFile decoded_ppf;
+  ASSERT_TRUE(
+      extras::DecodeBytes(Span<const uint8_t>(encoded_png.bitstreams.front()),
+                          ColorHints(), &decoded_ppf));
+  ASSERT_EQ(decoded_ppf.frames.size(), 1);
+  VerifySameImage(color, ppf.info.bits_per_sample, decoded_ppf.frames[0].color,
+                  decoded_ppf.info.bits_per_sample);
+
+  // Encodes the pixels while the decoder produces them.
+  JXLCompressParams cparams;
+  cparams.distance = 0;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 1);
+  std::vector<uint8_t> compressed;
+  ASSERT_TRUE(
+      EncodeImageJXL(cparams, ppf, /*jpeg_bytes=*/nullptr, &compressed));
+  JxlThreadParallelRunnerPtr runner =
+      JxlThreadParallelRunnerMake(/*memory_manager=*/nullptr, 4);
+  JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(color.format);
+  dparams.runner = JxlThreadParallelRunner;
+  dparams.runner_opaque = runner.get();
+  std::unique_ptr<ParallelPNGEncoder> streaming_encoder;
+  dparams.frame_pixel_callback =
+      [&](const PackedPixelFile& frame_ppf,
+          const JxlPixelFormat& format) -> JXLPixelCallback {
+    streaming_encoder =
+        jxl::make_unique<ParallelPNGEncoder>(frame_ppf.info, format);
+    return [&](size_t x, size_t y, size_t num_pixels, const void* pixels) {
+      streaming_encoder->SetPixels(x, y, num_pixels, pixels);
+    };
+  };
+  PackedPixelFile decoded_jxl;
+  ASSERT_TRUE(DecodeImageJXL(compressed.data(), compressed.size(), dparams,
+                             /*decoded_bytes=*/nullptr, &decoded_jxl));
+  ASSERT_THAT(streaming_encoder, NotNull());
+  std::vector<uint8_t> streamed_png;
+  ASSERT_TRUE(streaming_encoder->Finish(decoded_jxl, &streamed_png));
+  PackedPixelFile streamed_ppf;
+  ASSERT_TRUE(extras::DecodeBytes(Span<const uint8_t>(streamed_png),
+                                  ColorHints(), &streamed_ppf));
+  ASSERT_EQ(streamed_ppf.frames.size(), 1);
+  VerifySameImage(color, ppf.info.bits_per_sample,
+                  streamed_ppf.frames[0].color,
+                  streamed_ppf.info.bits_per_sample);
+}
+#endif
+
 }  // namespace
 }  // namespace extras
 }  // namespace jxl
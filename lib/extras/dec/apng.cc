@@ -561,7 +561,8 @@ int processing_finish(png_structp png_ptr, png_infop info_ptr,
 
 Status DecodeImageAPNG(const Span<const uint8_t> bytes,
                        const ColorHints& color_hints, PackedPixelFile* ppf,
-                       const SizeConstraints* constraints) {
+                       const SizeConstraints* constraints,
+                       const PackedFrameCallback& on_frame) {
   Reader r;
   unsigned int id, j, w, h, w0, h0, x0, y0;
   unsigned int delay_num, delay_den, dop, bop, rowbytes, imagesize;
@@ -587,8 +588,139 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
     uint32_t blend_op;
   };
 
+  // The frames that are not converted yet, unless `on_frame` is set.
   std::vector<FrameInfo> frames;
 
+  // Passes a converted frame to `on_frame`, or stores it in `ppf`.
+  const auto deliver = [&](PackedFrame&& pframe) -> Status {
+    if (on_frame) return on_frame(std::move(pframe));
+    ppf->frames.emplace_back(std::move(pframe));
+    return true;
+  };
+  // Whether a converted frame is the last one is only known at the end, so the
+  // last converted frame is held back.
+  std::vector<PackedFrame> pending;
+  const auto emit = [&](PackedFrame&& pframe) -> Status {
+    if (!pending.empty()) {
+      JXL_RETURN_IF_ERROR(deliver(std::move(pending.back())));
+      pending.clear();
+    }
+    pending.emplace_back(std::move(pframe));
+    return true;
+  };
+
+  bool has_nontrivial_background = false;
+  bool previous_frame_should_be_cleared = false;
+  // Position and size of the previous frame.
+  size_t px0 = 0;
+  size_t py0 = 0;
+  size_t pxs = 0;
+  size_t pys = 0;
+  enum {
+    DISPOSE_OP_NONE = 0,
+    DISPOSE_OP_BACKGROUND = 1,
+    DISPOSE_OP_PREVIOUS = 2,
+  };
+  enum {
+    BLEND_OP_SOURCE = 0,
+    BLEND_OP_OVER = 1,
+  };
+  // Converts the APNG frame to one or two frames with JPEG XL blending.
+  const auto add_frame = [&](FrameInfo&& frame) -> Status {
+    JXL_ASSERT(frame.data.xsize == frame.xsize);
+    JXL_ASSERT(frame.data.ysize == frame.ysize);
+
+    // Before encountering a DISPOSE_OP_NONE frame, the canvas is filled with 0,
+    // so DISPOSE_OP_BACKGROUND and DISPOSE_OP_PREVIOUS are equivalent.
+    if (frame.dispose_op == DISPOSE_OP_NONE) {
+      has_nontrivial_background = true;
+    }
+    bool should_blend = frame.blend_op == BLEND_OP_OVER;
+    bool use_for_next_frame =
+        has_nontrivial_background && frame.dispose_op != DISPOSE_OP_PREVIOUS;
+    size_t x0 = frame.x0;
+    size_t y0 = frame.y0;
+    size_t xsize = frame.data.xsize;
+    size_t ysize = frame.data.ysize;
+    PackedFrame pframe(std::move(frame.data));
+    if (previous_frame_should_be_cleared) {
+      if (px0 >= x0 && py0 >= y0 && px0 + pxs <= x0 + xsize &&
+          py0 + pys <= y0 + ysize && frame.blend_op == BLEND_OP_SOURCE &&
+          use_for_next_frame) {
+        // If the previous frame is entirely contained in the current frame and
+        // we are using BLEND_OP_SOURCE, nothing special needs to be done.
+      } else if (px0 == x0 && py0 == y0 && px0 + pxs == x0 + xsize &&
+                 py0 + pys == y0 + ysize && use_for_next_frame) {
+        // If the new frame has the same size as the old one, but we are
+        // blending, we can instead just not blend.
+        should_blend = false;
+      } else if (px0 <= x0 && py0 <= y0 && px0 + pxs >= x0 + xsize &&
+                 py0 + pys >= y0 + ysize && use_for_next_frame) {
+        // If the new frame is contained within the old frame, we can pad the
+        // new frame with zeros and not blend.
+        PackedImage new_data(pxs, pys, pframe.color.format);
+        memset(new_data.pixels(), 0, new_data.pixels_size);
+        for (size_t y = 0; y < ysize; y++) {
+          size_t bytes_per_pixel =
+              PackedImage::BitsPerChannel(new_data.format.data_type) *
+              new_data.format.num_channels / 8;
+          memcpy(static_cast<uint8_t*>(new_data.pixels()) +
+                     new_data.stride * (y + y0 - py0) +
+                     bytes_per_pixel * (x0 - px0),
+                 static_cast<const uint8_t*>(pframe.color.pixels()) +
+                     pframe.color.stride * y,
+                 xsize * bytes_per_pixel);
+        }
+
+        x0 = px0;
+        y0 = py0;
+        xsize = pxs;
+        ysize = pys;
+        should_blend = false;
+        pframe.color = std::move(new_data);
+      } else {
+        // If all else fails, insert a dummy blank frame with kReplace.
+        PackedFrame blank(pxs, pys, pframe.color.format);
+        memset(blank.color.pixels(), 0, blank.color.pixels_size);
+        blank.frame_info.layer_info.crop_x0 = px0;
+        blank.frame_info.layer_info.crop_y0 = py0;
+        blank.frame_info.layer_info.xsize = pxs;
+        blank.frame_info.layer_info.ysize = pys;
+        blank.frame_info.duration = 0;
+        bool is_full_size = px0 == 0 && py0 == 0 && pxs == ppf->info.xsize &&
+                            pys == ppf->info.ysize;
+        blank.frame_info.layer_info.have_crop = is_full_size ? 0 : 1;
+        blank.frame_info.layer_info.blend_info.blendmode = JXL_BLEND_REPLACE;
+        blank.frame_info.layer_info.blend_info.source = 1;
+        blank.frame_info.layer_info.save_as_reference = 1;
+        JXL_RETURN_IF_ERROR(emit(std::move(blank)));
+      }
+    }
+
+    pframe.frame_info.layer_info.crop_x0 = x0;
+    pframe.frame_info.layer_info.crop_y0 = y0;
+    pframe.frame_info.layer_info.xsize = xsize;
+    pframe.frame_info.layer_info.ysize = ysize;
+    pframe.frame_info.duration = frame.duration;
+    pframe.frame_info.layer_info.blend_info.blendmode =
+        should_blend ? JXL_BLEND_BLEND : JXL_BLEND_REPLACE;
+    bool is_full_size = x0 == 0 && y0 == 0 && xsize == ppf->info.xsize &&
+                        ysize == ppf->info.ysize;
+    pframe.frame_info.layer_info.have_crop = is_full_size ? 0 : 1;
+    pframe.frame_info.layer_info.blend_info.source = 1;
+    pframe.frame_info.layer_info.blend_info.alpha = 0;
+    pframe.frame_info.layer_info.save_as_reference = use_for_next_frame ? 1 : 0;
+
+    previous_frame_should_be_cleared =
+        has_nontrivial_background && frame.dispose_op == DISPOSE_OP_BACKGROUND;
+    px0 = frame.x0;
+    py0 = frame.y0;
+    pxs = frame.xsize;
+    pys = frame.ysize;
+    return emit(std::move(pframe));
+  };
+  bool color_hints_applied = false;
+
   // Make sure png memory is released in any case.
   auto scope_guard = MakeScopeGuard([&]() {
     png_destroy_read_struct(&png_ptr, &info_ptr, 0);
@@ -659,6 +791,17 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
                 memcpy(static_cast<uint8_t*>(frame.pixels()) + frame.stride * y,
                        frameRaw.rows[y], bytes_per_pixel * w0);
               }
+              if (on_frame) {
+                // The color chunks precede the first frame.
+                if (!color_hints_applied) {
+                  JXL_RETURN_IF_ERROR(ApplyColorHints(
+                      color_hints, have_color,
+                      ppf->info.num_color_channels == 1, ppf));
+                  color_hints_applied = true;
+                }
+                JXL_RETURN_IF_ERROR(add_frame(std::move(frames.back())));
+                frames.clear();
+              }
             } else {
               break;
             }
@@ -832,126 +975,20 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
       }
     }
 
-    JXL_RETURN_IF_ERROR(ApplyColorHints(
-        color_hints, have_color, ppf->info.num_color_channels == 1, ppf));
+    if (!color_hints_applied) {
+      JXL_RETURN_IF_ERROR(ApplyColorHints(
+          color_hints, have_color, ppf->info.num_color_channels == 1, ppf));
+    }
   }
 
   if (errorstate) return false;
 
-  bool has_nontrivial_background = false;
-  bool previous_frame_should_be_cleared = false;
-  enum {
-    DISPOSE_OP_NONE = 0,
-    DISPOSE_OP_BACKGROUND = 1,
-    DISPOSE_OP_PREVIOUS = 2,
-  };
-  enum {
-    BLEND_OP_SOURCE = 0,
-    BLEND_OP_OVER = 1,
-  };
-  for (size_t i = 0; i < frames.size(); i++) {
-    auto& frame = frames[i];
-    JXL_ASSERT(frame.data.xsize == frame.xsize);
-    JXL_ASSERT(frame.data.ysize == frame.ysize);
-
-    // Before encountering a DISPOSE_OP_NONE frame, the canvas is filled with 0,
-    // so DISPOSE_OP_BACKGROUND and DISPOSE_OP_PREVIOUS are equivalent.
-    if (frame.dispose_op == DISPOSE_OP_NONE) {
-      has_nontrivial_background = true;
-    }
-    bool should_blend = frame.blend_op == BLEND_OP_OVER;
-    bool use_for_next_frame =
-        has_nontrivial_background && frame.dispose_op != DISPOSE_OP_PREVIOUS;
-    size_t x0 = frame.x0;
-    size_t y0 = frame.y0;
-    size_t xsize = frame.data.xsize;
-    size_t ysize = frame.data.ysize;
-    if (previous_frame_should_be_cleared) {
-      size_t px0 = frames[i - 1].x0;
-      size_t py0 = frames[i - 1].y0;
-      size_t pxs = frames[i - 1].xsize;
-      size_t pys = frames[i - 1].ysize;
-      if (px0 >= x0 && py0 >= y0 && px0 + pxs <= x0 + xsize &&
-          py0 + pys <= y0 + ysize && frame.blend_op == BLEND_OP_SOURCE &&
-          use_for_next_frame) {
-        // If the previous frame is entirely contained in the current frame and
-        // we are using BLEND_OP_SOURCE, nothing special needs to be done.
-        ppf->frames.emplace_back(std::move(frame.data));
-      } else if (px0 == x0 && py0 == y0 && px0 + pxs == x0 + xsize &&
-                 py0 + pys == y0 + ysize && use_for_next_frame) {
-        // If the new frame has the same size as the old one, but we are
-        // blending, we can instead just not blend.
-        should_blend = false;
-        ppf->frames.emplace_back(std::move(frame.data));
-      } else if (px0 <= x0 && py0 <= y0 && px0 + pxs >= x0 + xsize &&
-                 py0 + pys >= y0 + ysize && use_for_next_frame) {
-        // If the new frame is contained within the old frame, we can pad the
-        // new frame with zeros and not blend.
-        PackedImage new_data(pxs, pys, frame.data.format);
-        memset(new_data.pixels(), 0, new_data.pixels_size);
-        for (size_t y = 0; y < ysize; y++) {
-          size_t bytes_per_pixel =
-              PackedImage::BitsPerChannel(new_data.format.data_type) *
-              new_data.format.num_channels / 8;
-          memcpy(static_cast<uint8_t*>(new_data.pixels()) +
-                     new_data.stride * (y + y0 - py0) +
-                     bytes_per_pixel * (x0 - px0),
-                 static_cast<const uint8_t*>(frame.data.pixels()) +
-                     frame.data.stride * y,
-                 xsize * bytes_per_pixel);
-        }
-
-        x0 = px0;
-        y0 = py0;
-        xsize = pxs;
-        ysize = pys;
-        should_blend = false;
-        ppf->frames.emplace_back(std::move(new_data));
-      } else {
-        // If all else fails, insert a dummy blank frame with kReplace.
-        PackedImage blank(pxs, pys, frame.data.format);
-        memset(blank.pixels(), 0, blank.pixels_size);
-        ppf->frames.emplace_back(std::move(blank));
-        auto& pframe = ppf->frames.back();
-        pframe.frame_info.layer_info.crop_x0 = px0;
-        pframe.frame_info.layer_info.crop_y0 = py0;
-        pframe.frame_info.layer_info.xsize = pxs;
-        pframe.frame_info.layer_info.ysize = pys;
-        pframe.frame_info.duration = 0;
-        bool is_full_size = px0 == 0 && py0 == 0 && pxs == ppf->info.xsize &&
-                            pys == ppf->info.ysize;
-        pframe.frame_info.layer_info.have_crop = is_full_size ? 0 : 1;
-        pframe.frame_info.layer_info.blend_info.blendmode = JXL_BLEND_REPLACE;
-        pframe.frame_info.layer_info.blend_info.source = 1;
-        pframe.frame_info.layer_info.save_as_reference = 1;
-        ppf->frames.emplace_back(std::move(frame.data));
-      }
-    } else {
-      ppf->frames.emplace_back(std::move(frame.data));
-    }
-
-    auto& pframe = ppf->frames.back();
-    pframe.frame_info.layer_info.crop_x0 = x0;
-    pframe.frame_info.layer_info.crop_y0 = y0;
-    pframe.frame_info.layer_info.xsize = xsize;
-    pframe.frame_info.layer_info.ysize = ysize;
-    pframe.frame_info.duration = frame.duration;
-    pframe.frame_info.layer_info.blend_info.blendmode =
-        should_blend ? JXL_BLEND_BLEND : JXL_BLEND_REPLACE;
-    bool is_full_size = x0 == 0 && y0 == 0 && xsize == ppf->info.xsize &&
-                        ysize == ppf->info.ysize;
-    pframe.frame_info.layer_info.have_crop = is_full_size ? 0 : 1;
-    pframe.frame_info.layer_info.blend_info.source = 1;
-    pframe.frame_info.layer_info.blend_info.alpha = 0;
-    pframe.frame_info.layer_info.save_as_reference = use_for_next_frame ? 1 : 0;
-
-    previous_frame_should_be_cleared =
-        has_nontrivial_background && frame.dispose_op == DISPOSE_OP_BACKGROUND;
+  for (FrameInfo& frame : frames) {
+    JXL_RETURN_IF_ERROR(add_frame(std::move(frame)));
   }
-  if (ppf->frames.empty()) return JXL_FAILURE("No frames decoded");
-  ppf->frames.back().frame_info.is_last = true;
-
-  return true;
+  if (pending.empty()) return JXL_FAILURE("No frames decoded");
+  pending.back().frame_info.is_last = true;
+  return deliver(std::move(pending.back()));
 }
 
 }  // namespace extras
@@ -24,9 +24,12 @@ struct SizeConstraints;
 namespace extras {
 
 // Decodes `bytes` into `ppf`.
+// Decodes `bytes` into `ppf`. If `on_frame` is set, the frames are passed to
+// it as soon as they are decoded instead of being stored in `ppf`.
 Status DecodeImageAPNG(Span<const uint8_t> bytes, const ColorHints& color_hints,
                        PackedPixelFile* ppf,
-                       const SizeConstraints* constraints = nullptr);
+                       const SizeConstraints* constraints = nullptr,
+                       const PackedFrameCallback& on_frame = nullptr);
 
 }  // namespace extras
 }  // namespace jxl
@@ -9,6 +9,7 @@
 #include <ImfIO.h>
 #include <ImfRgbaFile.h>
 #include <ImfStandardAttributes.h>
+#include <ImfThreading.h>
 
 #include <vector>
 
@@ -59,23 +60,72 @@ class InMemoryIStream : public OpenEXR::IStream {
   size_t pos_ = 0;
 };
 
+// Reads the pixels of the display window of `input` into `frame` through an
+// intermediate buffer.
+void ReadPixels(OpenEXR::RgbaInputFile& input, const PackedFrame& frame) {
+  const bool has_alpha = (input.channels() & OpenEXR::RgbaChannels::WRITE_A) ==
+                         OpenEXR::RgbaChannels::WRITE_A;
+  const int row_size = input.dataWindow().size().x + 1;
+  // Number of rows to read at a time.
+  // https://www.openexr.com/documentation/ReadingAndWritingImageFiles.pdf
+  // recommends reading the whole file at once.
+  const int y_chunk_size = input.displayWindow().size().y + 1;
+  std::vector<OpenEXR::Rgba> input_rows(row_size * y_chunk_size);
+  for (int start_y =
+           std::max(input.dataWindow().min.y, input.displayWindow().min.y);
+       start_y <=
+       std::min(input.dataWindow().max.y, input.displayWindow().max.y);
+       start_y += y_chunk_size) {
+    // Inclusive.
+    const int end_y = std::min(
+        start_y + y_chunk_size - 1,
+        std::min(input.dataWindow().max.y, input.displayWindow().max.y));
+    input.setFrameBuffer(
+        input_rows.data() - input.dataWindow().min.x - start_y * row_size,
+        /*xStride=*/1, /*yStride=*/row_size);
+    input.readPixels(start_y, end_y);
+    for (int exr_y = start_y; exr_y <= end_y; ++exr_y) {
+      const int image_y = exr_y - input.displayWindow().min.y;
+      const OpenEXR::Rgba* const JXL_RESTRICT input_row =
+          &input_rows[(exr_y - start_y) * row_size];
+      uint8_t* row = static_cast<uint8_t*>(frame.color.pixels()) +
+                     frame.color.stride * image_y;
+      const uint32_t pixel_size =
+          (3 + (has_alpha ? 1 : 0)) * kExrBitsPerSample / 8;
+      for (int exr_x =
+               std::max(input.dataWindow().min.x, input.displayWindow().min.x);
+           exr_x <=
+           std::min(input.dataWindow().max.x, input.displayWindow().max.x);
+           ++exr_x) {
+        const int image_x = exr_x - input.displayWindow().min.x;
+        memcpy(row + image_x * pixel_size,
+               input_row + (exr_x - input.dataWindow().min.x), pixel_size);
+      }
+    }
+  }
+}
+
 }  // namespace
 
 Status DecodeImageEXR(Span<const uint8_t> bytes, const ColorHints& color_hints,
-                      PackedPixelFile* ppf,
-                      const SizeConstraints* constraints) {
+                      PackedPixelFile* ppf, const SizeConstraints* constraints,
+                      const EXRDecompressParams* dparams) {
   InMemoryIStream is(bytes);
 
+  const int num_threads = dparams ? dparams->num_threads : 0;
+  if (OpenEXR::globalThreadCount() < num_threads) {
+    OpenEXR::setGlobalThreadCount(num_threads);
+  }
 #ifdef __EXCEPTIONS
   std::unique_ptr<OpenEXR::RgbaInputFile> input_ptr;
   try {
-    input_ptr.reset(new OpenEXR::RgbaInputFile(is));
+    input_ptr.reset(new OpenEXR::RgbaInputFile(is, num_threads));
   } catch (...) {
     return JXL_FAILURE("OpenEXR failed to parse input");
   }
   OpenEXR::RgbaInputFile& input = *input_ptr;
 #else
-  OpenEXR::RgbaInputFile input(is);
+  OpenEXR::RgbaInputFile input(is, num_threads);
 #endif
 
   if ((input.channels() & OpenEXR::RgbaChannels::WRITE_RGB) !=
@@ -111,43 +161,18 @@ Status DecodeImageEXR(Span<const uint8_t> bytes, const ColorHints& color_hints,
   ppf->frames.emplace_back(image_size.x, image_size.y, format);
   const auto& frame = ppf->frames.back();
 
-  const int row_size = input.dataWindow().size().x + 1;
-  // Number of rows to read at a time.
-  // https://www.openexr.com/documentation/ReadingAndWritingImageFiles.pdf
-  // recommends reading the whole file at once.
-  const int y_chunk_size = input.displayWindow().size().y + 1;
-  std::vector<OpenEXR::Rgba> input_rows(row_size * y_chunk_size);
-  for (int start_y =
-           std::max(input.dataWindow().min.y, input.displayWindow().min.y);
-       start_y <=
-       std::min(input.dataWindow().max.y, input.displayWindow().max.y);
-       start_y += y_chunk_size) {
-    // Inclusive.
-    const int end_y = std::min(
-        start_y + y_chunk_size - 1,
-        std::min(input.dataWindow().max.y, input.displayWindow().max.y));
-    input.setFrameBuffer(
-        input_rows.data() - input.dataWindow().min.x - start_y * row_size,
-        /*xStride=*/1, /*yStride=*/row_size);
-    input.readPixels(start_y, end_y);
-    for (int exr_y = start_y; exr_y <= end_y; ++exr_y) {
-      const int image_y = exr_y - input.displayWindow().min.y;
-      const OpenEXR::Rgba* const JXL_RESTRICT input_row =
-          &input_rows[(exr_y - start_y) * row_size];
-      uint8_t* row = static_cast<uint8_t*>(frame.color.pixels()) +
-                     frame.color.stride * image_y;
-      const uint32_t pixel_size =
-          (3 + (has_alpha ? 1 : 0)) * kExrBitsPerSample / 8;
-      for (int exr_x =
-               std::max(input.dataWindow().min.x, input.displayWindow().min.x);
-           exr_x <=
-           std::min(input.dataWindow().max.x, input.displayWindow().max.x);
-           ++exr_x) {
-        const int image_x = exr_x - input.displayWindow().min.x;
-        memcpy(row + image_x * pixel_size,
-               input_row + (exr_x - input.dataWindow().min.x), pixel_size);
-      }
-    }
+  // The RGBA frame buffer has the layout of OpenEXR::Rgba, so OpenEXR can
+  // write into it directly when it covers the whole data window.
+  if (has_alpha && input.dataWindow() == input.displayWindow() &&
+      frame.color.stride % sizeof(OpenEXR::Rgba) == 0) {
+    const Imath::Box2i& window = input.dataWindow();
+    const int row_size = frame.color.stride / sizeof(OpenEXR::Rgba);
+    input.setFrameBuffer(static_cast<OpenEXR::Rgba*>(frame.color.pixels()) -
+                             window.min.x - window.min.y * row_size,
+                         /*xStride=*/1, /*yStride=*/row_size);
+    input.readPixels(window.min.y, window.max.y);
+  } else {
+    ReadPixels(input, frame);
   }
 
   ppf->color_encoding.transfer_function = JXL_TRANSFER_FUNCTION_LINEAR;
@@ -21,10 +21,17 @@ struct SizeConstraints;
 
 namespace extras {
 
+struct EXRDecompressParams {
+  // Number of threads of the OpenEXR thread pool that decompress the scanline
+  // blocks or tiles in parallel. 0 decompresses on the calling thread.
+  int num_threads = 0;
+};
+
 // Decodes `bytes` into `ppf`. color_hints are ignored.
 Status DecodeImageEXR(Span<const uint8_t> bytes, const ColorHints& color_hints,
                       PackedPixelFile* ppf,
-                      const SizeConstraints* constraints = nullptr);
+                      const SizeConstraints* constraints = nullptr,
+                      const EXRDecompressParams* dparams = nullptr);
 
 }  // namespace extras
 }  // namespace jxl
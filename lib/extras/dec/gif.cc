@@ -54,97 +54,11 @@ void ensure_have_alpha(PackedFrame* frame) {
               frame->color.xsize * frame->color.ysize, 255u);
 }
 
-}  // namespace
-
-Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
-                      PackedPixelFile* ppf,
-                      const SizeConstraints* constraints) {
-  int error = GIF_OK;
-  ReadState state = {bytes};
-  const auto ReadFromSpan = [](GifFileType* const gif, GifByteType* const bytes,
-                               int n) {
-    ReadState* const state = reinterpret_cast<ReadState*>(gif->UserData);
-    // giflib API requires the input size `n` to be signed int.
-    if (static_cast<size_t>(n) > state->bytes.size()) {
-      n = state->bytes.size();
-    }
-    memcpy(bytes, state->bytes.data(), n);
-    state->bytes.remove_prefix(n);
-    return n;
-  };
-  GifUniquePtr gif(DGifOpen(&state, ReadFromSpan, &error));
-  if (gif == nullptr) {
-    if (error == D_GIF_ERR_NOT_GIF_FILE) {
-      // Not an error.
-      return false;
-    } else {
-      return JXL_FAILURE("Failed to read GIF: %s", GifErrorString(error));
-    }
-  }
-  error = DGifSlurp(gif.get());
-  if (error != GIF_OK) {
-    return JXL_FAILURE("Failed to read GIF: %s", GifErrorString(gif->Error));
-  }
-
-  msan::UnpoisonMemory(gif.get(), sizeof(*gif));
-  if (gif->SColorMap) {
-    msan::UnpoisonMemory(gif->SColorMap, sizeof(*gif->SColorMap));
-    msan::UnpoisonMemory(
-        gif->SColorMap->Colors,
-        sizeof(*gif->SColorMap->Colors) * gif->SColorMap->ColorCount);
-  }
-  msan::UnpoisonMemory(gif->SavedImages,
-                       sizeof(*gif->SavedImages) * gif->ImageCount);
-
-  JXL_RETURN_IF_ERROR(
-      VerifyDimensions<uint32_t>(constraints, gif->SWidth, gif->SHeight));
-  uint64_t total_pixel_count =
-      static_cast<uint64_t>(gif->SWidth) * gif->SHeight;
-  for (int i = 0; i < gif->ImageCount; ++i) {
-    const SavedImage& image = gif->SavedImages[i];
-    uint32_t w = image.ImageDesc.Width;
-    uint32_t h = image.ImageDesc.Height;
-    JXL_RETURN_IF_ERROR(VerifyDimensions<uint32_t>(constraints, w, h));
-    uint64_t pixel_count = static_cast<uint64_t>(w) * h;
-    if (total_pixel_count + pixel_count < total_pixel_count) {
-      return JXL_FAILURE("Image too big");
-    }
-    total_pixel_count += pixel_count;
-    if (constraints && (total_pixel_count > constraints->dec_max_pixels)) {
-      return JXL_FAILURE("Image too big");
-    }
-  }
-
-  if (!gif->SColorMap) {
-    for (int i = 0; i < gif->ImageCount; ++i) {
-      if (!gif->SavedImages[i].ImageDesc.ColorMap) {
-        return JXL_FAILURE("Missing GIF color map");
-      }
-    }
-  }
-
-  if (gif->ImageCount > 1) {
-    ppf->info.have_animation = true;
-    // Delays in GIF are specified in 100ths of a second.
-    ppf->info.animation.tps_numerator = 100;
-    ppf->info.animation.tps_denominator = 1;
-  }
-
-  ppf->frames.clear();
-  ppf->frames.reserve(gif->ImageCount);
-
-  ppf->info.xsize = gif->SWidth;
-  ppf->info.ysize = gif->SHeight;
-  ppf->info.bits_per_sample = 8;
-  ppf->info.exponent_bits_per_sample = 0;
-  // alpha_bits is later set to 8 if we find a frame with transparent pixels.
-  ppf->info.alpha_bits = 0;
-  ppf->info.alpha_exponent_bits = 0;
-  JXL_RETURN_IF_ERROR(ApplyColorHints(color_hints, /*color_already_set=*/false,
-                                      /*is_gray=*/false, ppf));
-
-  ppf->info.num_color_channels = 3;
-
+// Composites the frames of `gif` and passes each of them to `emit`, cropped
+// to the area that changed. Sets the alpha_bits of `ppf` to 8 if a frame has
+// transparent pixels.
+Status DecodeFrames(GifFileType* gif, PackedPixelFile* ppf,
+                    const PackedFrameCallback& emit) {
   // Pixel format for the 'canvas' onto which we paint
   // the (potentially individually cropped) GIF frames
   // of an animation.
@@ -218,9 +132,9 @@ Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
     }
 
     // Allocates the frame buffer.
-    ppf->frames.emplace_back(total_rect.xsize(), total_rect.ysize(),
-                             packed_frame_format);
-    PackedFrame* frame = &ppf->frames.back();
+    PackedFrame frame_storage(total_rect.xsize(), total_rect.ysize(),
+                              packed_frame_format);
+    PackedFrame* frame = &frame_storage;
 
     // We cannot tell right from the start whether there will be a
     // need for an alpha channel. This is discovered only as soon as
@@ -242,7 +156,7 @@ Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
     msan::UnpoisonMemory(color_map->Colors,
                          sizeof(*color_map->Colors) * color_map->ColorCount);
     GraphicsControlBlock gcb;
-    DGifSavedExtensionToGCB(gif.get(), i, &gcb);
+    DGifSavedExtensionToGCB(gif, i, &gcb);
     msan::UnpoisonMemory(&gcb, sizeof(gcb));
     bool is_full_size = total_rect.x0() == 0 && total_rect.y0() == 0 &&
                         total_rect.xsize() == canvas.color.xsize &&
@@ -378,6 +292,119 @@ Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
         std::fill_n(static_cast<PackedRgba*>(canvas.color.pixels()),
                     canvas.color.xsize * canvas.color.ysize, background_rgba);
     }
+    JXL_RETURN_IF_ERROR(emit(std::move(frame_storage)));
+  }
+  return true;
+}
+
+}  // namespace
+
+Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
+                      PackedPixelFile* ppf, const SizeConstraints* constraints,
+                      const PackedFrameCallback& on_frame) {
+  int error = GIF_OK;
+  ReadState state = {bytes};
+  const auto ReadFromSpan = [](GifFileType* const gif, GifByteType* const bytes,
+                               int n) {
+    ReadState* const state = reinterpret_cast<ReadState*>(gif->UserData);
+    // giflib API requires the input size `n` to be signed int.
+    if (static_cast<size_t>(n) > state->bytes.size()) {
+      n = state->bytes.size();
+    }
+    memcpy(bytes, state->bytes.data(), n);
+    state->bytes.remove_prefix(n);
+    return n;
+  };
+  GifUniquePtr gif(DGifOpen(&state, ReadFromSpan, &error));
+  if (gif == nullptr) {
+    if (error == D_GIF_ERR_NOT_GIF_FILE) {
+      // Not an error.
+      return false;
+    } else {
+      return JXL_FAILURE("Failed to read GIF: %s", GifErrorString(error));
+    }
+  }
+  error = DGifSlurp(gif.get());
+  if (error != GIF_OK) {
+    return JXL_FAILURE("Failed to read GIF: %s", GifErrorString(gif->Error));
+  }
+
+  msan::UnpoisonMemory(gif.get(), sizeof(*gif));
+  if (gif->SColorMap) {
+    msan::UnpoisonMemory(gif->SColorMap, sizeof(*gif->SColorMap));
+    msan::UnpoisonMemory(
+        gif->SColorMap->Colors,
+        sizeof(*gif->SColorMap->Colors) * gif->SColorMap->ColorCount);
+  }
+  msan::UnpoisonMemory(gif->SavedImages,
+                       sizeof(*gif->SavedImages) * gif->ImageCount);
+
+  JXL_RETURN_IF_ERROR(
+      VerifyDimensions<uint32_t>(constraints, gif->SWidth, gif->SHeight));
+  uint64_t total_pixel_count =
+      static_cast<uint64_t>(gif->SWidth) * gif->SHeight;
+  for (int i = 0; i < gif->ImageCount; ++i) {
+    const SavedImage& image = gif->SavedImages[i];
+    uint32_t w = image.ImageDesc.Width;
+    uint32_t h = image.ImageDesc.Height;
+    JXL_RETURN_IF_ERROR(VerifyDimensions<uint32_t>(constraints, w, h));
+    uint64_t pixel_count = static_cast<uint64_t>(w) * h;
+    if (total_pixel_count + pixel_count < total_pixel_count) {
+      return JXL_FAILURE("Image too big");
+    }
+    total_pixel_count += pixel_count;
+    if (constraints && (total_pixel_count > constraints->dec_max_pixels)) {
+      return JXL_FAILURE("Image too big");
+    }
+  }
+
+  if (!gif->SColorMap) {
+    for (int i = 0; i < gif->ImageCount; ++i) {
+      if (!gif->SavedImages[i].ImageDesc.ColorMap) {
+        return JXL_FAILURE("Missing GIF color map");
+      }
+    }
+  }
+
+  if (gif->ImageCount > 1) {
+    ppf->info.have_animation = true;
+    // Delays in GIF are specified in 100ths of a second.
+    ppf->info.animation.tps_numerator = 100;
+    ppf->info.animation.tps_denominator = 1;
+  }
+
+  ppf->info.xsize = gif->SWidth;
+  ppf->info.ysize = gif->SHeight;
+  ppf->info.bits_per_sample = 8;
+  ppf->info.exponent_bits_per_sample = 0;
+  // alpha_bits is later set to 8 if we find a frame with transparent pixels.
+  ppf->info.alpha_bits = 0;
+  ppf->info.alpha_exponent_bits = 0;
+  JXL_RETURN_IF_ERROR(ApplyColorHints(color_hints, /*color_already_set=*/false,
+                                      /*is_gray=*/false, ppf));
+
+  ppf->info.num_color_channels = 3;
+
+  if (!on_frame) {
+    ppf->frames.clear();
+    ppf->frames.reserve(gif->ImageCount);
+    JXL_RETURN_IF_ERROR(
+        DecodeFrames(gif.get(), ppf, [&](PackedFrame&& frame) -> Status {
+          ppf->frames.emplace_back(std::move(frame));
+          return true;
+        }));
+  } else {
+    // Whether the frames need an alpha channel is only known once they are
+    // all decoded, so they are first decoded without being kept.
+    const auto discard = [](PackedFrame&& /*frame*/) -> Status {
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(DecodeFrames(gif.get(), ppf, discard));
+    const bool seen_alpha = ppf->info.alpha_bits != 0;
+    return DecodeFrames(gif.get(), ppf, [&](PackedFrame&& frame) -> Status {
+      if (seen_alpha) ensure_have_alpha(&frame);
+      return on_frame(std::move(frame));
+    });
   }
   // Finally, if any frame has an alpha-channel, every frame will need
   // to have an alpha-channel.
@@ -23,9 +23,13 @@ struct SizeConstraints;
 namespace extras {
 
 // Decodes `bytes` into `ppf`. color_hints are ignored.
+// Decodes `bytes` into `ppf`. If `on_frame` is set, the frames are passed to
+// it one at a time instead of being stored in `ppf`; the frames are then
+// composited twice, since whether they need alpha is only known at the end.
 Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
                       PackedPixelFile* ppf,
-                      const SizeConstraints* constraints = nullptr);
+                      const SizeConstraints* constraints = nullptr,
+                      const PackedFrameCallback& on_frame = nullptr);
 
 }  // namespace extras
 }  // namespace jxl
@@ -7,6 +7,7 @@
 
 #include <setjmp.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <algorithm>
 #include <numeric>
@@ -15,6 +16,7 @@
 
 #include "lib/jpegli/decode.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/common.h"
 #include "lib/jxl/sanitizers.h"
 
 namespace jxl {
@@ -251,5 +253,112 @@ Status DecodeJpeg(const std::vector<uint8_t>& compressed,
   return success;
 }
 
+Status JPEGDataFromJpegli(jpeg_decompress_struct* cinfo,
+                          jvirt_barray_ptr* coef_arrays,
+                          jpeg::JPEGData* jpeg_data) {
+  static_assert(sizeof(JCOEF) == sizeof(jpeg::coeff_t), "JCOEF size mismatch");
+  if (cinfo->data_precision != BITS_IN_JSAMPLE) {
+    return JXL_FAILURE("Only 8 bit JPEGs can be recompressed");
+  }
+  if (cinfo->num_components > jpeg::kMaxComponents) {
+    return JXL_FAILURE("Too many components");
+  }
+  jpeg_data->width = cinfo->image_width;
+  jpeg_data->height = cinfo->image_height;
+  jpeg_data->restart_interval = cinfo->restart_interval;
+
+  // jpegli keeps the saved markers in reverse order.
+  std::vector<jpeg_saved_marker_ptr> markers;
+  for (jpeg_saved_marker_ptr marker = cinfo->marker_list; marker != nullptr;
+       marker = marker->next) {
+    markers.push_back(marker);
+  }
+  std::reverse(markers.begin(), markers.end());
+  for (jpeg_saved_marker_ptr marker : markers) {
+    msan::UnpoisonMemory(marker, sizeof(*marker));
+    msan::UnpoisonMemory(marker->data, marker->data_length);
+    if (marker->data_length != marker->original_length) {
+      return JXL_FAILURE("Truncated saved marker");
+    }
+    // Like the JPEG reader, keep the marker type and length with the payload.
+    const size_t marker_len = marker->data_length + 2;
+    std::vector<uint8_t> data = {static_cast<uint8_t>(marker->marker),
+                                 static_cast<uint8_t>(marker_len >> 8),
+                                 static_cast<uint8_t>(marker_len & 0xFF)};
+    data.insert(data.end(), marker->data, marker->data + marker->data_length);
+    if (marker->marker == JPEG_COM) {
+      jpeg_data->com_data.push_back(std::move(data));
+    } else {
+      jpeg_data->app_data.push_back(std::move(data));
+    }
+    jpeg_data->marker_order.push_back(marker->marker);
+  }
+  const auto& order = jpeg_data->marker_order;
+  const auto saved = [&](int marker) {
+    return std::find(order.begin(), order.end(), marker) != order.end();
+  };
+  if ((cinfo->saw_JFIF_marker && !saved(JPEG_APP0)) ||
+      (cinfo->saw_Adobe_marker && !saved(JPEG_APP0 + 14))) {
+    return JXL_FAILURE("The JFIF and Adobe markers have to be saved");
+  }
+
+  const size_t MCU_rows =
+      DivCeil(cinfo->image_height, cinfo->max_v_samp_factor * DCTSIZE);
+  const size_t MCU_cols =
+      DivCeil(cinfo->image_width, cinfo->max_h_samp_factor * DCTSIZE);
+  jpeg_data->components.resize(cinfo->num_components);
+  for (int c = 0; c < cinfo->num_components; ++c) {
+    jpeg_component_info* comp = &cinfo->comp_info[c];
+    const JQUANT_TBL* table = comp->quant_table != nullptr
+                                  ? comp->quant_table
+                                  : cinfo->quant_tbl_ptrs[comp->quant_tbl_no];
+    if (table == nullptr) {
+      return JXL_FAILURE("Missing quantization table");
+    }
+    jpeg::JPEGQuantTable quant;
+    quant.index = comp->quant_tbl_no;
+    for (size_t k = 0; k < DCTSIZE2; ++k) {
+      quant.values[k] = table->quantval[k];
+      if (quant.values[k] > 255) quant.precision = 1;
+    }
+    size_t quant_idx = 0;
+    while (quant_idx < jpeg_data->quant.size() &&
+           (jpeg_data->quant[quant_idx].index != quant.index ||
+            jpeg_data->quant[quant_idx].values != quant.values)) {
+      ++quant_idx;
+    }
+    if (quant_idx == jpeg_data->quant.size()) jpeg_data->quant.push_back(quant);
+
+    jpeg::JPEGComponent& component = jpeg_data->components[c];
+    component.id = comp->component_id;
+    component.h_samp_factor = comp->h_samp_factor;
+    component.v_samp_factor = comp->v_samp_factor;
+    component.quant_idx = quant_idx;
+    // The JPEG reader keeps the blocks of incomplete MCUs, which jpegli drops.
+    // Like libjpeg does when encoding, they get the DC of their left or top
+    // neighbour and no AC.
+    component.width_in_blocks = MCU_cols * comp->h_samp_factor;
+    component.height_in_blocks = MCU_rows * comp->v_samp_factor;
+    const size_t stride = component.width_in_blocks * DCTSIZE2;
+    component.coeffs.assign(stride * component.height_in_blocks, 0);
+    for (size_t by = 0; by < component.height_in_blocks; ++by) {
+      jpeg::coeff_t* row = &component.coeffs[by * stride];
+      size_t bx = 0;
+      if (by < comp->height_in_blocks) {
+        JBLOCKARRAY ba = (*cinfo->mem->access_virt_barray)(
+            reinterpret_cast<j_common_ptr>(cinfo), coef_arrays[c], by, 1,
+            FALSE);
+        memcpy(row, ba[0], comp->width_in_blocks * sizeof(JBLOCK));
+        bx = comp->width_in_blocks;
+      }
+      for (; bx < component.width_in_blocks; ++bx) {
+        row[bx * DCTSIZE2] =
+            bx > 0 ? row[(bx - 1) * DCTSIZE2] : row[bx * DCTSIZE2 - stride];
+      }
+    }
+  }
+  return true;
+}
+
 }  // namespace extras
 }  // namespace jxl
@@ -14,8 +14,10 @@
 #include <vector>
 
 #include "lib/extras/packed_image.h"
+#include "lib/jpegli/decode.h"
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/jpeg/jpeg_data.h"
 
 namespace jxl {
 namespace extras {
@@ -33,6 +35,19 @@ Status DecodeJpeg(const std::vector<uint8_t>& compressed,
                   const JpegDecompressParams& dparams, ThreadPool* pool,
                   PackedPixelFile* ppf);
 
+// Fills jpeg_data with the coefficients, quantization tables, components and
+// saved markers of a JPEG whose `coef_arrays` were read with
+// jpegli_read_coefficients(), so that a JPEG that is already decoded with
+// jpegli can be recompressed without parsing it again, e.g. with
+// jpeg::SetImageFromJpegData(). The APP and COM markers to keep, including the
+// JFIF and Adobe markers if present, must have been saved with
+// jpegli_save_markers() before jpegli_read_header(). jpegli does not keep the
+// Huffman codes, scan script and padding bits of the input, so jpeg_data can
+// not be used to reconstruct the original JPEG bytes.
+Status JPEGDataFromJpegli(jpeg_decompress_struct* cinfo,
+                          jvirt_barray_ptr* coef_arrays,
+                          jpeg::JPEGData* jpeg_data);
+
 }  // namespace extras
 }  // namespace jxl
 
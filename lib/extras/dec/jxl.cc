@@ -9,6 +9,11 @@
 #include <jxl/decode_cxx.h>
 #include <jxl/types.h>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "lib/extras/batch.h"
 #include "lib/extras/dec/color_description.h"
 #include "lib/extras/enc/encode.h"
 #include "lib/jxl/base/printf_macros.h"
@@ -103,13 +108,50 @@ void UpdateBitDepth(JxlBitDepth bit_depth, JxlDataType data_type, T* info) {
   }
 }
 
+// Returns the size of the pixels of one frame of the image in `compressed` at
+// the bit depth of its header, or 0 if the header can't be decoded. `dec` must
+// be reset afterwards.
+size_t FramePixelBytes(JxlDecoder* dec,
+                       const std::vector<uint8_t>& compressed) {
+  JxlBasicInfo info;
+  if (JXL_DEC_SUCCESS != JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO) ||
+      JXL_DEC_SUCCESS !=
+          JxlDecoderSetInput(dec, compressed.data(), compressed.size())) {
+    return 0;
+  }
+  JxlDecoderCloseInput(dec);
+  if (JXL_DEC_BASIC_INFO != JxlDecoderProcessInput(dec) ||
+      JXL_DEC_SUCCESS != JxlDecoderGetBasicInfo(dec, &info)) {
+    return 0;
+  }
+  const size_t bytes_per_sample = info.bits_per_sample <= 8    ? 1
+                                  : info.bits_per_sample <= 16 ? 2
+                                                               : 4;
+  return static_cast<size_t>(info.xsize) * info.ysize *
+         (info.num_color_channels + info.num_extra_channels) *
+         bytes_per_sample;
+}
+
+// The opaque pointer of the image out callback.
+struct ImageOut {
+  PackedPixelFile* ppf;
+  // The callback of dparams.frame_pixel_callback for the current frame.
+  JXLPixelCallback callback;
+};
+
 }  // namespace
 
 bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
                     const JXLDecompressParams& dparams, size_t* decoded_bytes,
                     PackedPixelFile* ppf, std::vector<uint8_t>* jpeg_bytes) {
-  auto decoder = JxlDecoderMake(/*memory_manager=*/nullptr);
-  JxlDecoder* dec = decoder.get();
+  auto decoder = JxlDecoderMake(dparams.memory_manager);
+  return DecodeImageJXL(decoder.get(), bytes, bytes_size, dparams,
+                        decoded_bytes, ppf, jpeg_bytes);
+}
+
+bool DecodeImageJXL(JxlDecoder* dec, const uint8_t* bytes, size_t bytes_size,
+                    const JXLDecompressParams& dparams, size_t* decoded_bytes,
+                    PackedPixelFile* ppf, std::vector<uint8_t>* jpeg_bytes) {
   ppf->frames.clear();
 
   if (dparams.runner_opaque != nullptr &&
@@ -120,6 +162,7 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
   }
 
   JxlPixelFormat format;
+  ImageOut image_out = {ppf, nullptr};
   std::vector<JxlPixelFormat> accepted_formats = dparams.accepted_formats;
   if (accepted_formats.empty()) {
     for (const uint32_t num_channels : {1, 2, 3, 4}) {
@@ -174,6 +217,16 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
       fprintf(stderr, "JxlDecoderSetRenderSpotColors failed\n");
       return false;
     }
+    if (dparams.fast_idct &&
+        JXL_DEC_SUCCESS != JxlDecoderSetFastIDCT(dec, JXL_TRUE)) {
+      fprintf(stderr, "JxlDecoderSetFastIDCT failed\n");
+      return false;
+    }
+    if (dparams.render_stats &&
+        JXL_DEC_SUCCESS != JxlDecoderSetCollectRenderStats(dec, JXL_TRUE)) {
+      fprintf(stderr, "JxlDecoderSetCollectRenderStats failed\n");
+      return false;
+    }
     if (JXL_DEC_SUCCESS !=
         JxlDecoderSetKeepOrientation(dec, dparams.keep_orientation)) {
       fprintf(stderr, "JxlDecoderSetKeepOrientation failed\n");
@@ -446,15 +499,16 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
       if (dparams.use_image_callback) {
         auto callback = [](void* opaque, size_t x, size_t y, size_t num_pixels,
                            const void* pixels) {
-          auto* ppf = reinterpret_cast<jxl::extras::PackedPixelFile*>(opaque);
-          jxl::extras::PackedImage& color = ppf->frames.back().color;
+          auto* out = reinterpret_cast<ImageOut*>(opaque);
+          jxl::extras::PackedImage& color = out->ppf->frames.back().color;
           uint8_t* pixels_buffer = reinterpret_cast<uint8_t*>(color.pixels());
           size_t sample_size = color.pixel_stride();
           memcpy(pixels_buffer + (color.stride * y + sample_size * x), pixels,
                  num_pixels * sample_size);
+          if (out->callback) out->callback(x, y, num_pixels, pixels);
         };
         if (JXL_DEC_SUCCESS !=
-            JxlDecoderSetImageOutCallback(dec, &format, callback, ppf)) {
+            JxlDecoderSetImageOutCallback(dec, &format, callback, &image_out)) {
           fprintf(stderr, "JxlDecoderSetImageOutCallback failed\n");
           return false;
         }
@@ -478,6 +532,9 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
         ppf->info.alpha_bits = ppf->info.bits_per_sample;
         ppf->info.alpha_exponent_bits = ppf->info.exponent_bits_per_sample;
       }
+      if (dparams.use_image_callback && dparams.frame_pixel_callback) {
+        image_out.callback = dparams.frame_pixel_callback(*ppf, format);
+      }
       JxlPixelFormat ec_format = format;
       ec_format.num_channels = 1;
       for (auto& eci : ppf->extra_channels_info) {
@@ -551,11 +608,69 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
     jpeg_bytes->insert(jpeg_bytes->end(), jpeg_data_chunk.data(),
                        jpeg_data_chunk.data() + used_jpeg_output);
   }
+  if (dparams.render_stats) {
+    dparams.render_stats->resize(JxlDecoderNumRenderStages(dec));
+    for (size_t i = 0; i < dparams.render_stats->size(); i++) {
+      JxlDecoderGetRenderStageStats(dec, i, &(*dparams.render_stats)[i]);
+    }
+  }
   if (decoded_bytes) {
     *decoded_bytes = bytes_size - JxlDecoderReleaseInput(dec);
   }
   return true;
 }
 
+size_t DecodeBatchJXL(const JXLDecompressParams& dparams, size_t num_files,
+                      size_t num_workers, size_t max_pixel_bytes,
+                      const JXLBatchReadFunc& read,
+                      const JXLBatchWriteFunc& write) {
+  num_workers = std::max<size_t>(1, std::min(num_workers, num_files));
+  SerializedRunner shared_runner;
+  shared_runner.runner = dparams.runner;
+  shared_runner.runner_opaque = dparams.runner_opaque;
+  JXLDecompressParams worker_dparams = dparams;
+  if (dparams.runner_opaque != nullptr) {
+    worker_dparams.runner = &SerializedRunner::Run;
+    worker_dparams.runner_opaque = &shared_runner;
+  }
+  ByteBudget budget(max_pixel_bytes);
+  std::atomic<size_t> next_file{0};
+  std::atomic<size_t> num_failures{0};
+
+  const auto work = [&]() {
+    auto decoder = JxlDecoderMake(dparams.memory_manager);
+    std::vector<uint8_t> compressed;
+    PackedPixelFile ppf;
+    for (;;) {
+      const size_t i = next_file.fetch_add(1);
+      if (i >= num_files) break;
+      compressed.clear();
+      if (!read(i, &compressed)) {
+        num_failures++;
+        continue;
+      }
+      const size_t size = FramePixelBytes(decoder.get(), compressed);
+      JxlDecoderResetKeepBuffers(decoder.get());
+      budget.Acquire(size);
+      bool ok = DecodeImageJXL(decoder.get(), compressed.data(),
+                               compressed.size(), worker_dparams,
+                               /*decoded_bytes=*/nullptr, &ppf);
+      JxlDecoderResetKeepBuffers(decoder.get());
+      // The input is not needed anymore, release its memory before writing.
+      std::vector<uint8_t>().swap(compressed);
+      ok = ok && write(i, ppf);
+      ppf = PackedPixelFile();
+      budget.Release(size);
+      if (!ok) num_failures++;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_workers; i++) threads.emplace_back(work);
+  work();
+  for (std::thread& thread : threads) thread.join();
+  return num_failures.load();
+}
+
 }  // namespace extras
 }  // namespace jxl
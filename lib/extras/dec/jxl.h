@@ -8,10 +8,13 @@
 
 // Decodes JPEG XL images in memory.
 
+#include <jxl/decode.h>
+#include <jxl/memory_manager.h>
 #include <jxl/parallel_runner.h>
 #include <jxl/types.h>
 #include <stdint.h>
 
+#include <functional>
 #include <limits>
 #include <string>
 #include <vector>
@@ -21,6 +24,12 @@
 namespace jxl {
 namespace extras {
 
+// Receives pixels of the color image of a frame as they are decoded, like a
+// JxlImageOutCallback, possibly from several threads at once.
+using JXLPixelCallback = std::function<void(size_t x, size_t y,
+                                            size_t num_pixels,
+                                            const void* pixels)>;
+
 struct JXLDecompressParams {
   // If empty, little endian float formats will be accepted.
   std::vector<JxlPixelFormat> accepted_formats;
@@ -33,11 +42,16 @@ struct JXLDecompressParams {
   bool render_spotcolors = true;
   // Whether to keep or undo the orientation given in the header.
   bool keep_orientation = false;
+  // Whether to use the faster fixed-point IDCT, see JxlDecoderSetFastIDCT.
+  bool fast_idct = false;
 
   // If runner_opaque is set, the decoder uses this parallel runner.
   JxlParallelRunner runner;
   void* runner_opaque = nullptr;
 
+  // If set, the decoder allocates its memory with this memory manager.
+  const JxlMemoryManager* memory_manager = nullptr;
+
   // Whether truncated input should be treated as an error.
   bool allow_partial_input = false;
 
@@ -51,11 +65,22 @@ struct JXLDecompressParams {
 
   // Whether to use the image callback or the image buffer to get the output.
   bool use_image_callback = true;
+  // If set with use_image_callback, called for each frame before its pixels
+  // are decoded, with the basic info updated to the output bit depth and the
+  // pixel format of the color image. The pixels are also given to the returned
+  // callback if it is not empty, for example to encode them while the rest of
+  // the frame is decoded.
+  std::function<JXLPixelCallback(const PackedPixelFile& ppf,
+                                 const JxlPixelFormat& format)>
+      frame_pixel_callback;
   // Whether to unpremultiply colors for associated alpha channels.
   bool unpremultiply_alpha = false;
 
   // Controls the effective bit depth of the output pixels.
   JxlBitDepth output_bitdepth = {JXL_BIT_DEPTH_FROM_PIXEL_FORMAT, 0, 0};
+
+  // If set, the render pipeline counters of each stage are stored here.
+  std::vector<JxlRenderStageStats>* render_stats = nullptr;
 };
 
 bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
@@ -63,6 +88,35 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
                     PackedPixelFile* ppf,
                     std::vector<uint8_t>* jpeg_bytes = nullptr);
 
+// Same as above, but decodes with `dec`, which must be freshly created or
+// reset, for example with JxlDecoderResetKeepBuffers to reuse its buffers
+// across a batch of images. dparams.memory_manager is not used.
+bool DecodeImageJXL(JxlDecoder* dec, const uint8_t* bytes, size_t bytes_size,
+                    const JXLDecompressParams& dparams, size_t* decoded_bytes,
+                    PackedPixelFile* ppf,
+                    std::vector<uint8_t>* jpeg_bytes = nullptr);
+
+// Reads the JPEG XL file with the given index, returns false on failure.
+using JXLBatchReadFunc =
+    std::function<bool(size_t index, std::vector<uint8_t>* compressed)>;
+// Writes the image decoded from the file with the given index, returns false
+// on failure.
+using JXLBatchWriteFunc =
+    std::function<bool(size_t index, const PackedPixelFile& ppf)>;
+
+// Decodes `num_files` JPEG XL files with the settings of `dparams`. Up to
+// `num_workers` files are read, decoded and written at the same time; each
+// worker reuses its decoder for all of its files, and all decoders share the
+// parallel runner of `dparams`. A file is not decoded while the images being
+// decoded or written add up to more than `max_pixel_bytes`, unless it is the
+// only one, where the size of an image is estimated from the size and bit
+// depth of its first frame. `read` and `write` are called concurrently from
+// several threads. Returns the number of files that failed.
+size_t DecodeBatchJXL(const JXLDecompressParams& dparams, size_t num_files,
+                      size_t num_workers, size_t max_pixel_bytes,
+                      const JXLBatchReadFunc& read,
+                      const JXLBatchWriteFunc& write);
+
 }  // namespace extras
 }  // namespace jxl
 
@@ -9,12 +9,22 @@
 #include <string.h>
 
 #include <cmath>
+#include <string>
 
 #include "lib/extras/size_constraints.h"
 #include "lib/jxl/base/bits.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/file_io.h"
+#include "lib/jxl/base/os_macros.h"
 #include "lib/jxl/base/status.h"
 
+#if !JXL_OS_WIN
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace jxl {
 namespace extras {
 namespace {
@@ -324,19 +334,20 @@ Span<const uint8_t> MakeSpan(const char* str) {
                              strlen(str));
 }
 
-}  // namespace
-
-Status DecodeImagePNM(const Span<const uint8_t> bytes,
-                      const ColorHints& color_hints, PackedPixelFile* ppf,
-                      const SizeConstraints* constraints) {
+// Parses the header of `bytes` into `header` and the image info, color
+// encoding and extra channel info of `ppf`, and sets `format` to the layout of
+// the interleaved color and alpha samples and `pos` to the first pixel.
+Status ParsePNM(const Span<const uint8_t> bytes, const ColorHints& color_hints,
+                const SizeConstraints* constraints, HeaderPNM* header,
+                PackedPixelFile* ppf, JxlPixelFormat* format,
+                const uint8_t** pos) {
   Parser parser(bytes);
-  HeaderPNM header = {};
-  const uint8_t* pos = nullptr;
-  if (!parser.ParseHeader(&header, &pos)) return false;
+  *header = {};
+  if (!parser.ParseHeader(header, pos)) return false;
   JXL_RETURN_IF_ERROR(
-      VerifyDimensions(constraints, header.xsize, header.ysize));
+      VerifyDimensions(constraints, header->xsize, header->ysize));
 
-  if (header.bits_per_sample == 0 || header.bits_per_sample > 32) {
+  if (header->bits_per_sample == 0 || header->bits_per_sample > 32) {
     return JXL_FAILURE("PNM: bits_per_sample invalid");
   }
 
@@ -344,30 +355,30 @@ Status DecodeImagePNM(const Span<const uint8_t> bytes,
   // with gamma number of 2.2). Deviate from the specification and assume
   // `sRGB` in our implementation.
   JXL_RETURN_IF_ERROR(ApplyColorHints(color_hints, /*color_already_set=*/false,
-                                      header.is_gray, ppf));
+                                      header->is_gray, ppf));
 
-  ppf->info.xsize = header.xsize;
-  ppf->info.ysize = header.ysize;
-  if (header.floating_point) {
+  ppf->info.xsize = header->xsize;
+  ppf->info.ysize = header->ysize;
+  if (header->floating_point) {
     ppf->info.bits_per_sample = 32;
     ppf->info.exponent_bits_per_sample = 8;
   } else {
-    ppf->info.bits_per_sample = header.bits_per_sample;
+    ppf->info.bits_per_sample = header->bits_per_sample;
     ppf->info.exponent_bits_per_sample = 0;
   }
 
   ppf->info.orientation = JXL_ORIENT_IDENTITY;
 
   // No alpha in PNM and PFM
-  ppf->info.alpha_bits = (header.has_alpha ? ppf->info.bits_per_sample : 0);
+  ppf->info.alpha_bits = (header->has_alpha ? ppf->info.bits_per_sample : 0);
   ppf->info.alpha_exponent_bits = 0;
-  ppf->info.num_color_channels = (header.is_gray ? 1 : 3);
-  uint32_t num_alpha_channels = (header.has_alpha ? 1 : 0);
+  ppf->info.num_color_channels = (header->is_gray ? 1 : 3);
+  uint32_t num_alpha_channels = (header->has_alpha ? 1 : 0);
   uint32_t num_interleaved_channels =
       ppf->info.num_color_channels + num_alpha_channels;
-  ppf->info.num_extra_channels = num_alpha_channels + header.ec_types.size();
+  ppf->info.num_extra_channels = num_alpha_channels + header->ec_types.size();
 
-  for (auto type : header.ec_types) {
+  for (auto type : header->ec_types) {
     PackedExtraChannel pec;
     pec.ec_info.bits_per_sample = ppf->info.bits_per_sample;
     pec.ec_info.type = type;
@@ -375,23 +386,39 @@ Status DecodeImagePNM(const Span<const uint8_t> bytes,
   }
 
   JxlDataType data_type;
-  if (header.floating_point) {
+  if (header->floating_point) {
     // There's no float16 pnm version.
     data_type = JXL_TYPE_FLOAT;
   } else {
-    if (header.bits_per_sample > 8) {
+    if (header->bits_per_sample > 8) {
       data_type = JXL_TYPE_UINT16;
     } else {
       data_type = JXL_TYPE_UINT8;
     }
   }
 
-  const JxlPixelFormat format{
+  *format = {
       /*num_channels=*/num_interleaved_channels,
       /*data_type=*/data_type,
-      /*endianness=*/header.big_endian ? JXL_BIG_ENDIAN : JXL_LITTLE_ENDIAN,
+      /*endianness=*/header->big_endian ? JXL_BIG_ENDIAN : JXL_LITTLE_ENDIAN,
       /*align=*/0,
   };
+  return true;
+}
+
+}  // namespace
+
+Status DecodeImagePNM(const Span<const uint8_t> bytes,
+                      const ColorHints& color_hints, PackedPixelFile* ppf,
+                      const SizeConstraints* constraints) {
+  HeaderPNM header;
+  JxlPixelFormat format;
+  const uint8_t* pos = nullptr;
+  if (!ParsePNM(bytes, color_hints, constraints, &header, ppf, &format,
+                &pos)) {
+    return false;
+  }
+  const JxlDataType data_type = format.data_type;
   const JxlPixelFormat ec_format{1, format.data_type, format.endianness, 0};
   ppf->frames.clear();
   ppf->frames.emplace_back(header.xsize, header.ysize, format);
@@ -435,6 +462,143 @@ Status DecodeImagePNM(const Span<const uint8_t> bytes,
   return true;
 }
 
+ChunkedPNMDecoder::~ChunkedPNMDecoder() {
+#if !JXL_OS_WIN
+  if (mapped_) munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+}
+
+Status ChunkedPNMDecoder::Init(const char* path, const ColorHints& color_hints,
+                               PackedPixelFile* ppf,
+                               const SizeConstraints* constraints) {
+  JXL_ASSERT(data_ == nullptr);
+#if JXL_OS_WIN
+  JXL_RETURN_IF_ERROR(ReadFile(std::string(path), &read_bytes_));
+  data_ = read_bytes_.data();
+  size_ = read_bytes_.size();
+#else
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) return JXL_FAILURE("Failed to open %s", path);
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 2) {
+    close(fd);
+    return JXL_FAILURE("Failed to get the size of %s", path);
+  }
+  void* data =
+      mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, /*offset=*/0);
+  close(fd);
+  if (data == MAP_FAILED) return JXL_FAILURE("Failed to map %s", path);
+  data_ = static_cast<const uint8_t*>(data);
+  size_ = st.st_size;
+  mapped_ = true;
+  // The rows are read in order, at most a group height at a time.
+  madvise(data, size_, MADV_SEQUENTIAL);
+#endif
+  if (size_ < 2) return JXL_FAILURE("PNM file too small");
+
+  HeaderPNM header;
+  if (!ParsePNM(Span<const uint8_t>(data_, size_), color_hints, constraints,
+                &header, ppf, &format_, &pixels_)) {
+    return false;
+  }
+  ppf->frames.clear();
+  xsize_ = header.xsize;
+  ysize_ = header.ysize;
+  flipped_y_ = header.floating_point;  // PFMs are flipped
+  num_alpha_channels_ = header.has_alpha ? 1 : 0;
+  num_extra_channels_ = header.ec_types.size();
+  sample_size_ = PackedImage::BitsPerChannel(format_.data_type) / kBitsPerByte;
+  color_pixel_size_ = format_.num_channels * sample_size_;
+  pixel_size_ = color_pixel_size_ + num_extra_channels_ * sample_size_;
+  row_size_ = xsize_ * pixel_size_;
+  const size_t pixels_size = data_ + size_ - pixels_;
+  if (ysize_ != 0 && pixels_size / ysize_ < row_size_) {
+    return JXL_FAILURE("PNM file too small");
+  }
+  return true;
+}
+
+JxlChunkedFrameInputSource ChunkedPNMDecoder::GetInputSource() {
+  return {this,
+          &GetColorChannelsPixelFormat,
+          &GetColorChannelDataAt,
+          &GetExtraChannelPixelFormat,
+          &GetExtraChannelDataAt,
+          &ReleaseBuffer};
+}
+
+void ChunkedPNMDecoder::GetColorChannelsPixelFormat(
+    void* opaque, JxlPixelFormat* pixel_format) {
+  *pixel_format = static_cast<ChunkedPNMDecoder*>(opaque)->format_;
+}
+
+const void* ChunkedPNMDecoder::GetColorChannelDataAt(void* opaque,
+                                                     size_t xpos, size_t ypos,
+                                                     size_t xsize,
+                                                     size_t ysize,
+                                                     size_t* row_offset) {
+  const ChunkedPNMDecoder* self = static_cast<ChunkedPNMDecoder*>(opaque);
+  if (self->num_extra_channels_ == 0 && !self->flipped_y_) {
+    *row_offset = self->row_size_;
+    return self->pixels_ + ypos * self->row_size_ +
+           xpos * self->color_pixel_size_;
+  }
+  return self->CopyRect(/*offset=*/0, self->color_pixel_size_, xpos, ypos,
+                        xsize, ysize, row_offset);
+}
+
+void ChunkedPNMDecoder::GetExtraChannelPixelFormat(
+    void* opaque, size_t ec_index, JxlPixelFormat* pixel_format) {
+  *pixel_format = static_cast<ChunkedPNMDecoder*>(opaque)->format_;
+  pixel_format->num_channels = 1;
+}
+
+const void* ChunkedPNMDecoder::GetExtraChannelDataAt(
+    void* opaque, size_t ec_index, size_t xpos, size_t ypos, size_t xsize,
+    size_t ysize, size_t* row_offset) {
+  const ChunkedPNMDecoder* self = static_cast<ChunkedPNMDecoder*>(opaque);
+  // The alpha channel, if any, is interleaved with the color.
+  JXL_ASSERT(ec_index >= self->num_alpha_channels_);
+  const size_t i = ec_index - self->num_alpha_channels_;
+  JXL_ASSERT(i < self->num_extra_channels_);
+  return self->CopyRect(self->color_pixel_size_ + i * self->sample_size_,
+                        self->sample_size_, xpos, ypos, xsize, ysize,
+                        row_offset);
+}
+
+void ChunkedPNMDecoder::ReleaseBuffer(void* opaque, const void* buf) {
+  const ChunkedPNMDecoder* self = static_cast<ChunkedPNMDecoder*>(opaque);
+  const uint8_t* bytes = static_cast<const uint8_t*>(buf);
+  // Rectangles in place are not released, copies are.
+  if (bytes >= self->data_ && bytes < self->data_ + self->size_) return;
+  free(const_cast<void*>(buf));
+}
+
+const void* ChunkedPNMDecoder::CopyRect(size_t offset, size_t sample_size,
+                                        size_t xpos, size_t ypos, size_t xsize,
+                                        size_t ysize,
+                                        size_t* row_offset) const {
+  *row_offset = xsize * sample_size;
+  uint8_t* out = static_cast<uint8_t*>(
+      malloc(std::max<size_t>(1, ysize * *row_offset)));
+  if (out == nullptr) return nullptr;
+  for (size_t y = 0; y < ysize; ++y) {
+    const size_t y_in = flipped_y_ ? ysize_ - 1 - (ypos + y) : ypos + y;
+    const uint8_t* row_in =
+        pixels_ + y_in * row_size_ + xpos * pixel_size_ + offset;
+    uint8_t* row_out = out + y * *row_offset;
+    if (sample_size == pixel_size_) {
+      memcpy(row_out, row_in, xsize * sample_size);
+      continue;
+    }
+    for (size_t x = 0; x < xsize; ++x) {
+      memcpy(row_out + x * sample_size, row_in + x * pixel_size_,
+             sample_size);
+    }
+  }
+  return out;
+}
+
 void TestCodecPNM() {
   size_t u = 77777;  // Initialized to wrong value.
   double d = 77.77;
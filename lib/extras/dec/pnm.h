@@ -8,9 +8,13 @@
 
 // Decodes PBM/PGM/PPM/PFM pixels in memory.
 
+#include <jxl/encode.h>
+#include <jxl/types.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include <vector>
+
 // TODO(janwas): workaround for incorrect Win64 codegen (cause unknown)
 #include <hwy/highway.h>
 
@@ -33,6 +37,76 @@ Status DecodeImagePNM(Span<const uint8_t> bytes, const ColorHints& color_hints,
                       PackedPixelFile* ppf,
                       const SizeConstraints* constraints = nullptr);
 
+// Reads a PGM/PPM/PFM/PAM file without loading it: the file is mapped into
+// memory and its pixels are handed to JxlEncoderAddChunkedFrame one rectangle
+// at a time. The rectangles point into the mapping when the rows of the file
+// have the layout of the pixel format, i.e. for PGM, PPM and PAM files without
+// extra channels other than alpha. PFM rows are stored bottom to top and PAM
+// extra channels are interleaved with the color, so those rectangles are
+// copied.
+class ChunkedPNMDecoder {
+ public:
+  ChunkedPNMDecoder() = default;
+  ChunkedPNMDecoder(const ChunkedPNMDecoder&) = delete;
+  ChunkedPNMDecoder& operator=(const ChunkedPNMDecoder&) = delete;
+  ~ChunkedPNMDecoder();
+
+  // Maps the file at `path` and sets the image info, color encoding and extra
+  // channel info of `ppf`, which gets no frames. color_hints are as for
+  // DecodeImagePNM.
+  Status Init(const char* path, const ColorHints& color_hints,
+              PackedPixelFile* ppf,
+              const SizeConstraints* constraints = nullptr);
+
+  // Returns the callbacks that provide the pixels of the single frame. They
+  // are valid as long as this decoder.
+  JxlChunkedFrameInputSource GetInputSource();
+
+  // Size of the mapped file in bytes.
+  size_t file_size() const { return size_; }
+
+ private:
+  static void GetColorChannelsPixelFormat(void* opaque,
+                                          JxlPixelFormat* pixel_format);
+  static const void* GetColorChannelDataAt(void* opaque, size_t xpos,
+                                           size_t ypos, size_t xsize,
+                                           size_t ysize, size_t* row_offset);
+  static void GetExtraChannelPixelFormat(void* opaque, size_t ec_index,
+                                         JxlPixelFormat* pixel_format);
+  static const void* GetExtraChannelDataAt(void* opaque, size_t ec_index,
+                                           size_t xpos, size_t ypos,
+                                           size_t xsize, size_t ysize,
+                                           size_t* row_offset);
+  static void ReleaseBuffer(void* opaque, const void* buf);
+
+  // Copies `sample_size` bytes at `offset` of each pixel of the rectangle
+  // into a new buffer, top row first.
+  const void* CopyRect(size_t offset, size_t sample_size, size_t xpos,
+                       size_t ypos, size_t xsize, size_t ysize,
+                       size_t* row_offset) const;
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  // Whether data_ is a memory mapping, or was read into an allocation on
+  // platforms without mmap.
+  bool mapped_ = false;
+  std::vector<uint8_t> read_bytes_;
+
+  const uint8_t* pixels_ = nullptr;
+  size_t xsize_ = 0;
+  size_t ysize_ = 0;
+  bool flipped_y_ = false;
+  JxlPixelFormat format_ = {};
+  size_t num_alpha_channels_ = 0;
+  size_t num_extra_channels_ = 0;
+  // Bytes of the interleaved color (and alpha) samples of a pixel, of one
+  // sample, of all the samples of a pixel and of a row in the file.
+  size_t color_pixel_size_ = 0;
+  size_t sample_size_ = 0;
+  size_t pixel_size_ = 0;
+  size_t row_size_ = 0;
+};
+
 void TestCodecPNM();
 
 }  // namespace extras
@@ -38,10 +38,13 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <zlib.h>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
+#include "lib/extras/enc/apng_filter.h"
 #include "lib/extras/exif.h"
 #include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/printf_macros.h"
@@ -74,6 +77,11 @@ class APNGEncoder : public Encoder {
     JXL_RETURN_IF_ERROR(VerifyBasicInfo(ppf.info));
     encoded_image->icc.clear();
     encoded_image->bitstreams.resize(1);
+    const auto parallel_deflate = options().find("parallel_deflate");
+    if (parallel_deflate != options().end() &&
+        parallel_deflate->second == "1" && !ppf.info.have_animation) {
+      return EncodeInParallel(ppf, pool, &encoded_image->bitstreams.front());
+    }
     return EncodePackedPixelFileToAPNG(ppf, pool,
                                        &encoded_image->bitstreams.front());
   }
@@ -82,8 +90,47 @@ class APNGEncoder : public Encoder {
   Status EncodePackedPixelFileToAPNG(const PackedPixelFile& ppf,
                                      ThreadPool* pool,
                                      std::vector<uint8_t>* bytes) const;
+  Status EncodeInParallel(const PackedPixelFile& ppf, ThreadPool* pool,
+                          std::vector<uint8_t>* bytes) const;
 };
 
+// Converts `num_samples` samples of `format` with `bits_per_sample` significant
+// bits to the samples of a PNG image, 8 bits or big endian 16 bits.
+void ConvertSamples(const uint8_t* in, size_t num_samples,
+                    const JxlPixelFormat& format, uint32_t bits_per_sample,
+                    uint8_t* out) {
+  if (format.data_type == JXL_TYPE_UINT8) {
+    if (bits_per_sample < 8) {
+      float mul = 255.0 / ((1u << bits_per_sample) - 1);
+      for (size_t i = 0; i < num_samples; ++i) {
+        out[i] = static_cast<uint8_t>(in[i] * mul + 0.5);
+      }
+    } else {
+      memcpy(out, in, num_samples);
+    }
+  } else if (format.data_type == JXL_TYPE_UINT16) {
+    if (bits_per_sample < 16 || format.endianness != JXL_BIG_ENDIAN) {
+      float mul = 65535.0 / ((1u << bits_per_sample) - 1);
+      const uint8_t* p_in = in;
+      uint8_t* p_out = out;
+      for (size_t i = 0; i < num_samples; ++i, p_in += 2, p_out += 2) {
+        uint32_t val = (format.endianness == JXL_BIG_ENDIAN ? LoadBE16(p_in)
+                                                            : LoadLE16(p_in));
+        StoreBE16(static_cast<uint32_t>(val * mul + 0.5), p_out);
+      }
+    } else {
+      memcpy(out, in, 2 * num_samples);
+    }
+  }
+}
+
+png_byte ColorType(size_t num_channels) {
+  png_byte color_type =
+      (num_channels < 3 ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_RGB);
+  if (num_channels % 2 == 0) color_type |= PNG_COLOR_MASK_ALPHA;
+  return color_type;
+}
+
 static void PngWrite(png_structp png_ptr, png_bytep data, png_size_t length) {
   std::vector<uint8_t>* bytes =
       static_cast<std::vector<uint8_t>*>(png_get_io_ptr(png_ptr));
@@ -195,16 +242,35 @@ void MaybeAddCICP(JxlColorEncoding c_enc, png_structp png_ptr,
   png_set_unknown_chunks(png_ptr, info_ptr, &cicp_chunk, 1);
 }
 
+// Adds the chunks of the first frame before the image data: the color
+// encoding, the ICC profile and the metadata.
+Status AddHeaderChunks(const PackedPixelFile& ppf, png_structp png_ptr,
+                       png_infop info_ptr) {
+  MaybeAddCICP(ppf.color_encoding, png_ptr, info_ptr);
+  if (!ppf.icc.empty()) {
+    png_set_benign_errors(png_ptr, 1);
+    png_set_iCCP(png_ptr, info_ptr, "1", 0, ppf.icc.data(), ppf.icc.size());
+  }
+  std::vector<std::string> textstrings;
+  JXL_RETURN_IF_ERROR(BlobsWriterPNG::Encode(ppf.metadata, &textstrings));
+  for (size_t kk = 0; kk + 1 < textstrings.size(); kk += 2) {
+    png_text text;
+    text.key = const_cast<png_charp>(textstrings[kk].c_str());
+    text.text = const_cast<png_charp>(textstrings[kk + 1].c_str());
+    text.compression = PNG_TEXT_COMPRESSION_zTXt;
+    png_set_text(png_ptr, info_ptr, &text, 1);
+  }
+  return true;
+}
+
 Status APNGEncoder::EncodePackedPixelFileToAPNG(
     const PackedPixelFile& ppf, ThreadPool* pool,
     std::vector<uint8_t>* bytes) const {
   size_t xsize = ppf.info.xsize;
   size_t ysize = ppf.info.ysize;
   bool has_alpha = ppf.info.alpha_bits != 0;
-  bool is_gray = ppf.info.num_color_channels == 1;
   size_t color_channels = ppf.info.num_color_channels;
   size_t num_channels = color_channels + (has_alpha ? 1 : 0);
-  size_t num_samples = num_channels * xsize * ysize;
 
   if (!ppf.info.have_animation && ppf.frames.size() != 1) {
     return JXL_FAILURE("Invalid number of frames");
@@ -225,30 +291,9 @@ Status APNGEncoder::EncodePackedPixelFileToAPNG(
     size_t out_stride = xsize * num_channels * out_bytes_per_sample;
     size_t out_size = ysize * out_stride;
     std::vector<uint8_t> out(out_size);
-
-    if (format.data_type == JXL_TYPE_UINT8) {
-      if (ppf.info.bits_per_sample < 8) {
-        float mul = 255.0 / ((1u << ppf.info.bits_per_sample) - 1);
-        for (size_t i = 0; i < num_samples; ++i) {
-          out[i] = static_cast<uint8_t>(in[i] * mul + 0.5);
-        }
-      } else {
-        memcpy(&out[0], in, out_size);
-      }
-    } else if (format.data_type == JXL_TYPE_UINT16) {
-      if (ppf.info.bits_per_sample < 16 ||
-          format.endianness != JXL_BIG_ENDIAN) {
-        float mul = 65535.0 / ((1u << ppf.info.bits_per_sample) - 1);
-        const uint8_t* p_in = in;
-        uint8_t* p_out = out.data();
-        for (size_t i = 0; i < num_samples; ++i, p_in += 2, p_out += 2) {
-          uint32_t val = (format.endianness == JXL_BIG_ENDIAN ? LoadBE16(p_in)
-                                                              : LoadLE16(p_in));
-          StoreBE16(static_cast<uint32_t>(val * mul + 0.5), p_out);
-        }
-      } else {
-        memcpy(&out[0], in, out_size);
-      }
+    for (size_t y = 0; y < ysize; ++y) {
+      ConvertSamples(in + y * color.stride, xsize * num_channels, format,
+                     ppf.info.bits_per_sample, &out[y * out_stride]);
     }
     png_structp png_ptr;
     png_infop info_ptr;
@@ -266,29 +311,14 @@ Status APNGEncoder::EncodePackedPixelFileToAPNG(
     int width = xsize;
     int height = ysize;
 
-    png_byte color_type = (is_gray ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_RGB);
-    if (has_alpha) color_type |= PNG_COLOR_MASK_ALPHA;
+    png_byte color_type = ColorType(num_channels);
     png_byte bit_depth = out_bytes_per_sample * 8;
 
     png_set_IHDR(png_ptr, info_ptr, width, height, bit_depth, color_type,
                  PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
                  PNG_FILTER_TYPE_BASE);
     if (count == 0) {
-      MaybeAddCICP(ppf.color_encoding, png_ptr, info_ptr);
-      if (!ppf.icc.empty()) {
-        png_set_benign_errors(png_ptr, 1);
-        png_set_iCCP(png_ptr, info_ptr, "1", 0, ppf.icc.data(), ppf.icc.size());
-      }
-      std::vector<std::string> textstrings;
-      JXL_RETURN_IF_ERROR(BlobsWriterPNG::Encode(ppf.metadata, &textstrings));
-      for (size_t kk = 0; kk + 1 < textstrings.size(); kk += 2) {
-        png_text text;
-        text.key = const_cast<png_charp>(textstrings[kk].c_str());
-        text.text = const_cast<png_charp>(textstrings[kk + 1].c_str());
-        text.compression = PNG_TEXT_COMPRESSION_zTXt;
-        png_set_text(png_ptr, info_ptr, &text, 1);
-      }
-
+      JXL_RETURN_IF_ERROR(AddHeaderChunks(ppf, png_ptr, info_ptr));
       png_write_info(png_ptr, info_ptr);
     } else {
       // fake writing a header, otherwise libpng gets confused
@@ -361,11 +391,188 @@ Status APNGEncoder::EncodePackedPixelFileToAPNG(
   return true;
 }
 
+Status APNGEncoder::EncodeInParallel(const PackedPixelFile& ppf,
+                                     ThreadPool* pool,
+                                     std::vector<uint8_t>* bytes) const {
+  if (ppf.frames.size() != 1) {
+    return JXL_FAILURE("Invalid number of frames");
+  }
+  const PackedImage& color = ppf.frames[0].color;
+  JXL_RETURN_IF_ERROR(VerifyPackedImage(color, ppf.info));
+  ParallelPNGEncoder encoder(ppf.info, color.format);
+  const uint8_t* pixels = static_cast<const uint8_t*>(color.pixels());
+  JXL_RETURN_IF_ERROR(RunOnPool(
+      pool, 0, color.ysize, ThreadPool::NoInit,
+      [&](const uint32_t y, size_t /* thread */) {
+        encoder.SetPixels(0, y, color.xsize, pixels + y * color.stride);
+      },
+      "EncodePNG"));
+  return encoder.Finish(ppf, bytes);
+}
+
+// The uncompressed size of a group, about as many bytes as a block of pigz.
+constexpr size_t kGroupBytes = 1 << 18;
+// The window of deflate, and so the size of the dictionaries.
+constexpr size_t kWindowSize = 1 << 15;
+constexpr size_t kMaxIDATSize = 1 << 20;
+
 }  // namespace
 
 std::unique_ptr<Encoder> GetAPNGEncoder() {
   return jxl::make_unique<APNGEncoder>();
 }
 
+ParallelPNGEncoder::ParallelPNGEncoder(const JxlBasicInfo& info,
+                                       const JxlPixelFormat& format)
+    : xsize_(info.xsize),
+      ysize_(info.ysize),
+      format_(format),
+      bits_per_sample_(info.bits_per_sample) {
+  JXL_ASSERT(format.num_channels >= 1 && format.num_channels <= 4);
+  JXL_ASSERT(format.data_type == JXL_TYPE_UINT8 ||
+             format.data_type == JXL_TYPE_UINT16);
+  bytes_per_pixel_ =
+      format.num_channels * (format.data_type == JXL_TYPE_UINT8 ? 1 : 2);
+  row_size_ = xsize_ * bytes_per_pixel_;
+  group_rows_ = std::max<size_t>(kGroupBytes / (row_size_ + 1), 1);
+  num_groups_ = DivCeil(ysize_, group_rows_);
+  rows_.resize(ysize_ * row_size_);
+  row_pixels_.reset(new std::atomic<size_t>[ysize_]);
+  for (size_t y = 0; y < ysize_; ++y) row_pixels_[y] = 0;
+  pending_rows_.reset(new std::atomic<size_t>[num_groups_]);
+  for (size_t g = 0; g < num_groups_; ++g) {
+    pending_rows_[g] = GroupEnd(g) - FirstDependency(g);
+  }
+  compressed_.resize(num_groups_);
+  adler_.resize(num_groups_);
+}
+
+size_t ParallelPNGEncoder::GroupEnd(size_t group) const {
+  return std::min(GroupBegin(group + 1), ysize_);
+}
+
+size_t ParallelPNGEncoder::FirstDependency(size_t group) const {
+  // The dictionary is made of the last filtered rows of the previous groups,
+  // and filtering a row needs the previous one.
+  const size_t begin = GroupBegin(group);
+  const size_t dictionary_rows = DivCeil(kWindowSize, row_size_ + 1);
+  const size_t dictionary_begin = begin - std::min(begin, dictionary_rows);
+  return dictionary_begin == 0 ? 0 : dictionary_begin - 1;
+}
+
+void ParallelPNGEncoder::SetPixels(size_t x, size_t y, size_t num_pixels,
+                                   const void* pixels) {
+  JXL_DASSERT(y < ysize_ && x + num_pixels <= xsize_);
+  ConvertSamples(static_cast<const uint8_t*>(pixels),
+                 num_pixels * format_.num_channels, format_, bits_per_sample_,
+                 &rows_[y * row_size_ + x * bytes_per_pixel_]);
+  if (row_pixels_[y].fetch_add(num_pixels) + num_pixels != xsize_) return;
+  for (size_t g = y / group_rows_; g < num_groups_ && FirstDependency(g) <= y;
+       ++g) {
+    if (pending_rows_[g].fetch_sub(1) == 1) CompressGroup(g);
+  }
+}
+
+void ParallelPNGEncoder::CompressGroup(size_t group) {
+  const size_t begin = GroupBegin(group);
+  const size_t end = GroupEnd(group);
+  const size_t first = FirstDependency(group);
+  // The filtered rows start with the filter type.
+  const size_t filtered_size = row_size_ + 1;
+  // Filters the rows of the dictionary again, with the same result as in the
+  // previous groups.
+  const size_t filtered_begin = first == 0 ? 0 : first + 1;
+  std::vector<uint8_t> filtered((end - filtered_begin) * filtered_size);
+  std::vector<uint8_t> scratch(PNGFilterScratchSize(row_size_));
+  const std::vector<uint8_t> zeros(row_size_);
+  for (size_t y = filtered_begin; y < end; ++y) {
+    const uint8_t* prev = y == 0 ? zeros.data() : &rows_[(y - 1) * row_size_];
+    uint8_t* out = &filtered[(y - filtered_begin) * filtered_size];
+    FilterPNGRow(prev, &rows_[y * row_size_], row_size_, bytes_per_pixel_,
+                 scratch.data(), out);
+  }
+  const size_t dictionary_size =
+      std::min((begin - filtered_begin) * filtered_size, kWindowSize);
+  const uint8_t* data = &filtered[(begin - filtered_begin) * filtered_size];
+  const size_t size = (end - begin) * filtered_size;
+  adler_[group] = adler32(adler32(0, nullptr, 0), data, size);
+
+  // A raw deflate stream, with the settings of libpng for filtered rows.
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15,
+                   /*memLevel=*/8, Z_FILTERED) != Z_OK) {
+    ok_ = false;
+    return;
+  }
+  if (dictionary_size != 0 &&
+      deflateSetDictionary(&stream, data - dictionary_size, dictionary_size) !=
+          Z_OK) {
+    ok_ = false;
+  }
+  // The last group finishes the stream, the others end at a byte boundary
+  // with an empty stored block, so that the next one can follow.
+  const int flush = group + 1 == num_groups_ ? Z_FINISH : Z_FULL_FLUSH;
+  std::vector<uint8_t>& out = compressed_[group];
+  out.resize(deflateBound(&stream, size) + 16);
+  stream.next_in = const_cast<Bytef*>(data);
+  stream.avail_in = size;
+  int ret;
+  do {
+    if (stream.total_out == out.size()) out.resize(2 * out.size());
+    stream.next_out = out.data() + stream.total_out;
+    stream.avail_out = out.size() - stream.total_out;
+    ret = deflate(&stream, flush);
+  } while (ret == Z_OK && stream.avail_out == 0);
+  if (ret != (flush == Z_FINISH ? Z_STREAM_END : Z_OK)) ok_ = false;
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+}
+
+Status ParallelPNGEncoder::Finish(const PackedPixelFile& ppf,
+                                  std::vector<uint8_t>* bytes) const {
+  for (size_t g = 0; g < num_groups_; ++g) {
+    if (pending_rows_[g] != 0) return JXL_FAILURE("Missing pixels");
+  }
+  if (!ok_) return JXL_FAILURE("Failed to compress the image");
+  // The zlib header of a 32 KiB window and the default compression level,
+  // the groups and the checksum of all of them.
+  std::vector<uint8_t> zlib_stream = {0x78, 0x9C};
+  uint32_t adler = adler32(0, nullptr, 0);
+  for (size_t g = 0; g < num_groups_; ++g) {
+    zlib_stream.insert(zlib_stream.end(), compressed_[g].begin(),
+                       compressed_[g].end());
+    adler = adler32_combine(adler, adler_[g],
+                            (GroupEnd(g) - GroupBegin(g)) * (row_size_ + 1));
+  }
+  zlib_stream.resize(zlib_stream.size() + 4);
+  StoreBE32(adler, &zlib_stream[zlib_stream.size() - 4]);
+
+  bytes->clear();
+  png_structp png_ptr =
+      png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (!png_ptr) return JXL_FAILURE("Could not init png encoder");
+  png_infop info_ptr = png_create_info_struct(png_ptr);
+  if (!info_ptr) return JXL_FAILURE("Could not init png info struct");
+  png_set_write_fn(png_ptr, bytes, PngWrite, NULL);
+  png_set_flush(png_ptr, 0);
+  const png_byte bit_depth = format_.data_type == JXL_TYPE_UINT8 ? 8 : 16;
+  png_set_IHDR(png_ptr, info_ptr, xsize_, ysize_, bit_depth,
+               ColorType(format_.num_channels), PNG_INTERLACE_NONE,
+               PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+  JXL_RETURN_IF_ERROR(AddHeaderChunks(ppf, png_ptr, info_ptr));
+  png_write_info(png_ptr, info_ptr);
+  png_byte idat[5] = "IDAT";
+  for (size_t pos = 0; pos < zlib_stream.size(); pos += kMaxIDATSize) {
+    png_write_chunk(png_ptr, idat, &zlib_stream[pos],
+                    std::min(kMaxIDATSize, zlib_stream.size() - pos));
+  }
+  // png_write_end only accepts image data written by libpng.
+  png_byte iend[5] = "IEND";
+  png_write_chunk(png_ptr, iend, nullptr, 0);
+  png_destroy_write_struct(&png_ptr, &info_ptr);
+  return true;
+}
+
 }  // namespace extras
 }  // namespace jxl
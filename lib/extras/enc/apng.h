@@ -8,15 +8,82 @@
 
 // Encodes APNG images in memory.
 
+#include <jxl/codestream_header.h>
+#include <jxl/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
 #include <memory>
+#include <vector>
 
 #include "lib/extras/enc/encode.h"
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/base/status.h"
 
 namespace jxl {
 namespace extras {
 
+// The encoder also accepts the option "parallel_deflate" = "1", which writes
+// images without animation with a ParallelPNGEncoder on the thread pool.
 std::unique_ptr<Encoder> GetAPNGEncoder();
 
+// Writes a PNG image without animation whose rows are filtered and compressed
+// in parallel: the image is split into groups of rows, each compressed on its
+// own and ended with a zlib full flush, and the compressed groups are then
+// concatenated into one zlib stream, like pigz does. Each group starts with
+// the last 32 KiB of the previous one as dictionary, so the file is only
+// slightly larger than with a single stream.
+//
+// The pixels can be set in any order and from several threads, for example
+// from the image out callback of the JPEG XL decoder, and each group is
+// compressed as soon as the pixels it depends on are set, by the thread that
+// set the last of them, so that the encoding overlaps with the production of
+// the pixels.
+class ParallelPNGEncoder {
+ public:
+  // Only the size, the bit depth and the channels of `info` are used, and
+  // `format` must be one of the formats accepted by the APNG encoder.
+  ParallelPNGEncoder(const JxlBasicInfo& info, const JxlPixelFormat& format);
+
+  // Sets `num_pixels` pixels of row `y` starting at column `x` from `pixels`,
+  // in the format given to the constructor. Can be called concurrently for
+  // different pixels, and each pixel must be set exactly once.
+  void SetPixels(size_t x, size_t y, size_t num_pixels, const void* pixels);
+
+  // Writes the image into `bytes`, with the color encoding, ICC profile and
+  // metadata of `ppf`. Fails if some pixels were not set.
+  Status Finish(const PackedPixelFile& ppf, std::vector<uint8_t>* bytes) const;
+
+ private:
+  size_t GroupBegin(size_t group) const { return group * group_rows_; }
+  size_t GroupEnd(size_t group) const;
+  // The first row needed to filter the rows of the group and its dictionary.
+  size_t FirstDependency(size_t group) const;
+  void CompressGroup(size_t group);
+
+  size_t xsize_;
+  size_t ysize_;
+  JxlPixelFormat format_;
+  uint32_t bits_per_sample_;
+  size_t bytes_per_pixel_;
+  // Of the unfiltered rows in the PNG format.
+  size_t row_size_;
+  size_t group_rows_;
+  size_t num_groups_;
+  // The unfiltered rows of the whole image.
+  std::vector<uint8_t> rows_;
+  // For each row, the number of pixels set so far.
+  std::unique_ptr<std::atomic<size_t>[]> row_pixels_;
+  // For each group, the number of rows it depends on that are not complete.
+  std::unique_ptr<std::atomic<size_t>[]> pending_rows_;
+  // The raw deflate data of each group and the Adler-32 checksum of its
+  // filtered rows.
+  std::vector<std::vector<uint8_t>> compressed_;
+  std::vector<uint32_t> adler_;
+  std::atomic<bool> ok_{true};
+};
+
 }  // namespace extras
 }  // namespace jxl
 
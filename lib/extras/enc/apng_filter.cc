@@ -0,0 +1,167 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/extras/enc/apng_filter.h"
+
+#include <string.h>
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/extras/enc/apng_filter.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+#include "lib/jxl/base/compiler_specific.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace jxl {
+namespace extras {
+namespace HWY_NAMESPACE {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::And;
+using hwy::HWY_NAMESPACE::AverageRound;
+using hwy::HWY_NAMESPACE::Eq;
+using hwy::HWY_NAMESPACE::IfThenElse;
+using hwy::HWY_NAMESPACE::Max;
+using hwy::HWY_NAMESPACE::Min;
+using hwy::HWY_NAMESPACE::SaturatedAdd;
+using hwy::HWY_NAMESPACE::Sub;
+using hwy::HWY_NAMESPACE::SumsOf8;
+using hwy::HWY_NAMESPACE::VecFromMask;
+using hwy::HWY_NAMESPACE::Xor;
+
+// The filter types of the PNG specification, in the order of their codes.
+enum Filter { kNone, kSub, kUp, kAverage, kPaeth, kNumFilters };
+
+uint8_t ScalarPaeth(uint8_t a, uint8_t b, uint8_t c) {
+  const int p = a + b - c;
+  const int pa = p > a ? p - a : a - p;
+  const int pb = p > b ? p - b : b - p;
+  const int pc = p > c ? p - c : c - p;
+  if (pa <= pb && pa <= pc) return a;
+  return pb <= pc ? b : c;
+}
+
+// Computes the distances of the Paeth predictor in 8 bits: pa = |b - c| and
+// pb = |a - c| fit, and pc = |a + b - 2c| is |pa - pb| if b - c and a - c have
+// different signs, otherwise pa + pb, which may saturate because it is only
+// compared with pa and pb.
+template <class D, class V>
+V Paeth(D d, V a, V b, V c) {
+  const V pa = Sub(Max(b, c), Min(b, c));
+  const V pb = Sub(Max(a, c), Min(a, c));
+  const auto same_sign = Eq(VecFromMask(d, Eq(Max(a, c), a)),
+                            VecFromMask(d, Eq(Max(b, c), b)));
+  const V pc = IfThenElse(same_sign, SaturatedAdd(pa, pb),
+                          Sub(Max(pa, pb), Min(pa, pb)));
+  const V min_bc = Min(pb, pc);
+  return IfThenElse(Eq(Min(pa, min_bc), pa), a,
+                    IfThenElse(Eq(min_bc, pb), b, c));
+}
+
+// The absolute values of the filtered bytes taken as signed.
+template <class D, class V>
+V Cost(D d, V v) {
+  return Min(v, Sub(Zero(d), v));
+}
+
+void FilterPNGRow(const uint8_t* JXL_RESTRICT prev,
+                  const uint8_t* JXL_RESTRICT row, size_t row_size,
+                  size_t bytes_per_pixel, uint8_t* JXL_RESTRICT scratch,
+                  uint8_t* JXL_RESTRICT out) {
+  const HWY_FULL(uint8_t) d;
+  const hwy::HWY_NAMESPACE::Repartition<uint64_t, decltype(d)> d64;
+  // The unfiltered row is the output of kNone.
+  uint8_t* JXL_RESTRICT filtered[kNumFilters] = {
+      nullptr, scratch, scratch + row_size, scratch + 2 * row_size,
+      scratch + 3 * row_size};
+  uint64_t costs[kNumFilters] = {};
+
+  // The bytes without left neighbors and the ones after the last full vector.
+  const auto filter_byte = [&](size_t x) {
+    const uint8_t a = x >= bytes_per_pixel ? row[x - bytes_per_pixel] : 0;
+    const uint8_t b = prev[x];
+    const uint8_t c = x >= bytes_per_pixel ? prev[x - bytes_per_pixel] : 0;
+    const uint8_t values[kNumFilters] = {
+        row[x], static_cast<uint8_t>(row[x] - a),
+        static_cast<uint8_t>(row[x] - b),
+        static_cast<uint8_t>(row[x] - ((a + b) >> 1)),
+        static_cast<uint8_t>(row[x] - ScalarPaeth(a, b, c))};
+    for (size_t f = 0; f < kNumFilters; ++f) {
+      if (f != kNone) filtered[f][x] = values[f];
+      costs[f] += values[f] < 128 ? values[f] : 256 - values[f];
+    }
+  };
+
+  size_t x = 0;
+  for (; x < bytes_per_pixel && x < row_size; ++x) filter_byte(x);
+  auto cost_none = Zero(d64);
+  auto cost_sub = Zero(d64);
+  auto cost_up = Zero(d64);
+  auto cost_average = Zero(d64);
+  auto cost_paeth = Zero(d64);
+  const auto one = Set(d, 1);
+  for (; x + Lanes(d) <= row_size; x += Lanes(d)) {
+    const auto v = LoadU(d, row + x);
+    const auto a = LoadU(d, row + x - bytes_per_pixel);
+    const auto b = LoadU(d, prev + x);
+    const auto c = LoadU(d, prev + x - bytes_per_pixel);
+    const auto sub = Sub(v, a);
+    const auto up = Sub(v, b);
+    // The average rounded down.
+    const auto average = Sub(v, Sub(AverageRound(a, b), And(Xor(a, b), one)));
+    const auto paeth = Sub(v, Paeth(d, a, b, c));
+    StoreU(sub, d, filtered[kSub] + x);
+    StoreU(up, d, filtered[kUp] + x);
+    StoreU(average, d, filtered[kAverage] + x);
+    StoreU(paeth, d, filtered[kPaeth] + x);
+    cost_none = Add(cost_none, SumsOf8(Cost(d, v)));
+    cost_sub = Add(cost_sub, SumsOf8(Cost(d, sub)));
+    cost_up = Add(cost_up, SumsOf8(Cost(d, up)));
+    cost_average = Add(cost_average, SumsOf8(Cost(d, average)));
+    cost_paeth = Add(cost_paeth, SumsOf8(Cost(d, paeth)));
+  }
+  for (; x < row_size; ++x) filter_byte(x);
+  costs[kNone] += GetLane(SumOfLanes(d64, cost_none));
+  costs[kSub] += GetLane(SumOfLanes(d64, cost_sub));
+  costs[kUp] += GetLane(SumOfLanes(d64, cost_up));
+  costs[kAverage] += GetLane(SumOfLanes(d64, cost_average));
+  costs[kPaeth] += GetLane(SumOfLanes(d64, cost_paeth));
+
+  size_t best = kNone;
+  for (size_t f = kSub; f < kNumFilters; ++f) {
+    if (costs[f] < costs[best]) best = f;
+  }
+  out[0] = best;
+  memcpy(out + 1, best == kNone ? row : filtered[best], row_size);
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace extras
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jxl {
+namespace extras {
+
+HWY_EXPORT(FilterPNGRow);
+
+size_t PNGFilterScratchSize(size_t row_size) {
+  // The outputs of the filters other than kNone.
+  return 4 * row_size;
+}
+
+void FilterPNGRow(const uint8_t* prev, const uint8_t* row, size_t row_size,
+                  size_t bytes_per_pixel, uint8_t* scratch, uint8_t* out) {
+  HWY_DYNAMIC_DISPATCH(FilterPNGRow)
+  (prev, row, row_size, bytes_per_pixel, scratch, out);
+}
+
+}  // namespace extras
+}  // namespace jxl
+#endif
@@ -0,0 +1,33 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_EXTRAS_ENC_APNG_FILTER_H_
+#define LIB_EXTRAS_ENC_APNG_FILTER_H_
+
+// SIMD filtering of PNG rows.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace jxl {
+namespace extras {
+
+// Returns the size of the scratch memory of FilterPNGRow for rows of
+// `row_size` bytes.
+size_t PNGFilterScratchSize(size_t row_size);
+
+// Writes the filter type and the filtered bytes of the unfiltered `row` of
+// `row_size` bytes to `out`, which has room for `row_size` + 1 bytes. `prev` is
+// the unfiltered previous row, all zeros for the first row of the image, and
+// `bytes_per_pixel` is the distance of the left neighbors. Of the five filters
+// of the PNG specification, chooses the one whose output has the smallest sum
+// of the absolute values of the bytes taken as signed, like libpng does.
+void FilterPNGRow(const uint8_t* prev, const uint8_t* row, size_t row_size,
+                  size_t bytes_per_pixel, uint8_t* scratch, uint8_t* out);
+
+}  // namespace extras
+}  // namespace jxl
+
+#endif  // LIB_EXTRAS_ENC_APNG_FILTER_H_
@@ -9,8 +9,10 @@
 #include <ImfIO.h>
 #include <ImfRgbaFile.h>
 #include <ImfStandardAttributes.h>
+#include <ImfThreading.h>
 #include <jxl/codestream_header.h>
 
+#include <sstream>
 #include <vector>
 
 #include "lib/extras/packed_image.h"
@@ -73,15 +75,94 @@ float LoadLEFloat(const uint8_t* p) {
   return result;
 }
 
-Status EncodeImageEXR(const PackedImage& image, const JxlBasicInfo& info,
-                      const JxlColorEncoding& c_enc, ThreadPool* pool,
-                      std::vector<uint8_t>* bytes) {
-  OpenEXR::setGlobalThreadCount(0);
+// Loads a Big-Endian half float
+uint16_t LoadBEHalf(const uint8_t* p) { return LoadBE16(p); }
+
+// Loads a Little-Endian half float
+uint16_t LoadLEHalf(const uint8_t* p) { return LoadLE16(p); }
 
+// Converts the float or half float RGB(A) `image` to premultiplied
+// OpenEXR::Rgba pixels, one row per task of `pool`.
+Status ConvertToRgba(const PackedImage& image, const JxlBasicInfo& info,
+                     ThreadPool* pool, std::vector<OpenEXR::Rgba>* rgba) {
   const size_t xsize = info.xsize;
   const size_t ysize = info.ysize;
   const bool has_alpha = info.alpha_bits > 0;
+  const JxlPixelFormat format = image.format;
+  const size_t num_channels = 3 + (has_alpha ? 1 : 0);
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(image.pixels());
+  rgba->resize(xsize * ysize);
+
+  if (format.data_type == JXL_TYPE_FLOAT16) {
+    auto loadHalf = format.endianness == JXL_BIG_ENDIAN ? LoadBEHalf : LoadLEHalf;
+    // Premultiplied or opaque half floats are copied without conversion.
+    const bool premultiply = has_alpha && !info.alpha_premultiplied;
+    return RunOnPool(
+        pool, 0, ysize, ThreadPool::NoInit,
+        [&](const uint32_t y, size_t /* thread */) {
+          const uint8_t* in_row = in + y * image.stride;
+          OpenEXR::Rgba* const JXL_RESTRICT row_data = &(*rgba)[y * xsize];
+          for (size_t x = 0; x < xsize; ++x) {
+            const uint8_t* in_pixel = &in_row[2 * num_channels * x];
+            OpenEXR::Rgba& pixel = row_data[x];
+            pixel.r.setBits(loadHalf(&in_pixel[0]));
+            pixel.g.setBits(loadHalf(&in_pixel[2]));
+            pixel.b.setBits(loadHalf(&in_pixel[4]));
+            if (!has_alpha) {
+              pixel.a = 1.0f;
+              continue;
+            }
+            pixel.a.setBits(loadHalf(&in_pixel[6]));
+            if (premultiply) {
+              const float alpha = pixel.a;
+              pixel.r = pixel.r * alpha;
+              pixel.g = pixel.g * alpha;
+              pixel.b = pixel.b * alpha;
+            }
+          }
+        },
+        "ConvertHalfToRgba");
+  }
+
+  auto loadFloat =
+      format.endianness == JXL_BIG_ENDIAN ? LoadBEFloat : LoadLEFloat;
+  auto loadAlpha =
+      has_alpha ? loadFloat : [](const uint8_t* p) -> float { return 1.0f; };
   const bool alpha_is_premultiplied = info.alpha_premultiplied;
+  return RunOnPool(
+      pool, 0, ysize, ThreadPool::NoInit,
+      [&](const uint32_t y, size_t /* thread */) {
+        const uint8_t* in_row = in + y * image.stride;
+        OpenEXR::Rgba* const JXL_RESTRICT row_data = &(*rgba)[y * xsize];
+        for (size_t x = 0; x < xsize; ++x) {
+          const uint8_t* in_pixel = &in_row[4 * num_channels * x];
+          float r = loadFloat(&in_pixel[0]);
+          float g = loadFloat(&in_pixel[4]);
+          float b = loadFloat(&in_pixel[8]);
+          const float alpha = loadAlpha(&in_pixel[12]);
+          if (!alpha_is_premultiplied) {
+            r *= alpha;
+            g *= alpha;
+            b *= alpha;
+          }
+          row_data[x] = OpenEXR::Rgba(r, g, b, alpha);
+        }
+      },
+      "ConvertFloatToRgba");
+}
+
+// Compresses with `num_threads` threads of the OpenEXR thread pool, or on the
+// calling thread if it is 0.
+Status EncodeImageEXR(const PackedImage& image, const JxlBasicInfo& info,
+                      const JxlColorEncoding& c_enc, int num_threads,
+                      ThreadPool* pool, std::vector<uint8_t>* bytes) {
+  if (OpenEXR::globalThreadCount() < num_threads) {
+    OpenEXR::setGlobalThreadCount(num_threads);
+  }
+
+  const size_t xsize = info.xsize;
+  const size_t ysize = info.ysize;
+  const bool has_alpha = info.alpha_bits > 0;
 
   if (info.num_color_channels != 3 ||
       c_enc.color_space != JXL_COLOR_SPACE_RGB ||
@@ -89,16 +170,11 @@ Status EncodeImageEXR(const PackedImage& image, const JxlBasicInfo& info,
     return JXL_FAILURE("Unsupported color encoding for OpenEXR output.");
   }
 
-  const size_t num_channels = 3 + (has_alpha ? 1 : 0);
-  const JxlPixelFormat format = image.format;
-
-  if (format.data_type != JXL_TYPE_FLOAT) {
+  if (image.format.data_type != JXL_TYPE_FLOAT &&
+      image.format.data_type != JXL_TYPE_FLOAT16) {
     return JXL_FAILURE("Unsupported pixel format for OpenEXR output");
   }
 
-  const uint8_t* in = reinterpret_cast<const uint8_t*>(image.pixels());
-  size_t in_stride = num_channels * 4 * xsize;
-
   OpenEXR::Header header(xsize, ysize);
   OpenEXR::Chromaticities chromaticities;
   chromaticities.red =
@@ -112,47 +188,21 @@ Status EncodeImageEXR(const PackedImage& image, const JxlBasicInfo& info,
   OpenEXR::addChromaticities(header, chromaticities);
   OpenEXR::addWhiteLuminance(header, 255.0f);
 
-  auto loadFloat =
-      format.endianness == JXL_BIG_ENDIAN ? LoadBEFloat : LoadLEFloat;
-  auto loadAlpha =
-      has_alpha ? loadFloat : [](const uint8_t* p) -> float { return 1.0f; };
+  std::vector<OpenEXR::Rgba> output_rows;
+  JXL_RETURN_IF_ERROR(ConvertToRgba(image, info, pool, &output_rows));
 
   // Ensure that the destructor of RgbaOutputFile has run before we look at the
   // size of `bytes`.
   {
     InMemoryOStream os(bytes);
     OpenEXR::RgbaOutputFile output(
-        os, header, has_alpha ? OpenEXR::WRITE_RGBA : OpenEXR::WRITE_RGB);
-    // How many rows to write at once. Again, the OpenEXR documentation
-    // recommends writing the whole image in one call.
-    const int y_chunk_size = ysize;
-    std::vector<OpenEXR::Rgba> output_rows(xsize * y_chunk_size);
-
-    for (size_t start_y = 0; start_y < ysize; start_y += y_chunk_size) {
-      // Inclusive.
-      const size_t end_y = std::min(start_y + y_chunk_size - 1, ysize - 1);
-      output.setFrameBuffer(output_rows.data() - start_y * xsize,
-                            /*xStride=*/1, /*yStride=*/xsize);
-      for (size_t y = start_y; y <= end_y; ++y) {
-        const uint8_t* in_row = &in[(y - start_y) * in_stride];
-        OpenEXR::Rgba* const JXL_RESTRICT row_data =
-            &output_rows[(y - start_y) * xsize];
-        for (size_t x = 0; x < xsize; ++x) {
-          const uint8_t* in_pixel = &in_row[4 * num_channels * x];
-          float r = loadFloat(&in_pixel[0]);
-          float g = loadFloat(&in_pixel[4]);
-          float b = loadFloat(&in_pixel[8]);
-          const float alpha = loadAlpha(&in_pixel[12]);
-          if (!alpha_is_premultiplied) {
-            r *= alpha;
-            g *= alpha;
-            b *= alpha;
-          }
-          row_data[x] = OpenEXR::Rgba(r, g, b, alpha);
-        }
-      }
-      output.writePixels(/*numScanLines=*/end_y - start_y + 1);
-    }
+        os, header, has_alpha ? OpenEXR::WRITE_RGBA : OpenEXR::WRITE_RGB,
+        num_threads);
+    // The OpenEXR documentation recommends writing the whole image in one
+    // call, which also lets OpenEXR compress the line blocks in parallel.
+    output.setFrameBuffer(output_rows.data(), /*xStride=*/1,
+                          /*yStride=*/xsize);
+    output.writePixels(/*numScanLines=*/ysize);
   }
 
   return true;
@@ -176,6 +226,13 @@ class EXREncoder : public Encoder {
   Status Encode(const PackedPixelFile& ppf, EncodedImage* encoded_image,
                 ThreadPool* pool = nullptr) const override {
     JXL_RETURN_IF_ERROR(VerifyBasicInfo(ppf.info));
+    int num_threads = 0;
+    for (const auto& it : options()) {
+      if (it.first == "num_threads") {
+        std::istringstream is(it.second);
+        JXL_RETURN_IF_ERROR(static_cast<bool>(is >> num_threads));
+      }
+    }
     encoded_image->icc.clear();
     encoded_image->bitstreams.clear();
     encoded_image->bitstreams.reserve(ppf.frames.size());
@@ -183,7 +240,7 @@ class EXREncoder : public Encoder {
       JXL_RETURN_IF_ERROR(VerifyPackedImage(frame.color, ppf.info));
       encoded_image->bitstreams.emplace_back();
       JXL_RETURN_IF_ERROR(EncodeImageEXR(frame.color, ppf.info,
-                                         ppf.color_encoding, pool,
+                                         ppf.color_encoding, num_threads, pool,
                                          &encoded_image->bitstreams.back()));
     }
     return true;
@@ -343,7 +343,6 @@ Status EncodeJpeg(const PackedPixelFile& ppf, const JpegSettings& jpeg_settings,
   std::vector<uint8_t> pixels;
   unsigned char* output_buffer = nullptr;
   unsigned long output_size = 0;
-  std::vector<uint8_t> row_bytes;
   size_t rowlen = RoundUpTo(ppf.info.xsize, VectorSize());
   hwy::AlignedFreeUniquePtr<float[]> xyb_tmp =
       hwy::AllocateAligned<float>(6 * rowlen);
@@ -468,10 +467,9 @@ Status EncodeJpeg(const PackedPixelFile& ppf, const JpegSettings& jpeg_settings,
         jpegli_write_scanlines(&cinfo, row, 1);
       }
     } else {
-      row_bytes.resize(image.stride);
+      // jpegli only reads the rows, which can be passed without a copy.
       for (size_t y = 0; y < info.ysize; ++y) {
-        memcpy(&row_bytes[0], pixels + y * image.stride, image.stride);
-        JSAMPROW row[] = {row_bytes.data()};
+        JSAMPROW row[] = {const_cast<uint8_t*>(pixels + y * image.stride)};
         jpegli_write_scanlines(&cinfo, row, 1);
       }
     }
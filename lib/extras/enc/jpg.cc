@@ -269,11 +269,10 @@ Status EncodeWithLibJpeg(const PackedImage& image, const JxlBasicInfo& info,
   if (cinfo.input_components > 3 || cinfo.input_components < 0)
     return JXL_FAILURE("invalid numbers of components");
 
-  std::vector<uint8_t> raw_bytes(image.pixels_size);
-  memcpy(&raw_bytes[0], reinterpret_cast<const uint8_t*>(image.pixels()),
-         image.pixels_size);
+  // libjpeg only reads the rows, which can be passed without a copy.
+  uint8_t* pixels = reinterpret_cast<uint8_t*>(image.pixels());
   for (size_t y = 0; y < info.ysize; ++y) {
-    JSAMPROW row[] = {raw_bytes.data() + y * image.stride};
+    JSAMPROW row[] = {pixels + y * image.stride};
 
     jpeg_write_scanlines(&cinfo, row, 1);
   }
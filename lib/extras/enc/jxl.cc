@@ -7,6 +7,11 @@
 
 #include <jxl/encode_cxx.h>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "lib/extras/batch.h"
 #include "lib/jxl/exif.h"
 
 namespace jxl {
@@ -35,12 +40,28 @@ bool SetFrameOptions(const std::vector<JXLOption>& options, size_t frame_index,
   return true;
 }
 
-bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
-                    const std::vector<uint8_t>* jpeg_bytes,
-                    std::vector<uint8_t>* compressed) {
-  auto encoder = JxlEncoderMake(/*memory_manager=*/nullptr);
-  JxlEncoder* enc = encoder.get();
+namespace {
 
+// Whether EncodeWithEncoder encodes the single frame of `ppf` in tiles.
+bool UseTiles(const JXLCompressParams& params, const PackedPixelFile& ppf,
+              const std::vector<uint8_t>* jpeg_bytes,
+              const JxlChunkedFrameInputSource* chunked_frame) {
+  return params.tile_size != 0 && !jpeg_bytes && !chunked_frame &&
+         ppf.frames.size() == 1 &&
+         (ppf.info.xsize > params.tile_size ||
+          ppf.info.ysize > params.tile_size);
+}
+
+// Sets the options of `params` and the image info, color encoding and boxes
+// of `ppf` in `enc`, which must be freshly created or reset, and adds the JPEG
+// frame if `jpeg_bytes` is set. The frames are then added with the returned
+// `frame_settings`, from option index `option_idx`. If `tiled`, the boxes are
+// left open for the tile index.
+bool SetUpEncoder(const JXLCompressParams& params, const PackedPixelFile& ppf,
+                  const std::vector<uint8_t>* jpeg_bytes, bool tiled,
+                  JxlEncoder* enc,
+                  JxlEncoderFrameSettings** frame_settings,
+                  size_t* option_idx) {
   if (params.allow_expert_options) {
     JxlEncoderAllowExpertOptions(enc);
   }
@@ -53,8 +74,14 @@ bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
   }
 
   auto settings = JxlEncoderFrameSettingsCreate(enc, nullptr);
-  size_t option_idx = 0;
-  if (!SetFrameOptions(params.options, 0, &option_idx, settings)) {
+  *frame_settings = settings;
+  *option_idx = 0;
+  if (!SetFrameOptions(params.options, 0, option_idx, settings)) {
+    return false;
+  }
+  if (params.stats != nullptr &&
+      JXL_ENC_SUCCESS != JxlEncoderCollectStats(settings, params.stats)) {
+    fprintf(stderr, "JxlEncoderCollectStats failed\n");
     return false;
   }
   if (JXL_ENC_SUCCESS !=
@@ -65,7 +92,7 @@ bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
 
   bool use_boxes = !ppf.metadata.exif.empty() || !ppf.metadata.xmp.empty() ||
                    !ppf.metadata.jumbf.empty() || !ppf.metadata.iptc.empty();
-  bool use_container = params.use_container || use_boxes ||
+  bool use_container = params.use_container || use_boxes || tiled ||
                        (jpeg_bytes && params.jpeg_store_metadata);
 
   if (JXL_ENC_SUCCESS !=
@@ -141,7 +168,7 @@ bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
       }
     }
 
-    if (use_boxes) {
+    if (use_boxes || tiled) {
       if (JXL_ENC_SUCCESS != JxlEncoderUseBoxes(enc)) {
         fprintf(stderr, "JxlEncoderUseBoxes() failed.\n");
         return false;
@@ -173,92 +200,115 @@ bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
           return false;
         }
       }
-      JxlEncoderCloseBoxes(enc);
+      if (!tiled) JxlEncoderCloseBoxes(enc);
     }
+  }
+  return true;
+}
 
-    for (size_t num_frame = 0; num_frame < ppf.frames.size(); ++num_frame) {
-      const jxl::extras::PackedFrame& pframe = ppf.frames[num_frame];
-      const jxl::extras::PackedImage& pimage = pframe.color;
-      JxlPixelFormat ppixelformat = pimage.format;
-      if (JXL_ENC_SUCCESS !=
-          JxlEncoderSetFrameHeader(settings, &pframe.frame_info)) {
-        fprintf(stderr, "JxlEncoderSetFrameHeader() failed.\n");
-        return false;
-      }
-      if (!SetFrameOptions(params.options, num_frame, &option_idx, settings)) {
+// Adds frame `num_frame`, which is `pframe` or, if `chunked_frame` is set,
+// the frame that it provides, to `enc`.
+bool AddPackedFrame(const JXLCompressParams& params,
+                    const PackedPixelFile& ppf, const PackedFrame* pframe,
+                    const JxlChunkedFrameInputSource* chunked_frame,
+                    size_t num_frame, JxlEncoder* enc,
+                    JxlEncoderFrameSettings* settings, size_t* option_idx) {
+  JxlFrameHeader frame_info;
+  JxlPixelFormat ppixelformat;
+  if (chunked_frame) {
+    JxlEncoderInitFrameHeader(&frame_info);
+    chunked_frame->get_color_channels_pixel_format(chunked_frame->opaque,
+                                                   &ppixelformat);
+  } else {
+    frame_info = pframe->frame_info;
+    ppixelformat = pframe->color.format;
+  }
+  if (JXL_ENC_SUCCESS != JxlEncoderSetFrameHeader(settings, &frame_info)) {
+    fprintf(stderr, "JxlEncoderSetFrameHeader() failed.\n");
+    return false;
+  }
+  if (!SetFrameOptions(params.options, num_frame, option_idx, settings)) {
+    return false;
+  }
+  if (ppf.info.alpha_bits > 0) {
+    JxlExtraChannelInfo extra_channel_info;
+    JxlEncoderInitExtraChannelInfo(JXL_CHANNEL_ALPHA, &extra_channel_info);
+    extra_channel_info.bits_per_sample = ppf.info.alpha_bits;
+    extra_channel_info.exponent_bits_per_sample = ppf.info.alpha_exponent_bits;
+    if (params.premultiply != -1) {
+      if (params.premultiply != 0 && params.premultiply != 1) {
+        fprintf(stderr, "premultiply must be one of: -1, 0, 1.\n");
         return false;
       }
-      if (num_alpha_channels > 0) {
-        JxlExtraChannelInfo extra_channel_info;
-        JxlEncoderInitExtraChannelInfo(JXL_CHANNEL_ALPHA, &extra_channel_info);
-        extra_channel_info.bits_per_sample = ppf.info.alpha_bits;
-        extra_channel_info.exponent_bits_per_sample =
-            ppf.info.alpha_exponent_bits;
-        if (params.premultiply != -1) {
-          if (params.premultiply != 0 && params.premultiply != 1) {
-            fprintf(stderr, "premultiply must be one of: -1, 0, 1.\n");
-            return false;
-          }
-          extra_channel_info.alpha_premultiplied = params.premultiply;
-        }
-        if (JXL_ENC_SUCCESS !=
-            JxlEncoderSetExtraChannelInfo(enc, 0, &extra_channel_info)) {
-          fprintf(stderr, "JxlEncoderSetExtraChannelInfo() failed.\n");
-          return false;
-        }
-        // We take the extra channel blend info frame_info, but don't do
-        // clamping.
-        JxlBlendInfo extra_channel_blend_info =
-            pframe.frame_info.layer_info.blend_info;
-        extra_channel_blend_info.clamp = JXL_FALSE;
-        JxlEncoderSetExtraChannelBlendInfo(settings, 0,
-                                           &extra_channel_blend_info);
-      }
-      size_t num_interleaved_alpha =
-          (ppixelformat.num_channels - ppf.info.num_color_channels);
-      // Add extra channel info for the rest of the extra channels.
-      for (size_t i = 0; i < ppf.info.num_extra_channels; ++i) {
-        if (i < ppf.extra_channels_info.size()) {
-          const auto& ec_info = ppf.extra_channels_info[i].ec_info;
-          if (JXL_ENC_SUCCESS !=
-              JxlEncoderSetExtraChannelInfo(enc, num_interleaved_alpha + i,
-                                            &ec_info)) {
-            fprintf(stderr, "JxlEncoderSetExtraChannelInfo() failed.\n");
-            return false;
-          }
-        }
-      }
-      if (JXL_ENC_SUCCESS != JxlEncoderAddImageFrame(settings, &ppixelformat,
-                                                     pimage.pixels(),
-                                                     pimage.pixels_size)) {
-        fprintf(stderr, "JxlEncoderAddImageFrame() failed.\n");
+      extra_channel_info.alpha_premultiplied = params.premultiply;
+    }
+    if (JXL_ENC_SUCCESS !=
+        JxlEncoderSetExtraChannelInfo(enc, 0, &extra_channel_info)) {
+      fprintf(stderr, "JxlEncoderSetExtraChannelInfo() failed.\n");
+      return false;
+    }
+    // We take the extra channel blend info frame_info, but don't do
+    // clamping.
+    JxlBlendInfo extra_channel_blend_info = frame_info.layer_info.blend_info;
+    extra_channel_blend_info.clamp = JXL_FALSE;
+    JxlEncoderSetExtraChannelBlendInfo(settings, 0, &extra_channel_blend_info);
+  }
+  size_t num_interleaved_alpha =
+      (ppixelformat.num_channels - ppf.info.num_color_channels);
+  // Add extra channel info for the rest of the extra channels.
+  for (size_t i = 0; i < ppf.info.num_extra_channels; ++i) {
+    if (i < ppf.extra_channels_info.size()) {
+      const auto& ec_info = ppf.extra_channels_info[i].ec_info;
+      if (JXL_ENC_SUCCESS !=
+          JxlEncoderSetExtraChannelInfo(enc, num_interleaved_alpha + i,
+                                        &ec_info)) {
+        fprintf(stderr, "JxlEncoderSetExtraChannelInfo() failed.\n");
         return false;
       }
-      // Only set extra channel buffer if it is provided non-interleaved.
-      for (size_t i = 0; i < pframe.extra_channels.size(); ++i) {
-        if (JXL_ENC_SUCCESS !=
-            JxlEncoderSetExtraChannelBuffer(settings, &ppixelformat,
-                                            pframe.extra_channels[i].pixels(),
-                                            pframe.extra_channels[i].stride *
-                                                pframe.extra_channels[i].ysize,
-                                            num_interleaved_alpha + i)) {
-          fprintf(stderr, "JxlEncoderSetExtraChannelBuffer() failed.\n");
-          return false;
-        }
-      }
     }
   }
-  JxlEncoderCloseInput(enc);
-  // Reading compressed output
-  compressed->clear();
-  compressed->resize(4096);
-  uint8_t* next_out = compressed->data();
-  size_t avail_out = compressed->size() - (next_out - compressed->data());
+  if (chunked_frame) {
+    if (JXL_ENC_SUCCESS !=
+        JxlEncoderAddChunkedFrame(settings, /*is_last_frame=*/JXL_FALSE,
+                                  *chunked_frame)) {
+      fprintf(stderr, "JxlEncoderAddChunkedFrame() failed.\n");
+      return false;
+    }
+    return true;
+  }
+  const jxl::extras::PackedImage& pimage = pframe->color;
+  if (JXL_ENC_SUCCESS != JxlEncoderAddImageFrame(settings, &ppixelformat,
+                                                 pimage.pixels(),
+                                                 pimage.pixels_size)) {
+    fprintf(stderr, "JxlEncoderAddImageFrame() failed.\n");
+    return false;
+  }
+  // Only set extra channel buffer if it is provided non-interleaved. Its own
+  // format has the alignment of its rows, which may be those of a view.
+  for (size_t i = 0; i < pframe->extra_channels.size(); ++i) {
+    const jxl::extras::PackedImage& ec = pframe->extra_channels[i];
+    if (JXL_ENC_SUCCESS !=
+        JxlEncoderSetExtraChannelBuffer(settings, &ec.format, ec.pixels(),
+                                        ec.pixels_size,
+                                        num_interleaved_alpha + i)) {
+      fprintf(stderr, "JxlEncoderSetExtraChannelBuffer() failed.\n");
+      return false;
+    }
+  }
+  return true;
+}
+
+// Appends the output of `enc` to `compressed`.
+bool AppendOutput(JxlEncoder* enc, std::vector<uint8_t>* compressed) {
+  size_t offset = compressed->size();
+  compressed->resize(offset + 4096);
+  uint8_t* next_out = compressed->data() + offset;
+  size_t avail_out = compressed->size() - offset;
   JxlEncoderStatus result = JXL_ENC_NEED_MORE_OUTPUT;
   while (result == JXL_ENC_NEED_MORE_OUTPUT) {
     result = JxlEncoderProcessOutput(enc, &next_out, &avail_out);
     if (result == JXL_ENC_NEED_MORE_OUTPUT) {
-      size_t offset = next_out - compressed->data();
+      offset = next_out - compressed->data();
       compressed->resize(compressed->size() * 2);
       next_out = compressed->data() + offset;
       avail_out = compressed->size() - offset;
@@ -272,5 +322,245 @@ bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
   return true;
 }
 
+// A view of the `xsize` x `ysize` pixels of `image` at `x0`, `y0`.
+PackedImage TileView(const PackedImage& image, size_t x0, size_t y0,
+                     size_t xsize, size_t ysize) {
+  uint8_t* pixels = static_cast<uint8_t*>(image.pixels()) +
+                    y0 * image.stride + x0 * image.pixel_stride();
+  return PackedImage(xsize, ysize, image.format, pixels, image.stride);
+}
+
+void AppendBigEndian(uint64_t value, size_t num_bytes,
+                     std::vector<uint8_t>* bytes) {
+  for (size_t i = num_bytes; i > 0; --i) {
+    bytes->push_back(static_cast<uint8_t>(value >> (8 * (i - 1))));
+  }
+}
+
+// Encodes the single frame of `ppf` in tiles, see JXLCompressParams::tile_size.
+// The output of each tile is taken before the next one is added, so that the
+// encoder releases its input, and the tiles are encoded as non-last frames
+// until the input is closed with the last one.
+bool EncodeTiles(const JXLCompressParams& params, const PackedPixelFile& ppf,
+                 JxlEncoder* enc, JxlEncoderFrameSettings* settings,
+                 size_t* option_idx, std::vector<uint8_t>* compressed) {
+  const PackedFrame& frame = ppf.frames[0];
+  const size_t tile_size = params.tile_size;
+  const size_t xsize = frame.color.xsize;
+  const size_t ysize = frame.color.ysize;
+  const size_t xtiles = DivCeil(xsize, tile_size);
+  const size_t ytiles = DivCeil(ysize, tile_size);
+  std::vector<uint8_t> index;
+  AppendBigEndian(tile_size, 4, &index);
+  AppendBigEndian(xtiles * ytiles, 4, &index);
+  compressed->clear();
+  for (size_t ty = 0; ty < ytiles; ++ty) {
+    for (size_t tx = 0; tx < xtiles; ++tx) {
+      const size_t x0 = tx * tile_size;
+      const size_t y0 = ty * tile_size;
+      const size_t tile_xsize = std::min(tile_size, xsize - x0);
+      const size_t tile_ysize = std::min(tile_size, ysize - y0);
+      PackedFrame tile(TileView(frame.color, x0, y0, tile_xsize, tile_ysize));
+      for (const PackedImage& ec : frame.extra_channels) {
+        tile.extra_channels.emplace_back(
+            TileView(ec, x0, y0, tile_xsize, tile_ysize));
+      }
+      tile.frame_info = frame.frame_info;
+      JxlLayerInfo& layer_info = tile.frame_info.layer_info;
+      layer_info.have_crop = JXL_TRUE;
+      layer_info.crop_x0 = static_cast<int32_t>(x0);
+      layer_info.crop_y0 = static_cast<int32_t>(y0);
+      layer_info.xsize = tile_xsize;
+      layer_info.ysize = tile_ysize;
+      layer_info.blend_info.blendmode = JXL_BLEND_REPLACE;
+      // The options of the single frame apply to all the tiles.
+      if (!AddPackedFrame(params, ppf, &tile, /*chunked_frame=*/nullptr,
+                          /*num_frame=*/0, enc, settings, option_idx)) {
+        return false;
+      }
+      for (size_t value : {x0, y0, tile_xsize, tile_ysize}) {
+        AppendBigEndian(value, 4, &index);
+      }
+      AppendBigEndian(compressed->size(), 8, &index);
+      if (ty + 1 == ytiles && tx + 1 == xtiles) {
+        if (JXL_ENC_SUCCESS != JxlEncoderAddBox(enc, "tidx", index.data(),
+                                                index.size(),
+                                                /*compress_box=*/JXL_FALSE)) {
+          fprintf(stderr, "JxlEncoderAddBox() failed (tidx).\n");
+          return false;
+        }
+        JxlEncoderCloseBoxes(enc);
+        JxlEncoderCloseInput(enc);
+      }
+      if (!AppendOutput(enc, compressed)) return false;
+    }
+  }
+  return true;
+}
+
+// Encodes into `enc`, which must be freshly created or reset. If
+// `chunked_frame` is set, it provides the single frame instead of `ppf`.
+bool EncodeWithEncoder(const JXLCompressParams& params,
+                       const PackedPixelFile& ppf,
+                       const std::vector<uint8_t>* jpeg_bytes,
+                       const JxlChunkedFrameInputSource* chunked_frame,
+                       JxlEncoder* enc, std::vector<uint8_t>* compressed) {
+  JxlEncoderFrameSettings* settings;
+  size_t option_idx;
+  const bool tiled = UseTiles(params, ppf, jpeg_bytes, chunked_frame);
+  if (!SetUpEncoder(params, ppf, jpeg_bytes, tiled, enc, &settings,
+                    &option_idx)) {
+    return false;
+  }
+  if (tiled) {
+    return EncodeTiles(params, ppf, enc, settings, &option_idx, compressed);
+  }
+  if (!jpeg_bytes) {
+    const size_t num_frames = chunked_frame ? 1 : ppf.frames.size();
+    for (size_t num_frame = 0; num_frame < num_frames; ++num_frame) {
+      if (!AddPackedFrame(params, ppf,
+                          chunked_frame ? nullptr : &ppf.frames[num_frame],
+                          chunked_frame, num_frame, enc, settings,
+                          &option_idx)) {
+        return false;
+      }
+    }
+  }
+  JxlEncoderCloseInput(enc);
+  compressed->clear();
+  return AppendOutput(enc, compressed);
+}
+
+}  // namespace
+
+bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
+                    const std::vector<uint8_t>* jpeg_bytes,
+                    std::vector<uint8_t>* compressed) {
+  auto encoder = JxlEncoderMake(params.memory_manager);
+  return EncodeWithEncoder(params, ppf, jpeg_bytes, /*chunked_frame=*/nullptr,
+                           encoder.get(), compressed);
+}
+
+bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
+                    const JxlChunkedFrameInputSource& chunked_frame,
+                    std::vector<uint8_t>* compressed) {
+  auto encoder = JxlEncoderMake(params.memory_manager);
+  return EncodeWithEncoder(params, ppf, /*jpeg_bytes=*/nullptr, &chunked_frame,
+                           encoder.get(), compressed);
+}
+
+JXLFrameEncoder::JXLFrameEncoder(const JXLCompressParams& params,
+                                 const PackedPixelFile& ppf)
+    : params_(params),
+      ppf_(ppf),
+      encoder_(JxlEncoderMake(params.memory_manager)) {}
+
+bool JXLFrameEncoder::AddFrame(PackedFrame&& frame) {
+  if (num_frames_ == 0 &&
+      !SetUpEncoder(params_, ppf_, /*jpeg_bytes=*/nullptr, /*tiled=*/false,
+                    encoder_.get(), &settings_, &option_idx_)) {
+    return false;
+  }
+  if (!pending_.empty() &&
+      (!AddPendingFrame() || !AppendOutput(encoder_.get(), &compressed_))) {
+    return false;
+  }
+  pending_.emplace_back(std::move(frame));
+  num_frames_++;
+  return true;
+}
+
+bool JXLFrameEncoder::AddPendingFrame() {
+  const bool ok = AddPackedFrame(params_, ppf_, &pending_.back(),
+                                 /*chunked_frame=*/nullptr, num_frames_ - 1,
+                                 encoder_.get(), settings_, &option_idx_);
+  pending_.clear();
+  return ok;
+}
+
+bool JXLFrameEncoder::Finish(std::vector<uint8_t>* compressed) {
+  if (pending_.empty()) {
+    fprintf(stderr, "No frames to encode.\n");
+    return false;
+  }
+  // Only now that the input is closed is the frame encoded as the last one.
+  if (!AddPendingFrame()) return false;
+  JxlEncoderCloseInput(encoder_.get());
+  if (!AppendOutput(encoder_.get(), &compressed_)) return false;
+  compressed->swap(compressed_);
+  compressed_.clear();
+  return true;
+}
+
+size_t EncodeJPEGBatchJXL(const JXLCompressParams& params, size_t num_files,
+                          size_t num_workers, size_t max_jpeg_bytes,
+                          const JPEGBatchReadFunc& read,
+                          const JPEGBatchWriteFunc& write) {
+  return EncodeBatchJXL(
+      params, num_files, num_workers, max_jpeg_bytes,
+      [&](size_t index, PackedPixelFile* /*ppf*/,
+          std::vector<uint8_t>* jpeg_bytes) { return read(index, jpeg_bytes); },
+      write);
+}
+
+size_t EncodeBatchJXL(const JXLCompressParams& params, size_t num_files,
+                      size_t num_workers, size_t max_bytes,
+                      const BatchReadFunc& read, const BatchWriteFunc& write) {
+  num_workers = std::max<size_t>(1, std::min(num_workers, num_files));
+  SerializedRunner shared_runner;
+  shared_runner.runner = params.runner;
+  shared_runner.runner_opaque = params.runner_opaque;
+  JXLCompressParams worker_params = params;
+  if (params.runner_opaque != nullptr) {
+    worker_params.runner = &SerializedRunner::Run;
+    worker_params.runner_opaque = &shared_runner;
+  }
+  ByteBudget budget(max_bytes);
+  std::atomic<size_t> next_file{0};
+  std::atomic<size_t> num_failures{0};
+
+  const auto work = [&]() {
+    auto encoder = JxlEncoderMake(/*memory_manager=*/nullptr);
+    PackedPixelFile ppf;
+    std::vector<uint8_t> jpeg_bytes;
+    std::vector<uint8_t> compressed;
+    for (;;) {
+      const size_t i = next_file.fetch_add(1);
+      if (i >= num_files) break;
+      ppf = PackedPixelFile();
+      jpeg_bytes.clear();
+      if (!read(i, &ppf, &jpeg_bytes)) {
+        num_failures++;
+        continue;
+      }
+      const bool is_jpeg = !jpeg_bytes.empty();
+      size_t size = jpeg_bytes.size();
+      for (const PackedFrame& frame : ppf.frames) {
+        size += frame.color.pixels_size;
+        for (const PackedImage& ec : frame.extra_channels) {
+          size += ec.pixels_size;
+        }
+      }
+      budget.Acquire(size);
+      JxlEncoderResetKeepBuffers(encoder.get());
+      bool ok = EncodeWithEncoder(worker_params, ppf,
+                                  is_jpeg ? &jpeg_bytes : nullptr,
+                                  /*chunked_frame=*/nullptr, encoder.get(),
+                                  &compressed);
+      // The input is not needed anymore, release its memory before writing.
+      std::vector<uint8_t>().swap(jpeg_bytes);
+      ppf = PackedPixelFile();
+      budget.Release(size);
+      if (!ok || !write(i, compressed)) num_failures++;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_workers; i++) threads.emplace_back(work);
+  work();
+  for (std::thread& thread : threads) thread.join();
+  return num_failures.load();
+}
+
 }  // namespace extras
 }  // namespace jxl
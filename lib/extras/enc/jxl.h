@@ -7,11 +7,13 @@
 #define LIB_EXTRAS_ENC_JXL_H_
 
 #include <jxl/encode.h>
+#include <jxl/encode_cxx.h>
 #include <jxl/parallel_runner.h>
 #include <jxl/thread_parallel_runner.h>
 #include <jxl/types.h>
 #include <stdint.h>
 
+#include <functional>
 #include <vector>
 
 #include "lib/extras/packed_image.h"
@@ -41,6 +43,14 @@ struct JXLCompressParams {
   float alpha_distance = 1.0f;
   // If set to true, forces container mode.
   bool use_container = false;
+  // If set, a single frame image wider or taller than `tile_size` is encoded
+  // as one frame per tile of `tile_size` x `tile_size` pixels, in row-major
+  // order, each replacing its part of the canvas, so that the encoder only
+  // holds one tile at a time. The file then uses the container and ends with
+  // a "tidx" box listing the tiles: big-endian u32 tile size and tile count,
+  // then for each tile u32 x0, y0, xsize, ysize and the u64 file offset of its
+  // first byte.
+  size_t tile_size = 0;
   // Whether to enable/disable byte-exact jpeg reconstruction for jpeg inputs.
   bool jpeg_store_metadata = true;
   // Whether to create brob boxes.
@@ -60,6 +70,12 @@ struct JXLCompressParams {
 
   bool allow_expert_options = false;
 
+  // If set, the encoder allocates its memory with this memory manager.
+  const JxlMemoryManager* memory_manager = nullptr;
+
+  // If set, the statistics of the encoded frames are added to it.
+  JxlEncoderStats* stats = nullptr;
+
   void AddOption(JxlEncoderFrameSettingId id, int64_t val) {
     options.emplace_back(JXLOption(id, val, 0));
   }
@@ -72,6 +88,77 @@ bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
                     const std::vector<uint8_t>* jpeg_bytes,
                     std::vector<uint8_t>* compressed);
 
+// Same as EncodeImageJXL, but the pixels of the single frame are pulled from
+// `chunked_frame` with JxlEncoderAddChunkedFrame; the frames of `ppf` are
+// ignored and only its image info, color encoding, extra channel info and
+// metadata are used.
+bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
+                    const JxlChunkedFrameInputSource& chunked_frame,
+                    std::vector<uint8_t>* compressed);
+
+// Encodes the frames of an image as they are added, for example by a
+// PackedFrameCallback while the input is decoded, so that the decoded frames
+// don't all need to be in memory at the same time. Each frame is encoded when
+// the next one is added, since only then is it known not to be the last one.
+class JXLFrameEncoder {
+ public:
+  // `ppf` provides the image info, color encoding and metadata when the first
+  // frame is added, and must outlive the encoder. Its frames are ignored.
+  JXLFrameEncoder(const JXLCompressParams& params, const PackedPixelFile& ppf);
+
+  bool AddFrame(PackedFrame&& frame);
+
+  // Encodes the last frame and returns the whole file in `compressed`.
+  bool Finish(std::vector<uint8_t>* compressed);
+
+  size_t num_frames() const { return num_frames_; }
+
+ private:
+  // Passes the held back frame to the encoder.
+  bool AddPendingFrame();
+
+  const JXLCompressParams& params_;
+  const PackedPixelFile& ppf_;
+  JxlEncoderPtr encoder_;
+  JxlEncoderFrameSettings* settings_ = nullptr;
+  size_t option_idx_ = 0;
+  size_t num_frames_ = 0;
+  std::vector<PackedFrame> pending_;
+  std::vector<uint8_t> compressed_;
+};
+
+// Reads the JPEG file with the given index, returns false on failure.
+using JPEGBatchReadFunc =
+    std::function<bool(size_t index, std::vector<uint8_t>* jpeg_bytes)>;
+// Reads the input file with the given index, either into `jpeg_bytes` to
+// transcode a JPEG file losslessly, or decoded into `ppf`. Returns false on
+// failure.
+using BatchReadFunc = std::function<bool(
+    size_t index, PackedPixelFile* ppf, std::vector<uint8_t>* jpeg_bytes)>;
+// Writes the JPEG XL file with the given index, returns false on failure.
+using BatchWriteFunc =
+    std::function<bool(size_t index, const std::vector<uint8_t>& compressed)>;
+using JPEGBatchWriteFunc = BatchWriteFunc;
+
+// Losslessly transcodes `num_files` JPEG files with the settings of `params`.
+// Up to `num_workers` files are read, transcoded and written at the same time;
+// each worker reuses its encoder for all of its files, and all encoders share
+// the parallel runner of `params`. A read file is not transcoded while the
+// files being transcoded add up to more than `max_jpeg_bytes`, unless it is the
+// only one. `read` and `write` are called concurrently from several threads.
+// Returns the number of files that failed.
+size_t EncodeJPEGBatchJXL(const JXLCompressParams& params, size_t num_files,
+                          size_t num_workers, size_t max_jpeg_bytes,
+                          const JPEGBatchReadFunc& read,
+                          const JPEGBatchWriteFunc& write);
+
+// Like EncodeJPEGBatchJXL, but the inputs may also be decoded images, which
+// are encoded with the settings of `params`. `max_bytes` bounds the JPEG bytes
+// and the pixel bytes of the decoded images that are being encoded.
+size_t EncodeBatchJXL(const JXLCompressParams& params, size_t num_files,
+                      size_t num_workers, size_t max_bytes,
+                      const BatchReadFunc& read, const BatchWriteFunc& write);
+
 }  // namespace extras
 }  // namespace jxl
 
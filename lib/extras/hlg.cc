@@ -7,16 +7,33 @@
 
 #include <cmath>
 
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/extras/hlg.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+#include "lib/extras/tone_mapping-inl.h"
+#include "lib/jxl/dec_tone_mapping-inl.h"
 #include "lib/jxl/enc_color_management.h"
 
+HWY_BEFORE_NAMESPACE();
 namespace jxl {
+namespace HWY_NAMESPACE {
 
-float GetHlgGamma(const float peak_luminance, const float surround_luminance) {
-  return 1.2f * std::pow(1.111f, std::log2(peak_luminance / 1000.f)) *
-         std::pow(0.98f, std::log2(surround_luminance / 5.f));
+static constexpr float rec2020_luminances[3] = {0.2627f, 0.6780f, 0.0593f};
+
+void HlgOOTFRow(const float gamma, float* JXL_RESTRICT row_r,
+                float* JXL_RESTRICT row_g, float* JXL_RESTRICT row_b,
+                const size_t xsize) {
+  using V = decltype(Zero(HWY_FULL(float)()));
+  const HlgOOTF ootf = HlgOOTF::FromGamma(gamma, rec2020_luminances);
+  TransformRGBRow(row_r, row_g, row_b, xsize,
+                  [&](V* red, V* green, V* blue) {
+                    ootf.Apply(red, green, blue);
+                  });
 }
 
-Status HlgOOTF(ImageBundle* ib, const float gamma, ThreadPool* pool) {
+Status HlgOOTFFrame(ImageBundle* ib, const float gamma, ThreadPool* pool) {
   ColorEncoding linear_rec2020;
   linear_rec2020.SetColorSpace(ColorSpace::kRGB);
   linear_rec2020.primaries = Primaries::k2100;
@@ -27,30 +44,45 @@ Status HlgOOTF(ImageBundle* ib, const float gamma, ThreadPool* pool) {
 
   JXL_RETURN_IF_ERROR(RunOnPool(
       pool, 0, ib->ysize(), ThreadPool::NoInit,
-      [&](const int y, const int thread) {
-        float* const JXL_RESTRICT rows[3] = {ib->color()->PlaneRow(0, y),
-                                             ib->color()->PlaneRow(1, y),
-                                             ib->color()->PlaneRow(2, y)};
-        for (size_t x = 0; x < ib->xsize(); ++x) {
-          float& red = rows[0][x];
-          float& green = rows[1][x];
-          float& blue = rows[2][x];
-          const float luminance =
-              0.2627f * red + 0.6780f * green + 0.0593f * blue;
-          const float ratio = std::pow(luminance, gamma - 1);
-          if (std::isfinite(ratio)) {
-            red *= ratio;
-            green *= ratio;
-            blue *= ratio;
-          }
-        }
+      [&](const uint32_t y, size_t /* thread */) {
+        HlgOOTFRow(gamma, ib->color()->PlaneRow(0, y),
+                   ib->color()->PlaneRow(1, y), ib->color()->PlaneRow(2, y),
+                   ib->xsize());
       },
       "HlgOOTF"));
   return true;
 }
 
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jxl {
+
+namespace {
+HWY_EXPORT(HlgOOTFRow);
+HWY_EXPORT(HlgOOTFFrame);
+}  // namespace
+
+float GetHlgGamma(const float peak_luminance, const float surround_luminance) {
+  return 1.2f * std::pow(1.111f, std::log2(peak_luminance / 1000.f)) *
+         std::pow(0.98f, std::log2(surround_luminance / 5.f));
+}
+
+void HlgOOTFRow(const float gamma, float* row_r, float* row_g, float* row_b,
+                const size_t xsize) {
+  HWY_DYNAMIC_DISPATCH(HlgOOTFRow)(gamma, row_r, row_g, row_b, xsize);
+}
+
+Status HlgOOTF(ImageBundle* ib, const float gamma, ThreadPool* pool) {
+  return HWY_DYNAMIC_DISPATCH(HlgOOTFFrame)(ib, gamma, pool);
+}
+
 Status HlgInverseOOTF(ImageBundle* ib, const float gamma, ThreadPool* pool) {
   return HlgOOTF(ib, 1.f / gamma, pool);
 }
 
 }  // namespace jxl
+#endif
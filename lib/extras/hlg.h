@@ -6,6 +6,8 @@
 #ifndef LIB_EXTRAS_HLG_H_
 #define LIB_EXTRAS_HLG_H_
 
+#include <stddef.h>
+
 #include "lib/jxl/image_bundle.h"
 
 namespace jxl {
@@ -16,6 +18,12 @@ Status HlgOOTF(ImageBundle* ib, float gamma, ThreadPool* pool = nullptr);
 
 Status HlgInverseOOTF(ImageBundle* ib, float gamma, ThreadPool* pool = nullptr);
 
+// Applies the OOTF of `gamma` in place to a row of `xsize` samples of linear
+// Rec. 2020, for callers that convert images one row at a time. The rows need
+// not be aligned. Use 1 / gamma for the inverse.
+void HlgOOTFRow(float gamma, float* row_r, float* row_g, float* row_b,
+                size_t xsize);
+
 }  // namespace jxl
 
 #endif  // LIB_EXTRAS_HLG_H_
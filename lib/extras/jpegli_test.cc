@@ -22,7 +22,11 @@
 #include "lib/extras/packed_image.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/codec_in_out.h"
 #include "lib/jxl/color_encoding_internal.h"
+#include "lib/jxl/common.h"
+#include "lib/jxl/jpeg/enc_jpeg_data.h"
+#include "lib/jxl/jpeg/enc_jpeg_data_reader.h"
 #include "lib/jxl/test_image.h"
 #include "lib/jxl/test_utils.h"
 #include "lib/jxl/testing.h"
@@ -310,6 +314,68 @@ TEST(JpegliTest, JpegliSetAppData) {
   EXPECT_FALSE(EncodeJpeg(ppf_in, settings, nullptr, &compressed));
 }
 
+TEST(JpegliTest, JpegliJPEGDataFromCoefficients) {
+  const PaddedBytes compressed =
+      jxl::test::ReadTestData("jxl/flower/flower.png.im_q85_420.jpg");
+  jpeg::JPEGData expected;
+  ASSERT_TRUE(jpeg::ReadJpeg(compressed.data(), compressed.size(),
+                             jpeg::JpegReadMode::kReadAll, &expected));
+
+  std::unique_ptr<jpeg::JPEGData> jpeg_data =
+      jxl::make_unique<jpeg::JPEGData>();
+  jpeg_decompress_struct cinfo;
+  jpeg_error_mgr jerr;
+  cinfo.err = jpegli_std_error(&jerr);
+  jpegli_create_decompress(&cinfo);
+  jpegli_mem_src(&cinfo, compressed.data(), compressed.size());
+  jpegli_save_markers(&cinfo, JPEG_COM, 0xFFFF);
+  for (int i = 0; i < 16; ++i) {
+    jpegli_save_markers(&cinfo, JPEG_APP0 + i, 0xFFFF);
+  }
+  ASSERT_EQ(JPEG_REACHED_SOS, jpegli_read_header(&cinfo, TRUE));
+  jvirt_barray_ptr* coef_arrays = jpegli_read_coefficients(&cinfo);
+  ASSERT_NE(nullptr, coef_arrays);
+  EXPECT_TRUE(JPEGDataFromJpegli(&cinfo, coef_arrays, jpeg_data.get()));
+  const size_t max_h_samp_factor = cinfo.max_h_samp_factor;
+  const size_t max_v_samp_factor = cinfo.max_v_samp_factor;
+  jpegli_finish_decompress(&cinfo);
+  jpegli_destroy_decompress(&cinfo);
+
+  EXPECT_EQ(expected.width, jpeg_data->width);
+  EXPECT_EQ(expected.height, jpeg_data->height);
+  EXPECT_EQ(expected.restart_interval, jpeg_data->restart_interval);
+  EXPECT_EQ(expected.app_data, jpeg_data->app_data);
+  EXPECT_EQ(expected.com_data, jpeg_data->com_data);
+  ASSERT_EQ(expected.components.size(), jpeg_data->components.size());
+  for (size_t c = 0; c < expected.components.size(); ++c) {
+    const jpeg::JPEGComponent& a = expected.components[c];
+    const jpeg::JPEGComponent& b = jpeg_data->components[c];
+    EXPECT_EQ(a.id, b.id);
+    EXPECT_EQ(a.h_samp_factor, b.h_samp_factor);
+    EXPECT_EQ(a.v_samp_factor, b.v_samp_factor);
+    EXPECT_EQ(expected.quant[a.quant_idx].values,
+              jpeg_data->quant[b.quant_idx].values);
+    ASSERT_EQ(a.width_in_blocks, b.width_in_blocks);
+    ASSERT_EQ(a.height_in_blocks, b.height_in_blocks);
+    // Only the blocks inside the image have to match.
+    const size_t xsize_blocks = DivCeil(
+        DivCeil(expected.width * a.h_samp_factor, max_h_samp_factor), 8);
+    const size_t ysize_blocks = DivCeil(
+        DivCeil(expected.height * a.v_samp_factor, max_v_samp_factor), 8);
+    for (size_t by = 0; by < ysize_blocks; ++by) {
+      const size_t offset = by * a.width_in_blocks * kDCTBlockSize;
+      const size_t len = xsize_blocks * kDCTBlockSize;
+      EXPECT_TRUE(std::equal(a.coeffs.begin() + offset,
+                             a.coeffs.begin() + offset + len,
+                             b.coeffs.begin() + offset));
+    }
+  }
+
+  CodecInOut io;
+  EXPECT_TRUE(jpeg::SetImageFromJpegData(std::move(jpeg_data), &io));
+  EXPECT_EQ(ColorTransform::kYCbCr, io.Main().color_transform);
+}
+
 struct TestConfig {
   int num_colors;
   int passes;
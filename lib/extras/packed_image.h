@@ -18,10 +18,12 @@
 #include <string.h>
 
 #include <algorithm>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"
 
 namespace jxl {
@@ -33,6 +35,29 @@ class PackedImage {
   PackedImage(size_t xsize, size_t ysize, const JxlPixelFormat& format)
       : PackedImage(xsize, ysize, format, CalcStride(format, xsize)) {}
 
+  // Called with the pixels of a view when the image is destroyed.
+  using ReleaseFunc = std::function<void(void*)>;
+
+  // A view of the `ysize * stride` bytes at `pixels`, which are not copied.
+  // If `release` is set, it is called with `pixels` when the image is
+  // destroyed; otherwise the caller keeps them alive for as long as the image.
+  // If `format.align` does not give rows of `stride` bytes, it is replaced by
+  // `stride`, so that the functions taking the format find the rows.
+  PackedImage(size_t xsize, size_t ysize, const JxlPixelFormat& format,
+              void* pixels, size_t stride, ReleaseFunc release = nullptr)
+      : xsize(xsize),
+        ysize(ysize),
+        stride(stride),
+        format(format),
+        pixels_size(ysize * stride),
+        pixels_(pixels, release ? std::move(release) : ReleaseFunc(NoRelease)) {
+    JXL_ASSERT(stride >= xsize * pixel_stride());
+    if (CalcStride(format, xsize) != stride) {
+      this->format.align = stride;
+    }
+  }
+
+  // The copy of a view owns its pixels, which have the same stride.
   PackedImage Copy() const {
     PackedImage copy(xsize, ysize, format);
     memcpy(reinterpret_cast<uint8_t*>(copy.pixels()),
@@ -84,6 +109,8 @@ class PackedImage {
         pixels_size(ysize * stride),
         pixels_(malloc(std::max<size_t>(1, pixels_size)), free) {}
 
+  static void NoRelease(void* /*pixels*/) {}
+
   static size_t CalcStride(const JxlPixelFormat& format, size_t xsize) {
     size_t stride = xsize * (BitsPerChannel(format.data_type) *
                              format.num_channels / jxl::kBitsPerByte);
@@ -93,7 +120,7 @@ class PackedImage {
     return stride;
   }
 
-  std::unique_ptr<void, decltype(free)*> pixels_;
+  std::unique_ptr<void, ReleaseFunc> pixels_;
 };
 
 // Helper class representing a frame, as seen from the API. Animations will have
@@ -164,6 +191,12 @@ class PackedPixelFile {
   PackedPixelFile() { JxlEncoderInitBasicInfo(&info); };
 };
 
+// Receives the frames of an animation one at a time, in order, as they are
+// decoded, instead of having them all stored in PackedPixelFile::frames. When
+// it is first called, the image info, color encoding and metadata of the
+// PackedPixelFile are set. Returning an error stops the decoding.
+using PackedFrameCallback = std::function<Status(PackedFrame&& frame)>;
+
 }  // namespace extras
 }  // namespace jxl
 
@@ -264,9 +264,9 @@ Status ConvertCodecInOutToPackedPixelFile(const CodecInOut& io,
                   : ppf->info.bits_per_sample;
     packed_frame.name = frame.name;
     packed_frame.frame_info.name_length = frame.name.size();
-    // Color transform
-    ImageBundle ib = frame.Copy();
-    const ImageBundle* to_color_transform = &ib;
+    // Color transform. The frame is only read, so that it is not copied when
+    // it is already in the desired color space.
+    const ImageBundle* to_color_transform = &frame;
     ImageMetadata metadata = io.metadata.m;
     ImageBundle store(&metadata);
     const ImageBundle* transformed;
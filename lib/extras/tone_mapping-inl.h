@@ -0,0 +1,72 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Applies the vector color transforms of dec_tone_mapping-inl.h to rows of
+// any length, shared by the tone mapping and HLG tools.
+
+#if defined(LIB_EXTRAS_TONE_MAPPING_INL_H_) == defined(HWY_TARGET_TOGGLE)
+#ifdef LIB_EXTRAS_TONE_MAPPING_INL_H_
+#undef LIB_EXTRAS_TONE_MAPPING_INL_H_
+#else
+#define LIB_EXTRAS_TONE_MAPPING_INL_H_
+#endif
+
+#include <stddef.h>
+#include <string.h>
+
+#include <hwy/highway.h>
+
+#include "lib/jxl/base/compiler_specific.h"
+HWY_BEFORE_NAMESPACE();
+namespace jxl {
+namespace HWY_NAMESPACE {
+namespace {
+
+// Calls `transform(&red, &green, &blue)` on the vectors of the first `xsize`
+// pixels of the rows and stores the results in place. The rows need not be
+// aligned nor padded: the pixels after the last full vector go through a
+// zero-padded copy.
+template <class Transform>
+HWY_MAYBE_UNUSED void TransformRGBRow(float* JXL_RESTRICT row_r,
+                                      float* JXL_RESTRICT row_g,
+                                      float* JXL_RESTRICT row_b, size_t xsize,
+                                      const Transform& transform) {
+  const HWY_FULL(float) df;
+  const size_t N = Lanes(df);
+  size_t x = 0;
+  for (; x + N <= xsize; x += N) {
+    auto red = LoadU(df, row_r + x);
+    auto green = LoadU(df, row_g + x);
+    auto blue = LoadU(df, row_b + x);
+    transform(&red, &green, &blue);
+    StoreU(red, df, row_r + x);
+    StoreU(green, df, row_g + x);
+    StoreU(blue, df, row_b + x);
+  }
+  if (x == xsize) return;
+  const size_t remaining = xsize - x;
+  HWY_ALIGN float tail[3 * MaxLanes(df)] = {};
+  memcpy(tail, row_r + x, remaining * sizeof(float));
+  memcpy(tail + N, row_g + x, remaining * sizeof(float));
+  memcpy(tail + 2 * N, row_b + x, remaining * sizeof(float));
+  auto red = Load(df, tail);
+  auto green = Load(df, tail + N);
+  auto blue = Load(df, tail + 2 * N);
+  transform(&red, &green, &blue);
+  Store(red, df, tail);
+  Store(green, df, tail + N);
+  Store(blue, df, tail + 2 * N);
+  memcpy(row_r + x, tail, remaining * sizeof(float));
+  memcpy(row_g + x, tail + N, remaining * sizeof(float));
+  memcpy(row_b + x, tail + 2 * N, remaining * sizeof(float));
+}
+
+}  // namespace
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#endif  // LIB_EXTRAS_TONE_MAPPING_INL_H_
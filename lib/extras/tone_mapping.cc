@@ -10,6 +10,7 @@
 #include <hwy/foreach_target.h>
 #include <hwy/highway.h>
 
+#include "lib/extras/tone_mapping-inl.h"
 #include "lib/jxl/dec_tone_mapping-inl.h"
 #include "lib/jxl/enc_color_management.h"
 #include "lib/jxl/image_bundle.h"
@@ -20,15 +21,35 @@ namespace HWY_NAMESPACE {
 
 static constexpr float rec2020_luminances[3] = {0.2627f, 0.6780f, 0.0593f};
 
-Status ToneMapFrame(const std::pair<float, float> display_nits,
-                    ImageBundle* const ib, ThreadPool* const pool) {
+void ToneMapRow(const std::pair<float, float> source_nits,
+                const std::pair<float, float> display_nits,
+                float* JXL_RESTRICT row_r, float* JXL_RESTRICT row_g,
+                float* JXL_RESTRICT row_b, const size_t xsize) {
   // Perform tone mapping as described in Report ITU-R BT.2390-8, section 5.4
   // (pp. 23-25).
   // https://www.itu.int/pub/R-REP-BT.2390-8-2020
+  using V = decltype(Zero(HWY_FULL(float)()));
+  const Rec2408ToneMapper<HWY_FULL(float)> tone_mapper(
+      source_nits, display_nits, rec2020_luminances);
+  TransformRGBRow(row_r, row_g, row_b, xsize,
+                  [&](V* red, V* green, V* blue) {
+                    tone_mapper.ToneMap(red, green, blue);
+                  });
+}
 
-  HWY_FULL(float) df;
-  using V = decltype(Zero(df));
+void GamutMapRow(const float preserve_saturation, float* JXL_RESTRICT row_r,
+                 float* JXL_RESTRICT row_g, float* JXL_RESTRICT row_b,
+                 const size_t xsize) {
+  using V = decltype(Zero(HWY_FULL(float)()));
+  TransformRGBRow(row_r, row_g, row_b, xsize,
+                  [&](V* red, V* green, V* blue) {
+                    GamutMap(red, green, blue, rec2020_luminances,
+                             preserve_saturation);
+                  });
+}
 
+Status ToneMapFrame(const std::pair<float, float> display_nits,
+                    ImageBundle* const ib, ThreadPool* const pool) {
   ColorEncoding linear_rec2020;
   linear_rec2020.SetColorSpace(ColorSpace::kRGB);
   linear_rec2020.primaries = Primaries::k2100;
@@ -37,35 +58,21 @@ Status ToneMapFrame(const std::pair<float, float> display_nits,
   JXL_RETURN_IF_ERROR(linear_rec2020.CreateICC());
   JXL_RETURN_IF_ERROR(ib->TransformTo(linear_rec2020, GetJxlCms(), pool));
 
-  Rec2408ToneMapper<decltype(df)> tone_mapper(
-      {ib->metadata()->tone_mapping.min_nits,
-       ib->metadata()->IntensityTarget()},
-      display_nits, rec2020_luminances);
+  const std::pair<float, float> source_nits = {
+      ib->metadata()->tone_mapping.min_nits, ib->metadata()->IntensityTarget()};
 
   return RunOnPool(
       pool, 0, ib->ysize(), ThreadPool::NoInit,
       [&](const uint32_t y, size_t /* thread */) {
-        float* const JXL_RESTRICT row_r = ib->color()->PlaneRow(0, y);
-        float* const JXL_RESTRICT row_g = ib->color()->PlaneRow(1, y);
-        float* const JXL_RESTRICT row_b = ib->color()->PlaneRow(2, y);
-        for (size_t x = 0; x < ib->xsize(); x += Lanes(df)) {
-          V red = Load(df, row_r + x);
-          V green = Load(df, row_g + x);
-          V blue = Load(df, row_b + x);
-          tone_mapper.ToneMap(&red, &green, &blue);
-          Store(red, df, row_r + x);
-          Store(green, df, row_g + x);
-          Store(blue, df, row_b + x);
-        }
+        ToneMapRow(source_nits, display_nits, ib->color()->PlaneRow(0, y),
+                   ib->color()->PlaneRow(1, y), ib->color()->PlaneRow(2, y),
+                   ib->xsize());
       },
       "ToneMap");
 }
 
 Status GamutMapFrame(ImageBundle* const ib, float preserve_saturation,
                      ThreadPool* const pool) {
-  HWY_FULL(float) df;
-  using V = decltype(Zero(df));
-
   ColorEncoding linear_rec2020;
   linear_rec2020.SetColorSpace(ColorSpace::kRGB);
   linear_rec2020.primaries = Primaries::k2100;
@@ -77,19 +84,9 @@ Status GamutMapFrame(ImageBundle* const ib, float preserve_saturation,
   JXL_RETURN_IF_ERROR(RunOnPool(
       pool, 0, ib->ysize(), ThreadPool::NoInit,
       [&](const uint32_t y, size_t /* thread*/) {
-        float* const JXL_RESTRICT row_r = ib->color()->PlaneRow(0, y);
-        float* const JXL_RESTRICT row_g = ib->color()->PlaneRow(1, y);
-        float* const JXL_RESTRICT row_b = ib->color()->PlaneRow(2, y);
-        for (size_t x = 0; x < ib->xsize(); x += Lanes(df)) {
-          V red = Load(df, row_r + x);
-          V green = Load(df, row_g + x);
-          V blue = Load(df, row_b + x);
-          GamutMap(&red, &green, &blue, rec2020_luminances,
-                   preserve_saturation);
-          Store(red, df, row_r + x);
-          Store(green, df, row_g + x);
-          Store(blue, df, row_b + x);
-        }
+        GamutMapRow(preserve_saturation, ib->color()->PlaneRow(0, y),
+                    ib->color()->PlaneRow(1, y), ib->color()->PlaneRow(2, y),
+                    ib->xsize());
       },
       "GamutMap"));
 
@@ -105,10 +102,25 @@ HWY_AFTER_NAMESPACE();
 namespace jxl {
 
 namespace {
+HWY_EXPORT(ToneMapRow);
+HWY_EXPORT(GamutMapRow);
 HWY_EXPORT(ToneMapFrame);
 HWY_EXPORT(GamutMapFrame);
 }  // namespace
 
+void ToneMapRow(const std::pair<float, float> source_nits,
+                const std::pair<float, float> display_nits, float* row_r,
+                float* row_g, float* row_b, const size_t xsize) {
+  HWY_DYNAMIC_DISPATCH(ToneMapRow)
+  (source_nits, display_nits, row_r, row_g, row_b, xsize);
+}
+
+void GamutMapRow(const float preserve_saturation, float* row_r, float* row_g,
+                 float* row_b, const size_t xsize) {
+  HWY_DYNAMIC_DISPATCH(GamutMapRow)
+  (preserve_saturation, row_r, row_g, row_b, xsize);
+}
+
 Status ToneMapTo(const std::pair<float, float> display_nits,
                  CodecInOut* const io, ThreadPool* const pool) {
   const auto tone_map_frame = HWY_DYNAMIC_DISPATCH(ToneMapFrame);
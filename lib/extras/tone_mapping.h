@@ -6,6 +6,10 @@
 #ifndef LIB_EXTRAS_TONE_MAPPING_H_
 #define LIB_EXTRAS_TONE_MAPPING_H_
 
+#include <stddef.h>
+
+#include <utility>
+
 #include "lib/jxl/codec_in_out.h"
 
 namespace jxl {
@@ -25,6 +29,17 @@ Status ToneMapTo(std::pair<float, float> display_nits, CodecInOut* io,
 Status GamutMap(CodecInOut* io, float preserve_saturation,
                 ThreadPool* pool = nullptr);
 
+// Row versions of the above, for callers that convert images one row at a
+// time instead of holding a whole CodecInOut. The rows hold `xsize` samples of
+// linear Rec. 2020 and are modified in place; they need not be aligned.
+// `source_nits` is the (min, max) luminance of the input, which ToneMapTo takes
+// from the metadata.
+void ToneMapRow(std::pair<float, float> source_nits,
+                std::pair<float, float> display_nits, float* row_r,
+                float* row_g, float* row_b, size_t xsize);
+void GamutMapRow(float preserve_saturation, float* row_r, float* row_g,
+                 float* row_b, size_t xsize);
+
 }  // namespace jxl
 
 #endif  // LIB_EXTRAS_TONE_MAPPING_H_
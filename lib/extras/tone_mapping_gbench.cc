@@ -5,6 +5,7 @@
 
 #include "benchmark/benchmark.h"
 #include "lib/extras/codec.h"
+#include "lib/extras/hlg.h"
 #include "lib/extras/tone_mapping.h"
 #include "lib/jxl/enc_color_management.h"
 
@@ -37,4 +38,46 @@ static void BM_ToneMapping(benchmark::State& state) {
 }
 BENCHMARK(BM_ToneMapping);
 
+static void BM_ToneMapRow(benchmark::State& state) {
+  // An odd width so that the partial vector at the end of the rows is included.
+  Image3F color(2267, 1512);
+  FillImage(0.5f, &color);
+
+  for (auto _ : state) {
+    for (size_t y = 0; y < color.ysize(); ++y) {
+      ToneMapRow({0.1, 255}, {0.1, 100}, color.PlaneRow(0, y),
+                 color.PlaneRow(1, y), color.PlaneRow(2, y), color.xsize());
+      GamutMapRow(0.1f, color.PlaneRow(0, y), color.PlaneRow(1, y),
+                  color.PlaneRow(2, y), color.xsize());
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * color.xsize() * color.ysize());
+}
+BENCHMARK(BM_ToneMapRow);
+
+static void BM_HlgOOTF(benchmark::State& state) {
+  Image3F color(2268, 1512);
+  FillImage(0.5f, &color);
+
+  ColorEncoding linear_rec2020;
+  linear_rec2020.SetColorSpace(ColorSpace::kRGB);
+  linear_rec2020.primaries = Primaries::k2100;
+  linear_rec2020.white_point = WhitePoint::kD65;
+  linear_rec2020.tf.SetTransferFunction(TransferFunction::kLinear);
+  JXL_CHECK(linear_rec2020.CreateICC());
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    CodecInOut ootf_input;
+    ootf_input.SetFromImage(CopyImage(color), linear_rec2020);
+    state.ResumeTiming();
+
+    JXL_CHECK(HlgOOTF(&ootf_input.Main(), GetHlgGamma(1000)));
+  }
+
+  state.SetItemsProcessed(state.iterations() * color.xsize() * color.ysize());
+}
+BENCHMARK(BM_HlgOOTF);
+
 }  // namespace jxl
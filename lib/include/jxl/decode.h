@@ -106,6 +106,17 @@ JXL_EXPORT JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager);
  */
 JXL_EXPORT void JxlDecoderReset(JxlDecoder* dec);
 
+/**
+ * Re-initializes a @ref JxlDecoder instance like @ref JxlDecoderReset, but
+ * keeps the internal decoding buffers allocated, such as the per-thread group
+ * scratch buffers and the dequantization tables. Decoding a batch of similar
+ * images then avoids allocating and recomputing them for every image. Use @ref
+ * JxlDecoderReset or @ref JxlDecoderDestroy to release the buffers.
+ *
+ * @param dec instance to be re-initialized.
+ */
+JXL_EXPORT void JxlDecoderResetKeepBuffers(JxlDecoder* dec);
+
 /**
  * Deinitializes and frees @ref JxlDecoder instance.
  *
@@ -348,7 +359,8 @@ typedef enum {
  *  - @ref JxlDecoderSetKeepOrientation,
  *  - @ref JxlDecoderSetUnpremultiplyAlpha,
  *  - @ref JxlDecoderSetParallelRunner,
- *  - @ref JxlDecoderSetRenderSpotcolors, and
+ *  - @ref JxlDecoderSetRenderSpotcolors,
+ *  - @ref JxlDecoderSetFastIDCT, and
  *  - @ref JxlDecoderSubscribeEvents.
  *
  * @param dec decoder object
@@ -370,6 +382,12 @@ JXL_EXPORT void JxlDecoderRewind(JxlDecoder* dec);
  * to the file format but are not rendered as part of an animation, or are not
  * the final still frame of a still image, are not counted.
  *
+ * If the decoder has seen a frame index box ("jxli"), which is kept across
+ * @ref JxlDecoderRewind, it jumps directly to the last indexed keyframe
+ * before the frame skipped to and decodes forward from there, rather than
+ * decoding the frames that the skipped frames depend on. This requires
+ * coalescing to be enabled.
+ *
  * @param dec decoder object
  * @param amount the amount of frames to skip
  */
@@ -422,6 +440,21 @@ JXL_EXPORT JxlDecoderStatus
 JxlDecoderSetParallelRunner(JxlDecoder* dec, JxlParallelRunner parallel_runner,
                             void* parallel_runner_opaque);
 
+/**
+ * Same as @ref JxlDecoderSetParallelRunner, for a runner that also receives a
+ * @ref JxlParallelRunHints describing the tasks of each run.
+ *
+ * @param dec decoder object
+ * @param parallel_runner function pointer to runner for multithreading. It may
+ *     be NULL to use the default, single-threaded, runner.
+ * @param parallel_runner_opaque opaque pointer for parallel_runner.
+ * @return @ref JXL_DEC_SUCCESS if the runner was set, @ref JXL_DEC_ERROR
+ *     otherwise (the previous runner remains set).
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetParallelRunnerWithHints(
+    JxlDecoder* dec, JxlParallelRunnerWithHints parallel_runner,
+    void* parallel_runner_opaque);
+
 /**
  * Returns a hint indicating how many more bytes the decoder is expected to
  * need to make @ref JxlDecoderGetBasicInfo available after the next @ref
@@ -519,6 +552,21 @@ JxlDecoderSetUnpremultiplyAlpha(JxlDecoder* dec, JXL_BOOL unpremul_alpha);
 JXL_EXPORT JxlDecoderStatus
 JxlDecoderSetRenderSpotcolors(JxlDecoder* dec, JXL_BOOL render_spotcolors);
 
+/** Enables or disables the 16-bit fixed-point inverse DCT of 8x8 and 16x16
+ * blocks, on the targets that have such transforms (currently Arm NEON). It
+ * is faster than the default floating point transform, but the decoded pixels
+ * differ slightly from the ones of the reference decoder, so it is only meant
+ * for 8-bit output. By default, it is disabled.
+ *
+ * This function must be called at the beginning, before decoding is performed.
+ *
+ * @param dec decoder object
+ * @param fast_idct JXL_TRUE to enable, JXL_FALSE to disable (default).
+ * @return @ref JXL_DEC_SUCCESS if no error, @ref JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetFastIDCT(JxlDecoder* dec,
+                                                  JXL_BOOL fast_idct);
+
 /** Enables or disables coalescing of zero-duration frames. By default, frames
  * are returned with coalescing enabled, i.e. all frames have the image
  * dimensions, and are blended if needed. When coalescing is disabled, frames
@@ -535,6 +583,107 @@ JxlDecoderSetRenderSpotcolors(JxlDecoder* dec, JXL_BOOL render_spotcolors);
 JXL_EXPORT JxlDecoderStatus JxlDecoderSetCoalescing(JxlDecoder* dec,
                                                     JXL_BOOL coalescing);
 
+/** Counters of the work done by one stage of the render pipeline, which turns
+ * the decoded groups into output pixels (e.g. "EPF", "Upsample", "Patches",
+ * "Splines", "Blending", "XYB", "Write"), summed over all rendered frames.
+ */
+typedef struct {
+  /** Name of the stage, a static string. */
+  const char* name;
+  /** Number of times the stage processed a row, or a part of a row. */
+  uint64_t rows;
+  /** Total time spent in the stage, summed over all threads. */
+  uint64_t nanoseconds;
+  /** Estimate of the bytes of pixel data read and written by the stage. */
+  uint64_t bytes;
+} JxlRenderStageStats;
+
+/** Enables or disables collecting @ref JxlRenderStageStats. This is disabled
+ * by default, since it reads a clock twice for every row processed by a stage.
+ * The counters are kept until @ref JxlDecoderReset, also over @ref
+ * JxlDecoderRewind.
+ *
+ * This function must be called at the beginning, before decoding is performed.
+ *
+ * @param dec decoder object
+ * @param enabled JXL_TRUE to enable, JXL_FALSE to disable (default).
+ * @return @ref JXL_DEC_SUCCESS if no error, @ref JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetCollectRenderStats(JxlDecoder* dec,
+                                                            JXL_BOOL enabled);
+
+/** Returns the number of different render pipeline stages that processed
+ * pixels so far, for @ref JxlDecoderGetRenderStageStats. Stages with the same
+ * name in different frames are counted together.
+ *
+ * @param dec decoder object
+ * @return number of stages with counters, 0 if collecting them is disabled.
+ */
+JXL_EXPORT size_t JxlDecoderNumRenderStages(const JxlDecoder* dec);
+
+/** Outputs the counters of a render pipeline stage, see @ref
+ * JxlDecoderSetCollectRenderStats. Stages are in the order in which they
+ * first appeared in a pipeline. Counters of a frame are added once the frame
+ * is fully decoded.
+ *
+ * @param dec decoder object
+ * @param index index of the stage, less than @ref JxlDecoderNumRenderStages.
+ * @param stats output value for the counters.
+ * @return @ref JXL_DEC_SUCCESS on success, @ref JXL_DEC_ERROR if the index is
+ *     invalid.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetRenderStageStats(
+    const JxlDecoder* dec, size_t index, JxlRenderStageStats* stats);
+
+/** Counters of the features of the decoded frames that determine which decoder
+ * paths are taken, for @ref JxlDecoderGetDiagnostic. Together with the render
+ * stage counters, they tell why an image decodes slower than another of the
+ * same size.
+ */
+typedef enum {
+  /** Number of frames, including the ones that are not displayed. */
+  JXL_DEC_DIAG_NUM_FRAMES,
+  /** Number of progressive passes of the frames. */
+  JXL_DEC_DIAG_NUM_PASSES,
+  /** Number of patches and splines drawn on the frames. */
+  JXL_DEC_DIAG_NUM_PATCHES,
+  JXL_DEC_DIAG_NUM_SPLINES,
+  /** Number of modular streams, such as modular groups or the DC of VarDCT
+   * groups. */
+  JXL_DEC_DIAG_NUM_MODULAR_STREAMS,
+  /** Number of nodes of the modular MA trees. */
+  JXL_DEC_DIAG_NUM_TREE_NODES,
+  /** Number of histograms, entropy codes and entropy codes using LZ77, of the
+   * modular streams and the VarDCT coefficients. */
+  JXL_DEC_DIAG_NUM_HISTOGRAMS,
+  JXL_DEC_DIAG_NUM_ENTROPY_CODES,
+  JXL_DEC_DIAG_NUM_LZ77_CODES,
+  /** Number of modular channels decoded by each of the specialized decoding
+   * loops: MA tree with a single leaf, gradient predictor only, weighted
+   * predictor only, generic tree traversal, and generic tree traversal that
+   * also runs the weighted predictor (the slowest). */
+  JXL_DEC_DIAG_NUM_SINGLE_LEAF_CHANNELS,
+  JXL_DEC_DIAG_NUM_GRADIENT_ONLY_CHANNELS,
+  JXL_DEC_DIAG_NUM_WP_ONLY_CHANNELS,
+  JXL_DEC_DIAG_NUM_GENERIC_CHANNELS,
+  JXL_DEC_DIAG_NUM_GENERIC_WP_CHANNELS,
+  /** Number of diagnostics. */
+  JXL_DEC_NUM_DIAGNOSTICS,
+} JxlDecoderDiagnostic;
+
+/** Returns a counter of the frames decoded so far, see @ref
+ * JxlDecoderDiagnostic. The counters are always collected, they are added
+ * once a frame is fully decoded and kept until @ref JxlDecoderReset, also over
+ * @ref JxlDecoderRewind. Streams that are decoded again when more input
+ * arrives are counted again.
+ *
+ * @param dec decoder object
+ * @param key the counter to return.
+ * @return the value of the counter, 0 if the key is invalid.
+ */
+JXL_EXPORT uint64_t JxlDecoderGetDiagnostic(const JxlDecoder* dec,
+                                            JxlDecoderDiagnostic key);
+
 /**
  * Decodes JPEG XL file using the available bytes. Requires input has been
  * set with @ref JxlDecoderSetInput. After @ref JxlDecoderProcessInput, input
@@ -636,6 +785,95 @@ JXL_EXPORT size_t JxlDecoderReleaseInput(JxlDecoder* dec);
  */
 JXL_EXPORT void JxlDecoderCloseInput(JxlDecoder* dec);
 
+/**
+ * Returns the number of input bytes, starting right after the input consumed
+ * so far, that the decoder is going to skip without looking at them. This
+ * allows reading only the needed byte ranges of a file from remote storage:
+ * the file offset of the next input is the total number of bytes consumed so
+ * far (all bytes given minus those returned by @ref JxlDecoderReleaseInput),
+ * including the bytes skipped with @ref JxlDecoderSkipInput.
+ *
+ * The decoder skips the contents of boxes that are not needed for the
+ * subscribed events, and the frame sections of frames that are not decoded,
+ * for example when subscribing to @ref JXL_DEC_FRAME but not to @ref
+ * JXL_DEC_FULL_IMAGE to read all frame headers, or when skipping frames. Such
+ * a probe does not allocate any frame decoding state. With a crop region set
+ * by @ref JxlDecoderSetCropRegion, it also skips the sections of the groups
+ * that do not affect the region, once the global section of the frame is
+ * decoded and the input is released at the start of such a section.
+ *
+ * Can only be called after @ref JxlDecoderReleaseInput, typically after @ref
+ * JxlDecoderProcessInput returned @ref JXL_DEC_NEED_MORE_INPUT.
+ *
+ * @param dec decoder object
+ * @param size output value for the amount of bytes that may be skipped.
+ * @return @ref JXL_DEC_SUCCESS on success, @ref JXL_DEC_ERROR if the input
+ *     was not released.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetSkippableInput(const JxlDecoder* dec,
+                                                        uint64_t* size);
+
+/**
+ * Marks bytes following the input consumed so far as consumed without
+ * providing them, at most as many as returned by @ref
+ * JxlDecoderGetSkippableInput. The next input given with @ref
+ * JxlDecoderSetInput must start right after the skipped bytes.
+ *
+ * @param dec decoder object
+ * @param size amount of bytes to skip.
+ * @return @ref JXL_DEC_SUCCESS on success, @ref JXL_DEC_ERROR if the input
+ *     was not released or more bytes would be skipped than are skippable.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSkipInput(JxlDecoder* dec,
+                                                uint64_t size);
+
+/**
+ * Returns the number of input bytes, starting right after the input consumed
+ * so far, that the decoder needs before the next bytes it can skip, so that
+ * a reader of remote storage can request exactly these bytes next, followed
+ * by @ref JxlDecoderGetSkippableInput. Inside a frame, this is the size of
+ * the following sections that the output depends on, up to the next section
+ * that @ref JxlDecoderGetSkippableInput would allow to skip, or only the size
+ * of the next section while the decoder cannot tell yet. The result is 0 if
+ * the input is not released at the start of a section of a decoded frame,
+ * for example while reading headers, in which case the amount is unknown.
+ *
+ * Can only be called after @ref JxlDecoderReleaseInput, typically after @ref
+ * JxlDecoderProcessInput returned @ref JXL_DEC_NEED_MORE_INPUT.
+ *
+ * @param dec decoder object
+ * @param size output value for the amount of bytes needed, or 0 if unknown.
+ * @return @ref JXL_DEC_SUCCESS on success, @ref JXL_DEC_ERROR if the input
+ *     was not released.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetNeededInput(const JxlDecoder* dec,
+                                                     uint64_t* size);
+
+/**
+ * Declares that the input given with @ref JxlDecoderSetInput at the beginning
+ * of the file holds the whole file, and that its memory stays valid and
+ * unchanged until the decoder is rewound, reset or destroyed. Once @ref
+ * JxlDecoderCloseInput is called as well, the decoder reads the image data in
+ * place from that memory, also when the codestream is split over multiple
+ * "jxlp" boxes, instead of copying the parts that continue in a next box into
+ * an internal buffer. Only a single section of the codestream that itself
+ * spans two boxes is still copied.
+ *
+ * If the input is later set to a different buffer, the decoder falls back to
+ * copying. This setting is kept across @ref JxlDecoderRewind, but the input
+ * must be set again after rewinding.
+ *
+ * Must be called before starting to decode.
+ *
+ * @param dec decoder object
+ * @param persistent JXL_TRUE if the input is persistent, JXL_FALSE otherwise
+ *     (the default).
+ * @return @ref JXL_DEC_SUCCESS if the setting was applied, @ref JXL_DEC_ERROR
+ *     if decoding already started.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetPersistentInput(JxlDecoder* dec,
+                                                         JXL_BOOL persistent);
+
 /**
  * Outputs the basic image information, such as image dimensions, bit depth and
  * all other JxlBasicInfo fields, if available.
@@ -963,6 +1201,224 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderGetFrameName(const JxlDecoder* dec,
 JXL_EXPORT JxlDecoderStatus JxlDecoderGetExtraChannelBlendInfo(
     const JxlDecoder* dec, size_t index, JxlBlendInfo* blend_info);
 
+/**
+ * Restricts the image output to a rectangular region of the image. The region
+ * is given in the coordinates of the image as reported in @ref JxlBasicInfo,
+ * that is, after undoing the orientation unless @ref
+ * JxlDecoderSetKeepOrientation was enabled. Pixel buffers and callbacks then
+ * receive only the region, with its top-left corner at position (0, 0), and
+ * @ref JxlDecoderImageOutBufferSize and @ref JxlDecoderExtraChannelBufferSize
+ * return the size for the region. The decoder skips the groups of the
+ * codestream that do not affect the region when the frame allows it, so this
+ * is faster than decoding and cropping the full image. The region does not
+ * apply to the preview image and to JPEG reconstruction.
+ *
+ * Requires that the basic image information is available and that coalescing
+ * is enabled. Must be set before the image out buffer or callback of a frame,
+ * and applies to all following frames. A region with zero width and height
+ * restores the default of outputting the full image.
+ *
+ * @param dec decoder object
+ * @param x0 left edge of the region
+ * @param y0 top edge of the region
+ * @param xsize width of the region
+ * @param ysize height of the region
+ * @return @ref JXL_DEC_SUCCESS on success, @ref JXL_DEC_ERROR if the region
+ *     does not fit in the image or the settings do not allow a region.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetCropRegion(JxlDecoder* dec,
+                                                    uint32_t x0, uint32_t y0,
+                                                    uint32_t xsize,
+                                                    uint32_t ysize);
+
+/**
+ * Sets a region of the image, for example the viewport of an interactive
+ * viewer, whose groups are decoded and drawn before the others. The region
+ * is given in the same coordinates as with @ref JxlDecoderSetCropRegion, and
+ * at full resolution if the output is downsampled. When several sections
+ * are available at once, because the input was already buffered or arrived
+ * out of order, the groups of the region are scheduled first, so that an
+ * image out callback receives their pixels first; @ref JxlDecoderFlushImage
+ * also draws them first. The decoded pixels are the same as without a
+ * region. Frames with their own size or origin are not affected.
+ *
+ * Requires that the basic image information is available. Unlike the crop
+ * region, it can be changed at any time, and applies from the next sections
+ * decoded. A region with zero width and height removes the priority.
+ *
+ * @param dec decoder object
+ * @param x0 left edge of the region
+ * @param y0 top edge of the region
+ * @param xsize width of the region
+ * @param ysize height of the region
+ * @return @ref JXL_DEC_SUCCESS on success, @ref JXL_DEC_ERROR if the region
+ *     does not fit in the image or the basic info is not available yet.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetPriorityRegion(JxlDecoder* dec,
+                                                        uint32_t x0,
+                                                        uint32_t y0,
+                                                        uint32_t xsize,
+                                                        uint32_t ysize);
+
+/**
+ * Requests the image output at a reduced resolution, for example for
+ * thumbnails. Each output pixel is the average of a block of `downsampling` x
+ * `downsampling` pixels of the full resolution image, and @ref
+ * JxlDecoderImageOutBufferSize returns the size for the reduced dimensions,
+ * rounded up. When the frame allows it, the decoder does not decode the passes
+ * that only add detail beyond the requested resolution; with a factor of 8, a
+ * VarDCT image is rendered from its DC only. The preview image is not affected.
+ *
+ * Must be set before the image out buffer or callback of a frame, and is
+ * ignored if coalescing is disabled. Cannot be combined with @ref
+ * JxlDecoderSetCropRegion or with @ref JxlDecoderSetExtraChannelBuffer.
+ *
+ * @param dec decoder object
+ * @param downsampling the downsampling factor: 1 (default), 2, 4 or 8.
+ * @return @ref JXL_DEC_SUCCESS on success, @ref JXL_DEC_ERROR if the factor is
+ *     not supported or cannot be set at this time.
+ */
+JXL_EXPORT JxlDecoderStatus
+JxlDecoderSetOutputDownsampling(JxlDecoder* dec, uint32_t downsampling);
+
+/**
+ * Selects the extra channels that are needed, for images with many extra
+ * channels of which only few are used. The other extra channels are not
+ * rendered, and the decoder also skips their entropy decoding where the
+ * modular transforms of the frame allow it: extra channels are stored in
+ * order, so this is most effective when the needed extra channels come
+ * first. Extra channels that the output depends on are still decoded: the
+ * alpha channel if the pixel format has alpha, spot colors if they are
+ * rendered, and all extra channels of frames that use patches, blend with
+ * other than replace or are referenced by later frames. The extra channels
+ * that are not decoded are zero in any output that still contains them.
+ *
+ * Requires that the basic image information is available. Must be set before
+ * the image out buffer or callback of a frame, and applies to all following
+ * frames. @ref JxlDecoderSetExtraChannelBuffer can only be called for the
+ * selected extra channels.
+ *
+ * @param dec decoder object
+ * @param indices indices of the needed extra channels, or NULL to restore the
+ *     default of decoding all of them.
+ * @param num_indices number of elements of `indices`, which may be 0 to only
+ *     decode the color channels.
+ * @return @ref JXL_DEC_SUCCESS on success, @ref JXL_DEC_ERROR if an index is
+ *     out of range, an extra channel buffer was already set for a channel that
+ *     is not selected, or the selection cannot be set at this time.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetDecodedExtraChannels(
+    JxlDecoder* dec, const uint32_t* indices, size_t num_indices);
+
+/**
+ * Allows the decoder to decode up to `max_frames` frames at the same time,
+ * which helps with animations of small frames, whose groups alone cannot keep
+ * all threads of the parallel runner busy. The frames are still returned in
+ * order, with the same events as when they are decoded one by one.
+ *
+ * A series of frames is decoded concurrently only when all of it is available
+ * in the input and none of these frames is blended onto, or uses patches or DC
+ * from, an earlier frame of the series. It is also only done when coalescing
+ * is enabled, the full image is the only pixel event subscribed to, the whole
+ * image is output at full resolution and no frames are being skipped. Other
+ * frames are decoded as usual. The decoded frames are kept in memory until
+ * they are output.
+ *
+ * @param dec decoder object
+ * @param max_frames maximum number of frames decoded concurrently, 1 (the
+ *     default) to decode frames one at a time.
+ * @return @ref JXL_DEC_SUCCESS on success, @ref JXL_DEC_ERROR if
+ *     `max_frames` is 0 or decoding already started.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetParallelFrames(JxlDecoder* dec,
+                                                        uint32_t max_frames);
+
+/**
+ * Tells the decoder that the parallel runner set with @ref
+ * JxlDecoderSetParallelRunner supports nested calls, i.e. calls made from a
+ * task of a call that is still running, like JxlWorkStealingParallelRunner.
+ * The frames decoded concurrently because of @ref JxlDecoderSetParallelFrames
+ * then also decode their groups in parallel on the runner, instead of using
+ * one thread per frame. Must not be enabled for a runner that rejects nested
+ * calls, such as JxlThreadParallelRunner.
+ *
+ * @param dec decoder object
+ * @param enabled JXL_TRUE if the runner supports nested calls, JXL_FALSE (the
+ *     default) otherwise.
+ * @return @ref JXL_DEC_SUCCESS on success, @ref JXL_DEC_ERROR if decoding
+ *     already started.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetNestedParallelism(JxlDecoder* dec,
+                                                           JXL_BOOL enabled);
+
+/**
+ * Enables or disables allocating the image buffers from an arena. The arena
+ * obtains large chunks from the memory manager passed to @ref
+ * JxlDecoderCreate and hands out buffers by bumping a pointer; a chunk is
+ * reused once all its buffers are freed, typically at the end of each frame.
+ * This avoids most allocator calls, at the cost of keeping the chunks until
+ * the decoder is destroyed. Without the arena, the image buffers are allocated
+ * one by one with the memory manager. Disabled by default. Must be called
+ * before starting decoding.
+ *
+ * @param dec decoder object
+ * @param enabled JXL_TRUE to use the arena.
+ * @return @ref JXL_DEC_SUCCESS if the setting was applied, @ref JXL_DEC_ERROR
+ *     if decoding already started.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetFrameArena(JxlDecoder* dec,
+                                                    JXL_BOOL enabled);
+
+/**
+ * Enables keeping freed image buffers to reuse them for later frames, instead
+ * of giving them back to the memory manager. Consecutive frames of an
+ * animation, and images decoded after @ref JxlDecoderResetKeepBuffers, mostly
+ * need buffers of the same sizes, which are then already paged in and often
+ * in cache. Has no effect while the frame arena of @ref
+ * JxlDecoderSetFrameArena is enabled. @ref JxlDecoderReset disables it and
+ * releases the retained buffers. Disabled by default. Must be called before
+ * starting decoding.
+ *
+ * @param dec decoder object
+ * @param max_retained_bytes bound on the bytes of the buffers kept for reuse,
+ *     or 0 to disable the pool and release its buffers.
+ * @return @ref JXL_DEC_SUCCESS if the setting was applied, @ref JXL_DEC_ERROR
+ *     if decoding already started.
+ */
+JXL_EXPORT JxlDecoderStatus
+JxlDecoderSetImageBufferPool(JxlDecoder* dec, size_t max_retained_bytes);
+
+/**
+ * Enables allocating the image buffers of at least 8 MiB so that they can be
+ * backed by transparent huge pages, which reduces the TLB misses and page
+ * faults when decoding very large images. Only has an effect on Linux, and
+ * costs up to 2 MiB of padding per such buffer. Disabled by default. Must be
+ * called before starting decoding.
+ *
+ * @param dec decoder object
+ * @param enabled JXL_TRUE to use huge pages.
+ * @return @ref JXL_DEC_SUCCESS if the setting was applied, @ref JXL_DEC_ERROR
+ *     if decoding already started.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetHugePages(JxlDecoder* dec,
+                                                   JXL_BOOL enabled);
+
+/**
+ * Returns the image buffer usage of the decoder since it was created, in
+ * total or for one subsystem. Only the image buffers are accounted, which are
+ * most of the memory used when decoding large images. Can be called at any
+ * time, also while another thread is decoding.
+ *
+ * @param dec decoder object
+ * @param tag @ref JXL_MEMORY_TAG_ALL, or the subsystem to query.
+ * @param usage output, the current and peak bytes of the buffers.
+ * @return @ref JXL_DEC_SUCCESS on success, @ref JXL_DEC_ERROR if @p tag is
+ *     invalid.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetMemoryUsage(const JxlDecoder* dec,
+                                                     JxlMemoryTag tag,
+                                                     JxlMemoryUsage* usage);
+
 /**
  * Returns the minimum size in bytes of the image output pixel buffer for the
  * given format. This is the buffer for @ref JxlDecoderSetImageOutBuffer.
@@ -1133,6 +1589,152 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderSetMultithreadedImageOutCallback(
     JxlImageOutInitCallback init_callback, JxlImageOutRunCallback run_callback,
     JxlImageOutDestroyCallback destroy_callback, void* init_opaque);
 
+/**
+ * Worker callback for @ref JxlDecoderSetImageOutRectCallback.
+ *
+ * @param run_opaque user data returned by the @c init callback.
+ * @param thread_id number in `[0, num_threads)` identifying the thread of the
+ *     current invocation of the callback.
+ * @param x horizontal position of the leftmost pixels of the rectangle.
+ * @param y vertical position of the top row of the rectangle.
+ * @param xsize width of the rectangle in pixels.
+ * @param ysize height of the rectangle in pixels. The product of @c xsize and
+ *     @c ysize is at most the @c num_pixels_per_thread passed to @c init.
+ * @param stride distance in bytes between the starts of consecutive rows of
+ *     the pixel data.
+ * @param pixels pixel data of the top row, in the format passed to @ref
+ *     JxlDecoderSetImageOutRectCallback. The data pointed to remains owned by
+ *     the caller and is only guaranteed to outlive the current callback
+ *     invocation.
+ */
+typedef void (*JxlImageOutRectCallback)(void* run_opaque, size_t thread_id,
+                                        size_t x, size_t y, size_t xsize,
+                                        size_t ysize, size_t stride,
+                                        const void* pixels);
+
+/** Similar to @ref JxlDecoderSetMultithreadedImageOutCallback except that the
+ * callback receives rectangles of pixels instead of single scanlines: the
+ * consecutive rows that one thread decodes for a group are collected, up to
+ * @c max_rows of them, and passed in one call. When the orientation of the
+ * image swaps its dimensions, the rows are decoded as columns of the output,
+ * and the rectangles have up to @c max_rows columns instead. Rectangles may
+ * still have a single row, for example when only part of a group is
+ * rendered. Each pixel is visited as described for @ref
+ * JxlDecoderSetImageOutCallback.
+ *
+ * Larger values of @c max_rows mean fewer callback calls, at the cost of a
+ * per-thread buffer of @c max_rows rows; the group size, 256, collects whole
+ * strips of groups.
+ *
+ * @param dec decoder object
+ * @param format format of the pixels. Object owned by user; its contents are
+ *     copied internally.
+ * @param max_rows maximum number of rows, or columns for the transposing
+ *     orientations, of the rectangles. Must be at least 1.
+ * @param init_callback initialization callback.
+ * @param run_callback the callback function receiving rectangles of pixel
+ *     data.
+ * @param destroy_callback clean-up callback invoked after all calls to @c
+ *     run_callback.
+ * @param init_opaque optional user data passed to @c init_callback, may be
+ *     NULL.
+ * @return @ref JXL_DEC_SUCCESS on success, @ref JXL_DEC_ERROR on error, such
+ *     as @ref JxlDecoderSetImageOutBuffer having already been called.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetImageOutRectCallback(
+    JxlDecoder* dec, const JxlPixelFormat* format, size_t max_rows,
+    JxlImageOutInitCallback init_callback,
+    JxlImageOutRectCallback run_callback,
+    JxlImageOutDestroyCallback destroy_callback, void* init_opaque);
+
+/**
+ * A plane of the image output, see @ref JxlDecoderSetImageOutPlanes.
+ */
+typedef struct {
+  /** Buffer the plane is written to, owned by the caller.
+   */
+  void* buffer;
+
+  /** Size of the buffer in bytes.
+   */
+  size_t size;
+
+  /** Distance in bytes between the starts of two consecutive rows of the
+   * plane.
+   */
+  size_t stride;
+} JxlImageOutPlane;
+
+/**
+ * Layout of the planes of @ref JxlDecoderSetImageOutPlanes.
+ */
+typedef enum {
+  /** One plane per channel of the pixel format, in channel order (R, G, B,
+   * A, or gray, alpha), each at the output image dimensions.
+   */
+  JXL_PLANES_CHANNELS = 0,
+
+  /** Y'CbCr 4:2:0 with the BT.601 matrix in three planes: Y, Cb and Cr
+   * (I420).
+   */
+  JXL_PLANES_YCBCR_BT601_I420 = 1,
+
+  /** Y'CbCr 4:2:0 with the BT.709 matrix in three planes: Y, Cb and Cr
+   * (I420).
+   */
+  JXL_PLANES_YCBCR_BT709_I420 = 2,
+
+  /** Y'CbCr 4:2:0 with the BT.601 matrix in two planes: Y, and Cb and Cr
+   * interleaved (NV12).
+   */
+  JXL_PLANES_YCBCR_BT601_NV12 = 3,
+
+  /** Y'CbCr 4:2:0 with the BT.709 matrix in two planes: Y, and Cb and Cr
+   * interleaved (NV12).
+   */
+  JXL_PLANES_YCBCR_BT709_NV12 = 4,
+} JxlPlaneLayout;
+
+/**
+ * Sets planar buffers to write the full resolution image to, instead of the
+ * interleaved buffer of @ref JxlDecoderSetImageOutBuffer. The render pipeline
+ * writes each row straight to the planes, so no separate conversion pass over
+ * the image is needed. This can be set when the @ref JXL_DEC_FRAME event
+ * occurs, or when the @ref JXL_DEC_NEED_IMAGE_OUT_BUFFER event occurs, and
+ * applies only for the current frame, like @ref JxlDecoderSetImageOutBuffer.
+ *
+ * With @ref JXL_PLANES_CHANNELS, there is one plane per channel of `format`,
+ * whose samples have the data type and endianness of `format` and the
+ * dimensions of @ref JxlDecoderImageOutBufferSize; the align value of `format`
+ * is ignored.
+ *
+ * With the Y'CbCr layouts, `format` must have 3 channels and the type @ref
+ * JXL_TYPE_UINT8. The pixels, in the color space of the output (see @ref
+ * JxlDecoderSetOutputColorProfile), are converted to 8-bit limited range
+ * Y'CbCr. The Y plane has the output image dimensions, the chroma planes half
+ * of them rounded up, with each chroma sample the average of a 2x2 block of
+ * pixels. The NV12 chroma plane holds Cb, Cr pairs. These layouts require
+ * that the output does not need to be rotated or flipped back, that is,
+ * @ref JxlDecoderSetKeepOrientation or an image without orientation.
+ *
+ * Planar output cannot be combined with @ref JxlDecoderSetOutputDownsampling
+ * or @ref JxlDecoderSetParallelFrames.
+ *
+ * @param dec decoder object
+ * @param layout the layout of the planes
+ * @param format format of the pixels. Object owned by user and its contents
+ *     are copied internally.
+ * @param planes the planes. Object owned by user and its contents are copied
+ *     internally; the buffers must stay valid until the frame is decoded.
+ * @param num_planes number of planes: the number of channels of `format`,
+ *     3 for I420 or 2 for NV12.
+ * @return @ref JXL_DEC_SUCCESS on success, @ref JXL_DEC_ERROR on error, such as
+ *     a plane that is too small or an unsupported combination of settings.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetImageOutPlanes(
+    JxlDecoder* dec, JxlPlaneLayout layout, const JxlPixelFormat* format,
+    const JxlImageOutPlane* planes, size_t num_planes);
+
 /**
  * Returns the minimum size in bytes of an extra channel pixel buffer for the
  * given format. This is the buffer for @ref JxlDecoderSetExtraChannelBuffer.
@@ -1197,6 +1799,12 @@ JxlDecoderSetExtraChannelBuffer(JxlDecoder* dec, const JxlPixelFormat* format,
  * JxlDecoderReleaseJPEGBuffer, bytes that the decoder has already output
  * should not be included, only the remaining bytes output must be set.
  *
+ * For a JPEG with a single scan, the bytes are written as soon as the rows
+ * they depend on are decoded, so part of the JPEG may already be in the buffer
+ * when @ref JxlDecoderProcessInput returns @ref JXL_DEC_NEED_MORE_INPUT. The
+ * buffer may then be released to take these bytes, and must be set again
+ * before decoding continues.
+ *
  * @param dec decoder object
  * @param data pointer to next bytes to write to
  * @param size amount of bytes available starting from data
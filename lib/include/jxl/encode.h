@@ -109,6 +109,11 @@ typedef enum {
    */
   JXL_ENC_ERR_BAD_INPUT = 4,
 
+  /** Encoding was aborted by the callback set with
+   * JxlEncoderSetProgressCallback.
+   */
+  JXL_ENC_ERR_ABORTED = 5,
+
   /** The encoder doesn't (yet) support this. Either no version of libjxl
    * supports this, and the API is used incorrectly, or the libjxl version
    * should have been checked before trying to do this.
@@ -139,7 +144,15 @@ typedef enum {
 
   /** Sets the decoding speed tier for the provided options. Minimum is 0
    * (slowest to decode, best quality/density), and maximum is 4 (fastest to
-   * decode, at the cost of some quality/density). Default is 0.
+   * decode, at the cost of some quality/density). Default is 0. Each tier
+   * includes the restrictions of the lower ones:
+   *  - 1: at most one EPF iteration, fewer histograms, and modular trees that
+   *    only use the weighted predictor in lossless mode.
+   *  - 2: no EPF below distance 1.5, and modular trees that only use the
+   *    gradient predictor.
+   *  - 3: no EPF, and prefix codes instead of ANS.
+   *  - 4: no Gaborish and no DCT larger than 16x16.
+   * Only the default upsampling kernels are used at every tier.
    */
   JXL_ENC_FRAME_SETTING_DECODING_SPEED = 1,
 
@@ -327,8 +340,13 @@ typedef enum {
    * If any frames are indexed, the first frame needs to
    * be indexed, too. If the first frame is not indexed, and
    * a later frame is attempted to be indexed, JXL_ENC_ERROR will occur.
-   * If non-keyframes, i.e., frames with cropping, blending or patches are
+   * If non-keyframes, i.e., frames with cropping or blending are
    * attempted to be indexed, JXL_ENC_ERROR will occur.
+   * The frame index box is stored in the container after the last frame, so
+   * indexing a frame enables the container format, and must be requested
+   * before any output was produced when the container is not used already.
+   * Decoders use the index to seek in animations, see @ref
+   * JxlDecoderSkipFrames.
    */
   JXL_ENC_FRAME_INDEX_BOX = 31,
 
@@ -346,6 +364,123 @@ typedef enum {
    */
   JXL_ENC_FRAME_SETTING_JPEG_COMPRESS_BOXES = 33,
 
+  /** Upper bound, in bytes, for the memory the encoder should use to encode
+   * the frame. -1 = no limit (default). When the estimated working set of the
+   * frame exceeds the limit, optional passes that need full-image buffers are
+   * dropped, in this order: butteraugli quantization iterations, patch
+   * search, and part of the pixel samples used to learn modular MA trees.
+   * The frame is still encoded if its estimated working set exceeds the limit
+   * without those, so this is a best-effort bound and not a guarantee.
+   */
+  JXL_ENC_FRAME_SETTING_MEMORY_LIMIT = 34,
+
+  /** Target size, in bytes, of the encoded frame. -1 or 0 = no target
+   * (default). When set, the AC quantization of lossy VarDCT frames is scaled
+   * from the one chosen for the distance to get the largest frame that fits
+   * in the target, or a frame as small as the search allows if none fits. The
+   * heuristics of the encoder only run once, the steps of the search only
+   * quantize and entropy code the frame again, and each of them is reported
+   * to the progress callback. This has no effect on modular and JPEG
+   * recompressed frames.
+   */
+  JXL_ENC_FRAME_SETTING_TARGET_SIZE = 35,
+
+  /** Learn a separate MA tree for each modular group and store it in the
+   * group's section, instead of a single tree for the whole frame. The trees
+   * are learned in parallel and without any state shared between groups, at
+   * the cost of signaling a tree and histograms per group.
+   * -1 = default (off), 0 = off, 1 = on.
+   */
+  JXL_ENC_FRAME_SETTING_MODULAR_LOCAL_TREES = 36,
+
+  /** Reuse the block sizes, quantization field, chroma from luma map and
+   * restoration filter strengths chosen for the previous frame in the 64x64
+   * tiles of a lossy VarDCT frame whose pixels did not change, instead of
+   * analyzing these tiles again. This makes encoding animations with mostly
+   * static content, such as screen recordings, faster. Only applies to frames
+   * of the same size and distance as the previous one, and makes the frames
+   * be encoded one after the other.
+   * -1 = default (off), 0 = off, 1 = on.
+   */
+  JXL_ENC_FRAME_SETTING_TEMPORAL_REUSE = 37,
+
+  /** Crop each full-size frame of an animation that replaces the whole canvas
+   * to the rectangle of pixels that differ from the previous such frame, and
+   * blend it onto the previous frame, which the encoder saves in reference
+   * slot 1 for that. This avoids encoding the static parts of animations
+   * again. Frames with the same pixels as the frame before them are not
+   * encoded at all: their duration is added to that frame, as long as it was
+   * not encoded yet when they were added. Frames with a custom crop,
+   * blending, reference slot or name are encoded as given. Not used for
+   * multi-rate encodings, the frame index box and timecodes.
+   * -1 = default (off), 0 = off, 1 = on.
+   */
+  JXL_ENC_FRAME_SETTING_AUTO_CROP = 38,
+
+  /** Choose the expensive encoder passes from a quick analysis of the frame
+   * content, within the budget given by JXL_ENC_FRAME_SETTING_EFFORT: screen
+   * content with few colors or large flat areas gets patch detection, while
+   * photographic content skips it and keeps the butteraugli iterations and
+   * dots detection. Only changes the passes that were left at their default.
+   * -1 = default (off), 0 = off, 1 = on.
+   */
+  JXL_ENC_FRAME_SETTING_AUTO_EFFORT = 39,
+
+  /** Keep the text-like patches found in the frames in reference frame slot 3,
+   * and let the next frames use them from there: a frame whose patches were
+   * all seen before, such as the next page of a document with the same font,
+   * needs no new patch frame, and the patches of the other frames are added to
+   * those of the previous ones. The application must not use reference slot 3
+   * itself. Makes the frames be encoded one after the other, and is not used
+   * for multi-rate encodings and the frame index box.
+   * -1 = default (off), 0 = off, 1 = on.
+   */
+  JXL_ENC_FRAME_SETTING_PERSISTENT_PATCHES = 40,
+
+  /** Allocate the large image buffers of the frame so that they can be backed
+   * by transparent huge pages (on Linux; elsewhere this has no effect), and
+   * fault in the pages of the main color image on all threads of the parallel
+   * runner before filling it. This reduces the TLB misses and first-touch
+   * costs of very large images, at the cost of up to 2 MiB of padding per
+   * buffer of at least 8 MiB.
+   * -1 = default (off), 0 = off, 1 = on.
+   */
+  JXL_ENC_FRAME_SETTING_HUGE_PAGES = 41,
+
+  /** Number of threads the frame is expected to be decoded with. -1 or 0 =
+   * unknown (default). Modular frames that would have fewer groups than this
+   * use smaller groups, down to 128x128, so that the decoder can process
+   * more of them in parallel, at a small cost in size.
+   * JXL_ENC_FRAME_SETTING_MODULAR_GROUP_SIZE is then the largest group size.
+   * VarDCT frames always have 256x256 groups, so this has no effect on them.
+   */
+  JXL_ENC_FRAME_SETTING_DECODER_THREADS = 42,
+
+  /** Budget for the encoding time of the frame on a single thread, in
+   * milliseconds. The encoder estimates the time of its passes from the number
+   * of pixels, uses the slowest effort up to JXL_ENC_FRAME_SETTING_EFFORT
+   * that fits, and spends the rest of the budget on patches, MA tree learning
+   * samples and butteraugli iterations, in this order. Set a high effort to
+   * let small frames use more of the budget. The estimates are rough and the
+   * budget is not enforced during encoding; use
+   * JxlEncoderSetProgressCallback to abort encodings that take too long.
+   * -1 = default (no budget), otherwise >= 0.
+   */
+  JXL_ENC_FRAME_SETTING_TIME_BUDGET = 43,
+
+  /** Encode the frames as a live stream, such as a screen sharing session or
+   * a camera feed, so that the cost of a frame depends on its size rather than
+   * its content. Lossless frames of effort 1 reuse the predictors and entropy
+   * code statistics of a previous frame while the coded size shows that they
+   * still fit, instead of sampling every frame and looking for a palette, at a
+   * small cost in size. Lossy frames are not affected; see
+   * JXL_ENC_FRAME_SETTING_TEMPORAL_REUSE for them. Use
+   * JxlEncoderSetOutputProcessor and JxlEncoderFlushInput to get the bytes of
+   * each frame as soon as it is added.
+   * -1 = default (off), 0 = off, 1 = on.
+   */
+  JXL_ENC_FRAME_SETTING_LIVE_CAPTURE = 44,
+
   /** Enum value not to be used as an option. This value is added to force the
    * C compiler to have the enum to take a known size.
    */
@@ -376,6 +511,49 @@ JXL_EXPORT JxlEncoder* JxlEncoderCreate(const JxlMemoryManager* memory_manager);
  */
 JXL_EXPORT void JxlEncoderReset(JxlEncoder* enc);
 
+/**
+ * Re-initializes a JxlEncoder instance like JxlEncoderReset, but keeps the
+ * image buffers of the previously encoded frames allocated. The input of the
+ * next images is converted into these buffers where their dimensions are the
+ * same or smaller, which avoids allocating and page faulting new memory when
+ * encoding a batch of similar images. Use JxlEncoderReset or
+ * JxlEncoderDestroy to release the buffers.
+ *
+ * @param enc instance to be re-initialized.
+ */
+JXL_EXPORT void JxlEncoderResetKeepBuffers(JxlEncoder* enc);
+
+/**
+ * Enables keeping freed image buffers to reuse them for later frames, instead
+ * of giving them back to the memory manager. Consecutive frames of an
+ * animation, and images encoded after JxlEncoderResetKeepBuffers, mostly need
+ * buffers of the same sizes, which are then already paged in and often in
+ * cache. JxlEncoderReset disables it and releases the retained buffers.
+ * Disabled by default.
+ *
+ * @param enc encoder object.
+ * @param max_retained_bytes bound on the bytes of the buffers kept for reuse,
+ *        or 0 to disable the pool and release its buffers.
+ * @return JXL_ENC_SUCCESS.
+ */
+JXL_EXPORT JxlEncoderStatus
+JxlEncoderSetImageBufferPool(JxlEncoder* enc, size_t max_retained_bytes);
+
+/**
+ * Returns the image buffer usage of the encoder since it was created, in
+ * total or for one subsystem. Only the image buffers are accounted, which are
+ * most of the memory used when encoding large images. Can be called at any
+ * time, also while another thread is encoding.
+ *
+ * @param enc encoder object.
+ * @param tag JXL_MEMORY_TAG_ALL, or the subsystem to query.
+ * @param usage output, the current and peak bytes of the buffers.
+ * @return JXL_ENC_SUCCESS on success, JXL_ENC_ERROR if @p tag is invalid.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderGetMemoryUsage(const JxlEncoder* enc,
+                                                     JxlMemoryTag tag,
+                                                     JxlMemoryUsage* usage);
+
 /**
  * Deinitializes and frees JxlEncoder instance.
  *
@@ -410,6 +588,56 @@ JXL_EXPORT JxlEncoderStatus
 JxlEncoderSetParallelRunner(JxlEncoder* enc, JxlParallelRunner parallel_runner,
                             void* parallel_runner_opaque);
 
+/**
+ * Same as @ref JxlEncoderSetParallelRunner, for a runner that also receives a
+ * @ref JxlParallelRunHints describing the tasks of each run.
+ *
+ * @param enc encoder object.
+ * @param parallel_runner function pointer to runner for multithreading. It may
+ *        be NULL to use the default, single-threaded, runner.
+ * @param parallel_runner_opaque opaque pointer for parallel_runner.
+ * @return JXL_ENC_SUCCESS if the runner was set, JXL_ENC_ERROR
+ * otherwise (the previous runner remains set).
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetParallelRunnerWithHints(
+    JxlEncoder* enc, JxlParallelRunnerWithHints parallel_runner,
+    void* parallel_runner_opaque);
+
+/**
+ * Function type for JxlEncoderSetProgressCallback.
+ *
+ * @param opaque the pointer passed to JxlEncoderSetProgressCallback.
+ * @param frame_progress fraction in the range [0, 1] of the work done so far to
+ *        encode the current frame. Values are increasing within a frame and
+ *        restart from 0 for the next frame.
+ * @return JXL_TRUE to continue encoding, JXL_FALSE to abort it.
+ */
+typedef JXL_BOOL (*JxlEncoderProgressCallback)(void* opaque,
+                                                float frame_progress);
+
+/**
+ * Sets a callback that reports the progress of encoding frames, and that can
+ * abort the encoding. It is called between the phases of the frame encoder,
+ * such as the color transform, the AC strategy and quantization search,
+ * tokenization and histogram building, and after each group of the parallel
+ * phases. The callback may be called from the threads of the parallel runner,
+ * but never concurrently. Frames are not encoded in parallel with each other
+ * while a callback is set.
+ *
+ * Once the callback returned JXL_FALSE, the encoder stops at the next phase or
+ * group, and the function that was encoding the frame returns JXL_ENC_ERROR,
+ * with JxlEncoderGetError returning JXL_ENC_ERR_ABORTED. The encoder must then
+ * be reset or destroyed. The fast lossless mode of effort 1 is not reported
+ * and can not be aborted.
+ *
+ * @param enc encoder object.
+ * @param callback the callback, or NULL to remove a previously set one.
+ * @param opaque pointer passed to the callback.
+ * @return JXL_ENC_SUCCESS if the callback was set, JXL_ENC_ERROR otherwise.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetProgressCallback(
+    JxlEncoder* enc, JxlEncoderProgressCallback callback, void* opaque);
+
 /**
  * Get the (last) error code in case JXL_ENC_ERROR was returned.
  *
@@ -453,6 +681,106 @@ JXL_EXPORT JxlEncoderStatus JxlEncoderProcessOutput(JxlEncoder* enc,
                                                     uint8_t** next_out,
                                                     size_t* avail_out);
 
+/**
+ * Callbacks through which the encoder writes its output directly into
+ * buffers owned by the application, as an alternative to copying it out with
+ * @ref JxlEncoderProcessOutput. Set with @ref JxlEncoderSetOutputProcessor.
+ */
+typedef struct JxlEncoderOutputProcessor {
+  /** A pointer to any user-defined data or state, passed as the first
+   * argument to each of the callbacks.
+   */
+  void* opaque;
+
+  /** Requests a buffer to write output to. On input, *size is the number of
+   * bytes the encoder would like to write; on output it must be set to the
+   * actual size of the returned buffer, which may be smaller but not zero.
+   * Returning NULL aborts the encoding with an error. At most one buffer is
+   * requested at a time.
+   */
+  void* (*get_buffer)(void* opaque, size_t* size);
+
+  /** Releases the buffer that was last returned by get_buffer, of which the
+   * first written_bytes bytes now contain output. The next buffer continues
+   * the output right after these bytes.
+   */
+  void (*release_buffer)(void* opaque, size_t written_bytes);
+
+  /** Moves the output position to an absolute byte position. Optional, may be
+   * NULL if the output does not support seeking. The encoder currently
+   * writes its output strictly sequentially and does not call this.
+   */
+  void (*seek)(void* opaque, uint64_t position);
+
+  /** Informs the application that all the output before finalized_position
+   * is complete and will not be revisited, so it may for example be sent over
+   * the network or unmapped. Optional, may be NULL.
+   */
+  void (*set_finalized_position)(void* opaque, uint64_t finalized_position);
+} JxlEncoderOutputProcessor;
+
+/**
+ * Sets the output processor of the encoder. Once set, the output is written
+ * through output_processor during @ref JxlEncoderFlushInput, and @ref
+ * JxlEncoderProcessOutput may no longer be used. Must be called before any
+ * output was produced.
+ *
+ * @param enc encoder object.
+ * @param output_processor the callbacks used to write the output.
+ * @return JXL_ENC_SUCCESS on success, JXL_ENC_ERROR on error
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetOutputProcessor(
+    JxlEncoder* enc, JxlEncoderOutputProcessor output_processor);
+
+/**
+ * Encodes all the frames and boxes added so far, writing the output through
+ * the output processor set with @ref JxlEncoderSetOutputProcessor. The same
+ * rules about closing the input as for @ref JxlEncoderProcessOutput apply.
+ *
+ * @param enc encoder object.
+ * @return JXL_ENC_SUCCESS on success, JXL_ENC_ERROR on error, for example if no
+ * output processor was set.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderFlushInput(JxlEncoder* enc);
+
+/**
+ * Enables the multi-rate mode, in which the encoder writes one codestream per
+ * distance in @p distances, all from the same frames and boxes. The input of
+ * each frame is converted to the color space of the codestream only once, for
+ * all the distances. The distances replace the ones set with @ref
+ * JxlEncoderSetFrameDistance, except for lossless frames. Must be called before
+ * any frame or box is added.
+ *
+ * The first codestream is written as usual. Once it is complete, that is once
+ * the input was closed and @ref JxlEncoderProcessOutput returned
+ * JXL_ENC_SUCCESS or @ref JxlEncoderFlushInput returned, @ref
+ * JxlEncoderStartNextMultiRateOutput starts the next one. The encoder keeps the
+ * frames and boxes until the last codestream is written. The fast lossless mode
+ * of effort 1 is not used in this mode.
+ *
+ * @param enc encoder object.
+ * @param distances the distances of the codestreams, in the order in which
+ * they are written, each in the range of @ref JxlEncoderSetFrameDistance.
+ * @param num_distances number of distances, at least 1.
+ * @return JXL_ENC_SUCCESS on success, JXL_ENC_ERROR on error, for example if
+ * frames or boxes were already added.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetMultiRateDistances(
+    JxlEncoder* enc, const float* distances, size_t num_distances);
+
+/**
+ * Starts writing the codestream of the next distance set with @ref
+ * JxlEncoderSetMultiRateDistances, encoding the same frames and boxes again.
+ * The output starts over as if it was a new image, including the signature and
+ * headers, and a different output processor may be set with @ref
+ * JxlEncoderSetOutputProcessor before the next output is written.
+ *
+ * @param enc encoder object.
+ * @return JXL_ENC_SUCCESS on success, JXL_ENC_ERROR if the current codestream
+ * is not complete or if there is no next distance.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderStartNextMultiRateOutput(JxlEncoder* enc);
+
 /**
  * Sets the frame information for this frame to the encoder. This includes
  * animation information such as frame duration to store in the frame header.
@@ -573,6 +901,28 @@ JXL_EXPORT JxlEncoderStatus
 JxlEncoderAddJPEGFrame(const JxlEncoderFrameSettings* frame_settings,
                        const uint8_t* buffer, size_t size);
 
+/**
+ * Same as @ref JxlEncoderAddJPEGFrame, but the JPEG encoded bytes are given in
+ * consecutive chunks, so that the whole JPEG file does not need to be in
+ * memory. Each marker segment, and each scan of the JPEG, is parsed as soon as
+ * its last byte is given, and only the bytes of the segment or scan that is
+ * being received are buffered. The frame is added with the chunk for which
+ * is_last is JXL_TRUE. Other frames must not be added before that.
+ *
+ * @param frame_settings set of options and metadata for this frame. Also
+ * includes reference to the encoder object. The options of the frame settings
+ * given with the last chunk apply to the frame.
+ * @param buffer next bytes of the JPEG. Owned by the caller and only used
+ * during the call.
+ * @param size size of buffer in bytes, may be 0.
+ * @param is_last JXL_TRUE if this is the last chunk of the JPEG.
+ * @return JXL_ENC_SUCCESS on success, JXL_ENC_ERROR on error. After an error,
+ * the chunks given so far are discarded.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderAddJPEGFrameChunk(
+    const JxlEncoderFrameSettings* frame_settings, const uint8_t* buffer,
+    size_t size, JXL_BOOL is_last);
+
 /**
  * Sets the buffer to read pixels from for the next image to encode. Must call
  * JxlEncoderSetBasicInfo before JxlEncoderAddImageFrame.
@@ -641,6 +991,104 @@ JXL_EXPORT JxlEncoderStatus JxlEncoderAddImageFrame(
     const JxlEncoderFrameSettings* frame_settings,
     const JxlPixelFormat* pixel_format, const void* buffer, size_t size);
 
+/**
+ * Same as @ref JxlEncoderAddImageFrame, but with each channel in a separate
+ * plane instead of interleaved. pixel_format.num_channels is the number of
+ * planes, in the same order as the interleaved channels: gray, gray + alpha,
+ * RGB or RGB + alpha. Each plane holds one sample of pixel_format.data_type
+ * per pixel, and pixel_format.align is ignored. This avoids interleaving
+ * planar images only for the encoder to separate the channels again.
+ *
+ * @param frame_settings set of options and metadata for this frame. Also
+ * includes reference to the encoder object.
+ * @param pixel_format format for the samples of every plane. Object owned by
+ * the caller and its contents are copied internally.
+ * @param planes array of pixel_format.num_channels pointers to the planes.
+ * Owned by the caller and their contents are copied internally.
+ * @param strides array of pixel_format.num_channels distances in bytes
+ * between the starts of consecutive rows of each plane. Each plane must hold
+ * ysize rows, the last of which may end right after its last sample.
+ * @return JXL_ENC_SUCCESS on success, JXL_ENC_ERROR on error
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderAddImageFramePlanar(
+    const JxlEncoderFrameSettings* frame_settings,
+    const JxlPixelFormat* pixel_format, const void* const* planes,
+    const size_t* strides);
+
+/**
+ * Callbacks that provide the pixel data of a frame on demand, one rectangle at
+ * a time, instead of requiring the entire frame to be in memory at once. Used
+ * with @ref JxlEncoderAddChunkedFrame.
+ *
+ * The encoder requests rectangles that are aligned to 256x256 groups and are
+ * at most 256x256 pixels in size. Pointers returned by the data callbacks must
+ * remain valid until they are passed to release_buffer.
+ */
+typedef struct JxlChunkedFrameInputSource {
+  /** A pointer to any user-defined data or state, passed as the first
+   * argument to each of the callbacks.
+   */
+  void* opaque;
+
+  /** Gets the pixel format of the color channels. The num_channels field
+   * must be 1 (grayscale), 2 (grayscale with interleaved alpha), 3 (RGB) or
+   * 4 (RGB with interleaved alpha). The align field is ignored, the row
+   * stride is given per rectangle by get_color_channel_data_at instead.
+   */
+  void (*get_color_channels_pixel_format)(void* opaque,
+                                          JxlPixelFormat* pixel_format);
+
+  /** Returns a pointer to the color channel data of the rectangle with the
+   * given origin and size, and stores in *row_offset the distance in bytes
+   * between the start of consecutive rows of that data.
+   */
+  const void* (*get_color_channel_data_at)(void* opaque, size_t xpos,
+                                           size_t ypos, size_t xsize,
+                                           size_t ysize, size_t* row_offset);
+
+  /** Gets the pixel format of the extra channel with index ec_index. The
+   * num_channels field is ignored, extra channels always have one channel.
+   * May be NULL if all extra channels are given through interleaved alpha.
+   */
+  void (*get_extra_channel_pixel_format)(void* opaque, size_t ec_index,
+                                         JxlPixelFormat* pixel_format);
+
+  /** Same as get_color_channel_data_at, but for the extra channel with index
+   * ec_index. May be NULL if all extra channels are given through interleaved
+   * alpha.
+   */
+  const void* (*get_extra_channel_data_at)(void* opaque, size_t ec_index,
+                                           size_t xpos, size_t ypos,
+                                           size_t xsize, size_t ysize,
+                                           size_t* row_offset);
+
+  /** Releases a buffer returned by one of the data callbacks. The encoder
+   * no longer accesses the buffer after this call.
+   */
+  void (*release_buffer)(void* opaque, const void* buf);
+} JxlChunkedFrameInputSource;
+
+/**
+ * Sets the frame to encode from a chunked input source. This works like @ref
+ * JxlEncoderAddImageFrame, but the pixels, including those of all the extra
+ * channels, are pulled from chunked_frame_input in group-sized rectangles, so
+ * the application never needs to have more than one such rectangle of the
+ * frame prepared at a time.
+ *
+ * All callbacks are invoked before this function returns, and from the
+ * calling thread only.
+ *
+ * @param frame_settings set of options and metadata for this frame. Also
+ * includes reference to the encoder object.
+ * @param is_last_frame whether this is the last frame, in which case the
+ * input is closed as if by @ref JxlEncoderCloseInput.
+ * @param chunked_frame_input the callbacks that provide the pixel data.
+ * @return JXL_ENC_SUCCESS on success, JXL_ENC_ERROR on error
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderAddChunkedFrame(
+    const JxlEncoderFrameSettings* frame_settings, JXL_BOOL is_last_frame,
+    JxlChunkedFrameInputSource chunked_frame_input);
+
 /**
  * Sets the buffer to read pixels from for an extra channel at a given index.
  * The index must be smaller than the num_extra_channels in the associated
@@ -1204,6 +1652,145 @@ JXL_EXPORT void JxlColorEncodingSetToLinearSRGB(
  */
 JXL_EXPORT void JxlEncoderAllowExpertOptions(JxlEncoder* enc);
 
+/**
+ * Opaque structure that holds statistics gathered while encoding frames, such
+ * as the size of each part of the codestream and the time spent in each phase
+ * of the encoder.
+ *
+ * Allocated and initialized with JxlEncoderStatsCreate().
+ * Cleaned up and deallocated with JxlEncoderStatsDestroy().
+ */
+typedef struct JxlEncoderStatsStruct JxlEncoderStats;
+
+/**
+ * Creates an instance of JxlEncoderStats with all values set to zero.
+ *
+ * @return pointer to initialized JxlEncoderStats instance
+ */
+JXL_EXPORT JxlEncoderStats* JxlEncoderStatsCreate(void);
+
+/**
+ * Deinitializes and frees JxlEncoderStats instance.
+ *
+ * @param stats instance to be cleaned up and deallocated. No-op if stats is
+ * null pointer.
+ */
+JXL_EXPORT void JxlEncoderStatsDestroy(JxlEncoderStats* stats);
+
+/**
+ * Sets the statistics object that accumulates the statistics of the frames
+ * encoded with these frame settings. The statistics of a frame are added once
+ * it is encoded, so after the JxlEncoderProcessOutput or JxlEncoderFlushInput
+ * call that wrote it. Gathering statistics has a small cost, and frames with
+ * statistics are not encoded in parallel with each other. The frames of the
+ * fast lossless mode of effort 1 are not accounted for.
+ *
+ * @param frame_settings set of options and metadata for this frame. Also
+ * includes reference to the encoder object.
+ * @param stats object to accumulate the statistics into, or NULL to stop
+ * gathering statistics. It must outlive the encoding of the frames that use
+ * it, and must not be shared between encoders that run concurrently.
+ * @return JXL_ENC_SUCCESS if the operation was successful, JXL_ENC_ERROR
+ * otherwise.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderCollectStats(
+    JxlEncoderFrameSettings* frame_settings, JxlEncoderStats* stats);
+
+/**
+ * Data type for querying JxlEncoderStats object.
+ */
+typedef enum {
+  /** Size in bits of each part of the codestream.
+   */
+  JXL_ENC_STAT_HEADER_BITS,
+  JXL_ENC_STAT_TOC_BITS,
+  JXL_ENC_STAT_DICTIONARY_BITS,
+  JXL_ENC_STAT_SPLINES_BITS,
+  JXL_ENC_STAT_NOISE_BITS,
+  JXL_ENC_STAT_QUANT_BITS,
+  JXL_ENC_STAT_MODULAR_TREE_BITS,
+  JXL_ENC_STAT_MODULAR_GLOBAL_BITS,
+  JXL_ENC_STAT_DC_BITS,
+  JXL_ENC_STAT_MODULAR_DC_GROUP_BITS,
+  JXL_ENC_STAT_CONTROL_FIELDS_BITS,
+  JXL_ENC_STAT_COEF_ORDER_BITS,
+  JXL_ENC_STAT_AC_HISTOGRAM_BITS,
+  JXL_ENC_STAT_AC_BITS,
+  JXL_ENC_STAT_MODULAR_AC_GROUP_BITS,
+  /** Total number of histograms after clustering, over all the parts of the
+   * codestream.
+   */
+  JXL_ENC_STAT_NUM_CLUSTERED_HISTOGRAMS,
+  /** Number of nodes of the modular MA trees.
+   */
+  JXL_ENC_STAT_NUM_TREE_NODES,
+  /** Number of patches, splines and progressive passes of the frames.
+   */
+  JXL_ENC_STAT_NUM_PATCHES,
+  JXL_ENC_STAT_NUM_SPLINES,
+  JXL_ENC_STAT_NUM_PASSES,
+  /** Number of entropy codes written, and how many of them use LZ77.
+   */
+  JXL_ENC_STAT_NUM_ENTROPY_CODES,
+  JXL_ENC_STAT_NUM_LZ77_CODES,
+  /** Number of varblocks of each type of the VarDCT mode.
+   */
+  JXL_ENC_STAT_NUM_SMALL_BLOCKS,
+  JXL_ENC_STAT_NUM_DCT4X8_BLOCKS,
+  JXL_ENC_STAT_NUM_AFV_BLOCKS,
+  JXL_ENC_STAT_NUM_DCT8_BLOCKS,
+  JXL_ENC_STAT_NUM_DCT8X16_BLOCKS,
+  JXL_ENC_STAT_NUM_DCT8X32_BLOCKS,
+  JXL_ENC_STAT_NUM_DCT16_BLOCKS,
+  JXL_ENC_STAT_NUM_DCT16X32_BLOCKS,
+  JXL_ENC_STAT_NUM_DCT32_BLOCKS,
+  JXL_ENC_STAT_NUM_DCT32X64_BLOCKS,
+  JXL_ENC_STAT_NUM_DCT64_BLOCKS,
+  /** Number of iterations of the butteraugli quantization search.
+   */
+  JXL_ENC_STAT_NUM_BUTTERAUGLI_ITERS,
+  /** Wall time in microseconds spent in each phase of the frame encoder. The
+   * phases that are skipped by the chosen encoding take no time, and the time
+   * of the phases that are run in parallel is not multiplied by the number of
+   * threads.
+   */
+  JXL_ENC_STAT_COLOR_TRANSFORM_MICROSECONDS,
+  JXL_ENC_STAT_AC_STRATEGY_MICROSECONDS,
+  JXL_ENC_STAT_QUANTIZATION_MICROSECONDS,
+  JXL_ENC_STAT_TOKENIZATION_MICROSECONDS,
+  JXL_ENC_STAT_MODULAR_MICROSECONDS,
+  JXL_ENC_STAT_HISTOGRAMS_MICROSECONDS,
+  JXL_ENC_STAT_GROUPS_MICROSECONDS,
+  /** Number of frames the statistics were gathered from.
+   */
+  JXL_ENC_STAT_NUM_FRAMES,
+  /** Number of statistics keys.
+   */
+  JXL_ENC_NUM_STATS,
+} JxlEncoderStatsKey;
+
+/**
+ * Returns the value of the statistics corresponding to the given key.
+ *
+ * @param stats object that was passed to the encoder with a
+ * JxlEncoderCollectStats function
+ * @param key the particular statistics to query
+ *
+ * @return the value of the statistics
+ */
+JXL_EXPORT size_t JxlEncoderStatsGet(const JxlEncoderStats* stats,
+                                     JxlEncoderStatsKey key);
+
+/**
+ * Adds the statistics of @p other to @p stats, for instance to sum up the
+ * statistics of several encoders.
+ *
+ * @param stats object whose statistics will be changed
+ * @param other stats object whose statistics will be added to @p stats
+ */
+JXL_EXPORT void JxlEncoderStatsMerge(JxlEncoderStats* stats,
+                                     const JxlEncoderStats* other);
+
 #if defined(__cplusplus) || defined(c_plusplus)
 }
 #endif
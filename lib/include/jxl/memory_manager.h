@@ -14,6 +14,7 @@
 #define JXL_MEMORY_MANAGER_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #if defined(__cplusplus) || defined(c_plusplus)
 extern "C" {
@@ -46,7 +47,8 @@ typedef void (*jpegxl_free_func)(void* opaque, void* address);
 /**
  * Memory Manager struct.
  * These functions, when provided by the caller, will be used to handle memory
- * allocations.
+ * allocations, including the image buffers. They may be called concurrently
+ * from the threads of the parallel runner, so they must be thread-safe.
  */
 typedef struct JxlMemoryManagerStruct {
   /** The opaque pointer that will be passed as the first parameter to all the
@@ -63,6 +65,54 @@ typedef struct JxlMemoryManagerStruct {
   /* TODO(deymo): Add cache-aligned alloc/free functions here. */
 } JxlMemoryManager;
 
+/**
+ * Subsystems whose image buffer allocations are accounted separately, see
+ * @ref JxlDecoderGetMemoryUsage and @ref JxlEncoderGetMemoryUsage.
+ */
+typedef enum {
+  /** All the image buffers, the sum of all the other tags.
+   */
+  JXL_MEMORY_TAG_ALL = 0,
+
+  /** Image buffers not attributed to one of the subsystems below, such as the
+   * input and output frames and the color transforms.
+   */
+  JXL_MEMORY_TAG_OTHER = 1,
+
+  /** Buffers of the render pipeline of the decoder.
+   */
+  JXL_MEMORY_TAG_RENDER_PIPELINE = 2,
+
+  /** Channels of the modular images.
+   */
+  JXL_MEMORY_TAG_MODULAR = 3,
+
+  /** DCT coefficients of the VarDCT frames.
+   */
+  JXL_MEMORY_TAG_AC_COEFFICIENTS = 4,
+
+  /** Butteraugli comparisons of the encoder.
+   */
+  JXL_MEMORY_TAG_BUTTERAUGLI = 5,
+
+  /** Number of tags, not a valid tag.
+   */
+  JXL_MEMORY_TAG_NUM = 6,
+} JxlMemoryTag;
+
+/**
+ * Image buffer usage of one @ref JxlMemoryTag. Sizes include the alignment
+ * padding of each buffer.
+ */
+typedef struct {
+  /** Bytes currently allocated. */
+  uint64_t current_bytes;
+  /** Maximum of current_bytes so far. */
+  uint64_t peak_bytes;
+  /** Number of allocations so far. */
+  uint64_t num_allocations;
+} JxlMemoryUsage;
+
 #if defined(__cplusplus) || defined(c_plusplus)
 }
 #endif
@@ -108,7 +108,9 @@ typedef void (*JxlParallelRunFunction)(void* jpegxl_opaque, uint32_t value,
  * provided parameter will not be called from the library from either @p init or
  * @p func in the same decoder or encoder instance. However, a single decoding
  * or encoding instance may call the provided JxlParallelRunner multiple
- * times for different parts of the decoding or encoding process.
+ * times for different parts of the decoding or encoding process. The only
+ * exception is when the caller explicitly tells the decoder that the runner
+ * supports nested calls, see JxlDecoderSetNestedParallelism.
  *
  * @return 0 if the @p init call succeeded (returned 0) and no other error
  * occurred in the runner code.
@@ -120,6 +122,37 @@ typedef JxlParallelRetCode (*JxlParallelRunner)(
     void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
     JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range);
 
+/**
+ * Information about the tasks of one parallel run, that a runner may use to
+ * decide how many threads to use and how to split the tasks between them.
+ */
+typedef struct {
+  /** Estimated time taken by one task, in nanoseconds, or 0 if unknown. This
+   * is only a rough estimate for a single thread of a typical CPU.
+   */
+  uint64_t task_cost_ns;
+
+  /** Name of the part of the encoding or decoding process that does the run,
+   * for example for profiling. Never NULL, but may be empty. The string is
+   * only valid during the run.
+   */
+  const char* label;
+} JxlParallelRunHints;
+
+/**
+ * JxlParallelRunnerWithHints function type. Same as JxlParallelRunner, with
+ * an additional @p hints parameter describing the tasks. The hints don't
+ * change the requirements on the runner: it must still call @p init once and
+ * @p func once for every number in the range [start_range, end_range).
+ *
+ * @param hints information about the tasks, never NULL and only valid
+ *     during the call.
+ */
+typedef JxlParallelRetCode (*JxlParallelRunnerWithHints)(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range,
+    const JxlParallelRunHints* hints);
+
 /* The following is an example of a JxlParallelRunner that doesn't use any
  * multi-threading. Note that this implementation doesn't store any state
  * between multiple calls of the ExampleSequentialRunner function, so the
@@ -48,6 +48,15 @@ JXL_THREADS_EXPORT JxlParallelRetCode JxlResizableParallelRunner(
     void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
     JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range);
 
+/** Same as JxlResizableParallelRunner, as a JxlParallelRunnerWithHints: runs
+ * with little estimated work only wake up as many threads as the work is
+ * worth, and very small runs are done on the calling thread.
+ */
+JXL_THREADS_EXPORT JxlParallelRetCode JxlResizableParallelRunnerWithHints(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range,
+    const JxlParallelRunHints* hints);
+
 /** Creates the runner for JxlResizableParallelRunner. Use as the opaque
  * runner. The runner will execute tasks on the calling thread until
  * @ref JxlResizableParallelRunnerSetThreads is called.
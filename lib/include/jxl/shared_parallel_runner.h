@@ -0,0 +1,85 @@
+/* Copyright (c) the JPEG XL Project Authors. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/** @addtogroup libjxl_threads
+ * @{
+ * @file shared_parallel_runner.h
+ * @brief implementation using std::thread of a ::JxlParallelRunner shared by
+ * many encoder and decoder instances.
+ */
+
+/** Implementation of JxlParallelRunner that can be shared by many encoder and
+ * decoder instances running at the same time, for example in a service that
+ * handles many images concurrently. It uses a fixed number of worker threads
+ * that are re-used for every call.
+ *
+ * Each instance uses its own client, created with @ref
+ * JxlSharedParallelRunnerCreateClient, as the opaque runner. Unlike with @ref
+ * thread_parallel_runner.h, calls with different clients may overlap; the
+ * thread that makes a call runs its tasks too, and the worker threads are
+ * shared between all ongoing calls. Each client gets a share of the worker
+ * threads proportional to its weight, counted in tasks: a client with twice
+ * the weight of another gets twice as many of its tasks run by the workers
+ * while both have tasks waiting.
+ */
+
+#ifndef JXL_SHARED_PARALLEL_RUNNER_H_
+#define JXL_SHARED_PARALLEL_RUNNER_H_
+
+#include <jxl/jxl_threads_export.h>
+#include <jxl/memory_manager.h>
+#include <jxl/parallel_runner.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+/** Parallel runner internally using std::thread. Use as JxlParallelRunner,
+ * with a client created by @ref JxlSharedParallelRunnerCreateClient as the
+ * opaque runner.
+ */
+JXL_THREADS_EXPORT JxlParallelRetCode JxlSharedParallelRunner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range);
+
+/** Creates the shared runner with the given number of worker threads. If
+ * @p num_worker_threads is zero, all tasks run on the calling threads.
+ */
+JXL_THREADS_EXPORT void* JxlSharedParallelRunnerCreate(
+    const JxlMemoryManager* memory_manager, size_t num_worker_threads);
+
+/** Destroys the runner created by JxlSharedParallelRunnerCreate. All of its
+ * clients must have been destroyed before.
+ */
+JXL_THREADS_EXPORT void JxlSharedParallelRunnerDestroy(void* runner);
+
+/** Creates a client of the shared runner, to be used as the opaque runner of
+ * JxlSharedParallelRunner by one encoder or decoder instance.
+ *
+ * @param runner the runner created by JxlSharedParallelRunnerCreate.
+ * @param weight the relative share of the worker threads that this client
+ *     gets when other clients have tasks waiting too, at least 1.
+ * @return NULL if @p weight is 0, the client otherwise.
+ */
+JXL_THREADS_EXPORT void* JxlSharedParallelRunnerCreateClient(void* runner,
+                                                             uint32_t weight);
+
+/** Destroys the client created by JxlSharedParallelRunnerCreateClient. It
+ * must not be used by a JxlSharedParallelRunner call in progress.
+ */
+JXL_THREADS_EXPORT void JxlSharedParallelRunnerDestroyClient(void* client);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* JXL_SHARED_PARALLEL_RUNNER_H_ */
+
+/** @}*/
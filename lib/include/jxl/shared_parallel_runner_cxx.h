@@ -0,0 +1,74 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+/// @addtogroup libjxl_threads
+/// @{
+///
+/// @file shared_parallel_runner_cxx.h
+/// @ingroup libjxl_threads
+/// @brief C++ header-only helper for @ref shared_parallel_runner.h.
+///
+/// There's no binary library associated with the header since this is a header
+/// only library.
+
+#ifndef JXL_SHARED_PARALLEL_RUNNER_CXX_H_
+#define JXL_SHARED_PARALLEL_RUNNER_CXX_H_
+
+#include <jxl/shared_parallel_runner.h>
+
+#include <memory>
+
+#if !(defined(__cplusplus) || defined(c_plusplus))
+#error \
+    "This a C++ only header. Use jxl/shared_parallel_runner.h from C" \
+    "sources."
+#endif
+
+/// Struct to call JxlSharedParallelRunnerDestroy from the
+/// JxlSharedParallelRunnerPtr unique_ptr.
+struct JxlSharedParallelRunnerDestroyStruct {
+  /// Calls @ref JxlSharedParallelRunnerDestroy() on the passed runner.
+  void operator()(void* runner) { JxlSharedParallelRunnerDestroy(runner); }
+};
+
+/// std::unique_ptr<> type that calls JxlSharedParallelRunnerDestroy() when
+/// releasing the runner.
+typedef std::unique_ptr<void, JxlSharedParallelRunnerDestroyStruct>
+    JxlSharedParallelRunnerPtr;
+
+/// Creates an instance of the shared runner into a JxlSharedParallelRunnerPtr.
+/// See @ref JxlSharedParallelRunnerCreate for details.
+static inline JxlSharedParallelRunnerPtr JxlSharedParallelRunnerMake(
+    const JxlMemoryManager* memory_manager, size_t num_worker_threads) {
+  return JxlSharedParallelRunnerPtr(
+      JxlSharedParallelRunnerCreate(memory_manager, num_worker_threads));
+}
+
+/// Struct to call JxlSharedParallelRunnerDestroyClient from the
+/// JxlSharedParallelRunnerClientPtr unique_ptr.
+struct JxlSharedParallelRunnerDestroyClientStruct {
+  /// Calls @ref JxlSharedParallelRunnerDestroyClient() on the passed client.
+  void operator()(void* client) {
+    JxlSharedParallelRunnerDestroyClient(client);
+  }
+};
+
+/// std::unique_ptr<> type that calls JxlSharedParallelRunnerDestroyClient()
+/// when releasing the client.
+typedef std::unique_ptr<void, JxlSharedParallelRunnerDestroyClientStruct>
+    JxlSharedParallelRunnerClientPtr;
+
+/// Creates a client of the shared runner into a
+/// JxlSharedParallelRunnerClientPtr. See @ref
+/// JxlSharedParallelRunnerCreateClient for details.
+static inline JxlSharedParallelRunnerClientPtr
+JxlSharedParallelRunnerMakeClient(void* runner, uint32_t weight) {
+  return JxlSharedParallelRunnerClientPtr(
+      JxlSharedParallelRunnerCreateClient(runner, weight));
+}
+
+#endif  // JXL_SHARED_PARALLEL_RUNNER_CXX_H_
+
+/// @}
@@ -58,6 +58,24 @@ JXL_THREADS_EXPORT void* JxlThreadParallelRunnerCreate(
  */
 JXL_THREADS_EXPORT void JxlThreadParallelRunnerDestroy(void* runner_opaque);
 
+/** Pins the worker threads of the runner to the given CPUs: worker i only
+ * runs on CPU cpus[i % num_cpus]. This keeps the workers from migrating between
+ * cores and NUMA nodes, and allows keeping them on the same socket or on the
+ * same type of cores. Tasks are still handed out dynamically, so workers on
+ * faster cores run more of them. With @p num_cpus 0, the workers get back the
+ * CPU affinity they had when the runner was created. Must not be called while
+ * a JxlThreadParallelRunner call with this runner is in progress.
+ *
+ * @param runner_opaque the runner created by JxlThreadParallelRunnerCreate.
+ * @param cpus the CPU numbers, as used by the operating system.
+ * @param num_cpus the number of elements of @p cpus.
+ * @return 0 on success, @ref JXL_PARALLEL_RET_RUNNER_ERROR if setting the
+ *     affinity failed or is not supported on this platform (currently it is
+ *     only supported on Linux).
+ */
+JXL_THREADS_EXPORT JxlParallelRetCode JxlThreadParallelRunnerSetAffinity(
+    void* runner_opaque, const size_t* cpus, size_t num_cpus);
+
 /** Returns a default num_worker_threads value for
  * JxlThreadParallelRunnerCreate.
  */
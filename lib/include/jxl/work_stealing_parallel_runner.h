@@ -0,0 +1,73 @@
+/* Copyright (c) the JPEG XL Project Authors. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/** @addtogroup libjxl_threads
+ * @{
+ * @file work_stealing_parallel_runner.h
+ * @brief implementation using std::thread of a work-stealing
+ * ::JxlParallelRunner.
+ */
+
+/** Implementation of JxlParallelRunner than can be used to enable
+ * multithreading when using the JPEG XL library. This uses std::thread
+ * internally and related synchronization functions. The number of threads
+ * is fixed at construction time; the threads (including the calling thread)
+ * are re-used for every JxlWorkStealingParallelRunner call. Only one
+ * concurrent JxlWorkStealingParallelRunner call per instance is allowed at a
+ * time, except for nested calls: the tasks may call
+ * JxlWorkStealingParallelRunner again with the same runner, and idle threads
+ * help with the tasks of these calls.
+ *
+ * Compared to the implementation in @ref thread_parallel_runner.h, the range
+ * of tasks is split between the threads up front, and each thread takes
+ * chunks of decreasing size from its own part and steals half of the
+ * remaining part of another thread when it runs out of work. Idle worker
+ * threads spin for a short while before they block, and the calling thread
+ * does not wait for all of them to wake up. This makes it better suited for
+ * many short calls with small tasks, especially with many threads.
+ */
+
+#ifndef JXL_WORK_STEALING_PARALLEL_RUNNER_H_
+#define JXL_WORK_STEALING_PARALLEL_RUNNER_H_
+
+#include <jxl/jxl_threads_export.h>
+#include <jxl/memory_manager.h>
+#include <jxl/parallel_runner.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+/** Parallel runner internally using std::thread. Use as JxlParallelRunner.
+ */
+JXL_THREADS_EXPORT JxlParallelRetCode JxlWorkStealingParallelRunner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range);
+
+/** Creates the runner for JxlWorkStealingParallelRunner. Use as the opaque
+ * runner. Tasks run on @p num_threads threads: the calling thread and
+ * @p num_threads - 1 worker threads. If @p num_threads is 0 or 1, all tasks
+ * run on the calling thread.
+ */
+JXL_THREADS_EXPORT void* JxlWorkStealingParallelRunnerCreate(
+    const JxlMemoryManager* memory_manager, size_t num_threads);
+
+/** Destroys the runner created by JxlWorkStealingParallelRunnerCreate.
+ */
+JXL_THREADS_EXPORT void JxlWorkStealingParallelRunnerDestroy(
+    void* runner_opaque);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* JXL_WORK_STEALING_PARALLEL_RUNNER_H_ */
+
+/** @}*/
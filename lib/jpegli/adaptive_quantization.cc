@@ -316,8 +316,10 @@ V HfModulation(const D d, const size_t x, const size_t y,
   return MulAdd(sum, sumcoeff, out_val);
 }
 
+// Computes the blocks [bx0, bx1) of the block rows [yb0, yb0 + yblen).
 void PerBlockModulations(const float butteraugli_target,
-                         const RowBuffer<float>& input, const size_t yb0,
+                         const RowBuffer<float>& input, const size_t bx0,
+                         const size_t bx1, const size_t yb0,
                          const size_t yblen, RowBuffer<float>* aq_map) {
   static const float kAcQuant = 0.841f;
   float base_level = 0.48f * kAcQuant;
@@ -338,7 +340,7 @@ void PerBlockModulations(const float butteraugli_target,
     const size_t y = yb * 8;
     float* const JXL_RESTRICT row_out = aq_map->Row(yb);
     const HWY_CAPPED(float, 8) df;
-    for (size_t ix = 0; ix < aq_map->xsize(); ix++) {
+    for (size_t ix = bx0; ix < bx1; ix++) {
       size_t x = ix * 8;
       auto out_val = Set(df, row_out[ix]);
       out_val = ComputeMask(df, out_val);
@@ -386,12 +388,13 @@ void UpdateMin4(const V v, V& min0, V& min1, V& min2, V& min3) {
 }
 
 // Computes a linear combination of the 4 lowest values of the 3x3 neighborhood
-// of each pixel. Output is downsampled 2x.
-void FuzzyErosion(const RowBuffer<float>& pre_erosion, const size_t yb0,
-                  const size_t yblen, RowBuffer<float>* tmp,
-                  RowBuffer<float>* aq_map) {
-  int xsize_blocks = aq_map->xsize();
-  int xsize = pre_erosion.xsize();
+// of each pixel. Output is downsampled 2x. Only computes the blocks [bx0, bx1),
+// 2 * bx0 must be a multiple of the vector size.
+void FuzzyErosion(const RowBuffer<float>& pre_erosion, const size_t bx0,
+                  const size_t bx1, const size_t yb0, const size_t yblen,
+                  RowBuffer<float>* tmp, RowBuffer<float>* aq_map) {
+  const int x0 = 2 * bx0;
+  const int x1 = bx1 == aq_map->xsize() ? pre_erosion.xsize() : 2 * bx1;
   HWY_FULL(float) d;
   const auto mul0 = Set(d, 0.125f);
   const auto mul1 = Set(d, 0.075f);
@@ -403,7 +406,7 @@ void FuzzyErosion(const RowBuffer<float>& pre_erosion, const size_t yb0,
     const float* JXL_RESTRICT rowm = pre_erosion.Row(y);
     const float* JXL_RESTRICT rowb = pre_erosion.Row(y + 1);
     float* row_out = tmp->Row(y);
-    for (int x = 0; x < xsize; x += Lanes(d)) {
+    for (int x = x0; x < x1; x += Lanes(d)) {
       int xm1 = x - 1;
       int xp1 = x + 1;
       auto min0 = LoadU(d, rowm + x);
@@ -423,7 +426,7 @@ void FuzzyErosion(const RowBuffer<float>& pre_erosion, const size_t yb0,
     if (iy % 2 == 1) {
       const float* JXL_RESTRICT row_out0 = tmp->Row(y - 1);
       float* JXL_RESTRICT aq_out = aq_map->Row(yb0 + iy / 2);
-      for (int bx = 0, x = 0; bx < xsize_blocks; ++bx, x += 2) {
+      for (size_t bx = bx0, x = x0; bx < bx1; ++bx, x += 2) {
         aq_out[bx] =
             (row_out[x] + row_out[x + 1] + row_out0[x] + row_out0[x + 1]);
       }
@@ -431,10 +434,13 @@ void FuzzyErosion(const RowBuffer<float>& pre_erosion, const size_t yb0,
   }
 }
 
-void ComputePreErosion(const RowBuffer<float>& input, const size_t xsize,
-                       const size_t y0, const size_t ylen, int border,
+// Computes the pixels [x0 / 4, x1 / 4) of the rows [y0 / 4, (y0 + ylen) / 4) of
+// the pre-erosion image, without their padding. x0 and x1 must be multiples of
+// 8, and tasks running at the same time may share `diff_buffer` only if their
+// x ranges do not overlap.
+void ComputePreErosion(const RowBuffer<float>& input, const size_t x0,
+                       const size_t x1, const size_t y0, const size_t ylen,
                        float* diff_buffer, RowBuffer<float>* pre_erosion) {
-  const size_t xsize_out = xsize / 4;
   const size_t y0_out = y0 / 4;
 
   // The XYB gamma is 3.0 to be able to decode faster with two muls.
@@ -457,7 +463,7 @@ void ComputePreErosion(const RowBuffer<float>& input, const size_t xsize,
     float* JXL_RESTRICT row_out = diff_buffer;
     const auto match_gamma_offset_v = Set(df, match_gamma_offset);
     const auto quarter = Set(df, 0.25f);
-    for (size_t x = 0; x < xsize; x += Lanes(df)) {
+    for (size_t x = x0; x < x1; x += Lanes(df)) {
       const auto in = LoadU(df, row_in + x);
       const auto in_r = LoadU(df, row_in + x + 1);
       const auto in_l = LoadU(df, row_in + x - 1);
@@ -479,12 +485,11 @@ void ComputePreErosion(const RowBuffer<float>& input, const size_t xsize,
     if (iy % 4 == 3) {
       size_t y_out = y0_out + iy / 4;
       float* row_dout = pre_erosion->Row(y_out);
-      for (size_t x = 0; x < xsize_out; x++) {
+      for (size_t x = x0 / 4; x < x1 / 4; x++) {
         row_dout[x] = (row_out[x * 4] + row_out[x * 4 + 1] +
                        row_out[x * 4 + 2] + row_out[x * 4 + 3]) *
                       0.25f;
       }
-      pre_erosion->PadRow(y_out, xsize_out, border);
     }
   }
 }
@@ -507,6 +512,9 @@ namespace {
 constexpr float kDcQuantPow = 0.66f;
 static const float kDcQuant = 1.913f;
 static constexpr int kPreErosionBorder = 1;
+// Number of blocks of the iMCU row that are processed by one task. Twice this
+// must be a multiple of the vector size of FuzzyErosion.
+constexpr size_t kBlocksPerTask = 128;
 
 }  // namespace
 
@@ -549,8 +557,20 @@ void ComputeAdaptiveQuantField(j_compress_ptr cinfo) {
   if (m->next_iMCU_row + 1 == cinfo->total_iMCU_rows) {
     ylen -= 4;
   }
-  HWY_DYNAMIC_DISPATCH(ComputePreErosion)
-  (input, xsize, y0, ylen, kPreErosionBorder, m->diff_buffer, &m->pre_erosion);
+  // The iMCU row is split into strips of blocks that are processed in
+  // parallel, first for the pre-erosion, which the fuzzy erosion of the
+  // neighbouring strips reads, then for the rest.
+  const uint32_t num_tasks = DivCeil(xsize_blocks, kBlocksPerTask);
+  const auto pre_erosion_task = [&](uint32_t i) {
+    const size_t x0 = i * kBlocksPerTask * DCTSIZE;
+    const size_t x1 = std::min(x0 + kBlocksPerTask * DCTSIZE, xsize);
+    HWY_DYNAMIC_DISPATCH(ComputePreErosion)
+    (input, x0, x1, y0, ylen, m->diff_buffer, &m->pre_erosion);
+  };
+  RunOnRunner(cinfo, num_tasks, pre_erosion_task);
+  for (size_t y = y0 / 4; y < (y0 + ylen) / 4; ++y) {
+    m->pre_erosion.PadRow(y, xsize / 4, kPreErosionBorder);
+  }
   if (y0 == 0) {
     m->pre_erosion.CopyRow(-1, 0, kPreErosionBorder);
   }
@@ -558,16 +578,22 @@ void ComputeAdaptiveQuantField(j_compress_ptr cinfo) {
     size_t last_row = m->ysize_blocks * 2 - 1;
     m->pre_erosion.CopyRow(last_row + 1, last_row, kPreErosionBorder);
   }
-  HWY_DYNAMIC_DISPATCH(FuzzyErosion)
-  (m->pre_erosion, yb0, yblen, &m->fuzzy_erosion_tmp, &m->quant_field);
-  HWY_DYNAMIC_DISPATCH(PerBlockModulations)
-  (m->distance, input, yb0, yblen, &m->quant_field);
-  for (int y = 0; y < cinfo->max_v_samp_factor; ++y) {
-    float* row = m->quant_field.Row(yb0 + y);
-    for (size_t x = 0; x < xsize_blocks; ++x) {
-      row[x] = (0.6f / row[x]) - 1.0f;
+  const auto quant_field_task = [&](uint32_t i) {
+    const size_t bx0 = i * kBlocksPerTask;
+    const size_t bx1 = std::min(bx0 + kBlocksPerTask, xsize_blocks);
+    HWY_DYNAMIC_DISPATCH(FuzzyErosion)
+    (m->pre_erosion, bx0, bx1, yb0, yblen, &m->fuzzy_erosion_tmp,
+     &m->quant_field);
+    HWY_DYNAMIC_DISPATCH(PerBlockModulations)
+    (m->distance, input, bx0, bx1, yb0, yblen, &m->quant_field);
+    for (size_t y = 0; y < yblen; ++y) {
+      float* row = m->quant_field.Row(yb0 + y);
+      for (size_t x = bx0; x < bx1; ++x) {
+        row[x] = (0.6f / row[x]) - 1.0f;
+      }
     }
-  }
+  };
+  RunOnRunner(cinfo, num_tasks, quant_field_task);
 }
 
 }  // namespace jpegli
@@ -52,6 +52,13 @@ static JXL_INLINE void EmitByte(JpegBitWriter* bw, int byte) {
   if (byte == 0xFF) bw->data[bw->pos++] = 0;
 }
 
+// Writes a marker to the output, the caller must make sure that the bit writer
+// is at a byte boundary.
+static JXL_INLINE void EmitMarker(JpegBitWriter* bw, int marker) {
+  bw->data[bw->pos++] = 0xFF;
+  bw->data[bw->pos++] = marker;
+}
+
 static JXL_INLINE void DischargeBitBuffer(JpegBitWriter* bw) {
   // At this point we are ready to emit the bytes of put_buffer to the output.
   // The JPEG format requires that after every 0xff byte in the entropy
@@ -8,6 +8,7 @@
 #include <cmath>
 
 #include "lib/jpegli/bit_writer.h"
+#include "lib/jpegli/dct.h"
 #include "lib/jpegli/entropy_coding.h"
 #include "lib/jpegli/error.h"
 #include "lib/jpegli/memory_manager.h"
@@ -31,6 +32,7 @@ using hwy::HWY_NAMESPACE::AndNot;
 using hwy::HWY_NAMESPACE::Compress;
 using hwy::HWY_NAMESPACE::CountTrue;
 using hwy::HWY_NAMESPACE::Eq;
+using hwy::HWY_NAMESPACE::GatherIndex;
 using hwy::HWY_NAMESPACE::GetLane;
 using hwy::HWY_NAMESPACE::MaskFromVec;
 using hwy::HWY_NAMESPACE::Max;
@@ -163,6 +165,27 @@ JXL_INLINE void ComputeSymbols(const int num_nonzeros,
   }
 }
 
+// Replaces the symbols of the AC coefficients with the lengths of their
+// (pre-shifted) Huffman codes, the extra bits of the coefficients with the
+// codes ORed with the extra bits, and the nonzero indexes with the number of
+// sixteen zero run symbols before each coefficient.
+JXL_INLINE void LookupACCodes(const int num_nonzeros,
+                              const HuffmanCodeTable* ac_huff,
+                              int32_t* JXL_RESTRICT nonzero_idx,
+                              int32_t* JXL_RESTRICT block,
+                              int32_t* JXL_RESTRICT symbols) {
+  const auto symbol_mask = Set(di, 0xff);
+  for (int i = 0; i < num_nonzeros; i += Lanes(di)) {
+    const auto symbol = Load(di, symbols + i);
+    const auto idx = And(symbol, symbol_mask);
+    const auto depth = GatherIndex(di, ac_huff->depth, idx);
+    const auto code = GatherIndex(di, ac_huff->code, idx);
+    Store(ShiftRight<8>(symbol), di, nonzero_idx + i);
+    Store(depth, di, symbols + i);
+    Store(Or(code, Load(di, block + i)), di, block + i);
+  }
+}
+
 void WriteBlock(int32_t* JXL_RESTRICT block, int32_t* JXL_RESTRICT symbols,
                 int32_t* JXL_RESTRICT nonzero_idx, HuffmanCodeTable* dc_huff,
                 HuffmanCodeTable* ac_huff, JpegBitWriter* bw) {
@@ -171,15 +194,39 @@ void WriteBlock(int32_t* JXL_RESTRICT block, int32_t* JXL_RESTRICT symbols,
   ComputeSymbols(num_nonzeros, nonzero_idx, block, symbols);
   int symbol = symbols[0];
   WriteBits(bw, dc_huff->depth[symbol], dc_huff->code[symbol] | block[0]);
-  for (int i = 1; i < num_nonzeros; ++i) {
-    symbol = symbols[i];
-    while (symbol > 255) {
+  const bool write_eob = nonzero_idx[num_nonzeros - 1] < 1008;
+  LookupACCodes(num_nonzeros, ac_huff, nonzero_idx, block, symbols);
+  const int32_t* JXL_RESTRICT depths = symbols;
+  const int32_t* JXL_RESTRICT codes = block;
+  const int32_t* JXL_RESTRICT zero_runs = nonzero_idx;
+  int i = 1;
+  // Write the codes of two coefficients at once if neither of them is preceded
+  // by a sixteen zero run symbol. A code with its extra bits is at most 28
+  // bits long, so the two codes fit into one call of WriteBits.
+  for (; i + 1 < num_nonzeros; i += 2) {
+    if (JXL_UNLIKELY((zero_runs[i] | zero_runs[i + 1]) != 0)) {
+      for (int k = i; k < i + 2; ++k) {
+        for (int r = 0; r < zero_runs[k]; ++r) {
+          WriteBits(bw, ac_huff->depth[0xf0], ac_huff->code[0xf0]);
+        }
+        WriteBits(bw, depths[k], codes[k]);
+      }
+      continue;
+    }
+    if (depths[i] == 0 || depths[i + 1] == 0) {
+      bw->healthy = false;
+    }
+    const uint64_t bits = (static_cast<uint64_t>(codes[i]) << depths[i + 1]) |
+                          static_cast<uint32_t>(codes[i + 1]);
+    WriteBits(bw, depths[i] + depths[i + 1], bits);
+  }
+  if (i < num_nonzeros) {
+    for (int r = 0; r < zero_runs[i]; ++r) {
       WriteBits(bw, ac_huff->depth[0xf0], ac_huff->code[0xf0]);
-      symbol -= 256;
     }
-    WriteBits(bw, ac_huff->depth[symbol], ac_huff->code[symbol] | block[i]);
+    WriteBits(bw, depths[i], codes[i]);
   }
-  if (nonzero_idx[num_nonzeros - 1] < 1008) {
+  if (write_eob) {
     WriteBits(bw, ac_huff->depth[0], ac_huff->code[0]);
   }
 }
@@ -189,6 +236,11 @@ void WriteiMCURow(j_compress_ptr cinfo) {
   JpegBitWriter* bw = &m->bw;
   int xsize_mcus = DivCeil(cinfo->image_width, 8 * cinfo->max_h_samp_factor);
   int mcu_y = m->next_iMCU_row;
+  const int restart_interval = cinfo->restart_interval;
+  if (mcu_y == 0) {
+    m->restarts_to_go = restart_interval;
+    m->next_restart_marker = 0;
+  }
   float* JXL_RESTRICT dct = m->dct_buffer;
   float* JXL_RESTRICT scratch_space = m->dct_buffer + DCTSIZE2;
   int32_t* block = m->block_tmp;
@@ -206,6 +258,16 @@ void WriteiMCURow(j_compress_ptr cinfo) {
   }
   const size_t qf_stride = m->quant_field.stride();
   for (int mcu_x = 0; mcu_x < xsize_mcus; ++mcu_x) {
+    if (restart_interval > 0) {
+      if (m->restarts_to_go == 0) {
+        JumpToByteBoundary(bw);
+        EmitMarker(bw, 0xD0 + m->next_restart_marker);
+        m->next_restart_marker = (m->next_restart_marker + 1) & 0x7;
+        m->restarts_to_go = restart_interval;
+        memset(last_dc_coeff, 0, sizeof(m->last_dc_coeff));
+      }
+      --m->restarts_to_go;
+    }
     for (int c = 0; c < cinfo->num_components; ++c) {
       jpeg_component_info* comp = &cinfo->comp_info[c];
       HuffmanCodeTable* dc_huff = &m->huff_tables[comp->dc_tbl_no];
@@ -748,11 +810,6 @@ bool EncodeDRI(j_compress_ptr cinfo) {
   return true;
 }
 
-static JXL_INLINE void EmitMarker(JpegBitWriter* bw, int marker) {
-  bw->data[bw->pos++] = 0xFF;
-  bw->data[bw->pos++] = marker;
-}
-
 void ProgressMonitorEncodePass(j_compress_ptr cinfo, size_t scan_index,
                                size_t mcu_y) {
   if (cinfo->progress == nullptr) {
@@ -764,57 +821,227 @@ void ProgressMonitorEncodePass(j_compress_ptr cinfo, size_t scan_index,
   (*cinfo->progress->progress_monitor)(reinterpret_cast<j_common_ptr>(cinfo));
 }
 
-bool EncodeScan(j_compress_ptr cinfo, int scan_index) {
-  jpeg_comp_master* m = cinfo->master;
-  const int restart_interval = cinfo->restart_interval;
-  int restarts_to_go = restart_interval;
-  int next_restart_marker = 0;
+namespace {
 
-  JpegBitWriter* bw = &m->bw;
-  coeff_t last_dc_coeff[MAX_COMPS_IN_SCAN] = {0};
-  DCTCodingState coding_state;
-  DCTCodingStateInit(&coding_state);
+// Layout of the MCUs of a scan.
+struct ScanLayout {
+  const jpeg_scan_info* scan_info;
+  const ScanCodingInfo* sci;
+  bool is_interleaved;
+  int MCUs_per_row;
+  int MCU_rows;
+};
 
-  const jpeg_scan_info* scan_info = &cinfo->scan_info[scan_index];
-  const ScanCodingInfo& sci = m->scan_coding_info[scan_index];
+ScanLayout GetScanLayout(j_compress_ptr cinfo, int scan_index) {
+  ScanLayout layout;
+  layout.scan_info = &cinfo->scan_info[scan_index];
+  layout.sci = &cinfo->master->scan_coding_info[scan_index];
   // "Non-interleaved" means color data comes in separate scans, in other words
   // each scan can contain only one color component.
-  const bool is_interleaved = (scan_info->comps_in_scan > 1);
+  layout.is_interleaved = (layout.scan_info->comps_in_scan > 1);
   jpeg_component_info* base_comp =
-      &cinfo->comp_info[scan_info->component_index[0]];
+      &cinfo->comp_info[layout.scan_info->component_index[0]];
   // h_group / v_group act as numerators for converting number of blocks to
   // number of MCU. In interleaved mode it is 1, so MCU is represented with
   // max_*_samp_factor blocks. In non-interleaved mode we choose numerator to
   // be the samping factor, consequently MCU is always represented with single
   // block.
-  const int h_group = is_interleaved ? 1 : base_comp->h_samp_factor;
-  const int v_group = is_interleaved ? 1 : base_comp->v_samp_factor;
-  int MCUs_per_row =
+  const int h_group = layout.is_interleaved ? 1 : base_comp->h_samp_factor;
+  const int v_group = layout.is_interleaved ? 1 : base_comp->v_samp_factor;
+  layout.MCUs_per_row =
       DivCeil(cinfo->image_width * h_group, 8 * cinfo->max_h_samp_factor);
-  int MCU_rows =
+  layout.MCU_rows =
       DivCeil(cinfo->image_height * v_group, 8 * cinfo->max_v_samp_factor);
+  return layout;
+}
+
+// Number of blocks in one MCU of the scan.
+size_t BlocksPerMCU(j_compress_ptr cinfo, const ScanLayout& layout) {
+  size_t num_blocks = 0;
+  for (int i = 0; i < layout.scan_info->comps_in_scan; ++i) {
+    jpeg_component_info* comp =
+        &cinfo->comp_info[layout.scan_info->component_index[i]];
+    num_blocks += layout.is_interleaved
+                      ? comp->h_samp_factor * comp->v_samp_factor
+                      : 1;
+  }
+  return num_blocks;
+}
+
+void AccessMCURow(j_compress_ptr cinfo, const ScanLayout& layout, int mcu_y,
+                  JBLOCKARRAY ba[MAX_COMPS_IN_SCAN]) {
+  jpeg_comp_master* m = cinfo->master;
+  for (int i = 0; i < layout.scan_info->comps_in_scan; ++i) {
+    int comp_idx = layout.scan_info->component_index[i];
+    jpeg_component_info* comp = &cinfo->comp_info[comp_idx];
+    int n_blocks_y = layout.is_interleaved ? comp->v_samp_factor : 1;
+    int by0 = mcu_y * n_blocks_y;
+    int block_rows_left = comp->height_in_blocks - by0;
+    int max_block_rows = std::min(n_blocks_y, block_rows_left);
+    ba[i] = (*cinfo->mem->access_virt_barray)(
+        reinterpret_cast<j_common_ptr>(cinfo), m->coeff_buffers[comp_idx],
+        by0, max_block_rows, false);
+  }
+}
+
+JXL_INLINE bool EncodeMCU(j_compress_ptr cinfo, const ScanLayout& layout,
+                          JBLOCKARRAY ba[MAX_COMPS_IN_SCAN], int mcu_x,
+                          int mcu_y, DCTCodingState* coding_state,
+                          coeff_t* last_dc_coeff, JpegBitWriter* bw) {
+  jpeg_comp_master* m = cinfo->master;
+  const jpeg_scan_info* scan_info = layout.scan_info;
   const bool is_progressive = cinfo->progressive_mode;
   const int Al = scan_info->Al;
   const int Ah = scan_info->Ah;
   const int Ss = scan_info->Ss;
   const int Se = scan_info->Se;
   HWY_ALIGN constexpr coeff_t kDummyBlock[DCTSIZE2] = {0};
+  for (int i = 0; i < scan_info->comps_in_scan; ++i) {
+    int comp_idx = scan_info->component_index[i];
+    jpeg_component_info* comp = &cinfo->comp_info[comp_idx];
+    HuffmanCodeTable* dc_huff = &m->huff_tables[layout.sci->dc_tbl_idx[i]];
+    HuffmanCodeTable* ac_huff = &m->huff_tables[layout.sci->ac_tbl_idx[i]];
+    int n_blocks_y = layout.is_interleaved ? comp->v_samp_factor : 1;
+    int n_blocks_x = layout.is_interleaved ? comp->h_samp_factor : 1;
+    for (int iy = 0; iy < n_blocks_y; ++iy) {
+      for (int ix = 0; ix < n_blocks_x; ++ix) {
+        size_t block_y = mcu_y * n_blocks_y + iy;
+        size_t block_x = mcu_x * n_blocks_x + ix;
+        const coeff_t* block;
+        if (block_x >= comp->width_in_blocks ||
+            block_y >= comp->height_in_blocks) {
+          block = kDummyBlock;
+        } else {
+          block = &ba[i][iy][block_x][0];
+        }
+        bool ok;
+        if (!is_progressive) {
+          ok = EncodeDCTBlockSequential(block, dc_huff, ac_huff,
+                                        last_dc_coeff + i, bw);
+        } else if (Ah == 0) {
+          ok = EncodeDCTBlockProgressive(block, dc_huff, ac_huff, Ss, Se, Al,
+                                         coding_state, last_dc_coeff + i, bw);
+        } else {
+          ok = EncodeRefinementBits(block, ac_huff, Ss, Se, Al, coding_state,
+                                    bw);
+        }
+        if (!ok) return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Minimum number of MCUs encoded by one task of EncodeScanParallel.
+constexpr int kMinMCUsPerTask = 1024;
+
+// Encodes a scan with restart markers by encoding groups of consecutive
+// restart intervals on the parallel runner, each group into its own buffer,
+// and then writing the buffers in order. Since the entropy coder state is
+// reset at each restart marker, the output is the same as that of the
+// sequential encoder.
+bool EncodeScanParallel(j_compress_ptr cinfo, int scan_index,
+                        const ScanLayout& layout) {
+  const int restart_interval = cinfo->restart_interval;
+  const int num_MCUs = layout.MCUs_per_row * layout.MCU_rows;
+  const int num_intervals = DivCeil(num_MCUs, restart_interval);
+  const int intervals_per_task =
+      std::max(1, std::min(num_intervals, kMinMCUsPerTask / restart_interval));
+  const int num_tasks = DivCeil(num_intervals, intervals_per_task);
+  // Free space that is needed in the buffer before encoding an MCU: the worst
+  // case size of the MCU, plus room for flushing the buffered refinement bits
+  // at the end of the interval.
+  const size_t max_MCU_bytes =
+      BlocksPerMCU(cinfo, layout) * (DCTSIZE2 * 16 + 8) + (1 << 16);
+  std::vector<std::vector<uint8_t>> outputs(num_tasks);
+  std::vector<char> ok(num_tasks, 0);
+  const auto encode_task = [&](uint32_t task) {
+    std::vector<uint8_t>& output = outputs[task];
+    JpegBitWriter bw;
+    bw.cinfo = cinfo;
+    bw.data = nullptr;
+    bw.len = 0;
+    bw.pos = 0;
+    bw.output_pos = 0;
+    bw.put_buffer = 0;
+    bw.free_bits = 64;
+    bw.healthy = true;
+    DCTCodingState coding_state;
+    DCTCodingStateInit(&coding_state);
+    coeff_t last_dc_coeff[MAX_COMPS_IN_SCAN];
+    JBLOCKARRAY ba[MAX_COMPS_IN_SCAN];
+    const int interval_begin = task * intervals_per_task;
+    const int interval_end =
+        std::min(num_intervals, interval_begin + intervals_per_task);
+    for (int interval = interval_begin; interval < interval_end; ++interval) {
+      if (interval > 0) {
+        if (bw.len - bw.pos < max_MCU_bytes) {
+          output.resize(2 * output.size() + max_MCU_bytes);
+          bw.data = output.data();
+          bw.len = output.size();
+        }
+        EmitMarker(&bw, 0xD0 + ((interval - 1) & 0x7));
+      }
+      memset(last_dc_coeff, 0, sizeof(last_dc_coeff));
+      const int mcu_end = std::min(num_MCUs, (interval + 1) * restart_interval);
+      int last_mcu_y = -1;
+      for (int mcu = interval * restart_interval; mcu < mcu_end; ++mcu) {
+        const int mcu_y = mcu / layout.MCUs_per_row;
+        const int mcu_x = mcu % layout.MCUs_per_row;
+        if (mcu_y != last_mcu_y) {
+          AccessMCURow(cinfo, layout, mcu_y, ba);
+          last_mcu_y = mcu_y;
+        }
+        if (bw.len - bw.pos < max_MCU_bytes) {
+          output.resize(2 * output.size() + max_MCU_bytes);
+          bw.data = output.data();
+          bw.len = output.size();
+        }
+        if (!EncodeMCU(cinfo, layout, ba, mcu_x, mcu_y, &coding_state,
+                       last_dc_coeff, &bw)) {
+          return;
+        }
+      }
+      Flush(&coding_state, &bw);
+      JumpToByteBoundary(&bw);
+    }
+    output.resize(bw.pos);
+    ok[task] = bw.healthy;
+  };
+  ProgressMonitorEncodePass(cinfo, scan_index, 0);
+  RunOnRunner(cinfo, num_tasks, encode_task);
+  for (int task = 0; task < num_tasks; ++task) {
+    if (!ok[task]) return false;
+    WriteOutput(cinfo, outputs[task]);
+    std::vector<uint8_t>().swap(outputs[task]);
+  }
+  return true;
+}
+
+}  // namespace
+
+bool EncodeScan(j_compress_ptr cinfo, int scan_index) {
+  jpeg_comp_master* m = cinfo->master;
+  const int restart_interval = cinfo->restart_interval;
+  int restarts_to_go = restart_interval;
+  int next_restart_marker = 0;
+
+  JpegBitWriter* bw = &m->bw;
+  coeff_t last_dc_coeff[MAX_COMPS_IN_SCAN] = {0};
+  DCTCodingState coding_state;
+  DCTCodingStateInit(&coding_state);
+
+  const ScanLayout layout = GetScanLayout(cinfo, scan_index);
+  if (restart_interval > 0 && m->runner != nullptr &&
+      layout.MCUs_per_row * layout.MCU_rows > restart_interval) {
+    return EncodeScanParallel(cinfo, scan_index, layout);
+  }
 
   JBLOCKARRAY ba[MAX_COMPS_IN_SCAN];
-  for (int mcu_y = 0; mcu_y < MCU_rows; ++mcu_y) {
+  for (int mcu_y = 0; mcu_y < layout.MCU_rows; ++mcu_y) {
     ProgressMonitorEncodePass(cinfo, scan_index, mcu_y);
-    for (int i = 0; i < scan_info->comps_in_scan; ++i) {
-      int comp_idx = scan_info->component_index[i];
-      jpeg_component_info* comp = &cinfo->comp_info[comp_idx];
-      int n_blocks_y = is_interleaved ? comp->v_samp_factor : 1;
-      int by0 = mcu_y * n_blocks_y;
-      int block_rows_left = comp->height_in_blocks - by0;
-      int max_block_rows = std::min(n_blocks_y, block_rows_left);
-      ba[i] = (*cinfo->mem->access_virt_barray)(
-          reinterpret_cast<j_common_ptr>(cinfo), m->coeff_buffers[comp_idx],
-          by0, max_block_rows, false);
-    }
-    for (int mcu_x = 0; mcu_x < MCUs_per_row; ++mcu_x) {
+    AccessMCURow(cinfo, layout, mcu_y, ba);
+    for (int mcu_x = 0; mcu_x < layout.MCUs_per_row; ++mcu_x) {
       // Possibly emit a restart marker.
       if (restart_interval > 0 && restarts_to_go == 0) {
         Flush(&coding_state, bw);
@@ -825,40 +1052,9 @@ bool EncodeScan(j_compress_ptr cinfo, int scan_index) {
         restarts_to_go = restart_interval;
         memset(last_dc_coeff, 0, sizeof(last_dc_coeff));
       }
-      // Encode one MCU
-      for (int i = 0; i < scan_info->comps_in_scan; ++i) {
-        int comp_idx = scan_info->component_index[i];
-        jpeg_component_info* comp = &cinfo->comp_info[comp_idx];
-        HuffmanCodeTable* dc_huff = &m->huff_tables[sci.dc_tbl_idx[i]];
-        HuffmanCodeTable* ac_huff = &m->huff_tables[sci.ac_tbl_idx[i]];
-        int n_blocks_y = is_interleaved ? comp->v_samp_factor : 1;
-        int n_blocks_x = is_interleaved ? comp->h_samp_factor : 1;
-        for (int iy = 0; iy < n_blocks_y; ++iy) {
-          for (int ix = 0; ix < n_blocks_x; ++ix) {
-            size_t block_y = mcu_y * n_blocks_y + iy;
-            size_t block_x = mcu_x * n_blocks_x + ix;
-            const coeff_t* block;
-            if (block_x >= comp->width_in_blocks ||
-                block_y >= comp->height_in_blocks) {
-              block = kDummyBlock;
-            } else {
-              block = &ba[i][iy][block_x][0];
-            }
-            bool ok;
-            if (!is_progressive) {
-              ok = EncodeDCTBlockSequential(block, dc_huff, ac_huff,
-                                            last_dc_coeff + i, bw);
-            } else if (Ah == 0) {
-              ok = EncodeDCTBlockProgressive(block, dc_huff, ac_huff, Ss, Se,
-                                             Al, &coding_state,
-                                             last_dc_coeff + i, bw);
-            } else {
-              ok = EncodeRefinementBits(block, ac_huff, Ss, Se, Al,
-                                        &coding_state, bw);
-            }
-            if (!ok) return false;
-          }
-        }
+      if (!EncodeMCU(cinfo, layout, ba, mcu_x, mcu_y, &coding_state,
+                     last_dc_coeff, bw)) {
+        return false;
       }
       --restarts_to_go;
     }
@@ -876,13 +1072,6 @@ bool EncodeScan(j_compress_ptr cinfo, int scan_index) {
   return true;
 }
 
-struct Token {
-  uint8_t histo_idx;
-  uint8_t symbol;
-  uint16_t bits;
-  Token(int i, int s, int b) : histo_idx(i), symbol(s), bits(b) {}
-};
-
 void ComputeTokensForBlock(const coeff_t* block, int histo_dc, int histo_ac,
                            coeff_t* last_dc_coeff, Token** tokens_ptr) {
   Token* next_token = *tokens_ptr;
@@ -933,11 +1122,6 @@ void ComputeTokensForBlock(const coeff_t* block, int histo_dc, int histo_ac,
   *tokens_ptr = next_token;
 }
 
-struct TokenArray {
-  Token* tokens = nullptr;
-  size_t num_tokens = 0;
-};
-
 size_t MaxNumTokensPerMCURow(j_compress_ptr cinfo) {
   int MCUs_per_row = DivCeil(cinfo->image_width, 8 * cinfo->max_h_samp_factor);
   size_t blocks_per_mcu = 0;
@@ -945,7 +1129,8 @@ size_t MaxNumTokensPerMCURow(j_compress_ptr cinfo) {
     jpeg_component_info* comp = &cinfo->comp_info[c];
     blocks_per_mcu += comp->h_samp_factor * comp->v_samp_factor;
   }
-  return kDCTBlockSize * blocks_per_mcu * MCUs_per_row;
+  // There is at most one restart marker token before each MCU.
+  return (kDCTBlockSize * blocks_per_mcu + 1) * MCUs_per_row;
 }
 
 size_t EstimateNumTokens(j_compress_ptr cinfo, size_t mcu_y, size_t ysize_mcus,
@@ -961,31 +1146,91 @@ size_t EstimateNumTokens(j_compress_ptr cinfo, size_t mcu_y, size_t ysize_mcus,
                   std::max(max_per_row, estimate - num_tokens));
 }
 
-void ComputeTokens(j_compress_ptr cinfo,
-                   std::vector<TokenArray>* token_arrays) {
+void InitTokenArrays(j_compress_ptr cinfo) {
+  jpeg_comp_master* m = cinfo->master;
+  // A new token array is started at most once per iMCU row.
+  m->token_arrays =
+      Allocate<TokenArray>(cinfo, cinfo->total_iMCU_rows, JPOOL_IMAGE);
+  m->cur_token_array = 0;
+  m->token_arrays[0].tokens = nullptr;
+  m->token_arrays[0].num_tokens = 0;
+  m->total_num_tokens = 0;
+  m->max_num_tokens = 0;
+  m->next_token = nullptr;
+  m->restarts_to_go = RestartIntervalForScan(cinfo, 0);
+  m->next_restart_marker = 0;
+  memset(m->last_dc_coeff, 0, sizeof(m->last_dc_coeff));
+}
+
+// Appends the tokens of the MCU row mcu_y to the token arrays, the coefficients
+// of the block at block row iy within the iMCU row and block column bx of
+// component c are given by get_block(c, iy, bx).
+template <typename GetBlock>
+void ComputeTokensForMCURow(j_compress_ptr cinfo, int mcu_y,
+                            const GetBlock& get_block) {
   jpeg_comp_master* m = cinfo->master;
-  TokenArray ta;
-  Token* next_token = ta.tokens;
-  size_t num_tokens = 0;
-  size_t total_num_tokens = 0;
-  size_t max_tokens_per_mcu_row = MaxNumTokensPerMCURow(cinfo);
   int xsize_mcus = DivCeil(cinfo->image_width, 8 * cinfo->max_h_samp_factor);
-  int ysize_mcus = DivCeil(cinfo->image_height, 8 * cinfo->max_v_samp_factor);
-  coeff_t last_dc_coeff[MAX_COMPS_IN_SCAN] = {0};
-  JBLOCKARRAY ba[MAX_COMPS_IN_SCAN];
-  for (int mcu_y = 0; mcu_y < ysize_mcus; ++mcu_y) {
-    ProgressMonitorEncodePass(cinfo, 0, mcu_y);
-    ta.num_tokens = next_token - ta.tokens;
-    if (ta.num_tokens + max_tokens_per_mcu_row > num_tokens) {
-      if (ta.tokens) {
-        token_arrays->push_back(ta);
-        total_num_tokens += ta.num_tokens;
+  size_t max_tokens_per_mcu_row = MaxNumTokensPerMCURow(cinfo);
+  TokenArray* ta = &m->token_arrays[m->cur_token_array];
+  ta->num_tokens = m->next_token - ta->tokens;
+  if (ta->num_tokens + max_tokens_per_mcu_row > m->max_num_tokens) {
+    if (ta->tokens) {
+      m->total_num_tokens += ta->num_tokens;
+      ta = &m->token_arrays[++m->cur_token_array];
+    }
+    m->max_num_tokens =
+        EstimateNumTokens(cinfo, mcu_y, cinfo->total_iMCU_rows,
+                          m->total_num_tokens, max_tokens_per_mcu_row);
+    ta->tokens = Allocate<Token>(cinfo, m->max_num_tokens, JPOOL_IMAGE);
+    ta->num_tokens = 0;
+    m->next_token = ta->tokens;
+  }
+  const int restart_interval = RestartIntervalForScan(cinfo, 0);
+  coeff_t* last_dc_coeff = m->last_dc_coeff;
+  Token* next_token = m->next_token;
+  for (int mcu_x = 0; mcu_x < xsize_mcus; ++mcu_x) {
+    if (restart_interval > 0) {
+      if (m->restarts_to_go == 0) {
+        *next_token++ = Token(kRestartMarkerToken, m->next_restart_marker, 0);
+        m->next_restart_marker = (m->next_restart_marker + 1) & 0x7;
+        m->restarts_to_go = restart_interval;
+        memset(last_dc_coeff, 0, sizeof(m->last_dc_coeff));
       }
-      num_tokens = EstimateNumTokens(cinfo, mcu_y, ysize_mcus, total_num_tokens,
-                                     max_tokens_per_mcu_row);
-      ta.tokens = Allocate<Token>(cinfo, num_tokens, JPOOL_IMAGE);
-      next_token = ta.tokens;
+      --m->restarts_to_go;
     }
+    for (int c = 0; c < cinfo->num_components; ++c) {
+      jpeg_component_info* comp = &cinfo->comp_info[c];
+      for (int iy = 0; iy < comp->v_samp_factor; ++iy) {
+        for (int ix = 0; ix < comp->h_samp_factor; ++ix) {
+          size_t block_y = mcu_y * comp->v_samp_factor + iy;
+          size_t block_x = mcu_x * comp->h_samp_factor + ix;
+          if (block_x >= comp->width_in_blocks ||
+              block_y >= comp->height_in_blocks) {
+            *next_token++ = Token(c, 0, 0);
+            *next_token++ = Token(c + 4, 0, 0);
+            continue;
+          }
+          ComputeTokensForBlock(get_block(c, iy, block_x), c, c + 4,
+                                &last_dc_coeff[c], &next_token);
+        }
+      }
+    }
+  }
+  m->next_token = next_token;
+}
+
+void FinishTokenArrays(j_compress_ptr cinfo) {
+  jpeg_comp_master* m = cinfo->master;
+  TokenArray* ta = &m->token_arrays[m->cur_token_array];
+  ta->num_tokens = m->next_token - ta->tokens;
+}
+
+void ComputeTokens(j_compress_ptr cinfo) {
+  jpeg_comp_master* m = cinfo->master;
+  InitTokenArrays(cinfo);
+  JBLOCKARRAY ba[MAX_COMPS_IN_SCAN];
+  for (size_t mcu_y = 0; mcu_y < cinfo->total_iMCU_rows; ++mcu_y) {
+    ProgressMonitorEncodePass(cinfo, 0, mcu_y);
     for (int c = 0; c < cinfo->num_components; ++c) {
       jpeg_component_info* comp = &cinfo->comp_info[c];
       int by0 = mcu_y * comp->v_samp_factor;
@@ -995,37 +1240,11 @@ void ComputeTokens(j_compress_ptr cinfo,
           reinterpret_cast<j_common_ptr>(cinfo), m->coeff_buffers[c], by0,
           max_block_rows, false);
     }
-    if (cinfo->max_h_samp_factor == 1 && cinfo->max_v_samp_factor == 1) {
-      for (int mcu_x = 0; mcu_x < xsize_mcus; ++mcu_x) {
-        for (int c = 0; c < cinfo->num_components; ++c) {
-          ComputeTokensForBlock(&ba[c][0][mcu_x][0], c, c + 4,
-                                &last_dc_coeff[c], &next_token);
-        }
-      }
-      continue;
-    }
-    for (int mcu_x = 0; mcu_x < xsize_mcus; ++mcu_x) {
-      for (int c = 0; c < cinfo->num_components; ++c) {
-        jpeg_component_info* comp = &cinfo->comp_info[c];
-        for (int iy = 0; iy < comp->v_samp_factor; ++iy) {
-          for (int ix = 0; ix < comp->h_samp_factor; ++ix) {
-            size_t block_y = mcu_y * comp->v_samp_factor + iy;
-            size_t block_x = mcu_x * comp->h_samp_factor + ix;
-            if (block_x >= comp->width_in_blocks ||
-                block_y >= comp->height_in_blocks) {
-              *next_token++ = Token(c, 0, 0);
-              *next_token++ = Token(c + 4, 0, 0);
-              continue;
-            }
-            ComputeTokensForBlock(&ba[c][iy][block_x][0], c, c + 4,
-                                  &last_dc_coeff[c], &next_token);
-          }
-        }
-      }
-    }
+    ComputeTokensForMCURow(cinfo, mcu_y, [&](int c, int iy, size_t bx) {
+      return &ba[c][iy][bx][0];
+    });
   }
-  ta.num_tokens = next_token - ta.tokens;
-  token_arrays->push_back(ta);
+  FinishTokenArrays(cinfo);
 }
 
 void WriteTokens(j_compress_ptr cinfo, const Token* tokens, size_t num_tokens,
@@ -1035,10 +1254,15 @@ void WriteTokens(j_compress_ptr cinfo, const Token* tokens, size_t num_tokens,
   size_t next_cycle = cycle_len;
   for (size_t i = 0; i < num_tokens; ++i) {
     Token t = tokens[i];
-    int nbits = t.symbol & 0xf;
-    WriteSymbol(t.symbol, &huff_tables[context_map[t.histo_idx]], bw);
-    if (nbits > 0) {
-      WriteBits(bw, nbits, t.bits);
+    if (t.histo_idx == kRestartMarkerToken) {
+      JumpToByteBoundary(bw);
+      EmitMarker(bw, 0xD0 + t.symbol);
+    } else {
+      int nbits = t.symbol & 0xf;
+      WriteSymbol(t.symbol, &huff_tables[context_map[t.histo_idx]], bw);
+      if (nbits > 0) {
+        WriteBits(bw, nbits, t.bits);
+      }
     }
     if (--next_cycle == 0) {
       if (!EmptyBitWriterBuffer(bw)) {
@@ -1053,17 +1277,24 @@ void BuildHistograms(const Token* tokens, size_t num_tokens,
                      Histogram* histograms) {
   for (size_t j = 0; j < num_tokens; ++j) {
     Token t = tokens[j];
+    if (t.histo_idx == kRestartMarkerToken) continue;
     ++histograms[t.histo_idx].count[t.symbol];
   }
 }
 
 void EncodeSingleScan(j_compress_ptr cinfo) {
-  std::vector<TokenArray> token_arrays;
-  ComputeTokens(cinfo, &token_arrays);
+  jpeg_comp_master* m = cinfo->master;
+  if (cinfo->global_state == kEncWriteCoeffs) {
+    ComputeTokens(cinfo);
+  } else {
+    // The tokens were computed while reading the input.
+    FinishTokenArrays(cinfo);
+  }
+  const size_t num_token_arrays = m->cur_token_array + 1;
   Histogram histograms[8] = {};
-  for (size_t i = 0; i < token_arrays.size(); ++i) {
-    Token* tokens = token_arrays[i].tokens;
-    size_t num_tokens = token_arrays[i].num_tokens;
+  for (size_t i = 0; i < num_token_arrays; ++i) {
+    Token* tokens = m->token_arrays[i].tokens;
+    size_t num_tokens = m->token_arrays[i].num_tokens;
     BuildHistograms(tokens, num_tokens, histograms);
   }
   JpegClusteredHistograms dc_clusters;
@@ -1097,17 +1328,21 @@ void EncodeSingleScan(j_compress_ptr cinfo) {
     context_map[c + 4] = sci.ac_tbl_idx[c];
   }
   sci.num_huffman_codes = num_huffman_codes;
-  memcpy(cinfo->master->scan_coding_info, &sci, sizeof(sci));
+  memcpy(m->scan_coding_info, &sci, sizeof(sci));
   EncodeDQT(cinfo, &is_baseline);
   EncodeSOF(cinfo, is_baseline);
+  cinfo->restart_interval = RestartIntervalForScan(cinfo, 0);
+  if (cinfo->restart_interval > 0) {
+    EncodeDRI(cinfo);
+  }
   EncodeDHT(cinfo, huffman_codes, num_huffman_codes);
   EncodeSOS(cinfo, 0);
 
-  JpegBitWriter* bw = &cinfo->master->bw;
-  HuffmanCodeTable* huff_tables = cinfo->master->huff_tables;
-  for (size_t i = 0; i < token_arrays.size(); ++i) {
-    Token* tokens = token_arrays[i].tokens;
-    size_t num_tokens = token_arrays[i].num_tokens;
+  JpegBitWriter* bw = &m->bw;
+  HuffmanCodeTable* huff_tables = m->huff_tables;
+  for (size_t i = 0; i < num_token_arrays; ++i) {
+    Token* tokens = m->token_arrays[i].tokens;
+    size_t num_tokens = m->token_arrays[i].num_tokens;
     WriteTokens(cinfo, tokens, num_tokens, huff_tables, context_map, bw);
   }
   JumpToByteBoundary(bw);
@@ -1119,6 +1354,30 @@ void EncodeSingleScan(j_compress_ptr cinfo) {
   }
 }
 
+void ComputeTokensForiMCURow(j_compress_ptr cinfo) {
+  jpeg_comp_master* m = cinfo->master;
+  if (m->next_iMCU_row == 0) {
+    InitTokenArrays(cinfo);
+  }
+  const int mcu_y = m->next_iMCU_row;
+  float* tmp = m->dct_buffer;
+  JCOEF block[DCTSIZE2];
+  ComputeTokensForMCURow(cinfo, mcu_y, [&](int c, int iy, size_t bx) {
+    jpeg_component_info* comp = &cinfo->comp_info[c];
+    RowBuffer<float>* plane = m->raw_data[c];
+    const size_t by = mcu_y * comp->v_samp_factor + iy;
+    float aq_strength = 0.0f;
+    if (m->use_adaptive_quantization) {
+      const float* qf_row = m->quant_field.Row(by * m->v_factor[c]);
+      aq_strength = qf_row[bx * m->h_factor[c]];
+    }
+    ComputeCoefficientBlock(plane->Row(8 * by) + 8 * bx, plane->stride(),
+                            m->quant_mul[c], aq_strength, m->zero_bias_mul[c],
+                            tmp, block);
+    return block;
+  });
+}
+
 HWY_EXPORT(WriteiMCURow);
 void WriteiMCURow(j_compress_ptr cinfo) {
   HWY_DYNAMIC_DISPATCH(WriteiMCURow)(cinfo);
@@ -30,6 +30,8 @@ bool EncodeScan(j_compress_ptr cinfo, int scan_index);
 
 void EncodeSingleScan(j_compress_ptr cinfo);
 
+void ComputeTokensForiMCURow(j_compress_ptr cinfo);
+
 void WriteiMCURow(j_compress_ptr cinfo);
 
 }  // namespace jpegli
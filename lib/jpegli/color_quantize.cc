@@ -5,9 +5,11 @@
 
 #include "lib/jpegli/color_quantize.h"
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 #include <unordered_map>
+#include <vector>
 
 #include "lib/jpegli/decode_internal.h"
 #include "lib/jpegli/error.h"
@@ -19,6 +21,15 @@ namespace {
 static constexpr int kNumColorCellBits[kMaxComponents] = {3, 4, 3, 3};
 static constexpr int kCompW[kMaxComponents] = {2, 3, 1, 1};
 
+// Number of bits per component of the cells of the inverse colormap of three
+// component images; each of these cells lies within one of the cells above.
+static constexpr int kNumInverseColorMapBits[3] = {5, 6, 5};
+// Inverse colormap entries that are not yet computed and whose cell does not
+// have a single nearest color, respectively; other entries are the color index
+// plus one.
+static constexpr uint16_t kInverseColorMapEmpty = 0;
+static constexpr uint16_t kInverseColorMapUnresolved = 0xffff;
+
 int Pow(int a, int b) {
   int r = 1;
   for (int i = 0; i < b; ++i) {
@@ -387,19 +398,24 @@ void ChooseColorMap2Pass(j_decompress_ptr cinfo) {
 
 namespace {
 
-void FindCandidatesForCell(j_decompress_ptr cinfo, int ncomp, int cell[],
+// Appends to candidates those of the given colors that can be the nearest
+// color of some pixel in the cell.
+void FindCandidatesForCell(j_decompress_ptr cinfo, int ncomp, const int cell[],
+                           const int cell_bits[], const uint8_t* colors,
+                           size_t num_colors,
                            std::vector<uint8_t>* candidates) {
   int cell_min[kMaxComponents];
   int cell_max[kMaxComponents];
   int cell_center[kMaxComponents];
   for (int c = 0; c < ncomp; ++c) {
-    cell_min[c] = cell[c] << (8 - kNumColorCellBits[c]);
-    cell_max[c] = cell_min[c] + (1 << (8 - kNumColorCellBits[c])) - 1;
+    cell_min[c] = cell[c] << (8 - cell_bits[c]);
+    cell_max[c] = cell_min[c] + (1 << (8 - cell_bits[c])) - 1;
     cell_center[c] = (cell_min[c] + cell_max[c]) >> 1;
   }
   int min_maxdist = std::numeric_limits<int>::max();
   int mindist[256];
-  for (int i = 0; i < cinfo->actual_number_of_colors; ++i) {
+  for (size_t j = 0; j < num_colors; ++j) {
+    const int i = colors[j];
     int dmin = 0;
     int dmax = 0;
     for (int c = 0; c < ncomp; ++c) {
@@ -421,16 +437,53 @@ void FindCandidatesForCell(j_decompress_ptr cinfo, int ncomp, int cell[],
       dmin += dminc * dminc;
       dmax += dmaxc * dmaxc;
     }
-    mindist[i] = dmin;
+    mindist[j] = dmin;
     min_maxdist = std::min(dmax, min_maxdist);
   }
-  for (int i = 0; i < cinfo->actual_number_of_colors; ++i) {
-    if (mindist[i] < min_maxdist) {
-      candidates->push_back(i);
+  for (size_t j = 0; j < num_colors; ++j) {
+    if (mindist[j] < min_maxdist) {
+      candidates->push_back(colors[j]);
     }
   }
 }
 
+size_t CandidateListIndex(j_decompress_ptr cinfo, const JSAMPLE* pixel) {
+  size_t cell_idx = 0;
+  size_t stride = 1;
+  for (int c = cinfo->out_color_components - 1; c >= 0; --c) {
+    cell_idx += (pixel[c] >> (8 - kNumColorCellBits[c])) * stride;
+    stride <<= kNumColorCellBits[c];
+  }
+  return cell_idx;
+}
+
+size_t InverseColorMapIndex(const JSAMPLE* pixel) {
+  return ((pixel[0] >> (8 - kNumInverseColorMapBits[0]))
+          << (kNumInverseColorMapBits[1] + kNumInverseColorMapBits[2])) +
+         ((pixel[1] >> (8 - kNumInverseColorMapBits[1]))
+          << kNumInverseColorMapBits[2]) +
+         (pixel[2] >> (8 - kNumInverseColorMapBits[2]));
+}
+
+// Computes the inverse colormap entry of the cell of the pixel. Only the
+// candidates of the enclosing, larger cell have to be considered.
+uint16_t ComputeInverseColorMapEntry(j_decompress_ptr cinfo,
+                                     const JSAMPLE* pixel) {
+  jpeg_decomp_master* m = cinfo->master;
+  const auto& colors = m->candidate_lists_[CandidateListIndex(cinfo, pixel)];
+  int cell[3];
+  for (int c = 0; c < 3; ++c) {
+    cell[c] = pixel[c] >> (8 - kNumInverseColorMapBits[c]);
+  }
+  std::vector<uint8_t> candidates;
+  FindCandidatesForCell(cinfo, 3, cell, kNumInverseColorMapBits, colors.data(),
+                        colors.size(), &candidates);
+  if (candidates.size() != 1) {
+    return kInverseColorMapUnresolved;
+  }
+  return candidates[0] + 1;
+}
+
 }  // namespace
 
 void CreateInverseColorMap(j_decompress_ptr cinfo) {
@@ -442,16 +495,34 @@ void CreateInverseColorMap(j_decompress_ptr cinfo) {
   }
   m->candidate_lists_.resize(num_cells);
 
+  std::vector<uint8_t> all_colors(cinfo->actual_number_of_colors);
+  for (size_t i = 0; i < all_colors.size(); ++i) {
+    all_colors[i] = i;
+  }
   int next_cell[kMaxComponents] = {0};
   for (int i = 0; i < num_cells; ++i) {
     m->candidate_lists_[i].clear();
-    FindCandidatesForCell(cinfo, ncomp, next_cell, &m->candidate_lists_[i]);
+    FindCandidatesForCell(cinfo, ncomp, next_cell, kNumColorCellBits,
+                          all_colors.data(), all_colors.size(),
+                          &m->candidate_lists_[i]);
     int c = ncomp - 1;
     while (c > 0 && next_cell[c] + 1 == (1 << kNumColorCellBits[c])) {
       next_cell[c--] = 0;
     }
     ++next_cell[c];
   }
+  // The entries of the inverse colormap are computed when first looked up.
+  if (ncomp == 3) {
+    const size_t num_entries = 1u << (kNumInverseColorMapBits[0] +
+                                      kNumInverseColorMapBits[1] +
+                                      kNumInverseColorMapBits[2]);
+    if (m->inverse_colormap_ == nullptr) {
+      m->inverse_colormap_ =
+          Allocate<uint16_t>(cinfo, num_entries, JPOOL_IMAGE);
+    }
+    std::fill(m->inverse_colormap_, m->inverse_colormap_ + num_entries,
+              kInverseColorMapEmpty);
+  }
   m->regenerate_inverse_colormap_ = false;
 }
 
@@ -464,12 +535,18 @@ int LookupColorIndex(j_decompress_ptr cinfo, JSAMPLE* pixel) {
       index += m->colormap_lut_[c * 256 + pixel[c]];
     }
   } else {
-    size_t cell_idx = 0;
-    size_t stride = 1;
-    for (int c = num_channels - 1; c >= 0; --c) {
-      cell_idx += (pixel[c] >> (8 - kNumColorCellBits[c])) * stride;
-      stride <<= kNumColorCellBits[c];
+    if (m->inverse_colormap_ != nullptr && num_channels == 3) {
+      uint16_t* entry = &m->inverse_colormap_[InverseColorMapIndex(pixel)];
+      if (*entry == kInverseColorMapEmpty) {
+        *entry = ComputeInverseColorMapEntry(cinfo, pixel);
+      }
+      if (*entry != kInverseColorMapUnresolved) {
+        index = *entry - 1;
+        JXL_ASSERT(index < cinfo->actual_number_of_colors);
+        return index;
+      }
     }
+    size_t cell_idx = CandidateListIndex(cinfo, pixel);
     JXL_ASSERT(cell_idx < m->candidate_lists_.size());
     int mindist = std::numeric_limits<int>::max();
     const auto& candidates = m->candidate_lists_[cell_idx];
@@ -10,9 +10,12 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <jxl/parallel_runner.h>
+
 #include <algorithm>
 #include <hwy/aligned_allocator.h>
 
+#include "lib/jpegli/error.h"
 #include "lib/jpegli/memory_manager.h"
 #include "lib/jpegli/simd.h"
 #include "lib/jxl/base/compiler_specific.h"  // for ssize_t
@@ -145,6 +148,32 @@ class RowBuffer {
   T* data_;
 };
 
+// Calls func(task) for each task in [0, num_tasks), on the parallel runner of
+// the encoder or decoder if it has one. `func` must not raise errors through
+// cinfo->err, since it may run on another thread.
+template <typename CInfo, typename Func>
+void RunOnRunner(CInfo cinfo, uint32_t num_tasks, const Func& func) {
+  JxlParallelRunner runner = cinfo->master->runner;
+  if (runner == nullptr || num_tasks <= 1) {
+    for (uint32_t i = 0; i < num_tasks; ++i) func(i);
+    return;
+  }
+  struct Trampoline {
+    static JxlParallelRetCode Init(void* /*opaque*/, size_t /*num_threads*/) {
+      return 0;
+    }
+    static void Run(void* opaque, uint32_t task, size_t /*thread*/) {
+      (*static_cast<const Func*>(opaque))(task);
+    }
+  };
+  JxlParallelRetCode ret =
+      (*runner)(cinfo->master->runner_opaque, const_cast<Func*>(&func),
+                &Trampoline::Init, &Trampoline::Run, 0, num_tasks);
+  if (ret != 0) {
+    JPEGLI_ERROR("Parallel runner failed.");
+  }
+}
+
 }  // namespace jpegli
 
 #endif  // LIB_JPEGLI_COMMON_INTERNAL_H_
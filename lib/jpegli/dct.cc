@@ -6,6 +6,7 @@
 #include "lib/jpegli/dct.h"
 
 #include <cmath>
+#include <vector>
 
 #undef HWY_TARGET_INCLUDE
 #define HWY_TARGET_INCLUDE "lib/jpegli/dct.cc"
@@ -40,9 +41,21 @@ void ComputeCoefficientBlock(const float* JXL_RESTRICT pixels, size_t stride,
   block[0] = std::round((dct[0] - kDCBias) * qmc[0]);
 }
 
+// Number of blocks of a block row that are transformed by one task.
+constexpr size_t kBlocksPerTask = 128;
+
+// A range of blocks of one block row of a component.
+struct BlockRowTask {
+  int c;
+  size_t by;
+  JBLOCKROW brow;
+  size_t bx0;
+  size_t bx1;
+};
+
 void ComputeDCTCoefficients(j_compress_ptr cinfo) {
   jpeg_comp_master* m = cinfo->master;
-  float* tmp = m->dct_buffer;
+  std::vector<BlockRowTask> tasks;
   for (int c = 0; c < cinfo->num_components; c++) {
     jpeg_component_info* comp = &cinfo->comp_info[c];
     int by0 = m->next_iMCU_row * comp->v_samp_factor;
@@ -51,27 +64,36 @@ void ComputeDCTCoefficients(j_compress_ptr cinfo) {
     JBLOCKARRAY ba = (*cinfo->mem->access_virt_barray)(
         reinterpret_cast<j_common_ptr>(cinfo), m->coeff_buffers[c], by0,
         max_block_rows, true);
-    float* qmc = m->quant_mul[c];
+    for (int iy = 0; iy < max_block_rows; iy++) {
+      for (size_t bx0 = 0; bx0 < comp->width_in_blocks;
+           bx0 += kBlocksPerTask) {
+        size_t bx1 = std::min<size_t>(bx0 + kBlocksPerTask,
+                                      comp->width_in_blocks);
+        tasks.push_back({c, static_cast<size_t>(by0 + iy), ba[iy], bx0, bx1});
+      }
+    }
+  }
+  const auto process_task = [&](uint32_t i) {
+    const BlockRowTask& task = tasks[i];
+    const int c = task.c;
+    HWY_ALIGN float tmp[2 * DCTSIZE2];
+    const float* qmc = m->quant_mul[c];
     RowBuffer<float>* plane = m->raw_data[c];
     const int h_factor = m->h_factor[c];
     const int v_factor = m->v_factor[c];
     const float zero_bias_mul = m->zero_bias_mul[c];
     float aq_strength = 0.0f;
-    for (int iy = 0; iy < comp->v_samp_factor; iy++) {
-      size_t by = by0 + iy;
-      if (by >= comp->height_in_blocks) continue;
-      JBLOCKROW brow = ba[iy];
-      const float* row = plane->Row(8 * by);
-      for (size_t bx = 0; bx < comp->width_in_blocks; bx++) {
-        JCOEF* block = &brow[bx][0];
-        if (m->use_adaptive_quantization) {
-          aq_strength = m->quant_field.Row(by * v_factor)[bx * h_factor];
-        }
-        ComputeCoefficientBlock(row + 8 * bx, plane->stride(), qmc, aq_strength,
-                                zero_bias_mul, tmp, block);
+    const float* row = plane->Row(8 * task.by);
+    for (size_t bx = task.bx0; bx < task.bx1; bx++) {
+      JCOEF* block = &task.brow[bx][0];
+      if (m->use_adaptive_quantization) {
+        aq_strength = m->quant_field.Row(task.by * v_factor)[bx * h_factor];
       }
+      ComputeCoefficientBlock(row + 8 * bx, plane->stride(), qmc, aq_strength,
+                              zero_bias_mul, tmp, block);
     }
-  }
+  };
+  RunOnRunner(cinfo, tasks.size(), process_task);
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -69,6 +69,7 @@ void InitializeImage(j_decompress_ptr cinfo) {
     m->ac_huff_lut_[i].value = 0xffff;
   }
   m->colormap_lut_ = nullptr;
+  m->inverse_colormap_ = nullptr;
   m->pixels_ = nullptr;
   m->scanlines_ = nullptr;
   m->regenerate_inverse_colormap_ = true;
@@ -951,3 +952,10 @@ void jpegli_set_output_format(j_decompress_ptr cinfo, JpegliDataType data_type,
       ((endianness == JPEGLI_BIG_ENDIAN && IsLittleEndian()) ||
        (endianness == JPEGLI_LITTLE_ENDIAN && !IsLittleEndian()));
 }
+
+void jpegli_set_decompress_parallel_runner(j_decompress_ptr cinfo,
+                                           JxlParallelRunner runner,
+                                           void* runner_opaque) {
+  cinfo->master->runner = runner;
+  cinfo->master->runner_opaque = runner_opaque;
+}
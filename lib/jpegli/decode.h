@@ -25,6 +25,8 @@
 #include <jpeglib.h>
 /* clang-format on */
 
+#include <jxl/parallel_runner.h>
+
 #include "lib/jpegli/common.h"
 
 #if defined(__cplusplus) || defined(c_plusplus)
@@ -101,6 +103,16 @@ void jpegli_new_colormap(j_decompress_ptr cinfo);
 void jpegli_set_output_format(j_decompress_ptr cinfo, JpegliDataType data_type,
                               JpegliEndianness endianness);
 
+// Sets the parallel runner used for the inverse DCT of the iMCU rows and for
+// entropy decoding the restart intervals of an iMCU row at the same time, when
+// the input buffer holds the whole iMCU row. The output does not depend on the
+// runner. The runner must stay valid until the decompression is finished or
+// aborted. Passing nullptr as runner turns off multithreading, which is the
+// default.
+void jpegli_set_decompress_parallel_runner(j_decompress_ptr cinfo,
+                                           JxlParallelRunner runner,
+                                           void* runner_opaque);
+
 #if defined(__cplusplus) || defined(c_plusplus)
 }  // extern "C"
 #endif
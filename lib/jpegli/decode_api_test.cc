@@ -5,7 +5,9 @@
 
 #include <stdio.h>
 
+#include <atomic>
 #include <cmath>
+#include <thread>
 #include <vector>
 
 #include "lib/jpegli/decode.h"
@@ -405,6 +407,69 @@ TEST(DecodeAPITest, ReuseCinfo) {
   jpegli_destroy_decompress(&cinfo);
 }
 
+JxlParallelRetCode TestRunner(void* runner_opaque, void* jpegxl_opaque,
+                              JxlParallelRunInit init,
+                              JxlParallelRunFunction func,
+                              uint32_t start_range, uint32_t end_range) {
+  const size_t num_threads = 4;
+  if (init(jpegxl_opaque, num_threads) != 0) return -1;
+  std::atomic<uint32_t> next_task{start_range};
+  std::vector<std::thread> threads;
+  for (size_t thread = 0; thread < num_threads; ++thread) {
+    threads.emplace_back([&, thread]() {
+      for (uint32_t task = next_task++; task < end_range; task = next_task++) {
+        func(jpegxl_opaque, task, thread);
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  return 0;
+}
+
+TEST(DecodeAPITest, ParallelRunnerSameOutput) {
+  TestImage input;
+  input.xsize = 1111;
+  input.ysize = 301;
+  GeneratePixels(&input);
+  std::vector<CompressParams> all_jparams(4);
+  all_jparams[0].restart_interval = 1;
+  all_jparams[1].restart_in_rows = 1;
+  all_jparams[1].progressive_mode = 2;
+  all_jparams[2].restart_interval = 7;
+  all_jparams[2].h_sampling = {2, 1, 1};
+  all_jparams[2].v_sampling = {2, 1, 1};
+  all_jparams[3].progressive_mode = 1;
+  DecompressParams dparams;
+  for (const CompressParams& jparams : all_jparams) {
+    std::vector<uint8_t> compressed;
+    JXL_CHECK(EncodeWithJpegli(input, jparams, &compressed));
+    TestImage expected;
+    DecodeWithLibjpeg(jparams, dparams, compressed, &expected);
+    TestImage output[3];
+    // The last decode reads the input in small chunks, so that some iMCU
+    // rows are not fully available and take the serial path.
+    for (int i = 0; i < 3; ++i) {
+      jpeg_decompress_struct cinfo;
+      SourceManager src(compressed.data(), compressed.size(),
+                        i < 2 ? compressed.size() : 1u << 12);
+      const auto try_catch_block = [&]() -> bool {
+        ERROR_HANDLER_SETUP(jpegli);
+        jpegli_create_decompress(&cinfo);
+        cinfo.src = reinterpret_cast<jpeg_source_mgr*>(&src);
+        if (i > 0) {
+          jpegli_set_decompress_parallel_runner(&cinfo, TestRunner, nullptr);
+        }
+        TestAPINonBuffered(jparams, dparams, expected, &cinfo, &output[i]);
+        return true;
+      };
+      EXPECT_TRUE(try_catch_block());
+      jpegli_destroy_decompress(&cinfo);
+    }
+    EXPECT_EQ(output[0].pixels, output[1].pixels);
+    EXPECT_EQ(output[0].pixels, output[2].pixels);
+  }
+}
+
 std::vector<TestConfig> GenerateBasicConfigs() {
   std::vector<TestConfig> all_configs;
   for (int samp : {1, 2}) {
@@ -113,10 +113,8 @@ struct jpeg_decomp_master {
 
   void (*color_transform)(float* row[jpegli::kMaxComponents], size_t len);
 
-  float* idct_scratch_;
   float* upsample_scratch_;
   uint8_t* output_scratch_;
-  int16_t* smoothing_scratch_;
   float* dequant_;
   // 1 = 1pass, 2 = 2pass, 3 = external
   int quant_mode_;
@@ -126,6 +124,7 @@ struct jpeg_decomp_master {
   uint8_t* pixels_;
   JSAMPARRAY scanlines_;
   std::vector<std::vector<uint8_t>> candidate_lists_;
+  uint16_t* inverse_colormap_;
   bool regenerate_inverse_colormap_;
   float* dither_[jpegli::kMaxComponents];
   float* error_row_[2 * jpegli::kMaxComponents];
@@ -145,6 +144,9 @@ struct jpeg_decomp_master {
   int (*coef_bits_latch)[SAVED_COEFS];
   int (*prev_coef_bits_latch)[SAVED_COEFS];
   bool apply_smoothing;
+
+  JxlParallelRunner runner = nullptr;
+  void* runner_opaque = nullptr;
 };
 
 #endif  // LIB_JPEGLI_DECODE_INTERNAL_H_
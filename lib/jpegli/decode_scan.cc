@@ -8,6 +8,7 @@
 #include <string.h>
 
 #include <hwy/base.h>
+#include <vector>
 
 #include "lib/jpegli/decode_internal.h"
 #include "lib/jpegli/error.h"
@@ -414,6 +415,162 @@ bool FinishScan(j_decompress_ptr cinfo, const uint8_t* data, const size_t len,
   return true;
 }
 
+// Returns the position of the next marker at or after pos, or len if there is
+// no complete marker in the data.
+size_t FindNextMarker(const uint8_t* data, const size_t len, size_t pos) {
+  while (pos + 1 < len) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(
+        memchr(data + pos, 0xff, len - 1 - pos));
+    if (p == nullptr) break;
+    pos = p - data;
+    if (data[pos + 1] != 0 && data[pos + 1] != 0xff) return pos;
+    ++pos;
+  }
+  return len;
+}
+
+// Clears the coefficients of the current scan's spectral band in the current
+// iMCU row.
+void ClearScanCoefficients(j_decompress_ptr cinfo) {
+  jpeg_decomp_master* m = cinfo->master;
+  for (int i = 0; i < cinfo->comps_in_scan; ++i) {
+    const jpeg_component_info* comp = cinfo->cur_comp_info[i];
+    int c = comp->component_index;
+    for (int biy = 0; biy < comp->v_samp_factor; ++biy) {
+      size_t block_y = cinfo->input_iMCU_row * comp->v_samp_factor + biy;
+      if (block_y >= comp->height_in_blocks) break;
+      for (size_t bx = 0; bx < comp->width_in_blocks; ++bx) {
+        coeff_t* coeffs = &m->coeff_rows[c][biy][bx][0];
+        for (int k = cinfo->Ss; k <= cinfo->Se; ++k) {
+          coeffs[kJPEGNaturalOrder[k]] = 0;
+        }
+      }
+    }
+  }
+}
+
+// Entropy decoding state of one restart interval.
+struct RestartIntervalState {
+  size_t begin;
+  size_t end;
+  size_t bit_pos;
+  coeff_t last_dc_coeff[kMaxComponents];
+  int eobrun;
+  bool ok;
+};
+
+// Decodes the current iMCU row by decoding its restart intervals on the
+// parallel runner, if the row starts at a restart interval boundary, ends at
+// one or at the end of the scan, and all of its data is in the input buffer.
+// This is only done for the first scan of each coefficient, so that the
+// coefficients can be cleared and the row decoded again serially if any of
+// the intervals has errors, which are then reported as usual.
+// Returns false if the row was not decoded.
+bool DecodeRestartIntervalsInParallel(j_decompress_ptr cinfo,
+                                      const uint8_t* const data,
+                                      const size_t len, size_t* pos,
+                                      size_t* bit_pos) {
+  jpeg_decomp_master* m = cinfo->master;
+  const int restart_interval = cinfo->restart_interval;
+  if (m->runner == nullptr || restart_interval == 0 || cinfo->Ah != 0 ||
+      *bit_pos != 0 || m->scan_mcu_col_ != 0 ||
+      m->restarts_to_go_ != restart_interval) {
+    return false;
+  }
+  const size_t mcu_row0 = m->scan_mcu_row_;
+  const size_t mcu_row1 =
+      std::min<size_t>(mcu_row0 + m->mcu_rows_per_iMCU_row_,
+                       cinfo->MCU_rows_in_scan);
+  const bool last_row = mcu_row1 == cinfo->MCU_rows_in_scan;
+  const int num_MCUs = (mcu_row1 - mcu_row0) * cinfo->MCUs_per_row;
+  if (num_MCUs % restart_interval != 0 && !last_row) {
+    return false;
+  }
+  const int num_intervals = DivCeil(num_MCUs, restart_interval);
+  if (num_intervals < 2) {
+    return false;
+  }
+  // Find the restart markers between the intervals and the marker after the
+  // last one.
+  std::vector<RestartIntervalState> intervals(num_intervals);
+  size_t next_begin = *pos;
+  for (int i = 0; i < num_intervals; ++i) {
+    intervals[i].begin = next_begin;
+    intervals[i].end = FindNextMarker(data, len, next_begin);
+    if (intervals[i].end + 2 > len) return false;
+    if (i + 1 < num_intervals) {
+      int marker = 0xd0 + ((m->next_restart_marker_ + i) & 0x7);
+      if (data[intervals[i].end + 1] != marker) return false;
+    }
+    next_begin = intervals[i].end + 2;
+  }
+  const auto decode_interval = [&](uint32_t task) {
+    const int i = task;
+    RestartIntervalState* s = &intervals[i];
+    memset(s->last_dc_coeff, 0, sizeof(s->last_dc_coeff));
+    s->eobrun = -1;
+    BitReaderState br(data, len, s->begin);
+    HWY_ALIGN_MAX coeff_t dummy_block[DCTSIZE2];
+    bool scan_ok = true;
+    const int mcu_end = std::min(num_MCUs, (i + 1) * restart_interval);
+    for (int mcu = i * restart_interval; mcu < mcu_end; ++mcu) {
+      const size_t mcu_y = mcu_row0 + mcu / cinfo->MCUs_per_row;
+      const size_t mcu_x = mcu % cinfo->MCUs_per_row;
+      for (int ci = 0; ci < cinfo->comps_in_scan; ++ci) {
+        const jpeg_component_info* comp = cinfo->cur_comp_info[ci];
+        int c = comp->component_index;
+        const HuffmanTableEntry* dc_lut =
+            &m->dc_huff_lut_[comp->dc_tbl_no * kJpegHuffmanLutSize];
+        const HuffmanTableEntry* ac_lut =
+            &m->ac_huff_lut_[comp->ac_tbl_no * kJpegHuffmanLutSize];
+        for (int iy = 0; iy < comp->MCU_height; ++iy) {
+          size_t block_y = mcu_y * comp->MCU_height + iy;
+          int biy = block_y % comp->v_samp_factor;
+          for (int ix = 0; ix < comp->MCU_width; ++ix) {
+            size_t block_x = mcu_x * comp->MCU_width + ix;
+            coeff_t* coeffs;
+            if (block_x >= comp->width_in_blocks ||
+                block_y >= comp->height_in_blocks) {
+              coeffs = dummy_block;
+            } else {
+              coeffs = &m->coeff_rows[c][biy][block_x][0];
+            }
+            scan_ok &= DecodeDCTBlock(dc_lut, ac_lut, cinfo->Ss, cinfo->Se,
+                                      cinfo->Al, &s->eobrun, &br,
+                                      &s->last_dc_coeff[c], coeffs);
+          }
+        }
+      }
+    }
+    size_t new_pos;
+    bool stream_ok = br.FinishStream(&new_pos, &s->bit_pos);
+    s->ok = scan_ok && stream_ok;
+    if (i + 1 < num_intervals) {
+      // The restart marker has to follow the data of the interval, the end of
+      // block run has to end within the interval.
+      if (s->bit_pos > 0) new_pos += data[new_pos] == 0xff ? 2 : 1;
+      s->ok &= new_pos == s->end && s->eobrun <= 0;
+    }
+    s->end = new_pos;
+  };
+  RunOnRunner(cinfo, num_intervals, decode_interval);
+  for (const RestartIntervalState& s : intervals) {
+    if (!s.ok) {
+      ClearScanCoefficients(cinfo);
+      return false;
+    }
+  }
+  const RestartIntervalState& last = intervals.back();
+  *pos = last.end;
+  *bit_pos = last.bit_pos;
+  memcpy(m->last_dc_coeff_, last.last_dc_coeff, sizeof(m->last_dc_coeff_));
+  m->eobrun_ = last.eobrun;
+  m->next_restart_marker_ = (m->next_restart_marker_ + num_intervals - 1) & 0x7;
+  m->restarts_to_go_ = num_intervals * restart_interval - num_MCUs;
+  m->scan_mcu_row_ = mcu_row1;
+  return true;
+}
+
 }  // namespace
 
 void PrepareForiMCURow(j_decompress_ptr cinfo) {
@@ -437,6 +594,18 @@ int ProcessScan(j_decompress_ptr cinfo, const uint8_t* const data,
     return kNeedMoreInput;
   }
   jpeg_decomp_master* m = cinfo->master;
+  if (DecodeRestartIntervalsInParallel(cinfo, data, len, pos, bit_pos)) {
+    if (m->scan_mcu_row_ == cinfo->MCU_rows_in_scan &&
+        !FinishScan(cinfo, data, len, pos, bit_pos)) {
+      return kNeedMoreInput;
+    }
+    ++cinfo->input_iMCU_row;
+    if (cinfo->input_iMCU_row < cinfo->total_iMCU_rows) {
+      PrepareForiMCURow(cinfo);
+      return JPEG_ROW_COMPLETED;
+    }
+    return JPEG_SCAN_COMPLETED;
+  }
   for (;;) {
     // Handle the restart intervals.
     if (cinfo->restart_interval > 0 && m->restarts_to_go_ == 0) {
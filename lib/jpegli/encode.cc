@@ -326,19 +326,16 @@ bool IsStreamingSupported(j_compress_ptr cinfo) {
   if (cinfo->global_state == kEncWriteCoeffs) {
     return false;
   }
-  // TODO(szabadka) Remove this restriction.
-  if (cinfo->restart_interval > 0 || cinfo->restart_in_rows > 0) {
-    return false;
-  }
-  if (cinfo->optimize_coding || cinfo->num_scans > 1) {
+  // Single scan images with optimized Huffman codes are tokenized while the
+  // input is read, but written only at the end.
+  if (cinfo->num_scans > 1) {
     return false;
   }
   return true;
 }
 
 bool IsSinglePassOptimizerSupported(j_compress_ptr cinfo) {
-  return cinfo->num_scans == 1 && cinfo->optimize_coding &&
-         cinfo->restart_interval == 0 && cinfo->restart_in_rows == 0;
+  return cinfo->num_scans == 1 && cinfo->optimize_coding;
 }
 
 void AllocateBuffers(j_compress_ptr cinfo) {
@@ -453,7 +450,11 @@ void ProcessiMCURow(j_compress_ptr cinfo) {
   }
   ComputeAdaptiveQuantField(cinfo);
   if (IsStreamingSupported(cinfo)) {
-    WriteiMCURow(cinfo);
+    if (cinfo->optimize_coding) {
+      ComputeTokensForiMCURow(cinfo);
+    } else {
+      WriteiMCURow(cinfo);
+    }
   } else {
     ComputeDCTCoefficients(cinfo);
   }
@@ -478,7 +479,7 @@ void InitProgressMonitor(j_compress_ptr cinfo) {
   if (cinfo->progress == nullptr) {
     return;
   }
-  if (IsStreamingSupported(cinfo)) {
+  if (IsStreamingSupported(cinfo) && !cinfo->optimize_coding) {
     // We have only one input pass.
     cinfo->progress->total_passes = 1;
   } else if (IsSinglePassOptimizerSupported(cinfo)) {
@@ -602,6 +603,8 @@ void jpegli_CreateCompress(j_compress_ptr cinfo, int version,
   cinfo->master->data_type = JPEGLI_TYPE_UINT8;
   cinfo->master->endianness = JPEGLI_NATIVE_ENDIAN;
   cinfo->master->coeff_buffers = nullptr;
+  cinfo->master->runner = nullptr;
+  cinfo->master->runner_opaque = nullptr;
 }
 
 void jpegli_set_xyb_mode(j_compress_ptr cinfo) {
@@ -796,6 +799,13 @@ void jpegli_simple_progression(j_compress_ptr cinfo) {
   jpegli_set_progressive_level(cinfo, jpegli::kDefaultProgressiveLevel);
 }
 
+void jpegli_set_parallel_runner(j_compress_ptr cinfo, JxlParallelRunner runner,
+                                void* runner_opaque) {
+  CheckState(cinfo, jpegli::kEncStart);
+  cinfo->master->runner = runner;
+  cinfo->master->runner_opaque = runner_opaque;
+}
+
 void jpegli_set_progressive_level(j_compress_ptr cinfo, int level) {
   CheckState(cinfo, jpegli::kEncStart);
   if (level < 0) {
@@ -976,7 +986,7 @@ JDIMENSION jpegli_write_scanlines(j_compress_ptr cinfo, JSAMPARRAY scanlines,
   }
   jpegli::ProgressMonitorInputPass(cinfo);
   if (cinfo->global_state == jpegli::kEncHeader &&
-      jpegli::IsStreamingSupported(cinfo)) {
+      jpegli::IsStreamingSupported(cinfo) && !cinfo->optimize_coding) {
     jpegli::WriteHeaderMarkers(cinfo);
   }
   cinfo->global_state = jpegli::kEncReadImage;
@@ -1018,7 +1028,7 @@ JDIMENSION jpegli_write_raw_data(j_compress_ptr cinfo, JSAMPIMAGE data,
   }
   jpegli::ProgressMonitorInputPass(cinfo);
   if (cinfo->global_state == jpegli::kEncHeader &&
-      jpegli::IsStreamingSupported(cinfo)) {
+      jpegli::IsStreamingSupported(cinfo) && !cinfo->optimize_coding) {
     jpegli::WriteHeaderMarkers(cinfo);
   }
   cinfo->global_state = jpegli::kEncReadImage;
@@ -1075,7 +1085,7 @@ void jpegli_finish_compress(j_compress_ptr cinfo) {
                  cinfo->image_height, cinfo->next_scanline);
   }
 
-  if (jpegli::IsStreamingSupported(cinfo)) {
+  if (jpegli::IsStreamingSupported(cinfo) && !cinfo->optimize_coding) {
     jpegli::JumpToByteBoundary(&m->bw);
     if (!jpegli::EmptyBitWriterBuffer(&m->bw)) {
       JPEGLI_ERROR("Output suspension is not supported in finish_compress");
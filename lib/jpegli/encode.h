@@ -25,6 +25,8 @@
 #include <jpeglib.h>
 /* clang-format on */
 
+#include <jxl/parallel_runner.h>
+
 #include "lib/jpegli/common.h"
 
 #if defined(__cplusplus) || defined(c_plusplus)
@@ -144,6 +146,16 @@ void jpegli_set_progressive_level(j_compress_ptr cinfo, int level);
 // AC coefficients. Must be called before jpegli_set_defaults().
 void jpegli_use_standard_quant_tables(j_compress_ptr cinfo);
 
+// Sets the parallel runner used for computing the adaptive quantization field
+// and the DCT coefficients of the iMCU rows and, when restart markers are
+// enabled, for encoding the restart intervals of the scans. The output does not
+// depend on the runner. Streaming sequential encoding without restart markers
+// only uses it for the adaptive quantization field. The
+// runner must stay valid until jpegli_finish_compress() returns. Passing
+// nullptr as runner turns off multithreading, which is the default.
+void jpegli_set_parallel_runner(j_compress_ptr cinfo, JxlParallelRunner runner,
+                                void* runner_opaque);
+
 #if defined(__cplusplus) || defined(c_plusplus)
 }  // extern "C"
 #endif
@@ -6,7 +6,9 @@
 #include <stdio.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <thread>
 #include <vector>
 
 #include "lib/jpegli/encode.h"
@@ -92,6 +94,67 @@ TEST(EncodeAPITest, ReuseCinfoSameImageTwice) {
             memcmp(compressed0.data(), compressed1.data(), compressed0.size()));
 }
 
+// Parallel runner that runs the tasks of each call on a few new threads.
+JxlParallelRetCode TestRunner(void* runner_opaque, void* jpegxl_opaque,
+                              JxlParallelRunInit init,
+                              JxlParallelRunFunction func,
+                              uint32_t start_range, uint32_t end_range) {
+  const size_t num_threads = 4;
+  if (init(jpegxl_opaque, num_threads) != 0) return -1;
+  std::atomic<uint32_t> next_task{start_range};
+  std::vector<std::thread> threads;
+  for (size_t thread = 0; thread < num_threads; ++thread) {
+    threads.emplace_back([&, thread]() {
+      for (uint32_t task = next_task++; task < end_range; task = next_task++) {
+        func(jpegxl_opaque, task, thread);
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  return 0;
+}
+
+TEST(EncodeAPITest, ParallelRunnerSameOutput) {
+  TestImage input;
+  input.xsize = 1111;
+  input.ysize = 301;
+  GeneratePixels(&input);
+  // The last one is streaming sequential encoding, where only the adaptive
+  // quantization runs on the runner.
+  std::vector<CompressParams> all_jparams(5);
+  all_jparams[0].restart_interval = 1;
+  all_jparams[1].restart_in_rows = 1;
+  all_jparams[1].progressive_mode = 2;
+  all_jparams[2].restart_interval = 7;
+  all_jparams[2].h_sampling = {2, 1, 1};
+  all_jparams[2].v_sampling = {2, 1, 1};
+  all_jparams[2].optimize_coding = 1;
+  all_jparams[3].progressive_mode = 1;
+  for (const CompressParams& jparams : all_jparams) {
+    std::vector<uint8_t> compressed[2];
+    for (int use_runner = 0; use_runner < 2; ++use_runner) {
+      uint8_t* buffer = nullptr;
+      unsigned long buffer_size = 0;
+      jpeg_compress_struct cinfo;
+      const auto try_catch_block = [&]() -> bool {
+        ERROR_HANDLER_SETUP(jpegli);
+        jpegli_create_compress(&cinfo);
+        jpegli_mem_dest(&cinfo, &buffer, &buffer_size);
+        if (use_runner) {
+          jpegli_set_parallel_runner(&cinfo, TestRunner, nullptr);
+        }
+        EncodeWithJpegli(input, jparams, &cinfo);
+        return true;
+      };
+      EXPECT_TRUE(try_catch_block());
+      jpegli_destroy_compress(&cinfo);
+      compressed[use_runner].assign(buffer, buffer + buffer_size);
+      if (buffer) free(buffer);
+    }
+    EXPECT_EQ(compressed[0], compressed[1]);
+  }
+}
+
 std::vector<TestConfig> GenerateBasicConfigs() {
   std::vector<TestConfig> all_configs;
   for (int samp : {1, 2}) {
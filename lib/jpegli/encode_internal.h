@@ -54,6 +54,24 @@ struct ScanCodingInfo {
 
 typedef int16_t coeff_t;
 
+// A Huffman-coded symbol of an entropy-coded segment, together with its extra
+// bits, and the index of the histogram it belongs to.
+struct Token {
+  uint8_t histo_idx;
+  uint8_t symbol;
+  uint16_t bits;
+  Token(int i, int s, int b) : histo_idx(i), symbol(s), bits(b) {}
+};
+
+// Histogram index of the tokens that stand for a restart marker rather than
+// for a Huffman symbol; their symbol is the number of the restart marker.
+constexpr int kRestartMarkerToken = 8;
+
+struct TokenArray {
+  Token* tokens = nullptr;
+  size_t num_tokens = 0;
+};
+
 }  // namespace jpegli
 
 struct jpeg_comp_master {
@@ -95,9 +113,20 @@ struct jpeg_comp_master {
   size_t last_dht_index;
   size_t last_restart_interval;
   JCOEF last_dc_coeff[MAX_COMPS_IN_SCAN];
+  int restarts_to_go;
+  int next_restart_marker;
+  // Tokens of the single-scan optimized Huffman coding mode; the current token
+  // array is token_arrays[cur_token_array] with room for max_num_tokens.
+  jpegli::TokenArray* token_arrays;
+  size_t cur_token_array;
+  size_t total_num_tokens;
+  size_t max_num_tokens;
+  jpegli::Token* next_token;
   jpegli::JpegBitWriter bw;
   float* dct_buffer;
   int32_t* block_tmp;
+  JxlParallelRunner runner;
+  void* runner_opaque;
 };
 
 #endif  // LIB_JPEGLI_ENCODE_INTERNAL_H_
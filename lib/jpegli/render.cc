@@ -56,6 +56,7 @@ using hwy::HWY_NAMESPACE::Clamp;
 using hwy::HWY_NAMESPACE::Gt;
 using hwy::HWY_NAMESPACE::IfThenElseZero;
 using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
 using hwy::HWY_NAMESPACE::NearestInt;
 using hwy::HWY_NAMESPACE::Or;
 using hwy::HWY_NAMESPACE::Rebind;
@@ -194,6 +195,34 @@ float LimitError(float error) {
   return error > 0.0f ? abserror : -abserror;
 }
 
+// Computes the errors diffused to the next row from the quantization errors
+// of the current row.
+void DiffuseErrorsToNextRow(const float* JXL_RESTRICT error, size_t len,
+                            float* JXL_RESTRICT next_error_row) {
+  if (len == 1) {
+    next_error_row[0] = (kFSWeightBL + kFSWeightBM + kFSWeightBR) * error[0];
+    return;
+  }
+  next_error_row[0] = (kFSWeightBL + kFSWeightBM) * error[0] +  //
+                      kFSWeightBL * error[1];
+  const auto wbl = Set(d, kFSWeightBL);
+  const auto wbm = Set(d, kFSWeightBM);
+  const auto wbr = Set(d, kFSWeightBR);
+  size_t x = 1;
+  for (; x + Lanes(d) < len; x += Lanes(d)) {
+    auto sum = Mul(wbm, LoadU(d, error + x));
+    sum = MulAdd(wbl, LoadU(d, error + x + 1), sum);
+    sum = MulAdd(wbr, LoadU(d, error + x - 1), sum);
+    StoreU(sum, d, next_error_row + x);
+  }
+  for (; x + 1 < len; ++x) {
+    next_error_row[x] = kFSWeightBM * error[x] + kFSWeightBL * error[x + 1] +
+                        kFSWeightBR * error[x - 1];
+  }
+  next_error_row[len - 1] = (kFSWeightBM + kFSWeightBR) * error[len - 1] +
+                            kFSWeightBR * error[len - 2];
+}
+
 void WriteToOutput(j_decompress_ptr cinfo, float* JXL_RESTRICT rows[],
                    size_t xoffset, size_t len, size_t num_channels,
                    uint8_t* JXL_RESTRICT output) {
@@ -216,35 +245,38 @@ void WriteToOutput(j_decompress_ptr cinfo, float* JXL_RESTRICT rows[],
           error_row[c] = m->error_row_[c + kMaxComponents];
           next_error_row[c] = m->error_row_[c];
         }
-        memset(next_error_row[c], 0.0, cinfo->output_width * sizeof(float));
       }
     }
     const float mul = 255.0f;
     if (cinfo->dither_mode != JDITHER_FS) {
       StoreUnsignedRow(rows, xoffset, len, num_channels, mul, scratch_space);
+      for (size_t i = 0; i < len; ++i) {
+        output[i] = LookupColorIndex(cinfo, &scratch_space[num_channels * i]);
+      }
+      return;
     }
+    // Only the error diffused to the right neighbour has to be propagated
+    // pixel by pixel. The quantization error of each pixel replaces the
+    // already consumed error of the current row, and the errors diffused to
+    // the next row are computed from them afterwards with SIMD.
+    float carry[kMaxComponents] = {};
+    uint8_t pixel[kMaxComponents];
     for (size_t i = 0; i < len; ++i) {
-      uint8_t* pixel = &scratch_space[num_channels * i];
-      if (cinfo->dither_mode == JDITHER_FS) {
-        for (size_t c = 0; c < num_channels; ++c) {
-          float val = rows[c][i] * mul + LimitError(error_row[c][i]);
-          pixel[c] = std::round(std::min(255.0f, std::max(0.0f, val)));
-        }
+      for (size_t c = 0; c < num_channels; ++c) {
+        float val = rows[c][i] * mul + LimitError(error_row[c][i] + carry[c]);
+        pixel[c] = std::round(std::min(255.0f, std::max(0.0f, val)));
       }
       int index = LookupColorIndex(cinfo, pixel);
       output[i] = index;
-      if (cinfo->dither_mode == JDITHER_FS) {
-        size_t prev_i = i > 0 ? i - 1 : 0;
-        size_t next_i = i + 1 < len ? i + 1 : len - 1;
-        for (size_t c = 0; c < num_channels; ++c) {
-          float error = pixel[c] - cinfo->colormap[c][index];
-          error_row[c][next_i] += kFSWeightMR * error;
-          next_error_row[c][prev_i] += kFSWeightBL * error;
-          next_error_row[c][i] += kFSWeightBM * error;
-          next_error_row[c][next_i] += kFSWeightBR * error;
-        }
+      for (size_t c = 0; c < num_channels; ++c) {
+        float error = pixel[c] - cinfo->colormap[c][index];
+        carry[c] = kFSWeightMR * error;
+        error_row[c][i] = error;
       }
     }
+    for (size_t c = 0; c < num_channels; ++c) {
+      DiffuseErrorsToNextRow(error_row[c], len, next_error_row[c]);
+    }
   } else if (m->output_data_type_ == JPEGLI_TYPE_UINT8) {
     const float mul = 255.0;
     StoreUnsignedRow(rows, xoffset, len, num_channels, mul, scratch_space);
@@ -276,6 +308,79 @@ void WriteToOutput(j_decompress_ptr cinfo, float* JXL_RESTRICT rows[],
   }
 }
 
+// Computes one output row of a YCbCr image from the (horizontally already
+// upsampled) component rows and stores it as interleaved 8-bit RGB samples.
+// If kUpsampleVertically is true, the chroma samples are interpolated
+// between the rows cb[0] / cr[0] and their neighbouring rows cb[1] / cr[1].
+// This is equivalent to Upsample2Vertical, YCbCrToRGB, DecenterRow and
+// WriteToOutput, but without storing the intermediate results.
+template <bool kUpsampleVertically>
+void WriteYCbCrRowToRGB8(const float* JXL_RESTRICT row_y,
+                         const float* JXL_RESTRICT cb[2],
+                         const float* JXL_RESTRICT cr[2], size_t len,
+                         uint8_t* JXL_RESTRICT scratch_space,
+                         uint8_t* JXL_RESTRICT output) {
+  const HWY_CAPPED(float, 8) df;
+  const Rebind<uint8_t, decltype(df)> du;
+  const auto zero = Zero(df);
+  const auto mul = Set(df, 255.0f);
+  const auto c128 = Set(df, 128.0f / 255);
+  const auto threefour = Set(df, 0.75f);
+  const auto onefour = Set(df, 0.25f);
+  // Full-range BT.601, same as in YCbCrToRGB.
+  const auto crcr = Set(df, 1.402f);
+  const auto cgcb = Set(df, -0.114f * 1.772f / 0.587f);
+  const auto cgcr = Set(df, -0.299f * 1.402f / 0.587f);
+  const auto cbcb = Set(df, 1.772f);
+  const auto chroma = [&](const float* JXL_RESTRICT rows[2], size_t x) {
+    if (!kUpsampleVertically) return LoadU(df, rows[0] + x);
+    const auto mid = Mul(LoadU(df, rows[0] + x), threefour);
+    return MulAdd(LoadU(df, rows[1] + x), onefour, mid);
+  };
+  const auto to_uint8 = [&](Vec<decltype(df)> v) {
+    return DemoteTo(du, NearestInt(Clamp(zero, Mul(Add(v, c128), mul), mul)));
+  };
+  const auto write_pixels = [&](size_t x, uint8_t* JXL_RESTRICT out) {
+    const auto y_vec = LoadU(df, row_y + x);
+    const auto cb_vec = chroma(cb, x);
+    const auto cr_vec = chroma(cr, x);
+    const auto r_vec = MulAdd(crcr, cr_vec, y_vec);
+    const auto g_vec = MulAdd(cgcr, cr_vec, MulAdd(cgcb, cb_vec, y_vec));
+    const auto b_vec = MulAdd(cbcb, cb_vec, y_vec);
+    StoreInterleaved3(to_uint8(r_vec), to_uint8(g_vec), to_uint8(b_vec), du,
+                      out);
+  };
+  size_t x = 0;
+  for (; x + Lanes(df) <= len; x += Lanes(df)) {
+    write_pixels(x, &output[3 * x]);
+  }
+  if (x < len) {
+    // The output buffer has no padding, the last partial vector goes through
+    // the scratch space.
+#if JXL_MEMORY_SANITIZER
+    const size_t padding = x + Lanes(df) - len;
+    const float* rows[5] = {row_y, cb[0], cr[0], cb[1], cr[1]};
+    for (size_t c = 0; c < (kUpsampleVertically ? 5 : 3); ++c) {
+      __msan_unpoison(rows[c] + len, sizeof(rows[c][0]) * padding);
+    }
+#endif
+    write_pixels(x, scratch_space);
+    memcpy(&output[3 * x], scratch_space, 3 * (len - x));
+  }
+}
+
+void WriteYCbCrToRGB8(const float* JXL_RESTRICT row_y,
+                      const float* JXL_RESTRICT cb[2],
+                      const float* JXL_RESTRICT cr[2], size_t len,
+                      uint8_t* JXL_RESTRICT scratch_space,
+                      uint8_t* JXL_RESTRICT output) {
+  if (cb[1] != nullptr) {
+    WriteYCbCrRowToRGB8<true>(row_y, cb, cr, len, scratch_space, output);
+  } else {
+    WriteYCbCrRowToRGB8<false>(row_y, cb, cr, len, scratch_space, output);
+  }
+}
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jpegli
@@ -288,6 +393,7 @@ namespace jpegli {
 HWY_EXPORT(GatherBlockStats);
 HWY_EXPORT(WriteToOutput);
 HWY_EXPORT(DecenterRow);
+HWY_EXPORT(WriteYCbCrToRGB8);
 
 void GatherBlockStats(const int16_t* JXL_RESTRICT coeffs,
                       const size_t coeffs_size, int32_t* JXL_RESTRICT nonzeros,
@@ -307,6 +413,29 @@ void DecenterRow(float* row, size_t xsize) {
   return HWY_DYNAMIC_DISPATCH(DecenterRow)(row, xsize);
 }
 
+void WriteYCbCrToRGB8(const float* JXL_RESTRICT row_y,
+                      const float* JXL_RESTRICT cb[2],
+                      const float* JXL_RESTRICT cr[2], size_t len,
+                      uint8_t* JXL_RESTRICT scratch_space,
+                      uint8_t* JXL_RESTRICT output) {
+  return HWY_DYNAMIC_DISPATCH(WriteYCbCrToRGB8)(row_y, cb, cr, len,
+                                                scratch_space, output);
+}
+
+// Returns true if the output rows can be computed directly from the
+// component rows with WriteYCbCrToRGB8, i.e. for 8-bit RGB output of YCbCr
+// images where the luma component is not subsampled and the two chroma
+// components are subsampled the same way.
+bool UseFusedYCbCrToRGB8Output(j_decompress_ptr cinfo) {
+  jpeg_decomp_master* m = cinfo->master;
+  return (!cinfo->quantize_colors &&
+          m->output_data_type_ == JPEGLI_TYPE_UINT8 &&
+          cinfo->jpeg_color_space == JCS_YCbCr &&
+          cinfo->out_color_space == JCS_RGB && cinfo->num_components == 3 &&
+          cinfo->out_color_components == 3 && m->v_factor[0] == 1 &&
+          m->v_factor[1] == m->v_factor[2] && m->v_factor[1] <= 2);
+}
+
 // Padding for horizontal chroma upsampling.
 constexpr size_t kPaddingLeft = 64;
 constexpr size_t kPaddingRight = 64;
@@ -394,9 +523,8 @@ bool do_smoothing(j_decompress_ptr cinfo) {
 }
 
 void PredictSmooth(j_decompress_ptr cinfo, JBLOCKARRAY blocks, int component,
-                   size_t bx, int iy) {
+                   size_t bx, int iy, int16_t* scratch) {
   const size_t imcu_row = cinfo->output_iMCU_row;
-  int16_t* scratch = cinfo->master->smoothing_scratch_;
   std::vector<int> Q_VAL(SAVED_COEFS);
   int* coef_bits;
 
@@ -567,7 +695,6 @@ void PrepareForOutput(j_decompress_ptr cinfo) {
     m->render_output_[c].Allocate(cinfo, cinfo->max_v_samp_factor,
                                   output_stride);
   }
-  m->idct_scratch_ = Allocate<float>(cinfo, 5 * DCTSIZE2, JPOOL_IMAGE_ALIGNED);
   m->upsample_scratch_ = Allocate<float>(
       cinfo, output_stride + kPaddingLeft + kPaddingRight, JPOOL_IMAGE_ALIGNED);
   size_t bytes_per_sample = jpegli_bytes_per_sample(m->output_data_type_);
@@ -575,8 +702,6 @@ void PrepareForOutput(j_decompress_ptr cinfo) {
   size_t scratch_stride = RoundUpTo(output_stride, HWY_ALIGNMENT);
   m->output_scratch_ = Allocate<uint8_t>(
       cinfo, bytes_per_pixel * scratch_stride, JPOOL_IMAGE_ALIGNED);
-  m->smoothing_scratch_ =
-      Allocate<int16_t>(cinfo, DCTSIZE2, JPOOL_IMAGE_ALIGNED);
   bool smoothing = do_smoothing(cinfo);
   m->apply_smoothing = smoothing && cinfo->do_block_smoothing;
   size_t coeffs_per_block = cinfo->num_components * DCTSIZE2;
@@ -606,9 +731,21 @@ void PrepareForOutput(j_decompress_ptr cinfo) {
   ChooseColorTransform(cinfo);
 }
 
+// Number of blocks of a block row that are transformed by one task.
+constexpr size_t kIDCTBlocksPerTask = 128;
+
+// A range of blocks of one block row of a component in the current iMCU row.
+struct IDCTTask {
+  int c;
+  int iy;
+  size_t bx0;
+  size_t bx1;
+};
+
 void DecodeCurrentiMCURow(j_decompress_ptr cinfo) {
   jpeg_decomp_master* m = cinfo->master;
   const size_t imcu_row = cinfo->output_iMCU_row;
+  std::vector<IDCTTask> tasks;
   JBLOCKARRAY ba[kMaxComponents];
   for (int c = 0; c < cinfo->num_components; ++c) {
     const jpeg_component_info* comp = &cinfo->comp_info[c];
@@ -643,33 +780,52 @@ void DecodeCurrentiMCURow(j_decompress_ptr cinfo) {
                                       &m->biases_[k0]);
       }
     }
-    RowBuffer<float>* raw_out = &m->raw_output_[c];
     for (int iy = 0; iy < compinfo.v_samp_factor; ++iy) {
       size_t by = block_row + iy;
       if (by >= compinfo.height_in_blocks) {
         continue;
       }
-      size_t dctsize = m->scaled_dct_size[c];
-      int16_t* JXL_RESTRICT row_in = &ba[c][iy][0][0];
-      float* JXL_RESTRICT row_out = raw_out->Row(by * dctsize);
-      for (size_t bx = 0; bx < compinfo.width_in_blocks; ++bx) {
-        if (m->apply_smoothing) {
-          PredictSmooth(cinfo, ba[c], c, bx, iy);
-          (*m->inverse_transform[c])(m->smoothing_scratch_, &m->dequant_[k0],
-                                     &m->biases_[k0], m->idct_scratch_,
-                                     &row_out[bx * dctsize], raw_out->stride(),
-                                     dctsize);
-        } else {
-          (*m->inverse_transform[c])(&row_in[bx * DCTSIZE2], &m->dequant_[k0],
-                                     &m->biases_[k0], m->idct_scratch_,
-                                     &row_out[bx * dctsize], raw_out->stride(),
-                                     dctsize);
-        }
+      for (size_t bx0 = 0; bx0 < compinfo.width_in_blocks;
+           bx0 += kIDCTBlocksPerTask) {
+        size_t bx1 = std::min<size_t>(bx0 + kIDCTBlocksPerTask,
+                                      compinfo.width_in_blocks);
+        tasks.push_back({c, iy, bx0, bx1});
       }
-      if (m->streaming_mode_) {
-        memset(row_in, 0, compinfo.width_in_blocks * sizeof(JBLOCK));
+    }
+  }
+  const auto transform_blocks = [&](uint32_t i) {
+    const IDCTTask& task = tasks[i];
+    const int c = task.c;
+    const int iy = task.iy;
+    const size_t k0 = c * DCTSIZE2;
+    const size_t by = imcu_row * cinfo->comp_info[c].v_samp_factor + iy;
+    const size_t dctsize = m->scaled_dct_size[c];
+    RowBuffer<float>* raw_out = &m->raw_output_[c];
+    HWY_ALIGN_MAX float idct_scratch[5 * DCTSIZE2];
+    HWY_ALIGN_MAX int16_t smoothing_scratch[DCTSIZE2];
+    int16_t* JXL_RESTRICT row_in = &ba[c][iy][0][0];
+    float* JXL_RESTRICT row_out = raw_out->Row(by * dctsize);
+    for (size_t bx = task.bx0; bx < task.bx1; ++bx) {
+      if (m->apply_smoothing) {
+        PredictSmooth(cinfo, ba[c], c, bx, iy, smoothing_scratch);
+        (*m->inverse_transform[c])(smoothing_scratch, &m->dequant_[k0],
+                                   &m->biases_[k0], idct_scratch,
+                                   &row_out[bx * dctsize], raw_out->stride(),
+                                   dctsize);
+      } else {
+        (*m->inverse_transform[c])(&row_in[bx * DCTSIZE2], &m->dequant_[k0],
+                                   &m->biases_[k0], idct_scratch,
+                                   &row_out[bx * dctsize], raw_out->stride(),
+                                   dctsize);
       }
     }
+  };
+  RunOnRunner(cinfo, tasks.size(), transform_blocks);
+  if (m->streaming_mode_) {
+    for (const IDCTTask& task : tasks) {
+      memset(&ba[task.c][task.iy][task.bx0][0], 0,
+             (task.bx1 - task.bx0) * sizeof(JBLOCK));
+    }
   }
 }
 
@@ -716,6 +872,39 @@ void ProcessOutput(j_decompress_ptr cinfo, size_t* num_output_rows,
     yend = std::min<size_t>(yend, ybegin + max_output_rows - *num_output_rows);
     size_t yb = (ybegin / vfactor) * vfactor;
     size_t ye = DivCeil(yend, vfactor) * vfactor;
+    if (UseFusedYCbCrToRGB8Output(cinfo)) {
+      // Vertical chroma upsampling, color conversion and output are done in
+      // one pass over each output row.
+      const int cfactor = m->v_factor[1];
+      const bool fancy = cinfo->do_fancy_upsampling && cfactor == 2;
+      const size_t cheight = m->raw_height_[1];
+      for (size_t y = ybegin; y < yend; ++y) {
+        const size_t ymid = y / cfactor;
+        const float* cb[2] = {m->raw_output_[1].Row(ymid), nullptr};
+        const float* cr[2] = {m->raw_output_[2].Row(ymid), nullptr};
+        if (fancy) {
+          const bool top = (y % 2) == 0;
+          size_t ynb = top ? (ymid == 0 ? 0 : ymid - 1)
+                           : (ymid + 1 == cheight ? ymid : ymid + 1);
+          cb[1] = m->raw_output_[1].Row(ynb);
+          cr[1] = m->raw_output_[2].Row(ynb);
+        }
+        if (scanlines) {
+          const size_t x0 = m->xoffset_;
+          const float* row_y = m->raw_output_[0].Row(y) + x0;
+          const float* cb_x0[2] = {cb[0] + x0, fancy ? cb[1] + x0 : nullptr};
+          const float* cr_x0[2] = {cr[0] + x0, fancy ? cr[1] + x0 : nullptr};
+          WriteYCbCrToRGB8(row_y, cb_x0, cr_x0, cinfo->output_width,
+                           m->output_scratch_, scanlines[*num_output_rows]);
+        }
+        ++cinfo->output_scanline;
+        ++(*num_output_rows);
+        if (cinfo->output_scanline == cinfo->output_height) {
+          ++m->output_passes_done_;
+        }
+      }
+      return;
+    }
     for (size_t y = yb; y < ye; y += vfactor) {
       for (int c = 0; c < cinfo->num_components; ++c) {
         RowBuffer<float>* raw_out = &m->raw_output_[c];
@@ -112,6 +112,7 @@ TEST_P(StreamingTestParam, TestStreaming) {
     cinfo.comp_info[0].v_samp_factor = config.jparams.v_sampling[0];
     jpegli_set_progressive_level(&cinfo, 0);
     cinfo.optimize_coding = FALSE;
+    cinfo.restart_interval = config.jparams.restart_interval;
     jpegli_start_compress(&cinfo, TRUE);
 
     size_t stride = cinfo.image_width * cinfo.input_components;
@@ -201,12 +202,15 @@ std::vector<TestConfig> GenerateTests() {
   const size_t ysize0 = 1080;
   for (int dysize : {0, 1, 8, 9}) {
     for (int v_sampling : {1, 2}) {
-      TestConfig config;
-      config.input.xsize = xsize0;
-      config.input.ysize = ysize0 + dysize;
-      config.jparams.h_sampling = {1, 1, 1};
-      config.jparams.v_sampling = {v_sampling, 1, 1};
-      all_tests.push_back(config);
+      for (int restart_interval : {0, 7}) {
+        TestConfig config;
+        config.input.xsize = xsize0;
+        config.input.ysize = ysize0 + dysize;
+        config.jparams.h_sampling = {1, 1, 1};
+        config.jparams.v_sampling = {v_sampling, 1, 1};
+        config.jparams.restart_interval = restart_interval;
+        all_tests.push_back(config);
+      }
     }
   }
   return all_tests;
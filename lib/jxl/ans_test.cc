@@ -16,6 +16,7 @@
 #include "lib/jxl/enc_ans.h"
 #include "lib/jxl/enc_aux_out.h"
 #include "lib/jxl/enc_bit_writer.h"
+#include "lib/jxl/test_utils.h"
 #include "lib/jxl/testing.h"
 
 namespace jxl {
@@ -274,5 +275,84 @@ TEST(ANSTest, TestCheckpointingPrefixLZ77) {
   TestCheckpointing(/*ans=*/false, /*lz77=*/true);
 }
 
+void ExpectIndependentOfThreads(const HistogramParams& params,
+                                size_t num_contexts,
+                                const std::vector<std::vector<Token>>& tokens) {
+  const auto encode = [&](ThreadPool* pool, std::vector<uint8_t>* bytes) {
+    std::vector<std::vector<Token>> tokens_copy = tokens;
+    std::vector<uint8_t> context_map;
+    EntropyEncodingData codes;
+    BitWriter writer;
+    BuildAndEncodeHistograms(params, num_contexts, tokens_copy, &codes,
+                             &context_map, &writer, 0, nullptr, pool);
+    BitWriter::Allotment allotment(&writer, 8);
+    writer.ZeroPadToByte();
+    allotment.ReclaimAndCharge(&writer, 0, nullptr);
+    Span<const uint8_t> span = writer.GetSpan();
+    bytes->assign(span.data(), span.data() + span.size());
+    return context_map;
+  };
+  std::vector<uint8_t> bytes;
+  std::vector<uint8_t> context_map = encode(nullptr, &bytes);
+  test::ThreadPoolForTests pool(4);
+  std::vector<uint8_t> bytes_threads;
+  std::vector<uint8_t> context_map_threads = encode(&pool, &bytes_threads);
+  EXPECT_EQ(context_map, context_map_threads);
+  EXPECT_EQ(bytes, bytes_threads);
+}
+
+TEST(ANSTest, HistogramsIndependentOfThreads) {
+  constexpr size_t kNumContexts = 300;
+  constexpr size_t kNumStreams = 16;
+  Rng rng(0);
+  std::vector<std::vector<Token>> tokens(kNumStreams);
+  for (std::vector<Token>& stream : tokens) {
+    for (size_t j = 0; j < 1 << 14; j++) {
+      // Skew the values per context so that clustering has work to do.
+      uint32_t context = rng.UniformU(0, kNumContexts);
+      uint32_t value = rng.UniformU(0, 1 + context % 37);
+      stream.emplace_back(context, value);
+    }
+  }
+  for (HistogramParams::ClusteringType clustering :
+       {HistogramParams::ClusteringType::kFast,
+        HistogramParams::ClusteringType::kBest}) {
+    HistogramParams params;
+    params.clustering = clustering;
+    ExpectIndependentOfThreads(params, kNumContexts, tokens);
+  }
+}
+
+TEST(ANSTest, LZ77IndependentOfThreads) {
+  constexpr size_t kNumContexts = 4;
+  constexpr size_t kNumStreams = 8;
+  Rng rng(0);
+  std::vector<std::vector<Token>> tokens(kNumStreams);
+  for (std::vector<Token>& stream : tokens) {
+    // Random runs copied from earlier in the stream, so that there are
+    // matches of many lengths and distances.
+    for (size_t j = 0; j < 1 << 12; j++) {
+      if (stream.size() > 16 && rng.UniformU(0, 4) != 0) {
+        size_t dist = rng.UniformU(1, std::min<size_t>(stream.size(), 300));
+        size_t len = rng.UniformU(3, 40);
+        for (size_t k = 0; k < len; k++) {
+          const Token token = stream[stream.size() - dist];
+          stream.push_back(token);
+        }
+      } else {
+        stream.emplace_back(rng.UniformU(0, kNumContexts),
+                            rng.UniformU(0, 64));
+      }
+    }
+  }
+  for (HistogramParams::LZ77Method method :
+       {HistogramParams::LZ77Method::kLZ77,
+        HistogramParams::LZ77Method::kOptimal}) {
+    HistogramParams params;
+    params.lz77_method = method;
+    ExpectIndependentOfThreads(params, kNumContexts, tokens);
+  }
+}
+
 }  // namespace
 }  // namespace jxl
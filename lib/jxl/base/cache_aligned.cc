@@ -11,7 +11,7 @@
 // Disabled: slower than malloc + alignment.
 #define JXL_USE_MMAP 0
 
-#if JXL_USE_MMAP
+#if JXL_USE_MMAP || defined(__linux__)
 #include <sys/mman.h>
 #endif
 
@@ -30,27 +30,158 @@ namespace {
 struct AllocationHeader {
   void* allocated;
   size_t allocated_size;
+  // Where `allocated` comes from; a null free function means malloc.
+  JxlMemoryManager memory_manager;
+  // Where the allocation is accounted, besides the global statistics.
+  AllocationStats* stats;
+  uint8_t tag;
   uint8_t left_padding[hwy::kMaxVectorSize];
 };
 #pragma pack(pop)
 
-std::atomic<uint64_t> num_allocations{0};
-std::atomic<uint64_t> bytes_in_use{0};
-std::atomic<uint64_t> max_bytes_in_use{0};
+thread_local CacheAligned::Settings current_settings;
+
+AllocationStats global_stats;
+
+const char* TagName(JxlMemoryTag tag) {
+  switch (tag) {
+    case JXL_MEMORY_TAG_ALL:
+      return "all";
+    case JXL_MEMORY_TAG_OTHER:
+      return "other";
+    case JXL_MEMORY_TAG_RENDER_PIPELINE:
+      return "render pipeline";
+    case JXL_MEMORY_TAG_MODULAR:
+      return "modular";
+    case JXL_MEMORY_TAG_AC_COEFFICIENTS:
+      return "AC coefficients";
+    case JXL_MEMORY_TAG_BUTTERAUGLI:
+      return "butteraugli";
+    default:
+      return "?";
+  }
+}
 
 }  // namespace
 
+void AllocationStats::Counter::Add(size_t bytes) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  const uint64_t prev_bytes =
+      current_bytes.fetch_add(bytes, std::memory_order_acq_rel);
+  uint64_t expected_max = peak_bytes.load(std::memory_order_acquire);
+  for (;;) {
+    const uint64_t desired =
+        std::max<uint64_t>(expected_max, prev_bytes + bytes);
+    if (peak_bytes.compare_exchange_strong(expected_max, desired,
+                                           std::memory_order_acq_rel)) {
+      break;
+    }
+  }
+}
+
+// `tag` is never JXL_MEMORY_TAG_ALL, see ScopedTag.
+void AllocationStats::Add(JxlMemoryTag tag, size_t bytes) {
+  counters_[JXL_MEMORY_TAG_ALL].Add(bytes);
+  counters_[tag].Add(bytes);
+}
+
+void AllocationStats::Remove(JxlMemoryTag tag, size_t bytes) {
+  // Subtract (2's complement negation).
+  const uint64_t negated = ~uint64_t{bytes} + 1;
+  counters_[JXL_MEMORY_TAG_ALL].current_bytes.fetch_add(
+      negated, std::memory_order_acq_rel);
+  counters_[tag].current_bytes.fetch_add(negated, std::memory_order_acq_rel);
+}
+
+JxlMemoryUsage AllocationStats::Get(JxlMemoryTag tag) const {
+  JXL_ASSERT(tag < JXL_MEMORY_TAG_NUM);
+  const Counter& counter = counters_[tag];
+  JxlMemoryUsage usage;
+  usage.current_bytes = counter.current_bytes.load(std::memory_order_relaxed);
+  usage.peak_bytes = counter.peak_bytes.load(std::memory_order_relaxed);
+  usage.num_allocations =
+      counter.num_allocations.load(std::memory_order_relaxed);
+  return usage;
+}
+
 // Avoids linker errors in pre-C++17 builds.
 constexpr size_t CacheAligned::kPointerSize;
 constexpr size_t CacheAligned::kCacheLineSize;
 constexpr size_t CacheAligned::kAlignment;
 constexpr size_t CacheAligned::kAlias;
+constexpr size_t CacheAligned::kHugePageSize;
+constexpr size_t CacheAligned::kMinHugePageAllocation;
 
 void CacheAligned::PrintStats() {
-  fprintf(
-      stderr, "Allocations: %" PRIuS " (max bytes in use: %E)\n",
-      static_cast<size_t>(num_allocations.load(std::memory_order_relaxed)),
-      static_cast<double>(max_bytes_in_use.load(std::memory_order_relaxed)));
+  const JxlMemoryUsage all = global_stats.Get(JXL_MEMORY_TAG_ALL);
+  fprintf(stderr, "Allocations: %" PRIuS " (max bytes in use: %E)\n",
+          static_cast<size_t>(all.num_allocations),
+          static_cast<double>(all.peak_bytes));
+  for (int i = JXL_MEMORY_TAG_ALL + 1; i < JXL_MEMORY_TAG_NUM; ++i) {
+    const JxlMemoryTag tag = static_cast<JxlMemoryTag>(i);
+    const JxlMemoryUsage usage = global_stats.Get(tag);
+    if (usage.num_allocations == 0) continue;
+    fprintf(stderr, "  %-16s %10" PRIuS " allocations, max bytes %E\n",
+            TagName(tag), static_cast<size_t>(usage.num_allocations),
+            static_cast<double>(usage.peak_bytes));
+  }
+}
+
+const AllocationStats& CacheAligned::GlobalStats() { return global_stats; }
+
+CacheAligned::ScopedMemoryManager::ScopedMemoryManager(
+    const JxlMemoryManager* memory_manager)
+    : previous_(current_settings.memory_manager) {
+  current_settings.memory_manager = memory_manager;
+}
+
+CacheAligned::ScopedMemoryManager::~ScopedMemoryManager() {
+  current_settings.memory_manager = previous_;
+}
+
+const JxlMemoryManager* CacheAligned::CurrentMemoryManager() {
+  return current_settings.memory_manager;
+}
+
+CacheAligned::ScopedHugePages::ScopedHugePages(bool enabled)
+    : previous_(current_settings.huge_pages) {
+  current_settings.huge_pages = enabled;
+}
+
+CacheAligned::ScopedHugePages::~ScopedHugePages() {
+  current_settings.huge_pages = previous_;
+}
+
+bool CacheAligned::HugePagesEnabled() { return current_settings.huge_pages; }
+
+CacheAligned::ScopedTag::ScopedTag(JxlMemoryTag tag)
+    : previous_(current_settings.tag) {
+  JXL_ASSERT(tag > JXL_MEMORY_TAG_ALL && tag < JXL_MEMORY_TAG_NUM);
+  current_settings.tag = tag;
+}
+
+CacheAligned::ScopedTag::~ScopedTag() { current_settings.tag = previous_; }
+
+CacheAligned::ScopedStats::ScopedStats(AllocationStats* stats)
+    : previous_(current_settings.stats) {
+  current_settings.stats = stats;
+}
+
+CacheAligned::ScopedStats::~ScopedStats() {
+  current_settings.stats = previous_;
+}
+
+const CacheAligned::Settings& CacheAligned::CurrentSettings() {
+  return current_settings;
+}
+
+CacheAligned::ScopedSettings::ScopedSettings(const Settings& settings)
+    : previous_(current_settings) {
+  current_settings = settings;
+}
+
+CacheAligned::ScopedSettings::~ScopedSettings() {
+  current_settings = previous_;
 }
 
 size_t CacheAligned::NextOffset() {
@@ -84,15 +215,38 @@ void* CacheAligned::Allocate(const size_t payload_size, size_t offset) {
   if (allocated == MAP_FAILED) return nullptr;
   const uintptr_t aligned = reinterpret_cast<uintptr_t>(allocated);
 #else
-  const size_t allocated_size = kAlias + offset + payload_size;
-  void* allocated = malloc(allocated_size);
+  const JxlMemoryManager* memory_manager = current_settings.memory_manager;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  const bool huge_pages =
+      current_settings.huge_pages && payload_size >= kMinHugePageAllocation;
+#else
+  const bool huge_pages = false;
+#endif
+  // Huge pages need the payload to start at a huge page boundary (plus the
+  // offset) to be used for all of it.
+  const size_t alignment = huge_pages ? kHugePageSize : kAlias;
+  const size_t allocated_size = alignment + offset + payload_size;
+  void* allocated =
+      memory_manager != nullptr
+          ? memory_manager->alloc(memory_manager->opaque, allocated_size)
+          : malloc(allocated_size);
   if (allocated == nullptr) return nullptr;
-  // Always round up even if already aligned - we already asked for kAlias
-  // extra bytes and there's no way to give them back.
-  uintptr_t aligned = reinterpret_cast<uintptr_t>(allocated) + kAlias;
+  // Always round up even if already aligned - we already asked for
+  // `alignment` extra bytes and there's no way to give them back.
+  uintptr_t aligned = reinterpret_cast<uintptr_t>(allocated) + alignment;
   static_assert((kAlias & (kAlias - 1)) == 0, "kAlias must be a power of 2");
   static_assert(kAlias >= kAlignment, "Cannot align to more than kAlias");
-  aligned &= ~(kAlias - 1);
+  static_assert(kHugePageSize % kAlias == 0, "Huge pages must keep the offset");
+  aligned &= ~(alignment - 1);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (huge_pages) {
+    // Only advice: if huge pages are not available, the regular ones are used.
+    const uintptr_t end =
+        (aligned + offset + payload_size) & ~(kHugePageSize - 1);
+    (void)madvise(reinterpret_cast<void*>(aligned), end - aligned,
+                  MADV_HUGEPAGE);
+  }
+#endif
 #endif
 
 #if 0
@@ -111,18 +265,10 @@ void* CacheAligned::Allocate(const size_t payload_size, size_t offset) {
 #endif
 
   // Update statistics (#allocations and max bytes in use)
-  num_allocations.fetch_add(1, std::memory_order_relaxed);
-  const uint64_t prev_bytes =
-      bytes_in_use.fetch_add(allocated_size, std::memory_order_acq_rel);
-  uint64_t expected_max = max_bytes_in_use.load(std::memory_order_acquire);
-  for (;;) {
-    const uint64_t desired =
-        std::max(expected_max, prev_bytes + allocated_size);
-    if (max_bytes_in_use.compare_exchange_strong(expected_max, desired,
-                                                 std::memory_order_acq_rel)) {
-      break;
-    }
-  }
+  const JxlMemoryTag tag = current_settings.tag;
+  AllocationStats* stats = current_settings.stats;
+  global_stats.Add(tag, allocated_size);
+  if (stats != nullptr) stats->Add(tag, allocated_size);
 
   const uintptr_t payload = aligned + offset;  // still aligned
 
@@ -130,6 +276,14 @@ void* CacheAligned::Allocate(const size_t payload_size, size_t offset) {
   AllocationHeader* header = reinterpret_cast<AllocationHeader*>(payload) - 1;
   header->allocated = allocated;
   header->allocated_size = allocated_size;
+  header->stats = stats;
+  header->tag = static_cast<uint8_t>(tag);
+#if JXL_USE_MMAP
+  header->memory_manager = JxlMemoryManager();
+#else
+  header->memory_manager =
+      memory_manager != nullptr ? *memory_manager : JxlMemoryManager();
+#endif
 
   return JXL_ASSUME_ALIGNED(reinterpret_cast<void*>(payload), 64);
 }
@@ -143,14 +297,21 @@ void CacheAligned::Free(const void* aligned_pointer) {
   const AllocationHeader* header =
       reinterpret_cast<const AllocationHeader*>(payload) - 1;
 
-  // Subtract (2's complement negation).
-  bytes_in_use.fetch_add(~header->allocated_size + 1,
-                         std::memory_order_acq_rel);
+  const JxlMemoryTag tag = static_cast<JxlMemoryTag>(header->tag);
+  global_stats.Remove(tag, header->allocated_size);
+  if (header->stats != nullptr) {
+    header->stats->Remove(tag, header->allocated_size);
+  }
 
 #if JXL_USE_MMAP
   munmap(header->allocated, header->allocated_size);
 #else
-  free(header->allocated);
+  if (header->memory_manager.free != nullptr) {
+    header->memory_manager.free(header->memory_manager.opaque,
+                                header->allocated);
+  } else {
+    free(header->allocated);
+  }
 #endif
 }
 
@@ -8,20 +8,47 @@
 
 // Memory allocator with support for alignment + misalignment.
 
+#include <jxl/memory_manager.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include <atomic>
 #include <memory>
 
 #include "lib/jxl/base/compiler_specific.h"
 
 namespace jxl {
 
+// Current and peak bytes of the allocations of each JxlMemoryTag. Thread-safe.
+class AllocationStats {
+ public:
+  void Add(JxlMemoryTag tag, size_t bytes);
+  void Remove(JxlMemoryTag tag, size_t bytes);
+
+  // `tag` must be less than JXL_MEMORY_TAG_NUM.
+  JxlMemoryUsage Get(JxlMemoryTag tag) const;
+
+ private:
+  struct Counter {
+    void Add(size_t bytes);
+
+    std::atomic<uint64_t> current_bytes{0};
+    std::atomic<uint64_t> peak_bytes{0};
+    std::atomic<uint64_t> num_allocations{0};
+  };
+
+  Counter counters_[JXL_MEMORY_TAG_NUM];
+};
+
 // Functions that depend on the cache line size.
 class CacheAligned {
  public:
+  // Prints the statistics of all the allocations of the process.
   static void PrintStats();
 
+  // Returns the statistics of all the allocations of the process.
+  static const AllocationStats& GlobalStats();
+
   static constexpr size_t kPointerSize = sizeof(void*);
   static constexpr size_t kCacheLineSize = 64;
   // To avoid RFOs, match L2 fill size (pairs of lines).
@@ -44,6 +71,102 @@ class CacheAligned {
   }
 
   static void Free(const void* aligned_pointer);
+
+  // While an instance is alive, Allocate on the same thread gets its memory
+  // from the given memory manager instead of malloc; nullptr restores malloc.
+  // The memory manager must stay valid until the allocations are freed, on
+  // any thread. Scopes can be nested.
+  class ScopedMemoryManager {
+   public:
+    explicit ScopedMemoryManager(const JxlMemoryManager* memory_manager);
+    ~ScopedMemoryManager();
+    ScopedMemoryManager(const ScopedMemoryManager&) = delete;
+    ScopedMemoryManager& operator=(const ScopedMemoryManager&) = delete;
+
+   private:
+    const JxlMemoryManager* previous_;
+  };
+
+  // Returns the memory manager of the innermost ScopedMemoryManager of this
+  // thread, or nullptr.
+  static const JxlMemoryManager* CurrentMemoryManager();
+
+  // Allocations of at least this size may be backed by huge pages.
+  static constexpr size_t kHugePageSize = size_t{2} << 20;
+  static constexpr size_t kMinHugePageAllocation = 4 * kHugePageSize;
+
+  // While an instance with `enabled` is alive, large allocations on the same
+  // thread are aligned to kHugePageSize (plus the usual offset) and marked
+  // for transparent huge pages, which reduces TLB misses and the number of
+  // page faults on first use. Only has an effect on Linux. Scopes can be
+  // nested.
+  class ScopedHugePages {
+   public:
+    explicit ScopedHugePages(bool enabled);
+    ~ScopedHugePages();
+    ScopedHugePages(const ScopedHugePages&) = delete;
+    ScopedHugePages& operator=(const ScopedHugePages&) = delete;
+
+   private:
+    bool previous_;
+  };
+
+  // Returns whether the innermost ScopedHugePages of this thread enables huge
+  // pages.
+  static bool HugePagesEnabled();
+
+  // While an instance is alive, allocations on the same thread are accounted
+  // under `tag`, both in the global statistics and in the ones of the
+  // innermost ScopedStats. Scopes can be nested.
+  class ScopedTag {
+   public:
+    explicit ScopedTag(JxlMemoryTag tag);
+    ~ScopedTag();
+    ScopedTag(const ScopedTag&) = delete;
+    ScopedTag& operator=(const ScopedTag&) = delete;
+
+   private:
+    JxlMemoryTag previous_;
+  };
+
+  // While an instance is alive, allocations on the same thread are also
+  // accounted in `stats` (unless null), which must outlive them. Scopes can be
+  // nested.
+  class ScopedStats {
+   public:
+    explicit ScopedStats(AllocationStats* stats);
+    ~ScopedStats();
+    ScopedStats(const ScopedStats&) = delete;
+    ScopedStats& operator=(const ScopedStats&) = delete;
+
+   private:
+    AllocationStats* previous_;
+  };
+
+  // All the settings of the scopes above.
+  struct Settings {
+    const JxlMemoryManager* memory_manager = nullptr;
+    bool huge_pages = false;
+    JxlMemoryTag tag = JXL_MEMORY_TAG_OTHER;
+    AllocationStats* stats = nullptr;
+  };
+
+  // Returns the settings of the innermost scopes of this thread.
+  static const Settings& CurrentSettings();
+
+  // While an instance is alive, the allocations on the same thread use
+  // `settings`, as if the scopes that produced them were installed. Used to
+  // carry the settings over to the threads of a ThreadPool.
+  class ScopedSettings {
+   public:
+    explicit ScopedSettings(const Settings& settings);
+    ~ScopedSettings();
+    ScopedSettings(const ScopedSettings&) = delete;
+    ScopedSettings& operator=(const ScopedSettings&) = delete;
+
+   private:
+    Settings previous_;
+  };
 };
 
 // Avoids the need for a function pointer (deleter) in CacheAlignedUniquePtr.
@@ -20,4 +20,16 @@ JxlParallelRetCode ThreadPool::SequentialRunnerStatic(
   return 0;
 }
 
+// static
+JxlParallelRetCode ThreadPool::HintedRunnerStatic(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range) {
+  const ThreadPool* self = static_cast<const ThreadPool*>(runner_opaque);
+  JxlParallelRunHints hints;
+  hints.task_cost_ns = 0;
+  hints.label = "";
+  return (*self->hinted_runner_)(self->hinted_runner_opaque_, jpegxl_opaque,
+                                 init, func, start_range, end_range, &hints);
+}
+
 }  // namespace jxl
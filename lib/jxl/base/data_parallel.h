@@ -13,7 +13,11 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <cstddef>
+
 #include "lib/jxl/base/bits.h"
+#include "lib/jxl/base/cache_aligned.h"
+#include "lib/jxl/base/profiler.h"
 #include "lib/jxl/base/status.h"
 #if JXL_COMPILER_MSVC
 // suppress warnings about the const & applied to function types
@@ -28,6 +32,18 @@ class ThreadPool {
       : runner_(runner ? runner : &ThreadPool::SequentialRunnerStatic),
         runner_opaque_(runner ? runner_opaque : static_cast<void*>(this)) {}
 
+  // Uses a runner that receives a JxlParallelRunHints for each run.
+  ThreadPool(JxlParallelRunnerWithHints runner, void* runner_opaque)
+      : runner_(runner ? &ThreadPool::HintedRunnerStatic
+                       : &ThreadPool::SequentialRunnerStatic),
+        runner_opaque_(static_cast<void*>(this)),
+        hinted_runner_(runner),
+        hinted_runner_opaque_(runner_opaque) {}
+
+  // Uses the sequential runner.
+  ThreadPool(std::nullptr_t runner, void* runner_opaque)
+      : ThreadPool(static_cast<JxlParallelRunner>(nullptr), runner_opaque) {}
+
   ThreadPool(const ThreadPool&) = delete;
   ThreadPool& operator&(const ThreadPool&) = delete;
 
@@ -38,18 +54,38 @@ class ThreadPool {
   // thread(s) for every task in [begin, end). init_func() must return a Status
   // indicating whether the initialization succeeded.
   // "thread" is an integer smaller than num_threads.
-  // Not thread-safe - no two calls to Run may overlap.
+  // Not thread-safe - no two calls to Run may overlap, unless the runner
+  // supports nested calls and the overlapping calls are made from data_func.
   // Subsequent calls will reuse the same threads.
+  // Allocations in init_func and data_func use the memory manager and huge
+  // page setting of the CacheAligned scopes active when calling Run, if any.
+  // "caller" and "task_cost_ns" (the estimated time of one data_func call, or
+  // 0 if unknown) are passed to runners that accept JxlParallelRunHints.
+  // With the profiler, the whole call and each data_func call are zones named
+  // "caller", with the number of tasks or the task index as argument.
   //
   // Precondition: begin <= end.
   template <class InitFunc, class DataFunc>
   Status Run(uint32_t begin, uint32_t end, const InitFunc& init_func,
-             const DataFunc& data_func, const char* caller = "") {
+             const DataFunc& data_func, const char* caller = "",
+             uint64_t task_cost_ns = 0) {
     JXL_ASSERT(begin <= end);
     if (begin == end) return true;
-    RunCallState<InitFunc, DataFunc> call_state(init_func, data_func);
-    // The runner_ uses the C convention and returns 0 in case of error, so we
+    if (caller == nullptr) caller = "";
+    PROFILER_ZONE_ARG(caller, end - begin);
+    RunCallState<InitFunc, DataFunc> call_state(init_func, data_func, caller);
+    // The runners use the C convention and return 0 in case of error, so we
     // convert it to a Status.
+    if (hinted_runner_ != nullptr) {
+      JxlParallelRunHints hints;
+      hints.task_cost_ns = task_cost_ns;
+      hints.label = caller;
+      return (*hinted_runner_)(hinted_runner_opaque_,
+                               static_cast<void*>(&call_state),
+                               &call_state.CallInitFunc,
+                               &call_state.CallDataFunc, begin, end,
+                               &hints) == 0;
+    }
     return (*runner_)(runner_opaque_, static_cast<void*>(&call_state),
                       &call_state.CallInitFunc, &call_state.CallDataFunc, begin,
                       end) == 0;
@@ -64,13 +100,18 @@ class ThreadPool {
   template <class InitFunc, class DataFunc>
   class RunCallState final {
    public:
-    RunCallState(const InitFunc& init_func, const DataFunc& data_func)
-        : init_func_(init_func), data_func_(data_func) {}
+    RunCallState(const InitFunc& init_func, const DataFunc& data_func,
+                 const char* caller)
+        : init_func_(init_func),
+          data_func_(data_func),
+          caller_(caller),
+          settings_(CacheAligned::CurrentSettings()) {}
 
     // JxlParallelRunInit interface.
     static int CallInitFunc(void* jpegxl_opaque, size_t num_threads) {
       const auto* self =
           static_cast<RunCallState<InitFunc, DataFunc>*>(jpegxl_opaque);
+      CacheAligned::ScopedSettings scope(self->settings_);
       // Returns -1 when the internal init function returns false Status to
       // indicate an error.
       return self->init_func_(num_threads) ? 0 : -1;
@@ -81,12 +122,17 @@ class ThreadPool {
                              size_t thread_id) {
       const auto* self =
           static_cast<RunCallState<InitFunc, DataFunc>*>(jpegxl_opaque);
+      CacheAligned::ScopedSettings scope(self->settings_);
+      PROFILER_ZONE_ARG(self->caller_, value);
       return self->data_func_(value, thread_id);
     }
 
    private:
     const InitFunc& init_func_;
     const DataFunc& data_func_;
+    const char* caller_;
+    // Allocation settings of the thread that called Run.
+    const CacheAligned::Settings settings_;
   };
 
   // Default JxlParallelRunner used when no runner is provided by the
@@ -95,20 +141,29 @@ class ThreadPool {
       void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
       JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range);
 
+  // JxlParallelRunner returned by runner() when a JxlParallelRunnerWithHints
+  // was provided; runner_opaque is the ThreadPool. Passes empty hints.
+  static JxlParallelRetCode HintedRunnerStatic(
+      void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+      JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range);
+
   // The caller supplied runner function and its opaque void*.
   const JxlParallelRunner runner_;
   void* const runner_opaque_;
+  // The caller supplied runner with hints, if any, and its opaque void*.
+  const JxlParallelRunnerWithHints hinted_runner_ = nullptr;
+  void* const hinted_runner_opaque_ = nullptr;
 };
 
 template <class InitFunc, class DataFunc>
 Status RunOnPool(ThreadPool* pool, const uint32_t begin, const uint32_t end,
                  const InitFunc& init_func, const DataFunc& data_func,
-                 const char* caller) {
+                 const char* caller, uint64_t task_cost_ns = 0) {
   if (pool == nullptr) {
     ThreadPool default_pool(nullptr, nullptr);
     return default_pool.Run(begin, end, init_func, data_func, caller);
   } else {
-    return pool->Run(begin, end, init_func, data_func, caller);
+    return pool->Run(begin, end, init_func, data_func, caller, task_cost_ns);
   }
 }
 
@@ -13,10 +13,21 @@
 
 #include <algorithm>  // sort
 #include <atomic>
+#include <chrono>
 #include <cinttypes>  // PRIu64
 #include <hwy/cache_control.h>
 #include <limits>
 #include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define JXL_PROFILER_HAS_PERF_EVENTS 1
+#else
+#define JXL_PROFILER_HAS_PERF_EVENTS 0
+#endif
 
 // Optionally use SIMD in StreamCacheLine if available.
 #undef HWY_TARGET_INCLUDE
@@ -87,13 +98,74 @@ struct ActiveZone {
   const char* name;
   uint64_t entry_timestamp;
   uint64_t child_total;
+  uint64_t argument;
+  bool has_argument;
+  bool has_counters;
+  uint64_t entry_counters[kNumCounters];
+  uint64_t child_counters[kNumCounters];
+};
+
+// One exited zone, for the trace.
+struct TraceEvent {
+  const char* name;
+  uint64_t entry_timestamp;
+  uint64_t duration;
+  uint64_t argument;
+  bool has_argument;
+};
+
+// Could be static members of Zone, but that would expose <atomic> in header.
+std::atomic<bool>& TraceEnabled() {
+  static std::atomic<bool> trace_enabled{false};
+  return trace_enabled;
+}
+
+// Timestamps of EnableTrace, to convert ticks to microseconds.
+struct TraceStart {
+  uint64_t ticks;
+  std::chrono::steady_clock::time_point time;
 };
 
+TraceStart& GetTraceStart() {
+  static TraceStart trace_start;
+  return trace_start;
+}
+
+std::atomic<bool>& CountersEnabled() {
+  static std::atomic<bool> counters_enabled{false};
+  return counters_enabled;
+}
+
+// Indices of the hardware counters in the counter packets.
+enum Counter : size_t {
+  kCycles,
+  kInstructions,
+  kCacheMisses,
+  kBranchMisses,
+};
+
+void WriteJSONString(const char* s, FILE* file) {
+  fputc('"', file);
+  for (; *s != '\0'; ++s) {
+    const unsigned char c = static_cast<unsigned char>(*s);
+    if (c == '"' || c == '\\') {
+      fputc('\\', file);
+      fputc(c, file);
+    } else if (c < 0x20) {
+      fprintf(file, "\\u%04x", c);
+    } else {
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
+
 // Totals for all Zones with the same name. POD, must be zero-initialized.
 struct ZoneTotals {
   uint64_t total_duration;
   const char* name;
   uint64_t num_calls;
+  uint64_t counters[kNumCounters];  // Self counts, zero if not enabled.
 };
 
 template <typename T>
@@ -106,6 +178,76 @@ inline T ClampedSubtract(const T minuend, const T subtrahend) {
 
 }  // namespace
 
+// Hardware performance counters of one thread, read all at once.
+class CounterGroup {
+ public:
+  // Returns nullptr if the cycle counter cannot be opened for the calling
+  // thread. The other counters are optional.
+  static CounterGroup* Open() {
+#if JXL_PROFILER_HAS_PERF_EVENTS
+    static constexpr uint64_t kConfigs[kNumCounters] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    CounterGroup* group = new CounterGroup;
+    for (size_t i = 0; i < kNumCounters; ++i) {
+      group->fds_[i] = OpenCounter(kConfigs[i], i == 0 ? -1 : group->fds_[0]);
+      if (i == 0 && group->fds_[0] < 0) {
+        delete group;
+        return nullptr;
+      }
+    }
+    return group;
+#else
+    return nullptr;
+#endif
+  }
+
+  ~CounterGroup() {
+#if JXL_PROFILER_HAS_PERF_EVENTS
+    for (int fd : fds_) {
+      if (fd >= 0) close(fd);
+    }
+#endif
+  }
+
+  // Stores the current counts in `values`, zero for unavailable counters.
+  void Read(uint64_t* HWY_RESTRICT values) const {
+    memset(values, 0, kNumCounters * sizeof(*values));
+#if JXL_PROFILER_HAS_PERF_EVENTS
+    // Layout of PERF_FORMAT_GROUP: number of counters, then their values in
+    // the order in which they were opened.
+    uint64_t group[1 + kNumCounters];
+    const ssize_t size = read(fds_[0], group, sizeof(group));
+    if (size < static_cast<ssize_t>(sizeof(uint64_t))) return;
+    size_t opened = 0;
+    for (size_t i = 0; i < kNumCounters && opened < group[0]; ++i) {
+      if (fds_[i] >= 0) values[i] = group[1 + opened++];
+    }
+#endif
+  }
+
+ private:
+  CounterGroup() = default;
+
+#if JXL_PROFILER_HAS_PERF_EVENTS
+  // Counts the user space events of the calling thread, on any CPU.
+  static int OpenCounter(uint64_t config, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, /*pid=*/0,
+                                    /*cpu=*/-1, group_fd, /*flags=*/0));
+  }
+#endif
+
+  int fds_[kNumCounters];  // Negative if unavailable, fds_[0] is the leader.
+};
+
 // Per-thread call graph (stack) and ZoneTotals for each zone.
 class Results {
  public:
@@ -119,7 +261,7 @@ class Results {
   uint64_t ZoneDuration(const Packet* packets) {
     HWY_ASSERT(depth_ == 0);
     HWY_ASSERT(num_zones_ == 0);
-    AnalyzePackets(packets, 2);
+    AnalyzePackets(packets, 2, /*record_trace=*/false);
     const uint64_t duration = zones_[0].total_duration;
     zones_[0].num_calls = 0;
     zones_[0].total_duration = 0;
@@ -136,23 +278,52 @@ class Results {
     child_overhead_ = child_overhead;
   }
 
+  // The counters are read before the exit timestamp of a zone, and before the
+  // entry timestamp, i.e. outside of the zone but inside of its parent.
+  void AddCounterOverhead(const uint64_t counter_overhead) {
+    self_overhead_ += counter_overhead;
+    child_overhead_ += counter_overhead;
+  }
+
   // Draw all required information from the packets, which can be discarded
   // afterwards. Called whenever this thread's storage is full.
   void AnalyzePackets(const Packet* HWY_RESTRICT packets,
-                      const size_t num_packets) {
+                      const size_t num_packets, bool record_trace = true) {
     // Ensures prior weakly-ordered streaming stores are globally visible.
     hwy::FlushStream();
 
     const uint64_t t0 = TicksBefore();
+    record_trace =
+        record_trace && TraceEnabled().load(std::memory_order_acquire);
 
     for (size_t i = 0; i < num_packets; ++i) {
       const uint64_t timestamp = packets[i].timestamp;
+      const size_t counter = reinterpret_cast<uintptr_t>(packets[i].name) -
+                             reinterpret_cast<uintptr_t>(CounterPacketName(0));
+      if (counter < kNumCounters) {
+        counter_values_[counter] = timestamp;
+        has_counter_values_ = true;
+        continue;
+      }
+      if (packets[i].name == ArgumentPacketName()) {
+        HWY_ASSERT(depth_ != 0);
+        zone_stack_[depth_ - 1].argument = timestamp;
+        zone_stack_[depth_ - 1].has_argument = true;
+        continue;
+      }
       // Entering a zone
       if (packets[i].name != nullptr) {
         HWY_ASSERT(depth_ < kMaxDepth);
         zone_stack_[depth_].name = packets[i].name;
         zone_stack_[depth_].entry_timestamp = timestamp;
         zone_stack_[depth_].child_total = 0;
+        zone_stack_[depth_].has_argument = false;
+        zone_stack_[depth_].has_counters = has_counter_values_;
+        memcpy(zone_stack_[depth_].entry_counters, counter_values_,
+               sizeof(counter_values_));
+        memset(zone_stack_[depth_].child_counters, 0,
+               sizeof(zone_stack_[depth_].child_counters));
+        has_counter_values_ = false;
         ++depth_;
         continue;
       }
@@ -163,12 +334,33 @@ class Results {
       const uint64_t self_duration = ClampedSubtract(
           duration, self_overhead_ + child_overhead_ + active.child_total);
 
-      UpdateOrAdd(active.name, 1, self_duration);
+      uint64_t counters[kNumCounters] = {};
+      const bool has_counters = active.has_counters && has_counter_values_;
+      has_counter_values_ = false;
+      if (has_counters) {
+        for (size_t c = 0; c < kNumCounters; ++c) {
+          counters[c] = counter_values_[c] - active.entry_counters[c];
+        }
+      }
+
+      uint64_t self_counters[kNumCounters];
+      for (size_t c = 0; c < kNumCounters; ++c) {
+        self_counters[c] =
+            ClampedSubtract(counters[c], active.child_counters[c]);
+      }
+      UpdateOrAdd(active.name, 1, self_duration, self_counters);
+      if (record_trace) {
+        trace_events_.push_back({active.name, active.entry_timestamp, duration,
+                                 active.argument, active.has_argument});
+      }
       --depth_;
 
       // "Deduct" the nested time from its parent's self_duration.
       if (depth_ != 0) {
         zone_stack_[depth_ - 1].child_total += duration + child_overhead_;
+        for (size_t c = 0; c < kNumCounters; ++c) {
+          zone_stack_[depth_ - 1].child_counters[c] += counters[c];
+        }
       }
     }
 
@@ -185,7 +377,8 @@ class Results {
 
     for (size_t i = 0; i < other.num_zones_; ++i) {
       const ZoneTotals& zone = other.zones_[i];
-      UpdateOrAdd(zone.name, zone.num_calls, zone.total_duration);
+      UpdateOrAdd(zone.name, zone.num_calls, zone.total_duration,
+                  zone.counters);
     }
     const uint64_t t1 = TicksAfter();
     analyze_elapsed_ += t1 - t0 + other.analyze_elapsed_;
@@ -202,13 +395,32 @@ class Results {
                 return r1.total_duration > r2.total_duration;
               });
 
+    const bool print_counters = CountersEnabled().load();
+    if (print_counters) {
+      // Miss rates are per thousand instructions. The bandwidth assumes that
+      // each cache miss transfers one 64 byte line.
+      printf("%-40s  %10s   %15s  %15s %6s %9s %9s %9s\n", "zone", "calls",
+             "clocks/call", "total clocks", "IPC", "LLC MPKI", "br MPKI",
+             "B/cycle");
+    }
     uint64_t total_visible_duration = 0;
     for (size_t i = 0; i < num_zones_; ++i) {
       const ZoneTotals& r = zones_[i];
       if (r.name[0] != '@') {
         total_visible_duration += r.total_duration;
-        printf("%-40s: %10" PRIu64 " x %15" PRIu64 "= %15" PRIu64 "\n", r.name,
+        printf("%-40s: %10" PRIu64 " x %15" PRIu64 "= %15" PRIu64, r.name,
                r.num_calls, r.total_duration / r.num_calls, r.total_duration);
+        if (print_counters) {
+          const double cycles = std::max<uint64_t>(r.counters[kCycles], 1);
+          const double kilo_instructions =
+              std::max<uint64_t>(r.counters[kInstructions], 1) / 1E3;
+          printf(" %6.2f %9.3f %9.3f %9.3f",
+                 r.counters[kInstructions] / cycles,
+                 r.counters[kCacheMisses] / kilo_instructions,
+                 r.counters[kBranchMisses] / kilo_instructions,
+                 r.counters[kCacheMisses] * 64 / cycles);
+        }
+        printf("\n");
       }
     }
 
@@ -218,11 +430,16 @@ class Results {
     printf("Total clocks measured: %" PRIu64 "\n", total_visible_duration);
   }
 
+  // Zones exited while the trace was enabled, in order of exit.
+  const std::vector<TraceEvent>& TraceEvents() const { return trace_events_; }
+  void ClearTraceEvents() { trace_events_.clear(); }
+
   // Single-threaded. Clears all results as if no zones had been recorded.
   void Reset() {
     analyze_elapsed_ = 0;
     HWY_ASSERT(depth_ == 0);
     num_zones_ = 0;
+    has_counter_values_ = false;
     memset(zone_stack_, 0, sizeof(zone_stack_));
     memset(zones_, 0, sizeof(zones_));
   }
@@ -232,11 +449,13 @@ class Results {
   // has not yet seen that name. Uses a self-organizing list data structure,
   // which avoids dynamic memory allocations and is faster than unordered_map.
   void UpdateOrAdd(const char* name, const uint64_t num_calls,
-                   const uint64_t duration) {
+                   const uint64_t duration,
+                   const uint64_t* HWY_RESTRICT counters) {
     // Special case for first zone: (maybe) update, without swapping.
     if (zones_[0].name == name) {
       zones_[0].total_duration += duration;
       zones_[0].num_calls += num_calls;
+      AddCounters(counters, zones_[0].counters);
       return;
     }
 
@@ -245,6 +464,7 @@ class Results {
       if (zones_[i].name == name) {
         zones_[i].total_duration += duration;
         zones_[i].num_calls += num_calls;
+        AddCounters(counters, zones_[i].counters);
         // Swap with predecessor (more conservative than move to front,
         // but at least as successful).
         std::swap(zones_[i - 1], zones_[i]);
@@ -258,9 +478,17 @@ class Results {
     zone->name = name;
     zone->num_calls = num_calls;
     zone->total_duration = duration;
+    memcpy(zone->counters, counters, sizeof(zone->counters));
     ++num_zones_;
   }
 
+  static void AddCounters(const uint64_t* HWY_RESTRICT from,
+                          uint64_t* HWY_RESTRICT to) {
+    for (size_t c = 0; c < kNumCounters; ++c) {
+      to[c] += from[c];
+    }
+  }
+
   // Each instantiation of a function template seems to get its own copy of
   // __func__ and GCC doesn't merge them. An N^2 search for duplicates is
   // acceptable because we only expect a few dozen zones.
@@ -271,6 +499,7 @@ class Results {
         if (!strcmp(zones_[i].name, zones_[j].name)) {
           zones_[i].num_calls += zones_[j].num_calls;
           zones_[i].total_duration += zones_[j].total_duration;
+          AddCounters(zones_[j].counters, zones_[i].counters);
           // Fill hole with last item.
           zones_[j] = zones_[--num_zones_];
         } else {  // Name differed, try next ZoneTotals.
@@ -287,6 +516,12 @@ class Results {
   size_t depth_ = 0;      // Number of active zones <= kMaxDepth.
   size_t num_zones_ = 0;  // Number of unique zones <= kMaxZones.
 
+  std::vector<TraceEvent> trace_events_;
+
+  // Last values of the counter packets, for the next entry or exit packet.
+  uint64_t counter_values_[kNumCounters] = {};
+  bool has_counter_values_ = false;
+
   // After other members to avoid large pointer offsets.
   alignas(64) ActiveZone zone_stack_[kMaxDepth];  // Last = newest
   alignas(64) ZoneTotals zones_[kMaxZones];       // Self-organizing list
@@ -298,7 +533,35 @@ ThreadSpecific::ThreadSpecific()
       num_packets_(0),
       results_(hwy::MakeUniqueAligned<Results>()) {}
 
-ThreadSpecific::~ThreadSpecific() {}
+ThreadSpecific::~ThreadSpecific() { delete counters_; }
+
+void ThreadSpecific::EnableCounters() {
+  CounterGroup* counters = CounterGroup::Open();
+  if (counters == nullptr) return;
+
+  // Reading the counters takes a system call, whose median duration is
+  // deducted like the rest of the profiler overhead.
+  const size_t kNumSamples = 63;
+  uint64_t samples[kNumSamples];
+  uint64_t values[kNumCounters];
+  for (size_t idx_sample = 0; idx_sample < kNumSamples; ++idx_sample) {
+    const uint64_t t0 = TicksBefore();
+    counters->Read(values);
+    const uint64_t t1 = TicksAfter();
+    samples[idx_sample] = t1 - t0;
+  }
+  std::sort(samples, samples + kNumSamples);
+  results_->AddCounterOverhead(samples[kNumSamples / 2]);
+  counters_ = counters;
+}
+
+void ThreadSpecific::WriteCounters() {
+  uint64_t values[kNumCounters];
+  counters_->Read(values);
+  for (size_t c = 0; c < kNumCounters; ++c) {
+    Write(CounterPacketName(c), values[c]);
+  }
+}
 
 void ThreadSpecific::FlushBuffer() {
   if (num_packets_ + kBufferCapacity > max_packets_) {
@@ -508,6 +771,10 @@ ThreadSpecific* Zone::InitThreadSpecific() {
   GetThreadSpecific() = thread_specific;
 
   thread_specific->ComputeOverhead();
+  // After ComputeOverhead, which expects two packets per zone.
+  if (CountersEnabled().load(std::memory_order_acquire)) {
+    thread_specific->EnableCounters();
+  }
   return thread_specific;
 }
 
@@ -533,6 +800,67 @@ ThreadSpecific* Zone::InitThreadSpecific() {
   }
 }
 
+/*static*/ void Zone::EnableTrace() {
+  TraceStart& start = GetTraceStart();
+  start.time = std::chrono::steady_clock::now();
+  start.ticks = TicksBefore();
+  TraceEnabled().store(true, std::memory_order_release);
+}
+
+/*static*/ bool Zone::EnableCounters() {
+  // Checks on the calling thread whether the counters can be opened at all.
+  CounterGroup* counters = CounterGroup::Open();
+  if (counters == nullptr) return false;
+  delete counters;
+  CountersEnabled().store(true, std::memory_order_release);
+  return true;
+}
+
+// Single-threaded.
+/*static*/ bool Zone::WriteTrace(const char* path) {
+  const TraceStart& start = GetTraceStart();
+  const uint64_t end_ticks = TicksAfter();
+  const double elapsed_us = std::chrono::duration<double, std::micro>(
+                                std::chrono::steady_clock::now() - start.time)
+                                .count();
+  const double us_per_tick =
+      end_ticks > start.ticks && elapsed_us > 0
+          ? elapsed_us / static_cast<double>(end_ticks - start.ticks)
+          : 1.0;
+
+  FILE* file = fopen(path, "w");
+  if (file == nullptr) return false;
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  const char* separator = "\n";
+  size_t thread = 0;
+  for (ThreadSpecific* p = GetHead().load(std::memory_order_relaxed);
+       p != nullptr; p = p->GetNext(), ++thread) {
+    p->AnalyzeRemainingPackets();
+    Results& results = p->GetResults();
+    for (const TraceEvent& event : results.TraceEvents()) {
+      const double ts =
+          static_cast<double>(static_cast<int64_t>(event.entry_timestamp -
+                                                   start.ticks)) *
+          us_per_tick;
+      fprintf(file, "%s{\"name\":", separator);
+      WriteJSONString(event.name, file);
+      fprintf(file,
+              ",\"ph\":\"X\",\"pid\":1,\"tid\":%" PRIu64
+              ",\"ts\":%.3f,\"dur\":%.3f",
+              static_cast<uint64_t>(thread), ts,
+              static_cast<double>(event.duration) * us_per_tick);
+      if (event.has_argument) {
+        fprintf(file, ",\"args\":{\"arg\":%" PRIu64 "}", event.argument);
+      }
+      fputc('}', file);
+      separator = ",\n";
+    }
+    results.ClearTraceEvents();
+  }
+  fprintf(file, "\n]}\n");
+  return fclose(file) == 0;
+}
+
 }  // namespace profiler
 }  // namespace jxl
 
@@ -17,6 +17,18 @@
 // After all threads have exited any zones, invoke PROFILER_PRINT_RESULTS() to
 // print call counts and average durations [CPU cycles] to stdout, sorted in
 // descending order of total duration.
+//
+// To also see when each zone ran on which thread, call PROFILER_ENABLE_TRACE()
+// before entering the zones and PROFILER_WRITE_TRACE(path) after exiting them,
+// which writes the timelines in the Chrome trace event format (viewable with
+// chrome://tracing or https://ui.perfetto.dev).
+//
+// On Linux, PROFILER_ENABLE_COUNTERS() additionally reads hardware performance
+// counters (cycles, instructions, cache and branch misses) at each zone entry
+// and exit of the threads that enter their first zone afterwards, and
+// PROFILER_PRINT_RESULTS then also prints the IPC and miss rates of each zone.
+// Each read is a system call, which is excluded from the zone durations but
+// makes the measured program slower.
 
 // If zero, this file has no effect and no measurements will be recorded.
 #ifndef JXL_PROFILER_ENABLED
@@ -56,7 +68,23 @@ struct Packet {
 #pragma pack(pop)
 static_assert(sizeof(Packet) == 16, "Wrong Packet size");
 
-class Results;  // pImpl
+// Name of the packets that store an argument of the innermost zone instead of
+// a timestamp. Not a valid string address.
+static HWY_INLINE const char* ArgumentPacketName() {
+  return reinterpret_cast<const char*>(uintptr_t{1});
+}
+
+// Number of hardware counters recorded by PROFILER_ENABLE_COUNTERS.
+static constexpr size_t kNumCounters = 4;
+
+// Name of the packets that store the value of the hardware counter `counter`
+// read before the next entry or exit packet. Not a valid string address.
+static HWY_INLINE const char* CounterPacketName(size_t counter) {
+  return reinterpret_cast<const char*>(uintptr_t{2} + counter);
+}
+
+class Results;       // pImpl
+class CounterGroup;  // pImpl
 
 // Per-thread packet storage, dynamically allocated and aligned.
 class ThreadSpecific {
@@ -71,6 +99,16 @@ class ThreadSpecific {
 
   HWY_INLINE void WriteEntry(const char* name) { Write(name, TicksBefore()); }
   HWY_INLINE void WriteExit() { Write(nullptr, TicksAfter()); }
+  HWY_INLINE void WriteArgument(uint64_t argument) {
+    Write(ArgumentPacketName(), argument);
+  }
+  // Must precede WriteEntry and WriteExit.
+  HWY_INLINE void MaybeWriteCounters() {
+    if (HWY_UNLIKELY(counters_ != nullptr)) WriteCounters();
+  }
+
+  // Starts reading the hardware counters, if the platform allows it.
+  PROFILER_PUBLIC void EnableCounters();
 
   PROFILER_PUBLIC void AnalyzeRemainingPackets();
 
@@ -82,6 +120,7 @@ class ThreadSpecific {
 
  private:
   PROFILER_PUBLIC void FlushBuffer();
+  PROFILER_PUBLIC void WriteCounters();
 
   // Write packet to buffer/storage, emptying them as needed.
   void Write(const char* name, const uint64_t timestamp) {
@@ -107,6 +146,9 @@ class ThreadSpecific {
   ThreadSpecific* next_ = nullptr;  // Owned, never released.
 
   hwy::AlignedUniquePtr<Results> results_;
+
+  // Null unless the hardware counters are read, see EnableCounters.
+  CounterGroup* counters_ = nullptr;  // Owned.
 };
 
 // RAII zone enter/exit recorder constructed by PROFILER_ZONE; also
@@ -120,14 +162,47 @@ class Zone {
       thread_specific = InitThreadSpecific();
     }
 
+    thread_specific->MaybeWriteCounters();
     thread_specific->WriteEntry(name);
   }
 
-  HWY_NOINLINE ~Zone() { GetThreadSpecific()->WriteExit(); }
+  // Also records `argument`, e.g. a task index, in the trace.
+  HWY_NOINLINE Zone(const char* name, uint64_t argument) {
+    HWY_FENCE;
+    ThreadSpecific* HWY_RESTRICT thread_specific = GetThreadSpecific();
+    if (HWY_UNLIKELY(thread_specific == nullptr)) {
+      thread_specific = InitThreadSpecific();
+    }
+
+    thread_specific->MaybeWriteCounters();
+    thread_specific->WriteEntry(name);
+    thread_specific->WriteArgument(argument);
+  }
+
+  HWY_NOINLINE ~Zone() {
+    ThreadSpecific* HWY_RESTRICT thread_specific = GetThreadSpecific();
+    thread_specific->MaybeWriteCounters();
+    thread_specific->WriteExit();
+  }
 
   // Call exactly once after all threads have exited all zones.
   PROFILER_PUBLIC static void PrintResults();
 
+  // Starts recording the zones of all threads for WriteTrace, which costs
+  // memory for each zone exit.
+  PROFILER_PUBLIC static void EnableTrace();
+
+  // Writes the zones recorded since EnableTrace to `path` in the Chrome trace
+  // event format, one track per thread. Call after all threads have exited
+  // all zones, before or after PrintResults. Returns false if the file
+  // cannot be written.
+  PROFILER_PUBLIC static bool WriteTrace(const char* path);
+
+  // Reads hardware counters in the zones of the threads that enter their
+  // first zone after this call. Returns false, without effect, if they are
+  // not supported or not accessible (see perf_event_paranoid on Linux).
+  PROFILER_PUBLIC static bool EnableCounters();
+
  private:
   // Returns reference to the thread's ThreadSpecific pointer (initially null).
   // Function-local static avoids needing a separate definition.
@@ -156,7 +231,18 @@ class Zone {
   const ::jxl::profiler::Zone zone(__func__); \
   HWY_FENCE
 
+// Like PROFILER_ZONE, for a name that is not a string literal (but a pointer
+// that stays valid until the results are printed) and with an argument that
+// is shown in the trace.
+#define PROFILER_ZONE_ARG(name, argument)                    \
+  HWY_FENCE;                                                 \
+  const ::jxl::profiler::Zone zone_with_arg(name, argument); \
+  HWY_FENCE
+
 #define PROFILER_PRINT_RESULTS ::jxl::profiler::Zone::PrintResults
+#define PROFILER_ENABLE_TRACE ::jxl::profiler::Zone::EnableTrace
+#define PROFILER_WRITE_TRACE ::jxl::profiler::Zone::WriteTrace
+#define PROFILER_ENABLE_COUNTERS ::jxl::profiler::Zone::EnableCounters
 
 }  // namespace profiler
 }  // namespace jxl
@@ -164,7 +250,11 @@ class Zone {
 #else  // !JXL_PROFILER_ENABLED
 #define PROFILER_ZONE(name)
 #define PROFILER_FUNC
+#define PROFILER_ZONE_ARG(name, argument)
 #define PROFILER_PRINT_RESULTS()
+#define PROFILER_ENABLE_TRACE()
+#define PROFILER_WRITE_TRACE(path) false
+#define PROFILER_ENABLE_COUNTERS() false
 #endif
 
 #endif  // LIB_JXL_BASE_PROFILER_H_
@@ -258,5 +258,56 @@ TEST(BitReaderTest, MoveTest) {
   EXPECT_TRUE(reader2.Close());
 }
 
+// Appending writers as sections yields the same bytes as copying them.
+TEST(BitReaderTest, SectionsTest) {
+  const auto write_bytes = [](BitWriter* writer, size_t num_bytes,
+                              uint32_t seed) {
+    BitWriter::Allotment allotment(writer, num_bytes * kBitsPerByte);
+    Rng rng(seed);
+    for (size_t i = 0; i < num_bytes; i++) {
+      writer->Write(8, rng.UniformU(0, 256));
+    }
+    allotment.ReclaimAndCharge(writer, 0, nullptr);
+  };
+  const auto make_groups = [&write_bytes]() {
+    std::vector<BitWriter> groups(4);
+    write_bytes(&groups[0], 10, 1);
+    write_bytes(&groups[2], 33, 2);  // groups[1] stays empty
+    write_bytes(&groups[3], 1, 3);
+    return groups;
+  };
+  const auto to_vector = [](const PaddedBytes& bytes) {
+    return std::vector<uint8_t>(bytes.data(), bytes.data() + bytes.size());
+  };
+  const auto make_writer = [&](bool keep_sections, bool write_after) {
+    BitWriter writer;
+    if (keep_sections) writer.KeepSections();
+    write_bytes(&writer, 5, 4);
+    writer.AppendByteAligned(make_groups());
+    if (write_after) write_bytes(&writer, 7, 5);
+    return writer;
+  };
+
+  const std::vector<uint8_t> expected =
+      to_vector(make_writer(false, false).TakeBytes());
+  ASSERT_EQ(49u, expected.size());
+
+  BitWriter writer = make_writer(true, false);
+  EXPECT_EQ(expected.size() * kBitsPerByte, writer.BitsWritten());
+  std::vector<PaddedBytes> sections = std::move(writer).TakeSections();
+  EXPECT_EQ(4u, sections.size());
+  PaddedBytes concatenated;
+  for (const PaddedBytes& section : sections) concatenated.append(section);
+  EXPECT_EQ(expected, to_vector(concatenated));
+
+  // Writing after appending sections concatenates them first.
+  const std::vector<uint8_t> expected_after =
+      to_vector(make_writer(false, true).TakeBytes());
+  EXPECT_EQ(expected_after, to_vector(make_writer(true, true).TakeBytes()));
+  std::vector<PaddedBytes> flushed = make_writer(true, true).TakeSections();
+  ASSERT_EQ(1u, flushed.size());
+  EXPECT_EQ(expected_after, to_vector(flushed[0]));
+}
+
 }  // namespace
 }  // namespace jxl
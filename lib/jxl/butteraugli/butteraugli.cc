@@ -88,6 +88,7 @@ void ConvolveBorderColumn(const ImageF& in, const std::vector<float>& kernel,
 // Computes a horizontal convolution and transposes the result.
 void ConvolutionWithTranspose(const ImageF& in,
                               const std::vector<float>& kernel,
+                              ThreadPool* pool,
                               ImageF* BUTTERAUGLI_RESTRICT out) {
   PROFILER_FUNC;
   JXL_CHECK(out->xsize() == in.ysize());
@@ -105,16 +106,21 @@ void ConvolutionWithTranspose(const ImageF& in,
   for (size_t i = 0; i <= len / 2; ++i) {
     scaled_kernel[i] = kernel[i] * scale_no_border;
   }
-
-  // middle
-  switch (len) {
-    case 7: {
-      PROFILER_ZONE("conv7");
-      const float sk0 = scaled_kernel[0];
-      const float sk1 = scaled_kernel[1];
-      const float sk2 = scaled_kernel[2];
-      const float sk3 = scaled_kernel[3];
-      for (size_t y = 0; y < in.ysize(); ++y) {
+  if (len != 7 && len != 13 && len != 15 && len != 33) {
+    printf("Warning: Unexpected kernel size! %" PRIuS "\n", len);
+  }
+
+  // Input row y is written to column y of the output. Each task handles
+  // enough rows to fill whole cache lines of the output rows, so that threads
+  // do not write to the same cache line.
+  constexpr size_t kRowsPerTask = 32;
+  const auto convolve_row = [&](const size_t y) {
+    switch (len) {
+      case 7: {
+        const float sk0 = scaled_kernel[0];
+        const float sk1 = scaled_kernel[1];
+        const float sk2 = scaled_kernel[2];
+        const float sk3 = scaled_kernel[3];
         const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
         for (size_t x = border1; x < border2; ++x, ++row_in) {
           const float sum0 = (row_in[0] + row_in[6]) * sk0;
@@ -124,11 +130,8 @@ void ConvolutionWithTranspose(const ImageF& in,
           float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
           row_out[y] = sum;
         }
-      }
-    } break;
-    case 13: {
-      PROFILER_ZONE("conv15");
-      for (size_t y = 0; y < in.ysize(); ++y) {
+      } break;
+      case 13: {
         const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
         for (size_t x = border1; x < border2; ++x, ++row_in) {
           float sum0 = (row_in[0] + row_in[12]) * scaled_kernel[0];
@@ -141,12 +144,9 @@ void ConvolutionWithTranspose(const ImageF& in,
           float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
           row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
         }
+        break;
       }
-      break;
-    }
-    case 15: {
-      PROFILER_ZONE("conv15");
-      for (size_t y = 0; y < in.ysize(); ++y) {
+      case 15: {
         const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
         for (size_t x = border1; x < border2; ++x, ++row_in) {
           float sum0 = (row_in[0] + row_in[14]) * scaled_kernel[0];
@@ -160,12 +160,9 @@ void ConvolutionWithTranspose(const ImageF& in,
           float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
           row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
         }
+        break;
       }
-      break;
-    }
-    case 33: {
-      PROFILER_ZONE("conv33");
-      for (size_t y = 0; y < in.ysize(); ++y) {
+      case 33: {
         const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
         for (size_t x = border1; x < border2; ++x, ++row_in) {
           float sum0 = (row_in[0] + row_in[32]) * scaled_kernel[0];
@@ -188,12 +185,9 @@ void ConvolutionWithTranspose(const ImageF& in,
           float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
           row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
         }
+        break;
       }
-      break;
-    }
-    default:
-      printf("Warning: Unexpected kernel size! %" PRIuS "\n", len);
-      for (size_t y = 0; y < in.ysize(); ++y) {
+      default: {
         const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y);
         for (size_t x = border1; x < border2; ++x) {
           const int d = x - offset;
@@ -209,16 +203,35 @@ void ConvolutionWithTranspose(const ImageF& in,
           row_out[y] = sum;
         }
       }
-  }
+    }
+  };
+  const size_t num_tasks = DivCeil(in.ysize(), kRowsPerTask);
+  JXL_CHECK(RunOnPool(
+      pool, 0, num_tasks, ThreadPool::NoInit,
+      [&](const uint32_t task, size_t /*thread*/) {
+        const size_t y_end = std::min(in.ysize(), (task + 1) * kRowsPerTask);
+        for (size_t y = task * kRowsPerTask; y < y_end; ++y) {
+          convolve_row(y);
+        }
+      },
+      "ButteraugliConvolve"));
+
+  // Each border column writes a separate output row.
   // left border
-  for (size_t x = 0; x < border1; ++x) {
-    ConvolveBorderColumn(in, kernel, x, out->Row(x));
-  }
+  JXL_CHECK(RunOnPool(
+      pool, 0, border1, ThreadPool::NoInit,
+      [&](const uint32_t x, size_t /*thread*/) {
+        ConvolveBorderColumn(in, kernel, x, out->Row(x));
+      },
+      "ButteraugliConvolveLeft"));
 
   // right border
-  for (size_t x = border2; x < in.xsize(); ++x) {
-    ConvolveBorderColumn(in, kernel, x, out->Row(x));
-  }
+  JXL_CHECK(RunOnPool(
+      pool, border2, in.xsize(), ThreadPool::NoInit,
+      [&](const uint32_t x, size_t /*thread*/) {
+        ConvolveBorderColumn(in, kernel, x, out->Row(x));
+      },
+      "ButteraugliConvolveRight"));
 }
 
 // A blur somewhat similar to a 2D Gaussian blur.
@@ -232,7 +245,7 @@ void ConvolutionWithTranspose(const ImageF& in,
 // optionally use gauss_blur followed by fixup of the borders for large images,
 // or fall back to the previous truncated FIR followed by a transpose.
 void Blur(const ImageF& in, float sigma, const ButteraugliParams& params,
-          BlurTemp* temp, ImageF* out) {
+          BlurTemp* temp, ThreadPool* pool, ImageF* out) {
   std::vector<float> kernel = ComputeKernel(sigma);
   // Separable5 does an in-place convolution, so this fast path is not safe if
   // in aliases out.
@@ -249,13 +262,13 @@ void Blur(const ImageF& in, float sigma, const ButteraugliParams& params,
         {HWY_REP4(w0), HWY_REP4(w1), HWY_REP4(w2)},
         {HWY_REP4(w0), HWY_REP4(w1), HWY_REP4(w2)},
     };
-    Separable5(in, Rect(in), weights, /*pool=*/nullptr, out);
+    Separable5(in, Rect(in), weights, pool, out);
     return;
   }
 
   ImageF* JXL_RESTRICT temp_t = temp->GetTransposed(in);
-  ConvolutionWithTranspose(in, kernel, temp_t);
-  ConvolutionWithTranspose(*temp_t, kernel, out);
+  ConvolutionWithTranspose(in, kernel, pool, temp_t);
+  ConvolutionWithTranspose(*temp_t, kernel, pool, out);
 }
 
 // Allows PaddedMaltaUnit to call either function via overloading.
@@ -365,8 +378,8 @@ void SuppressXByY(const ImageF& in_x, const ImageF& in_y, const double yw,
 
 static void SeparateFrequencies(size_t xsize, size_t ysize,
                                 const ButteraugliParams& params,
-                                BlurTemp* blur_temp, const Image3F& xyb,
-                                PsychoImage& ps) {
+                                BlurTemp* blur_temp, ThreadPool* pool,
+                                const Image3F& xyb, PsychoImage& ps) {
   PROFILER_FUNC;
   const HWY_FULL(float) d;
 
@@ -380,7 +393,7 @@ static void SeparateFrequencies(size_t xsize, size_t ysize,
   ps.lf = Image3F(xyb.xsize(), xyb.ysize());
   ps.mf = Image3F(xyb.xsize(), xyb.ysize());
   for (int i = 0; i < 3; ++i) {
-    Blur(xyb.Plane(i), kSigmaLf, params, blur_temp, &ps.lf.Plane(i));
+    Blur(xyb.Plane(i), kSigmaLf, params, blur_temp, pool, &ps.lf.Plane(i));
 
     // ... and keep everything else in mf.
     for (size_t y = 0; y < ysize; ++y) {
@@ -393,7 +406,8 @@ static void SeparateFrequencies(size_t xsize, size_t ysize,
       }
     }
     if (i == 2) {
-      Blur(ps.mf.Plane(i), kSigmaHf, params, blur_temp, &ps.mf.Plane(i));
+      Blur(ps.mf.Plane(i), kSigmaHf, params, blur_temp, pool,
+           &ps.mf.Plane(i));
       break;
     }
     // Divide mf into mf and hf.
@@ -404,7 +418,7 @@ static void SeparateFrequencies(size_t xsize, size_t ysize,
         Store(Load(d, row_mf + x), d, row_hf + x);
       }
     }
-    Blur(ps.mf.Plane(i), kSigmaHf, params, blur_temp, &ps.mf.Plane(i));
+    Blur(ps.mf.Plane(i), kSigmaHf, params, blur_temp, pool, &ps.mf.Plane(i));
     static const double kRemoveMfRange = 0.29;
     static const double kAddMfRange = 0.1;
     if (i == 0) {
@@ -454,7 +468,7 @@ static void SeparateFrequencies(size_t xsize, size_t ysize,
         row_uhf[x] = row_hf[x];
       }
     }
-    Blur(ps.hf[i], kSigmaUhf, params, blur_temp, &ps.hf[i]);
+    Blur(ps.hf[i], kSigmaUhf, params, blur_temp, pool, &ps.hf[i]);
     static const double kRemoveHfRange = 1.5;
     static const double kAddHfRange = 0.132;
     static const double kRemoveUhfRange = 0.04;
@@ -949,7 +963,8 @@ static void MaltaDiffMapT(const Tag tag, const ImageF& lum0, const ImageF& lum1,
                           const double w_0gt1, const double w_0lt1,
                           const double norm1, const double len,
                           const double mulli, ImageF* HWY_RESTRICT diffs,
-                          Image3F* HWY_RESTRICT block_diff_ac, size_t c) {
+                          Image3F* HWY_RESTRICT block_diff_ac, size_t c,
+                          ThreadPool* pool) {
   JXL_DASSERT(SameSize(lum0, lum1) && SameSize(lum0, *diffs));
   const size_t xsize_ = lum0.xsize();
   const size_t ysize_ = lum0.ysize();
@@ -962,7 +977,8 @@ static void MaltaDiffMapT(const Tag tag, const ImageF& lum0, const ImageF& lum1,
   const float norm2_0gt1 = w_pre0gt1 * norm1;
   const float norm2_0lt1 = w_pre0lt1 * norm1;
 
-  for (size_t y = 0; y < ysize_; ++y) {
+  const auto diff_row = [&](const uint32_t task, size_t /*thread*/) {
+    const size_t y = task;
     const float* HWY_RESTRICT row0 = lum0.ConstRow(y);
     const float* HWY_RESTRICT row1 = lum1.ConstRow(y);
     float* HWY_RESTRICT row_diffs = diffs->Row(y);
@@ -999,25 +1015,29 @@ static void MaltaDiffMapT(const Tag tag, const ImageF& lum0, const ImageF& lum1,
         }
       }
     }
-  }
-
-  size_t y0 = 0;
-  // Top
-  for (; y0 < 4; ++y0) {
-    float* BUTTERAUGLI_RESTRICT row_diff = block_diff_ac->PlaneRow(c, y0);
-    for (size_t x0 = 0; x0 < xsize_; ++x0) {
-      row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
-    }
-  }
+  };
+  JXL_CHECK(RunOnPool(pool, 0, ysize_, ThreadPool::NoInit, diff_row,
+                      "ButteraugliMaltaDiffs"));
 
   const HWY_FULL(float) df;
   const size_t aligned_x = std::max(size_t(4), Lanes(df));
   const intptr_t stride = diffs->PixelsPerRow();
 
-  // Middle
-  for (; y0 < ysize_ - 4; ++y0) {
-    const float* BUTTERAUGLI_RESTRICT row_in = diffs->ConstRow(y0);
+  // The Malta units read diffs up to 4 rows away, so this only starts once all
+  // of diffs is computed.
+  const auto malta_row = [&](const uint32_t task, size_t /*thread*/) {
+    const size_t y0 = task;
     float* BUTTERAUGLI_RESTRICT row_diff = block_diff_ac->PlaneRow(c, y0);
+    if (y0 < 4 || y0 >= ysize_ - 4) {
+      // Top and bottom
+      for (size_t x0 = 0; x0 < xsize_; ++x0) {
+        row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
+      }
+      return;
+    }
+
+    // Middle
+    const float* BUTTERAUGLI_RESTRICT row_in = diffs->ConstRow(y0);
     size_t x0 = 0;
     for (; x0 < aligned_x; ++x0) {
       row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
@@ -1031,32 +1051,28 @@ static void MaltaDiffMapT(const Tag tag, const ImageF& lum0, const ImageF& lum1,
     for (; x0 < xsize_; ++x0) {
       row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
     }
-  }
-
-  // Bottom
-  for (; y0 < ysize_; ++y0) {
-    float* BUTTERAUGLI_RESTRICT row_diff = block_diff_ac->PlaneRow(c, y0);
-    for (size_t x0 = 0; x0 < xsize_; ++x0) {
-      row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
-    }
-  }
+  };
+  JXL_CHECK(RunOnPool(pool, 0, ysize_, ThreadPool::NoInit, malta_row,
+                      "ButteraugliMalta"));
 }
 
 // Need non-template wrapper functions for HWY_EXPORT.
 void MaltaDiffMap(const ImageF& lum0, const ImageF& lum1, const double w_0gt1,
                   const double w_0lt1, const double norm1, const double len,
                   const double mulli, ImageF* HWY_RESTRICT diffs,
-                  Image3F* HWY_RESTRICT block_diff_ac, size_t c) {
+                  Image3F* HWY_RESTRICT block_diff_ac, size_t c,
+                  ThreadPool* pool) {
   MaltaDiffMapT(MaltaTag(), lum0, lum1, w_0gt1, w_0lt1, norm1, len, mulli,
-                diffs, block_diff_ac, c);
+                diffs, block_diff_ac, c, pool);
 }
 
 void MaltaDiffMapLF(const ImageF& lum0, const ImageF& lum1, const double w_0gt1,
                     const double w_0lt1, const double norm1, const double len,
                     const double mulli, ImageF* HWY_RESTRICT diffs,
-                    Image3F* HWY_RESTRICT block_diff_ac, size_t c) {
+                    Image3F* HWY_RESTRICT block_diff_ac, size_t c,
+                    ThreadPool* pool) {
   MaltaDiffMapT(MaltaTagLF(), lum0, lum1, w_0gt1, w_0lt1, norm1, len, mulli,
-                diffs, block_diff_ac, c);
+                diffs, block_diff_ac, c, pool);
 }
 
 void DiffPrecompute(const ImageF& xyb, float mul, float bias_arg, ImageF* out) {
@@ -1098,11 +1114,12 @@ void StoreMin3(const float v, float& min0, float& min1, float& min2) {
 
 // Look for smooth areas near the area of degradation.
 // If the areas area generally smooth, don't do masking.
-void FuzzyErosion(const ImageF& from, ImageF* to) {
+void FuzzyErosion(const ImageF& from, ThreadPool* pool, ImageF* to) {
   const size_t xsize = from.xsize();
   const size_t ysize = from.ysize();
   static const int kStep = 3;
-  for (size_t y = 0; y < ysize; ++y) {
+  const auto process_row = [&](const uint32_t task, size_t /*thread*/) {
+    const size_t y = task;
     for (size_t x = 0; x < xsize; ++x) {
       float min0 = from.Row(y)[x];
       float min1 = 2 * min0;
@@ -1141,14 +1158,16 @@ void FuzzyErosion(const ImageF& from, ImageF* to) {
       }
       to->Row(y)[x] = (0.45f * min0 + 0.3f * min1 + 0.25f * min2);
     }
-  }
+  };
+  JXL_CHECK(RunOnPool(pool, 0, ysize, ThreadPool::NoInit, process_row,
+                      "ButteraugliFuzzyErosion"));
 }
 
 // Compute values of local frequency and dc masking based on the activity
 // in the two images. img_diff_ac may be null.
 void Mask(const ImageF& mask0, const ImageF& mask1,
           const ButteraugliParams& params, BlurTemp* blur_temp,
-          ImageF* BUTTERAUGLI_RESTRICT mask,
+          ThreadPool* pool, ImageF* BUTTERAUGLI_RESTRICT mask,
           ImageF* BUTTERAUGLI_RESTRICT diff_ac) {
   // Only X and Y components are involved in masking. B's influence
   // is considered less important in the high frequency area, and we
@@ -1166,10 +1185,10 @@ void Mask(const ImageF& mask0, const ImageF& mask1,
   ImageF blurred1(xsize, ysize);
   DiffPrecompute(mask0, kMul, kBias, &diff0);
   DiffPrecompute(mask1, kMul, kBias, &diff1);
-  Blur(diff0, kRadius, params, blur_temp, &blurred0);
-  FuzzyErosion(blurred0, &diff0);
-  Blur(diff1, kRadius, params, blur_temp, &blurred1);
-  FuzzyErosion(blurred1, &diff1);
+  Blur(diff0, kRadius, params, blur_temp, pool, &blurred0);
+  FuzzyErosion(blurred0, pool, &diff0);
+  Blur(diff1, kRadius, params, blur_temp, pool, &blurred1);
+  FuzzyErosion(blurred1, pool, &diff1);
   for (size_t y = 0; y < ysize; ++y) {
     for (size_t x = 0; x < xsize; ++x) {
       mask->Row(y)[x] = diff0.Row(y)[x];
@@ -1186,7 +1205,8 @@ void Mask(const ImageF& mask0, const ImageF& mask1,
 void MaskPsychoImage(const PsychoImage& pi0, const PsychoImage& pi1,
                      const size_t xsize, const size_t ysize,
                      const ButteraugliParams& params, Image3F* temp,
-                     BlurTemp* blur_temp, ImageF* BUTTERAUGLI_RESTRICT mask,
+                     BlurTemp* blur_temp, ThreadPool* pool,
+                     ImageF* BUTTERAUGLI_RESTRICT mask,
                      ImageF* BUTTERAUGLI_RESTRICT diff_ac) {
   ImageF mask0(xsize, ysize);
   ImageF mask1(xsize, ysize);
@@ -1196,7 +1216,8 @@ void MaskPsychoImage(const PsychoImage& pi0, const PsychoImage& pi1,
       0.4f,
   };
   // Silly and unoptimized approach here. TODO(jyrki): rework this.
-  for (size_t y = 0; y < ysize; ++y) {
+  const auto process_row = [&](const uint32_t task, size_t /*thread*/) {
+    const size_t y = task;
     const float* BUTTERAUGLI_RESTRICT row_y_hf0 = pi0.hf[1].Row(y);
     const float* BUTTERAUGLI_RESTRICT row_y_hf1 = pi1.hf[1].Row(y);
     const float* BUTTERAUGLI_RESTRICT row_y_uhf0 = pi0.uhf[1].Row(y);
@@ -1217,8 +1238,10 @@ void MaskPsychoImage(const PsychoImage& pi0, const PsychoImage& pi1,
       row1[x] = xdiff1 * xdiff1 + ydiff1 * ydiff1;
       row1[x] = sqrt(row1[x]);
     }
-  }
-  Mask(mask0, mask1, params, blur_temp, mask, diff_ac);
+  };
+  JXL_CHECK(RunOnPool(pool, 0, ysize, ThreadPool::NoInit, process_row,
+                      "ButteraugliMaskPsycho"));
+  Mask(mask0, mask1, params, blur_temp, pool, mask, diff_ac);
 }
 
 double MaskY(double delta) {
@@ -1246,12 +1269,13 @@ inline float MaskColor(const float color[3], const float mask) {
 // Diffmap := sqrt of sum{diff images by multiplied by X and Y/B masks}
 void CombineChannelsToDiffmap(const ImageF& mask, const Image3F& block_diff_dc,
                               const Image3F& block_diff_ac, float xmul,
-                              ImageF* result) {
+                              ThreadPool* pool, ImageF* result) {
   PROFILER_FUNC;
   JXL_CHECK(SameSize(mask, *result));
   size_t xsize = mask.xsize();
   size_t ysize = mask.ysize();
-  for (size_t y = 0; y < ysize; ++y) {
+  const auto process_row = [&](const uint32_t task, size_t /*thread*/) {
+    const size_t y = task;
     float* BUTTERAUGLI_RESTRICT row_out = result->Row(y);
     for (size_t x = 0; x < xsize; ++x) {
       float val = mask.Row(y)[x];
@@ -1268,7 +1292,9 @@ void CombineChannelsToDiffmap(const ImageF& mask, const Image3F& block_diff_dc,
       row_out[x] =
           sqrt(MaskColor(diff_dc, dc_maskval) + MaskColor(diff_ac, maskval));
     }
-  }
+  };
+  JXL_CHECK(RunOnPool(pool, 0, ysize, ThreadPool::NoInit, process_row,
+                      "ButteraugliCombineChannels"));
 }
 
 // Adds weighted L2 difference between i0 and i1 to diffmap.
@@ -1421,16 +1447,18 @@ BUTTERAUGLI_INLINE void OpsinAbsorbance(const DF df, const V& in0, const V& in1,
 
 // `blurred` is a temporary image used inside this function and not returned.
 Image3F OpsinDynamicsImage(const Image3F& rgb, const ButteraugliParams& params,
-                           Image3F* blurred, BlurTemp* blur_temp) {
+                           Image3F* blurred, BlurTemp* blur_temp,
+                           ThreadPool* pool) {
   PROFILER_FUNC;
   Image3F xyb(rgb.xsize(), rgb.ysize());
   const double kSigma = 1.2;
-  Blur(rgb.Plane(0), kSigma, params, blur_temp, &blurred->Plane(0));
-  Blur(rgb.Plane(1), kSigma, params, blur_temp, &blurred->Plane(1));
-  Blur(rgb.Plane(2), kSigma, params, blur_temp, &blurred->Plane(2));
+  Blur(rgb.Plane(0), kSigma, params, blur_temp, pool, &blurred->Plane(0));
+  Blur(rgb.Plane(1), kSigma, params, blur_temp, pool, &blurred->Plane(1));
+  Blur(rgb.Plane(2), kSigma, params, blur_temp, pool, &blurred->Plane(2));
   const HWY_FULL(float) df;
-  const auto intensity_target_multiplier = Set(df, params.intensity_target);
-  for (size_t y = 0; y < rgb.ysize(); ++y) {
+  const auto process_row = [&](const uint32_t task, size_t /*thread*/) {
+    const size_t y = task;
+    const auto intensity_target_multiplier = Set(df, params.intensity_target);
     const float* BUTTERAUGLI_RESTRICT row_r = rgb.ConstPlaneRow(0, y);
     const float* BUTTERAUGLI_RESTRICT row_g = rgb.ConstPlaneRow(1, y);
     const float* BUTTERAUGLI_RESTRICT row_b = rgb.ConstPlaneRow(2, y);
@@ -1491,7 +1519,9 @@ Image3F OpsinDynamicsImage(const Image3F& rgb, const ButteraugliParams& params,
       Store(Add(cur_mixed0, cur_mixed1), df, row_out_y + x);
       Store(cur_mixed2, df, row_out_b + x);
     }
-  }
+  };
+  JXL_CHECK(RunOnPool(pool, 0, rgb.ysize(), ThreadPool::NoInit, process_row,
+                      "ButteraugliOpsinDynamics"));
   return xyb;
 }
 
@@ -1619,41 +1649,47 @@ Image3F* ButteraugliComparator::Temp() const {
 void ButteraugliComparator::ReleaseTemp() const { temp_in_use_.clear(); }
 
 ButteraugliComparator::ButteraugliComparator(const Image3F& rgb0,
-                                             const ButteraugliParams& params)
+                                             const ButteraugliParams& params,
+                                             ThreadPool* pool)
     : xsize_(rgb0.xsize()),
       ysize_(rgb0.ysize()),
       params_(params),
-      temp_(xsize_, ysize_) {
+      pool_(pool) {
+  CacheAligned::ScopedTag tag(JXL_MEMORY_TAG_BUTTERAUGLI);
+  temp_ = Image3F(xsize_, ysize_);
   if (xsize_ < 8 || ysize_ < 8) {
     return;
   }
 
-  Image3F xyb0 = HWY_DYNAMIC_DISPATCH(OpsinDynamicsImage)(rgb0, params, Temp(),
-                                                          &blur_temp_);
+  Image3F xyb0 = HWY_DYNAMIC_DISPATCH(OpsinDynamicsImage)(
+      rgb0, params, Temp(), &blur_temp_, pool_);
   ReleaseTemp();
   HWY_DYNAMIC_DISPATCH(SeparateFrequencies)
-  (xsize_, ysize_, params_, &blur_temp_, xyb0, pi0_);
+  (xsize_, ysize_, params_, &blur_temp_, pool_, xyb0, pi0_);
 
   // Awful recursive construction of samples of different resolution.
   // This is an after-thought and possibly somewhat parallel in
   // functionality with the PsychoImage multi-resolution approach.
-  sub_.reset(new ButteraugliComparator(SubSample2x(rgb0), params));
+  sub_.reset(new ButteraugliComparator(SubSample2x(rgb0), params, pool_));
 }
 
 void ButteraugliComparator::Mask(ImageF* BUTTERAUGLI_RESTRICT mask) const {
+  CacheAligned::ScopedTag tag(JXL_MEMORY_TAG_BUTTERAUGLI);
   HWY_DYNAMIC_DISPATCH(MaskPsychoImage)
-  (pi0_, pi0_, xsize_, ysize_, params_, Temp(), &blur_temp_, mask, nullptr);
+  (pi0_, pi0_, xsize_, ysize_, params_, Temp(), &blur_temp_, pool_, mask,
+   nullptr);
   ReleaseTemp();
 }
 
 void ButteraugliComparator::Diffmap(const Image3F& rgb1, ImageF& result) const {
   PROFILER_FUNC;
+  CacheAligned::ScopedTag tag(JXL_MEMORY_TAG_BUTTERAUGLI);
   if (xsize_ < 8 || ysize_ < 8) {
     ZeroFillImage(&result);
     return;
   }
   const Image3F xyb1 = HWY_DYNAMIC_DISPATCH(OpsinDynamicsImage)(
-      rgb1, params_, Temp(), &blur_temp_);
+      rgb1, params_, Temp(), &blur_temp_, pool_);
   ReleaseTemp();
   DiffmapOpsinDynamicsImage(xyb1, result);
   if (sub_) {
@@ -1661,7 +1697,8 @@ void ButteraugliComparator::Diffmap(const Image3F& rgb1, ImageF& result) const {
       return;
     }
     const Image3F sub_xyb = HWY_DYNAMIC_DISPATCH(OpsinDynamicsImage)(
-        SubSample2x(rgb1), params_, sub_->Temp(), &sub_->blur_temp_);
+        SubSample2x(rgb1), params_, sub_->Temp(), &sub_->blur_temp_,
+        sub_->pool_);
     sub_->ReleaseTemp();
     ImageF subresult;
     sub_->DiffmapOpsinDynamicsImage(sub_xyb, subresult);
@@ -1672,13 +1709,14 @@ void ButteraugliComparator::Diffmap(const Image3F& rgb1, ImageF& result) const {
 void ButteraugliComparator::DiffmapOpsinDynamicsImage(const Image3F& xyb1,
                                                       ImageF& result) const {
   PROFILER_FUNC;
+  CacheAligned::ScopedTag tag(JXL_MEMORY_TAG_BUTTERAUGLI);
   if (xsize_ < 8 || ysize_ < 8) {
     ZeroFillImage(&result);
     return;
   }
   PsychoImage pi1;
   HWY_DYNAMIC_DISPATCH(SeparateFrequencies)
-  (xsize_, ysize_, params_, &blur_temp_, xyb1, pi1);
+  (xsize_, ysize_, params_, &blur_temp_, pool_, xyb1, pi1);
   result = ImageF(xsize_, ysize_);
   DiffmapPsychoImage(pi1, result);
 }
@@ -1688,23 +1726,27 @@ namespace {
 void MaltaDiffMap(const ImageF& lum0, const ImageF& lum1, const double w_0gt1,
                   const double w_0lt1, const double norm1,
                   ImageF* HWY_RESTRICT diffs,
-                  Image3F* HWY_RESTRICT block_diff_ac, size_t c) {
+                  Image3F* HWY_RESTRICT block_diff_ac, size_t c,
+                  ThreadPool* pool) {
   PROFILER_FUNC;
   const double len = 3.75;
   static const double mulli = 0.39905817637;
   HWY_DYNAMIC_DISPATCH(MaltaDiffMap)
-  (lum0, lum1, w_0gt1, w_0lt1, norm1, len, mulli, diffs, block_diff_ac, c);
+  (lum0, lum1, w_0gt1, w_0lt1, norm1, len, mulli, diffs, block_diff_ac, c,
+   pool);
 }
 
 void MaltaDiffMapLF(const ImageF& lum0, const ImageF& lum1, const double w_0gt1,
                     const double w_0lt1, const double norm1,
                     ImageF* HWY_RESTRICT diffs,
-                    Image3F* HWY_RESTRICT block_diff_ac, size_t c) {
+                    Image3F* HWY_RESTRICT block_diff_ac, size_t c,
+                    ThreadPool* pool) {
   PROFILER_FUNC;
   const double len = 3.75;
   static const double mulli = 0.611612573796;
   HWY_DYNAMIC_DISPATCH(MaltaDiffMapLF)
-  (lum0, lum1, w_0gt1, w_0lt1, norm1, len, mulli, diffs, block_diff_ac, c);
+  (lum0, lum1, w_0gt1, w_0lt1, norm1, len, mulli, diffs, block_diff_ac, c,
+   pool);
 }
 
 }  // namespace
@@ -1712,6 +1754,7 @@ void MaltaDiffMapLF(const ImageF& lum0, const ImageF& lum1, const double w_0gt1,
 void ButteraugliComparator::DiffmapPsychoImage(const PsychoImage& pi1,
                                                ImageF& diffmap) const {
   PROFILER_FUNC;
+  CacheAligned::ScopedTag tag(JXL_MEMORY_TAG_BUTTERAUGLI);
   if (xsize_ < 8 || ysize_ < 8) {
     ZeroFillImage(&diffmap);
     return;
@@ -1726,35 +1769,36 @@ void ButteraugliComparator::DiffmapPsychoImage(const PsychoImage& pi1,
   static const double wUhfMalta = 1.10039032555;
   static const double norm1Uhf = 71.7800275169;
   MaltaDiffMap(pi0_.uhf[1], pi1.uhf[1], wUhfMalta * hf_asymmetry_,
-               wUhfMalta / hf_asymmetry_, norm1Uhf, &diffs, &block_diff_ac, 1);
+               wUhfMalta / hf_asymmetry_, norm1Uhf, &diffs, &block_diff_ac, 1,
+               pool_);
 
   static const double wUhfMaltaX = 173.5;
   static const double norm1UhfX = 5.0;
   MaltaDiffMap(pi0_.uhf[0], pi1.uhf[0], wUhfMaltaX * hf_asymmetry_,
                wUhfMaltaX / hf_asymmetry_, norm1UhfX, &diffs, &block_diff_ac,
-               0);
+               0, pool_);
 
   static const double wHfMalta = 18.7237414387;
   static const double norm1Hf = 4498534.45232;
   MaltaDiffMapLF(pi0_.hf[1], pi1.hf[1], wHfMalta * std::sqrt(hf_asymmetry_),
                  wHfMalta / std::sqrt(hf_asymmetry_), norm1Hf, &diffs,
-                 &block_diff_ac, 1);
+                 &block_diff_ac, 1, pool_);
 
   static const double wHfMaltaX = 6923.99476109;
   static const double norm1HfX = 8051.15833247;
   MaltaDiffMapLF(pi0_.hf[0], pi1.hf[0], wHfMaltaX * std::sqrt(hf_asymmetry_),
                  wHfMaltaX / std::sqrt(hf_asymmetry_), norm1HfX, &diffs,
-                 &block_diff_ac, 0);
+                 &block_diff_ac, 0, pool_);
 
   static const double wMfMalta = 37.0819870399;
   static const double norm1Mf = 130262059.556;
   MaltaDiffMapLF(pi0_.mf.Plane(1), pi1.mf.Plane(1), wMfMalta, wMfMalta, norm1Mf,
-                 &diffs, &block_diff_ac, 1);
+                 &diffs, &block_diff_ac, 1, pool_);
 
   static const double wMfMaltaX = 8246.75321353;
   static const double norm1MfX = 1009002.70582;
   MaltaDiffMapLF(pi0_.mf.Plane(0), pi1.mf.Plane(0), wMfMaltaX, wMfMaltaX,
-                 norm1MfX, &diffs, &block_diff_ac, 0);
+                 norm1MfX, &diffs, &block_diff_ac, 0, pool_);
 
   static const double wmul[9] = {
       400.0,         1.50815703118,  0,
@@ -1776,12 +1820,12 @@ void ButteraugliComparator::DiffmapPsychoImage(const PsychoImage& pi1,
 
   ImageF mask;
   HWY_DYNAMIC_DISPATCH(MaskPsychoImage)
-  (pi0_, pi1, xsize_, ysize_, params_, Temp(), &blur_temp_, &mask,
+  (pi0_, pi1, xsize_, ysize_, params_, Temp(), &blur_temp_, pool_, &mask,
    &block_diff_ac.Plane(1));
   ReleaseTemp();
 
   HWY_DYNAMIC_DISPATCH(CombineChannelsToDiffmap)
-  (mask, block_diff_dc, block_diff_ac, xmul_, &diffmap);
+  (mask, block_diff_dc, block_diff_ac, xmul_, pool_, &diffmap);
 }
 
 double ButteraugliScoreFromDiffmap(const ImageF& diffmap,
@@ -1806,8 +1850,10 @@ bool ButteraugliDiffmap(const Image3F& rgb0, const Image3F& rgb1,
 }
 
 bool ButteraugliDiffmap(const Image3F& rgb0, const Image3F& rgb1,
-                        const ButteraugliParams& params, ImageF& diffmap) {
+                        const ButteraugliParams& params, ImageF& diffmap,
+                        ThreadPool* pool) {
   PROFILER_FUNC;
+  CacheAligned::ScopedTag tag(JXL_MEMORY_TAG_BUTTERAUGLI);
   const size_t xsize = rgb0.xsize();
   const size_t ysize = rgb0.ysize();
   if (xsize < 1 || ysize < 1) {
@@ -1842,7 +1888,7 @@ bool ButteraugliDiffmap(const Image3F& rgb0, const Image3F& rgb1,
     }
     ImageF diffmap_scaled;
     const bool ok =
-        ButteraugliDiffmap(scaled0, scaled1, params, diffmap_scaled);
+        ButteraugliDiffmap(scaled0, scaled1, params, diffmap_scaled, pool);
     diffmap = ImageF(xsize, ysize);
     for (size_t y = 0; y < ysize; ++y) {
       for (size_t x = 0; x < xsize; ++x) {
@@ -1851,7 +1897,7 @@ bool ButteraugliDiffmap(const Image3F& rgb0, const Image3F& rgb1,
     }
     return ok;
   }
-  ButteraugliComparator butteraugli(rgb0, params);
+  ButteraugliComparator butteraugli(rgb0, params, pool);
   butteraugli.Diffmap(rgb1, diffmap);
   return true;
 }
@@ -1867,11 +1913,11 @@ bool ButteraugliInterface(const Image3F& rgb0, const Image3F& rgb1,
 
 bool ButteraugliInterface(const Image3F& rgb0, const Image3F& rgb1,
                           const ButteraugliParams& params, ImageF& diffmap,
-                          double& diffvalue) {
+                          double& diffvalue, ThreadPool* pool) {
 #if JXL_PROFILER_ENABLED
   auto trace_start = std::chrono::steady_clock::now();
 #endif
-  if (!ButteraugliDiffmap(rgb0, rgb1, params, diffmap)) {
+  if (!ButteraugliDiffmap(rgb0, rgb1, params, diffmap, pool)) {
     return false;
   }
 #if JXL_PROFILER_ENABLED
@@ -19,6 +19,7 @@
 #include <vector>
 
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/common.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_ops.h"
@@ -76,10 +77,13 @@ struct ButteraugliParams {
 // A diffvalue between kButteraugliGood and kButteraugliBad indicates that
 // a subtle difference can be observed between the images.
 //
+// If pool is not null, the computation is parallelized over image rows. The
+// result does not depend on the number of threads.
+//
 // Returns true on success.
 bool ButteraugliInterface(const Image3F &rgb0, const Image3F &rgb1,
                           const ButteraugliParams &params, ImageF &diffmap,
-                          double &diffvalue);
+                          double &diffvalue, ThreadPool *pool = nullptr);
 
 // Deprecated (calls the previous function)
 bool ButteraugliInterface(const Image3F &rgb0, const Image3F &rgb1,
@@ -157,7 +161,11 @@ class ButteraugliComparator {
   // Butteraugli is calibrated at xmul = 1.0. We add a multiplier here so that
   // we can test the hypothesis that a higher weighing of the X channel would
   // improve results at higher Butteraugli values.
-  ButteraugliComparator(const Image3F &rgb0, const ButteraugliParams &params);
+  //
+  // `pool` (optional) is used by all subsequent Diffmap calls, which therefore
+  // must not run concurrently on tasks of the same pool.
+  ButteraugliComparator(const Image3F &rgb0, const ButteraugliParams &params,
+                        ThreadPool *pool = nullptr);
   virtual ~ButteraugliComparator() = default;
 
   // Computes the butteraugli map between the original image given in the
@@ -179,6 +187,7 @@ class ButteraugliComparator {
   const size_t xsize_;
   const size_t ysize_;
   ButteraugliParams params_;
+  ThreadPool *pool_;
   PsychoImage pi0_;
 
   // Shared temporary image storage to reduce the number of allocations;
@@ -195,7 +204,8 @@ bool ButteraugliDiffmap(const Image3F &rgb0, const Image3F &rgb1,
                         double hf_asymmetry, double xmul, ImageF &diffmap);
 
 bool ButteraugliDiffmap(const Image3F &rgb0, const Image3F &rgb1,
-                        const ButteraugliParams &params, ImageF &diffmap);
+                        const ButteraugliParams &params, ImageF &diffmap,
+                        ThreadPool *pool = nullptr);
 
 double ButteraugliScoreFromDiffmap(const ImageF &diffmap,
                                    const ButteraugliParams *params = nullptr);
@@ -5,6 +5,7 @@
 
 #include <jxl/butteraugli.h>
 #include <jxl/butteraugli_cxx.h>
+#include <jxl/thread_parallel_runner_cxx.h>
 
 #include "lib/jxl/test_image.h"
 #include "lib/jxl/test_utils.h"
@@ -101,3 +102,50 @@ TEST(ButteraugliTest, Api) {
 
   EXPECT_NE(distance1, distance2);
 }
+
+TEST(ButteraugliTest, Threads) {
+  uint32_t xsize = 171;
+  uint32_t ysize = 219;
+  std::vector<uint8_t> orig_pixels =
+      jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  std::vector<uint8_t> dist_pixels =
+      jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  for (size_t i = 0; i < dist_pixels.size(); i += 997) {
+    dist_pixels[i] += 128;
+  }
+
+  JxlPixelFormat pixel_format = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+
+  JxlButteraugliApiPtr api(JxlButteraugliApiCreate(nullptr));
+  JxlButteraugliResultPtr result(JxlButteraugliCompute(
+      api.get(), xsize, ysize, &pixel_format, orig_pixels.data(),
+      orig_pixels.size(), &pixel_format, dist_pixels.data(),
+      dist_pixels.size()));
+
+  JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(nullptr, 4);
+  JxlButteraugliApiPtr threaded_api(JxlButteraugliApiCreate(nullptr));
+  JxlButteraugliApiSetParallelRunner(threaded_api.get(),
+                                     JxlThreadParallelRunner, runner.get());
+  JxlButteraugliResultPtr threaded_result(JxlButteraugliCompute(
+      threaded_api.get(), xsize, ysize, &pixel_format, orig_pixels.data(),
+      orig_pixels.size(), &pixel_format, dist_pixels.data(),
+      dist_pixels.size()));
+
+  // The threaded computation must give exactly the same result.
+  EXPECT_NE(0.0, JxlButteraugliResultGetDistance(result.get(), 8.0));
+  EXPECT_EQ(JxlButteraugliResultGetDistance(result.get(), 8.0),
+            JxlButteraugliResultGetDistance(threaded_result.get(), 8.0));
+  const float* distmap;
+  uint32_t row_stride;
+  JxlButteraugliResultGetDistmap(result.get(), &distmap, &row_stride);
+  const float* threaded_distmap;
+  uint32_t threaded_row_stride;
+  JxlButteraugliResultGetDistmap(threaded_result.get(), &threaded_distmap,
+                                 &threaded_row_stride);
+  for (uint32_t y = 0; y < ysize; y++) {
+    for (uint32_t x = 0; x < xsize; x++) {
+      EXPECT_EQ(distmap[y * row_stride + x],
+                threaded_distmap[y * threaded_row_stride + x]);
+    }
+  }
+}
@@ -8,6 +8,7 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <mutex>
 #include <vector>
 
 #include "lib/jxl/ans_params.h"
@@ -76,9 +77,30 @@ Status DecodePermutation(size_t skip, size_t size, coeff_order_t* order,
 
 namespace {
 
+// Natural coefficient orders of the order buckets. They do not depend on the
+// image, so each one is computed on first use and then shared by all the
+// decoders of the process.
+struct NaturalCoeffOrders {
+  std::once_flag computed[kNumOrders];
+  std::vector<coeff_order_t> orders[kNumOrders];
+};
+
+// Returns the natural order of `acs`, of size kDCTBlockSize * covered blocks.
+const std::vector<coeff_order_t>& NaturalCoeffOrder(AcStrategy acs) {
+  static NaturalCoeffOrders* natural = new NaturalCoeffOrders();
+  const uint8_t ord = kStrategyOrder[acs.RawStrategy()];
+  std::call_once(natural->computed[ord], [&] {
+    std::vector<coeff_order_t>& order = natural->orders[ord];
+    order.resize(kDCTBlockSize * acs.covered_blocks_x() *
+                 acs.covered_blocks_y());
+    acs.ComputeNaturalCoeffOrder(order.data());
+  });
+  return natural->orders[ord];
+}
+
 Status DecodeCoeffOrder(AcStrategy acs, coeff_order_t* order, BitReader* br,
                         ANSSymbolReader* reader,
-                        std::vector<coeff_order_t>& natural_order,
+                        const std::vector<coeff_order_t>& natural_order,
                         const std::vector<uint8_t>& context_map) {
   PROFILER_FUNC;
   const size_t llf = acs.covered_blocks_x() * acs.covered_blocks_y();
@@ -101,7 +123,6 @@ Status DecodeCoeffOrders(uint16_t used_orders, uint32_t used_acs,
   std::vector<uint8_t> context_map;
   ANSCode code;
   std::unique_ptr<ANSSymbolReader> reader;
-  std::vector<coeff_order_t> natural_order;
   // Bitstream does not have histograms if no coefficient order is used.
   if (used_orders != 0) {
     JXL_RETURN_IF_ERROR(
@@ -120,23 +141,19 @@ Status DecodeCoeffOrders(uint16_t used_orders, uint32_t used_acs,
     AcStrategy acs = AcStrategy::FromRawStrategy(o);
     bool used = (acs_mask & (1 << ord)) != 0;
 
-    const size_t llf = acs.covered_blocks_x() * acs.covered_blocks_y();
-    const size_t size = kDCTBlockSize * llf;
-
-    if (used || (used_orders & (1 << ord))) {
-      if (natural_order.size() < size) natural_order.resize(size);
-      acs.ComputeNaturalCoeffOrder(natural_order.data());
-    }
-
     if ((used_orders & (1 << ord)) == 0) {
       // No need to set the default order if no ACS uses this order.
       if (used) {
+        const std::vector<coeff_order_t>& natural_order =
+            NaturalCoeffOrder(acs);
+        const size_t size = natural_order.size();
         for (size_t c = 0; c < 3; c++) {
           memcpy(&order[CoeffOrderOffset(ord, c)], natural_order.data(),
                  size * sizeof(*order));
         }
       }
     } else {
+      const std::vector<coeff_order_t>& natural_order = NaturalCoeffOrder(acs);
       for (size_t c = 0; c < 3; c++) {
         coeff_order_t* dest = used ? &order[CoeffOrderOffset(ord, c)] : nullptr;
         JXL_RETURN_IF_ERROR(DecodeCoeffOrder(acs, dest, br, reader.get(),
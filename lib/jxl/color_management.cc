@@ -13,7 +13,9 @@
 #include <algorithm>
 #include <array>
 #include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 
@@ -503,10 +505,8 @@ Status CreateICCLutAtoBTagForXYB(PaddedBytes* JXL_RESTRICT tags) {
   }
   return true;
 }
-}  // namespace
 
-Status MaybeCreateProfile(const ColorEncoding& c,
-                          PaddedBytes* JXL_RESTRICT icc) {
+Status CreateProfile(const ColorEncoding& c, PaddedBytes* JXL_RESTRICT icc) {
   PaddedBytes header, tagtable, tags;
 
   if (c.GetColorSpace() == ColorSpace::kUnknown || c.tf.IsUnknown()) {
@@ -678,5 +678,40 @@ Status MaybeCreateProfile(const ColorEncoding& c,
   return true;
 }
 
+}  // namespace
+
+Status MaybeCreateProfile(const ColorEncoding& c,
+                          PaddedBytes* JXL_RESTRICT icc) {
+  // The profiles of the enumerated encodings only depend on the enum values,
+  // so they are created once per process. The PQ, HLG and XYB ones need large
+  // tables.
+  const bool enumerated = c.GetColorSpace() != ColorSpace::kUnknown &&
+                          !c.tf.IsUnknown() && !c.tf.IsGamma() &&
+                          c.white_point != WhitePoint::kCustom &&
+                          c.primaries != Primaries::kCustom;
+  if (!enumerated) return CreateProfile(c, icc);
+  const uint64_t key =
+      (static_cast<uint64_t>(c.GetColorSpace()) << 32) |
+      (static_cast<uint64_t>(c.white_point) << 24) |
+      (static_cast<uint64_t>(c.primaries) << 16) |
+      (static_cast<uint64_t>(c.tf.GetTransferFunction()) << 8) |
+      static_cast<uint64_t>(c.rendering_intent);
+  static std::mutex mutex;
+  static std::map<uint64_t, PaddedBytes>* profiles =
+      new std::map<uint64_t, PaddedBytes>();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto it = profiles->find(key);
+    if (it != profiles->end()) {
+      *icc = it->second;
+      return true;
+    }
+  }
+  JXL_RETURN_IF_ERROR(CreateProfile(c, icc));
+  std::lock_guard<std::mutex> lock(mutex);
+  profiles->emplace(key, *icc);
+  return true;
+}
+
 }  // namespace jxl
 #endif  // HWY_ONCE
@@ -26,6 +26,9 @@ enum class ExtraTF {
   kPQ,
   kHLG,
   kSRGB,
+  k709,
+  // Power law, including DCI.
+  kGamma,
 };
 
 // NOTE: for XYB colorspace, the created profile can be used to transform a
@@ -233,6 +233,78 @@ TEST_F(ColorManagementTest, D2700ToSRGB) {
                           FloatNear(0.601, 1e-3)));
 }
 
+TEST_F(ColorManagementTest, ReusedTransforms) {
+  PaddedBytes icc =
+      jxl::test::ReadTestData("jxl/color_management/sRGB-D2700.icc");
+  ColorEncoding sRGB_D2700;
+  ASSERT_TRUE(sRGB_D2700.SetICC(std::move(icc)));
+  const float sRGB_D2700_values[3] = {0.863, 0.737, 0.490};
+  const auto expect_sRGB = [&](ColorSpaceTransform* transform) {
+    float sRGB_values[3];
+    ASSERT_TRUE(transform->Run(0, sRGB_D2700_values, sRGB_values));
+    EXPECT_THAT(sRGB_values,
+                ElementsAre(FloatNear(0.914, 1e-3), FloatNear(0.745, 1e-3),
+                            FloatNear(0.601, 1e-3)));
+  };
+
+  ColorSpaceTransform first(GetJxlCms());
+  ASSERT_TRUE(first.Init(sRGB_D2700, ColorEncoding::SRGB(),
+                         kDefaultIntensityTarget, 1, 1));
+  // Transforms between other profiles evict the shared one from the cache,
+  // which must not affect the transform that still uses it.
+  for (int i = 0; i < 20; ++i) {
+    ColorEncoding gamma;
+    gamma.SetColorSpace(ColorSpace::kRGB);
+    ASSERT_TRUE(gamma.tf.SetGamma(1.0 / (1.5 + 0.05 * i)));
+    ASSERT_TRUE(gamma.CreateICC());
+    ColorSpaceTransform other(GetJxlCms());
+    ASSERT_TRUE(other.Init(gamma, ColorEncoding::SRGB(),
+                           kDefaultIntensityTarget, 1, 1));
+  }
+  expect_sRGB(&first);
+
+  for (int i = 0; i < 2; ++i) {
+    ColorSpaceTransform again(GetJxlCms());
+    ASSERT_TRUE(again.Init(sRGB_D2700, ColorEncoding::SRGB(),
+                           kDefaultIntensityTarget, 1, 1));
+    expect_sRGB(&again);
+  }
+}
+
+TEST_F(ColorManagementTest, MatrixTRCProfiles) {
+  ColorEncoding p3;
+  p3.SetColorSpace(ColorSpace::kRGB);
+  p3.white_point = WhitePoint::kD65;
+  p3.primaries = Primaries::kP3;
+  p3.tf.SetTransferFunction(TransferFunction::kLinear);
+  ASSERT_TRUE(p3.CreateICC());
+
+  // The out-of-gamut result keeps its negative components.
+  ColorSpaceTransform p3_to_srgb(GetJxlCms());
+  ASSERT_TRUE(p3_to_srgb.Init(p3, ColorEncoding::LinearSRGB(),
+                              kDefaultIntensityTarget, 1, 1));
+  const float p3_values[3] = {0., 1., 0.};
+  float srgb_values[3];
+  ASSERT_TRUE(p3_to_srgb.Run(0, p3_values, srgb_values));
+  EXPECT_THAT(srgb_values,
+              ElementsAre(FloatNear(-0.2247, 1e-3), FloatNear(1.0419, 1e-3),
+                          FloatNear(-0.0786, 1e-3)));
+
+  ColorEncoding gamma;
+  gamma.SetColorSpace(ColorSpace::kRGB);
+  ASSERT_TRUE(gamma.tf.SetGamma(1.0 / 2.2));
+  ASSERT_TRUE(gamma.CreateICC());
+  ColorSpaceTransform gamma_to_linear(GetJxlCms());
+  ASSERT_TRUE(gamma_to_linear.Init(gamma, ColorEncoding::LinearSRGB(),
+                                   kDefaultIntensityTarget, 1, 1));
+  const float gamma_values[3] = {0.5, 0.5, 0.5};
+  float linear_values[3];
+  ASSERT_TRUE(gamma_to_linear.Run(0, gamma_values, linear_values));
+  EXPECT_THAT(linear_values,
+              ElementsAre(FloatNear(0.21764, 1e-4), FloatNear(0.21764, 1e-4),
+                          FloatNear(0.21764, 1e-4)));
+}
+
 TEST_F(ColorManagementTest, P3HlgTo2020Hlg) {
   ColorEncoding p3_hlg;
   p3_hlg.SetColorSpace(ColorSpace::kRGB);
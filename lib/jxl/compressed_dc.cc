@@ -147,61 +147,77 @@ void AdaptiveDCSmoothing(const float* dc_factors, Image3F* dc,
 
   PROFILER_FUNC;
 
-  Image3F smoothed(xsize, ysize);
-  // Fill in borders that the loop below will not. First and last are unused.
-  for (size_t c = 0; c < 3; c++) {
-    for (size_t y : {size_t(0), ysize - 1}) {
-      memcpy(smoothed.PlaneRow(c, y), dc->PlaneRow(c, y),
+  // The image is smoothed in place, in stripes of rows processed in parallel.
+  // Each stripe keeps a copy of the original values of its current and
+  // previous rows; the original rows just outside of a stripe can be
+  // overwritten by the neighbouring stripes, so they are saved beforehand.
+  // This avoids allocating (and writing) a second full-size DC image.
+  constexpr size_t kStripeRows = 64;
+  const size_t num_stripes = DivCeil(ysize - 2, kStripeRows);
+  Image3F borders(xsize, 2 * num_stripes);
+  for (size_t s = 0; s < num_stripes; s++) {
+    const size_t y0 = 1 + s * kStripeRows;
+    const size_t y1 = std::min(y0 + kStripeRows, ysize - 1);
+    for (size_t c = 0; c < 3; c++) {
+      memcpy(borders.PlaneRow(c, 2 * s), dc->ConstPlaneRow(c, y0 - 1),
+             xsize * sizeof(float));
+      memcpy(borders.PlaneRow(c, 2 * s + 1), dc->ConstPlaneRow(c, y1),
              xsize * sizeof(float));
     }
   }
-  auto process_row = [&](const uint32_t y, size_t /*thread*/) {
-    const float* JXL_RESTRICT rows_top[3]{
-        dc->ConstPlaneRow(0, y - 1),
-        dc->ConstPlaneRow(1, y - 1),
-        dc->ConstPlaneRow(2, y - 1),
-    };
-    const float* JXL_RESTRICT rows[3] = {
-        dc->ConstPlaneRow(0, y),
-        dc->ConstPlaneRow(1, y),
-        dc->ConstPlaneRow(2, y),
-    };
-    const float* JXL_RESTRICT rows_bottom[3] = {
-        dc->ConstPlaneRow(0, y + 1),
-        dc->ConstPlaneRow(1, y + 1),
-        dc->ConstPlaneRow(2, y + 1),
-    };
-    float* JXL_RESTRICT rows_out[3] = {
-        smoothed.PlaneRow(0, y),
-        smoothed.PlaneRow(1, y),
-        smoothed.PlaneRow(2, y),
-    };
-    for (size_t x : {size_t(0), xsize - 1}) {
+  // Two rows (current and previous original values) per thread.
+  Image3F scratch;
+  const auto init = [&](size_t num_threads) {
+    scratch = Image3F(xsize, 2 * num_threads);
+    return true;
+  };
+  const size_t N = Lanes(D());
+  auto process_stripe = [&](const uint32_t s, size_t thread) {
+    const size_t y0 = 1 + s * kStripeRows;
+    const size_t y1 = std::min(y0 + kStripeRows, ysize - 1);
+    size_t cur = 2 * thread;
+    size_t prev = 2 * thread + 1;
+    for (size_t c = 0; c < 3; c++) {
+      memcpy(scratch.PlaneRow(c, prev), borders.ConstPlaneRow(c, 2 * s),
+             xsize * sizeof(float));
+    }
+    for (size_t y = y0; y < y1; y++) {
       for (size_t c = 0; c < 3; c++) {
-        rows_out[c][x] = rows[c][x];
+        memcpy(scratch.PlaneRow(c, cur), dc->ConstPlaneRow(c, y),
+               xsize * sizeof(float));
       }
-    }
-
-    size_t x = 1;
-    // First pixels
-    const size_t N = Lanes(D());
-    for (; x < std::min(N, xsize - 1); x++) {
-      ComputePixel<DScalar>(dc_factors, rows_top, rows, rows_bottom, rows_out,
-                            x);
-    }
-    // Full vectors.
-    for (; x + N <= xsize - 1; x += N) {
-      ComputePixel<D>(dc_factors, rows_top, rows, rows_bottom, rows_out, x);
-    }
-    // Last pixels.
-    for (; x < xsize - 1; x++) {
-      ComputePixel<DScalar>(dc_factors, rows_top, rows, rows_bottom, rows_out,
-                            x);
+      const float* JXL_RESTRICT rows_top[3];
+      const float* JXL_RESTRICT rows[3];
+      const float* JXL_RESTRICT rows_bottom[3];
+      float* JXL_RESTRICT rows_out[3];
+      for (size_t c = 0; c < 3; c++) {
+        rows_top[c] = scratch.ConstPlaneRow(c, prev);
+        rows[c] = scratch.ConstPlaneRow(c, cur);
+        rows_bottom[c] = y + 1 == y1 ? borders.ConstPlaneRow(c, 2 * s + 1)
+                                     : dc->ConstPlaneRow(c, y + 1);
+        rows_out[c] = dc->PlaneRow(c, y);
+      }
+      // The first and last pixels of the row are left unchanged.
+      size_t x = 1;
+      // First pixels
+      for (; x < std::min(N, xsize - 1); x++) {
+        ComputePixel<DScalar>(dc_factors, rows_top, rows, rows_bottom,
+                              rows_out, x);
+      }
+      // Full vectors.
+      for (; x + N <= xsize - 1; x += N) {
+        ComputePixel<D>(dc_factors, rows_top, rows, rows_bottom, rows_out, x);
+      }
+      // Last pixels.
+      for (; x < xsize - 1; x++) {
+        ComputePixel<DScalar>(dc_factors, rows_top, rows, rows_bottom,
+                              rows_out, x);
+      }
+      std::swap(cur, prev);
     }
   };
-  JXL_CHECK(RunOnPool(pool, 1, ysize - 1, ThreadPool::NoInit, process_row,
-                      "DCSmoothingRow"));
-  dc->Swap(smoothed);
+  JXL_CHECK(RunOnPool(pool, 0, num_stripes, init, process_stripe,
+                      "DCSmoothingStripe"));
 }
 
 // DC dequantization.
@@ -22,148 +22,138 @@ using hwy::HWY_NAMESPACE::Add;
 using hwy::HWY_NAMESPACE::Mul;
 using hwy::HWY_NAMESPACE::Vec;
 
-// Weighted sum of 1x5 pixels around ix, iy with [wx2 wx1 wx0 wx1 wx2].
-template <class WrapY>
-static float WeightedSumBorder(const ImageF& in, const WrapY wrap_y,
-                               const int64_t ix, const int64_t iy,
-                               const size_t xsize, const size_t ysize,
-                               const float wx0, const float wx1,
-                               const float wx2) {
-  const WrapMirror wrap_x;
-  const float* JXL_RESTRICT row = in.ConstRow(wrap_y(iy, ysize));
-  const float in_m2 = row[wrap_x(ix - 2, xsize)];
-  const float in_p2 = row[wrap_x(ix + 2, xsize)];
-  const float in_m1 = row[wrap_x(ix - 1, xsize)];
-  const float in_p1 = row[wrap_x(ix + 1, xsize)];
-  const float in_00 = row[ix];
-  const float sum_2 = wx2 * (in_m2 + in_p2);
-  const float sum_1 = wx1 * (in_m1 + in_p1);
-  const float sum_0 = wx0 * in_00;
-  return sum_2 + sum_1 + sum_0;
-}
-
-template <class WrapY, class V>
-static V WeightedSum(const ImageF& in, const WrapY wrap_y, const size_t ix,
-                     const int64_t iy, const size_t ysize, const V wx0,
-                     const V wx1, const V wx2) {
-  const HWY_FULL(float) d;
-  const float* JXL_RESTRICT center = in.ConstRow(wrap_y(iy, ysize)) + ix;
-  const auto in_m2 = LoadU(d, center - 2);
-  const auto in_p2 = LoadU(d, center + 2);
-  const auto in_m1 = LoadU(d, center - 1);
-  const auto in_p1 = LoadU(d, center + 1);
-  const auto in_00 = Load(d, center);
-  const auto sum_2 = Mul(wx2, Add(in_m2, in_p2));
-  const auto sum_1 = Mul(wx1, Add(in_m1, in_p1));
-  const auto sum_0 = Mul(wx0, in_00);
-  return Add(sum_2, Add(sum_1, sum_0));
-}
-
-// Produces result for one pixel
-template <class WrapY>
-float Symmetric5Border(const ImageF& in, const Rect& rect, const int64_t ix,
-                       const int64_t iy, const WeightsSymmetric5& weights) {
-  const float w0 = weights.c[0];
-  const float w1 = weights.r[0];
-  const float w2 = weights.R[0];
-  const float w4 = weights.d[0];
-  const float w5 = weights.L[0];
-  const float w8 = weights.D[0];
-
-  const size_t xsize = rect.xsize();
-  const size_t ysize = rect.ysize();
-  const WrapY wrap_y;
-  // Unrolled loop over all 5 rows of the kernel.
-  float sum0 = WeightedSumBorder(in, wrap_y, ix, iy, xsize, ysize, w0, w1, w2);
-
-  sum0 += WeightedSumBorder(in, wrap_y, ix, iy - 2, xsize, ysize, w2, w5, w8);
-  float sum1 =
-      WeightedSumBorder(in, wrap_y, ix, iy + 2, xsize, ysize, w2, w5, w8);
-
-  sum0 += WeightedSumBorder(in, wrap_y, ix, iy - 1, xsize, ysize, w1, w4, w5);
-  sum1 += WeightedSumBorder(in, wrap_y, ix, iy + 1, xsize, ysize, w1, w4, w5);
-
-  return sum0 + sum1;
-}
-
-// Produces result for one vector's worth of pixels
-template <class WrapY>
-static void Symmetric5Interior(const ImageF& in, const Rect& rect,
-                               const int64_t ix, const int64_t iy,
-                               const WeightsSymmetric5& weights,
-                               float* JXL_RESTRICT row_out) {
-  const HWY_FULL(float) d;
-
-  const auto w0 = LoadDup128(d, weights.c);
-  const auto w1 = LoadDup128(d, weights.r);
-  const auto w2 = LoadDup128(d, weights.R);
-  const auto w4 = LoadDup128(d, weights.d);
-  const auto w5 = LoadDup128(d, weights.L);
-  const auto w8 = LoadDup128(d, weights.D);
-
-  const size_t ysize = rect.ysize();
-  const WrapY wrap_y;
-  // Unrolled loop over all 5 rows of the kernel.
-  auto sum0 = WeightedSum(in, wrap_y, ix, iy, ysize, w0, w1, w2);
-
-  sum0 = Add(sum0, WeightedSum(in, wrap_y, ix, iy - 2, ysize, w2, w5, w8));
-  auto sum1 = WeightedSum(in, wrap_y, ix, iy + 2, ysize, w2, w5, w8);
-
-  sum0 = Add(sum0, WeightedSum(in, wrap_y, ix, iy - 1, ysize, w1, w4, w5));
-  sum1 = Add(sum1, WeightedSum(in, wrap_y, ix, iy + 1, ysize, w1, w4, w5));
-
-  Store(Add(sum0, sum1), d, row_out + ix);
-}
-
-template <class WrapY>
-static void Symmetric5Row(const ImageF& in, const Rect& rect, const int64_t iy,
-                          const WeightsSymmetric5& weights,
-                          float* JXL_RESTRICT row_out) {
-  const int64_t kRadius = 2;
-  const size_t xsize = rect.xsize();
-
-  size_t ix = 0;
-  const HWY_FULL(float) d;
-  const size_t N = Lanes(d);
-  const size_t aligned_x = RoundUpTo(kRadius, N);
-  for (; ix < std::min(aligned_x, xsize); ++ix) {
-    row_out[ix] = Symmetric5Border<WrapY>(in, rect, ix, iy, weights);
+// 5x5 convolution by a kernel with 6 unique weights (see WeightsSymmetric5),
+// run by ConvolveT like the other strategies. Vectors of pixels with kRadius
+// valid neighbors on each side are computed with unaligned loads; the first
+// and last pixels of a row are computed one at a time with mirrored
+// coordinates. Rows outside the image are mirrored by `wrap_row`.
+class Symmetric5Strategy {
+  using D = HWY_CAPPED(float, 16);
+  using V = Vec<D>;
+
+ public:
+  static constexpr int64_t kRadius = 2;
+
+  template <size_t kSizeModN, class WrapRow>
+  static JXL_MAYBE_INLINE void ConvolveRow(
+      const float* const JXL_RESTRICT row_m, const size_t xsize,
+      const int64_t stride, const WrapRow& wrap_row,
+      const WeightsSymmetric5& weights, float* const JXL_RESTRICT row_out) {
+    const D d;
+    const int64_t neg_stride = -stride;  // allows LEA addressing.
+    const float* const JXL_RESTRICT row_t2 =
+        wrap_row(row_m + 2 * neg_stride, stride);
+    const float* const JXL_RESTRICT row_t1 =
+        wrap_row(row_m + 1 * neg_stride, stride);
+    const float* const JXL_RESTRICT row_b1 =
+        wrap_row(row_m + 1 * stride, stride);
+    const float* const JXL_RESTRICT row_b2 =
+        wrap_row(row_m + 2 * stride, stride);
+
+    const size_t N = Lanes(d);
+    const size_t aligned_x = RoundUpTo(kRadius, N);
+    size_t x = 0;
+    for (; x < std::min(aligned_x, xsize); ++x) {
+      row_out[x] = BorderPixel(row_t2, row_t1, row_m, row_b1, row_b2, x,
+                               xsize, weights);
+    }
+
+    const V w0 = LoadDup128(d, weights.c);
+    const V w1 = LoadDup128(d, weights.r);
+    const V w2 = LoadDup128(d, weights.R);
+    const V w4 = LoadDup128(d, weights.d);
+    const V w5 = LoadDup128(d, weights.L);
+    const V w8 = LoadDup128(d, weights.D);
+    for (; x + N + kRadius <= xsize; x += N) {
+      // Unrolled loop over all 5 rows of the kernel.
+      V sum0 = WeightedSum(row_m + x, w0, w1, w2);
+      sum0 = Add(sum0, WeightedSum(row_t2 + x, w2, w5, w8));
+      V sum1 = WeightedSum(row_b2 + x, w2, w5, w8);
+      sum0 = Add(sum0, WeightedSum(row_t1 + x, w1, w4, w5));
+      sum1 = Add(sum1, WeightedSum(row_b1 + x, w1, w4, w5));
+      Store(Add(sum0, sum1), d, row_out + x);
+    }
+
+    for (; x < xsize; ++x) {
+      row_out[x] = BorderPixel(row_t2, row_t1, row_m, row_b1, row_b2, x,
+                               xsize, weights);
+    }
   }
-  for (; ix + N + kRadius <= xsize; ix += N) {
-    Symmetric5Interior<WrapY>(in, rect, ix, iy, weights, row_out);
+
+ private:
+  // Weighted sum of 1x5 pixels around `pos` with [wx2 wx1 wx0 wx1 wx2].
+  // Requires kRadius valid pixels before/after pos.
+  static JXL_MAYBE_INLINE V WeightedSum(const float* const JXL_RESTRICT pos,
+                                        const V wx0, const V wx1,
+                                        const V wx2) {
+    const D d;
+    const V in_m2 = LoadU(d, pos - 2);
+    const V in_p2 = LoadU(d, pos + 2);
+    const V in_m1 = LoadU(d, pos - 1);
+    const V in_p1 = LoadU(d, pos + 1);
+    const V in_00 = LoadU(d, pos);
+    const V sum_2 = Mul(wx2, Add(in_m2, in_p2));
+    const V sum_1 = Mul(wx1, Add(in_m1, in_p1));
+    const V sum_0 = Mul(wx0, in_00);
+    return Add(sum_2, Add(sum_1, sum_0));
   }
-  for (; ix < xsize; ++ix) {
-    row_out[ix] = Symmetric5Border<WrapY>(in, rect, ix, iy, weights);
+
+  // Same as WeightedSum for a single pixel, with mirrored coordinates.
+  static float WeightedSumBorder(const float* const JXL_RESTRICT row,
+                                 const int64_t x, const int64_t xsize,
+                                 const float wx0, const float wx1,
+                                 const float wx2) {
+    const float in_m2 = row[Mirror(x - 2, xsize)];
+    const float in_p2 = row[Mirror(x + 2, xsize)];
+    const float in_m1 = row[Mirror(x - 1, xsize)];
+    const float in_p1 = row[Mirror(x + 1, xsize)];
+    const float in_00 = row[x];
+    const float sum_2 = wx2 * (in_m2 + in_p2);
+    const float sum_1 = wx1 * (in_m1 + in_p1);
+    const float sum_0 = wx0 * in_00;
+    return sum_2 + sum_1 + sum_0;
   }
-}
 
-static JXL_NOINLINE void Symmetric5BorderRow(const ImageF& in, const Rect& rect,
-                                             const int64_t iy,
-                                             const WeightsSymmetric5& weights,
-                                             float* JXL_RESTRICT row_out) {
-  return Symmetric5Row<WrapMirror>(in, rect, iy, weights, row_out);
-}
+  static JXL_NOINLINE float BorderPixel(const float* const JXL_RESTRICT row_t2,
+                                        const float* const JXL_RESTRICT row_t1,
+                                        const float* const JXL_RESTRICT row_m,
+                                        const float* const JXL_RESTRICT row_b1,
+                                        const float* const JXL_RESTRICT row_b2,
+                                        const int64_t x, const int64_t xsize,
+                                        const WeightsSymmetric5& weights) {
+    const float w0 = weights.c[0];
+    const float w1 = weights.r[0];
+    const float w2 = weights.R[0];
+    const float w4 = weights.d[0];
+    const float w5 = weights.L[0];
+    const float w8 = weights.D[0];
+    float sum0 = WeightedSumBorder(row_m, x, xsize, w0, w1, w2);
+    sum0 += WeightedSumBorder(row_t2, x, xsize, w2, w5, w8);
+    float sum1 = WeightedSumBorder(row_b2, x, xsize, w2, w5, w8);
+    sum0 += WeightedSumBorder(row_t1, x, xsize, w1, w4, w5);
+    sum1 += WeightedSumBorder(row_b1, x, xsize, w1, w4, w5);
+    return sum0 + sum1;
+  }
+};
 
-// Semi-vectorized (interior pixels Fonly); called directly like slow::, unlike
-// the fully vectorized strategies below.
 void Symmetric5(const ImageF& in, const Rect& rect,
                 const WeightsSymmetric5& weights, ThreadPool* pool,
                 ImageF* JXL_RESTRICT out) {
-  PROFILER_FUNC;
+  using Conv = ConvolveT<Symmetric5Strategy>;
+  if (rect.xsize() >= Conv::MinWidth()) {
+    return Conv::Run(in, rect, weights, pool, out);
+  }
 
-  const size_t ysize = rect.ysize();
-  JXL_CHECK(RunOnPool(
-      pool, 0, static_cast<uint32_t>(ysize), ThreadPool::NoInit,
-      [&](const uint32_t task, size_t /*thread*/) {
-        const int64_t iy = task;
-
-        if (iy < 2 || iy >= static_cast<ssize_t>(ysize) - 2) {
-          Symmetric5BorderRow(in, rect, iy, weights, out->Row(iy));
-        } else {
-          Symmetric5Row<WrapUnchanged>(in, rect, iy, weights, out->Row(iy));
-        }
-      },
-      "Symmetric5x5Convolution"));
+  // Too narrow for a single vector: every pixel is a border pixel, which
+  // ConvolveRow handles for any width.
+  PROFILER_FUNC;
+  JXL_CHECK(SameSize(rect, *out));
+  const int64_t stride = in.PixelsPerRow();
+  const WrapRowMirror wrap_row(in, rect.ysize());
+  for (size_t y = 0; y < rect.ysize(); ++y) {
+    Symmetric5Strategy::ConvolveRow<0>(rect.ConstRow(in, y), rect.xsize(),
+                                       stride, wrap_row, weights, out->Row(y));
+  }
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -55,6 +55,7 @@ class ACImageT final : public ACImage {
     static_assert(
         std::is_same<T, int16_t>::value || std::is_same<T, int32_t>::value,
         "ACImage must be either 32- or 16- bit");
+    CacheAligned::ScopedTag tag(JXL_MEMORY_TAG_AC_COEFFICIENTS);
     img_ = Image3<T>(xsize, ysize);
   }
   ACType Type() const override {
@@ -357,6 +357,15 @@ Status DecodeHistograms(BitReader* br, size_t num_contexts, ANSCode* code,
   const size_t max_alphabet_size = 1 << code->log_alpha_size;
   JXL_RETURN_IF_ERROR(
       DecodeANSCodes(num_histograms, max_alphabet_size, br, code));
+  // Prefix codes with LZ77 are what the fast lossless encoder produces; their
+  // RLE-only fast path can decode two literals per table lookup.
+  if (code->use_prefix_code && code->lz77.enabled) {
+    for (size_t c = 0; c < num_histograms; c++) {
+      size_t max_symbol = std::min<size_t>(code->uint_config[c].split_token,
+                                           code->lz77.min_symbol);
+      code->huffman_data[c].BuildPairTable(max_symbol);
+    }
+  }
   // When using LZ77, flat codes might result in valid codestreams with
   // histograms that potentially allow very large bit counts.
   // TODO(veluca): in principle, a valid codestream might contain a histogram
@@ -276,20 +276,39 @@ class ANSSymbolReader {
   }
 
   // Takes a *clustered* idx. Can only use if HuffRleOnly() is true.
-  void ReadHybridUintClusteredHuffRleOnly(size_t ctx,
-                                          BitReader* JXL_RESTRICT br,
-                                          uint32_t* value, uint32_t* run) {
+  // Decodes either a value or, for an LZ77 token, the number of further
+  // repetitions of the previous value into `run`. If `allow_pair` is true
+  // and the next bits hold two literals without extra bits, decodes both at
+  // once into `value` and `next` and returns true; the caller must then
+  // consume `next` as the following value of the same context.
+  bool ReadHybridUintClusteredHuffRleOnlyPair(size_t ctx, bool allow_pair,
+                                              BitReader* JXL_RESTRICT br,
+                                              uint32_t* value, uint32_t* next,
+                                              uint32_t* run) {
     JXL_DASSERT(HuffRleOnly());
     br->Refill();  // covers ReadSymbolWithoutRefill + PeekBits
-    size_t token = ReadSymbolHuffWithoutRefill(ctx, br);
+    const HuffmanDecodingData& huff = huffman_data_[ctx];
+    if (allow_pair && !huff.pair_table_.empty()) {
+      const HuffmanDecodingData::SymbolPair& pair =
+          huff.pair_table_[br->PeekFixedBits<kHuffmanTableBits>()];
+      if (pair.bits != 0) {
+        br->Consume(pair.bits);
+        *value = pair.symbols[0];
+        *next = pair.symbols[1];
+        return true;
+      }
+    }
+    size_t token = huff.ReadSymbol(br);
     if (JXL_UNLIKELY(token >= lz77_threshold_)) {
       *run =
           ReadHybridUintConfig(lz77_length_uint_, token - lz77_threshold_, br) +
           lz77_min_length_ - 1;
-      return;
+      return false;
     }
     *value = ReadHybridUintConfig(configs[ctx], token, br);
+    return false;
   }
+
   bool HuffRleOnly() {
     if (lz77_window_ == nullptr) return false;
     if (!use_prefix_code_) return false;
@@ -346,6 +365,23 @@ class ANSSymbolReader {
     return ret;
   }
 
+  // Same as ReadHybridUintClustered, for readers that do not use LZ77 and
+  // whose type of entropy code is known at compile time: this skips all the
+  // per-symbol LZ77 bookkeeping and the entropy code type check.
+  template <bool uses_prefix_code>
+  JXL_INLINE size_t ReadHybridUintClusteredNoLZ77(size_t ctx,
+                                                  BitReader* JXL_RESTRICT br) {
+    JXL_DASSERT(!UsesLZ77());
+    JXL_DASSERT(uses_prefix_code == use_prefix_code_);
+    br->Refill();  // covers ReadSymbolWithoutRefill + PeekBits
+    size_t token = uses_prefix_code ? ReadSymbolHuffWithoutRefill(ctx, br)
+                                    : ReadSymbolANSWithoutRefill(ctx, br);
+    return ReadHybridUintConfig(configs[ctx], token, br);
+  }
+
+  bool UsesLZ77() const { return lz77_window_ != nullptr; }
+  bool UsesPrefixCode() const { return use_prefix_code_; }
+
   JXL_INLINE size_t ReadHybridUint(size_t ctx, BitReader* JXL_RESTRICT br,
                                    const std::vector<uint8_t>& context_map) {
     return ReadHybridUintClustered(context_map[ctx], br);
@@ -355,8 +391,22 @@ class ANSSymbolReader {
   // This function will modify the ANS state as if `count` symbols have been
   // decoded.
   bool IsSingleValueAndAdvance(size_t ctx, uint32_t* value, size_t count) {
-    // TODO(veluca): No optimization for Huffman mode yet.
-    if (use_prefix_code_) return false;
+    if (use_prefix_code_) {
+      // A zero-length code can only be the code of the single symbol of a
+      // histogram; reading it does not consume any bits.
+      if (num_to_copy_ != 0) return false;
+      const HuffmanCode& code = huffman_data_[ctx].table_[0];
+      if (code.bits != 0) return false;
+      if (configs[ctx].split_token <= code.value) return false;
+      if (code.value >= lz77_threshold_) return false;
+      *value = code.value;
+      if (lz77_window_) {
+        for (size_t i = 0; i < count; i++) {
+          lz77_window_[(num_decoded_++) & kWindowMask] = code.value;
+        }
+      }
+      return true;
+    }
     // TODO(eustas): propagate "degenerate_symbol" to simplify this method.
     const uint32_t res = state_ & (ANS_TAB_SIZE - 1u);
     const AliasTable::Entry* table = &alias_tables_[ctx << log_alpha_size_];
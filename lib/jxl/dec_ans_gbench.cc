@@ -0,0 +1,96 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cmath>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/base/random.h"
+#include "lib/jxl/base/span.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/dec_ans.h"
+#include "lib/jxl/dec_bit_reader.h"
+#include "lib/jxl/enc_ans.h"
+#include "lib/jxl/enc_bit_writer.h"
+
+namespace jxl {
+namespace {
+
+constexpr size_t kNumContexts = 4;
+constexpr size_t kNumTokens = 1 << 18;
+
+struct EncodedTokens {
+  std::vector<Token> tokens;
+  std::vector<uint8_t> bytes;
+};
+
+// Encodes tokens whose values are distributed like the prediction residuals of
+// a photographic image: geometrically, with a mean of roughly `mean`, and a
+// different scale for each context. LZ77 is disabled so that only the symbol
+// decoding is measured.
+EncodedTokens EncodeResiduals(size_t mean, bool use_prefix_code) {
+  EncodedTokens encoded;
+  Rng rng(0);
+  for (size_t i = 0; i < kNumTokens; ++i) {
+    const uint32_t context = rng.UniformU(0, kNumContexts);
+    const float scale = mean * (context + 1) / 2.5f;
+    const float value = -scale * std::log(1.0f - rng.UniformF(0.0f, 1.0f));
+    encoded.tokens.emplace_back(context, static_cast<uint32_t>(value));
+  }
+
+  HistogramParams params;
+  params.lz77_method = HistogramParams::LZ77Method::kNone;
+  params.force_huffman = use_prefix_code;
+  std::vector<std::vector<Token>> tokens = {encoded.tokens};
+  EntropyEncodingData codes;
+  std::vector<uint8_t> context_map;
+  BitWriter writer;
+  BuildAndEncodeHistograms(params, kNumContexts, tokens, &codes, &context_map,
+                           &writer, 0, nullptr);
+  WriteTokens(tokens[0], codes, context_map, &writer, 0, nullptr);
+  writer.ZeroPadToByte();
+  const Span<const uint8_t> span = writer.GetSpan();
+  encoded.bytes.assign(span.data(), span.data() + span.size());
+  return encoded;
+}
+
+// Decodes `kNumTokens` hybrid-uint tokens with ANSSymbolReader, including the
+// histograms. Arguments: mean token value, and whether to use prefix codes
+// (HuffmanDecodingData::ReadSymbol) instead of ANS.
+void BM_DecodeTokens(benchmark::State& state) {
+  const EncodedTokens encoded =
+      EncodeResiduals(state.range(0), /*use_prefix_code=*/state.range(1));
+  uint32_t checksum = 0;
+  for (auto _ : state) {
+    BitReader br(Span<const uint8_t>(encoded.bytes));
+    ANSCode code;
+    std::vector<uint8_t> context_map;
+    JXL_CHECK(DecodeHistograms(&br, kNumContexts, &code, &context_map));
+    ANSSymbolReader reader(&code, &br);
+    for (const Token& token : encoded.tokens) {
+      checksum += reader.ReadHybridUint(token.context, &br, context_map);
+    }
+    JXL_CHECK(reader.CheckANSFinalState());
+    JXL_CHECK(br.Close());
+  }
+  benchmark::DoNotOptimize(checksum);
+  state.SetItemsProcessed(kNumTokens * state.iterations());
+  state.SetBytesProcessed(encoded.bytes.size() * state.iterations());
+}
+
+BENCHMARK(BM_DecodeTokens)
+    ->ArgNames({"mean", "prefix"})
+    ->Args({2, 0})
+    ->Args({2, 1})
+    ->Args({16, 0})
+    ->Args({16, 1})
+    ->Args({256, 0})
+    ->Args({256, 1});
+
+}  // namespace
+}  // namespace jxl
@@ -38,6 +38,7 @@ class BitReader {
         bits_in_buf_(0),
         next_byte_{nullptr},
         end_minus_8_{nullptr},
+        end_{nullptr},
         first_byte_(nullptr) {}
   BitReader(const BitReader&) = delete;
 
@@ -49,6 +50,27 @@ class BitReader {
         next_byte_(bytes.data()),
         // Assumes first_byte_ >= 8.
         end_minus_8_(bytes.data() - 8 + bytes.size()),
+        end_(bytes.data() + bytes.size()),
+        first_byte_(bytes.data()) {
+    Refill();
+  }
+
+  // Same as above, but `readable_size` >= bytes.size() bytes starting at
+  // bytes.data() are known to be valid memory, e.g. because `bytes` is one
+  // section of a larger buffer. Refills may then load the bytes past the end
+  // of `bytes` instead of taking the bounds-checked path, so that only the
+  // sections at the very end of the buffer need it. The bits after the end of
+  // `bytes` are unspecified rather than zero, but reading them is still
+  // reported by AllReadsWithinBounds() and Close().
+  template <class ArrayLike>
+  BitReader(const ArrayLike& bytes, size_t readable_size)
+      : buf_(0),
+        bits_in_buf_(0),
+        next_byte_(bytes.data()),
+        end_minus_8_(bytes.data() - 8 +
+                     (readable_size > bytes.size() ? readable_size
+                                                   : bytes.size())),
+        end_(bytes.data() + bytes.size()),
         first_byte_(bytes.data()) {
     Refill();
   }
@@ -70,6 +92,7 @@ class BitReader {
     bits_in_buf_ = other.bits_in_buf_;
     next_byte_ = other.next_byte_;
     end_minus_8_ = other.end_minus_8_;
+    end_ = other.end_;
     first_byte_ = other.first_byte_;
     overread_bytes_ = other.overread_bytes_;
     close_called_ = other.close_called_;
@@ -104,7 +127,8 @@ class BitReader {
 
   // Returns the bits that would be returned by Read without calling Advance().
   // It is legal to PEEK at more bits than present in the bitstream (required
-  // by Huffman), and those bits will be zero.
+  // by Huffman), and those bits will be zero (or unspecified, if the reader
+  // was constructed with a readable_size).
   template <size_t N>
   JXL_INLINE uint64_t PeekFixedBits() const {
     static_assert(N <= kMaxBitsPerCall, "Reading too many bits in one call.");
@@ -218,7 +242,7 @@ class BitReader {
   // non-byte-aligned positions).
   const uint8_t* FirstByte() const { return first_byte_; }
   size_t TotalBytes() const {
-    return static_cast<size_t>(end_minus_8_ + 8 - first_byte_);
+    return static_cast<size_t>(end_ - first_byte_);
   }
 
   // Returns span of the remaining (unconsumed) bytes, e.g. for passing to
@@ -298,6 +322,7 @@ class BitReader {
   size_t bits_in_buf_;  // [0, 64)
   const uint8_t* JXL_RESTRICT next_byte_;
   const uint8_t* end_minus_8_;  // for refill bounds check
+  const uint8_t* end_;          // end of the bits to read, for TotalBytes
   const uint8_t* first_byte_;   // for GetSpan
 
   // Number of bytes past the end that were loaded into the buf_. These bytes
@@ -5,6 +5,8 @@
 
 #include "lib/jxl/dec_cache.h"
 
+#include <algorithm>
+
 #include "lib/jxl/blending.h"
 #include "lib/jxl/render_pipeline/stage_blending.h"
 #include "lib/jxl/render_pipeline/stage_chroma_upsampling.h"
@@ -42,8 +44,13 @@ Status PassesDecoderState::PreparePipeline(ImageBundle* decoded,
   if (options.use_slow_render_pipeline) {
     builder.UseSimpleImplementation();
   }
+  if (stage_hook) {
+    builder.SetStageHook(stage_hook);
+  }
 
-  if (!frame_header.chroma_subsampling.Is444()) {
+  if (frame_header.chroma_subsampling.Is420()) {
+    builder.AddStage(GetChromaUpsampling420Stage());
+  } else if (!frame_header.chroma_subsampling.Is444()) {
     for (size_t c = 0; c < 3; c++) {
       if (frame_header.chroma_subsampling.HShift(c) != 0) {
         builder.AddStage(GetChromaUpsamplingStage(c, /*horizontal=*/true));
@@ -54,17 +61,21 @@ Status PassesDecoderState::PreparePipeline(ImageBundle* decoded,
     }
   }
 
-  if (frame_header.loop_filter.gab) {
-    builder.AddStage(GetGaborishStage(frame_header.loop_filter));
-  }
-
   {
     const LoopFilter& lf = frame_header.loop_filter;
-    if (lf.epf_iters >= 3) {
-      builder.AddStage(GetEPFStage(lf, sigma, 0));
-    }
-    if (lf.epf_iters >= 1) {
-      builder.AddStage(GetEPFStage(lf, sigma, 1));
+    if (lf.gab && lf.epf_iters >= 1 && lf.epf_iters < 3) {
+      // Gaborish directly feeds the first EPF step.
+      builder.AddStage(GetGaborishEPF1Stage(lf, sigma));
+    } else {
+      if (lf.gab) {
+        builder.AddStage(GetGaborishStage(lf));
+      }
+      if (lf.epf_iters >= 3) {
+        builder.AddStage(GetEPFStage(lf, sigma, 0));
+      }
+      if (lf.epf_iters >= 1) {
+        builder.AddStage(GetEPFStage(lf, sigma, 1));
+      }
     }
     if (lf.epf_iters >= 2) {
       builder.AddStage(GetEPFStage(lf, sigma, 2));
@@ -83,6 +94,7 @@ Status PassesDecoderState::PreparePipeline(ImageBundle* decoded,
   if (!late_ec_upsample) {
     for (size_t ec = 0; ec < frame_header.extra_channel_upsampling.size();
          ec++) {
+      if (ec >= options.num_decoded_extra_channels) break;
       if (frame_header.extra_channel_upsampling[ec] != 1) {
         builder.AddStage(GetUpsamplingStage(
             frame_header.nonserialized_metadata->transform_data, 3 + ec,
@@ -101,9 +113,10 @@ Status PassesDecoderState::PreparePipeline(ImageBundle* decoded,
   }
 
   if (frame_header.upsampling != 1) {
+    size_t num_late_ec =
+        late_ec_upsample ? frame_header.extra_channel_upsampling.size() : 0;
     size_t nb_channels =
-        3 +
-        (late_ec_upsample ? frame_header.extra_channel_upsampling.size() : 0);
+        3 + std::min(num_late_ec, options.num_decoded_extra_channels);
     for (size_t c = 0; c < nb_channels; c++) {
       builder.AddStage(GetUpsamplingStage(
           frame_header.nonserialized_metadata->transform_data, c,
@@ -150,13 +163,34 @@ Status PassesDecoderState::PreparePipeline(ImageBundle* decoded,
                                             width, height, is_rgba, has_alpha,
                                             alpha_c));
   } else {
+    // The conversion to the output encoding may round to the 8-bit levels if
+    // its values are only written to an 8-bit output, and not unpremultiplied.
+    const bool write_8bit =
+        HasImageOutput() && main_planes.empty() && !unpremul_alpha &&
+        main_output.format.data_type == JXL_TYPE_UINT8 &&
+        main_output.bits_per_sample == 8;
+    const bool stored_before_output =
+        options.coalescing &&
+        (NeedsBlending(this) || (frame_header.CanBeReferenced() &&
+                                 !frame_header.save_before_color_transform));
     bool linear = false;
     if (frame_header.color_transform == ColorTransform::kYCbCr) {
       builder.AddStage(GetYCbCrStage());
     } else if (frame_header.color_transform == ColorTransform::kXYB) {
-      builder.AddStage(GetXYBStage(output_encoding_info));
-      if (output_encoding_info.color_encoding.GetColorSpace() !=
+      const bool has_spot_colors =
+          options.render_spotcolors &&
+          frame_header.nonserialized_metadata->m.Find(ExtraChannel::kSpotColor);
+      if (output_encoding_info.color_encoding.GetColorSpace() ==
           ColorSpace::kXYB) {
+        builder.AddStage(GetXYBStage(output_encoding_info));
+      } else if (!has_spot_colors &&
+                 !GetToneMappingStage(output_encoding_info)) {
+        // None of the stages before the write stage needs linear values, so
+        // the conversion to the output encoding can be done right away.
+        builder.AddStage(GetXYBToOutputStage(
+            output_encoding_info, write_8bit && !stored_before_output));
+      } else {
+        builder.AddStage(GetXYBStage(output_encoding_info));
         linear = true;
       }
     }  // Nothing to do for kNone.
@@ -209,20 +243,28 @@ Status PassesDecoderState::PreparePipeline(ImageBundle* decoded,
     }
 
     if (linear) {
-      builder.AddStage(GetFromLinearStage(output_encoding_info));
+      builder.AddStage(GetFromLinearStage(output_encoding_info, write_8bit));
       linear = false;
     }
 
-    if (main_output.callback.IsPresent() || main_output.buffer) {
-      builder.AddStage(GetWriteToOutputStage(main_output, width, height,
-                                             has_alpha, unpremul_alpha, alpha_c,
-                                             undo_orientation, extra_output));
+    if (HasImageOutput()) {
+      const bool chroma_420 =
+          !main_planes.empty() && main_plane_layout != JXL_PLANES_CHANNELS;
+      if (chroma_420) {
+        const bool bt709 = main_plane_layout == JXL_PLANES_YCBCR_BT709_I420 ||
+                           main_plane_layout == JXL_PLANES_YCBCR_BT709_NV12;
+        builder.AddStage(GetYCbCr420OutputStage(bt709, output_rect));
+      }
+      builder.AddStage(GetWriteToOutputStage(
+          main_output, output_rect, has_alpha, unpremul_alpha, alpha_c,
+          undo_orientation, extra_output, main_planes, chroma_420));
     } else {
       builder.AddStage(GetWriteToImageBundleStage(
           decoded, output_encoding_info.color_encoding));
     }
   }
   render_pipeline = std::move(builder).Finalize(shared->frame_dim);
+  if (options.collect_stats) render_pipeline->EnableStats();
   return render_pipeline->IsInitialized();
 }
 
@@ -43,17 +43,41 @@ struct PixelCallback {
     JXL_ASSERT(has_init == has_run && has_run == has_destroy);
 #endif
   }
+  PixelCallback(JxlImageOutInitCallback init, JxlImageOutRectCallback run_rect,
+                size_t max_rows, JxlImageOutDestroyCallback destroy,
+                void* init_opaque)
+      : init(init),
+        destroy(destroy),
+        init_opaque(init_opaque),
+        run_rect(run_rect),
+        max_rows(max_rows) {}
 
-  bool IsPresent() const { return run != nullptr; }
+  bool IsPresent() const { return run != nullptr || run_rect != nullptr; }
 
   void* Init(size_t num_threads, size_t num_pixels) const {
     return init(init_opaque, num_threads, num_pixels);
   }
 
+  // Passes `num_pixels` pixels of `pixel_size` bytes of row `y` from `x` on
+  // to the callback, as a rectangle of one row for rect callbacks.
+  void RunRow(void* run_opaque, size_t thread_id, size_t x, size_t y,
+              size_t num_pixels, size_t pixel_size, const void* pixels) const {
+    if (run_rect) {
+      run_rect(run_opaque, thread_id, x, y, num_pixels, 1,
+               num_pixels * pixel_size, pixels);
+    } else {
+      run(run_opaque, thread_id, x, y, num_pixels, pixels);
+    }
+  }
+
   JxlImageOutInitCallback init = nullptr;
   JxlImageOutRunCallback run = nullptr;
   JxlImageOutDestroyCallback destroy = nullptr;
   void* init_opaque = nullptr;
+  // Alternative to `run` receiving rectangles of up to `max_rows` rows, or
+  // columns if the output is transposed.
+  JxlImageOutRectCallback run_rect = nullptr;
+  size_t max_rows = 1;
 };
 
 struct ImageOutput {
@@ -70,6 +94,91 @@ struct ImageOutput {
   size_t stride;
 };
 
+// Temp images required for decoding a single group. Reduces memory allocations
+// for large images because we only initialize min(#threads, #groups) instances.
+struct GroupDecCache {
+  void InitOnce(size_t num_passes, size_t used_acs) {
+    PROFILER_FUNC;
+
+    for (size_t i = 0; i < num_passes; i++) {
+      if (num_nzeroes[i].xsize() == 0) {
+        // Allocate enough for a whole group - partial groups on the
+        // right/bottom border just use a subset. The valid size is passed via
+        // Rect.
+
+        num_nzeroes[i] = Image3I(kGroupDimInBlocks, kGroupDimInBlocks);
+      }
+    }
+    size_t max_block_area = 0;
+
+    for (uint8_t o = 0; o < AcStrategy::kNumValidStrategies; ++o) {
+      AcStrategy acs = AcStrategy::FromRawStrategy(o);
+      if ((used_acs & (1 << o)) == 0) continue;
+      size_t area =
+          acs.covered_blocks_x() * acs.covered_blocks_y() * kDCTBlockSize;
+      max_block_area = std::max(area, max_block_area);
+    }
+
+    if (max_block_area > max_block_area_) {
+      max_block_area_ = max_block_area;
+      // We need 3x float blocks for dequantized coefficients and 1x for scratch
+      // space for transforms.
+      float_memory_ = hwy::AllocateAligned<float>(max_block_area_ * 4);
+      // We need 3x int32 or int16 blocks for the quantized coefficients of all
+      // the varblocks that start in one row of blocks. They cover at most
+      // kGroupDimInBlocks columns, each at most max_block_area_ / kDCTBlockSize
+      // blocks tall.
+      const size_t row_area =
+          std::min(kGroupDimInBlocks * max_block_area_,
+                   kGroupDimInBlocks * kGroupDimInBlocks * kDCTBlockSize);
+      int32_memory_ = hwy::AllocateAligned<int32_t>(row_area * 3);
+      int16_memory_ = hwy::AllocateAligned<int16_t>(row_area * 3);
+      fast_idct_memory_ = hwy::AllocateAligned<int16_t>(max_block_area_ * 3);
+    }
+
+    dec_group_block = float_memory_.get();
+    scratch_space = dec_group_block + max_block_area_ * 3;
+    dec_group_qblock = int32_memory_.get();
+    dec_group_qblock16 = int16_memory_.get();
+    fast_idct_scratch_space = fast_idct_memory_.get();
+  }
+
+  void InitDCBufferOnce() {
+    if (dc_buffer.xsize() == 0) {
+      dc_buffer = ImageF(kGroupDimInBlocks + kRenderPipelineXOffset * 2,
+                         kGroupDimInBlocks + 4);
+    }
+  }
+
+  // Scratch space used by DecGroupImpl().
+  float* dec_group_block;
+  // Quantized coefficients of a row of blocks.
+  int32_t* dec_group_qblock;
+  int16_t* dec_group_qblock16;
+
+  // For TransformToPixels.
+  float* scratch_space;
+  // For the fixed-point IDCT: the coefficients, the pixels and the scratch
+  // space of a block.
+  int16_t* fast_idct_scratch_space;
+  // Note that only one of dec_group_qblock and dec_group_qblock16 is ever
+  // used.
+  // TODO(veluca): figure out if we can save allocations.
+
+  // AC decoding
+  Image3I num_nzeroes[kMaxNumPasses];
+
+  // Buffer for DC upsampling.
+  ImageF dc_buffer;
+
+ private:
+  hwy::AlignedFreeUniquePtr<float[]> float_memory_;
+  hwy::AlignedFreeUniquePtr<int32_t[]> int32_memory_;
+  hwy::AlignedFreeUniquePtr<int16_t[]> int16_memory_;
+  hwy::AlignedFreeUniquePtr<int16_t[]> fast_idct_memory_;
+  size_t max_block_area_ = 0;
+};
+
 // Per-frame decoder state. All the images here should be accessed through a
 // group rect (either with block units or pixel units).
 struct PassesDecoderState {
@@ -94,12 +203,27 @@ struct PassesDecoderState {
   // Image dimensions before applying undo_orientation.
   size_t width;
   size_t height;
+  // Part of the image, before applying undo_orientation, that is written to
+  // main_output and extra_output; its size is width x height.
+  Rect output_rect;
   ImageOutput main_output;
   std::vector<ImageOutput> extra_output;
+  // If not empty, the image is written to these planes instead of to the
+  // buffer or callback of main_output, whose format still gives the channels.
+  std::vector<ImageOutput> main_planes;
+  JxlPlaneLayout main_plane_layout;
+
+  bool HasImageOutput() const {
+    return main_output.callback.IsPresent() || main_output.buffer ||
+           !main_planes.empty();
+  }
 
   // Whether to use int16 float-XYB-to-uint8-srgb conversion.
   bool fast_xyb_srgb8_conversion;
 
+  // Whether to use the int16 fixed-point IDCT for the blocks that have one.
+  bool fast_idct = false;
+
   // If true, the RGBA output will be unpremultiplied before writing to the
   // output.
   bool unpremul_alpha;
@@ -121,13 +245,24 @@ struct PassesDecoderState {
   // Rendering pipeline.
   std::unique_ptr<RenderPipeline> render_pipeline;
 
+  // If set, PreparePipeline passes every stage through it, so that it can be
+  // replaced, see RenderPipelineStageHook.
+  RenderPipelineStageHook stage_hook;
+
   // Storage for the current frame if it can be referenced by future frames.
   ImageBundle frame_storage_for_referencing;
 
+  // Scratch buffers for decoding groups, used by up to min(#threads, #groups)
+  // threads at a time. Kept across frames.
+  std::vector<GroupDecCache> group_dec_caches;
+
   struct PipelineOptions {
     bool use_slow_render_pipeline;
     bool coalescing;
     bool render_spotcolors;
+    // The other extra channels are not decoded and get no upsampling stages.
+    size_t num_decoded_extra_channels;
+    bool collect_stats;
   };
 
   Status PreparePipeline(ImageBundle* decoded, PipelineOptions options);
@@ -144,7 +279,10 @@ struct PassesDecoderState {
 
     main_output.callback = PixelCallback();
     main_output.buffer = nullptr;
+    output_rect = Rect();
     extra_output.clear();
+    main_planes.clear();
+    main_plane_layout = JXL_PLANES_CHANNELS;
 
     fast_xyb_srgb8_conversion = false;
     unpremul_alpha = false;
@@ -160,6 +298,34 @@ struct PassesDecoderState {
     return true;
   }
 
+  // Drops everything that refers to the frames of the current image, so that
+  // this state can decode another image, but keeps the scratch buffers and the
+  // dequantization tables allocated.
+  void ResetForNextImage() {
+    for (auto& dc_frame : shared_storage.dc_frames) dc_frame = Image3F();
+    for (auto& reference_frame : shared_storage.reference_frames) {
+      reference_frame.frame = ImageBundle();
+      reference_frame.ib_is_in_xyb = false;
+    }
+    frame_storage_for_referencing = ImageBundle();
+    render_pipeline.reset();
+    visible_frame_index = 0;
+    nonvisible_frame_index = 0;
+    output_encoding_info = OutputEncodingInfo();
+  }
+
+  // Drops the reference frames and DC frames of the storage slots of `slots`,
+  // with the bits of FrameDecoder::SavedAs, once no later frame reads them.
+  void ReleaseReferences(int slots) {
+    for (size_t i = 0; i < 4; ++i) {
+      if (slots & (1 << i)) {
+        shared_storage.reference_frames[i].frame = ImageBundle();
+        shared_storage.reference_frames[i].ib_is_in_xyb = false;
+      }
+      if (slots & (16 << i)) shared_storage.dc_frames[i] = Image3F();
+    }
+  }
+
   // Initialize the decoder state after all of DC is decoded.
   Status InitForAC(ThreadPool* pool) {
     shared_storage.coeff_order_size = 0;
@@ -184,78 +350,6 @@ struct PassesDecoderState {
   void ComputeSigma(const Rect& block_rect, PassesDecoderState* state);
 };
 
-// Temp images required for decoding a single group. Reduces memory allocations
-// for large images because we only initialize min(#threads, #groups) instances.
-struct GroupDecCache {
-  void InitOnce(size_t num_passes, size_t used_acs) {
-    PROFILER_FUNC;
-
-    for (size_t i = 0; i < num_passes; i++) {
-      if (num_nzeroes[i].xsize() == 0) {
-        // Allocate enough for a whole group - partial groups on the
-        // right/bottom border just use a subset. The valid size is passed via
-        // Rect.
-
-        num_nzeroes[i] = Image3I(kGroupDimInBlocks, kGroupDimInBlocks);
-      }
-    }
-    size_t max_block_area = 0;
-
-    for (uint8_t o = 0; o < AcStrategy::kNumValidStrategies; ++o) {
-      AcStrategy acs = AcStrategy::FromRawStrategy(o);
-      if ((used_acs & (1 << o)) == 0) continue;
-      size_t area =
-          acs.covered_blocks_x() * acs.covered_blocks_y() * kDCTBlockSize;
-      max_block_area = std::max(area, max_block_area);
-    }
-
-    if (max_block_area > max_block_area_) {
-      max_block_area_ = max_block_area;
-      // We need 3x float blocks for dequantized coefficients and 1x for scratch
-      // space for transforms.
-      float_memory_ = hwy::AllocateAligned<float>(max_block_area_ * 4);
-      // We need 3x int32 or int16 blocks for quantized coefficients.
-      int32_memory_ = hwy::AllocateAligned<int32_t>(max_block_area_ * 3);
-      int16_memory_ = hwy::AllocateAligned<int16_t>(max_block_area_ * 3);
-    }
-
-    dec_group_block = float_memory_.get();
-    scratch_space = dec_group_block + max_block_area_ * 3;
-    dec_group_qblock = int32_memory_.get();
-    dec_group_qblock16 = int16_memory_.get();
-  }
-
-  void InitDCBufferOnce() {
-    if (dc_buffer.xsize() == 0) {
-      dc_buffer = ImageF(kGroupDimInBlocks + kRenderPipelineXOffset * 2,
-                         kGroupDimInBlocks + 4);
-    }
-  }
-
-  // Scratch space used by DecGroupImpl().
-  float* dec_group_block;
-  int32_t* dec_group_qblock;
-  int16_t* dec_group_qblock16;
-
-  // For TransformToPixels.
-  float* scratch_space;
-  // Note that scratch_space is never used at the same time as dec_group_qblock.
-  // Moreover, only one of dec_group_qblock16 is ever used.
-  // TODO(veluca): figure out if we can save allocations.
-
-  // AC decoding
-  Image3I num_nzeroes[kMaxNumPasses];
-
-  // Buffer for DC upsampling.
-  ImageF dc_buffer;
-
- private:
-  hwy::AlignedFreeUniquePtr<float[]> float_memory_;
-  hwy::AlignedFreeUniquePtr<int32_t[]> int32_memory_;
-  hwy::AlignedFreeUniquePtr<int16_t[]> int16_memory_;
-  size_t max_block_area_ = 0;
-};
-
 }  // namespace jxl
 
 #endif  // LIB_JXL_DEC_CACHE_H_
@@ -105,103 +105,122 @@ void StoreLEFloat(float value, uint8_t* p) {
   StoreLE32(u, p);
 }
 
-// The orientation may not be identity.
-// TODO(lode): SIMDify where possible
-template <typename T>
-Status UndoOrientation(jxl::Orientation undo_orientation, const Plane<T>& image,
-                       Plane<T>& out, jxl::ThreadPool* pool) {
-  const size_t xsize = image.xsize();
-  const size_t ysize = image.ysize();
-
-  if (undo_orientation == Orientation::kFlipHorizontal) {
-    out = Plane<T>(xsize, ysize);
-    JXL_RETURN_IF_ERROR(RunOnPool(
-        pool, 0, static_cast<uint32_t>(ysize), ThreadPool::NoInit,
-        [&](const uint32_t task, size_t /*thread*/) {
-          const int64_t y = task;
-          const T* JXL_RESTRICT row_in = image.Row(y);
-          T* JXL_RESTRICT row_out = out.Row(y);
-          for (size_t x = 0; x < xsize; ++x) {
-            row_out[xsize - x - 1] = row_in[x];
-          }
-        },
-        "UndoOrientation"));
-  } else if (undo_orientation == Orientation::kRotate180) {
-    out = Plane<T>(xsize, ysize);
-    JXL_RETURN_IF_ERROR(RunOnPool(
-        pool, 0, static_cast<uint32_t>(ysize), ThreadPool::NoInit,
-        [&](const uint32_t task, size_t /*thread*/) {
-          const int64_t y = task;
-          const T* JXL_RESTRICT row_in = image.Row(y);
-          T* JXL_RESTRICT row_out = out.Row(ysize - y - 1);
-          for (size_t x = 0; x < xsize; ++x) {
-            row_out[xsize - x - 1] = row_in[x];
-          }
-        },
-        "UndoOrientation"));
-  } else if (undo_orientation == Orientation::kFlipVertical) {
-    out = Plane<T>(xsize, ysize);
-    JXL_RETURN_IF_ERROR(RunOnPool(
-        pool, 0, static_cast<uint32_t>(ysize), ThreadPool::NoInit,
-        [&](const uint32_t task, size_t /*thread*/) {
-          const int64_t y = task;
-          const T* JXL_RESTRICT row_in = image.Row(y);
-          T* JXL_RESTRICT row_out = out.Row(ysize - y - 1);
-          for (size_t x = 0; x < xsize; ++x) {
-            row_out[x] = row_in[x];
-          }
-        },
-        "UndoOrientation"));
-  } else if (undo_orientation == Orientation::kTranspose) {
-    out = Plane<T>(ysize, xsize);
-    JXL_RETURN_IF_ERROR(RunOnPool(
-        pool, 0, static_cast<uint32_t>(ysize), ThreadPool::NoInit,
-        [&](const uint32_t task, size_t /*thread*/) {
-          const int64_t y = task;
-          const T* JXL_RESTRICT row_in = image.Row(y);
-          for (size_t x = 0; x < xsize; ++x) {
-            out.Row(x)[y] = row_in[x];
-          }
-        },
-        "UndoOrientation"));
-  } else if (undo_orientation == Orientation::kRotate90) {
-    out = Plane<T>(ysize, xsize);
-    JXL_RETURN_IF_ERROR(RunOnPool(
-        pool, 0, static_cast<uint32_t>(ysize), ThreadPool::NoInit,
-        [&](const uint32_t task, size_t /*thread*/) {
-          const int64_t y = task;
-          const T* JXL_RESTRICT row_in = image.Row(y);
-          for (size_t x = 0; x < xsize; ++x) {
-            out.Row(x)[ysize - y - 1] = row_in[x];
-          }
-        },
-        "UndoOrientation"));
-  } else if (undo_orientation == Orientation::kAntiTranspose) {
-    out = Plane<T>(ysize, xsize);
-    JXL_RETURN_IF_ERROR(RunOnPool(
-        pool, 0, static_cast<uint32_t>(ysize), ThreadPool::NoInit,
-        [&](const uint32_t task, size_t /*thread*/) {
-          const int64_t y = task;
-          const T* JXL_RESTRICT row_in = image.Row(y);
-          for (size_t x = 0; x < xsize; ++x) {
-            out.Row(xsize - x - 1)[ysize - y - 1] = row_in[x];
-          }
-        },
-        "UndoOrientation"));
-  } else if (undo_orientation == Orientation::kRotate270) {
-    out = Plane<T>(ysize, xsize);
-    JXL_RETURN_IF_ERROR(RunOnPool(
-        pool, 0, static_cast<uint32_t>(ysize), ThreadPool::NoInit,
-        [&](const uint32_t task, size_t /*thread*/) {
-          const int64_t y = task;
-          const T* JXL_RESTRICT row_in = image.Row(y);
-          for (size_t x = 0; x < xsize; ++x) {
-            out.Row(xsize - x - 1)[y] = row_in[x];
-          }
-        },
-        "UndoOrientation"));
+// Number of rows that OrientedChannels transposes at once.
+constexpr size_t kBandRows = 8;
+
+// The channels of an image with the orientation undone, without an oriented
+// copy of them: the flips only change which row is read and the order of its
+// values, and the transposing orientations gather the rows of bands of
+// kBandRows output rows at once, reading kBandRows consecutive values of each
+// input row, so that the input is read only once per band. The rows of a
+// band are valid until the thread loads the next band.
+class OrientedChannels {
+ public:
+  OrientedChannels(const ImageF* const* channels, size_t num_channels,
+                   Orientation undo_orientation)
+      : channels_(channels), num_channels_(num_channels) {
+    const Orientation o = undo_orientation;
+    transpose_ = o == Orientation::kTranspose || o == Orientation::kRotate90 ||
+                 o == Orientation::kAntiTranspose ||
+                 o == Orientation::kRotate270;
+    // Whether the input x, respectively y, runs backwards along the output
+    // columns, or the output rows for the transposing orientations.
+    mirror_x_ = o == Orientation::kFlipHorizontal ||
+                o == Orientation::kRotate180 ||
+                o == Orientation::kAntiTranspose ||
+                o == Orientation::kRotate270;
+    mirror_y_ = o == Orientation::kRotate180 ||
+                o == Orientation::kFlipVertical ||
+                o == Orientation::kRotate90 ||
+                o == Orientation::kAntiTranspose;
+    in_xsize_ = channels[0]->xsize();
+    in_ysize_ = channels[0]->ysize();
   }
-  return true;
+
+  size_t xsize() const { return transpose_ ? in_ysize_ : in_xsize_; }
+  size_t ysize() const { return transpose_ ? in_xsize_ : in_ysize_; }
+  uint32_t NumBands() const {
+    return static_cast<uint32_t>(DivCeil(ysize(), kBandRows));
+  }
+
+  Status Init(size_t num_threads) {
+    if (transpose_ || mirror_x_) {
+      scratch_ = ImageF(xsize(), kBandRows * num_channels_ * num_threads);
+    }
+    return true;
+  }
+
+  void LoadBand(size_t band, size_t thread) {
+    if (!transpose_) return;
+    const size_t y0 = band * kBandRows;
+    const size_t num_rows = std::min(kBandRows, ysize() - y0);
+    // The output rows of the band are the input columns [x0, x0 + num_rows),
+    // in reverse order if mirrored.
+    const size_t x0 = mirror_x_ ? in_xsize_ - y0 - num_rows : y0;
+    for (size_t c = 0; c < num_channels_; ++c) {
+      if (!channels_[c]) continue;
+      float* JXL_RESTRICT rows_out[kBandRows];
+      for (size_t i = 0; i < num_rows; ++i) {
+        const size_t k = mirror_x_ ? num_rows - 1 - i : i;
+        rows_out[k] = ScratchRow(c, i, thread);
+      }
+      for (size_t x = 0; x < in_ysize_; ++x) {
+        const float* JXL_RESTRICT row_in =
+            channels_[c]->ConstRow(mirror_y_ ? in_ysize_ - 1 - x : x) + x0;
+        for (size_t k = 0; k < num_rows; ++k) rows_out[k][x] = row_in[k];
+      }
+    }
+  }
+
+  // Returns the output row `y` of the non-null channel `c`, which is in the
+  // band last loaded by `thread`.
+  const float* Row(size_t c, size_t y, size_t thread) {
+    if (transpose_) return ScratchRow(c, y % kBandRows, thread);
+    const float* JXL_RESTRICT row_in =
+        channels_[c]->ConstRow(mirror_y_ ? in_ysize_ - 1 - y : y);
+    if (!mirror_x_) return row_in;
+    float* JXL_RESTRICT row_out = ScratchRow(c, y % kBandRows, thread);
+    for (size_t x = 0; x < in_xsize_; ++x) {
+      row_out[in_xsize_ - 1 - x] = row_in[x];
+    }
+    return row_out;
+  }
+
+ private:
+  float* ScratchRow(size_t c, size_t i, size_t thread) {
+    return scratch_.Row((thread * num_channels_ + c) * kBandRows + i);
+  }
+
+  const ImageF* const* channels_;
+  size_t num_channels_;
+  bool transpose_;
+  bool mirror_x_;
+  bool mirror_y_;
+  size_t in_xsize_;
+  size_t in_ysize_;
+  ImageF scratch_;
+};
+
+// Runs `row_func(y, thread)` for each output row of `oriented`, in tasks of
+// one band of rows.
+template <class InitFunc, class RowFunc>
+Status RunOnRows(ThreadPool* pool, OrientedChannels* oriented,
+                 const InitFunc& init_func, const RowFunc& row_func,
+                 const char* caller) {
+  const size_t ysize = oriented->ysize();
+  return RunOnPool(
+      pool, 0, oriented->NumBands(),
+      [&](size_t num_threads) -> Status {
+        JXL_RETURN_IF_ERROR(oriented->Init(num_threads));
+        return init_func(num_threads);
+      },
+      [&](const uint32_t band, const size_t thread) {
+        oriented->LoadBand(band, thread);
+        const size_t y0 = band * kBandRows;
+        const size_t y1 = std::min(ysize, y0 + kBandRows);
+        for (size_t y = y0; y < y1; ++y) row_func(y, thread);
+      },
+      caller);
 }
 }  // namespace
 
@@ -284,21 +303,10 @@ Status ConvertChannelsToExternal(const ImageF* channels[], size_t num_channels,
     return true;
   };
 
-  // Channels used to store the transformed original channels if needed.
-  ImageF temp_channels[kConvertMaxChannels];
-  if (undo_orientation != Orientation::kIdentity) {
-    for (size_t c = 0; c < num_channels; ++c) {
-      if (channels[c]) {
-        JXL_RETURN_IF_ERROR(UndoOrientation(undo_orientation, *channels[c],
-                                            temp_channels[c], pool));
-        channels[c] = &(temp_channels[c]);
-      }
-    }
-  }
-
   // First channel may not be nullptr.
-  size_t xsize = channels[0]->xsize();
-  size_t ysize = channels[0]->ysize();
+  OrientedChannels oriented(channels, num_channels, undo_orientation);
+  size_t xsize = oriented.xsize();
+  size_t ysize = oriented.ysize();
   if (stride < bytes_per_pixel * xsize) {
     return JXL_FAILURE("stride is smaller than scanline width in bytes: %" PRIuS
                        " vs %" PRIuS,
@@ -328,18 +336,18 @@ Status ConvertChannelsToExternal(const ImageF* channels[], size_t num_channels,
     if (bits_per_sample == 16) {
       bool swap_endianness = little_endian != IsLittleEndian();
       Plane<hwy::float16_t> f16_cache;
-      JXL_RETURN_IF_ERROR(RunOnPool(
-          pool, 0, static_cast<uint32_t>(ysize),
+      JXL_RETURN_IF_ERROR(RunOnRows(
+          pool, &oriented,
           [&](size_t num_threads) {
             f16_cache =
                 Plane<hwy::float16_t>(xsize, num_channels * num_threads);
             return InitOutCallback(num_threads);
           },
-          [&](const uint32_t task, const size_t thread) {
-            const int64_t y = task;
+          [&](const size_t y, const size_t thread) {
             const float* JXL_RESTRICT row_in[kConvertMaxChannels];
             for (size_t c = 0; c < num_channels; c++) {
-              row_in[c] = channels[c] ? channels[c]->Row(y) : ones.Row(0);
+              row_in[c] =
+                  channels[c] ? oriented.Row(c, y, thread) : ones.Row(0);
             }
             hwy::float16_t* JXL_RESTRICT row_f16[kConvertMaxChannels];
             for (size_t c = 0; c < num_channels; c++) {
@@ -366,24 +374,24 @@ Status ConvertChannelsToExternal(const ImageF* channels[], size_t num_channels,
               }
             }
             if (out_callback.IsPresent()) {
-              out_callback.run(out_run_opaque.get(), thread, 0, y, xsize,
-                               row_out);
+              out_callback.RunRow(out_run_opaque.get(), thread, 0, y, xsize,
+                                  bytes_per_pixel, row_out);
             }
           },
           "ConvertF16"));
     } else if (bits_per_sample == 32) {
-      JXL_RETURN_IF_ERROR(RunOnPool(
-          pool, 0, static_cast<uint32_t>(ysize),
+      JXL_RETURN_IF_ERROR(RunOnRows(
+          pool, &oriented,
           [&](size_t num_threads) { return InitOutCallback(num_threads); },
-          [&](const uint32_t task, const size_t thread) {
-            const int64_t y = task;
+          [&](const size_t y, const size_t thread) {
             uint8_t* row_out =
                 out_callback.IsPresent()
                     ? row_out_callback[thread].data()
                     : &(reinterpret_cast<uint8_t*>(out_image))[stride * y];
             const float* JXL_RESTRICT row_in[kConvertMaxChannels];
             for (size_t c = 0; c < num_channels; c++) {
-              row_in[c] = channels[c] ? channels[c]->Row(y) : ones.Row(0);
+              row_in[c] =
+                  channels[c] ? oriented.Row(c, y, thread) : ones.Row(0);
             }
             if (little_endian) {
               StoreFloatRow<StoreLEFloat>(row_in, num_channels, xsize, row_out);
@@ -391,8 +399,8 @@ Status ConvertChannelsToExternal(const ImageF* channels[], size_t num_channels,
               StoreFloatRow<StoreBEFloat>(row_in, num_channels, xsize, row_out);
             }
             if (out_callback.IsPresent()) {
-              out_callback.run(out_run_opaque.get(), thread, 0, y, xsize,
-                               row_out);
+              out_callback.RunRow(out_run_opaque.get(), thread, 0, y, xsize,
+                                  bytes_per_pixel, row_out);
             }
           },
           "ConvertFloat"));
@@ -404,21 +412,20 @@ Status ConvertChannelsToExternal(const ImageF* channels[], size_t num_channels,
     // range.
     float mul = (1ull << bits_per_sample) - 1;
     Plane<uint32_t> u32_cache;
-    JXL_RETURN_IF_ERROR(RunOnPool(
-        pool, 0, static_cast<uint32_t>(ysize),
+    JXL_RETURN_IF_ERROR(RunOnRows(
+        pool, &oriented,
         [&](size_t num_threads) {
           u32_cache = Plane<uint32_t>(xsize, num_channels * num_threads);
           return InitOutCallback(num_threads);
         },
-        [&](const uint32_t task, const size_t thread) {
-          const int64_t y = task;
+        [&](const size_t y, const size_t thread) {
           uint8_t* row_out =
               out_callback.IsPresent()
                   ? row_out_callback[thread].data()
                   : &(reinterpret_cast<uint8_t*>(out_image))[stride * y];
           const float* JXL_RESTRICT row_in[kConvertMaxChannels];
           for (size_t c = 0; c < num_channels; c++) {
-            row_in[c] = channels[c] ? channels[c]->Row(y) : ones.Row(0);
+            row_in[c] = channels[c] ? oriented.Row(c, y, thread) : ones.Row(0);
           }
           uint32_t* JXL_RESTRICT row_u32[kConvertMaxChannels];
           for (size_t c = 0; c < num_channels; c++) {
@@ -439,8 +446,8 @@ Status ConvertChannelsToExternal(const ImageF* channels[], size_t num_channels,
             }
           }
           if (out_callback.IsPresent()) {
-            out_callback.run(out_run_opaque.get(), thread, 0, y, xsize,
-                             row_out);
+            out_callback.RunRow(out_run_opaque.get(), thread, 0, y, xsize,
+                                bytes_per_pixel, row_out);
           }
         },
         "ConvertUint"));
@@ -465,12 +472,20 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
   Image3F unpremul;
   if (ib.AlphaIsPremultiplied() && ib.HasAlpha() && unpremul_alpha) {
     unpremul = Image3F(color->xsize(), color->ysize());
-    CopyImageTo(*color, &unpremul);
-    for (size_t y = 0; y < unpremul.ysize(); y++) {
-      UnpremultiplyAlpha(unpremul.PlaneRow(0, y), unpremul.PlaneRow(1, y),
-                         unpremul.PlaneRow(2, y), ib.alpha().Row(y),
-                         unpremul.xsize());
-    }
+    // Copies and unpremultiplies each row while it is in cache.
+    const size_t row_bytes = color->xsize() * sizeof(float);
+    JXL_RETURN_IF_ERROR(RunOnPool(
+        pool, 0, static_cast<uint32_t>(unpremul.ysize()), ThreadPool::NoInit,
+        [&](const uint32_t y, size_t /*thread*/) {
+          for (size_t c = 0; c < 3; c++) {
+            memcpy(unpremul.PlaneRow(c, y), color->ConstPlaneRow(c, y),
+                   row_bytes);
+          }
+          UnpremultiplyAlpha(unpremul.PlaneRow(0, y), unpremul.PlaneRow(1, y),
+                             unpremul.PlaneRow(2, y), ib.alpha().Row(y),
+                             unpremul.xsize());
+        },
+        "UnpremultiplyAlpha"));
     color = &unpremul;
   }
 
@@ -489,5 +504,16 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
       pool, out_image, out_size, out_callback, undo_orientation);
 }
 
+Status ConvertToExternal(const jxl::ImageF& channel, size_t bits_per_sample,
+                         bool float_out, JxlEndianness endianness,
+                         size_t stride, jxl::ThreadPool* pool, void* out_image,
+                         size_t out_size, const PixelCallback& out_callback,
+                         jxl::Orientation undo_orientation) {
+  const ImageF* channels[1] = {&channel};
+  return ConvertChannelsToExternal(channels, 1, bits_per_sample, float_out,
+                                   endianness, stride, pool, out_image,
+                                   out_size, out_callback, undo_orientation);
+}
+
 }  // namespace jxl
 #endif  // HWY_ONCE
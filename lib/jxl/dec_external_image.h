@@ -41,6 +41,15 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
                          jxl::Orientation undo_orientation,
                          bool unpremul_alpha = false);
 
+// Same as above for a single plane, such as an extra channel, written with one
+// sample per pixel.
+Status ConvertToExternal(const jxl::ImageF& channel, size_t bits_per_sample,
+                         bool float_out, JxlEndianness endianness,
+                         size_t stride_out, jxl::ThreadPool* thread_pool,
+                         void* out_image, size_t out_size,
+                         const PixelCallback& out_callback,
+                         jxl::Orientation undo_orientation);
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_DEC_EXTERNAL_IMAGE_H_
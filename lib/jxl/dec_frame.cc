@@ -103,7 +103,7 @@ Status DecodeFrame(PassesDecoderState* dec_state, ThreadPool* JXL_RESTRICT pool,
     for (auto toc_entry : frame_decoder.Toc()) {
       JXL_RETURN_IF_ERROR(pos + toc_entry.size <= avail_in);
       auto br = make_unique<BitReader>(
-          Span<const uint8_t>(next_in + pos, toc_entry.size));
+          Span<const uint8_t>(next_in + pos, toc_entry.size), avail_in - pos);
       section_info.emplace_back(
           FrameDecoder::SectionInfo{br.get(), toc_entry.id});
       section_closers.emplace_back(
@@ -132,7 +132,7 @@ Status FrameDecoder::InitFrame(BitReader* JXL_RESTRICT br, ImageBundle* decoded,
   JXL_ASSERT(is_finalized_);
 
   // Reset the dequantization matrices to their default values.
-  dec_state_->shared_storage.matrices = DequantMatrices();
+  dec_state_->shared_storage.matrices.Reset();
 
   frame_header_.nonserialized_is_preview = is_preview;
   JXL_ASSERT(frame_header_.nonserialized_metadata != nullptr);
@@ -203,6 +203,7 @@ Status FrameDecoder::InitFrameOutput() {
   JXL_RETURN_IF_ERROR(
       InitializePassesSharedState(frame_header_, &dec_state_->shared_storage));
   JXL_RETURN_IF_ERROR(dec_state_->Init());
+  dec_state_->fast_idct = fast_idct_;
   modular_frame_decoder_.Init(frame_dim_);
 
   if (decoded_->IsJPEG()) {
@@ -245,6 +246,8 @@ Status FrameDecoder::InitFrameOutput() {
   decoded_dc_groups_.resize(frame_dim_.num_dc_groups);
   decoded_passes_per_ac_group_.clear();
   decoded_passes_per_ac_group_.resize(frame_dim_.num_groups, 0);
+  flushed_ac_groups_.clear();
+  flushed_ac_groups_.resize(frame_dim_.num_groups, 0);
   processed_section_.clear();
   processed_section_.resize(toc_.size());
   allocated_ = false;
@@ -291,6 +294,9 @@ Status FrameDecoder::ProcessDCGlobal(BitReader* br) {
         frame_dim_.xsize_upsampled, frame_dim_.ysize_upsampled,
         dec_state_->shared->cmap));
   }
+  num_decoded_extra_channels_ = NumDecodedExtraChannels();
+  modular_frame_decoder_.SetNumDecodedExtraChannels(
+      num_decoded_extra_channels_);
   Status dec_status = modular_frame_decoder_.DecodeGlobalInfo(
       br, frame_header_, /*allow_truncated_group=*/false);
   if (dec_status.IsFatalError()) return dec_status;
@@ -380,6 +386,9 @@ Status FrameDecoder::ProcessACGlobal(BitReader* br) {
           dec_state_->shared_storage.block_ctx_map.NumACContexts();
       JXL_RETURN_IF_ERROR(DecodeHistograms(
           br, num_contexts, &dec_state_->code[i], &dec_state_->context_map[i]));
+      ++num_ac_entropy_codes_;
+      num_ac_histograms_ += dec_state_->code[i].uint_config.size();
+      if (dec_state_->code[i].lz77.enabled) ++num_ac_lz77_codes_;
       // Add extra values to enable the cheat in hot loop of DecodeACVarBlock.
       dec_state_->context_map[i].resize(
           num_contexts + kZeroDensityContextLimit - kZeroDensityContextCount);
@@ -388,10 +397,12 @@ Status FrameDecoder::ProcessACGlobal(BitReader* br) {
     }
     max_num_bits_ac += CeilLog2Nonzero(
         dec_state_->shared_storage.frame_header.passes.num_passes);
-    // 16-bit buffer for decoding to JPEG are not implemented.
+    // The coefficients of the frame fit in 16 bits in most cases, which halves
+    // the memory traffic of storing them across passes and of dequantizing
+    // them. JPEG reconstruction widens them back to 32 bits per block.
     // TODO(veluca): figure out the exact limit - 16 should still work with
     // 16-bit buffers, but we are excluding it for safety.
-    bool use_16_bit = max_num_bits_ac < 16 && !decoded_->IsJPEG();
+    bool use_16_bit = max_num_bits_ac < 16;
     bool store = frame_header_.passes.num_passes > 1;
     size_t xs = store ? kGroupDim * kGroupDim : 0;
     size_t ys = store ? frame_dim_.num_groups : 0;
@@ -444,6 +455,8 @@ Status FrameDecoder::ProcessACGlobal(BitReader* br) {
     }
   }
   decoded_ac_global_ = true;
+  // Groups flushed so far were drawn from the DC only.
+  std::fill(flushed_ac_groups_.begin(), flushed_ac_groups_.end(), 0);
   return true;
 }
 
@@ -469,10 +482,11 @@ Status FrameDecoder::ProcessACGroup(size_t ac_group_id,
   bool should_run_pipeline = true;
 
   if (frame_header_.encoding == FrameEncoding::kVarDCT) {
-    group_dec_caches_[thread].InitOnce(frame_header_.passes.num_passes,
-                                       dec_state_->used_acs);
+    GroupDecCache* group_dec_cache = &dec_state_->group_dec_caches[thread];
+    group_dec_cache->InitOnce(frame_header_.passes.num_passes,
+                              dec_state_->used_acs);
     JXL_RETURN_IF_ERROR(DecodeGroup(br, num_passes, ac_group_id, dec_state_,
-                                    &group_dec_caches_[thread], thread,
+                                    group_dec_cache, thread,
                                     render_pipeline_input, decoded_,
                                     decoded_passes_per_ac_group_[ac_group_id],
                                     force_draw, dc_only, &should_run_pipeline));
@@ -504,6 +518,7 @@ Status FrameDecoder::ProcessACGroup(size_t ac_group_id,
     if (modular_pass_ready) modular_ready = true;
   }
   decoded_passes_per_ac_group_[ac_group_id] += num_passes;
+  if (num_passes != 0) flushed_ac_groups_[ac_group_id] = 0;
 
   if ((frame_header_.flags & FrameHeader::kNoise) != 0) {
     PROFILER_ZONE("GenerateNoise");
@@ -553,6 +568,175 @@ void FrameDecoder::MarkSections(const SectionInfo* sections, size_t num,
   }
 }
 
+Rect FrameDecoder::OutputRect() const {
+  if (crop_region_.xsize() == 0 || crop_region_.ysize() == 0) {
+    return Rect(0, 0, dec_state_->width, dec_state_->height);
+  }
+  return UnorientedRect(crop_region_);
+}
+
+Rect FrameDecoder::UnorientedRect(const Rect& rect) const {
+  // Map the rect back through the flips and the transposition that the
+  // output stage applies to undo the orientation.
+  const Orientation orientation = dec_state_->undo_orientation;
+  const bool transpose = static_cast<int>(orientation) > 4;
+  const bool flip_x = orientation == Orientation::kFlipHorizontal ||
+                      orientation == Orientation::kRotate180 ||
+                      orientation == Orientation::kRotate270 ||
+                      orientation == Orientation::kAntiTranspose;
+  const bool flip_y = orientation == Orientation::kFlipVertical ||
+                      orientation == Orientation::kRotate180 ||
+                      orientation == Orientation::kRotate90 ||
+                      orientation == Orientation::kAntiTranspose;
+  size_t x0 = transpose ? rect.y0() : rect.x0();
+  size_t y0 = transpose ? rect.x0() : rect.y0();
+  size_t xsize = transpose ? rect.ysize() : rect.xsize();
+  size_t ysize = transpose ? rect.xsize() : rect.ysize();
+  if (flip_x) x0 = frame_header_.nonserialized_metadata->xsize() - x0 - xsize;
+  if (flip_y) y0 = frame_header_.nonserialized_metadata->ysize() - y0 - ysize;
+  return Rect(x0, y0, xsize, ysize);
+}
+
+std::vector<size_t> FrameDecoder::ACGroupOrder(
+    const std::vector<size_t>& group_cost) const {
+  // Side of a tile, in groups.
+  constexpr size_t kTileDim = 4;
+  const size_t xsize_tiles = DivCeil(frame_dim_.xsize_groups, kTileDim);
+  const size_t ysize_tiles = DivCeil(frame_dim_.ysize_groups, kTileDim);
+  std::vector<size_t> tile_cost(xsize_tiles * ysize_tiles);
+  for (size_t g = 0; g < frame_dim_.num_groups; g++) {
+    size_t gx = g % frame_dim_.xsize_groups;
+    size_t gy = g / frame_dim_.xsize_groups;
+    tile_cost[gy / kTileDim * xsize_tiles + gx / kTileDim] += group_cost[g];
+  }
+  std::vector<size_t> tiles(tile_cost.size());
+  std::iota(tiles.begin(), tiles.end(), 0);
+  std::stable_sort(tiles.begin(), tiles.end(), [&](size_t a, size_t b) {
+    return tile_cost[a] > tile_cost[b];
+  });
+  std::vector<size_t> order;
+  order.reserve(frame_dim_.num_groups);
+  for (size_t tile : tiles) {
+    size_t gx0 = tile % xsize_tiles * kTileDim;
+    size_t gy0 = tile / xsize_tiles * kTileDim;
+    size_t gx1 = std::min(gx0 + kTileDim, frame_dim_.xsize_groups);
+    size_t gy1 = std::min(gy0 + kTileDim, frame_dim_.ysize_groups);
+    for (size_t gy = gy0; gy < gy1; gy++) {
+      for (size_t gx = gx0; gx < gx1; gx++) {
+        order.push_back(gy * frame_dim_.xsize_groups + gx);
+      }
+    }
+  }
+  // Frames with their own origin are placed on the canvas later, so the
+  // region is only known in the coordinates of full frames.
+  if (priority_region_.xsize() == 0 || priority_region_.ysize() == 0 ||
+      frame_header_.custom_size_or_origin) {
+    return order;
+  }
+  const Rect region = UnorientedRect(priority_region_);
+  const size_t group_dim = frame_dim_.group_dim * frame_header_.upsampling;
+  const size_t gx0 = region.x0() / group_dim;
+  const size_t gy0 = region.y0() / group_dim;
+  const size_t gx1 = (region.x0() + region.xsize() - 1) / group_dim;
+  const size_t gy1 = (region.y0() + region.ysize() - 1) / group_dim;
+  std::stable_partition(order.begin(), order.end(), [&](size_t g) {
+    size_t gx = g % frame_dim_.xsize_groups;
+    size_t gy = g / frame_dim_.xsize_groups;
+    return gx >= gx0 && gx <= gx1 && gy >= gy0 && gy <= gy1;
+  });
+  return order;
+}
+
+bool FrameDecoder::CanRenderPartially() const {
+  if (!dec_state_->HasImageOutput()) {
+    return false;
+  }
+  // Referenced frames, frames blended onto a canvas of a different size and
+  // global modular transforms need every group.
+  return !(use_slow_rendering_pipeline_ || decoded_->IsJPEG() ||
+           frame_header_.CanBeReferenced() ||
+           frame_header_.frame_type == FrameType::kDCFrame ||
+           frame_header_.frame_type == FrameType::kReferenceOnly ||
+           frame_header_.custom_size_or_origin ||
+           modular_frame_decoder_.UsesFullImage());
+}
+
+bool FrameDecoder::IsACGroupOutsideCrop(size_t ac_group_id) const {
+  if (crop_region_.xsize() == 0 || crop_region_.ysize() == 0) return false;
+  if (!CanRenderPartially()) return false;
+  const Rect& out = dec_state_->output_rect;
+  // Keep one ring of groups around the crop region: the borders needed by the
+  // loop filters and upsampling are always smaller than a group.
+  const size_t group_dim = frame_dim_.group_dim * frame_header_.upsampling;
+  const size_t gx = ac_group_id % frame_dim_.xsize_groups;
+  const size_t gy = ac_group_id / frame_dim_.xsize_groups;
+  const size_t gx0 = out.x0() / group_dim;
+  const size_t gy0 = out.y0() / group_dim;
+  const size_t gx1 = (out.x0() + out.xsize() - 1) / group_dim;
+  const size_t gy1 = (out.y0() + out.ysize() - 1) / group_dim;
+  return gx + 1 < gx0 || gx > gx1 + 1 || gy + 1 < gy0 || gy > gy1 + 1;
+}
+
+size_t FrameDecoder::NumDecodedExtraChannels() const {
+  const std::vector<ExtraChannelInfo>& extra_channel_info =
+      frame_header_.nonserialized_metadata->m.extra_channel_info;
+  const size_t num_extra = extra_channel_info.size();
+  if (decoded_extra_channels_.empty()) return num_extra;
+  if (!dec_state_->HasImageOutput()) {
+    return num_extra;
+  }
+  // Extra channels of referenced frames, patches and blending can end up in
+  // any channel of the output.
+  if (frame_header_.CanBeReferenced() ||
+      (frame_header_.flags & FrameHeader::kPatches)) {
+    return num_extra;
+  }
+  if (coalescing_) {
+    if (frame_header_.blending_info.mode != BlendMode::kReplace) {
+      return num_extra;
+    }
+    for (const BlendingInfo& info : frame_header_.extra_channel_blending_info) {
+      if (info.mode != BlendMode::kReplace) return num_extra;
+    }
+  }
+  const size_t num_output_channels =
+      dec_state_->main_output.format.num_channels;
+  const bool output_alpha =
+      num_output_channels == 2 || num_output_channels == 4;
+  const ExtraChannelInfo* alpha =
+      frame_header_.nonserialized_metadata->m.Find(ExtraChannel::kAlpha);
+  size_t num = 0;
+  for (size_t i = 0; i < num_extra; i++) {
+    const ExtraChannelInfo& eci = extra_channel_info[i];
+    bool needed = i < decoded_extra_channels_.size() &&
+                  decoded_extra_channels_[i];
+    needed |= (&eci == alpha) && (output_alpha || dec_state_->unpremul_alpha);
+    needed |= render_spotcolors_ && eci.type == ExtraChannel::kSpotColor;
+    needed |= i < dec_state_->extra_output.size() &&
+              dec_state_->extra_output[i].buffer != nullptr;
+    if (needed) num = i + 1;
+  }
+  return num;
+}
+
+size_t FrameDecoder::NumPassesToDecode() const {
+  const Passes& passes = frame_header_.passes;
+  // The dropped detail must not be needed by later frames or by JPEG
+  // reconstruction.
+  if (output_downsampling_ <= 1 || decoded_->IsJPEG() ||
+      frame_header_.CanBeReferenced() || !SupportsProgression()) {
+    return passes.num_passes;
+  }
+  if (output_downsampling_ >= 8) return 0;
+  size_t num_passes = passes.num_passes;
+  for (size_t i = 0; i < passes.num_downsample; ++i) {
+    if (passes.downsample[i] <= output_downsampling_) {
+      num_passes = std::min<size_t>(num_passes, passes.last_pass[i] + 1);
+    }
+  }
+  return num_passes;
+}
+
 Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
                                      SectionStatus* section_status) {
   if (num == 0) return true;  // Nothing to process
@@ -651,8 +835,11 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
     pipeline_options.use_slow_render_pipeline = use_slow_rendering_pipeline_;
     pipeline_options.coalescing = coalescing_;
     pipeline_options.render_spotcolors = render_spotcolors_;
+    pipeline_options.num_decoded_extra_channels = num_decoded_extra_channels_;
+    pipeline_options.collect_stats = collect_render_stats_;
     JXL_RETURN_IF_ERROR(
         dec_state_->PreparePipeline(decoded_, pipeline_options));
+    prepared_pipeline_ = true;
     FinalizeDC();
     JXL_RETURN_IF_ERROR(AllocateOutput());
     if (progressive_detail_ >= JxlProgressiveDetail::kDC) {
@@ -677,22 +864,74 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
   }
 
   if (decoded_ac_global_) {
+    // Groups that do not affect the crop region are accepted without being
+    // decoded.
+    for (size_t g = 0; g < ac_group_sec.size(); g++) {
+      if (desired_num_ac_passes[g] == 0 || !IsACGroupOutsideCrop(g)) continue;
+      size_t first_pass = decoded_passes_per_ac_group_[g];
+      for (size_t i = 0; i < desired_num_ac_passes[g]; i++) {
+        section_status[ac_group_sec[g][first_pass + i]] = SectionStatus::kDone;
+      }
+      decoded_passes_per_ac_group_[g] += desired_num_ac_passes[g];
+      desired_num_ac_passes[g] = 0;
+    }
+
+    // Passes beyond the resolution of the output are accepted without being
+    // decoded, so groups are drawn as soon as their last needed pass is
+    // decoded. A group without any pass to decode is drawn from the DC.
+    const size_t max_passes = NumPassesToDecode();
+    std::vector<size_t> skipped_ac_passes(ac_group_sec.size());
+    std::vector<uint8_t> force_draw(ac_group_sec.size());
+    if (max_passes < frame_header_.passes.num_passes) {
+      for (size_t g = 0; g < ac_group_sec.size(); g++) {
+        size_t first_pass = decoded_passes_per_ac_group_[g];
+        if (first_pass >= max_passes) {
+          skipped_ac_passes[g] = desired_num_ac_passes[g];
+          desired_num_ac_passes[g] = 0;
+          force_draw[g] = first_pass == 0 && skipped_ac_passes[g] != 0;
+          continue;
+        }
+        size_t to_decode = max_passes - first_pass;
+        if (desired_num_ac_passes[g] >= to_decode) {
+          skipped_ac_passes[g] = desired_num_ac_passes[g] - to_decode;
+          desired_num_ac_passes[g] = to_decode;
+          force_draw[g] = true;
+        }
+      }
+    }
+
     // Mark all the AC groups that we received as not complete yet.
     for (size_t i = 0; i < ac_group_sec.size(); i++) {
-      if (desired_num_ac_passes[i] != 0) {
+      if (desired_num_ac_passes[i] != 0 || force_draw[i]) {
         dec_state_->render_pipeline->ClearDone(i);
       }
     }
 
+    // The size of the sections to decode is the cost estimate of a group;
+    // groups without any section only need drawing.
+    std::vector<size_t> group_cost(ac_group_sec.size());
+    for (size_t g = 0; g < ac_group_sec.size(); g++) {
+      if (desired_num_ac_passes[g] == 0 && !force_draw[g]) continue;
+      group_cost[g] = 1;
+      size_t first_pass = decoded_passes_per_ac_group_[g];
+      for (size_t i = 0; i < desired_num_ac_passes[g]; i++) {
+        group_cost[g] +=
+            sections[ac_group_sec[g][first_pass + i]].br->TotalBytes();
+      }
+    }
+    const std::vector<size_t> group_order = ACGroupOrder(group_cost);
+
     JXL_RETURN_IF_ERROR(RunOnPool(
         pool_, 0, ac_group_sec.size(),
         [this](size_t num_threads) {
           return PrepareStorage(num_threads,
                                 decoded_passes_per_ac_group_.size());
         },
-        [this, &ac_group_sec, &desired_num_ac_passes, &num, &sections,
-         &section_status, &has_error](size_t g, size_t thread) {
-          if (desired_num_ac_passes[g] == 0) {
+        [this, &group_order, &ac_group_sec, &desired_num_ac_passes,
+         &skipped_ac_passes, &force_draw, &num, &sections, &section_status,
+         &has_error](size_t task, size_t thread) {
+          size_t g = group_order[task];
+          if (desired_num_ac_passes[g] == 0 && skipped_ac_passes[g] == 0) {
             // no new AC pass, nothing to do
             return;
           }
@@ -703,16 +942,20 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
             JXL_ASSERT(ac_group_sec[g][first_pass + i] != num);
             readers[i] = sections[ac_group_sec[g][first_pass + i]].br;
           }
-          if (!ProcessACGroup(g, readers, desired_num_ac_passes[g],
-                              GetStorageLocation(thread, g),
-                              /*force_draw=*/false, /*dc_only=*/false)) {
+          bool dc_only = force_draw[g] && desired_num_ac_passes[g] == 0;
+          if ((desired_num_ac_passes[g] != 0 || force_draw[g]) &&
+              !ProcessACGroup(g, readers, desired_num_ac_passes[g],
+                              GetStorageLocation(thread, g), force_draw[g],
+                              dc_only)) {
             has_error = true;
-          } else {
-            for (size_t i = 0; i < desired_num_ac_passes[g]; i++) {
-              section_status[ac_group_sec[g][first_pass + i]] =
-                  SectionStatus::kDone;
-            }
+            return;
+          }
+          size_t num_passes = desired_num_ac_passes[g] + skipped_ac_passes[g];
+          for (size_t i = 0; i < num_passes; i++) {
+            section_status[ac_group_sec[g][first_pass + i]] =
+                SectionStatus::kDone;
           }
+          decoded_passes_per_ac_group_[g] += skipped_ac_passes[g];
         },
         "DecodeGroup"));
   }
@@ -722,6 +965,44 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
   return true;
 }
 
+bool FrameDecoder::FindSkippableSections(
+    const size_t* ids, size_t num, std::vector<uint8_t>* skippable) const {
+  skippable->assign(num, 0);
+  const bool single_section =
+      frame_dim_.num_groups == 1 && frame_header_.passes.num_passes == 1;
+  if (single_section || !decoded_dc_global_) return false;
+  // The passes of a group are decoded in order, so a pass can only be skipped
+  // after the previous ones.
+  std::vector<uint8_t> passes = decoded_passes_per_ac_group_;
+  const size_t ac_global_index = frame_dim_.num_dc_groups + 1;
+  for (size_t i = 0; i < num; i++) {
+    if (processed_section_[ids[i]]) {
+      (*skippable)[i] = 1;
+      continue;
+    }
+    if (ids[i] <= ac_global_index) continue;
+    size_t ac_idx = ids[i] - ac_global_index - 1;
+    size_t acg = ac_idx % frame_dim_.num_groups;
+    size_t acp = ac_idx / frame_dim_.num_groups;
+    if (acp != passes[acg] || !IsACGroupOutsideCrop(acg)) continue;
+    passes[acg]++;
+    (*skippable)[i] = 1;
+  }
+  return true;
+}
+
+void FrameDecoder::SkipSections(const size_t* ids, size_t num) {
+  const size_t ac_global_index = frame_dim_.num_dc_groups + 1;
+  for (size_t i = 0; i < num; i++) {
+    if (processed_section_[ids[i]]) continue;
+    JXL_DASSERT(ids[i] > ac_global_index);
+    size_t ac_idx = ids[i] - ac_global_index - 1;
+    processed_section_[ids[i]] = true;
+    decoded_passes_per_ac_group_[ac_idx % frame_dim_.num_groups]++;
+    num_sections_done_++;
+  }
+}
+
 Status FrameDecoder::Flush() {
   bool has_blending = frame_header_.blending_info.mode != BlendMode::kReplace ||
                       frame_header_.custom_size_or_origin;
@@ -749,12 +1030,19 @@ Status FrameDecoder::Flush() {
       decoded_passes_per_ac_group_.begin(), decoded_passes_per_ac_group_.end());
   if (completely_decoded_ac_pass < frame_header_.passes.num_passes) {
     // We don't have all AC yet: force a draw of all the missing areas.
-    // Mark all sections as not complete.
+    // Groups that did not change since the previous flush are already in the
+    // output; the render pipeline redraws the borders they share with the
+    // groups that are drawn again.
+    const bool skip_flushed = CanRenderPartially();
+    std::vector<size_t> needs_draw(decoded_passes_per_ac_group_.size());
     for (size_t i = 0; i < decoded_passes_per_ac_group_.size(); i++) {
-      if (decoded_passes_per_ac_group_[i] < frame_header_.passes.num_passes) {
+      if (decoded_passes_per_ac_group_[i] < frame_header_.passes.num_passes &&
+          !(skip_flushed && flushed_ac_groups_[i])) {
+        needs_draw[i] = 1;
         dec_state_->render_pipeline->ClearDone(i);
       }
     }
+    const std::vector<size_t> group_order = ACGroupOrder(needs_draw);
     std::atomic<bool> has_error{false};
     JXL_RETURN_IF_ERROR(RunOnPool(
         pool_, 0, decoded_passes_per_ac_group_.size(),
@@ -762,17 +1050,20 @@ Status FrameDecoder::Flush() {
           return PrepareStorage(num_threads,
                                 decoded_passes_per_ac_group_.size());
         },
-        [this, &has_error](const uint32_t g, size_t thread) {
-          if (decoded_passes_per_ac_group_[g] ==
-              frame_header_.passes.num_passes) {
+        [this, &group_order, &needs_draw, &has_error](const uint32_t task,
+                                                      size_t thread) {
+          const size_t g = group_order[task];
+          if (!needs_draw[g]) {
             // This group was drawn already, nothing to do.
             return;
           }
+          if (IsACGroupOutsideCrop(g)) return;
           BitReader* JXL_RESTRICT readers[kMaxNumPasses] = {};
           bool ok = ProcessACGroup(
               g, readers, /*num_passes=*/0, GetStorageLocation(thread, g),
               /*force_draw=*/true, /*dc_only=*/!decoded_ac_global_);
           if (!ok) has_error = true;
+          flushed_ac_groups_[g] = 1;
         },
         "ForceDrawGroup"));
     if (has_error) {
@@ -799,6 +1090,20 @@ int FrameDecoder::SavedAs(const FrameHeader& header) {
   return 0;
 }
 
+size_t FrameDecoder::NumCompleteRows() const {
+  if (!decoded_ac_global_) return 0;
+  const size_t num_passes = frame_header_.passes.num_passes;
+  for (size_t gy = 0; gy < frame_dim_.ysize_groups; gy++) {
+    for (size_t gx = 0; gx < frame_dim_.xsize_groups; gx++) {
+      size_t g = gy * frame_dim_.xsize_groups + gx;
+      if (decoded_passes_per_ac_group_[g] < num_passes) {
+        return gy * frame_dim_.group_dim;
+      }
+    }
+  }
+  return frame_dim_.ysize;
+}
+
 bool FrameDecoder::HasEverything() const {
   if (!decoded_dc_global_) return false;
   if (!decoded_ac_global_) return false;
@@ -811,28 +1116,31 @@ bool FrameDecoder::HasEverything() const {
   return true;
 }
 
-int FrameDecoder::References() const {
-  if (is_finalized_) {
-    return 0;
-  }
-  if (!HasEverything()) return 0;
-
+int FrameDecoder::BlendingReferences(const FrameHeader& header) {
   int result = 0;
-
-  // Blending
-  if (frame_header_.frame_type == FrameType::kRegularFrame ||
-      frame_header_.frame_type == FrameType::kSkipProgressive) {
-    bool cropped = frame_header_.custom_size_or_origin;
-    if (cropped || frame_header_.blending_info.mode != BlendMode::kReplace) {
-      result |= (1 << frame_header_.blending_info.source);
+  if (header.frame_type == FrameType::kRegularFrame ||
+      header.frame_type == FrameType::kSkipProgressive) {
+    bool cropped = header.custom_size_or_origin;
+    if (cropped || header.blending_info.mode != BlendMode::kReplace) {
+      result |= (1 << header.blending_info.source);
     }
-    const auto& extra = frame_header_.extra_channel_blending_info;
+    const auto& extra = header.extra_channel_blending_info;
     for (size_t i = 0; i < extra.size(); ++i) {
       if (cropped || extra[i].mode != BlendMode::kReplace) {
         result |= (1 << extra[i].source);
       }
     }
   }
+  return result;
+}
+
+int FrameDecoder::References() const {
+  if (is_finalized_) {
+    return 0;
+  }
+  if (!HasEverything()) return 0;
+
+  int result = BlendingReferences(frame_header_);
 
   // Patches
   if (frame_header_.flags & FrameHeader::kPatches) {
@@ -850,6 +1158,32 @@ int FrameDecoder::References() const {
   return result;
 }
 
+void FrameDecoder::AddDiagnostics(uint64_t* diagnostics) const {
+  const ImageFeatures& features = dec_state_->shared->image_features;
+  const ModularDecodeStats& modular = modular_frame_decoder_.DecodeStats();
+  diagnostics[JXL_DEC_DIAG_NUM_FRAMES] += 1;
+  diagnostics[JXL_DEC_DIAG_NUM_PASSES] += frame_header_.passes.num_passes;
+  diagnostics[JXL_DEC_DIAG_NUM_PATCHES] += features.patches.NumPatches();
+  diagnostics[JXL_DEC_DIAG_NUM_SPLINES] +=
+      features.splines.QuantizedSplines().size();
+  diagnostics[JXL_DEC_DIAG_NUM_MODULAR_STREAMS] += modular.num_streams;
+  diagnostics[JXL_DEC_DIAG_NUM_TREE_NODES] += modular.num_tree_nodes;
+  diagnostics[JXL_DEC_DIAG_NUM_HISTOGRAMS] +=
+      modular.num_histograms + num_ac_histograms_;
+  diagnostics[JXL_DEC_DIAG_NUM_ENTROPY_CODES] +=
+      modular.num_entropy_codes + num_ac_entropy_codes_;
+  diagnostics[JXL_DEC_DIAG_NUM_LZ77_CODES] +=
+      modular.num_lz77_codes + num_ac_lz77_codes_;
+  static_assert(JXL_DEC_DIAG_NUM_GENERIC_WP_CHANNELS -
+                            JXL_DEC_DIAG_NUM_SINGLE_LEAF_CHANNELS + 1 ==
+                        kNumModularDecodePaths,
+                "Channel diagnostics don't match ModularDecodePath");
+  for (size_t i = 0; i < kNumModularDecodePaths; ++i) {
+    diagnostics[JXL_DEC_DIAG_NUM_SINGLE_LEAF_CHANNELS + i] +=
+        modular.num_channels[i];
+  }
+}
+
 Status FrameDecoder::FinalizeFrame() {
   if (is_finalized_) {
     return JXL_FAILURE("FinalizeFrame called multiple times");
@@ -47,6 +47,39 @@ class FrameDecoder {
 
   void SetRenderSpotcolors(bool rsc) { render_spotcolors_ = rsc; }
   void SetCoalescing(bool c) { coalescing_ = c; }
+  void SetFastIDCT(bool fast) { fast_idct_ = fast; }
+  // Enables collecting per-stage counters in the render pipeline.
+  void SetCollectRenderStats(bool collect) { collect_render_stats_ = collect; }
+  // Returns the render pipeline counters of this frame, or nothing if they were
+  // not collected or the frame was not rendered.
+  std::vector<RenderPipeline::StageStats> GetRenderStats() const {
+    if (!prepared_pipeline_ || !dec_state_->render_pipeline) return {};
+    return dec_state_->render_pipeline->GetStats();
+  }
+  // Adds the counters of this frame to `diagnostics`, an array indexed by
+  // JxlDecoderDiagnostic.
+  void AddDiagnostics(uint64_t* diagnostics) const;
+  // Restricts the image output to `rect`, given in the coordinates of the
+  // output image (that is, after undoing the orientation if requested). An
+  // empty rect means the whole image is output.
+  void SetCropRegion(const Rect& rect) { crop_region_ = rect; }
+  // Sets a part of the output image, in the same coordinates as the crop
+  // region, whose groups are decoded and drawn before the others. It can be
+  // changed between calls to ProcessSections; an empty rect means no priority.
+  void SetPriorityRegion(const Rect& rect) { priority_region_ = rect; }
+  // Sets the factor (1, 2, 4 or 8) by which the output will be downsampled.
+  // If the frame allows it, the passes that only add detail beyond that
+  // resolution are then not decoded; for a factor of 8, the groups are drawn
+  // from the DC image only.
+  void SetOutputDownsampling(size_t downsampling) {
+    output_downsampling_ = downsampling;
+  }
+  // Sets which extra channels are needed in the image output, indexed by extra
+  // channel; an empty vector means all of them. Where the frame allows it, the
+  // others are not decoded and not rendered, and are left zero.
+  void SetDecodedExtraChannels(const std::vector<bool>& decoded) {
+    decoded_extra_channels_ = decoded;
+  }
 
   // Read FrameHeader and table of contents from the given BitReader.
   Status InitFrame(BitReader* JXL_RESTRICT br, ImageBundle* decoded,
@@ -85,6 +118,17 @@ class FrameDecoder {
   Status ProcessSections(const SectionInfo* sections, size_t num,
                          SectionStatus* section_status);
 
+  // Sets `skippable[i]` to whether the image output does not depend on the
+  // section `ids[i]`, where `ids` are the sections that follow the decoded
+  // ones, in file order: sections already processed and the passes of AC
+  // groups outside the crop region. Returns false, with all of them needed,
+  // if this is not known until the DC global section is decoded.
+  bool FindSkippableSections(const size_t* ids, size_t num,
+                             std::vector<uint8_t>* skippable) const;
+  // Marks the `num` sections `ids`, which FindSkippableSections found
+  // skippable in this order, as decoded without reading them.
+  void SkipSections(const size_t* ids, size_t num);
+
   // Flushes all the data decoded so far to pixels.
   Status Flush();
 
@@ -106,6 +150,12 @@ class FrameDecoder {
   // soon as the frame header is known.
   static int SavedAs(const FrameHeader& header);
 
+  // Returns the reference frames a frame is blended onto, as a bit mask in
+  // the same format as References. Unlike References, it is known as soon as
+  // the frame header is, but it does not include the references of patches or
+  // of the DC frame.
+  static int BlendingReferences(const FrameHeader& header);
+
   uint64_t SumSectionSizes() const { return section_sizes_sum_; }
   const std::vector<TocEntry>& Toc() const { return toc_; }
 
@@ -121,6 +171,10 @@ class FrameDecoder {
                              decoded_passes_per_ac_group_.end());
   }
 
+  // Returns the number of rows of the frame, from the top, whose AC groups
+  // have all their passes decoded.
+  size_t NumCompleteRows() const;
+
   // If enabled, ProcessSections will stop and return true when the DC
   // sections have been processed, instead of starting the AC sections. This
   // will only occur if supported (that is, flushing will produce a valid
@@ -129,25 +183,7 @@ class FrameDecoder {
   // to check the true finished state.
   // Returns the progressive detail that will be effective for the frame.
   JxlProgressiveDetail SetPauseAtProgressive(JxlProgressiveDetail prog_detail) {
-    bool single_section =
-        frame_dim_.num_groups == 1 && frame_header_.passes.num_passes == 1;
-    if (frame_header_.frame_type != kSkipProgressive &&
-        // If there's only one group and one pass, there is no separate section
-        // for DC and the entire full resolution image is available at once.
-        !single_section &&
-        // If extra channels are encoded with modular without squeeze, they
-        // don't support DC. If the are encoded with squeeze, DC works in theory
-        // but the implementation may not yet correctly support this for Flush.
-        // Therefore, can't correctly pause for a progressive step if there is
-        // an extra channel (including alpha channel)
-        // TODO(firsching): Check if this is still the case.
-        decoded_->metadata()->extra_channel_info.empty() &&
-        // DC is not guaranteed to be available in modular mode and may be a
-        // black image. If squeeze is used, it may be available depending on the
-        // current implementation.
-        // TODO(lode): do return DC if it's known that flushing at this point
-        // will produce a valid 1/8th downscaled image with modular encoding.
-        frame_header_.encoding == FrameEncoding::kVarDCT) {
+    if (SupportsProgression()) {
       progressive_detail_ = prog_detail;
     } else {
       progressive_detail_ = JxlProgressiveDetail::kFrames;
@@ -201,13 +237,14 @@ class FrameDecoder {
         std::swap(dec_state_->width, dec_state_->height);
       }
     }
+    dec_state_->output_rect = OutputRect();
     dec_state_->extra_output.clear();
 #if !JXL_HIGH_PRECISION
     if (dec_state_->main_output.buffer &&
         (format.data_type == JXL_TYPE_UINT8) && (format.num_channels >= 3) &&
         !dec_state_->unpremul_alpha &&
         (dec_state_->undo_orientation == Orientation::kIdentity) &&
-        decoded_->metadata()->xyb_encoded &&
+        crop_region_.xsize() == 0 && decoded_->metadata()->xyb_encoded &&
         dec_state_->output_encoding_info.color_encoding.IsSRGB() &&
         dec_state_->output_encoding_info.all_default_opsin &&
         (dec_state_->output_encoding_info.desired_intensity_target ==
@@ -229,6 +266,28 @@ class FrameDecoder {
     dec_state_->extra_output.push_back(out);
   }
 
+  // Writes the pixels to `planes` instead of the image buffer or callback. Must
+  // be called after SetImageOutput, which gives the pixel format.
+  void SetImageOutputPlanes(JxlPlaneLayout layout,
+                            const std::vector<JxlImageOutPlane>& planes) const {
+    const ImageOutput& main_output = dec_state_->main_output;
+    const bool nv12 = layout == JXL_PLANES_YCBCR_BT601_NV12 ||
+                      layout == JXL_PLANES_YCBCR_BT709_NV12;
+    dec_state_->main_plane_layout = layout;
+    dec_state_->main_planes.clear();
+    for (size_t i = 0; i < planes.size(); ++i) {
+      ImageOutput out;
+      out.format = main_output.format;
+      out.format.num_channels = (nv12 && i == 1) ? 2 : 1;
+      out.bits_per_sample =
+          layout == JXL_PLANES_CHANNELS ? main_output.bits_per_sample : 8;
+      out.buffer = planes[i].buffer;
+      out.buffer_size = planes[i].size;
+      out.stride = planes[i].stride;
+      dec_state_->main_planes.push_back(out);
+    }
+  }
+
  private:
   Status ProcessDCGlobal(BitReader* br);
   Status ProcessDCGroup(size_t dc_group_id, BitReader* br);
@@ -240,6 +299,59 @@ class FrameDecoder {
                         bool dc_only);
   void MarkSections(const SectionInfo* sections, size_t num,
                     SectionStatus* section_status);
+  // Returns the part of the image, before undoing the orientation, that is
+  // written to the image output.
+  Rect OutputRect() const;
+  // Maps `rect`, in the coordinates of the output image, to the image before
+  // undoing the orientation.
+  Rect UnorientedRect(const Rect& rect) const;
+  // Returns true if the pixels of this frame end up nowhere but in the image
+  // output, so that groups can be left out of rendering.
+  bool CanRenderPartially() const;
+  // Returns true if AC group `ac_group_id` does not contribute to any pixel of
+  // the crop region, so its sections do not need to be decoded.
+  bool IsACGroupOutsideCrop(size_t ac_group_id) const;
+  // Returns the order in which the AC groups, whose decoding cost is
+  // estimated by `group_cost`, are handed to the thread pool. Groups are
+  // arranged in square tiles, so that the contiguous ranges of tasks that a
+  // worker thread reserves are spatially compact and the borders the render
+  // pipeline shares between neighbouring groups stay in that thread's cache.
+  // Tiles are sorted by decreasing total cost, so that the cheapest tiles
+  // fill the small chunks at the tail of the schedule. The groups of the
+  // priority region come first, in the same order.
+  std::vector<size_t> ACGroupOrder(const std::vector<size_t>& group_cost) const;
+  // Returns the number of leading extra channels that have to be decoded for
+  // the image output, which includes the ones that alpha, spot color
+  // rendering, blending and later frames depend on.
+  size_t NumDecodedExtraChannels() const;
+  // Returns true if flushing after the DC or after a pass produces a valid
+  // downsampled image.
+  bool SupportsProgression() const {
+    bool single_section =
+        frame_dim_.num_groups == 1 && frame_header_.passes.num_passes == 1;
+    return frame_header_.frame_type != kSkipProgressive &&
+           // If there's only one group and one pass, there is no separate
+           // section for DC and the entire full resolution image is available
+           // at once.
+           !single_section &&
+           // If extra channels are encoded with modular without squeeze, they
+           // don't support DC. If the are encoded with squeeze, DC works in
+           // theory but the implementation may not yet correctly support this
+           // for Flush. Therefore, can't correctly pause for a progressive
+           // step if there is an extra channel (including alpha channel)
+           // TODO(firsching): Check if this is still the case.
+           decoded_->metadata()->extra_channel_info.empty() &&
+           // DC is not guaranteed to be available in modular mode and may be a
+           // black image. If squeeze is used, it may be available depending on
+           // the current implementation.
+           // TODO(lode): do return DC if it's known that flushing at this
+           // point will produce a valid 1/8th downscaled image with modular
+           // encoding.
+           frame_header_.encoding == FrameEncoding::kVarDCT;
+  }
+  // Returns the number of passes per group that contribute to the output at
+  // the output downsampling.
+  size_t NumPassesToDecode() const;
 
   // Allocates storage for parallel decoding using up to `num_threads` threads
   // of up to `num_tasks` tasks. The value of `thread` passed to
@@ -248,8 +360,8 @@ class FrameDecoder {
   // than the value of `num_tasks` passed here.
   Status PrepareStorage(size_t num_threads, size_t num_tasks) {
     size_t storage_size = std::min(num_threads, num_tasks);
-    if (storage_size > group_dec_caches_.size()) {
-      group_dec_caches_.resize(storage_size);
+    if (storage_size > dec_state_->group_dec_caches.size()) {
+      dec_state_->group_dec_caches.resize(storage_size);
     }
     use_task_id_ = num_threads > num_tasks;
     bool use_group_ids = (modular_frame_decoder_.UsesFullImage() &&
@@ -293,9 +405,25 @@ class FrameDecoder {
   ModularFrameDecoder modular_frame_decoder_;
   bool render_spotcolors_ = true;
   bool coalescing_ = true;
+  bool fast_idct_ = false;
+  bool collect_render_stats_ = false;
+  // Entropy codes of the AC coefficients, for AddDiagnostics.
+  size_t num_ac_entropy_codes_ = 0;
+  size_t num_ac_histograms_ = 0;
+  size_t num_ac_lz77_codes_ = 0;
+  // Whether dec_state_->render_pipeline was created for this frame.
+  bool prepared_pipeline_ = false;
+  Rect crop_region_;
+  Rect priority_region_;
+  size_t output_downsampling_ = 1;
+  std::vector<bool> decoded_extra_channels_;
+  size_t num_decoded_extra_channels_ = SIZE_MAX;
 
   std::vector<uint8_t> processed_section_;
   std::vector<uint8_t> decoded_passes_per_ac_group_;
+  // Whether the output already holds the current state of each AC group,
+  // drawn by a previous Flush(). Later flushes skip those groups.
+  std::vector<uint8_t> flushed_ac_groups_;
   std::vector<uint8_t> decoded_dc_groups_;
   bool decoded_dc_global_;
   bool decoded_ac_global_;
@@ -305,8 +433,6 @@ class FrameDecoder {
   bool is_finalized_ = true;
   bool allocated_ = false;
 
-  std::vector<GroupDecCache> group_dec_caches_;
-
   // Whether or not the task id should be used for storage indexing, instead of
   // the thread id.
   bool use_task_id_ = false;
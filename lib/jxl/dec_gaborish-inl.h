@@ -0,0 +1,98 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Gaborish smoothing of rows, shared by the render pipeline stages.
+
+#if defined(LIB_JXL_DEC_GABORISH_INL_H_) == defined(HWY_TARGET_TOGGLE)
+#ifdef LIB_JXL_DEC_GABORISH_INL_H_
+#undef LIB_JXL_DEC_GABORISH_INL_H_
+#else
+#define LIB_JXL_DEC_GABORISH_INL_H_
+#endif
+
+#include <stddef.h>
+
+#include <hwy/highway.h>
+
+#include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/loop_filter.h"
+HWY_BEFORE_NAMESPACE();
+namespace jxl {
+namespace HWY_NAMESPACE {
+namespace {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
+
+// Sets the center, side and corner weights of the 3x3 kernel of each channel,
+// normalized so that the kernel sums to 1.
+HWY_MAYBE_UNUSED void GaborishWeights(const LoopFilter& lf, float weights[9]) {
+  weights[0] = 1;
+  weights[1] = lf.gab_x_weight1;
+  weights[2] = lf.gab_x_weight2;
+  weights[3] = 1;
+  weights[4] = lf.gab_y_weight1;
+  weights[5] = lf.gab_y_weight2;
+  weights[6] = 1;
+  weights[7] = lf.gab_b_weight1;
+  weights[8] = lf.gab_b_weight2;
+  // Normalize
+  for (size_t c = 0; c < 3; c++) {
+    const float div =
+        weights[3 * c] + 4 * (weights[3 * c + 1] + weights[3 * c + 2]);
+    const float mul = 1.0f / div;
+    weights[3 * c] *= mul;
+    weights[3 * c + 1] *= mul;
+    weights[3 * c + 2] *= mul;
+  }
+}
+
+// Smooths the pixels [x0, x1) of the middle row `row_m` of one channel with
+// the 3 `weights` of that channel. `x0` must be a multiple of the vector size,
+// and all the rows must be aligned.
+HWY_MAYBE_UNUSED void GaborishRow(const float* weights,
+                                  const float* JXL_RESTRICT row_t,
+                                  const float* JXL_RESTRICT row_m,
+                                  const float* JXL_RESTRICT row_b, ssize_t x0,
+                                  ssize_t x1, float* JXL_RESTRICT row_out) {
+  const HWY_FULL(float) d;
+  const auto w0 = Set(d, weights[0]);
+  const auto w1 = Set(d, weights[1]);
+  const auto w2 = Set(d, weights[2]);
+// Group data need only be aligned to a block; for >=512 bit vectors, this may
+// result in unaligned loads.
+#if HWY_CAP_GE512
+#define LoadMaybeU LoadU
+#else
+#define LoadMaybeU Load
+#endif
+  for (ssize_t x = x0; x < x1; x += Lanes(d)) {
+    const auto t = LoadMaybeU(d, row_t + x);
+    const auto tl = LoadU(d, row_t + x - 1);
+    const auto tr = LoadU(d, row_t + x + 1);
+    const auto m = LoadMaybeU(d, row_m + x);
+    const auto l = LoadU(d, row_m + x - 1);
+    const auto r = LoadU(d, row_m + x + 1);
+    const auto b = LoadMaybeU(d, row_b + x);
+    const auto bl = LoadU(d, row_b + x - 1);
+    const auto br = LoadU(d, row_b + x + 1);
+    const auto sum0 = m;
+    const auto sum1 = Add(Add(l, r), Add(t, b));
+    const auto sum2 = Add(Add(tl, tr), Add(bl, br));
+    auto pixels = MulAdd(sum2, w2, MulAdd(sum1, w1, Mul(sum0, w0)));
+    Store(pixels, d, row_out + x);
+  }
+#undef LoadMaybeU
+}
+
+}  // namespace
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#endif  // LIB_JXL_DEC_GABORISH_INL_H_
@@ -24,6 +24,7 @@
 #include "lib/jxl/base/bits.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/profiler.h"
+#include "lib/jxl/base/random.h"  // For the test helpers of fast_dct-inl.h.
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/coeff_order.h"
 #include "lib/jxl/common.h"
@@ -34,6 +35,7 @@
 #include "lib/jxl/dec_xyb.h"
 #include "lib/jxl/entropy_coder.h"
 #include "lib/jxl/epf.h"
+#include "lib/jxl/fast_dct-inl.h"
 #include "lib/jxl/opsin_params.h"
 #include "lib/jxl/quant_weights.h"
 #include "lib/jxl/quantizer-inl.h"
@@ -71,6 +73,10 @@ namespace jxl {
 namespace HWY_NAMESPACE {
 
 // These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::ConvertTo;
+using hwy::HWY_NAMESPACE::DemoteTo;
+using hwy::HWY_NAMESPACE::NearestInt;
+using hwy::HWY_NAMESPACE::PromoteTo;
 using hwy::HWY_NAMESPACE::Rebind;
 using hwy::HWY_NAMESPACE::ShiftRight;
 
@@ -82,6 +88,56 @@ constexpr D d;
 constexpr DI di;
 constexpr DI16 di16;
 
+#if HWY_TARGET == HWY_NEON
+// Inverse DCT of an NxN block with the int16 fixed-point transforms, whose
+// inputs and outputs are scaled like in TestFastIDCT.
+template <size_t N>
+void FastIDCTToPixels(const float* JXL_RESTRICT coefficients,
+                      float* JXL_RESTRICT pixels, size_t pixels_stride,
+                      int16_t* JXL_RESTRICT scratch_space) {
+  constexpr float kScale = 1 << (14 - FastIDCTIntegerBits(FastDCTTag<N>()));
+  int16_t* JXL_RESTRICT from = scratch_space;
+  int16_t* JXL_RESTRICT to = scratch_space + N * N;
+  const auto scale = Set(d, kScale);
+  for (size_t i = 0; i < N * N; i += Lanes(d)) {
+    const auto v = NearestInt(Mul(Load(d, coefficients + i), scale));
+    StoreU(DemoteTo(di16, v), di16, from + i);
+  }
+  ComputeFastScaledIDCT<N, N>()(from, to, N, scratch_space + 2 * N * N);
+  const auto inv_scale = Set(d, 1.0f / kScale);
+  for (size_t y = 0; y < N; y++) {
+    for (size_t x = 0; x < N; x += Lanes(d)) {
+      const auto v = ConvertTo(d, PromoteTo(di, LoadU(di16, to + y * N + x)));
+      StoreU(Mul(v, inv_scale), d, pixels + y * pixels_stride + x);
+    }
+  }
+}
+#endif
+
+// Like TransformToPixels, but with the int16 fixed-point transforms. Returns
+// false if there is none for `strategy` on this target.
+bool FastTransformToPixels(const AcStrategy::Type strategy,
+                           const float* JXL_RESTRICT coefficients,
+                           float* JXL_RESTRICT pixels, size_t pixels_stride,
+                           int16_t* JXL_RESTRICT scratch_space) {
+#if HWY_TARGET == HWY_NEON
+  if (strategy == AcStrategy::Type::DCT) {
+    FastIDCTToPixels<8>(coefficients, pixels, pixels_stride, scratch_space);
+    return true;
+  }
+  if (strategy == AcStrategy::Type::DCT16X16) {
+    FastIDCTToPixels<16>(coefficients, pixels, pixels_stride, scratch_space);
+    return true;
+  }
+#endif
+  (void)strategy;
+  (void)coefficients;
+  (void)pixels;
+  (void)pixels_stride;
+  (void)scratch_space;
+  return false;
+}
+
 // TODO(veluca): consider SIMDfying.
 void Transpose8x8InPlace(int32_t* JXL_RESTRICT block) {
   for (size_t x = 0; x < 8; x++) {
@@ -91,6 +147,15 @@ void Transpose8x8InPlace(int32_t* JXL_RESTRICT block) {
   }
 }
 
+void TransposeAndPromote8x8(const int16_t* JXL_RESTRICT from,
+                            int32_t* JXL_RESTRICT to) {
+  for (size_t y = 0; y < 8; y++) {
+    for (size_t x = 0; x < 8; x++) {
+      to[x * 8 + y] = from[y * 8 + x];
+    }
+  }
+}
+
 template <ACType ac_type>
 void DequantLane(Vec<D> scaled_dequant_x, Vec<D> scaled_dequant_y,
                  Vec<D> scaled_dequant_b,
@@ -249,6 +314,14 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
     }
   }
 
+  // Varblocks of the current row of blocks whose coefficients are decoded but
+  // not yet transformed.
+  struct PendingBlock {
+    size_t bx;
+    ACPtr qblock[3];
+  };
+  PendingBlock pending[kGroupDimInBlocks];
+
   for (size_t by = 0; by < ysize_blocks; ++by) {
     get_block->StartRow(by);
     size_t sby[3] = {by >> vshift[0], by >> vshift[1], by >> vshift[2]};
@@ -285,141 +358,166 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
       }
     }
 
-    size_t bx = 0;
-    for (size_t tx = 0; tx < DivCeil(xsize_blocks, kColorTileDimInBlocks);
-         tx++) {
-      size_t abs_tx = tx + block_rect.x0() / kColorTileDimInBlocks;
-      auto x_cc_mul =
-          Set(d, dec_state->shared->cmap.YtoXRatio(row_cmap[0][abs_tx]));
-      auto b_cc_mul =
-          Set(d, dec_state->shared->cmap.YtoBRatio(row_cmap[2][abs_tx]));
-      // Increment bx by llf_x because those iterations would otherwise
-      // immediately continue (!IsFirstBlock). Reduces mispredictions.
-      for (; bx < xsize_blocks && bx < (tx + 1) * kColorTileDimInBlocks;) {
-        size_t sbx[3] = {bx >> hshift[0], bx >> hshift[1], bx >> hshift[2]};
-        AcStrategy acs = acs_row[bx];
-        const size_t llf_x = acs.covered_blocks_x();
-
-        // Can only happen in the second or lower rows of a varblock.
-        if (JXL_UNLIKELY(!acs.IsFirstBlock())) {
-          bx += llf_x;
-          continue;
-        }
-        PROFILER_ZONE("DecodeGroupImpl inner");
-        const size_t log2_covered_blocks = acs.log2_covered_blocks();
+    // The varblocks starting in this row of blocks are entropy decoded
+    // first, then dequantized and transformed grouped by strategy, so that
+    // the branchy ANS decoding and the SIMD transforms do not interleave.
+    size_t num_pending = 0;
+    size_t row_qblock_offset = 0;
+    // Increment bx by llf_x because those iterations would otherwise
+    // immediately continue (!IsFirstBlock). Reduces mispredictions.
+    for (size_t bx = 0; bx < xsize_blocks;) {
+      AcStrategy acs = acs_row[bx];
+      const size_t llf_x = acs.covered_blocks_x();
+
+      // Can only happen in the second or lower rows of a varblock.
+      if (JXL_UNLIKELY(!acs.IsFirstBlock())) {
+        bx += llf_x;
+        continue;
+      }
+      PROFILER_ZONE("DecodeGroupImpl inner");
+      const size_t log2_covered_blocks = acs.log2_covered_blocks();
 
-        const size_t covered_blocks = 1 << log2_covered_blocks;
-        const size_t size = covered_blocks * kDCTBlockSize;
+      const size_t covered_blocks = 1 << log2_covered_blocks;
+      const size_t size = covered_blocks * kDCTBlockSize;
 
-        ACPtr qblock[3];
-        if (accumulate) {
+      ACPtr* qblock = pending[num_pending].qblock;
+      if (accumulate) {
+        for (size_t c = 0; c < 3; c++) {
+          qblock[c] = dec_state->coefficients->PlaneRow(c, group_idx, offset);
+        }
+      } else {
+        // No point in reading from bitstream without accumulating and not
+        // drawing.
+        JXL_ASSERT(draw == kDraw);
+        if (ac_type == ACType::k16) {
+          int16_t* row_qblock =
+              group_dec_cache->dec_group_qblock16 + row_qblock_offset;
+          memset(row_qblock, 0, size * 3 * sizeof(int16_t));
           for (size_t c = 0; c < 3; c++) {
-            qblock[c] = dec_state->coefficients->PlaneRow(c, group_idx, offset);
+            qblock[c].ptr16 = row_qblock + c * size;
           }
         } else {
-          // No point in reading from bitstream without accumulating and not
-          // drawing.
-          JXL_ASSERT(draw == kDraw);
-          if (ac_type == ACType::k16) {
-            memset(group_dec_cache->dec_group_qblock16, 0,
-                   size * 3 * sizeof(int16_t));
-            for (size_t c = 0; c < 3; c++) {
-              qblock[c].ptr16 = group_dec_cache->dec_group_qblock16 + c * size;
-            }
-          } else {
-            memset(group_dec_cache->dec_group_qblock, 0,
-                   size * 3 * sizeof(int32_t));
-            for (size_t c = 0; c < 3; c++) {
-              qblock[c].ptr32 = group_dec_cache->dec_group_qblock + c * size;
-            }
+          int32_t* row_qblock =
+              group_dec_cache->dec_group_qblock + row_qblock_offset;
+          memset(row_qblock, 0, size * 3 * sizeof(int32_t));
+          for (size_t c = 0; c < 3; c++) {
+            qblock[c].ptr32 = row_qblock + c * size;
           }
         }
-        JXL_RETURN_IF_ERROR(get_block->LoadBlock(
-            bx, by, acs, size, log2_covered_blocks, qblock, ac_type));
-        offset += size;
-        if (draw == kDontDraw) {
-          bx += llf_x;
-          continue;
+        row_qblock_offset += size * 3;
+      }
+      JXL_RETURN_IF_ERROR(get_block->LoadBlock(
+          bx, by, acs, size, log2_covered_blocks, qblock, ac_type));
+      offset += size;
+      if (draw == kDraw) pending[num_pending++].bx = bx;
+      bx += llf_x;
+    }
+    if (draw == kDontDraw) continue;
+
+    std::stable_sort(pending, pending + num_pending,
+                     [&acs_row](const PendingBlock& a, const PendingBlock& b) {
+                       return acs_row[a.bx].RawStrategy() <
+                              acs_row[b.bx].RawStrategy();
+                     });
+    for (size_t p = 0; p < num_pending; p++) {
+      const size_t bx = pending[p].bx;
+      ACPtr* qblock = pending[p].qblock;
+      size_t sbx[3] = {bx >> hshift[0], bx >> hshift[1], bx >> hshift[2]};
+      AcStrategy acs = acs_row[bx];
+      const size_t size = acs.covered_blocks_x() * acs.covered_blocks_y() *
+                          kDCTBlockSize;
+      size_t abs_tx = (block_rect.x0() + bx) / kColorTileDimInBlocks;
+      if (JXL_UNLIKELY(decoded->IsJPEG())) {
+        if (acs.Strategy() != AcStrategy::Type::DCT) {
+          return JXL_FAILURE("Can only decode to JPEG if only DCT-8 is used.");
         }
 
-        if (JXL_UNLIKELY(decoded->IsJPEG())) {
-          if (acs.Strategy() != AcStrategy::Type::DCT) {
-            return JXL_FAILURE(
-                "Can only decode to JPEG if only DCT-8 is used.");
+        HWY_ALIGN int32_t transposed_dct_y[64];
+        HWY_ALIGN int32_t transposed_dct_16[64];
+        for (size_t c : {1, 0, 2}) {
+          // Propagate only Y for grayscale.
+          if (jpeg_is_gray && c != 1) {
+            continue;
           }
-
-          HWY_ALIGN int32_t transposed_dct_y[64];
-          for (size_t c : {1, 0, 2}) {
-            // Propagate only Y for grayscale.
-            if (jpeg_is_gray && c != 1) {
-              continue;
+          if ((sbx[c] << hshift[c] != bx) || (sby[c] << vshift[c] != by)) {
+            continue;
+          }
+          int16_t* JXL_RESTRICT jpeg_pos =
+              jpeg_row[c] + sbx[c] * kDCTBlockSize;
+          // JPEG XL is transposed, JPEG is not.
+          int32_t* JXL_RESTRICT transposed_dct;
+          if (ac_type == ACType::k16) {
+            TransposeAndPromote8x8(qblock[c].ptr16, transposed_dct_16);
+            transposed_dct = transposed_dct_16;
+          } else {
+            transposed_dct = qblock[c].ptr32;
+            Transpose8x8InPlace(transposed_dct);
+          }
+          // No CfL - no need to store the y block converted to integers.
+          if (!cs.Is444() ||
+              (row_cmap[0][abs_tx] == 0 && row_cmap[2][abs_tx] == 0)) {
+            for (size_t i = 0; i < 64; i += Lanes(d)) {
+              const auto ini = Load(di, transposed_dct + i);
+              const auto ini16 = DemoteTo(di16, ini);
+              StoreU(ini16, di16, jpeg_pos + i);
             }
-            if ((sbx[c] << hshift[c] != bx) || (sby[c] << vshift[c] != by)) {
-              continue;
+          } else if (c == 1) {
+            // Y channel: save for restoring X/B, but nothing else to do.
+            for (size_t i = 0; i < 64; i += Lanes(d)) {
+              const auto ini = Load(di, transposed_dct + i);
+              Store(ini, di, transposed_dct_y + i);
+              const auto ini16 = DemoteTo(di16, ini);
+              StoreU(ini16, di16, jpeg_pos + i);
             }
-            int16_t* JXL_RESTRICT jpeg_pos =
-                jpeg_row[c] + sbx[c] * kDCTBlockSize;
-            // JPEG XL is transposed, JPEG is not.
-            auto transposed_dct = qblock[c].ptr32;
-            Transpose8x8InPlace(transposed_dct);
-            // No CfL - no need to store the y block converted to integers.
-            if (!cs.Is444() ||
-                (row_cmap[0][abs_tx] == 0 && row_cmap[2][abs_tx] == 0)) {
-              for (size_t i = 0; i < 64; i += Lanes(d)) {
-                const auto ini = Load(di, transposed_dct + i);
-                const auto ini16 = DemoteTo(di16, ini);
-                StoreU(ini16, di16, jpeg_pos + i);
-              }
-            } else if (c == 1) {
-              // Y channel: save for restoring X/B, but nothing else to do.
-              for (size_t i = 0; i < 64; i += Lanes(d)) {
-                const auto ini = Load(di, transposed_dct + i);
-                Store(ini, di, transposed_dct_y + i);
-                const auto ini16 = DemoteTo(di16, ini);
-                StoreU(ini16, di16, jpeg_pos + i);
-              }
-            } else {
-              // transposed_dct_y contains the y channel block, transposed.
-              const auto scale = Set(
-                  di, dec_state->shared->cmap.RatioJPEG(row_cmap[c][abs_tx]));
-              const auto round = Set(di, 1 << (kCFLFixedPointPrecision - 1));
-              for (int i = 0; i < 64; i += Lanes(d)) {
-                auto in = Load(di, transposed_dct + i);
-                auto in_y = Load(di, transposed_dct_y + i);
-                auto qt = Load(di, scaled_qtable + c * size + i);
-                auto coeff_scale = ShiftRight<kCFLFixedPointPrecision>(
-                    Add(Mul(qt, scale), round));
-                auto cfl_factor = ShiftRight<kCFLFixedPointPrecision>(
-                    Add(Mul(in_y, coeff_scale), round));
-                StoreU(DemoteTo(di16, Add(in, cfl_factor)), di16, jpeg_pos + i);
-              }
+          } else {
+            // transposed_dct_y contains the y channel block, transposed.
+            const auto scale = Set(
+                di, dec_state->shared->cmap.RatioJPEG(row_cmap[c][abs_tx]));
+            const auto round = Set(di, 1 << (kCFLFixedPointPrecision - 1));
+            for (int i = 0; i < 64; i += Lanes(d)) {
+              auto in = Load(di, transposed_dct + i);
+              auto in_y = Load(di, transposed_dct_y + i);
+              auto qt = Load(di, scaled_qtable + c * size + i);
+              auto coeff_scale = ShiftRight<kCFLFixedPointPrecision>(
+                  Add(Mul(qt, scale), round));
+              auto cfl_factor = ShiftRight<kCFLFixedPointPrecision>(
+                  Add(Mul(in_y, coeff_scale), round));
+              StoreU(DemoteTo(di16, Add(in, cfl_factor)), di16, jpeg_pos + i);
             }
-            jpeg_pos[0] =
-                Clamp1<float>(dc_rows[c][sbx[c]] - dcoff[c], -2047, 2047);
           }
-        } else {
-          HWY_ALIGN float* const block = group_dec_cache->dec_group_block;
-          // Dequantize and add predictions.
-          dequant_block(
-              acs, inv_global_scale, row_quant[bx], dec_state->x_dm_multiplier,
-              dec_state->b_dm_multiplier, x_cc_mul, b_cc_mul, acs.RawStrategy(),
-              size, dec_state->shared->quantizer,
-              acs.covered_blocks_y() * acs.covered_blocks_x(), sbx, dc_rows,
-              dc_stride,
-              dec_state->output_encoding_info.opsin_params.quant_biases, qblock,
-              block);
-
-          for (size_t c : {1, 0, 2}) {
-            if ((sbx[c] << hshift[c] != bx) || (sby[c] << vshift[c] != by)) {
-              continue;
-            }
-            // IDCT
-            float* JXL_RESTRICT idct_pos = idct_row[c] + sbx[c] * kBlockDim;
+          jpeg_pos[0] =
+              Clamp1<float>(dc_rows[c][sbx[c]] - dcoff[c], -2047, 2047);
+        }
+      } else {
+        HWY_ALIGN float* const block = group_dec_cache->dec_group_block;
+        auto x_cc_mul =
+            Set(d, dec_state->shared->cmap.YtoXRatio(row_cmap[0][abs_tx]));
+        auto b_cc_mul =
+            Set(d, dec_state->shared->cmap.YtoBRatio(row_cmap[2][abs_tx]));
+        // Dequantize and add predictions.
+        dequant_block(
+            acs, inv_global_scale, row_quant[bx], dec_state->x_dm_multiplier,
+            dec_state->b_dm_multiplier, x_cc_mul, b_cc_mul, acs.RawStrategy(),
+            size, dec_state->shared->quantizer,
+            acs.covered_blocks_y() * acs.covered_blocks_x(), sbx, dc_rows,
+            dc_stride,
+            dec_state->output_encoding_info.opsin_params.quant_biases, qblock,
+            block);
+
+        for (size_t c : {1, 0, 2}) {
+          if ((sbx[c] << hshift[c] != bx) || (sby[c] << vshift[c] != by)) {
+            continue;
+          }
+          // IDCT
+          float* JXL_RESTRICT idct_pos = idct_row[c] + sbx[c] * kBlockDim;
+          if (!dec_state->fast_idct ||
+              !FastTransformToPixels(
+                  acs.Strategy(), block + c * size, idct_pos, idct_stride[c],
+                  group_dec_cache->fast_idct_scratch_space)) {
             TransformToPixels(acs.Strategy(), block + c * size, idct_pos,
                               idct_stride[c], group_dec_cache->scratch_space);
           }
         }
-        bx += llf_x;
       }
     }
   }
@@ -437,9 +535,26 @@ HWY_AFTER_NAMESPACE();
 #if HWY_ONCE
 namespace jxl {
 namespace {
+// How DecodeACVarBlock reads symbols: through the generic reader, or, when the
+// entropy code of the pass does not use LZ77, through a reader specialized for
+// the type of entropy code.
+enum class ACSymbolReader { kGeneric, kANS, kPrefix };
+
+template <ACSymbolReader symbol_reader>
+JXL_INLINE size_t ReadACSymbol(size_t ctx, BitReader* JXL_RESTRICT br,
+                               ANSSymbolReader* JXL_RESTRICT decoder,
+                               const std::vector<uint8_t>& context_map) {
+  if (symbol_reader == ACSymbolReader::kGeneric) {
+    return decoder->ReadHybridUint(ctx, br, context_map);
+  }
+  return decoder->ReadHybridUintClusteredNoLZ77<symbol_reader ==
+                                                ACSymbolReader::kPrefix>(
+      context_map[ctx], br);
+}
+
 // Decode quantized AC coefficients of DCT blocks.
 // LLF components in the output block will not be modified.
-template <ACType ac_type>
+template <ACType ac_type, ACSymbolReader symbol_reader>
 Status DecodeACVarBlock(size_t ctx_offset, size_t log2_covered_blocks,
                         int32_t* JXL_RESTRICT row_nzeros,
                         const int32_t* JXL_RESTRICT row_nzeros_top,
@@ -467,7 +582,8 @@ Status DecodeACVarBlock(size_t ctx_offset, size_t log2_covered_blocks,
   const int32_t nzero_ctx =
       block_ctx_map.NonZeroContext(predicted_nzeros, block_ctx) + ctx_offset;
 
-  size_t nzeros = decoder->ReadHybridUint(nzero_ctx, br, context_map);
+  size_t nzeros =
+      ReadACSymbol<symbol_reader>(nzero_ctx, br, decoder, context_map);
   if (nzeros + covered_blocks > size) {
     return JXL_FAILURE("Invalid AC: nzeros too large");
   }
@@ -489,7 +605,8 @@ Status DecodeACVarBlock(size_t ctx_offset, size_t log2_covered_blocks,
       const size_t ctx =
           histo_offset + ZeroDensityContext(nzeros, k, covered_blocks,
                                             log2_covered_blocks, prev);
-      const size_t u_coeff = decoder->ReadHybridUint(ctx, br, context_map);
+      const size_t u_coeff =
+          ReadACSymbol<symbol_reader>(ctx, br, decoder, context_map);
       // Hand-rolled version of UnpackSigned, shifting before the conversion to
       // signed integer to avoid undefined behavior of shifting negative
       // numbers.
@@ -514,6 +631,20 @@ Status DecodeACVarBlock(size_t ctx_offset, size_t log2_covered_blocks,
   return true;
 }
 
+using DecodeACVarBlockFn =
+    decltype(&DecodeACVarBlock<ACType::k16, ACSymbolReader::kGeneric>);
+
+template <ACType ac_type>
+DecodeACVarBlockFn SelectDecodeACVarBlock(const ANSSymbolReader& decoder) {
+  if (decoder.UsesLZ77()) {
+    return DecodeACVarBlock<ac_type, ACSymbolReader::kGeneric>;
+  }
+  if (decoder.UsesPrefixCode()) {
+    return DecodeACVarBlock<ac_type, ACSymbolReader::kPrefix>;
+  }
+  return DecodeACVarBlock<ac_type, ACSymbolReader::kANS>;
+}
+
 // Structs used by DecodeGroupImpl to get a quantized block.
 // GetBlockFromBitstream uses ANS decoding (and thus keeps track of row
 // pointers in row_nzeros), GetBlockFromEncoder simply reads the coefficient
@@ -538,9 +669,7 @@ struct GetBlockFromBitstream : public GetBlock {
   Status LoadBlock(size_t bx, size_t by, const AcStrategy& acs, size_t size,
                    size_t log2_covered_blocks, ACPtr block[3],
                    ACType ac_type) override {
-    auto decode_ac_varblock = ac_type == ACType::k16
-                                  ? DecodeACVarBlock<ACType::k16>
-                                  : DecodeACVarBlock<ACType::k32>;
+    const size_t ac_idx = static_cast<size_t>(ac_type);
     for (size_t c : {1, 0, 2}) {
       size_t sbx = bx >> hshift[c];
       size_t sby = by >> vshift[c];
@@ -549,7 +678,7 @@ struct GetBlockFromBitstream : public GetBlock {
       }
 
       for (size_t pass = 0; JXL_UNLIKELY(pass < num_passes); pass++) {
-        JXL_RETURN_IF_ERROR(decode_ac_varblock(
+        JXL_RETURN_IF_ERROR(decode_ac_varblock[pass][ac_idx](
             ctx_offset[pass], log2_covered_blocks, row_nzeros[pass][c],
             row_nzeros_top[pass][c], nzeros_stride, c, sbx, sby, bx, acs,
             &coeff_orders[pass * coeff_order_size], readers[pass],
@@ -595,6 +724,10 @@ struct GetBlockFromBitstream : public GetBlock {
 
       decoders[pass] =
           ANSSymbolReader(&dec_state->code[pass + first_pass], readers[pass]);
+      decode_ac_varblock[pass][static_cast<size_t>(ACType::k16)] =
+          SelectDecodeACVarBlock<ACType::k16>(decoders[pass]);
+      decode_ac_varblock[pass][static_cast<size_t>(ACType::k32)] =
+          SelectDecodeACVarBlock<ACType::k32>(decoders[pass]);
     }
     nzeros_stride = group_dec_cache->num_nzeroes[0].PixelsPerRow();
     for (size_t i = 0; i < num_passes; i++) {
@@ -610,6 +743,8 @@ struct GetBlockFromBitstream : public GetBlock {
   size_t coeff_order_size;
   const std::vector<uint8_t>* JXL_RESTRICT context_map;
   ANSSymbolReader decoders[kMaxNumPasses];
+  // Indexed by pass and ACType, chosen once per group in Init.
+  DecodeACVarBlockFn decode_ac_varblock[kMaxNumPasses][2];
   BitReader* JXL_RESTRICT* JXL_RESTRICT readers;
   size_t num_passes;
   size_t ctx_offset[kMaxNumPasses];
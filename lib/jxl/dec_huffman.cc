@@ -252,4 +252,23 @@ uint16_t HuffmanDecodingData::ReadSymbol(BitReader* br) const {
   return table->value;
 }
 
+void HuffmanDecodingData::BuildPairTable(size_t max_symbol) {
+  pair_table_.assign(1u << kHuffmanTableBits, SymbolPair());
+  for (size_t i = 0; i < pair_table_.size(); i++) {
+    const HuffmanCode& first = table_[i];
+    if (first.bits > kHuffmanTableBits || first.value >= max_symbol) continue;
+    // Root table entries of codes shorter than kHuffmanTableBits are
+    // replicated over all the values of the bits that follow them, so the
+    // remaining bits of the prefix identify the second code if it fits.
+    const HuffmanCode& second = table_[i >> first.bits];
+    if (second.bits > kHuffmanTableBits - first.bits ||
+        second.value >= max_symbol) {
+      continue;
+    }
+    pair_table_[i].bits = first.bits + second.bits;
+    pair_table_[i].symbols[0] = first.value;
+    pair_table_[i].symbols[1] = second.value;
+  }
+}
+
 }  // namespace jxl
@@ -24,7 +24,21 @@ struct HuffmanDecodingData {
 
   uint16_t ReadSymbol(BitReader* br) const;
 
+  // Fills pair_table_ from the root table: for every kHuffmanTableBits-bit
+  // prefix that holds two complete codes whose symbols are both smaller than
+  // `max_symbol`, stores the two symbols and their total code length.
+  void BuildPairTable(size_t max_symbol);
+
+  // Two consecutive symbols decoded from a single root table lookup. An entry
+  // with bits == 0 does not hold a pair.
+  struct SymbolPair {
+    uint8_t bits = 0;
+    uint16_t symbols[2] = {0, 0};
+  };
+
   std::vector<HuffmanCode> table_;
+  // Empty unless BuildPairTable was called.
+  std::vector<SymbolPair> pair_table_;
 };
 
 }  // namespace jxl
@@ -187,6 +187,7 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
   }
   do_color = decode_color;
   size_t nb_extra = metadata.extra_channel_info.size();
+  tree_cache.Clear();
   bool has_tree = reader->ReadBits(1);
   if (!allow_truncated_group ||
       reader->TotalBitsConsumed() < reader->TotalBytes() * kBitsPerByte) {
@@ -198,6 +199,10 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
       JXL_RETURN_IF_ERROR(DecodeTree(reader, &tree, tree_size_limit));
       JXL_RETURN_IF_ERROR(
           DecodeHistograms(reader, (tree.size() + 1) / 2, &code, &context_map));
+      decode_stats.num_tree_nodes += tree.size();
+      decode_stats.num_histograms += code.uint_config.size();
+      decode_stats.num_entropy_codes += 1;
+      decode_stats.num_lz77_codes += code.lz77.enabled ? 1 : 0;
     }
   }
   if (!do_color) nb_chans = 0;
@@ -249,6 +254,11 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
   ModularOptions options;
   options.max_chan_size = frame_dim.group_dim;
   options.group_dim = frame_dim.group_dim;
+  options.decode_stats = &decode_stats;
+  options.tree_cache = &tree_cache;
+  if (num_decoded_extra_channels < nb_extra) {
+    options.num_decoded_channels = nb_chans + num_decoded_extra_channels;
+  }
   Status dec_status = ModularGenericDecompress(
       reader, gi, &global_header, ModularStreamId::Global().ID(frame_dim),
       &options,
@@ -258,6 +268,8 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
   if (dec_status.IsFatalError()) {
     return JXL_FAILURE("Failed to decode global modular info");
   }
+  num_decoded_channels = NumDecodedChannels(global_header.transforms,
+                                            options.num_decoded_channels);
 
   // TODO(eustas): are we sure this can be done after partial decode?
   have_something = false;
@@ -312,6 +324,8 @@ Status ModularFrameDecoder::DecodeGroup(
     if (fc.w > frame_dim.group_dim || fc.h > frame_dim.group_dim) break;
   }
   size_t beginc = c;
+  // Channels of gi that come from the decoded channels of full_image.
+  size_t num_group_decoded_channels = 0;
   for (; c < full_image.channel.size(); c++) {
     Channel& fc = full_image.channel[c];
     int shift = std::min(fc.hshift, fc.vshift);
@@ -331,6 +345,7 @@ Status ModularFrameDecoder::DecodeGroup(
       gc.hshift = fc.hshift;
       gc.vshift = fc.vshift;
       gi.channel.emplace_back(std::move(gc));
+      if (c < num_decoded_channels) num_group_decoded_channels++;
     }
   }
   if (zerofill && use_full_image) return true;
@@ -350,6 +365,11 @@ Status ModularFrameDecoder::DecodeGroup(
     return true;
   }
   ModularOptions options;
+  options.decode_stats = &decode_stats;
+  options.tree_cache = &tree_cache;
+  if (num_decoded_channels != SIZE_MAX) {
+    options.num_decoded_channels = num_group_decoded_channels;
+  }
   if (!zerofill) {
     auto status = ModularGenericDecompress(
         reader, gi, /*header=*/nullptr, stream.ID(frame_dim), &options,
@@ -401,6 +421,8 @@ Status ModularFrameDecoder::DecodeVarDCTDC(size_t group_id, BitReader* reader,
   size_t extra_precision = reader->ReadFixedBits<2>();
   float mul = 1.0f / (1 << extra_precision);
   ModularOptions options;
+  options.decode_stats = &decode_stats;
+  options.tree_cache = &tree_cache;
   for (size_t c = 0; c < 3; c++) {
     Channel& ch = image.channel[c < 2 ? c ^ 1 : c];
     ch.w >>= dec_state->shared->frame_header.chroma_subsampling.HShift(c);
@@ -436,6 +458,8 @@ Status ModularFrameDecoder::DecodeAcMetadata(size_t group_id, BitReader* reader,
   image.channel[1] = Channel(cr.xsize(), cr.ysize(), 3, 3);
   image.channel[2] = Channel(count, 2, 0, 0);
   ModularOptions options;
+  options.decode_stats = &decode_stats;
+  options.tree_cache = &tree_cache;
   if (!ModularGenericDecompress(
           reader, image, /*header=*/nullptr, stream_id, &options,
           /*undo_transforms=*/true, &tree, &code, &context_map)) {
@@ -646,6 +670,15 @@ Status ModularFrameDecoder::ModularImageToDecodedRect(
     JXL_ASSERT(c < gi.channel.size());
     Channel& ch_in = gi.channel[c];
     Rect r = render_pipeline_input.GetBuffer(3 + ec).second;
+    if (ec >= num_decoded_extra_channels) {
+      // Not needed, and not upsampled by the render pipeline.
+      for (size_t y = 0; y < r.ysize(); ++y) {
+        float* const JXL_RESTRICT row_out =
+            r.Row(render_pipeline_input.GetBuffer(3 + ec).first, y);
+        memset(row_out, 0, r.xsize() * sizeof(*row_out));
+      }
+      continue;
+    }
     Rect mr(modular_rect.x0() >> ch_in.hshift,
             modular_rect.y0() >> ch_in.vshift,
             DivCeil(modular_rect.xsize(), 1 << ch_in.hshift),
@@ -7,6 +7,7 @@
 #define LIB_JXL_DEC_MODULAR_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <string>
 
@@ -87,6 +88,11 @@ struct ModularStreamId {
 class ModularFrameDecoder {
  public:
   void Init(const FrameDimensions& frame_dim) { this->frame_dim = frame_dim; }
+  // Only the first `num` extra channels are needed: the others are zero-filled
+  // and, where the modular transforms allow it, not decoded at all.
+  void SetNumDecodedExtraChannels(size_t num) {
+    num_decoded_extra_channels = num;
+  }
   Status DecodeGlobalInfo(BitReader* reader, const FrameHeader& frame_header,
                           bool allow_truncated_group);
   Status DecodeGroup(const Rect& rect, BitReader* reader, int minShift,
@@ -115,6 +121,8 @@ class ModularFrameDecoder {
   bool have_dc() const { return have_something; }
   void MaybeDropFullImage();
   bool UsesFullImage() const { return use_full_image; }
+  // Counters of the modular streams decoded so far, including the global tree.
+  const ModularDecodeStats& DecodeStats() const { return decode_stats; }
 
  private:
   Status ModularImageToDecodedRect(Image& gi, PassesDecoderState* dec_state,
@@ -129,10 +137,16 @@ class ModularFrameDecoder {
   bool have_something;
   bool use_full_image = true;
   bool all_same_shift;
+  size_t num_decoded_extra_channels = SIZE_MAX;
+  // Number of leading channels of full_image that are decoded.
+  size_t num_decoded_channels = SIZE_MAX;
   Tree tree;
   ANSCode code;
   std::vector<uint8_t> context_map;
   GroupHeader global_header;
+  ModularDecodeStats decode_stats;
+  // The global tree filtered for the groups and channels.
+  FilteredTreeCache tree_cache;
 };
 
 }  // namespace jxl
@@ -0,0 +1,152 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/decode.h>
+#include <jxl/decode_cxx.h>
+#include <jxl/encode.h>
+#include <jxl/encode_cxx.h>
+
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace {
+
+// Encodes a smooth 8-bit RGB test image losslessly as a single modular group
+// predicted with `predictor` (as JXL_ENC_FRAME_SETTING_MODULAR_PREDICTOR).
+// `tree_learning_percent` is passed to the encoder: 0 produces a single-leaf
+// tree, -1 the default learned tree.
+std::vector<uint8_t> EncodeModularImage(size_t xsize, size_t ysize,
+                                        int predictor,
+                                        int tree_learning_percent) {
+  std::vector<uint8_t> pixels(xsize * ysize * 3);
+  for (size_t y = 0; y < ysize; y++) {
+    for (size_t x = 0; x < xsize; x++) {
+      uint8_t* p = &pixels[(y * xsize + x) * 3];
+      const uint32_t noise = (x * 7919u + y * 104729u) * 2654435761u;
+      p[0] = static_cast<uint8_t>(x + ((noise >> 28) & 3));
+      p[1] = static_cast<uint8_t>(y + ((noise >> 24) & 3));
+      p[2] = static_cast<uint8_t>((x + y) / 2 + ((noise >> 20) & 7));
+    }
+  }
+
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  JxlBasicInfo basic_info;
+  JxlEncoderInitBasicInfo(&basic_info);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.uses_original_profile = JXL_TRUE;
+  JXL_CHECK(JXL_ENC_SUCCESS == JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+  JXL_CHECK(JXL_ENC_SUCCESS ==
+            JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+  JxlEncoderFrameSettings* settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+  JXL_CHECK(JXL_ENC_SUCCESS == JxlEncoderSetFrameLossless(settings, JXL_TRUE));
+  // Group size 1024, so that the whole image is a single group.
+  JXL_CHECK(JXL_ENC_SUCCESS ==
+            JxlEncoderFrameSettingsSetOption(
+                settings, JXL_ENC_FRAME_SETTING_MODULAR_GROUP_SIZE, 3));
+  JXL_CHECK(JXL_ENC_SUCCESS ==
+            JxlEncoderFrameSettingsSetOption(
+                settings, JXL_ENC_FRAME_SETTING_MODULAR_PREDICTOR, predictor));
+  JXL_CHECK(JXL_ENC_SUCCESS ==
+            JxlEncoderFrameSettingsSetOption(
+                settings, JXL_ENC_FRAME_SETTING_MODULAR_MA_TREE_LEARNING_PERCENT,
+                tree_learning_percent));
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  JXL_CHECK(JXL_ENC_SUCCESS == JxlEncoderAddImageFrame(settings, &format,
+                                                       pixels.data(),
+                                                       pixels.size()));
+  JxlEncoderCloseInput(enc.get());
+
+  std::vector<uint8_t> compressed(64);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size();
+  JxlEncoderStatus status = JXL_ENC_NEED_MORE_OUTPUT;
+  while (status == JXL_ENC_NEED_MORE_OUTPUT) {
+    status = JxlEncoderProcessOutput(enc.get(), &next_out, &avail_out);
+    if (status == JXL_ENC_NEED_MORE_OUTPUT) {
+      size_t offset = next_out - compressed.data();
+      compressed.resize(compressed.size() * 2);
+      next_out = compressed.data() + offset;
+      avail_out = compressed.size() - offset;
+    }
+  }
+  JXL_CHECK(status == JXL_ENC_SUCCESS);
+  compressed.resize(next_out - compressed.data());
+  return compressed;
+}
+
+// Decodes the `size` x `size` image `compressed` once per iteration, single
+// threaded.
+void DecodeRepeatedly(benchmark::State& state, size_t size,
+                      const std::vector<uint8_t>& compressed) {
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels(size * size * 3);
+
+  for (auto _ : state) {
+    JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+    JXL_CHECK(JXL_DEC_SUCCESS ==
+              JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE));
+    JXL_CHECK(JXL_DEC_SUCCESS == JxlDecoderSetInput(dec.get(),
+                                                    compressed.data(),
+                                                    compressed.size()));
+    JxlDecoderCloseInput(dec.get());
+    JXL_CHECK(JXL_DEC_NEED_IMAGE_OUT_BUFFER ==
+              JxlDecoderProcessInput(dec.get()));
+    JXL_CHECK(JXL_DEC_SUCCESS ==
+              JxlDecoderSetImageOutBuffer(dec.get(), &format, pixels.data(),
+                                          pixels.size()));
+    JXL_CHECK(JXL_DEC_FULL_IMAGE == JxlDecoderProcessInput(dec.get()));
+  }
+
+  state.SetItemsProcessed(size * size * state.iterations());
+}
+
+// Single-threaded decoding latency of a one-group weighted predictor image.
+// Arguments: image size and MA tree learning percentage.
+void BM_DecodeModularWeighted(benchmark::State& state) {
+  const size_t size = state.range(0);
+  DecodeRepeatedly(
+      state, size,
+      EncodeModularImage(size, size, /*predictor=*/6, state.range(1)));
+}
+
+// Same with the other predictors of the modular loops, with and without a
+// learned tree. Arguments: predictor and MA tree learning percentage.
+void BM_DecodeModularPredictor(benchmark::State& state) {
+  constexpr size_t kSize = 1024;
+  DecodeRepeatedly(
+      state, kSize,
+      EncodeModularImage(kSize, kSize, state.range(0), state.range(1)));
+}
+
+BENCHMARK(BM_DecodeModularWeighted)
+    ->ArgPair(256, 0)
+    ->ArgPair(256, -1)
+    ->ArgPair(1024, 0)
+    ->ArgPair(1024, -1)
+    ->Unit(benchmark::kMillisecond);
+
+// Zero, left, select, gradient, toptop predictive average, mix of gradient and
+// weighted, and mix of all predictors.
+BENCHMARK(BM_DecodeModularPredictor)
+    ->ArgNames({"predictor", "tree"})
+    ->ArgPair(0, 0)
+    ->ArgPair(1, 0)
+    ->ArgPair(4, 0)
+    ->ArgPair(5, 0)
+    ->ArgPair(5, -1)
+    ->ArgPair(13, 0)
+    ->ArgPair(14, -1)
+    ->ArgPair(15, -1)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace jxl
@@ -10,6 +10,7 @@
 #include <sys/types.h>
 
 #include <algorithm>
+#include <limits>
 #include <string>
 #include <tuple>
 #include <utility>
@@ -187,6 +188,7 @@ struct PatchInterval {
 void PatchDictionary::ComputePatchTree() {
   patch_tree_.clear();
   num_patches_.clear();
+  row_x_range_.clear();
   sorted_patches_y0_.clear();
   sorted_patches_y1_.clear();
   if (positions_.empty()) {
@@ -215,8 +217,17 @@ void PatchDictionary::ComputePatchTree() {
   // Count the number of patches for each row.
   sort_by_y1(0, intervals.size());
   num_patches_.resize(intervals.back().y1);
+  row_x_range_.resize(intervals.back().y1,
+                      std::make_pair(std::numeric_limits<size_t>::max(),
+                                     static_cast<size_t>(0)));
   for (auto iv : intervals) {
-    for (size_t y = iv.y0; y < iv.y1; ++y) num_patches_[y]++;
+    const auto& pos = positions_[iv.idx];
+    const size_t x1 = pos.x + ref_positions_[pos.ref_pos_idx].xsize;
+    for (size_t y = iv.y0; y < iv.y1; ++y) {
+      num_patches_[y]++;
+      row_x_range_[y].first = std::min(row_x_range_[y].first, pos.x);
+      row_x_range_[y].second = std::max(row_x_range_[y].second, x1);
+    }
   }
   PatchTreeNode root;
   root.start = 0;
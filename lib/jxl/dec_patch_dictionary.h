@@ -100,6 +100,7 @@ class PatchDictionary {
   }
 
   bool HasAny() const { return !positions_.empty(); }
+  size_t NumPatches() const { return positions_.size(); }
 
   Status Decode(BitReader* br, size_t xsize, size_t ysize,
                 bool* uses_extra_channels);
@@ -119,6 +120,14 @@ class PatchDictionary {
 
   std::vector<size_t> GetPatchesForRow(size_t y) const;
 
+  // Returns true if any patch covers a pixel of the row segment of `xsize`
+  // pixels starting at (x0, y). Cheaper than GetPatchesForRow, so that rows
+  // untouched by patches can be skipped entirely.
+  bool HasPatchesInRow(size_t y, size_t x0, size_t xsize) const {
+    return y < num_patches_.size() && num_patches_[y] > 0 &&
+           x0 < row_x_range_[y].second && x0 + xsize > row_x_range_[y].first;
+  }
+
  private:
   friend class PatchDictionaryEncoder;
 
@@ -140,6 +149,8 @@ class PatchDictionary {
   std::vector<PatchTreeNode> patch_tree_;
   // Number of patches for each row.
   std::vector<size_t> num_patches_;
+  // Union of the [x0, x1) ranges of the patches of each row.
+  std::vector<std::pair<size_t, size_t>> row_x_range_;
   std::vector<std::pair<size_t, size_t>> sorted_patches_y0_;
   std::vector<std::pair<size_t, size_t>> sorted_patches_y1_;
 
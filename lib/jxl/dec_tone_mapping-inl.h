@@ -152,6 +152,11 @@ class HlgOOTF {
         primaries_luminances);
   }
 
+  // Scales the colors by their luminance to the power of `gamma` - 1.
+  static HlgOOTF FromGamma(float gamma, const float primaries_luminances[3]) {
+    return HlgOOTF(gamma, primaries_luminances);
+  }
+
   template <typename V>
   void Apply(V* red, V* green, V* blue) const {
     hwy::HWY_NAMESPACE::DFromV<V> df;
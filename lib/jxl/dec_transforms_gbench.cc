@@ -0,0 +1,95 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/ac_strategy.h"
+#include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/random.h"
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jxl/dec_transforms_gbench.cc"
+#include <hwy/aligned_allocator.h>
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+#include "lib/jxl/dec_transforms-inl.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace jxl {
+namespace HWY_NAMESPACE {
+namespace {
+
+// Dequantizes and inverse transforms one varblock of the strategy given as
+// argument, as the inner loop of DecodeGroupImpl does for each varblock.
+HWY_NOINLINE void BM_DequantIDCT(benchmark::State& state) {
+  const AcStrategy acs =
+      AcStrategy::FromRawStrategy(static_cast<uint8_t>(state.range(0)));
+  const size_t xsize = acs.covered_blocks_x() * kBlockDim;
+  const size_t ysize = acs.covered_blocks_y() * kBlockDim;
+  const size_t area = xsize * ysize;
+  auto quantized = hwy::AllocateAligned<int32_t>(area);
+  auto dequant_matrix = hwy::AllocateAligned<float>(area);
+  auto coefficients = hwy::AllocateAligned<float>(area);
+  auto scratch = hwy::AllocateAligned<float>(AcStrategy::kMaxCoeffArea);
+  const size_t stride = AcStrategy::kMaxBlockDim;
+  auto pixels = hwy::AllocateAligned<float>(ysize * stride);
+
+  // Mostly zero coefficients, more likely in the low frequencies.
+  Rng rng(0);
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      const size_t i = y * xsize + x;
+      const bool nonzero = rng.Bernoulli(1.0f / (1 + x + y));
+      quantized[i] = nonzero ? rng.UniformI(-8, 9) : 0;
+      dequant_matrix[i] = 0.01f * (1 + x + y);
+    }
+  }
+
+  HWY_FULL(float) df;
+  HWY_FULL(int32_t) di;
+  for (auto _ : state) {
+    for (size_t i = 0; i < area; i += Lanes(df)) {
+      const auto q = ConvertTo(df, Load(di, quantized.get() + i));
+      Store(Mul(q, Load(df, dequant_matrix.get() + i)), df,
+            coefficients.get() + i);
+    }
+    TransformToPixels(acs.Strategy(), coefficients.get(), pixels.get(), stride,
+                      scratch.get());
+    benchmark::DoNotOptimize(pixels[0]);
+  }
+  state.SetItemsProcessed(area * state.iterations());
+}
+
+}  // namespace
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+#include "lib/jxl/gbench_targets_testonly.h"
+
+namespace jxl {
+namespace {
+
+HWY_EXPORT(BM_DequantIDCT);
+
+JXL_MAYBE_UNUSED const bool kRegistered = [] {
+  for (auto* bench :
+       RegisterForEachTarget("BM_DequantIDCT", [](benchmark::State& state) {
+         HWY_DYNAMIC_DISPATCH(BM_DequantIDCT)(state);
+       })) {
+    bench->ArgName("strategy")->DenseRange(
+        0, AcStrategy::kNumValidStrategies - 1);
+  }
+  return true;
+}();
+
+}  // namespace
+}  // namespace jxl
+#endif  // HWY_ONCE
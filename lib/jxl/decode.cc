@@ -5,15 +5,20 @@
 
 #include <jxl/decode.h>
 #include <jxl/types.h>
+#include <string.h>
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <deque>
 #include <functional>
+#include <iterator>
 #include <memory>
 #include <utility>
 #include <vector>
 
 #include "lib/jxl/base/byte_order.h"
+#include "lib/jxl/base/cache_aligned.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"
@@ -31,6 +36,7 @@
 #include "lib/jxl/headers.h"
 #include "lib/jxl/icc_codec.h"
 #include "lib/jxl/image_bundle.h"
+#include "lib/jxl/image_ops.h"
 #include "lib/jxl/loop_filter.h"
 #include "lib/jxl/memory_manager_internal.h"
 #include "lib/jxl/sanitizers.h"
@@ -282,6 +288,25 @@ std::vector<size_t> GetFrameDependencies(size_t index,
   return result;
 }
 
+/*
+Given saved_as and references as for GetFrameDependencies, returns the storage
+slots whose contents after the frame at the given index may still be read by a
+later frame. A slot is dead once a later frame saves to it before any frame
+reads it. Frames beyond saved_as are unknown and may read any slot that is not
+dead by then.
+*/
+int LiveStorageSlots(size_t index, const std::vector<int>& saved_as,
+                     const std::vector<int>& references) {
+  JXL_ASSERT(references.size() == saved_as.size());
+  int live = 0;
+  int dead = 0;
+  for (size_t i = index + 1; i < saved_as.size(); ++i) {
+    live |= references[i] & ~dead;
+    dead |= saved_as[i] & ~live;
+  }
+  return 0xff & ~dead;
+}
+
 // Parameters for user-requested extra channel output.
 struct ExtraChannelOutput {
   JxlPixelFormat format;
@@ -289,6 +314,31 @@ struct ExtraChannelOutput {
   size_t buffer_size;
 };
 
+// A frame decoded ahead of time, concurrently with the frames around it, with
+// its own decoder state. It is output when the decoder reaches it.
+struct PrefetchedFrame {
+  std::unique_ptr<jxl::PassesDecoderState> dec_state;
+  std::unique_ptr<jxl::FrameDecoder> frame_dec;
+  std::unique_ptr<jxl::ImageBundle> ib;
+  // Size of the frame header and TOC, and offset of the sections in the input
+  // span the frame was decoded from.
+  size_t header_size;
+  size_t sections_offset;
+  int references;
+};
+
+// Number of bytes copied at least when the codestream that is read in place
+// must be copied because it continues in the next box.
+constexpr size_t kMinCodestreamCopy = 4096;
+
+// Part of the codestream that is stored contiguously in the input.
+struct CodestreamChunk {
+  // Offset of data in the codestream.
+  uint64_t offset;
+  const uint8_t* data;
+  size_t size;
+};
+
 }  // namespace
 
 namespace jxl {
@@ -340,6 +390,12 @@ struct JxlDecoderStruct {
   JxlDecoderStruct() = default;
 
   JxlMemoryManager memory_manager;
+  // Image buffer usage of this decoder, see JxlDecoderGetMemoryUsage.
+  // Declared first so that it outlives the buffers accounted in it.
+  jxl::AllocationStats allocation_stats;
+  std::unique_ptr<jxl::MemoryArena> frame_arena;
+  // Used for the image buffers while max_image_buffer_pool_bytes is nonzero.
+  std::unique_ptr<jxl::BufferPool> image_buffer_pool;
   std::unique_ptr<jxl::ThreadPool> thread_pool;
 
   DecoderStage stage;
@@ -401,8 +457,42 @@ struct JxlDecoderStruct {
   bool keep_orientation;
   bool unpremul_alpha;
   bool render_spotcolors;
+  bool fast_idct;
   bool coalescing;
+  bool collect_render_stats;
+  // Render pipeline counters of the frames decoded so far, by stage name.
+  std::vector<JxlRenderStageStats> render_stats;
+  // Counters of the frames decoded so far, indexed by JxlDecoderDiagnostic.
+  uint64_t diagnostics[JXL_DEC_NUM_DIAGNOSTICS];
   float desired_intensity_target;
+  // Region of the image to output, empty if the whole image is output.
+  size_t crop_x0;
+  size_t crop_y0;
+  size_t crop_xsize;
+  size_t crop_ysize;
+  // Region of the image whose groups are decoded first, empty if none.
+  size_t priority_x0;
+  size_t priority_y0;
+  size_t priority_xsize;
+  size_t priority_ysize;
+  // Factor by which the output image is downsampled: 1, 2, 4 or 8.
+  size_t output_downsampling;
+  // Per extra channel, whether it is needed; empty if all of them are.
+  std::vector<bool> decoded_extra_channels;
+  // Maximum number of frames decoded concurrently.
+  size_t max_parallel_frames;
+  // Whether the parallel runner may be called from its own tasks, so that
+  // concurrently decoded frames can also use it.
+  bool nested_parallelism;
+  // Whether the image buffers are allocated from frame_arena, see
+  // JxlDecoderSetFrameArena.
+  bool use_frame_arena;
+  size_t max_image_buffer_pool_bytes;
+  // See JxlDecoderSetHugePages.
+  bool huge_pages;
+  // Whether the input that starts at the beginning of the file holds the whole
+  // file and stays valid, see JxlDecoderSetPersistentInput.
+  bool persistent_input;
 
   // Bitfield, for which informative events (JXL_DEC_BASIC_INFO, etc...) the
   // decoder returns a status. By default, do not return for any of the events,
@@ -432,6 +522,9 @@ struct JxlDecoderStruct {
   JxlImageOutRunCallback image_out_run_callback;
   JxlImageOutDestroyCallback image_out_destroy_callback;
   void* image_out_init_opaque;
+  // Set instead of image_out_run_callback by JxlDecoderSetImageOutRectCallback.
+  JxlImageOutRectCallback image_out_rect_callback;
+  size_t image_out_max_rows;
   struct SimpleImageOutCallback {
     JxlImageOutCallback callback;
     void* opaque;
@@ -439,6 +532,10 @@ struct JxlDecoderStruct {
   SimpleImageOutCallback simple_image_out_callback;
 
   size_t image_out_size;
+  // If not empty, the image is written to these planes instead of to
+  // image_out_buffer, see JxlDecoderSetImageOutPlanes.
+  std::vector<JxlImageOutPlane> image_out_planes;
+  JxlPlaneLayout image_out_plane_layout;
 
   JxlPixelFormat image_out_format;
   JxlBitDepth image_out_bit_depth;
@@ -455,6 +552,10 @@ struct JxlDecoderStruct {
 
   std::unique_ptr<jxl::PassesDecoderState> passes_state;
   std::unique_ptr<jxl::FrameDecoder> frame_dec;
+  // Frames following the current one that were already decoded, in codestream
+  // order, and the current frame if it was one of them.
+  std::deque<std::unique_ptr<PrefetchedFrame>> prefetched_frames;
+  std::unique_ptr<PrefetchedFrame> prefetched_frame;
   size_t next_section;
   std::vector<char> section_processed;
 
@@ -501,6 +602,11 @@ struct JxlDecoderStruct {
   // vector, it must be treated as a required frame.
   std::vector<char> frame_required;
 
+  // Set when frames were jumped over using the frame index box, so the
+  // internal index of the current frame is unknown and the per-frame vectors
+  // above are neither extended nor used until the next rewind.
+  bool frame_index_jumped;
+
   // Codestream input data is copied here temporarily when the decoder needs
   // more input bytes to process the next part of the stream. We copy the input
   // data in order to be able to release it all through the API it when
@@ -516,6 +622,9 @@ struct JxlDecoderStruct {
   size_t codestream_pos;
   // Number of bits after codestream_pos that were already processed.
   size_t codestream_bits_ahead;
+  // Offset in the codestream of the next byte to process, which includes the
+  // bytes skipped with AdvanceCodestream.
+  uint64_t codestream_offset;
 
   BoxStage box_stage;
 
@@ -549,6 +658,18 @@ struct JxlDecoderStruct {
   const uint8_t* next_in;
   size_t avail_in;
   bool input_closed;
+  // With persistent input, the input set at the beginning of the file, or
+  // nullptr if it was not given in one buffer.
+  const uint8_t* persistent_in;
+  size_t persistent_in_size;
+  // With persistent and closed input, the parts of the codestream in the
+  // input, in codestream order, so that sections are read in place also when
+  // they are in a later codestream box than the current one.
+  std::vector<CodestreamChunk> codestream_chunks;
+  bool codestream_chunks_found;
+
+  // Whether the codestream can be read in place from the input.
+  bool InputInPlace() const { return persistent_in && input_closed; }
 
   void AdvanceInput(size_t size) {
     JXL_DASSERT(avail_in >= size);
@@ -567,6 +688,7 @@ struct JxlDecoderStruct {
   }
 
   void AdvanceCodestream(size_t size) {
+    codestream_offset += size;
     size_t avail_codestream = AvailableCodestream();
     if (codestream_copy.empty()) {
       if (size <= avail_codestream) {
@@ -589,6 +711,92 @@ struct JxlDecoderStruct {
     }
   }
 
+  // With the input released at the start of a section of the current frame,
+  // sets `skippable` for the sections from next_section that end in the
+  // current box, as found by FrameDecoder::FindSkippableSections. Returns
+  // false if the input is elsewhere, and `known` to whether the decoder could
+  // tell which sections it needs.
+  bool FindSkippableSections(std::vector<uint8_t>* skippable,
+                             bool* known) const {
+    if (box_stage != BoxStage::kCodestream || !codestream_copy.empty() ||
+        codestream_pos != 0 || frame_stage != FrameStage::kFull ||
+        !frame_dec || prefetched_frame || preview_frame || InputInPlace()) {
+      return false;
+    }
+    const auto& toc = frame_dec->Toc();
+    std::vector<size_t> ids;
+    uint64_t end = 0;
+    for (size_t i = next_section; i < toc.size(); ++i) {
+      end += toc[i].size;
+      if (!box_contents_unbounded && end > box_contents_end - file_pos) break;
+      ids.push_back(toc[i].id);
+    }
+    *known = frame_dec->FindSkippableSections(ids.data(), ids.size(),
+                                              skippable);
+    return true;
+  }
+
+  // Number of bytes of the leading sections found by FindSkippableSections
+  // with `skippable` equal to `value`.
+  uint64_t LeadingSectionsSize(const std::vector<uint8_t>& skippable,
+                               uint8_t value) const {
+    const auto& toc = frame_dec->Toc();
+    uint64_t size = 0;
+    for (size_t i = 0; i < skippable.size() && skippable[i] == value; ++i) {
+      size += toc[next_section + i].size;
+    }
+    return size;
+  }
+
+  // Marks the sections in the next `size` bytes, which are skippable, as
+  // decoded, and skips them with AdvanceCodestream.
+  void SkipFrameSections(uint64_t size) {
+    std::vector<uint8_t> skippable;
+    bool known;
+    const bool at_section = FindSkippableSections(&skippable, &known);
+    JXL_ASSERT(at_section);
+    const auto& toc = frame_dec->Toc();
+    std::vector<size_t> ids;
+    uint64_t skipped = 0;
+    size_t num = 0;
+    for (; skipped < size; ++num) {
+      JXL_ASSERT(num < skippable.size() && skippable[num]);
+      size_t i = next_section + num;
+      if (!section_processed[i]) ids.push_back(toc[i].id);
+      section_processed[i] = 1;
+      skipped += toc[i].size;
+    }
+    frame_dec->SkipSections(ids.data(), ids.size());
+    next_section += num;
+    remaining_frame_size -= skipped;
+    AdvanceCodestream(skipped);
+  }
+
+  // Number of bytes after the current input that will be skipped without
+  // being looked at: the rest of a box whose contents are not needed,
+  // codestream bytes skipped with AdvanceCodestream up to the end of the box,
+  // or the following sections of the frame that the output does not need.
+  uint64_t SkippableInput() const {
+    if (box_stage == BoxStage::kSkip) {
+      if (box_contents_unbounded) return 0;
+      // The frame index box is parsed once it is complete.
+      if (memcmp(box_type, "jxli", 4) == 0 && file_pos == box_contents_begin) {
+        return 0;
+      }
+      return box_contents_end - file_pos;
+    }
+    if (box_stage == BoxStage::kCodestream && codestream_copy.empty()) {
+      std::vector<uint8_t> skippable;
+      bool known;
+      if (FindSkippableSections(&skippable, &known)) {
+        return LeadingSectionsSize(skippable, 1);
+      }
+      if (box_contents_unbounded) return codestream_pos;
+      return std::min<uint64_t>(codestream_pos, box_contents_end - file_pos);
+    }
+    return 0;
+  }
+
   JxlDecoderStatus RequestMoreInput() {
     if (codestream_copy.empty()) {
       size_t avail_codestream = AvailableCodestream();
@@ -622,10 +830,20 @@ struct JxlDecoderStruct {
       *span = jxl::Span<const uint8_t>(next_in, avail_codestream);
       return JXL_DEC_SUCCESS;
     } else {
+      size_t copy_end = avail_codestream;
+      if (InputInPlace()) {
+        // The rest of the input stays available, so rather than the whole
+        // box, only copy as much again as the copy already has, which is
+        // repeated as long as the decoder needs more.
+        copy_end = std::min(
+            avail_codestream,
+            codestream_unconsumed +
+                std::max<size_t>(codestream_copy.size(), kMinCodestreamCopy));
+      }
       codestream_copy.insert(codestream_copy.end(),
                              next_in + codestream_unconsumed,
-                             next_in + avail_codestream);
-      codestream_unconsumed = avail_codestream;
+                             next_in + copy_end);
+      codestream_unconsumed = copy_end;
       *span = jxl::Span<const uint8_t>(codestream_copy.data() + codestream_pos,
                                        codestream_copy.size() - codestream_pos);
       return JXL_DEC_SUCCESS;
@@ -678,8 +896,11 @@ JxlDecoderStatus JxlDecoderDefaultPixelFormat(const JxlDecoder* dec,
   return JXL_DEC_SUCCESS;
 }
 
-// Resets the state that must be reset for both Rewind and Reset
-void JxlDecoderRewindDecodingState(JxlDecoder* dec) {
+// Resets the state that must be reset for both Rewind and Reset. With
+// `keep_buffers`, the decoder state is kept for the next image instead of
+// being destroyed, so that its scratch buffers are reused.
+void JxlDecoderRewindDecodingState(JxlDecoder* dec,
+                                   bool keep_buffers = false) {
   dec->stage = DecoderStage::kInited;
   dec->got_signature = false;
   dec->last_codestream_seen = false;
@@ -718,6 +939,7 @@ void JxlDecoderRewindDecodingState(JxlDecoder* dec) {
   dec->recon_exif_size = 0;
   dec->recon_xmp_size = 0;
   dec->recon_output_jpeg = JpegReconStage::kNone;
+  dec->jpeg_decoder.ResetRows();
 #endif
 
   dec->events_wanted = dec->orig_events_wanted;
@@ -731,15 +953,29 @@ void JxlDecoderRewindDecodingState(JxlDecoder* dec) {
   dec->image_out_run_callback = nullptr;
   dec->image_out_destroy_callback = nullptr;
   dec->image_out_init_opaque = nullptr;
+  dec->image_out_rect_callback = nullptr;
+  dec->image_out_max_rows = 1;
   dec->image_out_size = 0;
+  dec->image_out_planes.clear();
+  dec->image_out_plane_layout = JXL_PLANES_CHANNELS;
   dec->image_out_bit_depth.type = JXL_BIT_DEPTH_FROM_PIXEL_FORMAT;
   dec->extra_channel_output.clear();
   dec->next_in = 0;
   dec->avail_in = 0;
   dec->input_closed = false;
+  dec->persistent_in = nullptr;
+  dec->persistent_in_size = 0;
+  dec->codestream_chunks.clear();
+  dec->codestream_chunks_found = false;
 
-  dec->passes_state.reset(nullptr);
   dec->frame_dec.reset(nullptr);
+  dec->prefetched_frames.clear();
+  dec->prefetched_frame.reset();
+  if (keep_buffers && dec->passes_state) {
+    dec->passes_state->ResetForNextImage();
+  } else {
+    dec->passes_state.reset(nullptr);
+  }
   dec->next_section = 0;
   dec->section_processed.clear();
 
@@ -752,6 +988,7 @@ void JxlDecoderRewindDecodingState(JxlDecoder* dec) {
   dec->codestream_unconsumed = 0;
   dec->codestream_pos = 0;
   dec->codestream_bits_ahead = 0;
+  dec->codestream_offset = 0;
 
   dec->frame_stage = FrameStage::kHeader;
   dec->remaining_frame_size = 0;
@@ -761,26 +998,64 @@ void JxlDecoderRewindDecodingState(JxlDecoder* dec) {
   dec->skipping_frame = false;
   dec->internal_frames = 0;
   dec->external_frames = 0;
+  dec->frame_index_jumped = false;
 }
 
-void JxlDecoderReset(JxlDecoder* dec) {
-  JxlDecoderRewindDecodingState(dec);
+namespace {
+
+void JxlDecoderResetImpl(JxlDecoder* dec, bool keep_buffers) {
+  JxlDecoderRewindDecodingState(dec, keep_buffers);
 
   dec->thread_pool.reset();
   dec->keep_orientation = false;
   dec->unpremul_alpha = false;
   dec->render_spotcolors = true;
+  dec->fast_idct = false;
   dec->coalescing = true;
+  dec->collect_render_stats = false;
+  dec->render_stats.clear();
+  std::fill(std::begin(dec->diagnostics), std::end(dec->diagnostics), 0);
   dec->desired_intensity_target = 0;
+  dec->crop_x0 = 0;
+  dec->crop_y0 = 0;
+  dec->crop_xsize = 0;
+  dec->crop_ysize = 0;
+  dec->priority_x0 = 0;
+  dec->priority_y0 = 0;
+  dec->priority_xsize = 0;
+  dec->priority_ysize = 0;
+  dec->output_downsampling = 1;
+  dec->decoded_extra_channels.clear();
+  dec->max_parallel_frames = 1;
+  dec->nested_parallelism = false;
+  dec->use_frame_arena = false;
+  dec->huge_pages = false;
+  if (!keep_buffers) {
+    // Buffers may only be retained for the next image when keeping buffers.
+    dec->max_image_buffer_pool_bytes = 0;
+    if (dec->image_buffer_pool) dec->image_buffer_pool->SetMaxRetainedBytes(0);
+  }
+  dec->persistent_input = false;
   dec->orig_events_wanted = 0;
   dec->events_wanted = 0;
   dec->frame_references.clear();
   dec->frame_saved_as.clear();
   dec->frame_external_to_internal.clear();
   dec->frame_required.clear();
+  dec->frame_index_box.entries.clear();
   dec->decompress_boxes = false;
 }
 
+}  // namespace
+
+void JxlDecoderReset(JxlDecoder* dec) {
+  JxlDecoderResetImpl(dec, /*keep_buffers=*/false);
+}
+
+void JxlDecoderResetKeepBuffers(JxlDecoder* dec) {
+  JxlDecoderResetImpl(dec, /*keep_buffers=*/true);
+}
+
 JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager) {
   JxlMemoryManager local_memory_manager;
   if (!jxl::MemoryManagerInit(&local_memory_manager, memory_manager))
@@ -833,7 +1108,8 @@ void JxlDecoderSkipFrames(JxlDecoder* dec, size_t amount) {
   size_t next_frame = dec->external_frames + dec->skip_frames;
 
   // A frame that has been seen before a rewind
-  if (next_frame < dec->frame_external_to_internal.size()) {
+  if (!dec->frame_index_jumped &&
+      next_frame < dec->frame_external_to_internal.size()) {
     size_t internal_index = dec->frame_external_to_internal[next_frame];
     if (internal_index < dec->frame_saved_as.size()) {
       std::vector<size_t> deps = GetFrameDependencies(
@@ -852,7 +1128,8 @@ JxlDecoderStatus JxlDecoderSkipCurrentFrame(JxlDecoder* dec) {
   if (dec->frame_stage != FrameStage::kFull) {
     return JXL_DEC_ERROR;
   }
-  JXL_DASSERT(dec->frame_dec);
+  JXL_DASSERT(dec->frame_dec || dec->prefetched_frame);
+  dec->prefetched_frame.reset();
   dec->frame_stage = FrameStage::kHeader;
   dec->AdvanceCodestream(dec->remaining_frame_size);
   if (dec->is_last_of_still) {
@@ -872,6 +1149,17 @@ JxlDecoderSetParallelRunner(JxlDecoder* dec, JxlParallelRunner parallel_runner,
   return JXL_DEC_SUCCESS;
 }
 
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetParallelRunnerWithHints(
+    JxlDecoder* dec, JxlParallelRunnerWithHints parallel_runner,
+    void* parallel_runner_opaque) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("parallel_runner must be set before starting");
+  }
+  dec->thread_pool.reset(
+      new jxl::ThreadPool(parallel_runner, parallel_runner_opaque));
+  return JXL_DEC_SUCCESS;
+}
+
 size_t JxlDecoderSizeHintBasicInfo(const JxlDecoder* dec) {
   if (dec->got_basic_info) return 0;
   return dec->basic_info_size_hint;
@@ -916,6 +1204,66 @@ JxlDecoderStatus JxlDecoderSetRenderSpotcolors(JxlDecoder* dec,
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetFastIDCT(JxlDecoder* dec, JXL_BOOL fast_idct) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set fast_idct option before starting");
+  }
+  dec->fast_idct = !!fast_idct;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetCollectRenderStats(JxlDecoder* dec,
+                                                 JXL_BOOL enabled) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set render stats option before starting");
+  }
+  dec->collect_render_stats = !!enabled;
+  return JXL_DEC_SUCCESS;
+}
+
+size_t JxlDecoderNumRenderStages(const JxlDecoder* dec) {
+  return dec->render_stats.size();
+}
+
+JxlDecoderStatus JxlDecoderGetRenderStageStats(const JxlDecoder* dec,
+                                               size_t index,
+                                               JxlRenderStageStats* stats) {
+  if (index >= dec->render_stats.size()) {
+    return JXL_API_ERROR("Invalid render stage index");
+  }
+  *stats = dec->render_stats[index];
+  return JXL_DEC_SUCCESS;
+}
+
+uint64_t JxlDecoderGetDiagnostic(const JxlDecoder* dec,
+                                 JxlDecoderDiagnostic key) {
+  if (key < 0 || key >= JXL_DEC_NUM_DIAGNOSTICS) return 0;
+  return dec->diagnostics[key];
+}
+
+namespace {
+
+// Adds the render pipeline counters and the diagnostics of a decoded frame to
+// the totals.
+void AddFrameStats(JxlDecoder* dec, const jxl::FrameDecoder& frame_dec) {
+  for (const auto& stage : frame_dec.GetRenderStats()) {
+    auto it = std::find_if(dec->render_stats.begin(), dec->render_stats.end(),
+                           [&](const JxlRenderStageStats& stats) {
+                             return strcmp(stats.name, stage.name) == 0;
+                           });
+    if (it == dec->render_stats.end()) {
+      dec->render_stats.push_back({stage.name, 0, 0, 0});
+      it = dec->render_stats.end() - 1;
+    }
+    it->rows += stage.rows;
+    it->nanoseconds += stage.nanoseconds;
+    it->bytes += stage.bytes;
+  }
+  frame_dec.AddDiagnostics(dec->diagnostics);
+}
+
+}  // namespace
+
 JxlDecoderStatus JxlDecoderSetCoalescing(JxlDecoder* dec, JXL_BOOL coalescing) {
   if (dec->stage != DecoderStage::kInited) {
     return JXL_API_ERROR("Must set coalescing option before starting");
@@ -942,34 +1290,44 @@ void GetCurrentDimensions(const JxlDecoder* dec, size_t& xsize, size_t& ysize) {
         static_cast<int>(dec->metadata.m.GetOrientation()) > 4) {
       std::swap(xsize, ysize);
     }
+  } else if (dec->crop_xsize != 0) {
+    xsize = dec->crop_xsize;
+    ysize = dec->crop_ysize;
+  } else if (dec->output_downsampling > 1) {
+    xsize = jxl::DivCeil(xsize, dec->output_downsampling);
+    ysize = jxl::DivCeil(ysize, dec->output_downsampling);
   }
 }
+
+// Whether the current frame is decoded at full resolution into dec->ib, to be
+// downsampled into the image out buffer afterwards.
+bool OutputIsDownsampled(const JxlDecoder* dec) {
+  return dec->output_downsampling > 1 && dec->coalescing && !dec->preview_frame;
+}
 }  // namespace
 
 namespace jxl {
 namespace {
 
-template <class T>
-bool CanRead(Span<const uint8_t> data, BitReader* reader, T* JXL_RESTRICT t) {
-  // Use a copy of the bit reader because CanRead advances bits.
-  BitReader reader2(data);
-  reader2.SkipBits(reader->TotalBitsConsumed());
-  bool result = Bundle::CanRead(&reader2, t);
-  JXL_ASSERT(reader2.Close());
-  return result;
-}
-
 // Returns JXL_DEC_SUCCESS if the full bundle was successfully read, status
-// indicating either error or need more input otherwise.
+// indicating either error or need more input otherwise. The bundle is read in
+// a single pass with a copy of the bit reader, and `reader` only advances past
+// it if it was complete.
 template <class T>
 JxlDecoderStatus ReadBundle(JxlDecoder* dec, Span<const uint8_t> data,
                             BitReader* reader, T* JXL_RESTRICT t) {
-  if (!CanRead(data, reader, t)) {
+  BitReader reader2(data);
+  reader2.SkipBits(reader->TotalBitsConsumed());
+  const Status status = Bundle::Read(&reader2, t);
+  const size_t bits = reader2.TotalBitsConsumed() - reader->TotalBitsConsumed();
+  JXL_ASSERT(reader2.Close());
+  if (status.code() == StatusCode::kNotEnoughBytes) {
     return dec->RequestMoreInput();
   }
-  if (!Bundle::Read(reader, t)) {
+  if (!status) {
     return JXL_DEC_ERROR;
   }
+  reader->SkipBits(bits);
   return JXL_DEC_SUCCESS;
 }
 
@@ -1104,26 +1462,455 @@ JxlDecoderStatus JxlDecoderReadAllHeaders(JxlDecoder* dec) {
   return JXL_DEC_SUCCESS;
 }
 
-JxlDecoderStatus JxlDecoderProcessSections(JxlDecoder* dec) {
+size_t OutputStride(size_t xsize, const JxlPixelFormat& format) {
+  size_t stride = DivCeil(
+      xsize * format.num_channels * BitsPerChannel(format.data_type),
+      kBitsPerByte);
+  if (format.align > 1) {
+    stride = DivCeil(stride, format.align) * format.align;
+  }
+  return stride;
+}
+
+bool IsFloatOutput(const JxlPixelFormat& format) {
+  return format.data_type == JXL_TYPE_FLOAT ||
+         format.data_type == JXL_TYPE_FLOAT16;
+}
+
+// Writes `ib`, which has the dimensions of the output image before undoing the
+// orientation, to the image out buffer or callback and to the extra channel
+// buffers.
+// The image out callback, if one was set.
+PixelCallback ImageOutCallback(const JxlDecoder* dec) {
+  if (dec->image_out_rect_callback) {
+    return PixelCallback(dec->image_out_init_callback,
+                         dec->image_out_rect_callback, dec->image_out_max_rows,
+                         dec->image_out_destroy_callback,
+                         dec->image_out_init_opaque);
+  }
+  return PixelCallback(dec->image_out_init_callback,
+                       dec->image_out_run_callback,
+                       dec->image_out_destroy_callback,
+                       dec->image_out_init_opaque);
+}
+
+JxlDecoderStatus WriteImageOutput(JxlDecoder* dec, const ImageBundle& ib) {
+  const JxlPixelFormat& format = dec->image_out_format;
+  size_t xsize, ysize;
+  GetCurrentDimensions(dec, xsize, ysize);
+  Orientation undo_orientation = dec->keep_orientation
+                                     ? Orientation::kIdentity
+                                     : dec->metadata.m.GetOrientation();
+  if (!ConvertToExternal(
+          ib, GetBitDepth(dec->image_out_bit_depth, dec->metadata.m, format),
+          IsFloatOutput(format), format.num_channels, format.endianness,
+          OutputStride(xsize, format), dec->thread_pool.get(),
+          dec->image_out_buffer, dec->image_out_size, ImageOutCallback(dec),
+          undo_orientation, dec->unpremul_alpha)) {
+    return JXL_API_ERROR("writing image output failed");
+  }
+  for (size_t i = 0; i < dec->extra_channel_output.size(); ++i) {
+    const ExtraChannelOutput& extra = dec->extra_channel_output[i];
+    if (!extra.buffer || i >= ib.extra_channels().size()) continue;
+    if (!ConvertToExternal(
+            ib.extra_channels()[i],
+            GetBitDepth(dec->image_out_bit_depth,
+                        dec->metadata.m.extra_channel_info[i], extra.format),
+            IsFloatOutput(extra.format), extra.format.endianness,
+            OutputStride(xsize, extra.format), dec->thread_pool.get(),
+            extra.buffer, extra.buffer_size, PixelCallback(),
+            undo_orientation)) {
+      return JXL_API_ERROR("writing extra channel output failed");
+    }
+  }
+  return JXL_DEC_SUCCESS;
+}
+
+// Downsamples the frame decoded at full resolution into dec->ib and writes it
+// to the image out buffer or callback.
+JxlDecoderStatus WriteDownsampledOutput(JxlDecoder* dec) {
+  const ImageBundle& ib = *dec->ib;
+  const size_t factor = dec->output_downsampling;
+  ImageBundle downsampled(&dec->image_metadata);
+  Image3F color = CopyImage(ib.color());
+  DownsampleImage(&color, factor);
+  downsampled.SetFromImage(std::move(color), ib.c_current());
+  if (ib.HasExtraChannels()) {
+    std::vector<ImageF> extra_channels;
+    for (const ImageF& extra_channel : ib.extra_channels()) {
+      extra_channels.push_back(CopyImage(extra_channel));
+      DownsampleImage(&extra_channels.back(), factor);
+    }
+    downsampled.SetExtraChannels(std::move(extra_channels));
+  }
+  return WriteImageOutput(dec, downsampled);
+}
+
+// Decodes all sections of a frame for which PrefetchFrames has read the frame
+// header and TOC.
+Status DecodePrefetchedFrame(const uint8_t* data, PrefetchedFrame* frame) {
+  FrameDecoder* frame_dec = frame->frame_dec.get();
+  JXL_RETURN_IF_ERROR(frame_dec->InitFrameOutput());
+  const auto& toc = frame_dec->Toc();
+  std::vector<std::unique_ptr<BitReader, std::function<void(BitReader*)>>>
+      readers;
+  std::vector<FrameDecoder::SectionInfo> section_info;
+  std::vector<FrameDecoder::SectionStatus> section_status(toc.size());
+  size_t pos = frame->sections_offset;
+  for (const auto& entry : toc) {
+    readers.push_back(
+        GetBitReader(Span<const uint8_t>(data + pos, entry.size)));
+    section_info.emplace_back(
+        FrameDecoder::SectionInfo{readers.back().get(), entry.id});
+    pos += entry.size;
+  }
+  JXL_RETURN_IF_ERROR(frame_dec->ProcessSections(
+      section_info.data(), section_info.size(), section_status.data()));
+  for (size_t i = 0; i < toc.size(); ++i) {
+    if (section_status[i] != FrameDecoder::kDone ||
+        !readers[i]->AllReadsWithinBounds()) {
+      return JXL_FAILURE("frame out of bounds");
+    }
+  }
+  frame->references = frame_dec->References();
+  return frame_dec->FinalizeFrame();
+}
+
+// If the frame starting at the current position and the ones following it can
+// be decoded independently of each other, decodes up to
+// dec->max_parallel_frames of them concurrently into dec->prefetched_frames.
+// Does nothing otherwise, so that these frames are decoded one by one, which
+// also reports their errors.
+JxlDecoderStatus PrefetchFrames(JxlDecoder* dec) {
+  if (dec->max_parallel_frames < 2 || !dec->coalescing ||
+      !dec->render_spotcolors || dec->skip_frames > 0 ||
+      OutputIsDownsampled(dec) || dec->crop_xsize != 0 ||
+      (dec->events_wanted & JXL_DEC_FRAME_PROGRESSION) ||
+      !(dec->events_wanted & JXL_DEC_FULL_IMAGE)) {
+    return JXL_DEC_SUCCESS;
+  }
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  if (dec->jpeg_decoder.IsOutputSet()) return JXL_DEC_SUCCESS;
+#endif
   Span<const uint8_t> span;
   JXL_API_RETURN_IF_ERROR(dec->GetCodestreamInput(&span));
+  const PassesDecoderState& dec_state = *dec->passes_state;
+  const auto& reference_frames = dec_state.shared_storage.reference_frames;
+  std::deque<std::unique_ptr<PrefetchedFrame>> frames;
+  size_t pos = 0;
+  size_t visible_frame_index = dec_state.visible_frame_index;
+  size_t nonvisible_frame_index = dec_state.nonvisible_frame_index;
+  // Storage slots written by the frames collected so far.
+  int saved = 0;
+  while (frames.size() < dec->max_parallel_frames) {
+    auto frame = jxl::make_unique<PrefetchedFrame>();
+    frame->dec_state = jxl::make_unique<PassesDecoderState>();
+    frame->dec_state->output_encoding_info = dec_state.output_encoding_info;
+    frame->dec_state->visible_frame_index = visible_frame_index;
+    frame->dec_state->nonvisible_frame_index = nonvisible_frame_index;
+    frame->ib = jxl::make_unique<ImageBundle>(&dec->image_metadata);
+    frame->frame_dec = jxl::make_unique<FrameDecoder>(
+        frame->dec_state.get(), dec->metadata,
+        dec->nested_parallelism ? dec->thread_pool.get() : nullptr,
+        /*use_slow_rendering_pipeline=*/false);
+    frame->frame_dec->SetCollectRenderStats(dec->collect_render_stats);
+    auto reader =
+        GetBitReader(Span<const uint8_t>(span.data() + pos, span.size() - pos));
+    if (!frame->frame_dec->InitFrame(reader.get(), frame->ib.get(),
+                                     /*is_preview=*/false) ||
+        !reader->AllReadsWithinBounds()) {
+      break;
+    }
+    const FrameHeader& header = frame->frame_dec->GetFrameHeader();
+    frame->header_size = reader->TotalBitsConsumed() / kBitsPerByte;
+    frame->sections_offset = pos + frame->header_size;
+    if (OutOfBounds(frame->sections_offset,
+                    frame->frame_dec->SumSectionSizes(), span.size())) {
+      break;
+    }
+    FrameDimensions frame_dim = header.ToFrameDimensions();
+    if (!CheckSizeLimit(dec, frame_dim.xsize_upsampled_padded,
+                        frame_dim.ysize_upsampled_padded)) {
+      break;
+    }
+    if (header.frame_type == FrameType::kDCFrame ||
+        (header.flags & FrameHeader::kUseDcFrame)) {
+      break;
+    }
+    // The references of patches are only known once the frame is decoded.
+    int references = FrameDecoder::BlendingReferences(header);
+    if (header.flags & FrameHeader::kPatches) references |= 0xf;
+    if (references & saved) break;
+    for (size_t i = 0; i < 4; ++i) {
+      if (!(references & (1 << i))) continue;
+      frame->dec_state->shared_storage.reference_frames[i].frame =
+          reference_frames[i].frame.Copy();
+      frame->dec_state->shared_storage.reference_frames[i].ib_is_in_xyb =
+          reference_frames[i].ib_is_in_xyb;
+    }
+    saved |= FrameDecoder::SavedAs(header);
+    visible_frame_index = frame->dec_state->visible_frame_index;
+    nonvisible_frame_index = frame->dec_state->nonvisible_frame_index;
+    pos = frame->sections_offset + frame->frame_dec->SumSectionSizes();
+    bool is_last = header.is_last;
+    frames.push_back(std::move(frame));
+    if (is_last) break;
+  }
+  if (frames.size() < 2) return JXL_DEC_SUCCESS;
+
+  std::atomic<bool> has_error{false};
+  const auto decode_frame = [&](const uint32_t i, size_t /* thread */) {
+    if (!DecodePrefetchedFrame(span.data(), frames[i].get())) {
+      has_error = true;
+    }
+  };
+  if (!RunOnPool(dec->thread_pool.get(), 0, frames.size(),
+                 ThreadPool::NoInit, decode_frame, "DecodeFrames") ||
+      has_error) {
+    return JXL_DEC_SUCCESS;
+  }
+  dec->prefetched_frames = std::move(frames);
+  return JXL_DEC_SUCCESS;
+}
+
+// Jumps ahead to the last keyframe of the frame index box that is not after
+// the frame being skipped to, since no frames before a keyframe are needed to
+// decode it. The frame indices of the index box count the frames with
+// coalescing, so it is not used without.
+void SeekWithFrameIndex(JxlDecoder* dec) {
+  if (!dec->coalescing || dec->codestream_bits_ahead != 0) return;
+  const size_t target = dec->external_frames + dec->skip_frames;
+  bool found = false;
+  uint64_t seek_offset = 0;
+  size_t seek_frame = 0;
+  uint64_t offset = 0;
+  uint64_t frame = 0;
+  for (const auto& entry : dec->frame_index_box.entries) {
+    offset += entry.OFFi;
+    if (frame > target) break;
+    if (frame >= dec->external_frames && offset > dec->codestream_offset) {
+      found = true;
+      seek_offset = offset;
+      seek_frame = frame;
+    }
+    frame += entry.Fi;
+  }
+  if (!found) return;
+  dec->AdvanceCodestream(seek_offset - dec->codestream_offset);
+  dec->skip_frames = target - seek_frame;
+  dec->external_frames = seek_frame;
+  dec->passes_state->visible_frame_index = seek_frame;
+  dec->passes_state->nonvisible_frame_index = 0;
+  dec->frame_index_jumped = true;
+}
+
+// Whether the next frame starts at a keyframe of the frame index box. Like
+// SeekWithFrameIndex, this relies on the frames from a keyframe on not reading
+// any frame before it.
+bool AtKeyframe(const JxlDecoder* dec) {
+  if (dec->codestream_bits_ahead != 0) return false;
+  uint64_t offset = 0;
+  for (const auto& entry : dec->frame_index_box.entries) {
+    offset += entry.OFFi;
+    if (offset == dec->codestream_offset) return true;
+    if (offset > dec->codestream_offset) break;
+  }
+  return false;
+}
+
+// Drops the reference frames and DC frames that no frame after the current one
+// reads: all of them after the last frame, otherwise the slots that the known
+// later frames overwrite first, for example when decoding again after a rewind.
+void ReleaseDeadReferences(JxlDecoder* dec) {
+  const size_t index = dec->internal_frames - 1;
+  int live = 0xff;
+  if (dec->is_last_total) {
+    live = 0;
+  } else if (!dec->frame_index_jumped && index < dec->frame_saved_as.size()) {
+    live = LiveStorageSlots(index, dec->frame_saved_as, dec->frame_references);
+  }
+  dec->passes_state->ReleaseReferences(0xff & ~live);
+}
+
+// Outputs the current frame, which was decoded by PrefetchFrames, and applies
+// the changes decoding it made to the decoder state.
+JxlDecoderStatus OutputPrefetchedFrame(JxlDecoder* dec) {
+  if (!dec->image_out_buffer_set && dec->is_last_of_still &&
+      !dec->skipping_frame) {
+    return JXL_DEC_NEED_IMAGE_OUT_BUFFER;
+  }
+  PrefetchedFrame& frame = *dec->prefetched_frame;
+  dec->AdvanceCodestream(dec->remaining_frame_size);
+  dec->remaining_frame_size = 0;
+  if (!dec->frame_index_jumped) {
+    dec->frame_references[dec->internal_frames - 1] = frame.references;
+  }
+  const FrameHeader& header = *dec->frame_header;
+  PassesDecoderState* dec_state = dec->passes_state.get();
+  if (header.CanBeReferenced()) {
+    dec_state->shared_storage.reference_frames[header.save_as_reference] =
+        std::move(frame.dec_state->shared_storage
+                      .reference_frames[header.save_as_reference]);
+  }
+  dec_state->visible_frame_index = frame.dec_state->visible_frame_index;
+  dec_state->nonvisible_frame_index = frame.dec_state->nonvisible_frame_index;
+  ReleaseDeadReferences(dec);
+  AddFrameStats(dec, *frame.frame_dec);
+  if (dec->is_last_of_still) {
+    if (dec->image_out_buffer_set) {
+      JXL_API_RETURN_IF_ERROR(WriteImageOutput(dec, *dec->ib));
+    }
+    dec->image_out_buffer_set = false;
+    dec->extra_channel_output.clear();
+  }
+  dec->prefetched_frame.reset();
+  return JXL_DEC_SUCCESS;
+}
+
+static JxlDecoderStatus ParseBoxHeader(const uint8_t* in, size_t size,
+                                       size_t pos, size_t file_pos,
+                                       JxlBoxType type, uint64_t* box_size,
+                                       uint64_t* header_size);
+
+// Lists the parts of the codestream in the persistent input. A box cut off
+// by the end of the input ends the list.
+void FindCodestreamChunks(JxlDecoder* dec) {
+  dec->codestream_chunks_found = true;
+  dec->codestream_chunks.clear();
+  const uint8_t* in = dec->persistent_in;
+  const size_t size = dec->persistent_in_size;
+  if (!dec->have_container) {
+    dec->codestream_chunks.push_back({0, in, size});
+    return;
+  }
+  uint64_t offset = 0;
+  size_t pos = 0;
+  while (pos < size) {
+    JxlBoxType type;
+    uint64_t box_size;
+    uint64_t header_size;
+    if (ParseBoxHeader(in, size, pos, pos, type, &box_size, &header_size) !=
+        JXL_DEC_SUCCESS) {
+      break;
+    }
+    const bool last = box_size == 0 || OutOfBounds(pos, box_size, size);
+    const size_t end = last ? size : pos + box_size;
+    size_t begin = pos + header_size;
+    if (memcmp(type, "jxlp", 4) == 0) begin += 4;
+    if ((memcmp(type, "jxlc", 4) == 0 || memcmp(type, "jxlp", 4) == 0) &&
+        begin < end) {
+      dec->codestream_chunks.push_back({offset, in + begin, end - begin});
+      offset += end - begin;
+    }
+    if (last) break;
+    pos = end;
+  }
+}
+
+// Returns in section the codestream bytes at the offset, in place if they are
+// in one chunk, otherwise copied to storage. Returns false if the codestream
+// ends before.
+bool GetCodestreamSection(const JxlDecoder* dec, uint64_t offset, size_t size,
+                          std::vector<uint8_t>* storage,
+                          Span<const uint8_t>* section) {
+  const std::vector<CodestreamChunk>& chunks = dec->codestream_chunks;
+  auto it = std::upper_bound(chunks.begin(), chunks.end(), offset,
+                             [](uint64_t offset, const CodestreamChunk& chunk) {
+                               return offset < chunk.offset;
+                             });
+  if (it == chunks.begin()) return false;
+  --it;
+  if (offset + size <= it->offset + it->size) {
+    *section = Span<const uint8_t>(it->data + (offset - it->offset), size);
+    return true;
+  }
+  storage->clear();
+  for (; it != chunks.end() && storage->size() < size; ++it) {
+    size_t begin = offset + storage->size() - it->offset;
+    size_t copy = std::min(size - storage->size(), it->size - begin);
+    storage->insert(storage->end(), it->data + begin, it->data + begin + copy);
+  }
+  if (storage->size() < size) return false;
+  *section = Span<const uint8_t>(storage->data(), size);
+  return true;
+}
+
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+// Copies the Exif and XMP boxes into the app markers of the reconstructed JPEG.
+JxlDecoderStatus SetJpegReconMetadata(JxlDecoder* dec) {
+  jxl::jpeg::JPEGData* jpeg_data = dec->ib->jpeg_data.get();
+  if (dec->recon_exif_size) {
+    JxlDecoderStatus status = jxl::JxlToJpegDecoder::SetExif(
+        dec->exif_metadata.data(), dec->exif_metadata.size(), jpeg_data);
+    if (status != JXL_DEC_SUCCESS) return status;
+  }
+  if (dec->recon_xmp_size) {
+    JxlDecoderStatus status = jxl::JxlToJpegDecoder::SetXmp(
+        dec->xmp_metadata.data(), dec->xmp_metadata.size(), jpeg_data);
+    if (status != JXL_DEC_SUCCESS) return status;
+  }
+  return JXL_DEC_SUCCESS;
+}
+#endif
+
+// Passes the current priority region to the frame decoder, which may have
+// changed since the previous sections.
+void SetFramePriorityRegion(JxlDecoder* dec) {
+  dec->frame_dec->SetPriorityRegion(
+      dec->preview_frame
+          ? jxl::Rect()
+          : jxl::Rect(dec->priority_x0, dec->priority_y0, dec->priority_xsize,
+                      dec->priority_ysize));
+}
+
+JxlDecoderStatus JxlDecoderProcessSections(JxlDecoder* dec) {
+  // The last sections may have been skipped with JxlDecoderSkipInput.
+  if (dec->next_section == dec->frame_dec->Toc().size()) {
+    return JXL_DEC_SUCCESS;
+  }
+  Span<const uint8_t> span;
+  // With persistent input all sections are read in place, rather than only
+  // those in the current box, and only a section that continues in the next
+  // box is copied.
+  const bool in_place = dec->InputInPlace();
+  if (in_place) {
+    if (!dec->codestream_chunks_found) FindCodestreamChunks(dec);
+  } else {
+    JXL_API_RETURN_IF_ERROR(dec->GetCodestreamInput(&span));
+  }
   const auto& toc = dec->frame_dec->Toc();
   size_t pos = 0;
   std::vector<jxl::FrameDecoder::SectionInfo> section_info;
   std::vector<jxl::FrameDecoder::SectionStatus> section_status;
+  std::vector<std::vector<uint8_t>> section_copies;
   for (size_t i = dec->next_section; i < toc.size(); ++i) {
     if (dec->section_processed[i]) continue;
     size_t id = toc[i].id;
     size_t size = toc[i].size;
-    if (OutOfBounds(pos, size, span.size())) {
-      break;
+    Span<const uint8_t> section;
+    if (in_place) {
+      std::vector<uint8_t> copy;
+      if (!GetCodestreamSection(dec, dec->codestream_offset + pos, size, &copy,
+                                &section)) {
+        break;
+      }
+      // The copied bytes do not move with the vector.
+      if (!copy.empty()) section_copies.push_back(std::move(copy));
+    } else {
+      if (OutOfBounds(pos, size, span.size())) {
+        break;
+      }
+      section = Span<const uint8_t>(span.data() + pos, size);
     }
-    auto br =
-        new jxl::BitReader(jxl::Span<const uint8_t>(span.data() + pos, size));
+    // Sections other than the last one in the input can be refilled from the
+    // bytes that follow them without bounds checks.
+    auto br = in_place ? new jxl::BitReader(section)
+                       : new jxl::BitReader(section, span.size() - pos);
     section_info.emplace_back(jxl::FrameDecoder::SectionInfo{br, id});
     section_status.emplace_back();
     pos += size;
   }
+  SetFramePriorityRegion(dec);
   jxl::Status status = dec->frame_dec->ProcessSections(
       section_info.data(), section_info.size(), section_status.data());
   bool out_of_bounds = false;
@@ -1246,23 +2033,43 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       if (!dec->jpeg_decoder.SetImageBundleJpegData(dec->ib.get()))
         return JXL_DEC_ERROR;
 #endif
-      dec->frame_dec.reset(new FrameDecoder(
-          dec->passes_state.get(), dec->metadata, dec->thread_pool.get(),
-          /*use_slow_rendering_pipeline=*/false));
+      if (dec->skip_frames > 0) {
+        dec->prefetched_frames.clear();
+        if (!dec->preview_frame) SeekWithFrameIndex(dec);
+      }
+      if (!dec->preview_frame && dec->prefetched_frames.empty()) {
+        // Before PrefetchFrames copies them.
+        if (AtKeyframe(dec)) dec->passes_state->ReleaseReferences(0xff);
+        if (dec->skip_frames == 0) {
+          JXL_API_RETURN_IF_ERROR(PrefetchFrames(dec));
+        }
+      }
       dec->frame_header.reset(new FrameHeader(&dec->metadata));
-      Span<const uint8_t> span;
-      JXL_API_RETURN_IF_ERROR(dec->GetCodestreamInput(&span));
-      auto reader = GetBitReader(span);
-      jxl::Status status = dec->frame_dec->InitFrame(
-          reader.get(), dec->ib.get(), dec->preview_frame);
-      if (!reader->AllReadsWithinBounds() ||
-          status.code() == StatusCode::kNotEnoughBytes) {
-        return dec->RequestMoreInput();
-      } else if (!status) {
-        return JXL_API_ERROR("invalid frame header");
+      if (!dec->preview_frame && !dec->prefetched_frames.empty()) {
+        dec->prefetched_frame = std::move(dec->prefetched_frames.front());
+        dec->prefetched_frames.pop_front();
+        dec->frame_dec.reset();
+        dec->ib = std::move(dec->prefetched_frame->ib);
+        dec->AdvanceCodestream(dec->prefetched_frame->header_size);
+        *dec->frame_header = dec->prefetched_frame->frame_dec->GetFrameHeader();
+      } else {
+        dec->frame_dec.reset(new FrameDecoder(
+            dec->passes_state.get(), dec->metadata, dec->thread_pool.get(),
+            /*use_slow_rendering_pipeline=*/false));
+        Span<const uint8_t> span;
+        JXL_API_RETURN_IF_ERROR(dec->GetCodestreamInput(&span));
+        auto reader = GetBitReader(span);
+        jxl::Status status = dec->frame_dec->InitFrame(
+            reader.get(), dec->ib.get(), dec->preview_frame);
+        if (!reader->AllReadsWithinBounds() ||
+            status.code() == StatusCode::kNotEnoughBytes) {
+          return dec->RequestMoreInput();
+        } else if (!status) {
+          return JXL_API_ERROR("invalid frame header");
+        }
+        dec->AdvanceCodestream(reader->TotalBitsConsumed() / kBitsPerByte);
+        *dec->frame_header = dec->frame_dec->GetFrameHeader();
       }
-      dec->AdvanceCodestream(reader->TotalBitsConsumed() / kBitsPerByte);
-      *dec->frame_header = dec->frame_dec->GetFrameHeader();
       jxl::FrameDimensions frame_dim = dec->frame_header->ToFrameDimensions();
       if (!CheckSizeLimit(dec, frame_dim.xsize_upsampled_padded,
                           frame_dim.ysize_upsampled_padded)) {
@@ -1271,7 +2078,7 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       bool output_needed =
           (dec->preview_frame ? (dec->events_wanted & JXL_DEC_PREVIEW_IMAGE)
                               : (dec->events_wanted & JXL_DEC_FULL_IMAGE));
-      if (output_needed) {
+      if (output_needed && !dec->prefetched_frame) {
         JXL_API_RETURN_IF_ERROR(dec->frame_dec->InitFrameOutput());
       }
       if (dec->cpu_limit_base != 0) {
@@ -1285,7 +2092,10 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
           return JXL_API_ERROR("used too much CPU");
         }
       }
-      dec->remaining_frame_size = dec->frame_dec->SumSectionSizes();
+      dec->remaining_frame_size =
+          dec->prefetched_frame
+              ? dec->prefetched_frame->frame_dec->SumSectionSizes()
+              : dec->frame_dec->SumSectionSizes();
 
       dec->frame_stage = FrameStage::kTOC;
       if (dec->preview_frame) {
@@ -1322,13 +2132,15 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         dec->skipping_frame = false;
       }
 
-      if (external_frame_index >= dec->frame_external_to_internal.size()) {
+      if (!dec->frame_index_jumped &&
+          external_frame_index >= dec->frame_external_to_internal.size()) {
         dec->frame_external_to_internal.push_back(internal_frame_index);
         JXL_ASSERT(dec->frame_external_to_internal.size() ==
                    external_frame_index + 1);
       }
 
-      if (internal_frame_index >= dec->frame_saved_as.size()) {
+      if (!dec->frame_index_jumped &&
+          internal_frame_index >= dec->frame_saved_as.size()) {
         dec->frame_saved_as.push_back(saved_as);
         JXL_ASSERT(dec->frame_saved_as.size() == internal_frame_index + 1);
 
@@ -1347,7 +2159,8 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         bool referenceable =
             dec->frame_header->CanBeReferenced() ||
             dec->frame_header->frame_type == FrameType::kDCFrame;
-        if (internal_frame_index < dec->frame_required.size() &&
+        if (!dec->frame_index_jumped &&
+            internal_frame_index < dec->frame_required.size() &&
             !dec->frame_required[internal_frame_index]) {
           referenceable = false;
         }
@@ -1370,9 +2183,24 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       }
     }
 
+    if (dec->frame_stage == FrameStage::kTOC && dec->prefetched_frame) {
+      dec->frame_stage = FrameStage::kFull;
+    }
+
     if (dec->frame_stage == FrameStage::kTOC) {
       dec->frame_dec->SetRenderSpotcolors(dec->render_spotcolors);
+      dec->frame_dec->SetFastIDCT(dec->fast_idct);
       dec->frame_dec->SetCoalescing(dec->coalescing);
+      dec->frame_dec->SetCollectRenderStats(dec->collect_render_stats);
+      dec->frame_dec->SetCropRegion(
+          dec->preview_frame ? jxl::Rect()
+                             : jxl::Rect(dec->crop_x0, dec->crop_y0,
+                                         dec->crop_xsize, dec->crop_ysize));
+      dec->frame_dec->SetOutputDownsampling(
+          OutputIsDownsampled(dec) ? dec->output_downsampling : 1);
+      dec->frame_dec->SetDecodedExtraChannels(
+          dec->preview_frame ? std::vector<bool>()
+                             : dec->decoded_extra_channels);
 
       if (!dec->preview_frame &&
           (dec->events_wanted & JXL_DEC_FRAME_PROGRESSION)) {
@@ -1399,7 +2227,10 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       }
     }
 
-    if (dec->frame_stage == FrameStage::kFull) {
+    if (dec->frame_stage == FrameStage::kFull && dec->prefetched_frame) {
+      JxlDecoderStatus status = OutputPrefetchedFrame(dec);
+      if (status != JXL_DEC_SUCCESS) return status;
+    } else if (dec->frame_stage == FrameStage::kFull) {
       if (!dec->image_out_buffer_set) {
         if (dec->preview_frame) {
           return JXL_DEC_NEED_PREVIEW_OUT_BUFFER;
@@ -1417,18 +2248,20 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         }
       }
 
-      if (dec->image_out_buffer_set) {
+      if (dec->image_out_buffer_set && !OutputIsDownsampled(dec)) {
         size_t xsize, ysize;
         GetCurrentDimensions(dec, xsize, ysize);
         size_t bits_per_sample = GetBitDepth(
             dec->image_out_bit_depth, dec->metadata.m, dec->image_out_format);
         dec->frame_dec->SetImageOutput(
-            PixelCallback{
-                dec->image_out_init_callback, dec->image_out_run_callback,
-                dec->image_out_destroy_callback, dec->image_out_init_opaque},
+            ImageOutCallback(dec),
             reinterpret_cast<uint8_t*>(dec->image_out_buffer),
             dec->image_out_size, xsize, ysize, dec->image_out_format,
             bits_per_sample, dec->unpremul_alpha, !dec->keep_orientation);
+        if (!dec->preview_frame && !dec->image_out_planes.empty()) {
+          dec->frame_dec->SetImageOutputPlanes(dec->image_out_plane_layout,
+                                               dec->image_out_planes);
+        }
         for (size_t i = 0; i < dec->extra_channel_output.size(); ++i) {
           const auto& extra = dec->extra_channel_output[i];
           size_t ec_bits_per_sample =
@@ -1466,12 +2299,32 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         return JXL_DEC_FRAME_PROGRESSION;
       }
 
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+      // The rows of a single scan JPEG are written as soon as their groups are
+      // decoded, if the metadata of its app markers is already known.
+      if (!all_sections_done && dec->jpeg_decoder.IsOutputSet() &&
+          dec->ib->jpeg_data != nullptr &&
+          JxlToJpegDecoder::CanWriteRows(*dec->ib->jpeg_data) &&
+          !dec->JbrdNeedMoreBoxes()) {
+        const size_t num_rows = dec->frame_dec->NumCompleteRows();
+        if (num_rows > 0) {
+          if (!dec->jpeg_decoder.IsWritingRows()) {
+            JxlDecoderStatus status = SetJpegReconMetadata(dec);
+            if (status != JXL_DEC_SUCCESS) return status;
+          }
+          JxlDecoderStatus status =
+              dec->jpeg_decoder.WriteRows(*dec->ib->jpeg_data, num_rows);
+          if (status != JXL_DEC_SUCCESS) return status;
+        }
+      }
+#endif
+
       if (!all_sections_done) {
         // Not all sections have been processed yet
         return dec->RequestMoreInput();
       }
 
-      if (!dec->preview_frame) {
+      if (!dec->preview_frame && !dec->frame_index_jumped) {
         size_t internal_index = dec->internal_frames - 1;
         JXL_ASSERT(dec->frame_references.size() > internal_index);
         // Always fill this in, even if it was already written, it could be that
@@ -1483,6 +2336,8 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       if (!dec->frame_dec->FinalizeFrame()) {
         return JXL_API_ERROR("decoding frame failed");
       }
+      if (!dec->preview_frame) ReleaseDeadReferences(dec);
+      AddFrameStats(dec, *dec->frame_dec);
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
       // If jpeg output was requested, we merely return the JXL_DEC_FULL_IMAGE
       // status without outputting pixels.
@@ -1493,6 +2348,9 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       }
 #endif
       if (dec->preview_frame || dec->is_last_of_still) {
+        if (dec->image_out_buffer_set && OutputIsDownsampled(dec)) {
+          JXL_API_RETURN_IF_ERROR(WriteDownsampledOutput(dec));
+        }
         dec->image_out_buffer_set = false;
         dec->extra_channel_output.clear();
       }
@@ -1534,6 +2392,17 @@ JxlDecoderStatus JxlDecoderSetInput(JxlDecoder* dec, const uint8_t* data,
 
   dec->next_in = data;
   dec->avail_in = size;
+  if (dec->persistent_input && dec->file_pos == 0) {
+    dec->persistent_in = data;
+    dec->persistent_in_size = size;
+  } else if (dec->persistent_in &&
+             (dec->file_pos > dec->persistent_in_size ||
+              data != dec->persistent_in + dec->file_pos)) {
+    // Not the buffer given at the beginning of the file.
+    dec->persistent_in = nullptr;
+    dec->codestream_chunks.clear();
+    dec->codestream_chunks_found = false;
+  }
   return JXL_DEC_SUCCESS;
 }
 
@@ -1546,6 +2415,46 @@ size_t JxlDecoderReleaseInput(JxlDecoder* dec) {
 
 void JxlDecoderCloseInput(JxlDecoder* dec) { dec->input_closed = true; }
 
+JxlDecoderStatus JxlDecoderGetSkippableInput(const JxlDecoder* dec,
+                                             uint64_t* size) {
+  if (dec->next_in) {
+    return JXL_API_ERROR("must release the input first");
+  }
+  *size = dec->SkippableInput();
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSkipInput(JxlDecoder* dec, uint64_t size) {
+  if (dec->next_in) {
+    return JXL_API_ERROR("must release the input first");
+  }
+  if (size > dec->SkippableInput()) {
+    return JXL_API_ERROR("cannot skip input that is needed");
+  }
+  if (dec->box_stage == BoxStage::kCodestream) {
+    if (dec->codestream_pos == 0 && size != 0) dec->SkipFrameSections(size);
+    dec->codestream_pos -= size;
+  }
+  dec->file_pos += size;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderGetNeededInput(const JxlDecoder* dec,
+                                          uint64_t* size) {
+  if (dec->next_in) {
+    return JXL_API_ERROR("must release the input first");
+  }
+  *size = 0;
+  std::vector<uint8_t> skippable;
+  bool known;
+  if (dec->SkippableInput() == 0 &&
+      dec->FindSkippableSections(&skippable, &known) && !skippable.empty()) {
+    *size = known ? dec->LeadingSectionsSize(skippable, 0)
+                  : dec->frame_dec->Toc()[dec->next_section].size;
+  }
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderSetJPEGBuffer(JxlDecoder* dec, uint8_t* data,
                                          size_t size) {
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
@@ -1572,6 +2481,31 @@ size_t JxlDecoderReleaseJPEGBuffer(JxlDecoder* dec) {
 #endif
 }
 
+// Parses the contents of a frame index box into box. Returns false if they
+// are invalid.
+static bool ParseFrameIndexBox(const uint8_t* in, size_t size,
+                               jxl::JxlDecoderFrameIndexBox* box) {
+  box->entries.clear();
+  size_t pos = 0;
+  uint64_t num_frames = jxl::DecodeVarInt(in, size, &pos);
+  if (pos + 8 > size) return false;
+  box->TNUM = LoadBE32(in + pos);
+  box->TDEN = LoadBE32(in + pos + 4);
+  pos += 8;
+  for (uint64_t i = 0; i < num_frames; ++i) {
+    // Every entry takes at least 3 bytes.
+    if (pos + 3 > size) return false;
+    uint64_t offset = jxl::DecodeVarInt(in, size, &pos);
+    uint64_t duration = jxl::DecodeVarInt(in, size, &pos);
+    uint64_t frames = jxl::DecodeVarInt(in, size, &pos);
+    if (pos > size || duration > 0xFFFFFFFFu || frames > 0xFFFFFFFFu) {
+      return false;
+    }
+    box->AddFrame(offset, duration, frames);
+  }
+  return true;
+}
+
 // Parses the header of the box, outputting the 4-character type and the box
 // size, including header size, as stored in the box header.
 // @param in current input bytes.
@@ -1690,24 +2624,16 @@ static JxlDecoderStatus HandleBoxes(JxlDecoder* dec) {
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
     if (dec->recon_output_jpeg == JpegReconStage::kSettingMetadata &&
         !dec->JbrdNeedMoreBoxes()) {
-      jxl::jpeg::JPEGData* jpeg_data = dec->ib->jpeg_data.get();
-      if (dec->recon_exif_size) {
-        JxlDecoderStatus status = jxl::JxlToJpegDecoder::SetExif(
-            dec->exif_metadata.data(), dec->exif_metadata.size(), jpeg_data);
-        if (status != JXL_DEC_SUCCESS) return status;
-      }
-      if (dec->recon_xmp_size) {
-        JxlDecoderStatus status = jxl::JxlToJpegDecoder::SetXmp(
-            dec->xmp_metadata.data(), dec->xmp_metadata.size(), jpeg_data);
-        if (status != JXL_DEC_SUCCESS) return status;
-      }
+      JxlDecoderStatus status = jxl::SetJpegReconMetadata(dec);
+      if (status != JXL_DEC_SUCCESS) return status;
       dec->recon_output_jpeg = JpegReconStage::kOutputting;
     }
 
     if (dec->recon_output_jpeg == JpegReconStage::kOutputting &&
         !dec->JbrdNeedMoreBoxes()) {
       JxlDecoderStatus status =
-          dec->jpeg_decoder.WriteOutput(*dec->ib->jpeg_data);
+          dec->jpeg_decoder.WriteOutput(*dec->ib->jpeg_data,
+                                        dec->thread_pool.get());
       if (status != JXL_DEC_SUCCESS) return status;
       dec->recon_output_jpeg = JpegReconStage::kFinished;
       dec->ib.reset();
@@ -1902,6 +2828,7 @@ static JxlDecoderStatus HandleBoxes(JxlDecoder* dec) {
       dec->AdvanceInput(4);
       dec->box_stage = BoxStage::kCodestream;
     } else if (dec->box_stage == BoxStage::kCodestream) {
+      size_t file_pos = dec->file_pos;
       JxlDecoderStatus status = jxl::JxlDecoderProcessCodestream(dec);
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
       if (status == JXL_DEC_FULL_IMAGE) {
@@ -1916,6 +2843,11 @@ static JxlDecoderStatus HandleBoxes(JxlDecoder* dec) {
           dec->box_stage = BoxStage::kHeader;
           continue;
         }
+        if (dec->InputInPlace() && dec->file_pos != file_pos &&
+            dec->AvailableCodestream() > 0) {
+          // Only part of the available input was copied, retry with more.
+          continue;
+        }
       }
 
       if (status == JXL_DEC_SUCCESS) {
@@ -2009,10 +2941,23 @@ static JxlDecoderStatus HandleBoxes(JxlDecoder* dec) {
         // Indicate how many more bytes needed starting from next_in.
         dec->basic_info_size_hint =
             InitialBasicInfoSizeHint() + dec->box_contents_end - dec->file_pos;
+        if (memcmp(dec->box_type, "jxli", 4) == 0 &&
+            dec->file_pos == dec->box_contents_begin) {
+          // Keep the frame index box in the input until it is complete.
+          return JXL_DEC_NEED_MORE_INPUT;
+        }
         // Don't have the full box yet, skip all we have so far
         dec->AdvanceInput(dec->avail_in);
         return JXL_DEC_NEED_MORE_INPUT;
       } else {
+        if (memcmp(dec->box_type, "jxli", 4) == 0 &&
+            dec->file_pos == dec->box_contents_begin &&
+            !ParseFrameIndexBox(dec->next_in, remaining,
+                                &dec->frame_index_box)) {
+          // The index is only used for seeking, other than that an invalid
+          // index does not prevent decoding.
+          dec->frame_index_box.entries.clear();
+        }
         // Full box available, skip all its remaining bytes
         dec->AdvanceInput(remaining);
         dec->box_stage = BoxStage::kHeader;
@@ -2024,7 +2969,24 @@ static JxlDecoderStatus HandleBoxes(JxlDecoder* dec) {
   return JXL_DEC_SUCCESS;
 }
 
+namespace {
+
+// Memory manager for the image buffers allocated by the decoder.
+const JxlMemoryManager* ImageMemoryManager(const JxlDecoder* dec) {
+  if (dec->use_frame_arena) return dec->frame_arena->memory_manager();
+  if (dec->max_image_buffer_pool_bytes != 0) {
+    return dec->image_buffer_pool->memory_manager();
+  }
+  return &dec->memory_manager;
+}
+
+}  // namespace
+
 JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
+  jxl::CacheAligned::ScopedMemoryManager memory_scope(
+      ImageMemoryManager(dec));
+  jxl::CacheAligned::ScopedHugePages huge_pages_scope(dec->huge_pages);
+  jxl::CacheAligned::ScopedStats stats_scope(&dec->allocation_stats);
   if (dec->stage == DecoderStage::kInited) {
     dec->stage = DecoderStage::kStarted;
   }
@@ -2324,10 +3286,18 @@ size_t JxlDecoderGetIntendedDownsamplingRatio(JxlDecoder* dec) {
 }
 
 JxlDecoderStatus JxlDecoderFlushImage(JxlDecoder* dec) {
+  jxl::CacheAligned::ScopedMemoryManager memory_scope(
+      ImageMemoryManager(dec));
+  jxl::CacheAligned::ScopedHugePages huge_pages_scope(dec->huge_pages);
+  jxl::CacheAligned::ScopedStats stats_scope(&dec->allocation_stats);
   if (!dec->image_out_buffer_set) return JXL_DEC_ERROR;
   if (dec->frame_stage != FrameStage::kFull) {
     return JXL_DEC_ERROR;
   }
+  if (dec->prefetched_frame) {
+    // The frame is already fully decoded.
+    return jxl::WriteImageOutput(dec, *dec->ib);
+  }
   JXL_DASSERT(dec->frame_dec);
   if (!dec->frame_dec->HasDecodedDC()) {
     // FrameDecoder::Flush currently requires DC to have been decoded already
@@ -2335,9 +3305,13 @@ JxlDecoderStatus JxlDecoderFlushImage(JxlDecoder* dec) {
     return JXL_DEC_ERROR;
   }
 
+  jxl::SetFramePriorityRegion(dec);
   if (!dec->frame_dec->Flush()) {
     return JXL_DEC_ERROR;
   }
+  if (OutputIsDownsampled(dec)) {
+    return jxl::WriteDownsampledOutput(dec);
+  }
 
   return JXL_DEC_SUCCESS;
 }
@@ -2420,7 +3394,8 @@ JxlDecoderStatus JxlDecoderSetImageOutBuffer(JxlDecoder* dec,
   if (!dec->got_basic_info || !(dec->orig_events_wanted & JXL_DEC_FULL_IMAGE)) {
     return JXL_API_ERROR("No image out buffer needed at this time");
   }
-  if (dec->image_out_buffer_set && !!dec->image_out_run_callback) {
+  if (dec->image_out_buffer_set &&
+      (dec->image_out_run_callback || dec->image_out_rect_callback)) {
     return JXL_API_ERROR(
         "Cannot change from image out callback to image out buffer");
   }
@@ -2441,6 +3416,89 @@ JxlDecoderStatus JxlDecoderSetImageOutBuffer(JxlDecoder* dec,
   dec->image_out_buffer = buffer;
   dec->image_out_size = size;
   dec->image_out_format = *format;
+  dec->image_out_planes.clear();
+
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetImageOutPlanes(JxlDecoder* dec,
+                                             JxlPlaneLayout layout,
+                                             const JxlPixelFormat* format,
+                                             const JxlImageOutPlane* planes,
+                                             size_t num_planes) {
+  if (!dec->got_basic_info || !(dec->orig_events_wanted & JXL_DEC_FULL_IMAGE)) {
+    return JXL_API_ERROR("No image out buffer needed at this time");
+  }
+  if (dec->image_out_buffer_set &&
+      (dec->image_out_run_callback || dec->image_out_rect_callback)) {
+    return JXL_API_ERROR(
+        "Cannot change from image out callback to image out planes");
+  }
+  if (dec->output_downsampling != 1) {
+    return JXL_API_ERROR("No image out planes with output downsampling");
+  }
+  if (dec->max_parallel_frames > 1) {
+    return JXL_API_ERROR("No image out planes with parallel frames");
+  }
+  if (format->num_channels < 3 &&
+      !dec->image_metadata.color_encoding.IsGray()) {
+    return JXL_API_ERROR("Number of channels is too low for color output");
+  }
+  size_t bits;
+  JxlDecoderStatus status = PrepareSizeCheck(dec, format, &bits);
+  if (status != JXL_DEC_SUCCESS) return status;
+  size_t xsize, ysize;
+  GetCurrentDimensions(dec, xsize, ysize);
+  // Dimensions and samples per pixel of each plane.
+  std::vector<std::array<size_t, 3>> plane_sizes;
+  if (layout == JXL_PLANES_CHANNELS) {
+    for (size_t c = 0; c < format->num_channels; c++) {
+      plane_sizes.push_back({xsize, ysize, 1});
+    }
+  } else if (layout == JXL_PLANES_YCBCR_BT601_I420 ||
+             layout == JXL_PLANES_YCBCR_BT709_I420 ||
+             layout == JXL_PLANES_YCBCR_BT601_NV12 ||
+             layout == JXL_PLANES_YCBCR_BT709_NV12) {
+    if (format->num_channels != 3 || format->data_type != JXL_TYPE_UINT8) {
+      return JXL_API_ERROR("Y'CbCr output requires 3 channels of uint8");
+    }
+    if (!dec->keep_orientation &&
+        dec->metadata.m.GetOrientation() != jxl::Orientation::kIdentity) {
+      return JXL_API_ERROR("Y'CbCr output cannot undo the orientation");
+    }
+    size_t chroma_xsize = jxl::DivCeil(xsize, 2);
+    size_t chroma_ysize = jxl::DivCeil(ysize, 2);
+    plane_sizes.push_back({xsize, ysize, 1});
+    if (layout == JXL_PLANES_YCBCR_BT601_NV12 ||
+        layout == JXL_PLANES_YCBCR_BT709_NV12) {
+      plane_sizes.push_back({chroma_xsize, chroma_ysize, 2});
+    } else {
+      plane_sizes.push_back({chroma_xsize, chroma_ysize, 1});
+      plane_sizes.push_back({chroma_xsize, chroma_ysize, 1});
+    }
+  } else {
+    return JXL_API_ERROR("Invalid plane layout");
+  }
+  if (num_planes != plane_sizes.size()) {
+    return JXL_API_ERROR("Wrong number of planes for the layout");
+  }
+  for (size_t i = 0; i < num_planes; i++) {
+    const JxlImageOutPlane& plane = planes[i];
+    size_t row_size = jxl::DivCeil(
+        plane_sizes[i][0] * plane_sizes[i][2] * bits, jxl::kBitsPerByte);
+    if (!plane.buffer || plane.stride < row_size ||
+        plane.size < plane.stride * (plane_sizes[i][1] - 1) + row_size) {
+      return JXL_API_ERROR("Image out plane %u is too small",
+                           static_cast<uint32_t>(i));
+    }
+  }
+
+  dec->image_out_buffer_set = true;
+  dec->image_out_buffer = nullptr;
+  dec->image_out_size = 0;
+  dec->image_out_format = *format;
+  dec->image_out_planes.assign(planes, planes + num_planes);
+  dec->image_out_plane_layout = layout;
 
   return JXL_DEC_SUCCESS;
 }
@@ -2479,6 +3537,9 @@ JxlDecoderStatus JxlDecoderSetExtraChannelBuffer(JxlDecoder* dec,
                                                  const JxlPixelFormat* format,
                                                  void* buffer, size_t size,
                                                  uint32_t index) {
+  if (dec->output_downsampling != 1) {
+    return JXL_API_ERROR("No extra channel buffers with output downsampling");
+  }
   size_t min_size;
   // This also checks whether the format and index are valid and supported and
   // basic info is available.
@@ -2488,6 +3549,11 @@ JxlDecoderStatus JxlDecoderSetExtraChannelBuffer(JxlDecoder* dec,
 
   if (size < min_size) return JXL_DEC_ERROR;
 
+  if (!dec->decoded_extra_channels.empty() &&
+      !dec->decoded_extra_channels[index]) {
+    return JXL_API_ERROR("Extra channel %u is not decoded", index);
+  }
+
   if (dec->extra_channel_output.size() <= index) {
     dec->extra_channel_output.resize(dec->metadata.m.num_extra_channels,
                                      {{}, nullptr, 0});
@@ -2532,7 +3598,8 @@ JxlDecoderStatus JxlDecoderSetMultithreadedImageOutCallback(
     JxlDecoder* dec, const JxlPixelFormat* format,
     JxlImageOutInitCallback init_callback, JxlImageOutRunCallback run_callback,
     JxlImageOutDestroyCallback destroy_callback, void* init_opaque) {
-  if (dec->image_out_buffer_set && !!dec->image_out_buffer) {
+  if (dec->image_out_buffer_set &&
+      (!!dec->image_out_buffer || !dec->image_out_planes.empty())) {
     return JXL_API_ERROR(
         "Cannot change from image out buffer to image out callback");
   }
@@ -2552,6 +3619,41 @@ JxlDecoderStatus JxlDecoderSetMultithreadedImageOutCallback(
   dec->image_out_run_callback = run_callback;
   dec->image_out_destroy_callback = destroy_callback;
   dec->image_out_init_opaque = init_opaque;
+  dec->image_out_rect_callback = nullptr;
+  dec->image_out_format = *format;
+
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetImageOutRectCallback(
+    JxlDecoder* dec, const JxlPixelFormat* format, size_t max_rows,
+    JxlImageOutInitCallback init_callback, JxlImageOutRectCallback run_callback,
+    JxlImageOutDestroyCallback destroy_callback, void* init_opaque) {
+  if (dec->image_out_buffer_set &&
+      (!!dec->image_out_buffer || !dec->image_out_planes.empty())) {
+    return JXL_API_ERROR(
+        "Cannot change from image out buffer to image out callback");
+  }
+  if (init_callback == nullptr || run_callback == nullptr ||
+      destroy_callback == nullptr) {
+    return JXL_API_ERROR("All callbacks are required");
+  }
+  if (max_rows == 0) {
+    return JXL_API_ERROR("The rectangles must have at least one row");
+  }
+
+  // Perform error checking for invalid format.
+  size_t bits_dummy;
+  JxlDecoderStatus status = PrepareSizeCheck(dec, format, &bits_dummy);
+  if (status != JXL_DEC_SUCCESS) return status;
+
+  dec->image_out_buffer_set = true;
+  dec->image_out_init_callback = init_callback;
+  dec->image_out_run_callback = nullptr;
+  dec->image_out_destroy_callback = destroy_callback;
+  dec->image_out_init_opaque = init_opaque;
+  dec->image_out_rect_callback = run_callback;
+  dec->image_out_max_rows = max_rows;
   dec->image_out_format = *format;
 
   return JXL_DEC_SUCCESS;
@@ -2692,6 +3794,182 @@ JxlDecoderStatus JxlDecoderSetDesiredIntensityTarget(
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetCropRegion(JxlDecoder* dec, uint32_t x0,
+                                         uint32_t y0, uint32_t xsize,
+                                         uint32_t ysize) {
+  if (!dec->got_basic_info) {
+    return JXL_API_ERROR("Basic info not yet available");
+  }
+  if (!dec->coalescing) {
+    return JXL_API_ERROR("Crop region requires coalescing");
+  }
+  if (dec->image_out_buffer_set) {
+    return JXL_API_ERROR("Must set crop region before the image out buffer");
+  }
+  if ((xsize == 0) != (ysize == 0)) {
+    return JXL_API_ERROR("Crop region must be empty or have a non-zero size");
+  }
+  if (xsize != 0 && dec->output_downsampling != 1) {
+    return JXL_API_ERROR("Cannot set a crop region on a downsampled output");
+  }
+  size_t image_xsize = dec->metadata.oriented_xsize(dec->keep_orientation);
+  size_t image_ysize = dec->metadata.oriented_ysize(dec->keep_orientation);
+  if (static_cast<size_t>(x0) + xsize > image_xsize ||
+      static_cast<size_t>(y0) + ysize > image_ysize) {
+    return JXL_API_ERROR("Crop region outside of the image");
+  }
+  dec->crop_x0 = xsize == 0 ? 0 : x0;
+  dec->crop_y0 = ysize == 0 ? 0 : y0;
+  dec->crop_xsize = xsize;
+  dec->crop_ysize = ysize;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetPriorityRegion(JxlDecoder* dec, uint32_t x0,
+                                             uint32_t y0, uint32_t xsize,
+                                             uint32_t ysize) {
+  if (!dec->got_basic_info) {
+    return JXL_API_ERROR("Basic info not yet available");
+  }
+  if ((xsize == 0) != (ysize == 0)) {
+    return JXL_API_ERROR(
+        "Priority region must be empty or have a non-zero size");
+  }
+  size_t image_xsize = dec->metadata.oriented_xsize(dec->keep_orientation);
+  size_t image_ysize = dec->metadata.oriented_ysize(dec->keep_orientation);
+  if (static_cast<size_t>(x0) + xsize > image_xsize ||
+      static_cast<size_t>(y0) + ysize > image_ysize) {
+    return JXL_API_ERROR("Priority region outside of the image");
+  }
+  dec->priority_x0 = xsize == 0 ? 0 : x0;
+  dec->priority_y0 = ysize == 0 ? 0 : y0;
+  dec->priority_xsize = xsize;
+  dec->priority_ysize = ysize;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetOutputDownsampling(JxlDecoder* dec,
+                                                 uint32_t downsampling) {
+  if (dec->image_out_buffer_set) {
+    return JXL_API_ERROR(
+        "Must set output downsampling before the image out buffer");
+  }
+  if (downsampling != 1 && downsampling != 2 && downsampling != 4 &&
+      downsampling != 8) {
+    return JXL_API_ERROR("Invalid output downsampling %u", downsampling);
+  }
+  if (downsampling != 1 && dec->crop_xsize != 0) {
+    return JXL_API_ERROR("Cannot downsample the output of a crop region");
+  }
+  dec->output_downsampling = downsampling;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetDecodedExtraChannels(JxlDecoder* dec,
+                                                  const uint32_t* indices,
+                                                  size_t num_indices) {
+  if (!dec->got_basic_info) {
+    return JXL_API_ERROR("Basic info not yet available");
+  }
+  if (dec->image_out_buffer_set) {
+    return JXL_API_ERROR(
+        "Must set decoded extra channels before the image out buffer");
+  }
+  if (!indices) {
+    dec->decoded_extra_channels.clear();
+    return JXL_DEC_SUCCESS;
+  }
+  std::vector<bool> decoded(dec->metadata.m.num_extra_channels, false);
+  for (size_t i = 0; i < num_indices; i++) {
+    if (indices[i] >= decoded.size()) {
+      return JXL_API_ERROR("Invalid extra channel index %u", indices[i]);
+    }
+    decoded[indices[i]] = true;
+  }
+  for (size_t i = 0; i < dec->extra_channel_output.size(); i++) {
+    if (dec->extra_channel_output[i].buffer && !decoded[i]) {
+      return JXL_API_ERROR("Extra channel %u has a buffer, so is decoded",
+                           static_cast<uint32_t>(i));
+    }
+  }
+  dec->decoded_extra_channels = std::move(decoded);
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetParallelFrames(JxlDecoder* dec,
+                                             uint32_t max_frames) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set parallel frames before starting");
+  }
+  if (max_frames == 0) {
+    return JXL_API_ERROR("Invalid number of parallel frames");
+  }
+  dec->max_parallel_frames = max_frames;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetNestedParallelism(JxlDecoder* dec,
+                                                JXL_BOOL enabled) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set nested parallelism before starting");
+  }
+  dec->nested_parallelism = !!enabled;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetFrameArena(JxlDecoder* dec, JXL_BOOL enabled) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set frame arena before starting");
+  }
+  if (enabled && !dec->frame_arena) {
+    dec->frame_arena.reset(new jxl::MemoryArena(&dec->memory_manager));
+  }
+  dec->use_frame_arena = !!enabled;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetImageBufferPool(JxlDecoder* dec,
+                                              size_t max_retained_bytes) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set image buffer pool before starting");
+  }
+  if (max_retained_bytes != 0 && !dec->image_buffer_pool) {
+    dec->image_buffer_pool.reset(new jxl::BufferPool(&dec->memory_manager));
+  }
+  if (dec->image_buffer_pool) {
+    dec->image_buffer_pool->SetMaxRetainedBytes(max_retained_bytes);
+  }
+  dec->max_image_buffer_pool_bytes = max_retained_bytes;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetHugePages(JxlDecoder* dec, JXL_BOOL enabled) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set huge pages before starting");
+  }
+  dec->huge_pages = !!enabled;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderGetMemoryUsage(const JxlDecoder* dec,
+                                          JxlMemoryTag tag,
+                                          JxlMemoryUsage* usage) {
+  if (tag < JXL_MEMORY_TAG_ALL || tag >= JXL_MEMORY_TAG_NUM) {
+    return JXL_API_ERROR("Invalid memory tag");
+  }
+  *usage = dec->allocation_stats.Get(tag);
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetPersistentInput(JxlDecoder* dec,
+                                             JXL_BOOL persistent) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set persistent input before starting");
+  }
+  dec->persistent_input = !!persistent;
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderSetBoxBuffer(JxlDecoder* dec, uint8_t* data,
                                         size_t size) {
   if (dec->box_out_buffer_set) {
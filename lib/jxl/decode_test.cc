@@ -8,9 +8,12 @@
 #include <jxl/resizable_parallel_runner_cxx.h>
 #include <jxl/thread_parallel_runner_cxx.h>
 #include <jxl/types.h>
+#include <jxl/work_stealing_parallel_runner_cxx.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <array>
+#include <atomic>
 #include <sstream>
 #include <string>
 #include <utility>
@@ -657,6 +660,140 @@ TEST(DecodeTest, CustomAllocTest) {
   EXPECT_LE(1, counters.frees);
 }
 
+// The image buffers are allocated with the memory manager of the decoder, and
+// the frame arena gets them from a few large chunks.
+TEST(DecodeTest, FrameArenaTest) {
+  struct CalledCounters {
+    std::atomic<int> allocs{0};
+    std::atomic<int> frees{0};
+  };
+  JxlMemoryManager mm;
+  mm.alloc = [](void* opaque, size_t size) {
+    reinterpret_cast<CalledCounters*>(opaque)->allocs++;
+    return malloc(size);
+  };
+  mm.free = [](void* opaque, void* address) {
+    if (address) reinterpret_cast<CalledCounters*>(opaque)->frees++;
+    free(address);
+  };
+
+  size_t xsize = 300, ysize = 200;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  jxl::TestCodestreamParams params;
+  params.cparams.SetLossless();
+  params.cparams.speed_tier = jxl::SpeedTier::kThunder;
+  jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      params);
+
+  int num_allocs[2];
+  for (int use_arena = 0; use_arena < 2; ++use_arena) {
+    CalledCounters counters;
+    mm.opaque = &counters;
+    JxlDecoder* dec = JxlDecoderCreate(&mm);
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetFrameArena(dec, use_arena));
+    std::vector<uint8_t> pixels2 = jxl::DecodeWithAPI(
+        dec, jxl::Span<const uint8_t>(compressed.data(), compressed.size()),
+        format, /*use_callback=*/false, /*set_buffer_early=*/false,
+        /*use_resizable_runner=*/false, /*require_boxes=*/false,
+        /*expect_success=*/true);
+    EXPECT_EQ(0u, jxl::test::ComparePixels(pixels.data(), pixels2.data(),
+                                           xsize, ysize, format, format));
+    JxlDecoderDestroy(dec);
+    num_allocs[use_arena] = counters.allocs.load();
+    EXPECT_EQ(counters.allocs.load(), counters.frees.load());
+  }
+  EXPECT_LT(num_allocs[1], num_allocs[0]);
+}
+
+// Decoding again after JxlDecoderResetKeepBuffers reuses the image buffers
+// retained by the pool.
+TEST(DecodeTest, ImageBufferPoolTest) {
+  struct CalledCounters {
+    std::atomic<int> allocs{0};
+    std::atomic<int> frees{0};
+  } counters;
+  JxlMemoryManager mm;
+  mm.opaque = &counters;
+  mm.alloc = [](void* opaque, size_t size) {
+    reinterpret_cast<CalledCounters*>(opaque)->allocs++;
+    return malloc(size);
+  };
+  mm.free = [](void* opaque, void* address) {
+    if (address) reinterpret_cast<CalledCounters*>(opaque)->frees++;
+    free(address);
+  };
+
+  size_t xsize = 300, ysize = 200;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  jxl::TestCodestreamParams params;
+  params.cparams.SetLossless();
+  params.cparams.speed_tier = jxl::SpeedTier::kThunder;
+  jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      params);
+
+  JxlDecoder* dec = JxlDecoderCreate(&mm);
+  int num_allocs[2];
+  for (int i = 0; i < 2; ++i) {
+    const int allocs_before = counters.allocs.load();
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageBufferPool(dec, 64 << 20));
+    std::vector<uint8_t> pixels2 = jxl::DecodeWithAPI(
+        dec, jxl::Span<const uint8_t>(compressed.data(), compressed.size()),
+        format, /*use_callback=*/false, /*set_buffer_early=*/false,
+        /*use_resizable_runner=*/false, /*require_boxes=*/false,
+        /*expect_success=*/true);
+    EXPECT_EQ(0u, jxl::test::ComparePixels(pixels.data(), pixels2.data(),
+                                           xsize, ysize, format, format));
+    JxlDecoderResetKeepBuffers(dec);
+    num_allocs[i] = counters.allocs.load() - allocs_before;
+  }
+  EXPECT_LT(num_allocs[1], num_allocs[0]);
+  JxlDecoderDestroy(dec);
+  EXPECT_EQ(counters.allocs.load(), counters.frees.load());
+}
+
+TEST(DecodeTest, MemoryUsageTest) {
+  size_t xsize = 300, ysize = 200;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  jxl::TestCodestreamParams params;
+  params.cparams.SetLossless();
+  params.cparams.speed_tier = jxl::SpeedTier::kThunder;
+  jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      params);
+
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  std::vector<uint8_t> pixels2 = jxl::DecodeWithAPI(
+      dec, jxl::Span<const uint8_t>(compressed.data(), compressed.size()),
+      format, /*use_callback=*/false, /*set_buffer_early=*/false,
+      /*use_resizable_runner=*/false, /*require_boxes=*/false,
+      /*expect_success=*/true);
+  EXPECT_EQ(0u, jxl::test::ComparePixels(pixels.data(), pixels2.data(), xsize,
+                                         ysize, format, format));
+
+  JxlMemoryUsage usage[JXL_MEMORY_TAG_NUM];
+  for (int i = 0; i < JXL_MEMORY_TAG_NUM; ++i) {
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderGetMemoryUsage(dec, static_cast<JxlMemoryTag>(i),
+                                       &usage[i]));
+    EXPECT_LE(usage[i].current_bytes, usage[i].peak_bytes);
+    EXPECT_LE(usage[i].peak_bytes, usage[JXL_MEMORY_TAG_ALL].peak_bytes);
+  }
+  // A lossless image is decoded from modular channels through the render
+  // pipeline.
+  EXPECT_LT(0u, usage[JXL_MEMORY_TAG_MODULAR].peak_bytes);
+  EXPECT_LT(0u, usage[JXL_MEMORY_TAG_RENDER_PIPELINE].peak_bytes);
+  EXPECT_EQ(0u, usage[JXL_MEMORY_TAG_AC_COEFFICIENTS].num_allocations);
+  EXPECT_EQ(0u, usage[JXL_MEMORY_TAG_BUTTERAUGLI].num_allocations);
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderGetMemoryUsage(dec, JXL_MEMORY_TAG_NUM, &usage[0]));
+  JxlDecoderDestroy(dec);
+}
+
 // TODO(lode): add multi-threaded test when multithreaded pixel decoding from
 // API is implemented.
 TEST(DecodeTest, DefaultParallelRunnerTest) {
@@ -1941,6 +2078,39 @@ TEST(DecodeTest, PixelTestOpaqueSrgbLossy) {
   }
 }
 
+// The 8-bit sRGB output is rounded with a table, it must be the float output
+// rounded to the nearest level.
+TEST(DecodeTest, PixelTestSrgb8MatchesFloat) {
+  size_t xsize = 123, ysize = 77;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  const jxl::Span<const uint8_t> span(compressed.data(), compressed.size());
+
+  JxlPixelFormat format8 = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> pixels8 = jxl::DecodeWithAPI(
+      span, format8, /*use_callback=*/false, /*set_buffer_early=*/false,
+      /*use_resizable_runner=*/false, /*require_boxes=*/false,
+      /*expect_success=*/true);
+  JxlPixelFormat format_float = {3, JXL_TYPE_FLOAT, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> pixels_float = jxl::DecodeWithAPI(
+      span, format_float, /*use_callback=*/false, /*set_buffer_early=*/false,
+      /*use_resizable_runner=*/false, /*require_boxes=*/false,
+      /*expect_success=*/true);
+  ASSERT_EQ(xsize * ysize * 3, pixels8.size());
+  ASSERT_EQ(pixels8.size() * sizeof(float), pixels_float.size());
+
+  for (size_t i = 0; i < pixels8.size(); ++i) {
+    float value;
+    memcpy(&value, pixels_float.data() + i * sizeof(float), sizeof(value));
+    value = std::min(std::max(value, 0.0f), 1.0f) * 255;
+    // Allows for the error of the approximate transfer function of the float
+    // output.
+    EXPECT_NEAR(pixels8[i], value, 0.55f) << "sample " << i;
+  }
+}
+
 // Opaque image with noise enabled, decoded to RGB8 and RGBA8.
 TEST(DecodeTest, PixelTestOpaqueSrgbLossyNoise) {
   for (unsigned channels = 3; channels <= 4; channels++) {
@@ -2551,6 +2721,85 @@ TEST(DecodeTest, AnimationTest) {
   JxlDecoderDestroy(dec);
 }
 
+void TestParallelFrames(JxlParallelRunner runner, void* runner_opaque,
+                        bool nested) {
+  size_t xsize = 64, ysize = 48;
+  static const size_t num_frames = 5;
+  std::vector<uint8_t> frames[num_frames];
+  JxlPixelFormat format = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+
+  jxl::CodecInOut io;
+  io.SetSize(xsize, ysize);
+  io.metadata.m.SetUintSamples(16);
+  io.metadata.m.color_encoding = jxl::ColorEncoding::SRGB(false);
+  io.metadata.m.SetAlphaBits(16);
+  io.metadata.m.have_animation = true;
+  io.frames.clear();
+  io.frames.reserve(num_frames);
+  for (size_t i = 0; i < num_frames; ++i) {
+    frames[i] = jxl::test::GetSomeTestImage(xsize, ysize, 4, i);
+    jxl::ImageBundle bundle(&io.metadata.m);
+    EXPECT_TRUE(ConvertFromExternal(
+        jxl::Span<const uint8_t>(frames[i].data(), frames[i].size()), xsize,
+        ysize, jxl::ColorEncoding::SRGB(/*is_gray=*/false),
+        /*bits_per_sample=*/16, format,
+        /*pool=*/nullptr, &bundle));
+    bundle.duration = 1;
+    io.frames.push_back(std::move(bundle));
+  }
+
+  jxl::CompressParams cparams;
+  cparams.SetLossless();  // Lossless to verify pixels exactly after roundtrip.
+  cparams.speed_tier = jxl::SpeedTier::kThunder;
+  jxl::AuxOut aux_out;
+  jxl::PaddedBytes compressed;
+  jxl::PassesEncoderState enc_state;
+  EXPECT_TRUE(jxl::EncodeFile(cparams, &io, &enc_state, &compressed,
+                              jxl::GetJxlCms(), &aux_out, nullptr));
+
+  JxlDecoder* dec = JxlDecoderCreate(NULL);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetParallelRunner(dec, runner, runner_opaque));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetParallelFrames(dec, 0));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetParallelFrames(dec, 3));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetNestedParallelism(dec, nested));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_FRAME | JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+
+  for (size_t i = 0; i < num_frames; ++i) {
+    EXPECT_EQ(JXL_DEC_FRAME, JxlDecoderProcessInput(dec));
+    JxlFrameHeader frame_header;
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetFrameHeader(dec, &frame_header));
+    EXPECT_EQ(i + 1 == num_frames, frame_header.is_last);
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+    std::vector<uint8_t> pixels(xsize * ysize * 8);
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutBuffer(
+                                   dec, &format, pixels.data(), pixels.size()));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(0u, jxl::test::ComparePixels(frames[i].data(), pixels.data(),
+                                           xsize, ysize, format, format));
+  }
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetNestedParallelism(dec, nested));
+
+  JxlDecoderDestroy(dec);
+}
+
+TEST(DecodeTest, ParallelFramesTest) {
+  JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(
+      NULL, JxlThreadParallelRunnerDefaultNumWorkerThreads());
+  TestParallelFrames(JxlThreadParallelRunner, runner.get(), /*nested=*/false);
+}
+
+TEST(DecodeTest, ParallelFramesNestedTest) {
+  JxlWorkStealingParallelRunnerPtr runner =
+      JxlWorkStealingParallelRunnerMake(NULL, 4);
+  TestParallelFrames(JxlWorkStealingParallelRunner, runner.get(),
+                     /*nested=*/true);
+}
+
 TEST(DecodeTest, AnimationTestStreaming) {
   size_t xsize = 123, ysize = 77;
   static const size_t num_frames = 2;
@@ -3667,87 +3916,891 @@ TEST(DecodeTest, OrientedCroppedFrameTest) {
   }
 }
 
-struct FramePositions {
-  size_t frame_start;
-  size_t header_end;
-  size_t toc_end;
-  std::vector<size_t> section_end;
-};
+TEST(DecodeTest, CropRegionTest) {
+  size_t xsize = 1100, ysize = 300;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  // 16-bit output so that the full decode does not take the fast 8-bit path,
+  // which rounds differently.
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  for (uint32_t orientation : {1u, 6u}) {
+    SCOPED_TRACE(testing::Message() << "orientation: " << orientation);
+    jxl::TestCodestreamParams params;
+    params.orientation = static_cast<JxlOrientation>(orientation);
+    jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+        jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+        params);
+    std::vector<uint8_t> full = jxl::DecodeWithAPI(
+        jxl::Span<const uint8_t>(compressed.data(), compressed.size()), format,
+        /*use_callback=*/false, /*set_buffer_early=*/false,
+        /*use_resizable_runner=*/false, /*require_boxes=*/false,
+        /*expect_success=*/true);
+    size_t oxsize = orientation > 4 ? ysize : xsize;
+    size_t oysize = orientation > 4 ? xsize : ysize;
+    ASSERT_EQ(oxsize * oysize * 6, full.size());
 
-struct StreamPositions {
-  size_t codestream_start;
-  size_t codestream_end;
-  size_t basic_info;
-  size_t jbrd_end = 0;
-  std::vector<size_t> box_start;
-  std::vector<FramePositions> frames;
-};
+    // The region is near the end of the image, far from the first groups.
+    size_t cx0 = oxsize - oxsize / 8 - 37, cy0 = oysize - oysize / 8 - 51;
+    size_t cxsize = 37, cysize = 51;
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(
+                  dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+    EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetCropRegion(dec, 0, 0, 1, 1));
+    EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderSetCropRegion(dec, oxsize - 1, 0, 2, 1));
+    EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetCropRegion(dec, 0, 0, 1, 0));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetCropRegion(dec, cx0, cy0, cxsize, cysize));
+    size_t buffer_size;
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderImageOutBufferSize(dec, &format, &buffer_size));
+    EXPECT_EQ(cxsize * cysize * 6, buffer_size);
+    std::vector<uint8_t> cropped(buffer_size);
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetImageOutBuffer(dec, &format, cropped.data(),
+                                          cropped.size()));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+    JxlDecoderDestroy(dec);
 
-void AnalyzeCodestream(const jxl::PaddedBytes& data,
-                       StreamPositions* streampos) {
-  // Unbox data to codestream and mark where it is broken up by boxes.
-  std::vector<uint8_t> codestream;
-  std::vector<std::pair<size_t, size_t>> breakpoints;
-  bool codestream_end = false;
-  ASSERT_LE(2, data.size());
-  if (data[0] == 0xff && data[1] == 0x0a) {
-    codestream = std::vector<uint8_t>(data.begin(), data.end());
-    streampos->codestream_start = 0;
-  } else {
-    const uint8_t* in = data.data();
-    size_t pos = 0;
-    while (pos < data.size()) {
-      ASSERT_LE(pos + 8, data.size());
-      streampos->box_start.push_back(pos);
-      size_t box_size = LoadBE32(in + pos);
-      if (box_size == 0) box_size = data.size() - pos;
-      ASSERT_LE(pos + box_size, data.size());
-      if (memcmp(in + pos + 4, "jxlc", 4) == 0) {
-        EXPECT_TRUE(codestream.empty());
-        streampos->codestream_start = pos + 8;
-        codestream.insert(codestream.end(), in + pos + 8, in + pos + box_size);
-        codestream_end = true;
-      } else if (memcmp(in + pos + 4, "jxlp", 4) == 0) {
-        codestream_end = (LoadBE32(in + pos + 8) & 0x80000000);
-        if (codestream.empty()) {
-          streampos->codestream_start = pos + 12;
-        } else if (box_size > 12 || !codestream_end) {
-          breakpoints.push_back({codestream.size(), 12});
-        }
-        codestream.insert(codestream.end(), in + pos + 12, in + pos + box_size);
-      } else if (memcmp(in + pos + 4, "jbrd", 4) == 0) {
-        EXPECT_TRUE(codestream.empty());
-        streampos->jbrd_end = pos + box_size;
-      } else if (!codestream.empty() && !codestream_end) {
-        breakpoints.push_back({codestream.size(), box_size});
-      }
-      pos += box_size;
+    for (size_t y = 0; y < cysize; ++y) {
+      EXPECT_EQ(0, memcmp(cropped.data() + y * cxsize * 6,
+                          full.data() + ((cy0 + y) * oxsize + cx0) * 6,
+                          cxsize * 6))
+          << "row " << y;
     }
-    ASSERT_EQ(pos, data.size());
   }
-  // Translate codestream positions to boxed stream positions.
-  size_t offset = streampos->codestream_start;
-  size_t bp = 0;
-  auto add_offset = [&](size_t pos) {
-    while (bp < breakpoints.size() && pos >= breakpoints[bp].first) {
-      offset += breakpoints[bp++].second;
-    }
-    return pos + offset;
+}
+
+TEST(DecodeTest, ImageOutRectCallbackTest) {
+  size_t xsize = 300, ysize = 290;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  const size_t max_rows = 16;
+  struct Output {
+    std::vector<uint8_t> pixels;
+    size_t stride;
+    bool transposed;
+    size_t num_calls = 0;
+    bool rects_too_large = false;
   };
-  // Analyze the unboxed codestream.
-  jxl::BitReader br(
-      jxl::Span<const uint8_t>(codestream.data(), codestream.size()));
-  ASSERT_EQ(br.ReadFixedBits<16>(), 0x0AFF);
-  jxl::CodecMetadata metadata;
-  EXPECT_TRUE(ReadSizeHeader(&br, &metadata.size));
-  EXPECT_TRUE(ReadImageMetadata(&br, &metadata.m));
-  streampos->basic_info =
-      add_offset(br.TotalBitsConsumed() / jxl::kBitsPerByte);
-  metadata.transform_data.nonserialized_xyb_encoded = metadata.m.xyb_encoded;
-  EXPECT_TRUE(jxl::Bundle::Read(&br, &metadata.transform_data));
-  EXPECT_TRUE(br.JumpToByteBoundary());
-  bool has_preview = metadata.m.have_preview;
-  while (br.TotalBitsConsumed() < br.TotalBytes() * jxl::kBitsPerByte) {
+  for (uint32_t orientation : {1u, 3u, 6u, 7u}) {
+    SCOPED_TRACE(testing::Message() << "orientation: " << orientation);
+    jxl::TestCodestreamParams params;
+    params.orientation = static_cast<JxlOrientation>(orientation);
+    jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+        jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+        params);
+    std::vector<uint8_t> full = jxl::DecodeWithAPI(
+        jxl::Span<const uint8_t>(compressed.data(), compressed.size()), format,
+        /*use_callback=*/false, /*set_buffer_early=*/false,
+        /*use_resizable_runner=*/false, /*require_boxes=*/false,
+        /*expect_success=*/true);
+    size_t oxsize = orientation > 4 ? ysize : xsize;
+
+    Output output;
+    output.pixels.resize(full.size());
+    output.stride = oxsize * 6;
+    output.transposed = orientation > 4;
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderSetImageOutRectCallback(
+                  dec, &format, /*max_rows=*/0,
+                  [](void* init_opaque, size_t, size_t) { return init_opaque; },
+                  [](void*, size_t, size_t, size_t, size_t, size_t, size_t,
+                     const void*) {},
+                  [](void*) {}, &output));
+    EXPECT_EQ(
+        JXL_DEC_SUCCESS,
+        JxlDecoderSetImageOutRectCallback(
+            dec, &format, max_rows,
+            [](void* init_opaque, size_t, size_t) { return init_opaque; },
+            [](void* run_opaque, size_t /*thread_id*/, size_t x, size_t y,
+               size_t xsize, size_t ysize, size_t stride, const void* pixels) {
+              Output* output = static_cast<Output*>(run_opaque);
+              output->num_calls++;
+              if ((output->transposed ? xsize : ysize) > max_rows) {
+                output->rects_too_large = true;
+              }
+              for (size_t iy = 0; iy < ysize; ++iy) {
+                memcpy(output->pixels.data() + (y + iy) * output->stride +
+                           x * 6,
+                       static_cast<const uint8_t*>(pixels) + iy * stride,
+                       xsize * 6);
+              }
+            },
+            [](void*) {}, &output));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+    JxlDecoderDestroy(dec);
+
+    EXPECT_TRUE(full == output.pixels);
+    EXPECT_FALSE(output.rects_too_large);
+    // There are two columns of groups, so one call per row of each group
+    // would be 2 * ysize calls.
+    EXPECT_LT(output.num_calls, ysize / 2);
+  }
+}
+
+TEST(DecodeTest, PriorityRegionTest) {
+  size_t xsize = 1100, ysize = 300;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  std::vector<uint8_t> full = jxl::DecodeWithAPI(
+      jxl::Span<const uint8_t>(compressed.data(), compressed.size()), format,
+      /*use_callback=*/true, /*set_buffer_early=*/false,
+      /*use_resizable_runner=*/false, /*require_boxes=*/false,
+      /*expect_success=*/true);
+  ASSERT_EQ(xsize * ysize * 6, full.size());
+
+  // Without a parallel runner the groups are decoded one at a time, in the
+  // order of the schedule.
+  std::vector<uint8_t> decoded(full.size());
+  size_t first_x = xsize, first_y = ysize;
+  auto callback = [&](size_t x, size_t y, size_t num_pixels,
+                      const void* pixels_row) {
+    if (first_x == xsize) {
+      first_x = x;
+      first_y = y;
+    }
+    memcpy(decoded.data() + (y * xsize + x) * 6, pixels_row, num_pixels * 6);
+  };
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(
+                dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetPriorityRegion(dec, 0, 0, 1, 1));
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderSetPriorityRegion(dec, 0, ysize - 1, 1, 2));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetPriorityRegion(dec, 0, 0, 0, 1));
+  // The region is in the fourth group of the second row of groups.
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetPriorityRegion(dec, 900, 260, 100, 30));
+  EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetImageOutCallback(
+                dec, &format,
+                [](void* opaque, size_t x, size_t y, size_t num_pixels,
+                   const void* pixels_row) {
+                  (*static_cast<decltype(&callback)>(opaque))(
+                      x, y, num_pixels, pixels_row);
+                },
+                /*opaque=*/&callback));
+  EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+  JxlDecoderDestroy(dec);
+
+  EXPECT_GE(first_x, 512u);
+  EXPECT_GE(first_y, 128u);
+  EXPECT_EQ(0, memcmp(decoded.data(), full.data(), full.size()));
+}
+
+TEST(DecodeTest, OutputDownsamplingTest) {
+  size_t xsize = 600, ysize = 400;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> full = jxl::DecodeWithAPI(
+      jxl::Span<const uint8_t>(compressed.data(), compressed.size()), format,
+      /*use_callback=*/false, /*set_buffer_early=*/false,
+      /*use_resizable_runner=*/false, /*require_boxes=*/false,
+      /*expect_success=*/true);
+  ASSERT_EQ(xsize * ysize * 3, full.size());
+
+  for (uint32_t factor : {2u, 8u}) {
+    SCOPED_TRACE(testing::Message() << "factor: " << factor);
+    size_t dxsize = jxl::DivCeil(xsize, factor);
+    size_t dysize = jxl::DivCeil(ysize, factor);
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetOutputDownsampling(dec, 3));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetOutputDownsampling(dec, factor));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(
+                  dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+    EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+    size_t buffer_size;
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderImageOutBufferSize(dec, &format, &buffer_size));
+    EXPECT_EQ(dxsize * dysize * 3, buffer_size);
+    std::vector<uint8_t> downsampled(buffer_size);
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetImageOutBuffer(dec, &format, downsampled.data(),
+                                          downsampled.size()));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+    JxlDecoderDestroy(dec);
+
+    // Compare with the box-downsampled full resolution image. With a factor
+    // of 8 only the DC is decoded, which is a coarser approximation.
+    double total_diff = 0;
+    int max_diff = 0;
+    for (size_t y = 0; y < dysize; ++y) {
+      for (size_t x = 0; x < dxsize; ++x) {
+        for (size_t c = 0; c < 3; ++c) {
+          int sum = 0, count = 0;
+          for (size_t iy = y * factor; iy < std::min(ysize, (y + 1) * factor);
+               ++iy) {
+            for (size_t ix = x * factor;
+                 ix < std::min(xsize, (x + 1) * factor); ++ix) {
+              sum += full[(iy * xsize + ix) * 3 + c];
+              ++count;
+            }
+          }
+          int diff = std::abs(downsampled[(y * dxsize + x) * 3 + c] -
+                              (sum + count / 2) / count);
+          total_diff += diff;
+          max_diff = std::max(max_diff, diff);
+        }
+      }
+    }
+    if (factor == 2) {
+      EXPECT_LE(max_diff, 2);
+    } else {
+      EXPECT_LE(total_diff / (dxsize * dysize * 3), 4.0);
+    }
+  }
+}
+
+TEST(DecodeTest, ResetKeepBuffersTest) {
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  // The second image is larger and the third smaller than the first one, so
+  // the kept buffers are both grown and reused.
+  size_t sizes[3][2] = {{300, 200}, {700, 300}, {150, 100}};
+  for (size_t i = 0; i < 3; ++i) {
+    size_t xsize = sizes[i][0], ysize = sizes[i][1];
+    SCOPED_TRACE(testing::Message() << "image: " << i);
+    std::vector<uint8_t> pixels =
+        jxl::test::GetSomeTestImage(xsize, ysize, 3, i);
+    jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+        jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize,
+        3, jxl::TestCodestreamParams());
+    std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+        jxl::Span<const uint8_t>(compressed.data(), compressed.size()), format,
+        /*use_callback=*/false, /*set_buffer_early=*/false,
+        /*use_resizable_runner=*/false, /*require_boxes=*/false,
+        /*expect_success=*/true);
+
+    if (i > 0) JxlDecoderResetKeepBuffers(dec);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+    std::vector<uint8_t> decoded(xsize * ysize * 3);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetImageOutBuffer(dec, &format, decoded.data(),
+                                          decoded.size()));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(expected, decoded);
+  }
+  JxlDecoderDestroy(dec);
+}
+
+TEST(DecodeTest, PersistentInputTest) {
+  size_t xsize = 700, ysize = 300;
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  // The multi box formats split the codestream in the middle of sections.
+  for (CodeStreamBoxFormat box_format :
+       {kCSBF_None, kCSBF_Single, kCSBF_Multi,
+        kCSBF_Multi_Other_Zero_Terminated}) {
+    SCOPED_TRACE(testing::Message() << "box format: " << box_format);
+    jxl::TestCodestreamParams params;
+    params.box_format = box_format;
+    jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+        jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize,
+        3, params);
+    std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+        jxl::Span<const uint8_t>(compressed.data(), compressed.size()), format,
+        /*use_callback=*/false, /*set_buffer_early=*/false,
+        /*use_resizable_runner=*/false, /*require_boxes=*/false,
+        /*expect_success=*/true);
+
+    JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetPersistentInput(dec.get(), JXL_TRUE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                  compressed.size()));
+    JxlDecoderCloseInput(dec.get());
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec.get()));
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderSetPersistentInput(dec.get(), JXL_TRUE));
+    std::vector<uint8_t> decoded(xsize * ysize * 3);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetImageOutBuffer(dec.get(), &format, decoded.data(),
+                                          decoded.size()));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec.get()));
+    EXPECT_EQ(expected, decoded);
+  }
+}
+
+TEST(DecodeTest, DecodedExtraChannelsTest) {
+  jxl::ThreadPool* pool = nullptr;
+  jxl::CodecInOut io;
+  size_t xsize = 300, ysize = 257;
+  constexpr size_t kNumExtra = 3;
+  io.metadata.m.color_encoding = jxl::ColorEncoding::SRGB();
+  jxl::Image3F main(xsize, ysize);
+  std::vector<jxl::ImageF> ec;
+  for (size_t i = 0; i < kNumExtra; i++) ec.emplace_back(xsize, ysize);
+  for (size_t y = 0; y < ysize; y++) {
+    for (size_t c = 0; c < 3; c++) {
+      float* JXL_RESTRICT row = main.PlaneRow(c, y);
+      for (size_t x = 0; x < xsize; x++) {
+        row[x] = ((x * (c + 1) + y) & 255) * (1.f / 255.f);
+      }
+    }
+    for (size_t i = 0; i < kNumExtra; i++) {
+      float* JXL_RESTRICT row = ec[i].Row(y);
+      for (size_t x = 0; x < xsize; x++) {
+        row[x] = (((x ^ y) + 40 * i) & 255) * (1.f / 255.f);
+      }
+    }
+  }
+  std::vector<uint8_t> expected_ec0(xsize * ysize);
+  for (size_t y = 0; y < ysize; y++) {
+    for (size_t x = 0; x < xsize; x++) {
+      expected_ec0[y * xsize + x] = (x ^ y) & 255;
+    }
+  }
+  io.SetFromImage(std::move(main), jxl::ColorEncoding::SRGB());
+  jxl::ExtraChannelInfo info;
+  info.bit_depth.bits_per_sample = 8;
+  info.dim_shift = 0;
+  info.type = jxl::ExtraChannel::kOptional;
+  for (size_t i = 0; i < kNumExtra; i++) {
+    io.metadata.m.extra_channel_info.push_back(info);
+  }
+  io.frames[0].SetExtraChannels(std::move(ec));
+
+  jxl::CompressParams cparams;
+  cparams.speed_tier = jxl::SpeedTier::kLightning;
+  cparams.SetLossless();
+
+  jxl::PaddedBytes compressed;
+  std::unique_ptr<jxl::PassesEncoderState> enc_state =
+      jxl::make_unique<jxl::PassesEncoderState>();
+  EXPECT_TRUE(jxl::EncodeFile(cparams, &io, enc_state.get(), &compressed,
+                              jxl::GetJxlCms(), nullptr, pool));
+
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+      jxl::Span<const uint8_t>(compressed.data(), compressed.size()), format,
+      /*use_callback=*/false, /*set_buffer_early=*/false,
+      /*use_resizable_runner=*/false, /*require_boxes=*/false,
+      /*expect_success=*/true);
+
+  for (size_t num_decoded = 0; num_decoded < 2; num_decoded++) {
+    SCOPED_TRACE(testing::Message() << "decoded extra: " << num_decoded);
+    JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+    const uint32_t decoded_extra = 0;
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderSetDecodedExtraChannels(dec.get(), &decoded_extra, 1));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(
+                  dec.get(), JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                  compressed.size()));
+    EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec.get()));
+    const uint32_t invalid_extra = kNumExtra;
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderSetDecodedExtraChannels(dec.get(), &invalid_extra, 1));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetDecodedExtraChannels(dec.get(), &decoded_extra,
+                                                num_decoded));
+
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec.get()));
+    std::vector<uint8_t> image(xsize * ysize * 3);
+    std::vector<uint8_t> extra(xsize * ysize);
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderSetExtraChannelBuffer(dec.get(), &format, extra.data(),
+                                              extra.size(), 2));
+    EXPECT_EQ(num_decoded ? JXL_DEC_SUCCESS : JXL_DEC_ERROR,
+              JxlDecoderSetExtraChannelBuffer(dec.get(), &format, extra.data(),
+                                              extra.size(), 0));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetImageOutBuffer(dec.get(), &format, image.data(),
+                                          image.size()));
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderSetDecodedExtraChannels(dec.get(), nullptr, 0));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec.get()));
+    EXPECT_EQ(expected, image);
+    if (num_decoded) {
+      EXPECT_EQ(expected_ec0, extra);
+    }
+  }
+}
+
+TEST(DecodeTest, ImageOutPlanesTest) {
+  size_t xsize = 123, ysize = 77;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  params.cparams.SetLossless();
+  params.cparams.speed_tier = jxl::SpeedTier::kThunder;
+  jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      params);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+      jxl::Span<const uint8_t>(compressed.data(), compressed.size()), format,
+      /*use_callback=*/false, /*set_buffer_early=*/false,
+      /*use_resizable_runner=*/false, /*require_boxes=*/false,
+      /*expect_success=*/true);
+  ASSERT_EQ(xsize * ysize * 3, expected.size());
+
+  // Decodes into planes with the given dimensions and a padded stride.
+  const auto decode_planes =
+      [&](JxlPlaneLayout layout,
+          const std::vector<std::array<size_t, 3>>& sizes) {
+        std::vector<std::vector<uint8_t>> buffers;
+        std::vector<JxlImageOutPlane> planes;
+        for (const auto& size : sizes) {
+          size_t stride = size[0] * size[2] + 7;
+          buffers.emplace_back(stride * size[1]);
+          planes.push_back({buffers.back().data(), buffers.back().size(),
+                            stride});
+        }
+        JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+        EXPECT_EQ(JXL_DEC_SUCCESS,
+                  JxlDecoderSubscribeEvents(
+                      dec.get(), JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+        EXPECT_EQ(JXL_DEC_SUCCESS,
+                  JxlDecoderSetInput(dec.get(), compressed.data(),
+                                     compressed.size()));
+        EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec.get()));
+        EXPECT_EQ(JXL_DEC_ERROR,
+                  JxlDecoderSetImageOutPlanes(dec.get(), layout, &format,
+                                              planes.data(),
+                                              planes.size() - 1));
+        planes[0].size--;
+        EXPECT_EQ(JXL_DEC_ERROR,
+                  JxlDecoderSetImageOutPlanes(dec.get(), layout, &format,
+                                              planes.data(), planes.size()));
+        planes[0].size++;
+        EXPECT_EQ(JXL_DEC_SUCCESS,
+                  JxlDecoderSetImageOutPlanes(dec.get(), layout, &format,
+                                              planes.data(), planes.size()));
+        EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+        EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec.get()));
+        return std::make_pair(std::move(buffers), planes);
+      };
+
+  {
+    std::vector<std::array<size_t, 3>> sizes(3, {xsize, ysize, 1});
+    auto result = decode_planes(JXL_PLANES_CHANNELS, sizes);
+    for (size_t c = 0; c < 3; c++) {
+      for (size_t y = 0; y < ysize; y++) {
+        for (size_t x = 0; x < xsize; x++) {
+          ASSERT_EQ(expected[(y * xsize + x) * 3 + c],
+                    result.first[c][y * result.second[c].stride + x]);
+        }
+      }
+    }
+  }
+
+  size_t cxsize = jxl::DivCeil(xsize, 2);
+  size_t cysize = jxl::DivCeil(ysize, 2);
+  for (bool nv12 : {false, true}) {
+    SCOPED_TRACE(testing::Message() << "nv12: " << nv12);
+    std::vector<std::array<size_t, 3>> sizes = {{xsize, ysize, 1}};
+    if (nv12) {
+      sizes.push_back({cxsize, cysize, 2});
+    } else {
+      sizes.push_back({cxsize, cysize, 1});
+      sizes.push_back({cxsize, cysize, 1});
+    }
+    auto result = decode_planes(
+        nv12 ? JXL_PLANES_YCBCR_BT601_NV12 : JXL_PLANES_YCBCR_BT601_I420,
+        sizes);
+    const auto rgb = [&](size_t x, size_t y, size_t c) {
+      return expected[(y * xsize + x) * 3 + c] * (1.0 / 255);
+    };
+    const auto luma = [](double r, double g, double b) {
+      return 0.299 * r + 0.587 * g + 0.114 * b;
+    };
+    for (size_t y = 0; y < ysize; y++) {
+      for (size_t x = 0; x < xsize; x++) {
+        double ref = (luma(rgb(x, y, 0), rgb(x, y, 1), rgb(x, y, 2)) * 219 +
+                      16);
+        ASSERT_NEAR(ref, result.first[0][y * result.second[0].stride + x],
+                    1.5);
+      }
+    }
+    for (size_t y = 0; y < cysize; y++) {
+      for (size_t x = 0; x < cxsize; x++) {
+        double mean[3] = {};
+        size_t x1 = std::min(2 * x + 1, xsize - 1);
+        size_t y1 = std::min(2 * y + 1, ysize - 1);
+        for (size_t c = 0; c < 3; c++) {
+          mean[c] = (rgb(2 * x, 2 * y, c) + rgb(x1, 2 * y, c) +
+                     rgb(2 * x, y1, c) + rgb(x1, y1, c)) *
+                    0.25;
+        }
+        double l = luma(mean[0], mean[1], mean[2]);
+        double cb = (mean[2] - l) * 224 / (2 * (1 - 0.114)) + 128;
+        double cr = (mean[0] - l) * 224 / (2 * (1 - 0.299)) + 128;
+        uint8_t cb_out, cr_out;
+        if (nv12) {
+          const uint8_t* row =
+              result.first[1].data() + y * result.second[1].stride;
+          cb_out = row[2 * x];
+          cr_out = row[2 * x + 1];
+        } else {
+          cb_out = result.first[1][y * result.second[1].stride + x];
+          cr_out = result.first[2][y * result.second[2].stride + x];
+        }
+        ASSERT_NEAR(cb, cb_out, 1.5);
+        ASSERT_NEAR(cr, cr_out, 1.5);
+      }
+    }
+  }
+}
+
+TEST(DecodeTest, SkippableInputTest) {
+  size_t xsize = 90, ysize = 120;
+  constexpr size_t num_frames = 5;
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  jxl::CodecInOut io;
+  io.SetSize(xsize, ysize);
+  io.metadata.m.SetUintSamples(16);
+  io.metadata.m.color_encoding = jxl::ColorEncoding::SRGB(false);
+  io.metadata.m.have_animation = true;
+  io.frames.clear();
+  uint32_t total_duration = 0;
+  for (size_t i = 0; i < num_frames; ++i) {
+    std::vector<uint8_t> frame =
+        jxl::test::GetSomeTestImage(xsize, ysize, 3, i);
+    jxl::ImageBundle bundle(&io.metadata.m);
+    EXPECT_TRUE(ConvertFromExternal(
+        jxl::Span<const uint8_t>(frame.data(), frame.size()), xsize, ysize,
+        jxl::ColorEncoding::SRGB(/*is_gray=*/false),
+        /*bits_per_sample=*/16, format,
+        /*pool=*/nullptr, &bundle));
+    bundle.duration = 5 + i;
+    total_duration += bundle.duration;
+    io.frames.push_back(std::move(bundle));
+  }
+  jxl::CompressParams cparams;
+  cparams.speed_tier = jxl::SpeedTier::kThunder;
+  jxl::PaddedBytes compressed;
+  jxl::PassesEncoderState enc_state;
+  EXPECT_TRUE(jxl::EncodeFile(cparams, &io, &enc_state, &compressed,
+                              jxl::GetJxlCms(), nullptr, nullptr));
+
+  // Reads the headers of all frames with small reads at increasing offsets,
+  // skipping the bytes the decoder does not need.
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  uint64_t skippable;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderGetSkippableInput(dec.get(), &skippable));
+  EXPECT_EQ(0u, skippable);
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSkipInput(dec.get(), 1));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(),
+                                      JXL_DEC_BASIC_INFO | JXL_DEC_FRAME));
+  constexpr size_t kReadSize = 64;
+  size_t pos = 0;
+  size_t bytes_read = 0;
+  size_t num_frames_seen = 0;
+  uint32_t duration = 0;
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_NEED_MORE_INPUT) {
+      pos -= JxlDecoderReleaseInput(dec.get());
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderGetSkippableInput(dec.get(), &skippable));
+      EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSkipInput(dec.get(), skippable + 1));
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSkipInput(dec.get(), skippable));
+      pos += skippable;
+      ASSERT_LE(pos, compressed.size());
+      size_t size = std::min(kReadSize, compressed.size() - pos);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetInput(dec.get(), compressed.data() + pos, size));
+      pos += size;
+      bytes_read += size;
+      if (pos == compressed.size()) JxlDecoderCloseInput(dec.get());
+    } else if (status == JXL_DEC_BASIC_INFO) {
+      continue;
+    } else if (status == JXL_DEC_FRAME) {
+      JxlFrameHeader frame_header;
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderGetFrameHeader(dec.get(), &frame_header));
+      duration += frame_header.duration;
+      num_frames_seen++;
+    } else {
+      EXPECT_EQ(JXL_DEC_SUCCESS, status);
+      break;
+    }
+  }
+  EXPECT_EQ(num_frames, num_frames_seen);
+  EXPECT_EQ(total_duration, duration);
+  EXPECT_LT(bytes_read * 4, compressed.size());
+}
+
+TEST(DecodeTest, SkippableSectionsTest) {
+  size_t xsize = 1100, ysize = 300;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  std::vector<uint8_t> full = jxl::DecodeWithAPI(
+      jxl::Span<const uint8_t>(compressed.data(), compressed.size()), format,
+      /*use_callback=*/false, /*set_buffer_early=*/false,
+      /*use_resizable_runner=*/false, /*require_boxes=*/false,
+      /*expect_success=*/true);
+  ASSERT_EQ(xsize * ysize * 6, full.size());
+
+  // The region is in the last column of groups, so the groups of the first
+  // three columns are not needed.
+  size_t cx0 = 1050, cy0 = 260, cxsize = 50, cysize = 30;
+  std::vector<uint8_t> cropped(cxsize * cysize * 6);
+  // Reads exactly the bytes the decoder needs, one at a time while it does not
+  // know how many, and skips the others.
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(),
+                                      JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+  uint64_t needed;
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetNeededInput(dec.get(), &needed));
+  EXPECT_EQ(0u, needed);
+  size_t pos = 0;
+  size_t bytes_skipped = 0;
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_NEED_MORE_INPUT) {
+      pos -= JxlDecoderReleaseInput(dec.get());
+      uint64_t skippable;
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderGetSkippableInput(dec.get(), &skippable));
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSkipInput(dec.get(), skippable));
+      pos += skippable;
+      bytes_skipped += skippable;
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetNeededInput(dec.get(), &needed));
+      ASSERT_LE(pos, compressed.size());
+      size_t size = std::min<size_t>(needed == 0 ? 1 : needed,
+                                     compressed.size() - pos);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetInput(dec.get(), compressed.data() + pos, size));
+      pos += size;
+      if (pos == compressed.size()) JxlDecoderCloseInput(dec.get());
+    } else if (status == JXL_DEC_BASIC_INFO) {
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetCropRegion(dec.get(), cx0, cy0,
+                                                         cxsize, cysize));
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec.get(), &format, cropped.data(),
+                                            cropped.size()));
+    } else if (status == JXL_DEC_FULL_IMAGE) {
+      continue;
+    } else {
+      EXPECT_EQ(JXL_DEC_SUCCESS, status);
+      break;
+    }
+  }
+  EXPECT_GT(bytes_skipped * 4, compressed.size());
+  for (size_t y = 0; y < cysize; ++y) {
+    EXPECT_EQ(0, memcmp(cropped.data() + y * cxsize * 6,
+                        full.data() + ((cy0 + y) * xsize + cx0) * 6,
+                        cxsize * 6))
+        << "row " << y;
+  }
+}
+
+TEST(DecodeTest, RenderStatsTest) {
+  size_t xsize = 123, ysize = 77;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      params);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+
+  for (bool collect : {false, true}) {
+    SCOPED_TRACE(testing::Message() << "collect: " << collect);
+    JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetCollectRenderStats(dec.get(), collect));
+    std::vector<uint8_t> pixels2 = jxl::DecodeWithAPI(
+        dec.get(),
+        jxl::Span<const uint8_t>(compressed.data(), compressed.size()),
+        format, /*use_callback=*/false, /*set_buffer_early=*/false,
+        /*use_resizable_runner=*/false, /*require_boxes=*/false,
+        /*expect_success=*/true);
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderSetCollectRenderStats(dec.get(), collect));
+    size_t num_stages = JxlDecoderNumRenderStages(dec.get());
+    JxlRenderStageStats stats;
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderGetRenderStageStats(dec.get(), num_stages, &stats));
+    if (!collect) {
+      EXPECT_EQ(0u, num_stages);
+      continue;
+    }
+    ASSERT_GT(num_stages, 0u);
+    bool has_write_stage = false;
+    for (size_t i = 0; i < num_stages; i++) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderGetRenderStageStats(dec.get(), i, &stats));
+      EXPECT_GT(stats.rows, 0u);
+      EXPECT_GT(stats.bytes, 0u);
+      if (std::string(stats.name) == "WritePixelCB") has_write_stage = true;
+    }
+    EXPECT_TRUE(has_write_stage);
+  }
+}
+
+TEST(DecodeTest, DiagnosticsTest) {
+  size_t xsize = 123, ysize = 77;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+
+  for (bool lossless : {false, true}) {
+    SCOPED_TRACE(testing::Message() << "lossless: " << lossless);
+    jxl::TestCodestreamParams params;
+    if (lossless) {
+      params.cparams.SetLossless();
+      params.cparams.speed_tier = jxl::SpeedTier::kThunder;
+    }
+    jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+        jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize,
+        3, params);
+    JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+    EXPECT_EQ(0u, JxlDecoderGetDiagnostic(dec.get(), JXL_DEC_DIAG_NUM_FRAMES));
+    jxl::DecodeWithAPI(
+        dec.get(),
+        jxl::Span<const uint8_t>(compressed.data(), compressed.size()),
+        format, /*use_callback=*/false, /*set_buffer_early=*/false,
+        /*use_resizable_runner=*/false, /*require_boxes=*/false,
+        /*expect_success=*/true);
+    EXPECT_EQ(1u, JxlDecoderGetDiagnostic(dec.get(), JXL_DEC_DIAG_NUM_FRAMES));
+    EXPECT_EQ(1u, JxlDecoderGetDiagnostic(dec.get(), JXL_DEC_DIAG_NUM_PASSES));
+    EXPECT_GT(
+        JxlDecoderGetDiagnostic(dec.get(), JXL_DEC_DIAG_NUM_ENTROPY_CODES), 0u);
+    EXPECT_GT(
+        JxlDecoderGetDiagnostic(dec.get(), JXL_DEC_DIAG_NUM_MODULAR_STREAMS),
+        0u);
+    uint64_t num_channels = 0;
+    for (int key = JXL_DEC_DIAG_NUM_SINGLE_LEAF_CHANNELS;
+         key <= JXL_DEC_DIAG_NUM_GENERIC_WP_CHANNELS; key++) {
+      num_channels += JxlDecoderGetDiagnostic(
+          dec.get(), static_cast<JxlDecoderDiagnostic>(key));
+    }
+    // Lossless: the three color channels, VarDCT: the three DC channels.
+    EXPECT_GE(num_channels, 3u);
+    EXPECT_EQ(0u, JxlDecoderGetDiagnostic(dec.get(), JXL_DEC_NUM_DIAGNOSTICS));
+    JxlDecoderReset(dec.get());
+    EXPECT_EQ(0u, JxlDecoderGetDiagnostic(dec.get(), JXL_DEC_DIAG_NUM_FRAMES));
+  }
+}
+
+struct FramePositions {
+  size_t frame_start;
+  size_t header_end;
+  size_t toc_end;
+  std::vector<size_t> section_end;
+};
+
+struct StreamPositions {
+  size_t codestream_start;
+  size_t codestream_end;
+  size_t basic_info;
+  size_t jbrd_end = 0;
+  std::vector<size_t> box_start;
+  std::vector<FramePositions> frames;
+};
+
+void AnalyzeCodestream(const jxl::PaddedBytes& data,
+                       StreamPositions* streampos) {
+  // Unbox data to codestream and mark where it is broken up by boxes.
+  std::vector<uint8_t> codestream;
+  std::vector<std::pair<size_t, size_t>> breakpoints;
+  bool codestream_end = false;
+  ASSERT_LE(2, data.size());
+  if (data[0] == 0xff && data[1] == 0x0a) {
+    codestream = std::vector<uint8_t>(data.begin(), data.end());
+    streampos->codestream_start = 0;
+  } else {
+    const uint8_t* in = data.data();
+    size_t pos = 0;
+    while (pos < data.size()) {
+      ASSERT_LE(pos + 8, data.size());
+      streampos->box_start.push_back(pos);
+      size_t box_size = LoadBE32(in + pos);
+      if (box_size == 0) box_size = data.size() - pos;
+      ASSERT_LE(pos + box_size, data.size());
+      if (memcmp(in + pos + 4, "jxlc", 4) == 0) {
+        EXPECT_TRUE(codestream.empty());
+        streampos->codestream_start = pos + 8;
+        codestream.insert(codestream.end(), in + pos + 8, in + pos + box_size);
+        codestream_end = true;
+      } else if (memcmp(in + pos + 4, "jxlp", 4) == 0) {
+        codestream_end = (LoadBE32(in + pos + 8) & 0x80000000);
+        if (codestream.empty()) {
+          streampos->codestream_start = pos + 12;
+        } else if (box_size > 12 || !codestream_end) {
+          breakpoints.push_back({codestream.size(), 12});
+        }
+        codestream.insert(codestream.end(), in + pos + 12, in + pos + box_size);
+      } else if (memcmp(in + pos + 4, "jbrd", 4) == 0) {
+        EXPECT_TRUE(codestream.empty());
+        streampos->jbrd_end = pos + box_size;
+      } else if (!codestream.empty() && !codestream_end) {
+        breakpoints.push_back({codestream.size(), box_size});
+      }
+      pos += box_size;
+    }
+    ASSERT_EQ(pos, data.size());
+  }
+  // Translate codestream positions to boxed stream positions.
+  size_t offset = streampos->codestream_start;
+  size_t bp = 0;
+  auto add_offset = [&](size_t pos) {
+    while (bp < breakpoints.size() && pos >= breakpoints[bp].first) {
+      offset += breakpoints[bp++].second;
+    }
+    return pos + offset;
+  };
+  // Analyze the unboxed codestream.
+  jxl::BitReader br(
+      jxl::Span<const uint8_t>(codestream.data(), codestream.size()));
+  ASSERT_EQ(br.ReadFixedBits<16>(), 0x0AFF);
+  jxl::CodecMetadata metadata;
+  EXPECT_TRUE(ReadSizeHeader(&br, &metadata.size));
+  EXPECT_TRUE(ReadImageMetadata(&br, &metadata.m));
+  streampos->basic_info =
+      add_offset(br.TotalBitsConsumed() / jxl::kBitsPerByte);
+  metadata.transform_data.nonserialized_xyb_encoded = metadata.m.xyb_encoded;
+  EXPECT_TRUE(jxl::Bundle::Read(&br, &metadata.transform_data));
+  EXPECT_TRUE(br.JumpToByteBoundary());
+  bool has_preview = metadata.m.have_preview;
+  while (br.TotalBitsConsumed() < br.TotalBytes() * jxl::kBitsPerByte) {
     FramePositions p;
     p.frame_start = add_offset(br.TotalBitsConsumed() / jxl::kBitsPerByte);
     jxl::FrameHeader frame_header(&metadata);
@@ -4297,6 +5350,52 @@ TEST(DecodeTest, FlushTest) {
   JxlDecoderDestroy(dec);
 }
 
+TEST(DecodeTest, FlushTestRepeatedFlush) {
+  size_t xsize = 333, ysize = 300;
+  uint32_t num_channels = 3;
+  std::vector<uint8_t> pixels =
+      jxl::test::GetSomeTestImage(xsize, ysize, num_channels, 0);
+  jxl::TestCodestreamParams params;
+  params.preview_mode = jxl::kSmallPreview;
+  jxl::PaddedBytes data = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize,
+      num_channels, params);
+  JxlPixelFormat format = {num_channels, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+
+  std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+      jxl::Span<const uint8_t>(data.data(), data.size()), format,
+      /*use_callback=*/false, /*set_buffer_early=*/false,
+      /*use_resizable_runner=*/false, /*require_boxes=*/false,
+      /*expect_success=*/true);
+
+  std::vector<uint8_t> pixels2(pixels.size());
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_FRAME | JXL_DEC_FULL_IMAGE));
+  size_t first_part = data.size() - 1;
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec, data.data(), first_part));
+  EXPECT_EQ(JXL_DEC_FRAME, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutBuffer(
+                                 dec, &format, pixels2.data(), pixels2.size()));
+  EXPECT_EQ(JXL_DEC_NEED_MORE_INPUT, JxlDecoderProcessInput(dec));
+
+  // A second flush without new input leaves the groups drawn by the first one
+  // untouched, and the output unchanged.
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderFlushImage(dec));
+  std::vector<uint8_t> flushed = pixels2;
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderFlushImage(dec));
+  EXPECT_EQ(flushed, pixels2);
+
+  // The groups completed after the flushes are drawn over the flushed output.
+  size_t consumed = first_part - JxlDecoderReleaseInput(dec);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec, data.data() + consumed,
+                                                data.size() - consumed));
+  EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(expected, pixels2);
+
+  JxlDecoderDestroy(dec);
+}
+
 TEST(DecodeTest, FlushTestImageOutCallback) {
   // Size large enough for multiple groups, required to have progressive
   // stages
@@ -4824,9 +5923,9 @@ TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructTestCodestream)) {
 }
 #endif  // JPEGXL_ENABLE_JPEG
 
-TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructionTest)) {
-  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
-  const jxl::PaddedBytes orig = jxl::test::ReadTestData(jpeg_path);
+// Recompresses `orig` into a container with a jbrd and a jxlc box.
+void CreateJPEGReconstructionContainer(const jxl::PaddedBytes& orig,
+                                       jxl::PaddedBytes* container) {
   jxl::CodecInOut orig_io;
   ASSERT_TRUE(
       jxl::jpeg::DecodeImageJPG(jxl::Span<const uint8_t>(orig), &orig_io));
@@ -4845,18 +5944,64 @@ TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructionTest)) {
   jxl::PaddedBytes jpeg_data;
   ASSERT_TRUE(
       EncodeJPEGData(*orig_io.Main().jpeg_data.get(), &jpeg_data, cparams));
-  jxl::PaddedBytes container;
-  container.append(jxl::kContainerHeader,
-                   jxl::kContainerHeader + sizeof(jxl::kContainerHeader));
+  container->append(jxl::kContainerHeader,
+                    jxl::kContainerHeader + sizeof(jxl::kContainerHeader));
   jxl::AppendBoxHeader(jxl::MakeBoxType("jbrd"), jpeg_data.size(), false,
-                       &container);
-  container.append(jpeg_data.data(), jpeg_data.data() + jpeg_data.size());
-  jxl::AppendBoxHeader(jxl::MakeBoxType("jxlc"), 0, true, &container);
+                       container);
+  container->append(jpeg_data.data(), jpeg_data.data() + jpeg_data.size());
+  jxl::AppendBoxHeader(jxl::MakeBoxType("jxlc"), 0, true, container);
   jxl::PaddedBytes codestream = std::move(writer).TakeBytes();
-  container.append(codestream.data(), codestream.data() + codestream.size());
+  container->append(codestream.data(), codestream.data() + codestream.size());
+}
+
+TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructionTest)) {
+  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
+  const jxl::PaddedBytes orig = jxl::test::ReadTestData(jpeg_path);
+  jxl::PaddedBytes container;
+  CreateJPEGReconstructionContainer(orig, &container);
   VerifyJPEGReconstruction(container, orig);
 }
 
+// The bytes of the rows of groups that are decoded are written before the rest
+// of the codestream is available.
+TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructionRowsTest)) {
+  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
+  const jxl::PaddedBytes orig = jxl::test::ReadTestData(jpeg_path);
+  jxl::PaddedBytes container;
+  CreateJPEGReconstructionContainer(orig, &container);
+
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(
+                dec.get(), JXL_DEC_JPEG_RECONSTRUCTION | JXL_DEC_FULL_IMAGE));
+  const size_t partial_size = container.size() * 3 / 4;
+  JxlDecoderSetInput(dec.get(), container.data(), partial_size);
+  EXPECT_EQ(JXL_DEC_JPEG_RECONSTRUCTION, JxlDecoderProcessInput(dec.get()));
+  std::vector<uint8_t> reconstructed_buffer(orig.size());
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetJPEGBuffer(dec.get(), reconstructed_buffer.data(),
+                                    reconstructed_buffer.size()));
+  EXPECT_EQ(JXL_DEC_NEED_MORE_INPUT, JxlDecoderProcessInput(dec.get()));
+  size_t used =
+      reconstructed_buffer.size() - JxlDecoderReleaseJPEGBuffer(dec.get());
+  EXPECT_GT(used, 0u);
+  EXPECT_LT(used, orig.size());
+  EXPECT_EQ(0, memcmp(reconstructed_buffer.data(), orig.data(), used));
+
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetJPEGBuffer(dec.get(),
+                                    reconstructed_buffer.data() + used,
+                                    reconstructed_buffer.size() - used));
+  size_t consumed = partial_size - JxlDecoderReleaseInput(dec.get());
+  JxlDecoderSetInput(dec.get(), container.data() + consumed,
+                     container.size() - consumed);
+  JxlDecoderCloseInput(dec.get());
+  EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+  used = reconstructed_buffer.size() - JxlDecoderReleaseJPEGBuffer(dec.get());
+  ASSERT_EQ(used, orig.size());
+  EXPECT_EQ(0, memcmp(reconstructed_buffer.data(), orig.data(), used));
+}
+
 TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructionMetadataTest)) {
   const std::string jpeg_path = "jxl/jpeg_reconstruction/1x1_exif_xmp.jpg";
   const std::string jxl_path = "jxl/jpeg_reconstruction/1x1_exif_xmp.jxl";
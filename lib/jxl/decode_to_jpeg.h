@@ -114,7 +114,56 @@ class JxlToJpegDecoder {
     return true;
   }
 
-  JxlDecoderStatus WriteOutput(const jpeg::JPEGData& jpeg_data) {
+  // Returns whether the output of `jpeg_data` can be written before all its
+  // coefficients are decoded: only the rows of a single scan are final before
+  // the others.
+  static bool CanWriteRows(const jpeg::JPEGData& jpeg_data) {
+    return jpeg_data.scan_info.size() == 1;
+  }
+
+  // Returns whether part of the JPEG bytestream was written by WriteRows.
+  bool IsWritingRows() const { return row_state_ != nullptr; }
+
+  // Discards the output state of WriteRows.
+  void ResetRows() { row_state_.reset(); }
+
+  // Writes the part of the JPEG bytestream that only depends on the first
+  // `num_rows` rows of the image, after the bytes written by the previous
+  // calls. Unlike with WriteOutput, the bytes written before the output buffer
+  // is full are kept.
+  JxlDecoderStatus WriteRows(const jpeg::JPEGData& jpeg_data,
+                             size_t num_rows) {
+    if (!row_state_) row_state_.reset(new jpeg::SerializationState());
+    auto write = [this](const uint8_t* buf, size_t len) {
+      size_t to_write = std::min<size_t>(avail_size_, len);
+      if (to_write != 0) memcpy(next_out_, buf, to_write);
+      next_out_ += to_write;
+      avail_size_ -= to_write;
+      return to_write;
+    };
+    Status write_result =
+        jpeg::WriteJpegRows(jpeg_data, num_rows, write, row_state_.get());
+    if (!write_result) {
+      if (avail_size_ == 0) {
+        return JXL_DEC_JPEG_NEED_MORE_OUTPUT;
+      }
+      return JXL_DEC_ERROR;
+    }
+    return JXL_DEC_SUCCESS;
+  }
+
+  JxlDecoderStatus WriteOutput(const jpeg::JPEGData& jpeg_data,
+                               ThreadPool* pool) {
+    if (row_state_) {
+      // Continue the output of WriteRows with all the rows.
+      JxlDecoderStatus status = WriteRows(jpeg_data, jpeg_data.height);
+      if (status != JXL_DEC_SUCCESS) return status;
+      if (row_state_->stage != jpeg::SerializationState::STAGE_DONE) {
+        return JXL_DEC_ERROR;
+      }
+      row_state_.reset();
+      return JXL_DEC_SUCCESS;
+    }
     // Copy JPEG bytestream if desired.
     uint8_t* tmp_next_out = next_out_;
     size_t tmp_avail_size = avail_size_;
@@ -126,7 +175,7 @@ class JxlToJpegDecoder {
       tmp_avail_size -= to_write;
       return to_write;
     };
-    Status write_result = jpeg::WriteJpeg(jpeg_data, write);
+    Status write_result = jpeg::WriteJpeg(jpeg_data, write, pool);
     if (!write_result) {
       if (tmp_avail_size == 0) {
         return JXL_DEC_JPEG_NEED_MORE_OUTPUT;
@@ -160,6 +209,9 @@ class JxlToJpegDecoder {
   uint8_t* next_out_ = nullptr;
   // Available bytes to write JPEG reconstruction to.
   size_t avail_size_ = 0;
+
+  // State of the output written by WriteRows, if any.
+  std::unique_ptr<jpeg::SerializationState> row_state_;
 };
 
 #else
@@ -205,7 +257,18 @@ class JxlToJpegDecoder {
     return JXL_DEC_ERROR;
   }
 
-  JxlDecoderStatus WriteOutput(const jpeg::JPEGData& /* jpeg_data */) {
+  static bool CanWriteRows(const jpeg::JPEGData& /* jpeg_data */) {
+    return false;
+  }
+  bool IsWritingRows() const { return false; }
+  void ResetRows() {}
+  JxlDecoderStatus WriteRows(const jpeg::JPEGData& /* jpeg_data */,
+                             size_t /* num_rows */) {
+    return JXL_DEC_SUCCESS;
+  }
+
+  JxlDecoderStatus WriteOutput(const jpeg::JPEGData& /* jpeg_data */,
+                               ThreadPool* /* pool */) {
     return JXL_DEC_SUCCESS;
   }
 };
@@ -11,6 +11,7 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdio>
+#include <limits>
 
 #undef HWY_TARGET_INCLUDE
 #define HWY_TARGET_INCLUDE "lib/jxl/enc_ac_strategy.cc"
@@ -370,18 +371,27 @@ static const float kChromaErrorWeight[AcStrategy::kNumValidStrategies] = {
     2.0f,   // DCT128X256 = 26,
 };
 
+// Returns the entropy estimate of the transform `acs` at pixel (x, y), or
+// infinity if the estimate is known to make
+// entropy_add + entropy_mul * estimate >= max_entropy before it is complete.
+// This early exit is exact because every term of the estimate is
+// non-negative, so the partial sums never decrease.
 float EstimateEntropy(const AcStrategy& acs, size_t x, size_t y,
                       const ACSConfig& config,
                       const float* JXL_RESTRICT cmap_factors, float* block,
-                      float* scratch_space, uint32_t* quantized) {
+                      float* scratch_space, uint32_t* quantized,
+                      float entropy_add, float entropy_mul, float max_entropy) {
   const size_t size = (1 << acs.log2_covered_blocks()) * kDCTBlockSize;
 
-  // Apply transform.
-  for (size_t c = 0; c < 3; c++) {
+  // Apply transform. The B channel is only transformed if the X and Y channels
+  // do not already exceed max_entropy.
+  const auto transform = [&](size_t c) {
     float* JXL_RESTRICT block_c = block + size * c;
     TransformFromPixels(acs.Strategy(), &config.Pixel(c, x, y),
                         config.src_stride, block_c, scratch_space);
-  }
+  };
+  transform(0);
+  transform(1);
 
   HWY_FULL(float) df;
 
@@ -440,6 +450,7 @@ float EstimateEntropy(const AcStrategy& acs, size_t x, size_t y,
   auto info_loss2 = Zero(df);
 
   for (size_t c = 0; c < 3; c++) {
+    if (c == 2) transform(2);
     const float* inv_matrix = config.dequant->InvMatrix(acs.RawStrategy(), c);
     const auto cmap_factor = Set(df, cmap_factors[c]);
 
@@ -478,6 +489,9 @@ float EstimateEntropy(const AcStrategy& acs, size_t x, size_t y,
     // Also add #bit of #bit of num_nonzeros, to estimate the ANS cost, with a
     // bias.
     entropy += config.zeros_mul * (CeilLog2Nonzero(nbits + 17) + nbits);
+    if (c < 2 && entropy_add + entropy_mul * entropy >= max_entropy) {
+      return std::numeric_limits<float>::infinity();
+    }
   }
   float ret =
       entropy +
@@ -570,7 +584,8 @@ uint8_t FindBest8x8Transform(size_t x, size_t y, int encoding_speed_tier,
     }
     AcStrategy acs = AcStrategy::FromRawStrategy(tx.type);
     float entropy = EstimateEntropy(acs, x, y, config, cmap_factors, block,
-                                    scratch_space, quantized);
+                                    scratch_space, quantized, tx.entropy_add,
+                                    tx.entropy_mul, best);
     entropy = tx.entropy_add + tx.entropy_mul * entropy;
     if (entropy < best) {
       best_tx = tx.type;
@@ -581,6 +596,38 @@ uint8_t FindBest8x8Transform(size_t x, size_t y, int encoding_speed_tier,
   return best_tx;
 }
 
+// Entropy estimates of the multi-block transforms tried in one 64x64 area,
+// indexed by strategy and by the position of their top-left 8x8 block in the
+// area. The estimates only depend on the pixels and fields of the area, so a
+// transform that is part of several candidate divisions is only estimated once.
+struct EntropyCache {
+  uint64_t known[AcStrategy::kNumValidStrategies] = {};
+  float entropy[AcStrategy::kNumValidStrategies][64];
+};
+
+// Returns entropy_mul times the entropy estimate of the transform `acs` at
+// block (bx + cx, by + cy), or infinity if the estimate is not cached and turns
+// out to be at least max_entropy.
+float EstimateEntropyCached(const AcStrategy& acs, size_t bx, size_t by,
+                            size_t cx, size_t cy, const ACSConfig& config,
+                            const float* JXL_RESTRICT cmap_factors,
+                            const float entropy_mul, const float max_entropy,
+                            EntropyCache* cache, float* block,
+                            float* scratch_space, uint32_t* quantized) {
+  const size_t raw_strategy = acs.RawStrategy();
+  const size_t pos = cy * 8 + cx;
+  if (cache->known[raw_strategy] & (uint64_t{1} << pos)) {
+    return entropy_mul * cache->entropy[raw_strategy][pos];
+  }
+  const float entropy = EstimateEntropy(
+      acs, (bx + cx) * 8, (by + cy) * 8, config, cmap_factors, block,
+      scratch_space, quantized, 0.0f, entropy_mul, max_entropy);
+  if (entropy == std::numeric_limits<float>::infinity()) return entropy;
+  cache->known[raw_strategy] |= uint64_t{1} << pos;
+  cache->entropy[raw_strategy][pos] = entropy;
+  return entropy_mul * entropy;
+}
+
 // bx, by addresses the 64x64 block at 8x8 subresolution
 // cx, cy addresses the left, upper 8x8 block position of the candidate
 // transform.
@@ -590,7 +637,8 @@ void TryMergeAcs(AcStrategy::Type acs_raw, size_t bx, size_t by, size_t cx,
                  AcStrategyImage* JXL_RESTRICT ac_strategy,
                  const float entropy_mul, const uint8_t candidate_priority,
                  uint8_t* priority, float* JXL_RESTRICT entropy_estimate,
-                 float* block, float* scratch_space, uint32_t* quantized) {
+                 EntropyCache* cache, float* block, float* scratch_space,
+                 uint32_t* quantized) {
   AcStrategy acs = AcStrategy::FromRawStrategy(acs_raw);
   float entropy_current = 0;
   for (size_t iy = 0; iy < acs.covered_blocks_y(); ++iy) {
@@ -604,10 +652,9 @@ void TryMergeAcs(AcStrategy::Type acs_raw, size_t bx, size_t by, size_t cx,
       entropy_current += entropy_estimate[(cy + iy) * 8 + (cx + ix)];
     }
   }
-  float entropy_candidate =
-      entropy_mul * EstimateEntropy(acs, (bx + cx) * 8, (by + cy) * 8, config,
-                                    cmap_factors, block, scratch_space,
-                                    quantized);
+  float entropy_candidate = EstimateEntropyCached(
+      acs, bx, by, cx, cy, config, cmap_factors, entropy_mul, entropy_current,
+      cache, block, scratch_space, quantized);
   if (entropy_candidate >= entropy_current) return;
   // Accept the candidate.
   for (size_t iy = 0; iy < acs.covered_blocks_y(); iy++) {
@@ -674,7 +721,8 @@ void FindBestFirstLevelDivisionForSquare(
     size_t cy, const ACSConfig& config, const float* JXL_RESTRICT cmap_factors,
     AcStrategyImage* JXL_RESTRICT ac_strategy, const float entropy_mul_JXK,
     const float entropy_mul_JXJ, float* JXL_RESTRICT entropy_estimate,
-    float* block, float* scratch_space, uint32_t* quantized) {
+    EntropyCache* cache, float* block, float* scratch_space,
+    uint32_t* quantized) {
   // We denote J for the larger dimension here, and K for the smaller.
   // For example, for 32x32 block splitting, J would be 32, K 16.
   const size_t blocks_half = blocks / 2;
@@ -721,45 +769,36 @@ void FindBestFirstLevelDivisionForSquare(
   float entropy_KXJ_top = std::numeric_limits<float>::max();
   float entropy_KXJ_bottom = std::numeric_limits<float>::max();
   float entropy_JXJ = std::numeric_limits<float>::max();
+  // Each candidate is only used if it is better than the transforms that it
+  // would replace, so its estimate can stop as soon as it is not.
   if (allow_JXK) {
     if (row0[bx + cx + 0].RawStrategy() != acs_rawJXK) {
-      entropy_JXK_left =
-          entropy_mul_JXK *
-          EstimateEntropy(acsJXK, (bx + cx + 0) * 8, (by + cy + 0) * 8, config,
-                          cmap_factors, block, scratch_space, quantized);
+      entropy_JXK_left = EstimateEntropyCached(
+          acsJXK, bx, by, cx, cy, config, cmap_factors, entropy_mul_JXK,
+          entropy[0][0] + entropy[1][0], cache, block, scratch_space,
+          quantized);
     }
     if (row0[bx + cx + blocks_half].RawStrategy() != acs_rawJXK) {
-      entropy_JXK_right =
-          entropy_mul_JXK * EstimateEntropy(acsJXK, (bx + cx + blocks_half) * 8,
-                                            (by + cy + 0) * 8, config,
-                                            cmap_factors, block, scratch_space,
-                                            quantized);
+      entropy_JXK_right = EstimateEntropyCached(
+          acsJXK, bx, by, cx + blocks_half, cy, config, cmap_factors,
+          entropy_mul_JXK, entropy[0][1] + entropy[1][1], cache, block,
+          scratch_space, quantized);
     }
   }
   if (allow_KXJ) {
     if (row0[bx + cx].RawStrategy() != acs_rawKXJ) {
-      entropy_KXJ_top =
-          entropy_mul_JXK *
-          EstimateEntropy(acsKXJ, (bx + cx + 0) * 8, (by + cy + 0) * 8, config,
-                          cmap_factors, block, scratch_space, quantized);
+      entropy_KXJ_top = EstimateEntropyCached(
+          acsKXJ, bx, by, cx, cy, config, cmap_factors, entropy_mul_JXK,
+          entropy[0][0] + entropy[0][1], cache, block, scratch_space,
+          quantized);
     }
     if (row1[bx + cx].RawStrategy() != acs_rawKXJ) {
-      entropy_KXJ_bottom =
-          entropy_mul_JXK * EstimateEntropy(acsKXJ, (bx + cx + 0) * 8,
-                                            (by + cy + blocks_half) * 8, config,
-                                            cmap_factors, block, scratch_space,
-                                            quantized);
+      entropy_KXJ_bottom = EstimateEntropyCached(
+          acsKXJ, bx, by, cx, cy + blocks_half, config, cmap_factors,
+          entropy_mul_JXK, entropy[1][0] + entropy[1][1], cache, block,
+          scratch_space, quantized);
     }
   }
-  if (allow_square_transform) {
-    // We control the exploration of the square transform separately so that
-    // we can turn it off at high decoding speeds for 32x32, but still allow
-    // exploring 16x32 and 32x16.
-    entropy_JXJ = entropy_mul_JXJ * EstimateEntropy(acsJXJ, (bx + cx + 0) * 8,
-                                                    (by + cy + 0) * 8, config,
-                                                    cmap_factors, block,
-                                                    scratch_space, quantized);
-  }
 
   // Test if this block should have JXK or KXJ transforms,
   // because it can have only one or the other.
@@ -767,6 +806,14 @@ void FindBestFirstLevelDivisionForSquare(
                   std::min(entropy_JXK_right, entropy[0][1] + entropy[1][1]);
   float costNxJ = std::min(entropy_KXJ_top, entropy[0][0] + entropy[0][1]) +
                   std::min(entropy_KXJ_bottom, entropy[1][0] + entropy[1][1]);
+  if (allow_square_transform) {
+    // We control the exploration of the square transform separately so that
+    // we can turn it off at high decoding speeds for 32x32, but still allow
+    // exploring 16x32 and 32x16.
+    entropy_JXJ = EstimateEntropyCached(
+        acsJXJ, bx, by, cx, cy, config, cmap_factors, entropy_mul_JXJ,
+        std::min(costJxN, costNxJ), cache, block, scratch_space, quantized);
+  }
   if (entropy_JXJ < costJxN && entropy_JXJ < costNxJ) {
     ac_strategy->Set(bx + cx, by + cy, acs_rawJXJ);
     SetEntropyForTransform(cx, cy, acs_rawJXJ, entropy_JXJ, entropy_estimate);
@@ -835,6 +882,7 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
   // when DCT8X8 is specified in the tree search.
   // 8x8 transforms have 10 variants, but every larger transform is just a DCT.
   float entropy_estimate[64] = {};
+  EntropyCache cache;
   // Favor all 8x8 transforms (against 16x8 and larger transforms)) at
   // low butteraugli_target distances.
   static const float k8x8mul1 = -0.55;
@@ -940,8 +988,8 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
             if ((cy | cx) % 8 == 0) {
               FindBestFirstLevelDivisionForSquare(
                   8, true, bx, by, cx, cy, config, cmap_factors, ac_strategy,
-                  tx.entropy_mul, entropy_mul64X64, entropy_estimate, block,
-                  scratch_space, quantized);
+                  tx.entropy_mul, entropy_mul64X64, entropy_estimate, &cache,
+                  block, scratch_space, quantized);
             }
             continue;
           } else if (tx.type == AcStrategy::Type::DCT32X16) {
@@ -965,7 +1013,7 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
               FindBestFirstLevelDivisionForSquare(
                   4, enable_32x32, bx, by, cx, cy, config, cmap_factors,
                   ac_strategy, tx.entropy_mul, entropy_mul32X32,
-                  entropy_estimate, block, scratch_space, quantized);
+                  entropy_estimate, &cache, block, scratch_space, quantized);
             }
             continue;
           } else if (tx.type == AcStrategy::Type::DCT32X16) {
@@ -987,8 +1035,8 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
             if ((cy | cx) % 2 == 0) {
               FindBestFirstLevelDivisionForSquare(
                   2, true, bx, by, cx, cy, config, cmap_factors, ac_strategy,
-                  tx.entropy_mul, entropy_mul16X16, entropy_estimate, block,
-                  scratch_space, quantized);
+                  tx.entropy_mul, entropy_mul16X16, entropy_estimate, &cache,
+                  block, scratch_space, quantized);
             }
             continue;
           } else if (tx.type == AcStrategy::Type::DCT16X8) {
@@ -1011,7 +1059,7 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
         // normal integral transform merging process.
         TryMergeAcs(tx.type, bx, by, cx, cy, config, cmap_factors, ac_strategy,
                     tx.entropy_mul, tx.priority, &priority[0], entropy_estimate,
-                    block, scratch_space, quantized);
+                    &cache, block, scratch_space, quantized);
       }
     }
   }
@@ -1025,7 +1073,7 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
       if ((cy | cx) % 2 != 0) {
         FindBestFirstLevelDivisionForSquare(
             2, true, bx, by, cx, cy, config, cmap_factors, ac_strategy,
-            entropy_mul16X8, entropy_mul16X16, entropy_estimate, block,
+            entropy_mul16X8, entropy_mul16X16, entropy_estimate, &cache, block,
             scratch_space, quantized);
       }
     }
@@ -1039,7 +1087,7 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
       }
       FindBestFirstLevelDivisionForSquare(
           4, enable_32x32, bx, by, cx, cy, config, cmap_factors, ac_strategy,
-          entropy_mul16X32, entropy_mul32X32, entropy_estimate, block,
+          entropy_mul16X32, entropy_mul32X32, entropy_estimate, &cache, block,
           scratch_space, quantized);
     }
   }
@@ -157,152 +157,134 @@ V SimpleGamma(const D d, V v) {
 }
 */
 
+// Applies the high frequency, color and gamma modulations of the 8x8 block at
+// (x, y) to out_val, in a single pass over the pixels of the block.
 template <class D, class V>
-V GammaModulation(const D d, const size_t x, const size_t y,
-                  const ImageF& xyb_x, const ImageF& xyb_y, const V out_val) {
-  const float kBias = 0.16f;
-  JXL_DASSERT(kBias > kOpsinAbsorbanceBias[0]);
-  JXL_DASSERT(kBias > kOpsinAbsorbanceBias[1]);
-  JXL_DASSERT(kBias > kOpsinAbsorbanceBias[2]);
-  auto overall_ratio = Zero(d);
-  auto bias = Set(d, kBias);
-  auto half = Set(d, 0.5f);
-  for (size_t dy = 0; dy < 8; ++dy) {
-    const float* const JXL_RESTRICT row_in_x = xyb_x.Row(y + dy);
-    const float* const JXL_RESTRICT row_in_y = xyb_y.Row(y + dy);
-    for (size_t dx = 0; dx < 8; dx += Lanes(d)) {
-      const auto iny = Add(Load(d, row_in_y + x + dx), bias);
-      const auto inx = Load(d, row_in_x + x + dx);
-      const auto r = Sub(iny, inx);
-      const auto g = Add(iny, inx);
-      const auto ratio_r =
-          RatioOfDerivativesOfCubicRootToSimpleGamma</*invert=*/true>(d, r);
-      const auto ratio_g =
-          RatioOfDerivativesOfCubicRootToSimpleGamma</*invert=*/true>(d, g);
-      const auto avg_ratio = Mul(half, Add(ratio_r, ratio_g));
-
-      overall_ratio = Add(overall_ratio, avg_ratio);
-    }
-  }
-  overall_ratio = Mul(SumOfLanes(d, overall_ratio), Set(d, 1.0f / 64));
-  // ideally -1.0, but likely optimal correction adds some entropy, so slightly
-  // less than that.
-  // ln(2) constant folded in because we want std::log but have FastLog2f.
-  const auto kGam = Set(d, -0.15526878023684174f * 0.693147180559945f);
-  return MulAdd(kGam, FastLog2f(d, overall_ratio), out_val);
-}
-
-template <class D, class V>
-V ColorModulation(const D d, const size_t x, const size_t y,
-                  const ImageF& xyb_x, const ImageF& xyb_y, const ImageF& xyb_b,
-                  const double butteraugli_target, V out_val) {
+V BlockModulations(const D d, const size_t x, const size_t y,
+                   const ImageF& xyb_x, const ImageF& xyb_y,
+                   const ImageF& xyb_b, const double butteraugli_target,
+                   V out_val) {
+  // Color modulation: reduce some bits from areas not blue or red, and
+  // calculate how much of the 8x8 block is covered with blue or red.
   static const float kStrengthMul = 4.0;
   static const float kRedRampStart = 0.045;
   static const float kRedRampLength = 0.09;
   static const float kBlueRampLength = 0.086890611400405895;
   static const float kBlueRampStart = 0.26973418507870539;
   const float strength = kStrengthMul * (1.0f - 0.15f * butteraugli_target);
-  if (strength < 0) {
-    return out_val;
-  }
+  const bool color_modulation = strength >= 0;
   // x values are smaller than y and b values, need to take the difference into
   // account.
   const float red_strength = strength * 6.0f;
   const float blue_strength = strength;
-  {
-    // Reduce some bits from areas not blue or red.
-    const float offset = strength * -0.007;  // 9174542291185913f;
-    out_val = Add(out_val, Set(d, offset));
-  }
-  // Calculate how much of the 8x8 block is covered with blue or red.
   auto blue_coverage = Zero(d);
   auto red_coverage = Zero(d);
   auto bias_y = Set(d, 0.2f);
   auto bias_y_add = Set(d, 0.1f);
-  for (size_t dy = 0; dy < 8; ++dy) {
-    const float* const JXL_RESTRICT row_in_x = xyb_x.Row(y + dy);
-    const float* const JXL_RESTRICT row_in_y = xyb_y.Row(y + dy);
-    const float* const JXL_RESTRICT row_in_b = xyb_b.Row(y + dy);
-    for (size_t dx = 0; dx < 8; dx += Lanes(d)) {
-      const auto pixel_y = Load(d, row_in_y + x + dx);
-      // Estimate redness-greeness relative to the intensity.
-      const auto pixel_xpy = Div(Abs(Load(d, row_in_x + x + dx)),
-                                 Max(Add(bias_y_add, pixel_y), bias_y));
-      const auto pixel_x =
-          Max(Set(d, 0.0f), Sub(pixel_xpy, Set(d, kRedRampStart)));
-      const auto pixel_b =
-          Max(Set(d, 0.0f), Sub(Load(d, row_in_b + x + dx),
-                                Add(pixel_y, Set(d, kBlueRampStart))));
-      const auto blue_slope = Min(pixel_b, Set(d, kBlueRampLength));
-      const auto red_slope = Min(pixel_x, Set(d, kRedRampLength));
-      red_coverage = Add(red_coverage, red_slope);
-      blue_coverage = Add(blue_coverage, blue_slope);
-    }
-  }
-
-  // Saturate when the high red or high blue coverage is above a level.
-  // The idea here is that if a certain fraction of the block is red or
-  // blue we consider as if it was fully red or blue.
-  static const float ratio = 28.0f;  // out of 64 pixels.
-
-  auto overall_red_coverage = SumOfLanes(d, red_coverage);
-  overall_red_coverage =
-      Min(overall_red_coverage, Set(d, ratio * kRedRampLength));
-  overall_red_coverage =
-      Mul(overall_red_coverage, Set(d, red_strength / ratio));
 
-  auto overall_blue_coverage = SumOfLanes(d, blue_coverage);
-  overall_blue_coverage =
-      Min(overall_blue_coverage, Set(d, ratio * kBlueRampLength));
-  overall_blue_coverage =
-      Mul(overall_blue_coverage, Set(d, blue_strength / ratio));
-
-  return Add(overall_red_coverage, Add(overall_blue_coverage, out_val));
-}
+  // Gamma modulation.
+  const float kBias = 0.16f;
+  JXL_DASSERT(kBias > kOpsinAbsorbanceBias[0]);
+  JXL_DASSERT(kBias > kOpsinAbsorbanceBias[1]);
+  JXL_DASSERT(kBias > kOpsinAbsorbanceBias[2]);
+  auto overall_ratio = Zero(d);
+  auto bias = Set(d, kBias);
+  auto half = Set(d, 0.5f);
 
-// Change precision in 8x8 blocks that have high frequency content.
-template <class D, class V>
-V HfModulation(const D d, const size_t x, const size_t y, const ImageF& xyb,
-               const V out_val) {
-  // Zero out the invalid differences for the rightmost value per row.
+  // High frequency modulation: change precision in 8x8 blocks that have high
+  // frequency content. Zero out the invalid differences for the rightmost
+  // value per row.
   const Rebind<uint32_t, D> du;
   HWY_ALIGN constexpr uint32_t kMaskRight[kBlockDim] = {~0u, ~0u, ~0u, ~0u,
                                                         ~0u, ~0u, ~0u, 0};
-
   auto sum = Zero(d);  // sum of absolute differences with right and below
 
   for (size_t dy = 0; dy < 8; ++dy) {
-    const float* JXL_RESTRICT row_in = xyb.Row(y + dy) + x;
+    const float* const JXL_RESTRICT row_in_x = xyb_x.Row(y + dy) + x;
+    const float* const JXL_RESTRICT row_in_y = xyb_y.Row(y + dy) + x;
+    const float* const JXL_RESTRICT row_in_b = xyb_b.Row(y + dy) + x;
     const float* JXL_RESTRICT row_in_next =
-        dy == 7 ? row_in : xyb.Row(y + dy + 1) + x;
-
-    // In SCALAR, there is no guarantee of having extra row padding.
-    // Hence, we need to ensure we don't access pixels outside the row itself.
-    // In SIMD modes, however, rows are padded, so it's safe to access one
-    // garbage value after the row. The vector then gets masked with kMaskRight
-    // to remove the influence of that value.
-#if HWY_TARGET != HWY_SCALAR
+        dy == 7 ? row_in_y : xyb_y.Row(y + dy + 1) + x;
     for (size_t dx = 0; dx < 8; dx += Lanes(d)) {
-#else
-    for (size_t dx = 0; dx < 7; dx += Lanes(d)) {
+      const auto pixel_x = Load(d, row_in_x + dx);
+      const auto pixel_y = Load(d, row_in_y + dx);
+
+      // In SCALAR, there is no guarantee of having extra row padding.
+      // Hence, we need to ensure we don't access pixels outside the row
+      // itself. In SIMD modes, however, rows are padded, so it's safe to
+      // access one garbage value after the row. The vector then gets masked
+      // with kMaskRight to remove the influence of that value.
+#if HWY_TARGET == HWY_SCALAR
+      if (dx < 7)
 #endif
-      const auto p = Load(d, row_in + dx);
-      const auto pr = LoadU(d, row_in + dx + 1);
-      const auto mask = BitCast(d, Load(du, kMaskRight + dx));
-      sum = Add(sum, And(mask, AbsDiff(p, pr)));
-
+      {
+        const auto pr = LoadU(d, row_in_y + dx + 1);
+        const auto mask = BitCast(d, Load(du, kMaskRight + dx));
+        sum = Add(sum, And(mask, AbsDiff(pixel_y, pr)));
+      }
       const auto pd = Load(d, row_in_next + dx);
-      sum = Add(sum, AbsDiff(p, pd));
+      sum = Add(sum, AbsDiff(pixel_y, pd));
+
+      if (color_modulation) {
+        // Estimate redness-greeness relative to the intensity.
+        const auto pixel_xpy =
+            Div(Abs(pixel_x), Max(Add(bias_y_add, pixel_y), bias_y));
+        const auto red =
+            Max(Set(d, 0.0f), Sub(pixel_xpy, Set(d, kRedRampStart)));
+        const auto blue =
+            Max(Set(d, 0.0f), Sub(Load(d, row_in_b + dx),
+                                  Add(pixel_y, Set(d, kBlueRampStart))));
+        const auto blue_slope = Min(blue, Set(d, kBlueRampLength));
+        const auto red_slope = Min(red, Set(d, kRedRampLength));
+        red_coverage = Add(red_coverage, red_slope);
+        blue_coverage = Add(blue_coverage, blue_slope);
+      }
+
+      const auto iny = Add(pixel_y, bias);
+      const auto r = Sub(iny, pixel_x);
+      const auto g = Add(iny, pixel_x);
+      const auto ratio_r =
+          RatioOfDerivativesOfCubicRootToSimpleGamma</*invert=*/true>(d, r);
+      const auto ratio_g =
+          RatioOfDerivativesOfCubicRootToSimpleGamma</*invert=*/true>(d, g);
+      const auto avg_ratio = Mul(half, Add(ratio_r, ratio_g));
+
+      overall_ratio = Add(overall_ratio, avg_ratio);
     }
-#if HWY_TARGET == HWY_SCALAR
-    const auto p = Load(d, row_in + 7);
-    const auto pd = Load(d, row_in_next + 7);
-    sum = Add(sum, AbsDiff(p, pd));
-#endif
   }
 
   sum = SumOfLanes(d, sum);
-  return MulAdd(sum, Set(d, -2.0052193233688884f / 112), out_val);
+  out_val = MulAdd(sum, Set(d, -2.0052193233688884f / 112), out_val);
+
+  if (color_modulation) {
+    const float offset = strength * -0.007;  // 9174542291185913f;
+    out_val = Add(out_val, Set(d, offset));
+    // Saturate when the high red or high blue coverage is above a level.
+    // The idea here is that if a certain fraction of the block is red or
+    // blue we consider as if it was fully red or blue.
+    static const float ratio = 28.0f;  // out of 64 pixels.
+
+    auto overall_red_coverage = SumOfLanes(d, red_coverage);
+    overall_red_coverage =
+        Min(overall_red_coverage, Set(d, ratio * kRedRampLength));
+    overall_red_coverage =
+        Mul(overall_red_coverage, Set(d, red_strength / ratio));
+
+    auto overall_blue_coverage = SumOfLanes(d, blue_coverage);
+    overall_blue_coverage =
+        Min(overall_blue_coverage, Set(d, ratio * kBlueRampLength));
+    overall_blue_coverage =
+        Mul(overall_blue_coverage, Set(d, blue_strength / ratio));
+
+    out_val = Add(overall_red_coverage, Add(overall_blue_coverage, out_val));
+  }
+
+  overall_ratio = Mul(SumOfLanes(d, overall_ratio), Set(d, 1.0f / 64));
+  // ideally -1.0, but likely optimal correction adds some entropy, so slightly
+  // less than that.
+  // ln(2) constant folded in because we want std::log but have FastLog2f.
+  const auto kGam = Set(d, -0.15526878023684174f * 0.693147180559945f);
+  return MulAdd(kGam, FastLog2f(d, overall_ratio), out_val);
 }
 
 void PerBlockModulations(const float butteraugli_target, const ImageF& xyb_x,
@@ -333,10 +315,8 @@ void PerBlockModulations(const float butteraugli_target, const ImageF& xyb_x,
       size_t x = ix * 8;
       auto out_val = Set(df, row_out[ix]);
       out_val = ComputeMask(df, out_val);
-      out_val = HfModulation(df, x, y, xyb_y, out_val);
-      out_val = ColorModulation(df, x, y, xyb_x, xyb_y, xyb_b,
-                                butteraugli_target, out_val);
-      out_val = GammaModulation(df, x, y, xyb_x, xyb_y, out_val);
+      out_val = BlockModulations(df, x, y, xyb_x, xyb_y, xyb_b,
+                                 butteraugli_target, out_val);
       // We want multiplicative quantization field, so everything
       // until this point has been modulating the exponent.
       row_out[ix] = FastPow2f(GetLane(out_val) * 1.442695041f) * mul + add;
@@ -359,25 +339,60 @@ float MaskingSqrt(const float v) {
   return GetLane(MaskingSqrt(DScalar(), vscalar));
 }
 
-void StoreMin4(const float v, float& min0, float& min1, float& min2,
-               float& min3) {
-  if (v < min3) {
-    if (v < min0) {
-      min3 = min2;
-      min2 = min1;
-      min1 = min0;
-      min0 = v;
-    } else if (v < min1) {
-      min3 = min2;
-      min2 = min1;
-      min1 = v;
-    } else if (v < min2) {
-      min3 = min2;
-      min2 = v;
-    } else {
-      min3 = v;
-    }
-  }
+// Inserts v into min0 <= min1 <= min2 <= min3, dropping the largest value.
+template <class V>
+HWY_INLINE void StoreMin4(const V v, V& min0, V& min1, V& min2, V& min3) {
+  const V t0 = Max(min0, v);
+  min0 = Min(min0, v);
+  const V t1 = Max(min1, t0);
+  min1 = Min(min1, t0);
+  const V t2 = Max(min2, t1);
+  min2 = Min(min2, t1);
+  min3 = Min(min3, t2);
+}
+
+// Sorts the four values in increasing order.
+template <class V>
+HWY_INLINE void Sort4(V& min0, V& min1, V& min2, V& min3) {
+  const auto compare_exchange = [](V& a, V& b) {
+    const V lo = Min(a, b);
+    b = Max(a, b);
+    a = lo;
+  };
+  compare_exchange(min0, min1);
+  compare_exchange(min2, min3);
+  compare_exchange(min0, min2);
+  compare_exchange(min1, min3);
+  compare_exchange(min1, min2);
+}
+
+// Stores the weighted sum of the four smallest values of the 3x3
+// neighbourhoods of Lanes(d) consecutive pixels. The neighbours of the first
+// pixel are at xm1, x and xp1 of rows rowt, row and rowb.
+template <class D>
+HWY_INLINE void FuzzyErosionPixels(const D d, const float* rowt,
+                                   const float* row, const float* rowb,
+                                   size_t xm1, size_t x, size_t xp1,
+                                   float* out) {
+  auto min0 = LoadU(d, row + x);
+  auto min1 = LoadU(d, row + xm1);
+  auto min2 = LoadU(d, row + xp1);
+  auto min3 = LoadU(d, rowt + xm1);
+  Sort4(min0, min1, min2, min3);
+  // The remaining five values of a 3x3 neighbourhood.
+  StoreMin4(LoadU(d, rowt + x), min0, min1, min2, min3);
+  StoreMin4(LoadU(d, rowt + xp1), min0, min1, min2, min3);
+  StoreMin4(LoadU(d, rowb + xm1), min0, min1, min2, min3);
+  StoreMin4(LoadU(d, rowb + x), min0, min1, min2, min3);
+  StoreMin4(LoadU(d, rowb + xp1), min0, min1, min2, min3);
+  static const float kMul0 = 0.125f;
+  static const float kMul1 = 0.075f;
+  static const float kMul2 = 0.06f;
+  static const float kMul3 = 0.05f;
+  auto v = Add(Mul(Set(d, kMul0), min0), Mul(Set(d, kMul1), min1));
+  v = Add(v, Mul(Set(d, kMul2), min2));
+  v = Add(v, Mul(Set(d, kMul3), min3));
+  StoreU(v, d, out);
 }
 
 // Look for smooth areas near the area of degradation.
@@ -391,6 +406,11 @@ void FuzzyErosion(const Rect& from_rect, const ImageF& from,
   static_assert(kStep == 1, "Step must be 1");
   JXL_ASSERT(to_rect.xsize() * 2 == from_rect.xsize());
   JXL_ASSERT(to_rect.ysize() * 2 == from_rect.ysize());
+  JXL_ASSERT(from_rect.xsize() <= kEncTileDimInBlocks * 2);
+  const HWY_FULL(float) df;
+  const HWY_CAPPED(float, 1) d1;
+  // Eroded values of one row at full resolution.
+  HWY_ALIGN float row_eroded[kEncTileDimInBlocks * 2];
   for (size_t fy = 0; fy < from_rect.ysize(); ++fy) {
     size_t y = fy + from_rect.y0();
     size_t ym1 = y >= kStep ? y - kStep : y;
@@ -398,38 +418,32 @@ void FuzzyErosion(const Rect& from_rect, const ImageF& from,
     const float* rowt = from.Row(ym1);
     const float* row = from.Row(y);
     const float* rowb = from.Row(yp1);
-    float* row_out = to_rect.Row(to, fy / 2);
-    for (size_t fx = 0; fx < from_rect.xsize(); ++fx) {
+    const auto border_pixel = [&](size_t fx) {
       size_t x = fx + from_rect.x0();
       size_t xm1 = x >= kStep ? x - kStep : x;
       size_t xp1 = x + kStep < xsize ? x + kStep : x;
-      float min0 = row[x];
-      float min1 = row[xm1];
-      float min2 = row[xp1];
-      float min3 = rowt[xm1];
-      // Sort the first four values.
-      if (min0 > min1) std::swap(min0, min1);
-      if (min0 > min2) std::swap(min0, min2);
-      if (min0 > min3) std::swap(min0, min3);
-      if (min1 > min2) std::swap(min1, min2);
-      if (min1 > min3) std::swap(min1, min3);
-      if (min2 > min3) std::swap(min2, min3);
-      // The remaining five values of a 3x3 neighbourhood.
-      StoreMin4(rowt[x], min0, min1, min2, min3);
-      StoreMin4(rowt[xp1], min0, min1, min2, min3);
-      StoreMin4(rowb[xm1], min0, min1, min2, min3);
-      StoreMin4(rowb[x], min0, min1, min2, min3);
-      StoreMin4(rowb[xp1], min0, min1, min2, min3);
-      static const float kMul0 = 0.125f;
-      static const float kMul1 = 0.075f;
-      static const float kMul2 = 0.06f;
-      static const float kMul3 = 0.05f;
-      float v = kMul0 * min0 + kMul1 * min1 + kMul2 * min2 + kMul3 * min3;
-      if (fx % 2 == 0 && fy % 2 == 0) {
-        row_out[fx / 2] = v;
+      FuzzyErosionPixels(d1, rowt, row, rowb, xm1, x, xp1, row_eroded + fx);
+    };
+    size_t fx = 0;
+    if (from_rect.x0() == 0) border_pixel(fx++);
+    // The right neighbours of all the lanes must be inside the image.
+    for (; fx + from_rect.x0() + Lanes(df) < xsize &&
+           fx + Lanes(df) <= from_rect.xsize();
+         fx += Lanes(df)) {
+      const size_t x = fx + from_rect.x0();
+      FuzzyErosionPixels(df, rowt, row, rowb, x - 1, x, x + 1,
+                         row_eroded + fx);
+    }
+    for (; fx < from_rect.xsize(); ++fx) border_pixel(fx);
+
+    float* row_out = to_rect.Row(to, fy / 2);
+    for (size_t tx = 0; tx < to_rect.xsize(); ++tx) {
+      if (fy % 2 == 0) {
+        row_out[tx] = row_eroded[2 * tx];
       } else {
-        row_out[fx / 2] += v;
+        row_out[tx] += row_eroded[2 * tx];
       }
+      row_out[tx] += row_eroded[2 * tx + 1];
     }
   }
 }
@@ -715,6 +729,42 @@ ImageF TileDistMap(const ImageF& distmap, int tile_size, int margin,
   return tile_distmap;
 }
 
+// Returns the indices of the tiles of `tile_comparator` whose diffmap may
+// differ between the `before` and `after` images, that is the tiles that have
+// a changed pixel within their border.
+std::vector<uint32_t> ChangedTiles(
+    const Image3F& before, const Image3F& after,
+    const JxlButteraugliTileComparator& tile_comparator) {
+  const size_t tile_dim = tile_comparator.tile_dim();
+  constexpr size_t kBorder = JxlButteraugliTileComparator::kBorder;
+  const size_t xsize_tiles = tile_comparator.xsize_tiles();
+  const size_t ysize_tiles = tile_comparator.ysize_tiles();
+  std::vector<bool> changed(xsize_tiles * ysize_tiles);
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t y = 0; y < before.ysize(); y++) {
+      const float* JXL_RESTRICT row_before = before.ConstPlaneRow(c, y);
+      const float* JXL_RESTRICT row_after = after.ConstPlaneRow(c, y);
+      const size_t ty0 = y < kBorder ? 0 : (y - kBorder) / tile_dim;
+      const size_t ty1 = std::min((y + kBorder) / tile_dim, ysize_tiles - 1);
+      for (size_t x = 0; x < before.xsize(); x++) {
+        if (row_before[x] == row_after[x]) continue;
+        const size_t tx0 = x < kBorder ? 0 : (x - kBorder) / tile_dim;
+        const size_t tx1 = std::min((x + kBorder) / tile_dim, xsize_tiles - 1);
+        for (size_t ty = ty0; ty <= ty1; ty++) {
+          for (size_t tx = tx0; tx <= tx1; tx++) {
+            changed[ty * xsize_tiles + tx] = true;
+          }
+        }
+      }
+    }
+  }
+  std::vector<uint32_t> tiles;
+  for (size_t i = 0; i < changed.size(); i++) {
+    if (changed[i]) tiles.push_back(i);
+  }
+  return tiles;
+}
+
 constexpr float kDcQuantPow = 0.87f;
 static const float kDcQuant = 1.295f;
 static const float kAcQuant = 0.8377f;
@@ -766,14 +816,22 @@ void FindBestQuantization(const ImageBundle& linear, const Image3F& opsin,
   if (fabs(params.intensity_target - 255.0f) < 1e-3) {
     params.intensity_target = 80.0f;
   }
-  JxlButteraugliComparator comparator(params, cms);
+  JxlButteraugliComparator comparator(params, cms, pool);
   JXL_CHECK(comparator.SetReferenceImage(linear));
   bool lower_is_better =
       (comparator.GoodQualityScore() < comparator.BadQualityScore());
+  // Iterations that only change the quantization of some areas of the image,
+  // which are common in the last ones, only compare the changed tiles again.
+  JxlButteraugliTileComparator tile_comparator(params, cms);
+  JXL_CHECK(tile_comparator.SetReferenceImage(linear));
+  const size_t num_tiles =
+      tile_comparator.xsize_tiles() * tile_comparator.ysize_tiles();
+  Image3F prev_dec_linear;
   const float initial_quant_dc = InitialQuantDC(butteraugli_target);
   AdjustQuantField(enc_state->shared.ac_strategy, Rect(quant_field),
                    &quant_field);
   ImageF tile_distmap;
+  ImageF diffmap;
   ImageF initial_quant_field = CopyImage(quant_field);
 
   float initial_qf_min, initial_qf_max;
@@ -809,12 +867,28 @@ void FindBestQuantization(const ImageBundle& linear, const Image3F& opsin,
     ImageBundle dec_linear = RoundtripImage(opsin, enc_state, cms, pool);
     PROFILER_ZONE("enc Butteraugli");
     float score;
-    ImageF diffmap;
-    JXL_CHECK(comparator.CompareWith(dec_linear, &diffmap, &score));
-    if (!lower_is_better) {
-      score = -score;
-      diffmap = ScaleImage(-1.0f, diffmap);
+    std::vector<uint32_t> changed_tiles;
+    if (i != 0 && lower_is_better) {
+      changed_tiles = ChangedTiles(prev_dec_linear, *dec_linear.color(),
+                                   tile_comparator);
+    }
+    if (i == 0 || !lower_is_better || changed_tiles.size() * 2 > num_tiles) {
+      JXL_CHECK(comparator.CompareWith(dec_linear, &diffmap, &score));
+      if (!lower_is_better) {
+        score = -score;
+        diffmap = ScaleImage(-1.0f, diffmap);
+      }
+    } else {
+      JXL_CHECK(tile_comparator.SetActualImage(dec_linear));
+      JXL_CHECK(RunOnPool(
+          pool, 0, changed_tiles.size(), ThreadPool::NoInit,
+          [&](const uint32_t k, size_t /* thread */) {
+            tile_comparator.CompareTile(changed_tiles[k], &diffmap);
+          },
+          "ButteraugliTiles"));
+      score = ButteraugliScoreFromDiffmap(diffmap, &params);
     }
+    if (i != iters) prev_dec_linear = CopyImage(*dec_linear.color());
     tile_distmap = TileDistMap(diffmap, 8 * cparams.resampling, 0,
                                enc_state->shared.ac_strategy);
     if (WantDebugOutput(aux_out)) {
@@ -1049,7 +1123,8 @@ void FindBestQuantizer(const ImageBundle* linear, const Image3F& opsin,
   if (cparams.max_error_mode) {
     PROFILER_ZONE("enc find best maxerr");
     FindBestQuantizationMaxError(opsin, enc_state, cms, pool, aux_out);
-  } else if (cparams.speed_tier <= SpeedTier::kKitten) {
+  } else if (cparams.speed_tier <= SpeedTier::kKitten &&
+             cparams.max_butteraugli_iters > 0) {
     // Normal encoding to a butteraugli score.
     PROFILER_ZONE("enc find best2");
     FindBestQuantization(*linear, opsin, enc_state, cms, pool, aux_out);
@@ -1089,6 +1164,8 @@ ImageBundle RoundtripImage(const Image3F& opsin, PassesEncoderState* enc_state,
   options.use_slow_render_pipeline = false;
   options.coalescing = true;
   options.render_spotcolors = false;
+  options.num_decoded_extra_channels = SIZE_MAX;
+  options.collect_stats = false;
 
   // Same as dec_state->shared->frame_header.nonserialized_metadata->m
   const ImageMetadata& metadata = *decoded.metadata();
@@ -558,7 +558,8 @@ void ChooseUintConfigs(const HistogramParams& params,
                        const std::vector<std::vector<Token>>& tokens,
                        const std::vector<uint8_t>& context_map,
                        std::vector<Histogram>* clustered_histograms,
-                       EntropyEncodingData* codes, size_t* log_alpha_size) {
+                       EntropyEncodingData* codes, size_t* log_alpha_size,
+                       ThreadPool* pool) {
   codes->uint_config.resize(clustered_histograms->size());
 
   if (params.uint_method == HistogramParams::HybridUintMethod::kNone) return;
@@ -614,19 +615,20 @@ void ChooseUintConfigs(const HistogramParams& params,
     };
   }
 
-  std::vector<float> costs(clustered_histograms->size(),
-                           std::numeric_limits<float>::max());
-  std::vector<uint32_t> extra_bits(clustered_histograms->size());
-  std::vector<uint8_t> is_valid(clustered_histograms->size());
+  const size_t num_histograms = clustered_histograms->size();
   size_t max_alpha =
       codes->use_prefix_code ? PREFIX_MAX_ALPHABET_SIZE : ANS_MAX_ALPHABET_SIZE;
-  for (HybridUintConfig cfg : configs) {
-    std::fill(is_valid.begin(), is_valid.end(), true);
-    std::fill(extra_bits.begin(), extra_bits.end(), 0);
-
-    for (size_t i = 0; i < clustered_histograms->size(); i++) {
-      (*clustered_histograms)[i].Clear();
-    }
+  // The cost of each histogram with each config; configs are evaluated in
+  // parallel and chosen in order afterwards. Invalid combinations keep an
+  // infinite cost.
+  std::vector<float> config_costs(configs.size() * num_histograms,
+                                  std::numeric_limits<float>::infinity());
+  const auto evaluate_config = [&](const uint32_t config_idx,
+                                   size_t /* thread */) {
+    const HybridUintConfig cfg = configs[config_idx];
+    std::vector<Histogram> histograms(num_histograms);
+    std::vector<uint32_t> extra_bits(num_histograms);
+    std::vector<uint8_t> is_valid(num_histograms, true);
     for (size_t i = 0; i < tokens.size(); ++i) {
       for (size_t j = 0; j < tokens[i].size(); ++j) {
         const Token token = tokens[i][j];
@@ -641,18 +643,28 @@ void ChooseUintConfigs(const HistogramParams& params,
           continue;
         }
         extra_bits[histo] += nbits;
-        (*clustered_histograms)[histo].Add(tok);
+        histograms[histo].Add(tok);
       }
     }
 
-    for (size_t i = 0; i < clustered_histograms->size(); i++) {
+    for (size_t i = 0; i < num_histograms; i++) {
       if (!is_valid[i]) continue;
-      float cost = (*clustered_histograms)[i].PopulationCost() + extra_bits[i];
+      float cost = histograms[i].PopulationCost() + extra_bits[i];
       // add signaling cost of the hybriduintconfig itself
       cost += CeilLog2Nonzero(cfg.split_exponent + 1);
       cost += CeilLog2Nonzero(cfg.split_exponent - cfg.msb_in_token + 1);
+      config_costs[config_idx * num_histograms + i] = cost;
+    }
+  };
+  JXL_CHECK(RunOnPool(pool, 0, configs.size(), ThreadPool::NoInit,
+                      evaluate_config, "ChooseUintConfigs"));
+
+  std::vector<float> costs(num_histograms, std::numeric_limits<float>::max());
+  for (size_t config_idx = 0; config_idx < configs.size(); config_idx++) {
+    for (size_t i = 0; i < num_histograms; i++) {
+      const float cost = config_costs[config_idx * num_histograms + i];
       if (cost < costs[i]) {
-        codes->uint_config[i] = cfg;
+        codes->uint_config[i] = configs[config_idx];
         costs[i] = cost;
       }
     }
@@ -692,12 +704,20 @@ class HistogramBuilder {
     histograms_[histo_idx].Add(symbol);
   }
 
+  void AddHistograms(const HistogramBuilder& other) {
+    JXL_DASSERT(other.histograms_.size() == histograms_.size());
+    for (size_t i = 0; i < histograms_.size(); ++i) {
+      histograms_[i].AddHistogram(other.histograms_[i]);
+    }
+  }
+
   // NOTE: `layer` is only for clustered_entropy; caller does ReclaimAndCharge.
   size_t BuildAndStoreEntropyCodes(
       const HistogramParams& params,
       const std::vector<std::vector<Token>>& tokens, EntropyEncodingData* codes,
       std::vector<uint8_t>* context_map, bool use_prefix_code,
-      BitWriter* writer, size_t layer, AuxOut* aux_out) const {
+      BitWriter* writer, size_t layer, AuxOut* aux_out,
+      ThreadPool* pool) const {
     size_t cost = 0;
     codes->encoding_info.clear();
     std::vector<Histogram> clustered_histograms(histograms_);
@@ -706,7 +726,7 @@ class HistogramBuilder {
       if (!ans_fuzzer_friendly_) {
         std::vector<uint32_t> histogram_symbols;
         ClusterHistograms(params, histograms_, kClustersLimit,
-                          &clustered_histograms, &histogram_symbols);
+                          &clustered_histograms, &histogram_symbols, pool);
         for (size_t c = 0; c < histograms_.size(); ++c) {
           (*context_map)[c] = static_cast<uint8_t>(histogram_symbols[c]);
         }
@@ -741,7 +761,7 @@ class HistogramBuilder {
       codes->uint_config.resize(1, HybridUintConfig(7, 0, 0));
     } else {
       ChooseUintConfigs(params, tokens, *context_map, &clustered_histograms,
-                        codes, &log_alpha_size);
+                        codes, &log_alpha_size, pool);
     }
     if (log_alpha_size < 5) log_alpha_size = 5;
     SizeWriter size_writer;  // Used if writer == nullptr to estimate costs.
@@ -939,6 +959,20 @@ void ApplyLZ77_RLE(const HistogramParams& params, size_t num_contexts,
   }
 }
 
+// Returns the length of the common prefix of a and b, up to max_len.
+// Compares four values at a time, which compilers turn into vector compares.
+size_t MatchLength(const uint32_t* a, const uint32_t* b, size_t max_len) {
+  size_t len = 0;
+  for (; len + 4 <= max_len; len += 4) {
+    if ((a[len] ^ b[len]) | (a[len + 1] ^ b[len + 1]) |
+        (a[len + 2] ^ b[len + 2]) | (a[len + 3] ^ b[len + 3])) {
+      break;
+    }
+  }
+  while (len < max_len && a[len] == b[len]) len++;
+  return len;
+}
+
 // Hash chain for LZ77 matching
 struct HashChain {
   size_t size_;
@@ -1088,10 +1122,7 @@ struct HashChain {
           i += r;
           j += r;
         }
-        while (i < end && data_[i] == data_[j]) {
-          i++;
-          j++;
-        }
+        if (i < end) i += MatchLength(&data_[i], &data_[j], end - i);
         len = i - pos;
         // This can trigger even if the new length is slightly smaller than the
         // best length, because it is possible for a slightly cheaper distance
@@ -1212,22 +1243,24 @@ float DistCost(size_t dist) {
 void ApplyLZ77_LZ77(const HistogramParams& params, size_t num_contexts,
                     const std::vector<std::vector<Token>>& tokens,
                     LZ77Params& lz77,
-                    std::vector<std::vector<Token>>& tokens_lz77) {
+                    std::vector<std::vector<Token>>& tokens_lz77,
+                    ThreadPool* pool) {
   // TODO(veluca): tune heuristics here.
   SymbolCostEstimator sce(num_contexts, params.force_huffman, tokens, lz77);
-  float bit_decrease = 0;
   size_t total_symbols = 0;
   tokens_lz77.resize(tokens.size());
-  HybridUintConfig uint_config;
-  std::vector<float> sym_cost;
-  for (size_t stream = 0; stream < tokens.size(); stream++) {
+  // Streams are matched independently, possibly in parallel; the estimated
+  // savings are summed in stream order afterwards.
+  std::vector<float> stream_bit_decrease(tokens.size());
+  const auto process_stream = [&](const uint32_t stream, size_t /* thread */) {
+    HybridUintConfig uint_config;
+    float bit_decrease = 0;
     size_t distance_multiplier =
         params.image_widths.size() > stream ? params.image_widths[stream] : 0;
     const auto& in = tokens[stream];
     auto& out = tokens_lz77[stream];
-    total_symbols += in.size();
     // Cumulative sum of bit costs.
-    sym_cost.resize(in.size() + 1);
+    std::vector<float> sym_cost(in.size() + 1);
     for (size_t i = 0; i < in.size(); i++) {
       uint32_t tok, nbits, unused_bits;
       uint_config.Encode(in[i].value, &tok, &nbits, &unused_bits);
@@ -1306,8 +1339,16 @@ void ApplyLZ77_LZ77(const HistogramParams& params, size_t num_contexts,
         // Literal, already pushed
       }
     }
-  }
+    stream_bit_decrease[stream] = bit_decrease;
+  };
+  JXL_CHECK(RunOnPool(pool, 0, tokens.size(), ThreadPool::NoInit,
+                      process_stream, "ApplyLZ77"));
 
+  float bit_decrease = 0;
+  for (size_t stream = 0; stream < tokens.size(); stream++) {
+    total_symbols += tokens[stream].size();
+    bit_decrease += stream_bit_decrease[stream];
+  }
   if (bit_decrease > total_symbols * 0.2 + 16) {
     lz77.enabled = true;
   }
@@ -1316,25 +1357,26 @@ void ApplyLZ77_LZ77(const HistogramParams& params, size_t num_contexts,
 void ApplyLZ77_Optimal(const HistogramParams& params, size_t num_contexts,
                        const std::vector<std::vector<Token>>& tokens,
                        LZ77Params& lz77,
-                       std::vector<std::vector<Token>>& tokens_lz77) {
+                       std::vector<std::vector<Token>>& tokens_lz77,
+                       ThreadPool* pool) {
   std::vector<std::vector<Token>> tokens_for_cost_estimate;
-  ApplyLZ77_LZ77(params, num_contexts, tokens, lz77, tokens_for_cost_estimate);
+  ApplyLZ77_LZ77(params, num_contexts, tokens, lz77, tokens_for_cost_estimate,
+                 pool);
   // If greedy-LZ77 does not give better compression than no-lz77, no reason to
   // run the optimal matching.
   if (!lz77.enabled) return;
   SymbolCostEstimator sce(num_contexts + 1, params.force_huffman,
                           tokens_for_cost_estimate, lz77);
   tokens_lz77.resize(tokens.size());
-  HybridUintConfig uint_config;
-  std::vector<float> sym_cost;
-  std::vector<uint32_t> dist_symbols;
-  for (size_t stream = 0; stream < tokens.size(); stream++) {
+  const auto process_stream = [&](const uint32_t stream, size_t /* thread */) {
+    HybridUintConfig uint_config;
+    std::vector<uint32_t> dist_symbols;
     size_t distance_multiplier =
         params.image_widths.size() > stream ? params.image_widths[stream] : 0;
     const auto& in = tokens[stream];
     auto& out = tokens_lz77[stream];
     // Cumulative sum of bit costs.
-    sym_cost.resize(in.size() + 1);
+    std::vector<float> sym_cost(in.size() + 1);
     for (size_t i = 0; i < in.size(); i++) {
       uint32_t tok, nbits, unused_bits;
       uint_config.Encode(in[i].value, &tok, &nbits, &unused_bits);
@@ -1442,12 +1484,14 @@ void ApplyLZ77_Optimal(const HistogramParams& params, size_t num_contexts,
       pos -= prefix_costs[pos].len;
     }
     std::reverse(out.begin(), out.end());
-  }
+  };
+  JXL_CHECK(RunOnPool(pool, 0, tokens.size(), ThreadPool::NoInit,
+                      process_stream, "ApplyLZ77Optimal"));
 }
 
 void ApplyLZ77(const HistogramParams& params, size_t num_contexts,
                const std::vector<std::vector<Token>>& tokens, LZ77Params& lz77,
-               std::vector<std::vector<Token>>& tokens_lz77) {
+               std::vector<std::vector<Token>>& tokens_lz77, ThreadPool* pool) {
   lz77.enabled = false;
   if (params.force_huffman) {
     lz77.min_symbol = std::min(PREFIX_MAX_ALPHABET_SIZE - 32, 512);
@@ -1459,9 +1503,9 @@ void ApplyLZ77(const HistogramParams& params, size_t num_contexts,
   } else if (params.lz77_method == HistogramParams::LZ77Method::kRLE) {
     ApplyLZ77_RLE(params, num_contexts, tokens, lz77, tokens_lz77);
   } else if (params.lz77_method == HistogramParams::LZ77Method::kLZ77) {
-    ApplyLZ77_LZ77(params, num_contexts, tokens, lz77, tokens_lz77);
+    ApplyLZ77_LZ77(params, num_contexts, tokens, lz77, tokens_lz77, pool);
   } else if (params.lz77_method == HistogramParams::LZ77Method::kOptimal) {
-    ApplyLZ77_Optimal(params, num_contexts, tokens, lz77, tokens_lz77);
+    ApplyLZ77_Optimal(params, num_contexts, tokens, lz77, tokens_lz77, pool);
   } else {
     JXL_ABORT("Not implemented");
   }
@@ -1474,11 +1518,11 @@ size_t BuildAndEncodeHistograms(const HistogramParams& params,
                                 EntropyEncodingData* codes,
                                 std::vector<uint8_t>* context_map,
                                 BitWriter* writer, size_t layer,
-                                AuxOut* aux_out) {
+                                AuxOut* aux_out, ThreadPool* pool) {
   size_t total_bits = 0;
   codes->lz77.nonserialized_distance_context = num_contexts;
   std::vector<std::vector<Token>> tokens_lz77;
-  ApplyLZ77(params, num_contexts, tokens, codes->lz77, tokens_lz77);
+  ApplyLZ77(params, num_contexts, tokens, codes->lz77, tokens_lz77, pool);
   if (ans_fuzzer_friendly_) {
     codes->lz77.length_uint_config = HybridUintConfig(10, 0, 0);
     codes->lz77.min_symbol = 2048;
@@ -1489,6 +1533,10 @@ size_t BuildAndEncodeHistograms(const HistogramParams& params,
                                  128 + num_contexts * 40 + max_contexts * 96);
   if (writer) {
     JXL_CHECK(Bundle::Write(codes->lz77, writer, layer, aux_out));
+    if (aux_out != nullptr) {
+      ++aux_out->num_entropy_codes;
+      if (codes->lz77.enabled) ++aux_out->num_lz77_codes;
+    }
   } else {
     size_t ebits, bits;
     JXL_CHECK(Bundle::CanEncode(codes->lz77, &ebits, &bits));
@@ -1523,34 +1571,56 @@ size_t BuildAndEncodeHistograms(const HistogramParams& params,
   if (ans_fuzzer_friendly_) {
     uint_config = HybridUintConfig(10, 0, 0);
   }
-  for (size_t i = 0; i < tokens.size(); ++i) {
+  const auto visit_tokens = [&](const std::vector<Token>& stream,
+                                HistogramBuilder* JXL_RESTRICT b) {
     if (codes->lz77.enabled) {
-      for (size_t j = 0; j < tokens[i].size(); ++j) {
-        const Token& token = tokens[i][j];
-        total_tokens++;
+      for (size_t j = 0; j < stream.size(); ++j) {
+        const Token& token = stream[j];
         uint32_t tok, nbits, bits;
         (token.is_lz77_length ? codes->lz77.length_uint_config : uint_config)
             .Encode(token.value, &tok, &nbits, &bits);
         tok += token.is_lz77_length ? codes->lz77.min_symbol : 0;
-        builder.VisitSymbol(tok, token.context);
+        b->VisitSymbol(tok, token.context);
       }
     } else if (num_contexts == 1) {
-      for (size_t j = 0; j < tokens[i].size(); ++j) {
-        const Token& token = tokens[i][j];
-        total_tokens++;
+      for (size_t j = 0; j < stream.size(); ++j) {
+        const Token& token = stream[j];
         uint32_t tok, nbits, bits;
         uint_config.Encode(token.value, &tok, &nbits, &bits);
-        builder.VisitSymbol(tok, /*token.context=*/0);
+        b->VisitSymbol(tok, /*token.context=*/0);
       }
     } else {
-      for (size_t j = 0; j < tokens[i].size(); ++j) {
-        const Token& token = tokens[i][j];
-        total_tokens++;
+      for (size_t j = 0; j < stream.size(); ++j) {
+        const Token& token = stream[j];
         uint32_t tok, nbits, bits;
         uint_config.Encode(token.value, &tok, &nbits, &bits);
-        builder.VisitSymbol(tok, token.context);
+        b->VisitSymbol(tok, token.context);
       }
     }
+  };
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    total_tokens += tokens[i].size();
+  }
+  if (pool == nullptr || tokens.size() <= 1) {
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      visit_tokens(tokens[i], &builder);
+    }
+  } else {
+    // Histograms only hold counts, so merging per-thread partial histograms
+    // gives the same result as a single pass.
+    std::vector<HistogramBuilder> thread_builders;
+    const auto init_builders = [&](const size_t num_threads) {
+      thread_builders.assign(num_threads, HistogramBuilder(num_contexts));
+      return true;
+    };
+    const auto build_histograms = [&](const uint32_t i, const size_t thread) {
+      visit_tokens(tokens[i], &thread_builders[thread]);
+    };
+    JXL_CHECK(RunOnPool(pool, 0, tokens.size(), init_builders,
+                        build_histograms, "BuildHistograms"));
+    for (const HistogramBuilder& thread_builder : thread_builders) {
+      builder.AddHistograms(thread_builder);
+    }
   }
 
   bool use_prefix_code =
@@ -1570,9 +1640,9 @@ size_t BuildAndEncodeHistograms(const HistogramParams& params,
   }
 
   // Encode histograms.
-  total_bits += builder.BuildAndStoreEntropyCodes(params, tokens, codes,
-                                                  context_map, use_prefix_code,
-                                                  writer, layer, aux_out);
+  total_bits += builder.BuildAndStoreEntropyCodes(
+      params, tokens, codes, context_map, use_prefix_code, writer, layer,
+      aux_out, pool);
   allotment.FinishedHistogram(writer);
   allotment.ReclaimAndCharge(writer, layer, aux_out);
 
@@ -1583,29 +1653,62 @@ size_t BuildAndEncodeHistograms(const HistogramParams& params,
   return total_bits;
 }
 
-size_t WriteTokens(const std::vector<Token>& tokens,
-                   const EntropyEncodingData& codes,
-                   const std::vector<uint8_t>& context_map, BitWriter* writer) {
+namespace {
+
+// Prefix codes are written in token order. The code and the extra bits of
+// consecutive tokens are packed into a 64-bit word that is handed to the
+// BitWriter only when full, instead of one BitWriter::Write per token. With a
+// single histogram and no LZ77 there is no context map or LZ77 lookup.
+template <bool kSingleHistogram>
+size_t WritePrefixTokens(const std::vector<Token>& tokens,
+                         const EntropyEncodingData& codes,
+                         const std::vector<uint8_t>& context_map,
+                         BitWriter* writer) {
   size_t num_extra_bits = 0;
-  if (codes.use_prefix_code) {
-    for (size_t i = 0; i < tokens.size(); i++) {
-      uint32_t tok, nbits, bits;
-      const Token& token = tokens[i];
-      size_t histo = context_map[token.context];
+  uint64_t allbits = 0;
+  size_t numallbits = 0;
+  for (const Token& token : tokens) {
+    uint32_t tok, nbits, bits;
+    size_t histo = 0;
+    if (kSingleHistogram) {
+      codes.uint_config[0].Encode(token.value, &tok, &nbits, &bits);
+    } else {
+      histo = context_map[token.context];
       (token.is_lz77_length ? codes.lz77.length_uint_config
                             : codes.uint_config[histo])
           .Encode(token.value, &tok, &nbits, &bits);
       tok += token.is_lz77_length ? codes.lz77.min_symbol : 0;
-      // Combine two calls to the BitWriter. Equivalent to:
-      // writer->Write(codes.encoding_info[histo][tok].depth,
-      //               codes.encoding_info[histo][tok].bits);
-      // writer->Write(nbits, bits);
-      uint64_t data = codes.encoding_info[histo][tok].bits;
-      data |= bits << codes.encoding_info[histo][tok].depth;
-      writer->Write(codes.encoding_info[histo][tok].depth + nbits, data);
-      num_extra_bits += nbits;
     }
-    return num_extra_bits;
+    const ANSEncSymbolInfo& info = codes.encoding_info[histo][tok];
+    // Same as writer->Write(info.depth, info.bits); writer->Write(nbits, bits);
+    const uint64_t data =
+        info.bits | (static_cast<uint64_t>(bits) << info.depth);
+    const size_t data_nbits = info.depth + nbits;
+    if (JXL_UNLIKELY(numallbits + data_nbits > BitWriter::kMaxBitsPerCall)) {
+      writer->Write(numallbits, allbits);
+      allbits = numallbits = 0;
+    }
+    allbits |= data << numallbits;
+    numallbits += data_nbits;
+    num_extra_bits += nbits;
+  }
+  if (numallbits != 0) writer->Write(numallbits, allbits);
+  return num_extra_bits;
+}
+
+}  // namespace
+
+size_t WriteTokens(const std::vector<Token>& tokens,
+                   const EntropyEncodingData& codes,
+                   const std::vector<uint8_t>& context_map, BitWriter* writer) {
+  size_t num_extra_bits = 0;
+  if (codes.use_prefix_code) {
+    if (codes.lz77.enabled || context_map.size() > 1) {
+      return WritePrefixTokens</*kSingleHistogram=*/false>(tokens, codes,
+                                                           context_map, writer);
+    }
+    return WritePrefixTokens</*kSingleHistogram=*/true>(tokens, codes,
+                                                        context_map, writer);
   }
   std::vector<uint64_t> out;
   std::vector<uint8_t> out_nbits;
@@ -89,6 +89,12 @@ void AuxOut::Assimilate(const AuxOut& victim) {
   num_dct32x64_blocks += victim.num_dct32x64_blocks;
   num_dct64_blocks += victim.num_dct64_blocks;
   num_butteraugli_iters += victim.num_butteraugli_iters;
+  num_tree_nodes += victim.num_tree_nodes;
+  num_patches += victim.num_patches;
+  num_splines += victim.num_splines;
+  num_passes += victim.num_passes;
+  num_entropy_codes += victim.num_entropy_codes;
+  num_lz77_codes += victim.num_lz77_codes;
   for (size_t i = 0; i < dc_pred_usage.size(); ++i) {
     dc_pred_usage[i] += victim.dc_pred_usage[i];
     dc_pred_usage_xb[i] += victim.dc_pred_usage_xb[i];
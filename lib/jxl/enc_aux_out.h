@@ -124,6 +124,18 @@ struct AuxOut {
 
   int num_butteraugli_iters = 0;
 
+  // Number of nodes of the modular MA trees.
+  size_t num_tree_nodes = 0;
+
+  // Number of patches, splines and progressive passes of the frames.
+  size_t num_patches = 0;
+  size_t num_splines = 0;
+  size_t num_passes = 0;
+
+  // Number of written entropy codes, and how many of them use LZ77.
+  size_t num_entropy_codes = 0;
+  size_t num_lz77_codes = 0;
+
   float max_quant_rescale = 1.0f;
   float min_quant_rescale = 1.0f;
   float min_bitrate_error = 0.0f;
@@ -17,6 +17,7 @@ namespace jxl {
 BitWriter::Allotment::Allotment(BitWriter* JXL_RESTRICT writer, size_t max_bits)
     : max_bits_(max_bits) {
   if (writer == nullptr) return;
+  writer->FlushSections();
   prev_bits_written_ = writer->BitsWritten();
   const size_t prev_bytes = writer->storage_.size();
   const size_t next_bytes = DivCeil(max_bits, kBitsPerByte);
@@ -86,6 +87,7 @@ void BitWriter::Allotment::PrivateReclaim(BitWriter* JXL_RESTRICT writer,
 
 void BitWriter::AppendByteAligned(const Span<const uint8_t>& span) {
   if (span.empty()) return;
+  FlushSections();
   storage_.resize(storage_.size() + span.size() + 1);  // extra zero padding
 
   // Concatenate by copying bytes because both source and destination are bytes.
@@ -118,6 +120,7 @@ void BitWriter::AppendByteAligned(const std::vector<BitWriter>& others) {
     // images with no alpha. Do nothing.
     return;
   }
+  FlushSections();
   storage_.resize(storage_.size() + other_bytes + 1);  // extra zero padding
 
   // Concatenate by copying bytes because both source and destination are bytes.
@@ -135,6 +138,62 @@ void BitWriter::AppendByteAligned(const std::vector<BitWriter>& others) {
   bits_written_ += other_bytes * kBitsPerByte;
 }
 
+void BitWriter::AppendByteAligned(std::vector<BitWriter>&& others) {
+  if (!keep_sections_) {
+    AppendByteAligned(static_cast<const std::vector<BitWriter>&>(others));
+    return;
+  }
+  JXL_ASSERT(BitsWritten() % kBitsPerByte == 0);
+  for (BitWriter& writer : others) {
+    JXL_ASSERT(writer.BitsWritten() % kBitsPerByte == 0);
+    if (writer.BitsWritten() == 0) continue;
+    bits_written_ += writer.BitsWritten();
+    sections_.emplace_back(std::move(writer));
+  }
+}
+
+void BitWriter::AppendUnaligned(const BitWriter& other) {
+  JXL_ASSERT(other.sections_.empty());
+  const size_t other_bits = other.BitsWritten();
+  if (other_bits == 0) return;
+  Allotment allotment(this, other_bits);
+  const uint8_t* JXL_RESTRICT other_bytes = other.storage_.data();
+  size_t pos = 0;
+  for (; pos + kBitsPerByte <= other_bits; pos += kBitsPerByte) {
+    Write(kBitsPerByte, other_bytes[pos / kBitsPerByte]);
+  }
+  if (pos < other_bits) {
+    const size_t n_bits = other_bits - pos;
+    Write(n_bits, other_bytes[pos / kBitsPerByte] & ((1u << n_bits) - 1));
+  }
+  allotment.ReclaimAndCharge(this, 0, /*aux_out=*/nullptr);
+}
+
+void BitWriter::FlushSections() {
+  if (sections_.empty()) return;
+  std::vector<BitWriter> sections = std::move(sections_);
+  sections_.clear();
+  size_t section_bits = 0;
+  for (const BitWriter& writer : sections) section_bits += writer.BitsWritten();
+  bits_written_ -= section_bits;
+  AppendByteAligned(sections);
+}
+
+std::vector<PaddedBytes> BitWriter::TakeSections() && {
+  // Callers must ensure byte alignment to avoid uninitialized bits.
+  JXL_ASSERT(bits_written_ % kBitsPerByte == 0);
+  std::vector<PaddedBytes> result;
+  result.reserve(1 + sections_.size());
+  size_t main_bits = bits_written_;
+  for (const BitWriter& writer : sections_) main_bits -= writer.BitsWritten();
+  storage_.resize(main_bits / kBitsPerByte);
+  result.emplace_back(std::move(storage_));
+  for (BitWriter& writer : sections_) {
+    result.emplace_back(std::move(writer).TakeBytes());
+  }
+  return result;
+}
+
 // TODO(lode): avoid code duplication
 void BitWriter::AppendByteAligned(
     const std::vector<std::unique_ptr<BitWriter>>& others) {
@@ -175,6 +234,7 @@ void BitWriter::AppendByteAligned(
 // For n > 5 bits, we write the lowest 5 bits as above, then write the next
 // lowest bits into BYTE+1 starting from its lower bits and so on.
 void BitWriter::Write(size_t n_bits, uint64_t bits) {
+  JXL_DASSERT(sections_.empty());  // Allotment flushes them
   JXL_DASSERT((bits >> n_bits) == 0);
   JXL_DASSERT(n_bits <= kMaxBitsPerCall);
   uint8_t* p = &storage_[bits_written_ / kBitsPerByte];
@@ -45,6 +45,8 @@ struct BitWriter {
   Span<const uint8_t> GetSpan() const {
     // Callers must ensure byte alignment to avoid uninitialized bits.
     JXL_ASSERT(bits_written_ % kBitsPerByte == 0);
+    // Sections are not contiguous with storage_; use TakeSections instead.
+    JXL_ASSERT(sections_.empty());
     return Span<const uint8_t>(storage_.data(), bits_written_ / kBitsPerByte);
   }
 
@@ -54,10 +56,21 @@ struct BitWriter {
   PaddedBytes&& TakeBytes() && {
     // Callers must ensure byte alignment to avoid uninitialized bits.
     JXL_ASSERT(bits_written_ % kBitsPerByte == 0);
+    FlushSections();
     storage_.resize(bits_written_ / kBitsPerByte);
     return std::move(storage_);
   }
 
+  // Opts in to AppendByteAligned(std::vector<BitWriter>&&) keeping the other
+  // writers as separate sections instead of copying them into storage_. Only
+  // useful if the caller retrieves the result via TakeSections.
+  void KeepSections() { keep_sections_ = true; }
+
+  // Like TakeBytes, but returns the written bytes as a list of chunks whose
+  // concatenation equals TakeBytes(), without copying the appended sections.
+  // *this must be an rvalue reference and is invalid afterwards.
+  std::vector<PaddedBytes> TakeSections() &&;
+
  private:
   // Must be byte-aligned before calling.
   void AppendByteAligned(const Span<const uint8_t>& span);
@@ -67,6 +80,13 @@ struct BitWriter {
   void AppendByteAligned(const BitWriter& other);
   void AppendByteAligned(const std::vector<std::unique_ptr<BitWriter>>& others);
   void AppendByteAligned(const std::vector<BitWriter>& others);
+  // Same as above, but if KeepSections was called, moves the others instead of
+  // copying them. Further writes concatenate pending sections (copying) first.
+  void AppendByteAligned(std::vector<BitWriter>&& others);
+
+  // Appends the bits of other, which need not be byte-aligned, at the current
+  // bit position. No allotment needed, other has already been charged.
+  void AppendUnaligned(const BitWriter& other);
 
   class Allotment {
    public:
@@ -119,9 +139,15 @@ struct BitWriter {
   }
 
  private:
+  // Copies pending sections into storage_, after which Write may be called.
+  void FlushSections();
+
   size_t bits_written_;
   PaddedBytes storage_;
   Allotment* current_allotment_ = nullptr;
+  bool keep_sections_ = false;
+  // Byte-aligned writers appended after storage_, see KeepSections.
+  std::vector<BitWriter> sections_;
 };
 
 }  // namespace jxl
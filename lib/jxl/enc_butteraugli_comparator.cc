@@ -10,12 +10,47 @@
 
 #include "lib/jxl/color_management.h"
 #include "lib/jxl/enc_image_bundle.h"
+#include "lib/jxl/image_ops.h"
 
 namespace jxl {
 
+namespace {
+
+Status CopyToLinearSRGB(const ImageBundle& ib, const JxlCmsInterface& cms,
+                        Image3F* linear_srgb) {
+  const ImageBundle* ib_linear_srgb;
+  ImageMetadata metadata = *ib.metadata();
+  ImageBundle store(&metadata);
+  if (!TransformIfNeeded(ib, ColorEncoding::LinearSRGB(ib.IsGray()), cms,
+                         /*pool=*/nullptr, &store, &ib_linear_srgb)) {
+    return false;
+  }
+  *linear_srgb = CopyImage(ib_linear_srgb->color());
+  return true;
+}
+
+// Images with more pixels than this are compared one tile at a time, as
+// butteraugli otherwise needs about 30 floats per pixel for the reference
+// image alone.
+constexpr size_t kMaxUntiledPixels = size_t{1} << 23;
+constexpr size_t kLargeImageTileDim = 512;
+
+std::unique_ptr<Comparator> MakeButteraugliComparator(
+    size_t xsize, size_t ysize, const ButteraugliParams& params,
+    const JxlCmsInterface& cms, ThreadPool* pool) {
+  if (xsize * ysize > kMaxUntiledPixels) {
+    return jxl::make_unique<JxlButteraugliTileComparator>(
+        params, cms, kLargeImageTileDim, /*cache_tiles=*/false, pool);
+  }
+  return jxl::make_unique<JxlButteraugliComparator>(params, cms, pool);
+}
+
+}  // namespace
+
 JxlButteraugliComparator::JxlButteraugliComparator(
-    const ButteraugliParams& params, const JxlCmsInterface& cms)
-    : params_(params), cms_(cms) {}
+    const ButteraugliParams& params, const JxlCmsInterface& cms,
+    ThreadPool* pool)
+    : params_(params), cms_(cms), pool_(pool) {}
 
 Status JxlButteraugliComparator::SetReferenceImage(const ImageBundle& ref) {
   const ImageBundle* ref_linear_srgb;
@@ -27,7 +62,7 @@ Status JxlButteraugliComparator::SetReferenceImage(const ImageBundle& ref) {
   }
 
   comparator_.reset(
-      new ButteraugliComparator(ref_linear_srgb->color(), params_));
+      new ButteraugliComparator(ref_linear_srgb->color(), params_, pool_));
   xsize_ = ref.xsize();
   ysize_ = ref.ysize();
   return true;
@@ -72,12 +107,115 @@ float JxlButteraugliComparator::BadQualityScore() const {
   return ButteraugliFuzzyInverse(0.5);
 }
 
+constexpr size_t JxlButteraugliTileComparator::kDefaultTileDim;
+constexpr size_t JxlButteraugliTileComparator::kBorder;
+
+JxlButteraugliTileComparator::JxlButteraugliTileComparator(
+    const ButteraugliParams& params, const JxlCmsInterface& cms,
+    size_t tile_dim, bool cache_tiles, ThreadPool* pool)
+    : params_(params),
+      cms_(cms),
+      tile_dim_(tile_dim),
+      cache_tiles_(cache_tiles),
+      pool_(pool) {
+  JXL_ASSERT(tile_dim % 2 == 0);
+}
+
+Status JxlButteraugliTileComparator::SetReferenceImage(const ImageBundle& ref) {
+  JXL_RETURN_IF_ERROR(CopyToLinearSRGB(ref, cms_, &ref_linear_srgb_));
+  xsize_ = ref.xsize();
+  ysize_ = ref.ysize();
+  tiles_.clear();
+  if (cache_tiles_) tiles_.resize(xsize_tiles() * ysize_tiles());
+  return true;
+}
+
+Status JxlButteraugliTileComparator::CompareWith(const ImageBundle& actual,
+                                                 ImageF* diffmap,
+                                                 float* score) {
+  JXL_RETURN_IF_ERROR(SetActualImage(actual));
+  ImageF temp_diffmap;
+  if (diffmap != nullptr) temp_diffmap = ImageF(xsize_, ysize_);
+  ImageF* tile_diffmap = diffmap != nullptr ? &temp_diffmap : nullptr;
+  float max_score = 0.0f;
+  for (size_t i = 0; i < xsize_tiles() * ysize_tiles(); i++) {
+    max_score = std::max(max_score, CompareTile(i, tile_diffmap));
+  }
+  // The distorted image is not needed any more.
+  actual_linear_srgb_ = Image3F();
+  if (score != nullptr) *score = max_score;
+  if (diffmap != nullptr) diffmap->Swap(temp_diffmap);
+  return true;
+}
+
+float JxlButteraugliTileComparator::GoodQualityScore() const {
+  return ButteraugliFuzzyInverse(1.5);
+}
+
+float JxlButteraugliTileComparator::BadQualityScore() const {
+  return ButteraugliFuzzyInverse(0.5);
+}
+
+Status JxlButteraugliTileComparator::SetActualImage(const ImageBundle& actual) {
+  if (ref_linear_srgb_.xsize() == 0) {
+    return JXL_FAILURE("Must set reference image first");
+  }
+  if (xsize_ != actual.xsize() || ysize_ != actual.ysize()) {
+    return JXL_FAILURE("Images must have same size");
+  }
+  return CopyToLinearSRGB(actual, cms_, &actual_linear_srgb_);
+}
+
+Rect JxlButteraugliTileComparator::PaddedTileRect(size_t tile_index) const {
+  const Rect tile =
+      TileRect(tile_index % xsize_tiles(), tile_index / xsize_tiles());
+  // The tiles start at even coordinates, and so do the padded tiles, so that
+  // the half resolution pass of butteraugli uses the same pixel pairs as for
+  // the whole image.
+  const size_t x0 = tile.x0() - std::min(tile.x0(), kBorder);
+  const size_t y0 = tile.y0() - std::min(tile.y0(), kBorder);
+  const size_t x1 = std::min(tile.x0() + tile.xsize() + kBorder, xsize_);
+  const size_t y1 = std::min(tile.y0() + tile.ysize() + kBorder, ysize_);
+  return Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+float JxlButteraugliTileComparator::CompareTile(size_t tile_index,
+                                                ImageF* diffmap) {
+  JXL_ASSERT(tile_index < xsize_tiles() * ysize_tiles());
+  const Rect padded = PaddedTileRect(tile_index);
+  std::unique_ptr<ButteraugliComparator> local_comparator;
+  std::unique_ptr<ButteraugliComparator>& comparator =
+      cache_tiles_ ? tiles_[tile_index] : local_comparator;
+  if (!comparator) {
+    comparator = jxl::make_unique<ButteraugliComparator>(
+        CopyImage(padded, ref_linear_srgb_), params_, pool_);
+  }
+  ImageF padded_diffmap(padded.xsize(), padded.ysize());
+  comparator->Diffmap(CopyImage(padded, actual_linear_srgb_), padded_diffmap);
+  const Rect tile =
+      TileRect(tile_index % xsize_tiles(), tile_index / xsize_tiles());
+  const Rect tile_in_padded(tile.x0() - padded.x0(), tile.y0() - padded.y0(),
+                            tile.xsize(), tile.ysize());
+  float max_score = 0.0f;
+  for (size_t y = 0; y < tile.ysize(); y++) {
+    const float* JXL_RESTRICT row = tile_in_padded.ConstRow(padded_diffmap, y);
+    for (size_t x = 0; x < tile.xsize(); x++) {
+      max_score = std::max(max_score, row[x]);
+    }
+  }
+  if (diffmap != nullptr) {
+    CopyImageTo(tile_in_padded, padded_diffmap, tile, diffmap);
+  }
+  return max_score;
+}
+
 float ButteraugliDistance(const ImageBundle& rgb0, const ImageBundle& rgb1,
                           const ButteraugliParams& params,
                           const JxlCmsInterface& cms, ImageF* distmap,
                           ThreadPool* pool) {
-  JxlButteraugliComparator comparator(params, cms);
-  return ComputeScore(rgb0, rgb1, &comparator, cms, distmap, pool);
+  std::unique_ptr<Comparator> comparator =
+      MakeButteraugliComparator(rgb0.xsize(), rgb0.ysize(), params, cms, pool);
+  return ComputeScore(rgb0, rgb1, comparator.get(), cms, distmap, pool);
 }
 
 float ButteraugliDistance(const std::vector<ImageBundle>& frames0,
@@ -85,14 +223,24 @@ float ButteraugliDistance(const std::vector<ImageBundle>& frames0,
                           const ButteraugliParams& params,
                           const JxlCmsInterface& cms, ImageF* distmap,
                           ThreadPool* pool) {
-  JxlButteraugliComparator comparator(params, cms);
   JXL_ASSERT(frames0.size() == frames1.size());
-  float max_dist = 0.0f;
-  for (size_t i = 0; i < frames0.size(); ++i) {
-    max_dist = std::max(
-        max_dist,
-        ComputeScore(frames0[i], frames1[i], &comparator, cms, distmap, pool));
+  if (frames0.size() == 1) {
+    return ButteraugliDistance(frames0[0], frames1[0], params, cms, distmap,
+                               pool);
   }
+  // Compares the frames in parallel, each on a single thread. The distmap is
+  // the one of the last frame.
+  std::vector<float> distances(frames0.size());
+  JXL_CHECK(RunOnPool(
+      pool, 0, frames0.size(), ThreadPool::NoInit,
+      [&](const uint32_t i, size_t /*thread*/) {
+        distances[i] = ButteraugliDistance(
+            frames0[i], frames1[i], params, cms,
+            i + 1 == frames0.size() ? distmap : nullptr, /*pool=*/nullptr);
+      },
+      "ButteraugliDistance frames"));
+  float max_dist = 0.0f;
+  for (float distance : distances) max_dist = std::max(max_dist, distance);
   return max_dist;
 }
 
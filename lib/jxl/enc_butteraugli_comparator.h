@@ -10,10 +10,12 @@
 #include <stddef.h>
 
 #include <memory>
+#include <vector>
 
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/butteraugli/butteraugli.h"
+#include "lib/jxl/common.h"
 #include "lib/jxl/enc_comparator.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_bundle.h"
@@ -22,8 +24,10 @@ namespace jxl {
 
 class JxlButteraugliComparator : public Comparator {
  public:
+  // `pool` is used by SetReferenceImage and CompareWith, if not null.
   explicit JxlButteraugliComparator(const ButteraugliParams& params,
-                                    const JxlCmsInterface& cms);
+                                    const JxlCmsInterface& cms,
+                                    ThreadPool* pool = nullptr);
 
   Status SetReferenceImage(const ImageBundle& ref) override;
 
@@ -36,11 +40,77 @@ class JxlButteraugliComparator : public Comparator {
  private:
   ButteraugliParams params_;
   JxlCmsInterface cms_;
+  ThreadPool* pool_;
   std::unique_ptr<ButteraugliComparator> comparator_;
   size_t xsize_ = 0;
   size_t ysize_ = 0;
 };
 
+// Computes the butteraugli diffmap of an image one tile at a time. The diffmap
+// of a tile is computed from the tile and a border of kBorder pixels around
+// it, which covers most of the support of the butteraugli filters, so it is
+// close to but not exactly the same as the corresponding part of the diffmap
+// of the whole image.
+// With `cache_tiles`, the reference side of each tile is computed when the
+// tile is first compared and is kept for the following comparisons, so that
+// the diffmap of a distorted image that only changed in some tiles can be
+// updated cheaply with CompareTile. Without it, only the tile being compared
+// needs the (large) butteraugli intermediate images, which bounds the memory
+// of CompareWith to a few floats per pixel.
+class JxlButteraugliTileComparator : public Comparator {
+ public:
+  static constexpr size_t kDefaultTileDim = 256;
+  static constexpr size_t kBorder = 48;
+
+  // `tile_dim` must be even. If not null, `pool` is used within each tile
+  // comparison; CompareTile must then not be called from tasks of that pool.
+  JxlButteraugliTileComparator(const ButteraugliParams& params,
+                               const JxlCmsInterface& cms,
+                               size_t tile_dim = kDefaultTileDim,
+                               bool cache_tiles = true,
+                               ThreadPool* pool = nullptr);
+
+  Status SetReferenceImage(const ImageBundle& ref) override;
+
+  // Compares all the tiles, one at a time.
+  Status CompareWith(const ImageBundle& actual, ImageF* diffmap,
+                     float* score) override;
+
+  float GoodQualityScore() const override;
+  float BadQualityScore() const override;
+
+  // Sets the distorted image that the following calls to CompareTile use.
+  Status SetActualImage(const ImageBundle& actual);
+
+  size_t tile_dim() const { return tile_dim_; }
+  size_t xsize_tiles() const { return DivCeil(xsize_, tile_dim_); }
+  size_t ysize_tiles() const { return DivCeil(ysize_, tile_dim_); }
+  Rect TileRect(size_t tx, size_t ty) const {
+    return Rect(tx * tile_dim_, ty * tile_dim_, tile_dim_, tile_dim_, xsize_,
+                ysize_);
+  }
+
+  // Writes the diffmap of the tile `tile_index` (in raster order) of the
+  // distorted image to the corresponding rect of `diffmap`, which has the size
+  // of the reference image or is null, and returns the maximum of the tile's
+  // diffmap. Can be called concurrently for different tiles.
+  float CompareTile(size_t tile_index, ImageF* diffmap);
+
+ private:
+  Rect PaddedTileRect(size_t tile_index) const;
+
+  ButteraugliParams params_;
+  JxlCmsInterface cms_;
+  size_t tile_dim_;
+  bool cache_tiles_;
+  ThreadPool* pool_;
+  Image3F ref_linear_srgb_;
+  Image3F actual_linear_srgb_;
+  std::vector<std::unique_ptr<ButteraugliComparator>> tiles_;
+  size_t xsize_ = 0;
+  size_t ysize_ = 0;
+};
+
 // Returns the butteraugli distance between rgb0 and rgb1.
 // If distmap is not null, it must be the same size as rgb0 and rgb1.
 float ButteraugliDistance(const ImageBundle& rgb0, const ImageBundle& rgb1,
@@ -77,6 +77,12 @@ Status InitializePassesEncoder(const Image3F& opsin, const JxlCmsInterface& cms,
       "Compute coeffs"));
 
   if (shared.frame_header.flags & FrameHeader::kUseDcFrame) {
+    // The DC frame is encoded and decoded before the AC metadata and the
+    // tokenization of this frame rather than alongside them: the library only
+    // runs tasks on the caller's ThreadPool, which does not accept concurrent
+    // or nested RunOnPool calls, so it is parallel only within EncodeFrame.
+    // The tokens also read quant_dc, which is reset below once the DC frame
+    // is decoded.
     CompressParams cparams = enc_state->cparams;
     cparams.dots = Override::kOff;
     cparams.noise = Override::kOff;
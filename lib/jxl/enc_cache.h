@@ -20,6 +20,7 @@
 #include "lib/jxl/enc_ans.h"
 #include "lib/jxl/enc_heuristics.h"
 #include "lib/jxl/enc_params.h"
+#include "lib/jxl/enc_progress.h"
 #include "lib/jxl/enc_progressive_split.h"
 #include "lib/jxl/frame_header.h"
 #include "lib/jxl/image.h"
@@ -31,6 +32,58 @@
 namespace jxl {
 
 struct AuxOut;
+struct PatchDictionaryCache;
+
+// Color transformed input of a frame, filled by the first EncodeFrame of the
+// frame and reused by the next ones, which encode the same frame with other
+// distances.
+struct FrameColorCache {
+  bool valid = false;
+  // The input in the color space of the frame, before the invisible pixels are
+  // simplified.
+  Image3F opsin;
+  // Linear sRGB input for the butteraugli loop, if it was computed.
+  bool has_linear = false;
+  ImageBundle linear;
+  // Owns the metadata of `linear` if it is not the metadata of the input.
+  std::unique_ptr<ImageMetadata> linear_metadata;
+};
+
+// Output of the lossy frame heuristics, filled by the first EncodeFrame of a
+// frame and reused by the next ones, which only quantize, tokenize and entropy
+// code the frame again with another quant_ac_rescale.
+struct FrameRequantization {
+  bool valid = false;
+  // The input after the heuristics, e.g. with gaborish, patches and splines
+  // applied.
+  Image3F opsin;
+  // Quantizer, DC quantization and quant field before they are rescaled.
+  std::unique_ptr<Quantizer> quantizer;
+  float inv_dc_quant[3];
+  ImageI raw_quant_field;
+  // Number of special frames written by the heuristics (e.g. the patches
+  // reference frame), the later ones are written again by each encoding.
+  size_t num_special_frames = 0;
+};
+
+// Output of the lossy frame heuristics of the previous frame of an animation.
+// EncodeFrame reuses it for the tiles whose input did not change, and stores
+// its own output into it for the next frame.
+struct FrameTemporalCache {
+  bool valid = false;
+  float butteraugli_distance = 0.0f;
+  // The input of the heuristics from which the output of each tile was
+  // computed, before gaborish.
+  Image3F opsin;
+  AcStrategyImage ac_strategy;
+  // Quant field before FindBestQuantizer.
+  ImageF quant_field;
+  ImageB epf_sharpness;
+  ImageSB ytox_map;
+  ImageSB ytob_map;
+  // Per-block DC values of the CfL heuristics.
+  ImageF cfl_dc_values;
+};
 
 // Contains encoder state.
 struct PassesEncoderState {
@@ -69,6 +122,25 @@ struct PassesEncoderState {
   // Heuristics to be used by the encoder.
   std::unique_ptr<EncoderHeuristics> heuristics =
       make_unique<DefaultEncoderHeuristics>();
+
+  // If not null, receives the progress of EncodeFrame and may abort it.
+  EncoderProgress* progress = nullptr;
+
+  // If not null, the color transformed input is taken from it if it is valid,
+  // and stored into it otherwise.
+  FrameColorCache* color_cache = nullptr;
+
+  // If not null, the output of the heuristics is taken from it if it is valid,
+  // and stored into it otherwise. Only used for VarDCT frames.
+  FrameRequantization* requantization = nullptr;
+
+  // If not null, the heuristics of unchanged tiles are taken from the previous
+  // frame, and the heuristics of this frame are stored into it.
+  FrameTemporalCache* temporal_cache = nullptr;
+
+  // If not null, text-like patches are looked up in and added to the patches
+  // of the previous frames.
+  PatchDictionaryCache* patch_cache = nullptr;
 };
 
 // Initialize per-frame information.
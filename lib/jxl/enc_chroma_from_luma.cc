@@ -11,6 +11,7 @@
 #include <algorithm>
 #include <array>
 #include <cmath>
+#include <vector>
 
 #undef HWY_TARGET_INCLUDE
 #define HWY_TARGET_INCLUDE "lib/jxl/enc_chroma_from_luma.cc"
@@ -19,6 +20,7 @@
 #include <hwy/highway.h>
 
 #include "lib/jxl/base/bits.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/padded_bytes.h"
 #include "lib/jxl/base/profiler.h"
 #include "lib/jxl/base/span.h"
@@ -48,20 +50,55 @@ struct CFLFunction {
   static constexpr float kCoeff = 1.f / 3;
   static constexpr float kThres = 100.0f;
   static constexpr float kInvColorFactor = 1.0f / kDefaultColorFactor;
+  // Number of values summed by one task of the pool. A multiple of the lane
+  // count of all targets, and larger than the coefficients of a color tile, so
+  // that only the whole-image DC search is split.
+  static constexpr size_t kChunkSize = 8192;
   CFLFunction(const float* values_m, const float* values_s, size_t num,
-              float base, float distance_mul)
+              float base, float distance_mul, ThreadPool* pool)
       : values_m(values_m),
         values_s(values_s),
         num(num),
         base(base),
-        distance_mul(distance_mul) {}
+        distance_mul(distance_mul),
+        pool(pool) {}
 
   // Returns f'(x), where f is 1/3 * sum ((|color residual| + 1)^2-1) +
-  // distance_mul * x^2 * num.
+  // distance_mul * x^2 * num. Large inputs are summed in fixed chunks, so that
+  // the result does not depend on the number of threads.
   float Compute(float x, float eps, float* fpeps, float* fmeps) const {
-    float first_derivative = 2 * distance_mul * num * x;
-    float first_derivative_peps = 2 * distance_mul * num * (x + eps);
-    float first_derivative_meps = 2 * distance_mul * num * (x - eps);
+    if (num <= kChunkSize) {
+      return ComputeRange(0, num, x, eps, fpeps, fmeps);
+    }
+    const size_t num_chunks = DivCeil(num, kChunkSize);
+    std::vector<std::array<float, 3>> sums(num_chunks);
+    JXL_CHECK(RunOnPool(
+        pool, 0, num_chunks, ThreadPool::NoInit,
+        [&](const uint32_t chunk, size_t /* thread */) {
+          const size_t begin = chunk * kChunkSize;
+          const size_t end = std::min(num, begin + kChunkSize);
+          sums[chunk][0] = ComputeRange(begin, end, x, eps, &sums[chunk][1],
+                                        &sums[chunk][2]);
+        },
+        "CfL Search"));
+    float first_derivative = 0;
+    *fpeps = 0;
+    *fmeps = 0;
+    for (const std::array<float, 3>& sum : sums) {
+      first_derivative += sum[0];
+      *fpeps += sum[1];
+      *fmeps += sum[2];
+    }
+    return first_derivative;
+  }
+
+  // Returns the terms of Compute for the values in [begin, end).
+  float ComputeRange(size_t begin, size_t end, float x, float eps,
+                     float* fpeps, float* fmeps) const {
+    const size_t n = end - begin;
+    float first_derivative = 2 * distance_mul * n * x;
+    float first_derivative_peps = 2 * distance_mul * n * (x + eps);
+    float first_derivative_meps = 2 * distance_mul * n * (x - eps);
 
     const auto inv_color_factor = Set(df, kInvColorFactor);
     const auto thres = Set(df, kThres);
@@ -75,9 +112,9 @@ struct CFLFunction {
     auto fd_v = Zero(df);
     auto fdpe_v = Zero(df);
     auto fdme_v = Zero(df);
-    JXL_ASSERT(num % Lanes(df) == 0);
+    JXL_ASSERT(n % Lanes(df) == 0);
 
-    for (size_t i = 0; i < num; i += Lanes(df)) {
+    for (size_t i = begin; i < end; i += Lanes(df)) {
       // color residual = ax + b
       const auto a = Mul(inv_color_factor, Load(df, values_m + i));
       const auto b =
@@ -112,39 +149,45 @@ struct CFLFunction {
   size_t num;
   float base;
   float distance_mul;
+  ThreadPool* pool;
 };
 
+// Closed-form minimizer of the squared color residuals
+// + distance_mul * x^2 * num.
+float LeastSquaresMultiplier(const float* values_m, const float* values_s,
+                             size_t num, float base, float distance_mul) {
+  static constexpr float kInvColorFactor = 1.0f / kDefaultColorFactor;
+  auto ca = Zero(df);
+  auto cb = Zero(df);
+  const auto inv_color_factor = Set(df, kInvColorFactor);
+  const auto base_v = Set(df, base);
+  for (size_t i = 0; i < num; i += Lanes(df)) {
+    // color residual = ax + b
+    const auto a = Mul(inv_color_factor, Load(df, values_m + i));
+    const auto b =
+        Sub(Mul(base_v, Load(df, values_m + i)), Load(df, values_s + i));
+    ca = MulAdd(a, a, ca);
+    cb = MulAdd(a, b, cb);
+  }
+  return -GetLane(SumOfLanes(df, cb)) /
+         (GetLane(SumOfLanes(df, ca)) + num * distance_mul * 0.5f);
+}
+
 // Chroma-from-luma search, values_m will have luma -- and values_s chroma.
+// The pool is used to split the search over large inputs.
 int32_t FindBestMultiplier(const float* values_m, const float* values_s,
                            size_t num, float base, float distance_mul,
-                           bool fast) {
+                           bool fast, ThreadPool* pool = nullptr) {
   if (num == 0) {
     return 0;
   }
-  float x;
-  if (fast) {
-    static constexpr float kInvColorFactor = 1.0f / kDefaultColorFactor;
-    auto ca = Zero(df);
-    auto cb = Zero(df);
-    const auto inv_color_factor = Set(df, kInvColorFactor);
-    const auto base_v = Set(df, base);
-    for (size_t i = 0; i < num; i += Lanes(df)) {
-      // color residual = ax + b
-      const auto a = Mul(inv_color_factor, Load(df, values_m + i));
-      const auto b =
-          Sub(Mul(base_v, Load(df, values_m + i)), Load(df, values_s + i));
-      ca = MulAdd(a, a, ca);
-      cb = MulAdd(a, b, cb);
-    }
-    // + distance_mul * x^2 * num
-    x = -GetLane(SumOfLanes(df, cb)) /
-        (GetLane(SumOfLanes(df, ca)) + num * distance_mul * 0.5f);
-  } else {
+  float x = LeastSquaresMultiplier(values_m, values_s, num, base, distance_mul);
+  if (!fast) {
     constexpr float eps = 100;
     constexpr float kClamp = 20.0f;
-    CFLFunction fn(values_m, values_s, num, base, distance_mul);
-    x = 0;
-    // Up to 20 Newton iterations, with approximate derivatives.
+    CFLFunction fn(values_m, values_s, num, base, distance_mul, pool);
+    // Up to 20 Newton iterations, with approximate derivatives, starting from
+    // the least squares solution, which is usually close to the minimum.
     // Derivatives are approximate due to the high amount of noise in the exact
     // derivatives.
     for (size_t i = 0; i < 20; i++) {
@@ -188,17 +231,17 @@ void InitDCStorage(size_t num_blocks, ImageF* dc_values) {
   }
 }
 
-void ComputeDC(const ImageF& dc_values, bool fast, int32_t* dc_x,
-               int32_t* dc_b) {
+void ComputeDC(const ImageF& dc_values, bool fast, ThreadPool* pool,
+               int32_t* dc_x, int32_t* dc_b) {
   constexpr float kDistanceMultiplierDC = 1e-5f;
   const float* JXL_RESTRICT dc_values_yx = dc_values.Row(0);
   const float* JXL_RESTRICT dc_values_x = dc_values.Row(1);
   const float* JXL_RESTRICT dc_values_yb = dc_values.Row(2);
   const float* JXL_RESTRICT dc_values_b = dc_values.Row(3);
   *dc_x = FindBestMultiplier(dc_values_yx, dc_values_x, dc_values.xsize(), 0.0f,
-                             kDistanceMultiplierDC, fast);
+                             kDistanceMultiplierDC, fast, pool);
   *dc_b = FindBestMultiplier(dc_values_yb, dc_values_b, dc_values.xsize(),
-                             kYToBRatio, kDistanceMultiplierDC, fast);
+                             kYToBRatio, kDistanceMultiplierDC, fast, pool);
 }
 
 void ComputeTile(const Image3F& opsin, const DequantMatrices& dequant,
@@ -373,10 +416,11 @@ void CfLHeuristics::ComputeTile(const Rect& r, const Image3F& opsin,
    mem.get() + thread * kItemsPerThread);
 }
 
-void CfLHeuristics::ComputeDC(bool fast, ColorCorrelationMap* cmap) {
+void CfLHeuristics::ComputeDC(bool fast, ThreadPool* pool,
+                              ColorCorrelationMap* cmap) {
   int32_t ytob_dc = 0;
   int32_t ytox_dc = 0;
-  HWY_DYNAMIC_DISPATCH(ComputeDC)(dc_values, fast, &ytox_dc, &ytob_dc);
+  HWY_DYNAMIC_DISPATCH(ComputeDC)(dc_values, fast, pool, &ytox_dc, &ytob_dc);
   cmap->SetYToBDC(ytob_dc);
   cmap->SetYToXDC(ytox_dc);
 }
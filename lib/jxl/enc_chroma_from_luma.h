@@ -51,7 +51,8 @@ struct CfLHeuristics {
                    const ImageI* raw_quant_field, const Quantizer* quantizer,
                    bool fast, size_t thread, ColorCorrelationMap* cmap);
 
-  void ComputeDC(bool fast, ColorCorrelationMap* cmap);
+  // Splits the search over the DC of large images across the pool.
+  void ComputeDC(bool fast, ThreadPool* pool, ColorCorrelationMap* cmap);
 
   ImageF dc_values;
   hwy::AlignedFreeUniquePtr<float[]> mem;
@@ -20,6 +20,7 @@
 #include <hwy/highway.h>
 
 #include "lib/jxl/ac_context.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/profiler.h"
 #include "lib/jxl/fast_math-inl.h"
 HWY_BEFORE_NAMESPACE();
@@ -85,14 +86,31 @@ float HistogramDistance(const Histogram& a, const Histogram& b) {
 // First step of a k-means clustering with a fancy distance metric.
 void FastClusterHistograms(const std::vector<Histogram>& in,
                            size_t max_histograms, std::vector<Histogram>* out,
-                           std::vector<uint32_t>* histogram_symbols) {
+                           std::vector<uint32_t>* histogram_symbols,
+                           ThreadPool* pool) {
   PROFILER_FUNC;
   out->clear();
   out->reserve(max_histograms);
   histogram_symbols->clear();
   histogram_symbols->resize(in.size(), max_histograms);
 
+  // Entropies and distances are computed in parallel over chunks of the input
+  // histograms; the selection of the farthest histogram stays sequential so
+  // that the result does not depend on the number of threads.
+  constexpr size_t kChunkSize = 64;
+  const size_t num_chunks = DivCeil(in.size(), kChunkSize);
+  if (num_chunks <= 1) pool = nullptr;
+
   std::vector<float> dists(in.size(), std::numeric_limits<float>::max());
+  const auto compute_entropy = [&](const uint32_t chunk, size_t /* thread */) {
+    const size_t end = std::min(in.size(), (chunk + 1) * kChunkSize);
+    for (size_t i = chunk * kChunkSize; i < end; i++) {
+      if (in[i].total_count_ == 0) continue;
+      HistogramEntropy(in[i]);
+    }
+  };
+  JXL_CHECK(RunOnPool(pool, 0, num_chunks, ThreadPool::NoInit, compute_entropy,
+                      "HistogramEntropy"));
   size_t largest_idx = 0;
   for (size_t i = 0; i < in.size(); i++) {
     if (in[i].total_count_ == 0) {
@@ -100,21 +118,28 @@ void FastClusterHistograms(const std::vector<Histogram>& in,
       dists[i] = 0.0f;
       continue;
     }
-    HistogramEntropy(in[i]);
     if (in[i].total_count_ > in[largest_idx].total_count_) {
       largest_idx = i;
     }
   }
 
   constexpr float kMinDistanceForDistinct = 48.0f;
+  const auto update_dists = [&](const uint32_t chunk, size_t /* thread */) {
+    const size_t end = std::min(in.size(), (chunk + 1) * kChunkSize);
+    for (size_t i = chunk * kChunkSize; i < end; i++) {
+      if (dists[i] == 0.0f) continue;
+      dists[i] = std::min(HistogramDistance(in[i], out->back()), dists[i]);
+    }
+  };
   while (out->size() < max_histograms) {
     (*histogram_symbols)[largest_idx] = out->size();
     out->push_back(in[largest_idx]);
     dists[largest_idx] = 0.0f;
+    JXL_CHECK(RunOnPool(pool, 0, num_chunks, ThreadPool::NoInit, update_dists,
+                        "HistogramDistance"));
     largest_idx = 0;
     for (size_t i = 0; i < in.size(); i++) {
       if (dists[i] == 0.0f) continue;
-      dists[i] = std::min(HistogramDistance(in[i], out->back()), dists[i]);
       if (dists[i] > dists[largest_idx]) largest_idx = i;
     }
     if (dists[largest_idx] < kMinDistanceForDistinct) break;
@@ -184,7 +209,8 @@ void HistogramReindex(std::vector<Histogram>* out,
 void ClusterHistograms(const HistogramParams params,
                        const std::vector<Histogram>& in, size_t max_histograms,
                        std::vector<Histogram>* out,
-                       std::vector<uint32_t>* histogram_symbols) {
+                       std::vector<uint32_t>* histogram_symbols,
+                       ThreadPool* pool) {
   max_histograms = std::min(max_histograms, params.max_histograms);
   max_histograms = std::min(max_histograms, in.size());
   if (params.clustering == HistogramParams::ClusteringType::kFastest) {
@@ -192,13 +218,25 @@ void ClusterHistograms(const HistogramParams params,
   }
 
   HWY_DYNAMIC_DISPATCH(FastClusterHistograms)
-  (in, max_histograms, out, histogram_symbols);
+  (in, max_histograms, out, histogram_symbols, pool);
 
   if (params.clustering == HistogramParams::ClusteringType::kBest) {
-    for (size_t i = 0; i < out->size(); i++) {
+    // Costs are computed on the thread pool, but pairs are enqueued in the
+    // same order as a sequential computation would.
+    // Returns the cost of merging histograms i and j.
+    const auto merge_cost = [out](uint32_t i, uint32_t j) {
+      Histogram histo;
+      histo.AddHistogram((*out)[i]);
+      histo.AddHistogram((*out)[j]);
+      return ANSPopulationCost(histo.data_.data(), histo.data_.size()) -
+             (*out)[i].entropy_ - (*out)[j].entropy_;
+    };
+    const auto population_cost = [&](const uint32_t i, size_t /* thread */) {
       (*out)[i].entropy_ =
           ANSPopulationCost((*out)[i].data_.data(), (*out)[i].data_.size());
-    }
+    };
+    JXL_CHECK(RunOnPool(pool, 0, out->size(), ThreadPool::NoInit,
+                        population_cost, "HistogramPopulationCost"));
     uint32_t next_version = 2;
     std::vector<uint32_t> version(out->size(), 1);
     std::vector<uint32_t> renumbering(out->size());
@@ -223,13 +261,17 @@ void ClusterHistograms(const HistogramParams params,
 
     // Create list of all pairs by increasing merging cost.
     std::priority_queue<HistogramPair> pairs_to_merge;
+    std::vector<float> pair_costs(out->size() * out->size());
+    const auto initial_costs = [&](const uint32_t i, size_t /* thread */) {
+      for (uint32_t j = i + 1; j < out->size(); j++) {
+        pair_costs[i * out->size() + j] = merge_cost(i, j);
+      }
+    };
+    JXL_CHECK(RunOnPool(pool, 0, out->size(), ThreadPool::NoInit,
+                        initial_costs, "HistogramMergeCosts"));
     for (uint32_t i = 0; i < out->size(); i++) {
       for (uint32_t j = i + 1; j < out->size(); j++) {
-        Histogram histo;
-        histo.AddHistogram((*out)[i]);
-        histo.AddHistogram((*out)[j]);
-        float cost = ANSPopulationCost(histo.data_.data(), histo.data_.size()) -
-                     (*out)[i].entropy_ - (*out)[j].entropy_;
+        float cost = pair_costs[i * out->size() + j];
         // Avoid enqueueing pairs that are not advantageous to merge.
         if (cost >= 0) continue;
         pairs_to_merge.push(
@@ -239,6 +281,7 @@ void ClusterHistograms(const HistogramParams params,
 
     // Merge the best pair to merge, add new pairs that get formed as a
     // consequence.
+    std::vector<float> costs(out->size());
     while (!pairs_to_merge.empty()) {
       uint32_t first = pairs_to_merge.top().first;
       uint32_t second = pairs_to_merge.top().second;
@@ -258,14 +301,17 @@ void ClusterHistograms(const HistogramParams params,
       }
       version[second] = 0;
       version[first] = next_version++;
+      const auto update_costs = [&](const uint32_t j, size_t /* thread */) {
+        if (j == first) return;
+        if (version[j] == 0) return;
+        costs[j] = merge_cost(first, j);
+      };
+      JXL_CHECK(RunOnPool(pool, 0, out->size(), ThreadPool::NoInit,
+                          update_costs, "HistogramMergeCosts"));
       for (uint32_t j = 0; j < out->size(); j++) {
         if (j == first) continue;
         if (version[j] == 0) continue;
-        Histogram histo;
-        histo.AddHistogram((*out)[first]);
-        histo.AddHistogram((*out)[j]);
-        float cost = ANSPopulationCost(histo.data_.data(), histo.data_.size()) -
-                     (*out)[first].entropy_ - (*out)[j].entropy_;
+        float cost = costs[j];
         // Avoid enqueueing pairs that are not advantageous to merge.
         if (cost >= 0) continue;
         pairs_to_merge.push(
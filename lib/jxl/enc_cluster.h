@@ -15,6 +15,7 @@
 #include <vector>
 
 #include "lib/jxl/ans_params.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/enc_ans.h"
 
 namespace jxl {
@@ -57,7 +58,8 @@ struct Histogram {
 
 void ClusterHistograms(HistogramParams params, const std::vector<Histogram>& in,
                        size_t max_histograms, std::vector<Histogram>* out,
-                       std::vector<uint32_t>* histogram_symbols);
+                       std::vector<uint32_t>* histogram_symbols,
+                       ThreadPool* pool = nullptr);
 }  // namespace jxl
 
 #endif  // LIB_JXL_ENC_CLUSTER_H_
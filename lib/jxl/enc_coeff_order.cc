@@ -10,6 +10,7 @@
 #include <vector>
 
 #include "lib/jxl/ans_params.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/padded_bytes.h"
 #include "lib/jxl/base/profiler.h"
 #include "lib/jxl/base/span.h"
@@ -59,7 +60,8 @@ std::pair<uint32_t, uint32_t> ComputeUsedOrders(
 void ComputeCoeffOrder(SpeedTier speed, const ACImage& acs,
                        const AcStrategyImage& ac_strategy,
                        const FrameDimensions& frame_dim, uint32_t& used_orders,
-                       uint16_t used_acs, coeff_order_t* JXL_RESTRICT order) {
+                       uint16_t used_acs, ThreadPool* pool,
+                       coeff_order_t* JXL_RESTRICT order) {
   std::vector<int32_t> num_zeros(kCoeffOrderMaxSize);
   // If compressing at high speed and only using 8x8 DCTs, only consider a
   // subset of blocks.
@@ -72,26 +74,30 @@ void ComputeCoeffOrder(SpeedTier speed, const ACImage& acs,
   // No need to compute number of zero coefficients if all orders are the
   // default.
   if (used_orders != 0) {
-    uint64_t threshold =
+    const uint64_t threshold =
         (std::numeric_limits<uint64_t>::max() >> 32) * block_fraction;
-    uint64_t s[2] = {static_cast<uint64_t>(0x94D049BB133111EBull),
-                     static_cast<uint64_t>(0xBF58476D1CE4E5B9ull)};
-    // Xorshift128+ adapted from xorshift128+-inl.h
-    auto use_sample = [&]() {
-      auto s1 = s[0];
-      const auto s0 = s[1];
-      const auto bits = s1 + s0;  // b, c
-      s[0] = s0;
-      s1 ^= s1 << 23;
-      s1 ^= s0 ^ (s1 >> 18) ^ (s0 >> 5);
-      s[1] = s1;
+    // Samples blocks with a hash of their position rather than a sequential
+    // random generator, so that the groups can be processed in any order.
+    const auto use_sample = [threshold](size_t group_index, size_t block) {
+      const uint64_t bits = ((static_cast<uint64_t>(group_index) << 32) |
+                             block) *
+                            0x9E3779B97F4A7C15ull;
       return (bits >> 32) <= threshold;
     };
 
-    // Count number of zero coefficients, separately for each DCT band.
+    // Count number of zero coefficients, separately for each DCT band. Each
+    // thread counts into its own copy; the sums do not depend on how groups
+    // are distributed among the threads.
     // TODO(veluca): precompute when doing DCT.
-    for (size_t group_index = 0; group_index < frame_dim.num_groups;
-         group_index++) {
+    std::vector<std::vector<int32_t>> thread_num_zeros;
+    const auto init = [&](size_t num_threads) {
+      thread_num_zeros.resize(num_threads,
+                              std::vector<int32_t>(kCoeffOrderMaxSize));
+      return true;
+    };
+    const auto count_group = [&](const uint32_t group_index,
+                                 const size_t thread) {
+      int32_t* JXL_RESTRICT zeros = thread_num_zeros[thread].data();
       const size_t gx = group_index % frame_dim.xsize_groups;
       const size_t gy = group_index / frame_dim.xsize_groups;
       const Rect rect(gx * kGroupDimInBlocks, gy * kGroupDimInBlocks,
@@ -110,35 +116,52 @@ void ComputeCoeffOrder(SpeedTier speed, const ACImage& acs,
         for (size_t bx = 0; bx < rect.xsize(); ++bx) {
           AcStrategy acs = acs_row[bx];
           if (!acs.IsFirstBlock()) continue;
-          if (!use_sample()) continue;
           size_t size = kDCTBlockSize << acs.log2_covered_blocks();
+          if (!use_sample(group_index, by * kGroupDimInBlocks + bx)) {
+            ac_offset += size;
+            continue;
+          }
           for (size_t c = 0; c < 3; ++c) {
             const size_t order_offset =
                 CoeffOrderOffset(kStrategyOrder[acs.RawStrategy()], c);
             if (type == ACType::k16) {
               for (size_t k = 0; k < size; k++) {
                 bool is_zero = rows[c].ptr16[ac_offset + k] == 0;
-                num_zeros[order_offset + k] += is_zero ? 1 : 0;
+                zeros[order_offset + k] += is_zero ? 1 : 0;
               }
             } else {
               for (size_t k = 0; k < size; k++) {
                 bool is_zero = rows[c].ptr32[ac_offset + k] == 0;
-                num_zeros[order_offset + k] += is_zero ? 1 : 0;
-              }
-            }
-            // Ensure LLFs are first in the order.
-            size_t cx = acs.covered_blocks_x();
-            size_t cy = acs.covered_blocks_y();
-            CoefficientLayout(&cy, &cx);
-            for (size_t iy = 0; iy < cy; iy++) {
-              for (size_t ix = 0; ix < cx; ix++) {
-                num_zeros[order_offset + iy * kBlockDim * cx + ix] = -1;
+                zeros[order_offset + k] += is_zero ? 1 : 0;
               }
             }
           }
           ac_offset += size;
         }
       }
+    };
+    JXL_CHECK(RunOnPool(pool, 0, frame_dim.num_groups, init, count_group,
+                        "CoeffOrderStats"));
+    for (const std::vector<int32_t>& zeros : thread_num_zeros) {
+      for (size_t i = 0; i < kCoeffOrderMaxSize; i++) {
+        num_zeros[i] += zeros[i];
+      }
+    }
+    // Ensure LLFs are first in the order. Orders of transforms that were not
+    // sampled have no zeros, which sorts the same as this.
+    for (uint8_t o = 0; o < AcStrategy::kNumValidStrategies; ++o) {
+      AcStrategy acs = AcStrategy::FromRawStrategy(o);
+      size_t cx = acs.covered_blocks_x();
+      size_t cy = acs.covered_blocks_y();
+      CoefficientLayout(&cy, &cx);
+      for (size_t c = 0; c < 3; ++c) {
+        const size_t order_offset = CoeffOrderOffset(kStrategyOrder[o], c);
+        for (size_t iy = 0; iy < cy; iy++) {
+          for (size_t ix = 0; ix < cx; ix++) {
+            num_zeros[order_offset + iy * kBlockDim * cx + ix] = -1;
+          }
+        }
+      }
     }
   }
   struct PosAndCount {
@@ -17,9 +17,12 @@
 #include <algorithm>
 #include <array>
 #include <atomic>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
 
 #undef HWY_TARGET_INCLUDE
 #define HWY_TARGET_INCLUDE "lib/jxl/enc_color_management.cc"
@@ -49,12 +52,18 @@
 
 namespace jxl {
 namespace {
-struct JxlCms {
+// The parts of a JxlCms that only depend on the input and output profiles,
+// shared by the JxlCms instances that convert between the same profiles.
+struct JxlCmsTransform {
 #if JPEGXL_ENABLE_SKCMS
+  // The profiles point into these.
   PaddedBytes icc_src, icc_dst;
   skcms_ICCProfile profile_src, profile_dst;
 #else
-  void* lcms_transform;
+  ~JxlCmsTransform();
+
+  // Thread-safe, see cmsFLAGS_NOCACHE.
+  void* lcms_transform = nullptr;
 #endif
 
   // These fields are used when the HLG OOTF or inverse OOTF must be applied.
@@ -65,12 +74,25 @@ struct JxlCms {
 
   size_t channels_src;
   size_t channels_dst;
-  ImageF buf_src;
-  ImageF buf_dst;
-  float intensity_target;
   bool skip_lcms = false;
   ExtraTF preprocess = ExtraTF::kNone;
   ExtraTF postprocess = ExtraTF::kNone;
+  // Exponents of the kGamma preprocess and postprocess: encoded = linear^gamma.
+  double src_gamma;
+  double dst_gamma;
+
+  // Whether the CMS is replaced by `matrix`, from the linear source RGB to the
+  // linear destination RGB, because both profiles only consist of primaries
+  // and a transfer function.
+  bool apply_matrix = false;
+  float matrix[9];
+};
+
+struct JxlCms {
+  std::shared_ptr<const JxlCmsTransform> transform;
+  ImageF buf_src;
+  ImageF buf_dst;
+  float intensity_target;
 };
 
 Status ApplyHlgOotf(JxlCms* t, float* JXL_RESTRICT buf, size_t xsize,
@@ -91,7 +113,7 @@ const size_t kX = 0;  // pixel index, multiplied by 3 for RGB
 // xform_src = UndoGammaCompression(buf_src).
 Status BeforeTransform(JxlCms* t, const float* buf_src, float* xform_src,
                        size_t buf_size) {
-  switch (t->preprocess) {
+  switch (t->transform->preprocess) {
     case ExtraTF::kNone:
       JXL_DASSERT(false);  // unreachable
       break;
@@ -122,7 +144,7 @@ Status BeforeTransform(JxlCms* t, const float* buf_src, float* xform_src,
         xform_src[i] = static_cast<float>(
             TF_HLG().DisplayFromEncoded(static_cast<double>(buf_src[i])));
       }
-      if (t->apply_hlg_ootf) {
+      if (t->transform->apply_hlg_ootf) {
         JXL_RETURN_IF_ERROR(
             ApplyHlgOotf(t, xform_src, buf_size, /*forward=*/true));
       }
@@ -133,6 +155,25 @@ Status BeforeTransform(JxlCms* t, const float* buf_src, float* xform_src,
 #endif
       break;
 
+    // Mirrored for negative values, like TF_SRGB.
+    case ExtraTF::k709:
+      for (size_t i = 0; i < buf_size; ++i) {
+        const double val = buf_src[i];
+        xform_src[i] = static_cast<float>(
+            std::copysign(TF_709().DisplayFromEncoded(std::abs(val)), val));
+      }
+      break;
+
+    case ExtraTF::kGamma: {
+      const double exponent = 1.0 / t->transform->src_gamma;
+      for (size_t i = 0; i < buf_size; ++i) {
+        const double val = buf_src[i];
+        xform_src[i] = static_cast<float>(
+            std::copysign(std::pow(std::abs(val), exponent), val));
+      }
+      break;
+    }
+
     case ExtraTF::kSRGB:
       HWY_FULL(float) df;
       for (size_t i = 0; i < buf_size; i += Lanes(df)) {
@@ -152,7 +193,7 @@ Status BeforeTransform(JxlCms* t, const float* buf_src, float* xform_src,
 
 // Applies gamma compression in-place.
 Status AfterTransform(JxlCms* t, float* JXL_RESTRICT buf_dst, size_t buf_size) {
-  switch (t->postprocess) {
+  switch (t->transform->postprocess) {
     case ExtraTF::kNone:
       JXL_DASSERT(false);  // unreachable
       break;
@@ -174,7 +215,7 @@ Status AfterTransform(JxlCms* t, float* JXL_RESTRICT buf_dst, size_t buf_size) {
       break;
     }
     case ExtraTF::kHLG:
-      if (t->apply_hlg_ootf) {
+      if (t->transform->apply_hlg_ootf) {
         JXL_RETURN_IF_ERROR(
             ApplyHlgOotf(t, buf_dst, buf_size, /*forward=*/false));
       }
@@ -187,6 +228,22 @@ Status AfterTransform(JxlCms* t, float* JXL_RESTRICT buf_dst, size_t buf_size) {
              buf_dst[3 * kX + 1], buf_dst[3 * kX + 2]);
 #endif
       break;
+    case ExtraTF::k709:
+      for (size_t i = 0; i < buf_size; ++i) {
+        const double val = buf_dst[i];
+        buf_dst[i] = static_cast<float>(
+            std::copysign(TF_709().EncodedFromDisplay(std::abs(val)), val));
+      }
+      break;
+    case ExtraTF::kGamma: {
+      const double exponent = t->transform->dst_gamma;
+      for (size_t i = 0; i < buf_size; ++i) {
+        const double val = buf_dst[i];
+        buf_dst[i] = static_cast<float>(
+            std::copysign(std::pow(std::abs(val), exponent), val));
+      }
+      break;
+    }
     case ExtraTF::kSRGB:
       HWY_FULL(float) df;
       for (size_t i = 0; i < buf_size; i += Lanes(df)) {
@@ -204,22 +261,55 @@ Status AfterTransform(JxlCms* t, float* JXL_RESTRICT buf_dst, size_t buf_size) {
   return true;
 }
 
+// Multiplies each interleaved RGB pixel by the 3x3 `matrix`, possibly in-place.
+void ApplyMatrix(const float* matrix, const float* buf_src, float* buf_dst,
+                 size_t xsize) {
+  HWY_FULL(float) df;
+  const auto m0 = Set(df, matrix[0]);
+  const auto m1 = Set(df, matrix[1]);
+  const auto m2 = Set(df, matrix[2]);
+  const auto m3 = Set(df, matrix[3]);
+  const auto m4 = Set(df, matrix[4]);
+  const auto m5 = Set(df, matrix[5]);
+  const auto m6 = Set(df, matrix[6]);
+  const auto m7 = Set(df, matrix[7]);
+  const auto m8 = Set(df, matrix[8]);
+  size_t x = 0;
+  for (; x + Lanes(df) <= xsize; x += Lanes(df)) {
+    hwy::HWY_NAMESPACE::Vec<decltype(df)> r, g, b;
+    LoadInterleaved3(df, buf_src + 3 * x, r, g, b);
+    const auto out0 = MulAdd(m0, r, MulAdd(m1, g, Mul(m2, b)));
+    const auto out1 = MulAdd(m3, r, MulAdd(m4, g, Mul(m5, b)));
+    const auto out2 = MulAdd(m6, r, MulAdd(m7, g, Mul(m8, b)));
+    StoreInterleaved3(out0, out1, out2, df, buf_dst + 3 * x);
+  }
+  for (; x < xsize; ++x) {
+    const float r = buf_src[3 * x + 0];
+    const float g = buf_src[3 * x + 1];
+    const float b = buf_src[3 * x + 2];
+    buf_dst[3 * x + 0] = matrix[0] * r + matrix[1] * g + matrix[2] * b;
+    buf_dst[3 * x + 1] = matrix[3] * r + matrix[4] * g + matrix[5] * b;
+    buf_dst[3 * x + 2] = matrix[6] * r + matrix[7] * g + matrix[8] * b;
+  }
+}
+
 Status DoColorSpaceTransform(void* cms_data, const size_t thread,
                              const float* buf_src, float* buf_dst,
                              size_t xsize) {
   // No lock needed.
   JxlCms* t = reinterpret_cast<JxlCms*>(cms_data);
+  const JxlCmsTransform& transform = *t->transform;
 
   const float* xform_src = buf_src;  // Read-only.
-  if (t->preprocess != ExtraTF::kNone) {
+  if (transform.preprocess != ExtraTF::kNone) {
     float* mutable_xform_src = t->buf_src.Row(thread);  // Writable buffer.
     JXL_RETURN_IF_ERROR(BeforeTransform(t, buf_src, mutable_xform_src,
-                                        xsize * t->channels_src));
+                                        xsize * transform.channels_src));
     xform_src = mutable_xform_src;
   }
 
 #if JPEGXL_ENABLE_SKCMS
-  if (t->channels_src == 1 && !t->skip_lcms) {
+  if (transform.channels_src == 1 && !transform.skip_lcms) {
     // Expand from 1 to 3 channels, starting from the end in case
     // xform_src == t->buf_src.Row(thread).
     float* mutable_xform_src = t->buf_src.Row(thread);
@@ -231,7 +321,7 @@ Status DoColorSpaceTransform(void* cms_data, const size_t thread,
     xform_src = mutable_xform_src;
   }
 #else
-  if (t->channels_src == 4 && !t->skip_lcms) {
+  if (transform.channels_src == 4 && !transform.skip_lcms) {
     // LCMS does CMYK in a weird way: 0 = white, 100 = max ink
     float* mutable_xform_src = t->buf_src.Row(thread);
     for (size_t x = 0; x < xsize * 4; ++x) {
@@ -248,32 +338,37 @@ Status DoColorSpaceTransform(void* cms_data, const size_t thread,
   const float in2 = xform_src[3 * kX + 2];
 #endif
 
-  if (t->skip_lcms) {
+  if (transform.skip_lcms) {
     if (buf_dst != xform_src) {
-      memcpy(buf_dst, xform_src, xsize * t->channels_src * sizeof(*buf_dst));
+      memcpy(buf_dst, xform_src,
+             xsize * transform.channels_src * sizeof(*buf_dst));
     }  // else: in-place, no need to copy
+  } else if (transform.apply_matrix) {
+    ApplyMatrix(transform.matrix, xform_src, buf_dst, xsize);
   } else {
 #if JPEGXL_ENABLE_SKCMS
     JXL_CHECK(
         skcms_Transform(xform_src,
-                        (t->channels_src == 4 ? skcms_PixelFormat_RGBA_ffff
-                                              : skcms_PixelFormat_RGB_fff),
-                        skcms_AlphaFormat_Opaque, &t->profile_src, buf_dst,
-                        skcms_PixelFormat_RGB_fff, skcms_AlphaFormat_Opaque,
-                        &t->profile_dst, xsize));
+                        (transform.channels_src == 4
+                             ? skcms_PixelFormat_RGBA_ffff
+                             : skcms_PixelFormat_RGB_fff),
+                        skcms_AlphaFormat_Opaque, &transform.profile_src,
+                        buf_dst, skcms_PixelFormat_RGB_fff,
+                        skcms_AlphaFormat_Opaque, &transform.profile_dst,
+                        xsize));
 #else   // JPEGXL_ENABLE_SKCMS
-    cmsDoTransform(t->lcms_transform, xform_src, buf_dst,
+    cmsDoTransform(transform.lcms_transform, xform_src, buf_dst,
                    static_cast<cmsUInt32Number>(xsize));
 #endif  // JPEGXL_ENABLE_SKCMS
   }
 #if JXL_CMS_VERBOSE >= 2
   printf("xform skip%d: %.4f %.4f %.4f (%p) -> (%p) %.4f %.4f %.4f\n",
-         t->skip_lcms, in0, in1, in2, xform_src, buf_dst, buf_dst[3 * kX],
-         buf_dst[3 * kX + 1], buf_dst[3 * kX + 2]);
+         transform.skip_lcms, in0, in1, in2, xform_src, buf_dst,
+         buf_dst[3 * kX], buf_dst[3 * kX + 1], buf_dst[3 * kX + 2]);
 #endif
 
 #if JPEGXL_ENABLE_SKCMS
-  if (t->channels_dst == 1 && !t->skip_lcms) {
+  if (transform.channels_dst == 1 && !transform.skip_lcms) {
     // Contract back from 3 to 1 channel, this time forward.
     float* grayscale_buf_dst = t->buf_dst.Row(thread);
     for (size_t x = 0; x < xsize; ++x) {
@@ -283,8 +378,9 @@ Status DoColorSpaceTransform(void* cms_data, const size_t thread,
   }
 #endif
 
-  if (t->postprocess != ExtraTF::kNone) {
-    JXL_RETURN_IF_ERROR(AfterTransform(t, buf_dst, xsize * t->channels_dst));
+  if (transform.postprocess != ExtraTF::kNone) {
+    JXL_RETURN_IF_ERROR(
+        AfterTransform(t, buf_dst, xsize * transform.channels_dst));
   }
   return true;
 }
@@ -846,6 +942,66 @@ Status GetPrimariesLuminances(const ColorEncoding& encoding,
   return true;
 }
 
+// Returns whether the ICC profile of `c` only consists of its primaries, white
+// point and transfer function. SetFieldsFromICC only identifies the transfer
+// function if the profile it creates from the fields is equivalent.
+bool IsMatrixTRC(const ColorEncoding& c) {
+  return (c.GetColorSpace() == ColorSpace::kRGB ||
+          c.GetColorSpace() == ColorSpace::kGray) &&
+         !c.IsCMYK() && !c.tf.IsUnknown();
+}
+
+// Returns the ExtraTF that converts `c` from and to linear, and sets `gamma`
+// for kGamma.
+ExtraTF ExtraTFOf(const ColorEncoding& c, double* gamma) {
+  if (c.tf.IsGamma()) {
+    *gamma = c.tf.GetGamma();
+    return ExtraTF::kGamma;
+  }
+  if (c.tf.IsDCI()) {
+    *gamma = 1.0 / 2.6;
+    return ExtraTF::kGamma;
+  }
+  if (c.tf.IsSRGB()) return ExtraTF::kSRGB;
+  if (c.tf.IsPQ()) return ExtraTF::kPQ;
+  if (c.tf.IsHLG()) return ExtraTF::kHLG;
+  if (c.tf.Is709()) return ExtraTF::k709;
+  JXL_DASSERT(c.tf.IsLinear());
+  return ExtraTF::kNone;
+}
+
+// Sets up `t` to replace the CMS with the transfer functions of `c_src` and
+// `c_dst`, and the matrix between their linear color spaces through XYZ D50,
+// which is what the CMS computes for matrix/TRC profiles.
+Status InitMatrixTransform(const ColorEncoding& c_src,
+                           const ColorEncoding& c_dst, JxlCmsTransform* t) {
+  t->preprocess = ExtraTFOf(c_src, &t->src_gamma);
+  t->postprocess = ExtraTFOf(c_dst, &t->dst_gamma);
+  t->channels_src = c_src.Channels();
+  t->channels_dst = c_dst.Channels();
+  // Gray is the luminance in both.
+  if (c_src.IsGray() || c_src.SameColorSpace(c_dst)) {
+    t->skip_lcms = true;
+    return true;
+  }
+  const PrimariesCIExy p_src = c_src.GetPrimaries();
+  const CIExy w_src = c_src.GetWhitePoint();
+  float src_to_xyzd50[9];
+  JXL_RETURN_IF_ERROR(PrimariesToXYZD50(p_src.r.x, p_src.r.y, p_src.g.x,
+                                        p_src.g.y, p_src.b.x, p_src.b.y,
+                                        w_src.x, w_src.y, src_to_xyzd50));
+  const PrimariesCIExy p_dst = c_dst.GetPrimaries();
+  const CIExy w_dst = c_dst.GetWhitePoint();
+  float xyzd50_to_dst[9];
+  JXL_RETURN_IF_ERROR(PrimariesToXYZD50(p_dst.r.x, p_dst.r.y, p_dst.g.x,
+                                        p_dst.g.y, p_dst.b.x, p_dst.b.y,
+                                        w_dst.x, w_dst.y, xyzd50_to_dst));
+  JXL_RETURN_IF_ERROR(Inv3x3Matrix(xyzd50_to_dst));
+  Mul3x3Matrix(xyzd50_to_dst, src_to_xyzd50, t->matrix);
+  t->apply_matrix = true;
+  return true;
+}
+
 Status ApplyHlgOotf(JxlCms* t, float* JXL_RESTRICT buf, size_t xsize,
                     bool forward) {
   if (295 <= t->intensity_target && t->intensity_target <= 305) {
@@ -855,7 +1011,8 @@ Status ApplyHlgOotf(JxlCms* t, float* JXL_RESTRICT buf, size_t xsize,
   float gamma = 1.2f * std::pow(1.111f, std::log2(t->intensity_target * 1e-3f));
   if (!forward) gamma = 1.f / gamma;
 
-  switch (t->hlg_ootf_num_channels) {
+  const std::array<float, 3>& luminances = t->transform->hlg_ootf_luminances;
+  switch (t->transform->hlg_ootf_num_channels) {
     case 1:
       for (size_t x = 0; x < xsize; ++x) {
         buf[x] = std::pow(buf[x], gamma);
@@ -864,9 +1021,9 @@ Status ApplyHlgOotf(JxlCms* t, float* JXL_RESTRICT buf, size_t xsize,
 
     case 3:
       for (size_t x = 0; x < xsize; x += 3) {
-        const float luminance = buf[x] * t->hlg_ootf_luminances[0] +
-                                buf[x + 1] * t->hlg_ootf_luminances[1] +
-                                buf[x + 2] * t->hlg_ootf_luminances[2];
+        const float luminance = buf[x] * luminances[0] +
+                                buf[x + 1] * luminances[1] +
+                                buf[x + 2] * luminances[2];
         const float ratio = std::pow(luminance, gamma - 1);
         if (std::isfinite(ratio)) {
           buf[x] *= ratio;
@@ -895,7 +1052,7 @@ Status ApplyHlgOotf(JxlCms* t, float* JXL_RESTRICT buf, size_t xsize,
 
     default:
       return JXL_FAILURE("HLG OOTF not implemented for %" PRIuS " channels",
-                         t->hlg_ootf_num_channels);
+                         t->transform->hlg_ootf_num_channels);
   }
   return true;
 }
@@ -1040,19 +1197,99 @@ void ColorEncoding::DecideIfWantICC() {
 
 namespace {
 
+#if !JPEGXL_ENABLE_SKCMS
+JxlCmsTransform::~JxlCmsTransform() {
+  if (lcms_transform != nullptr) TransformDeleter()(lcms_transform);
+}
+#endif
+
+// Maximum number of transforms kept by the TransformCache.
+constexpr size_t kMaxCachedTransforms = 16;
+
+// Transforms prepared for the most recently used pairs of profiles, shared by
+// all the JxlCms instances of the process: creating an lcms transform from a
+// complex ICC profile takes milliseconds, and applications tend to convert
+// between the same few profiles over and over. The profiles also determine the
+// pixel formats and the rendering intent, so they are the whole key.
+class TransformCache {
+ public:
+  static TransformCache& Get() {
+    // Never destroyed, so that it can be used until the process exits.
+    static TransformCache* cache = new TransformCache();
+    return *cache;
+  }
+
+  // Returns nullptr if there is no transform for these profiles.
+  std::shared_ptr<const JxlCmsTransform> Find(const JxlColorProfile& input,
+                                              const JxlColorProfile& output) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return FindLocked(input, output);
+  }
+
+  // Adds a transform that was created after Find failed, and returns it. If
+  // another thread added one for the same profiles meanwhile, returns that one
+  // instead.
+  std::shared_ptr<const JxlCmsTransform> Insert(
+      const JxlColorProfile& input, const JxlColorProfile& output,
+      std::shared_ptr<const JxlCmsTransform> transform) {
+    // Destroyed after the lock is released.
+    std::shared_ptr<const JxlCmsTransform> evicted;
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_ptr<const JxlCmsTransform> found = FindLocked(input, output);
+    if (found) return found;
+    entries_.emplace_front();
+    Entry& entry = entries_.front();
+    entry.icc_src.assign(input.icc.data, input.icc.data + input.icc.size);
+    entry.icc_dst.assign(output.icc.data, output.icc.data + output.icc.size);
+    entry.transform = std::move(transform);
+    if (entries_.size() > kMaxCachedTransforms) {
+      evicted = std::move(entries_.back().transform);
+      entries_.pop_back();
+    }
+    return entry.transform;
+  }
+
+ private:
+  struct Entry {
+    std::vector<uint8_t> icc_src;
+    std::vector<uint8_t> icc_dst;
+    std::shared_ptr<const JxlCmsTransform> transform;
+  };
+
+  static bool SameICC(const std::vector<uint8_t>& icc,
+                      const JxlColorProfile& profile) {
+    return icc.size() == profile.icc.size &&
+           (icc.empty() ||
+            memcmp(icc.data(), profile.icc.data, icc.size()) == 0);
+  }
+
+  // Moves the entry it finds to the front.
+  std::shared_ptr<const JxlCmsTransform> FindLocked(
+      const JxlColorProfile& input, const JxlColorProfile& output) {
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (SameICC(it->icc_src, input) && SameICC(it->icc_dst, output)) {
+        entries_.splice(entries_.begin(), entries_, it);
+        return entries_.front().transform;
+      }
+    }
+    return nullptr;
+  }
+
+  std::mutex mutex_;
+  // Most recently used first.
+  std::list<Entry> entries_;
+};
+
 void JxlCmsDestroy(void* cms_data) {
   if (cms_data == nullptr) return;
   JxlCms* t = reinterpret_cast<JxlCms*>(cms_data);
-#if !JPEGXL_ENABLE_SKCMS
-  TransformDeleter()(t->lcms_transform);
-#endif
   delete t;
 }
 
-void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
-                 const JxlColorProfile* input, const JxlColorProfile* output,
-                 float intensity_target) {
-  auto t = jxl::make_unique<JxlCms>();
+// Prepares the conversion from `input` to `output`, or returns nullptr.
+std::shared_ptr<const JxlCmsTransform> CreateTransform(
+    const JxlColorProfile* input, const JxlColorProfile* output) {
+  auto t = std::make_shared<JxlCmsTransform>();
   PaddedBytes icc_src, icc_dst;
   icc_src.assign(input->icc.data, input->icc.data + input->icc.size);
   ColorEncoding c_src;
@@ -1071,11 +1308,14 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
 #endif
 
 #if JPEGXL_ENABLE_SKCMS
-  if (!DecodeProfile(input->icc.data, input->icc.size, &t->profile_src)) {
+  // The transform can outlive the profiles of this call.
+  t->icc_src.assign(input->icc.data, input->icc.data + input->icc.size);
+  t->icc_dst.assign(output->icc.data, output->icc.data + output->icc.size);
+  if (!DecodeProfile(t->icc_src.data(), t->icc_src.size(), &t->profile_src)) {
     JXL_NOTIFY_ERROR("JxlCmsInit: skcms failed to parse input ICC");
     return nullptr;
   }
-  if (!DecodeProfile(output->icc.data, output->icc.size, &t->profile_dst)) {
+  if (!DecodeProfile(t->icc_dst.data(), t->icc_dst.size(), &t->profile_dst)) {
     JXL_NOTIFY_ERROR("JxlCmsInit: skcms failed to parse output ICC");
     return nullptr;
   }
@@ -1112,6 +1352,20 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
     }
   }
 
+  // The absolute intent also scales by the ratio of the white points.
+  if (!t->skip_lcms && IsMatrixTRC(c_src) && IsMatrixTRC(c_dst) &&
+      c_src.Channels() == c_dst.Channels() &&
+      c_dst.rendering_intent != RenderingIntent::kAbsolute) {
+#if JXL_CMS_VERBOSE
+    printf("Transfer functions and matrix, skipping CMS\n");
+#endif
+    if (!InitMatrixTransform(c_src, c_dst, t.get())) {
+      JXL_NOTIFY_ERROR("JxlCmsInit: failed to compute the primaries matrix");
+      return nullptr;
+    }
+    return t;
+  }
+
   // Special-case SRGB <=> linear if the primaries / white point are the same,
   // or any conversion where PQ or HLG is involved:
   bool src_linear = c_src.tf.IsLinear();
@@ -1221,8 +1475,7 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
   JXL_CHECK(channels_src == channels_dst ||
             (channels_src == 4 && channels_dst == 3));
 #if JXL_CMS_VERBOSE
-  printf("Channels: %" PRIuS "; Threads: %" PRIuS "\n", channels_src,
-         num_threads);
+  printf("Channels: %" PRIuS "\n", channels_src);
 #endif
 
 #if !JPEGXL_ENABLE_SKCMS
@@ -1243,6 +1496,28 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
   }
 #endif  // !JPEGXL_ENABLE_SKCMS
 
+  t->channels_src = channels_src;
+  t->channels_dst = channels_dst;
+  return t;
+}
+
+void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
+                 const JxlColorProfile* input, const JxlColorProfile* output,
+                 float intensity_target) {
+  auto t = jxl::make_unique<JxlCms>();
+  TransformCache& cache = TransformCache::Get();
+  t->transform = cache.Find(*input, *output);
+  if (!t->transform) {
+    std::shared_ptr<const JxlCmsTransform> transform =
+        CreateTransform(input, output);
+    if (!transform) return nullptr;
+    t->transform = cache.Insert(*input, *output, std::move(transform));
+  }
+  const JxlCmsTransform& transform = *t->transform;
+#if JXL_CMS_VERBOSE
+  printf("Threads: %" PRIuS "\n", num_threads);
+#endif
+
   // Ideally LCMS would convert directly from External to Image3. However,
   // cmsDoTransformLineStride only accepts 32-bit BytesPerPlaneIn, whereas our
   // planes can be more than 4 GiB apart. Hence, transform inputs/outputs must
@@ -1251,16 +1526,15 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
   // buffers. To avoid separate allocations, we use the rows of an image.
   // Because LCMS apparently also cannot handle <= 16 bit inputs and 32-bit
   // outputs (or vice versa), we use floating point input/output.
-  t->channels_src = channels_src;
-  t->channels_dst = channels_dst;
 #if JPEGXL_ENABLE_SKCMS
   // SkiaCMS doesn't support grayscale float buffers, so we create space for RGB
   // float buffers anyway.
-  t->buf_src = ImageF(xsize * (channels_src == 4 ? 4 : 3), num_threads);
+  t->buf_src =
+      ImageF(xsize * (transform.channels_src == 4 ? 4 : 3), num_threads);
   t->buf_dst = ImageF(xsize * 3, num_threads);
 #else
-  t->buf_src = ImageF(xsize * channels_src, num_threads);
-  t->buf_dst = ImageF(xsize * channels_dst, num_threads);
+  t->buf_src = ImageF(xsize * transform.channels_src, num_threads);
+  t->buf_dst = ImageF(xsize * transform.channels_dst, num_threads);
 #endif
   t->intensity_target = intensity_target;
   return t.release();
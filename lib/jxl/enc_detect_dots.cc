@@ -297,12 +297,28 @@ Rect BoundingRectangle(const std::vector<Pixel>& pixels) {
 
 std::vector<ConnectedComponent> FindCC(const ImageF& energy, double t_low,
                                        double t_high, uint32_t maxWindow,
-                                       double minScore) {
+                                       double minScore, ThreadPool* pool) {
   PROFILER_FUNC;
   const int kExtraRect = 4;
+  // Extracting components only zeroes pixels, so rows without a seed above
+  // t_high never get one. Find the rows with seeds in parallel, so that the
+  // sequential extraction below only visits those.
+  std::vector<uint8_t> has_seed(energy.ysize());
+  const auto find_seeds = [&](const uint32_t y, size_t /* thread */) {
+    const float* JXL_RESTRICT row = energy.ConstRow(y);
+    for (size_t x = 0; x < energy.xsize(); x++) {
+      if (row[x] > t_high) {
+        has_seed[y] = 1;
+        return;
+      }
+    }
+  };
+  JXL_CHECK(RunOnPool(pool, 0, energy.ysize(), ThreadPool::NoInit, find_seeds,
+                      "FindDotSeeds"));
   ImageF img = CopyImage(energy);
-  std::vector<ConnectedComponent> ans;
+  std::vector<ConnectedComponent> candidates;
   for (size_t y = 0; y < img.ysize(); y++) {
+    if (!has_seed[y]) continue;
     float* JXL_RESTRICT row = img.Row(y);
     for (size_t x = 0; x < img.xsize(); x++) {
       if (row[x] > t_high) {
@@ -320,20 +336,27 @@ std::vector<ConnectedComponent> FindCC(const ImageF& energy, double t_low,
 #endif  // JXL_DEBUG_DOT_DETECT
         Rect bounds = BoundingRectangle(pixels);
         if (bounds.xsize() < maxWindow && bounds.ysize() < maxWindow) {
-          ConnectedComponent cc{bounds, std::move(pixels)};
-          cc.CompStats(energy, kExtraRect);
-          if (cc.score < minScore) continue;
-          JXL_DEBUG(JXL_DEBUG_DOT_DETECT,
-                    "cc mode: (%d,%d), max: %f, bgMean: %f bgVar: "
-                    "%f bound:(%" PRIuS ",%" PRIuS ",%" PRIuS ",%" PRIuS ")\n",
-                    cc.mode.x, cc.mode.y, cc.maxEnergy, cc.meanEnergy,
-                    cc.varEnergy, cc.bounds.x0(), cc.bounds.y0(),
-                    cc.bounds.xsize(), cc.bounds.ysize());
-          ans.push_back(cc);
+          candidates.emplace_back(bounds, std::move(pixels));
         }
       }
     }
   }
+  const auto comp_stats = [&](const uint32_t i, size_t /* thread */) {
+    candidates[i].CompStats(energy, kExtraRect);
+  };
+  JXL_CHECK(RunOnPool(pool, 0, candidates.size(), ThreadPool::NoInit,
+                      comp_stats, "DotCompStats"));
+  std::vector<ConnectedComponent> ans;
+  for (ConnectedComponent& cc : candidates) {
+    if (cc.score < minScore) continue;
+    JXL_DEBUG(JXL_DEBUG_DOT_DETECT,
+              "cc mode: (%d,%d), max: %f, bgMean: %f bgVar: "
+              "%f bound:(%" PRIuS ",%" PRIuS ",%" PRIuS ",%" PRIuS ")\n",
+              cc.mode.x, cc.mode.y, cc.maxEnergy, cc.meanEnergy, cc.varEnergy,
+              cc.bounds.x0(), cc.bounds.y0(), cc.bounds.xsize(),
+              cc.bounds.ysize());
+    ans.push_back(std::move(cc));
+  }
   return ans;
 }
 
@@ -554,8 +577,9 @@ std::vector<PatchInfo> DetectGaussianEllipses(
   aux.DumpXybImage("smooth", smooth);
   aux.DumpPlaneNormalized("energy", energy);
 #endif  // JXL_DEBUG_DOT_DETECT
-  std::vector<ConnectedComponent> components = FindCC(
-      energy, params.t_low, params.t_high, params.maxWinSize, params.minScore);
+  std::vector<ConnectedComponent> components =
+      FindCC(energy, params.t_low, params.t_high, params.maxWinSize,
+             params.minScore, pool);
   size_t numCC =
       std::min(params.maxCC, (components.size() * params.percCC) / 100);
   if (components.size() > numCC) {
@@ -566,8 +590,15 @@ std::vector<PatchInfo> DetectGaussianEllipses(
         });
     components.erase(components.begin() + numCC, components.end());
   }
-  for (const auto& cc : components) {
-    GaussianEllipse ellipse = FitGaussian(cc, energy, opsin, smooth);
+  std::vector<GaussianEllipse> ellipses(components.size());
+  const auto fit_gaussian = [&](const uint32_t i, size_t /* thread */) {
+    ellipses[i] = FitGaussian(components[i], energy, opsin, smooth);
+  };
+  JXL_CHECK(RunOnPool(pool, 0, components.size(), ThreadPool::NoInit,
+                      fit_gaussian, "FitGaussian"));
+  for (size_t i = 0; i < components.size(); i++) {
+    const ConnectedComponent& cc = components[i];
+    const GaussianEllipse& ellipse = ellipses[i];
     if (ellipse.x < 0.0 ||
         std::ceil(ellipse.x) >= static_cast<double>(opsin.xsize()) ||
         ellipse.y < 0.0 ||
@@ -166,9 +166,16 @@ void TokenizeCoefficients(const coeff_order_t* JXL_RESTRICT orders,
   const size_t xsize_blocks = rect.xsize();
   const size_t ysize_blocks = rect.ysize();
 
-  // TODO(user): update the estimate: usually less coefficients are used.
-  output->reserve(output->size() +
-                  3 * xsize_blocks * ysize_blocks * kDCTBlockSize);
+  // Tokens are written into an arena at the end of `output`, sized for the
+  // worst case of one token per coefficient (each block emits one token for
+  // the number of non-zeros instead of one per LLF coefficient), so that the
+  // hot loop below does not need to check for capacity. The arena is shrunk
+  // to the tokens actually written at the end.
+  const size_t output_start = output->size();
+  output->resize(output_start +
+                 3 * xsize_blocks * ysize_blocks * kDCTBlockSize);
+  Token* JXL_RESTRICT tokens = output->data() + output_start;
+  size_t num_tokens = 0;
 
   size_t offset[3] = {};
   const size_t nzeros_stride = tmp_num_nzeroes->PixelsPerRow();
@@ -226,7 +233,7 @@ void TokenizeCoefficients(const coeff_order_t* JXL_RESTRICT orders,
         const int32_t nzero_ctx =
             block_ctx_map.NonZeroContext(predicted_nzeros, block_ctx);
 
-        output->emplace_back(nzero_ctx, nzeros);
+        tokens[num_tokens++] = Token(nzero_ctx, nzeros);
         const size_t histo_offset =
             block_ctx_map.ZeroDensityContextsOffset(block_ctx);
         // Skip LLF.
@@ -237,7 +244,7 @@ void TokenizeCoefficients(const coeff_order_t* JXL_RESTRICT orders,
               histo_offset + ZeroDensityContext(nzeros, k, covered_blocks,
                                                 log2_covered_blocks, prev);
           uint32_t u_coeff = PackSigned(coeff);
-          output->emplace_back(ctx, u_coeff);
+          tokens[num_tokens++] = Token(ctx, u_coeff);
           prev = coeff != 0;
           nzeros -= prev;
         }
@@ -246,6 +253,7 @@ void TokenizeCoefficients(const coeff_order_t* JXL_RESTRICT orders,
       }
     }
   }
+  output->resize(output_start + num_tokens);
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
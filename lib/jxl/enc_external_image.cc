@@ -40,34 +40,32 @@ size_t JxlDataTypeBytes(JxlDataType data_type) {
   }
 }
 
-}  // namespace
-
-Status ConvertFromExternal(Span<const uint8_t> bytes, size_t xsize,
-                           size_t ysize, size_t bits_per_sample,
-                           JxlPixelFormat format, size_t c, ThreadPool* pool,
-                           ImageF* channel) {
-  if (format.data_type == JXL_TYPE_UINT8) {
+Status CheckBitsPerSample(size_t bits_per_sample, JxlDataType data_type) {
+  if (data_type == JXL_TYPE_UINT8) {
     JXL_RETURN_IF_ERROR(bits_per_sample > 0 && bits_per_sample <= 8);
-  } else if (format.data_type == JXL_TYPE_UINT16) {
+  } else if (data_type == JXL_TYPE_UINT16) {
     JXL_RETURN_IF_ERROR(bits_per_sample > 8 && bits_per_sample <= 16);
-  } else if (format.data_type == JXL_TYPE_FLOAT16) {
+  } else if (data_type == JXL_TYPE_FLOAT16) {
     JXL_RETURN_IF_ERROR(bits_per_sample == 16);
-  } else if (format.data_type == JXL_TYPE_FLOAT) {
+  } else if (data_type == JXL_TYPE_FLOAT) {
     JXL_RETURN_IF_ERROR(bits_per_sample == 32);
   } else {
-    JXL_FAILURE("unsupported pixel format data type %d", format.data_type);
+    JXL_FAILURE("unsupported pixel format data type %d", data_type);
   }
+  return true;
+}
+
+// Validates the size of an interleaved buffer and returns its row stride.
+Status GetExternalRowSize(Span<const uint8_t> bytes, size_t xsize,
+                          size_t ysize, const JxlPixelFormat& format,
+                          size_t* row_size) {
   size_t bytes_per_channel = JxlDataTypeBytes(format.data_type);
   size_t bytes_per_pixel = format.num_channels * bytes_per_channel;
-  size_t pixel_offset = c * bytes_per_channel;
-  // Only for uint8/16.
-  float scale = 1. / ((1ull << bits_per_sample) - 1);
-
   const size_t last_row_size = xsize * bytes_per_pixel;
   const size_t align = format.align;
-  const size_t row_size =
+  *row_size =
       (align > 1 ? jxl::DivCeil(last_row_size, align) * align : last_row_size);
-  const size_t bytes_to_read = row_size * (ysize - 1) + last_row_size;
+  const size_t bytes_to_read = *row_size * (ysize - 1) + last_row_size;
   if (xsize == 0 || ysize == 0) return JXL_FAILURE("Empty image");
   if (bytes.size() < bytes_to_read) {
     return JXL_FAILURE("Buffer size is too small, expected: %" PRIuS
@@ -76,30 +74,99 @@ Status ConvertFromExternal(Span<const uint8_t> bytes, size_t xsize,
                        bytes_to_read, bytes.size(), xsize, ysize,
                        format.num_channels, bytes_per_channel);
   }
-  JXL_ASSERT(channel->xsize() == xsize);
-  JXL_ASSERT(channel->ysize() == ysize);
   // Too large buffer is likely an application bug, so also fail for that.
   // Do allow padding to stride in last row though.
-  if (bytes.size() > row_size * ysize) {
+  if (bytes.size() > *row_size * ysize) {
     return JXL_FAILURE("Buffer size is too large");
   }
+  return true;
+}
+
+// Converts the interleaved channels `channel_index[i]` into `channels[i]` in a
+// single pass over the rows, so that each input row is read from memory once
+// instead of once per channel.
+Status ConvertChannelsFromExternal(const uint8_t* data, size_t xsize,
+                                   size_t ysize, size_t stride,
+                                   size_t bits_per_sample,
+                                   const JxlPixelFormat& format,
+                                   const std::vector<size_t>& channel_index,
+                                   const std::vector<ImageF*>& channels,
+                                   ThreadPool* pool) {
+  JXL_RETURN_IF_ERROR(CheckBitsPerSample(bits_per_sample, format.data_type));
+  JXL_ASSERT(channel_index.size() == channels.size());
+  for (const ImageF* channel : channels) {
+    JXL_ASSERT(channel->xsize() == xsize);
+    JXL_ASSERT(channel->ysize() == ysize);
+  }
+  size_t bytes_per_channel = JxlDataTypeBytes(format.data_type);
+  size_t bytes_per_pixel = format.num_channels * bytes_per_channel;
+  // Only for uint8/16.
+  float scale = 1. / ((1ull << bits_per_sample) - 1);
 
   const bool little_endian =
       format.endianness == JXL_LITTLE_ENDIAN ||
       (format.endianness == JXL_NATIVE_ENDIAN && IsLittleEndian());
 
-  const uint8_t* const in = bytes.data();
+  std::atomic<size_t> error_count = {0};
+
+  const auto convert_row = [&](const uint32_t task, size_t /*thread*/) {
+    const size_t y = task;
+    for (size_t i = 0; i < channels.size(); ++i) {
+      size_t offset = stride * y + channel_index[i] * bytes_per_channel;
+      float* JXL_RESTRICT row_out = channels[i]->Row(y);
+      const auto save_value = [&](size_t index, float value) {
+        row_out[index] = value;
+      };
+      if (!LoadFloatRow(data + offset, xsize, bytes_per_pixel,
+                        format.data_type, little_endian, scale, save_value)) {
+        error_count++;
+      }
+    }
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, static_cast<uint32_t>(ysize),
+                                ThreadPool::NoInit, convert_row,
+                                "ConvertChannels"));
+
+  if (error_count) {
+    JXL_FAILURE("unsupported pixel format data type");
+  }
+
+  return true;
+}
+
+}  // namespace
+
+Status ConvertFromExternalNoSizeCheck(const uint8_t* data, size_t xsize,
+                                      size_t ysize, size_t stride,
+                                      size_t bits_per_sample,
+                                      JxlPixelFormat format, size_t c,
+                                      ThreadPool* pool, const Rect& rect,
+                                      ImageF* channel) {
+  JXL_RETURN_IF_ERROR(CheckBitsPerSample(bits_per_sample, format.data_type));
+  JXL_ASSERT(rect.xsize() == xsize);
+  JXL_ASSERT(rect.ysize() == ysize);
+  JXL_ASSERT(rect.x0() + xsize <= channel->xsize());
+  JXL_ASSERT(rect.y0() + ysize <= channel->ysize());
+  size_t bytes_per_channel = JxlDataTypeBytes(format.data_type);
+  size_t bytes_per_pixel = format.num_channels * bytes_per_channel;
+  size_t pixel_offset = c * bytes_per_channel;
+  // Only for uint8/16.
+  float scale = 1. / ((1ull << bits_per_sample) - 1);
+
+  const bool little_endian =
+      format.endianness == JXL_LITTLE_ENDIAN ||
+      (format.endianness == JXL_NATIVE_ENDIAN && IsLittleEndian());
 
   std::atomic<size_t> error_count = {0};
 
   const auto convert_row = [&](const uint32_t task, size_t /*thread*/) {
     const size_t y = task;
-    size_t offset = row_size * task + pixel_offset;
-    float* JXL_RESTRICT row_out = channel->Row(y);
+    size_t offset = stride * y + pixel_offset;
+    float* JXL_RESTRICT row_out = rect.Row(channel, y);
     const auto save_value = [&](size_t index, float value) {
       row_out[index] = value;
     };
-    if (!LoadFloatRow(in + offset, xsize, bytes_per_pixel, format.data_type,
+    if (!LoadFloatRow(data + offset, xsize, bytes_per_pixel, format.data_type,
                       little_endian, scale, save_value)) {
       error_count++;
     }
@@ -114,6 +181,21 @@ Status ConvertFromExternal(Span<const uint8_t> bytes, size_t xsize,
 
   return true;
 }
+
+Status ConvertFromExternal(Span<const uint8_t> bytes, size_t xsize,
+                           size_t ysize, size_t bits_per_sample,
+                           JxlPixelFormat format, size_t c, ThreadPool* pool,
+                           ImageF* channel) {
+  size_t row_size;
+  JXL_RETURN_IF_ERROR(GetExternalRowSize(bytes, xsize, ysize, format,
+                                         &row_size));
+  JXL_ASSERT(channel->xsize() == xsize);
+  JXL_ASSERT(channel->ysize() == ysize);
+  return ConvertFromExternalNoSizeCheck(bytes.data(), xsize, ysize, row_size,
+                                        bits_per_sample, format, c, pool,
+                                        Rect(*channel), channel);
+}
+
 Status ConvertFromExternal(Span<const uint8_t> bytes, size_t xsize,
                            size_t ysize, const ColorEncoding& c_current,
                            size_t bits_per_sample, JxlPixelFormat format,
@@ -126,26 +208,53 @@ Status ConvertFromExternal(Span<const uint8_t> bytes, size_t xsize,
                        color_channels, format.num_channels);
   }
 
-  Image3F color(xsize, ysize);
+  size_t row_size;
+  JXL_RETURN_IF_ERROR(GetExternalRowSize(bytes, xsize, ysize, format,
+                                         &row_size));
+
+  Image3F color;
+  if (ib->HasColor() && ib->xsize() == xsize && ib->ysize() == ysize) {
+    // Convert into the planes already allocated by the caller.
+    color = std::move(*ib->color());
+  } else {
+    color = Image3F(xsize, ysize);
+  }
+  std::vector<size_t> channel_index;
+  std::vector<ImageF*> channels;
   for (size_t c = 0; c < color_channels; ++c) {
-    JXL_RETURN_IF_ERROR(ConvertFromExternal(bytes, xsize, ysize,
-                                            bits_per_sample, format, c, pool,
-                                            &color.Plane(c)));
+    channel_index.push_back(c);
+    channels.push_back(&color.Plane(c));
+  }
+
+  // Passing an interleaved image with an alpha channel to an image that doesn't
+  // have alpha channel just discards the passed alpha channel.
+  const bool convert_alpha = has_alpha && ib->HasAlpha();
+  ImageF alpha;
+  ImageF* alpha_ptr = nullptr;
+  if (convert_alpha) {
+    ImageF* existing_alpha = ib->alpha();
+    if (existing_alpha->xsize() == xsize && existing_alpha->ysize() == ysize) {
+      alpha_ptr = existing_alpha;
+    } else {
+      alpha = ImageF(xsize, ysize);
+      alpha_ptr = &alpha;
+    }
+    channel_index.push_back(format.num_channels - 1);
+    channels.push_back(alpha_ptr);
   }
+
+  // Color and alpha are converted in the same pass over the input rows.
+  JXL_RETURN_IF_ERROR(ConvertChannelsFromExternal(
+      bytes.data(), xsize, ysize, row_size, bits_per_sample, format,
+      channel_index, channels, pool));
   if (color_channels == 1) {
     CopyImageTo(color.Plane(0), &color.Plane(1));
     CopyImageTo(color.Plane(0), &color.Plane(2));
   }
   ib->SetFromImage(std::move(color), c_current);
 
-  // Passing an interleaved image with an alpha channel to an image that doesn't
-  // have alpha channel just discards the passed alpha channel.
-  if (has_alpha && ib->HasAlpha()) {
-    ImageF alpha(xsize, ysize);
-    JXL_RETURN_IF_ERROR(
-        ConvertFromExternal(bytes, xsize, ysize, bits_per_sample, format,
-                            format.num_channels - 1, pool, &alpha));
-    ib->SetAlpha(std::move(alpha));
+  if (convert_alpha) {
+    if (alpha_ptr == &alpha) ib->SetAlpha(std::move(alpha));
   } else if (!has_alpha && ib->HasAlpha()) {
     // if alpha is not passed, but it is expected, then assume
     // it is all-opaque
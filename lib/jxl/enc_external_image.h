@@ -20,13 +20,26 @@
 #include "lib/jxl/image_bundle.h"
 
 namespace jxl {
+
+// Converts channel `c` of an interleaved `xsize` x `ysize` pixel buffer with
+// rows `stride` bytes apart into the `rect` region of `channel`. The caller is
+// responsible for validating that `data` holds enough bytes.
+Status ConvertFromExternalNoSizeCheck(const uint8_t* data, size_t xsize,
+                                      size_t ysize, size_t stride,
+                                      size_t bits_per_sample,
+                                      JxlPixelFormat format, size_t c,
+                                      ThreadPool* pool, const Rect& rect,
+                                      ImageF* channel);
+
 Status ConvertFromExternal(Span<const uint8_t> bytes, size_t xsize,
                            size_t ysize, size_t bits_per_sample,
                            JxlPixelFormat format, size_t c, ThreadPool* pool,
                            ImageF* channel);
 
 // Convert an interleaved pixel buffer to the internal ImageBundle
-// representation. This is the opposite of ConvertToExternal().
+// representation. This is the opposite of ConvertToExternal(). Color and alpha
+// planes that `ib` already has with the right dimensions are written to
+// instead of being reallocated.
 Status ConvertFromExternal(Span<const uint8_t> bytes, size_t xsize,
                            size_t ysize, const ColorEncoding& c_current,
                            size_t bits_per_sample, JxlPixelFormat format,
@@ -7,12 +7,15 @@
 
 #include <array>
 #include <new>
+#include <vector>
 
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/color_encoding_internal.h"
+#include "lib/jxl/dec_external_image.h"
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/image_test_utils.h"
+#include "lib/jxl/test_utils.h"
 #include "lib/jxl/testing.h"
 
 namespace jxl {
@@ -75,5 +78,40 @@ TEST(ExternalImageTest, AlphaPremultiplied) {
                                   ColorEncoding::SRGB(), &ib));
 }
 
+TEST(ExternalImageTest, UndoOrientation) {
+  // Not multiples of the rows gathered at once for the transposes.
+  const size_t xsize = 21;
+  const size_t ysize = 13;
+  ImageF image(xsize, ysize);
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      image.Row(y)[x] = (y * xsize + x) / 65535.0f;
+    }
+  }
+  test::ThreadPoolForTests pool(3);
+  std::vector<uint8_t> out(xsize * ysize * 2);
+  for (uint32_t o = 1; o <= 8; ++o) {
+    const bool transposed = o >= 5;
+    const size_t out_xsize = transposed ? ysize : xsize;
+    ASSERT_TRUE(ConvertToExternal(image, 16, /*float_out=*/false,
+                                  JXL_BIG_ENDIAN, out_xsize * 2, &pool,
+                                  out.data(), out.size(),
+                                  /*out_callback=*/{},
+                                  static_cast<Orientation>(o)));
+    for (size_t y = 0; y < ysize; ++y) {
+      for (size_t x = 0; x < xsize; ++x) {
+        const size_t mx = xsize - 1 - x;
+        const size_t my = ysize - 1 - y;
+        // The position of the input pixel (x, y) in the output.
+        const size_t positions[8][2] = {{x, y},   {mx, y},  {mx, my}, {x, my},
+                                        {y, x},   {my, x},  {my, mx}, {y, mx}};
+        const size_t* pos = positions[o - 1];
+        const uint8_t* p = &out[(pos[1] * out_xsize + pos[0]) * 2];
+        EXPECT_EQ(y * xsize + x, (p[0] << 8u) | p[1]) << "orientation " << o;
+      }
+    }
+  }
+}
+
 }  // namespace
 }  // namespace jxl
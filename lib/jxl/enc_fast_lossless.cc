@@ -8,6 +8,7 @@
 #include "lib/jxl/enc_fast_lossless.h"
 
 #include <assert.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -171,6 +172,18 @@ struct BitWriter {
   uint64_t buffer = 0;
 };
 
+// Reference frame in which frames that are not the last one are saved, and on
+// which partial frames are blended.
+constexpr uint32_t kFastLosslessReference = 1;
+
+// Encoder of the strips of rows of a streaming frame.
+struct FJxlStripEncoder {
+  virtual ~FJxlStripEncoder() = default;
+  virtual void AddRows(JxlFastLosslessFrameState* frame_state,
+                       const unsigned char* rgba, size_t row_stride,
+                       size_t num_rows) = 0;
+};
+
 }  // namespace
 
 extern "C" {
@@ -180,14 +193,42 @@ struct JxlFastLosslessFrameState {
   size_t height;
   size_t nb_chans;
   size_t bitdepth;
+  // Size of the image, and position of the frame in it.
+  size_t image_width;
+  size_t image_height;
+  size_t x0 = 0;
+  size_t y0 = 0;
+  bool have_animation = false;
+  uint32_t duration = 0;
+  bool have_timecodes = false;
+  uint32_t timecode = 0;
   BitWriter header;
   std::vector<std::array<BitWriter, 4>> group_data;
+  // Only set for streaming frames.
+  std::unique_ptr<FJxlStripEncoder> strip_encoder;
   size_t current_bit_writer = 0;
   size_t bit_writer_byte_pos = 0;
   size_t bits_in_buffer = 0;
   uint64_t bit_buffer = 0;
 };
 
+struct JxlFastLosslessLiveState {
+  // Whether the samples below can be used for the next frame of `nb_chans`
+  // channels of `bitdepth` bits.
+  bool have_samples = false;
+  size_t nb_chans = 0;
+  size_t bitdepth = 0;
+  // FastPredictor of each channel, and the counts of the sampled tokens of
+  // the channel, of kNumRawSymbols and kNumLZ77 symbols.
+  uint8_t predictors[4] = {};
+  uint64_t raw_counts[4][19] = {};
+  uint64_t lz77_counts[4][33] = {};
+  // Coded bits per pixel of the frame of the samples, and number of frames
+  // that reused them since.
+  double sampled_bits_per_pixel = 0;
+  size_t frames_since_sampling = 0;
+};
+
 size_t JxlFastLosslessOutputSize(const JxlFastLosslessFrameState* frame) {
   size_t total_size_groups = 0;
   for (size_t i = 0; i < frame->group_data.size(); i++) {
@@ -207,6 +248,26 @@ size_t JxlFastLosslessMaxRequiredOutput(
   return JxlFastLosslessOutputSize(frame) + 32;
 }
 
+void JxlFastLosslessSetFrameOrigin(JxlFastLosslessFrameState* frame,
+                                   size_t image_width, size_t image_height,
+                                   size_t x0, size_t y0) {
+  assert(x0 + frame->width <= image_width);
+  assert(y0 + frame->height <= image_height);
+  frame->image_width = image_width;
+  frame->image_height = image_height;
+  frame->x0 = x0;
+  frame->y0 = y0;
+}
+
+void JxlFastLosslessSetAnimationFrame(JxlFastLosslessFrameState* frame,
+                                      uint32_t duration, int have_timecodes,
+                                      uint32_t timecode) {
+  frame->have_animation = true;
+  frame->duration = duration;
+  frame->have_timecodes = have_timecodes;
+  frame->timecode = timecode;
+}
+
 void JxlFastLosslessPrepareHeader(JxlFastLosslessFrameState* frame,
                                   int add_image_header, int is_last) {
   BitWriter* output = &frame->header;
@@ -249,12 +310,12 @@ void JxlFastLosslessPrepareHeader(JxlFastLosslessFrameState* frame,
       }
     };
 
-    wsz(frame->height);
+    wsz(frame->image_height);
 
     // No special ratio.
     output->Write(3, 0);
 
-    wsz(frame->width);
+    wsz(frame->image_width);
 
     // Hand-crafted ImageMetadata.
     output->Write(1, 0);  // all_default
@@ -314,18 +375,73 @@ void JxlFastLosslessPrepareHeader(JxlFastLosslessFrameState* frame,
   }
   output->Write(2, 0b01);  // default group size
   output->Write(2, 0b00);  // exactly one pass
-  output->Write(1, 0);     // no custom size or origin
+  bool is_partial_frame = frame->x0 != 0 || frame->y0 != 0 ||
+                          frame->width != frame->image_width ||
+                          frame->height != frame->image_height;
+  if (is_partial_frame) {
+    output->Write(1, 1);  // custom size or origin
+    auto wcrop = [output](size_t value) {
+      if (value < (1 << 8)) {
+        output->Write(2, 0b00);
+        output->Write(8, value);
+      } else if (value - 256 < (1 << 11)) {
+        output->Write(2, 0b01);
+        output->Write(11, value - 256);
+      } else if (value - 2304 < (1 << 14)) {
+        output->Write(2, 0b10);
+        output->Write(14, value - 2304);
+      } else {
+        output->Write(2, 0b11);
+        output->Write(30, value - 18688);
+      }
+    };
+    wcrop(frame->x0 * 2);  // PackSigned(x0)
+    wcrop(frame->y0 * 2);  // PackSigned(y0)
+    wcrop(frame->width);
+    wcrop(frame->height);
+  } else {
+    output->Write(1, 0);  // no custom size or origin
+  }
+  // Partial frames are blended on the previous frame, which is saved as
+  // reference frame kFastLosslessReference.
   output->Write(2, 0b00);  // kReplace blending mode
+  if (is_partial_frame) {
+    output->Write(2, kFastLosslessReference);  // blending source
+  }
   if (have_alpha) {
     output->Write(2, 0b00);  // kReplace blending mode for alpha channel
+    if (is_partial_frame) {
+      output->Write(2, kFastLosslessReference);  // blending source
+    }
+  }
+  if (frame->have_animation) {
+    // duration
+    if (frame->duration < 2) {
+      output->Write(2, frame->duration);
+    } else if (frame->duration < (1 << 8)) {
+      output->Write(2, 0b10);
+      output->Write(8, frame->duration);
+    } else {
+      output->Write(2, 0b11);
+      output->Write(32, frame->duration);
+    }
+    if (frame->have_timecodes) {
+      output->Write(32, frame->timecode);
+    }
   }
   output->Write(1, is_last);  // is_last
-  output->Write(2, 0b00);     // a frame has no name
-  output->Write(1, 0);        // loop filter is not all_default
-  output->Write(1, 0);        // no gaborish
-  output->Write(2, 0);        // 0 EPF iters
-  output->Write(2, 0b00);     // No LF extensions
-  output->Write(2, 0b00);     // No FH extensions
+  if (!is_last) {
+    output->Write(2, kFastLosslessReference);  // save_as_reference
+    if (!is_partial_frame) {
+      output->Write(1, 0);  // saved after the color transform
+    }
+  }
+  output->Write(2, 0b00);  // a frame has no name
+  output->Write(1, 0);     // loop filter is not all_default
+  output->Write(1, 0);     // no gaborish
+  output->Write(2, 0);     // 0 EPF iters
+  output->Write(2, 0b00);  // No LF extensions
+  output->Write(2, 0b00);  // No FH extensions
 
   output->Write(1, 0);      // No TOC permutation
   output->ZeroPadToByte();  // TOC is byte-aligned.
@@ -452,6 +568,14 @@ void JxlFastLosslessFreeFrameState(JxlFastLosslessFrameState* frame) {
   delete frame;
 }
 
+JxlFastLosslessLiveState* JxlFastLosslessCreateLiveState(void) {
+  return new JxlFastLosslessLiveState();
+}
+
+void JxlFastLosslessFreeLiveState(JxlFastLosslessLiveState* live) {
+  delete live;
+}
+
 }  // extern "C"
 
 #endif
@@ -462,6 +586,12 @@ namespace {
 
 constexpr size_t kNumRawSymbols = 19;
 constexpr size_t kNumLZ77 = 33;
+static_assert(sizeof(JxlFastLosslessLiveState::raw_counts[0]) ==
+                  kNumRawSymbols * sizeof(uint64_t),
+              "");
+static_assert(sizeof(JxlFastLosslessLiveState::lz77_counts[0]) ==
+                  kNumLZ77 * sizeof(uint64_t),
+              "");
 constexpr size_t kLZ77CacheSize = 32;
 
 constexpr size_t kLZ77Offset = 224;
@@ -2066,6 +2196,19 @@ struct Bits16 {
 
 #endif
 
+// Predictors that the fast path can use for a channel, with their values in
+// the bitstream.
+enum class FastPredictor : uint8_t {
+  kLeft = 1,
+  kTop = 2,
+  kSelect = 4,
+  kGradient = 5,
+};
+
+constexpr FastPredictor kAllFastPredictors[] = {
+    FastPredictor::kGradient, FastPredictor::kLeft, FastPredictor::kTop,
+    FastPredictor::kSelect};
+
 #ifdef FJXL_GENERIC_SIMD
 constexpr size_t SIMDVec32::kLanes;
 constexpr size_t SIMDVec16::kLanes;
@@ -2385,9 +2528,31 @@ using unsigned_t = typename detail::IntegerTypes<T>::unsigned_;
 template <typename T>
 using simd_t = typename detail::SIMDType<T>::type;
 
+template <FastPredictor predictor, typename T>
+FJXL_INLINE T Predict(T left, T top, T topleft) {
+  T zero = T::Val(0);
+  if (predictor == FastPredictor::kLeft) return left;
+  if (predictor == FastPredictor::kTop) return top;
+  if (predictor == FastPredictor::kSelect) {
+    T pa = top.Sub(topleft);
+    T pb = left.Sub(topleft);
+    pa = zero.Gt(pa).IfThenElse(zero.Sub(pa), pa);
+    pb = zero.Gt(pb).IfThenElse(zero.Sub(pb), pb);
+    return pb.Gt(pa).IfThenElse(left, top);
+  }
+  T ac = left.Sub(topleft);
+  T ab = left.Sub(top);
+  T bc = top.Sub(topleft);
+  T grad = ac.Add(top);
+  T d = ab.Xor(bc);
+  T clamp = zero.Gt(d).IfThenElse(top, left);
+  T s = ac.Xor(bc);
+  return zero.Gt(s).IfThenElse(grad, clamp);
+}
+
 // This function will process exactly one vector worth of pixels.
 
-template <typename T>
+template <FastPredictor predictor, typename T>
 size_t PredictPixels(const signed_t<T>* pixels, const signed_t<T>* pixels_left,
                      const signed_t<T>* pixels_top,
                      const signed_t<T>* pixels_topleft,
@@ -2396,15 +2561,8 @@ size_t PredictPixels(const signed_t<T>* pixels, const signed_t<T>* pixels_left,
   T left = T::Load((unsigned_t<T>*)pixels_left);
   T top = T::Load((unsigned_t<T>*)pixels_top);
   T topleft = T::Load((unsigned_t<T>*)pixels_topleft);
-  T ac = left.Sub(topleft);
-  T ab = left.Sub(top);
-  T bc = top.Sub(topleft);
-  T grad = ac.Add(top);
-  T d = ab.Xor(bc);
   T zero = T::Val(0);
-  T clamp = zero.Gt(d).IfThenElse(top, left);
-  T s = ac.Xor(bc);
-  T pred = zero.Gt(s).IfThenElse(grad, clamp);
+  T pred = Predict<predictor>(left, top, topleft);
   T res = px.Sub(pred);
   T res_times_2 = res.Add(res);
   res = zero.Gt(res).IfThenElse(T::Val(-1).Sub(res_times_2), res_times_2);
@@ -2694,7 +2852,9 @@ constexpr uint8_t MoreThan14Bits::kMinRawLength[];
 constexpr uint8_t MoreThan14Bits::kMaxRawLength[];
 
 void PrepareDCGlobalCommon(bool is_single_group, size_t width, size_t height,
-                           const PrefixCode code[4], BitWriter* output) {
+                           const PrefixCode code[4],
+                           const FastPredictor predictors[4],
+                           BitWriter* output) {
   output->Allocate(100000 + (is_single_group ? width * height * 16 : 0));
   // No patches, spline or noise.
   output->Write(1, 1);  // default DC dequantization factors (?)
@@ -2716,12 +2876,19 @@ void PrepareDCGlobalCommon(bool is_single_group, size_t width, size_t height,
   // Huffman table + extra bits for the tree.
   uint8_t symbol_bits[6] = {0b00, 0b10, 0b001, 0b101, 0b0011, 0b0111};
   uint8_t symbol_nbits[6] = {2, 2, 3, 3, 4, 4};
-  // Write a tree with a leaf per channel, and gradient predictor for every
-  // leaf.
-  for (auto v : {1, 2, 1, 4, 1, 0, 0, 5, 0, 0, 0, 0, 5,
-                 0, 0, 0, 0, 5, 0, 0, 0, 0, 5, 0, 0, 0}) {
+  // Write a tree with a leaf per channel, splitting on the channel property.
+  for (auto v : {1, 2, 1, 4, 1, 0}) {
     output->Write(symbol_nbits[v], symbol_bits[v]);
   }
+  // Leaves are in the order of channels 3, 2, 1, 0; each of them has the
+  // predictor of its channel, offset 0 and multiplier 1.
+  for (size_t i = 0; i < 4; i++) {
+    uint8_t predictor = static_cast<uint8_t>(predictors[3 - i]);
+    for (uint8_t v : {uint8_t{0}, predictor, uint8_t{0}, uint8_t{0},
+                      uint8_t{0}}) {
+      output->Write(symbol_nbits[v], symbol_bits[v]);
+    }
+  }
 
   output->Write(1, 1);     // Enable lz77 for the main bitstream
   output->Write(2, 0b00);  // lz77 offset 224
@@ -2772,8 +2939,9 @@ void PrepareDCGlobalCommon(bool is_single_group, size_t width, size_t height,
 
 void PrepareDCGlobal(bool is_single_group, size_t width, size_t height,
                      size_t nb_chans, const PrefixCode code[4],
-                     BitWriter* output) {
-  PrepareDCGlobalCommon(is_single_group, width, height, code, output);
+                     const FastPredictor predictors[4], BitWriter* output) {
+  PrepareDCGlobalCommon(is_single_group, width, height, code, predictors,
+                        output);
   if (nb_chans > 2) {
     output->Write(2, 0b01);     // 1 transform
     output->Write(2, 0b00);     // RCT
@@ -2856,6 +3024,31 @@ struct ChannelRowProcessor {
   using upixel_t = typename BitDepth::upixel_t;
   using pixel_t = typename BitDepth::pixel_t;
   T* t;
+  FastPredictor predictor = FastPredictor::kGradient;
+
+#ifndef FJXL_GENERIC_SIMD
+  template <FastPredictor kPredictor>
+  static pixel_t Predict(pixel_t left, pixel_t top, pixel_t topleft) {
+    if (kPredictor == FastPredictor::kLeft) return left;
+    if (kPredictor == FastPredictor::kTop) return top;
+    if (kPredictor == FastPredictor::kSelect) {
+      pixel_t pa = top > topleft ? top - topleft : topleft - top;
+      pixel_t pb = left > topleft ? left - topleft : topleft - left;
+      return pa < pb ? left : top;
+    }
+    pixel_t ac = left - topleft;
+    pixel_t ab = left - top;
+    pixel_t bc = top - topleft;
+    pixel_t grad = static_cast<pixel_t>(static_cast<upixel_t>(ac) +
+                                        static_cast<upixel_t>(top));
+    pixel_t d = ab ^ bc;
+    pixel_t clamp = d < 0 ? top : left;
+    pixel_t s = ac ^ bc;
+    return s < 0 ? grad : clamp;
+  }
+#endif
+
+  template <FastPredictor kPredictor>
   void ProcessChunk(const pixel_t* row, const pixel_t* row_left,
                     const pixel_t* row_top, const pixel_t* row_topleft,
                     size_t n) {
@@ -2866,9 +3059,9 @@ struct ChannelRowProcessor {
     constexpr size_t kNum =
         sizeof(pixel_t) == 2 ? SIMDVec16::kLanes : SIMDVec32::kLanes;
     for (size_t ix = 0; ix < kChunkSize; ix += kNum) {
-      size_t c =
-          PredictPixels<simd_t<pixel_t>>(row + ix, row_left + ix, row_top + ix,
-                                         row_topleft + ix, residuals + ix);
+      size_t c = PredictPixels<kPredictor, simd_t<pixel_t>>(
+          row + ix, row_left + ix, row_top + ix, row_topleft + ix,
+          residuals + ix);
       prefix_size =
           prefix_size == required_prefix_size ? prefix_size + c : prefix_size;
       required_prefix_size += kNum;
@@ -2876,18 +3069,8 @@ struct ChannelRowProcessor {
 #else
     for (size_t ix = 0; ix < kChunkSize; ix++) {
       pixel_t px = row[ix];
-      pixel_t left = row_left[ix];
-      pixel_t top = row_top[ix];
-      pixel_t topleft = row_topleft[ix];
-      pixel_t ac = left - topleft;
-      pixel_t ab = left - top;
-      pixel_t bc = top - topleft;
-      pixel_t grad = static_cast<pixel_t>(static_cast<upixel_t>(ac) +
-                                          static_cast<upixel_t>(top));
-      pixel_t d = ab ^ bc;
-      pixel_t clamp = d < 0 ? top : left;
-      pixel_t s = ac ^ bc;
-      pixel_t pred = s < 0 ? grad : clamp;
+      pixel_t pred =
+          Predict<kPredictor>(row_left[ix], row_top[ix], row_topleft[ix]);
       residuals[ix] = PackSigned(px - pred);
       prefix_size = prefix_size == required_prefix_size
                         ? prefix_size + (residuals[ix] == 0)
@@ -2909,12 +3092,32 @@ struct ChannelRowProcessor {
     }
   }
 
+  template <FastPredictor kPredictor>
   void ProcessRow(const pixel_t* row, const pixel_t* row_left,
                   const pixel_t* row_top, const pixel_t* row_topleft,
                   size_t xs) {
     for (size_t x = 0; x < xs; x += kChunkSize) {
-      ProcessChunk(row + x, row_left + x, row_top + x, row_topleft + x,
-                   std::min(kChunkSize, xs - x));
+      ProcessChunk<kPredictor>(row + x, row_left + x, row_top + x,
+                               row_topleft + x, std::min(kChunkSize, xs - x));
+    }
+  }
+
+  void ProcessRow(const pixel_t* row, const pixel_t* row_left,
+                  const pixel_t* row_top, const pixel_t* row_topleft,
+                  size_t xs) {
+    switch (predictor) {
+      case FastPredictor::kLeft:
+        return ProcessRow<FastPredictor::kLeft>(row, row_left, row_top,
+                                                row_topleft, xs);
+      case FastPredictor::kTop:
+        return ProcessRow<FastPredictor::kTop>(row, row_left, row_top,
+                                               row_topleft, xs);
+      case FastPredictor::kSelect:
+        return ProcessRow<FastPredictor::kSelect>(row, row_left, row_top,
+                                                  row_topleft, xs);
+      case FastPredictor::kGradient:
+        return ProcessRow<FastPredictor::kGradient>(row, row_left, row_top,
+                                                    row_topleft, xs);
     }
   }
 
@@ -3261,7 +3464,7 @@ template <typename BitDepth>
 void WriteACSection(const unsigned char* rgba, size_t x0, size_t y0, size_t xs,
                     size_t ys, size_t row_stride, bool is_single_group,
                     BitDepth bitdepth, size_t nb_chans, bool big_endian,
-                    const PrefixCode code[4],
+                    const PrefixCode code[4], const FastPredictor predictors[4],
                     std::array<BitWriter, 4>& output) {
   for (size_t i = 0; i < nb_chans; i++) {
     if (is_single_group && i == 0) continue;
@@ -3280,6 +3483,7 @@ void WriteACSection(const unsigned char* rgba, size_t x0, size_t y0, size_t xs,
   ChannelRowProcessor<ChunkEncoder<BitDepth>, BitDepth> row_encoders[4];
   for (size_t c = 0; c < nb_chans; c++) {
     row_encoders[c].t = &encoders[c];
+    row_encoders[c].predictor = predictors[c];
     encoders[c].output = &output[c];
     encoders[c].code = &code[c];
   }
@@ -3383,7 +3587,8 @@ void CollectSamples(const unsigned char* rgba, size_t x0, size_t y0, size_t xs,
                     uint64_t raw_counts[4][kNumRawSymbols],
                     uint64_t lz77_counts[4][kNumLZ77], bool is_single_group,
                     bool palette, BitDepth bitdepth, size_t nb_chans,
-                    bool big_endian, const int16_t* lookup) {
+                    bool big_endian, const int16_t* lookup,
+                    const FastPredictor predictors[4]) {
   if (palette) {
     ChunkSampleCollector<UpTo8Bits> sample_collectors[4];
     ChannelRowProcessor<ChunkSampleCollector<UpTo8Bits>, UpTo8Bits>
@@ -3403,6 +3608,7 @@ void CollectSamples(const unsigned char* rgba, size_t x0, size_t y0, size_t xs,
         row_sample_collectors[4];
     for (size_t c = 0; c < nb_chans; c++) {
       row_sample_collectors[c].t = &sample_collectors[c];
+      row_sample_collectors[c].predictor = predictors[c];
       sample_collectors[c].raw_counts = raw_counts[c];
       sample_collectors[c].lz77_counts = lz77_counts[c];
     }
@@ -3415,13 +3621,27 @@ void CollectSamples(const unsigned char* rgba, size_t x0, size_t y0, size_t xs,
 
 void PrepareDCGlobalPalette(bool is_single_group, size_t width, size_t height,
                             const PrefixCode code[4],
+                            size_t nb_chans,
                             const std::vector<uint32_t>& palette,
                             size_t pcolors, BitWriter* output) {
-  PrepareDCGlobalCommon(is_single_group, width, height, code, output);
+  const FastPredictor predictors[4] = {
+      FastPredictor::kGradient, FastPredictor::kGradient,
+      FastPredictor::kGradient, FastPredictor::kGradient};
+  PrepareDCGlobalCommon(is_single_group, width, height, code, predictors,
+                        output);
   output->Write(2, 0b01);     // 1 transform
   output->Write(2, 0b01);     // Palette
   output->Write(5, 0b00000);  // Starting from ch 0
-  output->Write(2, 0b10);     // 4-channel palette (RGBA)
+  if (nb_chans == 1) {
+    output->Write(2, 0b00);  // 1-channel palette (Gray)
+  } else if (nb_chans == 3) {
+    output->Write(2, 0b01);  // 3-channel palette (RGB)
+  } else if (nb_chans == 4) {
+    output->Write(2, 0b10);  // 4-channel palette (RGBA)
+  } else {
+    output->Write(2, 0b11);
+    output->Write(13, nb_chans - 1);  // 2-channel palette (GA)
+  }
   // pcolors <= kMaxColors + kChunkSize - 1
   static_assert(kMaxColors + kChunkSize < 1281,
                 "add code to signal larger palette sizes");
@@ -3455,15 +3675,12 @@ void PrepareDCGlobalPalette(bool is_single_group, size_t width, size_t height,
   }
   p[0][15] = 0;
   row_encoder.ProcessRow(p[0] + 16, p[0] + 15, p[0] + 15, p[0] + 15, pcolors);
-  p[1][15] = p[0][16];
-  p[0][15] = p[0][16];
-  row_encoder.ProcessRow(p[1] + 16, p[1] + 15, p[0] + 16, p[0] + 15, pcolors);
-  p[2][15] = p[1][16];
-  p[1][15] = p[1][16];
-  row_encoder.ProcessRow(p[2] + 16, p[2] + 15, p[1] + 16, p[1] + 15, pcolors);
-  p[3][15] = p[2][16];
-  p[2][15] = p[2][16];
-  row_encoder.ProcessRow(p[3] + 16, p[3] + 15, p[2] + 16, p[2] + 15, pcolors);
+  for (size_t c = 1; c < nb_chans; c++) {
+    p[c][15] = p[c - 1][16];
+    p[c - 1][15] = p[c - 1][16];
+    row_encoder.ProcessRow(p[c] + 16, p[c] + 15, p[c - 1] + 16, p[c - 1] + 15,
+                           pcolors);
+  }
   row_encoder.Finalize();
 
   if (!is_single_group) {
@@ -3471,25 +3688,336 @@ void PrepareDCGlobalPalette(bool is_single_group, size_t width, size_t height,
   }
 }
 
+// Rough number of bits needed to encode the given samples, in which a token
+// costs one bit more than its extra bits.
+uint64_t EstimateSamplesBits(const uint64_t raw_counts[4][kNumRawSymbols],
+                             const uint64_t lz77_counts[4][kNumLZ77]) {
+  uint64_t bits = 0;
+  for (size_t c = 0; c < 4; c++) {
+    for (size_t i = 0; i < kNumRawSymbols; i++) {
+      bits += raw_counts[c][i] * std::max<size_t>(i, 1);
+    }
+    for (size_t i = 0; i < kNumLZ77; i++) {
+      bits += lz77_counts[c][i] * (i < 16 ? 1 : i - 11);
+    }
+  }
+  return bits;
+}
+
+// If `group_costs` is not null, also stores there the estimated cost of
+// encoding each AC group, which is proportional to the size of its samples.
+template <typename BitDepth>
+void CollectFrameSamples(const unsigned char* rgba, size_t width, size_t stride,
+                         size_t height, bool onegroup, bool palette,
+                         BitDepth bitdepth, size_t nb_chans, bool big_endian,
+                         int effort, const int16_t* lookup,
+                         const FastPredictor predictors[4],
+                         uint64_t raw_counts[4][kNumRawSymbols],
+                         uint64_t lz77_counts[4][kNumLZ77],
+                         uint64_t* group_costs = nullptr) {
+  size_t num_groups_x = (width + 255) / 256;
+  size_t num_groups_y = (height + 255) / 256;
+
+  uint64_t bits_before_group = 0;
+  // sample the middle (effort * 2) rows of every group
+  for (size_t g = 0; g < num_groups_y * num_groups_x; g++) {
+    size_t xg = g % num_groups_x;
+    size_t yg = g / num_groups_x;
+    int y_offset = yg * 256;
+    int y_max = std::min<size_t>(height - yg * 256, 256);
+    int y_begin = y_offset + std::max<int>(0, y_max - 2 * effort) / 2;
+    int y_count =
+        std::min<int>(2 * effort * y_max / 256, y_offset + y_max - y_begin - 1);
+    int x_max =
+        std::min<size_t>(width - xg * 256, 256) / kChunkSize * kChunkSize;
+    CollectSamples(rgba, xg * 256, y_begin, x_max, stride, y_count, raw_counts,
+                   lz77_counts, onegroup, palette, bitdepth, nb_chans,
+                   big_endian, lookup, predictors);
+    if (group_costs) {
+      uint64_t bits = EstimateSamplesBits(raw_counts, lz77_counts);
+      group_costs[g] = bits - bits_before_group;
+      bits_before_group = bits;
+    }
+  }
+}
+
+// Fast lossless effort from which the predictor of each channel is chosen
+// among kAllFastPredictors, instead of always using the gradient predictor.
+constexpr int kPredictorSearchEffort = 3;
+
+// Number of frames of a live stream that reuse the samples of a previous frame
+// before new samples are taken, and growth of the coded bits per pixel over the
+// frame of the samples from which the next frame takes new samples.
+constexpr size_t kLiveMaxReusedFrames = 60;
+constexpr double kLiveMaxBitsGrowth = 1.125;
+
+// Estimates the number of bits needed to entropy code the given samples of a
+// channel, including extra bits.
+double EstimateChannelCost(const uint64_t raw_counts[kNumRawSymbols],
+                           const uint64_t lz77_counts[kNumLZ77]) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < kNumRawSymbols; i++) total += raw_counts[i];
+  for (size_t i = 0; i < kNumLZ77; i++) total += lz77_counts[i];
+  double cost = 0;
+  auto add_symbol = [&](uint64_t count, size_t extra_bits) {
+    if (count == 0) return;
+    cost += count * (log2(static_cast<double>(total) / count) +
+                     static_cast<double>(extra_bits));
+  };
+  for (size_t i = 0; i < kNumRawSymbols; i++) {
+    add_symbol(raw_counts[i], i == 0 ? 0 : i - 1);
+  }
+  for (size_t i = 0; i < kNumLZ77; i++) {
+    add_symbol(lz77_counts[i], i < 16 ? 0 : i - 12);
+  }
+  return cost;
+}
+
+// Picks, for each channel, the predictor that produces the cheapest sampled
+// residuals, and returns the samples of the chosen predictors. This is
+// equivalent to learning a tree with a leaf per channel, as the tree is fixed
+// to split on the channel property only.
+template <typename BitDepth>
+void ChoosePredictors(const unsigned char* rgba, size_t width, size_t stride,
+                      size_t height, bool onegroup, BitDepth bitdepth,
+                      size_t nb_chans, bool big_endian, int effort,
+                      FastPredictor predictors[4],
+                      uint64_t raw_counts[4][kNumRawSymbols],
+                      uint64_t lz77_counts[4][kNumLZ77],
+                      uint64_t* group_costs = nullptr) {
+  double best_cost[4];
+  std::fill(best_cost, best_cost + 4, std::numeric_limits<double>::max());
+  for (size_t p = 0; p < sizeof(kAllFastPredictors) / sizeof(FastPredictor);
+       p++) {
+    FastPredictor candidate = kAllFastPredictors[p];
+    const FastPredictor candidates[4] = {candidate, candidate, candidate,
+                                         candidate};
+    uint64_t candidate_raw_counts[4][kNumRawSymbols] = {};
+    uint64_t candidate_lz77_counts[4][kNumLZ77] = {};
+    CollectFrameSamples(rgba, width, stride, height, onegroup,
+                        /*palette=*/false, bitdepth, nb_chans, big_endian,
+                        effort, /*lookup=*/nullptr, candidates,
+                        candidate_raw_counts, candidate_lz77_counts,
+                        p == 0 ? group_costs : nullptr);
+    for (size_t c = 0; c < 4; c++) {
+      double cost = EstimateChannelCost(candidate_raw_counts[c],
+                                        candidate_lz77_counts[c]);
+      if (cost >= best_cost[c]) continue;
+      best_cost[c] = cost;
+      predictors[c] = candidate;
+      memcpy(raw_counts[c], candidate_raw_counts[c], sizeof(raw_counts[c]));
+      memcpy(lz77_counts[c], candidate_lz77_counts[c], sizeof(lz77_counts[c]));
+    }
+  }
+}
+
+template <typename BitDepth>
+void ComputePrefixCodes(BitDepth bitdepth, size_t nb_chans, bool palette,
+                        int pcolors,
+                        const uint64_t sampled_raw_counts[4][kNumRawSymbols],
+                        const uint64_t sampled_lz77_counts[4][kNumLZ77],
+                        PrefixCode hcode[4]) {
+  // TODO(veluca): can probably improve this and make it bitdepth-dependent.
+  uint64_t base_raw_counts[kNumRawSymbols] = {
+      3843, 852, 1270, 1214, 1014, 727, 481, 300, 159, 51,
+      5,    1,   1,    1,    1,    1,   1,   1,   1};
+
+  bool doing_ycocg = nb_chans > 2 && !palette;
+  for (size_t i = bitdepth.NumSymbols(doing_ycocg); i < kNumRawSymbols; i++) {
+    base_raw_counts[i] = 0;
+  }
+
+  uint64_t raw_counts[4][kNumRawSymbols];
+  for (size_t c = 0; c < 4; c++) {
+    for (size_t i = 0; i < kNumRawSymbols; i++) {
+      raw_counts[c][i] = (sampled_raw_counts[c][i] << 8) + base_raw_counts[i];
+    }
+  }
+
+  if (palette) {
+    unsigned token, nbits, bits;
+    EncodeHybridUint000(PackSigned(pcolors - 1), &token, &nbits, &bits);
+    // ensure all palette indices can actually be encoded
+    for (size_t i = 0; i < token + 1; i++)
+      raw_counts[0][i] = std::max<uint64_t>(raw_counts[0][i], 1);
+    // these tokens are only used for the palette itself so they can get a bad
+    // code
+    for (size_t i = token + 1; i < 10; i++) raw_counts[0][i] = 1;
+  }
+
+  uint64_t base_lz77_counts[kNumLZ77] = {
+      29, 27, 25,  23, 21, 21, 19, 18, 21, 17, 16, 15, 15, 14,
+      13, 13, 137, 98, 61, 34, 1,  1,  1,  1,  1,  1,  1,  1,
+  };
+
+  uint64_t lz77_counts[4][kNumLZ77];
+  for (size_t c = 0; c < 4; c++) {
+    for (size_t i = 0; i < kNumLZ77; i++) {
+      lz77_counts[c][i] =
+          (sampled_lz77_counts[c][i] << 8) + base_lz77_counts[i];
+    }
+  }
+
+  for (size_t i = 0; i < 4; i++) {
+    hcode[i] = PrefixCode(bitdepth, raw_counts[i], lz77_counts[i]);
+  }
+}
+
+JxlFastLosslessFrameState* NewFrameState(size_t width, size_t height,
+                                         size_t nb_chans, size_t bitdepth) {
+  size_t num_groups_x = (width + 255) / 256;
+  size_t num_groups_y = (height + 255) / 256;
+  size_t num_dc_groups_x = (width + 2047) / 2048;
+  size_t num_dc_groups_y = (height + 2047) / 2048;
+  bool onegroup = num_groups_x == 1 && num_groups_y == 1;
+
+  size_t num_groups = onegroup ? 1
+                               : (2 + num_dc_groups_x * num_dc_groups_y +
+                                  num_groups_x * num_groups_y);
+
+  JxlFastLosslessFrameState* frame_state = new JxlFastLosslessFrameState();
+
+  frame_state->width = width;
+  frame_state->height = height;
+  frame_state->nb_chans = nb_chans;
+  frame_state->bitdepth = bitdepth;
+  frame_state->image_width = width;
+  frame_state->image_height = height;
+
+  frame_state->group_data = std::vector<std::array<BitWriter, 4>>(num_groups);
+  return frame_state;
+}
+
+// Encodes the groups of rows [first_row, first_row + num_rows) of the frame;
+// `rgba` points to `first_row`, which must be the first row of a group.
+// If `group_costs` (indexed by group of the whole frame) is not null, the
+// groups are handed to the runner from the most to the least expensive, so
+// that a large group started last does not keep the other threads idle.
+template <typename BitDepth>
+void WriteGroups(const unsigned char* rgba, size_t stride, size_t first_row,
+                 size_t num_rows, bool palette, BitDepth bitdepth,
+                 bool big_endian, const PrefixCode hcode[4],
+                 const FastPredictor predictors[4], const int16_t* lookup,
+                 const uint64_t* group_costs,
+                 JxlFastLosslessFrameState* frame_state,
+                 void* runner_opaque, FJxlParallelRunner runner) {
+  assert(first_row % 256 == 0);
+  size_t width = frame_state->width;
+  size_t height = frame_state->height;
+  size_t nb_chans = frame_state->nb_chans;
+  size_t num_groups_x = (width + 255) / 256;
+  size_t num_groups_y = (height + 255) / 256;
+  size_t num_dc_groups_x = (width + 2047) / 2048;
+  size_t num_dc_groups_y = (height + 2047) / 2048;
+  bool onegroup = num_groups_x == 1 && num_groups_y == 1;
+  size_t first_group_y = first_row / 256;
+  size_t num_rows_of_groups = (num_rows + 255) / 256;
+  size_t num_tasks = num_groups_x * num_rows_of_groups;
+
+  std::vector<size_t> order(num_tasks);
+  for (size_t i = 0; i < num_tasks; i++) order[i] = i;
+  if (group_costs) {
+    const uint64_t* costs = group_costs + first_group_y * num_groups_x;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return costs[a] > costs[b];
+    });
+  }
+
+  auto run_one = [&](size_t i) {
+    size_t xg = i % num_groups_x;
+    size_t yg = first_group_y + i / num_groups_x;
+    size_t g = yg * num_groups_x + xg;
+    size_t group_id =
+        onegroup ? 0 : (2 + num_dc_groups_x * num_dc_groups_y + g);
+    size_t xs = std::min<size_t>(width - xg * 256, 256);
+    size_t ys = std::min<size_t>(height - yg * 256, 256);
+    size_t x0 = xg * 256;
+    // Row of the group in `rgba`.
+    size_t y0 = (yg - first_group_y) * 256;
+    auto& gd = frame_state->group_data[group_id];
+    if (!palette) {
+      WriteACSection(rgba, x0, y0, xs, ys, stride, onegroup, bitdepth, nb_chans,
+                     big_endian, hcode, predictors, gd);
+
+    } else {
+      WriteACSectionPalette(rgba, x0, y0, xs, ys, stride, onegroup, hcode,
+                            lookup, nb_chans, gd[0]);
+    }
+  };
+
+  // Each group is written to its own BitWriter, so the order in which they
+  // are encoded does not change the output.
+  auto run_task = [&](size_t i) { run_one(order[i]); };
+
+  runner(
+      runner_opaque, &run_task,
+      +[](void* r, size_t i) {
+        (*reinterpret_cast<decltype(&run_task)>(r))(i);
+      },
+      num_tasks);
+}
+
+// Keeps the samples of a live frame that was just encoded for the next frames,
+// or drops the reused ones if they no longer fit the content.
+void UpdateLiveState(bool reused_samples, bool palette,
+                     const FastPredictor predictors[4],
+                     const uint64_t raw_counts[4][kNumRawSymbols],
+                     const uint64_t lz77_counts[4][kNumLZ77],
+                     const JxlFastLosslessFrameState* frame_state,
+                     JxlFastLosslessLiveState* live) {
+  uint64_t bits = 0;
+  for (const auto& writers : frame_state->group_data) {
+    for (size_t c = 0; c < frame_state->nb_chans; c++) {
+      bits += writers[c].bytes_written * 8 + writers[c].bits_in_buffer;
+    }
+  }
+  const double bits_per_pixel =
+      static_cast<double>(bits) / (frame_state->width * frame_state->height);
+  if (reused_samples) {
+    live->frames_since_sampling++;
+    if (bits_per_pixel > live->sampled_bits_per_pixel * kLiveMaxBitsGrowth) {
+      live->have_samples = false;
+    }
+    return;
+  }
+  // The prefix codes of palette frames only cover the indices of their palette.
+  live->have_samples = !palette;
+  live->nb_chans = frame_state->nb_chans;
+  live->bitdepth = frame_state->bitdepth;
+  for (size_t c = 0; c < 4; c++) {
+    live->predictors[c] = static_cast<uint8_t>(predictors[c]);
+  }
+  memcpy(live->raw_counts, raw_counts, sizeof(live->raw_counts));
+  memcpy(live->lz77_counts, lz77_counts, sizeof(live->lz77_counts));
+  live->sampled_bits_per_pixel = bits_per_pixel;
+  live->frames_since_sampling = 0;
+}
+
 template <typename BitDepth>
 JxlFastLosslessFrameState* LLEnc(const unsigned char* rgba, size_t width,
                                  size_t stride, size_t height,
                                  BitDepth bitdepth, size_t nb_chans,
                                  bool big_endian, int effort,
-                                 void* runner_opaque,
-                                 FJxlParallelRunner runner) {
+                                 void* runner_opaque, FJxlParallelRunner runner,
+                                 JxlFastLosslessLiveState* live) {
   assert(width != 0);
   assert(height != 0);
   assert(stride >= nb_chans * BitDepth::kInputBytes * width);
 
+  // Frames of a live stream reuse the predictors and samples of a previous
+  // frame when possible, which also rules out palette.
+  const bool reuse_samples =
+      live != nullptr && live->have_samples && live->nb_chans == nb_chans &&
+      live->bitdepth == bitdepth.bitdepth &&
+      live->frames_since_sampling < kLiveMaxReusedFrames;
+
   // Count colors to try palette
   std::vector<uint32_t> palette(kHashSize);
   palette[0] = 1;
   std::vector<int16_t> lookup(kHashSize);
   lookup[0] = 0;
   int pcolors = 0;
-  bool collided = effort < 2 || bitdepth.bitdepth != 8 ||
-                  nb_chans < 4;  // todo: also do rgb palette
+  bool collided = reuse_samples || effort < 2 || bitdepth.bitdepth != 8;
   for (size_t y = 0; y < height && !collided; y++) {
     const unsigned char* r = rgba + stride * y;
     size_t x = 0;
@@ -3506,6 +4034,10 @@ JxlFastLosslessFrameState* LLEnc(const unsigned char* rgba, size_t width,
           }
         }
         for (int i = 0; i < 8; i++) palette[index[i]] = p[i];
+        // catch different colors of the same batch with the same hash
+        for (int i = 0; i < 8; i++) {
+          if (palette[index[i]] != p[i]) collided = true;
+        }
       }
       for (; x < width; x++) {
         uint32_t p;
@@ -3518,6 +4050,25 @@ JxlFastLosslessFrameState* LLEnc(const unsigned char* rgba, size_t width,
         palette[index] = p;
       }
     } else {
+      // same unrolling, for pixels of 1 to 3 bytes
+      for (; x + 7 < width; x += 8) {
+        uint32_t p[8] = {}, index[8];
+        for (int i = 0; i < 8; i++) {
+          memcpy(&p[i], r + (x + i) * nb_chans, nb_chans);
+        }
+        for (int i = 0; i < 8; i++) index[i] = pixel_hash(p[i]);
+        for (int i = 0; i < 8; i++) {
+          uint32_t init_entry = index[i] ? 0 : 1;
+          if (init_entry != palette[index[i]] && p[i] != palette[index[i]]) {
+            collided = true;
+          }
+        }
+        for (int i = 0; i < 8; i++) palette[index[i]] = p[i];
+        // catch different colors of the same batch with the same hash
+        for (int i = 0; i < 8; i++) {
+          if (palette[index[i]] != p[i]) collided = true;
+        }
+      }
       for (; x < width; x++) {
         uint32_t p = 0;
         memcpy(&p, r + x * nb_chans, nb_chans);
@@ -3537,15 +4088,17 @@ JxlFastLosslessFrameState* LLEnc(const unsigned char* rgba, size_t width,
     if (palette[0] == 1) palette[0] = 0;
     bool have_color = false;
     uint8_t minG = 255, maxG = 0;
+    // Index of the channel used to estimate the range of gray levels.
+    size_t gray_chan = nb_chans < 3 ? 0 : 1;
     for (uint32_t k = 0; k < kHashSize; k++) {
       if (palette[k] == 0) continue;
       uint8_t p[4];
       memcpy(p, &palette[k], 4);
       // move entries to front so sort has less work
       palette[nb_entries] = palette[k];
-      if (p[0] != p[1] || p[0] != p[2]) have_color = true;
-      if (p[1] < minG) minG = p[1];
-      if (p[1] > maxG) maxG = p[1];
+      if (nb_chans >= 3 && (p[0] != p[1] || p[0] != p[2])) have_color = true;
+      if (p[gray_chan] < minG) minG = p[gray_chan];
+      if (p[gray_chan] > maxG) maxG = p[gray_chan];
       nb_entries++;
       // don't do palette if too many colors are needed
       if (nb_entries + pcolors > kMaxColors) {
@@ -3559,19 +4112,21 @@ JxlFastLosslessFrameState* LLEnc(const unsigned char* rgba, size_t width,
     }
   }
   if (!collided) {
-    std::sort(
-        palette.begin(), palette.begin() + nb_entries,
-        [](uint32_t ap, uint32_t bp) {
-          if (ap == 0) return false;
-          if (bp == 0) return true;
-          uint8_t a[4], b[4];
-          memcpy(a, &ap, 4);
-          memcpy(b, &bp, 4);
-          float ay, by;
-          ay = (0.299f * a[0] + 0.587f * a[1] + 0.114f * a[2] + 0.01f) * a[3];
-          by = (0.299f * b[0] + 0.587f * b[1] + 0.114f * b[2] + 0.01f) * b[3];
-          return ay < by;  // sort on alpha*luma
-        });
+    auto alpha_luma = [nb_chans](uint32_t color) -> float {
+      uint8_t c[4];
+      memcpy(c, &color, 4);
+      if (nb_chans < 3) {
+        return (c[0] + 0.01f) * (nb_chans == 2 ? c[1] : 255);
+      }
+      return (0.299f * c[0] + 0.587f * c[1] + 0.114f * c[2] + 0.01f) *
+             (nb_chans == 4 ? c[3] : 255);
+    };
+    std::sort(palette.begin(), palette.begin() + nb_entries,
+              [&](uint32_t ap, uint32_t bp) {
+                if (ap == 0) return false;
+                if (bp == 0) return true;
+                return alpha_luma(ap) < alpha_luma(bp);  // sort on alpha*luma
+              });
     for (int k = 0; k < nb_entries; k++) {
       if (palette[k] == 0) break;
       lookup[pixel_hash(palette[k])] = pcolors++;
@@ -3580,142 +4135,184 @@ JxlFastLosslessFrameState* LLEnc(const unsigned char* rgba, size_t width,
 
   size_t num_groups_x = (width + 255) / 256;
   size_t num_groups_y = (height + 255) / 256;
-  size_t num_dc_groups_x = (width + 2047) / 2048;
-  size_t num_dc_groups_y = (height + 2047) / 2048;
+  bool onegroup = num_groups_x == 1 && num_groups_y == 1;
 
   uint64_t raw_counts[4][kNumRawSymbols] = {};
   uint64_t lz77_counts[4][kNumLZ77] = {};
-
-  bool onegroup = num_groups_x == 1 && num_groups_y == 1;
-
-  // sample the middle (effort * 2) rows of every group
-  for (size_t g = 0; g < num_groups_y * num_groups_x; g++) {
-    size_t xg = g % num_groups_x;
-    size_t yg = g / num_groups_x;
-    int y_offset = yg * 256;
-    int y_max = std::min<size_t>(height - yg * 256, 256);
-    int y_begin = y_offset + std::max<int>(0, y_max - 2 * effort) / 2;
-    int y_count =
-        std::min<int>(2 * effort * y_max / 256, y_offset + y_max - y_begin - 1);
-    int x_max =
-        std::min<size_t>(width - xg * 256, 256) / kChunkSize * kChunkSize;
-    CollectSamples(rgba, xg * 256, y_begin, x_max, stride, y_count, raw_counts,
-                   lz77_counts, onegroup, !collided, bitdepth, nb_chans,
-                   big_endian, lookup.data());
-  }
-
-  // TODO(veluca): can probably improve this and make it bitdepth-dependent.
-  uint64_t base_raw_counts[kNumRawSymbols] = {
-      3843, 852, 1270, 1214, 1014, 727, 481, 300, 159, 51,
-      5,    1,   1,    1,    1,    1,   1,   1,   1};
-
-  bool doing_ycocg = nb_chans > 2 && collided;
-  for (size_t i = bitdepth.NumSymbols(doing_ycocg); i < kNumRawSymbols; i++) {
-    base_raw_counts[i] = 0;
-  }
-
-  for (size_t c = 0; c < 4; c++) {
-    for (size_t i = 0; i < kNumRawSymbols; i++) {
-      raw_counts[c][i] = (raw_counts[c][i] << 8) + base_raw_counts[i];
-    }
-  }
-
-  if (!collided) {
-    unsigned token, nbits, bits;
-    EncodeHybridUint000(PackSigned(pcolors - 1), &token, &nbits, &bits);
-    // ensure all palette indices can actually be encoded
-    for (size_t i = 0; i < token + 1; i++)
-      raw_counts[0][i] = std::max<uint64_t>(raw_counts[0][i], 1);
-    // these tokens are only used for the palette itself so they can get a bad
-    // code
-    for (size_t i = token + 1; i < 10; i++) raw_counts[0][i] = 1;
-  }
-
-  uint64_t base_lz77_counts[kNumLZ77] = {
-      29, 27, 25,  23, 21, 21, 19, 18, 21, 17, 16, 15, 15, 14,
-      13, 13, 137, 98, 61, 34, 1,  1,  1,  1,  1,  1,  1,  1,
-  };
-
-  for (size_t c = 0; c < 4; c++) {
-    for (size_t i = 0; i < kNumLZ77; i++) {
-      lz77_counts[c][i] = (lz77_counts[c][i] << 8) + base_lz77_counts[i];
+  FastPredictor predictors[4] = {
+      FastPredictor::kGradient, FastPredictor::kGradient,
+      FastPredictor::kGradient, FastPredictor::kGradient};
+  std::vector<uint64_t> group_costs(num_groups_x * num_groups_y);
+  if (reuse_samples) {
+    for (size_t c = 0; c < 4; c++) {
+      predictors[c] = static_cast<FastPredictor>(live->predictors[c]);
     }
+    memcpy(raw_counts, live->raw_counts, sizeof(raw_counts));
+    memcpy(lz77_counts, live->lz77_counts, sizeof(lz77_counts));
+  } else if (collided && effort >= kPredictorSearchEffort) {
+    ChoosePredictors(rgba, width, stride, height, onegroup, bitdepth, nb_chans,
+                     big_endian, effort, predictors, raw_counts, lz77_counts,
+                     group_costs.data());
+  } else {
+    CollectFrameSamples(rgba, width, stride, height, onegroup, !collided,
+                        bitdepth, nb_chans, big_endian, effort, lookup.data(),
+                        predictors, raw_counts, lz77_counts,
+                        group_costs.data());
   }
 
   alignas(64) PrefixCode hcode[4];
-  for (size_t i = 0; i < 4; i++) {
-    hcode[i] = PrefixCode(bitdepth, raw_counts[i], lz77_counts[i]);
-  }
+  ComputePrefixCodes(bitdepth, nb_chans, !collided, pcolors, raw_counts,
+                     lz77_counts, hcode);
 
-  size_t num_groups = onegroup ? 1
-                               : (2 + num_dc_groups_x * num_dc_groups_y +
-                                  num_groups_x * num_groups_y);
+  JxlFastLosslessFrameState* frame_state =
+      NewFrameState(width, height, nb_chans, bitdepth.bitdepth);
 
-  JxlFastLosslessFrameState* frame_state = new JxlFastLosslessFrameState();
-
-  frame_state->width = width;
-  frame_state->height = height;
-  frame_state->nb_chans = nb_chans;
-  frame_state->bitdepth = bitdepth.bitdepth;
-
-  frame_state->group_data = std::vector<std::array<BitWriter, 4>>(num_groups);
   if (collided) {
-    PrepareDCGlobal(onegroup, width, height, nb_chans, hcode,
+    PrepareDCGlobal(onegroup, width, height, nb_chans, hcode, predictors,
                     &frame_state->group_data[0][0]);
   } else {
-    PrepareDCGlobalPalette(onegroup, width, height, hcode, palette, pcolors,
-                           &frame_state->group_data[0][0]);
+    PrepareDCGlobalPalette(onegroup, width, height, hcode, nb_chans, palette,
+                           pcolors, &frame_state->group_data[0][0]);
   }
 
-  auto run_one = [&](size_t g) {
-    size_t xg = g % num_groups_x;
-    size_t yg = g / num_groups_x;
-    size_t group_id =
-        onegroup ? 0 : (2 + num_dc_groups_x * num_dc_groups_y + g);
-    size_t xs = std::min<size_t>(width - xg * 256, 256);
-    size_t ys = std::min<size_t>(height - yg * 256, 256);
-    size_t x0 = xg * 256;
-    size_t y0 = yg * 256;
-    auto& gd = frame_state->group_data[group_id];
-    if (collided) {
-      WriteACSection(rgba, x0, y0, xs, ys, stride, onegroup, bitdepth, nb_chans,
-                     big_endian, hcode, gd);
+  // The cost of the groups is only estimated when they are sampled.
+  WriteGroups(rgba, stride, /*first_row=*/0, height, !collided, bitdepth,
+              big_endian, hcode, predictors, lookup.data(),
+              reuse_samples ? nullptr : group_costs.data(), frame_state,
+              runner_opaque, runner);
 
-    } else {
-      WriteACSectionPalette(rgba, x0, y0, xs, ys, stride, onegroup, hcode,
-                            lookup.data(), nb_chans, gd[0]);
-    }
-  };
+  if (live != nullptr) {
+    UpdateLiveState(reuse_samples, !collided, predictors, raw_counts,
+                    lz77_counts, frame_state, live);
+  }
+  return frame_state;
+}
 
-  runner(
-      runner_opaque, &run_one,
-      +[](void* r, size_t i) { (*reinterpret_cast<decltype(&run_one)>(r))(i); },
-      num_groups_x * num_groups_y);
+// Encodes the strips of rows of a streaming frame. Palette is not used, as
+// the set of colors is not known in advance, and the prefix codes are computed
+// from the first strip.
+template <typename BitDepth>
+struct StreamingEncoder : public FJxlStripEncoder {
+  StreamingEncoder(BitDepth bitdepth, bool big_endian, int effort,
+                   void* runner_opaque, FJxlParallelRunner runner)
+      : bitdepth(bitdepth),
+        big_endian(big_endian),
+        effort(effort),
+        runner_opaque(runner_opaque),
+        runner(runner) {}
+
+  void AddRows(JxlFastLosslessFrameState* frame_state,
+               const unsigned char* rgba, size_t stride,
+               size_t num_rows) override {
+    size_t width = frame_state->width;
+    size_t height = frame_state->height;
+    size_t nb_chans = frame_state->nb_chans;
+    assert(num_rows != 0);
+    assert(rows_added + num_rows <= height);
+    assert(num_rows % 256 == 0 || rows_added + num_rows == height);
+    assert(stride >= nb_chans * BitDepth::kInputBytes * width);
+    bool onegroup = width <= 256 && height <= 256;
+    if (rows_added == 0) {
+      size_t sample_rows = std::min<size_t>(num_rows, 256);
+      if (effort >= kPredictorSearchEffort) {
+        ChoosePredictors(rgba, width, stride, sample_rows, onegroup, bitdepth,
+                         nb_chans, big_endian, effort, predictors, raw_counts,
+                         lz77_counts);
+      } else {
+        CollectFrameSamples(rgba, width, stride, sample_rows, onegroup,
+                            /*palette=*/false, bitdepth, nb_chans, big_endian,
+                            effort, /*lookup=*/nullptr, predictors, raw_counts,
+                            lz77_counts);
+      }
+    }
+    // The codes are not kept in the (heap-allocated) encoder, as they require
+    // an alignment that is not guaranteed there.
+    alignas(64) PrefixCode hcode[4];
+    ComputePrefixCodes(bitdepth, nb_chans, /*palette=*/false, /*pcolors=*/0,
+                       raw_counts, lz77_counts, hcode);
+    if (rows_added == 0) {
+      PrepareDCGlobal(onegroup, width, height, nb_chans, hcode, predictors,
+                      &frame_state->group_data[0][0]);
+    }
+    WriteGroups(rgba, stride, rows_added, num_rows, /*palette=*/false,
+                bitdepth, big_endian, hcode, predictors, /*lookup=*/nullptr,
+                /*group_costs=*/nullptr, frame_state, runner_opaque, runner);
+    rows_added += num_rows;
+  }
+
+  BitDepth bitdepth;
+  bool big_endian;
+  int effort;
+  void* runner_opaque;
+  FJxlParallelRunner* runner;
+  size_t rows_added = 0;
+  FastPredictor predictors[4] = {
+      FastPredictor::kGradient, FastPredictor::kGradient,
+      FastPredictor::kGradient, FastPredictor::kGradient};
+  uint64_t raw_counts[4][kNumRawSymbols] = {};
+  uint64_t lz77_counts[4][kNumLZ77] = {};
+};
 
+template <typename BitDepth>
+JxlFastLosslessFrameState* LLEncStreaming(size_t width, size_t height,
+                                          BitDepth bitdepth, size_t nb_chans,
+                                          bool big_endian, int effort,
+                                          void* runner_opaque,
+                                          FJxlParallelRunner runner) {
+  assert(width != 0);
+  assert(height != 0);
+  JxlFastLosslessFrameState* frame_state =
+      NewFrameState(width, height, nb_chans, bitdepth.bitdepth);
+  frame_state->strip_encoder.reset(new StreamingEncoder<BitDepth>(
+      bitdepth, big_endian, effort, runner_opaque, runner));
   return frame_state;
 }
 
 JxlFastLosslessFrameState* JxlFastLosslessEncodeImpl(
     const unsigned char* rgba, size_t width, size_t stride, size_t height,
     size_t nb_chans, size_t bitdepth, bool big_endian, int effort,
-    void* runner_opaque, FJxlParallelRunner runner) {
+    void* runner_opaque, FJxlParallelRunner runner,
+    JxlFastLosslessLiveState* live) {
   assert(bitdepth > 0);
   assert(nb_chans <= 4);
   assert(nb_chans != 0);
   if (bitdepth <= 8) {
     return LLEnc(rgba, width, stride, height, UpTo8Bits(bitdepth), nb_chans,
-                 big_endian, effort, runner_opaque, runner);
+                 big_endian, effort, runner_opaque, runner, live);
   }
   if (bitdepth <= 13) {
     return LLEnc(rgba, width, stride, height, From9To13Bits(bitdepth), nb_chans,
-                 big_endian, effort, runner_opaque, runner);
+                 big_endian, effort, runner_opaque, runner, live);
   }
   if (bitdepth == 14) {
     return LLEnc(rgba, width, stride, height, Exactly14Bits(bitdepth), nb_chans,
-                 big_endian, effort, runner_opaque, runner);
+                 big_endian, effort, runner_opaque, runner, live);
   }
   return LLEnc(rgba, width, stride, height, MoreThan14Bits(bitdepth), nb_chans,
-               big_endian, effort, runner_opaque, runner);
+               big_endian, effort, runner_opaque, runner, live);
+}
+
+JxlFastLosslessFrameState* JxlFastLosslessStreamingImpl(
+    size_t width, size_t height, size_t nb_chans, size_t bitdepth,
+    bool big_endian, int effort, void* runner_opaque,
+    FJxlParallelRunner runner) {
+  assert(bitdepth > 0);
+  assert(nb_chans <= 4);
+  assert(nb_chans != 0);
+  if (bitdepth <= 8) {
+    return LLEncStreaming(width, height, UpTo8Bits(bitdepth), nb_chans,
+                          big_endian, effort, runner_opaque, runner);
+  }
+  if (bitdepth <= 13) {
+    return LLEncStreaming(width, height, From9To13Bits(bitdepth), nb_chans,
+                          big_endian, effort, runner_opaque, runner);
+  }
+  if (bitdepth == 14) {
+    return LLEncStreaming(width, height, Exactly14Bits(bitdepth), nb_chans,
+                          big_endian, effort, runner_opaque, runner);
+  }
+  return LLEncStreaming(width, height, MoreThan14Bits(bitdepth), nb_chans,
+                        big_endian, effort, runner_opaque, runner);
 }
 
 }  // namespace
@@ -3821,6 +4418,16 @@ JxlFastLosslessFrameState* JxlFastLosslessPrepareFrame(
     const unsigned char* rgba, size_t width, size_t row_stride, size_t height,
     size_t nb_chans, size_t bitdepth, int big_endian, int effort,
     void* runner_opaque, FJxlParallelRunner runner) {
+  return JxlFastLosslessPrepareLiveFrame(
+      /*live=*/nullptr, rgba, width, row_stride, height, nb_chans, bitdepth,
+      big_endian, effort, runner_opaque, runner);
+}
+
+JxlFastLosslessFrameState* JxlFastLosslessPrepareLiveFrame(
+    JxlFastLosslessLiveState* live, const unsigned char* rgba, size_t width,
+    size_t row_stride, size_t height, size_t nb_chans, size_t bitdepth,
+    int big_endian, int effort, void* runner_opaque,
+    FJxlParallelRunner runner) {
   auto trivial_runner =
       +[](void*, void* opaque, void fun(void*, size_t), size_t count) {
         for (size_t i = 0; i < count; i++) {
@@ -3837,22 +4444,67 @@ JxlFastLosslessFrameState* JxlFastLosslessPrepareFrame(
       __builtin_cpu_supports("avx512vbmi") &&
       __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512f") &&
       __builtin_cpu_supports("avx512vl")) {
-    return AVX512::JxlFastLosslessEncodeImpl(rgba, width, row_stride, height,
-                                             nb_chans, bitdepth, big_endian,
-                                             effort, runner_opaque, runner);
+    return AVX512::JxlFastLosslessEncodeImpl(
+        rgba, width, row_stride, height, nb_chans, bitdepth, big_endian, effort,
+        runner_opaque, runner, live);
   }
 #endif
 #if FJXL_ENABLE_AVX2
   if (__builtin_cpu_supports("avx2")) {
-    return AVX2::JxlFastLosslessEncodeImpl(rgba, width, row_stride, height,
-                                           nb_chans, bitdepth, big_endian,
-                                           effort, runner_opaque, runner);
+    return AVX2::JxlFastLosslessEncodeImpl(
+        rgba, width, row_stride, height, nb_chans, bitdepth, big_endian, effort,
+        runner_opaque, runner, live);
   }
 #endif
 
   return default_implementation::JxlFastLosslessEncodeImpl(
       rgba, width, row_stride, height, nb_chans, bitdepth, big_endian, effort,
-      runner_opaque, runner);
+      runner_opaque, runner, live);
+}
+
+JxlFastLosslessFrameState* JxlFastLosslessPrepareStreamingFrame(
+    size_t width, size_t height, size_t nb_chans, size_t bitdepth,
+    int big_endian, int effort, void* runner_opaque,
+    FJxlParallelRunner runner) {
+  auto trivial_runner =
+      +[](void*, void* opaque, void fun(void*, size_t), size_t count) {
+        for (size_t i = 0; i < count; i++) {
+          fun(opaque, i);
+        }
+      };
+
+  if (runner == nullptr) {
+    runner = trivial_runner;
+  }
+
+#if FJXL_ENABLE_AVX512
+  if (__builtin_cpu_supports("avx512cd") &&
+      __builtin_cpu_supports("avx512vbmi") &&
+      __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512vl")) {
+    return AVX512::JxlFastLosslessStreamingImpl(width, height, nb_chans,
+                                                bitdepth, big_endian, effort,
+                                                runner_opaque, runner);
+  }
+#endif
+#if FJXL_ENABLE_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    return AVX2::JxlFastLosslessStreamingImpl(width, height, nb_chans,
+                                              bitdepth, big_endian, effort,
+                                              runner_opaque, runner);
+  }
+#endif
+
+  return default_implementation::JxlFastLosslessStreamingImpl(
+      width, height, nb_chans, bitdepth, big_endian, effort, runner_opaque,
+      runner);
+}
+
+void JxlFastLosslessAddRows(JxlFastLosslessFrameState* frame,
+                            const unsigned char* rgba, size_t row_stride,
+                            size_t num_rows) {
+  assert(frame->strip_encoder != nullptr);
+  frame->strip_encoder->AddRows(frame, rgba, row_stride, num_rows);
 }
 
 }  // extern "C"
@@ -5,6 +5,7 @@
 
 #ifndef LIB_JXL_ENC_FAST_LOSSLESS_H_
 #define LIB_JXL_ENC_FAST_LOSSLESS_H_
+#include <stdint.h>
 #include <stdlib.h>
 
 #ifdef __cplusplus
@@ -19,6 +20,9 @@ typedef void(FJxlParallelRunner)(void* runner_opaque, void* opaque,
                                  void fun(void*, size_t), size_t count);
 
 // You may pass `nullptr` as a runner: encoding will be sequential.
+// `effort` controls the number of rows that are sampled to compute the
+// entropy codes; from effort 3, the samples are also used to choose the
+// predictor of each channel.
 size_t JxlFastLosslessEncode(const unsigned char* rgba, size_t width,
                              size_t row_stride, size_t height, size_t nb_chans,
                              size_t bitdepth, int big_endian, int effort,
@@ -38,10 +42,71 @@ JxlFastLosslessFrameState* JxlFastLosslessPrepareFrame(
     size_t nb_chans, size_t bitdepth, int big_endian, int effort,
     void* runner_opaque, FJxlParallelRunner runner);
 
-// Prepare the (image/frame) header. You may encode animations by concatenating
-// the output of multiple frames, of which the first one has add_image_header =
-// 1 and subsequent ones have add_image_header = 0, and all frames but the last
-// one have is_last = 0.
+// State kept across the frames of a live stream, such as a screen sharing
+// session or a camera feed, whose consecutive frames have similar statistics.
+// Frames prepared with JxlFastLosslessPrepareLiveFrame reuse the predictors and
+// prefix code samples taken from a previous frame with the same number of
+// channels and bit depth, instead of sampling their pixels and looking for a
+// palette, so that their cost only depends on their size. New samples are
+// taken after a palette frame, every 60 frames, and when a frame is coded with
+// 1/8 more bits per pixel than the frame of the samples.
+struct JxlFastLosslessLiveState;
+
+// Returned JxlFastLosslessLiveState must be freed by calling
+// JxlFastLosslessFreeLiveState.
+JxlFastLosslessLiveState* JxlFastLosslessCreateLiveState(void);
+
+void JxlFastLosslessFreeLiveState(JxlFastLosslessLiveState* live);
+
+// Same as JxlFastLosslessPrepareFrame, for the next frame of the stream of
+// `live`, which is updated with the statistics of the frame. A null `live`
+// prepares an independent frame.
+JxlFastLosslessFrameState* JxlFastLosslessPrepareLiveFrame(
+    JxlFastLosslessLiveState* live, const unsigned char* rgba, size_t width,
+    size_t row_stride, size_t height, size_t nb_chans, size_t bitdepth,
+    int big_endian, int effort, void* runner_opaque,
+    FJxlParallelRunner runner);
+
+// Streaming API, in which the image is provided as consecutive strips of rows.
+// Each strip is encoded as soon as it is added, so that only one strip of
+// pixels needs to be kept in memory. The prefix codes are computed from the
+// first strip, and palette is never used.
+//
+// Returned JxlFastLosslessFrameState must be freed by calling
+// JxlFastLosslessFreeFrameState.
+JxlFastLosslessFrameState* JxlFastLosslessPrepareStreamingFrame(
+    size_t width, size_t height, size_t nb_chans, size_t bitdepth,
+    int big_endian, int effort, void* runner_opaque, FJxlParallelRunner runner);
+
+// Encodes the next `num_rows` rows of a streaming frame, starting at `rgba`.
+// `num_rows` must be a multiple of 256 for all but the last strip, and all the
+// rows of the image must have been added before calling
+// JxlFastLosslessPrepareHeader.
+void JxlFastLosslessAddRows(JxlFastLosslessFrameState* frame,
+                            const unsigned char* rgba, size_t row_stride,
+                            size_t num_rows);
+
+// Makes the frame cover the rectangle of the image of size `image_width` x
+// `image_height` that starts at (`x0`, `y0`). If the frame does not cover the
+// whole image, it replaces that rectangle of the previous frame, which must
+// also have been encoded by this encoder. Must be called before
+// JxlFastLosslessPrepareHeader.
+void JxlFastLosslessSetFrameOrigin(JxlFastLosslessFrameState* frame,
+                                   size_t image_width, size_t image_height,
+                                   size_t x0, size_t y0);
+
+// Makes the frame an animation frame shown for `duration` ticks, with the given
+// timecode if `have_timecodes`. Only for codestreams whose image header is not
+// written by this encoder (add_image_header = 0), as it must signal the
+// animation. Must be called before JxlFastLosslessPrepareHeader.
+void JxlFastLosslessSetAnimationFrame(JxlFastLosslessFrameState* frame,
+                                      uint32_t duration, int have_timecodes,
+                                      uint32_t timecode);
+
+// Prepare the (image/frame) header. You may encode multiple frames by
+// concatenating the output of multiple frames, of which the first one has
+// add_image_header = 1 and subsequent ones have add_image_header = 0, and all
+// frames but the last one have is_last = 0.
 void JxlFastLosslessPrepareHeader(JxlFastLosslessFrameState* frame,
                                   int add_image_header, int is_last);
 
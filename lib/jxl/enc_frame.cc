@@ -267,6 +267,11 @@ Status LoopFilterFromParams(const CompressParams& cparams,
           }
         }
       }
+      // A single iteration keeps the decoder on the fused Gaborish and EPF
+      // stage.
+      if (cparams.decoding_speed_tier >= 1) {
+        loop_filter->epf_iters = std::min<size_t>(loop_filter->epf_iters, 1);
+      }
     }
   }
   // Strength of EPF in modular mode.
@@ -283,6 +288,21 @@ Status LoopFilterFromParams(const CompressParams& cparams,
   return true;
 }
 
+// Returns the largest group size shift, at most `shift`, that gives the
+// `xsize` x `ysize` frame at least `num_threads` groups to decode in parallel.
+// Groups are not made smaller than 128x128 because their local context and
+// their headers cost bits, and beyond that the gain in parallelism is small.
+size_t GroupSizeShiftForThreads(size_t xsize, size_t ysize, size_t shift,
+                                size_t num_threads) {
+  for (; shift > 0; --shift) {
+    const size_t group_dim = (kGroupDim >> 1) << shift;
+    if (DivCeil(xsize, group_dim) * DivCeil(ysize, group_dim) >= num_threads) {
+      break;
+    }
+  }
+  return shift;
+}
+
 Status MakeFrameHeader(const CompressParams& cparams,
                        const ProgressiveSplitter& progressive_splitter,
                        const FrameInfo& frame_info, const ImageBundle& ib,
@@ -299,6 +319,13 @@ Status MakeFrameHeader(const CompressParams& cparams,
   if (cparams.modular_mode) {
     frame_header->encoding = FrameEncoding::kModular;
     frame_header->group_size_shift = cparams.modular_group_size_shift;
+    if (cparams.decoder_threads > 1) {
+      const size_t resampling =
+          cparams.already_downsampled ? 1 : cparams.resampling;
+      frame_header->group_size_shift = GroupSizeShiftForThreads(
+          DivCeil(ib.xsize(), resampling), DivCeil(ib.ysize(), resampling),
+          frame_header->group_size_shift, cparams.decoder_threads);
+    }
   }
 
   frame_header->chroma_subsampling = ib.chroma_subsampling;
@@ -583,8 +610,12 @@ class LossyFrameEncoder {
                     const JxlCmsInterface& cms, ThreadPool* pool,
                     AuxOut* aux_out)
       : enc_state_(enc_state), cms_(cms), pool_(pool), aux_out_(aux_out) {
-    JXL_CHECK(InitializePassesSharedState(frame_header, &enc_state_->shared,
-                                          /*encoder=*/true));
+    // When requantizing, the shared state still holds the output of the
+    // heuristics.
+    if (!ReusesHeuristics()) {
+      JXL_CHECK(InitializePassesSharedState(frame_header, &enc_state_->shared,
+                                            /*encoder=*/true));
+    }
     enc_state_->cparams = cparams;
     enc_state_->passes.clear();
   }
@@ -634,50 +665,50 @@ class LossyFrameEncoder {
         enc_state_, modular_frame_encoder, linear, opsin, cms_, pool_,
         aux_out_));
 
-    JXL_RETURN_IF_ERROR(InitializePassesEncoder(
-        *opsin, cms, pool_, enc_state_, modular_frame_encoder, aux_out_));
-
-    enc_state_->passes.resize(enc_state_->progressive_splitter.GetNumPasses());
-    for (PassesEncoderState::PassData& pass : enc_state_->passes) {
-      pass.ac_tokens.resize(shared.frame_dim.num_groups);
+    FrameRequantization* requantization = enc_state_->requantization;
+    if (requantization != nullptr) {
+      requantization->opsin = CopyImage(*opsin);
+      requantization->quantizer = make_unique<Quantizer>(shared.quantizer);
+      for (size_t c = 0; c < 3; c++) {
+        requantization->inv_dc_quant[c] = shared.matrices.InvDCQuant(c);
+      }
+      requantization->raw_quant_field = CopyImage(shared.raw_quant_field);
+      requantization->num_special_frames = enc_state_->special_frames.size();
+      requantization->valid = true;
     }
 
-    ComputeAllCoeffOrders(shared.frame_dim);
-    shared.num_histograms = 1;
+    return ComputeQuantizedData(*opsin, cms, modular_frame_encoder,
+                                frame_header);
+  }
 
-    const auto tokenize_group_init = [&](const size_t num_threads) {
-      group_caches_.resize(num_threads);
-      return true;
-    };
-    const auto tokenize_group = [&](const uint32_t group_index,
-                                    const size_t thread) {
-      // Tokenize coefficients.
-      const Rect rect = shared.BlockGroupRect(group_index);
-      for (size_t idx_pass = 0; idx_pass < enc_state_->passes.size();
-           idx_pass++) {
-        JXL_ASSERT(enc_state_->coeffs[idx_pass]->Type() == ACType::k32);
-        const int32_t* JXL_RESTRICT ac_rows[3] = {
-            enc_state_->coeffs[idx_pass]->PlaneRow(0, group_index, 0).ptr32,
-            enc_state_->coeffs[idx_pass]->PlaneRow(1, group_index, 0).ptr32,
-            enc_state_->coeffs[idx_pass]->PlaneRow(2, group_index, 0).ptr32,
-        };
-        // Ensure group cache is initialized.
-        group_caches_[thread].InitOnce();
-        TokenizeCoefficients(
-            &shared.coeff_orders[idx_pass * shared.coeff_order_size], rect,
-            ac_rows, shared.ac_strategy, frame_header->chroma_subsampling,
-            &group_caches_[thread].num_nzeroes,
-            &enc_state_->passes[idx_pass].ac_tokens[group_index],
-            enc_state_->shared.quant_dc, enc_state_->shared.raw_quant_field,
-            enc_state_->shared.block_ctx_map);
-      }
-    };
-    JXL_RETURN_IF_ERROR(RunOnPool(pool_, 0, shared.frame_dim.num_groups,
-                                  tokenize_group_init, tokenize_group,
-                                  "TokenizeGroup"));
+  // Whether the output of the heuristics of a previous encoding of the frame
+  // is available, see RequantizeEncodingData.
+  bool ReusesHeuristics() const {
+    return enc_state_->requantization != nullptr &&
+           enc_state_->requantization->valid;
+  }
 
-    *frame_header = shared.frame_header;
-    return true;
+  // Same as ComputeEncodingData, but starts from the output of the heuristics
+  // of a previous encoding of the frame with the same parameters, except
+  // quant_ac_rescale.
+  Status RequantizeEncodingData(const JxlCmsInterface& cms,
+                                ModularFrameEncoder* modular_frame_encoder,
+                                FrameHeader* frame_header) {
+    PROFILER_ZONE("RequantizeEncodingData uninstrumented");
+    JXL_ASSERT(ReusesHeuristics());
+    const FrameRequantization& requantization = *enc_state_->requantization;
+    PassesSharedState& shared = enc_state_->shared;
+
+    // Undo the rescaling of InitializePassesEncoder and the adjustments of the
+    // quant field by ComputeCoefficients.
+    DequantMatricesSetCustomDC(&shared.matrices, requantization.inv_dc_quant);
+    shared.quantizer = *requantization.quantizer;
+    CopyImageTo(requantization.raw_quant_field, &shared.raw_quant_field);
+    // The DC frame, if any, is written again by InitializePassesEncoder.
+    enc_state_->special_frames.resize(requantization.num_special_frames);
+
+    return ComputeQuantizedData(requantization.opsin, cms,
+                                modular_frame_encoder, frame_header);
   }
 
   Status ComputeJPEGTranscodingData(const jpeg::JPEGData& jpeg_data,
@@ -1028,6 +1059,7 @@ class LossyFrameEncoder {
     JXL_RETURN_IF_ERROR(RunOnPool(pool_, 0, shared.frame_dim.num_groups,
                                   tokenize_group_init, tokenize_group,
                                   "TokenizeGroup"));
+    ReleaseCoefficients();
     *frame_header = shared.frame_header;
     doing_jpeg_recompression = true;
     return true;
@@ -1061,39 +1093,67 @@ class LossyFrameEncoder {
       allotment.ReclaimAndCharge(writer, kLayerAC, aux_out_);
     }
 
-    for (size_t i = 0; i < enc_state_->progressive_splitter.GetNumPasses();
-         i++) {
-      // Encode coefficient orders.
-      size_t order_bits = 0;
-      JXL_RETURN_IF_ERROR(U32Coder::CanEncode(
-          kOrderEnc, enc_state_->used_orders[i], &order_bits));
-      BitWriter::Allotment allotment(writer, order_bits);
-      JXL_CHECK(U32Coder::Write(kOrderEnc, enc_state_->used_orders[i], writer));
-      allotment.ReclaimAndCharge(writer, kLayerOrder, aux_out_);
-      EncodeCoeffOrders(
-          enc_state_->used_orders[i],
-          &enc_state_->shared
-               .coeff_orders[i * enc_state_->shared.coeff_order_size],
-          writer, kLayerOrder, aux_out_);
-
-      // Encode histograms.
-      HistogramParams hist_params(
-          enc_state_->cparams.speed_tier,
-          enc_state_->shared.block_ctx_map.NumACContexts());
-      if (enc_state_->cparams.speed_tier > SpeedTier::kTortoise) {
-        hist_params.lz77_method = HistogramParams::LZ77Method::kNone;
-      }
-      if (enc_state_->cparams.decoding_speed_tier >= 1) {
-        hist_params.max_histograms = 6;
+    const size_t num_passes = enc_state_->progressive_splitter.GetNumPasses();
+    if (num_passes == 1) {
+      return EncodePassACInfo(0, writer, aux_out_, pool_);
+    }
+    // The passes of progressive frames are independent: build their
+    // histograms in parallel and concatenate them in pass order.
+    std::vector<BitWriter> pass_writers(num_passes);
+    std::vector<AuxOut> pass_aux_outs(aux_out_ != nullptr ? num_passes : 0);
+    std::atomic<int> num_errors{0};
+    const auto encode_pass = [&](const uint32_t i, size_t /* thread */) {
+      AuxOut* pass_aux_out = aux_out_ != nullptr ? &pass_aux_outs[i] : nullptr;
+      if (!EncodePassACInfo(i, &pass_writers[i], pass_aux_out,
+                            /*pool=*/nullptr)) {
+        num_errors.fetch_add(1, std::memory_order_relaxed);
       }
-      BuildAndEncodeHistograms(
-          hist_params,
-          enc_state_->shared.num_histograms *
-              enc_state_->shared.block_ctx_map.NumACContexts(),
-          enc_state_->passes[i].ac_tokens, &enc_state_->passes[i].codes,
-          &enc_state_->passes[i].context_map, writer, kLayerAC, aux_out_);
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool_, 0, num_passes, ThreadPool::NoInit,
+                                  encode_pass, "EncodePassACInfo"));
+    JXL_RETURN_IF_ERROR(num_errors.load(std::memory_order_relaxed) == 0);
+    for (size_t i = 0; i < num_passes; i++) {
+      writer->AppendUnaligned(pass_writers[i]);
+      if (aux_out_ != nullptr) aux_out_->Assimilate(pass_aux_outs[i]);
     }
+    return true;
+  }
 
+  // Writes the coefficient orders and histograms of one pass.
+  Status EncodePassACInfo(size_t i, BitWriter* writer, AuxOut* aux_out,
+                          ThreadPool* pool) {
+    // Encode coefficient orders.
+    size_t order_bits = 0;
+    JXL_RETURN_IF_ERROR(U32Coder::CanEncode(
+        kOrderEnc, enc_state_->used_orders[i], &order_bits));
+    BitWriter::Allotment allotment(writer, order_bits);
+    JXL_CHECK(U32Coder::Write(kOrderEnc, enc_state_->used_orders[i], writer));
+    allotment.ReclaimAndCharge(writer, kLayerOrder, aux_out);
+    EncodeCoeffOrders(
+        enc_state_->used_orders[i],
+        &enc_state_->shared
+             .coeff_orders[i * enc_state_->shared.coeff_order_size],
+        writer, kLayerOrder, aux_out);
+
+    // Encode histograms.
+    HistogramParams hist_params(
+        enc_state_->cparams.speed_tier,
+        enc_state_->shared.block_ctx_map.NumACContexts());
+    if (enc_state_->cparams.speed_tier > SpeedTier::kTortoise) {
+      hist_params.lz77_method = HistogramParams::LZ77Method::kNone;
+    }
+    if (enc_state_->cparams.decoding_speed_tier >= 1) {
+      hist_params.max_histograms = 6;
+    }
+    if (enc_state_->cparams.decoding_speed_tier >= 3) {
+      hist_params.force_huffman = true;
+    }
+    BuildAndEncodeHistograms(
+        hist_params,
+        enc_state_->shared.num_histograms *
+            enc_state_->shared.block_ctx_map.NumACContexts(),
+        enc_state_->passes[i].ac_tokens, &enc_state_->passes[i].codes,
+        &enc_state_->passes[i].context_map, writer, kLayerAC, aux_out, pool);
     return true;
   }
 
@@ -1107,6 +1167,71 @@ class LossyFrameEncoder {
   PassesEncoderState* State() { return enc_state_; }
 
  private:
+  // Computes and tokenizes the coefficients from the output of the heuristics.
+  Status ComputeQuantizedData(const Image3F& opsin, const JxlCmsInterface& cms,
+                              ModularFrameEncoder* modular_frame_encoder,
+                              FrameHeader* frame_header) {
+    PassesSharedState& shared = enc_state_->shared;
+
+    JXL_RETURN_IF_ERROR(InitializePassesEncoder(
+        opsin, cms, pool_, enc_state_, modular_frame_encoder, aux_out_));
+
+    enc_state_->passes.resize(enc_state_->progressive_splitter.GetNumPasses());
+    for (PassesEncoderState::PassData& pass : enc_state_->passes) {
+      pass.ac_tokens.resize(shared.frame_dim.num_groups);
+    }
+
+    ComputeAllCoeffOrders(shared.frame_dim);
+    shared.num_histograms = 1;
+
+    const auto tokenize_group_init = [&](const size_t num_threads) {
+      group_caches_.resize(num_threads);
+      return true;
+    };
+    const auto tokenize_group = [&](const uint32_t group_index,
+                                    const size_t thread) {
+      if (ProgressAborted(enc_state_->progress)) return;
+      // Tokenize coefficients.
+      const Rect rect = shared.BlockGroupRect(group_index);
+      for (size_t idx_pass = 0; idx_pass < enc_state_->passes.size();
+           idx_pass++) {
+        JXL_ASSERT(enc_state_->coeffs[idx_pass]->Type() == ACType::k32);
+        const int32_t* JXL_RESTRICT ac_rows[3] = {
+            enc_state_->coeffs[idx_pass]->PlaneRow(0, group_index, 0).ptr32,
+            enc_state_->coeffs[idx_pass]->PlaneRow(1, group_index, 0).ptr32,
+            enc_state_->coeffs[idx_pass]->PlaneRow(2, group_index, 0).ptr32,
+        };
+        // Ensure group cache is initialized.
+        group_caches_[thread].InitOnce();
+        TokenizeCoefficients(
+            &shared.coeff_orders[idx_pass * shared.coeff_order_size], rect,
+            ac_rows, shared.ac_strategy, frame_header->chroma_subsampling,
+            &group_caches_[thread].num_nzeroes,
+            &enc_state_->passes[idx_pass].ac_tokens[group_index],
+            enc_state_->shared.quant_dc, enc_state_->shared.raw_quant_field,
+            enc_state_->shared.block_ctx_map);
+      }
+      ProgressTaskDone(enc_state_->progress);
+    };
+    BeginProgressTasks(enc_state_->progress, EncoderPhase::kTokenization,
+                       shared.frame_dim.num_groups);
+    JXL_RETURN_IF_ERROR(RunOnPool(pool_, 0, shared.frame_dim.num_groups,
+                                  tokenize_group_init, tokenize_group,
+                                  "TokenizeGroup"));
+    JXL_RETURN_IF_ERROR(
+        ReportProgress(enc_state_->progress, EncoderPhase::kTokenization));
+    ReleaseCoefficients();
+
+    *frame_header = shared.frame_header;
+    return true;
+  }
+
+  // The coefficients, 12 bytes per pixel and pass, are only read by the
+  // coefficient orders and the tokenization; freeing them once all groups are
+  // tokenized lowers the peak memory of the modular encoding and the writing of
+  // the groups that follow. The next frame allocates them again.
+  void ReleaseCoefficients() { enc_state_->coeffs.clear(); }
+
   void ComputeAllCoeffOrders(const FrameDimensions& frame_dim) {
     PROFILER_FUNC;
     // No coefficient reordering in Falcon or faster.
@@ -1122,7 +1247,7 @@ class LossyFrameEncoder {
       ComputeCoeffOrder(
           enc_state_->cparams.speed_tier, *enc_state_->coeffs[i],
           enc_state_->shared.ac_strategy, frame_dim, enc_state_->used_orders[i],
-          used_orders_info.first,
+          used_orders_info.first, pool_,
           &enc_state_->shared
                .coeff_orders[i * enc_state_->shared.coeff_order_size]);
     }
@@ -1184,11 +1309,79 @@ Status ParamsPostInit(CompressParams* p) {
   return true;
 }
 
+namespace {
+
+// Encodes the frame with the largest AC quantization rescale for which it fits
+// in cparams.target_size bytes, or with the smallest rescale of the search if
+// it never fits. The heuristics only run for the first encoding of the frame,
+// the next ones only quantize and entropy code it again.
+Status EncodeFrameToTargetSize(const CompressParams& cparams_orig,
+                               const FrameInfo& frame_info,
+                               const CodecMetadata* metadata,
+                               const ImageBundle& ib,
+                               PassesEncoderState* passes_enc_state,
+                               const JxlCmsInterface& cms, ThreadPool* pool,
+                               BitWriter* writer, AuxOut* aux_out) {
+  // Bounds of the search, they keep the global scale of the quantizer in the
+  // range that the heuristics produce.
+  constexpr float kMinRescale = 1.0f / 32;
+  constexpr float kMaxRescale = 4.0f;
+  constexpr size_t kMaxSteps = 12;
+  const size_t target_bits = cparams_orig.target_size * kBitsPerByte;
+
+  CompressParams cparams = cparams_orig;
+  cparams.target_size = 0;
+  FrameRequantization requantization;
+  passes_enc_state->requantization = &requantization;
+
+  float low = kMinRescale;
+  float high = kMaxRescale;
+  float rescale = 1.0f;
+  float best_rescale = kMinRescale;
+  size_t best_bits = 0;
+  Status status = true;
+  for (size_t i = 0; i < kMaxSteps; i++) {
+    cparams.quant_ac_rescale = cparams_orig.quant_ac_rescale * rescale;
+    BitWriter trial_writer;
+    status = EncodeFrame(cparams, frame_info, metadata, ib, passes_enc_state,
+                         cms, pool, &trial_writer, /*aux_out=*/nullptr);
+    if (!status) break;
+    const size_t bits = trial_writer.BitsWritten();
+    if (bits <= target_bits) {
+      if (bits > best_bits) {
+        best_bits = bits;
+        best_rescale = rescale;
+      }
+      low = rescale;
+      // Close enough, another step would gain less than 1%.
+      if (bits >= target_bits - target_bits / 100) break;
+    } else {
+      high = rescale;
+    }
+    if (high < low * 1.01f) break;
+    rescale = std::sqrt(low * high);
+  }
+  if (status) {
+    cparams.quant_ac_rescale = cparams_orig.quant_ac_rescale * best_rescale;
+    status = EncodeFrame(cparams, frame_info, metadata, ib, passes_enc_state,
+                         cms, pool, writer, aux_out);
+  }
+  passes_enc_state->requantization = nullptr;
+  if (status && aux_out) {
+    aux_out->min_quant_rescale = best_rescale;
+    aux_out->max_quant_rescale = best_rescale;
+  }
+  return status;
+}
+
+}  // namespace
+
 Status EncodeFrame(const CompressParams& cparams_orig,
                    const FrameInfo& frame_info, const CodecMetadata* metadata,
                    const ImageBundle& ib, PassesEncoderState* passes_enc_state,
                    const JxlCmsInterface& cms, ThreadPool* pool,
                    BitWriter* writer, AuxOut* aux_out) {
+  CacheAligned::ScopedHugePages huge_pages(cparams_orig.huge_pages);
   CompressParams cparams = cparams_orig;
   if (cparams.speed_tier == SpeedTier::kGlacier && !cparams.IsLossless()) {
     cparams.speed_tier = SpeedTier::kTortoise;
@@ -1243,8 +1436,10 @@ Status EncodeFrame(const CompressParams& cparams_orig,
         [&](size_t task, size_t) {
           BitWriter w;
           PassesEncoderState state;
+          // The tasks run concurrently, so they can't share aux_out. The
+          // statistics of the chosen parameters are gathered below.
           if (!EncodeFrame(all_params[task], frame_info, metadata, ib, &state,
-                           cms, nullptr, &w, aux_out)) {
+                           cms, nullptr, &w, /*aux_out=*/nullptr)) {
             num_errors.fetch_add(1, std::memory_order_relaxed);
             return;
           }
@@ -1308,9 +1503,20 @@ Status EncodeFrame(const CompressParams& cparams_orig,
     }
     cparams.quant_ac_rescale = best_rescale;
   }
+  if (cparams_orig.target_size > 0 &&
+      frame_info.frame_type == FrameType::kRegularFrame && !ib.IsJPEG() &&
+      !cparams.modular_mode && !cparams.max_error_mode) {
+    return EncodeFrameToTargetSize(cparams, frame_info, metadata, ib,
+                                   passes_enc_state, cms, pool, writer,
+                                   aux_out);
+  }
   ib.VerifyMetadata();
 
-  passes_enc_state->special_frames.clear();
+  const bool reuse_heuristics = passes_enc_state->requantization != nullptr &&
+                                passes_enc_state->requantization->valid;
+  if (!reuse_heuristics) {
+    passes_enc_state->special_frames.clear();
+  }
 
   if (cparams.qprogressive_mode) {
     passes_enc_state->progressive_splitter.SetProgressiveMode(
@@ -1389,6 +1595,7 @@ Status EncodeFrame(const CompressParams& cparams_orig,
 
   Image3F opsin;
   const ColorEncoding& c_linear = ColorEncoding::LinearSRGB(ib.IsGray());
+  FrameColorCache* color_cache = passes_enc_state->color_cache;
   std::unique_ptr<ImageMetadata> metadata_linear =
       jxl::make_unique<ImageMetadata>();
   metadata_linear->xyb_encoded =
@@ -1428,28 +1635,44 @@ Status EncodeFrame(const CompressParams& cparams_orig,
 
   const std::vector<ImageF>* extra_channels = &ib.extra_channels();
   std::vector<ImageF> extra_channels_storage;
-  // Clear patches
-  passes_enc_state->shared.image_features.patches = PatchDictionary();
-  passes_enc_state->shared.image_features.patches.SetPassesSharedState(
-      &passes_enc_state->shared);
+  if (!reuse_heuristics) {
+    // Clear patches
+    passes_enc_state->shared.image_features.patches = PatchDictionary();
+    passes_enc_state->shared.image_features.patches.SetPassesSharedState(
+        &passes_enc_state->shared);
+  }
 
   if (ib.IsJPEG()) {
     JXL_RETURN_IF_ERROR(lossy_frame_encoder.ComputeJPEGTranscodingData(
         *ib.jpeg_data, modular_frame_encoder.get(), frame_header.get()));
+  } else if (reuse_heuristics &&
+             frame_header->encoding == FrameEncoding::kVarDCT) {
+    JXL_RETURN_IF_ERROR(lossy_frame_encoder.RequantizeEncodingData(
+        cms, modular_frame_encoder.get(), frame_header.get()));
   } else if (!lossy_frame_encoder.State()->heuristics->HandlesColorConversion(
                  cparams, ib) ||
-             frame_header->encoding != FrameEncoding::kVarDCT) {
+             frame_header->encoding != FrameEncoding::kVarDCT ||
+             color_cache != nullptr) {
     // Allocating a large enough image avoids a copy when padding.
     opsin =
         Image3F(RoundUpToBlockDim(ib.xsize()), RoundUpToBlockDim(ib.ysize()));
+    if (cparams.huge_pages) {
+      JXL_RETURN_IF_ERROR(PrefaultImage(pool, &opsin));
+    }
     opsin.ShrinkTo(ib.xsize(), ib.ysize());
 
     const bool want_linear = frame_header->encoding == FrameEncoding::kVarDCT &&
                              cparams.speed_tier <= SpeedTier::kKitten;
     const ImageBundle* JXL_RESTRICT ib_or_linear = &ib;
 
-    if (frame_header->color_transform == ColorTransform::kXYB &&
-        frame_info.ib_needs_color_transform) {
+    if (color_cache != nullptr && color_cache->valid) {
+      CopyImageTo(color_cache->opsin, &opsin);
+      if (color_cache->has_linear) {
+        linear_storage = color_cache->linear.Copy();
+        ib_or_linear = &linear_storage;
+      }
+    } else if (frame_header->color_transform == ColorTransform::kXYB &&
+               frame_info.ib_needs_color_transform) {
       // linear_storage would only be used by the Butteraugli loop (passing
       // linear sRGB avoids a color conversion there). Otherwise, don't
       // fill it to reduce memory usage.
@@ -1462,6 +1685,16 @@ Status EncodeFrame(const CompressParams& cparams_orig,
               // input is already in XYB.
       CopyImageTo(ib.color(), &opsin);
     }
+    if (color_cache != nullptr && !color_cache->valid) {
+      color_cache->opsin = CopyImage(opsin);
+      color_cache->has_linear = ib_or_linear != &ib;
+      if (color_cache->has_linear) {
+        color_cache->linear = ib_or_linear->Copy();
+        // linear_storage, and so its copy, refers to metadata_linear.
+        color_cache->linear_metadata = std::move(metadata_linear);
+      }
+      color_cache->valid = true;
+    }
     bool lossless = cparams.IsLossless();
     if (ib.HasAlpha() && !ib.AlphaIsPremultiplied() &&
         frame_header->frame_type == FrameType::kRegularFrame &&
@@ -1478,6 +1711,8 @@ Status EncodeFrame(const CompressParams& cparams_orig,
       JXL_RETURN_IF_ERROR(
           aux_out->InspectImage3F("enc_frame:OpsinDynamicsImage", opsin));
     }
+    JXL_RETURN_IF_ERROR(ReportProgress(passes_enc_state->progress,
+                                       EncoderPhase::kColorTransform));
     if (frame_header->encoding == FrameEncoding::kVarDCT) {
       PadImageToBlockMultipleInPlace(&opsin);
       JXL_RETURN_IF_ERROR(lossy_frame_encoder.ComputeEncodingData(
@@ -1505,6 +1740,8 @@ Status EncodeFrame(const CompressParams& cparams_orig,
       *frame_header, *ib.metadata(), &opsin, *extra_channels,
       lossy_frame_encoder.State(), cms, pool, aux_out,
       /* do_color=*/frame_header->encoding == FrameEncoding::kModular));
+  JXL_RETURN_IF_ERROR(
+      ReportProgress(passes_enc_state->progress, EncoderPhase::kModular));
 
   writer->AppendByteAligned(lossy_frame_encoder.State()->special_frames);
   frame_header->UpdateFlag(
@@ -1534,6 +1771,14 @@ Status EncodeFrame(const CompressParams& cparams_orig,
                                    frame_dim.num_dc_groups, has_ac_global));
   };
 
+  if (aux_out != nullptr) {
+    const ImageFeatures& features =
+        lossy_frame_encoder.State()->shared.image_features;
+    aux_out->num_patches += features.patches.NumPatches();
+    aux_out->num_splines += features.splines.QuantizedSplines().size();
+    aux_out->num_passes += num_passes;
+  }
+
   if (frame_header->flags & FrameHeader::kPatches) {
     PatchDictionaryEncoder::Encode(
         lossy_frame_encoder.State()->shared.image_features.patches,
@@ -1568,7 +1813,7 @@ Status EncodeFrame(const CompressParams& cparams_orig,
         lossy_frame_encoder.EncodeGlobalDCInfo(*frame_header, get_output(0)));
   }
   JXL_RETURN_IF_ERROR(
-      modular_frame_encoder->EncodeGlobalInfo(get_output(0), aux_out));
+      modular_frame_encoder->EncodeGlobalInfo(get_output(0), aux_out, pool));
   JXL_RETURN_IF_ERROR(modular_frame_encoder->EncodeStream(
       get_output(0), aux_out, kLayerModularGlobal, ModularStreamId::Global()));
 
@@ -1611,10 +1856,16 @@ Status EncodeFrame(const CompressParams& cparams_orig,
     JXL_RETURN_IF_ERROR(lossy_frame_encoder.EncodeGlobalACInfo(
         get_output(global_ac_index), modular_frame_encoder.get()));
   }
+  JXL_RETURN_IF_ERROR(
+      ReportProgress(passes_enc_state->progress, EncoderPhase::kHistograms));
 
   std::atomic<int> num_errors{0};
   const auto process_group = [&](const uint32_t group_index,
                                  const size_t thread) {
+    if (ProgressAborted(passes_enc_state->progress)) {
+      num_errors.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
     AuxOut* my_aux_out = aux_out ? &aux_outs[thread] : nullptr;
 
     for (size_t i = 0; i < num_passes; i++) {
@@ -1633,12 +1884,17 @@ Status EncodeFrame(const CompressParams& cparams_orig,
         return;
       }
     }
+    ProgressTaskDone(passes_enc_state->progress);
   };
+  BeginProgressTasks(passes_enc_state->progress, EncoderPhase::kGroups,
+                     num_groups);
   JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_groups, resize_aux_outs,
                                 process_group, "EncodeGroupCoefficients"));
 
   // Resizing aux_outs to 0 also Assimilates the array.
   static_cast<void>(resize_aux_outs(0));
+  JXL_RETURN_IF_ERROR(
+      ReportProgress(passes_enc_state->progress, EncoderPhase::kGroups));
   JXL_RETURN_IF_ERROR(num_errors.load(std::memory_order_relaxed) == 0);
 
   for (BitWriter& bw : group_codes) {
@@ -1725,7 +1981,7 @@ Status EncodeFrame(const CompressParams& cparams_orig,
 
   JXL_RETURN_IF_ERROR(
       WriteGroupOffsets(group_codes, permutation_ptr, writer, aux_out));
-  writer->AppendByteAligned(group_codes);
+  writer->AppendByteAligned(std::move(group_codes));
 
   return true;
 }
@@ -698,6 +698,67 @@ void DownsampleImage2_Iterative(Image3F* opsin) {
   }
   *opsin = std::move(downsampled);
 }
+
+// Largest difference of the input of a tile from the previous frame for which
+// the heuristics of the previous frame are reused for the tile. This is below
+// the quantization step of 8-bit inputs, so only static content is reused.
+constexpr float kTemporalReuseMaxDiff = 1e-3f;
+
+// Returns whether the pixels of the tile `block_rect` differ by at most
+// kTemporalReuseMaxDiff from the previous frame.
+bool TileUnchanged(const Image3F& opsin, const Image3F& prev,
+                   const Rect& block_rect) {
+  const Rect rect(block_rect.x0() * kBlockDim, block_rect.y0() * kBlockDim,
+                  block_rect.xsize() * kBlockDim,
+                  block_rect.ysize() * kBlockDim, opsin.xsize(),
+                  opsin.ysize());
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t y = 0; y < rect.ysize(); y++) {
+      const float* JXL_RESTRICT row = rect.ConstPlaneRow(opsin, c, y);
+      const float* JXL_RESTRICT row_prev = rect.ConstPlaneRow(prev, c, y);
+      float max_diff = 0.0f;
+      for (size_t x = 0; x < rect.xsize(); x++) {
+        max_diff = std::max(max_diff, std::abs(row[x] - row_prev[x]));
+      }
+      if (max_diff > kTemporalReuseMaxDiff) return false;
+    }
+  }
+  return true;
+}
+
+// Copies the transforms starting in `rect` of `from` to `to`.
+void CopyAcStrategy(const AcStrategyImage& from, const Rect& rect,
+                    AcStrategyImage* JXL_RESTRICT to) {
+  for (size_t y = 0; y < rect.ysize(); y++) {
+    AcStrategyRow row = from.ConstRow(rect, y);
+    for (size_t x = 0; x < rect.xsize(); x++) {
+      AcStrategy acs = row[x];
+      if (!acs.IsFirstBlock()) continue;
+      to->Set(rect.x0() + x, rect.y0() + y, acs.Strategy());
+    }
+  }
+}
+
+// Stores the heuristics output of the tiles that were not reused as the output
+// for the next frame.
+void UpdateTemporalCache(const PassesEncoderState& enc_state,
+                         const CfLHeuristics& cfl_heuristics,
+                         FrameTemporalCache* JXL_RESTRICT cache) {
+  const PassesSharedState& shared = enc_state.shared;
+  const FrameDimensions& frame_dim = shared.frame_dim;
+  cache->butteraugli_distance = enc_state.cparams.butteraugli_distance;
+  cache->ac_strategy =
+      AcStrategyImage(frame_dim.xsize_blocks, frame_dim.ysize_blocks);
+  CopyAcStrategy(shared.ac_strategy, Rect(shared.ac_strategy),
+                 &cache->ac_strategy);
+  cache->quant_field = CopyImage(enc_state.initial_quant_field);
+  cache->epf_sharpness = CopyImage(shared.epf_sharpness);
+  cache->ytox_map = CopyImage(shared.cmap.ytox_map);
+  cache->ytob_map = CopyImage(shared.cmap.ytob_map);
+  cache->cfl_dc_values = CopyImage(cfl_heuristics.dc_values);
+  cache->valid = true;
+}
+
 }  // namespace
 
 Status DefaultEncoderHeuristics::LossyFrameHeuristics(
@@ -735,7 +796,7 @@ Status DefaultEncoderHeuristics::LossyFrameHeuristics(
         quality_coef = kNoiseRampupStart;
       }
       if (!GetNoiseParameter(*opsin, &shared.image_features.noise_params,
-                             quality_coef)) {
+                             quality_coef, pool)) {
         shared.frame_header.flags &= ~FrameHeader::kNoise;
       }
     }
@@ -850,7 +911,51 @@ Status DefaultEncoderHeuristics::LossyFrameHeuristics(
     quantizer.SetQuantField(quant_dc, enc_state->initial_quant_field, nullptr);
   }
 
-  // TODO(veluca): do something about animations.
+  // Tiles whose input did not change since the previous frame of an animation
+  // take the heuristics output of that frame instead of recomputing it.
+  const size_t xsize_tiles =
+      DivCeil(shared.frame_dim.xsize_blocks, kEncTileDimInBlocks);
+  const size_t num_tiles =
+      xsize_tiles * DivCeil(shared.frame_dim.ysize_blocks, kEncTileDimInBlocks);
+  const auto tile_rect = [&](size_t tid) {
+    size_t tx = tid % xsize_tiles;
+    size_t ty = tid / xsize_tiles;
+    size_t by0 = ty * kEncTileDimInBlocks;
+    size_t by1 = std::min((ty + 1) * kEncTileDimInBlocks,
+                          shared.frame_dim.ysize_blocks);
+    size_t bx0 = tx * kEncTileDimInBlocks;
+    size_t bx1 = std::min((tx + 1) * kEncTileDimInBlocks,
+                          shared.frame_dim.xsize_blocks);
+    return Rect(bx0, by0, bx1 - bx0, by1 - by0);
+  };
+  FrameTemporalCache* temporal_cache = enc_state->temporal_cache;
+  std::vector<uint8_t> reuse_tile(num_tiles, 0);
+  if (temporal_cache != nullptr) {
+    const bool cache_usable =
+        temporal_cache->valid && SameSize(temporal_cache->opsin, *opsin) &&
+        temporal_cache->butteraugli_distance == cparams.butteraugli_distance &&
+        temporal_cache->ac_strategy.xsize() == shared.frame_dim.xsize_blocks &&
+        temporal_cache->ac_strategy.ysize() == shared.frame_dim.ysize_blocks;
+    if (!cache_usable) {
+      temporal_cache->valid = false;
+      temporal_cache->opsin = CopyImage(*opsin);
+    } else {
+      JXL_RETURN_IF_ERROR(RunOnPool(
+          pool, 0, num_tiles, ThreadPool::NoInit,
+          [&](const uint32_t tid, size_t /* thread */) {
+            const Rect r = tile_rect(tid);
+            reuse_tile[tid] = TileUnchanged(*opsin, temporal_cache->opsin, r);
+            if (reuse_tile[tid]) return;
+            // The analysis of this tile is done again, on the new input.
+            const Rect pixel_rect(r.x0() * kBlockDim, r.y0() * kBlockDim,
+                                  r.xsize() * kBlockDim, r.ysize() * kBlockDim,
+                                  opsin->xsize(), opsin->ysize());
+            CopyImageTo(pixel_rect, *opsin, pixel_rect,
+                        &temporal_cache->opsin);
+          },
+          "TemporalReuse"));
+    }
+  }
 
   // Apply inverse-gaborish.
   if (shared.frame_header.loop_filter.gab) {
@@ -868,19 +973,34 @@ Status DefaultEncoderHeuristics::LossyFrameHeuristics(
 
   cfl_heuristics.Init(*opsin);
   acs_heuristics.Init(*opsin, enc_state);
+  if (temporal_cache != nullptr && temporal_cache->valid &&
+      SameSize(temporal_cache->cfl_dc_values, cfl_heuristics.dc_values)) {
+    // Reused tiles don't compute their DC values for ComputeDC.
+    CopyImageTo(temporal_cache->cfl_dc_values, &cfl_heuristics.dc_values);
+  }
 
   auto process_tile = [&](const uint32_t tid, const size_t thread) {
-    size_t n_enc_tiles =
-        DivCeil(enc_state->shared.frame_dim.xsize_blocks, kEncTileDimInBlocks);
-    size_t tx = tid % n_enc_tiles;
-    size_t ty = tid / n_enc_tiles;
-    size_t by0 = ty * kEncTileDimInBlocks;
-    size_t by1 = std::min((ty + 1) * kEncTileDimInBlocks,
-                          enc_state->shared.frame_dim.ysize_blocks);
-    size_t bx0 = tx * kEncTileDimInBlocks;
-    size_t bx1 = std::min((tx + 1) * kEncTileDimInBlocks,
-                          enc_state->shared.frame_dim.xsize_blocks);
-    Rect r(bx0, by0, bx1 - bx0, by1 - by0);
+    if (ProgressAborted(enc_state->progress)) return;
+    const Rect r = tile_rect(tid);
+
+    if (reuse_tile[tid]) {
+      CopyAcStrategy(temporal_cache->ac_strategy, r,
+                     &enc_state->shared.ac_strategy);
+      CopyImageTo(r, temporal_cache->epf_sharpness, r,
+                  &enc_state->shared.epf_sharpness);
+      CopyImageTo(r, temporal_cache->quant_field, r,
+                  &enc_state->initial_quant_field);
+      quantizer.SetQuantFieldRect(enc_state->initial_quant_field, r,
+                                  &enc_state->shared.raw_quant_field);
+      const size_t tx = r.x0() / kColorTileDimInBlocks;
+      const size_t ty = r.y0() / kColorTileDimInBlocks;
+      enc_state->shared.cmap.ytox_map.Row(ty)[tx] =
+          temporal_cache->ytox_map.ConstRow(ty)[tx];
+      enc_state->shared.cmap.ytob_map.Row(ty)[tx] =
+          temporal_cache->ytob_map.ConstRow(ty)[tx];
+      ProgressTaskDone(enc_state->progress);
+      return;
+    }
 
     // For speeds up to Wombat, we only compute the color correlation map
     // once we know the transform type and the quantization map.
@@ -916,27 +1036,33 @@ Status DefaultEncoderHeuristics::LossyFrameHeuristics(
           /*fast=*/cparams.speed_tier >= SpeedTier::kWombat, thread,
           &enc_state->shared.cmap);
     }
+    ProgressTaskDone(enc_state->progress);
   };
+  BeginProgressTasks(enc_state->progress, EncoderPhase::kAcStrategy, num_tiles);
   JXL_RETURN_IF_ERROR(RunOnPool(
-      pool, 0,
-      DivCeil(enc_state->shared.frame_dim.xsize_blocks, kEncTileDimInBlocks) *
-          DivCeil(enc_state->shared.frame_dim.ysize_blocks,
-                  kEncTileDimInBlocks),
+      pool, 0, num_tiles,
       [&](const size_t num_threads) {
         ar_heuristics.PrepareForThreads(num_threads);
         cfl_heuristics.PrepareForThreads(num_threads);
         return true;
       },
       process_tile, "Enc Heuristics"));
+  JXL_RETURN_IF_ERROR(
+      ReportProgress(enc_state->progress, EncoderPhase::kAcStrategy));
 
   acs_heuristics.Finalize(aux_out);
   if (cparams.speed_tier <= SpeedTier::kHare) {
     cfl_heuristics.ComputeDC(/*fast=*/cparams.speed_tier >= SpeedTier::kWombat,
-                             &enc_state->shared.cmap);
+                             pool, &enc_state->shared.cmap);
+  }
+  if (temporal_cache != nullptr) {
+    UpdateTemporalCache(*enc_state, cfl_heuristics, temporal_cache);
   }
 
   // Refine quantization levels.
   FindBestQuantizer(original_pixels, *opsin, enc_state, cms, pool, aux_out);
+  JXL_RETURN_IF_ERROR(
+      ReportProgress(enc_state->progress, EncoderPhase::kQuantization));
 
   // Choose a context model that depends on the amount of quantization for AC.
   if (cparams.speed_tier < SpeedTier::kFalcon) {
@@ -37,7 +37,9 @@
 #include "lib/jxl/modular/encoding/ma_common.h"
 #include "lib/jxl/modular/modular_image.h"
 #include "lib/jxl/modular/options.h"
+#include "lib/jxl/modular/transform/enc_rct.h"
 #include "lib/jxl/modular/transform/enc_transform.h"
+#include "lib/jxl/modular/transform/transform.h"  // CheckEqualChannels
 #include "lib/jxl/toc.h"
 
 namespace jxl {
@@ -988,6 +990,9 @@ Status ModularFrameEncoder::PrepareEncoding(const FrameHeader& frame_header,
   stream_headers_.resize(num_streams);
   tokens_.resize(num_streams);
 
+  // Each stream learns and writes its own tree in EncodeStream.
+  if (cparams_.modular_local_trees) return true;
+
   if (heuristics->CustomFixedTreeLossless(frame_dim_, &tree_)) {
     // Using a fixed tree.
   } else if (cparams_.speed_tier < SpeedTier::kFalcon ||
@@ -1013,8 +1018,12 @@ Status ModularFrameEncoder::PrepareEncoding(const FrameHeader& frame_header,
     std::atomic_flag invalid_force_wp = ATOMIC_FLAG_INIT;
 
     std::vector<Tree> trees(useful_splits.size() - 1);
+    // With a single tree to learn, parallelize sample gathering and the
+    // learning itself instead, as tasks cannot be nested on the same pool.
+    ThreadPool* chunk_pool = trees.size() == 1 ? nullptr : pool;
+    ThreadPool* learn_pool = trees.size() == 1 ? pool : nullptr;
     JXL_RETURN_IF_ERROR(RunOnPool(
-        pool, 0, useful_splits.size() - 1, ThreadPool::NoInit,
+        chunk_pool, 0, useful_splits.size() - 1, ThreadPool::NoInit,
         [&](const uint32_t chunk, size_t /* thread */) {
           // TODO(veluca): parallelize more.
           size_t total_pixels = 0;
@@ -1046,6 +1055,8 @@ Status ModularFrameEncoder::PrepareEncoding(const FrameHeader& frame_header,
             invalid_force_wp.test_and_set(std::memory_order_acq_rel);
             return;
           }
+          tree_samples.SetMaxDistinctSamples(
+              stream_options_[start].max_tree_samples);
           std::vector<pixel_type> pixel_samples;
           std::vector<pixel_type> diff_samples;
           std::vector<uint32_t> group_pixel_count;
@@ -1065,16 +1076,29 @@ Status ModularFrameEncoder::PrepareEncoding(const FrameHeader& frame_header,
               range, local_multiplier_info, group_pixel_count,
               channel_pixel_count, pixel_samples, diff_samples,
               stream_options_[start].max_property_values);
-          for (size_t i = start; i < stop; i++) {
-            JXL_CHECK(ModularGenericCompress(
-                stream_images_[i], stream_options_[i], /*writer=*/nullptr,
-                /*aux_out=*/nullptr, 0, i, &tree_samples, &total_pixels));
+          // Samples of each stream are gathered separately, possibly in
+          // parallel, and then added in stream order, so that the result does
+          // not depend on the number of threads.
+          std::vector<TreeSamples> stream_samples(stop - start, tree_samples);
+          std::vector<size_t> stream_pixels(stop - start);
+          JXL_CHECK(RunOnPool(
+              learn_pool, start, stop, ThreadPool::NoInit,
+              [&](const uint32_t i, size_t /* thread */) {
+                JXL_CHECK(ModularGenericCompress(
+                    stream_images_[i], stream_options_[i], /*writer=*/nullptr,
+                    /*aux_out=*/nullptr, 0, i, &stream_samples[i - start],
+                    &stream_pixels[i - start]));
+              },
+              "GatherTreeData"));
+          for (size_t i = 0; i < stop - start; i++) {
+            tree_samples.AddSamples(stream_samples[i]);
+            stream_samples[i] = TreeSamples();
+            total_pixels += stream_pixels[i];
           }
 
-          // TODO(veluca): parallelize more.
-          trees[chunk] =
-              LearnTree(std::move(tree_samples), total_pixels,
-                        stream_options_[start], local_multiplier_info, range);
+          trees[chunk] = LearnTree(std::move(tree_samples), total_pixels,
+                                   stream_options_[start],
+                                   local_multiplier_info, range, learn_pool);
         },
         "LearnTrees"));
     if (invalid_force_wp.test_and_set(std::memory_order_acq_rel)) {
@@ -1140,7 +1164,8 @@ Status ModularFrameEncoder::PrepareEncoding(const FrameHeader& frame_header,
 }
 
 Status ModularFrameEncoder::EncodeGlobalInfo(BitWriter* writer,
-                                             AuxOut* aux_out) {
+                                             AuxOut* aux_out,
+                                             ThreadPool* pool) {
   BitWriter::Allotment allotment(writer, 1);
   // If we are using brotli, or not using modular mode.
   if (tree_tokens_.empty() || tree_tokens_[0].empty()) {
@@ -1150,6 +1175,7 @@ Status ModularFrameEncoder::EncodeGlobalInfo(BitWriter* writer,
   }
   writer->Write(1, 1);
   allotment.ReclaimAndCharge(writer, kLayerModularTree, aux_out);
+  if (aux_out != nullptr) aux_out->num_tree_nodes += tree_.size();
 
   // Write tree
   HistogramParams params;
@@ -1159,12 +1185,17 @@ Status ModularFrameEncoder::EncodeGlobalInfo(BitWriter* writer,
         cparams_.speed_tier > SpeedTier::kThunder
             ? HistogramParams::ANSHistogramStrategy::kFast
             : HistogramParams::ANSHistogramStrategy::kApproximate;
-    params.lz77_method =
-        cparams_.decoding_speed_tier >= 3 && cparams_.modular_mode
-            ? (cparams_.speed_tier >= SpeedTier::kFalcon
-                   ? HistogramParams::LZ77Method::kRLE
-                   : HistogramParams::LZ77Method::kLZ77)
-            : HistogramParams::LZ77Method::kNone;
+    // The hash chain match finder is cheap enough to always try LZ77 on
+    // modular streams from kFalcon on.
+    if (!cparams_.modular_mode) {
+      params.lz77_method = HistogramParams::LZ77Method::kNone;
+    } else if (cparams_.speed_tier > SpeedTier::kFalcon) {
+      params.lz77_method = cparams_.decoding_speed_tier >= 3
+                               ? HistogramParams::LZ77Method::kRLE
+                               : HistogramParams::LZ77Method::kNone;
+    } else {
+      params.lz77_method = HistogramParams::LZ77Method::kLZ77;
+    }
     // Near-lossless DC, as well as modular mode, require choosing hybrid uint
     // more carefully.
     if ((!extra_dc_precision.empty() && extra_dc_precision[0] != 0) ||
@@ -1192,6 +1223,9 @@ Status ModularFrameEncoder::EncodeGlobalInfo(BitWriter* writer,
     params.uint_method = HistogramParams::HybridUintMethod::k000;
     params.force_huffman = true;
   }
+  if (cparams_.decoding_speed_tier >= 3) {
+    params.force_huffman = true;
+  }
   BuildAndEncodeHistograms(params, kNumTreeContexts, tree_tokens_, &code_,
                            &context_map_, writer, kLayerModularTree, aux_out);
   WriteTokens(tree_tokens_[0], code_, context_map_, writer, kLayerModularTree,
@@ -1199,7 +1233,8 @@ Status ModularFrameEncoder::EncodeGlobalInfo(BitWriter* writer,
   params.image_widths = image_widths_;
   // Write histograms.
   BuildAndEncodeHistograms(params, (tree_.size() + 1) / 2, tokens_, &code_,
-                           &context_map_, writer, kLayerModularGlobal, aux_out);
+                           &context_map_, writer, kLayerModularGlobal, aux_out,
+                           pool);
   return true;
 }
 
@@ -1210,6 +1245,11 @@ Status ModularFrameEncoder::EncodeStream(BitWriter* writer, AuxOut* aux_out,
   if (stream_images_[stream_id].channel.empty()) {
     return true;  // Image with no channels, header never gets decoded.
   }
+  if (cparams_.modular_local_trees) {
+    return ModularGenericCompress(stream_images_[stream_id],
+                                  stream_options_[stream_id], writer, aux_out,
+                                  layer, stream_id);
+  }
   JXL_RETURN_IF_ERROR(
       Bundle::Write(stream_headers_[stream_id], writer, layer, aux_out));
   WriteTokens(tokens_[stream_id], code_, context_map_, writer, layer, aux_out);
@@ -1266,37 +1306,47 @@ float EstimateWPCost(const Image& img, size_t i) {
   return histo_cost + extra_bits;
 }
 
-float EstimateCost(const Image& img) {
+constexpr uint32_t kCostCutoffs[] = {0,  1,  3,  5,   7,   11,  15,  23, 31,
+                                     47, 63, 95, 127, 191, 255, 392, 500};
+constexpr size_t kNumCostContexts =
+    sizeof(kCostCutoffs) / sizeof(*kCostCutoffs) + 1;
+
+// Adds the tokens of the gradient residuals of row `r` of `w` pixels to the
+// histograms of EstimateCost. `prev` is the row above, nullptr for the first
+// row.
+void AddEstimateCostRow(const pixel_type* JXL_RESTRICT r,
+                        const pixel_type* JXL_RESTRICT prev, size_t w,
+                        Histogram* histo, size_t* extra_bits) {
   // TODO(veluca): consider SIMDfication of this code.
+  HybridUintConfig config;
+  for (size_t x = 0; x < w; x++) {
+    pixel_type_w left = (x ? r[x - 1] : prev ? prev[x] : 0);
+    pixel_type_w top = (prev ? prev[x] : left);
+    pixel_type_w topleft = (x && prev ? prev[x - 1] : left);
+    size_t maxdiff = std::max(std::max(left, top), topleft) -
+                     std::min(std::min(left, top), topleft);
+    size_t ctx = 0;
+    for (uint32_t c : kCostCutoffs) {
+      ctx += c > maxdiff;
+    }
+    pixel_type res = r[x] - ClampedGradient(top, left, topleft);
+    uint32_t token, nbits, bits;
+    config.Encode(PackSigned(res), &token, &nbits, &bits);
+    histo[ctx].Add(token);
+    *extra_bits += nbits;
+  }
+}
+
+float EstimateCost(const Image& img) {
   size_t extra_bits = 0;
   float histo_cost = 0;
-  HybridUintConfig config;
-  uint32_t cutoffs[] = {0,  1,  3,  5,   7,   11,  15,  23, 31,
-                        47, 63, 95, 127, 191, 255, 392, 500};
-  constexpr size_t nc = sizeof(cutoffs) / sizeof(*cutoffs) + 1;
-  Histogram histo[nc] = {};
+  Histogram histo[kNumCostContexts] = {};
   for (const Channel& ch : img.channel) {
-    const intptr_t onerow = ch.plane.PixelsPerRow();
     for (size_t y = 0; y < ch.h; y++) {
-      const pixel_type* JXL_RESTRICT r = ch.Row(y);
-      for (size_t x = 0; x < ch.w; x++) {
-        pixel_type_w left = (x ? r[x - 1] : y ? *(r + x - onerow) : 0);
-        pixel_type_w top = (y ? *(r + x - onerow) : left);
-        pixel_type_w topleft = (x && y ? *(r + x - 1 - onerow) : left);
-        size_t maxdiff = std::max(std::max(left, top), topleft) -
-                         std::min(std::min(left, top), topleft);
-        size_t ctx = 0;
-        for (uint32_t c : cutoffs) {
-          ctx += c > maxdiff;
-        }
-        pixel_type res = r[x] - ClampedGradient(top, left, topleft);
-        uint32_t token, nbits, bits;
-        config.Encode(PackSigned(res), &token, &nbits, &bits);
-        histo[ctx].Add(token);
-        extra_bits += nbits;
-      }
+      AddEstimateCostRow(ch.Row(y), y ? ch.Row(y - 1) : nullptr, ch.w, histo,
+                         &extra_bits);
     }
-    for (size_t h = 0; h < nc; h++) {
+    for (size_t h = 0; h < kNumCostContexts; h++) {
       histo_cost += histo[h].ShannonEntropy();
       histo[h].Clear();
     }
@@ -1304,6 +1354,35 @@ float EstimateCost(const Image& img) {
   return histo_cost + extra_bits;
 }
 
+// EstimateCost of the channels `begin_c` to `begin_c` + 2 of `img` after the
+// RCT `rct_type`, computed on two rows at a time instead of on a transformed
+// copy of the image. The other channels are left out since the RCT does not
+// change them.
+float EstimateRCTCost(const Image& img, size_t begin_c, size_t rct_type) {
+  const size_t w = img.channel[begin_c].w;
+  const size_t h = img.channel[begin_c].h;
+  // Two rows of each channel, the current one and the one above.
+  std::vector<pixel_type> rows(6 * w);
+  size_t extra_bits = 0;
+  float histo_cost = 0;
+  Histogram histo[3][kNumCostContexts] = {};
+  for (size_t y = 0; y < h; y++) {
+    pixel_type* out[3];
+    for (size_t c = 0; c < 3; c++) out[c] = &rows[(2 * c + (y & 1)) * w];
+    FwdRCTRow(img, begin_c, rct_type, y, out);
+    for (size_t c = 0; c < 3; c++) {
+      const pixel_type* prev = y ? &rows[(2 * c + (~y & 1)) * w] : nullptr;
+      AddEstimateCostRow(out[c], prev, w, histo[c], &extra_bits);
+    }
+  }
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t i = 0; i < kNumCostContexts; i++) {
+      histo_cost += histo[c][i].ShannonEntropy();
+    }
+  }
+  return histo_cost + extra_bits;
+}
+
 }  // namespace
 
 Status ModularFrameEncoder::PrepareStreamParams(const Rect& rect,
@@ -1448,17 +1527,15 @@ Status ModularFrameEncoder::PrepareStreamParams(const Rect& rect,
                   1 * 7 + 2, 2 * 7 + 1, 2 * 7 + 2, 2 * 7 + 3, 4 * 7 + 4,
                   4 * 7 + 5, 0 * 7 + 2, 0 * 7 + 1, 0 * 7 + 3}) {
       if (nb_rcts_to_try == 0) break;
-      sg.rct_type = i;
       nb_rcts_to_try--;
-      if (do_transform(gi, sg, weighted::Header())) {
-        float cost = EstimateCost(gi);
-        if (cost < best_cost) {
-          best_rct = i;
-          best_cost = cost;
-        }
-        Transform t = gi.transform.back();
-        JXL_RETURN_IF_ERROR(t.Inverse(gi, weighted::Header(), nullptr));
-        gi.transform.pop_back();
+      // Like FwdRCT, the no-op RCT is not a transform and is not scored.
+      if (i == 0 || !CheckEqualChannels(gi, sg.begin_c, sg.begin_c + 2)) {
+        continue;
+      }
+      float cost = EstimateRCTCost(gi, sg.begin_c, i);
+      if (cost < best_cost) {
+        best_rct = i;
+        best_cost = cost;
       }
     }
     // Apply the best RCT to the image for future encoding.
@@ -14,6 +14,7 @@
 #include <utility>
 
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/chroma_from_luma.h"
 #include "lib/jxl/convolve.h"
 #include "lib/jxl/enc_aux_out.h"
@@ -26,7 +27,28 @@ namespace {
 
 using OptimizeArray = optimize::Array<double, NoiseParams::kNumNoisePoints>;
 
-float GetScoreSumsOfAbsoluteDifferences(const Image3F& opsin, const int x,
+// Upper bound for the number of blocks analyzed per image. Larger images only
+// analyze evenly spaced rows of blocks.
+constexpr size_t kMaxNoiseBlocks = 1 << 16;
+
+// Returns 0.5 * (X + Y), the channel that the noise model is built on.
+ImageF NoiseModelChannel(const Image3F& opsin, ThreadPool* pool) {
+  ImageF luma(opsin.xsize(), opsin.ysize());
+  JXL_CHECK(RunOnPool(
+      pool, 0, opsin.ysize(), ThreadPool::NoInit,
+      [&](const uint32_t y, size_t /* thread */) {
+        const float* JXL_RESTRICT row_x = opsin.ConstPlaneRow(0, y);
+        const float* JXL_RESTRICT row_y = opsin.ConstPlaneRow(1, y);
+        float* JXL_RESTRICT row_out = luma.Row(y);
+        for (size_t x = 0; x < opsin.xsize(); x++) {
+          row_out[x] = 0.5f * (row_y[x] + row_x[x]);
+        }
+      },
+      "NoiseModelChannel"));
+  return luma;
+}
+
+float GetScoreSumsOfAbsoluteDifferences(const ImageF& luma, const int x,
                                         const int y, const int block_size) {
   const int small_bl_size_x = 3;
   const int small_bl_size_y = 4;
@@ -43,13 +65,11 @@ float GetScoreSumsOfAbsoluteDifferences(const Image3F& opsin, const int x,
       // size of the center patch, we compare all the patches inside window with
       // the center one
       for (int cy = 0; cy < small_bl_size_y; ++cy) {
+        const float* JXL_RESTRICT row_wnd = luma.ConstRow(y + y_bl + cy);
+        const float* JXL_RESTRICT row_center = luma.ConstRow(y + offset + cy);
         for (int cx = 0; cx < small_bl_size_x; ++cx) {
-          float wnd = 0.5f * (opsin.PlaneRow(1, y + y_bl + cy)[x + x_bl + cx] +
-                              opsin.PlaneRow(0, y + y_bl + cy)[x + x_bl + cx]);
-          float center =
-              0.5f * (opsin.PlaneRow(1, y + offset + cy)[x + offset + cx] +
-                      opsin.PlaneRow(0, y + offset + cy)[x + offset + cx]);
-          sad_sum += std::abs(center - wnd);
+          sad_sum +=
+              std::abs(row_center[x + offset + cx] - row_wnd[x + x_bl + cx]);
         }
       }
       sad[counter++] = sad_sum;
@@ -58,8 +78,9 @@ float GetScoreSumsOfAbsoluteDifferences(const Image3F& opsin, const int x,
   const int kSamples = (kNumSAD) / 2;
   // As with ROAD (rank order absolute distance), we keep the smallest half of
   // the values in SAD (we use here the more robust patch SAD instead of
-  // absolute single-pixel differences).
-  std::sort(sad.begin(), sad.end());
+  // absolute single-pixel differences). Only that half needs to be sorted.
+  std::nth_element(sad.begin(), sad.begin() + kSamples, sad.end());
+  std::sort(sad.begin(), sad.begin() + kSamples);
   const float total_sad_sum =
       std::accumulate(sad.begin(), sad.begin() + kSamples, 0.0f);
   return total_sad_sum / kSamples;
@@ -123,21 +144,34 @@ class NoiseHistogram {
   uint32_t bins[kBins];
 };
 
-std::vector<float> GetSADScoresForPatches(const Image3F& opsin,
+// Returns the number of block rows between two analyzed ones.
+size_t NoiseBlockRowStep(const ImageF& luma, const size_t block_s) {
+  const size_t num_blocks = (luma.ysize() / block_s) * (luma.xsize() / block_s);
+  return std::max<size_t>(1, DivCeil(num_blocks, kMaxNoiseBlocks));
+}
+
+std::vector<float> GetSADScoresForPatches(const ImageF& luma,
                                           const size_t block_s,
+                                          const size_t row_step,
                                           const size_t num_bin,
-                                          NoiseHistogram* sad_histogram) {
-  std::vector<float> sad_scores(
-      (opsin.ysize() / block_s) * (opsin.xsize() / block_s), 0.0f);
-
-  int block_index = 0;
-
-  for (size_t y = 0; y + block_s <= opsin.ysize(); y += block_s) {
-    for (size_t x = 0; x + block_s <= opsin.xsize(); x += block_s) {
-      float sad_sc = GetScoreSumsOfAbsoluteDifferences(opsin, x, y, block_s);
-      sad_scores[block_index++] = sad_sc;
-      sad_histogram->Increment(sad_sc * num_bin);
-    }
+                                          NoiseHistogram* sad_histogram,
+                                          ThreadPool* pool) {
+  const size_t xsize_blocks = luma.xsize() / block_s;
+  const size_t ysize_blocks = DivCeil(luma.ysize() / block_s, row_step);
+  std::vector<float> sad_scores(ysize_blocks * xsize_blocks, 0.0f);
+
+  JXL_CHECK(RunOnPool(
+      pool, 0, ysize_blocks, ThreadPool::NoInit,
+      [&](const uint32_t by, size_t /* thread */) {
+        const size_t y = by * row_step * block_s;
+        for (size_t bx = 0; bx < xsize_blocks; ++bx) {
+          sad_scores[by * xsize_blocks + bx] =
+              GetScoreSumsOfAbsoluteDifferences(luma, bx * block_s, y, block_s);
+        }
+      },
+      "NoiseSADScores"));
+  for (const float sad_sc : sad_scores) {
+    sad_histogram->Increment(sad_sc * num_bin);
   }
   return sad_scores;
 }
@@ -233,10 +267,9 @@ void OptimizeNoiseParameters(const std::vector<NoiseLevel>& noise_level,
 }
 
 std::vector<NoiseLevel> GetNoiseLevel(
-    const Image3F& opsin, const std::vector<float>& texture_strength,
-    const float threshold, const size_t block_s) {
-  std::vector<NoiseLevel> noise_level_per_intensity;
-
+    const ImageF& luma, const std::vector<float>& texture_strength,
+    const float threshold, const size_t block_s, const size_t row_step,
+    ThreadPool* pool) {
   const int filt_size = 1;
   static const float kLaplFilter[filt_size * 2 + 1][filt_size * 2 + 1] = {
       {-0.25f, -1.0f, -0.25f},
@@ -246,77 +279,67 @@ std::vector<NoiseLevel> GetNoiseLevel(
 
   // The noise model is built based on channel 0.5 * (X+Y) as we notice that it
   // is similar to the model 0.5 * (Y-X)
-  size_t patch_index = 0;
-
-  for (size_t y = 0; y + block_s <= opsin.ysize(); y += block_s) {
-    for (size_t x = 0; x + block_s <= opsin.xsize(); x += block_s) {
-      if (texture_strength[patch_index] <= threshold) {
-        // Calculate mean value
-        float mean_int = 0;
-        for (size_t y_bl = 0; y_bl < block_s; ++y_bl) {
-          for (size_t x_bl = 0; x_bl < block_s; ++x_bl) {
-            mean_int += 0.5f * (opsin.PlaneRow(1, y + y_bl)[x + x_bl] +
-                                opsin.PlaneRow(0, y + y_bl)[x + x_bl]);
+  const size_t xsize_blocks = luma.xsize() / block_s;
+  const size_t ysize_blocks = DivCeil(luma.ysize() / block_s, row_step);
+  // Collected per block row, so that the order does not depend on threads.
+  std::vector<std::vector<NoiseLevel>> row_noise_levels(ysize_blocks);
+
+  JXL_CHECK(RunOnPool(
+      pool, 0, ysize_blocks, ThreadPool::NoInit,
+      [&](const uint32_t by, size_t /* thread */) {
+        const size_t y = by * row_step * block_s;
+        for (size_t bx = 0; bx < xsize_blocks; ++bx) {
+          if (texture_strength[by * xsize_blocks + bx] > threshold) continue;
+          const size_t x = bx * block_s;
+          // Calculate mean value
+          float mean_int = 0;
+          for (size_t y_bl = 0; y_bl < block_s; ++y_bl) {
+            const float* JXL_RESTRICT row = luma.ConstRow(y + y_bl);
+            for (size_t x_bl = 0; x_bl < block_s; ++x_bl) {
+              mean_int += row[x + x_bl];
+            }
           }
-        }
-        mean_int /= block_s * block_s;
-
-        // Calculate Noise level
-        float noise_level = 0;
-        size_t count = 0;
-        for (size_t y_bl = 0; y_bl < block_s; ++y_bl) {
-          for (size_t x_bl = 0; x_bl < block_s; ++x_bl) {
-            float filtered_value = 0;
-            for (int y_f = -1 * filt_size; y_f <= filt_size; ++y_f) {
-              if ((static_cast<ssize_t>(y_bl) + y_f) >= 0 &&
-                  (y_bl + y_f) < block_s) {
-                for (int x_f = -1 * filt_size; x_f <= filt_size; ++x_f) {
-                  if ((static_cast<ssize_t>(x_bl) + x_f) >= 0 &&
-                      (x_bl + x_f) < block_s) {
-                    filtered_value +=
-                        0.5f *
-                        (opsin.PlaneRow(1, y + y_bl + y_f)[x + x_bl + x_f] +
-                         opsin.PlaneRow(0, y + y_bl + y_f)[x + x_bl + x_f]) *
-                        kLaplFilter[y_f + filt_size][x_f + filt_size];
-                  } else {
-                    filtered_value +=
-                        0.5f *
-                        (opsin.PlaneRow(1, y + y_bl + y_f)[x + x_bl - x_f] +
-                         opsin.PlaneRow(0, y + y_bl + y_f)[x + x_bl - x_f]) *
-                        kLaplFilter[y_f + filt_size][x_f + filt_size];
-                  }
-                }
-              } else {
+          mean_int /= block_s * block_s;
+
+          // Calculate Noise level, mirroring the filter at the block borders.
+          float noise_level = 0;
+          size_t count = 0;
+          for (size_t y_bl = 0; y_bl < block_s; ++y_bl) {
+            for (size_t x_bl = 0; x_bl < block_s; ++x_bl) {
+              float filtered_value = 0;
+              for (int y_f = -1 * filt_size; y_f <= filt_size; ++y_f) {
+                const bool y_inside =
+                    (static_cast<ssize_t>(y_bl) + y_f) >= 0 &&
+                    (y_bl + y_f) < block_s;
+                const float* JXL_RESTRICT row =
+                    luma.ConstRow(y + y_bl + (y_inside ? y_f : -y_f));
                 for (int x_f = -1 * filt_size; x_f <= filt_size; ++x_f) {
-                  if ((static_cast<ssize_t>(x_bl) + x_f) >= 0 &&
-                      (x_bl + x_f) < block_s) {
-                    filtered_value +=
-                        0.5f *
-                        (opsin.PlaneRow(1, y + y_bl - y_f)[x + x_bl + x_f] +
-                         opsin.PlaneRow(0, y + y_bl - y_f)[x + x_bl + x_f]) *
-                        kLaplFilter[y_f + filt_size][x_f + filt_size];
-                  } else {
-                    filtered_value +=
-                        0.5f *
-                        (opsin.PlaneRow(1, y + y_bl - y_f)[x + x_bl - x_f] +
-                         opsin.PlaneRow(0, y + y_bl - y_f)[x + x_bl - x_f]) *
-                        kLaplFilter[y_f + filt_size][x_f + filt_size];
-                  }
+                  const bool x_inside =
+                      (static_cast<ssize_t>(x_bl) + x_f) >= 0 &&
+                      (x_bl + x_f) < block_s;
+                  const float weight =
+                      kLaplFilter[y_f + filt_size][x_f + filt_size];
+                  filtered_value +=
+                      row[x + x_bl + (x_inside ? x_f : -x_f)] * weight;
                 }
               }
+              noise_level += std::abs(filtered_value);
+              ++count;
             }
-            noise_level += std::abs(filtered_value);
-            ++count;
           }
+          noise_level /= count;
+          NoiseLevel nl;
+          nl.intensity = mean_int;
+          nl.noise_level = noise_level;
+          row_noise_levels[by].push_back(nl);
         }
-        noise_level /= count;
-        NoiseLevel nl;
-        nl.intensity = mean_int;
-        nl.noise_level = noise_level;
-        noise_level_per_intensity.push_back(nl);
-      }
-      ++patch_index;
-    }
+      },
+      "NoiseLevel"));
+
+  std::vector<NoiseLevel> noise_level_per_intensity;
+  for (const std::vector<NoiseLevel>& row : row_noise_levels) {
+    noise_level_per_intensity.insert(noise_level_per_intensity.end(),
+                                     row.begin(), row.end());
   }
   return noise_level_per_intensity;
 }
@@ -331,7 +354,7 @@ void EncodeFloatParam(float val, float precision, BitWriter* writer) {
 }  // namespace
 
 Status GetNoiseParameter(const Image3F& opsin, NoiseParams* noise_params,
-                         float quality_coef) {
+                         float quality_coef, ThreadPool* pool) {
   // The size of a patch in decoder might be different from encoder's patch
   // size.
   // For encoder: the patch size should be big enough to estimate
@@ -339,9 +362,11 @@ Status GetNoiseParameter(const Image3F& opsin, NoiseParams* noise_params,
   //              to be able to estimate intensity value of the patch
   const size_t block_s = 8;
   const size_t kNumBin = 256;
+  const ImageF luma = NoiseModelChannel(opsin, pool);
+  const size_t row_step = NoiseBlockRowStep(luma, block_s);
   NoiseHistogram sad_histogram;
-  std::vector<float> sad_scores =
-      GetSADScoresForPatches(opsin, block_s, kNumBin, &sad_histogram);
+  std::vector<float> sad_scores = GetSADScoresForPatches(
+      luma, block_s, row_step, kNumBin, &sad_histogram, pool);
   float sad_threshold = GetSADThreshold(sad_histogram, kNumBin);
   // If threshold is too large, the image has a strong pattern. This pattern
   // fools our model and it will add too much noise. Therefore, we do not add
@@ -350,8 +375,8 @@ Status GetNoiseParameter(const Image3F& opsin, NoiseParams* noise_params,
     noise_params->Clear();
     return false;
   }
-  std::vector<NoiseLevel> nl =
-      GetNoiseLevel(opsin, sad_scores, sad_threshold, block_s);
+  std::vector<NoiseLevel> nl = GetNoiseLevel(luma, sad_scores, sad_threshold,
+                                             block_s, row_step, pool);
 
   OptimizeNoiseParameters(nl, noise_params);
   for (float& i : noise_params->lut) {
@@ -79,6 +79,7 @@ struct CompressParams {
   // 4 = fastest speed, lowest quality
   size_t decoding_speed_tier = 0;
 
+  // 0 disables the butteraugli quantization search of kKitten and slower.
   int max_butteraugli_iters = 4;
 
   int max_butteraugli_iters_guetzli_mode = 100;
@@ -151,6 +152,22 @@ struct CompressParams {
   float channel_colors_percent = 80.f;
   int palette_colors = 1 << 10;  // up to 10-bit palette is probably worthwhile
   bool lossy_palette = false;
+  // Learn a tree for each modular stream independently and store it in the
+  // stream's section, instead of a global tree.
+  bool modular_local_trees = false;
+  // Reuse the lossy heuristics of the previous frame for the tiles of an
+  // animation frame whose input did not change.
+  bool temporal_reuse = false;
+  // Keep the text-like patches of the frames in a reference frame and reuse
+  // them in the next frames.
+  bool persistent_patches = false;
+  // Back large buffers with transparent huge pages, and fault in the pages of
+  // the color image on all threads before filling it.
+  bool huge_pages = false;
+  // Number of threads the frame is expected to be decoded with, 0 if unknown.
+  // Modular frames use smaller groups when there would be fewer groups than
+  // threads.
+  size_t decoder_threads = 0;
 
   // Returns whether these params are lossless as defined by SetLossless();
   bool IsLossless() const { return modular_mode && ModularPartIsLossless(); }
@@ -13,6 +13,7 @@
 #include <atomic>
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -204,6 +205,24 @@ struct PatchColorspaceInfo {
   }
 };
 
+// Hashes the size and quantized pixels of a patch, i.e. exactly the fields
+// compared by QuantizedPatch::operator==.
+uint64_t HashQuantizedPatch(const QuantizedPatch& patch) {
+  uint64_t hash = 0xcbf29ce484222325ull;  // FNV-1a
+  const auto mix = [&hash](uint64_t v) {
+    hash ^= v;
+    hash *= 0x100000001b3ull;
+  };
+  mix(patch.xsize);
+  mix(patch.ysize);
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t i = 0; i < patch.xsize * patch.ysize; i++) {
+      mix(static_cast<uint8_t>(patch.pixels[c][i]));
+    }
+  }
+  return hash;
+}
+
 std::vector<PatchInfo> FindTextLikePatches(
     const Image3F& opsin, const PassesEncoderState* JXL_RESTRICT state,
     ThreadPool* pool, AuxOut* aux_out, bool is_xyb) {
@@ -260,7 +279,8 @@ std::vector<PatchInfo> FindTextLikePatches(
   const auto process_row = [&](const uint32_t y, size_t /* thread */) {
     for (uint64_t x = 0; x < opsin.xsize() / kPatchSide; x++) {
       bool all_same = true;
-      for (size_t iy = 0; iy < static_cast<size_t>(kPatchSide); iy++) {
+      for (size_t iy = 0; all_same && iy < static_cast<size_t>(kPatchSide);
+           iy++) {
         for (size_t ix = 0; ix < static_cast<size_t>(kPatchSide); ix++) {
           size_t cx = x * kPatchSide + ix;
           size_t cy = y * kPatchSide + iy;
@@ -271,22 +291,24 @@ std::vector<PatchInfo> FindTextLikePatches(
         }
       }
       if (!all_same) continue;
-      size_t num = 0;
-      size_t num_same = 0;
-      for (int64_t iy = -kExtraSide; iy < kExtraSide + kPatchSide; iy++) {
-        for (int64_t ix = -kExtraSide; ix < kExtraSide + kPatchSide; ix++) {
-          int64_t cx = x * kPatchSide + ix;
-          int64_t cy = y * kPatchSide + iy;
-          if (cx < 0 || static_cast<uint64_t>(cx) >= opsin.xsize() ||  //
-              cy < 0 || static_cast<uint64_t>(cy) >= opsin.ysize()) {
-            continue;
+      const int64_t x0 = std::max<int64_t>(x * kPatchSide - kExtraSide, 0);
+      const int64_t x1 = std::min<int64_t>(
+          (x + 1) * kPatchSide + kExtraSide, opsin.xsize());
+      const int64_t y0 = std::max<int64_t>(y * kPatchSide - kExtraSide, 0);
+      const int64_t y1 = std::min<int64_t>(
+          (y + 1) * kPatchSide + kExtraSide, opsin.ysize());
+      const size_t num = (x1 - x0) * (y1 - y0);
+      // Too few equal pixels nearby: stop as soon as more than 1/8 of the
+      // neighbourhood differs.
+      size_t num_different = 0;
+      for (int64_t cy = y0; cy < y1 && num_different * 8 <= num; cy++) {
+        for (int64_t cx = x0; cx < x1; cx++) {
+          if (!is_same({cx, cy}, {x * kPatchSide, y * kPatchSide})) {
+            num_different++;
           }
-          num++;
-          if (is_same({cx, cy}, {x * kPatchSide, y * kPatchSide})) num_same++;
         }
       }
-      // Too few equal pixels nearby.
-      if (num_same * 8 < num * 7) continue;
+      if (num_different * 8 > num) continue;
       screenshot_row[y * screenshot_stride + x] = 1;
       has_screenshot_areas = true;
     }
@@ -294,7 +316,6 @@ std::vector<PatchInfo> FindTextLikePatches(
   JXL_CHECK(RunOnPool(pool, 0, opsin.ysize() / kPatchSide, ThreadPool::NoInit,
                       process_row, "IsScreenshotLike"));
 
-  // TODO(veluca): also parallelize the rest of this function.
   if (WantDebugOutput(aux_out)) {
     aux_out->DumpPlaneNormalized("screenshot_like", is_screenshot_like);
   }
@@ -401,10 +422,15 @@ std::vector<PatchInfo> FindTextLikePatches(
   constexpr int kMinPeak = 2;
   constexpr int kHasSimilarRadius = 2;
 
-  std::vector<PatchInfo> info;
-
-  // Find small CC outside the "similar enough" areas, compute bounding boxes,
-  // and run heuristics to exclude some patches.
+  // Find small CC outside the "similar enough" areas and compute bounding
+  // boxes. This flood fill is inherently sequential; the per-candidate
+  // heuristics below run on the thread pool.
+  struct PatchCandidate {
+    size_t min_x, min_y, max_x, max_y;
+    std::pair<uint32_t, uint32_t> reference;
+    std::vector<std::pair<uint32_t, uint32_t>> cc;
+  };
+  std::vector<PatchCandidate> candidates;
   ImageB visited(opsin.xsize(), opsin.ysize());
   ZeroFillImage(&visited);
   uint8_t* JXL_RESTRICT visited_row = visited.Row(0);
@@ -465,56 +491,88 @@ std::vector<PatchInfo> FindTextLikePatches(
           max_y - min_y >= kMaxPatchSize) {
         continue;
       }
-      size_t bpos = background_stride * reference.second + reference.first;
-      float ref[3] = {background_rows[0][bpos], background_rows[1][bpos],
-                      background_rows[2][bpos]};
-      bool has_similar = false;
-      for (size_t iy = std::max<int>(
-               static_cast<int32_t>(min_y) - kHasSimilarRadius, 0);
-           iy < std::min(max_y + kHasSimilarRadius + 1, opsin.ysize()); iy++) {
-        for (size_t ix = std::max<int>(
-                 static_cast<int32_t>(min_x) - kHasSimilarRadius, 0);
-             ix < std::min(max_x + kHasSimilarRadius + 1, opsin.xsize());
-             ix++) {
-          size_t opos = opsin_stride * iy + ix;
-          float px[3] = {opsin_rows[0][opos], opsin_rows[1][opos],
-                         opsin_rows[2][opos]};
-          if (pci.is_similar_v(ref, px, kHasSimilarThreshold)) {
-            has_similar = true;
-          }
+      candidates.push_back({min_x, min_y, max_x, max_y, reference, cc});
+    }
+  }
+
+  // Run heuristics to exclude some patches.
+  const auto reference_color = [&](const PatchCandidate& cand, size_t c) {
+    return background_rows[c][background_stride * cand.reference.second +
+                              cand.reference.first];
+  };
+  std::vector<uint8_t> is_patch(candidates.size());
+  const auto check_candidate = [&](const uint32_t i, size_t /* thread */) {
+    const PatchCandidate& cand = candidates[i];
+    float ref[3];
+    for (size_t c = 0; c < 3; c++) ref[c] = reference_color(cand, c);
+    bool has_similar = false;
+    for (size_t iy = std::max<int>(
+             static_cast<int32_t>(cand.min_y) - kHasSimilarRadius, 0);
+         !has_similar &&
+         iy < std::min(cand.max_y + kHasSimilarRadius + 1, opsin.ysize());
+         iy++) {
+      for (size_t ix = std::max<int>(
+               static_cast<int32_t>(cand.min_x) - kHasSimilarRadius, 0);
+           ix < std::min(cand.max_x + kHasSimilarRadius + 1, opsin.xsize());
+           ix++) {
+        size_t opos = opsin_stride * iy + ix;
+        float px[3] = {opsin_rows[0][opos], opsin_rows[1][opos],
+                       opsin_rows[2][opos]};
+        if (pci.is_similar_v(ref, px, kHasSimilarThreshold)) {
+          has_similar = true;
+          break;
         }
       }
-      if (!has_similar) continue;
-      info.emplace_back();
-      info.back().second.emplace_back(min_x, min_y);
-      QuantizedPatch& patch = info.back().first;
-      patch.xsize = max_x - min_x + 1;
-      patch.ysize = max_y - min_y + 1;
-      int max_value = 0;
-      for (size_t c : {1, 0, 2}) {
-        for (size_t iy = min_y; iy <= max_y; iy++) {
-          for (size_t ix = min_x; ix <= max_x; ix++) {
-            size_t offset = (iy - min_y) * patch.xsize + ix - min_x;
-            patch.fpixels[c][offset] =
-                opsin_rows[c][iy * opsin_stride + ix] - ref[c];
-            int val = pci.Quantize(patch.fpixels[c][offset], c);
-            patch.pixels[c][offset] = val;
-            if (std::abs(val) > max_value) max_value = std::abs(val);
-          }
+    }
+    if (!has_similar) return;
+    int max_value = 0;
+    for (size_t c = 0; c < 3; c++) {
+      for (size_t iy = cand.min_y; iy <= cand.max_y; iy++) {
+        for (size_t ix = cand.min_x; ix <= cand.max_x; ix++) {
+          int val = pci.Quantize(opsin_rows[c][iy * opsin_stride + ix] - ref[c],
+                                 c);
+          if (std::abs(val) > max_value) max_value = std::abs(val);
         }
       }
-      if (max_value < kMinPeak) {
-        info.pop_back();
-        continue;
+    }
+    is_patch[i] = max_value >= kMinPeak;
+  };
+  JXL_CHECK(RunOnPool(pool, 0, candidates.size(), ThreadPool::NoInit,
+                      check_candidate, "CheckPatchCandidates"));
+
+  std::vector<size_t> patch_candidates;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    if (!is_patch[i]) continue;
+    patch_candidates.push_back(i);
+    if (paint_ccs) {
+      float cc_color = rng.UniformF(0.5, 1.0);
+      for (std::pair<uint32_t, uint32_t> p : candidates[i].cc) {
+        ccs.Row(p.second)[p.first] = cc_color;
       }
-      if (paint_ccs) {
-        float cc_color = rng.UniformF(0.5, 1.0);
-        for (std::pair<uint32_t, uint32_t> p : cc) {
-          ccs.Row(p.second)[p.first] = cc_color;
+    }
+  }
+
+  std::vector<PatchInfo> info(patch_candidates.size());
+  const auto quantize_patch = [&](const uint32_t i, size_t /* thread */) {
+    const PatchCandidate& cand = candidates[patch_candidates[i]];
+    info[i].second.emplace_back(cand.min_x, cand.min_y);
+    QuantizedPatch& patch = info[i].first;
+    patch.xsize = cand.max_x - cand.min_x + 1;
+    patch.ysize = cand.max_y - cand.min_y + 1;
+    for (size_t c = 0; c < 3; c++) {
+      const float ref = reference_color(cand, c);
+      for (size_t iy = cand.min_y; iy <= cand.max_y; iy++) {
+        for (size_t ix = cand.min_x; ix <= cand.max_x; ix++) {
+          size_t offset = (iy - cand.min_y) * patch.xsize + ix - cand.min_x;
+          patch.fpixels[c][offset] =
+              opsin_rows[c][iy * opsin_stride + ix] - ref;
+          patch.pixels[c][offset] = pci.Quantize(patch.fpixels[c][offset], c);
         }
       }
     }
-  }
+  };
+  JXL_CHECK(RunOnPool(pool, 0, info.size(), ThreadPool::NoInit,
+                      quantize_patch, "QuantizePatches"));
 
   if (paint_ccs) {
     JXL_ASSERT(WantDebugOutput(aux_out));
@@ -524,25 +582,34 @@ std::vector<PatchInfo> FindTextLikePatches(
     return {};
   }
 
-  // Remove duplicates.
+  // Remove duplicates. Patches are bucketed by a hash of their quantized
+  // pixels, so that only patches with equal hashes are compared; most patches
+  // occur only once and are dropped before the remaining ones get sorted.
   constexpr size_t kMinPatchOccurrences = 2;
-  std::sort(info.begin(), info.end());
-  size_t unique = 0;
-  for (size_t i = 1; i < info.size(); i++) {
-    if (info[i].first == info[unique].first) {
-      info[unique].second.insert(info[unique].second.end(),
-                                 info[i].second.begin(), info[i].second.end());
-    } else {
-      if (info[unique].second.size() >= kMinPatchOccurrences) {
-        unique++;
+  std::unordered_map<uint64_t, std::vector<size_t>> buckets;
+  for (size_t i = 0; i < info.size(); i++) {
+    std::vector<size_t>& bucket = buckets[HashQuantizedPatch(info[i].first)];
+    bool merged = false;
+    for (size_t j : bucket) {
+      if (info[j].first == info[i].first) {
+        info[j].second.insert(info[j].second.end(), info[i].second.begin(),
+                              info[i].second.end());
+        info[i].second.clear();
+        merged = true;
+        break;
       }
-      info[unique] = info[i];
     }
+    if (!merged) bucket.push_back(i);
   }
-  if (info[unique].second.size() >= kMinPatchOccurrences) {
+  size_t unique = 0;
+  for (size_t i = 0; i < info.size(); i++) {
+    if (info[i].second.size() < kMinPatchOccurrences) continue;
+    std::sort(info[i].second.begin(), info[i].second.end());
+    if (i != unique) info[unique] = std::move(info[i]);
     unique++;
   }
   info.resize(unique);
+  std::sort(info.begin(), info.end());
 
   size_t max_patch_size = 0;
 
@@ -558,6 +625,110 @@ std::vector<PatchInfo> FindTextLikePatches(
   return info;
 }
 
+// Upper bound for the pixels of the patches kept in PatchDictionaryCache.
+constexpr size_t kMaxPersistentPatchPixels = 1 << 20;
+
+// Adds the occurrences of a patch at the given position of a reference frame,
+// if it has any.
+void AddPatchPositions(const PatchInfo& info,
+                       const PatchReferencePosition& ref_pos, size_t num_ec,
+                       std::vector<PatchPosition>* positions,
+                       std::vector<PatchReferencePosition>* pref_positions,
+                       std::vector<PatchBlending>* blendings) {
+  if (info.second.empty()) return;
+  for (const auto& pos : info.second) {
+    positions->emplace_back(
+        PatchPosition{pos.first, pos.second, pref_positions->size()});
+    // Add blending for color channels, ignore other channels.
+    blendings->push_back({PatchBlendMode::kAdd, 0, false});
+    for (size_t j = 0; j < num_ec; ++j) {
+      blendings->push_back({PatchBlendMode::kNone, 0, false});
+    }
+  }
+  pref_positions->push_back(ref_pos);
+}
+
+// Returns the patches of the cache by hash.
+std::unordered_multimap<uint64_t, size_t> IndexCachedPatches(
+    const PatchDictionaryCache& cache) {
+  std::unordered_multimap<uint64_t, size_t> index;
+  for (size_t i = 0; i < cache.patches.size(); i++) {
+    index.emplace(HashQuantizedPatch(cache.patches[i]), i);
+  }
+  return index;
+}
+
+// Returns the index of the patch in the cache, or -1 if it is not there.
+int64_t FindCachedPatch(const std::unordered_multimap<uint64_t, size_t>& index,
+                        const PatchDictionaryCache& cache,
+                        const QuantizedPatch& patch) {
+  const auto range = index.equal_range(HashQuantizedPatch(patch));
+  for (auto it = range.first; it != range.second; ++it) {
+    if (cache.patches[it->second] == patch) return it->second;
+  }
+  return -1;
+}
+
+// If all patches of the frame are in the cache, makes the frame use them from
+// the reference frame of the cache and returns true.
+bool UseCachedPatches(const std::vector<PatchInfo>& info,
+                      const PatchDictionaryCache& cache,
+                      PassesEncoderState* JXL_RESTRICT state) {
+  const std::unordered_multimap<uint64_t, size_t> index =
+      IndexCachedPatches(cache);
+  std::vector<size_t> cached(info.size());
+  for (size_t i = 0; i < info.size(); i++) {
+    const int64_t found = FindCachedPatch(index, cache, info[i].first);
+    if (found < 0) return false;
+    cached[i] = found;
+  }
+  std::vector<PatchPosition> positions;
+  std::vector<PatchReferencePosition> pref_positions;
+  std::vector<PatchBlending> blendings;
+  size_t num_ec = state->shared.metadata->m.num_extra_channels;
+  for (size_t i = 0; i < info.size(); i++) {
+    AddPatchPositions(info[i], cache.ref_positions[cached[i]], num_ec,
+                      &positions, &pref_positions, &blendings);
+  }
+  state->shared.reference_frames[kPersistentPatchReference].frame =
+      cache.frame.Copy();
+  state->shared.reference_frames[kPersistentPatchReference].ib_is_in_xyb =
+      cache.ib_is_in_xyb;
+  PatchDictionaryEncoder::SetPositions(
+      &state->shared.image_features.patches, std::move(positions),
+      std::move(pref_positions), std::move(blendings));
+  return true;
+}
+
+// Adds the patches of the cache that the frame does not use, without
+// occurrences, so that the next frames can use them too. Starts over from the
+// patches of the frame if the dictionary would become too large.
+void AddCachedPatches(const PatchDictionaryCache& cache,
+                      std::vector<PatchInfo>* info) {
+  std::unordered_multimap<uint64_t, size_t> index;
+  size_t total_pixels = 0;
+  for (size_t i = 0; i < info->size(); i++) {
+    const QuantizedPatch& patch = (*info)[i].first;
+    index.emplace(HashQuantizedPatch(patch), i);
+    total_pixels += patch.xsize * patch.ysize;
+  }
+  std::vector<const QuantizedPatch*> unused;
+  for (const QuantizedPatch& patch : cache.patches) {
+    const auto range = index.equal_range(HashQuantizedPatch(patch));
+    bool used = false;
+    for (auto it = range.first; it != range.second; ++it) {
+      if ((*info)[it->second].first == patch) used = true;
+    }
+    if (used) continue;
+    unused.push_back(&patch);
+    total_pixels += patch.xsize * patch.ysize;
+  }
+  if (total_pixels > kMaxPersistentPatchPixels) return;
+  for (const QuantizedPatch* patch : unused) {
+    info->emplace_back(*patch, std::vector<std::pair<uint32_t, uint32_t>>());
+  }
+}
+
 }  // namespace
 
 void FindBestPatchDictionary(const Image3F& opsin,
@@ -566,6 +737,7 @@ void FindBestPatchDictionary(const Image3F& opsin,
                              AuxOut* aux_out, bool is_xyb) {
   std::vector<PatchInfo> info =
       FindTextLikePatches(opsin, state, pool, aux_out, is_xyb);
+  PatchDictionaryCache* cache = info.empty() ? nullptr : state->patch_cache;
 
   // TODO(veluca): this doesn't work if both dots and patches are enabled.
   // For now, since dots and patches are not likely to occur in the same kind of
@@ -580,6 +752,12 @@ void FindBestPatchDictionary(const Image3F& opsin,
 
   if (info.empty()) return;
 
+  if (cache != nullptr) {
+    if (cache->valid && UseCachedPatches(info, *cache, state)) return;
+    if (cache->valid) AddCachedPatches(*cache, &info);
+  }
+  const size_t ref = cache != nullptr ? kPersistentPatchReference : 0;
+
   std::sort(
       info.begin(), info.end(), [&](const PatchInfo& a, const PatchInfo& b) {
         return a.first.xsize * a.first.ysize > b.first.xsize * b.first.ysize;
@@ -679,6 +857,8 @@ void FindBestPatchDictionary(const Image3F& opsin,
   std::vector<PatchPosition> positions;
   std::vector<PatchReferencePosition> pref_positions;
   std::vector<PatchBlending> blendings;
+  // Positions of all patches in the reference frame, used or not.
+  std::vector<PatchReferencePosition> cache_ref_positions;
   float* JXL_RESTRICT ref_rows[3] = {
       reference_frame.PlaneRow(0, 0),
       reference_frame.PlaneRow(1, 0),
@@ -693,7 +873,7 @@ void FindBestPatchDictionary(const Image3F& opsin,
     ref_pos.ysize = info[i].first.ysize;
     ref_pos.x0 = ref_positions[i].first;
     ref_pos.y0 = ref_positions[i].second;
-    ref_pos.ref = 0;
+    ref_pos.ref = ref;
     for (size_t y = 0; y < ref_pos.ysize; y++) {
       for (size_t x = 0; x < ref_pos.xsize; x++) {
         for (size_t c = 0; c < 3; c++) {
@@ -702,24 +882,30 @@ void FindBestPatchDictionary(const Image3F& opsin,
         }
       }
     }
-    for (const auto& pos : info[i].second) {
-      positions.emplace_back(
-          PatchPosition{pos.first, pos.second, pref_positions.size()});
-      // Add blending for color channels, ignore other channels.
-      blendings.push_back({PatchBlendMode::kAdd, 0, false});
-      for (size_t j = 0; j < num_ec; ++j) {
-        blendings.push_back({PatchBlendMode::kNone, 0, false});
-      }
+    AddPatchPositions(info[i], ref_pos, num_ec, &positions, &pref_positions,
+                      &blendings);
+    if (cache != nullptr) {
+      cache_ref_positions.push_back(ref_pos);
     }
-    pref_positions.emplace_back(std::move(ref_pos));
   }
 
   CompressParams cparams = state->cparams;
   // Recursive application of patches could create very weird issues.
   cparams.patches = Override::kOff;
 
-  RoundtripPatchFrame(&reference_frame, state, 0, cparams, cms, pool, aux_out,
-                      /*subtract=*/true);
+  RoundtripPatchFrame(&reference_frame, state, ref, cparams, cms, pool,
+                      aux_out, /*subtract=*/true);
+
+  if (cache != nullptr) {
+    cache->valid = true;
+    cache->patches.clear();
+    for (PatchInfo& patch_info : info) {
+      cache->patches.push_back(std::move(patch_info.first));
+    }
+    cache->ref_positions = std::move(cache_ref_positions);
+    cache->frame = state->shared.reference_frames[ref].frame.Copy();
+    cache->ib_is_in_xyb = state->shared.reference_frames[ref].ib_is_in_xyb;
+  }
 
   // TODO(veluca): this assumes that applying patches is commutative, which is
   // not true for all blending modes. This code only produces kAdd patches, so
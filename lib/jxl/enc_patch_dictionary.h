@@ -74,6 +74,23 @@ struct QuantizedPatch {
 using PatchInfo =
     std::pair<QuantizedPatch, std::vector<std::pair<uint32_t, uint32_t>>>;
 
+// Reference frame slot of the patches kept across frames with
+// CompressParams::persistent_patches.
+constexpr size_t kPersistentPatchReference = 3;
+
+// Text-like patches of the previous frames, which the decoder has in reference
+// frame slot kPersistentPatchReference. Frames whose patches are all in there
+// use them without encoding a new patch frame.
+struct PatchDictionaryCache {
+  bool valid = false;
+  // The patches in the reference frame, and their positions in it.
+  std::vector<QuantizedPatch> patches;
+  std::vector<PatchReferencePosition> ref_positions;
+  // The reference frame, as decoded.
+  ImageBundle frame;
+  bool ib_is_in_xyb = false;
+};
+
 // Friend class of PatchDictionary.
 class PatchDictionaryEncoder {
  public:
@@ -0,0 +1,46 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/enc_progress.h"
+
+namespace jxl {
+
+void EncoderProgress::Call(float progress) {
+  if (!callback_ || aborted_.load(std::memory_order_relaxed)) return;
+  if (!callback_(opaque_, progress)) {
+    aborted_.store(true, std::memory_order_relaxed);
+  }
+}
+
+Status EncoderProgress::Report(EncoderPhase phase) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Clock::time_point now = Clock::now();
+    phase_seconds_[static_cast<size_t>(phase)] +=
+        std::chrono::duration<double>(now - phase_start_).count();
+    phase_start_ = now;
+    progress_ = PhaseEndProgress(phase);
+    num_tasks_ = 0;
+    Call(progress_);
+  }
+  if (Aborted()) return JXL_FAILURE("Encoding aborted");
+  return true;
+}
+
+void EncoderProgress::BeginTasks(EncoderPhase phase, size_t num_tasks) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  tasks_end_ = PhaseEndProgress(phase);
+  num_tasks_ = num_tasks;
+  tasks_done_ = 0;
+}
+
+void EncoderProgress::TaskDone() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (num_tasks_ == 0) return;
+  ++tasks_done_;
+  Call(progress_ + (tasks_end_ - progress_) * tasks_done_ / num_tasks_);
+}
+
+}  // namespace jxl
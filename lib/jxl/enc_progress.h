@@ -0,0 +1,124 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_ENC_PROGRESS_H_
+#define LIB_JXL_ENC_PROGRESS_H_
+
+// Progress reporting, cooperative cancellation and phase timing of
+// EncodeFrame.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+
+// The phases of EncodeFrame, in the order in which they end. Depending on the
+// encoding, some phases are skipped.
+enum class EncoderPhase : uint32_t {
+  kColorTransform = 0,
+  kAcStrategy,
+  kQuantization,
+  kTokenization,
+  kModular,
+  kHistograms,
+  kGroups,
+};
+constexpr size_t kNumEncoderPhases = 7;
+
+// Fraction of the work of EncodeFrame that is done at the end of each phase.
+// These are rough averages over images and efforts, only meant to make the
+// reported progress increase steadily.
+static inline float PhaseEndProgress(EncoderPhase phase) {
+  static constexpr float kPhaseEnd[kNumEncoderPhases] = {
+      0.1f, 0.3f, 0.55f, 0.7f, 0.8f, 0.85f, 1.0f};
+  return kPhaseEnd[static_cast<size_t>(phase)];
+}
+
+// Relays the progress of encoding a frame to the application, and its requests
+// to abort the encoding, and measures the wall time spent in each phase. The
+// methods may be called concurrently from the threads of the pool, but the
+// callback is never called concurrently.
+class EncoderProgress {
+ public:
+  // Receives the fraction of the frame done so far, returns false to request
+  // that the encoding is aborted.
+  typedef bool (*Callback)(void* opaque, float progress);
+
+  // The callback may be null, to only measure the phase times.
+  EncoderProgress(Callback callback, void* opaque)
+      : callback_(callback), opaque_(opaque), phase_start_(Clock::now()) {}
+
+  EncoderProgress(const EncoderProgress&) = delete;
+  EncoderProgress& operator=(const EncoderProgress&) = delete;
+
+  // Reports that `phase` is done, the time since the previous report is charged
+  // to it. Returns an error if the application requested to abort, now or
+  // earlier.
+  Status Report(EncoderPhase phase);
+
+  // Starts `phase` as a parallel loop of num_tasks tasks, which report with
+  // TaskDone. The phase still ends with Report.
+  void BeginTasks(EncoderPhase phase, size_t num_tasks);
+
+  // Reports that one more task of the current phase is done.
+  void TaskDone();
+
+  // Whether the application requested to abort. Tasks should return early
+  // once this is true, the phase then fails in its final Report.
+  bool Aborted() const { return aborted_.load(std::memory_order_relaxed); }
+
+  // Wall time in seconds spent in each phase, indexed by EncoderPhase. Must not
+  // be called concurrently with Report.
+  const std::array<double, kNumEncoderPhases>& PhaseSeconds() const {
+    return phase_seconds_;
+  }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  // Calls the callback with the mutex held.
+  void Call(float progress);
+
+  const Callback callback_;
+  void* const opaque_;
+  std::atomic<bool> aborted_{false};
+  std::mutex mutex_;
+  // Progress and time at the end of the last phase, the current phase and the
+  // time spent in each phase, guarded by mutex_.
+  float progress_ = 0.0f;
+  Clock::time_point phase_start_;
+  std::array<double, kNumEncoderPhases> phase_seconds_ = {};
+  float tasks_end_ = 0.0f;
+  size_t num_tasks_ = 0;
+  size_t tasks_done_ = 0;
+};
+
+// Helpers for the optional progress of the encoder state, which may be null.
+static inline Status ReportProgress(EncoderProgress* progress,
+                                    EncoderPhase phase) {
+  if (!progress) return true;
+  return progress->Report(phase);
+}
+static inline void BeginProgressTasks(EncoderProgress* progress,
+                                      EncoderPhase phase, size_t num_tasks) {
+  if (progress) progress->BeginTasks(phase, num_tasks);
+}
+static inline bool ProgressAborted(const EncoderProgress* progress) {
+  return progress && progress->Aborted();
+}
+static inline void ProgressTaskDone(EncoderProgress* progress) {
+  if (progress) progress->TaskDone();
+}
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_ENC_PROGRESS_H_
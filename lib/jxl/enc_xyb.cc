@@ -6,7 +6,9 @@
 #include "lib/jxl/enc_xyb.h"
 
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <cmath>
 #include <cstdlib>
 
 #undef HWY_TARGET_INCLUDE
@@ -35,7 +37,11 @@ namespace jxl {
 namespace HWY_NAMESPACE {
 
 // These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Abs;
 using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::AllTrue;
+using hwy::HWY_NAMESPACE::And;
+using hwy::HWY_NAMESPACE::GatherIndex;
 using hwy::HWY_NAMESPACE::Mul;
 using hwy::HWY_NAMESPACE::MulAdd;
 using hwy::HWY_NAMESPACE::Sub;
@@ -116,6 +122,45 @@ V LinearFromSRGB(V encoded) {
   return TF_SRGB().DisplayFromEncoded(encoded);
 }
 
+// Linear values of the 8-bit sRGB levels, exact unlike the rational
+// polynomial of TF_SRGB.
+const float* SRGB8ToLinearTable() {
+  static const std::array<float, 256> table = [] {
+    std::array<float, 256> t;
+    for (size_t i = 0; i < t.size(); ++i) {
+      const double encoded = i / 255.0;
+      t[i] = static_cast<float>(
+          encoded <= 0.04045 ? encoded / 12.92
+                             : std::pow((encoded + 0.055) / 1.055, 2.4));
+    }
+    return t;
+  }();
+  return table.data();
+}
+
+// Same as LinearFromSRGB, but looks up the values in `srgb8_table` if they are
+// all 8-bit levels, as they are when the input had 8 bits per sample. The
+// levels are only exact up to the rounding of the division by 255, hence the
+// tolerance, which is far below the error of the polynomial.
+template <class V>
+V LinearFromSRGB8(V encoded, const float* JXL_RESTRICT srgb8_table) {
+  const HWY_FULL(float) d;
+  const auto scaled = Mul(encoded, Set(d, 255.0f));
+  const auto index = NearestInt(scaled);
+  const auto is_level = And(
+      Le(Abs(Sub(ConvertTo(d, index), scaled)), Set(d, 1E-3f)),
+      And(Ge(scaled, Zero(d)), Le(scaled, Set(d, 255.0f))));
+  if (!AllTrue(d, is_level)) return LinearFromSRGB(encoded);
+  return GatherIndex(d, srgb8_table, index);
+}
+
+// Decodes with LinearFromSRGB8 if `srgb8_table` is not null.
+template <class V>
+V LinearFromSRGB(V encoded, const float* JXL_RESTRICT srgb8_table) {
+  return srgb8_table ? LinearFromSRGB8(encoded, srgb8_table)
+                     : LinearFromSRGB(encoded);
+}
+
 Status LinearSRGBToXYB(const Image3F& linear,
                        const float* JXL_RESTRICT premul_absorb,
                        ThreadPool* pool, Image3F* JXL_RESTRICT xyb) {
@@ -144,8 +189,11 @@ Status LinearSRGBToXYB(const Image3F& linear,
       "LinearToXYB");
 }
 
+// `srgb8_table` is SRGB8ToLinearTable() if the input had 8 bits per sample, or
+// null.
 Status SRGBToXYB(const Image3F& srgb, const float* JXL_RESTRICT premul_absorb,
-                 ThreadPool* pool, Image3F* JXL_RESTRICT xyb) {
+                 const float* JXL_RESTRICT srgb8_table, ThreadPool* pool,
+                 Image3F* JXL_RESTRICT xyb) {
   const size_t xsize = srgb.xsize();
 
   const HWY_FULL(float) d;
@@ -161,9 +209,9 @@ Status SRGBToXYB(const Image3F& srgb, const float* JXL_RESTRICT premul_absorb,
         float* JXL_RESTRICT row_xyb2 = xyb->PlaneRow(2, y);
 
         for (size_t x = 0; x < xsize; x += Lanes(d)) {
-          const auto in_r = LinearFromSRGB(Load(d, row_srgb0 + x));
-          const auto in_g = LinearFromSRGB(Load(d, row_srgb1 + x));
-          const auto in_b = LinearFromSRGB(Load(d, row_srgb2 + x));
+          const auto in_r = LinearFromSRGB(Load(d, row_srgb0 + x), srgb8_table);
+          const auto in_g = LinearFromSRGB(Load(d, row_srgb1 + x), srgb8_table);
+          const auto in_b = LinearFromSRGB(Load(d, row_srgb2 + x), srgb8_table);
           LinearRGBToXYB(in_r, in_g, in_b, premul_absorb, row_xyb0 + x,
                          row_xyb1 + x, row_xyb2 + x);
         }
@@ -173,6 +221,7 @@ Status SRGBToXYB(const Image3F& srgb, const float* JXL_RESTRICT premul_absorb,
 
 Status SRGBToXYBAndLinear(const Image3F& srgb,
                           const float* JXL_RESTRICT premul_absorb,
+                          const float* JXL_RESTRICT srgb8_table,
                           ThreadPool* pool, Image3F* JXL_RESTRICT xyb,
                           Image3F* JXL_RESTRICT linear) {
   const size_t xsize = srgb.xsize();
@@ -195,9 +244,9 @@ Status SRGBToXYBAndLinear(const Image3F& srgb,
         float* JXL_RESTRICT row_xyb2 = xyb->PlaneRow(2, y);
 
         for (size_t x = 0; x < xsize; x += Lanes(d)) {
-          const auto in_r = LinearFromSRGB(Load(d, row_srgb0 + x));
-          const auto in_g = LinearFromSRGB(Load(d, row_srgb1 + x));
-          const auto in_b = LinearFromSRGB(Load(d, row_srgb2 + x));
+          const auto in_r = LinearFromSRGB(Load(d, row_srgb0 + x), srgb8_table);
+          const auto in_g = LinearFromSRGB(Load(d, row_srgb1 + x), srgb8_table);
+          const auto in_b = LinearFromSRGB(Load(d, row_srgb2 + x), srgb8_table);
 
           Store(in_r, d, row_linear0 + x);
           Store(in_g, d, row_linear1 + x);
@@ -298,7 +347,7 @@ void Image3FToXYB(const Image3F& in, const ColorEncoding& color_encoding,
   if (c_linear_srgb.SameColorEncoding(color_encoding)) {
     JXL_CHECK(LinearSRGBToXYB(in, premul_absorb, pool, xyb));
   } else if (color_encoding.IsSRGB()) {
-    JXL_CHECK(SRGBToXYB(in, premul_absorb, pool, xyb));
+    JXL_CHECK(SRGBToXYB(in, premul_absorb, /*srgb8_table=*/nullptr, pool, xyb));
   } else {
     Image3F linear =
         TransformToLinearRGB(in, color_encoding, intensity_target, cms, pool);
@@ -340,16 +389,21 @@ const ImageBundle* ToXYB(const ImageBundle& in, ThreadPool* pool,
 
   // Common case: already sRGB, can avoid the color transform
   if (in.IsSRGB()) {
+    const BitDepth& bit_depth = in.metadata()->bit_depth;
+    const float* srgb8_table =
+        (!bit_depth.floating_point_sample && bit_depth.bits_per_sample == 8)
+            ? SRGB8ToLinearTable()
+            : nullptr;
     // Common case: can avoid allocating/copying
     if (!want_linear) {
-      JXL_CHECK(SRGBToXYB(in.color(), premul_absorb, pool, xyb));
+      JXL_CHECK(SRGBToXYB(in.color(), premul_absorb, srgb8_table, pool, xyb));
       return &in;
     }
 
     // Slow encoder also wants linear sRGB.
     linear->SetFromImage(Image3F(xsize, ysize), c_linear_srgb);
-    JXL_CHECK(SRGBToXYBAndLinear(in.color(), premul_absorb, pool, xyb,
-                                 linear->color()));
+    JXL_CHECK(SRGBToXYBAndLinear(in.color(), premul_absorb, srgb8_table, pool,
+                                 xyb, linear->color()));
     return linear;
   }
 
@@ -435,8 +489,10 @@ Status RgbToYcbcr(const ImageF& r_plane, const ImageF& g_plane,
       }
     }
   };
+  // Vectorized, well below one nanosecond per pixel.
   return RunOnPool(pool, 0, static_cast<int>(num_stripes), ThreadPool::NoInit,
-                   transform, "RgbToYcbCr");
+                   transform, "RgbToYcbCr",
+                   /*task_cost_ns=*/lines_per_group * xsize / 4);
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -9,11 +9,15 @@
 #include <jxl/types.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <limits>
+#include <unordered_set>
 
 #include "lib/jxl/base/byte_order.h"
+#include "lib/jxl/base/cache_aligned.h"
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/codec_in_out.h"
@@ -25,6 +29,7 @@
 #include "lib/jxl/enc_file.h"
 #include "lib/jxl/enc_icc_codec.h"
 #include "lib/jxl/enc_params.h"
+#include "lib/jxl/enc_progress.h"
 #include "lib/jxl/encode_internal.h"
 #include "lib/jxl/exif.h"
 #include "lib/jxl/jpeg/enc_jpeg_data.h"
@@ -75,6 +80,9 @@ void QueueFrame(
     frame->option_values.cparams.SetLossless();
   }
 
+  // The next fast lossless frame can not be blended on this one.
+  frame_settings->enc->last_fast_lossless_frame.clear();
+
   jxl::JxlEncoderQueuedInput queued_input(frame_settings->enc->memory_manager);
   queued_input.frame = std::move(frame);
   frame_settings->enc->input_queue.emplace_back(std::move(queued_input));
@@ -269,7 +277,7 @@ JxlEncoderStatus VerifyInputBitDepth(JxlBitDepth bit_depth,
 }
 
 bool EncodeFrameIndexBox(const jxl::JxlEncoderFrameIndexBox& frame_index_box,
-                         jxl::BitWriter& writer) {
+                         std::vector<uint8_t>* contents) {
   bool ok = true;
   int NF = 0;
   for (size_t i = 0; i < frame_index_box.entries.size(); ++i) {
@@ -294,59 +302,615 @@ bool EncodeFrameIndexBox(const jxl::JxlEncoderFrameIndexBox& frame_index_box,
   output_pos += 4;
   StoreBE32(frame_index_box.TDEN, &buffer[output_pos]);
   output_pos += 4;
-  // When we record a frame in the index, the record needs to know
-  // how many frames until the next indexed frame. That is why
-  // we store the 'prev' record. That 'prev' record needs to store
-  // the offset byte position to previously recorded indexed frame,
-  // that's why we also trace previous to the previous frame.
-  int prev_prev_ix = -1;  // For position offset (OFFi) delta coding.
-  int prev_ix = 0;
-  int T_prev = 0;
-  int T = 0;
-  for (size_t i = 1; i < frame_index_box.entries.size(); ++i) {
-    if (frame_index_box.entries[i].to_be_indexed) {
-      // Now we can record the previous entry, since we need to store
-      // there how many frames until the next one.
-      int64_t OFFi = frame_index_box.entries[prev_ix].OFFi;
-      if (prev_prev_ix != -1) {
-        // Offi needs to be offset of start byte of this frame compared to start
-        // byte of previous frame from this index in the JPEG XL codestream. For
-        // the first frame, this is the offset from the first byte of the JPEG
-        // XL codestream.
-        OFFi -= frame_index_box.entries[prev_prev_ix].OFFi;
-      }
-      int32_t Ti = T_prev;
-      int32_t Fi = i - prev_ix;
+  // When we record a frame in the index, the record needs to know the
+  // duration and how many displayed frames there are until the next indexed
+  // frame. That is why each record is only written once the next indexed
+  // frame, or the end of the frames, is reached. OFFi is delta coded against
+  // the previous indexed frame.
+  size_t prev_ix = 0;
+  uint64_t prev_OFFi = 0;
+  uint64_t T = 0;
+  uint64_t F = 0;
+  for (size_t i = 0; i <= frame_index_box.entries.size(); ++i) {
+    if (i == frame_index_box.entries.size() ||
+        (i > 0 && frame_index_box.entries[i].to_be_indexed)) {
+      uint64_t OFFi = frame_index_box.entries[prev_ix].OFFi - prev_OFFi;
       ok &= jxl::EncodeVarInt(OFFi, buffer_vec.size(), &output_pos, buffer);
-      ok &= jxl::EncodeVarInt(Ti, buffer_vec.size(), &output_pos, buffer);
-      ok &= jxl::EncodeVarInt(Fi, buffer_vec.size(), &output_pos, buffer);
-      prev_prev_ix = prev_ix;
+      ok &= jxl::EncodeVarInt(T, buffer_vec.size(), &output_pos, buffer);
+      ok &= jxl::EncodeVarInt(F, buffer_vec.size(), &output_pos, buffer);
+      prev_OFFi = frame_index_box.entries[prev_ix].OFFi;
       prev_ix = i;
-      T_prev = T;
-      T += frame_index_box.entries[i].duration;
+      T = 0;
+      F = 0;
     }
-  }
-  {
-    // Last frame.
-    size_t i = frame_index_box.entries.size();
-    int64_t OFFi = frame_index_box.entries[prev_ix].OFFi;
-    if (prev_prev_ix != -1) {
-      OFFi -= frame_index_box.entries[prev_prev_ix].OFFi;
+    if (i < frame_index_box.entries.size()) {
+      T += frame_index_box.entries[i].duration;
+      if (frame_index_box.entries[i].displayed) ++F;
     }
-    int32_t Ti = T_prev;
-    int32_t Fi = i - prev_ix;
-    ok &= jxl::EncodeVarInt(OFFi, buffer_vec.size(), &output_pos, buffer);
-    ok &= jxl::EncodeVarInt(Ti, buffer_vec.size(), &output_pos, buffer);
-    ok &= jxl::EncodeVarInt(Fi, buffer_vec.size(), &output_pos, buffer);
   }
   // Enough buffer has been allocated, this function should never fail in
   // writing.
   JXL_ASSERT(ok);
+  buffer_vec.resize(output_pos);
+  *contents = std::move(buffer_vec);
   return ok;
 }
 
+// Rough estimates of the working set of EncodeFrame, used to decide which
+// optional passes fit in the memory limit of a frame.
+// Input planes, XYB copy, quantization field, AC strategy and coefficients.
+constexpr uint64_t kVarDctBytesPerPixel = 64;
+// Roundtrip decoded image and butteraugli comparator state.
+constexpr uint64_t kButteraugliBytesPerPixel = 128;
+// Copy of the pixels in the screenshot areas searched for patches.
+constexpr uint64_t kPatchesBytesPerPixel = 16;
+// Modular channel and tokens.
+constexpr uint64_t kModularBytesPerSample = 16;
+// Properties of a pixel sample for MA tree learning.
+constexpr uint64_t kTreeSampleBytes = 64;
+// Never go below this tree learning fraction, lossy modular needs samples.
+constexpr float kMinTreeSamplesFraction = 0.01f;
+
+// Drops optional full-image passes from the cparams of the frame until its
+// estimated working set fits in the memory limit of its settings.
+void ApplyMemoryLimit(const JxlEncoderStruct* enc,
+                      jxl::JxlEncoderQueuedFrame* input_frame) {
+  if (input_frame->option_values.memory_limit < 0) return;
+  const uint64_t limit = input_frame->option_values.memory_limit;
+  jxl::CompressParams& cparams = input_frame->option_values.cparams;
+  const uint64_t pixels = static_cast<uint64_t>(input_frame->frame.xsize()) *
+                          input_frame->frame.ysize();
+  const uint64_t samples = pixels * (3 + enc->metadata.m.num_extra_channels);
+  const bool modular = cparams.modular_mode;
+
+  uint64_t estimate = samples * (sizeof(float) + kModularBytesPerSample);
+  if (!modular) estimate += pixels * kVarDctBytesPerPixel;
+
+  const bool butteraugli = !modular && cparams.max_butteraugli_iters > 0 &&
+                           cparams.speed_tier <= jxl::SpeedTier::kKitten;
+  const uint64_t butteraugli_bytes =
+      butteraugli ? pixels * kButteraugliBytesPerPixel : 0;
+  const uint64_t patches_bytes =
+      cparams.patches != jxl::Override::kOff ? pixels * kPatchesBytesPerPixel
+                                             : 0;
+  const uint64_t tree_bytes =
+      modular ? static_cast<uint64_t>(samples * cparams.options.nb_repeats) *
+                    kTreeSampleBytes
+              : 0;
+
+  if (estimate + butteraugli_bytes + patches_bytes + tree_bytes <= limit) {
+    return;
+  }
+  if (butteraugli_bytes > 0) {
+    cparams.max_butteraugli_iters = 0;
+  }
+  if (estimate + patches_bytes + tree_bytes <= limit) return;
+  if (patches_bytes > 0) {
+    cparams.patches = jxl::Override::kOff;
+  }
+  if (estimate + tree_bytes <= limit) return;
+  if (tree_bytes > 0) {
+    const uint64_t available = limit > estimate ? limit - estimate : 0;
+    cparams.options.nb_repeats = std::max(
+        kMinTreeSamplesFraction, cparams.options.nb_repeats *
+                                     static_cast<float>(available) / tree_bytes);
+  }
+}
+
+// Rough single-threaded encoding times in nanoseconds per pixel, used to decide
+// which encoder passes fit in the time budget of a frame. Indexed by
+// SpeedTier, without the passes that ApplyTimeBudget adjusts separately.
+constexpr uint64_t kVarDctNanosPerPixel[10] = {500, 500, 400, 400, 250,
+                                               150, 80,  40,  20,  15};
+constexpr uint64_t kModularNanosPerPixel[10] = {4000, 1500, 800, 500, 300,
+                                                200,  120,  60,  30,  10};
+// One iteration of the butteraugli loop of FindBestQuantization.
+constexpr uint64_t kButteraugliNanosPerPixel = 300;
+// Patch detection.
+constexpr uint64_t kPatchesNanosPerPixel = 20;
+// MA tree learning, per sampled pixel.
+constexpr uint64_t kTreeSampleNanos = 400;
+
+// Chooses the slowest speed tier, up to the one of the effort setting, whose
+// estimated encoding time fits in the time budget of the frame, then spends
+// what is left of the budget on the optional passes, in the order of their
+// expected gain per time: patches, tree learning samples and butteraugli
+// iterations.
+void ApplyTimeBudget(const JxlEncoderStruct* enc,
+                     jxl::JxlEncoderQueuedFrame* input_frame) {
+  if (input_frame->option_values.time_budget < 0) return;
+  // In nanoseconds, saturated at about 290 years.
+  const uint64_t budget = std::min<uint64_t>(
+      input_frame->option_values.time_budget, uint64_t{1} << 43) * 1000000;
+  jxl::CompressParams& cparams = input_frame->option_values.cparams;
+  const uint64_t pixels = static_cast<uint64_t>(input_frame->frame.xsize()) *
+                          input_frame->frame.ysize();
+  const uint64_t samples = pixels * (3 + enc->metadata.m.num_extra_channels);
+  const bool modular = cparams.modular_mode;
+  const uint64_t* nanos_per_pixel =
+      modular ? kModularNanosPerPixel : kVarDctNanosPerPixel;
+  const auto learns_tree = [&](jxl::SpeedTier tier) {
+    return modular && tier < jxl::SpeedTier::kFalcon;
+  };
+  const auto tree_nanos = [&](float fraction) {
+    return static_cast<uint64_t>(samples * fraction) * kTreeSampleNanos;
+  };
+
+  int tier = static_cast<int>(cparams.speed_tier);
+  for (; tier < static_cast<int>(jxl::SpeedTier::kLightning); tier++) {
+    uint64_t needed = pixels * nanos_per_pixel[tier];
+    if (learns_tree(static_cast<jxl::SpeedTier>(tier))) {
+      needed += tree_nanos(kMinTreeSamplesFraction);
+    }
+    if (needed <= budget) break;
+  }
+  cparams.speed_tier = static_cast<jxl::SpeedTier>(tier);
+  const uint64_t spent = pixels * nanos_per_pixel[tier];
+  uint64_t left = budget > spent ? budget - spent : 0;
+
+  if (cparams.patches != jxl::Override::kOff &&
+      cparams.speed_tier <= jxl::SpeedTier::kSquirrel) {
+    const uint64_t patches_nanos = pixels * kPatchesNanosPerPixel;
+    if (patches_nanos <= left) {
+      left -= patches_nanos;
+    } else {
+      cparams.patches = jxl::Override::kOff;
+    }
+  }
+  if (learns_tree(cparams.speed_tier)) {
+    const uint64_t wanted = tree_nanos(cparams.options.nb_repeats);
+    if (wanted > left) {
+      cparams.options.nb_repeats = std::max(
+          kMinTreeSamplesFraction,
+          cparams.options.nb_repeats * static_cast<float>(left) / wanted);
+    }
+    const uint64_t used = tree_nanos(cparams.options.nb_repeats);
+    left = left > used ? left - used : 0;
+  }
+  if (!modular && cparams.speed_tier <= jxl::SpeedTier::kKitten) {
+    const uint64_t iters = left / std::max<uint64_t>(
+                                      1, pixels * kButteraugliNanosPerPixel);
+    cparams.max_butteraugli_iters = static_cast<int>(std::min<uint64_t>(
+        cparams.max_butteraugli_iters, iters));
+  }
+}
+
+// Upper bound for the number of pixels sampled by ApplyAutoEffort.
+constexpr size_t kAutoEffortMaxSamples = 1 << 16;
+// Frames with at most this many distinct sampled colors are screen content.
+constexpr size_t kAutoEffortMaxColors = 256;
+// Frames with a larger fraction of samples equal to their right neighbour are
+// screen content.
+constexpr float kAutoEffortFlatFraction = 0.5f;
+
+// Samples the color channels of the frame on a regular grid and returns
+// whether it looks like screen content, i.e. has few distinct colors or large
+// flat areas.
+bool IsScreenContent(const jxl::ImageBundle& ib) {
+  const jxl::Image3F& color = ib.color();
+  const size_t xsize = color.xsize();
+  const size_t ysize = color.ysize();
+  if (xsize < 2 || ysize == 0) return false;
+  size_t step = 1;
+  while ((xsize / step) * (ysize / step) > kAutoEffortMaxSamples) step++;
+  std::unordered_set<uint32_t> colors;
+  size_t samples = 0;
+  size_t flat = 0;
+  const auto quantize = [](float v) {
+    return static_cast<uint32_t>(std::min(std::max(v, 0.0f), 1.0f) * 255 +
+                                 0.5f);
+  };
+  for (size_t y = 0; y < ysize; y += step) {
+    const float* JXL_RESTRICT rows[3] = {color.ConstPlaneRow(0, y),
+                                         color.ConstPlaneRow(1, y),
+                                         color.ConstPlaneRow(2, y)};
+    for (size_t x = 0; x + 1 < xsize; x += step) {
+      uint32_t key = 0;
+      bool same = true;
+      for (size_t c = 0; c < 3; c++) {
+        const uint32_t v = quantize(rows[c][x]);
+        key = (key << 8) | v;
+        same &= v == quantize(rows[c][x + 1]);
+      }
+      if (colors.size() <= kAutoEffortMaxColors) colors.insert(key);
+      flat += same;
+      samples++;
+    }
+  }
+  return colors.size() <= kAutoEffortMaxColors ||
+         flat > kAutoEffortFlatFraction * samples;
+}
+
+// Chooses the optional passes that the frame settings left at their default
+// from the content of the frame: patches pay off for screen content, while
+// butteraugli iterations and dots detection only help photographic content.
+void ApplyAutoEffort(jxl::JxlEncoderQueuedFrame* input_frame) {
+  if (!input_frame->option_values.auto_effort) return;
+  const jxl::ImageBundle& ib = input_frame->frame;
+  if (ib.IsJPEG() || !ib.HasColor()) return;
+  jxl::CompressParams& cparams = input_frame->option_values.cparams;
+  const bool screen_content = IsScreenContent(ib);
+  if (cparams.patches == jxl::Override::kDefault) {
+    cparams.patches = screen_content ? jxl::Override::kOn : jxl::Override::kOff;
+  }
+  if (!screen_content) return;
+  if (cparams.dots == jxl::Override::kDefault) {
+    cparams.dots = jxl::Override::kOff;
+  }
+  cparams.max_butteraugli_iters = 0;
+}
+
+// Copies the frame settings into the ImageBundle and cparams of a queued
+// frame, since EncodeFrame creates the jxl::FrameHeader object internally based
+// on those.
+void PrepareQueuedFrame(const JxlEncoderStruct* enc,
+                        jxl::JxlEncoderQueuedFrame* input_frame) {
+  // TODO(zond): Handle progressive mode like EncodeFile does it.
+  if (enc->metadata.m.xyb_encoded) {
+    input_frame->option_values.cparams.color_transform =
+        jxl::ColorTransform::kXYB;
+  } else {
+    // TODO(zond): Figure out when to use kYCbCr instead.
+    input_frame->option_values.cparams.color_transform =
+        jxl::ColorTransform::kNone;
+  }
+  if (!enc->multi_rate_distances.empty()) {
+    if (!input_frame->option_values.lossless) {
+      input_frame->option_values.cparams.butteraugli_distance =
+          enc->multi_rate_distances[enc->multi_rate_output];
+    }
+    if (enc->multi_rate_distances.size() > 1 && !input_frame->color_cache) {
+      input_frame->color_cache = jxl::make_unique<jxl::FrameColorCache>();
+    }
+  }
+  ApplyAutoEffort(input_frame);
+  ApplyTimeBudget(enc, input_frame);
+  ApplyMemoryLimit(enc, input_frame);
+
+  jxl::ImageBundle& ib = input_frame->frame;
+  if (enc->metadata.m.have_animation) {
+    ib.duration = input_frame->option_values.header.duration;
+    ib.timecode = input_frame->option_values.header.timecode;
+  } else {
+    // If have_animation is false, the encoder should ignore the duration and
+    // timecode values. However, assigning them to ib will cause the encoder
+    // to write an invalid frame header that can't be decoded so ensure
+    // they're the default value of 0 here.
+    ib.duration = 0;
+    ib.timecode = 0;
+  }
+  ib.name = input_frame->option_values.frame_name;
+  ib.blendmode = static_cast<jxl::BlendMode>(
+      input_frame->option_values.header.layer_info.blend_info.blendmode);
+  ib.blend = input_frame->option_values.header.layer_info.blend_info.blendmode !=
+             JXL_BLEND_REPLACE;
+  ib.use_for_next_frame =
+      !!input_frame->option_values.header.layer_info.save_as_reference;
+
+  if (input_frame->option_values.header.layer_info.have_crop) {
+    ib.origin.x0 = input_frame->option_values.header.layer_info.crop_x0;
+    ib.origin.y0 = input_frame->option_values.header.layer_info.crop_y0;
+  }
+}
+
+void GetQueuedFrameInfo(const JxlEncoderStruct* enc, bool last_frame,
+                        const jxl::JxlEncoderQueuedFrame& input_frame,
+                        jxl::FrameInfo* frame_info) {
+  const JxlLayerInfo& layer_info = input_frame.option_values.header.layer_info;
+  frame_info->is_last = last_frame;
+  frame_info->save_as_reference = layer_info.save_as_reference;
+  frame_info->source = layer_info.blend_info.source;
+  frame_info->clamp = layer_info.blend_info.clamp;
+  frame_info->alpha_channel = layer_info.blend_info.alpha;
+  frame_info->extra_channel_blending_info.resize(
+      enc->metadata.m.num_extra_channels);
+  // If extra channel blend info has not been set, use the blend mode from
+  // the layer_info.
+  const JxlBlendInfo& default_blend_info = layer_info.blend_info;
+  for (size_t i = 0; i < enc->metadata.m.num_extra_channels; ++i) {
+    auto& to = frame_info->extra_channel_blending_info[i];
+    const auto& from =
+        i < input_frame.option_values.extra_channel_blend_info.size()
+            ? input_frame.option_values.extra_channel_blend_info[i]
+            : default_blend_info;
+    to.mode = static_cast<jxl::BlendMode>(from.blendmode);
+    to.source = from.source;
+    to.alpha_channel = from.alpha;
+    to.clamp = (from.clamp != 0);
+  }
+}
+
+bool CallProgressCallback(void* opaque, float progress) {
+  const JxlEncoderStruct* enc = static_cast<const JxlEncoderStruct*>(opaque);
+  return enc->progress_callback(enc->progress_opaque, progress) != JXL_FALSE;
+}
+
+// Frames at most this large are encoded concurrently with the other frames
+// queued after them, since they have too few groups to keep a thread pool busy
+// on their own.
+constexpr size_t kMaxConcurrentFramePixels = 4 * jxl::kGroupDim * jxl::kGroupDim;
+// Upper bound on the number of frames encoded concurrently, which bounds the
+// memory held by the encoded but not yet written frames.
+constexpr size_t kMaxConcurrentFrames = 16;
+
+bool CanEncodeConcurrently(const jxl::JxlEncoderQueuedFrame& frame) {
+  if (frame.encoded) return false;
+  // The statistics are gathered frame by frame.
+  if (frame.option_values.stats) return false;
+  // Each frame reuses the heuristics of the previous one.
+  if (frame.option_values.cparams.temporal_reuse) return false;
+  // Each frame is cropped against the previous one.
+  if (frame.option_values.auto_crop) return false;
+  // Each frame uses the patches of the previous ones.
+  if (frame.option_values.cparams.persistent_patches) return false;
+  for (uint8_t initialized : frame.ec_initialized) {
+    if (!initialized) return false;
+  }
+  return frame.frame.xsize() * frame.frame.ysize() <= kMaxConcurrentFramePixels;
+}
+
+}  // namespace
+
+jxl::Status JxlEncoderStruct::EncodeQueuedFramesConcurrently() {
+  std::vector<jxl::JxlEncoderQueuedFrame*> frames;
+  std::vector<jxl::FrameInfo> frame_infos;
+  size_t frames_seen = 0;
+  for (const jxl::JxlEncoderQueuedInput& input : input_queue) {
+    if (frames.size() >= kMaxConcurrentFrames) break;
+    if (input.box) continue;
+    ++frames_seen;
+    // Fast lossless frames are already encoded when they are added.
+    if (input.fast_lossless_frame) continue;
+    if (!CanEncodeConcurrently(*input.frame)) break;
+    // Whether this frame ends up being the last one is only known once
+    // JxlEncoderCloseFrames was called or a later frame is queued.
+    bool last_frame = num_queued_frames == frames_seen;
+    if (last_frame && !frames_closed) break;
+    PrepareQueuedFrame(this, input.frame.get());
+    frame_infos.emplace_back();
+    GetQueuedFrameInfo(this, last_frame, *input.frame, &frame_infos.back());
+    frames.push_back(input.frame.get());
+  }
+  if (frames.size() < 2) return true;
+
+  // Each frame gets its own PassesEncoderState (as in the sequential path), so
+  // the frames don't depend on each other's encoder state and the frame
+  // headers only refer to reference frames through the decoder.
+  std::atomic<bool> has_error{false};
+  const auto encode_frame = [&](const uint32_t i, size_t /*thread*/) {
+    jxl::PassesEncoderState enc_state;
+    enc_state.color_cache = frames[i]->color_cache.get();
+    jxl::BitWriter writer;
+    writer.KeepSections();
+    if (!jxl::EncodeFrame(frames[i]->option_values.cparams, frame_infos[i],
+                          &metadata, frames[i]->frame, &enc_state, cms,
+                          /*pool=*/nullptr, &writer, /*aux_out=*/nullptr)) {
+      has_error = true;
+      return;
+    }
+    frames[i]->encoded_sections = std::move(writer).TakeSections();
+    frames[i]->encoded = true;
+  };
+  JXL_RETURN_IF_ERROR(jxl::RunOnPool(thread_pool.get(), 0, frames.size(),
+                                     jxl::ThreadPool::NoInit, encode_frame,
+                                     "EncodeQueuedFrames"));
+  if (has_error) return JXL_FAILURE("Failed to encode queued frames");
+  return true;
+}
+
+jxl::Status JxlEncoderStruct::CompressQueuedBoxes() {
+  std::vector<jxl::JxlEncoderQueuedBox*> boxes;
+  for (jxl::JxlEncoderQueuedInput& input : input_queue) {
+    if (input.box && input.box->compress_box && input.box->compressed.empty()) {
+      boxes.push_back(input.box.get());
+    }
+  }
+  const int quality = brotli_effort >= 0 ? brotli_effort : 4;
+  std::atomic<bool> has_error{false};
+  const auto compress_box = [&](const uint32_t i, size_t /*thread*/) {
+    jxl::JxlEncoderQueuedBox* box = boxes[i];
+    jxl::PaddedBytes compressed(4);
+    // Prepend the original box type in the brob box contents
+    for (size_t c = 0; c < 4; c++) {
+      compressed[c] = static_cast<uint8_t>(box->type[c]);
+    }
+    if (JXL_ENC_SUCCESS != BrotliCompress(quality, box->contents.data(),
+                                          box->contents.size(), &compressed)) {
+      has_error = true;
+      return;
+    }
+    box->compressed = std::move(compressed);
+  };
+  JXL_RETURN_IF_ERROR(jxl::RunOnPool(thread_pool.get(), 0, boxes.size(),
+                                     jxl::ThreadPool::NoInit, compress_box,
+                                     "CompressQueuedBoxes"));
+  if (has_error) return JXL_FAILURE("Failed to compress queued boxes");
+  return true;
+}
+
+namespace {
+
+// Reference slot holding the canvas which auto-cropped frames are blended
+// onto. Slot 0 is used by the patch dictionaries.
+constexpr uint32_t kAutoCropReference = 1;
+
+// Returns whether the frame uses and extends the patches kept from the
+// previous frames.
+bool UsesPersistentPatches(const JxlEncoderStruct* enc,
+                           const jxl::JxlEncoderQueuedFrame& frame) {
+  const jxl::JxlEncoderFrameSettingsValues& values = frame.option_values;
+  if (!values.cparams.persistent_patches) return false;
+  // Each codestream of a multi-rate encoding starts without reference frames.
+  if (!enc->multi_rate_distances.empty()) return false;
+  // Indexed frames must be keyframes.
+  return !values.frame_index_box;
+}
+
+bool CanAutoCrop(const JxlEncoderStruct* enc,
+                 const jxl::JxlEncoderQueuedFrame& frame) {
+  const jxl::JxlEncoderFrameSettingsValues& values = frame.option_values;
+  if (!values.auto_crop || !enc->metadata.m.have_animation) return false;
+  // The next codestreams of a multi-rate encoding need the uncropped frames.
+  if (!enc->multi_rate_distances.empty()) return false;
+  // Indexed frames must be keyframes.
+  if (values.frame_index_box) return false;
+  if (frame.frame.IsJPEG() || values.cparams.already_downsampled) return false;
+  if (values.cparams.resampling != 1 || values.cparams.ec_resampling != 1) {
+    return false;
+  }
+  // Only frames that replace the whole canvas are cropped, the others already
+  // depend on the previous frames.
+  const JxlLayerInfo& layer_info = values.header.layer_info;
+  if (layer_info.have_crop || layer_info.save_as_reference != 0 ||
+      layer_info.blend_info.blendmode != JXL_BLEND_REPLACE) {
+    return false;
+  }
+  for (const JxlBlendInfo& blend_info : values.extra_channel_blend_info) {
+    if (blend_info.blendmode != JXL_BLEND_REPLACE) return false;
+  }
+  return frame.frame.xsize() == enc->metadata.xsize() &&
+         frame.frame.ysize() == enc->metadata.ysize();
+}
+
+// Returns the smallest rect containing the pixels in which the color or an
+// extra channel of `a` and `b` differ, or an empty rect.
+jxl::Rect ChangedRect(const jxl::ImageBundle& a, const jxl::ImageBundle& b) {
+  size_t x0 = a.xsize();
+  size_t x1 = 0;
+  size_t y0 = a.ysize();
+  size_t y1 = 0;
+  const auto update = [&](const jxl::ImageF& plane_a,
+                          const jxl::ImageF& plane_b) {
+    for (size_t y = 0; y < plane_a.ysize(); y++) {
+      const float* JXL_RESTRICT row_a = plane_a.ConstRow(y);
+      const float* JXL_RESTRICT row_b = plane_b.ConstRow(y);
+      size_t first = 0;
+      while (first < plane_a.xsize() && row_a[first] == row_b[first]) ++first;
+      if (first == plane_a.xsize()) continue;
+      size_t last = plane_a.xsize() - 1;
+      while (row_a[last] == row_b[last]) --last;
+      x0 = std::min(x0, first);
+      x1 = std::max(x1, last + 1);
+      y0 = std::min(y0, y);
+      y1 = std::max(y1, y + 1);
+    }
+  };
+  for (size_t c = 0; c < 3; c++) {
+    update(a.color().Plane(c), b.color().Plane(c));
+  }
+  for (size_t i = 0; i < a.extra_channels().size(); i++) {
+    update(a.extra_channels()[i], b.extra_channels()[i]);
+  }
+  if (x1 <= x0 || y1 <= y0) return jxl::Rect();
+  return jxl::Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
 }  // namespace
 
+void JxlEncoderStruct::AutoCropFrame(jxl::JxlEncoderQueuedFrame* input_frame,
+                                     bool last_frame) {
+  if (!CanAutoCrop(this, *input_frame)) {
+    // The canvas is no longer known to be in the reference slot.
+    plane_pool.Retain(&auto_crop_canvas);
+    auto_crop_canvas = jxl::ImageBundle();
+    return;
+  }
+  jxl::ImageBundle& ib = input_frame->frame;
+  JxlLayerInfo& layer_info = input_frame->option_values.header.layer_info;
+  const bool have_canvas =
+      auto_crop_canvas.HasColor() && jxl::SameSize(auto_crop_canvas, ib) &&
+      auto_crop_canvas.extra_channels().size() == ib.extra_channels().size();
+  jxl::Rect rect;
+  if (have_canvas) {
+    rect = ChangedRect(auto_crop_canvas, ib);
+    // Frames cannot be empty: keep a pixel, it is the same as in the canvas.
+    if (rect.xsize() == 0) rect = jxl::Rect(0, 0, 1, 1);
+  }
+
+  // The uncropped input is the canvas of the next frame.
+  jxl::ImageBundle canvas;
+  if (have_canvas) {
+    // Move the full-size planes to the canvas and only copy the crop.
+    canvas = jxl::ImageBundle(ib.metadata());
+    canvas.SetFromImage(std::move(*ib.color()), ib.c_current());
+    std::vector<jxl::ImageF> extra_channels = std::move(ib.extra_channels());
+    ib.ClearExtraChannels();
+    if (!extra_channels.empty()) {
+      canvas.SetExtraChannels(std::move(extra_channels));
+    }
+    extra_channels.clear();
+    jxl::Image3F color(rect.xsize(), rect.ysize());
+    jxl::CopyImageTo(rect, *canvas.color(), jxl::Rect(color), &color);
+    for (const jxl::ImageF& plane : canvas.extra_channels()) {
+      extra_channels.emplace_back(rect.xsize(), rect.ysize());
+      jxl::CopyImageTo(rect, plane, jxl::Rect(extra_channels.back()),
+                       &extra_channels.back());
+    }
+    ib.SetFromImage(std::move(color), canvas.c_current());
+    if (!extra_channels.empty()) ib.SetExtraChannels(std::move(extra_channels));
+
+    layer_info.have_crop = JXL_TRUE;
+    layer_info.crop_x0 = rect.x0();
+    layer_info.crop_y0 = rect.y0();
+    layer_info.xsize = rect.xsize();
+    layer_info.ysize = rect.ysize();
+    layer_info.blend_info.source = kAutoCropReference;
+    for (JxlBlendInfo& blend_info :
+         input_frame->option_values.extra_channel_blend_info) {
+      blend_info.source = kAutoCropReference;
+    }
+    ib.origin.x0 = rect.x0();
+    ib.origin.y0 = rect.y0();
+  } else if (!last_frame) {
+    canvas = ib.Copy();
+  }
+  plane_pool.Retain(&auto_crop_canvas);
+  if (last_frame) {
+    auto_crop_canvas = jxl::ImageBundle();
+    plane_pool.Retain(&canvas);
+  } else {
+    layer_info.save_as_reference = kAutoCropReference;
+    ib.use_for_next_frame = true;
+    auto_crop_canvas = std::move(canvas);
+  }
+}
+
+void JxlEncoderStruct::MergeRepeatedFrames(
+    jxl::JxlEncoderQueuedFrame* input_frame) {
+  if (!CanAutoCrop(this, *input_frame) || metadata.m.animation.have_timecodes) {
+    return;
+  }
+  const jxl::ImageBundle& ib = input_frame->frame;
+  uint32_t& duration = input_frame->option_values.header.duration;
+  while (input_queue.size() > 1 && input_queue[1].frame) {
+    // The last queued frame may still get its extra channels until the frames
+    // are closed.
+    if (num_queued_frames == 2 && !frames_closed) break;
+    const jxl::JxlEncoderQueuedFrame& next = *input_queue[1].frame;
+    if (next.encoded || !CanAutoCrop(this, next) ||
+        !next.option_values.frame_name.empty()) {
+      break;
+    }
+    if (std::find(next.ec_initialized.begin(), next.ec_initialized.end(), 0) !=
+        next.ec_initialized.end()) {
+      break;
+    }
+    const uint32_t next_duration = next.option_values.header.duration;
+    if (next_duration > std::numeric_limits<uint32_t>::max() - duration) break;
+    const jxl::ImageBundle& next_ib = next.frame;
+    if (!jxl::SameSize(ib, next_ib) ||
+        ib.extra_channels().size() != next_ib.extra_channels().size() ||
+        !ib.c_current().SameColorEncoding(next_ib.c_current()) ||
+        ChangedRect(ib, next_ib).xsize() != 0) {
+      break;
+    }
+    duration += next_duration;
+    plane_pool.Retain(&input_queue[1].frame->frame);
+    input_queue.erase(input_queue.begin() + 1);
+    num_queued_frames--;
+  }
+}
+
 JxlEncoderStatus JxlEncoderStruct::RefillOutputByteQueue() {
   jxl::PaddedBytes bytes;
 
@@ -409,16 +973,19 @@ JxlEncoderStatus JxlEncoderStruct::RefillOutputByteQueue() {
 
     if (MustUseContainer()) {
       // Add "JXL " and ftyp box.
-      output_byte_queue.insert(
-          output_byte_queue.end(), jxl::kContainerHeader,
+      std::vector<uint8_t> header(
+          jxl::kContainerHeader,
           jxl::kContainerHeader + sizeof(jxl::kContainerHeader));
       if (codestream_level != 5) {
         // Add jxll box directly after the ftyp box to indicate the codestream
         // level.
-        output_byte_queue.insert(
-            output_byte_queue.end(), jxl::kLevelBoxHeader,
-            jxl::kLevelBoxHeader + sizeof(jxl::kLevelBoxHeader));
-        output_byte_queue.push_back(codestream_level);
+        header.insert(header.end(), jxl::kLevelBoxHeader,
+                      jxl::kLevelBoxHeader + sizeof(jxl::kLevelBoxHeader));
+        header.push_back(codestream_level);
+      }
+      if (!output_processor.Append(header)) {
+        return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
+                             "Failed to write output");
       }
 
       // Whether to write the basic info and color profile header of the
@@ -432,28 +999,46 @@ JxlEncoderStatus JxlEncoderStruct::RefillOutputByteQueue() {
           (use_boxes && (!input.frame && !input.fast_lossless_frame));
 
       if (partial_header) {
+        std::vector<uint8_t> box_header;
         jxl::AppendBoxHeader(jxl::MakeBoxType("jxlp"), bytes.size() + 4,
-                             /*unbounded=*/false, &output_byte_queue);
-        AppendJxlpBoxCounter(jxlp_counter++, /*last=*/false,
-                             &output_byte_queue);
-        output_byte_queue.insert(output_byte_queue.end(), bytes.data(),
-                                 bytes.data() + bytes.size());
+                             /*unbounded=*/false, &box_header);
+        AppendJxlpBoxCounter(jxlp_counter++, /*last=*/false, &box_header);
+        if (!output_processor.Append(box_header) ||
+            !output_processor.Append(std::move(bytes))) {
+          return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
+                               "Failed to write output");
+        }
         bytes.clear();
       }
 
       if (store_jpeg_metadata && !jpeg_metadata.empty()) {
-        jxl::AppendBoxHeader(jxl::MakeBoxType("jbrd"), jpeg_metadata.size(),
-                             false, &output_byte_queue);
-        output_byte_queue.insert(output_byte_queue.end(), jpeg_metadata.begin(),
-                                 jpeg_metadata.end());
+        if (!AppendBoxHeader(jxl::MakeBoxType("jbrd"), jpeg_metadata.size(),
+                             false) ||
+            !output_processor.Append(jpeg_metadata)) {
+          return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
+                               "Failed to write output");
+        }
       }
     }
+    output_processor.SetFinalizedPosition();
     wrote_bytes = true;
   }
 
   // Choose frame or box processing: exactly one of the two unique pointers (box
   // or frame) in the input queue item is non-null.
   if (input.frame || input.fast_lossless_frame) {
+    if (input.frame && !input.frame->encoded) {
+      MergeRepeatedFrames(input.frame.get());
+    }
+    // The progress callback must not be called concurrently, so frames are
+    // only encoded concurrently without it.
+    if (input.frame && !input.frame->encoded && thread_pool &&
+        !progress_callback) {
+      if (!EncodeQueuedFramesConcurrently()) {
+        return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
+                             "Failed to encode frame");
+      }
+    }
     jxl::MemoryManagerUniquePtr<jxl::JxlEncoderQueuedFrame> input_frame =
         std::move(input.frame);
     if (input.fast_lossless_frame) {
@@ -469,116 +1054,87 @@ JxlEncoderStatus JxlEncoderStruct::RefillOutputByteQueue() {
         }
       }
 
-      // TODO(zond): If the input queue is empty and the frames_closed is true,
-      // then mark this frame as the last.
-
-      // TODO(zond): Handle progressive mode like EncodeFile does it.
-      // TODO(zond): Handle animation like EncodeFile does it, by checking if
-      //             JxlEncoderCloseFrames has been called and if the frame
-      //             queue is empty (to see if it's the last animation frame).
-
-      if (metadata.m.xyb_encoded) {
-        input_frame->option_values.cparams.color_transform =
-            jxl::ColorTransform::kXYB;
-      } else {
-        // TODO(zond): Figure out when to use kYCbCr instead.
-        input_frame->option_values.cparams.color_transform =
-            jxl::ColorTransform::kNone;
+      if (!input_frame->encoded) {
+        // The frame may have been encoded ahead of time together with the
+        // frames queued after it, in which case it was prepared already.
+        PrepareQueuedFrame(this, input_frame.get());
       }
     }
 
-    uint32_t duration;
-    uint32_t timecode;
-    if (input_frame && metadata.m.have_animation) {
-      duration = input_frame->option_values.header.duration;
-      timecode = input_frame->option_values.header.timecode;
-    } else {
-      // If have_animation is false, the encoder should ignore the duration and
-      // timecode values. However, assigning them to ib will cause the encoder
-      // to write an invalid frame header that can't be decoded so ensure
-      // they're the default value of 0 here.
-      duration = 0;
-      timecode = 0;
-    }
+    uint32_t duration = input_frame ? input_frame->frame.duration : 0;
 
     bool last_frame = frames_closed && !num_queued_frames;
+    if (input_frame && !input_frame->encoded) {
+      AutoCropFrame(input_frame.get(), last_frame);
+    }
+    // A frame saved in the slot of the patches kept by the previous frames
+    // replaces them.
+    if (input_frame &&
+        input_frame->option_values.header.layer_info.save_as_reference ==
+            jxl::kPersistentPatchReference) {
+      patch_cache.valid = false;
+    }
 
     size_t codestream_byte_size = 0;
+    // The frame's headers, TOC and group data, as separately allocated chunks
+    // that are handed to the output without concatenating them.
+    std::vector<jxl::PaddedBytes> frame_sections;
 
     jxl::BitWriter writer;
 
     if (input_frame) {
-      jxl::PassesEncoderState enc_state;
-
+      const bool displayed = duration != 0 || last_frame;
       frame_index_box.AddFrame(codestream_bytes_written_end_of_frame, duration,
+                               displayed,
                                input_frame->option_values.frame_index_box);
 
-      // EncodeFrame creates jxl::FrameHeader object internally based on the
-      // FrameInfo, imagebundle, cparams and metadata. Copy the information to
-      // these.
-      jxl::ImageBundle& ib = input_frame->frame;
-      ib.duration = duration;
-      ib.timecode = timecode;
-      ib.name = input_frame->option_values.frame_name;
-      ib.blendmode = static_cast<jxl::BlendMode>(
-          input_frame->option_values.header.layer_info.blend_info.blendmode);
-      ib.blend =
-          input_frame->option_values.header.layer_info.blend_info.blendmode !=
-          JXL_BLEND_REPLACE;
-
-      size_t save_as_reference =
-          input_frame->option_values.header.layer_info.save_as_reference;
-      ib.use_for_next_frame = !!save_as_reference;
-
-      jxl::FrameInfo frame_info;
-      frame_info.is_last = last_frame;
-      frame_info.save_as_reference = save_as_reference;
-      frame_info.source =
-          input_frame->option_values.header.layer_info.blend_info.source;
-      frame_info.clamp =
-          input_frame->option_values.header.layer_info.blend_info.clamp;
-      frame_info.alpha_channel =
-          input_frame->option_values.header.layer_info.blend_info.alpha;
-      frame_info.extra_channel_blending_info.resize(
-          metadata.m.num_extra_channels);
-      // If extra channel blend info has not been set, use the blend mode from
-      // the layer_info.
-      JxlBlendInfo default_blend_info =
-          input_frame->option_values.header.layer_info.blend_info;
-      for (size_t i = 0; i < metadata.m.num_extra_channels; ++i) {
-        auto& to = frame_info.extra_channel_blending_info[i];
-        const auto& from =
-            i < input_frame->option_values.extra_channel_blend_info.size()
-                ? input_frame->option_values.extra_channel_blend_info[i]
-                : default_blend_info;
-        to.mode = static_cast<jxl::BlendMode>(from.blendmode);
-        to.source = from.source;
-        to.alpha_channel = from.alpha;
-        to.clamp = (from.clamp != 0);
-      }
-
-      if (input_frame->option_values.header.layer_info.have_crop) {
-        ib.origin.x0 = input_frame->option_values.header.layer_info.crop_x0;
-        ib.origin.y0 = input_frame->option_values.header.layer_info.crop_y0;
+      if (input_frame->encoded) {
+        frame_sections = std::move(input_frame->encoded_sections);
+      } else {
+        jxl::FrameInfo frame_info;
+        GetQueuedFrameInfo(this, last_frame, *input_frame, &frame_info);
+        jxl::PassesEncoderState enc_state;
+        JxlEncoderStats* stats = input_frame->option_values.stats;
+        // The progress also measures the phase times of the statistics.
+        jxl::EncoderProgress progress(
+            progress_callback ? &CallProgressCallback : nullptr, this);
+        if (progress_callback || stats) enc_state.progress = &progress;
+        enc_state.color_cache = input_frame->color_cache.get();
+        if (input_frame->option_values.cparams.temporal_reuse) {
+          enc_state.temporal_cache = &temporal_cache;
+        }
+        if (UsesPersistentPatches(this, *input_frame)) {
+          enc_state.patch_cache = &patch_cache;
+        }
+        jxl::AuxOut aux_out;
+        JXL_ASSERT(writer.BitsWritten() == 0);
+        writer.KeepSections();
+        if (!jxl::EncodeFrame(input_frame->option_values.cparams, frame_info,
+                              &metadata, input_frame->frame, &enc_state, cms,
+                              thread_pool.get(), &writer,
+                              stats ? &aux_out : nullptr)) {
+          if (progress.Aborted()) {
+            return JXL_API_ERROR(this, JXL_ENC_ERR_ABORTED,
+                                 "Encoding aborted by the progress callback");
+          }
+          return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
+                               "Failed to encode frame");
+        }
+        frame_sections = std::move(writer).TakeSections();
+        if (stats) stats->AddFrame(aux_out, progress);
       }
-      JXL_ASSERT(writer.BitsWritten() == 0);
-      if (!jxl::EncodeFrame(input_frame->option_values.cparams, frame_info,
-                            &metadata, input_frame->frame, &enc_state, cms,
-                            thread_pool.get(), &writer,
-                            /*aux_out=*/nullptr)) {
-        return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
-                             "Failed to encode frame");
+      size_t frame_byte_size = 0;
+      for (const jxl::PaddedBytes& section : frame_sections) {
+        frame_byte_size += section.size();
       }
       codestream_bytes_written_beginning_of_frame =
           codestream_bytes_written_end_of_frame;
-      codestream_bytes_written_end_of_frame +=
-          jxl::DivCeil(writer.BitsWritten(), 8);
+      codestream_bytes_written_end_of_frame += frame_byte_size;
 
       // Possibly bytes already contains the codestream header: in case this is
       // the first frame, and the codestream header was not encoded as jxlp
       // above.
-      bytes.append(std::move(writer).TakeBytes());
-      codestream_byte_size = bytes.size();
+      codestream_byte_size = bytes.size() + frame_byte_size;
     } else {
       JXL_CHECK(!output_fast_frame_queue.empty());
       JxlFastLosslessPrepareHeader(output_fast_frame_queue.front().get(),
@@ -589,66 +1145,246 @@ JxlEncoderStatus JxlEncoderStruct::RefillOutputByteQueue() {
     }
 
     if (MustUseContainer()) {
+      std::vector<uint8_t> box_header;
       if (last_frame && jxlp_counter == 0) {
         // If this is the last frame and no jxlp boxes were used yet, it's
         // slighly more efficient to write a jxlc box since it has 4 bytes
         // less overhead.
         jxl::AppendBoxHeader(jxl::MakeBoxType("jxlc"), codestream_byte_size,
-                             /*unbounded=*/false, &output_byte_queue);
+                             /*unbounded=*/false, &box_header);
       } else {
         jxl::AppendBoxHeader(jxl::MakeBoxType("jxlp"), codestream_byte_size + 4,
-                             /*unbounded=*/false, &output_byte_queue);
-        AppendJxlpBoxCounter(jxlp_counter++, last_frame, &output_byte_queue);
+                             /*unbounded=*/false, &box_header);
+        AppendJxlpBoxCounter(jxlp_counter++, last_frame, &box_header);
+      }
+      if (!output_processor.Append(box_header)) {
+        return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
+                             "Failed to write output");
       }
     }
 
-    output_byte_queue.insert(output_byte_queue.end(), bytes.data(),
-                             bytes.data() + bytes.size());
+    if (!output_processor.Append(std::move(bytes))) {
+      return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC, "Failed to write output");
+    }
+    bytes.clear();
+    for (jxl::PaddedBytes& section : frame_sections) {
+      if (!output_processor.Append(std::move(section))) {
+        return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
+                             "Failed to write output");
+      }
+    }
+    if (!output_fast_frame_queue.empty() &&
+        output_processor.OutputProcessorSet()) {
+      if (!output_processor.AppendFastLosslessFrame(
+              output_fast_frame_queue.front().get())) {
+        return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
+                             "Failed to write output");
+      }
+      output_fast_frame_queue.pop_front();
+    }
 
     if (input_frame) {
       last_used_cparams = input_frame->option_values.cparams;
+      if (KeepInputForNextOutput()) {
+        jxl::JxlEncoderQueuedInput kept_input(memory_manager);
+        kept_input.frame = std::move(input_frame);
+        multi_rate_inputs.emplace_back(std::move(kept_input));
+      } else {
+        plane_pool.Retain(&input_frame->frame);
+      }
     }
     if (last_frame && frame_index_box.StoreFrameIndexBox()) {
-      bytes.clear();
-      EncodeFrameIndexBox(frame_index_box, writer);
-      jxl::AppendBoxHeader(jxl::MakeBoxType("jxli"), bytes.size(),
-                           /*unbounded=*/false, &output_byte_queue);
+      std::vector<uint8_t> index_contents;
+      EncodeFrameIndexBox(frame_index_box, &index_contents);
+      if (!AppendBoxHeader(jxl::MakeBoxType("jxli"), index_contents.size(),
+                           /*unbounded=*/false) ||
+          !output_processor.Append(index_contents)) {
+        return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
+                             "Failed to write output");
+      }
     }
   } else {
-    // Not a frame, so is a box instead
+    // Not a frame, so is a box instead. The boxes queued after it are
+    // compressed at the same time.
+    if (input.box->compress_box && input.box->compressed.empty() &&
+        !CompressQueuedBoxes()) {
+      return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
+                           "Brotli compression for brob box failed");
+    }
     jxl::MemoryManagerUniquePtr<jxl::JxlEncoderQueuedBox> box =
         std::move(input.box);
     input_queue.erase(input_queue.begin());
     num_queued_boxes--;
 
     if (box->compress_box) {
-      jxl::PaddedBytes compressed(4);
-      // Prepend the original box type in the brob box contents
-      for (size_t i = 0; i < 4; i++) {
-        compressed[i] = static_cast<uint8_t>(box->type[i]);
-      }
-      if (JXL_ENC_SUCCESS !=
-          BrotliCompress((brotli_effort >= 0 ? brotli_effort : 4),
-                         box->contents.data(), box->contents.size(),
-                         &compressed)) {
+      // The compressed contents are kept for the next codestream of a
+      // multi-rate encoding.
+      const jxl::PaddedBytes& compressed = box->compressed;
+      if (!AppendBoxHeader(jxl::MakeBoxType("brob"), compressed.size(),
+                           false) ||
+          !output_processor.Append(compressed.data(), compressed.size())) {
         return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
-                             "Brotli compression for brob box failed");
+                             "Failed to write output");
       }
-      jxl::AppendBoxHeader(jxl::MakeBoxType("brob"), compressed.size(), false,
-                           &output_byte_queue);
-      output_byte_queue.insert(output_byte_queue.end(), compressed.data(),
-                               compressed.data() + compressed.size());
     } else {
-      jxl::AppendBoxHeader(box->type, box->contents.size(), false,
-                           &output_byte_queue);
-      output_byte_queue.insert(output_byte_queue.end(), box->contents.data(),
-                               box->contents.data() + box->contents.size());
+      if (!AppendBoxHeader(box->type, box->contents.size(), false) ||
+          !output_processor.Append(box->contents)) {
+        return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
+                             "Failed to write output");
+      }
+    }
+    if (KeepInputForNextOutput()) {
+      jxl::JxlEncoderQueuedInput kept_input(memory_manager);
+      kept_input.box = std::move(box);
+      multi_rate_inputs.emplace_back(std::move(kept_input));
     }
   }
+  output_processor.SetFinalizedPosition();
 
   return JXL_ENC_SUCCESS;
 }
 
+jxl::Status JxlEncoderStruct::AppendBoxHeader(const jxl::BoxType& type,
+                                              size_t size, bool unbounded) {
+  std::vector<uint8_t> header;
+  jxl::AppendBoxHeader(type, size, unbounded, &header);
+  return output_processor.Append(header);
+}
+
+namespace jxl {
+
+Status JxlEncoderOutputProcessorWrapper::Append(const uint8_t* data,
+                                                size_t size) {
+  if (size == 0) return true;
+  position_ += size;
+  if (!has_processor_) {
+    // Small appends, such as box headers, extend the last chunk instead of
+    // creating a new one.
+    constexpr size_t kMinChunkSize = 1 << 12;
+    if (chunks_.empty() || chunks_.back().size() >= kMinChunkSize) {
+      chunks_.emplace_back();
+    }
+    chunks_.back().append(data, data + size);
+    return true;
+  }
+  while (size > 0) {
+    size_t buffer_size = size;
+    void* buffer = processor_.get_buffer(processor_.opaque, &buffer_size);
+    if (buffer == nullptr || buffer_size == 0) {
+      return JXL_FAILURE("Output processor did not provide a buffer");
+    }
+    size_t to_copy = std::min(buffer_size, size);
+    memcpy(buffer, data, to_copy);
+    processor_.release_buffer(processor_.opaque, to_copy);
+    data += to_copy;
+    size -= to_copy;
+  }
+  return true;
+}
+
+Status JxlEncoderOutputProcessorWrapper::Append(PaddedBytes&& bytes) {
+  if (bytes.empty()) return true;
+  if (has_processor_) return Append(bytes.data(), bytes.size());
+  position_ += bytes.size();
+  chunks_.emplace_back(std::move(bytes));
+  return true;
+}
+
+Status JxlEncoderOutputProcessorWrapper::AppendFastLosslessFrame(
+    JxlFastLosslessFrameState* frame) {
+  JXL_ASSERT(has_processor_);
+  // JxlFastLosslessWriteOutput requires at least 32 bytes of output space, so
+  // fall back to a local buffer if the application provides smaller buffers.
+  constexpr size_t kMinOutputSize = 32;
+  uint8_t local[kMinOutputSize];
+  for (;;) {
+    size_t buffer_size = JxlFastLosslessMaxRequiredOutput(frame);
+    void* buffer = processor_.get_buffer(processor_.opaque, &buffer_size);
+    if (buffer == nullptr || buffer_size == 0) {
+      return JXL_FAILURE("Output processor did not provide a buffer");
+    }
+    if (buffer_size < kMinOutputSize) {
+      size_t count = JxlFastLosslessWriteOutput(frame, local, kMinOutputSize);
+      size_t to_copy = std::min(count, buffer_size);
+      memcpy(buffer, local, to_copy);
+      processor_.release_buffer(processor_.opaque, to_copy);
+      position_ += to_copy;
+      if (count == 0) return true;
+      JXL_RETURN_IF_ERROR(Append(local + to_copy, count - to_copy));
+      continue;
+    }
+    size_t count = JxlFastLosslessWriteOutput(
+        frame, static_cast<uint8_t*>(buffer), buffer_size);
+    processor_.release_buffer(processor_.opaque, count);
+    position_ += count;
+    if (count == 0) return true;
+  }
+}
+
+void JxlEncoderOutputProcessorWrapper::SetFinalizedPosition() {
+  if (has_processor_ && processor_.set_finalized_position) {
+    processor_.set_finalized_position(processor_.opaque, position_);
+  }
+}
+
+void JxlEncoderOutputProcessorWrapper::CopyOutput(uint8_t** next_out,
+                                                  size_t* avail_out) {
+  while (*avail_out > 0 && !chunks_.empty()) {
+    const PaddedBytes& chunk = chunks_.front();
+    size_t to_copy = std::min(*avail_out, chunk.size() - first_chunk_offset_);
+    memcpy(*next_out, chunk.data() + first_chunk_offset_, to_copy);
+    *next_out += to_copy;
+    *avail_out -= to_copy;
+    first_chunk_offset_ += to_copy;
+    if (first_chunk_offset_ == chunk.size()) {
+      chunks_.pop_front();
+      first_chunk_offset_ = 0;
+    }
+  }
+}
+
+ImageF JxlEncoderPlanePool::Take(size_t xsize, size_t ysize) {
+  size_t best = planes_.size();
+  for (size_t i = 0; i < planes_.size(); ++i) {
+    const ImageF& plane = planes_[i];
+    if (plane.orig_xsize() < xsize || plane.orig_ysize() < ysize) continue;
+    if (best == planes_.size() ||
+        plane.orig_xsize() * plane.orig_ysize() <
+            planes_[best].orig_xsize() * planes_[best].orig_ysize()) {
+      best = i;
+    }
+  }
+  if (best == planes_.size()) return ImageF(xsize, ysize);
+  ImageF plane = std::move(planes_[best]);
+  planes_.erase(planes_.begin() + best);
+  plane.ShrinkTo(xsize, ysize);
+  return plane;
+}
+
+Image3F JxlEncoderPlanePool::TakeColor(size_t xsize, size_t ysize) {
+  ImageF plane0 = Take(xsize, ysize);
+  ImageF plane1 = Take(xsize, ysize);
+  ImageF plane2 = Take(xsize, ysize);
+  return Image3F(std::move(plane0), std::move(plane1), std::move(plane2));
+}
+
+void JxlEncoderPlanePool::Retain(ImageBundle* frame) {
+  if (frame->HasColor()) {
+    for (size_t c = 0; c < 3; ++c) {
+      planes_.emplace_back(std::move(frame->color()->Plane(c)));
+    }
+  }
+  for (ImageF& extra_channel : frame->extra_channels()) {
+    planes_.emplace_back(std::move(extra_channel));
+  }
+  frame->extra_channels().clear();
+  if (planes_.size() > kMaxPlanes) {
+    planes_.erase(planes_.begin(), planes_.end() - kMaxPlanes);
+  }
+}
+
+}  // namespace jxl
+
 JxlEncoderStatus JxlEncoderSetColorEncoding(JxlEncoder* enc,
                                             const JxlColorEncoding* color) {
   if (!enc->basic_info_set) {
@@ -1090,6 +1826,13 @@ JxlEncoderStatus JxlEncoderFrameSettingsSetOption(
     case JXL_ENC_FRAME_SETTING_LOSSY_PALETTE:
     case JXL_ENC_FRAME_SETTING_JPEG_RECON_CFL:
     case JXL_ENC_FRAME_SETTING_JPEG_COMPRESS_BOXES:
+    case JXL_ENC_FRAME_SETTING_MODULAR_LOCAL_TREES:
+    case JXL_ENC_FRAME_SETTING_TEMPORAL_REUSE:
+    case JXL_ENC_FRAME_SETTING_AUTO_CROP:
+    case JXL_ENC_FRAME_SETTING_AUTO_EFFORT:
+    case JXL_ENC_FRAME_SETTING_PERSISTENT_PATCHES:
+    case JXL_ENC_FRAME_SETTING_HUGE_PAGES:
+    case JXL_ENC_FRAME_SETTING_LIVE_CAPTURE:
       if (value < -1 || value > 1) {
         return JXL_API_ERROR(
             frame_settings->enc, JXL_ENC_ERR_API_USAGE,
@@ -1305,7 +2048,21 @@ JxlEncoderStatus JxlEncoderFrameSettingsSetOption(
       }
       return JXL_ENC_SUCCESS;
     case JXL_ENC_FRAME_INDEX_BOX:
-      frame_settings->values.frame_index_box = true;
+      if (value < 0 || value > 1) {
+        return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                             "Option value has to be 0 or 1");
+      }
+      if (value && !frame_settings->enc->MustUseContainer() &&
+          frame_settings->enc->wrote_bytes) {
+        return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                             "The frame index box requires a container, "
+                             "which can only be enabled at the beginning");
+      }
+      frame_settings->values.frame_index_box = value;
+      if (value) {
+        frame_settings->enc->frame_index_box.index_box_requested_through_api =
+            true;
+      }
       return JXL_ENC_SUCCESS;
     case JXL_ENC_FRAME_SETTING_PHOTON_NOISE:
       return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_NOT_SUPPORTED,
@@ -1314,6 +2071,55 @@ JxlEncoderStatus JxlEncoderFrameSettingsSetOption(
     case JXL_ENC_FRAME_SETTING_JPEG_COMPRESS_BOXES:
       frame_settings->values.cparams.jpeg_compress_boxes = value;
       return JXL_ENC_SUCCESS;
+    case JXL_ENC_FRAME_SETTING_MEMORY_LIMIT:
+      if (value < -1) {
+        return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                             "Memory limit has to be -1 (no limit) or >= 0");
+      }
+      frame_settings->values.memory_limit = value;
+      return JXL_ENC_SUCCESS;
+    case JXL_ENC_FRAME_SETTING_TARGET_SIZE:
+      if (value < -1) {
+        return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                             "Target size has to be -1 (no target) or >= 0");
+      }
+      frame_settings->values.cparams.target_size = value == -1 ? 0 : value;
+      return JXL_ENC_SUCCESS;
+    case JXL_ENC_FRAME_SETTING_DECODER_THREADS:
+      if (value < -1) {
+        return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                             "Decoder threads has to be -1 (unknown) or >= 0");
+      }
+      frame_settings->values.cparams.decoder_threads = value == -1 ? 0 : value;
+      return JXL_ENC_SUCCESS;
+    case JXL_ENC_FRAME_SETTING_TIME_BUDGET:
+      if (value < -1) {
+        return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                             "Time budget has to be -1 (no budget) or >= 0");
+      }
+      frame_settings->values.time_budget = value;
+      return JXL_ENC_SUCCESS;
+    case JXL_ENC_FRAME_SETTING_MODULAR_LOCAL_TREES:
+      frame_settings->values.cparams.modular_local_trees = value == 1;
+      return JXL_ENC_SUCCESS;
+    case JXL_ENC_FRAME_SETTING_TEMPORAL_REUSE:
+      frame_settings->values.cparams.temporal_reuse = value == 1;
+      return JXL_ENC_SUCCESS;
+    case JXL_ENC_FRAME_SETTING_AUTO_CROP:
+      frame_settings->values.auto_crop = value == 1;
+      return JXL_ENC_SUCCESS;
+    case JXL_ENC_FRAME_SETTING_AUTO_EFFORT:
+      frame_settings->values.auto_effort = value == 1;
+      return JXL_ENC_SUCCESS;
+    case JXL_ENC_FRAME_SETTING_PERSISTENT_PATCHES:
+      frame_settings->values.cparams.persistent_patches = value == 1;
+      return JXL_ENC_SUCCESS;
+    case JXL_ENC_FRAME_SETTING_HUGE_PAGES:
+      frame_settings->values.cparams.huge_pages = value == 1;
+      return JXL_ENC_SUCCESS;
+    case JXL_ENC_FRAME_SETTING_LIVE_CAPTURE:
+      frame_settings->values.live_capture = value == 1;
+      return JXL_ENC_SUCCESS;
     default:
       return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_NOT_SUPPORTED,
                            "Unknown option");
@@ -1403,6 +2209,17 @@ JxlEncoderStatus JxlEncoderFrameSettingsSetFloatOption(
     case JXL_ENC_FRAME_SETTING_BROTLI_EFFORT:
     case JXL_ENC_FRAME_SETTING_FILL_ENUM:
     case JXL_ENC_FRAME_SETTING_JPEG_COMPRESS_BOXES:
+    case JXL_ENC_FRAME_SETTING_MEMORY_LIMIT:
+    case JXL_ENC_FRAME_SETTING_TARGET_SIZE:
+    case JXL_ENC_FRAME_SETTING_MODULAR_LOCAL_TREES:
+    case JXL_ENC_FRAME_SETTING_TEMPORAL_REUSE:
+    case JXL_ENC_FRAME_SETTING_AUTO_CROP:
+    case JXL_ENC_FRAME_SETTING_AUTO_EFFORT:
+    case JXL_ENC_FRAME_SETTING_PERSISTENT_PATCHES:
+    case JXL_ENC_FRAME_SETTING_HUGE_PAGES:
+    case JXL_ENC_FRAME_SETTING_DECODER_THREADS:
+    case JXL_ENC_FRAME_SETTING_TIME_BUDGET:
+    case JXL_ENC_FRAME_SETTING_LIVE_CAPTURE:
       return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_NOT_SUPPORTED,
                            "Int option, try setting it with "
                            "JxlEncoderFrameSettingsSetOption");
@@ -1433,12 +2250,27 @@ JxlEncoder* JxlEncoderCreate(const JxlMemoryManager* memory_manager) {
 
 void JxlEncoderReset(JxlEncoder* enc) {
   enc->thread_pool.reset();
+  enc->max_image_buffer_pool_bytes = 0;
+  if (enc->image_buffer_pool) enc->image_buffer_pool->SetMaxRetainedBytes(0);
+  enc->progress_callback = nullptr;
+  enc->progress_opaque = nullptr;
   enc->input_queue.clear();
   enc->num_queued_frames = 0;
   enc->num_queued_boxes = 0;
   enc->encoder_options.clear();
-  enc->output_byte_queue.clear();
+  enc->output_processor.Reset();
   enc->output_fast_frame_queue.clear();
+  enc->last_fast_lossless_frame.clear();
+  enc->fast_lossless_live.reset();
+  enc->plane_pool.Clear();
+  enc->temporal_cache = jxl::FrameTemporalCache();
+  enc->patch_cache = jxl::PatchDictionaryCache();
+  enc->auto_crop_canvas = jxl::ImageBundle();
+  enc->multi_rate_distances.clear();
+  enc->multi_rate_output = 0;
+  enc->multi_rate_inputs.clear();
+  enc->jpeg_reader.reset();
+  enc->chunked_jpeg_data.reset();
   enc->codestream_bytes_written_beginning_of_frame = 0;
   enc->codestream_bytes_written_end_of_frame = 0;
   enc->wrote_bytes = false;
@@ -1456,6 +2288,17 @@ void JxlEncoderReset(JxlEncoder* enc) {
   JxlEncoderInitBasicInfo(&enc->basic_info);
 }
 
+void JxlEncoderResetKeepBuffers(JxlEncoder* enc) {
+  jxl::JxlEncoderPlanePool plane_pool = std::move(enc->plane_pool);
+  std::unique_ptr<jxl::BufferPool> image_buffer_pool =
+      std::move(enc->image_buffer_pool);
+  const size_t max_image_buffer_pool_bytes = enc->max_image_buffer_pool_bytes;
+  JxlEncoderReset(enc);
+  enc->plane_pool = std::move(plane_pool);
+  enc->image_buffer_pool = std::move(image_buffer_pool);
+  enc->max_image_buffer_pool_bytes = max_image_buffer_pool_bytes;
+}
+
 void JxlEncoderDestroy(JxlEncoder* enc) {
   if (enc) {
     JxlMemoryManager local_memory_manager = enc->memory_manager;
@@ -1524,6 +2367,187 @@ JxlEncoderStatus JxlEncoderSetParallelRunner(JxlEncoder* enc,
   return JXL_ENC_SUCCESS;
 }
 
+JxlEncoderStatus JxlEncoderSetParallelRunnerWithHints(
+    JxlEncoder* enc, JxlParallelRunnerWithHints parallel_runner,
+    void* parallel_runner_opaque) {
+  if (enc->thread_pool) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
+                         "parallel runner already set");
+  }
+  enc->thread_pool = jxl::MemoryManagerMakeUnique<jxl::ThreadPool>(
+      &enc->memory_manager, parallel_runner, parallel_runner_opaque);
+  if (!enc->thread_pool) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_GENERIC,
+                         "error setting parallel runner");
+  }
+  return JXL_ENC_SUCCESS;
+}
+
+JxlEncoderStatus JxlEncoderSetImageBufferPool(JxlEncoder* enc,
+                                              size_t max_retained_bytes) {
+  if (max_retained_bytes != 0 && !enc->image_buffer_pool) {
+    enc->image_buffer_pool.reset(new jxl::BufferPool(&enc->memory_manager));
+  }
+  if (enc->image_buffer_pool) {
+    enc->image_buffer_pool->SetMaxRetainedBytes(max_retained_bytes);
+  }
+  enc->max_image_buffer_pool_bytes = max_retained_bytes;
+  return JXL_ENC_SUCCESS;
+}
+
+JxlEncoderStatus JxlEncoderGetMemoryUsage(const JxlEncoder* enc,
+                                          JxlMemoryTag tag,
+                                          JxlMemoryUsage* usage) {
+  if (tag < JXL_MEMORY_TAG_ALL || tag >= JXL_MEMORY_TAG_NUM) {
+    return JXL_API_ERROR_NOSET("Invalid memory tag");
+  }
+  *usage = enc->allocation_stats.Get(tag);
+  return JXL_ENC_SUCCESS;
+}
+
+JxlEncoderStatus JxlEncoderSetProgressCallback(
+    JxlEncoder* enc, JxlEncoderProgressCallback callback, void* opaque) {
+  enc->progress_callback = callback;
+  enc->progress_opaque = opaque;
+  return JXL_ENC_SUCCESS;
+}
+
+void JxlEncoderStatsStruct::AddFrame(const jxl::AuxOut& frame_aux_out,
+                                     const jxl::EncoderProgress& progress) {
+  aux_out.Assimilate(frame_aux_out);
+  for (size_t i = 0; i < jxl::kNumEncoderPhases; ++i) {
+    phase_seconds[i] += progress.PhaseSeconds()[i];
+  }
+  ++num_frames;
+}
+
+JxlEncoderStats* JxlEncoderStatsCreate() { return new JxlEncoderStats(); }
+
+void JxlEncoderStatsDestroy(JxlEncoderStats* stats) { delete stats; }
+
+JxlEncoderStatus JxlEncoderCollectStats(JxlEncoderFrameSettings* frame_settings,
+                                        JxlEncoderStats* stats) {
+  frame_settings->values.stats = stats;
+  return JXL_ENC_SUCCESS;
+}
+
+namespace {
+size_t PhaseMicroseconds(const JxlEncoderStats* stats,
+                         jxl::EncoderPhase phase) {
+  return static_cast<size_t>(
+      stats->phase_seconds[static_cast<size_t>(phase)] * 1e6 + 0.5);
+}
+}  // namespace
+
+size_t JxlEncoderStatsGet(const JxlEncoderStats* stats,
+                          JxlEncoderStatsKey key) {
+  if (!stats) return 0;
+  const jxl::AuxOut& aux_out = stats->aux_out;
+  switch (key) {
+    case JXL_ENC_STAT_HEADER_BITS:
+      return aux_out.layers[jxl::kLayerHeader].total_bits;
+    case JXL_ENC_STAT_TOC_BITS:
+      return aux_out.layers[jxl::kLayerTOC].total_bits;
+    case JXL_ENC_STAT_DICTIONARY_BITS:
+      return aux_out.layers[jxl::kLayerDictionary].total_bits;
+    case JXL_ENC_STAT_SPLINES_BITS:
+      return aux_out.layers[jxl::kLayerSplines].total_bits;
+    case JXL_ENC_STAT_NOISE_BITS:
+      return aux_out.layers[jxl::kLayerNoise].total_bits;
+    case JXL_ENC_STAT_QUANT_BITS:
+      return aux_out.layers[jxl::kLayerQuant].total_bits;
+    case JXL_ENC_STAT_MODULAR_TREE_BITS:
+      return aux_out.layers[jxl::kLayerModularTree].total_bits;
+    case JXL_ENC_STAT_MODULAR_GLOBAL_BITS:
+      return aux_out.layers[jxl::kLayerModularGlobal].total_bits;
+    case JXL_ENC_STAT_DC_BITS:
+      return aux_out.layers[jxl::kLayerDC].total_bits;
+    case JXL_ENC_STAT_MODULAR_DC_GROUP_BITS:
+      return aux_out.layers[jxl::kLayerModularDcGroup].total_bits;
+    case JXL_ENC_STAT_CONTROL_FIELDS_BITS:
+      return aux_out.layers[jxl::kLayerControlFields].total_bits;
+    case JXL_ENC_STAT_COEF_ORDER_BITS:
+      return aux_out.layers[jxl::kLayerOrder].total_bits;
+    case JXL_ENC_STAT_AC_HISTOGRAM_BITS:
+      return aux_out.layers[jxl::kLayerAC].total_bits;
+    case JXL_ENC_STAT_AC_BITS:
+      return aux_out.layers[jxl::kLayerACTokens].total_bits;
+    case JXL_ENC_STAT_MODULAR_AC_GROUP_BITS:
+      return aux_out.layers[jxl::kLayerModularAcGroup].total_bits;
+    case JXL_ENC_STAT_NUM_CLUSTERED_HISTOGRAMS: {
+      size_t total = 0;
+      for (const auto& layer : aux_out.layers) {
+        total += layer.num_clustered_histograms;
+      }
+      return total;
+    }
+    case JXL_ENC_STAT_NUM_TREE_NODES:
+      return aux_out.num_tree_nodes;
+    case JXL_ENC_STAT_NUM_PATCHES:
+      return aux_out.num_patches;
+    case JXL_ENC_STAT_NUM_SPLINES:
+      return aux_out.num_splines;
+    case JXL_ENC_STAT_NUM_PASSES:
+      return aux_out.num_passes;
+    case JXL_ENC_STAT_NUM_ENTROPY_CODES:
+      return aux_out.num_entropy_codes;
+    case JXL_ENC_STAT_NUM_LZ77_CODES:
+      return aux_out.num_lz77_codes;
+    case JXL_ENC_STAT_NUM_SMALL_BLOCKS:
+      return aux_out.num_small_blocks;
+    case JXL_ENC_STAT_NUM_DCT4X8_BLOCKS:
+      return aux_out.num_dct4x8_blocks;
+    case JXL_ENC_STAT_NUM_AFV_BLOCKS:
+      return aux_out.num_afv_blocks;
+    case JXL_ENC_STAT_NUM_DCT8_BLOCKS:
+      return aux_out.num_dct8_blocks;
+    case JXL_ENC_STAT_NUM_DCT8X16_BLOCKS:
+      return aux_out.num_dct8x16_blocks;
+    case JXL_ENC_STAT_NUM_DCT8X32_BLOCKS:
+      return aux_out.num_dct8x32_blocks;
+    case JXL_ENC_STAT_NUM_DCT16_BLOCKS:
+      return aux_out.num_dct16_blocks;
+    case JXL_ENC_STAT_NUM_DCT16X32_BLOCKS:
+      return aux_out.num_dct16x32_blocks;
+    case JXL_ENC_STAT_NUM_DCT32_BLOCKS:
+      return aux_out.num_dct32_blocks;
+    case JXL_ENC_STAT_NUM_DCT32X64_BLOCKS:
+      return aux_out.num_dct32x64_blocks;
+    case JXL_ENC_STAT_NUM_DCT64_BLOCKS:
+      return aux_out.num_dct64_blocks;
+    case JXL_ENC_STAT_NUM_BUTTERAUGLI_ITERS:
+      return aux_out.num_butteraugli_iters;
+    case JXL_ENC_STAT_COLOR_TRANSFORM_MICROSECONDS:
+      return PhaseMicroseconds(stats, jxl::EncoderPhase::kColorTransform);
+    case JXL_ENC_STAT_AC_STRATEGY_MICROSECONDS:
+      return PhaseMicroseconds(stats, jxl::EncoderPhase::kAcStrategy);
+    case JXL_ENC_STAT_QUANTIZATION_MICROSECONDS:
+      return PhaseMicroseconds(stats, jxl::EncoderPhase::kQuantization);
+    case JXL_ENC_STAT_TOKENIZATION_MICROSECONDS:
+      return PhaseMicroseconds(stats, jxl::EncoderPhase::kTokenization);
+    case JXL_ENC_STAT_MODULAR_MICROSECONDS:
+      return PhaseMicroseconds(stats, jxl::EncoderPhase::kModular);
+    case JXL_ENC_STAT_HISTOGRAMS_MICROSECONDS:
+      return PhaseMicroseconds(stats, jxl::EncoderPhase::kHistograms);
+    case JXL_ENC_STAT_GROUPS_MICROSECONDS:
+      return PhaseMicroseconds(stats, jxl::EncoderPhase::kGroups);
+    case JXL_ENC_STAT_NUM_FRAMES:
+      return stats->num_frames;
+    default:
+      return 0;
+  }
+}
+
+void JxlEncoderStatsMerge(JxlEncoderStats* stats,
+                          const JxlEncoderStats* other) {
+  if (!stats || !other) return;
+  stats->aux_out.Assimilate(other->aux_out);
+  for (size_t i = 0; i < jxl::kNumEncoderPhases; ++i) {
+    stats->phase_seconds[i] += other->phase_seconds[i];
+  }
+  stats->num_frames += other->num_frames;
+}
+
 namespace {
 JxlEncoderStatus GetCurrentDimensions(
     const JxlEncoderFrameSettings* frame_settings, size_t& xsize,
@@ -1545,25 +2569,33 @@ JxlEncoderStatus GetCurrentDimensions(
   }
   return JXL_ENC_SUCCESS;
 }
-}  // namespace
 
-JxlEncoderStatus JxlEncoderAddJPEGFrame(
-    const JxlEncoderFrameSettings* frame_settings, const uint8_t* buffer,
-    size_t size) {
-  if (frame_settings->enc->frames_closed) {
+// Frames stored in the frame index box must be keyframes, which can be decoded
+// without the frames before them.
+JxlEncoderStatus VerifyFrameIndexBox(
+    const JxlEncoderFrameSettings* frame_settings) {
+  if (!frame_settings->values.frame_index_box) return JXL_ENC_SUCCESS;
+  const JxlLayerInfo& layer_info = frame_settings->values.header.layer_info;
+  bool replace = layer_info.blend_info.blendmode == JXL_BLEND_REPLACE;
+  for (const JxlBlendInfo& blend_info :
+       frame_settings->values.extra_channel_blend_info) {
+    replace &= blend_info.blendmode == JXL_BLEND_REPLACE;
+  }
+  if (layer_info.have_crop || !replace) {
     return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
-                         "Frame input is already closed");
-  }
-
-  jxl::CodecInOut io;
-  if (!jxl::jpeg::DecodeImageJPG(jxl::Span<const uint8_t>(buffer, size), &io)) {
-    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_BAD_INPUT,
-                         "Error during decode of input JPEG");
+                         "Frames with cropping or blending cannot be indexed "
+                         "in the frame index box");
   }
+  return JXL_ENC_SUCCESS;
+}
 
+// Queues the frame of a JPEG codestream decoded into io as coefficients, and
+// the metadata of the JPEG as boxes.
+JxlEncoderStatus QueueJPEGFrame(const JxlEncoderFrameSettings* frame_settings,
+                                jxl::CodecInOut* io) {
   if (!frame_settings->enc->color_encoding_set) {
     if (!SetColorEncodingFromJpegData(
-            *io.Main().jpeg_data,
+            *io->Main().jpeg_data,
             &frame_settings->enc->metadata.m.color_encoding)) {
       return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_BAD_INPUT,
                            "Error in input JPEG color space");
@@ -1573,8 +2605,8 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(
   if (!frame_settings->enc->basic_info_set) {
     JxlBasicInfo basic_info;
     JxlEncoderInitBasicInfo(&basic_info);
-    basic_info.xsize = io.Main().jpeg_data->width;
-    basic_info.ysize = io.Main().jpeg_data->height;
+    basic_info.xsize = io->Main().jpeg_data->width;
+    basic_info.ysize = io->Main().jpeg_data->height;
     basic_info.uses_original_profile = true;
     if (JxlEncoderSetBasicInfo(frame_settings->enc, &basic_info) !=
         JXL_ENC_SUCCESS) {
@@ -1587,13 +2619,13 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(
     return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
                          "Can't XYB encode a lossless JPEG");
   }
-  if (!io.blobs.exif.empty()) {
+  if (!io->blobs.exif.empty()) {
     JxlOrientation orientation = static_cast<JxlOrientation>(
         frame_settings->enc->metadata.m.orientation);
-    jxl::InterpretExif(io.blobs.exif, &orientation);
+    jxl::InterpretExif(io->blobs.exif, &orientation);
     frame_settings->enc->metadata.m.orientation = orientation;
 
-    size_t exif_size = io.blobs.exif.size();
+    size_t exif_size = io->blobs.exif.size();
     // Exif data in JPEG is limited to 64k
     if (exif_size > 0xFFFF) {
       return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
@@ -1601,25 +2633,25 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(
     }
     exif_size += 4;  // prefix 4 zero bytes for tiff offset
     std::vector<uint8_t> exif(exif_size);
-    memcpy(exif.data() + 4, io.blobs.exif.data(), io.blobs.exif.size());
+    memcpy(exif.data() + 4, io->blobs.exif.data(), io->blobs.exif.size());
     JxlEncoderUseBoxes(frame_settings->enc);
     JxlEncoderAddBox(frame_settings->enc, "Exif", exif.data(), exif_size,
                      frame_settings->values.cparams.jpeg_compress_boxes);
   }
-  if (!io.blobs.xmp.empty()) {
+  if (!io->blobs.xmp.empty()) {
     JxlEncoderUseBoxes(frame_settings->enc);
-    JxlEncoderAddBox(frame_settings->enc, "xml ", io.blobs.xmp.data(),
-                     io.blobs.xmp.size(),
+    JxlEncoderAddBox(frame_settings->enc, "xml ", io->blobs.xmp.data(),
+                     io->blobs.xmp.size(),
                      frame_settings->values.cparams.jpeg_compress_boxes);
   }
-  if (!io.blobs.jumbf.empty()) {
+  if (!io->blobs.jumbf.empty()) {
     JxlEncoderUseBoxes(frame_settings->enc);
-    JxlEncoderAddBox(frame_settings->enc, "jumb", io.blobs.jumbf.data(),
-                     io.blobs.jumbf.size(),
+    JxlEncoderAddBox(frame_settings->enc, "jumb", io->blobs.jumbf.data(),
+                     io->blobs.jumbf.size(),
                      frame_settings->values.cparams.jpeg_compress_boxes);
   }
   if (frame_settings->enc->store_jpeg_metadata) {
-    jxl::jpeg::JPEGData data_in = *io.Main().jpeg_data;
+    jxl::jpeg::JPEGData data_in = *io->Main().jpeg_data;
     jxl::PaddedBytes jpeg_data;
     if (!jxl::jpeg::EncodeJPEGData(data_in, &jpeg_data,
                                    frame_settings->values.cparams)) {
@@ -1638,21 +2670,27 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(
       jxl::JxlEncoderQueuedFrame{
           frame_settings->values,
           jxl::ImageBundle(&frame_settings->enc->metadata.m),
-          {}});
+          {},
+          /*encoded=*/false,
+          /*encoded_sections=*/{},
+          /*color_cache=*/nullptr});
   if (!queued_frame) {
     // TODO(jon): when can this happen? is this an API usage error?
     return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
                          "No frame queued?");
   }
-  queued_frame->frame.SetFromImage(std::move(*io.Main().color()),
-                                   io.Main().c_current());
+  queued_frame->frame.SetFromImage(std::move(*io->Main().color()),
+                                   io->Main().c_current());
   size_t xsize, ysize;
   if (GetCurrentDimensions(frame_settings, xsize, ysize) != JXL_ENC_SUCCESS) {
     return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
                          "bad dimensions");
   }
-  if (xsize != static_cast<size_t>(io.Main().jpeg_data->width) ||
-      ysize != static_cast<size_t>(io.Main().jpeg_data->height)) {
+  if (VerifyFrameIndexBox(frame_settings) != JXL_ENC_SUCCESS) {
+    return JXL_ENC_ERROR;
+  }
+  if (xsize != static_cast<size_t>(io->Main().jpeg_data->width) ||
+      ysize != static_cast<size_t>(io->Main().jpeg_data->height)) {
     return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
                          "JPEG dimensions don't match frame dimensions");
   }
@@ -1663,29 +2701,96 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(
     queued_frame->ec_initialized.push_back(0);
   }
   queued_frame->frame.SetExtraChannels(std::move(extra_channels));
-  queued_frame->frame.jpeg_data = std::move(io.Main().jpeg_data);
-  queued_frame->frame.color_transform = io.Main().color_transform;
-  queued_frame->frame.chroma_subsampling = io.Main().chroma_subsampling;
+  queued_frame->frame.jpeg_data = std::move(io->Main().jpeg_data);
+  queued_frame->frame.color_transform = io->Main().color_transform;
+  queued_frame->frame.chroma_subsampling = io->Main().chroma_subsampling;
 
   QueueFrame(frame_settings, queued_frame);
   return JXL_ENC_SUCCESS;
 }
 
+}  // namespace
+
+JxlEncoderStatus JxlEncoderAddJPEGFrame(
+    const JxlEncoderFrameSettings* frame_settings, const uint8_t* buffer,
+    size_t size) {
+  jxl::CacheAligned::ScopedMemoryManager memory_scope(
+      frame_settings->enc->ImageMemoryManager());
+  jxl::CacheAligned::ScopedStats stats_scope(
+      &frame_settings->enc->allocation_stats);
+  if (frame_settings->enc->frames_closed) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                         "Frame input is already closed");
+  }
+  if (frame_settings->enc->jpeg_reader) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                         "A chunked JPEG frame is being added");
+  }
+
+  jxl::CodecInOut io;
+  if (!jxl::jpeg::DecodeImageJPG(jxl::Span<const uint8_t>(buffer, size), &io,
+                                 frame_settings->enc->thread_pool.get())) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_BAD_INPUT,
+                         "Error during decode of input JPEG");
+  }
+  return QueueJPEGFrame(frame_settings, &io);
+}
+
+JxlEncoderStatus JxlEncoderAddJPEGFrameChunk(
+    const JxlEncoderFrameSettings* frame_settings, const uint8_t* buffer,
+    size_t size, JXL_BOOL is_last) {
+  jxl::CacheAligned::ScopedMemoryManager memory_scope(
+      frame_settings->enc->ImageMemoryManager());
+  jxl::CacheAligned::ScopedStats stats_scope(
+      &frame_settings->enc->allocation_stats);
+  JxlEncoder* enc = frame_settings->enc;
+  if (enc->frames_closed) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
+                         "Frame input is already closed");
+  }
+  if (!enc->jpeg_reader) {
+    enc->chunked_jpeg_data = jxl::make_unique<jxl::jpeg::JPEGData>();
+    enc->jpeg_reader = jxl::make_unique<jxl::jpeg::JpegChunkedReader>(
+        enc->chunked_jpeg_data.get(), enc->thread_pool.get());
+  }
+  bool ok = enc->jpeg_reader->Append(buffer, size);
+  if (ok && !is_last) return JXL_ENC_SUCCESS;
+  ok = ok && enc->jpeg_reader->Finish();
+  std::unique_ptr<jxl::jpeg::JPEGData> jpeg_data =
+      std::move(enc->chunked_jpeg_data);
+  enc->jpeg_reader.reset();
+  jxl::CodecInOut io;
+  if (!ok || !jxl::jpeg::SetImageFromJpegData(std::move(jpeg_data), &io)) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_BAD_INPUT,
+                         "Error during decode of input JPEG");
+  }
+  return QueueJPEGFrame(frame_settings, &io);
+}
+
 static bool CanDoFastLossless(const JxlEncoderFrameSettings* frame_settings,
                               const JxlPixelFormat* pixel_format,
                               bool has_alpha) {
   if (!frame_settings->values.lossless) {
     return false;
   }
+  // Fast lossless frames can only be written once.
+  if (!frame_settings->enc->multi_rate_distances.empty()) {
+    return false;
+  }
   // TODO(veluca): many of the following options could be made to work, but are
   // just not implemented in FJXL's frame header handling yet.
   if (frame_settings->values.frame_index_box) {
     return false;
   }
-  if (frame_settings->values.header.layer_info.have_crop) {
+  if (frame_settings->values.header.layer_info.have_crop ||
+      frame_settings->values.auto_crop) {
     return false;
   }
-  if (frame_settings->enc->metadata.m.have_animation) {
+  // Frames are always blended with kReplace on the previous one, which is
+  // saved as a reference managed by the fast lossless encoder.
+  if (frame_settings->values.header.layer_info.blend_info.blendmode !=
+          JXL_BLEND_REPLACE ||
+      frame_settings->values.header.layer_info.save_as_reference != 0) {
     return false;
   }
   if (frame_settings->values.cparams.speed_tier != jxl::SpeedTier::kLightning) {
@@ -1734,9 +2839,47 @@ static bool CanDoFastLossless(const JxlEncoderFrameSettings* frame_settings,
   return true;
 }
 
-JxlEncoderStatus JxlEncoderAddImageFrame(
+namespace {
+// Returns the smallest rectangle that contains all the pixels that differ
+// between the frames `a` and `b`, which have the same layout. As frames can not
+// be empty, returns a 1x1 rectangle if the frames are equal.
+jxl::Rect FindChangedRect(const uint8_t* a, const uint8_t* b, size_t xsize,
+                          size_t ysize, size_t row_size,
+                          size_t bytes_per_pixel) {
+  const size_t row_bytes = xsize * bytes_per_pixel;
+  auto same_row = [&](size_t y) {
+    return memcmp(a + y * row_size, b + y * row_size, row_bytes) == 0;
+  };
+  auto same_pixel = [&](const uint8_t* row_a, const uint8_t* row_b,
+                        size_t x) {
+    return memcmp(row_a + x * bytes_per_pixel, row_b + x * bytes_per_pixel,
+                  bytes_per_pixel) == 0;
+  };
+  size_t y0 = 0;
+  while (y0 < ysize && same_row(y0)) y0++;
+  if (y0 == ysize) return jxl::Rect(0, 0, 1, 1);
+  size_t y1 = ysize;
+  while (same_row(y1 - 1)) y1--;
+  size_t x0 = xsize;
+  size_t x1 = 0;
+  for (size_t y = y0; y < y1; y++) {
+    const uint8_t* row_a = a + y * row_size;
+    const uint8_t* row_b = b + y * row_size;
+    size_t x = 0;
+    while (x < x0 && same_pixel(row_a, row_b, x)) x++;
+    x0 = x;
+    size_t x_end = xsize;
+    while (x_end > x1 && same_pixel(row_a, row_b, x_end - 1)) x_end--;
+    x1 = x_end;
+  }
+  return jxl::Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+// Checks that a frame with the given color channels pixel format can be added
+// with these frame settings.
+JxlEncoderStatus VerifyImageFrameInput(
     const JxlEncoderFrameSettings* frame_settings,
-    const JxlPixelFormat* pixel_format, const void* buffer, size_t size) {
+    const JxlPixelFormat* pixel_format) {
   if (!frame_settings->enc->basic_info_set ||
       (!frame_settings->enc->color_encoding_set &&
        !frame_settings->enc->metadata.m.xyb_encoded)) {
@@ -1762,6 +2905,90 @@ JxlEncoderStatus JxlEncoderAddImageFrame(
                            "RGB pixel format input for a grayscale image");
     }
   }
+  if (JXL_ENC_SUCCESS !=
+      VerifyInputBitDepth(frame_settings->values.image_bit_depth,
+                          *pixel_format)) {
+    return JXL_API_ERROR_NOSET("Invalid input bit depth");
+  }
+  if (frame_settings->values.lossless &&
+      frame_settings->enc->metadata.m.xyb_encoded) {
+    return JXL_API_ERROR(
+        frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+        "Set uses_original_profile=true for lossless encoding");
+  }
+  return JXL_ENC_SUCCESS;
+}
+
+// Sets up the extra channels and frame header related fields of a newly
+// created queued frame, and determines the color encoding of the input pixels.
+JxlEncoderStatus InitQueuedFrame(const JxlEncoderFrameSettings* frame_settings,
+                                 const JxlPixelFormat* pixel_format,
+                                 size_t xsize, size_t ysize,
+                                 jxl::JxlEncoderQueuedFrame* queued_frame,
+                                 jxl::ColorEncoding* c_current) {
+  if (!frame_settings->enc->color_encoding_set) {
+    if ((pixel_format->data_type == JXL_TYPE_FLOAT) ||
+        (pixel_format->data_type == JXL_TYPE_FLOAT16)) {
+      *c_current =
+          jxl::ColorEncoding::LinearSRGB(pixel_format->num_channels < 3);
+    } else {
+      *c_current = jxl::ColorEncoding::SRGB(pixel_format->num_channels < 3);
+    }
+  } else {
+    *c_current = frame_settings->enc->metadata.m.color_encoding;
+  }
+  uint32_t num_channels = pixel_format->num_channels;
+  size_t has_interleaved_alpha =
+      static_cast<size_t>(num_channels == 2 || num_channels == 4);
+  if (has_interleaved_alpha >
+      frame_settings->enc->metadata.m.num_extra_channels) {
+    return JXL_API_ERROR(
+        frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+        "number of extra channels mismatch (need 1 extra channel for alpha)");
+  }
+  std::vector<jxl::ImageF> extra_channels(
+      frame_settings->enc->metadata.m.num_extra_channels);
+  for (auto& extra_channel : extra_channels) {
+    extra_channel = frame_settings->enc->plane_pool.Take(xsize, ysize);
+  }
+  queued_frame->frame.SetExtraChannels(std::move(extra_channels));
+  for (auto& ec_info : frame_settings->enc->metadata.m.extra_channel_info) {
+    if (has_interleaved_alpha && ec_info.type == jxl::ExtraChannel::kAlpha) {
+      queued_frame->ec_initialized.push_back(1);
+      has_interleaved_alpha = 0;  // only first Alpha is initialized
+    } else {
+      queued_frame->ec_initialized.push_back(0);
+    }
+  }
+  queued_frame->frame.origin.x0 =
+      frame_settings->values.header.layer_info.crop_x0;
+  queued_frame->frame.origin.y0 =
+      frame_settings->values.header.layer_info.crop_y0;
+  queued_frame->frame.use_for_next_frame =
+      (frame_settings->values.header.layer_info.save_as_reference != 0u);
+  queued_frame->frame.blendmode =
+      frame_settings->values.header.layer_info.blend_info.blendmode ==
+              JXL_BLEND_REPLACE
+          ? jxl::BlendMode::kReplace
+          : jxl::BlendMode::kBlend;
+  queued_frame->frame.blend =
+      frame_settings->values.header.layer_info.blend_info.source > 0;
+  queued_frame->option_values.cparams.level =
+      frame_settings->enc->codestream_level;
+  return JXL_ENC_SUCCESS;
+}
+}  // namespace
+
+JxlEncoderStatus JxlEncoderAddImageFrame(
+    const JxlEncoderFrameSettings* frame_settings,
+    const JxlPixelFormat* pixel_format, const void* buffer, size_t size) {
+  jxl::CacheAligned::ScopedMemoryManager memory_scope(
+      frame_settings->enc->ImageMemoryManager());
+  jxl::CacheAligned::ScopedStats stats_scope(
+      &frame_settings->enc->allocation_stats);
+  if (VerifyImageFrameInput(frame_settings, pixel_format) != JXL_ENC_SUCCESS) {
+    return JXL_ENC_ERROR;
+  }
 
   bool has_alpha = frame_settings->enc->metadata.m.HasAlpha();
 
@@ -1770,6 +2997,9 @@ JxlEncoderStatus JxlEncoderAddImageFrame(
     return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
                          "bad dimensions");
   }
+  if (VerifyFrameIndexBox(frame_settings) != JXL_ENC_SUCCESS) {
+    return JXL_ENC_ERROR;
+  }
 
   // All required conditions to do fast-lossless.
   if (CanDoFastLossless(frame_settings, pixel_format, has_alpha)) {
@@ -1798,14 +3028,48 @@ JxlEncoderStatus JxlEncoderAddImageFrame(
           pool, 0, count, jxl::ThreadPool::NoInit,
           [&](size_t i, size_t) { fun(opaque, i); }, "Encode fast lossless"));
     };
-    QueueFastLosslessFrame(
-        frame_settings,
-        JxlFastLosslessPrepareFrame(
-            reinterpret_cast<const unsigned char*>(buffer), xsize, row_size,
-            ysize, pixel_format->num_channels,
+    const uint8_t* pixels = reinterpret_cast<const uint8_t*>(buffer);
+    const bool have_animation = frame_settings->enc->metadata.m.have_animation;
+    // Animation frames only encode the area that changed from the previous
+    // frame.
+    jxl::Rect rect(0, 0, xsize, ysize);
+    std::vector<uint8_t>& last_frame =
+        frame_settings->enc->last_fast_lossless_frame;
+    if (have_animation) {
+      const JxlPixelFormat& last_format =
+          frame_settings->enc->last_fast_lossless_format;
+      if (!last_frame.empty() &&
+          last_format.num_channels == pixel_format->num_channels &&
+          last_format.data_type == pixel_format->data_type &&
+          last_format.endianness == pixel_format->endianness &&
+          last_format.align == pixel_format->align) {
+        rect = FindChangedRect(last_frame.data(), pixels, xsize, ysize,
+                               row_size, bytes_per_pixel);
+      }
+      last_frame.assign(pixels, pixels + bytes_to_read);
+      frame_settings->enc->last_fast_lossless_format = *pixel_format;
+    }
+    jxl::FJXLLiveUniquePtr& live = frame_settings->enc->fast_lossless_live;
+    if (frame_settings->values.live_capture && !live) {
+      live.reset(JxlFastLosslessCreateLiveState());
+    }
+    JxlFastLosslessFrameState* fast_lossless_frame =
+        JxlFastLosslessPrepareLiveFrame(
+            frame_settings->values.live_capture ? live.get() : nullptr,
+            pixels + rect.y0() * row_size + rect.x0() * bytes_per_pixel,
+            rect.xsize(), row_size, rect.ysize(), pixel_format->num_channels,
             frame_settings->enc->metadata.m.bit_depth.bits_per_sample,
             big_endian, /*effort=*/2, frame_settings->enc->thread_pool.get(),
-            runner));
+            runner);
+    if (have_animation) {
+      JxlFastLosslessSetFrameOrigin(fast_lossless_frame, xsize, ysize,
+                                    rect.x0(), rect.y0());
+      JxlFastLosslessSetAnimationFrame(
+          fast_lossless_frame, frame_settings->values.header.duration,
+          frame_settings->enc->metadata.m.animation.have_timecodes,
+          frame_settings->values.header.timecode);
+    }
+    QueueFastLosslessFrame(frame_settings, fast_lossless_frame);
     return JXL_ENC_SUCCESS;
   }
 
@@ -1816,7 +3080,10 @@ JxlEncoderStatus JxlEncoderAddImageFrame(
       jxl::JxlEncoderQueuedFrame{
           frame_settings->values,
           jxl::ImageBundle(&frame_settings->enc->metadata.m),
-          {}});
+          {},
+          /*encoded=*/false,
+          /*encoded_sections=*/{},
+          /*color_cache=*/nullptr});
 
   if (!queued_frame) {
     // TODO(jon): when can this happen? is this an API usage error?
@@ -1825,62 +3092,15 @@ JxlEncoderStatus JxlEncoderAddImageFrame(
   }
 
   jxl::ColorEncoding c_current;
-  if (!frame_settings->enc->color_encoding_set) {
-    if ((pixel_format->data_type == JXL_TYPE_FLOAT) ||
-        (pixel_format->data_type == JXL_TYPE_FLOAT16)) {
-      c_current =
-          jxl::ColorEncoding::LinearSRGB(pixel_format->num_channels < 3);
-    } else {
-      c_current = jxl::ColorEncoding::SRGB(pixel_format->num_channels < 3);
-    }
-  } else {
-    c_current = frame_settings->enc->metadata.m.color_encoding;
-  }
-  uint32_t num_channels = pixel_format->num_channels;
-  size_t has_interleaved_alpha =
-      static_cast<size_t>(num_channels == 2 || num_channels == 4);
-  if (has_interleaved_alpha >
-      frame_settings->enc->metadata.m.num_extra_channels) {
-    return JXL_API_ERROR(
-        frame_settings->enc, JXL_ENC_ERR_API_USAGE,
-        "number of extra channels mismatch (need 1 extra channel for alpha)");
-  }
-  std::vector<jxl::ImageF> extra_channels(
-      frame_settings->enc->metadata.m.num_extra_channels);
-  for (auto& extra_channel : extra_channels) {
-    extra_channel = jxl::ImageF(xsize, ysize);
-  }
-  queued_frame->frame.SetExtraChannels(std::move(extra_channels));
-  for (auto& ec_info : frame_settings->enc->metadata.m.extra_channel_info) {
-    if (has_interleaved_alpha && ec_info.type == jxl::ExtraChannel::kAlpha) {
-      queued_frame->ec_initialized.push_back(1);
-      has_interleaved_alpha = 0;  // only first Alpha is initialized
-    } else {
-      queued_frame->ec_initialized.push_back(0);
-    }
-  }
-  queued_frame->frame.origin.x0 =
-      frame_settings->values.header.layer_info.crop_x0;
-  queued_frame->frame.origin.y0 =
-      frame_settings->values.header.layer_info.crop_y0;
-  queued_frame->frame.use_for_next_frame =
-      (frame_settings->values.header.layer_info.save_as_reference != 0u);
-  queued_frame->frame.blendmode =
-      frame_settings->values.header.layer_info.blend_info.blendmode ==
-              JXL_BLEND_REPLACE
-          ? jxl::BlendMode::kReplace
-          : jxl::BlendMode::kBlend;
-  queued_frame->frame.blend =
-      frame_settings->values.header.layer_info.blend_info.source > 0;
-
-  if (JXL_ENC_SUCCESS !=
-      VerifyInputBitDepth(frame_settings->values.image_bit_depth,
-                          *pixel_format)) {
-    return JXL_API_ERROR_NOSET("Invalid input bit depth");
+  if (InitQueuedFrame(frame_settings, pixel_format, xsize, ysize,
+                      queued_frame.get(), &c_current) != JXL_ENC_SUCCESS) {
+    return JXL_ENC_ERROR;
   }
   size_t bits_per_sample =
       GetBitDepth(frame_settings->values.image_bit_depth,
                   frame_settings->enc->metadata.m, *pixel_format);
+  queued_frame->frame.SetFromImage(
+      frame_settings->enc->plane_pool.TakeColor(xsize, ysize), c_current);
   const uint8_t* uint8_buffer = reinterpret_cast<const uint8_t*>(buffer);
   if (!jxl::ConvertFromExternal(
           jxl::Span<const uint8_t>(uint8_buffer, size), xsize, ysize, c_current,
@@ -1889,19 +3109,274 @@ JxlEncoderStatus JxlEncoderAddImageFrame(
     return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
                          "Invalid input buffer");
   }
-  if (frame_settings->values.lossless &&
-      frame_settings->enc->metadata.m.xyb_encoded) {
-    return JXL_API_ERROR(
-        frame_settings->enc, JXL_ENC_ERR_API_USAGE,
-        "Set uses_original_profile=true for lossless encoding");
+
+  QueueFrame(frame_settings, queued_frame);
+  return JXL_ENC_SUCCESS;
+}
+
+JxlEncoderStatus JxlEncoderAddImageFramePlanar(
+    const JxlEncoderFrameSettings* frame_settings,
+    const JxlPixelFormat* pixel_format, const void* const* planes,
+    const size_t* strides) {
+  jxl::CacheAligned::ScopedMemoryManager memory_scope(
+      frame_settings->enc->ImageMemoryManager());
+  jxl::CacheAligned::ScopedStats stats_scope(
+      &frame_settings->enc->allocation_stats);
+  if (VerifyImageFrameInput(frame_settings, pixel_format) != JXL_ENC_SUCCESS) {
+    return JXL_ENC_ERROR;
+  }
+  size_t xsize, ysize;
+  if (GetCurrentDimensions(frame_settings, xsize, ysize) != JXL_ENC_SUCCESS) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
+                         "bad dimensions");
+  }
+  if (VerifyFrameIndexBox(frame_settings) != JXL_ENC_SUCCESS) {
+    return JXL_ENC_ERROR;
+  }
+  if (planes == nullptr || strides == nullptr) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                         "planes and strides must be set");
+  }
+
+  auto queued_frame = jxl::MemoryManagerMakeUnique<jxl::JxlEncoderQueuedFrame>(
+      &frame_settings->enc->memory_manager,
+      // JxlEncoderQueuedFrame is a struct with no constructors, so we use the
+      // default move constructor there.
+      jxl::JxlEncoderQueuedFrame{
+          frame_settings->values,
+          jxl::ImageBundle(&frame_settings->enc->metadata.m),
+          {},
+          /*encoded=*/false,
+          /*encoded_sections=*/{},
+          /*color_cache=*/nullptr});
+  if (!queued_frame) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
+                         "No frame queued?");
+  }
+  jxl::ColorEncoding c_current;
+  if (InitQueuedFrame(frame_settings, pixel_format, xsize, ysize,
+                      queued_frame.get(), &c_current) != JXL_ENC_SUCCESS) {
+    return JXL_ENC_ERROR;
+  }
+  jxl::ImageBundle& ib = queued_frame->frame;
+  const size_t color_channels = c_current.Channels();
+  if (pixel_format->num_channels < color_channels) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                         "Not enough planes for the color channels");
+  }
+  const bool has_planar_alpha =
+      pixel_format->num_channels == 2 || pixel_format->num_channels == 4;
+  const size_t bits_per_sample =
+      GetBitDepth(frame_settings->values.image_bit_depth,
+                  frame_settings->enc->metadata.m, *pixel_format);
+  // Each plane is converted as a single-channel image with its own stride,
+  // directly into the plane of the frame.
+  JxlPixelFormat plane_format = *pixel_format;
+  plane_format.num_channels = 1;
+  const size_t row_size = xsize * BitsPerChannel(pixel_format->data_type) / 8;
+  const auto convert_plane = [&](size_t c, jxl::ImageF* channel) {
+    if (planes[c] == nullptr || strides[c] < row_size) {
+      return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                           "Invalid plane or stride");
+    }
+    if (!jxl::ConvertFromExternalNoSizeCheck(
+            reinterpret_cast<const uint8_t*>(planes[c]), xsize, ysize,
+            strides[c], bits_per_sample, plane_format, 0,
+            frame_settings->enc->thread_pool.get(), jxl::Rect(*channel),
+            channel)) {
+      return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                           "Invalid input plane");
+    }
+    return JXL_ENC_SUCCESS;
+  };
+
+  jxl::Image3F color = frame_settings->enc->plane_pool.TakeColor(xsize, ysize);
+  for (size_t c = 0; c < color_channels; ++c) {
+    if (convert_plane(c, &color.Plane(c)) != JXL_ENC_SUCCESS) {
+      return JXL_ENC_ERROR;
+    }
+  }
+  if (color_channels == 1) {
+    CopyImageTo(color.Plane(0), &color.Plane(1));
+    CopyImageTo(color.Plane(0), &color.Plane(2));
+  }
+  ib.SetFromImage(std::move(color), c_current);
+  if (has_planar_alpha && ib.HasAlpha() &&
+      convert_plane(pixel_format->num_channels - 1, ib.alpha()) !=
+          JXL_ENC_SUCCESS) {
+    return JXL_ENC_ERROR;
   }
-  queued_frame->option_values.cparams.level =
-      frame_settings->enc->codestream_level;
 
   QueueFrame(frame_settings, queued_frame);
   return JXL_ENC_SUCCESS;
 }
 
+namespace {
+// Copies one rectangle of a chunked input channel into `channel`, releasing
+// the buffer obtained from the input source afterwards.
+JxlEncoderStatus ReadChunkedRect(const JxlEncoderFrameSettings* frame_settings,
+                                 const void* buffer, size_t row_offset,
+                                 const JxlPixelFormat& pixel_format,
+                                 size_t bits_per_sample, size_t c,
+                                 const jxl::Rect& rect, jxl::ImageF* channel) {
+  const size_t bytes_per_channel = BitsPerChannel(pixel_format.data_type) / 8;
+  if (buffer == nullptr) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                         "Chunked input source returned no pixel data");
+  }
+  if (row_offset <
+      rect.xsize() * pixel_format.num_channels * bytes_per_channel) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                         "Chunked input row offset too small");
+  }
+  if (!jxl::ConvertFromExternalNoSizeCheck(
+          reinterpret_cast<const uint8_t*>(buffer), rect.xsize(), rect.ysize(),
+          row_offset, bits_per_sample, pixel_format, c,
+          frame_settings->enc->thread_pool.get(), rect, channel)) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                         "Invalid chunked input buffer");
+  }
+  return JXL_ENC_SUCCESS;
+}
+}  // namespace
+
+JxlEncoderStatus JxlEncoderAddChunkedFrame(
+    const JxlEncoderFrameSettings* frame_settings, JXL_BOOL is_last_frame,
+    JxlChunkedFrameInputSource chunked_frame_input) {
+  jxl::CacheAligned::ScopedMemoryManager memory_scope(
+      frame_settings->enc->ImageMemoryManager());
+  jxl::CacheAligned::ScopedStats stats_scope(
+      &frame_settings->enc->allocation_stats);
+  JxlPixelFormat pixel_format = {4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  chunked_frame_input.get_color_channels_pixel_format(
+      chunked_frame_input.opaque, &pixel_format);
+  if (VerifyImageFrameInput(frame_settings, &pixel_format) !=
+      JXL_ENC_SUCCESS) {
+    return JXL_ENC_ERROR;
+  }
+  size_t xsize, ysize;
+  if (GetCurrentDimensions(frame_settings, xsize, ysize) != JXL_ENC_SUCCESS) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
+                         "bad dimensions");
+  }
+  if (VerifyFrameIndexBox(frame_settings) != JXL_ENC_SUCCESS) {
+    return JXL_ENC_ERROR;
+  }
+
+  auto queued_frame = jxl::MemoryManagerMakeUnique<jxl::JxlEncoderQueuedFrame>(
+      &frame_settings->enc->memory_manager,
+      // JxlEncoderQueuedFrame is a struct with no constructors, so we use the
+      // default move constructor there.
+      jxl::JxlEncoderQueuedFrame{
+          frame_settings->values,
+          jxl::ImageBundle(&frame_settings->enc->metadata.m),
+          {},
+          /*encoded=*/false,
+          /*encoded_sections=*/{},
+          /*color_cache=*/nullptr});
+  if (!queued_frame) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
+                         "No frame queued?");
+  }
+  jxl::ColorEncoding c_current;
+  if (InitQueuedFrame(frame_settings, &pixel_format, xsize, ysize,
+                      queued_frame.get(), &c_current) != JXL_ENC_SUCCESS) {
+    return JXL_ENC_ERROR;
+  }
+  jxl::ImageBundle& ib = queued_frame->frame;
+  const size_t color_channels = c_current.Channels();
+  const bool has_interleaved_alpha =
+      pixel_format.num_channels == 2 || pixel_format.num_channels == 4;
+  const size_t bits_per_sample =
+      GetBitDepth(frame_settings->values.image_bit_depth,
+                  frame_settings->enc->metadata.m, pixel_format);
+
+  // The pixels are requested one group at a time, so that the application
+  // never needs to provide more than a group-sized window of the frame and can
+  // produce the pixels on demand.
+  jxl::Image3F color = frame_settings->enc->plane_pool.TakeColor(xsize, ysize);
+  for (size_t y0 = 0; y0 < ysize; y0 += jxl::kGroupDim) {
+    for (size_t x0 = 0; x0 < xsize; x0 += jxl::kGroupDim) {
+      const jxl::Rect rect(x0, y0, jxl::kGroupDim, jxl::kGroupDim, xsize,
+                           ysize);
+      size_t row_offset = 0;
+      const void* buffer = chunked_frame_input.get_color_channel_data_at(
+          chunked_frame_input.opaque, rect.x0(), rect.y0(), rect.xsize(),
+          rect.ysize(), &row_offset);
+      JxlEncoderStatus status = JXL_ENC_SUCCESS;
+      for (size_t c = 0; c < color_channels && status == JXL_ENC_SUCCESS;
+           ++c) {
+        status = ReadChunkedRect(frame_settings, buffer, row_offset,
+                                 pixel_format, bits_per_sample, c, rect,
+                                 &color.Plane(c));
+      }
+      if (status == JXL_ENC_SUCCESS && has_interleaved_alpha &&
+          ib.HasAlpha()) {
+        status = ReadChunkedRect(frame_settings, buffer, row_offset,
+                                 pixel_format, bits_per_sample,
+                                 pixel_format.num_channels - 1, rect,
+                                 ib.alpha());
+      }
+      if (buffer != nullptr) {
+        chunked_frame_input.release_buffer(chunked_frame_input.opaque, buffer);
+      }
+      if (status != JXL_ENC_SUCCESS) return status;
+    }
+  }
+  if (color_channels == 1) {
+    CopyImageTo(color.Plane(0), &color.Plane(1));
+    CopyImageTo(color.Plane(0), &color.Plane(2));
+  }
+  ib.SetFromImage(std::move(color), c_current);
+
+  for (size_t ec = 0; ec < queued_frame->ec_initialized.size(); ++ec) {
+    if (queued_frame->ec_initialized[ec]) continue;
+    if (chunked_frame_input.get_extra_channel_pixel_format == nullptr ||
+        chunked_frame_input.get_extra_channel_data_at == nullptr) {
+      return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                           "Chunked input source has no extra channel data");
+    }
+    JxlPixelFormat ec_format = pixel_format;
+    chunked_frame_input.get_extra_channel_pixel_format(
+        chunked_frame_input.opaque, ec, &ec_format);
+    ec_format.num_channels = 1;
+    if (JXL_ENC_SUCCESS !=
+        VerifyInputBitDepth(frame_settings->values.image_bit_depth,
+                            ec_format)) {
+      return JXL_API_ERROR_NOSET("Invalid input bit depth");
+    }
+    const size_t ec_bits_per_sample = GetBitDepth(
+        frame_settings->values.image_bit_depth,
+        frame_settings->enc->metadata.m.extra_channel_info[ec], ec_format);
+    for (size_t y0 = 0; y0 < ysize; y0 += jxl::kGroupDim) {
+      for (size_t x0 = 0; x0 < xsize; x0 += jxl::kGroupDim) {
+        const jxl::Rect rect(x0, y0, jxl::kGroupDim, jxl::kGroupDim, xsize,
+                             ysize);
+        size_t row_offset = 0;
+        const void* buffer = chunked_frame_input.get_extra_channel_data_at(
+            chunked_frame_input.opaque, ec, rect.x0(), rect.y0(), rect.xsize(),
+            rect.ysize(), &row_offset);
+        JxlEncoderStatus status =
+            ReadChunkedRect(frame_settings, buffer, row_offset, ec_format,
+                            ec_bits_per_sample, 0, rect,
+                            &ib.extra_channels()[ec]);
+        if (buffer != nullptr) {
+          chunked_frame_input.release_buffer(chunked_frame_input.opaque,
+                                             buffer);
+        }
+        if (status != JXL_ENC_SUCCESS) return status;
+      }
+    }
+    queued_frame->ec_initialized[ec] = 1;
+  }
+
+  QueueFrame(frame_settings, queued_frame);
+  if (is_last_frame) {
+    JxlEncoderCloseInput(frame_settings->enc);
+  }
+  return JXL_ENC_SUCCESS;
+}
+
 JxlEncoderStatus JxlEncoderUseBoxes(JxlEncoder* enc) {
   if (enc->wrote_bytes) {
     return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
@@ -1951,6 +3426,10 @@ JxlEncoderStatus JxlEncoderAddBox(JxlEncoder* enc, const JxlBoxType type,
 JXL_EXPORT JxlEncoderStatus JxlEncoderSetExtraChannelBuffer(
     const JxlEncoderOptions* frame_settings, const JxlPixelFormat* pixel_format,
     const void* buffer, size_t size, uint32_t index) {
+  jxl::CacheAligned::ScopedMemoryManager memory_scope(
+      frame_settings->enc->ImageMemoryManager());
+  jxl::CacheAligned::ScopedStats stats_scope(
+      &frame_settings->enc->allocation_stats);
   if (index >= frame_settings->enc->metadata.m.num_extra_channels) {
     return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
                          "Invalid value for the index of extra channel");
@@ -2006,16 +3485,19 @@ void JxlEncoderCloseInput(JxlEncoder* enc) {
 }
 JxlEncoderStatus JxlEncoderProcessOutput(JxlEncoder* enc, uint8_t** next_out,
                                          size_t* avail_out) {
+  jxl::CacheAligned::ScopedMemoryManager memory_scope(
+      enc->ImageMemoryManager());
+  jxl::CacheAligned::ScopedStats stats_scope(&enc->allocation_stats);
+  if (enc->output_processor.OutputProcessorSet()) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
+                         "Cannot call JxlEncoderProcessOutput after calling "
+                         "JxlEncoderSetOutputProcessor");
+  }
   while (*avail_out >= 32 &&
-         (!enc->output_byte_queue.empty() ||
+         (enc->output_processor.HasOutputToWrite() ||
           !enc->output_fast_frame_queue.empty() || !enc->input_queue.empty())) {
-    if (!enc->output_byte_queue.empty()) {
-      size_t to_copy = std::min(*avail_out, enc->output_byte_queue.size());
-      std::copy_n(enc->output_byte_queue.begin(), to_copy, *next_out);
-      *next_out += to_copy;
-      *avail_out -= to_copy;
-      enc->output_byte_queue.erase(enc->output_byte_queue.begin(),
-                                   enc->output_byte_queue.begin() + to_copy);
+    if (enc->output_processor.HasOutputToWrite()) {
+      enc->output_processor.CopyOutput(next_out, avail_out);
     } else if (!enc->output_fast_frame_queue.empty()) {
       size_t count = JxlFastLosslessWriteOutput(
           enc->output_fast_frame_queue.front().get(), *next_out, *avail_out);
@@ -2032,13 +3514,106 @@ JxlEncoderStatus JxlEncoderProcessOutput(JxlEncoder* enc, uint8_t** next_out,
     }
   }
 
-  if (!enc->output_byte_queue.empty() ||
+  if (enc->output_processor.HasOutputToWrite() ||
       !enc->output_fast_frame_queue.empty() || !enc->input_queue.empty()) {
     return JXL_ENC_NEED_MORE_OUTPUT;
   }
   return JXL_ENC_SUCCESS;
 }
 
+JxlEncoderStatus JxlEncoderSetMultiRateDistances(JxlEncoder* enc,
+                                                const float* distances,
+                                                size_t num_distances) {
+  if (enc->wrote_bytes || !enc->input_queue.empty()) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
+                         "Multi-rate distances must be set before adding "
+                         "frames or boxes");
+  }
+  if (num_distances == 0) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
+                         "At least one distance is required");
+  }
+  std::vector<float> multi_rate_distances(distances, distances + num_distances);
+  for (float& distance : multi_rate_distances) {
+    if (distance < 0.f || distance > 25.f) {
+      return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
+                           "Distance has to be in [0.0..25.0] (corresponding "
+                           "to quality in [0.0..100.0])");
+    }
+    if (distance > 0.f && distance < 0.01f) {
+      distance = 0.01f;
+    }
+  }
+  enc->multi_rate_distances = std::move(multi_rate_distances);
+  enc->multi_rate_output = 0;
+  return JXL_ENC_SUCCESS;
+}
+
+JxlEncoderStatus JxlEncoderStartNextMultiRateOutput(JxlEncoder* enc) {
+  if (!enc->KeepInputForNextOutput()) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
+                         "No multi-rate codestream left to write");
+  }
+  if (!enc->frames_closed || !enc->input_queue.empty() ||
+      !enc->output_fast_frame_queue.empty() ||
+      enc->output_processor.HasOutputToWrite()) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
+                         "The current codestream is not complete");
+  }
+  enc->multi_rate_output++;
+  enc->input_queue = std::move(enc->multi_rate_inputs);
+  enc->multi_rate_inputs.clear();
+  for (jxl::JxlEncoderQueuedInput& input : enc->input_queue) {
+    if (input.frame) {
+      input.frame->encoded = false;
+      enc->num_queued_frames++;
+    } else {
+      enc->num_queued_boxes++;
+    }
+  }
+  enc->output_processor.StartNewOutput();
+  enc->codestream_bytes_written_beginning_of_frame = 0;
+  enc->codestream_bytes_written_end_of_frame = 0;
+  enc->frame_index_box.entries.clear();
+  enc->wrote_bytes = false;
+  enc->jxlp_counter = 0;
+  return JXL_ENC_SUCCESS;
+}
+
+JxlEncoderStatus JxlEncoderSetOutputProcessor(
+    JxlEncoder* enc, JxlEncoderOutputProcessor output_processor) {
+  if (enc->wrote_bytes) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
+                         "Cannot set output processor after output was "
+                         "already produced");
+  }
+  if (output_processor.get_buffer == nullptr ||
+      output_processor.release_buffer == nullptr) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
+                         "Missing output processor callbacks");
+  }
+  enc->output_processor =
+      jxl::JxlEncoderOutputProcessorWrapper(output_processor);
+  return JXL_ENC_SUCCESS;
+}
+
+JxlEncoderStatus JxlEncoderFlushInput(JxlEncoder* enc) {
+  jxl::CacheAligned::ScopedMemoryManager memory_scope(
+      enc->ImageMemoryManager());
+  jxl::CacheAligned::ScopedStats stats_scope(&enc->allocation_stats);
+  if (!enc->output_processor.OutputProcessorSet()) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
+                         "Cannot flush input without setting output "
+                         "processor with JxlEncoderSetOutputProcessor");
+  }
+  while (!enc->input_queue.empty()) {
+    if (enc->RefillOutputByteQueue() != JXL_ENC_SUCCESS) {
+      return JXL_ENC_ERROR;
+    }
+  }
+  return JXL_ENC_SUCCESS;
+}
+
 JxlEncoderStatus JxlEncoderSetFrameHeader(JxlEncoderOptions* frame_settings,
                                           const JxlFrameHeader* frame_header) {
   if (frame_header->layer_info.blend_info.source > 3) {
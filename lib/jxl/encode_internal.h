@@ -12,12 +12,22 @@
 #include <jxl/parallel_runner.h>
 #include <jxl/types.h>
 
+#include <array>
 #include <deque>
+#include <memory>
 #include <vector>
 
 #include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/padded_bytes.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/enc_aux_out.h"
 #include "lib/jxl/enc_fast_lossless.h"
 #include "lib/jxl/enc_frame.h"
+#include "lib/jxl/enc_patch_dictionary.h"
+#include "lib/jxl/enc_progress.h"
+#include "lib/jxl/image.h"
+#include "lib/jxl/image_bundle.h"
+#include "lib/jxl/jpeg/enc_jpeg_data_reader.h"
 #include "lib/jxl/memory_manager_internal.h"
 
 namespace jxl {
@@ -51,6 +61,9 @@ codestream, bytes from box headers or non-codestream boxes are not counted.
 
 typedef struct JxlEncoderFrameIndexBoxEntryStruct {
   bool to_be_indexed;
+  // Whether the frame is shown on its own, rather than merged with the next
+  // frame as a zero-duration layer.
+  bool displayed;
   uint32_t duration;
   uint64_t OFFi;
 } JxlEncoderFrameIndexBoxEntry;
@@ -78,7 +91,8 @@ typedef struct JxlEncoderFrameIndexBoxStruct {
   // That way we can ensure that every index box will have the first frame.
   // If the API user decides to mark it as an indexed frame, we call
   // the AddFrame again, this time with requested.
-  void AddFrame(uint64_t OFFi, uint32_t duration, bool to_be_indexed) {
+  void AddFrame(uint64_t OFFi, uint32_t duration, bool displayed,
+                bool to_be_indexed) {
     // We call AddFrame to every frame.
     // Recording the first frame is required by the standard.
     // Knowing the last frame is required, since the last indexed frame
@@ -94,6 +108,7 @@ typedef struct JxlEncoderFrameIndexBoxStruct {
     }
     JxlEncoderFrameIndexBoxEntry e;
     e.to_be_indexed = to_be_indexed;
+    e.displayed = displayed;
     e.OFFi = OFFi;
     e.duration = duration;
     entries.push_back(e);
@@ -112,6 +127,20 @@ typedef struct JxlEncoderFrameSettingsValuesStruct {
   std::string frame_name;
   JxlBitDepth image_bit_depth;
   bool frame_index_box = false;
+  // Whether full-size animation frames are cropped to the region that changed
+  // since the previous frame.
+  bool auto_crop = false;
+  // Whether the optional encoder passes are chosen based on the content.
+  bool auto_effort = false;
+  // Upper bound for the encoder memory in bytes, or -1 for no limit.
+  int64_t memory_limit = -1;
+  // Encoding time budget in milliseconds, or -1 for none.
+  int64_t time_budget = -1;
+  // Whether fast lossless frames reuse the statistics of the previous ones.
+  bool live_capture = false;
+  // Statistics of the frames encoded with these settings, owned by the
+  // application, or null.
+  JxlEncoderStats* stats = nullptr;
 } JxlEncoderFrameSettingsValues;
 
 typedef std::array<uint8_t, 4> BoxType;
@@ -135,18 +164,32 @@ struct JxlEncoderQueuedFrame {
   JxlEncoderFrameSettingsValues option_values;
   ImageBundle frame;
   std::vector<uint8_t> ec_initialized;
+  // Whether the frame was already encoded together with other queued frames,
+  // in which case encoded_sections holds its codestream bytes.
+  bool encoded;
+  std::vector<PaddedBytes> encoded_sections;
+  // Color transformed input shared by the codestreams of a multi-rate
+  // encoding, or null.
+  std::unique_ptr<FrameColorCache> color_cache;
 };
 
 struct JxlEncoderQueuedBox {
   BoxType type;
   std::vector<uint8_t> contents;
   bool compress_box;
+  // The contents of the brob box, with the original type first, once
+  // compressed by CompressQueuedBoxes.
+  PaddedBytes compressed;
 };
 
 using FJXLFrameUniquePtr =
     std::unique_ptr<JxlFastLosslessFrameState,
                     decltype(&JxlFastLosslessFreeFrameState)>;
 
+using FJXLLiveUniquePtr =
+    std::unique_ptr<JxlFastLosslessLiveState,
+                    decltype(&JxlFastLosslessFreeLiveState)>;
+
 // Either a frame, or a box, not both.
 // Can also be a FJXL frame.
 struct JxlEncoderQueuedInput {
@@ -159,6 +202,89 @@ struct JxlEncoderQueuedInput {
                                             JxlFastLosslessFreeFrameState};
 };
 
+// Destination of the bytes produced by the encoder. Without an output
+// processor, the bytes are kept in chunks until JxlEncoderProcessOutput copies
+// them into the buffer of the caller. With an output processor, they are
+// written directly into the buffers provided by the application.
+class JxlEncoderOutputProcessorWrapper {
+ public:
+  JxlEncoderOutputProcessorWrapper() = default;
+  explicit JxlEncoderOutputProcessorWrapper(
+      const JxlEncoderOutputProcessor& processor)
+      : processor_(processor), has_processor_(true) {}
+
+  bool OutputProcessorSet() const { return has_processor_; }
+
+  // Appends `size` bytes at the end of the output.
+  Status Append(const uint8_t* data, size_t size);
+  // Same as above, but avoids copying the bytes if no output processor is set.
+  Status Append(PaddedBytes&& bytes);
+  template <typename T>
+  Status Append(const T& bytes) {
+    return Append(bytes.data(), bytes.size());
+  }
+
+  // Writes the full output of a fast lossless frame through the output
+  // processor. Only valid if an output processor is set.
+  Status AppendFastLosslessFrame(JxlFastLosslessFrameState* frame);
+
+  // Informs the output processor, if set, that the output written so far is
+  // complete.
+  void SetFinalizedPosition();
+
+  // Total number of bytes appended so far.
+  size_t CurrentPosition() const { return position_; }
+
+  // Whether there are appended bytes not yet retrieved with CopyOutput.
+  bool HasOutputToWrite() const { return !chunks_.empty(); }
+
+  // Moves as many of the pending bytes as fit to *next_out.
+  void CopyOutput(uint8_t** next_out, size_t* avail_out);
+
+  void Reset() { *this = JxlEncoderOutputProcessorWrapper(); }
+
+  // Starts a new output with the same output processor, if any. Only valid
+  // once the previous output was fully written.
+  void StartNewOutput() {
+    chunks_.clear();
+    first_chunk_offset_ = 0;
+    position_ = 0;
+  }
+
+ private:
+  JxlEncoderOutputProcessor processor_ = {};
+  bool has_processor_ = false;
+  std::deque<PaddedBytes> chunks_;
+  // Number of bytes of the first chunk already copied out by CopyOutput.
+  size_t first_chunk_offset_ = 0;
+  size_t position_ = 0;
+};
+
+// Image planes of frames that were already encoded, kept allocated so that the
+// input of later frames with the same or smaller dimensions can be converted
+// into them instead of into newly allocated planes.
+class JxlEncoderPlanePool {
+ public:
+  // Returns a plane of the given dimensions, reusing the smallest retained
+  // plane that is large enough if there is one. The content is undefined.
+  ImageF Take(size_t xsize, size_t ysize);
+
+  // Same as above, for the three planes of a color image.
+  Image3F TakeColor(size_t xsize, size_t ysize);
+
+  // Moves the color and extra channel planes of an encoded frame into the
+  // pool.
+  void Retain(ImageBundle* frame);
+
+  void Clear() { planes_.clear(); }
+
+ private:
+  // Bounds the memory held by the pool if frames have a varying number of
+  // channels or dimensions.
+  static constexpr size_t kMaxPlanes = 16;
+  std::vector<ImageF> planes_;
+};
+
 // Appends a JXL container box header with given type, size, and unbounded
 // properties to output.
 template <typename T>
@@ -197,17 +323,56 @@ void AppendBoxHeader(const jxl::BoxType& type, size_t size, bool unbounded,
 struct JxlEncoderStruct {
   JxlEncoderError error = JxlEncoderError::JXL_ENC_ERR_OK;
   JxlMemoryManager memory_manager;
+  // Image buffer usage of this encoder, see JxlEncoderGetMemoryUsage.
+  // Declared first so that it outlives the buffers accounted in it.
+  jxl::AllocationStats allocation_stats;
+  // Declared early so that it outlives the buffers allocated from it. Used
+  // for the image buffers while max_image_buffer_pool_bytes is nonzero.
+  std::unique_ptr<jxl::BufferPool> image_buffer_pool;
+  size_t max_image_buffer_pool_bytes = 0;
   jxl::MemoryManagerUniquePtr<jxl::ThreadPool> thread_pool{
       nullptr, jxl::MemoryManagerDeleteHelper(&memory_manager)};
   JxlCmsInterface cms;
+  // Optional callback reporting the progress of EncodeFrame.
+  JxlEncoderProgressCallback progress_callback;
+  void* progress_opaque;
   std::vector<jxl::MemoryManagerUniquePtr<JxlEncoderFrameSettings>>
       encoder_options;
 
   size_t num_queued_frames;
   size_t num_queued_boxes;
   std::vector<jxl::JxlEncoderQueuedInput> input_queue;
-  std::deque<uint8_t> output_byte_queue;
+  jxl::JxlEncoderOutputProcessorWrapper output_processor;
   std::deque<jxl::FJXLFrameUniquePtr> output_fast_frame_queue;
+  // Pixels and format of the last animation frame, if it was encoded with the
+  // fast lossless encoder, so that only the area that changed is encoded in
+  // the next one. Empty otherwise.
+  std::vector<uint8_t> last_fast_lossless_frame;
+  JxlPixelFormat last_fast_lossless_format;
+  // Statistics of the fast lossless frames encoded with
+  // JXL_ENC_FRAME_SETTING_LIVE_CAPTURE, created with the first one.
+  jxl::FJXLLiveUniquePtr fast_lossless_live = {nullptr,
+                                               JxlFastLosslessFreeLiveState};
+  // Planes of encoded frames, reused for the input of the next frames and, with
+  // JxlEncoderResetKeepBuffers, of the next image.
+  jxl::JxlEncoderPlanePool plane_pool;
+  // Heuristics of the last frame encoded with
+  // JXL_ENC_FRAME_SETTING_TEMPORAL_REUSE, seeding those of the next frame.
+  jxl::FrameTemporalCache temporal_cache;
+  // Patches kept in a reference frame by the frames encoded with
+  // JXL_ENC_FRAME_SETTING_PERSISTENT_PATCHES.
+  jxl::PatchDictionaryCache patch_cache;
+  // Full-size input of the last frame saved by AutoCropFrame, no color if
+  // there is none.
+  jxl::ImageBundle auto_crop_canvas;
+
+  // Distances of the codestreams of a multi-rate encoding, empty otherwise,
+  // and the index of the codestream being written.
+  std::vector<float> multi_rate_distances;
+  size_t multi_rate_output = 0;
+  // Frames and boxes already written to the current codestream of a multi-rate
+  // encoding, queued again for the next codestream.
+  std::vector<jxl::JxlEncoderQueuedInput> multi_rate_inputs;
 
   // How many codestream bytes have been written, i.e.,
   // content of jxlc and jxlp boxes. Frame index box jxli
@@ -231,6 +396,10 @@ struct JxlEncoderStruct {
   bool store_jpeg_metadata;
   jxl::CodecMetadata metadata;
   std::vector<uint8_t> jpeg_metadata;
+  // Parser of the JPEG frame being added with JxlEncoderAddJPEGFrameChunk, and
+  // the JPEG data that it fills.
+  std::unique_ptr<jxl::jpeg::JpegChunkedReader> jpeg_reader;
+  std::unique_ptr<jxl::jpeg::JPEGData> chunked_jpeg_data;
 
   // Wrote any output at all, so wrote the data before the first user added
   // frame or box, such as signature, basic info, ICC profile or jpeg
@@ -252,19 +421,55 @@ struct JxlEncoderStruct {
   bool allow_expert_options = false;
   int brotli_effort = -1;
 
+  // Memory manager for the image buffers allocated by the encoder.
+  const JxlMemoryManager* ImageMemoryManager() const {
+    return max_image_buffer_pool_bytes != 0
+               ? image_buffer_pool->memory_manager()
+               : &memory_manager;
+  }
+
   // Takes the first frame in the input_queue, encodes it, and appends
-  // the bytes to the output_byte_queue.
+  // the bytes to the output_processor.
   JxlEncoderStatus RefillOutputByteQueue();
 
+  // Encodes the small frames at the front of the input_queue concurrently on
+  // the thread_pool, one frame per task, so that RefillOutputByteQueue only
+  // needs to write their bytes. Does nothing if fewer than two such frames are
+  // queued.
+  jxl::Status EncodeQueuedFramesConcurrently();
+
+  // Compresses all the boxes of the input_queue that are to be written as brob
+  // boxes and are not compressed yet concurrently on the thread_pool, one box
+  // per task, so that the metadata boxes don't each delay the output.
+  jxl::Status CompressQueuedBoxes();
+
+  // With the auto crop option, crops the prepared input_frame to the pixels
+  // that differ from the previous frame, and saves the frames as references
+  // to blend the next cropped frames onto.
+  void AutoCropFrame(jxl::JxlEncoderQueuedFrame* input_frame, bool last_frame);
+
+  // With the auto crop option, drops the complete frames queued right after
+  // input_frame that have the same pixels, and adds their durations to its
+  // duration instead.
+  void MergeRepeatedFrames(jxl::JxlEncoderQueuedFrame* input_frame);
+
+  // Whether the frames and boxes must be kept after being written, for the
+  // next codestreams of a multi-rate encoding.
+  bool KeepInputForNextOutput() const {
+    return multi_rate_output + 1 < multi_rate_distances.size();
+  }
+
   bool MustUseContainer() const {
     return use_container || (codestream_level != 5 && codestream_level != -1) ||
-           store_jpeg_metadata || use_boxes;
+           store_jpeg_metadata || use_boxes ||
+           frame_index_box.index_box_requested_through_api;
   }
 
   // Appends the bytes of a JXL box header with the provided type and size to
-  // the end of the output_byte_queue. If unbounded is true, the size won't be
+  // the end of the output_processor. If unbounded is true, the size won't be
   // added to the header and the box will be assumed to continue until EOF.
-  void AppendBoxHeader(const jxl::BoxType& type, size_t size, bool unbounded);
+  jxl::Status AppendBoxHeader(const jxl::BoxType& type, size_t size,
+                              bool unbounded);
 };
 
 struct JxlEncoderFrameSettingsStruct {
@@ -272,4 +477,16 @@ struct JxlEncoderFrameSettingsStruct {
   jxl::JxlEncoderFrameSettingsValues values;
 };
 
+struct JxlEncoderStatsStruct {
+  jxl::AuxOut aux_out;
+  // Wall time in seconds spent in each jxl::EncoderPhase.
+  std::array<double, jxl::kNumEncoderPhases> phase_seconds = {};
+  size_t num_frames = 0;
+
+  // Adds the statistics of one frame, gathered in its own AuxOut since the
+  // encoder overwrites some of the AuxOut fields for each frame.
+  void AddFrame(const jxl::AuxOut& frame_aux_out,
+                const jxl::EncoderProgress& progress);
+};
+
 #endif  // LIB_JXL_ENCODE_INTERNAL_H_
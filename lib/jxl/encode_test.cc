@@ -251,6 +251,175 @@ TEST(EncodeTest, EncoderResetTest) {
                       false);
 }
 
+TEST(EncodeTest, EncoderResetKeepBuffersTest) {
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  VerifyFrameEncoding(50, 200, enc.get(),
+                      JxlEncoderFrameSettingsCreate(enc.get(), nullptr), 4300,
+                      false);
+  // The next image fits in the retained buffers of the first one.
+  JxlEncoderResetKeepBuffers(enc.get());
+  VerifyFrameEncoding(45, 120, enc.get(),
+                      JxlEncoderFrameSettingsCreate(enc.get(), nullptr), 3000,
+                      false);
+  // This one is wider, so it can't reuse them.
+  JxlEncoderResetKeepBuffers(enc.get());
+  VerifyFrameEncoding(157, 77, enc.get(),
+                      JxlEncoderFrameSettingsCreate(enc.get(), nullptr), 2300,
+                      false);
+}
+
+TEST(EncodeTest, MemoryUsageTest) {
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  JxlMemoryUsage usage;
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderGetMemoryUsage(enc.get(), JXL_MEMORY_TAG_ALL, &usage));
+  EXPECT_EQ(0u, usage.num_allocations);
+  VerifyFrameEncoding(enc.get(),
+                      JxlEncoderFrameSettingsCreate(enc.get(), nullptr));
+  JxlMemoryUsage all;
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderGetMemoryUsage(enc.get(), JXL_MEMORY_TAG_ALL, &all));
+  EXPECT_LT(0u, all.num_allocations);
+  EXPECT_LE(all.current_bytes, all.peak_bytes);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderGetMemoryUsage(enc.get(), JXL_MEMORY_TAG_AC_COEFFICIENTS,
+                                     &usage));
+  // The default settings encode a VarDCT frame.
+  EXPECT_LT(0u, usage.peak_bytes);
+  EXPECT_LE(usage.peak_bytes, all.peak_bytes);
+  EXPECT_EQ(JXL_ENC_ERROR,
+            JxlEncoderGetMemoryUsage(enc.get(), JXL_MEMORY_TAG_NUM, &usage));
+}
+
+namespace {
+struct ProgressState {
+  std::vector<float> reports;
+  // Number of reports after which the callback requests an abort, or 0.
+  size_t abort_after = 0;
+};
+
+JXL_BOOL RecordProgress(void* opaque, float frame_progress) {
+  ProgressState* state = static_cast<ProgressState*>(opaque);
+  state->reports.push_back(frame_progress);
+  return state->reports.size() == state->abort_after ? JXL_FALSE : JXL_TRUE;
+}
+}  // namespace
+
+TEST(EncodeTest, ProgressCallbackTest) {
+  const size_t xsize = 600;
+  const size_t ysize = 300;
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  for (size_t abort_after : {0, 1, 5}) {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    ProgressState state;
+    state.abort_after = abort_after;
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetProgressCallback(
+                                   enc.get(), &RecordProgress, &state));
+    JxlBasicInfo basic_info;
+    jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+    basic_info.xsize = xsize;
+    basic_info.ysize = ysize;
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+    JxlColorEncoding color_encoding;
+    JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/false);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                      pixels.data(), pixels.size()));
+    JxlEncoderCloseInput(enc.get());
+    std::vector<uint8_t> compressed(1 << 20);
+    uint8_t* next_out = compressed.data();
+    size_t avail_out = compressed.size();
+    JxlEncoderStatus status =
+        JxlEncoderProcessOutput(enc.get(), &next_out, &avail_out);
+    if (abort_after == 0) {
+      EXPECT_EQ(JXL_ENC_SUCCESS, status);
+      ASSERT_FALSE(state.reports.empty());
+      for (size_t i = 1; i < state.reports.size(); ++i) {
+        EXPECT_LE(state.reports[i - 1], state.reports[i]);
+      }
+      EXPECT_EQ(1.0f, state.reports.back());
+    } else {
+      EXPECT_EQ(JXL_ENC_ERROR, status);
+      EXPECT_EQ(JXL_ENC_ERR_ABORTED, JxlEncoderGetError(enc.get()));
+      // The callback is not called anymore after it requested the abort.
+      EXPECT_EQ(abort_after, state.reports.size());
+    }
+  }
+}
+
+TEST(EncodeTest, StatsTest) {
+  JxlEncoderStats* lossy_stats = JxlEncoderStatsCreate();
+  JxlEncoderStats* lossless_stats = JxlEncoderStatsCreate();
+  {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderCollectStats(frame_settings, lossy_stats));
+    VerifyFrameEncoding(enc.get(), frame_settings);
+  }
+  EXPECT_EQ(1, JxlEncoderStatsGet(lossy_stats, JXL_ENC_STAT_NUM_FRAMES));
+  EXPECT_GT(JxlEncoderStatsGet(lossy_stats, JXL_ENC_STAT_AC_BITS), 0);
+  EXPECT_GT(JxlEncoderStatsGet(lossy_stats, JXL_ENC_STAT_DC_BITS), 0);
+  EXPECT_GT(
+      JxlEncoderStatsGet(lossy_stats, JXL_ENC_STAT_NUM_CLUSTERED_HISTOGRAMS),
+      0);
+  size_t num_blocks = 0;
+  for (int key = JXL_ENC_STAT_NUM_SMALL_BLOCKS;
+       key <= JXL_ENC_STAT_NUM_DCT64_BLOCKS; ++key) {
+    num_blocks +=
+        JxlEncoderStatsGet(lossy_stats, static_cast<JxlEncoderStatsKey>(key));
+  }
+  EXPECT_GT(num_blocks, 0);
+  size_t microseconds = 0;
+  for (int key = JXL_ENC_STAT_COLOR_TRANSFORM_MICROSECONDS;
+       key <= JXL_ENC_STAT_GROUPS_MICROSECONDS; ++key) {
+    microseconds +=
+        JxlEncoderStatsGet(lossy_stats, static_cast<JxlEncoderStatsKey>(key));
+  }
+  EXPECT_GT(microseconds, 0);
+
+  {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetFrameLossless(frame_settings, 1));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderCollectStats(frame_settings, lossless_stats));
+    VerifyFrameEncoding(63, 129, enc.get(), frame_settings, 3600, false);
+  }
+  EXPECT_GT(JxlEncoderStatsGet(lossless_stats, JXL_ENC_STAT_NUM_TREE_NODES),
+            0);
+  EXPECT_GT(
+      JxlEncoderStatsGet(lossless_stats, JXL_ENC_STAT_MODULAR_GLOBAL_BITS), 0);
+  EXPECT_EQ(0, JxlEncoderStatsGet(lossless_stats, JXL_ENC_STAT_AC_BITS));
+
+  const size_t lossy_ac_bits =
+      JxlEncoderStatsGet(lossy_stats, JXL_ENC_STAT_AC_BITS);
+  const size_t lossy_tree_nodes =
+      JxlEncoderStatsGet(lossy_stats, JXL_ENC_STAT_NUM_TREE_NODES);
+  JxlEncoderStatsMerge(lossy_stats, lossless_stats);
+  EXPECT_EQ(2, JxlEncoderStatsGet(lossy_stats, JXL_ENC_STAT_NUM_FRAMES));
+  EXPECT_EQ(lossy_ac_bits,
+            JxlEncoderStatsGet(lossy_stats, JXL_ENC_STAT_AC_BITS));
+  EXPECT_EQ(
+      lossy_tree_nodes +
+          JxlEncoderStatsGet(lossless_stats, JXL_ENC_STAT_NUM_TREE_NODES),
+      JxlEncoderStatsGet(lossy_stats, JXL_ENC_STAT_NUM_TREE_NODES));
+  JxlEncoderStatsDestroy(lossless_stats);
+  JxlEncoderStatsDestroy(lossy_stats);
+}
+
 TEST(EncodeTest, CmsTest) {
   JxlEncoderPtr enc = JxlEncoderMake(nullptr);
   EXPECT_NE(nullptr, enc.get());
@@ -286,6 +455,152 @@ TEST(EncodeTest, CmsTest) {
   EXPECT_TRUE(cms_called);
 }
 
+TEST(EncodeTest, MemoryLimitTest) {
+  {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+    EXPECT_EQ(JXL_ENC_ERROR,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_MEMORY_LIMIT, -2));
+    EXPECT_EQ(JXL_ENC_ERROR,
+              JxlEncoderFrameSettingsSetFloatOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_MEMORY_LIMIT, 1.0f));
+  }
+
+  {
+    // A limit that no frame fits in drops the optional passes, but the frame
+    // is still encoded.
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_EFFORT, 8));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_MEMORY_LIMIT, 1));
+    VerifyFrameEncoding(enc.get(), frame_settings);
+    EXPECT_EQ(0, enc->last_used_cparams.max_butteraugli_iters);
+    EXPECT_EQ(jxl::Override::kOff, enc->last_used_cparams.patches);
+  }
+
+  {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_MEMORY_LIMIT, 1));
+    VerifyFrameEncoding(enc.get(), frame_settings);
+    EXPECT_LT(enc->last_used_cparams.options.nb_repeats, 0.5f);
+  }
+
+  {
+    // A generous limit leaves the settings untouched.
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_EFFORT, 8));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_MEMORY_LIMIT,
+                  int64_t{1} << 32));
+    VerifyFrameEncoding(enc.get(), frame_settings);
+    EXPECT_EQ(4, enc->last_used_cparams.max_butteraugli_iters);
+  }
+}
+
+TEST(EncodeTest, DecoderThreadsTest) {
+  {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+    EXPECT_EQ(JXL_ENC_ERROR,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_DECODER_THREADS, -2));
+    EXPECT_EQ(JXL_ENC_ERROR,
+              JxlEncoderFrameSettingsSetFloatOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_DECODER_THREADS, 1.0f));
+  }
+
+  {
+    // The frame is split into two 128x128 groups instead of a single one, and
+    // still roundtrips.
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_DECODER_THREADS, 16));
+    VerifyFrameEncoding(63, 129, enc.get(), frame_settings, 5400,
+                        /*lossy_use_original_profile=*/false);
+    EXPECT_EQ(16u, enc->last_used_cparams.decoder_threads);
+  }
+}
+
+TEST(EncodeTest, TimeBudgetTest) {
+  {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+    EXPECT_EQ(JXL_ENC_ERROR,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_TIME_BUDGET, -2));
+    EXPECT_EQ(JXL_ENC_ERROR,
+              JxlEncoderFrameSettingsSetFloatOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_TIME_BUDGET, 1.0f));
+  }
+
+  {
+    // No time at all falls back to the fastest effort, and the frame is still
+    // encoded.
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_EFFORT, 8));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_TIME_BUDGET, 0));
+    VerifyFrameEncoding(63, 129, enc.get(), frame_settings, 5400,
+                        /*lossy_use_original_profile=*/false);
+    EXPECT_EQ(jxl::SpeedTier::kLightning, enc->last_used_cparams.speed_tier);
+  }
+
+  {
+    // A generous budget keeps the effort and all butteraugli iterations.
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_EFFORT, 8));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_TIME_BUDGET, 100000));
+    VerifyFrameEncoding(enc.get(), frame_settings);
+    EXPECT_EQ(jxl::SpeedTier::kKitten, enc->last_used_cparams.speed_tier);
+    EXPECT_EQ(4, enc->last_used_cparams.max_butteraugli_iters);
+  }
+}
+
 TEST(EncodeTest, frame_settingsTest) {
   {
     JxlEncoderPtr enc = JxlEncoderMake(nullptr);
@@ -870,6 +1185,53 @@ static void ProcessEncoder(JxlEncoder* enc, std::vector<uint8_t>& compressed,
   EXPECT_EQ(JXL_ENC_SUCCESS, process_result);
 }
 
+TEST(EncodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGChunkedReconstructionTest)) {
+  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
+  const jxl::PaddedBytes orig = jxl::test::ReadTestData(jpeg_path);
+
+  // Chunks that split marker segments and scans at arbitrary positions.
+  for (size_t chunk_size : {1, 7, 4096}) {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderStoreJPEGMetadata(enc.get(), JXL_TRUE));
+    for (size_t pos = 0; pos < orig.size(); pos += chunk_size) {
+      const size_t size = std::min(chunk_size, orig.size() - pos);
+      const JXL_BOOL is_last = pos + size == orig.size();
+      ASSERT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddJPEGFrameChunk(frame_settings, orig.data() + pos,
+                                            size, is_last));
+    }
+    JxlEncoderCloseInput(enc.get());
+
+    std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
+    uint8_t* next_out = compressed.data();
+    size_t avail_out = compressed.size() - (next_out - compressed.data());
+    ProcessEncoder(enc.get(), compressed, next_out, avail_out);
+
+    jxl::extras::JXLDecompressParams dparams;
+    std::vector<uint8_t> decoded_jpeg_bytes;
+    jxl::extras::PackedPixelFile ppf;
+    EXPECT_TRUE(DecodeImageJXL(compressed.data(), compressed.size(), dparams,
+                               nullptr, &ppf, &decoded_jpeg_bytes));
+
+    EXPECT_EQ(decoded_jpeg_bytes.size(), orig.size());
+    EXPECT_EQ(0, memcmp(decoded_jpeg_bytes.data(), orig.data(), orig.size()));
+  }
+
+  // A truncated JPEG is not added.
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderAddJPEGFrameChunk(frame_settings, orig.data(),
+                                        orig.size() / 2, JXL_FALSE));
+  EXPECT_EQ(JXL_ENC_ERROR, JxlEncoderAddJPEGFrameChunk(frame_settings, nullptr,
+                                                       0, JXL_TRUE));
+}
+
 TEST(EncodeTest, BasicInfoTest) {
   JxlEncoderPtr enc = JxlEncoderMake(nullptr);
   EXPECT_NE(nullptr, enc.get());
@@ -1085,49 +1447,549 @@ TEST(EncodeTest, AnimationHeaderTest) {
 
   EXPECT_EQ(true, seen_frame);
 }
-TEST(EncodeTest, CroppedFrameTest) {
+
+namespace {
+// Encodes a few small animation frames which, when a parallel runner is used,
+// are encoded concurrently.
+std::vector<uint8_t> EncodeSmallAnimation(JxlParallelRunner runner,
+                                          void* runner_opaque) {
   JxlEncoderPtr enc = JxlEncoderMake(nullptr);
   EXPECT_NE(nullptr, enc.get());
-
-  JxlEncoderFrameSettings* frame_settings =
-      JxlEncoderFrameSettingsCreate(enc.get(), NULL);
-  size_t xsize = 300;
-  size_t ysize = 300;
-  JxlPixelFormat pixel_format = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
-  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
-  std::vector<uint8_t> pixels2(pixels.size());
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetParallelRunner(enc.get(), runner, runner_opaque));
+  size_t xsize = 67;
+  size_t ysize = 45;
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
   JxlBasicInfo basic_info;
   jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
-  // Encoding a 300x300 frame in an image that is only 100x100
-  basic_info.xsize = 100;
-  basic_info.ysize = 100;
-  basic_info.uses_original_profile = JXL_TRUE;
-  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetCodestreamLevel(enc.get(), 10));
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.have_animation = true;
+  basic_info.animation.tps_numerator = 10;
+  basic_info.animation.tps_denominator = 1;
   EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
   JxlColorEncoding color_encoding;
   JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/false);
   EXPECT_EQ(JXL_ENC_SUCCESS,
             JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
-
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), NULL);
   JxlFrameHeader header;
   JxlEncoderInitFrameHeader(&header);
-  header.layer_info.have_crop = JXL_TRUE;
-  header.layer_info.xsize = xsize;
-  header.layer_info.ysize = ysize;
-  header.layer_info.crop_x0 = -50;
-  header.layer_info.crop_y0 = -250;
-  JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE);
-  JxlEncoderSetFrameHeader(frame_settings, &header);
-  JxlEncoderFrameSettingsSetOption(frame_settings, JXL_ENC_FRAME_SETTING_EFFORT,
-                                   1);
-
-  std::vector<uint8_t> compressed = std::vector<uint8_t>(100);
+  header.duration = 1;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetFrameHeader(frame_settings, &header));
+  for (size_t i = 0; i < 5; ++i) {
+    std::vector<uint8_t> pixels =
+        jxl::test::GetSomeTestImage(xsize, ysize, 3, /*seed=*/i);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                      pixels.data(), pixels.size()));
+  }
+  JxlEncoderCloseInput(enc.get());
+  std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
   uint8_t* next_out = compressed.data();
   size_t avail_out = compressed.size() - (next_out - compressed.data());
-  EXPECT_EQ(JXL_ENC_SUCCESS,
-            JxlEncoderAddImageFrame(frame_settings, &pixel_format,
-                                    pixels.data(), pixels.size()));
-  JxlEncoderCloseFrames(enc.get());
+  ProcessEncoder(enc.get(), compressed, next_out, avail_out);
+  return compressed;
+}
+}  // namespace
+
+TEST(EncodeTest, ConcurrentAnimationFramesTest) {
+  auto runner = JxlThreadParallelRunnerMake(nullptr, 4);
+  std::vector<uint8_t> compressed =
+      EncodeSmallAnimation(JxlThreadParallelRunner, runner.get());
+  // Encoding the frames one by one must give the same codestream.
+  EXPECT_EQ(EncodeSmallAnimation(nullptr, nullptr), compressed);
+
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_NE(nullptr, dec.get());
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FRAME));
+  JxlDecoderSetInput(dec.get(), compressed.data(), compressed.size());
+  JxlDecoderCloseInput(dec.get());
+  size_t num_frames = 0;
+  bool seen_last = false;
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_FRAME) {
+      JxlFrameHeader header;
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetFrameHeader(dec.get(), &header));
+      EXPECT_FALSE(seen_last);
+      seen_last = header.is_last;
+      ++num_frames;
+    } else {
+      EXPECT_EQ(JXL_DEC_SUCCESS, status);
+      break;
+    }
+  }
+  EXPECT_EQ(5u, num_frames);
+  EXPECT_TRUE(seen_last);
+}
+
+TEST(EncodeTest, FastLosslessAnimationTest) {
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  size_t xsize = 300;
+  size_t ysize = 280;
+  JxlPixelFormat pixel_format = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  JxlBasicInfo basic_info;
+  jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.uses_original_profile = JXL_TRUE;
+  basic_info.have_animation = true;
+  basic_info.animation.tps_numerator = 10;
+  basic_info.animation.tps_denominator = 1;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/false);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE));
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderFrameSettingsSetOption(frame_settings,
+                                             JXL_ENC_FRAME_SETTING_EFFORT, 1));
+  JxlFrameHeader header;
+  JxlEncoderInitFrameHeader(&header);
+  header.duration = 3;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetFrameHeader(frame_settings, &header));
+
+  // The second frame only changes a rectangle of the first one, and the third
+  // frame is equal to the second one.
+  std::vector<std::vector<uint8_t>> frames(3);
+  frames[0] = jxl::test::GetSomeTestImage(xsize, ysize, 4, /*seed=*/0);
+  frames[1] = frames[0];
+  std::vector<uint8_t> other =
+      jxl::test::GetSomeTestImage(xsize, ysize, 4, /*seed=*/1);
+  const size_t bytes_per_pixel = 8;
+  for (size_t y = 30; y < 260; ++y) {
+    const size_t offset = (y * xsize + 100) * bytes_per_pixel;
+    memcpy(frames[1].data() + offset, other.data() + offset,
+           50 * bytes_per_pixel);
+  }
+  frames[2] = frames[1];
+  for (const auto& frame : frames) {
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                      frame.data(), frame.size()));
+  }
+  JxlEncoderCloseInput(enc.get());
+  std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size() - (next_out - compressed.data());
+  ProcessEncoder(enc.get(), compressed, next_out, avail_out);
+
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_NE(nullptr, dec.get());
+  EXPECT_EQ(
+      JXL_DEC_SUCCESS,
+      JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FRAME | JXL_DEC_FULL_IMAGE));
+  JxlDecoderSetInput(dec.get(), compressed.data(), compressed.size());
+  JxlDecoderCloseInput(dec.get());
+  std::vector<uint8_t> decoded(frames[0].size());
+  size_t num_frames = 0;
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_FRAME) {
+      JxlFrameHeader header2;
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetFrameHeader(dec.get(), &header2));
+      EXPECT_EQ(header.duration, header2.duration);
+      EXPECT_EQ(num_frames == 2 ? JXL_TRUE : JXL_FALSE, header2.is_last);
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec.get(), &pixel_format,
+                                            decoded.data(), decoded.size()));
+    } else if (status == JXL_DEC_FULL_IMAGE) {
+      ASSERT_LT(num_frames, frames.size());
+      EXPECT_EQ(frames[num_frames], decoded);
+      ++num_frames;
+    } else {
+      EXPECT_EQ(JXL_DEC_SUCCESS, status);
+      break;
+    }
+  }
+  EXPECT_EQ(3u, num_frames);
+}
+
+TEST(EncodeTest, LiveCaptureTest) {
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  size_t xsize = 300;
+  size_t ysize = 280;
+  JxlPixelFormat pixel_format = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  JxlBasicInfo basic_info;
+  jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.uses_original_profile = JXL_TRUE;
+  basic_info.have_animation = true;
+  basic_info.animation.tps_numerator = 30;
+  basic_info.animation.tps_denominator = 1;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/false);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE));
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderFrameSettingsSetOption(frame_settings,
+                                             JXL_ENC_FRAME_SETTING_EFFORT, 1));
+  EXPECT_EQ(JXL_ENC_ERROR,
+            JxlEncoderFrameSettingsSetOption(
+                frame_settings, JXL_ENC_FRAME_SETTING_LIVE_CAPTURE, 2));
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderFrameSettingsSetOption(
+                frame_settings, JXL_ENC_FRAME_SETTING_LIVE_CAPTURE, 1));
+  JxlFrameHeader header;
+  JxlEncoderInitFrameHeader(&header);
+  header.duration = 1;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetFrameHeader(frame_settings, &header));
+
+  // The later frames are coded with the statistics of the first one, whatever
+  // their content, and must still be lossless.
+  std::vector<std::vector<uint8_t>> frames;
+  for (uint32_t seed = 0; seed < 4; ++seed) {
+    frames.push_back(jxl::test::GetSomeTestImage(xsize, ysize, 4, seed));
+  }
+  for (const auto& frame : frames) {
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                      frame.data(), frame.size()));
+  }
+  EXPECT_NE(nullptr, enc->fast_lossless_live.get());
+  JxlEncoderCloseInput(enc.get());
+  std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size() - (next_out - compressed.data());
+  ProcessEncoder(enc.get(), compressed, next_out, avail_out);
+
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_NE(nullptr, dec.get());
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE));
+  JxlDecoderSetInput(dec.get(), compressed.data(), compressed.size());
+  JxlDecoderCloseInput(dec.get());
+  std::vector<uint8_t> decoded(frames[0].size());
+  size_t num_frames = 0;
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec.get(), &pixel_format,
+                                            decoded.data(), decoded.size()));
+    } else if (status == JXL_DEC_FULL_IMAGE) {
+      ASSERT_LT(num_frames, frames.size());
+      EXPECT_EQ(frames[num_frames], decoded);
+      ++num_frames;
+    } else {
+      EXPECT_EQ(JXL_DEC_SUCCESS, status);
+      break;
+    }
+  }
+  EXPECT_EQ(frames.size(), num_frames);
+}
+
+TEST(EncodeTest, FrameIndexBoxTest) {
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  const size_t xsize = 64;
+  const size_t ysize = 48;
+  const size_t num_frames = 12;
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  JxlBasicInfo basic_info;
+  jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.have_animation = true;
+  basic_info.animation.tps_numerator = 10;
+  basic_info.animation.tps_denominator = 1;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/false);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+  JxlFrameHeader header;
+  JxlEncoderInitFrameHeader(&header);
+  header.duration = 1;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetFrameHeader(frame_settings, &header));
+  EXPECT_EQ(JXL_ENC_ERROR,
+            JxlEncoderFrameSettingsSetOption(frame_settings,
+                                             JXL_ENC_FRAME_INDEX_BOX, 2));
+  // Blended frames are not keyframes, so cannot be indexed.
+  JxlEncoderFrameSettings* blend_settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), frame_settings);
+  JxlFrameHeader blend_header = header;
+  blend_header.layer_info.blend_info.blendmode = JXL_BLEND_ADD;
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetFrameHeader(blend_settings, &blend_header));
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderFrameSettingsSetOption(blend_settings,
+                                             JXL_ENC_FRAME_INDEX_BOX, 1));
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  EXPECT_EQ(JXL_ENC_ERROR,
+            JxlEncoderAddImageFrame(blend_settings, &pixel_format,
+                                    pixels.data(), pixels.size()));
+  for (size_t i = 0; i < num_frames; ++i) {
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderFrameSettingsSetOption(
+                                   frame_settings, JXL_ENC_FRAME_INDEX_BOX,
+                                   (i % 4 == 0) ? 1 : 0));
+    pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, /*seed=*/i);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                      pixels.data(), pixels.size()));
+  }
+  JxlEncoderCloseInput(enc.get());
+  std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size() - (next_out - compressed.data());
+  ProcessEncoder(enc.get(), compressed, next_out, avail_out);
+
+  // Decode all frames once, which also reads the frame index box at the end.
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_NE(nullptr, dec.get());
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE |
+                                                     JXL_DEC_BOX));
+  JxlDecoderSetInput(dec.get(), compressed.data(), compressed.size());
+  JxlDecoderCloseInput(dec.get());
+  std::vector<std::vector<uint8_t>> decoded;
+  bool seen_index = false;
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_BOX) {
+      JxlBoxType type;
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderGetBoxType(dec.get(), type, JXL_FALSE));
+      seen_index |= memcmp(type, "jxli", 4) == 0;
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      decoded.emplace_back(xsize * ysize * 3);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec.get(), &pixel_format,
+                                            decoded.back().data(),
+                                            decoded.back().size()));
+    } else if (status != JXL_DEC_FULL_IMAGE) {
+      EXPECT_EQ(JXL_DEC_SUCCESS, status);
+      break;
+    }
+  }
+  EXPECT_TRUE(seen_index);
+  ASSERT_EQ(num_frames, decoded.size());
+
+  // Seeking uses the index to start decoding at the keyframe before the frame,
+  // which must give the same pixels as decoding all frames.
+  for (size_t target : {9, 2, 4}) {
+    JxlDecoderRewind(dec.get());
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE));
+    JxlDecoderSetInput(dec.get(), compressed.data(), compressed.size());
+    JxlDecoderCloseInput(dec.get());
+    JxlDecoderSkipFrames(dec.get(), target);
+    for (size_t i = target; i < num_frames; ++i) {
+      EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER,
+                JxlDecoderProcessInput(dec.get()));
+      std::vector<uint8_t> frame(xsize * ysize * 3);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec.get(), &pixel_format,
+                                            frame.data(), frame.size()));
+      EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+      EXPECT_EQ(decoded[i], frame);
+    }
+  }
+}
+
+namespace {
+// Encodes an image with a metadata box at each of the distances, with a single
+// multi-rate encoder or with one encoder per distance.
+std::vector<std::vector<uint8_t>> EncodeAtDistances(
+    const std::vector<float>& distances, bool multi_rate) {
+  const size_t xsize = 150;
+  const size_t ysize = 100;
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  const uint8_t xml_data[] = "<x:xmpmeta></x:xmpmeta>";
+  std::vector<std::vector<uint8_t>> outputs;
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  for (size_t i = 0; i < distances.size(); ++i) {
+    if (multi_rate && i > 0) {
+      EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderStartNextMultiRateOutput(enc.get()));
+    } else {
+      JxlEncoderReset(enc.get());
+      if (multi_rate) {
+        EXPECT_EQ(JXL_ENC_SUCCESS,
+                  JxlEncoderSetMultiRateDistances(enc.get(), distances.data(),
+                                                  distances.size()));
+      }
+      EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderUseBoxes(enc.get()));
+      JxlBasicInfo basic_info;
+      jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+      basic_info.xsize = xsize;
+      basic_info.ysize = ysize;
+      EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+      JxlColorEncoding color_encoding;
+      JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/false);
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddBox(enc.get(), "XML ", xml_data, sizeof(xml_data),
+                                 /*compress_box=*/JXL_FALSE));
+      JxlEncoderFrameSettings* frame_settings =
+          JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderSetFrameDistance(frame_settings, distances[i]));
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                        pixels.data(), pixels.size()));
+      JxlEncoderCloseInput(enc.get());
+    }
+    std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
+    uint8_t* next_out = compressed.data();
+    size_t avail_out = compressed.size() - (next_out - compressed.data());
+    ProcessEncoder(enc.get(), compressed, next_out, avail_out);
+    outputs.push_back(compressed);
+  }
+  if (multi_rate) {
+    // All the distances were written.
+    EXPECT_EQ(JXL_ENC_ERROR, JxlEncoderStartNextMultiRateOutput(enc.get()));
+  }
+  return outputs;
+}
+}  // namespace
+
+TEST(EncodeTest, MultiRateTest) {
+  const std::vector<float> distances = {0.5f, 1.0f, 3.0f};
+  std::vector<std::vector<uint8_t>> outputs =
+      EncodeAtDistances(distances, /*multi_rate=*/true);
+  ASSERT_EQ(distances.size(), outputs.size());
+  // Each codestream is the same as the one of a separate encoder.
+  EXPECT_EQ(EncodeAtDistances(distances, /*multi_rate=*/false), outputs);
+  EXPECT_GT(outputs[0].size(), outputs[1].size());
+  EXPECT_GT(outputs[1].size(), outputs[2].size());
+
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  // No distances, and an unfinished codestream.
+  EXPECT_EQ(JXL_ENC_ERROR,
+            JxlEncoderSetMultiRateDistances(enc.get(), distances.data(), 0));
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetMultiRateDistances(enc.get(), distances.data(),
+                                            distances.size()));
+  EXPECT_EQ(JXL_ENC_ERROR, JxlEncoderStartNextMultiRateOutput(enc.get()));
+}
+
+std::vector<uint8_t> EncodeWithTargetSize(int64_t target_size) {
+  const size_t xsize = 150;
+  const size_t ysize = 100;
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  JxlBasicInfo basic_info;
+  jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/false);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderFrameSettingsSetOption(
+                frame_settings, JXL_ENC_FRAME_SETTING_TARGET_SIZE,
+                target_size));
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                    pixels.data(), pixels.size()));
+  JxlEncoderCloseInput(enc.get());
+  std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size() - (next_out - compressed.data());
+  ProcessEncoder(enc.get(), compressed, next_out, avail_out);
+  jxl::CodecInOut decoded_io;
+  EXPECT_TRUE(jxl::test::DecodeFile(
+      {}, jxl::Span<const uint8_t>(compressed.data(), compressed.size()),
+      &decoded_io));
+  return compressed;
+}
+
+TEST(EncodeTest, TargetSizeTest) {
+  // The target only covers the frame, not the codestream headers.
+  const size_t kHeaderSize = 16;
+  const std::vector<uint8_t> unconstrained = EncodeWithTargetSize(-1);
+  const size_t target_size = unconstrained.size() / 2;
+  const std::vector<uint8_t> half = EncodeWithTargetSize(target_size);
+  EXPECT_LE(half.size(), target_size + kHeaderSize);
+  EXPECT_GT(half.size(), target_size / 2);
+  // A target that no frame fits in still produces the smallest frame.
+  const std::vector<uint8_t> tiny = EncodeWithTargetSize(1);
+  EXPECT_LT(tiny.size(), half.size());
+  // A larger target than the distance needs gives a larger frame.
+  const std::vector<uint8_t> large =
+      EncodeWithTargetSize(unconstrained.size() * 2);
+  EXPECT_GT(large.size(), unconstrained.size());
+
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+  EXPECT_EQ(JXL_ENC_ERROR,
+            JxlEncoderFrameSettingsSetOption(
+                frame_settings, JXL_ENC_FRAME_SETTING_TARGET_SIZE, -2));
+}
+
+TEST(EncodeTest, CroppedFrameTest) {
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+  size_t xsize = 300;
+  size_t ysize = 300;
+  JxlPixelFormat pixel_format = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  std::vector<uint8_t> pixels2(pixels.size());
+  JxlBasicInfo basic_info;
+  jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+  // Encoding a 300x300 frame in an image that is only 100x100
+  basic_info.xsize = 100;
+  basic_info.ysize = 100;
+  basic_info.uses_original_profile = JXL_TRUE;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetCodestreamLevel(enc.get(), 10));
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/false);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+
+  JxlFrameHeader header;
+  JxlEncoderInitFrameHeader(&header);
+  header.layer_info.have_crop = JXL_TRUE;
+  header.layer_info.xsize = xsize;
+  header.layer_info.ysize = ysize;
+  header.layer_info.crop_x0 = -50;
+  header.layer_info.crop_y0 = -250;
+  JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE);
+  JxlEncoderSetFrameHeader(frame_settings, &header);
+  JxlEncoderFrameSettingsSetOption(frame_settings, JXL_ENC_FRAME_SETTING_EFFORT,
+                                   1);
+
+  std::vector<uint8_t> compressed = std::vector<uint8_t>(100);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size() - (next_out - compressed.data());
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                    pixels.data(), pixels.size()));
+  JxlEncoderCloseFrames(enc.get());
   ProcessEncoder(enc.get(), compressed, next_out, avail_out);
 
   JxlDecoderPtr dec = JxlDecoderMake(nullptr);
@@ -1171,6 +2033,261 @@ TEST(EncodeTest, CroppedFrameTest) {
   EXPECT_EQ(true, seen_frame);
 }
 
+namespace {
+struct ChunkedInputState {
+  const std::vector<uint8_t>* pixels;
+  size_t xsize;
+  JxlPixelFormat pixel_format;
+  std::vector<uint8_t> tile;
+  size_t requested = 0;
+  size_t released = 0;
+};
+
+const void* GetChunkedColorData(void* opaque, size_t xpos, size_t ypos,
+                                size_t xsize, size_t ysize,
+                                size_t* row_offset) {
+  ChunkedInputState* state = static_cast<ChunkedInputState*>(opaque);
+  EXPECT_EQ(0u, xpos % 256);
+  EXPECT_EQ(0u, ypos % 256);
+  EXPECT_LE(xsize, 256u);
+  EXPECT_LE(ysize, 256u);
+  // Copy the requested rectangle to a separate buffer, so that stride and
+  // offset handling is exercised.
+  const size_t bytes_per_pixel = state->pixel_format.num_channels * 2;
+  const size_t full_stride = state->xsize * bytes_per_pixel;
+  *row_offset = xsize * bytes_per_pixel + 8;
+  state->tile.resize(*row_offset * ysize);
+  for (size_t y = 0; y < ysize; ++y) {
+    memcpy(state->tile.data() + y * *row_offset,
+           state->pixels->data() + (ypos + y) * full_stride +
+               xpos * bytes_per_pixel,
+           xsize * bytes_per_pixel);
+  }
+  state->requested++;
+  return state->tile.data();
+}
+}  // namespace
+
+TEST(EncodeTest, ChunkedFrameTest) {
+  size_t xsize = 300;
+  size_t ysize = 290;
+  JxlPixelFormat pixel_format = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+
+  std::vector<uint8_t> compressed[2];
+  for (int chunked = 0; chunked <= 1; ++chunked) {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+    JxlBasicInfo basic_info;
+    jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+    basic_info.xsize = xsize;
+    basic_info.ysize = ysize;
+    basic_info.uses_original_profile = JXL_TRUE;
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetCodestreamLevel(enc.get(), 10));
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+    JxlColorEncoding color_encoding;
+    JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/false);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+    JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE);
+    JxlEncoderFrameSettingsSetOption(frame_settings,
+                                     JXL_ENC_FRAME_SETTING_EFFORT, 3);
+
+    ChunkedInputState state;
+    state.pixels = &pixels;
+    state.xsize = xsize;
+    state.pixel_format = pixel_format;
+    if (chunked) {
+      JxlChunkedFrameInputSource input;
+      input.opaque = &state;
+      input.get_color_channels_pixel_format = [](void* opaque,
+                                                 JxlPixelFormat* format) {
+        *format = static_cast<ChunkedInputState*>(opaque)->pixel_format;
+      };
+      input.get_color_channel_data_at = GetChunkedColorData;
+      input.get_extra_channel_pixel_format = nullptr;
+      input.get_extra_channel_data_at = nullptr;
+      input.release_buffer = [](void* opaque, const void* /*buf*/) {
+        static_cast<ChunkedInputState*>(opaque)->released++;
+      };
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddChunkedFrame(frame_settings, JXL_TRUE, input));
+      EXPECT_EQ(4u, state.requested);
+      EXPECT_EQ(state.requested, state.released);
+    } else {
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                        pixels.data(), pixels.size()));
+      JxlEncoderCloseInput(enc.get());
+    }
+    compressed[chunked].resize(64);
+    uint8_t* next_out = compressed[chunked].data();
+    size_t avail_out = compressed[chunked].size();
+    ProcessEncoder(enc.get(), compressed[chunked], next_out, avail_out);
+  }
+  EXPECT_EQ(compressed[0], compressed[1]);
+}
+
+TEST(EncodeTest, PlanarFrameTest) {
+  size_t xsize = 123;
+  size_t ysize = 77;
+  JxlPixelFormat pixel_format = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  // The planes have padding at the end of each row.
+  const size_t stride = xsize * 2 + 6;
+  std::vector<uint8_t> planes[4];
+  for (size_t c = 0; c < 4; ++c) {
+    planes[c].resize(stride * ysize);
+    for (size_t y = 0; y < ysize; ++y) {
+      for (size_t x = 0; x < xsize; ++x) {
+        const size_t pos = ((y * xsize + x) * 4 + c) * 2;
+        planes[c][y * stride + x * 2] = pixels[pos];
+        planes[c][y * stride + x * 2 + 1] = pixels[pos + 1];
+      }
+    }
+  }
+
+  std::vector<uint8_t> compressed[2];
+  for (int planar = 0; planar <= 1; ++planar) {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+    JxlBasicInfo basic_info;
+    jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+    basic_info.xsize = xsize;
+    basic_info.ysize = ysize;
+    basic_info.uses_original_profile = JXL_TRUE;
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetCodestreamLevel(enc.get(), 10));
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+    JxlColorEncoding color_encoding;
+    JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/false);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+    JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE);
+    JxlEncoderFrameSettingsSetOption(frame_settings,
+                                     JXL_ENC_FRAME_SETTING_EFFORT, 3);
+    if (planar) {
+      const void* plane_ptrs[4] = {planes[0].data(), planes[1].data(),
+                                   planes[2].data(), planes[3].data()};
+      const size_t strides[4] = {stride, stride, stride, stride};
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddImageFramePlanar(frame_settings, &pixel_format,
+                                              plane_ptrs, strides));
+    } else {
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                        pixels.data(), pixels.size()));
+    }
+    JxlEncoderCloseInput(enc.get());
+    compressed[planar].resize(64);
+    uint8_t* next_out = compressed[planar].data();
+    size_t avail_out = compressed[planar].size();
+    ProcessEncoder(enc.get(), compressed[planar], next_out, avail_out);
+  }
+  EXPECT_EQ(compressed[0], compressed[1]);
+}
+
+namespace {
+struct OutputProcessorState {
+  std::vector<uint8_t> output;
+  std::vector<uint8_t> buffer;
+  size_t max_buffer_size;
+  uint64_t finalized_position = 0;
+};
+}  // namespace
+
+TEST(EncodeTest, OutputProcessorTest) {
+  size_t xsize = 123;
+  size_t ysize = 77;
+  JxlPixelFormat pixel_format = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+
+  // Effort 1 lossless uses the fast lossless encoder, which writes its output
+  // separately. Small buffer sizes exercise the splitting of the output.
+  for (int effort : {1, 7}) {
+    for (size_t max_buffer_size : {size_t(5), size_t(1) << 20}) {
+      std::vector<uint8_t> compressed[2];
+      for (int use_processor = 0; use_processor <= 1; ++use_processor) {
+        JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+        EXPECT_NE(nullptr, enc.get());
+        EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderUseContainer(enc.get(), true));
+        JxlEncoderFrameSettings* frame_settings =
+            JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+        JxlBasicInfo basic_info;
+        jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+        basic_info.xsize = xsize;
+        basic_info.ysize = ysize;
+        basic_info.uses_original_profile = JXL_TRUE;
+        EXPECT_EQ(JXL_ENC_SUCCESS,
+                  JxlEncoderSetCodestreamLevel(enc.get(), 10));
+        EXPECT_EQ(JXL_ENC_SUCCESS,
+                  JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+        JxlColorEncoding color_encoding;
+        JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/false);
+        EXPECT_EQ(JXL_ENC_SUCCESS,
+                  JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+        JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE);
+        JxlEncoderFrameSettingsSetOption(frame_settings,
+                                         JXL_ENC_FRAME_SETTING_EFFORT, effort);
+
+        OutputProcessorState state;
+        state.max_buffer_size = max_buffer_size;
+        if (use_processor) {
+          JxlEncoderOutputProcessor processor;
+          processor.opaque = &state;
+          processor.get_buffer = [](void* opaque, size_t* size) -> void* {
+            auto* state = static_cast<OutputProcessorState*>(opaque);
+            *size = std::min(*size, state->max_buffer_size);
+            state->buffer.resize(*size);
+            return state->buffer.data();
+          };
+          processor.release_buffer = [](void* opaque, size_t written_bytes) {
+            auto* state = static_cast<OutputProcessorState*>(opaque);
+            EXPECT_LE(written_bytes, state->buffer.size());
+            state->output.insert(state->output.end(), state->buffer.begin(),
+                                 state->buffer.begin() + written_bytes);
+          };
+          processor.seek = nullptr;
+          processor.set_finalized_position = [](void* opaque,
+                                                uint64_t finalized_position) {
+            auto* state = static_cast<OutputProcessorState*>(opaque);
+            EXPECT_LE(state->finalized_position, finalized_position);
+            EXPECT_EQ(finalized_position, state->output.size());
+            state->finalized_position = finalized_position;
+          };
+          EXPECT_EQ(JXL_ENC_SUCCESS,
+                    JxlEncoderSetOutputProcessor(enc.get(), processor));
+        }
+        EXPECT_EQ(JXL_ENC_SUCCESS,
+                  JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                          pixels.data(), pixels.size()));
+        JxlEncoderCloseInput(enc.get());
+        if (use_processor) {
+          uint8_t dummy[64];
+          uint8_t* next_out = dummy;
+          size_t avail_out = sizeof(dummy);
+          EXPECT_EQ(JXL_ENC_ERROR,
+                    JxlEncoderProcessOutput(enc.get(), &next_out, &avail_out));
+          EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderFlushInput(enc.get()));
+          EXPECT_EQ(state.finalized_position, state.output.size());
+          compressed[use_processor] = state.output;
+        } else {
+          EXPECT_EQ(JXL_ENC_ERROR, JxlEncoderFlushInput(enc.get()));
+          compressed[use_processor].resize(64);
+          uint8_t* next_out = compressed[use_processor].data();
+          size_t avail_out = compressed[use_processor].size();
+          ProcessEncoder(enc.get(), compressed[use_processor], next_out,
+                         avail_out);
+        }
+      }
+      EXPECT_EQ(compressed[0], compressed[1]);
+    }
+  }
+}
+
 TEST(EncodeTest, JXL_BOXES_TEST(BoxTest)) {
   // Test with uncompressed boxes and with brob boxes
   for (int compress_box = 0; compress_box <= 1; ++compress_box) {
@@ -1296,6 +2413,80 @@ TEST(EncodeTest, JXL_BOXES_TEST(BoxTest)) {
   }
 }
 
+namespace {
+// Encodes a small image after three brob boxes which, when a parallel runner
+// is used, are compressed concurrently.
+std::vector<uint8_t> EncodeWithCompressedBoxes(JxlParallelRunner runner,
+                                               void* runner_opaque) {
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetParallelRunner(enc.get(), runner, runner_opaque));
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderUseBoxes(enc.get()));
+  size_t xsize = 30;
+  size_t ysize = 20;
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  JxlBasicInfo basic_info;
+  jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/false);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+  for (const char* type : {"xml ", "jumb", "abcd"}) {
+    std::string contents;
+    for (size_t i = 0; i < 1000; ++i) contents += type + std::to_string(i);
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(contents.data());
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddBox(enc.get(), type, data, contents.size(),
+                               /*compress_box=*/JXL_TRUE));
+  }
+  JxlEncoderCloseBoxes(enc.get());
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), NULL);
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                    pixels.data(), pixels.size()));
+  JxlEncoderCloseInput(enc.get());
+  std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size() - (next_out - compressed.data());
+  ProcessEncoder(enc.get(), compressed, next_out, avail_out);
+  return compressed;
+}
+}  // namespace
+
+TEST(EncodeTest, JXL_BOXES_TEST(ConcurrentBoxCompressionTest)) {
+  auto runner = JxlThreadParallelRunnerMake(nullptr, 4);
+  std::vector<uint8_t> compressed =
+      EncodeWithCompressedBoxes(JxlThreadParallelRunner, runner.get());
+  // Compressing the boxes one by one must give the same file.
+  EXPECT_EQ(EncodeWithCompressedBoxes(nullptr, nullptr), compressed);
+
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_NE(nullptr, dec.get());
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetDecompressBoxes(dec.get(), JXL_TRUE));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_BOX));
+  JxlDecoderSetInput(dec.get(), compressed.data(), compressed.size());
+  JxlDecoderCloseInput(dec.get());
+  std::vector<std::string> types;
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_SUCCESS) break;
+    ASSERT_EQ(JXL_DEC_BOX, status);
+    JxlBoxType type;
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetBoxType(dec.get(), type, true));
+    if (memcmp(type, "JXL ", 4) != 0 && memcmp(type, "ftyp", 4) != 0 &&
+        memcmp(type, "jxl", 3) != 0) {
+      types.emplace_back(type, 4);
+    }
+  }
+  EXPECT_EQ((std::vector<std::string>{"xml ", "jumb", "abcd"}), types);
+}
+
 #if JPEGXL_ENABLE_JPEG  // Loading .jpg files requires libjpeg support.
 TEST(EncodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGFrameTest)) {
   for (int skip_basic_info = 0; skip_basic_info < 2; skip_basic_info++) {
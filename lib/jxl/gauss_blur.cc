@@ -372,10 +372,10 @@ void VerticalStrip(const hwy::AlignedUniquePtr<RecursiveGaussian>& rg,
   }
 }
 
-// Apply 1D vertical scan to multiple columns (one per vector lane).
-// Not yet parallelized.
+// Apply 1D vertical scan to multiple columns (one per vector lane), with one
+// task per strip of columns.
 void FastGaussianVertical(const hwy::AlignedUniquePtr<RecursiveGaussian>& rg,
-                          const ImageF& in, ThreadPool* /*pool*/,
+                          const ImageF& in, ThreadPool* pool,
                           ImageF* JXL_RESTRICT out) {
   PROFILER_FUNC;
   JXL_CHECK(SameSize(in, *out));
@@ -386,13 +386,20 @@ void FastGaussianVertical(const hwy::AlignedUniquePtr<RecursiveGaussian>& rg,
       (kVN < kCacheLineLanes) ? (kCacheLineLanes / kVN) : 4;
   constexpr size_t kFastPace = kCacheLineVectors * kVN;
 
-  size_t x = 0;
-  for (; x + kFastPace <= in.xsize(); x += kFastPace) {
-    VerticalStrip<kCacheLineVectors>(rg, in, x, out);
-  }
-  for (; x < in.xsize(); x += kVN) {
-    VerticalStrip<1>(rg, in, x, out);
-  }
+  // Full cache lines first, then single vectors for the remaining columns.
+  const size_t num_fast = in.xsize() / kFastPace;
+  const size_t fast_end = num_fast * kFastPace;
+  const size_t num_strips = num_fast + DivCeil(in.xsize() - fast_end, kVN);
+  JXL_CHECK(RunOnPool(
+      pool, 0, num_strips, ThreadPool::NoInit,
+      [&](const uint32_t task, size_t /*thread*/) {
+        if (task < num_fast) {
+          VerticalStrip<kCacheLineVectors>(rg, in, task * kFastPace, out);
+        } else {
+          VerticalStrip<1>(rg, in, fast_end + (task - num_fast) * kVN, out);
+        }
+      },
+      "FastGaussianVertical"));
 }
 
 // TODO(veluca): consider replacing with FastGaussian.
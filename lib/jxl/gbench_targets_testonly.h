@@ -0,0 +1,44 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_GBENCH_TARGETS_TESTONLY_H_
+#define LIB_JXL_GBENCH_TARGETS_TESTONLY_H_
+
+// Registration of benchmarks for each Highway target.
+
+#include <hwy/targets.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+namespace jxl {
+
+// Registers the benchmark "`name`/<target>" for each Highway target that is
+// compiled in and supported by the CPU. It runs `function` with the dynamic
+// dispatch restricted to that target, including the choice of the
+// implementation of the render pipeline stages created by `function`.
+// Returns the benchmarks, for setting their arguments.
+template <class Function>
+std::vector<benchmark::internal::Benchmark*> RegisterForEachTarget(
+    const std::string& name, const Function& function) {
+  std::vector<benchmark::internal::Benchmark*> benchmarks;
+  for (const uint32_t target : hwy::SupportedAndGeneratedTargets()) {
+    const std::string target_name = name + "/" + hwy::TargetName(target);
+    benchmarks.push_back(benchmark::RegisterBenchmark(
+        target_name.c_str(), [target, function](benchmark::State& state) {
+          hwy::SetSupportedTargetsForTest(target);
+          function(state);
+          hwy::SetSupportedTargetsForTest(0);
+        }));
+  }
+  return benchmarks;
+}
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_GBENCH_TARGETS_TESTONLY_H_
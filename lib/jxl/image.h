@@ -69,6 +69,10 @@ struct PlaneBase {
   JXL_INLINE size_t xsize() const { return xsize_; }
   JXL_INLINE size_t ysize() const { return ysize_; }
 
+  // Dimensions the image was allocated with, up to which ShrinkTo may grow it.
+  JXL_INLINE size_t orig_xsize() const { return orig_xsize_; }
+  JXL_INLINE size_t orig_ysize() const { return orig_ysize_; }
+
   // NOTE: do not use this for copying rows - the valid xsize may be much less.
   JXL_INLINE size_t bytes_per_row() const { return bytes_per_row_; }
 
@@ -13,6 +13,7 @@
 #include <limits>
 #include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/profiler.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"
@@ -147,9 +148,9 @@ Image3<T> CopyImage(const Image3<T>& from) {
 template <typename T>
 Image3<T> CopyImage(const Rect& rect, const Image3<T>& from) {
   Image3<T> to(rect.xsize(), rect.ysize());
-  CopyImageTo(rect, from.Plane(0), to.Plane(0));
-  CopyImageTo(rect, from.Plane(1), to.Plane(1));
-  CopyImageTo(rect, from.Plane(2), to.Plane(2));
+  CopyImageTo(rect, from.Plane(0), &to.Plane(0));
+  CopyImageTo(rect, from.Plane(1), &to.Plane(1));
+  CopyImageTo(rect, from.Plane(2), &to.Plane(2));
   return to;
 }
 
@@ -323,6 +324,34 @@ void ZeroFillImage(Plane<T>* image) {
   }
 }
 
+// Writes to every memory page of a freshly allocated image, in parallel, so
+// that the page faults are spread over the threads instead of slowing down the
+// first pass over the image. The pixel values remain undefined.
+template <typename T>
+Status PrefaultImage(ThreadPool* pool, Image3<T>* image) {
+  const size_t xsize = image->xsize();
+  const size_t ysize = image->ysize();
+  if (xsize == 0 || ysize == 0) return true;
+  constexpr size_t kPageSize = 4096;
+  constexpr size_t kBytesPerTask = size_t{1} << 20;
+  const size_t rows_per_task =
+      std::max<size_t>(kBytesPerTask / image->bytes_per_row(), 1);
+  const size_t num_stripes = DivCeil(ysize, rows_per_task);
+  const auto touch = [&](const uint32_t task, size_t /* thread */) {
+    const size_t c = task % 3;
+    const size_t y0 = task / 3 * rows_per_task;
+    const size_t y1 = std::min(y0 + rows_per_task, ysize);
+    for (size_t y = y0; y < y1; ++y) {
+      T* JXL_RESTRICT row = image->PlaneRow(c, y);
+      for (size_t x = 0; x < xsize; x += kPageSize / sizeof(T)) {
+        row[x] = T(0);
+      }
+    }
+  };
+  return RunOnPool(pool, 0, 3 * num_stripes, ThreadPool::NoInit, touch,
+                   "PrefaultImage");
+}
+
 // Mirrors out of bounds coordinates and returns valid coordinates unchanged.
 // We assume the radius (distance outside the image) is small compared to the
 // image size, otherwise this might not terminate.
@@ -69,6 +69,39 @@ TEST(ImageTest, TestAllocator) {
   }
 }
 
+// Large allocations with huge pages keep the requested offset.
+TEST(ImageTest, TestHugePageAllocator) {
+  CacheAligned::ScopedHugePages huge_pages(true);
+  const size_t size = CacheAligned::kMinHugePageAllocation + 4;
+  for (size_t offset = 0; offset <= CacheAligned::kAlias;
+       offset += 4 * CacheAligned::kAlignment) {
+    uint8_t* bytes =
+        static_cast<uint8_t*>(CacheAligned::Allocate(size, offset));
+    ASSERT_TRUE(bytes != nullptr);
+    if (offset != 0) {
+      EXPECT_EQ(offset % CacheAligned::kAlias,
+                reinterpret_cast<uintptr_t>(bytes) % CacheAligned::kAlias);
+    }
+    memset(bytes, 1, size);
+    EXPECT_EQ(1, bytes[size - 1]);
+    CacheAligned::Free(bytes);
+  }
+}
+
+TEST(ImageTest, TestPrefaultImage) {
+  Image3F image(1000, 700);
+  FillImage(1.0f, &image);
+  JXL_CHECK(PrefaultImage(nullptr, &image));
+  size_t num_zeros = 0;
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < image.ysize(); ++y) {
+      num_zeros += image.ConstPlaneRow(c, y)[0] == 0.0f;
+    }
+  }
+  // Every row starts in a page that was touched.
+  EXPECT_EQ(3 * image.ysize(), num_zeros);
+}
+
 template <typename T>
 void TestFillImpl(Image3<T>* img, const char* layout) {
   FillImage(T(1), img);
@@ -8,11 +8,13 @@
 #include <stdlib.h>
 #include <string.h> /* for memset, memcpy */
 
+#include <atomic>
 #include <deque>
 #include <string>
 #include <vector>
 
 #include "lib/jxl/base/bits.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/common.h"
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/jpeg/dec_jpeg_serialization_state.h"
@@ -200,6 +202,27 @@ static JXL_INLINE void WriteSymbol(int symbol, HuffmanCodeTable* table,
   }
 }
 
+// Writes the Huffman code of the symbol followed by nbits extra bits. The
+// bit buffer always has room for 16 bits, so if the code and the extra bits
+// together are not longer than that, they are written with one call of
+// WriteBits.
+template <int kOutputMode>
+static JXL_INLINE void WriteSymbolAndBits(int symbol, HuffmanCodeTable* table,
+                                          int nbits, uint32_t bits,
+                                          JpegBitWriter* bw) {
+  if (kOutputMode == OutputModes::kModeWrite) {
+    const int depth = table->depth[symbol];
+    if (depth > 0 && depth + nbits <= 16) {
+      WriteBits(bw, depth + nbits, (table->code[symbol] << nbits) | bits);
+      return;
+    }
+  }
+  WriteSymbol<kOutputMode>(symbol, table, bw);
+  if (nbits > 0) {
+    WriteBits(bw, nbits, bits);
+  }
+}
+
 // Emit all buffered data to the bit stream using the given Huffman code and
 // bit writer.
 template <int kOutputMode>
@@ -497,11 +520,12 @@ bool EncodeDCTBlockSequential(const coeff_t* coeffs, HuffmanCodeTable* dc_huff,
     temp2--;
   }
   int dc_nbits = (temp == 0) ? 0 : (FloorLog2Nonzero<uint32_t>(temp) + 1);
-  WriteSymbol<kOutputMode>(dc_nbits, dc_huff, bw);
-  if (dc_nbits >= 12) return false;
-  if (dc_nbits > 0) {
-    WriteBits(bw, dc_nbits, temp2 & ((1u << dc_nbits) - 1));
+  if (dc_nbits >= 12) {
+    WriteSymbol<kOutputMode>(dc_nbits, dc_huff, bw);
+    return false;
   }
+  WriteSymbolAndBits<kOutputMode>(dc_nbits, dc_huff, dc_nbits,
+                                  temp2 & ((1u << dc_nbits) - 1), bw);
   int r = 0;
   for (int k = 1; k < 64; ++k) {
     if ((temp = coeffs[kJPEGNaturalOrder[k]]) == 0) {
@@ -522,8 +546,8 @@ bool EncodeDCTBlockSequential(const coeff_t* coeffs, HuffmanCodeTable* dc_huff,
     int ac_nbits = FloorLog2Nonzero<uint32_t>(temp) + 1;
     if (ac_nbits >= 16) return false;
     int symbol = (r << 4u) + ac_nbits;
-    WriteSymbol<kOutputMode>(symbol, ac_huff, bw);
-    WriteBits(bw, ac_nbits, temp2 & ((1 << ac_nbits) - 1));
+    WriteSymbolAndBits<kOutputMode>(symbol, ac_huff, ac_nbits,
+                                    temp2 & ((1 << ac_nbits) - 1), bw);
     r = 0;
   }
   for (int i = 0; i < num_zero_runs; ++i) {
@@ -747,27 +771,22 @@ SerializationStatus JXL_NOINLINE DoEncodeScan(const JPEGData& jpg,
   const int Ss = is_progressive ? scan_info.Ss : 0;
   const int Se = is_progressive ? scan_info.Se : 63;
 
-  // DC-only is defined by [0..0] spectral range.
-  const bool want_ac = ((Ss != 0) || (Se != 0));
-  // TODO: support streaming decoding again.
-  const bool complete_ac = true;
-  const bool has_ac = true;
-  if (want_ac && !has_ac) return SerializationStatus::NEEDS_MORE_INPUT;
-
-  // |has_ac| implies |complete_dc| but not vice versa; for the sake of
-  // simplicity we pretend they are equal, because they are separated by just a
-  // few bytes of input.
-  const bool complete_dc = has_ac;
-  const bool complete = want_ac ? complete_ac : complete_dc;
-  // When "incomplete" |ac_dc| tracks information about current ("incomplete")
-  // band parsing progress.
-
-  // FIXME: Is this always complete?
-  // const int last_mcu_y =
-  //     complete ? MCU_rows : parsing_state.internal->ac_dc.next_mcu_y *
-  //     v_group;
-  (void)complete;
-  const int last_mcu_y = complete ? MCU_rows : 0;
+  // Only the MCU rows covered by the available rows of the image are encoded,
+  // the next call continues the scan from there.
+  int last_mcu_y = MCU_rows;
+  if (state->num_available_rows < jpg.height) {
+    int max_v_samp_factor = 1;
+    for (const auto& c : jpg.components) {
+      max_v_samp_factor = std::max(c.v_samp_factor, max_v_samp_factor);
+    }
+    const size_t v_group =
+        is_interleaved
+            ? 1
+            : jpg.components[scan_info.components[0].comp_idx].v_samp_factor;
+    const size_t num_rows = state->num_available_rows * v_group /
+                            (8 * max_v_samp_factor);
+    last_mcu_y = std::min<size_t>(MCU_rows, num_rows);
+  }
 
   for (; ss.mcu_y < last_mcu_y; ++ss.mcu_y) {
     for (int mcu_x = 0; mcu_x < MCUs_per_row; ++mcu_x) {
@@ -837,6 +856,8 @@ SerializationStatus JXL_NOINLINE DoEncodeScan(const JPEGData& jpg,
   }
   if (ss.mcu_y < MCU_rows) {
     if (!bw->healthy) return SerializationStatus::ERROR;
+    // The complete bytes can already be output.
+    if (bw->pos > 0) SwapBuffer(bw);
     return SerializationStatus::NEEDS_MORE_INPUT;
   }
   Flush<kOutputMode>(coding_state, bw);
@@ -941,7 +962,8 @@ SerializationStatus SerializeSection(uint8_t marker, SerializationState* state,
   }
 }
 
-// TODO(veluca): add streaming support again.
+// Serializes `jpg` as far as `ss->num_available_rows` allows. Output that `out`
+// does not accept stays in `ss` and is written first by the next call.
 template <int kOutputMode>
 Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
                          SerializationState* ss) {
@@ -954,6 +976,7 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
           return StatusMessage(Status(StatusCode::kNotEnoughBytes),
                                "Failed to write output");
         }
+        chunk.next += num_written;
         chunk.len -= num_written;
         if (chunk.len == 0) {
           ss->output_queue.pop_front();
@@ -963,6 +986,7 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
     return true;
   };
 
+  JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
   while (true) {
     switch (ss->stage) {
       case SerializationState::STAGE_INIT: {
@@ -991,8 +1015,8 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
         }
 
         EncodeSOI(ss);
-        JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
         ss->stage = SerializationState::STAGE_SERIALIZE_SECTION;
+        JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
         break;
       }
 
@@ -1009,15 +1033,21 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
           ss->stage = SerializationState::STAGE_ERROR;
           break;
         }
-        JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
-        if (status == SerializationStatus::NEEDS_MORE_INPUT) {
-          return JXL_FAILURE("Incomplete serialization data");
-        } else if (status != SerializationStatus::DONE) {
+        if (status == SerializationStatus::DONE) {
+          ++ss->section_index;
+        } else if (status != SerializationStatus::NEEDS_MORE_INPUT) {
           JXL_DASSERT(false);
           ss->stage = SerializationState::STAGE_ERROR;
           break;
         }
-        ++ss->section_index;
+        JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
+        if (status == SerializationStatus::NEEDS_MORE_INPUT) {
+          if (ss->num_available_rows >= jpg.height) {
+            return JXL_FAILURE("Incomplete serialization data");
+          }
+          // Continued by the next call, with more available rows.
+          return true;
+        }
         break;
       }
 
@@ -1034,13 +1064,100 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
   }
 }
 
+// Serializes the markers in order, except for the scans, which only depend on
+// the Huffman tables defined before them: these are encoded on the pool from a
+// copy of the state at their position. The output is written once all scans
+// are done. Only valid for JPEGs without explicit padding bits, which are
+// consumed in output order.
+Status WriteJpegParallel(const JPEGData& jpg, const JPEGOutput& out,
+                         ThreadPool* pool) {
+  JXL_DASSERT(!jpg.has_zero_padding_bit);
+  if (jpg.marker_order.empty()) {
+    return JXL_FAILURE("JPEG serialization error");
+  }
+  SerializationState ss;
+  ss.dc_huff_table.resize(kMaxHuffmanTables);
+  ss.ac_huff_table.resize(kMaxHuffmanTables);
+  // Output of the markers between the scans, and of the scans. A deque, since
+  // the sections and states must not move.
+  std::deque<std::deque<OutputChunk>> sections;
+  std::deque<SerializationState> scans;
+  std::vector<size_t> scan_sections;
+  EncodeSOI(&ss);
+  for (uint8_t marker : jpg.marker_order) {
+    if (marker == 0xDA) {
+      if (static_cast<size_t>(ss.scan_index) >= jpg.scan_info.size()) {
+        return JXL_FAILURE("JPEG serialization error");
+      }
+      scans.emplace_back();
+      SerializationState& scan = scans.back();
+      scan.stage = SerializationState::STAGE_SERIALIZE_SECTION;
+      scan.scan_index = ss.scan_index++;
+      scan.dc_huff_table = ss.dc_huff_table;
+      scan.ac_huff_table = ss.ac_huff_table;
+      scan.seen_dri_marker = ss.seen_dri_marker;
+      scan.is_progressive = ss.is_progressive;
+      sections.emplace_back(std::move(ss.output_queue));
+      ss.output_queue.clear();
+      scan_sections.push_back(sections.size());
+      sections.emplace_back();
+      continue;
+    }
+    if (SerializeSection<OutputModes::kModeWrite>(marker, &ss, jpg) !=
+        SerializationStatus::DONE) {
+      JXL_WARNING("Failed to encode marker 0x%.2x", marker);
+      return JXL_FAILURE("JPEG serialization error");
+    }
+  }
+  sections.emplace_back(std::move(ss.output_queue));
+
+  std::atomic<bool> has_error{false};
+  const auto encode_scan = [&](const uint32_t i, size_t /* thread */) {
+    SerializationState& scan = scans[i];
+    if (EncodeScan<OutputModes::kModeWrite>(jpg, &scan) !=
+        SerializationStatus::DONE) {
+      has_error = true;
+      return;
+    }
+    sections[scan_sections[i]] = std::move(scan.output_queue);
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, scans.size(), ThreadPool::NoInit,
+                                encode_scan, "EncodeJpegScan"));
+  if (has_error) return JXL_FAILURE("JPEG serialization error");
+
+  for (std::deque<OutputChunk>& section : sections) {
+    for (OutputChunk& chunk : section) {
+      while (chunk.len > 0) {
+        size_t num_written = out(chunk.next, chunk.len);
+        if (num_written == 0) {
+          return StatusMessage(Status(StatusCode::kNotEnoughBytes),
+                               "Failed to write output");
+        }
+        chunk.next += num_written;
+        chunk.len -= num_written;
+      }
+    }
+  }
+  return true;
+}
+
 }  // namespace
 
-Status WriteJpeg(const JPEGData& jpg, const JPEGOutput& out) {
+Status WriteJpeg(const JPEGData& jpg, const JPEGOutput& out, ThreadPool* pool) {
+  if (pool != nullptr && jpg.scan_info.size() > 1 &&
+      !jpg.has_zero_padding_bit) {
+    return WriteJpegParallel(jpg, out, pool);
+  }
   SerializationState ss;
   return WriteJpegInternal<OutputModes::kModeWrite>(jpg, out, &ss);
 }
 
+Status WriteJpegRows(const JPEGData& jpg, size_t num_rows,
+                     const JPEGOutput& out, SerializationState* ss) {
+  ss->num_available_rows = num_rows;
+  return WriteJpegInternal<OutputModes::kModeWrite>(jpg, out, ss);
+}
+
 Status ProcessJpeg(const JPEGData& jpg, SerializationState* ss) {
   auto nullout = [](const uint8_t* buf, size_t len) { return len; };
   return WriteJpegInternal<OutputModes::kModeHistogram>(jpg, nullout, ss);
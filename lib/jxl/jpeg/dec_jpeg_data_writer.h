@@ -13,6 +13,7 @@
 
 #include <functional>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/jpeg/dec_jpeg_serialization_state.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
 
@@ -23,7 +24,17 @@ namespace jpeg {
 // written.
 using JPEGOutput = std::function<size_t(const uint8_t* buf, size_t len)>;
 
-Status WriteJpeg(const JPEGData& jpg, const JPEGOutput& out);
+// If `pool` is not null, the scans of multi-scan JPEGs, such as progressive
+// ones, are encoded in parallel.
+Status WriteJpeg(const JPEGData& jpg, const JPEGOutput& out,
+                 ThreadPool* pool = nullptr);
+
+// Continues the serialization of `jpg` in `ss` up to the last MCU row that is
+// covered by the first `num_rows` rows of the image, which must not change
+// anymore. The JPEG is complete once `ss->stage` is STAGE_DONE. Output that is
+// not accepted by `out` is kept in `ss` and written by the next call.
+Status WriteJpegRows(const JPEGData& jpg, size_t num_rows,
+                     const JPEGOutput& out, SerializationState* ss);
 
 // Same as WriteJpeg, but instead of writing to the output, collects statistics
 // about the bit-stream into `ss`.
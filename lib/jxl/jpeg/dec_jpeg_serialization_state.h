@@ -7,6 +7,7 @@
 #define LIB_JXL_JPEG_DEC_JPEG_SERIALIZATION_STATE_H_
 
 #include <deque>
+#include <limits>
 #include <vector>
 
 #include "lib/jxl/jpeg/dec_jpeg_output_chunk.h"
@@ -86,6 +87,9 @@ struct SerializationState {
   const uint8_t* pad_bits_end = nullptr;
   bool seen_dri_marker = false;
   bool is_progressive = false;
+  // Number of rows of the image, from the top, whose coefficients are final.
+  // Scans stop before the first MCU row that is not covered by them.
+  size_t num_available_rows = std::numeric_limits<size_t>::max();
 
   EncodeScanState scan_state;
 };
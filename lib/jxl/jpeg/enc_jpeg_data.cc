@@ -299,17 +299,24 @@ Status EncodeJPEGData(JPEGData& jpeg_data, PaddedBytes* bytes,
   return true;
 }
 
-Status DecodeImageJPG(const Span<const uint8_t> bytes, CodecInOut* io) {
+Status DecodeImageJPG(const Span<const uint8_t> bytes, CodecInOut* io,
+                      ThreadPool* pool) {
   if (!IsJPG(bytes)) return false;
+  std::unique_ptr<jpeg::JPEGData> jpeg_data = make_unique<jpeg::JPEGData>();
+  if (!jpeg::ReadJpeg(bytes.data(), bytes.size(), jpeg::JpegReadMode::kReadAll,
+                      jpeg_data.get(), pool)) {
+    return JXL_FAILURE("Error reading JPEG");
+  }
+  return SetImageFromJpegData(std::move(jpeg_data), io);
+}
+
+Status SetImageFromJpegData(std::unique_ptr<JPEGData> jpeg_data_in,
+                            CodecInOut* io) {
   io->frames.clear();
   io->frames.reserve(1);
   io->frames.emplace_back(&io->metadata.m);
-  io->Main().jpeg_data = make_unique<jpeg::JPEGData>();
+  io->Main().jpeg_data = std::move(jpeg_data_in);
   jpeg::JPEGData* jpeg_data = io->Main().jpeg_data.get();
-  if (!jpeg::ReadJpeg(bytes.data(), bytes.size(), jpeg::JpegReadMode::kReadAll,
-                      jpeg_data)) {
-    return JXL_FAILURE("Error reading JPEG");
-  }
   JXL_RETURN_IF_ERROR(
       SetColorEncodingFromJpegData(*jpeg_data, &io->metadata.m.color_encoding));
   JXL_RETURN_IF_ERROR(SetBlobsFromJpegData(*jpeg_data, &io->blobs));
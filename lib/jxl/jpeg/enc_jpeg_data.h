@@ -6,6 +6,9 @@
 #ifndef LIB_JXL_JPEG_ENC_JPEG_DATA_H_
 #define LIB_JXL_JPEG_ENC_JPEG_DATA_H_
 
+#include <memory>
+
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/padded_bytes.h"
 #include "lib/jxl/codec_in_out.h"
 #include "lib/jxl/enc_params.h"
@@ -23,7 +26,15 @@ Status SetColorEncodingFromJpegData(const jpeg::JPEGData& jpg,
  * Decodes bytes containing JPEG codestream into a CodecInOut as coefficients
  * only, for lossless JPEG transcoding.
  */
-Status DecodeImageJPG(Span<const uint8_t> bytes, CodecInOut* io);
+Status DecodeImageJPG(Span<const uint8_t> bytes, CodecInOut* io,
+                      ThreadPool* pool = nullptr);
+
+/**
+ * Same as DecodeImageJPG, but from a JPEG codestream that is already parsed
+ * into jpeg_data.
+ */
+Status SetImageFromJpegData(std::unique_ptr<JPEGData> jpeg_data,
+                            CodecInOut* io);
 
 }  // namespace jpeg
 }  // namespace jxl
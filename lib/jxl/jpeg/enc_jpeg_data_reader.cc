@@ -9,9 +9,11 @@
 #include <string.h>
 
 #include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"
@@ -24,6 +26,10 @@ namespace jpeg {
 namespace {
 static const int kBrunsliMaxSampling = 15;
 
+// Minimum number of MCUs of a scan that one task decodes when the restart
+// intervals are decoded in parallel.
+static const int kMinMCUsPerTask = 1024;
+
 // Macros for commonly used error conditions.
 
 #define JXL_JPEG_VERIFY_LEN(n)                                \
@@ -435,16 +441,17 @@ struct BitReaderState {
   // Enqueue the padding bits seen (0 or 1).
   // Returns false if there is inconsistent or invalid padding or the stream
   // ended too early.
-  bool FinishStream(JPEGData* jpg, size_t* pos) {
+  bool FinishStream(std::vector<uint8_t>* padding_bits,
+                    bool* has_zero_padding_bit, size_t* pos) {
     int npadbits = bits_left_ & 7;
     if (npadbits > 0) {
       uint64_t padmask = (1ULL << npadbits) - 1;
       uint64_t padbits = (val_ >> (bits_left_ - npadbits)) & padmask;
       if (padbits != padmask) {
-        jpg->has_zero_padding_bit = true;
+        *has_zero_padding_bit = true;
       }
       for (int i = npadbits - 1; i >= 0; --i) {
-        jpg->padding_bits.push_back((padbits >> i) & 1);
+        padding_bits->push_back((padbits >> i) & 1);
       }
     }
     // Give back some bytes that we did not use.
@@ -728,7 +735,8 @@ bool ProcessRestart(const uint8_t* data, const size_t len,
                     int* next_restart_marker, BitReaderState* br,
                     JPEGData* jpg) {
   size_t pos = 0;
-  if (!br->FinishStream(jpg, &pos)) {
+  if (!br->FinishStream(&jpg->padding_bits, &jpg->has_zero_padding_bit,
+                        &pos)) {
     return JXL_FAILURE("Invalid scan");
   }
   int expected_marker = 0xd0 + *next_restart_marker;
@@ -744,11 +752,44 @@ bool ProcessRestart(const uint8_t* data, const size_t len,
   return true;
 }
 
+// Finds the positions of the first `num_markers` restart markers of the
+// entropy-coded data that starts at data[pos]. Returns false if the data ends
+// before, or if they are not in the expected order.
+bool FindRestartMarkers(const uint8_t* data, const size_t len, size_t pos,
+                        int num_markers, std::vector<size_t>* marker_pos) {
+  marker_pos->clear();
+  while (static_cast<int>(marker_pos->size()) < num_markers) {
+    const void* next = memchr(data + pos, 0xff, len - std::min(pos, len));
+    if (next == nullptr) return false;
+    pos = static_cast<const uint8_t*>(next) - data;
+    if (pos + 1 >= len) return false;
+    const int marker = data[pos + 1];
+    if (marker != 0) {
+      const int expected_marker = 0xd0 + (marker_pos->size() & 7);
+      if (marker != expected_marker) return false;
+      marker_pos->push_back(pos);
+    }
+    pos += 2;
+  }
+  return true;
+}
+
+// Side information of the restart intervals of a scan decoded by one task.
+struct ScanSideInfo {
+  std::vector<uint32_t> reset_points;
+  std::vector<JPEGScanInfo::ExtraZeroRunInfo> extra_zero_runs;
+  std::vector<uint8_t> padding_bits;
+  bool has_zero_padding_bit = false;
+  // Position after the last interval.
+  size_t end_pos = 0;
+};
+
 bool ProcessScan(const uint8_t* data, const size_t len,
                  const std::vector<HuffmanTableEntry>& dc_huff_lut,
                  const std::vector<HuffmanTableEntry>& ac_huff_lut,
                  uint16_t scan_progression[kMaxComponents][kDCTBlockSize],
-                 bool is_progressive, size_t* pos, JPEGData* jpg) {
+                 bool is_progressive, ThreadPool* pool, size_t* pos,
+                 JPEGData* jpg) {
   if (!ProcessSOS(data, len, pos, jpg)) {
     return false;
   }
@@ -770,12 +811,6 @@ bool ProcessScan(const uint8_t* data, const size_t len,
     MCUs_per_row = DivCeil(jpg->width * c.h_samp_factor, 8 * max_h_samp_factor);
     MCU_rows = DivCeil(jpg->height * c.v_samp_factor, 8 * max_v_samp_factor);
   }
-  coeff_t last_dc_coeff[kMaxComponents] = {0};
-  BitReaderState br(data, len, *pos);
-  int restarts_to_go = jpg->restart_interval;
-  int next_restart_marker = 0;
-  int eobrun = -1;
-  int block_scan_index = 0;
   const int Al = is_progressive ? scan_info->Al : 0;
   const int Ah = is_progressive ? scan_info->Ah : 0;
   const int Ss = is_progressive ? scan_info->Ss : 0;
@@ -802,27 +837,32 @@ bool ProcessScan(const uint8_t* data, const size_t len,
   if (Al > 10) {
     return JXL_FAILURE("Scan parameter Al=%d is not supported.", Al);
   }
-  for (int mcu_y = 0; mcu_y < MCU_rows; ++mcu_y) {
-    for (int mcu_x = 0; mcu_x < MCUs_per_row; ++mcu_x) {
-      // Handle the restart intervals.
-      if (jpg->restart_interval > 0) {
-        if (restarts_to_go == 0) {
-          if (ProcessRestart(data, len, &next_restart_marker, &br, jpg)) {
-            restarts_to_go = jpg->restart_interval;
-            memset(static_cast<void*>(last_dc_coeff), 0, sizeof(last_dc_coeff));
-            if (eobrun > 0) {
-              return JXL_FAILURE("End-of-block run too long.");
-            }
-            eobrun = -1;  // fresh start
-          } else {
-            return JXL_FAILURE("Could not process restart.");
-          }
-        }
-        --restarts_to_go;
-      }
+  int blocks_per_mcu = 1;
+  if (is_interleaved) {
+    blocks_per_mcu = 0;
+    for (size_t i = 0; i < scan_info->num_components; ++i) {
+      const int comp_idx = scan_info->components[i].comp_idx;
+      const JPEGComponent& c = jpg->components[comp_idx];
+      blocks_per_mcu += c.h_samp_factor * c.v_samp_factor;
+    }
+  }
+  const int num_mcus = MCU_rows * MCUs_per_row;
+  const int restart_interval =
+      jpg->restart_interval > 0 ? jpg->restart_interval : num_mcus;
+  const int num_segments = DivCeil(num_mcus, std::max(restart_interval, 1));
+
+  // Decodes the MCUs [mcu_begin, mcu_end) of one restart interval from `br`.
+  const auto decode_mcus = [&](int mcu_begin, int mcu_end, BitReaderState* br,
+                               ScanSideInfo* side_info) -> bool {
+    coeff_t last_dc_coeff[kMaxComponents] = {0};
+    int eobrun = -1;
+    int block_scan_index = mcu_begin * blocks_per_mcu;
+    for (int mcu = mcu_begin; mcu < mcu_end; ++mcu) {
+      const int mcu_y = mcu / MCUs_per_row;
+      const int mcu_x = mcu % MCUs_per_row;
       // Decode one MCU.
       for (size_t i = 0; i < scan_info->num_components; ++i) {
-        JPEGComponentScanInfo* si = &scan_info->components[i];
+        const JPEGComponentScanInfo* si = &scan_info->components[i];
         JPEGComponent* c = &jpg->components[si->comp_idx];
         const HuffmanTableEntry* dc_lut =
             &dc_huff_lut[si->dc_tbl_idx * kJpegHuffmanLutSize];
@@ -840,36 +880,104 @@ bool ProcessScan(const uint8_t* data, const size_t len,
             coeff_t* coeffs = &c->coeffs[block_idx * kDCTBlockSize];
             if (Ah == 0) {
               if (!DecodeDCTBlock(dc_lut, ac_lut, Ss, Se, Al, &eobrun,
-                                  &reset_state, &num_zero_runs, &br, jpg,
+                                  &reset_state, &num_zero_runs, br, jpg,
                                   &last_dc_coeff[si->comp_idx], coeffs)) {
                 return false;
               }
             } else {
               if (!RefineDCTBlock(ac_lut, Ss, Se, Al, &eobrun, &reset_state,
-                                  &br, jpg, coeffs)) {
+                                  br, jpg, coeffs)) {
                 return false;
               }
             }
             if (reset_state) {
-              scan_info->reset_points.emplace_back(block_scan_index);
+              side_info->reset_points.emplace_back(block_scan_index);
             }
             if (num_zero_runs > 0) {
               JPEGScanInfo::ExtraZeroRunInfo info;
               info.block_idx = block_scan_index;
               info.num_extra_zero_runs = num_zero_runs;
-              scan_info->extra_zero_runs.push_back(info);
+              side_info->extra_zero_runs.push_back(info);
             }
             ++block_scan_index;
           }
         }
       }
     }
-  }
-  if (eobrun > 0) {
-    return JXL_FAILURE("End-of-block run too long.");
-  }
-  if (!br.FinishStream(jpg, pos)) {
-    return JXL_FAILURE("Invalid scan.");
+    if (eobrun > 0) {
+      return JXL_FAILURE("End-of-block run too long.");
+    }
+    return true;
+  };
+
+  std::vector<size_t> restart_pos;
+  if (pool != nullptr && num_segments > 1 &&
+      num_mcus >= 2 * kMinMCUsPerTask &&
+      FindRestartMarkers(data, len, *pos, num_segments - 1, &restart_pos)) {
+    // The restart intervals are decoded independently, in tasks of
+    // consecutive intervals whose side information is appended in order.
+    const int segments_per_task =
+        DivCeil(kMinMCUsPerTask, std::max(restart_interval, 1));
+    const int num_tasks = DivCeil(num_segments, segments_per_task);
+    std::vector<ScanSideInfo> task_info(num_tasks);
+    std::atomic<bool> has_error{false};
+    const auto decode_task = [&](const uint32_t task, size_t /* thread */) {
+      ScanSideInfo* side_info = &task_info[task];
+      const int begin = task * segments_per_task;
+      const int end = std::min(num_segments, begin + segments_per_task);
+      for (int s = begin; s < end; ++s) {
+        BitReaderState br(data, len, s == 0 ? *pos : restart_pos[s - 1] + 2);
+        const int mcu_begin = s * restart_interval;
+        const int mcu_end = std::min(num_mcus, mcu_begin + restart_interval);
+        size_t segment_end = 0;
+        if (!decode_mcus(mcu_begin, mcu_end, &br, side_info) ||
+            !br.FinishStream(&side_info->padding_bits,
+                             &side_info->has_zero_padding_bit, &segment_end) ||
+            (s + 1 < num_segments && segment_end != restart_pos[s])) {
+          has_error = true;
+          return;
+        }
+        side_info->end_pos = segment_end;
+      }
+    };
+    if (!RunOnPool(pool, 0, num_tasks, ThreadPool::NoInit, decode_task,
+                   "DecodeJpegScan") ||
+        has_error) {
+      return JXL_FAILURE("Invalid scan.");
+    }
+    for (ScanSideInfo& side_info : task_info) {
+      scan_info->reset_points.insert(scan_info->reset_points.end(),
+                                     side_info.reset_points.begin(),
+                                     side_info.reset_points.end());
+      scan_info->extra_zero_runs.insert(scan_info->extra_zero_runs.end(),
+                                        side_info.extra_zero_runs.begin(),
+                                        side_info.extra_zero_runs.end());
+      jpg->padding_bits.insert(jpg->padding_bits.end(),
+                               side_info.padding_bits.begin(),
+                               side_info.padding_bits.end());
+      jpg->has_zero_padding_bit |= side_info.has_zero_padding_bit;
+    }
+    *pos = task_info.back().end_pos;
+  } else {
+    BitReaderState br(data, len, *pos);
+    int next_restart_marker = 0;
+    ScanSideInfo side_info;
+    for (int s = 0; s < num_segments; ++s) {
+      if (s > 0 && !ProcessRestart(data, len, &next_restart_marker, &br, jpg)) {
+        return JXL_FAILURE("Could not process restart.");
+      }
+      const int mcu_begin = s * restart_interval;
+      const int mcu_end = std::min(num_mcus, mcu_begin + restart_interval);
+      if (!decode_mcus(mcu_begin, mcu_end, &br, &side_info)) {
+        return false;
+      }
+    }
+    scan_info->reset_points = std::move(side_info.reset_points);
+    scan_info->extra_zero_runs = std::move(side_info.extra_zero_runs);
+    if (!br.FinishStream(&jpg->padding_bits, &jpg->has_zero_padding_bit,
+                         pos)) {
+      return JXL_FAILURE("Invalid scan.");
+    }
   }
   if (*pos > len) {
     return JXL_FAILURE("Unexpected end of file during scan. pos=%" PRIuS
@@ -916,10 +1024,144 @@ size_t FindNextMarker(const uint8_t* data, const size_t len, size_t pos) {
   return num_skipped;
 }
 
+// Whether the marker is followed by a marker segment (with a length).
+bool HasMarkerSegment(int marker) {
+  return marker != 0xd8 && marker != 0xd9 && (marker < 0xd0 || marker > 0xd7);
+}
+
+}  // namespace
+
+// State of the parser that is carried from one marker segment to the next.
+struct JpegReaderState {
+  JpegReaderState()
+      : dc_huff_lut(kMaxHuffmanTables * kJpegHuffmanLutSize),
+        ac_huff_lut(kMaxHuffmanTables * kJpegHuffmanLutSize) {}
+
+  std::vector<HuffmanTableEntry> dc_huff_lut;
+  std::vector<HuffmanTableEntry> ac_huff_lut;
+  bool found_sof = false;
+  bool found_dri = false;
+  uint16_t scan_progression[kMaxComponents][kDCTBlockSize] = {{0}};
+  bool is_progressive = false;  // default
+  // Pool used to decode the restart intervals of the scans, may be null.
+  ThreadPool* pool = nullptr;
+};
+
+namespace {
+
+// Parses the marker segment of marker, which starts at data[*pos] right after
+// the marker, and appends the marker to jpg->marker_order.
+bool ProcessMarkerSegment(int marker, const uint8_t* data, const size_t len,
+                          JpegReadMode mode, JpegReaderState* state,
+                          size_t* pos, JPEGData* jpg) {
+  bool ok = true;
+  switch (marker) {
+    case 0xc0:
+    case 0xc1:
+    case 0xc2:
+      state->is_progressive = (marker == 0xc2);
+      ok = ProcessSOF(data, len, mode, pos, jpg);
+      state->found_sof = true;
+      break;
+    case 0xc4:
+      ok = ProcessDHT(data, len, mode, &state->dc_huff_lut,
+                      &state->ac_huff_lut, pos, jpg);
+      break;
+    case 0xd0:
+    case 0xd1:
+    case 0xd2:
+    case 0xd3:
+    case 0xd4:
+    case 0xd5:
+    case 0xd6:
+    case 0xd7:
+      // RST markers do not have any data.
+      break;
+    case 0xd9:
+      // Found end marker.
+      break;
+    case 0xda:
+      if (mode == JpegReadMode::kReadAll) {
+        ok = ProcessScan(data, len, state->dc_huff_lut, state->ac_huff_lut,
+                         state->scan_progression, state->is_progressive,
+                         state->pool, pos, jpg);
+      }
+      break;
+    case 0xdb:
+      ok = ProcessDQT(data, len, pos, jpg);
+      break;
+    case 0xdd:
+      ok = ProcessDRI(data, len, pos, &state->found_dri, jpg);
+      break;
+    case 0xe0:
+    case 0xe1:
+    case 0xe2:
+    case 0xe3:
+    case 0xe4:
+    case 0xe5:
+    case 0xe6:
+    case 0xe7:
+    case 0xe8:
+    case 0xe9:
+    case 0xea:
+    case 0xeb:
+    case 0xec:
+    case 0xed:
+    case 0xee:
+    case 0xef:
+      if (mode != JpegReadMode::kReadTables) {
+        ok = ProcessAPP(data, len, pos, jpg);
+      }
+      break;
+    case 0xfe:
+      if (mode != JpegReadMode::kReadTables) {
+        ok = ProcessCOM(data, len, pos, jpg);
+      }
+      break;
+    default:
+      return JXL_FAILURE("Unsupported marker: %d pos=%" PRIuS " len=%" PRIuS,
+                         marker, *pos, len);
+  }
+  if (!ok) {
+    return false;
+  }
+  jpg->marker_order.push_back(marker);
+  return true;
+}
+
+// Checks the parsed stream once all markers are read, the bytes after the EOI
+// marker are in tail[0 ... tail_len).
+bool FinishJpeg(const uint8_t* tail, const size_t tail_len, JpegReadMode mode,
+                const JpegReaderState& state, JPEGData* jpg) {
+  if (!state.found_sof) {
+    return JXL_FAILURE("Missing SOF marker.");
+  }
+
+  // Supplemental checks.
+  if (mode == JpegReadMode::kReadAll) {
+    if (tail_len > 0) {
+      jpg->tail_data = std::vector<uint8_t>(tail, tail + tail_len);
+    }
+    if (!FixupIndexes(jpg)) {
+      return false;
+    }
+    if (jpg->huffman_code.empty()) {
+      // Section B.2.4.2: "If a table has never been defined for a particular
+      // destination, then when this destination is specified in a scan header,
+      // the results are unpredictable."
+      return JXL_FAILURE("Need at least one Huffman code table.");
+    }
+    if (jpg->huffman_code.size() >= kMaxDHTMarkers) {
+      return JXL_FAILURE("Too many Huffman tables.");
+    }
+  }
+  return true;
+}
+
 }  // namespace
 
 bool ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
-              JPEGData* jpg) {
+              JPEGData* jpg, ThreadPool* pool) {
   size_t pos = 0;
   // Check SOI marker.
   JXL_JPEG_EXPECT_MARKER();
@@ -928,15 +1170,10 @@ bool ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
   if (marker != 0xd8) {
     return JXL_FAILURE("Did not find expected SOI marker, actual=%d", marker);
   }
-  int lut_size = kMaxHuffmanTables * kJpegHuffmanLutSize;
-  std::vector<HuffmanTableEntry> dc_huff_lut(lut_size);
-  std::vector<HuffmanTableEntry> ac_huff_lut(lut_size);
-  bool found_sof = false;
-  bool found_dri = false;
-  uint16_t scan_progression[kMaxComponents][kDCTBlockSize] = {{0}};
+  JpegReaderState state;
+  state.pool = pool;
 
   jpg->padding_bits.resize(0);
-  bool is_progressive = false;  // default
   do {
     // Read next marker.
     size_t num_skipped = FindNextMarker(data, len, pos);
@@ -949,105 +1186,92 @@ bool ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
     JXL_JPEG_EXPECT_MARKER();
     marker = data[pos + 1];
     pos += 2;
-    bool ok = true;
-    switch (marker) {
-      case 0xc0:
-      case 0xc1:
-      case 0xc2:
-        is_progressive = (marker == 0xc2);
-        ok = ProcessSOF(data, len, mode, &pos, jpg);
-        found_sof = true;
-        break;
-      case 0xc4:
-        ok = ProcessDHT(data, len, mode, &dc_huff_lut, &ac_huff_lut, &pos, jpg);
-        break;
-      case 0xd0:
-      case 0xd1:
-      case 0xd2:
-      case 0xd3:
-      case 0xd4:
-      case 0xd5:
-      case 0xd6:
-      case 0xd7:
-        // RST markers do not have any data.
-        break;
-      case 0xd9:
-        // Found end marker.
-        break;
-      case 0xda:
-        if (mode == JpegReadMode::kReadAll) {
-          ok = ProcessScan(data, len, dc_huff_lut, ac_huff_lut,
-                           scan_progression, is_progressive, &pos, jpg);
-        }
-        break;
-      case 0xdb:
-        ok = ProcessDQT(data, len, &pos, jpg);
-        break;
-      case 0xdd:
-        ok = ProcessDRI(data, len, &pos, &found_dri, jpg);
-        break;
-      case 0xe0:
-      case 0xe1:
-      case 0xe2:
-      case 0xe3:
-      case 0xe4:
-      case 0xe5:
-      case 0xe6:
-      case 0xe7:
-      case 0xe8:
-      case 0xe9:
-      case 0xea:
-      case 0xeb:
-      case 0xec:
-      case 0xed:
-      case 0xee:
-      case 0xef:
-        if (mode != JpegReadMode::kReadTables) {
-          ok = ProcessAPP(data, len, &pos, jpg);
-        }
-        break;
-      case 0xfe:
-        if (mode != JpegReadMode::kReadTables) {
-          ok = ProcessCOM(data, len, &pos, jpg);
-        }
-        break;
-      default:
-        return JXL_FAILURE("Unsupported marker: %d pos=%" PRIuS " len=%" PRIuS,
-                           marker, pos, len);
-    }
-    if (!ok) {
+    if (!ProcessMarkerSegment(marker, data, len, mode, &state, &pos, jpg)) {
       return false;
     }
-    jpg->marker_order.push_back(marker);
-    if (mode == JpegReadMode::kReadHeader && found_sof) {
+    if (mode == JpegReadMode::kReadHeader && state.found_sof) {
       break;
     }
   } while (marker != 0xd9);
 
-  if (!found_sof) {
-    return JXL_FAILURE("Missing SOF marker.");
-  }
+  return FinishJpeg(data + std::min(pos, len), len - std::min(pos, len), mode,
+                    state, jpg);
+}
 
-  // Supplemental checks.
-  if (mode == JpegReadMode::kReadAll) {
-    if (pos < len) {
-      jpg->tail_data = std::vector<uint8_t>(data + pos, data + len);
+JpegChunkedReader::JpegChunkedReader(JPEGData* jpg, ThreadPool* pool)
+    : jpg_(jpg), state_(new JpegReaderState()) {
+  state_->pool = pool;
+}
+
+JpegChunkedReader::~JpegChunkedReader() = default;
+
+bool JpegChunkedReader::Append(const uint8_t* data, const size_t len) {
+  buffer_.insert(buffer_.end(), data, data + len);
+  const uint8_t* buf = buffer_.data();
+  const size_t size = buffer_.size();
+  if (!found_soi_) {
+    if (size < 2) return true;
+    if (buf[0] != 0xff || buf[1] != 0xd8) {
+      return JXL_FAILURE("Did not find expected SOI marker");
     }
-    if (!FixupIndexes(jpg)) {
-      return false;
+    pos_ = 2;
+    found_soi_ = true;
+    jpg_->padding_bits.resize(0);
+  }
+  while (!found_eoi_) {
+    const size_t num_skipped = FindNextMarker(buf, size, pos_);
+    const size_t marker_pos = pos_ + num_skipped;
+    // Wait for the rest of the in-between-markers data.
+    if (marker_pos + 2 > size) break;
+    const int marker = buf[marker_pos + 1];
+    size_t end = marker_pos + 2;
+    if (HasMarkerSegment(marker)) {
+      if (end + 2 > size) break;
+      end += (buf[end] << 8) + buf[end + 1];
+      if (end > size) break;
+      if (marker == 0xda) {
+        // The entropy-coded data of the scan ends at the first marker that is
+        // not a restart marker, which must be available to parse the scan.
+        size_t i = std::max(end, scan_search_pos_);
+        while (i + 1 < size &&
+               (buf[i] != 0xff || buf[i + 1] == 0 ||
+                (buf[i + 1] >= 0xd0 && buf[i + 1] <= 0xd7))) {
+          ++i;
+        }
+        if (i + 1 >= size) {
+          scan_search_pos_ = i;
+          break;
+        }
+      }
     }
-    if (jpg->huffman_code.empty()) {
-      // Section B.2.4.2: "If a table has never been defined for a particular
-      // destination, then when this destination is specified in a scan header,
-      // the results are unpredictable."
-      return JXL_FAILURE("Need at least one Huffman code table.");
+    if (num_skipped > 0) {
+      // Add a fake marker to indicate arbitrary in-between-markers data.
+      jpg_->marker_order.push_back(0xff);
+      jpg_->inter_marker_data.emplace_back(buf + pos_, buf + marker_pos);
     }
-    if (jpg->huffman_code.size() >= kMaxDHTMarkers) {
-      return JXL_FAILURE("Too many Huffman tables.");
+    pos_ = marker_pos + 2;
+    if (!ProcessMarkerSegment(marker, buf, size, JpegReadMode::kReadAll,
+                              state_.get(), &pos_, jpg_)) {
+      return false;
     }
+    scan_search_pos_ = 0;
+    found_eoi_ = (marker == 0xd9);
   }
+  if (found_eoi_) return true;
+  // Only keep the bytes that are not parsed yet.
+  buffer_.erase(buffer_.begin(), buffer_.begin() + pos_);
+  scan_search_pos_ -= std::min(scan_search_pos_, pos_);
+  pos_ = 0;
   return true;
 }
 
+bool JpegChunkedReader::Finish() {
+  if (!found_eoi_) {
+    return JXL_FAILURE("Unexpected end of input: missing EOI marker");
+  }
+  return FinishJpeg(buffer_.data() + pos_, buffer_.size() - pos_,
+                    JpegReadMode::kReadAll, *state_, jpg_);
+}
+
 }  // namespace jpeg
 }  // namespace jxl
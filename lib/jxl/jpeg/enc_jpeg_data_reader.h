@@ -11,6 +11,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <memory>
+#include <vector>
+
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
 
 namespace jxl {
@@ -27,8 +31,41 @@ enum class JpegReadMode {
 // If mode is kReadHeader, it fills in only the image dimensions in *jpg.
 // Returns false if the data is not valid JPEG, or if it contains an unsupported
 // JPEG feature.
+// If `pool` is not null, the restart intervals of large scans are decoded in
+// parallel.
 bool ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
-              JPEGData* jpg);
+              JPEGData* jpg, ThreadPool* pool = nullptr);
+
+struct JpegReaderState;
+
+// Parses a JPEG stream that is provided in chunks into *jpg, like ReadJpeg with
+// kReadAll. Each marker segment, and each scan with its entropy-coded data, is
+// parsed as soon as its last byte arrives, so only the bytes of the segment or
+// scan being received are buffered.
+class JpegChunkedReader {
+ public:
+  explicit JpegChunkedReader(JPEGData* jpg, ThreadPool* pool = nullptr);
+  ~JpegChunkedReader();
+
+  // Appends data[0 ... len) to the stream and parses the segments that it
+  // completes. Returns false if the data is not valid JPEG, or if it contains
+  // an unsupported JPEG feature.
+  bool Append(const uint8_t* data, size_t len);
+
+  // Ends the stream. Returns false if it is not a complete JPEG stream.
+  bool Finish();
+
+ private:
+  JPEGData* jpg_;
+  std::unique_ptr<JpegReaderState> state_;
+  // Bytes that are not parsed yet, starting at pos_.
+  std::vector<uint8_t> buffer_;
+  size_t pos_ = 0;
+  // Where the search for the end of the scan being received continues.
+  size_t scan_search_pos_ = 0;
+  bool found_soi_ = false;
+  bool found_eoi_ = false;
+};
 
 }  // namespace jpeg
 }  // namespace jxl
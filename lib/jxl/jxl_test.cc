@@ -40,6 +40,7 @@
 #include "lib/jxl/jpeg/dec_jpeg_data.h"
 #include "lib/jxl/jpeg/dec_jpeg_data_writer.h"
 #include "lib/jxl/jpeg/enc_jpeg_data.h"
+#include "lib/jxl/jpeg/enc_jpeg_data_reader.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
 #include "lib/jxl/modular/options.h"
 #include "lib/jxl/test_image.h"
@@ -361,6 +362,24 @@ TEST(JxlTest, RoundtripLargeFast) {
   EXPECT_THAT(ComputeDistance2(t.ppf(), ppf_out), IsSlightlyBelow(100));
 }
 
+// Huge pages and prefaulting only change how the buffers are allocated.
+TEST(JxlTest, RoundtripLargeHugePages) {
+  ThreadPoolForTests pool(8);
+  const PaddedBytes orig = jxl::test::ReadTestData("jxl/flower/flower.png");
+  TestImage t;
+  t.DecodeFromBytes(orig).ClearMetadata();
+
+  JXLCompressParams cparams;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 3);
+
+  PackedPixelFile ppf_out;
+  const size_t size = Roundtrip(t.ppf(), cparams, {}, &pool, &ppf_out);
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_HUGE_PAGES, 1);
+  PackedPixelFile ppf_huge_pages;
+  EXPECT_EQ(size, Roundtrip(t.ppf(), cparams, {}, &pool, &ppf_huge_pages));
+  EXPECT_EQ(0.0, ComputeDistance2(ppf_out, ppf_huge_pages));
+}
+
 TEST(JxlTest, RoundtripDotsForceEpf) {
   ThreadPoolForTests pool(8);
   const PaddedBytes orig = jxl::test::ReadTestData(
@@ -1003,6 +1022,31 @@ TEST(JxlTest, JXL_SLOW_TEST(RoundtripLossless8LightningGradient)) {
   EXPECT_EQ(ComputeDistance2(t.ppf(), ppf_out), 0.0);
 }
 
+TEST(JxlTest, RoundtripLossless8LightningFewColors) {
+  ThreadPoolForTests pool(8);
+  for (size_t channels = 1; channels <= 4; ++channels) {
+    TestImage t;
+    t.SetDimensions(300, 300).SetChannels(channels);
+    TestImage::Frame frame = t.AddFrame();
+    // Few colors with sparse gray levels, which are encoded with a palette.
+    for (size_t y = 0; y < t.ppf().info.ysize; ++y) {
+      for (size_t x = 0; x < t.ppf().info.xsize; ++x) {
+        size_t color = (x / 7 + y / 5) % 6;
+        for (size_t c = 0; c < channels; ++c) {
+          frame.SetValue(y, x, c, ((color + c) % 6) / 5.0f);
+        }
+      }
+    }
+
+    JXLCompressParams cparams = CompressParamsForLossless();
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 1);  // kLightning
+
+    PackedPixelFile ppf_out;
+    Roundtrip(t.ppf(), cparams, {}, &pool, &ppf_out);
+    EXPECT_EQ(ComputeDistance2(t.ppf(), ppf_out), 0.0);
+  }
+}
+
 TEST(JxlTest, JXL_SLOW_TEST(RoundtripLossless8Falcon)) {
   ThreadPoolForTests pool(8);
   const PaddedBytes orig = jxl::test::ReadTestData(
@@ -1173,6 +1217,58 @@ TEST(JxlTest, RoundtripLossless8Gray) {
   EXPECT_EQ(ppf_out.info.bits_per_sample, 8);
 }
 
+TEST(JxlTest, RoundtripLosslessLocalTrees) {
+  const PaddedBytes orig = jxl::test::ReadTestData(
+      "external/wesaturate/500px/cvo9xd_keong_macan_grayscale.png");
+  TestImage t;
+  t.SetColorEncoding("Gra_D65_Rel_SRG").DecodeFromBytes(orig).ClearMetadata();
+
+  JXLCompressParams cparams = CompressParamsForLossless();
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 4);  // kCheetah
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_MODULAR_LOCAL_TREES, 1);
+
+  JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(t.ppf().frames[0].color.format);
+
+  PackedPixelFile ppf_out;
+  size_t size = Roundtrip(t.ppf(), cparams, dparams, nullptr, &ppf_out);
+  EXPECT_EQ(ComputeDistance2(t.ppf(), ppf_out), 0.0);
+
+  // The trees of the groups do not depend on each other, so neither does the
+  // output on the number of threads.
+  ThreadPoolForTests pool(8);
+  EXPECT_EQ(Roundtrip(t.ppf(), cparams, dparams, &pool, &ppf_out), size);
+  EXPECT_EQ(ComputeDistance2(t.ppf(), ppf_out), 0.0);
+}
+
+TEST(JxlTest, RoundtripAnimationTemporalReuse) {
+  TestImage t;
+  t.SetDimensions(256, 192);
+  t.AddFrame().RandomFill();
+  t.AddFrame().RandomFill();  // Same seed: identical to the first frame.
+  t.ppf().info.have_animation = JXL_TRUE;
+  t.ppf().info.animation.tps_numerator = 10;
+  t.ppf().info.animation.tps_denominator = 1;
+  for (auto& frame : t.ppf().frames) frame.frame_info.duration = 1;
+
+  JXLCompressParams cparams;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 7);  // kSquirrel
+
+  JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(t.ppf().frames[0].color.format);
+
+  PackedPixelFile ppf_out;
+  const size_t size = Roundtrip(t.ppf(), cparams, dparams, nullptr, &ppf_out);
+
+  // The second frame reuses all the heuristics of the first one, which are
+  // the same as those it would compute.
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_TEMPORAL_REUSE, 1);
+  PackedPixelFile ppf_reuse;
+  EXPECT_EQ(Roundtrip(t.ppf(), cparams, dparams, nullptr, &ppf_reuse), size);
+  ASSERT_EQ(2u, ppf_reuse.frames.size());
+  EXPECT_EQ(0.0, ComputeDistance2(ppf_out, ppf_reuse));
+}
+
 #if JPEGXL_ENABLE_GIF
 
 TEST(JxlTest, RoundtripAnimation) {
@@ -1219,6 +1315,112 @@ TEST(JxlTest, RoundtripLosslessAnimation) {
   EXPECT_LE(ButteraugliDistance(t.ppf(), ppf_out), 5e-4);
 }
 
+TEST(JxlTest, RoundtripLosslessAnimationAutoCrop) {
+  ThreadPool* pool = nullptr;
+  const PaddedBytes orig = jxl::test::ReadTestData("jxl/traffic_light.gif");
+  TestImage t;
+  t.DecodeFromBytes(orig).ClearMetadata();
+  // Full-size frames, which the encoder crops itself.
+  t.CoalesceGIFAnimationWithAlpha();
+  EXPECT_EQ(4, t.ppf().frames.size());
+
+  JXLCompressParams cparams = CompressParamsForLossless();
+
+  JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(t.ppf().frames[0].color.format);
+
+  PackedPixelFile ppf_out;
+  const size_t size = Roundtrip(t.ppf(), cparams, dparams, pool, &ppf_out);
+
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_AUTO_CROP, 1);
+  PackedPixelFile ppf_crop;
+  // Only the lights change between the frames.
+  EXPECT_LT(Roundtrip(t.ppf(), cparams, dparams, pool, &ppf_crop), size);
+  ASSERT_EQ(ppf_crop.frames.size(), t.ppf().frames.size());
+  EXPECT_EQ(0.0, ComputeDistance2(ppf_out, ppf_crop));
+}
+
+TEST(JxlTest, RoundtripLosslessAnimationAutoCropRepeatedFrame) {
+  ThreadPool* pool = nullptr;
+  const PaddedBytes orig = jxl::test::ReadTestData("jxl/traffic_light.gif");
+  TestImage t;
+  t.DecodeFromBytes(orig).ClearMetadata();
+  t.CoalesceGIFAnimationWithAlpha();
+  std::vector<PackedFrame>& frames = t.ppf().frames;
+  const uint32_t duration = frames[1].frame_info.duration;
+  frames.insert(frames.begin() + 2, frames[1].Copy());
+
+  JXLCompressParams cparams = CompressParamsForLossless();
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_AUTO_CROP, 1);
+  JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(frames[0].color.format);
+
+  // The repeated frame is shown for longer instead of being encoded.
+  PackedPixelFile ppf_out;
+  EXPECT_GT(Roundtrip(t.ppf(), cparams, dparams, pool, &ppf_out), 0);
+  ASSERT_EQ(4, ppf_out.frames.size());
+  EXPECT_EQ(2 * duration, ppf_out.frames[1].frame_info.duration);
+  EXPECT_EQ(frames[3].frame_info.duration,
+            ppf_out.frames[2].frame_info.duration);
+}
+
+TEST(JxlTest, RoundtripAutoEffort) {
+  ThreadPool* pool = nullptr;
+  // Screen content: axis-aligned blocks of four colors.
+  TestImage screen;
+  screen.SetDimensions(256, 256).SetChannels(3);
+  TestImage::Frame frame = screen.AddFrame();
+  for (size_t y = 0; y < 256; y++) {
+    for (size_t x = 0; x < 256; x++) {
+      const size_t block = ((x / 32) + (y / 16)) % 4;
+      for (size_t c = 0; c < 3; c++) {
+        frame.SetValue(y, x, c, block == c ? 0.8f : 0.1f * block);
+      }
+    }
+  }
+  const PaddedBytes orig = jxl::test::ReadTestData(
+      "external/wesaturate/500px/u76c0g_bliznaca_srgb8.png");
+  TestImage photo;
+  photo.DecodeFromBytes(orig).ClearMetadata();
+
+  JXLCompressParams cparams;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_AUTO_EFFORT, 1);
+  for (const TestImage* t : {&screen, &photo}) {
+    PackedPixelFile ppf_out;
+    EXPECT_GT(Roundtrip(t->ppf(), cparams, {}, pool, &ppf_out), 0);
+    EXPECT_LE(ButteraugliDistance(t->ppf(), ppf_out), 1.6);
+  }
+}
+
+TEST(JxlTest, RoundtripAnimationTemporalReuseChangedTiles) {
+  ThreadPool* pool = nullptr;
+  const PaddedBytes orig = jxl::test::ReadTestData("jxl/traffic_light.gif");
+  TestImage t;
+  t.DecodeFromBytes(orig).ClearMetadata();
+  EXPECT_EQ(4, t.ppf().frames.size());
+
+  JXLCompressParams cparams;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_TEMPORAL_REUSE, 1);
+
+  JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(t.ppf().frames[0].color.format);
+
+  // Only the lights change between the frames: the other tiles reuse the
+  // heuristics of the previous frame.
+  PackedPixelFile ppf_out;
+  EXPECT_THAT(Roundtrip(t.ppf(), cparams, dparams, pool, &ppf_out),
+              IsSlightlyBelow(2500));
+
+  t.CoalesceGIFAnimationWithAlpha();
+  ASSERT_EQ(ppf_out.frames.size(), t.ppf().frames.size());
+  EXPECT_LE(ButteraugliDistance(t.ppf(), ppf_out),
+#if JXL_HIGH_PRECISION
+            1.55);
+#else
+            1.75);
+#endif
+}
+
 TEST(JxlTest, RoundtripAnimationPatches) {
   ThreadPool* pool = nullptr;
   const PaddedBytes orig = jxl::test::ReadTestData("jxl/animation_patches.gif");
@@ -1242,6 +1444,32 @@ TEST(JxlTest, RoundtripAnimationPatches) {
   EXPECT_THAT(ButteraugliDistance(t.ppf(), ppf_out), IsSlightlyBelow(0.9));
 }
 
+TEST(JxlTest, RoundtripAnimationPersistentPatches) {
+  ThreadPool* pool = nullptr;
+  const PaddedBytes orig = jxl::test::ReadTestData("jxl/animation_patches.gif");
+
+  TestImage t;
+  t.DecodeFromBytes(orig).ClearMetadata();
+  ASSERT_EQ(2u, t.ppf().frames.size());
+
+  JXLCompressParams cparams;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_PATCHES, 1);
+
+  JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(t.ppf().frames[0].color.format);
+
+  PackedPixelFile ppf_out;
+  const size_t size = Roundtrip(t.ppf(), cparams, dparams, pool, &ppf_out);
+
+  // The second frame finds its patches in the reference frame of the first.
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_PERSISTENT_PATCHES, 1);
+  PackedPixelFile ppf_persistent;
+  EXPECT_LE(Roundtrip(t.ppf(), cparams, dparams, pool, &ppf_persistent), size);
+  EXPECT_EQ(ppf_persistent.frames.size(), t.ppf().frames.size());
+  EXPECT_THAT(ButteraugliDistance(t.ppf(), ppf_persistent),
+              IsSlightlyBelow(0.9));
+}
+
 #endif  // JPEGXL_ENABLE_GIF
 
 size_t RoundtripJpeg(const PaddedBytes& jpeg_in, ThreadPool* pool) {
@@ -1431,6 +1659,51 @@ TEST(JxlTest, JXL_TRANSCODE_JPEG_TEST(RoundtripJpegRecompression420Progr)) {
   EXPECT_NEAR(RoundtripJpeg(orig, &pool), 455499u, 10);
 }
 
+TEST(JxlTest, JXL_TRANSCODE_JPEG_TEST(RoundtripJpegRecompressionRestarts)) {
+  ThreadPoolForTests pool(8);
+  const PaddedBytes orig =
+      jxl::test::ReadTestData("jxl/flower/flower.png.im_q85_420.jpg");
+  // Rewrite the JPEG with a restart marker after each row of MCUs.
+  jpeg::JPEGData jpeg_data;
+  ASSERT_TRUE(jpeg::ReadJpeg(orig.data(), orig.size(),
+                             jpeg::JpegReadMode::kReadAll, &jpeg_data));
+  jpeg_data.restart_interval = DivCeil(jpeg_data.width, 16);
+  jpeg_data.marker_order.insert(
+      std::find(jpeg_data.marker_order.begin(), jpeg_data.marker_order.end(),
+                0xDA),
+      0xDD);
+  PaddedBytes jpeg_with_restarts;
+  ASSERT_TRUE(jpeg::WriteJpeg(
+      jpeg_data, [&jpeg_with_restarts](const uint8_t* buf, size_t len) {
+        jpeg_with_restarts.append(buf, buf + len);
+        return len;
+      }));
+
+  // The restart intervals decoded in parallel give the same JPEGData.
+  jpeg::JPEGData serial;
+  jpeg::JPEGData parallel;
+  ASSERT_TRUE(jpeg::ReadJpeg(jpeg_with_restarts.data(),
+                             jpeg_with_restarts.size(),
+                             jpeg::JpegReadMode::kReadAll, &serial));
+  ASSERT_TRUE(jpeg::ReadJpeg(
+      jpeg_with_restarts.data(), jpeg_with_restarts.size(),
+      jpeg::JpegReadMode::kReadAll, &parallel, &pool));
+  ASSERT_EQ(serial.components.size(), parallel.components.size());
+  for (size_t c = 0; c < serial.components.size(); c++) {
+    EXPECT_EQ(serial.components[c].coeffs, parallel.components[c].coeffs);
+  }
+  ASSERT_EQ(serial.scan_info.size(), parallel.scan_info.size());
+  for (size_t i = 0; i < serial.scan_info.size(); i++) {
+    EXPECT_EQ(serial.scan_info[i].reset_points,
+              parallel.scan_info[i].reset_points);
+    EXPECT_EQ(serial.scan_info[i].extra_zero_runs.size(),
+              parallel.scan_info[i].extra_zero_runs.size());
+  }
+  EXPECT_EQ(serial.padding_bits, parallel.padding_bits);
+
+  RoundtripJpeg(jpeg_with_restarts, &pool);
+}
+
 TEST(JxlTest, RoundtripProgressive) {
   ThreadPoolForTests pool(4);
   const PaddedBytes orig = jxl::test::ReadTestData("jxl/flower/flower.png");
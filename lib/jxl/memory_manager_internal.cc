@@ -7,12 +7,213 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
+#include <iterator>
+
 namespace jxl {
 
+namespace {
+
+// Chunks are at least this large; larger allocations get a chunk of their own
+// that is returned to the parent as soon as it is freed.
+constexpr size_t kArenaChunkSize = size_t{4} << 20;
+// Alignment of the allocations, as guaranteed by malloc.
+constexpr size_t kArenaAlignment = 16;
+
+// Smaller buffers are left to the parent, which typically caches them well.
+constexpr size_t kMinPooledSize = size_t{64} << 10;
+
+// Returns the size whose buffers serve an allocation of `size` bytes, or 0 if
+// it is not pooled.
+size_t PoolSizeClass(size_t size) {
+  if (size < kMinPooledSize) return 0;
+  size_t power_of_two = kMinPooledSize;
+  while (power_of_two <= size / 2) power_of_two *= 2;
+  const size_t granularity = power_of_two / 8;
+  if (size > SIZE_MAX - granularity) return 0;
+  return (size + granularity - 1) / granularity * granularity;
+}
+
+}  // namespace
+
+struct MemoryArena::Chunk {
+  size_t size;  // including this header
+  size_t used;  // including this header
+  size_t num_allocations;
+};
+
+// Each allocation is preceded by a pointer to its chunk, padded to keep the
+// allocation aligned.
+static_assert(sizeof(void*) <= kArenaAlignment, "Allocation prefix too small");
+static constexpr size_t kArenaChunkHeader =
+    (sizeof(MemoryArena::Chunk) + kArenaAlignment - 1) & ~(kArenaAlignment - 1);
+
 void* MemoryManagerDefaultAlloc(void* opaque, size_t size) {
   return malloc(size);
 }
 
 void MemoryManagerDefaultFree(void* opaque, void* address) { free(address); }
 
+MemoryArena::MemoryArena(const JxlMemoryManager* parent) : parent_(*parent) {
+  memory_manager_.opaque = this;
+  memory_manager_.alloc = &MemoryArena::Alloc;
+  memory_manager_.free = &MemoryArena::Free;
+}
+
+MemoryArena::~MemoryArena() {
+  for (Chunk* chunk : chunks_) {
+    JXL_DASSERT(chunk->num_allocations == 0);
+    MemoryManagerFree(&parent_, chunk);
+  }
+}
+
+size_t MemoryArena::ReservedBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t total = 0;
+  for (const Chunk* chunk : chunks_) total += chunk->size;
+  return total;
+}
+
+MemoryArena::Chunk* MemoryArena::NewChunk(size_t min_size) {
+  const size_t size = std::max(min_size + kArenaChunkHeader, kArenaChunkSize);
+  if (size < min_size) return nullptr;  // overflow
+  Chunk* chunk = static_cast<Chunk*>(MemoryManagerAlloc(&parent_, size));
+  if (chunk == nullptr) return nullptr;
+  chunk->size = size;
+  chunk->used = kArenaChunkHeader;
+  chunk->num_allocations = 0;
+  chunks_.push_back(chunk);
+  return chunk;
+}
+
+// static
+void* MemoryArena::Alloc(void* opaque, size_t size) {
+  MemoryArena* self = static_cast<MemoryArena*>(opaque);
+  if (size > SIZE_MAX - 2 * kArenaAlignment) return nullptr;
+  const size_t needed =
+      kArenaAlignment + ((size + kArenaAlignment - 1) & ~(kArenaAlignment - 1));
+  std::lock_guard<std::mutex> lock(self->mutex_);
+  Chunk* chunk = self->current_;
+  if (chunk == nullptr || chunk->size - chunk->used < needed) {
+    chunk = nullptr;
+    for (size_t i = 0; i < self->empty_chunks_.size(); ++i) {
+      if (self->empty_chunks_[i]->size - kArenaChunkHeader >= needed) {
+        chunk = self->empty_chunks_[i];
+        self->empty_chunks_.erase(self->empty_chunks_.begin() + i);
+        break;
+      }
+    }
+    if (chunk == nullptr) chunk = self->NewChunk(needed);
+    if (chunk == nullptr) return nullptr;
+    // Only chunks of the regular size are worth bumping more allocations
+    // from; a full current chunk is reused once its allocations are freed.
+    if (chunk->size == kArenaChunkSize) {
+      if (self->current_ != nullptr && self->current_->num_allocations == 0) {
+        self->current_->used = kArenaChunkHeader;
+        self->empty_chunks_.push_back(self->current_);
+      }
+      self->current_ = chunk;
+    }
+  }
+  uint8_t* prefix = reinterpret_cast<uint8_t*>(chunk) + chunk->used;
+  chunk->used += needed;
+  chunk->num_allocations++;
+  memcpy(prefix, &chunk, sizeof(chunk));
+  return prefix + kArenaAlignment;
+}
+
+// static
+void MemoryArena::Free(void* opaque, void* address) {
+  if (address == nullptr) return;
+  MemoryArena* self = static_cast<MemoryArena*>(opaque);
+  Chunk* chunk;
+  memcpy(&chunk, static_cast<uint8_t*>(address) - kArenaAlignment,
+         sizeof(chunk));
+  std::lock_guard<std::mutex> lock(self->mutex_);
+  JXL_DASSERT(chunk->num_allocations > 0);
+  if (--chunk->num_allocations != 0) return;
+  if (chunk == self->current_) {
+    // Released in bulk: bump from the start again.
+    chunk->used = kArenaChunkHeader;
+  } else if (chunk->size > kArenaChunkSize) {
+    self->chunks_.erase(
+        std::find(self->chunks_.begin(), self->chunks_.end(), chunk));
+    MemoryManagerFree(&self->parent_, chunk);
+  } else {
+    chunk->used = kArenaChunkHeader;
+    self->empty_chunks_.push_back(chunk);
+  }
+}
+
+BufferPool::BufferPool(const JxlMemoryManager* parent) : parent_(*parent) {
+  memory_manager_.opaque = this;
+  memory_manager_.alloc = &BufferPool::Alloc;
+  memory_manager_.free = &BufferPool::Free;
+}
+
+BufferPool::~BufferPool() { SetMaxRetainedBytes(0); }
+
+void BufferPool::SetMaxRetainedBytes(size_t max_retained_bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  max_retained_bytes_ = max_retained_bytes;
+  // Give back the largest buffers first, most of the bytes are there.
+  while (retained_bytes_ > max_retained_bytes_) {
+    auto it = std::prev(free_buffers_.end());
+    MemoryManagerFree(&parent_, it->second.back());
+    it->second.pop_back();
+    retained_bytes_ -= it->first;
+    if (it->second.empty()) free_buffers_.erase(it);
+  }
+}
+
+size_t BufferPool::RetainedBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return retained_bytes_;
+}
+
+// static
+void* BufferPool::Alloc(void* opaque, size_t size) {
+  BufferPool* self = static_cast<BufferPool*>(opaque);
+  // Each buffer is preceded by its size class, padded to keep the buffer
+  // aligned.
+  if (size > SIZE_MAX - kArenaAlignment) return nullptr;
+  const size_t size_class = PoolSizeClass(size + kArenaAlignment);
+  uint8_t* buffer = nullptr;
+  if (size_class != 0) {
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    auto it = self->free_buffers_.find(size_class);
+    if (it != self->free_buffers_.end()) {
+      buffer = static_cast<uint8_t*>(it->second.back());
+      it->second.pop_back();
+      self->retained_bytes_ -= size_class;
+      if (it->second.empty()) self->free_buffers_.erase(it);
+    }
+  }
+  if (buffer == nullptr) {
+    buffer = static_cast<uint8_t*>(MemoryManagerAlloc(
+        &self->parent_, size_class != 0 ? size_class : size + kArenaAlignment));
+    if (buffer == nullptr) return nullptr;
+  }
+  memcpy(buffer, &size_class, sizeof(size_class));
+  return buffer + kArenaAlignment;
+}
+
+// static
+void BufferPool::Free(void* opaque, void* address) {
+  if (address == nullptr) return;
+  BufferPool* self = static_cast<BufferPool*>(opaque);
+  uint8_t* buffer = static_cast<uint8_t*>(address) - kArenaAlignment;
+  size_t size_class;
+  memcpy(&size_class, buffer, sizeof(size_class));
+  if (size_class != 0) {
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    if (self->retained_bytes_ + size_class <= self->max_retained_bytes_) {
+      self->free_buffers_[size_class].push_back(buffer);
+      self->retained_bytes_ += size_class;
+      return;
+    }
+  }
+  MemoryManagerFree(&self->parent_, buffer);
+}
+
 }  // namespace jxl
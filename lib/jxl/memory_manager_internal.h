@@ -15,7 +15,10 @@
 #include <string.h>  // memcpy
 
 #include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/status.h"
@@ -96,6 +99,84 @@ JXL_INLINE MemoryManagerUniquePtr<T> MemoryManagerMakeUnique(
                                    MemoryManagerDeleteHelper(memory_manager));
 }
 
+// Memory manager that carves allocations out of large chunks obtained from a
+// parent memory manager. A chunk is reused as soon as all its allocations are
+// freed, so that the buffers of each frame are allocated by bumping a pointer
+// and released in bulk, without going through the parent. Thread-safe.
+// All allocations must be freed before the arena is destroyed.
+class MemoryArena {
+ public:
+  explicit MemoryArena(const JxlMemoryManager* parent);
+  ~MemoryArena();
+  MemoryArena(const MemoryArena&) = delete;
+  MemoryArena& operator=(const MemoryArena&) = delete;
+
+  // Memory manager allocating from this arena; valid as long as the arena.
+  const JxlMemoryManager* memory_manager() const { return &memory_manager_; }
+
+  // Total size of the chunks currently obtained from the parent.
+  size_t ReservedBytes() const;
+
+  // Header at the start of each chunk.
+  struct Chunk;
+
+ private:
+  static void* Alloc(void* opaque, size_t size);
+  static void Free(void* opaque, void* address);
+  Chunk* NewChunk(size_t min_size);
+
+  JxlMemoryManager parent_;
+  JxlMemoryManager memory_manager_;
+
+  // Protects all the remaining variables and the chunks.
+  mutable std::mutex mutex_;
+  // Chunk that allocations are bumped from, or nullptr.
+  Chunk* current_ = nullptr;
+  // Chunks without allocations, other than current_.
+  std::vector<Chunk*> empty_chunks_;
+  std::vector<Chunk*> chunks_;
+};
+
+// Memory manager that keeps freed buffers of at least 64 KiB to return them
+// again for later allocations of a similar size, instead of giving them back
+// to a parent memory manager. This avoids the page faults of fresh memory for
+// the image planes of consecutive frames and images, which mostly have the
+// same sizes. Sizes are rounded up to 1/8 of their power of two, the most
+// recently freed buffer of a size is reused first and at most a given number
+// of bytes is retained. Thread-safe. All allocations must be freed before the
+// pool is destroyed.
+class BufferPool {
+ public:
+  explicit BufferPool(const JxlMemoryManager* parent);
+  ~BufferPool();
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  // Memory manager allocating from this pool; valid as long as the pool.
+  const JxlMemoryManager* memory_manager() const { return &memory_manager_; }
+
+  // Sets the bound on the bytes of the retained buffers, and gives back the
+  // buffers beyond it to the parent. Zero disables retaining buffers.
+  void SetMaxRetainedBytes(size_t max_retained_bytes);
+
+  // Total size of the freed buffers currently retained.
+  size_t RetainedBytes() const;
+
+ private:
+  static void* Alloc(void* opaque, size_t size);
+  static void Free(void* opaque, void* address);
+
+  JxlMemoryManager parent_;
+  JxlMemoryManager memory_manager_;
+
+  // Protects all the remaining variables.
+  mutable std::mutex mutex_;
+  size_t max_retained_bytes_ = 0;
+  size_t retained_bytes_ = 0;
+  // Retained buffers by rounded size, most recently freed last.
+  std::map<size_t, std::vector<void*>> free_buffers_;
+};
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_MEMORY_MANAGER_INTERNAL_H_
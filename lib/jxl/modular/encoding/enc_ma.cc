@@ -19,6 +19,7 @@
 #include <hwy/foreach_target.h>
 #include <hwy/highway.h>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/random.h"
 #include "lib/jxl/enc_ans.h"
 #include "lib/jxl/fast_math-inl.h"
@@ -168,10 +169,14 @@ void SplitTreeSamples(TreeSamples &tree_samples, size_t begin, size_t pos,
   }
 }
 
+// Below this number of distinct samples in a node, the per-property split
+// search is not worth distributing across threads.
+constexpr size_t kMinSamplesForParallelSplit = 4096;
+
 void FindBestSplit(TreeSamples &tree_samples, float threshold,
                    const std::vector<ModularMultiplierInfo> &mul_info,
                    StaticPropRange initial_static_prop_range,
-                   float fast_decode_multiplier, Tree *tree) {
+                   float fast_decode_multiplier, ThreadPool *pool, Tree *tree) {
   struct NodeInfo {
     size_t pos;
     size_t begin;
@@ -179,6 +184,56 @@ void FindBestSplit(TreeSamples &tree_samples, float threshold,
     uint64_t used_properties;
     StaticPropRange static_prop_range;
   };
+  struct SplitInfo {
+    size_t prop = 0;
+    uint32_t val = 0;
+    size_t pos = 0;
+    float lcost = std::numeric_limits<float>::max();
+    float rcost = std::numeric_limits<float>::max();
+    Predictor lpred = Predictor::Zero;
+    Predictor rpred = Predictor::Zero;
+    float Cost() const { return lcost + rcost; }
+  };
+  // Best split found so far for each of the kinds of split that are
+  // considered.
+  struct BestSplits {
+    SplitInfo static_constant;
+    SplitInfo static_prop;
+    SplitInfo nonstatic;
+    SplitInfo nowp;
+    // Keeps the first of equally good splits, so that merging the splits
+    // found for each property in order gives the same result as a sequential
+    // search.
+    void Merge(const BestSplits &other) {
+      if (other.static_constant.Cost() < static_constant.Cost()) {
+        static_constant = other.static_constant;
+      }
+      if (other.static_prop.Cost() < static_prop.Cost()) {
+        static_prop = other.static_prop;
+      }
+      if (other.nonstatic.Cost() < nonstatic.Cost()) {
+        nonstatic = other.nonstatic;
+      }
+      if (other.nowp.Cost() < nowp.Cost()) nowp = other.nowp;
+    }
+  };
+  struct CostInfo {
+    float cost = std::numeric_limits<float>::max();
+    float extra_cost = 0;
+    float Cost() const { return cost + extra_cost; }
+    Predictor pred;  // will be uninitialized in some cases, but never used.
+  };
+  // Per-thread temporary storage for the split search.
+  struct SplitScratch {
+    std::vector<int> prop_value_used_count;
+    std::vector<int> count_increase;
+    std::vector<size_t> extra_bits_increase;
+    std::vector<CostInfo> costs_l;
+    std::vector<CostInfo> costs_r;
+    std::vector<int32_t> counts_above;
+    std::vector<int32_t> counts_below;
+    std::vector<int32_t> rounded_counts;
+  };
   std::vector<NodeInfo> nodes;
   nodes.push_back(NodeInfo{0, 0, tree_samples.NumDistinctSamples(), 0,
                            initial_static_prop_range});
@@ -186,6 +241,9 @@ void FindBestSplit(TreeSamples &tree_samples, float threshold,
   size_t num_predictors = tree_samples.NumPredictors();
   size_t num_properties = tree_samples.NumProperties();
 
+  std::vector<SplitScratch> scratch;
+  std::vector<BestSplits> prop_splits(num_properties);
+
   // TODO(veluca): consider parallelizing the search (processing multiple nodes
   // at a time).
   while (!nodes.empty()) {
@@ -197,21 +255,7 @@ void FindBestSplit(TreeSamples &tree_samples, float threshold,
     nodes.pop_back();
     if (begin == end) continue;
 
-    struct SplitInfo {
-      size_t prop = 0;
-      uint32_t val = 0;
-      size_t pos = 0;
-      float lcost = std::numeric_limits<float>::max();
-      float rcost = std::numeric_limits<float>::max();
-      Predictor lpred = Predictor::Zero;
-      Predictor rpred = Predictor::Zero;
-      float Cost() { return lcost + rcost; }
-    };
-
-    SplitInfo best_split_static_constant;
-    SplitInfo best_split_static;
-    SplitInfo best_split_nonstatic;
-    SplitInfo best_split_nowp;
+    BestSplits best_splits;
 
     JXL_DASSERT(begin <= end);
     JXL_DASSERT(end <= tree_samples.NumDistinctSamples());
@@ -245,7 +289,7 @@ void FindBestSplit(TreeSamples &tree_samples, float threshold,
                   tot_extra_bits[pred];
     }
 
-    SplitInfo *best = &best_split_nonstatic;
+    SplitInfo *best = &best_splits.nonstatic;
 
     SplitInfo forced_split;
     // The multiplier ranges cut halfway through the current ranges of static
@@ -278,40 +322,24 @@ void FindBestSplit(TreeSamples &tree_samples, float threshold,
     }
 
     if (best != &forced_split) {
-      std::vector<int> prop_value_used_count;
-      std::vector<int> count_increase;
-      std::vector<size_t> extra_bits_increase;
+      // The lower the threshold, the higher the expected noisiness of the
+      // estimate. Thus, discourage changing predictors.
+      float change_pred_penalty = 800.0f / (100.0f + threshold);
       // For each property, compute which of its values are used, and what
       // tokens correspond to those usages. Then, iterate through the values,
       // and compute the entropy of each side of the split (of the form `prop >
       // threshold`). Finally, find the split that minimizes the cost.
-      struct CostInfo {
-        float cost = std::numeric_limits<float>::max();
-        float extra_cost = 0;
-        float Cost() const { return cost + extra_cost; }
-        Predictor pred;  // will be uninitialized in some cases, but never used.
-      };
-      std::vector<CostInfo> costs_l;
-      std::vector<CostInfo> costs_r;
-
-      std::vector<int32_t> counts_above(max_symbols);
-      std::vector<int32_t> counts_below(max_symbols);
-
-      // The lower the threshold, the higher the expected noisiness of the
-      // estimate. Thus, discourage changing predictors.
-      float change_pred_penalty = 800.0f / (100.0f + threshold);
-      for (size_t prop = 0; prop < num_properties && base_bits > threshold;
-           prop++) {
-        costs_l.clear();
-        costs_r.clear();
+      const auto find_best_split_for_property = [&](size_t prop,
+                                                    SplitScratch &s,
+                                                    BestSplits &splits) {
         size_t prop_size = tree_samples.NumPropertyValues(prop);
-        if (extra_bits_increase.size() < prop_size) {
-          count_increase.resize(prop_size * max_symbols);
-          extra_bits_increase.resize(prop_size);
+        if (s.extra_bits_increase.size() < prop_size) {
+          s.count_increase.resize(prop_size * max_symbols);
+          s.extra_bits_increase.resize(prop_size);
         }
         // Clear prop_value_used_count (which cannot be cleared "on the go")
-        prop_value_used_count.clear();
-        prop_value_used_count.resize(prop_size);
+        s.prop_value_used_count.clear();
+        s.prop_value_used_count.resize(prop_size);
 
         size_t first_used = prop_size;
         size_t last_used = 0;
@@ -320,12 +348,14 @@ void FindBestSplit(TreeSamples &tree_samples, float threshold,
         // property at the same time, possibly with a bottom-up approach.
         for (size_t i = begin; i < end; i++) {
           size_t p = tree_samples.Property(prop, i);
-          prop_value_used_count[p]++;
+          s.prop_value_used_count[p]++;
           last_used = std::max(last_used, p);
           first_used = std::min(first_used, p);
         }
-        costs_l.resize(last_used - first_used);
-        costs_r.resize(last_used - first_used);
+        s.costs_l.clear();
+        s.costs_r.clear();
+        s.costs_l.resize(last_used - first_used);
+        s.costs_r.resize(last_used - first_used);
         // For all predictors, compute the right and left costs of each split.
         for (size_t pred = 0; pred < num_predictors; pred++) {
           // Compute cost and histogram increments for each property value.
@@ -333,31 +363,32 @@ void FindBestSplit(TreeSamples &tree_samples, float threshold,
             size_t p = tree_samples.Property(prop, i);
             size_t cnt = tree_samples.Count(i);
             size_t sym = tree_samples.Token(pred, i);
-            count_increase[p * max_symbols + sym] += cnt;
-            extra_bits_increase[p] += tree_samples.NBits(pred, i) * cnt;
+            s.count_increase[p * max_symbols + sym] += cnt;
+            s.extra_bits_increase[p] += tree_samples.NBits(pred, i) * cnt;
           }
-          memcpy(counts_above.data(), counts.data() + pred * max_symbols,
-                 max_symbols * sizeof counts_above[0]);
-          memset(counts_below.data(), 0, max_symbols * sizeof counts_below[0]);
+          memcpy(s.counts_above.data(), counts.data() + pred * max_symbols,
+                 max_symbols * sizeof s.counts_above[0]);
+          memset(s.counts_below.data(), 0,
+                 max_symbols * sizeof s.counts_below[0]);
           size_t extra_bits_below = 0;
           // Exclude last used: this ensures neither counts_above nor
           // counts_below is empty.
           for (size_t i = first_used; i < last_used; i++) {
-            if (!prop_value_used_count[i]) continue;
-            extra_bits_below += extra_bits_increase[i];
+            if (!s.prop_value_used_count[i]) continue;
+            extra_bits_below += s.extra_bits_increase[i];
             // The increase for this property value has been used, and will not
             // be used again: clear it. Also below.
-            extra_bits_increase[i] = 0;
+            s.extra_bits_increase[i] = 0;
             for (size_t sym = 0; sym < max_symbols; sym++) {
-              counts_above[sym] -= count_increase[i * max_symbols + sym];
-              counts_below[sym] += count_increase[i * max_symbols + sym];
-              count_increase[i * max_symbols + sym] = 0;
+              s.counts_above[sym] -= s.count_increase[i * max_symbols + sym];
+              s.counts_below[sym] += s.count_increase[i * max_symbols + sym];
+              s.count_increase[i * max_symbols + sym] = 0;
             }
-            float rcost = EstimateBits(counts_above.data(),
-                                       rounded_counts.data(), max_symbols) +
+            float rcost = EstimateBits(s.counts_above.data(),
+                                       s.rounded_counts.data(), max_symbols) +
                           tot_extra_bits[pred] - extra_bits_below;
-            float lcost = EstimateBits(counts_below.data(),
-                                       rounded_counts.data(), max_symbols) +
+            float lcost = EstimateBits(s.counts_below.data(),
+                                       s.rounded_counts.data(), max_symbols) +
                           extra_bits_below;
             JXL_DASSERT(extra_bits_below <= tot_extra_bits[pred]);
             float penalty = 0;
@@ -376,16 +407,16 @@ void FindBestSplit(TreeSamples &tree_samples, float threshold,
             if (tree_samples.PredictorFromIndex(pred) == Predictor::Zero) {
               penalty -= 1e-8;
             }
-            if (rcost + penalty < costs_r[i - first_used].Cost()) {
-              costs_r[i - first_used].cost = rcost;
-              costs_r[i - first_used].extra_cost = penalty;
-              costs_r[i - first_used].pred =
+            if (rcost + penalty < s.costs_r[i - first_used].Cost()) {
+              s.costs_r[i - first_used].cost = rcost;
+              s.costs_r[i - first_used].extra_cost = penalty;
+              s.costs_r[i - first_used].pred =
                   tree_samples.PredictorFromIndex(pred);
             }
-            if (lcost + penalty < costs_l[i - first_used].Cost()) {
-              costs_l[i - first_used].cost = lcost;
-              costs_l[i - first_used].extra_cost = penalty;
-              costs_l[i - first_used].pred =
+            if (lcost + penalty < s.costs_l[i - first_used].Cost()) {
+              s.costs_l[i - first_used].cost = lcost;
+              s.costs_l[i - first_used].extra_cost = penalty;
+              s.costs_l[i - first_used].pred =
                   tree_samples.PredictorFromIndex(pred);
             }
           }
@@ -394,55 +425,86 @@ void FindBestSplit(TreeSamples &tree_samples, float threshold,
         // of costs of the two sides.
         size_t split = begin;
         for (size_t i = first_used; i < last_used; i++) {
-          if (!prop_value_used_count[i]) continue;
-          split += prop_value_used_count[i];
-          float rcost = costs_r[i - first_used].cost;
-          float lcost = costs_l[i - first_used].cost;
+          if (!s.prop_value_used_count[i]) continue;
+          split += s.prop_value_used_count[i];
+          float rcost = s.costs_r[i - first_used].cost;
+          float lcost = s.costs_l[i - first_used].cost;
           // WP was not used + we would use the WP property or predictor
           bool adds_wp =
               (tree_samples.PropertyFromIndex(prop) == kWPProp &&
                (used_properties & (1LU << prop)) == 0) ||
-              ((costs_l[i - first_used].pred == Predictor::Weighted ||
-                costs_r[i - first_used].pred == Predictor::Weighted) &&
+              ((s.costs_l[i - first_used].pred == Predictor::Weighted ||
+                s.costs_r[i - first_used].pred == Predictor::Weighted) &&
                (*tree)[pos].predictor != Predictor::Weighted);
           bool zero_entropy_side = rcost == 0 || lcost == 0;
 
           SplitInfo &best =
               prop < kNumStaticProperties
-                  ? (zero_entropy_side ? best_split_static_constant
-                                       : best_split_static)
-                  : (adds_wp ? best_split_nonstatic : best_split_nowp);
+                  ? (zero_entropy_side ? splits.static_constant
+                                       : splits.static_prop)
+                  : (adds_wp ? splits.nonstatic : splits.nowp);
           if (lcost + rcost < best.Cost()) {
             best.prop = prop;
             best.val = i;
             best.pos = split;
             best.lcost = lcost;
-            best.lpred = costs_l[i - first_used].pred;
+            best.lpred = s.costs_l[i - first_used].pred;
             best.rcost = rcost;
-            best.rpred = costs_r[i - first_used].pred;
+            best.rpred = s.costs_r[i - first_used].pred;
           }
         }
         // Clear extra_bits_increase and cost_increase for last_used.
-        extra_bits_increase[last_used] = 0;
+        s.extra_bits_increase[last_used] = 0;
         for (size_t sym = 0; sym < max_symbols; sym++) {
-          count_increase[last_used * max_symbols + sym] = 0;
+          s.count_increase[last_used * max_symbols + sym] = 0;
+        }
+      };
+
+      if (base_bits > threshold) {
+        // Properties are searched independently, possibly in parallel; the
+        // per-property results are then merged in property order, which keeps
+        // the tree independent of the number of threads.
+        ThreadPool *node_pool =
+            end - begin >= kMinSamplesForParallelSplit ? pool : nullptr;
+        const auto init_scratch = [&](size_t num_threads) {
+          scratch.resize(num_threads);
+          for (SplitScratch &s : scratch) {
+            s.count_increase.clear();
+            s.extra_bits_increase.clear();
+            s.counts_above.resize(max_symbols);
+            s.counts_below.resize(max_symbols);
+            s.rounded_counts.resize(max_symbols);
+          }
+          return true;
+        };
+        const auto process_property = [&](const uint32_t prop,
+                                           size_t thread) {
+          prop_splits[prop] = BestSplits();
+          find_best_split_for_property(prop, scratch[thread],
+                                       prop_splits[prop]);
+        };
+        JXL_CHECK(RunOnPool(node_pool, 0, num_properties, init_scratch,
+                            process_property, "FindBestSplit"));
+        for (size_t prop = 0; prop < num_properties; prop++) {
+          best_splits.Merge(prop_splits[prop]);
         }
       }
 
       // Try to avoid introducing WP.
-      if (best_split_nowp.Cost() + threshold < base_bits &&
-          best_split_nowp.Cost() <= fast_decode_multiplier * best->Cost()) {
-        best = &best_split_nowp;
+      if (best_splits.nowp.Cost() + threshold < base_bits &&
+          best_splits.nowp.Cost() <= fast_decode_multiplier * best->Cost()) {
+        best = &best_splits.nowp;
       }
       // Split along static props if possible and not significantly more
       // expensive.
-      if (best_split_static.Cost() + threshold < base_bits &&
-          best_split_static.Cost() <= fast_decode_multiplier * best->Cost()) {
-        best = &best_split_static;
+      if (best_splits.static_prop.Cost() + threshold < base_bits &&
+          best_splits.static_prop.Cost() <=
+              fast_decode_multiplier * best->Cost()) {
+        best = &best_splits.static_prop;
       }
       // Split along static props to create constant nodes if possible.
-      if (best_split_static_constant.Cost() + threshold < base_bits) {
-        best = &best_split_static_constant;
+      if (best_splits.static_constant.Cost() + threshold < base_bits) {
+        best = &best_splits.static_constant;
       }
     }
 
@@ -490,7 +552,8 @@ HWY_EXPORT(FindBestSplit);  // Local function.
 void ComputeBestTree(TreeSamples &tree_samples, float threshold,
                      const std::vector<ModularMultiplierInfo> &mul_info,
                      StaticPropRange static_prop_range,
-                     float fast_decode_multiplier, Tree *tree) {
+                     float fast_decode_multiplier, ThreadPool *pool,
+                     Tree *tree) {
   // TODO(veluca): take into account that different contexts can have different
   // uint configs.
   //
@@ -506,7 +569,7 @@ void ComputeBestTree(TreeSamples &tree_samples, float threshold,
              std::numeric_limits<uint32_t>::max());
   HWY_DYNAMIC_DISPATCH(FindBestSplit)
   (tree_samples, threshold, mul_info, static_prop_range, fast_decode_multiplier,
-   tree);
+   pool, tree);
 }
 
 constexpr int32_t TreeSamples::kPropertyRange;
@@ -617,14 +680,47 @@ void TreeSamples::AddToTable(size_t a) {
   }
 }
 
+void TreeSamples::RemoveFromTable(size_t a) {
+  size_t pos1 = Hash1(a);
+  size_t pos2 = Hash2(a);
+  if (dedup_table_[pos1] == a) {
+    dedup_table_[pos1] = kDedupEntryUnused;
+  } else if (dedup_table_[pos2] == a) {
+    dedup_table_[pos2] = kDedupEntryUnused;
+  }
+}
+
+void TreeSamples::ReservoirSample() {
+  size_t last = sample_counts.size() - 1;
+  if (last < max_distinct_samples_) return;
+  RemoveFromTable(last);
+  num_samples -= sample_counts[last];
+  size_t dest = reservoir_rng_.UniformU(0, num_unmerged_samples_);
+  if (dest < max_distinct_samples_) {
+    RemoveFromTable(dest);
+    num_samples -= sample_counts[dest];
+    num_samples += sample_counts[last];
+    for (auto &r : residuals) r[dest] = r[last];
+    for (auto &p : props) p[dest] = p[last];
+    sample_counts[dest] = sample_counts[last];
+    if (sample_counts[dest] != std::numeric_limits<uint16_t>::max()) {
+      AddToTable(dest);
+    }
+  }
+  for (auto &r : residuals) r.pop_back();
+  for (auto &p : props) p.pop_back();
+  sample_counts.pop_back();
+}
+
 void TreeSamples::PrepareForSamples(size_t num_samples) {
+  size_t total_num_samples = std::min(num_samples + sample_counts.size(),
+                                      max_distinct_samples_ + 1);
   for (auto &res : residuals) {
-    res.reserve(res.size() + num_samples);
+    res.reserve(total_num_samples);
   }
   for (auto &p : props) {
-    p.reserve(p.size() + num_samples);
+    p.reserve(total_num_samples);
   }
-  size_t total_num_samples = num_samples + sample_counts.size();
   size_t next_pow2 = 1LLU << CeilLog2Nonzero(total_num_samples * 3 / 2);
   InitTable(next_pow2);
 }
@@ -692,6 +788,57 @@ void TreeSamples::AddSample(pixel_type_w pixel, const Properties &properties,
     for (auto &r : residuals) r.pop_back();
     for (auto &p : props) p.pop_back();
     sample_counts.pop_back();
+  } else {
+    num_unmerged_samples_++;
+    ReservoirSample();
+  }
+}
+
+void TreeSamples::MergeLastSample() {
+  constexpr uint32_t kMaxCount = std::numeric_limits<uint16_t>::max();
+  size_t last = sample_counts.size() - 1;
+  for (size_t pos : {Hash1(last), Hash2(last)}) {
+    uint32_t other = dedup_table_[pos];
+    if (other == kDedupEntryUnused || !IsSameSample(last, other)) continue;
+    uint32_t count = sample_counts[other] + sample_counts[last];
+    sample_counts[other] = std::min(count, kMaxCount);
+    if (count < kMaxCount) {
+      for (auto &r : residuals) r.pop_back();
+      for (auto &p : props) p.pop_back();
+      sample_counts.pop_back();
+      return;
+    }
+    // Remove from hash table samples that are saturated, and keep what does
+    // not fit as a new sample.
+    dedup_table_[pos] = kDedupEntryUnused;
+    if (count == kMaxCount) {
+      for (auto &r : residuals) r.pop_back();
+      for (auto &p : props) p.pop_back();
+      sample_counts.pop_back();
+      return;
+    }
+    sample_counts[last] = count - kMaxCount;
+    break;
+  }
+  if (sample_counts[last] != kMaxCount) AddToTable(last);
+  num_unmerged_samples_++;
+  ReservoirSample();
+}
+
+void TreeSamples::AddSamples(const TreeSamples &other) {
+  JXL_ASSERT(other.predictors == predictors);
+  JXL_ASSERT(other.props_to_use == props_to_use);
+  PrepareForSamples(other.NumDistinctSamples());
+  for (size_t i = 0; i < other.NumDistinctSamples(); i++) {
+    for (size_t j = 0; j < residuals.size(); j++) {
+      residuals[j].push_back(other.residuals[j][i]);
+    }
+    for (size_t j = 0; j < props.size(); j++) {
+      props[j].push_back(other.props[j][i]);
+    }
+    sample_counts.push_back(other.sample_counts[i]);
+    num_samples += other.sample_counts[i];
+    MergeLastSample();
   }
 }
 
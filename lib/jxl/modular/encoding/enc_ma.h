@@ -6,8 +6,11 @@
 #ifndef LIB_JXL_MODULAR_ENCODING_ENC_MA_H_
 #define LIB_JXL_MODULAR_ENCODING_ENC_MA_H_
 
+#include <limits>
 #include <numeric>
 
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/random.h"
 #include "lib/jxl/enc_ans.h"
 #include "lib/jxl/entropy_coder.h"
 #include "lib/jxl/modular/encoding/dec_ma.h"
@@ -29,6 +32,12 @@ struct TreeSamples {
   // Set the properties to use. Must be called before adding any samples.
   Status SetProperties(const std::vector<uint32_t> &properties,
                        ModularOptions::TreeMode wp_tree_mode);
+  // Set the maximum number of distinct samples to keep. Once it is reached,
+  // new distinct samples replace existing ones with reservoir sampling.
+  void SetMaxDistinctSamples(size_t max_samples) {
+    JXL_ASSERT(max_samples > 0);
+    max_distinct_samples_ = max_samples;
+  }
 
   size_t Token(size_t pred, size_t i) const { return residuals[pred][i].tok; }
   size_t NBits(size_t pred, size_t i) const { return residuals[pred][i].nbits; }
@@ -74,6 +83,10 @@ struct TreeSamples {
   // Add a sample.
   void AddSample(pixel_type_w pixel, const Properties &properties,
                  const pixel_type_w *predictions);
+  // Add all the samples of `other`, which must use the same predictors and
+  // properties, with the same quantization. Adding the samples of several
+  // streams in a fixed order gives a deterministic result.
+  void AddSamples(const TreeSamples &other);
   // Pre-cluster property values.
   void PreQuantizeProperties(
       const StaticPropRange &range,
@@ -122,8 +135,13 @@ struct TreeSamples {
   // Mapping property value -> quantized property value.
   static constexpr int32_t kPropertyRange = 511;
   std::vector<std::vector<uint8_t>> property_mapping;
-  // Number of samples seen.
+  // Number of samples represented by `sample_counts`.
   size_t num_samples = 0;
+  // Number of samples that were not merged with an existing distinct sample,
+  // and bound on the number of distinct samples that are kept.
+  size_t num_unmerged_samples_ = 0;
+  size_t max_distinct_samples_ = std::numeric_limits<uint32_t>::max();
+  Rng reservoir_rng_{0};
   // Table for deduplication.
   static constexpr uint32_t kDedupEntryUnused{static_cast<uint32_t>(-1)};
   std::vector<uint32_t> dedup_table_;
@@ -136,6 +154,13 @@ struct TreeSamples {
   // Returns true if `a` was already present in the table.
   bool AddToTableAndMerge(size_t a);
   void AddToTable(size_t a);
+  void RemoveFromTable(size_t a);
+  // Keeps the just-added distinct sample in the reservoir with the right
+  // probability, if there are too many distinct samples.
+  void ReservoirSample();
+  // Merges the last sample, which may have any count, into an existing
+  // identical sample if there is one.
+  void MergeLastSample();
 };
 
 void TokenizeTree(const Tree &tree, std::vector<Token> *tokens,
@@ -148,10 +173,13 @@ void CollectPixelSamples(const Image &image, const ModularOptions &options,
                          std::vector<pixel_type> &pixel_samples,
                          std::vector<pixel_type> &diff_samples);
 
+// The split search of large nodes is distributed over `pool`, if not null; the
+// resulting tree does not depend on the number of threads.
 void ComputeBestTree(TreeSamples &tree_samples, float threshold,
                      const std::vector<ModularMultiplierInfo> &mul_info,
                      StaticPropRange static_prop_range,
-                     float fast_decode_multiplier, Tree *tree);
+                     float fast_decode_multiplier, ThreadPool *pool,
+                     Tree *tree);
 
 }  // namespace jxl
 #endif  // LIB_JXL_MODULAR_ENCODING_ENC_MA_H_
@@ -8,10 +8,12 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <algorithm>
 #include <queue>
 
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/scope_guard.h"
+#include "lib/jxl/common.h"
 #include "lib/jxl/modular/encoding/context_predict.h"
 #include "lib/jxl/modular/options.h"
 
@@ -125,36 +127,221 @@ FlatTree FilterTree(const Tree &global_tree,
   return output;
 }
 
+namespace {
+
+// Decodes a channel whose tree, after filtering on static properties, is a
+// single leaf with a predictor other than Weighted. Instantiated per predictor
+// so that the prediction inlines to an expression of the neighbours; pixels
+// away from the channel borders also skip the edge-case handling.
+template <Predictor predictor>
+void DecodeChannelNoTreeNoWP(BitReader *br, ANSSymbolReader *reader,
+                             size_t ctx_id, int32_t multiplier,
+                             int64_t offset, Channel *channel) {
+  const intptr_t onerow = channel->plane.PixelsPerRow();
+  const size_t w = channel->w;
+  const auto decode_pixel = [&](pixel_type *JXL_RESTRICT pp,
+                                pixel_type_w guess) {
+    uint64_t v = reader->ReadHybridUintClustered(ctx_id, br);
+    JXL_DASSERT((v & 0xFFFFFFFF) == v);
+    // if it overflows, it overflows, and we have a problem anyway
+    *pp = UnpackSigned(v) * multiplier + guess + offset;
+  };
+  for (size_t y = 0; y < channel->h; y++) {
+    pixel_type *JXL_RESTRICT r = channel->Row(y);
+    size_t x = 0;
+    if (y > 1 && w > 4) {
+      for (; x < 2; x++) {
+        decode_pixel(r + x, PredictNoTreeNoWP(w, r + x, onerow, x, y, predictor)
+                                .guess);
+      }
+      for (; x < w - 2; x++) {
+        decode_pixel(r + x, detail::Predict<detail::kNoEdgeCases>(
+                                /*p=*/nullptr, w, r + x, onerow, x, y,
+                                predictor, /*lookup=*/nullptr,
+                                /*references=*/nullptr, /*wp_state=*/nullptr,
+                                /*predictions=*/nullptr)
+                                .guess);
+      }
+    }
+    for (; x < w; x++) {
+      decode_pixel(r + x,
+                   PredictNoTreeNoWP(w, r + x, onerow, x, y, predictor).guess);
+    }
+  }
+}
+
+// Decodes a channel whose tree is a single leaf with a predictor that only
+// depends on the left, top and top-left neighbours, no offset and multiplier,
+// and whose histograms are prefix codes with only RLE as LZ77; this is the
+// structure of the channels produced by the fast lossless encoder.
+template <Predictor predictor>
+void DecodeChannelNoTreeHuffRle(BitReader *br, ANSSymbolReader *reader,
+                                size_t ctx_id, Channel *channel) {
+  static_assert(predictor == Predictor::Gradient ||
+                    predictor == Predictor::Left ||
+                    predictor == Predictor::Top ||
+                    predictor == Predictor::Select,
+                "Unsupported predictor");
+  uint32_t run = 0;
+  uint32_t v = 0;
+  // Second literal of a pair decoded by the previous lookup, if any.
+  uint32_t next = 0;
+  bool has_next = false;
+  pixel_type_w sv = 0;
+  // A pair must not be decoded for the last pixel of the channel, as the
+  // second literal would belong to whatever is decoded next.
+  const auto read_value = [&](bool allow_pair) {
+    if (has_next) {
+      v = next;
+      has_next = false;
+      return;
+    }
+    has_next = reader->ReadHybridUintClusteredHuffRleOnlyPair(
+        ctx_id, allow_pair, br, &v, &next, &run);
+  };
+  for (size_t y = 0; y < channel->h; y++) {
+    pixel_type *JXL_RESTRICT r = channel->Row(y);
+    const pixel_type *JXL_RESTRICT rtop = (y ? channel->Row(y - 1) : r - 1);
+    const pixel_type *JXL_RESTRICT rtopleft =
+        (y ? channel->Row(y - 1) - 1 : r - 1);
+    const bool last_row = y + 1 == channel->h;
+    // All the supported predictors agree on the first column, where the
+    // neighbours are all equal to the pixel above.
+    pixel_type_w guess = (y ? rtop[0] : 0);
+    if (run == 0) {
+      read_value(!last_row || channel->w > 1);
+      sv = UnpackSigned(v);
+    } else {
+      run--;
+    }
+    r[0] = sv + guess;
+    for (size_t x = 1; x < channel->w; x++) {
+      pixel_type left = r[x - 1];
+      pixel_type top = rtop[x];
+      pixel_type topleft = rtopleft[x];
+      pixel_type_w guess;
+      if (predictor == Predictor::Left) {
+        guess = left;
+      } else if (predictor == Predictor::Top) {
+        guess = top;
+      } else if (predictor == Predictor::Select) {
+        guess = Select(left, top, topleft);
+      } else {
+        guess = ClampedGradient(top, left, topleft);
+      }
+      if (!run) {
+        read_value(!last_row || x + 1 < channel->w);
+        sv = UnpackSigned(v);
+      } else {
+        run--;
+      }
+      r[x] = sv + guess;
+    }
+  }
+}
+
+}  // namespace
+
+void FilterTreeForChannel(
+    const Tree &tree, const std::vector<uint8_t> &context_map,
+    std::array<pixel_type, kNumStaticProperties> &static_props,
+    FilteredTree *filtered) {
+  filtered->use_wp = false;
+  filtered->wp_only = false;
+  filtered->gradient_only = false;
+  filtered->tree =
+      FilterTree(tree, static_props, &filtered->num_props, &filtered->use_wp,
+                 &filtered->wp_only, &filtered->gradient_only);
+
+  // From here on, tree lookup returns a *clustered* context ID.
+  // This avoids an extra memory lookup after tree traversal.
+  for (size_t i = 0; i < filtered->tree.size(); i++) {
+    if (filtered->tree[i].property0 == -1) {
+      filtered->tree[i].childID = context_map[filtered->tree[i].childID];
+    }
+  }
+  // A single leaf needs no lookup table.
+  if (filtered->tree.size() == 1) return;
+
+  // Check if this tree is a WP-only tree with a small enough property value
+  // range.
+  // Initialized to avoid clang-tidy complaining.
+  std::fill(std::begin(filtered->context_lookup),
+            std::end(filtered->context_lookup), 0);
+  std::fill(std::begin(filtered->offsets), std::end(filtered->offsets), 0);
+  std::fill(std::begin(filtered->multipliers), std::end(filtered->multipliers),
+            0);
+  if (filtered->wp_only) {
+    filtered->wp_only =
+        TreeToLookupTable(filtered->tree, filtered->context_lookup,
+                          filtered->offsets, filtered->multipliers);
+  }
+  if (filtered->gradient_only) {
+    filtered->gradient_only =
+        TreeToLookupTable(filtered->tree, filtered->context_lookup,
+                          filtered->offsets, filtered->multipliers);
+  }
+}
+
+const FilteredTree *FilteredTreeCache::Get(
+    const Tree &tree, const std::vector<uint8_t> &context_map,
+    std::array<pixel_type, kNumStaticProperties> &static_props) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!has_splits_) {
+    for (const PropertyDecisionNode &node : tree) {
+      if (node.property < 0 || node.property >= kNumStaticProperties) continue;
+      splits_[node.property].push_back(node.splitval);
+    }
+    for (std::vector<pixel_type> &splits : splits_) {
+      std::sort(splits.begin(), splits.end());
+      splits.erase(std::unique(splits.begin(), splits.end()), splits.end());
+    }
+    has_splits_ = true;
+  }
+  // The nodes of static properties compare with `>`, so the values with the
+  // same number of split values strictly below them go the same way.
+  std::array<size_t, kNumStaticProperties> key;
+  for (size_t i = 0; i < kNumStaticProperties; i++) {
+    key[i] = std::lower_bound(splits_[i].begin(), splits_[i].end(),
+                              static_props[i]) -
+             splits_[i].begin();
+  }
+  std::unique_ptr<FilteredTree> &filtered = trees_[key];
+  if (!filtered) {
+    filtered = jxl::make_unique<FilteredTree>();
+    FilterTreeForChannel(tree, context_map, static_props, filtered.get());
+  }
+  return filtered.get();
+}
+
+void FilteredTreeCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  has_splits_ = false;
+  for (std::vector<pixel_type> &splits : splits_) splits.clear();
+  trees_.clear();
+}
+
 Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
-                                 const std::vector<uint8_t> &context_map,
-                                 const Tree &global_tree,
+                                 const FilteredTree &filtered,
                                  const weighted::Header &wp_header,
                                  pixel_type chan, size_t group_id,
-                                 Image *image) {
+                                 ModularDecodeStats *stats, Image *image) {
   Channel &channel = image->channel[chan];
 
   std::array<pixel_type, kNumStaticProperties> static_props = {
       {chan, (int)group_id}};
-  // TODO(veluca): filter the tree according to static_props.
 
   // zero pixel channel? could happen
   if (channel.w == 0 || channel.h == 0) return true;
 
-  bool tree_has_wp_prop_or_pred = false;
-  bool is_wp_only = false;
-  bool is_gradient_only = false;
-  size_t num_props;
-  FlatTree tree =
-      FilterTree(global_tree, static_props, &num_props,
-                 &tree_has_wp_prop_or_pred, &is_wp_only, &is_gradient_only);
-
-  // From here on, tree lookup returns a *clustered* context ID.
-  // This avoids an extra memory lookup after tree traversal.
-  for (size_t i = 0; i < tree.size(); i++) {
-    if (tree[i].property0 == -1) {
-      tree[i].childID = context_map[tree[i].childID];
-    }
-  }
+  const FlatTree &tree = filtered.tree;
+  const size_t num_props = filtered.num_props;
+  const bool tree_has_wp_prop_or_pred = filtered.use_wp;
+  const bool is_wp_only = filtered.wp_only;
+  const bool is_gradient_only = filtered.gradient_only;
+  const uint8_t *context_lookup = filtered.context_lookup;
+  const int8_t *offsets = filtered.offsets;
+  const int8_t *multipliers = filtered.multipliers;
 
   JXL_DEBUG_V(3, "Decoded MA tree with %" PRIuS " nodes", tree.size());
 
@@ -167,7 +354,14 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
     return val * multiplier + offset;
   };
 
+  const auto count_path = [stats](ModularDecodePath path) {
+    if (stats == nullptr) return;
+    stats->num_channels[static_cast<size_t>(path)].fetch_add(
+        1, std::memory_order_relaxed);
+  };
+
   if (tree.size() == 1) {
+    count_path(ModularDecodePath::kSingleLeaf);
     // special optimized case: no meta-adaptation, so no need
     // to compute properties.
     Predictor predictor = tree[0].predictor;
@@ -178,8 +372,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
       uint32_t value;
       if (reader->IsSingleValueAndAdvance(ctx_id, &value,
                                           channel.w * channel.h)) {
-        // Special-case: histogram has a single symbol, with no extra bits, and
-        // we use ANS mode.
+        // Special-case: histogram has a single symbol, with no extra bits.
         JXL_DEBUG_V(8, "Fastest track.");
         pixel_type v = make_pixel(value, multiplier, offset);
         for (size_t y = 0; y < channel.h; y++) {
@@ -206,38 +399,28 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
           }
         }
       }
-    } else if (predictor == Predictor::Gradient && offset == 0 &&
-               multiplier == 1 && reader->HuffRleOnly()) {
-      JXL_DEBUG_V(8, "Gradient RLE (fjxl) very fast track.");
-      uint32_t run = 0;
-      uint32_t v = 0;
-      pixel_type_w sv = 0;
-      for (size_t y = 0; y < channel.h; y++) {
-        pixel_type *JXL_RESTRICT r = channel.Row(y);
-        const pixel_type *JXL_RESTRICT rtop = (y ? channel.Row(y - 1) : r - 1);
-        const pixel_type *JXL_RESTRICT rtopleft =
-            (y ? channel.Row(y - 1) - 1 : r - 1);
-        pixel_type_w guess = (y ? rtop[0] : 0);
-        if (run == 0) {
-          reader->ReadHybridUintClusteredHuffRleOnly(ctx_id, br, &v, &run);
-          sv = UnpackSigned(v);
-        } else {
-          run--;
-        }
-        r[0] = sv + guess;
-        for (size_t x = 1; x < channel.w; x++) {
-          pixel_type left = r[x - 1];
-          pixel_type top = rtop[x];
-          pixel_type topleft = rtopleft[x];
-          pixel_type_w guess = ClampedGradient(top, left, topleft);
-          if (!run) {
-            reader->ReadHybridUintClusteredHuffRleOnly(ctx_id, br, &v, &run);
-            sv = UnpackSigned(v);
-          } else {
-            run--;
-          }
-          r[x] = sv + guess;
-        }
+    } else if ((predictor == Predictor::Gradient ||
+                predictor == Predictor::Left || predictor == Predictor::Top ||
+                predictor == Predictor::Select) &&
+               offset == 0 && multiplier == 1 && reader->HuffRleOnly()) {
+      JXL_DEBUG_V(8, "Prefix code RLE (fjxl) very fast track.");
+      switch (predictor) {
+        case Predictor::Left:
+          DecodeChannelNoTreeHuffRle<Predictor::Left>(br, reader, ctx_id,
+                                                      &channel);
+          break;
+        case Predictor::Top:
+          DecodeChannelNoTreeHuffRle<Predictor::Top>(br, reader, ctx_id,
+                                                     &channel);
+          break;
+        case Predictor::Select:
+          DecodeChannelNoTreeHuffRle<Predictor::Select>(br, reader, ctx_id,
+                                                        &channel);
+          break;
+        default:
+          DecodeChannelNoTreeHuffRle<Predictor::Gradient>(br, reader, ctx_id,
+                                                          &channel);
+          break;
       }
     } else if (predictor == Predictor::Gradient && offset == 0 &&
                multiplier == 1) {
@@ -257,31 +440,72 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
     } else if (predictor != Predictor::Weighted) {
       // special optimized case: no wp
       JXL_DEBUG_V(8, "Quite fast track.");
-      const intptr_t onerow = channel.plane.PixelsPerRow();
-      for (size_t y = 0; y < channel.h; y++) {
-        pixel_type *JXL_RESTRICT r = channel.Row(y);
-        for (size_t x = 0; x < channel.w; x++) {
-          PredictionResult pred =
-              PredictNoTreeNoWP(channel.w, r + x, onerow, x, y, predictor);
-          pixel_type_w g = pred.guess + offset;
-          uint64_t v = reader->ReadHybridUintClustered(ctx_id, br);
-          // NOTE: pred.multiplier is unset.
-          r[x] = make_pixel(v, multiplier, g);
-        }
+      decltype(&DecodeChannelNoTreeNoWP<Predictor::Zero>) decode_channel;
+      switch (predictor) {
+        case Predictor::Left:
+          decode_channel = DecodeChannelNoTreeNoWP<Predictor::Left>;
+          break;
+        case Predictor::Top:
+          decode_channel = DecodeChannelNoTreeNoWP<Predictor::Top>;
+          break;
+        case Predictor::Average0:
+          decode_channel = DecodeChannelNoTreeNoWP<Predictor::Average0>;
+          break;
+        case Predictor::Select:
+          decode_channel = DecodeChannelNoTreeNoWP<Predictor::Select>;
+          break;
+        case Predictor::Gradient:
+          decode_channel = DecodeChannelNoTreeNoWP<Predictor::Gradient>;
+          break;
+        case Predictor::TopRight:
+          decode_channel = DecodeChannelNoTreeNoWP<Predictor::TopRight>;
+          break;
+        case Predictor::TopLeft:
+          decode_channel = DecodeChannelNoTreeNoWP<Predictor::TopLeft>;
+          break;
+        case Predictor::LeftLeft:
+          decode_channel = DecodeChannelNoTreeNoWP<Predictor::LeftLeft>;
+          break;
+        case Predictor::Average1:
+          decode_channel = DecodeChannelNoTreeNoWP<Predictor::Average1>;
+          break;
+        case Predictor::Average2:
+          decode_channel = DecodeChannelNoTreeNoWP<Predictor::Average2>;
+          break;
+        case Predictor::Average3:
+          decode_channel = DecodeChannelNoTreeNoWP<Predictor::Average3>;
+          break;
+        case Predictor::Average4:
+          decode_channel = DecodeChannelNoTreeNoWP<Predictor::Average4>;
+          break;
+        default:
+          // Zero predictors are handled above, and the tree decoder rejects
+          // encoder-only predictors.
+          decode_channel = DecodeChannelNoTreeNoWP<Predictor::Zero>;
+          break;
       }
+      decode_channel(br, reader, ctx_id, multiplier, offset, &channel);
     } else {
       JXL_DEBUG_V(8, "Somewhat fast track.");
       const intptr_t onerow = channel.plane.PixelsPerRow();
       weighted::State wp_state(wp_header, channel.w, channel.h);
       for (size_t y = 0; y < channel.h; y++) {
         pixel_type *JXL_RESTRICT r = channel.Row(y);
+        // With a single leaf the residuals do not depend on the decoded
+        // pixels, so the entropy decoding of a row and its (serial) weighted
+        // prediction run as two separate loops. The residuals are stored in
+        // the row itself, as the prediction of a pixel only reads the pixels
+        // to its left and the rows above.
+        for (size_t x = 0; x < channel.w; x++) {
+          uint64_t v = reader->ReadHybridUintClustered(ctx_id, br);
+          r[x] = make_pixel(v, multiplier, 0);
+        }
         for (size_t x = 0; x < channel.w; x++) {
           pixel_type_w g = PredictNoTreeWP(channel.w, r + x, onerow, x, y,
                                            predictor, &wp_state)
                                .guess +
                            offset;
-          uint64_t v = reader->ReadHybridUintClustered(ctx_id, br);
-          r[x] = make_pixel(v, multiplier, g);
+          r[x] = static_cast<pixel_type>(r[x] + g);
           wp_state.UpdateErrors(r[x], x, y, channel.w);
         }
       }
@@ -289,19 +513,10 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
     return true;
   }
 
-  // Check if this tree is a WP-only tree with a small enough property value
-  // range.
-  // Initialized to avoid clang-tidy complaining.
-  uint8_t context_lookup[2 * kPropRangeFast] = {};
-  int8_t multipliers[2 * kPropRangeFast] = {};
-  int8_t offsets[2 * kPropRangeFast] = {};
-  if (is_wp_only) {
-    is_wp_only = TreeToLookupTable(tree, context_lookup, offsets, multipliers);
-  }
-  if (is_gradient_only) {
-    is_gradient_only =
-        TreeToLookupTable(tree, context_lookup, offsets, multipliers);
-  }
+  count_path(is_gradient_only            ? ModularDecodePath::kGradientOnly
+             : is_wp_only                ? ModularDecodePath::kWPOnly
+             : !tree_has_wp_prop_or_pred ? ModularDecodePath::kGeneric
+                                         : ModularDecodePath::kGenericWP);
 
   if (is_gradient_only) {
     JXL_DEBUG_V(8, "Gradient fast track.");
@@ -446,6 +661,38 @@ Status ValidateChannelDimensions(const Image &image,
   return true;
 }
 
+size_t NumDecodedChannels(const std::vector<Transform> &transforms,
+                          size_t num_channels) {
+  for (const Transform &transform : transforms) {
+    if (num_channels == SIZE_MAX) break;
+    switch (transform.id) {
+      case TransformId::kRCT:
+        if (transform.begin_c < num_channels &&
+            transform.begin_c + 3 > num_channels) {
+          num_channels = transform.begin_c + 3;
+        }
+        break;
+      case TransformId::kPalette:
+        // The palette becomes a new first meta-channel and its channels are
+        // replaced by a single index channel at begin_c + 1.
+        if (transform.begin_c + transform.num_c <= num_channels) {
+          num_channels += 2 - transform.num_c;
+        } else if (transform.begin_c >= num_channels) {
+          num_channels++;
+        } else {
+          num_channels = transform.begin_c + 2;
+        }
+        break;
+      default:
+        // Squeeze spreads every channel over residuals at the end of the
+        // image.
+        num_channels = SIZE_MAX;
+        break;
+    }
+  }
+  return num_channels;
+}
+
 Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
                      size_t group_id, ModularOptions *options,
                      const Tree *global_tree, const ANSCode *global_code,
@@ -498,6 +745,14 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
   }
   if (num_chans == 0) return true;
 
+  size_t num_decoded_channels = nb_channels;
+  if (options->num_decoded_channels < nb_channels) {
+    num_decoded_channels =
+        NumDecodedChannels(header.transforms, options->num_decoded_channels);
+    num_decoded_channels = std::min(
+        std::max(num_decoded_channels, image.nb_meta_channels), nb_channels);
+  }
+
   size_t next_channel = 0;
   auto scope_guard = MakeScopeGuard([&]() {
     // Do not do anything if truncated groups are not allowed.
@@ -536,6 +791,15 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
     JXL_RETURN_IF_ERROR(DecodeTree(br, &tree_storage, max_tree_size));
     JXL_RETURN_IF_ERROR(DecodeHistograms(br, (tree_storage.size() + 1) / 2,
                                          &code_storage, &context_map_storage));
+    if (ModularDecodeStats *stats = options->decode_stats) {
+      stats->num_tree_nodes.fetch_add(tree_storage.size(),
+                                      std::memory_order_relaxed);
+      stats->num_histograms.fetch_add(code_storage.uint_config.size(),
+                                      std::memory_order_relaxed);
+      stats->num_entropy_codes.fetch_add(1, std::memory_order_relaxed);
+      stats->num_lz77_codes.fetch_add(code_storage.lz77.enabled ? 1 : 0,
+                                      std::memory_order_relaxed);
+    }
   } else {
     if (!global_tree || !global_code || !global_ctx_map ||
         global_tree->empty()) {
@@ -546,8 +810,17 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
     context_map = global_ctx_map;
   }
 
-  // Read channels
+  if (options->decode_stats != nullptr) {
+    options->decode_stats->num_streams.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Read channels. They are decoded one after the other even when the tree
+  // does not look at previous channels: they share one entropy coded stream,
+  // and the position where a channel starts is only known once the previous
+  // one is decoded.
   ANSSymbolReader reader(code, br, distance_multiplier);
+  FilteredTree filtered_storage;
+  bool skipped_channels = false;
   for (; next_channel < nb_channels; next_channel++) {
     Channel &channel = image.channel[next_channel];
     if (!channel.w || !channel.h) {
@@ -558,9 +831,23 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
          channel.h > options->max_chan_size)) {
       break;
     }
+    if (next_channel >= num_decoded_channels) {
+      skipped_channels = true;
+      break;
+    }
+    std::array<pixel_type, kNumStaticProperties> static_props = {
+        {static_cast<pixel_type>(next_channel),
+         static_cast<pixel_type>(group_id)}};
+    const FilteredTree *filtered = &filtered_storage;
+    if (header.use_global_tree && options->tree_cache != nullptr) {
+      filtered = options->tree_cache->Get(*tree, *context_map, static_props);
+    } else {
+      FilterTreeForChannel(*tree, *context_map, static_props,
+                           &filtered_storage);
+    }
     JXL_RETURN_IF_ERROR(DecodeModularChannelMAANS(
-        br, &reader, *context_map, *tree, header.wp_header, next_channel,
-        group_id, &image));
+        br, &reader, *filtered, header.wp_header, next_channel, group_id,
+        options->decode_stats, &image));
     // Truncated group.
     if (!br->AllReadsWithinBounds()) {
       if (!allow_truncated_group) return JXL_FAILURE("Truncated input");
@@ -571,6 +858,15 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
   // Make sure no zero-filling happens even if next_channel < nb_channels.
   scope_guard.Disarm();
 
+  if (skipped_channels) {
+    // The remaining channels are not needed, so the stream is not read to the
+    // end.
+    for (size_t c = next_channel; c < nb_channels; c++) {
+      ZeroFillImage(&image.channel[c].plane);
+    }
+    return true;
+  }
+
   if (!reader.CheckANSFinalState()) {
     return JXL_FAILURE("ANS decode final state failed");
   }
@@ -9,6 +9,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include "lib/jxl/dec_ans.h"
@@ -117,11 +121,63 @@ bool TreeToLookupTable(const FlatTree &tree,
   }
   return true;
 }
+
+// A tree filtered by the static properties of a channel, with the leaves
+// mapped to clustered contexts, and the lookup tables of the fast paths when
+// they apply.
+struct FilteredTree {
+  FlatTree tree;
+  size_t num_props;
+  bool use_wp;
+  bool wp_only;
+  bool gradient_only;
+  uint8_t context_lookup[2 * kPropRangeFast];
+  int8_t offsets[2 * kPropRangeFast];
+  int8_t multipliers[2 * kPropRangeFast];
+};
+
+// Computes `*filtered` for the channel with `static_props`.
+void FilterTreeForChannel(
+    const Tree &tree, const std::vector<uint8_t> &context_map,
+    std::array<pixel_type, kNumStaticProperties> &static_props,
+    FilteredTree *filtered);
+
+// The filtered versions of a global tree, shared by the channels of all the
+// groups whose static properties take the same branches of the tree. Can be
+// used from several threads at once.
+class FilteredTreeCache {
+ public:
+  // Returns the filtered `tree` for `static_props`. The tree and the context
+  // map must not change until the next Clear().
+  const FilteredTree *Get(
+      const Tree &tree, const std::vector<uint8_t> &context_map,
+      std::array<pixel_type, kNumStaticProperties> &static_props);
+
+  void Clear();
+
+ private:
+  std::mutex mutex_;
+  bool has_splits_ = false;
+  // Sorted split values of the nodes of each static property. Values with the
+  // same number of split values below them take the same branches.
+  std::vector<pixel_type> splits_[kNumStaticProperties];
+  std::map<std::array<size_t, kNumStaticProperties>,
+           std::unique_ptr<FilteredTree>>
+      trees_;
+};
+
 // TODO(veluca): make cleaner interfaces.
 
 Status ValidateChannelDimensions(const Image &image,
                                  const ModularOptions &options);
 
+// Maps the number of leading channels that are needed in an image before
+// `transforms` to the number of leading channels that have to be decoded
+// after they are meta-applied. Returns SIZE_MAX if the transforms mix the
+// needed channels with the others.
+size_t NumDecodedChannels(const std::vector<Transform> &transforms,
+                          size_t num_channels);
+
 Status ModularGenericDecompress(BitReader *br, Image &image,
                                 GroupHeader *header, size_t group_id,
                                 ModularOptions *options,
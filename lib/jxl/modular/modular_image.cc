@@ -13,6 +13,11 @@
 
 namespace jxl {
 
+Plane<pixel_type> Channel::AllocatePlane(size_t xsize, size_t ysize) {
+  CacheAligned::ScopedTag tag(JXL_MEMORY_TAG_MODULAR);
+  return Plane<pixel_type>(xsize, ysize);
+}
+
 void Image::undo_transforms(const weighted::Header &wp_header,
                             jxl::ThreadPool *pool) {
   while (!transform.empty()) {
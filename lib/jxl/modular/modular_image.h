@@ -38,7 +38,7 @@ class Channel {
   size_t w, h;
   int hshift, vshift;  // w ~= image.w >> hshift;  h ~= image.h >> vshift
   Channel(size_t iw, size_t ih, int hsh = 0, int vsh = 0)
-      : plane(iw, ih), w(iw), h(ih), hshift(hsh), vshift(vsh) {}
+      : plane(AllocatePlane(iw, ih)), w(iw), h(ih), hshift(hsh), vshift(vsh) {}
 
   Channel(const Channel& other) = delete;
   Channel& operator=(const Channel& other) = delete;
@@ -58,8 +58,7 @@ class Channel {
 
   void shrink() {
     if (plane.xsize() == w && plane.ysize() == h) return;
-    jxl::Plane<pixel_type> resizedplane(w, h);
-    plane = std::move(resizedplane);
+    plane = AllocatePlane(w, h);
   }
   void shrink(int nw, int nh) {
     w = nw;
@@ -71,6 +70,10 @@ class Channel {
   JXL_INLINE const pixel_type* Row(const size_t y) const {
     return plane.Row(y);
   }
+
+ private:
+  // Allocates a plane accounted under JXL_MEMORY_TAG_MODULAR.
+  static jxl::Plane<pixel_type> AllocatePlane(size_t xsize, size_t ysize);
 };
 
 class Transform;
@@ -6,9 +6,11 @@
 #ifndef LIB_JXL_MODULAR_OPTIONS_H_
 #define LIB_JXL_MODULAR_OPTIONS_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <array>
+#include <atomic>
 #include <vector>
 
 namespace jxl {
@@ -52,6 +54,37 @@ struct ModularMultiplierInfo {
   uint32_t multiplier;
 };
 
+// How the pixels of a modular channel were decoded, from fastest to slowest.
+enum class ModularDecodePath : size_t {
+  // The MA tree of the channel has a single leaf.
+  kSingleLeaf,
+  // All the leaves use the gradient predictor and split on small properties.
+  kGradientOnly,
+  // All the leaves use the weighted predictor and split on small properties.
+  kWPOnly,
+  // Generic tree traversal, without the weighted predictor.
+  kGeneric,
+  // Generic tree traversal with the weighted predictor.
+  kGenericWP,
+};
+constexpr size_t kNumModularDecodePaths =
+    static_cast<size_t>(ModularDecodePath::kGenericWP) + 1;
+
+class FilteredTreeCache;
+
+// Counters of the decisions that drive the cost of decoding modular streams,
+// shared by the streams decoded in parallel.
+struct ModularDecodeStats {
+  std::atomic<uint64_t> num_streams{0};
+  // Of the trees, histograms and entropy codes local to the streams. The
+  // global ones are counted by their owner.
+  std::atomic<uint64_t> num_tree_nodes{0};
+  std::atomic<uint64_t> num_histograms{0};
+  std::atomic<uint64_t> num_entropy_codes{0};
+  std::atomic<uint64_t> num_lz77_codes{0};
+  std::array<std::atomic<uint64_t>, kNumModularDecodePaths> num_channels{};
+};
+
 struct ModularOptions {
   /// Used in both encode and decode:
 
@@ -62,6 +95,18 @@ struct ModularOptions {
   // Used during decoding for validation of transforms (sqeeezing) scheme.
   size_t group_dim = 0x1FFFFFFF;
 
+  // Used during decoding: only the channels with an index below this one (in
+  // the image before transforms) are needed. The others are zero-filled
+  // instead of decoded where the transforms allow it.
+  size_t num_decoded_channels = SIZE_MAX;
+
+  // If set, the decoder counts what it decodes there.
+  ModularDecodeStats* decode_stats = nullptr;
+
+  // If set, the decoder takes the filtered versions of the global tree from
+  // there instead of filtering it for each channel.
+  FilteredTreeCache* tree_cache = nullptr;
+
   /// Encode options:
   // Fraction of pixels to look at to learn a MA tree
   // Number of iterations to do to learn a MA tree
@@ -78,6 +123,10 @@ struct ModularOptions {
                                                            10, 11, 12, 13};
   float splitting_heuristics_node_threshold = 96;
   size_t max_property_values = 32;
+  // Maximum number of distinct samples kept for learning a MA tree. Beyond
+  // this, samples are reservoir-sampled, which bounds memory usage on very
+  // large images.
+  size_t max_tree_samples = 1 << 24;
 
   // Predictor to use for each channel.
   Predictor predictor = static_cast<Predictor>(-1);
@@ -320,6 +320,12 @@ Status FwdPaletteIteration(Image &input, uint32_t begin_c, uint32_t end_c,
     }
     for (size_t x = 0; x < w; x++) {
       if (lossy && candidate_palette.size() >= nb_colors) break;
+      // Runs of one color need a single lookup in the set.
+      bool same_as_left = x > 0;
+      for (uint32_t c = 0; c < nb && same_as_left; c++) {
+        same_as_left = p_in[c][x] == p_in[c][x - 1];
+      }
+      if (same_as_left) continue;
       for (uint32_t c = 0; c < nb; c++) {
         color[c] = p_in[c][x];
       }
@@ -12,6 +12,11 @@ namespace jxl {
 
 Status FwdRCT(Image &input, size_t begin_c, size_t rct_type, ThreadPool *pool);
 
+// Writes row `y` of the channels `begin_c` to `begin_c` + 2 of `input` after
+// the RCT `rct_type` to `out`, which may alias the rows of `input`.
+void FwdRCTRow(const Image &input, size_t begin_c, size_t rct_type, size_t y,
+               pixel_type *const out[3]);
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_MODULAR_TRANSFORM_ENC_RCT_H_
@@ -4,8 +4,63 @@
 // license that can be found in the LICENSE file.
 
 #include "lib/jxl/modular/transform/palette.h"
-
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jxl/modular/transform/palette.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+HWY_BEFORE_NAMESPACE();
 namespace jxl {
+namespace HWY_NAMESPACE {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::AllTrue;
+using hwy::HWY_NAMESPACE::Ge;
+using hwy::HWY_NAMESPACE::GatherIndex;
+using hwy::HWY_NAMESPACE::Lt;
+using hwy::HWY_NAMESPACE::Max;
+using hwy::HWY_NAMESPACE::Min;
+
+// Replaces a row of palette indices with the palette colors of the `nb`
+// channels in `p_out`, where p_out[0] may alias `p_index`. Vectors of indices
+// that all fall in the explicit palette are looked up with gathers, the others
+// (implicit delta and color cube entries) with GetPaletteValue. If
+// `clamp_index`, indices are first clamped to the explicit palette.
+void InvPaletteRow(const pixel_type *p_index, pixel_type *const *p_out,
+                   size_t nb, size_t w, bool clamp_index,
+                   const pixel_type *JXL_RESTRICT p_palette, int palette_size,
+                   intptr_t onerow, int bit_depth) {
+  const auto lookup_pixel = [&](size_t x) {
+    int index = p_index[x];
+    if (clamp_index) index = Clamp1<int>(index, 0, palette_size - 1);
+    for (size_t c = 0; c < nb; c++) {
+      p_out[c][x] = palette_internal::GetPaletteValue(
+          p_palette, index, /*c=*/c,
+          /*palette_size=*/palette_size,
+          /*onerow=*/onerow, /*bit_depth=*/bit_depth);
+    }
+  };
+  size_t x = 0;
+  if (palette_size > 0) {
+    const HWY_FULL(pixel_type) d;
+    const size_t N = Lanes(d);
+    const auto zero = Zero(d);
+    const auto size = Set(d, palette_size);
+    const auto max_index = Set(d, palette_size - 1);
+    for (; x + N <= w; x += N) {
+      auto index = LoadU(d, p_index + x);
+      if (clamp_index) {
+        index = Min(Max(index, zero), max_index);
+      } else if (!AllTrue(d, Ge(index, zero)) || !AllTrue(d, Lt(index, size))) {
+        for (size_t i = x; i < x + N; i++) lookup_pixel(i);
+        continue;
+      }
+      for (size_t c = 0; c < nb; c++) {
+        StoreU(GatherIndex(d, p_palette + c * onerow, index), d, p_out[c] + x);
+      }
+    }
+  }
+  for (; x < w; x++) lookup_pixel(x);
+}
 
 Status InvPalette(Image &input, uint32_t begin_c, uint32_t nb_colors,
                   uint32_t nb_deltas, Predictor predictor,
@@ -37,45 +92,23 @@ Status InvPalette(Image &input, uint32_t begin_c, uint32_t nb_colors,
     // Nothing to do.
     // Avoid touching "empty" channels with non-zero height.
   } else if (nb_deltas == 0 && predictor == Predictor::Zero) {
-    if (nb == 1) {
-      JXL_RETURN_IF_ERROR(RunOnPool(
-          pool, 0, h, ThreadPool::NoInit,
-          [&](const uint32_t task, size_t /* thread */) {
-            const size_t y = task;
-            pixel_type *p = input.channel[c0].Row(y);
-            for (size_t x = 0; x < w; x++) {
-              const int index = Clamp1<int>(p[x], 0, (pixel_type)palette.w - 1);
-              p[x] = palette_internal::GetPaletteValue(
-                  p_palette, index, /*c=*/0,
-                  /*palette_size=*/palette.w,
-                  /*onerow=*/onerow, /*bit_depth=*/bit_depth);
-            }
-          },
-          "UndoChannelPalette"));
-    } else {
-      JXL_RETURN_IF_ERROR(RunOnPool(
-          pool, 0, h, ThreadPool::NoInit,
-          [&](const uint32_t task, size_t /* thread */) {
-            const size_t y = task;
-            std::vector<pixel_type *> p_out(nb);
-            const pixel_type *p_index = input.channel[c0].Row(y);
-            for (int c = 0; c < nb; c++)
-              p_out[c] = input.channel[c0 + c].Row(y);
-            for (size_t x = 0; x < w; x++) {
-              const int index = p_index[x];
-              for (int c = 0; c < nb; c++) {
-                p_out[c][x] = palette_internal::GetPaletteValue(
-                    p_palette, index, /*c=*/c,
-                    /*palette_size=*/palette.w,
-                    /*onerow=*/onerow, /*bit_depth=*/bit_depth);
-              }
-            }
-          },
-          "UndoPalette"));
-    }
+    JXL_RETURN_IF_ERROR(RunOnPool(
+        pool, 0, h, ThreadPool::NoInit,
+        [&](const uint32_t task, size_t /* thread */) {
+          const size_t y = task;
+          std::vector<pixel_type *> p_out(nb);
+          const pixel_type *p_index = input.channel[c0].Row(y);
+          for (int c = 0; c < nb; c++) p_out[c] = input.channel[c0 + c].Row(y);
+          InvPaletteRow(p_index, p_out.data(), nb, w, /*clamp_index=*/nb == 1,
+                        p_palette, palette.w, onerow, bit_depth);
+        },
+        "UndoPalette"));
   } else {
     // Parallelized per channel.
-    ImageI indices = CopyImage(input.channel[c0].plane);
+    // The indices are still needed while the first channel is overwritten, so
+    // move them out of it and give it a fresh plane instead of copying them.
+    ImageI indices = std::move(input.channel[c0].plane);
+    input.channel[c0].plane = ImageI(indices.xsize(), indices.ysize());
     if (predictor == Predictor::Weighted) {
       JXL_RETURN_IF_ERROR(RunOnPool(
           pool, 0, nb, ThreadPool::NoInit,
@@ -150,6 +183,21 @@ Status InvPalette(Image &input, uint32_t begin_c, uint32_t nb_colors,
   return num_errors.load(std::memory_order_relaxed) == 0;
 }
 
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jxl {
+
+HWY_EXPORT(InvPalette);
+Status InvPalette(Image &input, uint32_t begin_c, uint32_t nb_colors,
+                  uint32_t nb_deltas, Predictor predictor,
+                  const weighted::Header &wp_header, ThreadPool *pool) {
+  return HWY_DYNAMIC_DISPATCH(InvPalette)(input, begin_c, nb_colors, nb_deltas,
+                                          predictor, wp_header, pool);
+}
+
 Status MetaPalette(Image &input, uint32_t begin_c, uint32_t end_c,
                    uint32_t nb_colors, uint32_t nb_deltas, bool lossy) {
   JXL_RETURN_IF_ERROR(CheckEqualChannels(input, begin_c, end_c));
@@ -174,3 +222,4 @@ Status MetaPalette(Image &input, uint32_t begin_c, uint32_t end_c,
 }
 
 }  // namespace jxl
+#endif
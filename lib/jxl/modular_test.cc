@@ -94,6 +94,28 @@ TEST(ModularTest, RoundtripLosslessCustomWP_PermuteRCT) {
   JXL_EXPECT_OK(SamePixels(*io.Main().color(), *io_out.Main().color(), _));
 }
 
+TEST(ModularTest, RoundtripLosslessFewTreeSamples) {
+  const PaddedBytes orig = jxl::test::ReadTestData(
+      "external/wesaturate/500px/u76c0g_bliznaca_srgb8.png");
+  CompressParams cparams;
+  cparams.SetLossless();
+  cparams.options.nb_repeats = 1.0f;
+  // Far fewer than the number of distinct samples, so that most of them go
+  // through reservoir sampling.
+  cparams.options.max_tree_samples = 1000;
+
+  CodecInOut io_out;
+
+  CodecInOut io;
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io));
+  io.ShrinkTo(100, 100);
+
+  size_t compressed_size;
+  JXL_EXPECT_OK(Roundtrip(&io, cparams, {}, &io_out, _, &compressed_size));
+  EXPECT_LE(compressed_size, 14000u);
+  JXL_EXPECT_OK(SamePixels(*io.Main().color(), *io_out.Main().color(), _));
+}
+
 TEST(ModularTest, RoundtripLossyDeltaPalette) {
   const PaddedBytes orig = jxl::test::ReadTestData(
       "external/wesaturate/500px/u76c0g_bliznaca_srgb8.png");
@@ -537,5 +559,33 @@ TEST(ModularTest, UnsqueezeIntegerOverflow) {
   }
 }
 
+TEST(ModularTest, FilteredTreeCacheSharesEquivalentGroups) {
+  // Gradient for the groups after 3, Zero for the others.
+  Tree tree = {PropertyDecisionNode::Split(/*p=*/1, /*split_val=*/3, 1),
+               PropertyDecisionNode::Leaf(Predictor::Gradient),
+               PropertyDecisionNode::Leaf(Predictor::Zero)};
+  tree[1].lchild = 0;
+  tree[2].lchild = 1;
+  const std::vector<uint8_t> context_map = {1, 0};
+  FilteredTreeCache cache;
+  const auto get = [&](pixel_type chan, pixel_type group_id) {
+    std::array<pixel_type, kNumStaticProperties> static_props = {
+        {chan, group_id}};
+    return cache.Get(tree, context_map, static_props);
+  };
+  const FilteredTree* first = get(0, 0);
+  ASSERT_EQ(1, first->tree.size());
+  EXPECT_EQ(Predictor::Zero, first->tree[0].predictor);
+  EXPECT_EQ(0, first->tree[0].childID);
+  EXPECT_EQ(first, get(0, 3));
+  EXPECT_EQ(first, get(2, 1));
+  const FilteredTree* last = get(0, 4);
+  EXPECT_NE(first, last);
+  ASSERT_EQ(1, last->tree.size());
+  EXPECT_EQ(Predictor::Gradient, last->tree[0].predictor);
+  EXPECT_EQ(1, last->tree[0].childID);
+  EXPECT_EQ(last, get(1, 100));
+}
+
 }  // namespace
 }  // namespace jxl
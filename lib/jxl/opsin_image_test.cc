@@ -5,6 +5,9 @@
 
 #include <stdio.h>
 
+#include <cmath>
+#include <utility>
+
 #include <hwy/tests/test_util-inl.h>
 
 #include "lib/jxl/base/compiler_specific.h"
@@ -109,6 +112,41 @@ TEST(OpsinImageTest, VerifyZero) {
   EXPECT_NEAR(0, b, 1e-7);
 }
 
+TEST(OpsinImageTest, SRGB8Levels) {
+  // 8-bit inputs are converted to linear with a table.
+  ImageMetadata metadata8;
+  metadata8.SetUintSamples(8);
+  metadata8.color_encoding = ColorEncoding::SRGB();
+  ImageMetadata metadata_float;
+  metadata_float.SetFloat32Samples();
+  metadata_float.color_encoding = ColorEncoding::LinearSRGB();
+  Image3F srgb(256, 1);
+  Image3F linear(256, 1);
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t x = 0; x < 256; ++x) {
+      // Same as ConvertFromExternal.
+      srgb.PlaneRow(c, 0)[x] = x * (1.0f / 255);
+      const double encoded = x / 255.0;
+      linear.PlaneRow(c, 0)[x] =
+          encoded <= 0.04045 ? encoded / 12.92
+                             : std::pow((encoded + 0.055) / 1.055, 2.4);
+    }
+  }
+  ImageBundle ib8(&metadata8);
+  ib8.SetFromImage(std::move(srgb), metadata8.color_encoding);
+  ImageBundle ib_float(&metadata_float);
+  ib_float.SetFromImage(std::move(linear), metadata_float.color_encoding);
+  Image3F xyb8(256, 1);
+  Image3F xyb_float(256, 1);
+  (void)ToXYB(ib8, /*pool=*/nullptr, &xyb8, GetJxlCms());
+  (void)ToXYB(ib_float, /*pool=*/nullptr, &xyb_float, GetJxlCms());
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t x = 0; x < 256; ++x) {
+      EXPECT_EQ(xyb_float.PlaneRow(c, 0)[x], xyb8.PlaneRow(c, 0)[x]);
+    }
+  }
+}
+
 TEST(OpsinImageTest, VerifyGray) {
   // Test that grayscale colors have a fixed y/b ratio and x==0.
   for (size_t i = 1; i < 255; i++) {
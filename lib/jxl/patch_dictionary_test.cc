@@ -54,5 +54,26 @@ TEST(PatchDictionaryTest, GrayscaleVarDCT) {
       1.1);
 }
 
+TEST(PatchDictionaryTest, Threads) {
+  const PaddedBytes orig = jxl::test::ReadTestData("jxl/grayscale_patches.png");
+  CodecInOut io;
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io));
+
+  CompressParams cparams;
+  cparams.SetLossless();
+  cparams.patches = jxl::Override::kOn;
+
+  // Patch detection must not depend on the number of threads.
+  CodecInOut io2;
+  size_t compressed_size;
+  JXL_EXPECT_OK(Roundtrip(&io, cparams, {}, &io2, _, &compressed_size));
+  test::ThreadPoolForTests pool(4);
+  CodecInOut io3;
+  size_t compressed_size_threads;
+  JXL_EXPECT_OK(Roundtrip(&io, cparams, {}, &io3, _, &compressed_size_threads,
+                          &pool));
+  EXPECT_EQ(compressed_size, compressed_size_threads);
+}
+
 }  // namespace
 }  // namespace jxl
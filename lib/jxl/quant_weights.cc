@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <cmath>
 #include <limits>
+#include <mutex>
 #include <utility>
 
 #include "lib/jxl/base/bits.h"
@@ -491,14 +492,19 @@ Status DequantMatrices::Decode(BitReader* br,
                                ModularFrameDecoder* modular_frame_decoder) {
   size_t all_default = br->ReadBits(1);
   size_t num_tables = all_default ? 0 : static_cast<size_t>(kNum);
+  if (all_default && all_default_) {
+    // The tables computed so far are still valid.
+    return true;
+  }
   encodings_.clear();
   encodings_.resize(kNum, QuantEncoding::Library(0));
+  computed_mask_ = 0;
+  all_default_ = all_default;
   for (size_t i = 0; i < num_tables; i++) {
     JXL_RETURN_IF_ERROR(
         jxl::Decode(br, &encodings_[i], required_size_x[i % kNum],
                     required_size_y[i % kNum], i, modular_frame_decoder));
   }
-  computed_mask_ = 0;
   return true;
 }
 
@@ -1180,14 +1186,59 @@ DequantMatrices::DequantMatrices() {
   }
 }
 
+void DequantMatrices::Reset() {
+  if (!all_default_) {
+    encodings_.clear();
+    encodings_.resize(size_t(QuantTable::kNum), QuantEncoding::Library(0));
+    computed_mask_ = 0;
+    all_default_ = true;
+  }
+  for (size_t c = 0; c < 3; c++) {
+    dc_quant_[c] = kDCQuant[c];
+    inv_dc_quant_[c] = kInvDCQuant[c];
+  }
+}
+
+namespace {
+
+// Tables computed from the default encodings. They are the same for all
+// frames, so they are shared by every DequantMatrices of the process whose
+// encodings are all the default ones, and computed at most once each.
+struct DefaultDequantTables {
+  std::mutex mutex;
+  // Guarded by mutex: storage and the QuantTable kinds already computed in it.
+  hwy::AlignedFreeUniquePtr<float[]> storage;
+  uint32_t computed_kind_mask = 0;
+};
+
+DefaultDequantTables* GetDefaultDequantTables() {
+  static DefaultDequantTables* tables = new DefaultDequantTables();
+  return tables;
+}
+
+}  // namespace
+
 Status DequantMatrices::EnsureComputed(uint32_t acs_mask) {
   const QuantEncoding* library = Library();
 
-  if (!table_storage_) {
-    table_storage_ = hwy::AllocateAligned<float>(2 * kTotalTableSize);
-    table_ = table_storage_.get();
-    inv_table_ = table_storage_.get() + kTotalTableSize;
+  DefaultDequantTables* defaults = nullptr;
+  std::unique_lock<std::mutex> defaults_lock;
+  float* storage;
+  if (all_default_) {
+    defaults = GetDefaultDequantTables();
+    defaults_lock = std::unique_lock<std::mutex>(defaults->mutex);
+    if (!defaults->storage) {
+      defaults->storage = hwy::AllocateAligned<float>(2 * kTotalTableSize);
+    }
+    storage = defaults->storage.get();
+  } else {
+    if (!table_storage_) {
+      table_storage_ = hwy::AllocateAligned<float>(2 * kTotalTableSize);
+    }
+    storage = table_storage_.get();
   }
+  table_ = storage;
+  inv_table_ = storage + kTotalTableSize;
 
   size_t offsets[kNum * 3 + 1];
   size_t pos = 0;
@@ -1208,9 +1259,13 @@ Status DequantMatrices::EnsureComputed(uint32_t acs_mask) {
     }
   }
   uint32_t computed_kind_mask = 0;
-  for (size_t i = 0; i < AcStrategy::kNumValidStrategies; i++) {
-    if (computed_mask_ & (1u << i)) {
-      computed_kind_mask |= 1u << kQuantTable[i];
+  if (defaults) {
+    computed_kind_mask = defaults->computed_kind_mask;
+  } else {
+    for (size_t i = 0; i < AcStrategy::kNumValidStrategies; i++) {
+      if (computed_mask_ & (1u << i)) {
+        computed_kind_mask |= 1u << kQuantTable[i];
+      }
     }
   }
   for (size_t table = 0; table < kNum; table++) {
@@ -1219,17 +1274,16 @@ Status DequantMatrices::EnsureComputed(uint32_t acs_mask) {
     size_t pos = offsets[table * 3];
     if (encodings_[table].mode == QuantEncoding::kQuantModeLibrary) {
       JXL_CHECK(HWY_DYNAMIC_DISPATCH(ComputeQuantTable)(
-          library[table], table_storage_.get(),
-          table_storage_.get() + kTotalTableSize, table, QuantTable(table),
-          &pos));
+          library[table], storage, storage + kTotalTableSize, table,
+          QuantTable(table), &pos));
     } else {
       JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(ComputeQuantTable)(
-          encodings_[table], table_storage_.get(),
-          table_storage_.get() + kTotalTableSize, table, QuantTable(table),
-          &pos));
+          encodings_[table], storage, storage + kTotalTableSize, table,
+          QuantTable(table), &pos));
     }
     JXL_ASSERT(pos == offsets[table * 3 + 3]);
   }
+  if (defaults) defaults->computed_kind_mask |= kind_mask;
   computed_mask_ |= acs_mask;
 
   return true;
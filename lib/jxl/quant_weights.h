@@ -364,6 +364,11 @@ class DequantMatrices {
 
   DequantMatrices();
 
+  // Restores the default encodings and DC quantization, as after construction,
+  // but keeps the table storage and, if the encodings were already the default
+  // ones, the tables computed for them.
+  void Reset();
+
   static const QuantEncoding* Library();
 
   typedef std::array<QuantEncodingInternal, kNumPredefinedTables * kNum>
@@ -396,6 +401,7 @@ class DequantMatrices {
   void SetEncodings(const std::vector<QuantEncoding>& encodings) {
     encodings_ = encodings;
     computed_mask_ = 0;
+    all_default_ = false;
   }
 
   // For encoder.
@@ -433,7 +439,11 @@ class DequantMatrices {
       ArraySum(required_size_) * kDCTBlockSize * 3;
 
   uint32_t computed_mask_ = 0;
-  // kTotalTableSize entries followed by kTotalTableSize for inv_table
+  // Whether encodings_ are all QuantEncoding::Library(0).
+  bool all_default_ = true;
+  // kTotalTableSize entries followed by kTotalTableSize for inv_table. Only
+  // used for non-default encodings: table_ and inv_table_ otherwise point to
+  // tables shared by all instances.
   hwy::AlignedFreeUniquePtr<float[]> table_storage_;
   const float* table_;
   const float* inv_table_;
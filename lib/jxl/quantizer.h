@@ -76,6 +76,8 @@ class Quantizer {
 
   float ScaleGlobalScale(const float scale) {
     int new_global_scale = static_cast<int>(global_scale_ * scale + 0.5f);
+    // Ensure that new_global_scale stays positive.
+    if (new_global_scale < 1) new_global_scale = 1;
     float scale_out = new_global_scale * 1.0f / global_scale_;
     global_scale_ = new_global_scale;
     RecomputeFromGlobalScale();
@@ -439,6 +439,13 @@ std::vector<std::pair<ImageF*, Rect>> LowMemoryRenderPipeline::PrepareBuffers(
 
 namespace {
 
+// Trailing stages are run on chunks of at most this many pixels of a row, one
+// chunk after the other, so that the data of a chunk stays in L1 cache from
+// the first to the last of these stages also for wide (e.g. upsampled) rows.
+// This is a multiple of the maximum vector size, since the stages may process
+// up to a full vector after the end of their input.
+constexpr size_t kTrailingStagesChunkSize = 256;
+
 JXL_INLINE int GetMirroredY(int y, ssize_t group_y0, ssize_t image_ysize) {
   if (group_y0 == 0 && (y < 0 || y + group_y0 >= image_ysize)) {
     return Mirror(y, image_ysize);
@@ -674,6 +681,9 @@ void LowMemoryRenderPipeline::RenderRect(size_t thread_id,
   int num_extra_rows = *std::max_element(virtual_ypadding_for_output_.begin(),
                                          virtual_ypadding_for_output_.end());
 
+  // Start of the current row of the trailing stages, for each channel.
+  std::vector<float*> trailing_rows(input_data.size());
+
   for (int vy = -num_extra_rows;
        vy < int(image_area_rect.ysize()) + num_extra_rows; vy++) {
     for (size_t i = 0; i < first_trailing_stage_; i++) {
@@ -699,9 +709,9 @@ void LowMemoryRenderPipeline::RenderRect(size_t thread_id,
       prepare_io_rows(y, i);
 
       // Produce output rows.
-      stages_[i]->ProcessRow(input_rows[i], output_rows,
-                             xpadding_for_output_[i], group_rect[i].xsize(),
-                             group_rect[i].x0(), image_y, thread_id);
+      ProcessStageRow(i, input_rows[i], output_rows, xpadding_for_output_[i],
+                      group_rect[i].xsize(), group_rect[i].x0(), image_y,
+                      thread_id);
     }
 
     // Process trailing stages, i.e. the final set of non-kInOut stages; they
@@ -711,7 +721,7 @@ void LowMemoryRenderPipeline::RenderRect(size_t thread_id,
 
     for (size_t c = 0; c < input_data.size(); c++) {
       // Skip pixels that are not part of the actual final image area.
-      input_rows[first_trailing_stage_][c][0] =
+      trailing_rows[c] =
           rows.GetBuffer(stage_input_for_channel_[first_trailing_stage_][c], y,
                          c) +
           x_pixels_skip;
@@ -733,16 +743,23 @@ void LowMemoryRenderPipeline::RenderRect(size_t thread_id,
       continue;
     }
 
-    for (size_t i = first_trailing_stage_; i < stages_.size(); i++) {
-      // Before the first_image_dim_stage_, coordinates are relative to the
-      // current frame.
-      size_t x0 =
-          i < first_image_dim_stage_ ? full_image_x0 - frame_x0 : full_image_x0;
-      size_t y =
-          i < first_image_dim_stage_ ? full_image_y - frame_y0 : full_image_y;
-      stages_[i]->ProcessRow(input_rows[first_trailing_stage_], output_rows,
-                             /*xextra=*/0, full_image_x1 - full_image_x0, x0, y,
-                             thread_id);
+    const size_t xsize = full_image_x1 - full_image_x0;
+    for (size_t chunk = 0; chunk < xsize; chunk += kTrailingStagesChunkSize) {
+      for (size_t c = 0; c < input_data.size(); c++) {
+        input_rows[first_trailing_stage_][c][0] = trailing_rows[c] + chunk;
+      }
+      const size_t chunk_size =
+          std::min(kTrailingStagesChunkSize, xsize - chunk);
+      for (size_t i = first_trailing_stage_; i < stages_.size(); i++) {
+        // Before the first_image_dim_stage_, coordinates are relative to the
+        // current frame.
+        size_t x0 = i < first_image_dim_stage_ ? full_image_x0 - frame_x0
+                                               : full_image_x0;
+        size_t y =
+            i < first_image_dim_stage_ ? full_image_y - frame_y0 : full_image_y;
+        ProcessStageRow(i, input_rows[first_trailing_stage_], output_rows,
+                        /*xextra=*/0, chunk_size, x0 + chunk, y, thread_id);
+      }
     }
   }
 }
@@ -761,9 +778,8 @@ void LowMemoryRenderPipeline::RenderPadding(size_t thread_id, Rect rect) {
     stages_[first_image_dim_stage_ - 1]->ProcessPaddingRow(
         input_rows, rect.xsize(), rect.x0(), rect.y0() + y);
     for (size_t i = first_image_dim_stage_; i < stages_.size(); i++) {
-      stages_[i]->ProcessRow(input_rows, output_rows,
-                             /*xextra=*/0, rect.xsize(), rect.x0(),
-                             rect.y0() + y, thread_id);
+      ProcessStageRow(i, input_rows, output_rows, /*xextra=*/0, rect.xsize(),
+                      rect.x0(), rect.y0() + y, thread_id);
     }
   }
 }
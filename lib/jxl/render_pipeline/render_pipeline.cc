@@ -6,6 +6,7 @@
 #include "lib/jxl/render_pipeline/render_pipeline.h"
 
 #include <algorithm>
+#include <chrono>
 
 #include "lib/jxl/render_pipeline/low_memory_render_pipeline.h"
 #include "lib/jxl/render_pipeline/simple_render_pipeline.h"
@@ -15,11 +16,16 @@ namespace jxl {
 
 void RenderPipeline::Builder::AddStage(
     std::unique_ptr<RenderPipelineStage> stage) {
+  if (stage_hook_) {
+    stage = stage_hook_(std::move(stage));
+    JXL_ASSERT(stage);
+  }
   stages_.push_back(std::move(stage));
 }
 
 std::unique_ptr<RenderPipeline> RenderPipeline::Builder::Finalize(
     FrameDimensions frame_dimensions) && {
+  CacheAligned::ScopedTag tag(JXL_MEMORY_TAG_RENDER_PIPELINE);
 #if JXL_ENABLE_ASSERT
   // Check that the last stage is not an kInOut stage for any channel, and that
   // there is at least one stage.
@@ -94,6 +100,7 @@ std::unique_ptr<RenderPipeline> RenderPipeline::Builder::Finalize(
 
 RenderPipelineInput RenderPipeline::GetInputBuffers(size_t group_id,
                                                     size_t thread_id) {
+  CacheAligned::ScopedTag tag(JXL_MEMORY_TAG_RENDER_PIPELINE);
   RenderPipelineInput ret;
   JXL_DASSERT(group_id < group_completed_passes_.size());
   ret.group_id_ = group_id;
@@ -106,6 +113,7 @@ RenderPipelineInput RenderPipeline::GetInputBuffers(size_t group_id,
 void RenderPipeline::InputReady(
     size_t group_id, size_t thread_id,
     const std::vector<std::pair<ImageF*, Rect>>& buffers) {
+  CacheAligned::ScopedTag tag(JXL_MEMORY_TAG_RENDER_PIPELINE);
   JXL_DASSERT(group_id < group_completed_passes_.size());
   group_completed_passes_[group_id]++;
   for (size_t i = 0; i < buffers.size(); ++i) {
@@ -114,16 +122,86 @@ void RenderPipeline::InputReady(
   }
 
   ProcessBuffers(group_id, thread_id);
+  for (const auto& stage : stages_) {
+    stage->FlushRows(thread_id);
+  }
 }
 
 Status RenderPipeline::PrepareForThreads(size_t num, bool use_group_ids) {
+  CacheAligned::ScopedTag tag(JXL_MEMORY_TAG_RENDER_PIPELINE);
   for (const auto& stage : stages_) {
     JXL_RETURN_IF_ERROR(stage->PrepareForThreads(num));
   }
   PrepareForThreadsInternal(num, use_group_ids);
+  if (collect_stats_) {
+    if (stage_bytes_per_pixel_.empty()) {
+      for (size_t i = 0; i < stages_.size(); i++) {
+        const RenderPipelineStage::Settings& settings = stages_[i]->settings_;
+        size_t bytes = 0;
+        for (size_t c = 0; c < channel_shifts_[i].size(); c++) {
+          switch (stages_[i]->GetChannelMode(c)) {
+            case RenderPipelineChannelMode::kIgnored:
+              break;
+            case RenderPipelineChannelMode::kInPlace:
+              bytes += 2 * sizeof(float);
+              break;
+            case RenderPipelineChannelMode::kInput:
+              bytes += sizeof(float);
+              break;
+            case RenderPipelineChannelMode::kInOut:
+              bytes += sizeof(float) << (settings.shift_x + settings.shift_y);
+              bytes += sizeof(float);
+              break;
+          }
+        }
+        stage_bytes_per_pixel_.push_back(bytes);
+      }
+    }
+    if (thread_stats_.size() < num) {
+      std::vector<StageStats> stats(stages_.size());
+      for (size_t i = 0; i < stages_.size(); i++) {
+        stats[i].name = stages_[i]->GetName();
+      }
+      thread_stats_.resize(num, stats);
+    }
+  }
   return true;
 }
 
+void RenderPipeline::ProcessStageRow(
+    size_t i, const RenderPipelineStage::RowInfo& input_rows,
+    const RenderPipelineStage::RowInfo& output_rows, size_t xextra,
+    size_t xsize, size_t xpos, size_t ypos, size_t thread_id) {
+  if (!collect_stats_) {
+    stages_[i]->ProcessRow(input_rows, output_rows, xextra, xsize, xpos, ypos,
+                           thread_id);
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  stages_[i]->ProcessRow(input_rows, output_rows, xextra, xsize, xpos, ypos,
+                         thread_id);
+  auto end = std::chrono::steady_clock::now();
+  StageStats& stats = thread_stats_[thread_id][i];
+  stats.rows++;
+  stats.nanoseconds +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+          .count();
+  stats.bytes += (xsize + 2 * xextra) * stage_bytes_per_pixel_[i];
+}
+
+std::vector<RenderPipeline::StageStats> RenderPipeline::GetStats() const {
+  if (thread_stats_.empty()) return {};
+  std::vector<StageStats> result = thread_stats_[0];
+  for (size_t t = 1; t < thread_stats_.size(); t++) {
+    for (size_t i = 0; i < result.size(); i++) {
+      result[i].rows += thread_stats_[t][i].rows;
+      result[i].nanoseconds += thread_stats_[t][i].nanoseconds;
+      result[i].bytes += thread_stats_[t][i].bytes;
+    }
+  }
+  return result;
+}
+
 void RenderPipelineInput::Done() {
   JXL_ASSERT(pipeline_);
   pipeline_->InputReady(group_id_, thread_id_, buffers_);
@@ -8,6 +8,10 @@
 
 #include <stdint.h>
 
+#include <functional>
+#include <memory>
+#include <vector>
+
 #include "lib/jxl/image.h"
 #include "lib/jxl/render_pipeline/render_pipeline_stage.h"
 
@@ -47,6 +51,20 @@ class RenderPipelineInput {
   friend class RenderPipeline;
 };
 
+// Called with each stage as it is added to a pipeline; returns the stage to
+// use in its place, or the same stage to keep it. This lets an embedder swap
+// the CPU implementation of a stage, identified by GetName(), for one backed by
+// an accelerator. Such a stage can collect the rows of a group in ProcessRow
+// and process them all in FlushRows. The replacement must have the same
+// Settings and channel modes as the stage it replaces.
+using RenderPipelineStageHook =
+    std::function<std::unique_ptr<RenderPipelineStage>(
+        std::unique_ptr<RenderPipelineStage>)>;
+
+// All the rows are float32, even for 8-bit output: the stages before the
+// conversion to the output color space work on linear or XYB values, and the
+// 11-bit mantissa of float16 does not leave enough margin for them once the
+// transfer function amplifies the errors in the shadows.
 class RenderPipeline {
  public:
   class Builder {
@@ -61,6 +79,11 @@ class RenderPipeline {
     // the pipeline.
     void UseSimpleImplementation() { use_simple_implementation_ = true; }
 
+    // Passes the stages added from now on through `hook`.
+    void SetStageHook(RenderPipelineStageHook hook) {
+      stage_hook_ = std::move(hook);
+    }
+
     // Finalizes setup of the pipeline. Shifts for all channels should be 0 at
     // this point.
     std::unique_ptr<RenderPipeline> Finalize(
@@ -70,6 +93,7 @@ class RenderPipeline {
     std::vector<std::unique_ptr<RenderPipelineStage>> stages_;
     size_t num_c_;
     bool use_simple_implementation_ = false;
+    RenderPipelineStageHook stage_hook_;
   };
 
   friend class Builder;
@@ -102,6 +126,23 @@ class RenderPipeline {
 
   virtual void ClearDone(size_t i) {}
 
+  // Counters of the work done by one stage.
+  struct StageStats {
+    const char* name = nullptr;
+    uint64_t rows = 0;
+    uint64_t nanoseconds = 0;
+    // Estimate of the bytes of row data read and written by the stage.
+    uint64_t bytes = 0;
+  };
+
+  // Enables collecting StageStats for each stage. Must be called before
+  // PrepareForThreads. This adds two clock reads to every call of a stage.
+  void EnableStats() { collect_stats_ = true; }
+
+  // Returns the counters of each stage, summed over all threads, or nothing if
+  // EnableStats was not called.
+  std::vector<StageStats> GetStats() const;
+
  protected:
   std::vector<std::unique_ptr<RenderPipelineStage>> stages_;
   // Shifts for every channel at the input of each stage.
@@ -117,6 +158,13 @@ class RenderPipeline {
 
   friend class RenderPipelineInput;
 
+  // Calls ProcessRow of stage `i`, updating its counters if enabled.
+  void ProcessStageRow(size_t i,
+                       const RenderPipelineStage::RowInfo& input_rows,
+                       const RenderPipelineStage::RowInfo& output_rows,
+                       size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                       size_t thread_id);
+
  private:
   void InputReady(size_t group_id, size_t thread_id,
                   const std::vector<std::pair<ImageF*, Rect>>& buffers);
@@ -132,6 +180,12 @@ class RenderPipeline {
 
   // Called once frame dimensions and stages are known.
   virtual void Init() {}
+
+  bool collect_stats_ = false;
+  // Bytes of row data per pixel that each stage reads and writes.
+  std::vector<size_t> stage_bytes_per_pixel_;
+  // Per-thread counters of each stage.
+  std::vector<std::vector<StageStats>> thread_stats_;
 };
 
 }  // namespace jxl
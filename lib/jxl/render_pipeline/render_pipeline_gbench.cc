@@ -0,0 +1,121 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <stddef.h>
+
+#include <functional>
+#include <memory>
+#include <utility>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/random.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/common.h"
+#include "lib/jxl/dec_cache.h"
+#include "lib/jxl/epf.h"
+#include "lib/jxl/gbench_targets_testonly.h"
+#include "lib/jxl/image.h"
+#include "lib/jxl/image_metadata.h"
+#include "lib/jxl/image_ops.h"
+#include "lib/jxl/loop_filter.h"
+#include "lib/jxl/render_pipeline/render_pipeline.h"
+#include "lib/jxl/render_pipeline/stage_epf.h"
+#include "lib/jxl/render_pipeline/stage_upsampling.h"
+#include "lib/jxl/render_pipeline/stage_write.h"
+
+namespace jxl {
+namespace {
+
+constexpr size_t kImageSize = 1024;
+
+// Runs the stages added by `add_stages` on a three-channel VarDCT frame of
+// kImageSize x kImageSize pixels after upsampling, with noise as input, and
+// reports the output pixels per second. The pipeline is built outside of the
+// timing, its input buffers are filled inside.
+void RunStages(
+    benchmark::State& state, size_t upsampling,
+    const std::function<void(RenderPipeline::Builder*)>& add_stages) {
+  FrameDimensions frame_dim;
+  frame_dim.Set(kImageSize, kImageSize, /*group_size_shift=*/1,
+                /*max_hshift=*/0, /*max_vshift=*/0, /*modular_mode=*/false,
+                upsampling);
+  Image3F noise(frame_dim.group_dim, frame_dim.group_dim);
+  Rng rng(0);
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < noise.ysize(); ++y) {
+      float* JXL_RESTRICT row = noise.PlaneRow(c, y);
+      for (size_t x = 0; x < noise.xsize(); ++x) {
+        row[x] = rng.UniformF(0.0f, 1.0f);
+      }
+    }
+  }
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    RenderPipeline::Builder builder(/*num_c=*/3);
+    add_stages(&builder);
+    Image3F output;
+    builder.AddStage(GetWriteToImage3FStage(&output));
+    std::unique_ptr<RenderPipeline> pipeline =
+        std::move(builder).Finalize(frame_dim);
+    JXL_CHECK(pipeline->PrepareForThreads(1, /*use_group_ids=*/false));
+    state.ResumeTiming();
+
+    for (size_t group = 0; group < frame_dim.num_groups; ++group) {
+      RenderPipelineInput input = pipeline->GetInputBuffers(group, 0);
+      for (size_t c = 0; c < 3; ++c) {
+        const std::pair<ImageF*, Rect>& buffer = input.GetBuffer(c);
+        CopyImageTo(Rect(0, 0, buffer.second.xsize(), buffer.second.ysize()),
+                    noise.Plane(c), buffer.second, buffer.first);
+      }
+      input.Done();
+    }
+    JXL_CHECK(pipeline->PassesWithAllInput() == 1);
+  }
+  state.SetItemsProcessed(frame_dim.xsize_upsampled *
+                          frame_dim.ysize_upsampled * state.iterations());
+}
+
+// One of the three edge-preserving filter passes, given as argument.
+void BM_EPF(benchmark::State& state) {
+  const size_t epf_stage = state.range(0);
+  const LoopFilter lf;
+  FrameDimensions frame_dim;
+  frame_dim.Set(kImageSize, kImageSize, /*group_size_shift=*/1,
+                /*max_hshift=*/0, /*max_vshift=*/0, /*modular_mode=*/false,
+                /*upsampling=*/1);
+  ImageF sigma(frame_dim.xsize_blocks + 2 * kSigmaPadding,
+               frame_dim.ysize_blocks + 2 * kSigmaPadding);
+  FillImage(kInvSigmaNum / lf.epf_sigma_for_modular, &sigma);
+  RunStages(state, /*upsampling=*/1, [&](RenderPipeline::Builder* builder) {
+    builder->AddStage(GetEPFStage(lf, sigma, epf_stage));
+  });
+}
+
+// Upsampling of the three channels with the default weights. Argument: log2 of
+// the upsampling factor.
+void BM_Upsampling(benchmark::State& state) {
+  const size_t shift = state.range(0);
+  const CustomTransformData transform_data;
+  RunStages(state, size_t{1} << shift, [&](RenderPipeline::Builder* builder) {
+    for (size_t c = 0; c < 3; ++c) {
+      builder->AddStage(GetUpsamplingStage(transform_data, c, shift));
+    }
+  });
+}
+
+JXL_MAYBE_UNUSED const bool kRegistered = [] {
+  for (auto* bench : RegisterForEachTarget("BM_EPF", &BM_EPF)) {
+    bench->ArgName("stage")->DenseRange(0, 2)->Unit(benchmark::kMillisecond);
+  }
+  for (auto* bench : RegisterForEachTarget("BM_Upsampling", &BM_Upsampling)) {
+    bench->ArgName("shift")->DenseRange(1, 3)->Unit(benchmark::kMillisecond);
+  }
+  return true;
+}();
+
+}  // namespace
+}  // namespace jxl
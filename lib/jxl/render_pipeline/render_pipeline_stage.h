@@ -107,6 +107,9 @@ class RenderPipelineStage {
   // color channels (always 3) and followed by all other channels.
   virtual RenderPipelineChannelMode GetChannelMode(size_t c) const = 0;
 
+  // Identifies the stage, for example for RenderPipelineStageHook.
+  virtual const char* GetName() const = 0;
+
  protected:
   explicit RenderPipelineStage(Settings settings) : settings_(settings) {}
 
@@ -158,7 +161,9 @@ class RenderPipelineStage {
   virtual void ProcessPaddingRow(const RowInfo& output_rows, size_t xsize,
                                  size_t xpos, size_t ypos) const {}
 
-  virtual const char* GetName() const = 0;
+  // Called after the rows that `thread_id` rendered for one group were
+  // processed, for stages that collect the rows of several ProcessRow calls.
+  virtual void FlushRows(size_t thread_id) const {}
 
   Settings settings_;
   friend class RenderPipeline;
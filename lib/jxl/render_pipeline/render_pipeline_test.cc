@@ -9,6 +9,7 @@
 #include <stdio.h>
 
 #include <algorithm>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -117,6 +118,42 @@ TEST(RenderPipelineTest, CallAllGroups) {
   EXPECT_EQ(pipeline->PassesWithAllInput(), 1);
 }
 
+TEST(RenderPipelineTest, StageHook) {
+  RenderPipeline::Builder builder(/*num_c=*/1);
+  std::vector<std::string> names;
+  size_t num_replaced = 0;
+  builder.SetStageHook([&](std::unique_ptr<RenderPipelineStage> stage)
+                           -> std::unique_ptr<RenderPipelineStage> {
+    names.emplace_back(stage->GetName());
+    if (names.back() == "TEST::Check0FinalStage") {
+      ++num_replaced;
+      return jxl::make_unique<Check0FinalStage>();
+    }
+    return stage;
+  });
+  builder.AddStage(jxl::make_unique<UpsampleXSlowStage>());
+  builder.AddStage(jxl::make_unique<UpsampleYSlowStage>());
+  builder.AddStage(jxl::make_unique<Check0FinalStage>());
+  FrameDimensions frame_dimensions;
+  frame_dimensions.Set(/*xsize=*/1024, /*ysize=*/1024, /*group_size_shift=*/0,
+                       /*max_hshift=*/0, /*max_vshift=*/0,
+                       /*modular_mode=*/false, /*upsampling=*/1);
+  auto pipeline = std::move(builder).Finalize(frame_dimensions);
+  ASSERT_EQ(3u, names.size());
+  EXPECT_EQ("TEST::UpsampleXSlowStage", names[0]);
+  EXPECT_EQ(1u, num_replaced);
+  ASSERT_TRUE(pipeline->PrepareForThreads(1, /*use_group_ids=*/false));
+
+  for (size_t i = 0; i < frame_dimensions.num_groups; i++) {
+    auto input_buffers = pipeline->GetInputBuffers(i, 0);
+    FillPlane(0.0f, input_buffers.GetBuffer(0).first,
+              input_buffers.GetBuffer(0).second);
+    input_buffers.Done();
+  }
+
+  EXPECT_EQ(pipeline->PassesWithAllInput(), 1);
+}
+
 TEST(RenderPipelineTest, BuildFast) {
   RenderPipeline::Builder builder(/*num_c=*/1);
   builder.AddStage(jxl::make_unique<UpsampleXSlowStage>());
@@ -183,8 +183,8 @@ void SimpleRenderPipeline::ProcessBuffers(size_t group_id, size_t thread_id) {
                 (y << stage->settings_.shift_y) + iy + kRenderPipelineXOffset);
           }
         }
-        stage->ProcessRow(input_rows, output_rows, /*xextra=*/0, xsize,
-                          /*xpos=*/0, y, thread_id);
+        ProcessStageRow(stage_id, input_rows, output_rows, /*xextra=*/0,
+                        xsize, /*xpos=*/0, y, thread_id);
       }
     }
 
@@ -110,6 +110,27 @@ class BlendingStage : public RenderPipelineStage {
     for (size_t i = 0; i < ec_info.size(); i++) {
       make_blending(ec_info[i], &blending_info_[1 + i]);
     }
+
+    // Rows in which every channel is replaced are left as they are, and so
+    // are rows in which the foreground is opaque if every channel is either
+    // replaced or alpha blended with the same alpha channel.
+    replace_all_ = std::all_of(
+        blending_info_.begin(), blending_info_.end(),
+        [](const PatchBlending& pb) {
+          return pb.mode == PatchBlendMode::kReplace;
+        });
+    const size_t alpha = blending_info_[0].alpha_channel;
+    if (blending_info_[0].mode == PatchBlendMode::kBlendAbove &&
+        alpha < extra_channel_info_->size() &&
+        (*extra_channel_info_)[alpha].type == ExtraChannel::kAlpha &&
+        std::all_of(blending_info_.begin() + 1, blending_info_.end(),
+                    [alpha](const PatchBlending& pb) {
+                      return pb.mode == PatchBlendMode::kReplace ||
+                             (pb.mode == PatchBlendMode::kBlendAbove &&
+                              pb.alpha_channel == alpha);
+                    })) {
+      opaque_alpha_channel_ = 3 + alpha;
+    }
   }
 
   Status IsInitialized() const override { return initialized_; }
@@ -137,6 +158,17 @@ class BlendingStage : public RenderPipelineStage {
       xsize =
           std::max<ssize_t>(0, static_cast<ssize_t>(image_xsize_) - bg_xpos);
     }
+    if (replace_all_) return;
+    if (opaque_alpha_channel_ < input_rows.size()) {
+      const float* JXL_RESTRICT row_alpha =
+          GetInputRow(input_rows, opaque_alpha_channel_, 0) + offset;
+      bool opaque = true;
+      for (size_t x = 0; x < xsize; x++) {
+        opaque &= row_alpha[x] == 1.0f;
+      }
+      // Blending an opaque foreground yields the foreground.
+      if (opaque) return;
+    }
     std::vector<const float*> bg_row_ptrs_(input_rows.size());
     std::vector<float*> fg_row_ptrs_(input_rows.size());
     size_t num_c = std::min(input_rows.size(), extra_channel_info_->size() + 3);
@@ -218,6 +250,11 @@ class BlendingStage : public RenderPipelineStage {
   std::vector<PatchBlending> blending_info_;
   const std::vector<ExtraChannelInfo>* extra_channel_info_;
   std::vector<float> zeroes_;
+  // Whether the foreground replaces every channel.
+  bool replace_all_ = false;
+  // Channel whose value 1 in a whole row means that blending the row leaves
+  // the foreground unchanged, or SIZE_MAX.
+  size_t opaque_alpha_channel_ = SIZE_MAX;
 };
 
 std::unique_ptr<RenderPipelineStage> GetBlendingStage(
@@ -101,6 +101,66 @@ class VerticalChromaUpsamplingStage : public RenderPipelineStage {
   size_t c_;
 };
 
+// Upsamples both chroma channels of 4:2:0 frames in both directions, with the
+// same operations as the horizontal stage followed by the vertical one, but
+// without the buffers of the intermediate rows.
+class ChromaUpsampling420Stage : public RenderPipelineStage {
+ public:
+  ChromaUpsampling420Stage()
+      : RenderPipelineStage(RenderPipelineStage::Settings::Symmetric(
+            /*shift=*/1, /*border=*/1)) {}
+
+  void ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                  size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                  size_t thread_id) const final {
+    PROFILER_ZONE("ChromaUpsampling420");
+    HWY_FULL(float) df;
+    xextra = RoundUpTo(xextra, Lanes(df));
+    auto threefour = Set(df, 0.75f);
+    auto onefour = Set(df, 0.25f);
+    using V = decltype(onefour);
+    const auto horizontal = [&](const float* row, ssize_t x, V* left,
+                                V* right) {
+      auto current = Mul(LoadU(df, row + x), threefour);
+      *left = MulAdd(onefour, LoadU(df, row + x - 1), current);
+      *right = MulAdd(onefour, LoadU(df, row + x + 1), current);
+    };
+    for (size_t c = 0; c < 3; c += 2) {
+      const float* row_top = GetInputRow(input_rows, c, -1);
+      const float* row_mid = GetInputRow(input_rows, c, 0);
+      const float* row_bot = GetInputRow(input_rows, c, 1);
+      float* row_out0 = GetOutputRow(output_rows, c, 0);
+      float* row_out1 = GetOutputRow(output_rows, c, 1);
+      for (ssize_t x = -xextra; x < static_cast<ssize_t>(xsize + xextra);
+           x += Lanes(df)) {
+        V top_left, top_right, mid_left, mid_right, bot_left, bot_right;
+        horizontal(row_top, x, &top_left, &top_right);
+        horizontal(row_mid, x, &mid_left, &mid_right);
+        horizontal(row_bot, x, &bot_left, &bot_right);
+        auto mid_left_scaled = Mul(mid_left, threefour);
+        auto mid_right_scaled = Mul(mid_right, threefour);
+        StoreInterleaved(df, MulAdd(top_left, onefour, mid_left_scaled),
+                         MulAdd(top_right, onefour, mid_right_scaled),
+                         row_out0 + x * 2);
+        StoreInterleaved(df, MulAdd(bot_left, onefour, mid_left_scaled),
+                         MulAdd(bot_right, onefour, mid_right_scaled),
+                         row_out1 + x * 2);
+      }
+    }
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return c == 0 || c == 2 ? RenderPipelineChannelMode::kInOut
+                            : RenderPipelineChannelMode::kIgnored;
+  }
+
+  const char* GetName() const override { return "ChromaUps420"; }
+};
+
+std::unique_ptr<RenderPipelineStage> GetChromaUpsampling420Stage() {
+  return jxl::make_unique<ChromaUpsampling420Stage>();
+}
+
 std::unique_ptr<RenderPipelineStage> GetChromaUpsamplingStage(size_t channel,
                                                               bool horizontal) {
   if (horizontal) {
@@ -119,11 +179,16 @@ HWY_AFTER_NAMESPACE();
 namespace jxl {
 
 HWY_EXPORT(GetChromaUpsamplingStage);
+HWY_EXPORT(GetChromaUpsampling420Stage);
 
 std::unique_ptr<RenderPipelineStage> GetChromaUpsamplingStage(size_t channel,
                                                               bool horizontal) {
   return HWY_DYNAMIC_DISPATCH(GetChromaUpsamplingStage)(channel, horizontal);
 }
 
+std::unique_ptr<RenderPipelineStage> GetChromaUpsampling420Stage() {
+  return HWY_DYNAMIC_DISPATCH(GetChromaUpsampling420Stage)();
+}
+
 }  // namespace jxl
 #endif
@@ -22,6 +22,11 @@ namespace jxl {
 // channel.
 std::unique_ptr<RenderPipelineStage> GetChromaUpsamplingStage(size_t channel,
                                                               bool horizontal);
+
+// Applies the horizontal and the vertical upsampling to both chroma channels
+// of 4:2:0 frames at once, with the same results as the separate stages.
+std::unique_ptr<RenderPipelineStage> GetChromaUpsampling420Stage();
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_RENDER_PIPELINE_STAGE_CHROMA_UPSAMPLING_H_
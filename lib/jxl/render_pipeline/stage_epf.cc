@@ -5,7 +5,12 @@
 
 #include "lib/jxl/render_pipeline/stage_epf.h"
 
+#include <string.h>
+
+#include <vector>
+
 #include "lib/jxl/epf.h"
+#include "lib/jxl/image_ops.h"
 #include "lib/jxl/sanitizers.h"
 
 #undef HWY_TARGET_INCLUDE
@@ -13,6 +18,8 @@
 #include <hwy/foreach_target.h>
 #include <hwy/highway.h>
 
+#include "lib/jxl/dec_gaborish-inl.h"
+
 HWY_BEFORE_NAMESPACE();
 namespace jxl {
 namespace HWY_NAMESPACE {
@@ -35,6 +42,19 @@ JXL_INLINE Vec<DF> Weight(Vec<DF> sad, Vec<DF> inv_sigma, Vec<DF> thres) {
   return ZeroIfNegative(v);
 }
 
+// Returns true if none of the blocks of `row_sigma` that cover the pixels
+// [x0, x1) of the frame need filtering, i.e. the filter output of the whole
+// range equals its input.
+JXL_INLINE bool AllBlocksUnfiltered(const float* JXL_RESTRICT row_sigma,
+                                    ssize_t x0, ssize_t x1) {
+  size_t bx0 = (x0 + kSigmaPadding * kBlockDim) / kBlockDim;
+  size_t bx1 = (x1 - 1 + kSigmaPadding * kBlockDim) / kBlockDim;
+  for (size_t bx = bx0; bx <= bx1; bx++) {
+    if (row_sigma[bx] >= kMinSigma) return false;
+  }
+  return true;
+}
+
 // 5x5 plus-shaped kernel with 5 SADs per pixel (3x3 plus-shaped). So this makes
 // this filter a 7x7 filter.
 class EPF0Stage : public RenderPipelineStage {
@@ -77,6 +97,15 @@ class EPF0Stage : public RenderPipelineStage {
     xextra = RoundUpTo(xextra, Lanes(df));
     const float* JXL_RESTRICT row_sigma =
         sigma_->Row(ypos / kBlockDim + kSigmaPadding);
+    // Rows only made of blocks with too small a sigma pass through unchanged.
+    if (AllBlocksUnfiltered(row_sigma, xpos - xextra, xpos + xsize + xextra)) {
+      const size_t len = RoundUpTo(xsize + 2 * xextra, Lanes(df));
+      for (size_t c = 0; c < 3; c++) {
+        memcpy(GetOutputRow(output_rows, c, 0) - xextra,
+               GetInputRow(input_rows, c, 0) - xextra, len * sizeof(float));
+      }
+      return;
+    }
 
     float sm = lf_.epf_pass0_sigma_scale * 1.65;
     float bsm = sm * lf_.epf_border_sad_mul;
@@ -208,10 +237,34 @@ class EPF1Stage : public RenderPipelineStage {
   void ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
                   size_t xextra, size_t xsize, size_t xpos, size_t ypos,
                   size_t thread_id) const final {
+    float* JXL_RESTRICT rows[3][5];
+    float* JXL_RESTRICT rows_out[3];
+    for (size_t c = 0; c < 3; c++) {
+      for (int i = 0; i < 5; i++) {
+        rows[c][i] = GetInputRow(input_rows, c, i - 2);
+      }
+      rows_out[c] = GetOutputRow(output_rows, c, 0);
+    }
+    FilterRow(rows, rows_out, xextra, xsize, xpos, ypos);
+  }
+
+  // Filters the row of each channel at the center of `rows`, which holds the
+  // rows from 2 above to 2 below it, into `rows_out`.
+  void FilterRow(float* JXL_RESTRICT rows[3][5],
+                 float* JXL_RESTRICT rows_out[3], size_t xextra, size_t xsize,
+                 size_t xpos, size_t ypos) const {
     DF df;
     xextra = RoundUpTo(xextra, Lanes(df));
     const float* JXL_RESTRICT row_sigma =
         sigma_->Row(ypos / kBlockDim + kSigmaPadding);
+    // Rows only made of blocks with too small a sigma pass through unchanged.
+    if (AllBlocksUnfiltered(row_sigma, xpos - xextra, xpos + xsize + xextra)) {
+      const size_t len = RoundUpTo(xsize + 2 * xextra, Lanes(df));
+      for (size_t c = 0; c < 3; c++) {
+        memcpy(rows_out[c] - xextra, rows[c][2] - xextra, len * sizeof(float));
+      }
+      return;
+    }
 
     float sm = 1.65f;
     float bsm = sm * lf_.epf_border_sad_mul;
@@ -221,13 +274,6 @@ class EPF1Stage : public RenderPipelineStage {
     HWY_ALIGN float sad_mul_border[kBlockDim] = {bsm, bsm, bsm, bsm,
                                                  bsm, bsm, bsm, bsm};
 
-    float* JXL_RESTRICT rows[3][5];
-    for (size_t c = 0; c < 3; c++) {
-      for (int i = 0; i < 5; i++) {
-        rows[c][i] = GetInputRow(input_rows, c, i - 2);
-      }
-    }
-
     const float* sad_mul =
         (ypos % kBlockDim == 0 || ypos % kBlockDim == kBlockDim - 1)
             ? sad_mul_border
@@ -241,7 +287,7 @@ class EPF1Stage : public RenderPipelineStage {
       if (row_sigma[bx] < kMinSigma) {
         for (size_t c = 0; c < 3; c++) {
           auto px = Load(df, rows[c][2 + 0] + x);
-          Store(px, df, GetOutputRow(output_rows, c, 0) + x);
+          Store(px, df, rows_out[c] + x);
         }
         continue;
       }
@@ -337,9 +383,9 @@ class EPF1Stage : public RenderPipelineStage {
 #else
       auto inv_w = ApproximateReciprocal(w);
 #endif
-      Store(Mul(X, inv_w), df, GetOutputRow(output_rows, 0, 0) + x);
-      Store(Mul(Y, inv_w), df, GetOutputRow(output_rows, 1, 0) + x);
-      Store(Mul(B, inv_w), df, GetOutputRow(output_rows, 2, 0) + x);
+      Store(Mul(X, inv_w), df, rows_out[0] + x);
+      Store(Mul(Y, inv_w), df, rows_out[1] + x);
+      Store(Mul(B, inv_w), df, rows_out[2] + x);
     }
   }
 
@@ -355,6 +401,105 @@ class EPF1Stage : public RenderPipelineStage {
   const ImageF* sigma_;
 };
 
+// Gaborish followed by the EPF1 step, without a buffer between them. The
+// gaborish output of the 5 rows that EPF1 reads is kept in a window of rows
+// for each thread, so that each call for the next row of a group only smooths
+// one more row.
+class GaborishEPF1Stage : public RenderPipelineStage {
+ public:
+  GaborishEPF1Stage(const LoopFilter& lf, const ImageF& sigma)
+      : RenderPipelineStage(RenderPipelineStage::Settings::Symmetric(
+            /*shift=*/0, /*border=*/3)),
+        epf_(lf, sigma) {
+    GaborishWeights(lf, weights_);
+  }
+
+  Status PrepareForThreads(size_t num_threads) override {
+    windows_.resize(num_threads);
+    return true;
+  }
+
+  void ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                  size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                  size_t thread_id) const final {
+    PROFILER_ZONE("GaborishEPF1");
+    const HWY_FULL(float) d;
+    Window& window = windows_[thread_id];
+    const size_t width = xsize + 2 * (xextra + kRenderPipelineXOffset);
+    if (window.rows.xsize() < width) {
+      window.rows = ImageF(width, 3 * kWindowRows);
+      // The lanes past the smoothed pixels are loaded but not used.
+      ZeroFillImage(&window.rows);
+      window.valid = false;
+    }
+    const ssize_t y = ypos;
+    const bool next_row = window.valid && window.xpos == xpos &&
+                          window.xsize == xsize && window.xextra == xextra &&
+                          window.ypos + 1 == y;
+    // The same pixels as a gaborish stage before EPF1 would produce.
+    const ssize_t x0 = -RoundUpTo(xextra + 2, Lanes(d));
+    const ssize_t x1 = xsize + xextra + 2;
+    for (int offset = next_row ? 2 : -2; offset <= 2; offset++) {
+      for (size_t c = 0; c < 3; c++) {
+        GaborishRow(weights_ + 3 * c, GetInputRow(input_rows, c, offset - 1),
+                    GetInputRow(input_rows, c, offset),
+                    GetInputRow(input_rows, c, offset + 1), x0, x1,
+                    WindowRow(&window, c, y + offset));
+      }
+    }
+    window.valid = true;
+    window.xpos = xpos;
+    window.xsize = xsize;
+    window.xextra = xextra;
+    window.ypos = y;
+
+    float* JXL_RESTRICT rows[3][5];
+    float* JXL_RESTRICT rows_out[3];
+    for (size_t c = 0; c < 3; c++) {
+      for (int i = 0; i < 5; i++) {
+        rows[c][i] = WindowRow(&window, c, y + i - 2);
+      }
+      rows_out[c] = GetOutputRow(output_rows, c, 0);
+    }
+    epf_.FilterRow(rows, rows_out, xextra, xsize, xpos, ypos);
+  }
+
+  // The input may change before the next group is rendered by this thread.
+  void FlushRows(size_t thread_id) const override {
+    if (thread_id < windows_.size()) windows_[thread_id].valid = false;
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return c < 3 ? RenderPipelineChannelMode::kInOut
+                 : RenderPipelineChannelMode::kIgnored;
+  }
+
+  const char* GetName() const override { return "GabEPF1"; }
+
+ private:
+  static constexpr int kWindowRows = 5;
+
+  struct Window {
+    // kWindowRows rows of gaborish output for each channel, in which the row
+    // of image row y is at y modulo kWindowRows.
+    ImageF rows;
+    bool valid = false;
+    size_t xpos = 0;
+    size_t xsize = 0;
+    size_t xextra = 0;
+    ssize_t ypos = 0;
+  };
+
+  static float* WindowRow(Window* window, size_t c, ssize_t y) {
+    const ssize_t slot = (y % kWindowRows + kWindowRows) % kWindowRows;
+    return window->rows.Row(c * kWindowRows + slot) + kRenderPipelineXOffset;
+  }
+
+  float weights_[9];
+  EPF1Stage epf_;
+  mutable std::vector<Window> windows_;
+};
+
 // 3x3 plus-shaped kernel with 1 SAD per pixel. So this makes this filter a 3x3
 // filter.
 class EPF2Stage : public RenderPipelineStage {
@@ -397,6 +542,15 @@ class EPF2Stage : public RenderPipelineStage {
     xextra = RoundUpTo(xextra, Lanes(df));
     const float* JXL_RESTRICT row_sigma =
         sigma_->Row(ypos / kBlockDim + kSigmaPadding);
+    // Rows only made of blocks with too small a sigma pass through unchanged.
+    if (AllBlocksUnfiltered(row_sigma, xpos - xextra, xpos + xsize + xextra)) {
+      const size_t len = RoundUpTo(xsize + 2 * xextra, Lanes(df));
+      for (size_t c = 0; c < 3; c++) {
+        memcpy(GetOutputRow(output_rows, c, 0) - xextra,
+               GetInputRow(input_rows, c, 0) - xextra, len * sizeof(float));
+      }
+      return;
+    }
 
     float sm = lf_.epf_pass2_sigma_scale * 1.65;
     float bsm = sm * lf_.epf_border_sad_mul;
@@ -492,6 +646,11 @@ std::unique_ptr<RenderPipelineStage> GetEPFStage2(const LoopFilter& lf,
   return jxl::make_unique<EPF2Stage>(lf, sigma);
 }
 
+std::unique_ptr<RenderPipelineStage> GetGaborishEPF1Stage(const LoopFilter& lf,
+                                                          const ImageF& sigma) {
+  return jxl::make_unique<GaborishEPF1Stage>(lf, sigma);
+}
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jxl
@@ -503,6 +662,7 @@ namespace jxl {
 HWY_EXPORT(GetEPFStage0);
 HWY_EXPORT(GetEPFStage1);
 HWY_EXPORT(GetEPFStage2);
+HWY_EXPORT(GetGaborishEPF1Stage);
 
 std::unique_ptr<RenderPipelineStage> GetEPFStage(const LoopFilter& lf,
                                                  const ImageF& sigma,
@@ -520,5 +680,11 @@ std::unique_ptr<RenderPipelineStage> GetEPFStage(const LoopFilter& lf,
   }
 }
 
+std::unique_ptr<RenderPipelineStage> GetGaborishEPF1Stage(const LoopFilter& lf,
+                                                          const ImageF& sigma) {
+  JXL_ASSERT(lf.gab == 1 && lf.epf_iters != 0 && lf.epf_iters < 3);
+  return HWY_DYNAMIC_DISPATCH(GetGaborishEPF1Stage)(lf, sigma);
+}
+
 }  // namespace jxl
 #endif
@@ -26,6 +26,12 @@ namespace jxl {
 std::unique_ptr<RenderPipelineStage> GetEPFStage(const LoopFilter& lf,
                                                  const ImageF& sigma,
                                                  size_t epf_stage);
+
+// Applies gaborish and then the EPF step 1, with the same results as the
+// gaborish stage followed by GetEPFStage(lf, sigma, 1). Only for loop filters
+// with gaborish whose first EPF step is step 1, i.e. with 1 or 2 iterations.
+std::unique_ptr<RenderPipelineStage> GetGaborishEPF1Stage(const LoopFilter& lf,
+                                                          const ImageF& sigma);
 }  // namespace jxl
 
 #endif  // LIB_JXL_RENDER_PIPELINE_STAGE_EPF_H_
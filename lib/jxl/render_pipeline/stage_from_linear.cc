@@ -5,12 +5,15 @@
 
 #include "lib/jxl/render_pipeline/stage_from_linear.h"
 
+#include <cmath>
+
 #undef HWY_TARGET_INCLUDE
 #define HWY_TARGET_INCLUDE "lib/jxl/render_pipeline/stage_from_linear.cc"
 #include <hwy/foreach_target.h>
 #include <hwy/highway.h>
 
 #include "lib/jxl/dec_tone_mapping-inl.h"
+#include "lib/jxl/dec_xyb-inl.h"
 #include "lib/jxl/sanitizers.h"
 #include "lib/jxl/transfer_functions-inl.h"
 
@@ -20,7 +23,10 @@ namespace HWY_NAMESPACE {
 namespace {
 
 // These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::GatherIndex;
+using hwy::HWY_NAMESPACE::IfThenElseZero;
 using hwy::HWY_NAMESPACE::IfThenZeroElse;
+using hwy::HWY_NAMESPACE::Rebind;
 
 template <typename Op>
 struct PerChannelOp {
@@ -57,6 +63,61 @@ struct OpRgb {
   }
 };
 
+// Rounds to the nearest 8-bit sRGB level, divided by 255, for outputs with 8
+// bits per sample. Each of the kBuckets intervals of linear values contains at
+// most one of the values where the rounded level changes (the steepest slope
+// is 255 * 12.92 levels per unit), so the level is that of the start of the
+// interval, plus one if the value is past the next change. Values within float
+// rounding of a change may round either way.
+struct OpRgb8 {
+  static constexpr size_t kBuckets = 4096;
+  struct Table {
+    // Level at the start of each interval, and the linear value at which the
+    // next level starts.
+    float level[kBuckets + 1];
+    float next_change[kBuckets + 1];
+  };
+
+  static const Table* GetTable() {
+    static const Table* table = [] {
+      // Linear value from which the sRGB value rounds to `level`.
+      const auto change = [](size_t level) {
+        const double encoded = (level - 0.5) / 255;
+        return encoded <= 0.04045 ? encoded / 12.92
+                                  : std::pow((encoded + 0.055) / 1.055, 2.4);
+      };
+      Table* t = new Table;
+      size_t level = 0;
+      for (size_t i = 0; i <= kBuckets; ++i) {
+        const double start = static_cast<double>(i) / kBuckets;
+        while (level < 255 && change(level + 1) <= start) ++level;
+        t->level[i] = level;
+        t->next_change[i] =
+            level < 255 ? static_cast<float>(change(level + 1)) : 2.0f;
+      }
+      return t;
+    }();
+    return table;
+  }
+
+  OpRgb8() : table(GetTable()) {}
+
+  template <typename D, typename T>
+  T Transform(D d, const T& linear) const {
+    const Rebind<int32_t, D> di;
+    const auto clamped = Min(ZeroIfNegative(linear), Set(d, 1.0f));
+    const auto index =
+        ConvertTo(di, Mul(clamped, Set(d, static_cast<float>(kBuckets))));
+    const auto level = GatherIndex(d, table->level, index);
+    const auto next_change = GatherIndex(d, table->next_change, index);
+    const auto rounded = Add(
+        level, IfThenElseZero(Ge(clamped, next_change), Set(d, 1.0f)));
+    return Mul(rounded, Set(d, 1.0f / 255));
+  }
+
+  const Table* table;
+};
+
 struct OpPq {
   template <typename D, typename T>
   T Transform(D d, const T& linear) const {
@@ -142,35 +203,109 @@ class FromLinearStage : public RenderPipelineStage {
   Op op_;
 };
 
+// Same as XYBStage followed by FromLinearStage<Op>, but without storing the
+// linear values to the rows in between.
 template <typename Op>
-std::unique_ptr<FromLinearStage<Op>> MakeFromLinearStage(Op&& op) {
-  return jxl::make_unique<FromLinearStage<Op>>(std::forward<Op>(op));
-}
+class XYBToOutputStage : public RenderPipelineStage {
+ public:
+  XYBToOutputStage(Op op, const OpsinParams& opsin_params)
+      : RenderPipelineStage(RenderPipelineStage::Settings()),
+        op_(std::move(op)),
+        opsin_params_(opsin_params) {}
 
-std::unique_ptr<RenderPipelineStage> GetFromLinearStage(
-    const OutputEncodingInfo& output_encoding_info) {
+  void ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                  size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                  size_t thread_id) const final {
+    PROFILER_ZONE("XYBToOutput");
+    const HWY_FULL(float) d;
+    const size_t xsize_v = RoundUpTo(xsize, Lanes(d));
+    float* JXL_RESTRICT row0 = GetInputRow(input_rows, 0, 0);
+    float* JXL_RESTRICT row1 = GetInputRow(input_rows, 1, 0);
+    float* JXL_RESTRICT row2 = GetInputRow(input_rows, 2, 0);
+    msan::UnpoisonMemory(row0 + xsize, sizeof(float) * (xsize_v - xsize));
+    msan::UnpoisonMemory(row1 + xsize, sizeof(float) * (xsize_v - xsize));
+    msan::UnpoisonMemory(row2 + xsize, sizeof(float) * (xsize_v - xsize));
+    for (ssize_t x = -xextra; x < (ssize_t)(xsize + xextra); x += Lanes(d)) {
+      const auto in_opsin_x = LoadU(d, row0 + x);
+      const auto in_opsin_y = LoadU(d, row1 + x);
+      const auto in_opsin_b = LoadU(d, row2 + x);
+      auto r = Undefined(d);
+      auto g = Undefined(d);
+      auto b = Undefined(d);
+      XybToRgb(d, in_opsin_x, in_opsin_y, in_opsin_b, opsin_params_, &r, &g,
+               &b);
+      op_.Transform(d, &r, &g, &b);
+      StoreU(r, d, row0 + x);
+      StoreU(g, d, row1 + x);
+      StoreU(b, d, row2 + x);
+    }
+    msan::PoisonMemory(row0 + xsize, sizeof(float) * (xsize_v - xsize));
+    msan::PoisonMemory(row1 + xsize, sizeof(float) * (xsize_v - xsize));
+    msan::PoisonMemory(row2 + xsize, sizeof(float) * (xsize_v - xsize));
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return c < 3 ? RenderPipelineChannelMode::kInPlace
+                 : RenderPipelineChannelMode::kIgnored;
+  }
+
+  const char* GetName() const override { return "XYBToOutput"; }
+
+ private:
+  Op op_;
+  const OpsinParams opsin_params_;
+};
+
+// Creates a FromLinearStage, or a XYBToOutputStage if `opsin_params` is not
+// null, for each supported transfer function.
+struct StageFactory {
+  const OpsinParams* opsin_params;
+
+  template <typename Op>
+  std::unique_ptr<RenderPipelineStage> operator()(Op&& op) const {
+    if (opsin_params) {
+      return jxl::make_unique<XYBToOutputStage<Op>>(std::forward<Op>(op),
+                                                    *opsin_params);
+    }
+    return jxl::make_unique<FromLinearStage<Op>>(std::forward<Op>(op));
+  }
+};
+
+std::unique_ptr<RenderPipelineStage> MakeStage(
+    const StageFactory& make, const OutputEncodingInfo& output_encoding_info,
+    bool round_to_8bit) {
   if (output_encoding_info.color_encoding.tf.IsLinear()) {
-    return MakeFromLinearStage(MakePerChannelOp(OpLinear()));
+    return make(MakePerChannelOp(OpLinear()));
   } else if (output_encoding_info.color_encoding.tf.IsSRGB()) {
-    return MakeFromLinearStage(MakePerChannelOp(OpRgb()));
+    if (round_to_8bit) return make(MakePerChannelOp(OpRgb8()));
+    return make(MakePerChannelOp(OpRgb()));
   } else if (output_encoding_info.color_encoding.tf.IsPQ()) {
-    return MakeFromLinearStage(MakePerChannelOp(OpPq()));
+    return make(MakePerChannelOp(OpPq()));
   } else if (output_encoding_info.color_encoding.tf.IsHLG()) {
-    return MakeFromLinearStage(
-        OpHlg(output_encoding_info.luminances,
-              output_encoding_info.desired_intensity_target));
+    return make(OpHlg(output_encoding_info.luminances,
+                      output_encoding_info.desired_intensity_target));
   } else if (output_encoding_info.color_encoding.tf.Is709()) {
-    return MakeFromLinearStage(MakePerChannelOp(Op709()));
+    return make(MakePerChannelOp(Op709()));
   } else if (output_encoding_info.color_encoding.tf.IsGamma() ||
              output_encoding_info.color_encoding.tf.IsDCI()) {
-    return MakeFromLinearStage(
-        MakePerChannelOp(OpGamma{output_encoding_info.inverse_gamma}));
+    return make(MakePerChannelOp(OpGamma{output_encoding_info.inverse_gamma}));
   } else {
     // This is a programming error.
     JXL_ABORT("Invalid target encoding");
   }
 }
 
+std::unique_ptr<RenderPipelineStage> GetFromLinearStage(
+    const OutputEncodingInfo& output_encoding_info, bool round_to_8bit) {
+  return MakeStage(StageFactory{nullptr}, output_encoding_info, round_to_8bit);
+}
+
+std::unique_ptr<RenderPipelineStage> GetXYBToOutputStage(
+    const OutputEncodingInfo& output_encoding_info, bool round_to_8bit) {
+  return MakeStage(StageFactory{&output_encoding_info.opsin_params},
+                   output_encoding_info, round_to_8bit);
+}
+
 }  // namespace
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
@@ -183,8 +318,17 @@ namespace jxl {
 HWY_EXPORT(GetFromLinearStage);
 
 std::unique_ptr<RenderPipelineStage> GetFromLinearStage(
-    const OutputEncodingInfo& output_encoding_info) {
-  return HWY_DYNAMIC_DISPATCH(GetFromLinearStage)(output_encoding_info);
+    const OutputEncodingInfo& output_encoding_info, bool round_to_8bit) {
+  return HWY_DYNAMIC_DISPATCH(GetFromLinearStage)(output_encoding_info,
+                                                  round_to_8bit);
+}
+
+HWY_EXPORT(GetXYBToOutputStage);
+
+std::unique_ptr<RenderPipelineStage> GetXYBToOutputStage(
+    const OutputEncodingInfo& output_encoding_info, bool round_to_8bit) {
+  return HWY_DYNAMIC_DISPATCH(GetXYBToOutputStage)(output_encoding_info,
+                                                   round_to_8bit);
 }
 
 }  // namespace jxl
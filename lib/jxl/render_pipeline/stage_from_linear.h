@@ -12,8 +12,17 @@
 namespace jxl {
 
 // Converts the color channels from linear to the specified output encoding.
+// If `round_to_8bit`, the values are only written to an output with 8 bits per
+// sample, and sRGB values are rounded to the 8-bit levels with a table instead
+// of being computed.
 std::unique_ptr<RenderPipelineStage> GetFromLinearStage(
-    const OutputEncodingInfo& output_encoding_info);
+    const OutputEncodingInfo& output_encoding_info, bool round_to_8bit = false);
+
+// Converts the color channels from XYB to the specified output encoding, in a
+// single pass. Equivalent to GetXYBStage followed by GetFromLinearStage, for
+// output encodings other than XYB.
+std::unique_ptr<RenderPipelineStage> GetXYBToOutputStage(
+    const OutputEncodingInfo& output_encoding_info, bool round_to_8bit = false);
 
 }  // namespace jxl
 
@@ -41,17 +41,16 @@ typename StrengthEval::V NoiseStrength(const StrengthEval& eval,
   return Clamp0ToMax(D(), eval(x), Set(D(), 1.0f));
 }
 
-// TODO(veluca): SIMD-fy.
+// Interpolates the lut of the noise parameters, which is turned into byte
+// tables once per frame so that the SIMD targets look it up with shuffles.
 class StrengthEvalLut {
  public:
   using V = Vec<D>;
 
-  explicit StrengthEvalLut(const NoiseParams& noise_params)
+  void Init(const NoiseParams& noise_params) {
 #if HWY_TARGET == HWY_SCALAR
-      : noise_params_(noise_params)
-#endif
-  {
-#if HWY_TARGET != HWY_SCALAR
+    noise_params_ = &noise_params;
+#else
     uint32_t lut[8];
     memcpy(lut, noise_params.lut, sizeof(lut));
     for (size_t i = 0; i < 8; i++) {
@@ -74,8 +73,8 @@ class StrengthEvalLut {
         IfThenElse(Ge(scaled_vx, Set(D(), kScale + 1)), Set(D(), 1), frac_x);
     auto floor_x_int = ConvertTo(DI(), floor_x);
 #if HWY_TARGET == HWY_SCALAR
-    auto low = Set(D(), noise_params_.lut[floor_x_int.raw]);
-    auto hi = Set(D(), noise_params_.lut[floor_x_int.raw + 1]);
+    auto low = Set(D(), noise_params_->lut[floor_x_int.raw]);
+    auto hi = Set(D(), noise_params_->lut[floor_x_int.raw + 1]);
 #else
     // Set each lane's bytes to {0, 0, 2x+1, 2x}.
     auto floorx_indices_low =
@@ -108,7 +107,7 @@ class StrengthEvalLut {
   HWY_ALIGN uint8_t high16_lut[16];
   HWY_ALIGN uint8_t low16_lut[16];
 #else
-  const NoiseParams& noise_params_;
+  const NoiseParams* noise_params_ = nullptr;
 #endif
 };
 
@@ -152,13 +151,19 @@ class AddNoiseStage : public RenderPipelineStage {
         cmap_(cmap),
         first_c_(first_c) {}
 
+  Status PrepareForThreads(size_t num_threads) override {
+    // The noise parameters are only known once the frame is being decoded.
+    noise_model_.Init(noise_params_);
+    return true;
+  }
+
   void ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
                   size_t xextra, size_t xsize, size_t xpos, size_t ypos,
                   size_t thread_id) const final {
     PROFILER_ZONE("Noise apply");
 
     if (!noise_params_.HasAny()) return;
-    const StrengthEvalLut noise_model(noise_params_);
+    const StrengthEvalLut& noise_model = noise_model_;
     D d;
     const auto half = Set(d, 0.5f);
 
@@ -219,6 +224,7 @@ class AddNoiseStage : public RenderPipelineStage {
   const NoiseParams& noise_params_;
   const ColorCorrelationMap& cmap_;
   size_t first_c_;
+  StrengthEvalLut noise_model_;
 };
 
 std::unique_ptr<RenderPipelineStage> GetAddNoiseStage(
@@ -20,11 +20,13 @@ class PatchDictionaryStage : public RenderPipelineStage {
     PROFILER_ZONE("RenderPatches");
     JXL_ASSERT(xpos == 0 || xpos >= xextra);
     size_t x0 = xpos ? xpos - xextra : 0;
+    size_t len = xsize + xextra + xpos - x0;
+    if (!patches_.HasPatchesInRow(ypos, x0, len)) return;
     std::vector<float*> row_ptrs(num_channels_);
     for (size_t i = 0; i < num_channels_; i++) {
       row_ptrs[i] = GetInputRow(input_rows, i, 0) + x0 - xpos;
     }
-    patches_.AddOneRow(row_ptrs.data(), ypos, x0, xsize + xextra + xpos - x0);
+    patches_.AddOneRow(row_ptrs.data(), ypos, x0, len);
   }
 
   RenderPipelineChannelMode GetChannelMode(size_t c) const final {
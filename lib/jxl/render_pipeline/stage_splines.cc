@@ -24,6 +24,7 @@ class SplineStage : public RenderPipelineStage {
                   size_t xextra, size_t xsize, size_t xpos, size_t ypos,
                   size_t thread_id) const final {
     PROFILER_ZONE("RenderSplines");
+    if (!splines_.HasSegmentsInRow(ypos)) return;
     float* row_x = GetInputRow(input_rows, 0, 0);
     float* row_y = GetInputRow(input_rows, 1, 0);
     float* row_b = GetInputRow(input_rows, 2, 0);
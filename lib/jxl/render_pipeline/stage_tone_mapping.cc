@@ -5,6 +5,8 @@
 
 #include "lib/jxl/render_pipeline/stage_tone_mapping.h"
 
+#include <hwy/aligned_allocator.h>
+
 #undef HWY_TARGET_INCLUDE
 #define HWY_TARGET_INCLUDE "lib/jxl/render_pipeline/stage_tone_mapping.cc"
 #include <hwy/foreach_target.h>
@@ -19,6 +21,14 @@ HWY_BEFORE_NAMESPACE();
 namespace jxl {
 namespace HWY_NAMESPACE {
 
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::AllTrue;
+using hwy::HWY_NAMESPACE::ConvertTo;
+using hwy::HWY_NAMESPACE::GatherIndex;
+using hwy::HWY_NAMESPACE::Le;
+using hwy::HWY_NAMESPACE::Rebind;
+using hwy::HWY_NAMESPACE::Sqrt;
+
 class ToneMappingStage : public RenderPipelineStage {
  public:
   explicit ToneMappingStage(OutputEncodingInfo output_encoding_info)
@@ -39,6 +49,7 @@ class ToneMappingStage : public RenderPipelineStage {
           std::pair<float, float>(
               0, output_encoding_info_.desired_intensity_target),
           output_encoding_info_.luminances);
+      InitToneMapLUT();
     } else if (output_encoding_info_.orig_color_encoding.tf.IsHLG() &&
                !output_encoding_info_.color_encoding.tf.IsHLG()) {
       hlg_ootf_ = jxl::make_unique<HlgOOTF>(
@@ -58,6 +69,71 @@ class ToneMappingStage : public RenderPipelineStage {
 
   bool IsNeeded() const { return tone_mapper_ || hlg_ootf_; }
 
+  // The Rec. 2408 tone curve scales all channels of a pixel by a factor that
+  // only depends on its luminance. The factor is tabulated once against the
+  // square root of the luminance, which samples the dark end more densely,
+  // and looked up with linear interpolation instead of evaluating the PQ
+  // transfer functions per pixel.
+  void InitToneMapLUT() {
+    const HWY_FULL(float) d;
+    const float* lum = output_encoding_info_.luminances;
+    const float inv_lum_sum = 1.0f / (lum[0] + lum[1] + lum[2]);
+    // Limit of the factor for luminances too small for the tone curve to
+    // change them.
+    const float normalizer = output_encoding_info_.orig_intensity_target /
+                             output_encoding_info_.desired_intensity_target;
+    // ToneMap outputs gray up to an absolute luminance of 1e-6 nits.
+    tone_map_min_luminance_ =
+        1e-6f / output_encoding_info_.orig_intensity_target;
+    // The lookup of the last entry reads one entry past it.
+    tone_map_lut_.resize(RoundUpTo(kToneMapLUTSize + 2, Lanes(d)));
+    for (size_t i = 0; i < tone_map_lut_.size(); i += Lanes(d)) {
+      const auto u = Mul(Iota(d, i), Set(d, 1.0f / kToneMapLUTSize));
+      const auto v = Mul(Mul(u, u), Set(d, inv_lum_sum));
+      auto r = v;
+      auto g = v;
+      auto b = v;
+      tone_mapper_->ToneMap(&r, &g, &b);
+      Store(Div(r, v), d, tone_map_lut_.data() + i);
+    }
+    for (size_t i = 0; i < tone_map_lut_.size(); i++) {
+      float u = static_cast<float>(i) / kToneMapLUTSize;
+      if (u * u <= tone_map_min_luminance_) {
+        tone_map_lut_[i] = normalizer;
+      }
+    }
+    tone_map_lut_normalizer_ = normalizer;
+  }
+
+  // Applies the tabulated tone curve to a vector of pixels. Returns false,
+  // leaving the pixels untouched, if some of them are brighter than the
+  // range of the table.
+  template <class V>
+  JXL_INLINE bool ToneMapWithLUT(V* r, V* g, V* b) const {
+    const HWY_FULL(float) d;
+    const Rebind<int32_t, HWY_FULL(float)> di;
+    const float* lum = output_encoding_info_.luminances;
+    const auto luminance =
+        MulAdd(Set(d, lum[0]), *r,
+               MulAdd(Set(d, lum[1]), *g, Mul(Set(d, lum[2]), *b)));
+    if (!AllTrue(d, Le(luminance, Set(d, 1.0f)))) return false;
+    const auto pos = Mul(Sqrt(ZeroIfNegative(luminance)),
+                         Set(d, static_cast<float>(kToneMapLUTSize)));
+    const auto idx = ConvertTo(di, pos);
+    const auto frac = Sub(pos, ConvertTo(d, idx));
+    const auto lo = GatherIndex(d, tone_map_lut_.data(), idx);
+    const auto hi = GatherIndex(d, tone_map_lut_.data() + 1, idx);
+    const auto multiplier = MulAdd(Sub(hi, lo), frac, lo);
+    // Pixels too dark for the tone curve become gray, as in ToneMap.
+    const auto is_dark = Le(luminance, Set(d, tone_map_min_luminance_));
+    const auto gray =
+        Mul(ZeroIfNegative(luminance), Set(d, tone_map_lut_normalizer_));
+    for (V* const val : {r, g, b}) {
+      *val = IfThenElse(is_dark, gray, Mul(*val, multiplier));
+    }
+    return true;
+  }
+
   void ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
                   size_t xextra, size_t xsize, size_t xpos, size_t ypos,
                   size_t thread_id) const final {
@@ -85,7 +161,7 @@ class ToneMappingStage : public RenderPipelineStage {
         g = Mul(g, Set(d, to_intensity_target_));
         b = Mul(b, Set(d, to_intensity_target_));
         if (tone_mapper_) {
-          tone_mapper_->ToneMap(&r, &g, &b);
+          if (!ToneMapWithLUT(&r, &g, &b)) tone_mapper_->ToneMap(&r, &g, &b);
         } else {
           JXL_ASSERT(hlg_ootf_);
           hlg_ootf_->Apply(&r, &g, &b);
@@ -115,6 +191,8 @@ class ToneMappingStage : public RenderPipelineStage {
 
  private:
   using ToneMapper = Rec2408ToneMapper<HWY_FULL(float)>;
+  // Number of intervals of the tone map table.
+  static constexpr size_t kToneMapLUTSize = 4096;
   OutputEncodingInfo output_encoding_info_;
   std::unique_ptr<ToneMapper> tone_mapper_;
   std::unique_ptr<HlgOOTF> hlg_ootf_;
@@ -123,6 +201,11 @@ class ToneMappingStage : public RenderPipelineStage {
   // require it.
   float to_intensity_target_ = 1.f;
   float from_desired_intensity_target_ = 1.f;
+  // Tone map factor at sqrt(luminance) = i / kToneMapLUTSize.
+  std::vector<float, hwy::AlignedAllocator<float>> tone_map_lut_;
+  float tone_map_lut_normalizer_ = 1.f;
+  // Relative luminance up to which ToneMap outputs gray.
+  float tone_map_min_luminance_ = 0.f;
 };
 
 std::unique_ptr<RenderPipelineStage> GetToneMappingStage(
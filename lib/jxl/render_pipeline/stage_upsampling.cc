@@ -42,6 +42,9 @@ class UpsamplingStage : public RenderPipelineStage {
             weights[5 * N * y - y * (y - 1) / 2 + x - y];
       }
     }
+    if (shift == 1) InitWeights<2>();
+    if (shift == 2) InitWeights<4>();
+    if (shift == 3) InitWeights<8>();
   }
 
   void ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
@@ -83,6 +86,20 @@ class UpsamplingStage : public RenderPipelineStage {
   const char* GetName() const override { return "Upsample"; }
 
  private:
+  template <size_t N>
+  void InitWeights() {
+    for (size_t oy = 0; oy < N; oy++) {
+      for (size_t ox = 0; ox < N; ox++) {
+        for (ssize_t iy = -2; iy <= 2; iy++) {
+          for (ssize_t ix = -2; ix <= 2; ix++) {
+            weights_[oy][ox][(iy + 2) * 5 + ix + 2] =
+                Kernel<N>(ox, oy, ix, iy);
+          }
+        }
+      }
+    }
+  }
+
   template <size_t N>
   JXL_INLINE float Kernel(size_t x, size_t y, ssize_t ix, ssize_t iy) const {
     ix += 2;
@@ -125,24 +142,39 @@ class UpsamplingStage : public RenderPipelineStage {
       ups[6] = &ups6;
       ups[7] = &ups7;
     }
+    const float* JXL_RESTRICT rows_in[5];
+    for (ssize_t iy = -2; iy <= 2; iy++) {
+      rows_in[iy + 2] = GetInputRow(input_rows, c_, iy);
+    }
+    float* JXL_RESTRICT rows_out[N];
     for (size_t oy = 0; oy < N; oy++) {
-      float* dst_row = GetOutputRow(output_rows, c_, oy);
-      for (ssize_t x = x0; x < x1; x += Lanes(df)) {
+      rows_out[oy] = GetOutputRow(output_rows, c_, oy);
+    }
+    for (ssize_t x = x0; x < x1; x += Lanes(df)) {
+      // The 5x5 input neighbourhood and its range are shared by all the NxN
+      // output pixels, so load them once.
+      V in[25];
+      auto min = LoadU(df, rows_in[2] + x);
+      auto max = min;
+      for (size_t iy = 0; iy < 5; iy++) {
+        for (size_t ix = 0; ix < 5; ix++) {
+          auto v = LoadU(df, rows_in[iy] + x + ix - 2);
+          in[iy * 5 + ix] = v;
+          min = Min(v, min);
+          max = Max(v, max);
+        }
+      }
+      for (size_t oy = 0; oy < N; oy++) {
         for (size_t ox = 0; ox < N; ox++) {
+          const float* JXL_RESTRICT weights = weights_[oy][ox];
           auto result = Zero(df);
-          auto min = LoadU(df, GetInputRow(input_rows, c_, 0) + x);
-          auto max = min;
-          for (ssize_t iy = -2; iy <= 2; iy++) {
-            for (ssize_t ix = -2; ix <= 2; ix++) {
-              auto v = LoadU(df, GetInputRow(input_rows, c_, iy) + x + ix);
-              result = MulAdd(Set(df, Kernel<N>(ox, oy, ix, iy)), v, result);
-              min = Min(v, min);
-              max = Max(v, max);
-            }
+          for (size_t i = 0; i < 25; i++) {
+            result = MulAdd(Set(df, weights[i]), in[i], result);
           }
           // Avoid overshooting.
           *ups[ox] = Clamp(result, min, max);
         }
+        float* dst_row = rows_out[oy];
         if (N == 2) {
           StoreInterleaved(df, ups0, ups1, dst_row + x * N);
         }
@@ -159,6 +191,9 @@ class UpsamplingStage : public RenderPipelineStage {
 
   size_t c_;
   float kernel_[4][4][5][5];
+  // Kernel<N>(ox, oy, ix, iy) for every output position of the NxN output
+  // block, in row-major order of the 5x5 input neighbourhood.
+  float weights_[8][8][25];
 };
 
 std::unique_ptr<RenderPipelineStage> GetUpsamplingStage(
@@ -33,13 +33,17 @@ using hwy::HWY_NAMESPACE::ShiftRightSame;
 
 class WriteToOutputStage : public RenderPipelineStage {
  public:
-  WriteToOutputStage(const ImageOutput& main_output, size_t width,
-                     size_t height, bool has_alpha, bool unpremul_alpha,
-                     size_t alpha_c, Orientation undo_orientation,
-                     const std::vector<ImageOutput>& extra_output)
+  WriteToOutputStage(const ImageOutput& main_output, const Rect& output_rect,
+                     bool has_alpha, bool unpremul_alpha, size_t alpha_c,
+                     Orientation undo_orientation,
+                     const std::vector<ImageOutput>& extra_output,
+                     const std::vector<ImageOutput>& main_planes,
+                     bool chroma_420)
       : RenderPipelineStage(RenderPipelineStage::Settings()),
-        width_(width),
-        height_(height),
+        x0_(output_rect.x0()),
+        y0_(output_rect.y0()),
+        width_(output_rect.xsize()),
+        height_(output_rect.ysize()),
         main_(main_output),
         num_color_(main_.num_channels_ < 3 ? 1 : 3),
         want_alpha_(main_.num_channels_ == 2 || main_.num_channels_ == 4),
@@ -49,12 +53,16 @@ class WriteToOutputStage : public RenderPipelineStage {
         flip_x_(ShouldFlipX(undo_orientation)),
         flip_y_(ShouldFlipY(undo_orientation)),
         transpose_(ShouldTranspose(undo_orientation)),
+        chroma_420_(chroma_420),
         opaque_alpha_(kMaxPixelsPerCall, 1.0f) {
+    for (const ImageOutput& plane : main_planes) {
+      planes_.emplace_back(plane);
+    }
     for (size_t ec = 0; ec < extra_output.size(); ++ec) {
       if (extra_output[ec].callback.IsPresent() || extra_output[ec].buffer) {
         Output extra(extra_output[ec]);
         extra.channel_index_ = 3 + ec;
-        extra_channels_.push_back(extra);
+        extra_channels_.push_back(std::move(extra));
       }
     }
   }
@@ -79,16 +87,20 @@ class WriteToOutputStage : public RenderPipelineStage {
                   size_t xextra, size_t xsize, size_t xpos, size_t ypos,
                   size_t thread_id) const final {
     JXL_DASSERT(xextra == 0);
-    JXL_DASSERT(main_.run_opaque_ || main_.buffer_);
-    if (ypos >= height_) return;
-    if (xpos >= width_) return;
+    JXL_DASSERT(main_.run_opaque_ || main_.buffer_ || !planes_.empty());
+    if (ypos < y0_ || ypos >= y0_ + height_) return;
+    if (xpos + xsize <= x0_ || xpos >= x0_ + width_) return;
+    // Number of input pixels left of the output rect.
+    size_t skip = x0_ > xpos ? x0_ - xpos : 0;
+    xpos = xpos + skip - x0_;
+    ypos -= y0_;
     if (flip_y_) {
       ypos = height_ - 1u - ypos;
     }
-    size_t limit = std::min(xsize, width_ - xpos);
-    for (size_t x0 = 0; x0 < limit; x0 += kMaxPixelsPerCall) {
-      size_t xstart = xpos + x0;
-      size_t len = std::min<size_t>(kMaxPixelsPerCall, limit - x0);
+    size_t limit = std::min(xsize - skip, width_ - xpos);
+    for (size_t x0 = skip; x0 < skip + limit; x0 += kMaxPixelsPerCall) {
+      size_t xstart = xpos + x0 - skip;
+      size_t len = std::min<size_t>(kMaxPixelsPerCall, skip + limit - x0);
 
       const float* line_buffers[4];
       for (size_t c = 0; c < num_color_; c++) {
@@ -103,7 +115,17 @@ class WriteToOutputStage : public RenderPipelineStage {
       if (has_alpha_ && want_alpha_ && unpremul_alpha_) {
         UnpremulAlpha(thread_id, len, line_buffers);
       }
-      OutputBuffers(main_, thread_id, ypos, xstart, len, line_buffers);
+      if (planes_.empty()) {
+        OutputBuffers(main_, thread_id, ypos, xstart, len, line_buffers);
+      } else if (chroma_420_) {
+        OutputChroma420(thread_id, ypos, xstart, len, line_buffers);
+      } else {
+        for (size_t c = 0; c < planes_.size(); ++c) {
+          const float* plane_buffers[4] = {line_buffers[c]};
+          OutputBuffers(planes_[c], thread_id, ypos, xstart, len,
+                        plane_buffers);
+        }
+      }
       for (const auto& extra : extra_channels_) {
         line_buffers[0] = GetInputRow(input_rows, extra.channel_index_, 0) + x0;
         OutputBuffers(extra, thread_id, ypos, xstart, len, line_buffers);
@@ -123,9 +145,25 @@ class WriteToOutputStage : public RenderPipelineStage {
     return RenderPipelineChannelMode::kIgnored;
   }
 
+  void FlushRows(size_t thread_id) const final {
+    if (main_.pixel_callback_.run_rect) FlushRect(main_, thread_id);
+  }
+
   const char* GetName() const override { return "WritePixelCB"; }
 
  private:
+  // The rows converted by one thread that were not yet passed to the rect
+  // callback: `num_rows` rows of `len` pixels from `xstart`, from the
+  // consecutive positions `first_ypos` to `last_ypos`.
+  struct RectRows {
+    CacheAlignedUniquePtr pixels;
+    size_t xstart = 0;
+    size_t len = 0;
+    size_t first_ypos = 0;
+    size_t last_ypos = 0;
+    size_t num_rows = 0;
+  };
+
   struct Output {
     Output(const ImageOutput& image_out)
         : pixel_callback_(image_out.callback),
@@ -137,8 +175,24 @@ class WriteToOutputStage : public RenderPipelineStage {
           data_type_(image_out.format.data_type),
           bits_per_sample_(image_out.bits_per_sample) {}
 
+    size_t PixelSize() const {
+      const size_t bytes_per_sample = data_type_ == JXL_TYPE_UINT8   ? 1
+                                      : data_type_ == JXL_TYPE_FLOAT ? 4
+                                                                     : 2;
+      return num_channels_ * bytes_per_sample;
+    }
+
     Status PrepareForThreads(size_t num_threads) {
-      if (pixel_callback_.IsPresent()) {
+      if (pixel_callback_.run_rect) {
+        const size_t num_pixels = kMaxPixelsPerCall * pixel_callback_.max_rows;
+        run_opaque_ = pixel_callback_.Init(num_threads, num_pixels);
+        JXL_RETURN_IF_ERROR(run_opaque_ != nullptr);
+        rect_rows_.resize(num_threads);
+        for (RectRows& rows : rect_rows_) {
+          rows.pixels = AllocateArray(num_pixels * PixelSize());
+          rows.num_rows = 0;
+        }
+      } else if (pixel_callback_.IsPresent()) {
         run_opaque_ =
             pixel_callback_.Init(num_threads, /*num_pixels=*/kMaxPixelsPerCall);
         JXL_RETURN_IF_ERROR(run_opaque_ != nullptr);
@@ -158,10 +212,23 @@ class WriteToOutputStage : public RenderPipelineStage {
     JxlDataType data_type_;
     size_t bits_per_sample_;
     size_t channel_index_;  // used for extra_channels
+    // Per thread, only with a rect callback.
+    mutable std::vector<RectRows> rect_rows_;
   };
 
   Status PrepareForThreads(size_t num_threads) override {
-    JXL_RETURN_IF_ERROR(main_.PrepareForThreads(num_threads));
+    if (planes_.empty()) {
+      JXL_RETURN_IF_ERROR(main_.PrepareForThreads(num_threads));
+    }
+    for (auto& plane : planes_) {
+      JXL_RETURN_IF_ERROR(plane.PrepareForThreads(num_threads));
+    }
+    if (chroma_420_) {
+      temp_chroma_.resize(num_threads * 2);
+      for (CacheAlignedUniquePtr& temp : temp_chroma_) {
+        temp = AllocateArray(sizeof(float) * kMaxPixelsPerCall);
+      }
+    }
     for (auto& extra : extra_channels_) {
       JXL_RETURN_IF_ERROR(extra.PrepareForThreads(num_threads));
     }
@@ -197,70 +264,159 @@ class WriteToOutputStage : public RenderPipelineStage {
             undo_orientation == Orientation::kAntiTranspose);
   }
 
+  // Reads the color rows from the input and writes the unpremultiplied values
+  // to the temporary rows in the same pass; the alpha row is only read. The
+  // rows are padded so that the last vector may read past `len`.
   void UnpremulAlpha(size_t thread_id, size_t len,
                      const float** line_buffers) const {
     const HWY_FULL(float) d;
     auto one = Set(d, 1.0f);
     float* temp_in[4];
-    for (size_t c = 0; c < main_.num_channels_; ++c) {
+    for (size_t c = 0; c < num_color_; ++c) {
       size_t tix = thread_id * main_.num_channels_ + c;
       temp_in[c] = reinterpret_cast<float*>(temp_in_[tix].get());
-      memcpy(temp_in[c], line_buffers[c], sizeof(float) * len);
     }
+    const float* JXL_RESTRICT alpha_row = line_buffers[num_color_];
     auto small_alpha = Set(d, kSmallAlpha);
     for (size_t ix = 0; ix < len; ix += Lanes(d)) {
-      auto alpha = LoadU(d, temp_in[num_color_] + ix);
+      auto alpha = LoadU(d, alpha_row + ix);
       auto mul = Div(one, Max(small_alpha, alpha));
       for (size_t c = 0; c < num_color_; ++c) {
-        auto val = LoadU(d, temp_in[c] + ix);
+        auto val = LoadU(d, line_buffers[c] + ix);
         StoreU(Mul(val, mul), d, temp_in[c] + ix);
       }
     }
-    for (size_t c = 0; c < main_.num_channels_; ++c) {
+    for (size_t c = 0; c < num_color_; ++c) {
       line_buffers[c] = temp_in[c];
     }
   }
 
+  // Writes the Y row, and on the even rows of the output also the chroma
+  // samples of the 2x2 blocks that start in this row, whose values are the
+  // same on all of their pixels.
+  void OutputChroma420(size_t thread_id, size_t ypos, size_t xstart,
+                       size_t len, const float** line_buffers) const {
+    const float* luma[4] = {line_buffers[0]};
+    OutputBuffers(planes_[0], thread_id, ypos, xstart, len, luma);
+    if (ypos & 1) return;
+    float* chroma[2];
+    for (size_t c = 0; c < 2; ++c) {
+      chroma[c] =
+          reinterpret_cast<float*>(temp_chroma_[thread_id * 2 + c].get());
+    }
+    size_t num = 0;
+    for (size_t i = xstart & 1; i < len; i += 2, ++num) {
+      chroma[0][num] = line_buffers[1][i];
+      chroma[1][num] = line_buffers[2][i];
+    }
+    if (num == 0) return;
+    const size_t chroma_x = (xstart + 1) / 2;
+    if (planes_.size() == 2) {
+      const float* cbcr[4] = {chroma[0], chroma[1]};
+      OutputBuffers(planes_[1], thread_id, ypos / 2, chroma_x, num, cbcr);
+    } else {
+      for (size_t c = 0; c < 2; ++c) {
+        const float* samples[4] = {chroma[c]};
+        OutputBuffers(planes_[1 + c], thread_id, ypos / 2, chroma_x, num,
+                      samples);
+      }
+    }
+  }
+
   void OutputBuffers(const Output& out, size_t thread_id, size_t ypos,
                      size_t xstart, size_t len, const float* input[4]) const {
     if (flip_x_) {
       FlipX(out, thread_id, len, &xstart, input);
     }
     if (out.data_type_ == JXL_TYPE_UINT8) {
-      uint8_t* JXL_RESTRICT temp =
-          reinterpret_cast<uint8_t*>(temp_out_[thread_id].get());
-      StoreUnsignedRow(out, input, len, temp);
-      WriteToOutput(out, thread_id, ypos, xstart, len, temp);
+      OutputRow(out, thread_id, ypos, xstart, len, input,
+                reinterpret_cast<uint8_t*>(temp_out_[thread_id].get()));
     } else if (out.data_type_ == JXL_TYPE_UINT16 ||
                out.data_type_ == JXL_TYPE_FLOAT16) {
-      uint16_t* JXL_RESTRICT temp =
-          reinterpret_cast<uint16_t*>(temp_out_[thread_id].get());
-      if (out.data_type_ == JXL_TYPE_UINT16) {
-        StoreUnsignedRow(out, input, len, temp);
-      } else {
-        StoreFloat16Row(out, input, len, temp);
-      }
-      if (out.swap_endianness_) {
-        const HWY_FULL(uint16_t) du;
-        size_t output_len = len * out.num_channels_;
-        for (size_t j = 0; j < output_len; j += Lanes(du)) {
-          auto v = LoadU(du, temp + j);
-          auto vswap = Or(ShiftRightSame(v, 8), ShiftLeftSame(v, 8));
-          StoreU(vswap, du, temp + j);
-        }
-      }
-      WriteToOutput(out, thread_id, ypos, xstart, len, temp);
+      OutputRow(out, thread_id, ypos, xstart, len, input,
+                reinterpret_cast<uint16_t*>(temp_out_[thread_id].get()));
     } else if (out.data_type_ == JXL_TYPE_FLOAT) {
-      float* JXL_RESTRICT temp =
-          reinterpret_cast<float*>(temp_out_[thread_id].get());
-      StoreFloatRow(out, input, len, temp);
-      if (out.swap_endianness_) {
-        size_t output_len = len * out.num_channels_;
-        for (size_t j = 0; j < output_len; ++j) {
-          temp[j] = BSwapFloat(temp[j]);
-        }
-      }
+      OutputRow(out, thread_id, ypos, xstart, len, input,
+                reinterpret_cast<float*>(temp_out_[thread_id].get()));
+    }
+  }
+
+  // Converts `len` pixels to the output format, writing whole vectors of
+  // pixels straight into the output buffer rows when possible, and the rest
+  // through `temp`.
+  template <typename T>
+  void OutputRow(const Output& out, size_t thread_id, size_t ypos,
+                 size_t xstart, size_t len, const float* input[4],
+                 T* JXL_RESTRICT temp) const {
+    if (out.pixel_callback_.run_rect && !transpose_) {
+      // The rows of the rectangle are far enough apart for the stores of
+      // whole vectors.
+      const size_t stride = kMaxPixelsPerCall * out.PixelSize();
+      const size_t row = AddRectRow(out, thread_id, ypos, xstart, len);
+      StoreRow(out, input, len,
+               reinterpret_cast<T*>(
+                   out.rect_rows_[thread_id].pixels.get() + row * stride));
+      return;
+    }
+    uint8_t* buffer = reinterpret_cast<uint8_t*>(out.buffer_);
+    if (out.run_opaque_ || transpose_ || out.stride_ % sizeof(T) != 0 ||
+        reinterpret_cast<uintptr_t>(buffer) % sizeof(T) != 0) {
+      StoreRow(out, input, len, temp);
       WriteToOutput(out, thread_id, ypos, xstart, len, temp);
+      return;
+    }
+    const HWY_FULL(float) d;
+    // The stores of whole vectors write exactly the pixels of the row.
+    const size_t direct_len = len - len % Lanes(d);
+    T* row = reinterpret_cast<T*>(buffer + ypos * out.stride_) +
+             xstart * out.num_channels_;
+    JXL_DASSERT((ypos * out.stride_ + (xstart + len) * out.num_channels_ *
+                                          sizeof(T)) <= out.buffer_size_);
+    StoreRow(out, input, direct_len, row);
+    if (direct_len == len) return;
+    const float* tail[4];
+    for (size_t c = 0; c < out.num_channels_; ++c) {
+      tail[c] = input[c] + direct_len;
+    }
+    StoreRow(out, tail, len - direct_len, temp);
+    memcpy(row + direct_len * out.num_channels_, temp,
+           (len - direct_len) * out.num_channels_ * sizeof(T));
+  }
+
+  void StoreRow(const Output& out, const float* input[4], size_t len,
+                uint8_t* output) const {
+    StoreUnsignedRow(out, input, len, output);
+  }
+
+  void StoreRow(const Output& out, const float* input[4], size_t len,
+                uint16_t* output) const {
+    if (out.data_type_ == JXL_TYPE_UINT16) {
+      StoreUnsignedRow(out, input, len, output);
+    } else {
+      StoreFloat16Row(out, input, len, output);
+    }
+    if (out.swap_endianness_) {
+      const HWY_FULL(float) d;
+      // Same number of lanes as the float vectors, so that whole vectors of
+      // pixels are swapped exactly.
+      const Rebind<uint16_t, decltype(d)> du;
+      const size_t output_len = len * out.num_channels_;
+      for (size_t j = 0; j < output_len; j += Lanes(du)) {
+        auto v = LoadU(du, output + j);
+        auto vswap = Or(ShiftRightSame(v, 8), ShiftLeftSame(v, 8));
+        StoreU(vswap, du, output + j);
+      }
+    }
+  }
+
+  void StoreRow(const Output& out, const float* input[4], size_t len,
+                float* output) const {
+    StoreFloatRow(out, input, len, output);
+    if (out.swap_endianness_) {
+      size_t output_len = len * out.num_channels_;
+      for (size_t j = 0; j < output_len; ++j) {
+        output[j] = BSwapFloat(output[j]);
+      }
     }
   }
 
@@ -411,7 +567,18 @@ class WriteToOutputStage : public RenderPipelineStage {
                      size_t xstart, size_t len, T* output) const {
     if (transpose_) {
       // TODO(szabadka) Buffer 8x8 chunks and transpose with SIMD.
-      if (out.run_opaque_) {
+      if (out.pixel_callback_.run_rect) {
+        // The row is a column of the rectangle.
+        const size_t pixel_size = out.PixelSize();
+        const size_t stride = out.pixel_callback_.max_rows * pixel_size;
+        const size_t column = AddRectRow(out, thread_id, ypos, xstart, len);
+        uint8_t* rect =
+            out.rect_rows_[thread_id].pixels.get() + column * pixel_size;
+        const uint8_t* pixels = reinterpret_cast<const uint8_t*>(output);
+        for (size_t i = 0; i < len; ++i) {
+          memcpy(rect + i * stride, pixels + i * pixel_size, pixel_size);
+        }
+      } else if (out.run_opaque_) {
         for (size_t i = 0, j = 0; i < len; ++i, j += out.num_channels_) {
           out.pixel_callback_.run(out.run_opaque_, thread_id, ypos, xstart + i,
                                   1, output + j);
@@ -440,7 +607,59 @@ class WriteToOutputStage : public RenderPipelineStage {
     }
   }
 
+  // Adds the row `ypos` of `len` pixels from `xstart` to the rows of
+  // `thread_id` for the rect callback, first passing the collected rows to the
+  // callback if the row doesn't extend them, and returns the index of its row,
+  // or column if transposed, in the rectangle. The rows are stored from the
+  // end of the rectangle when flipped vertically, so that they are always in
+  // order.
+  size_t AddRectRow(const Output& out, size_t thread_id, size_t ypos,
+                    size_t xstart, size_t len) const {
+    RectRows& rows = out.rect_rows_[thread_id];
+    const size_t max_rows = out.pixel_callback_.max_rows;
+    const size_t next_ypos = flip_y_ ? rows.last_ypos - 1 : rows.last_ypos + 1;
+    if (rows.num_rows != 0 &&
+        (rows.num_rows == max_rows || xstart != rows.xstart ||
+         len != rows.len || ypos != next_ypos)) {
+      FlushRect(out, thread_id);
+    }
+    if (rows.num_rows == 0) {
+      rows.xstart = xstart;
+      rows.len = len;
+      rows.first_ypos = ypos;
+    }
+    rows.last_ypos = ypos;
+    const size_t index = flip_y_ ? max_rows - 1 - rows.num_rows : rows.num_rows;
+    rows.num_rows++;
+    return index;
+  }
+
+  // Passes the rows collected by `thread_id` to the rect callback.
+  void FlushRect(const Output& out, size_t thread_id) const {
+    RectRows& rows = out.rect_rows_[thread_id];
+    if (rows.num_rows == 0) return;
+    const size_t pixel_size = out.PixelSize();
+    const size_t max_rows = out.pixel_callback_.max_rows;
+    const size_t first = flip_y_ ? max_rows - rows.num_rows : 0;
+    const size_t ypos = flip_y_ ? rows.last_ypos : rows.first_ypos;
+    const uint8_t* pixels = rows.pixels.get();
+    if (transpose_) {
+      out.pixel_callback_.run_rect(out.run_opaque_, thread_id, ypos,
+                                   rows.xstart, rows.num_rows, rows.len,
+                                   max_rows * pixel_size,
+                                   pixels + first * pixel_size);
+    } else {
+      const size_t stride = kMaxPixelsPerCall * pixel_size;
+      out.pixel_callback_.run_rect(out.run_opaque_, thread_id, rows.xstart,
+                                   ypos, rows.len, rows.num_rows, stride,
+                                   pixels + first * stride);
+    }
+    rows.num_rows = 0;
+  }
+
   static constexpr size_t kMaxPixelsPerCall = 1024;
+  size_t x0_;
+  size_t y0_;
   size_t width_;
   size_t height_;
   Output main_;  // color + alpha
@@ -452,21 +671,27 @@ class WriteToOutputStage : public RenderPipelineStage {
   bool flip_x_;
   bool flip_y_;
   bool transpose_;
+  // Planes of the image output replacing main_, with 4:2:0 Y'CbCr if
+  // chroma_420_ is true.
+  std::vector<Output> planes_;
+  bool chroma_420_;
   std::vector<Output> extra_channels_;
   std::vector<float> opaque_alpha_;
   std::vector<CacheAlignedUniquePtr> temp_in_;
   std::vector<CacheAlignedUniquePtr> temp_out_;
+  std::vector<CacheAlignedUniquePtr> temp_chroma_;
 };
 
 constexpr size_t WriteToOutputStage::kMaxPixelsPerCall;
 
 std::unique_ptr<RenderPipelineStage> GetWriteToOutputStage(
-    const ImageOutput& main_output, size_t width, size_t height, bool has_alpha,
+    const ImageOutput& main_output, const Rect& output_rect, bool has_alpha,
     bool unpremul_alpha, size_t alpha_c, Orientation undo_orientation,
-    std::vector<ImageOutput>& extra_output) {
+    std::vector<ImageOutput>& extra_output,
+    const std::vector<ImageOutput>& main_planes, bool chroma_420) {
   return jxl::make_unique<WriteToOutputStage>(
-      main_output, width, height, has_alpha, unpremul_alpha, alpha_c,
-      undo_orientation, extra_output);
+      main_output, output_rect, has_alpha, unpremul_alpha, alpha_c,
+      undo_orientation, extra_output, main_planes, chroma_420);
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -588,12 +813,13 @@ std::unique_ptr<RenderPipelineStage> GetWriteToImage3FStage(Image3F* image) {
 }
 
 std::unique_ptr<RenderPipelineStage> GetWriteToOutputStage(
-    const ImageOutput& main_output, size_t width, size_t height, bool has_alpha,
+    const ImageOutput& main_output, const Rect& output_rect, bool has_alpha,
     bool unpremul_alpha, size_t alpha_c, Orientation undo_orientation,
-    std::vector<ImageOutput>& extra_output) {
+    std::vector<ImageOutput>& extra_output,
+    const std::vector<ImageOutput>& main_planes, bool chroma_420) {
   return HWY_DYNAMIC_DISPATCH(GetWriteToOutputStage)(
-      main_output, width, height, has_alpha, unpremul_alpha, alpha_c,
-      undo_orientation, extra_output);
+      main_output, output_rect, has_alpha, unpremul_alpha, alpha_c,
+      undo_orientation, extra_output, main_planes, chroma_420);
 }
 
 }  // namespace jxl
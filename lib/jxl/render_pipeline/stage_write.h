@@ -20,11 +20,16 @@ std::unique_ptr<RenderPipelineStage> GetWriteToImageBundleStage(
 // Gets a stage to write color channels to an Image3F.
 std::unique_ptr<RenderPipelineStage> GetWriteToImage3FStage(Image3F* image);
 
-// Gets a stage to write to a pixel callback or image buffer.
+// Gets a stage to write to a pixel callback or image buffer. Only the pixels
+// inside `output_rect` are written, with its top-left corner at the origin of
+// the output. If `main_planes` is not empty, the color and alpha channels are
+// written to one plane each instead, or, if `chroma_420` is true, the Y'CbCr
+// channels to a Y plane and to subsampled Cb and Cr planes, or one CbCr plane.
 std::unique_ptr<RenderPipelineStage> GetWriteToOutputStage(
-    const ImageOutput& main_output, size_t width, size_t height, bool has_alpha,
+    const ImageOutput& main_output, const Rect& output_rect, bool has_alpha,
     bool unpremul_alpha, size_t alpha_c, Orientation undo_orientation,
-    std::vector<ImageOutput>& extra_output);
+    std::vector<ImageOutput>& extra_output,
+    const std::vector<ImageOutput>& main_planes, bool chroma_420);
 
 }  // namespace jxl
 
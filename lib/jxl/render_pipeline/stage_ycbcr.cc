@@ -81,5 +81,95 @@ std::unique_ptr<RenderPipelineStage> GetYCbCrStage() {
   return HWY_DYNAMIC_DISPATCH(GetYCbCrStage)();
 }
 
+namespace {
+class YCbCr420OutputStage : public RenderPipelineStage {
+ public:
+  YCbCr420OutputStage(bool bt709, const Rect& output_rect)
+      : RenderPipelineStage(
+            RenderPipelineStage::Settings::SymmetricBorderOnly(1)),
+        kr_(bt709 ? 0.2126f : 0.299f),
+        kb_(bt709 ? 0.0722f : 0.114f),
+        x0_(output_rect.x0()),
+        y0_(output_rect.y0()),
+        x1_(output_rect.x0() + output_rect.xsize()),
+        y1_(output_rect.y0() + output_rect.ysize()) {}
+
+  void ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                  size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                  size_t thread_id) const final {
+    PROFILER_ZONE("YCbCr420Output");
+    const float kg = 1.0f - kr_ - kb_;
+    // Limited range: Y' in [16, 235] and chroma in [16, 240], out of 255.
+    const float y_mul = 219.0f / 255;
+    const float y_add = 16.0f / 255;
+    const float cb_mul = 224.0f / 255 / (2 * (1 - kb_));
+    const float cr_mul = 224.0f / 255 / (2 * (1 - kr_));
+    const float c_add = 128.0f / 255;
+
+    const int dy = Partner(ypos, y0_, y1_);
+    const float* JXL_RESTRICT row[3];
+    const float* JXL_RESTRICT row_dy[3];
+    float* JXL_RESTRICT row_out[3];
+    for (size_t c = 0; c < 3; c++) {
+      row[c] = GetInputRow(input_rows, c, 0);
+      row_dy[c] = GetInputRow(input_rows, c, dy);
+      row_out[c] = GetOutputRow(output_rows, c, 0);
+    }
+    const ssize_t begin = -static_cast<ssize_t>(xextra);
+    const ssize_t end = xsize + xextra;
+    for (ssize_t x = begin; x < end; x++) {
+      const int dx = Partner(xpos + x, x0_, x1_);
+      float rgb[3];
+      for (size_t c = 0; c < 3; c++) {
+        rgb[c] = Clamp01(row[c][x]);
+      }
+      const float luma = kr_ * rgb[0] + kg * rgb[1] + kb_ * rgb[2];
+      float block[3];
+      for (size_t c = 0; c < 3; c++) {
+        block[c] = 0.25f * (rgb[c] + Clamp01(row[c][x + dx]) +
+                            Clamp01(row_dy[c][x]) +
+                            Clamp01(row_dy[c][x + dx]));
+      }
+      const float block_luma =
+          kr_ * block[0] + kg * block[1] + kb_ * block[2];
+      row_out[0][x] = luma * y_mul + y_add;
+      row_out[1][x] = (block[2] - block_luma) * cb_mul + c_add;
+      row_out[2][x] = (block[0] - block_luma) * cr_mul + c_add;
+    }
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return c < 3 ? RenderPipelineChannelMode::kInOut
+                 : RenderPipelineChannelMode::kIgnored;
+  }
+
+  const char* GetName() const override { return "YCbCr420Output"; }
+
+ private:
+  static float Clamp01(float v) { return std::min(std::max(v, 0.0f), 1.0f); }
+
+  // Returns the offset to the other row or column of the 2x2 block that `pos`
+  // is in, or 0 if there is none inside [begin, end). Positions left of the
+  // image wrap around and are outside.
+  static int Partner(size_t pos, size_t begin, size_t end) {
+    if (pos < begin || pos >= end) return 0;
+    if ((pos - begin) & 1) return -1;
+    return pos + 1 < end ? 1 : 0;
+  }
+
+  float kr_;
+  float kb_;
+  size_t x0_;
+  size_t y0_;
+  size_t x1_;
+  size_t y1_;
+};
+}  // namespace
+
+std::unique_ptr<RenderPipelineStage> GetYCbCr420OutputStage(
+    bool bt709, const Rect& output_rect) {
+  return jxl::make_unique<YCbCr420OutputStage>(bt709, output_rect);
+}
+
 }  // namespace jxl
 #endif
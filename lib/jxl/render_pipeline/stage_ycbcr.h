@@ -14,12 +14,21 @@
 #include <vector>
 
 #include "lib/jxl/dec_xyb.h"
+#include "lib/jxl/image.h"
 #include "lib/jxl/render_pipeline/render_pipeline_stage.h"
 
 namespace jxl {
 
 // Converts the color channels from YCbCr to RGB.
 std::unique_ptr<RenderPipelineStage> GetYCbCrStage();
+
+// Converts the color channels from nonlinear RGB to limited range Y'CbCr with
+// the BT.709 or BT.601 matrix, scaled such that an 8-bit output stage writes
+// the Y'CbCr values. Each pixel gets the chroma of the 2x2 block of
+// `output_rect` it is in, so that the chroma of 4:2:0 output can be taken from
+// any pixel of the block.
+std::unique_ptr<RenderPipelineStage> GetYCbCr420OutputStage(
+    bool bt709, const Rect& output_rect);
 }  // namespace jxl
 
 #endif  // LIB_JXL_RENDER_PIPELINE_STAGE_YCBCR_H_
@@ -7,6 +7,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <numeric>
 
 #include "lib/jxl/ans_params.h"
 #include "lib/jxl/base/printf_macros.h"
@@ -65,7 +66,7 @@ float ContinuousIDCT(const float dct[32], const float t) {
 
 template <typename DF>
 void DrawSegment(DF df, const SplineSegment& segment, const bool add,
-                 const size_t y, const size_t x, float* JXL_RESTRICT rows[3]) {
+                 const float dy2, const size_t x, float* JXL_RESTRICT rows[3]) {
   Rebind<int32_t, DF> di;
   const auto inv_sigma = Set(df, segment.inv_sigma);
   const auto half = Set(df, 0.5f);
@@ -73,8 +74,7 @@ void DrawSegment(DF df, const SplineSegment& segment, const bool add,
   const auto sigma_over_4_times_intensity =
       Set(df, segment.sigma_over_4_times_intensity);
   const auto dx = Sub(ConvertTo(df, Iota(di, x)), Set(df, segment.center_x));
-  const auto dy = Set(df, y - segment.center_y);
-  const auto sqd = MulAdd(dx, dx, Mul(dy, dy));
+  const auto sqd = MulAdd(dx, dx, Set(df, dy2));
   const auto distance = Sqrt(sqd);
   const auto one_dimensional_factor =
       Sub(FastErff(df, Mul(MulAdd(distance, half, one_over_2s2), inv_sigma)),
@@ -96,19 +96,21 @@ void DrawSegment(const SplineSegment& segment, const bool add, const size_t y,
   // one-past-the-end
   x1 =
       std::min<ssize_t>(x1, segment.center_x + segment.maximum_distance + 1.5f);
+  // The vertical distance is the same for the whole row.
+  const float dy = y - segment.center_y;
+  const float dy2 = dy * dy;
   HWY_FULL(float) df;
   for (; x + static_cast<ssize_t>(Lanes(df)) <= x1; x += Lanes(df)) {
-    DrawSegment(df, segment, add, y, x, rows);
+    DrawSegment(df, segment, add, dy2, x, rows);
   }
   for (; x < x1; ++x) {
-    DrawSegment(HWY_CAPPED(float, 1)(), segment, add, y, x, rows);
+    DrawSegment(HWY_CAPPED(float, 1)(), segment, add, dy2, x, rows);
   }
 }
 
 void ComputeSegments(const Spline::Point& center, const float intensity,
                      const float color[3], const float sigma,
                      std::vector<SplineSegment>& segments,
-                     std::vector<std::pair<size_t, size_t>>& segments_by_y,
                      size_t* pixel_limit) {
   // In worst case zero-sized dot spans over 2 rows / columns.
   constexpr const float kThinDotSpan = 2.0f;
@@ -156,26 +158,33 @@ void ComputeSegments(const Spline::Point& center, const float intensity,
   }
   // TODO(eustas): perhaps we should charge less: (y1 - y0) <= cost
   *pixel_limit -= area_cost;
-  ssize_t y0 = center.y - maximum_distance + .5f;
-  ssize_t y1 = center.y + maximum_distance + 1.5f;  // one-past-the-end
-  for (ssize_t y = std::max<ssize_t>(y0, 0); y < y1; y++) {
-    segments_by_y.emplace_back(y, segments.size());
-  }
   segments.push_back(segment);
 }
 
 void DrawSegments(float* JXL_RESTRICT row_x, float* JXL_RESTRICT row_y,
                   float* JXL_RESTRICT row_b, const Rect& image_rect,
                   const bool add, const SplineSegment* segments,
-                  const size_t* segment_indices,
-                  const size_t* segment_y_start) {
+                  const size_t* segment_indices, const size_t* segment_y_start,
+                  const float max_segment_width) {
   JXL_ASSERT(image_rect.ysize() == 1);
   float* JXL_RESTRICT rows[3] = {row_x - image_rect.x0(),
                                  row_y - image_rect.x0(),
                                  row_b - image_rect.x0()};
   size_t y = image_rect.y0();
-  for (size_t i = segment_y_start[y]; i < segment_y_start[y + 1]; i++) {
-    DrawSegment(segments[segment_indices[i]], add, y, image_rect.x0(),
+  const float x0 = image_rect.x0();
+  const float x1 = image_rect.x0() + image_rect.xsize();
+  // The segments of the row are sorted by their left end; the ones that end
+  // before x0 have their left end before x0 - max_segment_width, which is
+  // where the drawing can start.
+  const size_t* begin = segment_indices + segment_y_start[y];
+  const size_t* end = segment_indices + segment_y_start[y + 1];
+  const size_t* first = std::partition_point(begin, end, [&](size_t i) {
+    return SegmentLeft(segments[i]) + max_segment_width + 1.5f <= x0;
+  });
+  for (const size_t* i = first; i != end; ++i) {
+    const SplineSegment& segment = segments[*i];
+    if (SegmentLeft(segment) + 0.5f >= x1) break;
+    DrawSegment(segment, add, y, image_rect.x0(),
                 image_rect.x0() + image_rect.xsize(), rows);
   }
 }
@@ -184,7 +193,6 @@ void SegmentsFromPoints(
     const Spline& spline,
     const std::vector<std::pair<Spline::Point, float>>& points_to_draw,
     const float arc_length, std::vector<SplineSegment>& segments,
-    std::vector<std::pair<size_t, size_t>>& segments_by_y,
     size_t* pixel_limit) {
   const float inv_arc_length = 1.0f / arc_length;
   int k = 0;
@@ -201,8 +209,7 @@ void SegmentsFromPoints(
     }
     const float sigma =
         ContinuousIDCT(spline.sigma_dct, (32 - 1) * progress_along_arc);
-    ComputeSegments(point, multiplier, color, sigma, segments, segments_by_y,
-                    pixel_limit);
+    ComputeSegments(point, multiplier, color, sigma, segments, pixel_limit);
     if (*pixel_limit == 0) {
       return;
     }
@@ -538,6 +545,7 @@ void Splines::Clear() {
   segments_.clear();
   segment_indices_.clear();
   segment_y_start_.clear();
+  max_segment_width_ = 0.0f;
 }
 
 Status Splines::Decode(jxl::BitReader* br, const size_t num_pixels) {
@@ -599,7 +607,7 @@ Status Splines::InitializeDrawCache(const size_t image_xsize,
   segments_.clear();
   segment_indices_.clear();
   segment_y_start_.clear();
-  std::vector<std::pair<size_t, size_t>> segments_by_y;
+  max_segment_width_ = 0.0f;
   Spline spline;
   float pixel_limit = 16.0f * image_xsize * image_ysize + (1 << 16);
   // Apply some extra cap to avoid overflows.
@@ -640,7 +648,7 @@ Status Splines::InitializeDrawCache(const size_t image_xsize,
       continue;
     }
     HWY_DYNAMIC_DISPATCH(SegmentsFromPoints)
-    (spline, points_to_draw, arc_length, segments_, segments_by_y, &px_limit);
+    (spline, points_to_draw, arc_length, segments_, &px_limit);
     if (px_limit == 0) {
       return JXL_FAILURE("Too many pixels covered with splines");
     }
@@ -659,20 +667,47 @@ Status Splines::InitializeDrawCache(const size_t image_xsize,
     return JXL_FAILURE("Too large total_estimated_area_reached: %" PRIu64,
                        total_estimated_area_reached);
   }
-  // TODO(eustas): consider linear sorting here.
-  std::sort(segments_by_y.begin(), segments_by_y.end());
-  segment_indices_.resize(segments_by_y.size());
-  segment_y_start_.resize(image_ysize + 1);
-  for (size_t i = 0; i < segments_by_y.size(); i++) {
-    segment_indices_[i] = segments_by_y[i].second;
-    size_t y = segments_by_y[i].first;
-    if (y < image_ysize) {
+  // The rows [y0, y1) of the image that a segment touches.
+  const auto segment_rows = [image_ysize](const SplineSegment& segment,
+                                          size_t* y0, size_t* y1) {
+    const ssize_t first = segment.center_y - segment.maximum_distance + .5f;
+    // one-past-the-end
+    const ssize_t last = segment.center_y + segment.maximum_distance + 1.5f;
+    *y0 = std::min<size_t>(std::max<ssize_t>(first, 0), image_ysize);
+    *y1 = std::max(*y0, std::min<size_t>(std::max<ssize_t>(last, 0),
+                                         image_ysize));
+  };
+  // Each row lists its segments in the order of their left end, so that
+  // DrawSegments can skip the ones outside of the columns it draws.
+  std::vector<size_t> order(segments_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return SegmentLeft(segments_[a]) < SegmentLeft(segments_[b]);
+  });
+  // Counting sort of the (row, segment) pairs by row.
+  segment_y_start_.assign(image_ysize + 1, 0);
+  for (const SplineSegment& segment : segments_) {
+    size_t y0, y1;
+    segment_rows(segment, &y0, &y1);
+    for (size_t y = y0; y < y1; y++) {
       segment_y_start_[y + 1]++;
     }
+    max_segment_width_ =
+        std::max(max_segment_width_, 2 * segment.maximum_distance);
   }
   for (size_t y = 0; y < image_ysize; y++) {
     segment_y_start_[y + 1] += segment_y_start_[y];
   }
+  segment_indices_.resize(segment_y_start_[image_ysize]);
+  std::vector<size_t> next(segment_y_start_.begin(),
+                           segment_y_start_.end() - 1);
+  for (size_t i : order) {
+    size_t y0, y1;
+    segment_rows(segments_[i], &y0, &y1);
+    for (size_t y = y0; y < y1; y++) {
+      segment_indices_[next[y]++] = i;
+    }
+  }
   return true;
 }
 
@@ -685,7 +720,7 @@ void Splines::ApplyToRow(float* JXL_RESTRICT row_x, float* JXL_RESTRICT row_y,
   for (size_t iy = 0; iy < image_row.ysize(); iy++) {
     HWY_DYNAMIC_DISPATCH(DrawSegments)
     (row_x, row_y, row_b, image_row.Line(iy), add, segments_.data(),
-     segment_indices_.data(), segment_y_start_.data());
+     segment_indices_.data(), segment_y_start_.data(), max_segment_width_);
   }
 }
 
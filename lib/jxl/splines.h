@@ -90,6 +90,11 @@ struct SplineSegment {
   float color[3];
 };
 
+// The leftmost column that a segment may touch, before rounding.
+inline float SegmentLeft(const SplineSegment& segment) {
+  return segment.center_x - segment.maximum_distance;
+}
+
 class Splines {
  public:
   Splines() = default;
@@ -102,6 +107,13 @@ class Splines {
 
   bool HasAny() const { return !splines_.empty(); }
 
+  // Returns true if some spline segment touches row `y`. Only valid after
+  // InitializeDrawCache.
+  bool HasSegmentsInRow(size_t y) const {
+    return y + 1 < segment_y_start_.size() &&
+           segment_y_start_[y] != segment_y_start_[y + 1];
+  }
+
   void Clear();
 
   Status Decode(BitReader* br, size_t num_pixels);
@@ -141,6 +153,8 @@ class Splines {
   std::vector<SplineSegment> segments_;
   std::vector<size_t> segment_indices_;
   std::vector<size_t> segment_y_start_;
+  // Largest distance between the left and right ends of a segment.
+  float max_segment_width_ = 0.0f;
 };
 
 }  // namespace jxl
@@ -319,6 +319,48 @@ TEST(SplinesTest, Drawing) {
       *io_expected.Main().color(), *io_actual.Main().color(), 1e-2f, 1e-1f, _));
 }
 
+TEST(SplinesTest, DrawingInColumns) {
+  // Several splines far apart, so that most columns only overlap some of the
+  // segments of their rows.
+  std::vector<QuantizedSpline> quantized_splines;
+  std::vector<Spline::Point> starting_points;
+  for (float x : {20.f, 120.f, 220.f}) {
+    const Spline spline{{{x, 10}, {x + 60, 150}, {x + 10, 300}},
+                        /*color_dct=*/{{0.5f}, {0.5f, 0.25f}, {0.5f}},
+                        /*sigma_dct=*/{2.0f, 0.5f}};
+    quantized_splines.emplace_back(spline, kQuantizationAdjustment, kYToX,
+                                   kYToB);
+    starting_points.push_back(spline.control_points.front());
+  }
+  Splines splines(kQuantizationAdjustment, std::move(quantized_splines),
+                  std::move(starting_points));
+  Image3F expected(320, 320);
+  ZeroFillImage(&expected);
+  ASSERT_TRUE(
+      splines.InitializeDrawCache(expected.xsize(), expected.ysize(), *cmap));
+  splines.AddTo(&expected, Rect(expected), Rect(expected));
+
+  // The same segments are added in the same order to each pixel.
+  Image3F actual(320, 320);
+  ZeroFillImage(&actual);
+  constexpr size_t kColumns = 13;
+  for (size_t y = 0; y < actual.ysize(); ++y) {
+    for (size_t x = 0; x < actual.xsize(); x += kColumns) {
+      const size_t xsize = std::min(kColumns, actual.xsize() - x);
+      splines.AddToRow(actual.PlaneRow(0, y) + x, actual.PlaneRow(1, y) + x,
+                       actual.PlaneRow(2, y) + x, Rect(x, y, xsize, 1));
+    }
+  }
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < actual.ysize(); ++y) {
+      for (size_t x = 0; x < actual.xsize(); ++x) {
+        ASSERT_EQ(expected.PlaneRow(c, y)[x], actual.PlaneRow(c, y)[x])
+            << "c " << c << " x " << x << " y " << y;
+      }
+    }
+  }
+}
+
 TEST(SplinesTest, ClearedEveryFrame) {
   CodecInOut io_expected;
   const PaddedBytes bytes_expected =
@@ -131,6 +131,11 @@ class TF_709 {
     return kMulHi * std::pow(d, kPowHi) + kSub;
   }
 
+  JXL_INLINE double DisplayFromEncoded(const double e) const {
+    if (e < kInvThresh) return kInvMulLow * e;
+    return std::pow(e * kInvMulHi + kInvAdd, kInvPowHi);
+  }
+
   // Maximum error 1e-6.
   template <class D, class V>
   JXL_INLINE V EncodedFromDisplay(D d, V x) const {
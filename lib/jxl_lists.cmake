@@ -39,6 +39,8 @@ set(JPEGXL_INTERNAL_CODEC_APNG_SOURCES
   extras/dec/apng.h
   extras/enc/apng.cc
   extras/enc/apng.h
+  extras/enc/apng_filter.cc
+  extras/enc/apng_filter.h
 )
 
 set(JPEGXL_INTERNAL_CODEC_EXR_SOURCES
@@ -68,6 +70,7 @@ set(JPEGXL_INTERNAL_CODEC_JPG_SOURCES
 )
 
 set(JPEGXL_INTERNAL_CODEC_JXL_SOURCES
+  extras/batch.h
   extras/dec/jxl.cc
   extras/dec/jxl.h
   extras/enc/jxl.cc
@@ -158,6 +161,7 @@ set(JPEGXL_INTERNAL_DEC_SOURCES
   jxl/dec_external_image.h
   jxl/dec_frame.cc
   jxl/dec_frame.h
+  jxl/dec_gaborish-inl.h
   jxl/dec_group.cc
   jxl/dec_group.h
   jxl/dec_group_border.cc
@@ -380,6 +384,8 @@ set(JPEGXL_INTERNAL_ENC_SOURCES
   jxl/enc_patch_dictionary.h
   jxl/enc_photon_noise.cc
   jxl/enc_photon_noise.h
+  jxl/enc_progress.cc
+  jxl/enc_progress.h
   jxl/enc_progressive_split.cc
   jxl/enc_progressive_split.h
   jxl/enc_quant_weights.cc
@@ -424,6 +430,7 @@ set(JPEGXL_INTERNAL_EXTRAS_FOR_TOOLS_SOURCES
   extras/hlg.h
   extras/packed_image_convert.cc
   extras/packed_image_convert.h
+  extras/tone_mapping-inl.h
   extras/tone_mapping.cc
   extras/tone_mapping.h
 )
@@ -447,11 +454,16 @@ set(JPEGXL_INTERNAL_EXTRAS_SOURCES
 
 set(JPEGXL_INTERNAL_GBENCH_SOURCES
   extras/tone_mapping_gbench.cc
+  jxl/dec_ans_gbench.cc
   jxl/dec_external_image_gbench.cc
+  jxl/dec_modular_gbench.cc
+  jxl/dec_transforms_gbench.cc
   jxl/enc_external_image_gbench.cc
   jxl/gauss_blur_gbench.cc
+  jxl/render_pipeline/render_pipeline_gbench.cc
   jxl/splines_gbench.cc
   jxl/tf_gbench.cc
+  threads/thread_parallel_runner_gbench.cc
 )
 
 set(JPEGXL_INTERNAL_JPEGLI_SOURCES
@@ -548,6 +560,7 @@ set(JPEGXL_INTERNAL_TESTLIB_FILES
   jxl/dec_transforms_testonly.cc
   jxl/dec_transforms_testonly.h
   jxl/fake_parallel_runner_testonly.h
+  jxl/gbench_targets_testonly.h
   jxl/image_test_utils.h
   jxl/render_pipeline/test_render_pipeline_stages.h
   jxl/test_image.cc
@@ -619,13 +632,19 @@ set(JPEGXL_INTERNAL_TESTS
 set(JPEGXL_INTERNAL_THREADS_PUBLIC_HEADERS
   include/jxl/resizable_parallel_runner.h
   include/jxl/resizable_parallel_runner_cxx.h
+  include/jxl/shared_parallel_runner.h
+  include/jxl/shared_parallel_runner_cxx.h
   include/jxl/thread_parallel_runner.h
   include/jxl/thread_parallel_runner_cxx.h
+  include/jxl/work_stealing_parallel_runner.h
+  include/jxl/work_stealing_parallel_runner_cxx.h
 )
 
 set(JPEGXL_INTERNAL_THREADS_SOURCES
   threads/resizable_parallel_runner.cc
+  threads/shared_parallel_runner.cc
   threads/thread_parallel_runner.cc
   threads/thread_parallel_runner_internal.cc
   threads/thread_parallel_runner_internal.h
+  threads/work_stealing_parallel_runner.cc
 )
@@ -15,6 +15,10 @@
 namespace jpegxl {
 namespace {
 
+// Runs with less estimated work per thread than this are not worth waking up
+// more threads for.
+constexpr uint64_t kMinWorkPerThreadNs = 20000;
+
 // A thread pool that allows changing the number of threads it runs. It also
 // runs tasks on the calling thread, which can work better on schedulers for
 // heterogeneous architectures.
@@ -43,18 +47,32 @@ struct ResizeableParallelRunner {
 
   ~ResizeableParallelRunner() { SetNumThreads(0); }
 
+  // Returns how many threads are worth using for the given run.
+  size_t MaxThreads(uint32_t start, uint32_t end,
+                    const JxlParallelRunHints* hints) const {
+    size_t max_threads = workers_.size() + 1;
+    if (hints->task_cost_ns != 0 && end > start) {
+      const uint64_t work_ns = hints->task_cost_ns * (end - start);
+      max_threads = std::min<uint64_t>(
+          max_threads, std::max<uint64_t>(work_ns / kMinWorkPerThreadNs, 1));
+    }
+    return max_threads;
+  }
+
   JxlParallelRetCode Run(void* jxl_opaque, JxlParallelRunInit init,
                          JxlParallelRunFunction func, uint32_t start,
-                         uint32_t end) {
-    if (start + 1 == end) {
+                         uint32_t end, size_t max_threads) {
+    if (start + 1 == end || max_threads == 1) {
       JxlParallelRetCode ret = init(jxl_opaque, 1);
       if (ret != 0) return ret;
 
-      func(jxl_opaque, start, 0);
+      for (uint32_t task = start; task < end; ++task) {
+        func(jxl_opaque, task, 0);
+      }
       return ret;
     }
 
-    size_t num_workers = std::min<size_t>(workers_.size() + 1, end - start);
+    size_t num_workers = std::min<size_t>(max_threads, end - start);
     JxlParallelRetCode ret = init(jxl_opaque, num_workers);
     if (ret != 0) {
       return ret;
@@ -63,7 +81,7 @@ struct ResizeableParallelRunner {
     {
       std::unique_lock<std::mutex> l(state_mutex_);
       // Avoid waking up more workers than needed.
-      max_running_workers_ = end - start - 1;
+      max_running_workers_ = num_workers - 1;
       next_task_ = start;
       end_task_ = end;
       func_ = func;
@@ -167,8 +185,20 @@ extern "C" {
 JXL_THREADS_EXPORT JxlParallelRetCode JxlResizableParallelRunner(
     void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
     JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range) {
-  return static_cast<jpegxl::ResizeableParallelRunner*>(runner_opaque)
-      ->Run(jpegxl_opaque, init, func, start_range, end_range);
+  jpegxl::ResizeableParallelRunner* runner =
+      static_cast<jpegxl::ResizeableParallelRunner*>(runner_opaque);
+  return runner->Run(jpegxl_opaque, init, func, start_range, end_range,
+                     /*max_threads=*/SIZE_MAX);
+}
+
+JXL_THREADS_EXPORT JxlParallelRetCode JxlResizableParallelRunnerWithHints(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range,
+    const JxlParallelRunHints* hints) {
+  jpegxl::ResizeableParallelRunner* runner =
+      static_cast<jpegxl::ResizeableParallelRunner*>(runner_opaque);
+  return runner->Run(jpegxl_opaque, init, func, start_range, end_range,
+                     runner->MaxThreads(start_range, end_range, hints));
 }
 
 JXL_THREADS_EXPORT void* JxlResizableParallelRunnerCreate(
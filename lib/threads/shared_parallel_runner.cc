@@ -0,0 +1,217 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/shared_parallel_runner.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jpegxl {
+namespace {
+
+struct SharedParallelRunner;
+
+// One encoder or decoder instance using the shared runner. Clients are
+// scheduled with stride scheduling: every task of a client run by a worker
+// advances its pass by kStrideScale / weight, and the workers take tasks of
+// the client with the lowest pass.
+struct SharedRunnerClient {
+  static constexpr uint64_t kStrideScale = 1 << 20;
+
+  SharedRunnerClient(SharedParallelRunner* runner, uint32_t weight)
+      : runner(runner), stride(kStrideScale / weight) {}
+
+  SharedParallelRunner* const runner;
+  const uint64_t stride;
+  // Guarded by the mutex of the runner.
+  uint64_t pass = 0;
+};
+
+// A thread pool whose workers are shared by concurrent Run calls of
+// different clients.
+struct SharedParallelRunner {
+  explicit SharedParallelRunner(size_t num_worker_threads) {
+    workers_.reserve(num_worker_threads);
+    for (size_t i = 0; i < num_worker_threads; i++) {
+      workers_.emplace_back([this, i]() { WorkerBody(i + 1); });
+    }
+  }
+
+  ~SharedParallelRunner() {
+    {
+      std::unique_lock<std::mutex> l(mutex_);
+      exit_ = true;
+      work_available_.notify_all();
+    }
+    for (std::thread& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  JxlParallelRetCode Run(SharedRunnerClient* client, void* jxl_opaque,
+                         JxlParallelRunInit init, JxlParallelRunFunction func,
+                         uint32_t start, uint32_t end) {
+    if (start > end) return -1;
+    if (start == end) return 0;
+
+    if (workers_.empty() || start + 1 == end) {
+      JxlParallelRetCode ret = init(jxl_opaque, 1);
+      if (ret != 0) return ret;
+      for (uint32_t task = start; task < end; ++task) {
+        func(jxl_opaque, task, 0);
+      }
+      return 0;
+    }
+
+    // The calling thread is thread 0, worker i is thread i.
+    JxlParallelRetCode ret = init(jxl_opaque, workers_.size() + 1);
+    if (ret != 0) return ret;
+
+    Job job;
+    job.client = client;
+    job.func = func;
+    job.jxl_opaque = jxl_opaque;
+    job.next_task = start;
+    job.end_task = end;
+
+    std::unique_lock<std::mutex> l(mutex_);
+    // A client that was idle does not get to catch up on the time it did not
+    // use the workers.
+    client->pass = std::max(client->pass, virtual_time_);
+    jobs_.push_back(&job);
+    size_t num_wakeups = std::min<size_t>(num_idle_workers_, end - start - 1);
+    for (size_t i = 0; i < num_wakeups; ++i) {
+      work_available_.notify_one();
+    }
+
+    // The calling thread only runs tasks of its own job, independently of
+    // the scheduling of the workers.
+    while (job.next_task < job.end_task) {
+      RunChunk(&job, /*thread=*/0, &l);
+    }
+    while (job.num_running != 0) {
+      job.done.wait(l);
+    }
+    return 0;
+  }
+
+ private:
+  // The state of one Run call, guarded by mutex_.
+  struct Job {
+    SharedRunnerClient* client;
+    JxlParallelRunFunction func;
+    void* jxl_opaque;  // not owned
+    uint32_t next_task;
+    uint32_t end_task;
+    // Number of threads running tasks of this job.
+    size_t num_running = 0;
+    // Notified when num_running becomes zero after all tasks were taken.
+    std::condition_variable done;
+  };
+
+  void WorkerBody(size_t thread) {
+    std::unique_lock<std::mutex> l(mutex_);
+    while (!exit_) {
+      Job* job = NextJob();
+      if (job == nullptr) {
+        num_idle_workers_++;
+        work_available_.wait(l);
+        num_idle_workers_--;
+        continue;
+      }
+      virtual_time_ = std::max(virtual_time_, job->client->pass);
+      RunChunk(job, thread, &l);
+    }
+  }
+
+  // Returns the job of the client with the lowest pass, or nullptr if there
+  // are no tasks left to take.
+  Job* NextJob() const {
+    Job* best = nullptr;
+    for (Job* job : jobs_) {
+      if (best == nullptr || job->client->pass < best->client->pass) {
+        best = job;
+      }
+    }
+    return best;
+  }
+
+  // Takes some tasks of the job and runs them with the lock released. The
+  // chunk size decreases with the number of remaining tasks to balance the
+  // load at the end. Only the tasks run by the workers (thread != 0) count
+  // towards the share of the client.
+  void RunChunk(Job* job, size_t thread, std::unique_lock<std::mutex>* l) {
+    const uint32_t num_remaining = job->end_task - job->next_task;
+    const uint32_t size = std::max<uint32_t>(
+        num_remaining / (4 * (workers_.size() + 1)), 1);
+    const uint32_t begin = job->next_task;
+    const uint32_t end = begin + size;
+    job->next_task = end;
+    if (thread != 0) job->client->pass += size * job->client->stride;
+    if (job->next_task == job->end_task) {
+      jobs_.erase(std::find(jobs_.begin(), jobs_.end(), job));
+    }
+    job->num_running++;
+    l->unlock();
+    for (uint32_t task = begin; task < end; ++task) {
+      job->func(job->jxl_opaque, task, thread);
+    }
+    l->lock();
+    job->num_running--;
+    if (job->num_running == 0 && job->next_task == job->end_task) {
+      job->done.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+
+  // Protects all the remaining variables and the jobs.
+  std::mutex mutex_;
+  // Notified when a job is added and when the workers should exit.
+  std::condition_variable work_available_;
+  // Jobs with tasks that are not taken yet.
+  std::vector<Job*> jobs_;
+  // The highest pass of a client whose tasks were taken by a worker.
+  uint64_t virtual_time_ = 0;
+  size_t num_idle_workers_ = 0;
+  bool exit_ = false;
+};
+
+}  // namespace
+}  // namespace jpegxl
+
+extern "C" {
+JXL_THREADS_EXPORT JxlParallelRetCode JxlSharedParallelRunner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range) {
+  jpegxl::SharedRunnerClient* client =
+      static_cast<jpegxl::SharedRunnerClient*>(runner_opaque);
+  return client->runner->Run(client, jpegxl_opaque, init, func, start_range,
+                             end_range);
+}
+
+JXL_THREADS_EXPORT void* JxlSharedParallelRunnerCreate(
+    const JxlMemoryManager* memory_manager, size_t num_worker_threads) {
+  return new jpegxl::SharedParallelRunner(num_worker_threads);
+}
+
+JXL_THREADS_EXPORT void JxlSharedParallelRunnerDestroy(void* runner) {
+  delete static_cast<jpegxl::SharedParallelRunner*>(runner);
+}
+
+JXL_THREADS_EXPORT void* JxlSharedParallelRunnerCreateClient(void* runner,
+                                                             uint32_t weight) {
+  if (weight == 0) return nullptr;
+  return new jpegxl::SharedRunnerClient(
+      static_cast<jpegxl::SharedParallelRunner*>(runner), weight);
+}
+
+JXL_THREADS_EXPORT void JxlSharedParallelRunnerDestroyClient(void* client) {
+  delete static_cast<jpegxl::SharedRunnerClient*>(client);
+}
+}
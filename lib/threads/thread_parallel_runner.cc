@@ -63,6 +63,15 @@ JxlParallelRetCode JxlThreadParallelRunner(
       runner_opaque, jpegxl_opaque, init, func, start_range, end_range);
 }
 
+JxlParallelRetCode JxlThreadParallelRunnerSetAffinity(void* runner_opaque,
+                                                     const size_t* cpus,
+                                                     size_t num_cpus) {
+  jpegxl::ThreadParallelRunner* runner =
+      static_cast<jpegxl::ThreadParallelRunner*>(runner_opaque);
+  return runner->SetAffinity(cpus, num_cpus) ? 0
+                                             : JXL_PARALLEL_RET_RUNNER_ERROR;
+}
+
 /// Starts the given number of worker threads and blocks until they are ready.
 /// "num_worker_threads" defaults to one per hyperthread. If zero, all tasks
 /// run on the main thread.
@@ -0,0 +1,70 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/thread_parallel_runner_cxx.h>
+#include <jxl/work_stealing_parallel_runner_cxx.h>
+
+#include <atomic>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/status.h"
+
+namespace jpegxl {
+namespace {
+
+// Many RunOnPool calls with small tasks, similar to the per-row and per-block
+// calls of the encoder heuristics. state.range(0) is the number of threads,
+// state.range(1) the number of tasks per call.
+void RunSmallTasks(benchmark::State& state, jxl::ThreadPool* pool) {
+  const uint32_t num_tasks = state.range(1);
+  std::vector<float> data(num_tasks * 16, 1.0f);
+  std::atomic<uint32_t> num_calls{0};
+  for (auto _ : state) {
+    JXL_CHECK(RunOnPool(
+        pool, 0, num_tasks, jxl::ThreadPool::NoInit,
+        [&](const uint32_t task, size_t /*thread*/) {
+          float* row = &data[task * 16];
+          for (size_t i = 0; i < 16; ++i) {
+            row[i] = row[i] * 0.5f + 0.5f;
+          }
+          num_calls.fetch_add(1, std::memory_order_relaxed);
+        },
+        "RunSmallTasks"));
+  }
+  JXL_CHECK(num_calls.load() == num_tasks * state.iterations());
+  state.SetItemsProcessed(num_tasks * state.iterations());
+}
+
+void BM_ThreadParallelRunner(benchmark::State& state) {
+  JxlThreadParallelRunnerPtr runner =
+      JxlThreadParallelRunnerMake(nullptr, state.range(0));
+  jxl::ThreadPool pool(JxlThreadParallelRunner, runner.get());
+  RunSmallTasks(state, &pool);
+}
+
+void BM_WorkStealingParallelRunner(benchmark::State& state) {
+  JxlWorkStealingParallelRunnerPtr runner =
+      JxlWorkStealingParallelRunnerMake(nullptr, state.range(0));
+  jxl::ThreadPool pool(JxlWorkStealingParallelRunner, runner.get());
+  RunSmallTasks(state, &pool);
+}
+
+void ThreadAndTaskCounts(benchmark::internal::Benchmark* b) {
+  for (int num_threads : {8, 32, 128}) {
+    for (int num_tasks : {64, 1024, 16384}) {
+      b->Args({num_threads, num_tasks});
+    }
+  }
+}
+
+BENCHMARK(BM_ThreadParallelRunner)->Apply(ThreadAndTaskCounts)->UseRealTime();
+BENCHMARK(BM_WorkStealingParallelRunner)
+    ->Apply(ThreadAndTaskCounts)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace jpegxl
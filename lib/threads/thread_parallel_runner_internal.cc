@@ -188,6 +188,16 @@ ThreadParallelRunner::ThreadParallelRunner(const int num_worker_threads)
   // Safely handle spurious worker wakeups.
   worker_start_command_ = kWorkerWait;
 
+#if defined(__linux__)
+  if (sched_getaffinity(0, sizeof(initial_affinity_), &initial_affinity_) !=
+      0) {
+    CPU_ZERO(&initial_affinity_);
+    for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      CPU_SET(cpu, &initial_affinity_);
+    }
+  }
+#endif
+
   for (uint32_t i = 0; i < num_worker_threads_; ++i) {
     threads_.emplace_back(ThreadFunc, this, i);
   }
@@ -202,6 +212,34 @@ ThreadParallelRunner::ThreadParallelRunner(const int num_worker_threads)
       [](const int task, const int thread) { PROFILER_ZONE("@InitWorkers"); });
 }
 
+bool ThreadParallelRunner::SetAffinity(const size_t* cpus,
+                                       const size_t num_cpus) {
+#if defined(__linux__)
+  for (size_t i = 0; i < num_cpus; ++i) {
+    if (cpus[i] >= CPU_SETSIZE) return false;
+  }
+  // Without worker threads, the tasks run on the caller, which is not pinned.
+  if (num_worker_threads_ == 0) return true;
+  std::atomic<bool> ok{true};
+  RunOnEachThread([&](const int task, const int thread) {
+    cpu_set_t cpu_set = initial_affinity_;
+    if (num_cpus != 0) {
+      CPU_ZERO(&cpu_set);
+      CPU_SET(cpus[thread % num_cpus], &cpu_set);
+    }
+    // Thread id 0 means the calling thread.
+    if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+      ok.store(false, std::memory_order_relaxed);
+    }
+  });
+  return ok.load();
+#else
+  (void)cpus;
+  (void)num_cpus;
+  return false;
+#endif
+}
+
 ThreadParallelRunner::~ThreadParallelRunner() {
   if (num_worker_threads_ != 0) {
     StartWorkers(kWorkerExit);
@@ -38,6 +38,10 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
 #include <atomic>
 #include <condition_variable>  //NOLINT
 #include <mutex>               //NOLINT
@@ -85,6 +89,11 @@ class ThreadParallelRunner {
     WorkersReadyBarrier();
   }
 
+  // Pins worker i to CPU cpus[i % num_cpus], or restores the initial affinity
+  // of the workers if num_cpus is zero. Returns false if that fails or is not
+  // supported. Must not be called concurrently with Runner.
+  bool SetAffinity(const size_t* cpus, size_t num_cpus);
+
   JxlMemoryManager memory_manager;
 
  private:
@@ -155,6 +164,11 @@ class ThreadParallelRunner {
   JxlParallelRunFunction data_func_;
   void* jpegxl_opaque_;
 
+#if defined(__linux__)
+  // CPU affinity of the thread that created the workers, which they inherit.
+  cpu_set_t initial_affinity_;
+#endif
+
   // Updated by workers; padding avoids false sharing.
   uint8_t padding1[64];
   std::atomic<uint32_t> num_reserved_{0};
@@ -3,7 +3,19 @@
 // Use of this source code is governed by a BSD-style
 // license that can be found in the LICENSE file.
 
+#include <jxl/resizable_parallel_runner_cxx.h>
+#include <jxl/shared_parallel_runner_cxx.h>
+#include <jxl/work_stealing_parallel_runner_cxx.h>
+
 #include <atomic>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
 
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/test_utils.h"
@@ -119,5 +131,212 @@ TEST(ThreadParallelRunnerTest, TestCounter) {
   EXPECT_EQ(expected, counters[0].counter);
 }
 
+#if defined(__linux__)
+TEST(ThreadParallelRunnerTest, TestAffinity) {
+  cpu_set_t allowed;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+  std::vector<size_t> cpus;
+  for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+  }
+  ASSERT_FALSE(cpus.empty());
+
+  const int kNumThreads = 5;
+  JxlThreadParallelRunnerPtr runner =
+      JxlThreadParallelRunnerMake(nullptr, kNumThreads);
+  ASSERT_EQ(0, JxlThreadParallelRunnerSetAffinity(runner.get(), cpus.data(),
+                                                  cpus.size()));
+  jxl::ThreadPool pool(JxlThreadParallelRunner, runner.get());
+  std::atomic<int> num_misplaced{0};
+  EXPECT_TRUE(RunOnPool(
+      &pool, 0, kNumThreads * 16, jxl::ThreadPool::NoInit,
+      [&](const int task, const int thread) {
+        if (static_cast<size_t>(sched_getcpu()) !=
+            cpus[thread % cpus.size()]) {
+          num_misplaced++;
+        }
+      },
+      "TestAffinity"));
+  EXPECT_EQ(0, num_misplaced.load());
+
+  // Unpinning and invalid CPU numbers.
+  EXPECT_EQ(0, JxlThreadParallelRunnerSetAffinity(runner.get(), nullptr, 0));
+  const size_t invalid_cpu = CPU_SETSIZE;
+  EXPECT_NE(0, JxlThreadParallelRunnerSetAffinity(runner.get(), &invalid_cpu,
+                                                  1));
+}
+#endif
+
+// Same as TestPool, for the work-stealing runner.
+TEST(WorkStealingParallelRunnerTest, TestPool) {
+  for (int num_threads = 0; num_threads <= 18; ++num_threads) {
+    JxlWorkStealingParallelRunnerPtr runner =
+        JxlWorkStealingParallelRunnerMake(nullptr, num_threads);
+    jxl::ThreadPool pool(JxlWorkStealingParallelRunner, runner.get());
+    for (int num_tasks = 0; num_tasks < 32; ++num_tasks) {
+      std::vector<int> mementos(num_tasks);
+      for (int begin = 0; begin < 32; ++begin) {
+        std::fill(mementos.begin(), mementos.end(), 0);
+        EXPECT_TRUE(RunOnPool(
+            &pool, begin, begin + num_tasks, jxl::ThreadPool::NoInit,
+            [begin, num_tasks, &mementos](const int task, const int thread) {
+              EXPECT_GE(task, begin);
+              EXPECT_LT(task, begin + num_tasks);
+              mementos.at(task - begin) += 1000 + task;
+            },
+            "TestPool"));
+        // Every task ran exactly once.
+        for (int task = begin; task < begin + num_tasks; ++task) {
+          EXPECT_EQ(1000 + task, mementos.at(task - begin));
+        }
+      }
+    }
+  }
+}
+
+// Many consecutive calls with more tasks than threads, where the tasks take
+// very different amounts of time, so that threads have to steal work.
+TEST(WorkStealingParallelRunnerTest, TestUnbalancedTasks) {
+  const int kNumThreads = 8;
+  JxlWorkStealingParallelRunnerPtr runner =
+      JxlWorkStealingParallelRunnerMake(nullptr, kNumThreads);
+  jxl::ThreadPool pool(JxlWorkStealingParallelRunner, runner.get());
+  alignas(128) Counter counters[kNumThreads];
+  const int kNumTasks = 1000;
+  int expected = 0;
+  for (int run = 0; run < 100; ++run) {
+    EXPECT_TRUE(RunOnPool(
+        &pool, 0, kNumTasks, jxl::ThreadPool::NoInit,
+        [&counters](const int task, const int thread) {
+          // Make the tasks in the first part of the range much slower.
+          volatile int work = 0;
+          for (int i = 0; i < (task < kNumTasks / 8 ? 1000 : 1); ++i) {
+            work = work + 1;
+          }
+          counters[thread].counter += task;
+        },
+        "TestUnbalancedTasks"));
+    for (int i = 0; i < kNumTasks; ++i) {
+      expected += i;
+    }
+  }
+  for (int i = 1; i < kNumThreads; ++i) {
+    counters[0].Assimilate(counters[i]);
+  }
+  EXPECT_EQ(expected, counters[0].counter);
+}
+
+// Tasks that run the work-stealing runner again, three levels deep.
+TEST(WorkStealingParallelRunnerTest, TestNestedRuns) {
+  for (int num_threads : {1, 2, 7}) {
+    JxlWorkStealingParallelRunnerPtr runner =
+        JxlWorkStealingParallelRunnerMake(nullptr, num_threads);
+    jxl::ThreadPool pool(JxlWorkStealingParallelRunner, runner.get());
+    std::atomic<int> num_leaves{0};
+    std::function<bool(int, uint32_t)> run_level = [&](const int level,
+                                                       const uint32_t num) {
+      return RunOnPool(
+          &pool, 0, num, jxl::ThreadPool::NoInit,
+          [&](const uint32_t task, size_t /*thread*/) {
+            if (level == 0) {
+              num_leaves.fetch_add(1);
+            } else {
+              EXPECT_TRUE(run_level(level - 1, 3 + task % 5));
+            }
+          },
+          "TestNestedRuns");
+    };
+    EXPECT_TRUE(run_level(3, 10));
+    int expected = 0;
+    for (uint32_t a = 0; a < 10; ++a) {
+      for (uint32_t b = 0; b < 3 + a % 5; ++b) {
+        for (uint32_t c = 0; c < 3 + b % 5; ++c) {
+          expected += 3 + c % 5;
+        }
+      }
+    }
+    EXPECT_EQ(expected, num_leaves.load());
+  }
+}
+
+// Several threads use the same shared runner at the same time, each with its
+// own client, like concurrent decoder instances.
+// Runs with a small estimated cost stay on the calling thread, and all tasks
+// run exactly once whatever the hints.
+TEST(ResizableParallelRunnerTest, TestHints) {
+  JxlResizableParallelRunnerPtr runner = JxlResizableParallelRunnerMake(nullptr);
+  JxlResizableParallelRunnerSetThreads(runner.get(), 8);
+  jxl::ThreadPool pool(JxlResizableParallelRunnerWithHints, runner.get());
+  // Estimated cost of a task and the expected number of threads.
+  const std::pair<uint64_t, size_t> kCases[] = {
+      {0, 8}, {1, 1}, {1000, 5}, {1000000, 8}};
+  for (const auto& test_case : kCases) {
+    const uint64_t task_cost_ns = test_case.first;
+    const uint32_t kNumTasks = 100;
+    std::vector<std::atomic<int>> mementos(kNumTasks);
+    for (auto& memento : mementos) memento.store(0);
+    size_t num_threads = 0;
+    EXPECT_TRUE(RunOnPool(
+        &pool, 0, kNumTasks,
+        [&num_threads](size_t num) {
+          num_threads = num;
+          return true;
+        },
+        [&](const uint32_t task, size_t thread) {
+          EXPECT_LT(thread, num_threads);
+          mementos[task].fetch_add(1);
+        },
+        "TestHints", task_cost_ns));
+    EXPECT_EQ(test_case.second, num_threads);
+    for (uint32_t task = 0; task < kNumTasks; ++task) {
+      EXPECT_EQ(1, mementos[task].load());
+    }
+  }
+}
+
+TEST(SharedParallelRunnerTest, TestConcurrentClients) {
+  for (size_t num_workers : {0, 1, 4}) {
+    JxlSharedParallelRunnerPtr runner =
+        JxlSharedParallelRunnerMake(nullptr, num_workers);
+    const int kNumClients = 6;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kNumClients; ++i) {
+      threads.emplace_back([&runner, i]() {
+        JxlSharedParallelRunnerClientPtr client =
+            JxlSharedParallelRunnerMakeClient(runner.get(), i + 1);
+        jxl::ThreadPool pool(JxlSharedParallelRunner, client.get());
+        for (int run = 0; run < 50; ++run) {
+          const uint32_t num_tasks = (run * 37 + i) % 200;
+          std::vector<std::atomic<int>> mementos(num_tasks);
+          for (auto& memento : mementos) memento.store(0);
+          size_t num_threads = 0;
+          EXPECT_TRUE(RunOnPool(
+              &pool, 0, num_tasks,
+              [&num_threads](size_t num) {
+                num_threads = num;
+                return true;
+              },
+              [&](const uint32_t task, size_t thread) {
+                EXPECT_LT(thread, num_threads);
+                mementos[task].fetch_add(1);
+              },
+              "TestConcurrentClients"));
+          for (uint32_t task = 0; task < num_tasks; ++task) {
+            EXPECT_EQ(1, mementos[task].load());
+          }
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+}
+
+TEST(SharedParallelRunnerTest, TestInvalidWeight) {
+  JxlSharedParallelRunnerPtr runner = JxlSharedParallelRunnerMake(nullptr, 2);
+  EXPECT_EQ(nullptr, JxlSharedParallelRunnerCreateClient(runner.get(), 0));
+}
+
 }  // namespace
 }  // namespace jpegxl
@@ -0,0 +1,372 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/work_stealing_parallel_runner.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jpegxl {
+namespace {
+
+// Number of times a waiting thread checks its condition before it blocks.
+constexpr size_t kNumSpins = 1 << 10;
+
+// A thread takes 1/kChunkFraction of the remaining tasks of its own range at
+// a time, but at least one task.
+constexpr uint32_t kChunkFraction = 8;
+
+inline void Pause() {
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__i386__) || defined(__x86_64__))
+  __builtin_ia32_pause();
+#endif
+}
+
+// The tasks [begin, end) are encoded as (begin << 32) + end, so that a range
+// can be shrunk from either side with a single compare-and-swap.
+inline uint64_t PackRange(uint32_t begin, uint32_t end) {
+  return (static_cast<uint64_t>(begin) << 32) + end;
+}
+inline uint32_t RangeBegin(uint64_t range) { return range >> 32; }
+inline uint32_t RangeEnd(uint64_t range) { return range & 0xFFFFFFFF; }
+
+// The runner and the thread index of the current thread, while it runs the
+// tasks of a runner or waits for them.
+thread_local const void* current_runner = nullptr;
+thread_local size_t current_thread = 0;
+
+// A thread pool where each thread (including the calling thread) gets a part
+// of the range of tasks. Threads take chunks from the front of their own
+// range, and when it is empty, they steal the back half of the range of
+// another thread.
+//
+// Tasks may call Run again (nested runs). Every Run call uses its own job,
+// which idle workers help with; the thread that called Run only runs the
+// tasks of its own job until they are all done, so that it cannot end up
+// waiting for itself.
+struct WorkStealingParallelRunner {
+  explicit WorkStealingParallelRunner(size_t num_threads)
+      : num_threads_(std::max<size_t>(num_threads, 1)), jobs_(kMaxJobs) {
+    for (Job& job : jobs_) {
+      job.ranges = std::vector<Range>(num_threads_);
+      // Suppress "unused-field" warning.
+      (void)job.padding;
+    }
+    workers_.reserve(num_threads_ - 1);
+    for (size_t i = 1; i < num_threads_; ++i) {
+      workers_.emplace_back([this, i]() { WorkerBody(i); });
+    }
+  }
+
+  ~WorkStealingParallelRunner() {
+    exit_.store(true);
+    Notify(&num_parked_workers_, &workers_can_proceed_);
+    for (std::thread& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  JxlParallelRetCode Run(void* jxl_opaque, JxlParallelRunInit init,
+                         JxlParallelRunFunction func, uint32_t start,
+                         uint32_t end) {
+    if (start > end) return -1;
+    if (start == end) return 0;
+
+    const bool nested = (current_runner == this);
+    if (!nested && depth_.fetch_add(1, std::memory_order_acq_rel) != 0) {
+      depth_.fetch_add(-1, std::memory_order_acq_rel);
+      return -1;  // Only nested calls may overlap.
+    }
+    const JxlParallelRetCode ret =
+        nested ? RunJob(jxl_opaque, init, func, start, end, current_thread)
+               : RunTopLevelJob(jxl_opaque, init, func, start, end);
+    if (!nested) depth_.fetch_add(-1, std::memory_order_acq_rel);
+    return ret;
+  }
+
+ private:
+  // Maximum number of Run calls that are in progress at the same time. Once
+  // all jobs are taken, nested calls run their tasks on the calling thread.
+  static constexpr size_t kMaxJobs = 32;
+
+  // The tasks of one thread that are not taken yet. Padding avoids false
+  // sharing.
+  struct Range {
+    Range() : tasks(0) {}
+    std::atomic<uint64_t> tasks;
+    uint8_t padding[64 - sizeof(std::atomic<uint64_t>)];
+  };
+
+  // The state of one Run call.
+  struct Job {
+    // Set while a Run call uses this job.
+    std::atomic<bool> claimed{false};
+    // Set while other threads may take tasks of this job.
+    std::atomic<bool> active{false};
+    // Number of threads that may be looking at the tasks of this job, apart
+    // from the one that called Run.
+    std::atomic<uint32_t> num_helpers{0};
+    std::atomic<uint64_t> num_pending_tasks{0};
+    // Function to run and its argument, written before active is set.
+    JxlParallelRunFunction func = nullptr;
+    void* jxl_opaque = nullptr;  // not owned
+    std::vector<Range> ranges;
+    uint8_t padding[64];
+  };
+
+  JxlParallelRetCode RunTopLevelJob(void* jxl_opaque, JxlParallelRunInit init,
+                                    JxlParallelRunFunction func,
+                                    uint32_t start, uint32_t end) {
+    const void* saved_runner = current_runner;
+    const size_t saved_thread = current_thread;
+    current_runner = this;
+    current_thread = 0;
+    const JxlParallelRetCode ret =
+        RunJob(jxl_opaque, init, func, start, end, /*thread=*/0);
+    current_runner = saved_runner;
+    current_thread = saved_thread;
+    return ret;
+  }
+
+  JxlParallelRetCode RunJob(void* jxl_opaque, JxlParallelRunInit init,
+                            JxlParallelRunFunction func, uint32_t start,
+                            uint32_t end, size_t thread) {
+    Job* job = (num_threads_ == 1 || start + 1 == end) ? nullptr : ClaimJob();
+    if (job == nullptr) {
+      JxlParallelRetCode ret = init(jxl_opaque, 1);
+      if (ret != 0) return ret;
+      for (uint32_t task = start; task < end; ++task) {
+        func(jxl_opaque, task, 0);
+      }
+      return 0;
+    }
+
+    JxlParallelRetCode ret = init(jxl_opaque, num_threads_);
+    if (ret != 0) {
+      job->claimed.store(false, std::memory_order_release);
+      return ret;
+    }
+
+    job->func = func;
+    job->jxl_opaque = jxl_opaque;
+    const uint64_t num_tasks = end - start;
+    job->num_pending_tasks.store(num_tasks, std::memory_order_relaxed);
+    for (size_t i = 0; i < num_threads_; ++i) {
+      job->ranges[i].tasks.store(
+          PackRange(start + num_tasks * i / num_threads_,
+                    start + num_tasks * (i + 1) / num_threads_),
+          std::memory_order_relaxed);
+    }
+    job->active.store(true);
+    work_generation_.fetch_add(1);
+    Notify(&num_parked_workers_, &workers_can_proceed_);
+
+    RunTasks(job, thread);
+
+    SpinThenPark(&num_parked_callers_, &work_done_, [job]() {
+      return job->num_pending_tasks.load(std::memory_order_acquire) == 0;
+    });
+    // Some workers may still be looking for tasks to steal.
+    job->active.store(false);
+    SpinThenPark(&num_parked_callers_, &work_done_,
+                 [job]() { return job->num_helpers.load() == 0; });
+    job->claimed.store(false, std::memory_order_release);
+    return 0;
+  }
+
+  Job* ClaimJob() {
+    for (Job& job : jobs_) {
+      bool claimed = false;
+      if (!job.claimed.load(std::memory_order_relaxed) &&
+          job.claimed.compare_exchange_strong(claimed, true,
+                                              std::memory_order_acquire)) {
+        return &job;
+      }
+    }
+    return nullptr;
+  }
+
+  void WorkerBody(size_t thread) {
+    current_runner = this;
+    current_thread = thread;
+    while (true) {
+      // Jobs that become active after this load increment it.
+      const uint32_t generation = work_generation_.load();
+      if (HelpJobs(thread)) continue;
+      SpinThenPark(&num_parked_workers_, &workers_can_proceed_, [&]() {
+        return exit_.load() || work_generation_.load() != generation;
+      });
+      if (exit_.load()) return;
+    }
+  }
+
+  // Runs the tasks of all active jobs that are not taken yet. Returns true
+  // if it ran any task.
+  bool HelpJobs(size_t thread) {
+    bool ran_tasks = false;
+    for (Job& job : jobs_) {
+      if (!job.active.load(std::memory_order_relaxed)) continue;
+      job.num_helpers.fetch_add(1);
+      // The thread that called Run may have finished in the meantime.
+      if (job.active.load()) {
+        ran_tasks |= RunTasks(&job, thread);
+      }
+      if (job.num_helpers.fetch_sub(1) == 1) {
+        Notify(&num_parked_callers_, &work_done_);
+      }
+    }
+    return ran_tasks;
+  }
+
+  // Runs tasks of the job until there is nothing left to take or steal.
+  // Returns true if it ran any task.
+  bool RunTasks(Job* job, size_t thread) {
+    bool ran_tasks = false;
+    uint32_t begin;
+    uint32_t end;
+    while (true) {
+      if (!TakeChunk(job, thread, &begin, &end)) {
+        if (!Steal(job, thread)) return ran_tasks;
+        // Other threads may steal the stolen tasks before we take them.
+        continue;
+      }
+      for (uint32_t task = begin; task < end; ++task) {
+        job->func(job->jxl_opaque, task, thread);
+      }
+      ran_tasks = true;
+      const uint32_t num_done = end - begin;
+      if (job->num_pending_tasks.fetch_sub(
+              num_done, std::memory_order_acq_rel) == num_done) {
+        Notify(&num_parked_callers_, &work_done_);
+      }
+    }
+  }
+
+  // Takes a chunk of tasks from the front of the range of the given thread.
+  // The chunk size decreases with the number of remaining tasks, so that
+  // there is still work to steal towards the end.
+  static bool TakeChunk(Job* job, size_t thread, uint32_t* begin,
+                        uint32_t* end) {
+    std::atomic<uint64_t>& tasks = job->ranges[thread].tasks;
+    uint64_t range = tasks.load(std::memory_order_relaxed);
+    while (true) {
+      const uint32_t range_begin = RangeBegin(range);
+      const uint32_t range_end = RangeEnd(range);
+      if (range_begin >= range_end) return false;
+      const uint32_t size =
+          std::max<uint32_t>((range_end - range_begin) / kChunkFraction, 1);
+      if (tasks.compare_exchange_weak(range,
+                                      PackRange(range_begin + size, range_end),
+                                      std::memory_order_relaxed)) {
+        *begin = range_begin;
+        *end = range_begin + size;
+        return true;
+      }
+    }
+  }
+
+  // Moves the back half of the range of another thread to the (empty) range
+  // of the given thread. Returns false if all ranges are empty.
+  bool Steal(Job* job, size_t thread) const {
+    for (size_t i = 1; i < num_threads_; ++i) {
+      std::atomic<uint64_t>& victim =
+          job->ranges[(thread + i) % num_threads_].tasks;
+      uint64_t range = victim.load(std::memory_order_relaxed);
+      while (true) {
+        const uint32_t range_begin = RangeBegin(range);
+        const uint32_t range_end = RangeEnd(range);
+        if (range_begin >= range_end) break;
+        const uint32_t mid = range_end - (range_end - range_begin + 1) / 2;
+        if (victim.compare_exchange_weak(range, PackRange(range_begin, mid),
+                                         std::memory_order_relaxed)) {
+          // Only this thread adds tasks to its own range, and other threads
+          // do not modify it while it is empty.
+          job->ranges[thread].tasks.store(PackRange(mid, range_end),
+                                          std::memory_order_relaxed);
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // Waits until pred() is true. Spins for a while first, since the condition
+  // usually becomes true soon, and then blocks on the condition variable.
+  // Whoever makes the condition true must call Notify with the same
+  // arguments afterwards.
+  template <class Pred>
+  void SpinThenPark(std::atomic<uint32_t>* num_parked,
+                    std::condition_variable* cv, const Pred& pred) {
+    for (size_t i = 0; i < kNumSpins; ++i) {
+      if (pred()) return;
+      // Give up the time slice from time to time in case there are more
+      // threads than cores.
+      if ((i % 64) == 63) {
+        std::this_thread::yield();
+      } else {
+        Pause();
+      }
+    }
+    std::unique_lock<std::mutex> l(mutex_);
+    num_parked->fetch_add(1);
+    while (!pred()) {
+      cv->wait(l);
+    }
+    num_parked->fetch_sub(1);
+  }
+
+  // Wakes up the threads blocked in SpinThenPark, if there are any.
+  void Notify(std::atomic<uint32_t>* num_parked, std::condition_variable* cv) {
+    if (num_parked->load() == 0) return;
+    // Taking the lock ensures that a thread that saw the old state in
+    // SpinThenPark is already waiting on the condition variable.
+    { std::unique_lock<std::mutex> l(mutex_); }
+    cv->notify_all();
+  }
+
+  const size_t num_threads_;
+  std::vector<Job> jobs_;
+  std::vector<std::thread> workers_;
+
+  // Counts the top-level Run calls, which must not overlap.
+  std::atomic<int> depth_{0};
+  std::atomic<bool> exit_{false};
+  // Incremented every time a job becomes active.
+  std::atomic<uint32_t> work_generation_{0};
+
+  // Only guards blocking in SpinThenPark.
+  std::mutex mutex_;
+  std::condition_variable workers_can_proceed_;
+  std::atomic<uint32_t> num_parked_workers_{0};
+  std::condition_variable work_done_;
+  std::atomic<uint32_t> num_parked_callers_{0};
+};
+
+}  // namespace
+}  // namespace jpegxl
+
+extern "C" {
+JXL_THREADS_EXPORT JxlParallelRetCode JxlWorkStealingParallelRunner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range) {
+  return static_cast<jpegxl::WorkStealingParallelRunner*>(runner_opaque)
+      ->Run(jpegxl_opaque, init, func, start_range, end_range);
+}
+
+JXL_THREADS_EXPORT void* JxlWorkStealingParallelRunnerCreate(
+    const JxlMemoryManager* memory_manager, size_t num_threads) {
+  return new jpegxl::WorkStealingParallelRunner(num_threads);
+}
+
+JXL_THREADS_EXPORT void JxlWorkStealingParallelRunnerDestroy(
+    void* runner_opaque) {
+  delete static_cast<jpegxl::WorkStealingParallelRunner*>(runner_opaque);
+}
+}
@@ -50,7 +50,20 @@ struct _GdkPixbufJxlAnimation {
   // load_increment afterwards gives an error.
   gboolean done;
 
-  // Image information.
+  // Input not consumed by the decoder yet. The frames of an animation are only
+  // decoded when an iterator reaches them, so that the rest of the stream waits
+  // here; `frames_wanted` is the number of frames to decode so far.
+  GByteArray *pending_input;
+  size_t frames_wanted;
+
+  // Rows of the current frame written by draw_pixels, on the threads of the
+  // parallel runner, and not yet reported to area_updated_callback.
+  GMutex updated_rows_mutex;
+  size_t updated_y0;
+  size_t updated_y1;
+
+  // Image information; the size is the one of the output, which is
+  // downsampled when a smaller size is requested.
   size_t xsize;
   size_t ysize;
   gboolean alpha_premultiplied;
@@ -72,6 +85,9 @@ G_DECLARE_FINAL_TYPE(GdkPixbufJxlAnimation, gdk_pixbuf_jxl_animation, GDK,
 G_DEFINE_TYPE(GdkPixbufJxlAnimation, gdk_pixbuf_jxl_animation,
               GDK_TYPE_PIXBUF_ANIMATION);
 
+static gboolean decode_input(GdkPixbufJxlAnimation *decoder_state,
+                             const guchar *buf, size_t size, GError **error);
+
 // Iterator to a given point in time in the animation; contains a pointer to the
 // full animation.
 struct _GdkPixbufJxlAnimationIter {
@@ -93,6 +109,7 @@ static void gdk_pixbuf_jxl_animation_init(GdkPixbufJxlAnimation *obj) {
   (void)glib_autoptr_cleanup_GdkPixbufJxlAnimation;
   (void)GDK_JXL_ANIMATION;
   (void)GDK_IS_JXL_ANIMATION;
+  g_mutex_init(&obj->updated_rows_mutex);
 }
 
 static gboolean gdk_pixbuf_jxl_animation_is_static_image(
@@ -144,9 +161,13 @@ static void gdk_pixbuf_jxl_animation_finalize(GObject *obj) {
     }
     g_array_free(decoder_state->frames, /*free_segment=*/TRUE);
   }
+  if (decoder_state->pending_input != NULL) {
+    g_byte_array_free(decoder_state->pending_input, /*free_segment=*/TRUE);
+  }
   JxlResizableParallelRunnerDestroy(decoder_state->parallel_runner);
   JxlDecoderDestroy(decoder_state->decoder);
   g_free(decoder_state->icc_buff);
+  g_mutex_clear(&decoder_state->updated_rows_mutex);
 }
 
 static void gdk_pixbuf_jxl_animation_class_init(
@@ -203,12 +224,28 @@ G_GNUC_BEGIN_IGNORE_DEPRECATIONS
 static gboolean gdk_pixbuf_jxl_animation_iter_advance(
     GdkPixbufAnimationIter *iter, const GTimeVal *current_time) {
   GdkPixbufJxlAnimationIter *jxl_iter = (GdkPixbufJxlAnimationIter *)iter;
+  GdkPixbufJxlAnimation *animation = jxl_iter->animation;
   size_t old_frame = jxl_iter->current_frame;
 
   uint64_t current_time_ms = current_time->tv_sec * 1000ULL +
                              current_time->tv_usec / 1000 -
                              jxl_iter->time_offset;
 
+  // Decodes the frames up to the current time, if their input is available;
+  // otherwise load_increment decodes them when it arrives.
+  while (!animation->done && animation->frames->len > 0 &&
+         animation->frames->len >= animation->frames_wanted &&
+         current_time_ms >= animation->total_duration_ms) {
+    animation->frames_wanted = animation->frames->len + 1;
+    GError *error = NULL;
+    if (!decode_input(animation, NULL, 0, &error)) {
+      g_warning("Failed to decode JXL animation frame: %s", error->message);
+      g_error_free(error);
+      // Shows the frames decoded so far.
+      animation->done = TRUE;
+    }
+  }
+
   if (jxl_iter->animation->frames->len == 0) {
     jxl_iter->current_frame = 0;
   } else if (!jxl_iter->animation->done &&
@@ -277,8 +314,10 @@ static gpointer begin_load(GdkPixbufModuleSizeFunc size_func,
   decoder_state->frames =
       g_array_new(/*zero_terminated=*/FALSE, /*clear_=*/TRUE,
                   sizeof(GdkPixbufJxlAnimationFrame));
+  decoder_state->pending_input = g_byte_array_new();
+  decoder_state->frames_wanted = 1;
 
-  if (decoder_state->frames == NULL) {
+  if (decoder_state->frames == NULL || decoder_state->pending_input == NULL) {
     g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
                 "Creation of the frame array failed");
     goto cleanup;
@@ -327,6 +366,13 @@ cleanup:
 }
 
 static gboolean stop_load(gpointer context, GError **error) {
+  GdkPixbufJxlAnimation *decoder_state = context;
+  // The loader, which is the user data of the callbacks, may be destroyed
+  // before the animation, whose frames are still decoded afterwards.
+  decoder_state->image_size_callback = NULL;
+  decoder_state->pixbuf_prepared_callback = NULL;
+  decoder_state->area_updated_callback = NULL;
+  decoder_state->user_data = NULL;
   g_object_unref(context);
   return TRUE;
 }
@@ -353,32 +399,77 @@ static void draw_pixels(void *context, size_t x, size_t y, size_t num_pixels,
       &decoder_state->icc, dst,
       has_alpha ? skcms_PixelFormat_RGBA_8888 : skcms_PixelFormat_RGB_888,
       skcms_AlphaFormat_Unpremul, skcms_sRGB_profile(), num_pixels);
-}
 
-static gboolean load_increment(gpointer context, const guchar *buf, guint size,
-                               GError **error) {
-  GdkPixbufJxlAnimation *decoder_state = context;
-  if (decoder_state->done == TRUE) {
-    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
-                "JXL decoder load_increment called after end of file");
-    return FALSE;
+  g_mutex_lock(&decoder_state->updated_rows_mutex);
+  if (decoder_state->updated_y0 >= decoder_state->updated_y1) {
+    decoder_state->updated_y0 = y;
+    decoder_state->updated_y1 = y + 1;
+  } else {
+    decoder_state->updated_y0 = MIN(decoder_state->updated_y0, y);
+    decoder_state->updated_y1 = MAX(decoder_state->updated_y1, y + 1);
   }
+  g_mutex_unlock(&decoder_state->updated_rows_mutex);
+}
 
-  JxlDecoderStatus status;
+// Reports the rows of the current frame written since the last call, so that
+// the groups are shown as soon as they are decoded.
+static void report_updated_rows(GdkPixbufJxlAnimation *decoder_state) {
+  g_mutex_lock(&decoder_state->updated_rows_mutex);
+  size_t y0 = decoder_state->updated_y0;
+  size_t y1 = decoder_state->updated_y1;
+  decoder_state->updated_y0 = 0;
+  decoder_state->updated_y1 = 0;
+  g_mutex_unlock(&decoder_state->updated_rows_mutex);
+  if (y0 >= y1 || !decoder_state->area_updated_callback) return;
+  GdkPixbuf *output =
+      g_array_index(decoder_state->frames, GdkPixbufJxlAnimationFrame,
+                    decoder_state->frames->len - 1)
+          .data;
+  decoder_state->area_updated_callback(output, 0, y0,
+                                       gdk_pixbuf_get_width(output), y1 - y0,
+                                       decoder_state->user_data);
+}
 
-  if ((status = JxlDecoderSetInput(decoder_state->decoder, buf, size)) !=
-      JXL_DEC_SUCCESS) {
-    // Should never happen if things are done properly.
-    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
-                "JXL decoder logic error: %x", status);
-    return FALSE;
+// Returns the largest downsampling factor of the decoder for which the output
+// is at least `width` x `height`, so that the decoder skips the details that
+// the GdkPixbufLoader would discard when scaling to the requested size.
+static uint32_t downsampling_for_size(size_t xsize, size_t ysize, gint width,
+                                      gint height) {
+  uint32_t downsampling = 1;
+  while (downsampling < 8) {
+    size_t next = downsampling * 2;
+    if ((xsize + next - 1) / next < (size_t)width ||
+        (ysize + next - 1) / next < (size_t)height) {
+      break;
+    }
+    downsampling = next;
   }
+  return downsampling;
+}
+
+// Whether the frames that an iterator needs so far are decoded; the frames of
+// still images are all decoded.
+static gboolean has_wanted_frames(GdkPixbufJxlAnimation *decoder_state) {
+  size_t num_frames = decoder_state->frames->len;
+  return decoder_state->has_animation &&
+         num_frames >= decoder_state->frames_wanted &&
+         g_array_index(decoder_state->frames, GdkPixbufJxlAnimationFrame,
+                       num_frames - 1)
+             .decoded;
+}
+
+// Processes the input set in the decoder until it needs more input, or until
+// the frames wanted by the iterators are decoded.
+static gboolean process_input(GdkPixbufJxlAnimation *decoder_state,
+                              GError **error) {
+  JxlDecoderStatus status;
 
   for (;;) {
+    if (has_wanted_frames(decoder_state)) return TRUE;
     status = JxlDecoderProcessInput(decoder_state->decoder);
     switch (status) {
       case JXL_DEC_NEED_MORE_INPUT: {
-        JxlDecoderReleaseInput(decoder_state->decoder);
+        report_updated_rows(decoder_state);
         return TRUE;
       }
 
@@ -415,6 +506,17 @@ static gboolean load_increment(gpointer context, const guchar *buf, guint size,
           return TRUE;
         }
 
+        // Thumbnails and other small sizes are decoded at a lower resolution;
+        // GdkPixbufLoader scales the output to the requested size.
+        uint32_t downsampling =
+            downsampling_for_size(info.xsize, info.ysize, width, height);
+        if (downsampling > 1 &&
+            JxlDecoderSetOutputDownsampling(decoder_state->decoder,
+                                            downsampling) == JXL_DEC_SUCCESS) {
+          decoder_state->xsize = (info.xsize + downsampling - 1) / downsampling;
+          decoder_state->ysize = (info.ysize + downsampling - 1) / downsampling;
+        }
+
         // Set an appropriate number of threads for the image size.
         JxlResizableParallelRunnerSetThreads(
             decoder_state->parallel_runner,
@@ -457,7 +559,6 @@ static gboolean load_increment(gpointer context, const guchar *buf, guint size,
       }
 
       case JXL_DEC_FRAME: {
-        // TODO(veluca): support rescaling.
         JxlFrameHeader frame_header;
         if (JxlDecoderGetFrameHeader(decoder_state->decoder, &frame_header) !=
             JXL_DEC_SUCCESS) {
@@ -511,11 +612,13 @@ static gboolean load_increment(gpointer context, const guchar *buf, guint size,
       }
 
       case JXL_DEC_FULL_IMAGE: {
-        // TODO(veluca): consider doing partial updates.
+        decoder_state->updated_y0 = 0;
+        decoder_state->updated_y1 = 0;
         if (decoder_state->area_updated_callback) {
-          GdkPixbuf *output = g_array_index(decoder_state->frames,
-                                            GdkPixbufJxlAnimationFrame, 0)
-                                  .data;
+          GdkPixbuf *output =
+              g_array_index(decoder_state->frames, GdkPixbufJxlAnimationFrame,
+                            decoder_state->frames->len - 1)
+                  .data;
           decoder_state->area_updated_callback(
               output, 0, 0, gdk_pixbuf_get_width(output),
               gdk_pixbuf_get_height(output), decoder_state->user_data);
@@ -542,6 +645,48 @@ static gboolean load_increment(gpointer context, const guchar *buf, guint size,
   return TRUE;
 }
 
+// Decodes `size` bytes of `buf` after the pending input, and keeps the bytes
+// that the decoder did not consume for the next call.
+static gboolean decode_input(GdkPixbufJxlAnimation *decoder_state,
+                             const guchar *buf, size_t size, GError **error) {
+  GByteArray *pending = decoder_state->pending_input;
+  const guchar *input = buf;
+  size_t input_size = size;
+  if (pending->len != 0) {
+    if (size != 0) g_byte_array_append(pending, buf, size);
+    input = pending->data;
+    input_size = pending->len;
+  }
+
+  JxlDecoderStatus status;
+  if ((status = JxlDecoderSetInput(decoder_state->decoder, input,
+                                   input_size)) != JXL_DEC_SUCCESS) {
+    // Should never happen if things are done properly.
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+                "JXL decoder logic error: %x", status);
+    return FALSE;
+  }
+  gboolean ok = process_input(decoder_state, error);
+  size_t remaining = JxlDecoderReleaseInput(decoder_state->decoder);
+  if (input == buf) {
+    g_byte_array_append(pending, buf + size - remaining, remaining);
+  } else {
+    g_byte_array_remove_range(pending, 0, input_size - remaining);
+  }
+  return ok;
+}
+
+static gboolean load_increment(gpointer context, const guchar *buf, guint size,
+                               GError **error) {
+  GdkPixbufJxlAnimation *decoder_state = context;
+  if (decoder_state->done == TRUE) {
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+                "JXL decoder load_increment called after end of file");
+    return FALSE;
+  }
+  return decode_input(decoder_state, buf, size, error);
+}
+
 static gboolean jxl_is_save_option_supported(const gchar *option_key) {
   if (g_strcmp0(option_key, "quality") == 0) {
     return TRUE;
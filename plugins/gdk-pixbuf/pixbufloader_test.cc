@@ -32,10 +32,29 @@ int main(int argc, char* argv[]) {
   GdkPixbuf* pb = gdk_pixbuf_new_from_file(filename, &error);
   if (pb != nullptr) {
     g_object_unref(pb);
-    return 0;
   } else {
     fprintf(stderr, "Error loading file: %s\n", filename);
     g_assert_no_error(error);
     return 1;
   }
+
+  // Small sizes, as requested by thumbnailers, are decoded at a lower
+  // resolution and then scaled to the requested size.
+  const int kThumbnailSize = 16;
+  pb = gdk_pixbuf_new_from_file_at_size(filename, kThumbnailSize,
+                                        kThumbnailSize, &error);
+  if (pb == nullptr) {
+    fprintf(stderr, "Error loading file at size: %s\n", filename);
+    g_assert_no_error(error);
+    return 1;
+  }
+  const int width = gdk_pixbuf_get_width(pb);
+  const int height = gdk_pixbuf_get_height(pb);
+  g_object_unref(pb);
+  if (width > kThumbnailSize || height > kThumbnailSize ||
+      (width != kThumbnailSize && height != kThumbnailSize)) {
+    fprintf(stderr, "Unexpected size %dx%d of %s\n", width, height, filename);
+    return 1;
+  }
+  return 0;
 }
@@ -8,31 +8,59 @@
 #include <jxl/decode.h>
 #include <jxl/decode_cxx.h>
 
+#include <algorithm>
+
 #define _PROFILE_ORIGIN_ JXL_COLOR_PROFILE_TARGET_ORIGINAL
 #define _PROFILE_TARGET_ JXL_COLOR_PROFILE_TARGET_DATA
 #define LOAD_PROC "file-jxl-load"
 
 namespace jxl {
 
+namespace {
+
+// Frames decoded at the same time when they don't depend on each other; each
+// one keeps its pixels in memory until it is added as a layer.
+constexpr uint32_t kMaxParallelFrames = 4;
+
+// Sets the output buffer of the current frame, which is reused for all frames
+// since their size is the same with coalescing.
 bool SetJpegXlOutBuffer(
     std::unique_ptr<JxlDecoderStruct, JxlDecoderDestroyStruct> *dec,
-    JxlPixelFormat *format, size_t *buffer_size, gpointer *pixels_buffer_1) {
+    JxlPixelFormat *format, std::vector<uint8_t> *pixels) {
+  size_t buffer_size;
   if (JXL_DEC_SUCCESS !=
-      JxlDecoderImageOutBufferSize(dec->get(), format, buffer_size)) {
+      JxlDecoderImageOutBufferSize(dec->get(), format, &buffer_size)) {
     g_printerr(LOAD_PROC " Error: JxlDecoderImageOutBufferSize failed\n");
     return false;
   }
-  *pixels_buffer_1 = g_malloc(*buffer_size);
+  pixels->resize(buffer_size);
   if (JXL_DEC_SUCCESS != JxlDecoderSetImageOutBuffer(dec->get(), format,
-                                                     *pixels_buffer_1,
-                                                     *buffer_size)) {
+                                                     pixels->data(),
+                                                     pixels->size())) {
     g_printerr(LOAD_PROC " Error: JxlDecoderSetImageOutBuffer failed\n");
     return false;
   }
   return true;
 }
 
-bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
+// Returns the largest downsampling factor of the decoder for which the larger
+// side of the image is at least `size`; with 8, VarDCT images are rendered
+// from their DC only.
+uint32_t DownsamplingForSize(size_t xsize, size_t ysize, size_t size) {
+  const size_t max_side = std::max(xsize, ysize);
+  uint32_t downsampling = 1;
+  while (downsampling < 8 &&
+         (max_side + 2 * downsampling - 1) / (2 * downsampling) >= size) {
+    downsampling *= 2;
+  }
+  return downsampling;
+}
+
+// Loads the image, downsampled to at least `thumb_size` pixels on its larger
+// side unless it is 0; `width` and `height` are set to the size of the file.
+bool LoadImage(const gchar *const filename, const size_t thumb_size,
+               gint32 *const image_id, gint *const width,
+               gint *const height) {
   bool stop_processing = false;
   JxlDecoderStatus status = JXL_DEC_NEED_MORE_INPUT;
   std::vector<uint8_t> icc_profile;
@@ -47,9 +75,9 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
 
   gint32 layer;
 
-  gpointer pixels_buffer_1 = nullptr;
-  gpointer pixels_buffer_2 = nullptr;
-  size_t buffer_size = 0;
+  std::vector<uint8_t> pixels;
+  uint32_t downsampling = 1;
+  const char *babl_type = "float";
 
   GimpImageBaseType image_type = GIMP_RGB;
   GimpImageType layer_type = GIMP_RGB_IMAGE;
@@ -85,10 +113,10 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
 
   auto dec = JxlDecoderMake(nullptr);
   if (JXL_DEC_SUCCESS !=
-      JxlDecoderSubscribeEvents(
-          dec.get(), JXL_DEC_BASIC_INFO | JXL_DEC_COLOR_ENCODING |
-                         JXL_DEC_FULL_IMAGE | JXL_DEC_FRAME_PROGRESSION |
-                         JXL_DEC_FRAME)) {
+      JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_BASIC_INFO |
+                                               JXL_DEC_COLOR_ENCODING |
+                                               JXL_DEC_FULL_IMAGE |
+                                               JXL_DEC_FRAME)) {
     g_printerr(LOAD_PROC " Error: JxlDecoderSubscribeEvents failed\n");
     return false;
   }
@@ -106,15 +134,17 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
     return false;
   }
 
+  // Only the pixels of whole frames are needed, so that the layers that don't
+  // depend on each other can be decoded at the same time.
+  if (thumb_size == 0 &&
+      JXL_DEC_SUCCESS !=
+          JxlDecoderSetParallelFrames(dec.get(), kMaxParallelFrames)) {
+    g_printerr(LOAD_PROC " Warning: JxlDecoderSetParallelFrames failed\n");
+  }
+
   // grand decode loop...
   JxlDecoderSetInput(dec.get(), compressed.data(), compressed.size());
 
-  if (JXL_DEC_SUCCESS != JxlDecoderSetProgressiveDetail(
-                             dec.get(), JxlProgressiveDetail::kPasses)) {
-    g_printerr(LOAD_PROC " Error: JxlDecoderSetProgressiveDetail failed\n");
-    return false;
-  }
-
   while (true) {
     gimp_load_progress.update();
 
@@ -128,6 +158,20 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
 
       xsize = info.xsize;
       ysize = info.ysize;
+      *width = info.xsize;
+      *height = info.ysize;
+      if (thumb_size != 0) {
+        downsampling = DownsamplingForSize(xsize, ysize, thumb_size);
+        if (downsampling > 1 &&
+            JXL_DEC_SUCCESS !=
+                JxlDecoderSetOutputDownsampling(dec.get(), downsampling)) {
+          g_printerr(LOAD_PROC
+                     " Warning: JxlDecoderSetOutputDownsampling failed\n");
+          downsampling = 1;
+        }
+        xsize = (xsize + downsampling - 1) / downsampling;
+        ysize = (ysize + downsampling - 1) / downsampling;
+      }
       if (info.have_animation) {
         animation = info.animation;
         tps_denom = animation.tps_denominator;
@@ -296,8 +340,11 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
         }
       }
 
-      // Set image bit depth and linearity
+      // Set image bit depth and linearity, and decode in the same type so
+      // that the pixels are copied to the layers without conversion.
       if (info.bits_per_sample <= 8) {
+        format.data_type = JXL_TYPE_UINT8;
+        babl_type = "u8";
         if (is_linear) {
           precision = GIMP_PRECISION_U8_LINEAR;
         } else {
@@ -305,38 +352,36 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
         }
       } else if (info.bits_per_sample <= 16) {
         if (info.exponent_bits_per_sample > 0) {
+          format.data_type = JXL_TYPE_FLOAT16;
+          babl_type = "half";
           if (is_linear) {
             precision = GIMP_PRECISION_HALF_LINEAR;
           } else {
             precision = GIMP_PRECISION_HALF_GAMMA;
           }
-        } else if (is_linear) {
-          precision = GIMP_PRECISION_U16_LINEAR;
         } else {
-          precision = GIMP_PRECISION_U16_GAMMA;
-        }
-      } else {
-        if (info.exponent_bits_per_sample > 0) {
+          format.data_type = JXL_TYPE_UINT16;
+          babl_type = "u16";
           if (is_linear) {
-            precision = GIMP_PRECISION_FLOAT_LINEAR;
+            precision = GIMP_PRECISION_U16_LINEAR;
           } else {
-            precision = GIMP_PRECISION_FLOAT_GAMMA;
+            precision = GIMP_PRECISION_U16_GAMMA;
           }
-        } else if (is_linear) {
-          precision = GIMP_PRECISION_U32_LINEAR;
+        }
+      } else {
+        // TODO(xiota): Add option to convert 32-bit integer images to U32
+        format.data_type = JXL_TYPE_FLOAT;
+        babl_type = "float";
+        if (is_linear) {
+          precision = GIMP_PRECISION_FLOAT_LINEAR;
         } else {
-          precision = GIMP_PRECISION_U32_GAMMA;
+          precision = GIMP_PRECISION_FLOAT_GAMMA;
         }
       }
 
       // create new image
-      if (is_linear) {
-        *image_id = gimp_image_new_with_precision(xsize, ysize, image_type,
-                                                  GIMP_PRECISION_FLOAT_LINEAR);
-      } else {
-        *image_id = gimp_image_new_with_precision(xsize, ysize, image_type,
-                                                  GIMP_PRECISION_FLOAT_GAMMA);
-      }
+      *image_id =
+          gimp_image_new_with_precision(xsize, ysize, image_type, precision);
 
       if (profile_int) {
         gimp_image_set_color_profile(*image_id, profile_int);
@@ -344,10 +389,7 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
         g_printerr(LOAD_PROC " Warning: No color profile.\n");
       }
     } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
-      // get image from decoder in FLOAT
-      format.data_type = JXL_TYPE_FLOAT;
-      if (!SetJpegXlOutBuffer(&dec, &format, &buffer_size, &pixels_buffer_1))
-        return false;
+      if (!SetJpegXlOutBuffer(&dec, &format, &pixels)) return false;
     } else if (status == JXL_DEC_FULL_IMAGE) {
       // create and insert layer
       gchar *layer_name;
@@ -385,33 +427,28 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
       gimp_image_insert_layer(*image_id, layer, /*parent_id=*/-1,
                               /*position=*/0);
 
-      pixels_buffer_2 = g_malloc(buffer_size);
       GeglBuffer *buffer = gimp_drawable_get_buffer(layer);
-      const Babl *destination_format = gegl_buffer_set_format(buffer, nullptr);
 
+      // The pixels are in the format of the layer, so GEGL copies them as is.
       std::string babl_format_str = "";
       if (is_gray) {
-        babl_format_str += "Y'";
+        babl_format_str += is_linear ? "Y" : "Y'";
       } else {
-        babl_format_str += "R'G'B'";
+        babl_format_str += is_linear ? "RGB" : "R'G'B'";
       }
       if (info.alpha_bits > 0) {
         babl_format_str += "A";
       }
-      babl_format_str += " float";
+      babl_format_str += " ";
+      babl_format_str += babl_type;
 
       const Babl *source_format = babl_format(babl_format_str.c_str());
 
-      babl_process(babl_fish(source_format, destination_format),
-                   pixels_buffer_1, pixels_buffer_2, xsize * ysize);
-
-      gegl_buffer_set(buffer, GEGL_RECTANGLE(0, 0, xsize, ysize), 0, nullptr,
-                      pixels_buffer_2, GEGL_AUTO_ROWSTRIDE);
+      gegl_buffer_set(buffer, GEGL_RECTANGLE(0, 0, xsize, ysize), 0,
+                      source_format, pixels.data(), GEGL_AUTO_ROWSTRIDE);
       gimp_item_transform_translate(layer, crop_x0, crop_y0);
 
       g_clear_object(&buffer);
-      g_free(pixels_buffer_1);
-      g_free(pixels_buffer_2);
       if (stop_processing) status = JXL_DEC_SUCCESS;
       g_free(layer_name);
       layer_idx++;
@@ -422,10 +459,10 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
         g_printerr(LOAD_PROC " Error: JxlDecoderSetImageOutBuffer failed\n");
         return false;
       }
-      xsize = frame_header.layer_info.xsize;
-      ysize = frame_header.layer_info.ysize;
-      crop_x0 = frame_header.layer_info.crop_x0;
-      crop_y0 = frame_header.layer_info.crop_y0;
+      xsize = (frame_header.layer_info.xsize + downsampling - 1) / downsampling;
+      ysize = (frame_header.layer_info.ysize + downsampling - 1) / downsampling;
+      crop_x0 = frame_header.layer_info.crop_x0 / (long)downsampling;
+      crop_y0 = frame_header.layer_info.crop_y0 / (long)downsampling;
       frame_duration = frame_header.duration;
       blend_mode = frame_header.layer_info.blend_info.blendmode;
       if (blend_mode != JXL_BLEND_BLEND && blend_mode != JXL_BLEND_REPLACE) {
@@ -447,9 +484,9 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
       // It's not required to call JxlDecoderReleaseInput(dec.get())
       // since the decoder will be destroyed.
       break;
-    } else if (status == JXL_DEC_NEED_MORE_INPUT ||
-               status == JXL_DEC_FRAME_PROGRESSION) {
-      stop_processing = status != JXL_DEC_FRAME_PROGRESSION;
+    } else if (status == JXL_DEC_NEED_MORE_INPUT) {
+      // The file is truncated: keep what could be decoded of the last frame.
+      stop_processing = true;
       if (JxlDecoderFlushImage(dec.get()) == JXL_DEC_SUCCESS) {
         status = JXL_DEC_FULL_IMAGE;
         continue;
@@ -471,17 +508,23 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
     gimp_image_set_color_profile(*image_id, profile_icc);
   }
 
-  gimp_load_progress.update();
-
-  // TODO(xiota): Add option to keep image as float
-  if (info.bits_per_sample < 32) {
-    gimp_image_convert_precision(*image_id, precision);
-  }
-
   gimp_image_set_filename(*image_id, filename);
 
   gimp_load_progress.finished();
   return true;
 }
 
+}  // namespace
+
+bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
+  gint width, height;
+  return LoadImage(filename, /*thumb_size=*/0, image_id, &width, &height);
+}
+
+bool LoadJpegXlThumbnail(const gchar *const filename, const gint thumb_size,
+                         gint32 *const image_id, gint *const width,
+                         gint *const height) {
+  return LoadImage(filename, std::max(thumb_size, 1), image_id, width, height);
+}
+
 }  // namespace jxl
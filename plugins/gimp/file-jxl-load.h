@@ -12,6 +12,12 @@ namespace jxl {
 
 bool LoadJpegXlImage(const gchar* filename, gint32* image_id);
 
+// Loads the image downsampled by up to 8, which only decodes the DC of VarDCT
+// images, so that its larger side is at least `thumb_size`. `width` and
+// `height` are set to the size of the image in the file.
+bool LoadJpegXlThumbnail(const gchar* filename, gint thumb_size,
+                         gint32* image_id, gint* width, gint* height);
+
 }  // namespace jxl
 
 #endif  // PLUGINS_GIMP_FILE_JXL_LOAD_H_
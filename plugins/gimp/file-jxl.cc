@@ -15,6 +15,7 @@ namespace jxl {
 namespace {
 
 constexpr char kLoadProc[] = "file-jxl-load";
+constexpr char kLoadThumbProc[] = "file-jxl-load-thumb";
 constexpr char kSaveProc[] = "file-jxl-save";
 
 void Query() {
@@ -52,6 +53,39 @@ void Query() {
         "0,string,\\000\\000\\000\x0CJXL\\040\\015\\012\x87\\012");
   }
 
+  {
+    static char filename_name[] = "filename";
+    static char filename_description[] = "The name of the file to load";
+    static char thumb_size_name[] = "thumb-size";
+    static char thumb_size_description[] = "Preferred thumbnail size";
+    static const GimpParamDef thumb_args[] = {
+        {GIMP_PDB_STRING, filename_name, filename_description},
+        {GIMP_PDB_INT32, thumb_size_name, thumb_size_description},
+    };
+    static char image_name[] = "image";
+    static char image_description[] = "Thumbnail image";
+    static char width_name[] = "image-width";
+    static char width_description[] = "Width of the full-sized image";
+    static char height_name[] = "image-height";
+    static char height_description[] = "Height of the full-sized image";
+    static const GimpParamDef thumb_return_vals[] = {
+        {GIMP_PDB_IMAGE, image_name, image_description},
+        {GIMP_PDB_INT32, width_name, width_description},
+        {GIMP_PDB_INT32, height_name, height_description},
+    };
+
+    gimp_install_procedure(
+        /*name=*/kLoadThumbProc,
+        /*blurb=*/"Loads a preview of JPEG XL image files",
+        /*help=*/"Loads JPEG XL image files downsampled by up to 8",
+        /*author=*/"JPEG XL Project", /*copyright=*/"JPEG XL Project",
+        /*date=*/"2019", /*menu_label=*/nullptr, /*image_types=*/nullptr,
+        /*type=*/GIMP_PLUGIN, /*n_params=*/G_N_ELEMENTS(thumb_args),
+        /*n_return_vals=*/G_N_ELEMENTS(thumb_return_vals),
+        /*params=*/thumb_args, /*return_vals=*/thumb_return_vals);
+    gimp_register_thumbnail_loader(kLoadProc, kLoadThumbProc);
+  }
+
   {
     static char run_mode_name[] = "run-mode";
     static char run_mode_description[] = "Run mode";
@@ -89,7 +123,7 @@ void Run(const gchar* const name, const gint nparams,
          GimpParam** const return_vals) {
   gegl_init(nullptr, nullptr);
 
-  static GimpParam values[2];
+  static GimpParam values[4];
 
   *nreturn_vals = 1;
   *return_vals = values;
@@ -114,6 +148,30 @@ void Run(const gchar* const name, const gint nparams,
     values[0].data.d_status = GIMP_PDB_SUCCESS;
     values[1].type = GIMP_PDB_IMAGE;
     values[1].data.d_image = image_id;
+  } else if (strcmp(name, kLoadThumbProc) == 0) {
+    if (nparams != 2) {
+      values[0].data.d_status = GIMP_PDB_CALLING_ERROR;
+      return;
+    }
+
+    const gchar* const filename = params[0].data.d_string;
+    const gint thumb_size = params[1].data.d_int32;
+    gint32 image_id;
+    gint width, height;
+    if (!LoadJpegXlThumbnail(filename, thumb_size, &image_id, &width,
+                             &height)) {
+      values[0].data.d_status = GIMP_PDB_EXECUTION_ERROR;
+      return;
+    }
+
+    *nreturn_vals = 4;
+    values[0].data.d_status = GIMP_PDB_SUCCESS;
+    values[1].type = GIMP_PDB_IMAGE;
+    values[1].data.d_image = image_id;
+    values[2].type = GIMP_PDB_INT32;
+    values[2].data.d_int32 = width;
+    values[3].type = GIMP_PDB_INT32;
+    values[3].data.d_int32 = height;
   } else if (strcmp(name, kSaveProc) == 0) {
     if (nparams != 5) {
       values[0].data.d_status = GIMP_PDB_CALLING_ERROR;
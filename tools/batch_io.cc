@@ -0,0 +1,115 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "tools/batch_io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include "third_party/dirent.h"
+#else
+#include <dirent.h>
+#endif
+
+namespace jpegxl {
+namespace tools {
+
+namespace {
+
+bool IsDirectory(const std::string& path) {
+  struct stat s;
+  return stat(path.c_str(), &s) == 0 && S_ISDIR(s.st_mode);
+}
+
+bool IsRegularFile(const std::string& path) {
+  struct stat s;
+  return stat(path.c_str(), &s) == 0 && S_ISREG(s.st_mode);
+}
+
+}  // namespace
+
+bool ParseBatchFlag(const char* arg, const char* name, size_t* value) {
+  const size_t len = strlen(name);
+  if (strncmp(arg, name, len) != 0 || arg[len] != '=') return false;
+  char* end;
+  *value = strtoul(arg + len + 1, &end, 10);
+  return end != arg + len + 1 && *end == '\0';
+}
+
+bool ParseBatchFlag(const char* arg, const char* name, float* value) {
+  const size_t len = strlen(name);
+  if (strncmp(arg, name, len) != 0 || arg[len] != '=') return false;
+  char* end;
+  *value = strtof(arg + len + 1, &end);
+  return end != arg + len + 1 && *end == '\0';
+}
+
+bool ParseBatchFlag(const char* arg, const char* name, std::string* value) {
+  const size_t len = strlen(name);
+  if (strncmp(arg, name, len) != 0 || arg[len] != '=') return false;
+  *value = arg + len + 1;
+  return !value->empty();
+}
+
+bool AddBatchInput(const std::string& path, std::vector<std::string>* inputs) {
+  if (!IsDirectory(path)) {
+    inputs->push_back(path);
+    return true;
+  }
+  DIR* dir = opendir(path.c_str());
+  if (!dir) {
+    fprintf(stderr, "Failed to read directory %s\n", path.c_str());
+    return false;
+  }
+  std::vector<std::string> files;
+  while (const dirent* entry = readdir(dir)) {
+    const std::string file = path + "/" + entry->d_name;
+    if (IsRegularFile(file)) files.push_back(file);
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
+  inputs->insert(inputs->end(), files.begin(), files.end());
+  return true;
+}
+
+bool AddBatchInputList(const char* list, std::vector<std::string>* inputs) {
+  FILE* file = fopen(list, "r");
+  if (!file) {
+    fprintf(stderr, "Failed to read %s\n", list);
+    return false;
+  }
+  bool ok = true;
+  std::string line;
+  for (int c = fgetc(file);; c = fgetc(file)) {
+    if (c != EOF && c != '\n') {
+      if (c != '\r') line += static_cast<char>(c);
+      continue;
+    }
+    if (!line.empty()) ok = ok && AddBatchInput(line, inputs);
+    line.clear();
+    if (c == EOF) break;
+  }
+  fclose(file);
+  return ok;
+}
+
+std::string BatchOutputPath(const std::string& output_dir,
+                            const std::string& input,
+                            const std::string& extension) {
+  std::string name(input);
+  const size_t slash = name.find_last_of("/\\");
+  if (slash != std::string::npos) name = name.substr(slash + 1);
+  const size_t dot = name.find_last_of('.');
+  if (dot != std::string::npos && dot > 0) name = name.substr(0, dot);
+  return output_dir + "/" + name + extension;
+}
+
+}  // namespace tools
+}  // namespace jpegxl
@@ -0,0 +1,40 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef TOOLS_BATCH_IO_H_
+#define TOOLS_BATCH_IO_H_
+
+// Input and output paths of the batch tools.
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+namespace jpegxl {
+namespace tools {
+
+// Parses "NAME=VALUE" into `value`, returns false if `arg` is not of this form.
+bool ParseBatchFlag(const char* arg, const char* name, size_t* value);
+bool ParseBatchFlag(const char* arg, const char* name, float* value);
+bool ParseBatchFlag(const char* arg, const char* name, std::string* value);
+
+// Appends `path` to `inputs`, or the regular files it contains, sorted by
+// name, if it is a directory. Returns false if the directory can't be read.
+bool AddBatchInput(const std::string& path, std::vector<std::string>* inputs);
+
+// Calls AddBatchInput for each non-empty line of the text file `list`.
+bool AddBatchInputList(const char* list, std::vector<std::string>* inputs);
+
+// Returns OUTPUT_DIR/NAME`extension`, where NAME is the file name of `input`
+// without its extension.
+std::string BatchOutputPath(const std::string& output_dir,
+                            const std::string& input,
+                            const std::string& extension);
+
+}  // namespace tools
+}  // namespace jpegxl
+
+#endif  // TOOLS_BATCH_IO_H_
@@ -183,6 +183,77 @@ Status BenchmarkArgs::AddCommandLineOptions() {
               "How many times to decode (>1 for more precise measurements). "
               "Defaults to 1.",
               1);
+  AddFlag(&decode_throughput, "decode_throughput",
+          "Only measure the decoding of the already compressed JPEG XL files "
+          "matched by --input, preloaded into memory, with new and reused "
+          "decoders and warm and cold caches, --decode_reps times for each "
+          "count of --decode_threads.",
+          false);
+  AddString(&decode_threads, "decode_threads",
+            "Comma separated list of the numbers of worker threads for "
+            "--decode_throughput. Defaults to 0, 1, 2, 4... up to one per CPU "
+            "core.");
+  AddUnsigned(&cold_cache_mb, "cold_cache_mb",
+              "Size in MiB of the buffer that --decode_throughput overwrites "
+              "before each cold-cache decode, which should exceed the last "
+              "level cache.",
+              64);
+  AddFlag(&thread_scaling, "thread_scaling",
+          "Only encode and decode the images matched by --input with 1, 2, 4, "
+          "... threads, --encode_reps and --decode_reps times each, and print "
+          "how the encoder, its phases and the decoder scale.",
+          false);
+  AddUnsigned(&thread_scaling_max, "thread_scaling_max",
+              "Largest number of threads of --thread_scaling, 0 for the "
+              "number of cores.",
+              0);
+  AddDouble(&thread_scaling_distance, "thread_scaling_distance",
+            "Butteraugli distance of the --thread_scaling encodes, 0 for "
+            "lossless.",
+            1.0);
+  AddUnsigned(&thread_scaling_effort, "thread_scaling_effort",
+              "Effort of the --thread_scaling encodes.", 7);
+  AddFlag(&concurrency, "concurrency",
+          "Only run concurrent encoder and decoder instances, each encoding "
+          "or decoding the images matched by --input --encode_reps or "
+          "--decode_reps times, and print their aggregate throughput, the "
+          "latency percentiles of one image and their peak memory.",
+          false);
+  AddString(&concurrent_instances, "concurrent_instances",
+            "Comma separated list of the numbers of instances that "
+            "--concurrency runs at the same time. Defaults to 1, 2, 4... up "
+            "to one per CPU core.");
+  AddUnsigned(&instance_threads, "instance_threads",
+              "Number of threads of each --concurrency instance.", 1);
+  AddFlag(&shared_runner, "shared_runner",
+          "Whether the --concurrency instances share the worker threads of "
+          "one JxlSharedParallelRunner instead of each having its own "
+          "runner.",
+          false);
+  AddDouble(&concurrency_distance, "concurrency_distance",
+            "Butteraugli distance of the --concurrency encodes, 0 for "
+            "lossless.",
+            1.0);
+  AddUnsigned(&concurrency_effort, "concurrency_effort",
+              "Effort of the --concurrency encodes.", 7);
+  AddFlag(&progressive_timeline, "progressive_timeline",
+          "Only print when the basic info, the progressive steps and the full "
+          "frames of the JPEG XL files matched by --input become available "
+          "as their bytes arrive, see --input_chunk_bytes and "
+          "--bandwidth_mbps.",
+          false);
+  AddString(&progressive_detail, "progressive_detail",
+            "Progressive steps flushed by --progressive_timeline: dc, "
+            "last_passes or passes.",
+            "passes");
+  AddUnsigned(&input_chunk_bytes, "input_chunk_bytes",
+              "Number of bytes given to the decoder at once by "
+              "--progressive_timeline.",
+              16384);
+  AddDouble(&bandwidth_mbps, "bandwidth_mbps",
+            "Simulated bandwidth in Mbit/s at which --progressive_timeline "
+            "receives the bytes, 0 for unlimited.",
+            0);
 
   AddString(&sample_tmp_dir, "sample_tmp_dir",
             "Directory to put samples from input images.");
@@ -195,6 +266,15 @@ Status BenchmarkArgs::AddCommandLineOptions() {
             "smallest p norm for pooling butteraugli values", 3.0);
 
   AddFlag(&profiler, "profiler", "If true, print profiler results.", false);
+  AddString(&trace_file, "trace_file",
+            "If not empty, writes the timeline of the profiler zones of each "
+            "thread to this file in the Chrome trace event format. Requires "
+            "a build with JPEGXL_ENABLE_PROFILER.");
+  AddFlag(&profiler_counters, "profiler_counters",
+          "If true, --profiler also prints the IPC, cache and branch miss "
+          "rates of each zone, from the hardware performance counters. "
+          "Requires Linux and a build with JPEGXL_ENABLE_PROFILER.",
+          false);
 
   AddFlag(&show_progress, "show_progress",
           "Show activity dots per completed file during benchmark.", false);
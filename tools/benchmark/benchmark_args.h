@@ -146,6 +146,23 @@ struct BenchmarkArgs {
   int inner_threads;
   size_t decode_reps;
   size_t encode_reps;
+  bool decode_throughput;
+  std::string decode_threads;
+  size_t cold_cache_mb;
+  bool thread_scaling;
+  size_t thread_scaling_max;
+  double thread_scaling_distance;
+  size_t thread_scaling_effort;
+  bool concurrency;
+  std::string concurrent_instances;
+  size_t instance_threads;
+  bool shared_runner;
+  double concurrency_distance;
+  size_t concurrency_effort;
+  bool progressive_timeline;
+  std::string progressive_detail;
+  size_t input_chunk_bytes;
+  double bandwidth_mbps;
 
   std::string sample_tmp_dir;
 
@@ -153,6 +170,8 @@ struct BenchmarkArgs {
   int sample_dimensions;
 
   bool profiler;
+  std::string trace_file;
+  bool profiler_counters;
   double error_pnorm;
   bool show_progress;
 
@@ -22,6 +22,7 @@
 #endif
 #include "lib/extras/packed_image_convert.h"
 #include "lib/extras/time.h"
+#include "lib/jxl/base/cache_aligned.h"
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/override.h"
 #include "lib/jxl/base/padded_bytes.h"
@@ -358,6 +359,8 @@ class JxlCodec : public ImageCodec {
                     jpegxl::tools::SpeedStats* speed_stats) override {
     dparams_.runner = pool->runner();
     dparams_.runner_opaque = pool->runner_opaque();
+    // Lets the MemoryMeter of the benchmark count the decoder allocations.
+    dparams_.memory_manager = jxl::CacheAligned::CurrentMemoryManager();
     JxlDataType data_type = uint8_ ? JXL_TYPE_UINT8 : JXL_TYPE_FLOAT;
     dparams_.accepted_formats = {{3, data_type, JXL_NATIVE_ENDIAN, 0},
                                  {4, data_type, JXL_NATIVE_ENDIAN, 0}};
@@ -367,6 +370,9 @@ class JxlCodec : public ImageCodec {
     // originals, so we must set the option to keep the original orientation
     // instead.
     dparams_.keep_orientation = true;
+    if (Args()->print_more_stats) {
+      dparams_.render_stats = &render_stats_;
+    }
     PackedPixelFile ppf;
     size_t decoded_bytes;
     const double start = jxl::Now();
@@ -382,6 +388,7 @@ class JxlCodec : public ImageCodec {
     JxlStats jxl_stats;
     jxl_stats.num_inputs = 1;
     jxl_stats.aux_out = cinfo_;
+    jxl_stats.render_stats = render_stats_;
     stats->jxl_stats.Assimilate(jxl_stats);
   }
 
@@ -390,6 +397,8 @@ class JxlCodec : public ImageCodec {
   CompressParams cparams_;
   bool has_ctransform_ = false;
   JXLDecompressParams dparams_;
+  // Of the last decoded image, if print_more_stats is set.
+  std::vector<JxlRenderStageStats> render_stats_;
   bool uint8_ = false;
   bool normalize_bitrate_ = false;
 };
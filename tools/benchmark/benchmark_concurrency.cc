@@ -0,0 +1,285 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "tools/benchmark/benchmark_concurrency.h"
+
+#include <jxl/encode.h>
+#include <jxl/memory_manager.h>
+#include <jxl/parallel_runner.h>
+#include <jxl/shared_parallel_runner.h>
+#include <jxl/shared_parallel_runner_cxx.h>
+#include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lib/extras/dec/color_hints.h"
+#include "lib/extras/dec/decode.h"
+#include "lib/extras/dec/jxl.h"
+#include "lib/extras/enc/jxl.h"
+#include "lib/extras/packed_image.h"
+#include "lib/extras/time.h"
+#include "lib/jxl/base/file_io.h"
+#include "lib/jxl/base/printf_macros.h"
+#include "lib/jxl/base/span.h"
+#include "tools/benchmark/benchmark_args.h"
+#include "tools/benchmark/benchmark_file_io.h"
+#include "tools/benchmark/benchmark_memory.h"
+
+namespace jpegxl {
+namespace tools {
+namespace {
+
+struct Image {
+  std::string name;
+  jxl::extras::PackedPixelFile ppf;
+  size_t pixels = 0;
+  // Encoded once before the measurements, for the decoders.
+  std::vector<uint8_t> compressed;
+};
+
+struct InstanceRunner {
+  JxlParallelRunner runner;
+  // Null for single-threaded instances.
+  void* runner_opaque;
+};
+
+// The parallel runners of the instances: a JxlThreadParallelRunner with
+// `num_threads` worker threads for each instance, or one client for each
+// instance of a JxlSharedParallelRunner whose workers add up to the same
+// number of threads, since the calling threads also run the tasks.
+class InstanceRunners {
+ public:
+  InstanceRunners(size_t num_instances, size_t num_threads, bool shared) {
+    if (shared) {
+      shared_runner_ = JxlSharedParallelRunnerMake(
+          nullptr, num_instances * (std::max<size_t>(num_threads, 1) - 1));
+      for (size_t i = 0; i < num_instances; ++i) {
+        clients_.push_back(JxlSharedParallelRunnerMakeClient(
+            shared_runner_.get(), /*weight=*/1));
+      }
+    } else if (num_threads > 1) {
+      for (size_t i = 0; i < num_instances; ++i) {
+        thread_runners_.push_back(
+            JxlThreadParallelRunnerMake(nullptr, num_threads));
+      }
+    }
+  }
+
+  InstanceRunner Get(size_t instance) const {
+    if (!clients_.empty()) {
+      return {JxlSharedParallelRunner, clients_[instance].get()};
+    }
+    if (!thread_runners_.empty()) {
+      return {JxlThreadParallelRunner, thread_runners_[instance].get()};
+    }
+    return {JxlThreadParallelRunner, nullptr};
+  }
+
+ private:
+  // Declared before the clients, which must be destroyed first.
+  JxlSharedParallelRunnerPtr shared_runner_;
+  std::vector<JxlSharedParallelRunnerClientPtr> clients_;
+  std::vector<JxlThreadParallelRunnerPtr> thread_runners_;
+};
+
+// Encodes or decodes one image, allocating the image buffers with
+// `memory_manager`.
+using Job = std::function<bool(const Image& image, const InstanceRunner& runner,
+                               const JxlMemoryManager* memory_manager)>;
+
+bool Encode(const Image& image, const InstanceRunner& runner,
+            const JxlMemoryManager* memory_manager,
+            std::vector<uint8_t>* compressed) {
+  jxl::extras::JXLCompressParams cparams;
+  cparams.distance = Args()->concurrency_distance;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, Args()->concurrency_effort);
+  cparams.runner = runner.runner;
+  cparams.runner_opaque = runner.runner_opaque;
+  cparams.memory_manager = memory_manager;
+  return jxl::extras::EncodeImageJXL(cparams, image.ppf,
+                                     /*jpeg_bytes=*/nullptr, compressed);
+}
+
+bool EncodeJob(const Image& image, const InstanceRunner& runner,
+               const JxlMemoryManager* memory_manager) {
+  std::vector<uint8_t> compressed;
+  return Encode(image, runner, memory_manager, &compressed);
+}
+
+bool DecodeJob(const Image& image, const InstanceRunner& runner,
+               const JxlMemoryManager* memory_manager) {
+  jxl::extras::JXLDecompressParams dparams;
+  dparams.runner = runner.runner;
+  dparams.runner_opaque = runner.runner_opaque;
+  dparams.memory_manager = memory_manager;
+  jxl::extras::PackedPixelFile decoded;
+  return jxl::extras::DecodeImageJXL(image.compressed.data(),
+                                     image.compressed.size(), dparams,
+                                     /*decoded_bytes=*/nullptr, &decoded);
+}
+
+struct InstanceResult {
+  bool ok = true;
+  std::vector<double> latencies;
+  size_t peak_bytes = 0;
+};
+
+// Runs `job` on each image `num_reps` times. The instances start at different
+// images, so that they don't all work on the same one.
+void RunInstance(const std::vector<Image>& images, size_t instance,
+                 size_t num_reps, const InstanceRunner& runner, const Job& job,
+                 InstanceResult* result) {
+  MemoryMeter meter;
+  for (size_t i = 0; i < num_reps * images.size(); ++i) {
+    const Image& image = images[(instance + i) % images.size()];
+    const double start = jxl::Now();
+    if (!job(image, runner, meter.memory_manager())) {
+      fprintf(stderr, "Failed to encode or decode %s\n", image.name.c_str());
+      result->ok = false;
+      return;
+    }
+    result->latencies.push_back(jxl::Now() - start);
+  }
+  result->peak_bytes = meter.PeakBytes();
+}
+
+// Returns the value below which `fraction` of the sorted `values` are.
+double Percentile(const std::vector<double>& values, double fraction) {
+  const size_t index = std::min(
+      values.size() - 1, static_cast<size_t>(fraction * values.size()));
+  return values[index];
+}
+
+// Runs `num_instances` instances of `job` at the same time and prints a row of
+// the table. `megapixels` is the size of the work of one instance. The
+// efficiency is relative to `single_mps`, the throughput per instance of the
+// first row, which is set if it is 0.
+bool RunConcurrently(const char* name, const std::vector<Image>& images,
+                     size_t num_instances, size_t num_reps, double megapixels,
+                     const Job& job, double* single_mps) {
+  InstanceRunners runners(num_instances, Args()->instance_threads,
+                          Args()->shared_runner);
+  std::vector<InstanceResult> results(num_instances);
+  std::vector<std::thread> threads;
+  const double start = jxl::Now();
+  for (size_t i = 0; i < num_instances; ++i) {
+    threads.emplace_back([&, i]() {
+      RunInstance(images, i, num_reps, runners.Get(i), job, &results[i]);
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  const double seconds = jxl::Now() - start;
+
+  std::vector<double> latencies;
+  size_t max_peak_bytes = 0;
+  size_t total_peak_bytes = 0;
+  for (const InstanceResult& result : results) {
+    if (!result.ok) return false;
+    latencies.insert(latencies.end(), result.latencies.begin(),
+                     result.latencies.end());
+    max_peak_bytes = std::max(max_peak_bytes, result.peak_bytes);
+    total_peak_bytes += result.peak_bytes;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  const double mps = num_instances * megapixels / seconds;
+  if (*single_mps == 0) *single_mps = mps / num_instances;
+  printf("%-6s %9" PRIuS " %9.2f %10.3f %9.2f %9.2f %9.2f %9.2f %9.1f %9.1f\n",
+         name, num_instances, mps, mps / (num_instances * *single_mps),
+         Percentile(latencies, 0.5) * 1E3, Percentile(latencies, 0.9) * 1E3,
+         Percentile(latencies, 0.99) * 1E3, latencies.back() * 1E3,
+         max_peak_bytes / 1048576.0, total_peak_bytes / 1048576.0);
+  return true;
+}
+
+bool ParseInstanceCounts(const std::string& list,
+                         std::vector<size_t>* counts) {
+  counts->clear();
+  if (list.empty()) {
+    const size_t num_cores =
+        std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    for (size_t n = 1; n < num_cores; n *= 2) counts->push_back(n);
+    counts->push_back(num_cores);
+    return true;
+  }
+  const char* pos = list.c_str();
+  for (;;) {
+    char* end;
+    const unsigned long n = strtoul(pos, &end, 10);
+    if (end == pos || n == 0) return false;
+    counts->push_back(n);
+    if (*end == '\0') return true;
+    if (*end != ',') return false;
+    pos = end + 1;
+  }
+}
+
+}  // namespace
+
+int RunConcurrencyBenchmark() {
+  std::vector<size_t> instance_counts;
+  if (!ParseInstanceCounts(Args()->concurrent_instances, &instance_counts)) {
+    fprintf(stderr, "Invalid --concurrent_instances %s\n",
+            Args()->concurrent_instances.c_str());
+    return EXIT_FAILURE;
+  }
+  std::vector<std::string> fnames;
+  if (!MatchFiles(Args()->input, &fnames) || fnames.empty()) {
+    fprintf(stderr, "No files match --input %s\n", Args()->input.c_str());
+    return EXIT_FAILURE;
+  }
+  std::vector<Image> images(fnames.size());
+  double megapixels = 0;
+  for (size_t i = 0; i < fnames.size(); ++i) {
+    Image& image = images[i];
+    image.name = fnames[i];
+    std::vector<uint8_t> encoded;
+    if (!jxl::ReadFile(image.name, &encoded) ||
+        !jxl::extras::DecodeBytes(jxl::Span<const uint8_t>(encoded),
+                                  jxl::extras::ColorHints(), &image.ppf) ||
+        !Encode(image, {JxlThreadParallelRunner, nullptr},
+                /*memory_manager=*/nullptr, &image.compressed)) {
+      fprintf(stderr, "Failed to load or encode %s\n", image.name.c_str());
+      return EXIT_FAILURE;
+    }
+    image.pixels = static_cast<size_t>(image.ppf.info.xsize) *
+                   image.ppf.info.ysize;
+    megapixels += image.pixels * 1E-6;
+  }
+
+  const size_t encode_reps = std::max<size_t>(Args()->encode_reps, 1);
+  const size_t decode_reps = std::max<size_t>(Args()->decode_reps, 1);
+  printf("%" PRIuS " images (%.3f MP), distance %.3f, effort %" PRIuS
+         ", %" PRIuS " threads per instance, %s\n",
+         images.size(), megapixels, Args()->concurrency_distance,
+         Args()->concurrency_effort, Args()->instance_threads,
+         Args()->shared_runner ? "shared runner" : "separate runners");
+  printf("%-6s %9s %9s %10s %9s %9s %9s %9s %9s %9s\n", "", "instances",
+         "MP/s", "efficiency", "p50 ms", "p90 ms", "p99 ms", "max ms",
+         "peak MiB", "sum MiB");
+  double single_encode_mps = 0;
+  double single_decode_mps = 0;
+  for (size_t num_instances : instance_counts) {
+    if (!RunConcurrently("encode", images, num_instances, encode_reps,
+                         encode_reps * megapixels, EncodeJob,
+                         &single_encode_mps) ||
+        !RunConcurrently("decode", images, num_instances, decode_reps,
+                         decode_reps * megapixels, DecodeJob,
+                         &single_decode_mps)) {
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+}  // namespace tools
+}  // namespace jpegxl
@@ -0,0 +1,23 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef TOOLS_BENCHMARK_BENCHMARK_CONCURRENCY_H_
+#define TOOLS_BENCHMARK_BENCHMARK_CONCURRENCY_H_
+
+namespace jpegxl {
+namespace tools {
+
+// Implements --concurrency: for each count of --concurrent_instances, runs that
+// many encoder (then decoder) instances at the same time, each encoding (then
+// decoding) all the images matched by --input --encode_reps (--decode_reps)
+// times with --instance_threads threads, and prints the aggregate throughput,
+// the latency percentiles of a single job and the peak memory of the
+// instances. Returns the exit code of the program.
+int RunConcurrencyBenchmark();
+
+}  // namespace tools
+}  // namespace jpegxl
+
+#endif  // TOOLS_BENCHMARK_BENCHMARK_CONCURRENCY_H_
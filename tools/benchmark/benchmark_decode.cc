@@ -0,0 +1,363 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "tools/benchmark/benchmark_decode.h"
+
+#include <jxl/decode.h>
+#include <jxl/decode_cxx.h>
+#include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lib/extras/time.h"
+#include "lib/jxl/base/file_io.h"
+#include "lib/jxl/base/printf_macros.h"
+#include "tools/benchmark/benchmark_args.h"
+#include "tools/benchmark/benchmark_file_io.h"
+
+namespace jpegxl {
+namespace tools {
+namespace {
+
+// Bound on the image buffers a reused decoder keeps for the next image, large
+// enough for the images of typical benchmark corpora.
+constexpr size_t kReusedBufferPoolBytes = size_t{256} << 20;
+
+struct InputFile {
+  std::string name;
+  std::vector<uint8_t> compressed;
+  size_t pixels = 0;
+  // Output of the decoder, allocated by the first decode.
+  std::vector<uint8_t> decoded;
+};
+
+// Evicts the data of the previous decodes from the caches by overwriting and
+// reading back a buffer that is larger than them.
+class CacheFlusher {
+ public:
+  explicit CacheFlusher(size_t bytes) : buffer_(bytes) {}
+
+  void Flush() {
+    ++value_;
+    memset(buffer_.data(), value_, buffer_.size());
+    uint8_t sum = 0;
+    for (size_t i = 0; i < buffer_.size(); i += 64) sum += buffer_[i];
+    sink_ = sum;
+  }
+
+ private:
+  std::vector<uint8_t> buffer_;
+  uint8_t value_ = 0;
+  volatile uint8_t sink_ = 0;
+};
+
+// Decodes all the frames of `file` to 8-bit RGBA with `dec`, which must be
+// new or reset, and returns the number of pixels of the image in `pixels`.
+bool Decode(JxlDecoder* dec, void* runner, InputFile* file, size_t* pixels) {
+  if (JXL_DEC_SUCCESS !=
+          JxlDecoderSubscribeEvents(dec,
+                                    JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE) ||
+      JXL_DEC_SUCCESS !=
+          JxlDecoderSetParallelRunner(dec, JxlThreadParallelRunner, runner)) {
+    return false;
+  }
+  const JxlPixelFormat format = {4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  JxlDecoderSetInput(dec, file->compressed.data(), file->compressed.size());
+  JxlDecoderCloseInput(dec);
+  for (;;) {
+    const JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+    if (status == JXL_DEC_SUCCESS) return true;
+    if (status == JXL_DEC_BASIC_INFO) {
+      JxlBasicInfo info;
+      if (JXL_DEC_SUCCESS != JxlDecoderGetBasicInfo(dec, &info)) return false;
+      *pixels = static_cast<size_t>(info.xsize) * info.ysize;
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      size_t size;
+      if (JXL_DEC_SUCCESS !=
+          JxlDecoderImageOutBufferSize(dec, &format, &size)) {
+        return false;
+      }
+      if (file->decoded.size() < size) file->decoded.resize(size);
+      if (JXL_DEC_SUCCESS != JxlDecoderSetImageOutBuffer(
+                                 dec, &format, file->decoded.data(), size)) {
+        return false;
+      }
+    } else if (status != JXL_DEC_FULL_IMAGE) {
+      return false;
+    }
+  }
+}
+
+bool ParseThreadCounts(const std::string& list, std::vector<size_t>* counts) {
+  counts->clear();
+  if (list.empty()) {
+    const size_t num_cores =
+        std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    counts->push_back(0);
+    for (size_t n = 1; n < num_cores; n *= 2) counts->push_back(n);
+    counts->push_back(num_cores);
+    return true;
+  }
+  const char* pos = list.c_str();
+  for (;;) {
+    char* end;
+    const unsigned long n = strtoul(pos, &end, 10);
+    if (end == pos) return false;
+    counts->push_back(n);
+    if (*end == '\0') return true;
+    if (*end != ',') return false;
+    pos = end + 1;
+  }
+}
+
+// Reads the files matched by --input.
+bool LoadFiles(std::vector<InputFile>* files) {
+  std::vector<std::string> fnames;
+  if (!MatchFiles(Args()->input, &fnames) || fnames.empty()) {
+    fprintf(stderr, "No files match --input %s\n", Args()->input.c_str());
+    return false;
+  }
+  files->resize(fnames.size());
+  for (size_t i = 0; i < fnames.size(); ++i) {
+    (*files)[i].name = fnames[i];
+    if (!jxl::ReadFile(fnames[i], &(*files)[i].compressed)) {
+      fprintf(stderr, "Failed to read %s\n", fnames[i].c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+// Something that became available while decoding progressively.
+struct ProgressionEvent {
+  const char* name;
+  // Number of bytes of the file that had arrived.
+  size_t bytes;
+  // Simulated time since the first byte was sent.
+  double seconds;
+  // Of the image flushed at a JXL_DEC_FRAME_PROGRESSION, otherwise 1.
+  size_t downsampling;
+};
+
+// Decodes `file` as its bytes arrive in chunks of `chunk_bytes`, at
+// `bytes_per_second` (unlimited if 0), flushing the image at each frame
+// progression. The time of the events is simulated: the decoding time is
+// measured, and the decoder waits if the next chunk arrives later.
+bool DecodeProgressively(const InputFile& file, void* runner,
+                         JxlProgressiveDetail detail, size_t chunk_bytes,
+                         double bytes_per_second,
+                         std::vector<ProgressionEvent>* events) {
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  if (JXL_DEC_SUCCESS !=
+          JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_BASIC_INFO |
+                                                   JXL_DEC_FRAME_PROGRESSION |
+                                                   JXL_DEC_FULL_IMAGE) ||
+      JXL_DEC_SUCCESS != JxlDecoderSetProgressiveDetail(dec.get(), detail) ||
+      JXL_DEC_SUCCESS != JxlDecoderSetParallelRunner(
+                             dec.get(), JxlThreadParallelRunner, runner)) {
+    return false;
+  }
+  const JxlPixelFormat format = {4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels;
+  const uint8_t* data = file.compressed.data();
+  const size_t size = file.compressed.size();
+  size_t arrived = 0;
+  size_t consumed = 0;
+  double now = 0;
+  const auto arrive_next_chunk = [&]() {
+    arrived = std::min(size, arrived + chunk_bytes);
+    if (bytes_per_second > 0) now = std::max(now, arrived / bytes_per_second);
+    JxlDecoderSetInput(dec.get(), data + consumed, arrived - consumed);
+    if (arrived == size) JxlDecoderCloseInput(dec.get());
+  };
+  arrive_next_chunk();
+  for (;;) {
+    const double start = jxl::Now();
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_FRAME_PROGRESSION &&
+        JXL_DEC_SUCCESS != JxlDecoderFlushImage(dec.get())) {
+      return false;
+    }
+    now += jxl::Now() - start;
+    if (status == JXL_DEC_SUCCESS) return true;
+    if (status == JXL_DEC_NEED_MORE_INPUT) {
+      if (arrived == size) return false;
+      consumed = arrived - JxlDecoderReleaseInput(dec.get());
+      arrive_next_chunk();
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      size_t buffer_size;
+      if (JXL_DEC_SUCCESS !=
+          JxlDecoderImageOutBufferSize(dec.get(), &format, &buffer_size)) {
+        return false;
+      }
+      pixels.resize(buffer_size);
+      if (JXL_DEC_SUCCESS !=
+          JxlDecoderSetImageOutBuffer(dec.get(), &format, pixels.data(),
+                                      pixels.size())) {
+        return false;
+      }
+    } else if (status == JXL_DEC_BASIC_INFO) {
+      events->push_back({"basic info", arrived, now, 1});
+    } else if (status == JXL_DEC_FRAME_PROGRESSION) {
+      events->push_back({"progression", arrived, now,
+                         JxlDecoderGetIntendedDownsamplingRatio(dec.get())});
+    } else if (status == JXL_DEC_FULL_IMAGE) {
+      events->push_back({"full frame", arrived, now, 1});
+    } else {
+      return false;
+    }
+  }
+}
+
+bool ParseProgressiveDetail(const std::string& name,
+                            JxlProgressiveDetail* detail) {
+  if (name == "dc") {
+    *detail = kDC;
+  } else if (name == "last_passes") {
+    *detail = kLastPasses;
+  } else if (name == "passes") {
+    *detail = kPasses;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Returns the value below which `fraction` of the sorted `values` are.
+double Percentile(const std::vector<double>& values, double fraction) {
+  const size_t index = std::min(
+      values.size() - 1, static_cast<size_t>(fraction * values.size()));
+  return values[index];
+}
+
+}  // namespace
+
+int RunDecodeBenchmark() {
+  std::vector<size_t> thread_counts;
+  if (!ParseThreadCounts(Args()->decode_threads, &thread_counts)) {
+    fprintf(stderr, "Invalid --decode_threads %s\n",
+            Args()->decode_threads.c_str());
+    return EXIT_FAILURE;
+  }
+  std::vector<InputFile> files;
+  if (!LoadFiles(&files)) return EXIT_FAILURE;
+
+  // Decodes the files once, which checks them and allocates the output
+  // buffers.
+  size_t total_pixels = 0;
+  {
+    JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(
+        nullptr, JxlThreadParallelRunnerDefaultNumWorkerThreads());
+    for (InputFile& file : files) {
+      JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+      if (!Decode(dec.get(), runner.get(), &file, &file.pixels)) {
+        fprintf(stderr, "Failed to decode %s\n", file.name.c_str());
+        return EXIT_FAILURE;
+      }
+      total_pixels += file.pixels;
+    }
+  }
+  const size_t num_reps = std::max<size_t>(Args()->decode_reps, 1);
+  printf("Decoding %" PRIuS " files (%.3f MP), %" PRIuS " times each\n",
+         files.size(), total_pixels * 1E-6, num_reps);
+  printf("%7s %-7s %-5s %9s %9s %9s %9s\n", "threads", "decoder", "cache",
+         "MP/s", "p50 ms", "p90 ms", "p99 ms");
+
+  CacheFlusher flusher(Args()->cold_cache_mb << 20);
+  for (size_t num_threads : thread_counts) {
+    JxlThreadParallelRunnerPtr runner =
+        JxlThreadParallelRunnerMake(nullptr, num_threads);
+    for (bool reuse : {false, true}) {
+      for (bool cold : {false, true}) {
+        JxlDecoderPtr reused_dec;
+        if (reuse) {
+          reused_dec = JxlDecoderMake(nullptr);
+          JxlDecoderSetImageBufferPool(reused_dec.get(),
+                                       kReusedBufferPoolBytes);
+        }
+        std::vector<double> latencies;
+        double total_seconds = 0;
+        // The first pass warms up the caches and the reused decoder.
+        for (size_t rep = 0; rep <= num_reps; ++rep) {
+          for (InputFile& file : files) {
+            if (cold) flusher.Flush();
+            const double t0 = jxl::Now();
+            JxlDecoderPtr new_dec;
+            if (!reuse) new_dec = JxlDecoderMake(nullptr);
+            JxlDecoder* dec = reuse ? reused_dec.get() : new_dec.get();
+            size_t pixels;
+            const bool ok = Decode(dec, runner.get(), &file, &pixels);
+            if (reuse) {
+              JxlDecoderResetKeepBuffers(dec);
+            } else {
+              new_dec.reset();
+            }
+            const double t1 = jxl::Now();
+            if (!ok) {
+              fprintf(stderr, "Failed to decode %s\n", file.name.c_str());
+              return EXIT_FAILURE;
+            }
+            if (rep == 0) continue;
+            latencies.push_back(t1 - t0);
+            total_seconds += t1 - t0;
+          }
+        }
+        std::sort(latencies.begin(), latencies.end());
+        printf("%7" PRIuS " %-7s %-5s %9.2f %9.3f %9.3f %9.3f\n", num_threads,
+               reuse ? "reused" : "new", cold ? "cold" : "warm",
+               total_pixels * num_reps * 1E-6 / total_seconds,
+               Percentile(latencies, 0.5) * 1E3,
+               Percentile(latencies, 0.9) * 1E3,
+               Percentile(latencies, 0.99) * 1E3);
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+int RunProgressiveBenchmark() {
+  JxlProgressiveDetail detail;
+  if (!ParseProgressiveDetail(Args()->progressive_detail, &detail)) {
+    fprintf(stderr, "Invalid --progressive_detail %s\n",
+            Args()->progressive_detail.c_str());
+    return EXIT_FAILURE;
+  }
+  const size_t chunk_bytes = std::max<size_t>(Args()->input_chunk_bytes, 1);
+  const double bytes_per_second = Args()->bandwidth_mbps * 1E6 / 8;
+  std::vector<InputFile> files;
+  if (!LoadFiles(&files)) return EXIT_FAILURE;
+
+  JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(
+      nullptr, JxlThreadParallelRunnerDefaultNumWorkerThreads());
+  for (const InputFile& file : files) {
+    std::vector<ProgressionEvent> events;
+    if (!DecodeProgressively(file, runner.get(), detail, chunk_bytes,
+                             bytes_per_second, &events)) {
+      fprintf(stderr, "Failed to decode %s\n", file.name.c_str());
+      return EXIT_FAILURE;
+    }
+    const size_t size = file.compressed.size();
+    printf("%s: %" PRIuS " bytes\n", file.name.c_str(), size);
+    printf("  %-12s %10s %7s %10s %6s\n", "event", "bytes", "%", "ms",
+           "ratio");
+    for (const ProgressionEvent& event : events) {
+      printf("  %-12s %10" PRIuS " %6.1f%% %10.3f %6" PRIuS "\n", event.name,
+             event.bytes, event.bytes * 100.0 / size, event.seconds * 1E3,
+             event.downsampling);
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+}  // namespace tools
+}  // namespace jpegxl
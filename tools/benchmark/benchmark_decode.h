@@ -0,0 +1,28 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef TOOLS_BENCHMARK_BENCHMARK_DECODE_H_
+#define TOOLS_BENCHMARK_BENCHMARK_DECODE_H_
+
+namespace jpegxl {
+namespace tools {
+
+// Implements --decode_throughput: decodes the JPEG XL files matched by --input,
+// preloaded into memory, and prints the throughput and latency percentiles
+// for each number of threads, with new and reused decoders and with warm and
+// cold caches. Returns the exit code of the program.
+int RunDecodeBenchmark();
+
+// Implements --progressive_timeline: decodes each file matched by --input as
+// its bytes arrive, in chunks of --input_chunk_bytes at --bandwidth_mbps, and
+// prints when (in simulated time) and after how many bytes the basic info,
+// each progressive flush and each full frame become available. Returns the
+// exit code of the program.
+int RunProgressiveBenchmark();
+
+}  // namespace tools
+}  // namespace jpegxl
+
+#endif  // TOOLS_BENCHMARK_BENCHMARK_DECODE_H_
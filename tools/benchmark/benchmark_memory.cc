@@ -0,0 +1,97 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "tools/benchmark/benchmark_memory.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <cstddef>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define JXL_BENCHMARK_HAS_RUSAGE 1
+#else
+#define JXL_BENCHMARK_HAS_RUSAGE 0
+#endif
+
+namespace jpegxl {
+namespace tools {
+namespace {
+
+// Keeps the allocations as aligned as the ones of malloc.
+constexpr size_t kHeaderSize = alignof(std::max_align_t);
+static_assert(kHeaderSize >= sizeof(size_t), "Header too small");
+
+size_t PeakRss() {
+#if JXL_BENCHMARK_HAS_RUSAGE
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+  return usage.ru_maxrss;
+#else
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+  return 0;
+#endif
+}
+
+}  // namespace
+
+struct MemoryMeter::Counters {
+  void Unref() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+  }
+
+  jxl::AllocationStats stats;
+  // One for the meter and one for each allocation.
+  std::atomic<size_t> refs{1};
+};
+
+MemoryMeter::MemoryMeter()
+    : counters_(new Counters),
+      memory_manager_{counters_, &Alloc, &Free},
+      initial_peak_rss_(PeakRss()),
+      scope_(&memory_manager_) {}
+
+MemoryMeter::~MemoryMeter() { counters_->Unref(); }
+
+size_t MemoryMeter::PeakBytes() const {
+  return counters_->stats.Get(JXL_MEMORY_TAG_ALL).peak_bytes;
+}
+
+size_t MemoryMeter::NumAllocations() const {
+  return counters_->stats.Get(JXL_MEMORY_TAG_ALL).num_allocations;
+}
+
+size_t MemoryMeter::PeakRssIncrease() const {
+  const size_t peak_rss = PeakRss();
+  return peak_rss > initial_peak_rss_ ? peak_rss - initial_peak_rss_ : 0;
+}
+
+void* MemoryMeter::Alloc(void* opaque, size_t size) {
+  Counters* counters = static_cast<Counters*>(opaque);
+  uint8_t* allocation = static_cast<uint8_t*>(malloc(kHeaderSize + size));
+  if (allocation == nullptr) return nullptr;
+  *reinterpret_cast<size_t*>(allocation) = size;
+  counters->refs.fetch_add(1, std::memory_order_relaxed);
+  counters->stats.Add(JXL_MEMORY_TAG_OTHER, size);
+  return allocation + kHeaderSize;
+}
+
+void MemoryMeter::Free(void* opaque, void* address) {
+  if (address == nullptr) return;
+  Counters* counters = static_cast<Counters*>(opaque);
+  uint8_t* allocation = static_cast<uint8_t*>(address) - kHeaderSize;
+  counters->stats.Remove(JXL_MEMORY_TAG_OTHER,
+                         *reinterpret_cast<size_t*>(allocation));
+  free(allocation);
+  counters->Unref();
+}
+
+}  // namespace tools
+}  // namespace jpegxl
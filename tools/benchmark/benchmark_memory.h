@@ -0,0 +1,58 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef TOOLS_BENCHMARK_BENCHMARK_MEMORY_H_
+#define TOOLS_BENCHMARK_BENCHMARK_MEMORY_H_
+
+#include <jxl/memory_manager.h>
+#include <stddef.h>
+
+#include "lib/jxl/base/cache_aligned.h"
+
+namespace jpegxl {
+namespace tools {
+
+// Measures the memory used by a step of the benchmark, e.g. the encoding of
+// an image. While it is alive, the image buffers allocated on the calling
+// thread (and on the threads of the ThreadPool it runs) are counted, and
+// codecs can pass the memory manager of the innermost meter,
+// jxl::CacheAligned::CurrentMemoryManager(), to the libraries that accept
+// one. Allocations that the libraries make with malloc are not counted.
+class MemoryMeter {
+ public:
+  MemoryMeter();
+  ~MemoryMeter();
+  MemoryMeter(const MemoryMeter&) = delete;
+  MemoryMeter& operator=(const MemoryMeter&) = delete;
+
+  // Counts the allocations made with it, on any thread, also after the scope
+  // of the meter.
+  const JxlMemoryManager* memory_manager() const { return &memory_manager_; }
+
+  size_t PeakBytes() const;
+  size_t NumAllocations() const;
+
+  // Returns how much the peak resident set size of the process increased
+  // since the construction, or 0 if unknown. Only meaningful if no other
+  // thread of the process allocates memory meanwhile.
+  size_t PeakRssIncrease() const;
+
+ private:
+  // Shared by the meter and its allocations, which can outlive it.
+  struct Counters;
+
+  static void* Alloc(void* opaque, size_t size);
+  static void Free(void* opaque, void* address);
+
+  Counters* counters_;
+  const JxlMemoryManager memory_manager_;
+  const size_t initial_peak_rss_;
+  jxl::CacheAligned::ScopedMemoryManager scope_;
+};
+
+}  // namespace tools
+}  // namespace jpegxl
+
+#endif  // TOOLS_BENCHMARK_BENCHMARK_MEMORY_H_
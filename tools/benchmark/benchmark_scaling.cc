@@ -0,0 +1,214 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "tools/benchmark/benchmark_scaling.h"
+
+#include <jxl/encode.h>
+#include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "lib/extras/dec/color_hints.h"
+#include "lib/extras/dec/decode.h"
+#include "lib/extras/dec/jxl.h"
+#include "lib/extras/enc/jxl.h"
+#include "lib/extras/packed_image.h"
+#include "lib/extras/time.h"
+#include "lib/jxl/base/file_io.h"
+#include "lib/jxl/base/printf_macros.h"
+#include "lib/jxl/base/span.h"
+#include "tools/benchmark/benchmark_args.h"
+#include "tools/benchmark/benchmark_file_io.h"
+#include "tools/speed_stats.h"
+
+namespace jpegxl {
+namespace tools {
+namespace {
+
+struct EncoderPhase {
+  JxlEncoderStatsKey key;
+  const char* name;
+};
+
+constexpr EncoderPhase kEncoderPhases[] = {
+    {JXL_ENC_STAT_COLOR_TRANSFORM_MICROSECONDS, "color transform"},
+    {JXL_ENC_STAT_AC_STRATEGY_MICROSECONDS, "AC strategy"},
+    {JXL_ENC_STAT_QUANTIZATION_MICROSECONDS, "quantization"},
+    {JXL_ENC_STAT_TOKENIZATION_MICROSECONDS, "tokenization"},
+    {JXL_ENC_STAT_MODULAR_MICROSECONDS, "modular (tree learning)"},
+    {JXL_ENC_STAT_HISTOGRAMS_MICROSECONDS, "histograms"},
+    {JXL_ENC_STAT_GROUPS_MICROSECONDS, "groups"},
+};
+constexpr size_t kNumEncoderPhases =
+    sizeof(kEncoderPhases) / sizeof(kEncoderPhases[0]);
+
+// 1, 2, 4, ... and `max_threads` itself if it is not a power of two.
+std::vector<size_t> ThreadCounts(size_t max_threads) {
+  std::vector<size_t> counts;
+  for (size_t n = 1; n < max_threads; n *= 2) counts.push_back(n);
+  counts.push_back(max_threads);
+  return counts;
+}
+
+struct Scaling {
+  ThreadScaling encode;
+  ThreadScaling encoder_phases[kNumEncoderPhases];
+  ThreadScaling decode;
+  // Time of each render stage summed over all threads, by thread count.
+  std::vector<std::vector<JxlRenderStageStats>> render_stats;
+};
+
+// Adds to `scaling` the encode and decode times of `ppf` with `num_threads`.
+bool Measure(const jxl::extras::PackedPixelFile& ppf, size_t num_threads,
+             Scaling* scaling) {
+  JxlThreadParallelRunnerPtr runner =
+      JxlThreadParallelRunnerMake(nullptr, num_threads);
+  jxl::extras::JXLCompressParams cparams;
+  cparams.distance = Args()->thread_scaling_distance;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT,
+                    Args()->thread_scaling_effort);
+  cparams.runner_opaque = runner.get();
+
+  const size_t encode_reps = std::max<size_t>(Args()->encode_reps, 1);
+  SpeedStats encode_speed;
+  double phase_seconds[kNumEncoderPhases] = {};
+  std::vector<uint8_t> compressed;
+  for (size_t rep = 0; rep < encode_reps; ++rep) {
+    JxlEncoderStats* stats = JxlEncoderStatsCreate();
+    cparams.stats = stats;
+    compressed.clear();
+    const double start = jxl::Now();
+    const bool ok = jxl::extras::EncodeImageJXL(cparams, ppf,
+                                                /*jpeg_bytes=*/nullptr,
+                                                &compressed);
+    encode_speed.NotifyElapsed(jxl::Now() - start);
+    for (size_t i = 0; i < kNumEncoderPhases; ++i) {
+      phase_seconds[i] +=
+          JxlEncoderStatsGet(stats, kEncoderPhases[i].key) * 1E-6 /
+          encode_reps;
+    }
+    JxlEncoderStatsDestroy(stats);
+    if (!ok) return false;
+  }
+
+  jxl::extras::JXLDecompressParams dparams;
+  dparams.runner = JxlThreadParallelRunner;
+  dparams.runner_opaque = runner.get();
+  std::vector<JxlRenderStageStats> render_stats;
+  const size_t decode_reps = std::max<size_t>(Args()->decode_reps, 1);
+  SpeedStats decode_speed;
+  for (size_t rep = 0; rep < decode_reps; ++rep) {
+    // Only the last repetition is measured per stage.
+    dparams.render_stats = rep + 1 == decode_reps ? &render_stats : nullptr;
+    jxl::extras::PackedPixelFile decoded;
+    const double start = jxl::Now();
+    if (!jxl::extras::DecodeImageJXL(compressed.data(), compressed.size(),
+                                     dparams, /*decoded_bytes=*/nullptr,
+                                     &decoded)) {
+      return false;
+    }
+    decode_speed.NotifyElapsed(jxl::Now() - start);
+  }
+
+  SpeedStats::Summary summary;
+  if (!encode_speed.GetSummary(&summary)) return false;
+  scaling->encode.NotifyElapsed(num_threads, summary.central_tendency);
+  for (size_t i = 0; i < kNumEncoderPhases; ++i) {
+    scaling->encoder_phases[i].NotifyElapsed(num_threads, phase_seconds[i]);
+  }
+  if (!decode_speed.GetSummary(&summary)) return false;
+  scaling->decode.NotifyElapsed(num_threads, summary.central_tendency);
+  scaling->render_stats.push_back(std::move(render_stats));
+  return true;
+}
+
+void PrintScaling(const std::vector<size_t>& thread_counts,
+                  const Scaling& scaling) {
+  scaling.encode.Print("Encode");
+  printf("\nEncoder phase             serial fraction\n");
+  for (size_t i = 0; i < kNumEncoderPhases; ++i) {
+    printf("%-25s %15.3f\n", kEncoderPhases[i].name,
+           scaling.encoder_phases[i].SerialFraction());
+  }
+  printf("\n");
+  scaling.decode.Print("Decode");
+
+  // The render stages only report the time summed over the threads, so their
+  // serial fraction is unknown; an increase of that summed time shows
+  // contention or synchronization overhead instead.
+  const std::vector<JxlRenderStageStats>& single = scaling.render_stats[0];
+  if (single.empty()) return;
+  printf("\nRender stage     thread time relative to 1 thread\n%-16s",
+         "threads:");
+  for (size_t n : thread_counts) printf(" %6" PRIuS, n);
+  printf("\n");
+  for (const JxlRenderStageStats& stage : single) {
+    printf("%-16s", stage.name);
+    for (const std::vector<JxlRenderStageStats>& stats :
+         scaling.render_stats) {
+      auto it = std::find_if(stats.begin(), stats.end(),
+                             [&](const JxlRenderStageStats& other) {
+                               return !strcmp(other.name, stage.name);
+                             });
+      if (it == stats.end() || stage.nanoseconds == 0) {
+        printf(" %6s", "-");
+      } else {
+        printf(" %6.2f", 1.0 * it->nanoseconds / stage.nanoseconds);
+      }
+    }
+    printf("\n");
+  }
+}
+
+}  // namespace
+
+int RunThreadScalingBenchmark() {
+  size_t max_threads = Args()->thread_scaling_max;
+  if (max_threads == 0) {
+    max_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  }
+  const std::vector<size_t> thread_counts = ThreadCounts(max_threads);
+
+  std::vector<std::string> fnames;
+  if (!MatchFiles(Args()->input, &fnames) || fnames.empty()) {
+    fprintf(stderr, "No files match --input %s\n", Args()->input.c_str());
+    return EXIT_FAILURE;
+  }
+  for (const std::string& fname : fnames) {
+    std::vector<uint8_t> encoded;
+    jxl::extras::PackedPixelFile ppf;
+    if (!jxl::ReadFile(fname, &encoded) ||
+        !jxl::extras::DecodeBytes(jxl::Span<const uint8_t>(encoded),
+                                  jxl::extras::ColorHints(), &ppf)) {
+      fprintf(stderr, "Failed to load %s\n", fname.c_str());
+      return EXIT_FAILURE;
+    }
+    Scaling scaling;
+    for (size_t num_threads : thread_counts) {
+      if (!Measure(ppf, num_threads, &scaling)) {
+        fprintf(stderr,
+                "Failed to encode or decode %s with %" PRIuS " threads\n",
+                fname.c_str(), num_threads);
+        return EXIT_FAILURE;
+      }
+    }
+    printf("%s\n", fname.c_str());
+    PrintScaling(thread_counts, scaling);
+    printf("\n");
+  }
+  return EXIT_SUCCESS;
+}
+
+}  // namespace tools
+}  // namespace jpegxl
@@ -0,0 +1,21 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef TOOLS_BENCHMARK_BENCHMARK_SCALING_H_
+#define TOOLS_BENCHMARK_BENCHMARK_SCALING_H_
+
+namespace jpegxl {
+namespace tools {
+
+// Implements --thread_scaling: encodes and decodes each image matched by
+// --input with 1, 2, 4, ... up to --thread_scaling_max threads, and prints the
+// speedup, efficiency and estimated serial fraction of the encoder, of each of
+// its phases and of the decoder. Returns the exit code of the program.
+int RunThreadScalingBenchmark();
+
+}  // namespace tools
+}  // namespace jpegxl
+
+#endif  // TOOLS_BENCHMARK_BENCHMARK_SCALING_H_
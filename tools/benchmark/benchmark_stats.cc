@@ -5,6 +5,7 @@
 
 #include "tools/benchmark/benchmark_stats.h"
 
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -99,6 +100,12 @@ std::vector<ColumnDescriptor> GetColumnDescriptors(size_t num_extra_metrics) {
       {{"64"},              8,  4, TYPE_POSITIVE_FLOAT, true},
       {{"BPP*pnorm"},      16, 12, TYPE_POSITIVE_FLOAT, false},
       {{"Bugs"},            7,  5, TYPE_COUNT, false},
+      {{"E peak MB"},      10,  2, TYPE_POSITIVE_FLOAT, false},
+      {{"E allocs"},        9,  0, TYPE_SIZE, true},
+      {{"E RSS MB"},        9,  2, TYPE_POSITIVE_FLOAT, true},
+      {{"D peak MB"},      10,  2, TYPE_POSITIVE_FLOAT, false},
+      {{"D allocs"},        9,  0, TYPE_SIZE, true},
+      {{"D RSS MB"},        9,  2, TYPE_POSITIVE_FLOAT, true},
   };
   // clang-format on
 
@@ -157,6 +164,16 @@ void BenchmarkStats::Assimilate(const BenchmarkStats& victim) {
   distances.insert(distances.end(), victim.distances.begin(),
                    victim.distances.end());
   total_errors += victim.total_errors;
+  max_encode_peak_bytes =
+      std::max(max_encode_peak_bytes, victim.max_encode_peak_bytes);
+  total_encode_allocations += victim.total_encode_allocations;
+  max_encode_peak_rss =
+      std::max(max_encode_peak_rss, victim.max_encode_peak_rss);
+  max_decode_peak_bytes =
+      std::max(max_decode_peak_bytes, victim.max_decode_peak_bytes);
+  total_decode_allocations += victim.total_decode_allocations;
+  max_decode_peak_rss =
+      std::max(max_decode_peak_rss, victim.max_decode_peak_rss);
   jxl_stats.Assimilate(victim.jxl_stats);
   if (extra_metrics.size() < victim.extra_metrics.size()) {
     extra_metrics.resize(victim.extra_metrics.size());
@@ -166,6 +183,35 @@ void BenchmarkStats::Assimilate(const BenchmarkStats& victim) {
   }
 }
 
+void JxlStats::Assimilate(const JxlStats& victim) {
+  num_inputs += victim.num_inputs;
+  aux_out.Assimilate(victim.aux_out);
+  for (const JxlRenderStageStats& stage : victim.render_stats) {
+    auto it = std::find_if(render_stats.begin(), render_stats.end(),
+                           [&](const JxlRenderStageStats& stats) {
+                             return strcmp(stats.name, stage.name) == 0;
+                           });
+    if (it == render_stats.end()) {
+      render_stats.push_back(stage);
+    } else {
+      it->rows += stage.rows;
+      it->nanoseconds += stage.nanoseconds;
+      it->bytes += stage.bytes;
+    }
+  }
+}
+
+void JxlStats::Print() const {
+  aux_out.Print(num_inputs);
+  if (render_stats.empty()) return;
+  printf("Render stage          rows     ms       MB   GB/s\n");
+  for (const JxlRenderStageStats& stats : render_stats) {
+    printf("%-16s %9" PRIu64 " %8.2f %8.1f %6.2f\n", stats.name, stats.rows,
+           stats.nanoseconds * 1E-6, stats.bytes * 1E-6,
+           stats.nanoseconds ? 1.0 * stats.bytes / stats.nanoseconds : 0.0);
+  }
+}
+
 void BenchmarkStats::PrintMoreStats() const {
   if (Args()->print_more_stats) {
     jxl_stats.Print();
@@ -251,8 +297,14 @@ std::vector<ColumnValue> BenchmarkStats::ComputeColumns(
                  total_input_pixels;
   values[22].f = bpp_p_norm;
   values[23].i = total_errors;
+  values[24].f = max_encode_peak_bytes * 1E-6;
+  values[25].i = total_encode_allocations;
+  values[26].f = max_encode_peak_rss * 1E-6;
+  values[27].f = max_decode_peak_bytes * 1E-6;
+  values[28].i = total_decode_allocations;
+  values[29].f = max_decode_peak_rss * 1E-6;
   for (size_t i = 0; i < extra_metrics.size(); i++) {
-    values[24 + i].f = extra_metrics[i] / total_input_files;
+    values[30 + i].f = extra_metrics[i] / total_input_files;
   }
   return values;
 }
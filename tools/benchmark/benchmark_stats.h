@@ -6,6 +6,7 @@
 #ifndef TOOLS_BENCHMARK_BENCHMARK_STATS_H_
 #define TOOLS_BENCHMARK_BENCHMARK_STATS_H_
 
+#include <jxl/decode.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -26,14 +27,13 @@ struct JxlStats {
     num_inputs = 0;
     aux_out = AuxOut();
   }
-  void Assimilate(const JxlStats& victim) {
-    num_inputs += victim.num_inputs;
-    aux_out.Assimilate(victim.aux_out);
-  }
-  void Print() const { aux_out.Print(num_inputs); }
+  void Assimilate(const JxlStats& victim);
+  void Print() const;
 
   size_t num_inputs;
   AuxOut aux_out;
+  // Decoder render pipeline counters, by stage name.
+  std::vector<JxlRenderStageStats> render_stats;
 };
 
 // The value of an entry in the table. Depending on the ColumnType, the string,
@@ -69,6 +69,14 @@ struct BenchmarkStats {
   double ssimulacra2 = 0.0;
   std::vector<float> distances;
   size_t total_errors = 0;
+  // Memory used by encoding and decoding one image, see MemoryMeter. The
+  // peaks are the maximum over the images, the allocation counts the sum.
+  size_t max_encode_peak_bytes = 0;
+  size_t total_encode_allocations = 0;
+  size_t max_encode_peak_rss = 0;
+  size_t max_decode_peak_bytes = 0;
+  size_t total_decode_allocations = 0;
+  size_t max_decode_peak_rss = 0;
   JxlStats jxl_stats;
   std::vector<float> extra_metrics;
 };
@@ -37,13 +37,18 @@
 #include "lib/jxl/enc_butteraugli_comparator.h"
 #include "lib/jxl/enc_butteraugli_pnorm.h"
 #include "lib/jxl/enc_color_management.h"
+#include "lib/jxl/enc_image_bundle.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/jpeg/enc_jpeg_data.h"
 #include "tools/benchmark/benchmark_args.h"
 #include "tools/benchmark/benchmark_codec.h"
+#include "tools/benchmark/benchmark_concurrency.h"
+#include "tools/benchmark/benchmark_decode.h"
 #include "tools/benchmark/benchmark_file_io.h"
+#include "tools/benchmark/benchmark_memory.h"
+#include "tools/benchmark/benchmark_scaling.h"
 #include "tools/benchmark/benchmark_stats.h"
 #include "tools/benchmark/benchmark_utils.h"
 #include "tools/codec_config.h"
@@ -61,6 +66,7 @@ using ::jxl::ColorEncoding;
 using ::jxl::Image3F;
 using ::jxl::ImageBundle;
 using ::jxl::ImageF;
+using ::jxl::ImageMetadata;
 using ::jxl::PaddedBytes;
 using ::jxl::Rng;
 using ::jxl::Status;
@@ -129,6 +135,7 @@ void DoCompress(const std::string& filename, const CodecInOut& io,
 
   std::string ext = FileExtension(filename);
   if (valid && !Args()->decode_only) {
+    MemoryMeter meter;
     for (size_t i = 0; i < Args()->encode_reps; ++i) {
       if (codec->CanRecompressJpeg() && (ext == ".jpg" || ext == ".jpeg")) {
         std::string data_in;
@@ -155,6 +162,10 @@ void DoCompress(const std::string& filename, const CodecInOut& io,
     }
     JXL_CHECK(speed_stats.GetSummary(&summary));
     s->total_time_encode += summary.central_tendency;
+    s->max_encode_peak_bytes = meter.PeakBytes();
+    s->total_encode_allocations =
+        meter.NumAllocations() / std::max<size_t>(Args()->encode_reps, 1);
+    s->max_encode_peak_rss = meter.PeakRssIncrease();
   }
 
   if (valid && Args()->decode_only) {
@@ -168,6 +179,7 @@ void DoCompress(const std::string& filename, const CodecInOut& io,
   io2.metadata.m = io.metadata.m;
   if (valid) {
     speed_stats = jpegxl::tools::SpeedStats();
+    MemoryMeter meter;
     for (size_t i = 0; i < Args()->decode_reps; ++i) {
       if (!codec->Decompress(filename, Span<const uint8_t>(*compressed),
                              inner_pool, &io2, &speed_stats)) {
@@ -189,6 +201,10 @@ void DoCompress(const std::string& filename, const CodecInOut& io,
     }
     JXL_CHECK(speed_stats.GetSummary(&summary));
     s->total_time_decode += summary.central_tendency;
+    s->max_decode_peak_bytes = meter.PeakBytes();
+    s->total_decode_allocations =
+        meter.NumAllocations() / std::max<size_t>(Args()->decode_reps, 1);
+    s->max_decode_peak_rss = meter.PeakRssIncrease();
   }
 
   std::string name = FileBaseName(filename);
@@ -225,7 +241,23 @@ void DoCompress(const std::string& filename, const CodecInOut& io,
       // Verify output
       PROFILER_ZONE("Benchmark stats");
       float distance;
+      // Butteraugli and SSIMULACRA2 both compare the images in linear sRGB,
+      // which is converted to once for both of them.
+      ImageMetadata metadata1 = *ib1.metadata();
+      ImageMetadata metadata2 = *ib2.metadata();
+      ImageBundle store1(&metadata1);
+      ImageBundle store2(&metadata2);
+      const ImageBundle* linear1 = &ib1;
+      const ImageBundle* linear2 = &ib2;
       if (SameSize(ib1, ib2)) {
+        JXL_CHECK(TransformIfNeeded(ib1,
+                                    ColorEncoding::LinearSRGB(ib1.IsGray()),
+                                    jxl::GetJxlCms(), inner_pool, &store1,
+                                    &linear1));
+        JXL_CHECK(TransformIfNeeded(ib2,
+                                    ColorEncoding::LinearSRGB(ib2.IsGray()),
+                                    jxl::GetJxlCms(), inner_pool, &store2,
+                                    &linear2));
         ButteraugliParams params;
         if (ib1.metadata()->IntensityTarget() !=
             ib2.metadata()->IntensityTarget()) {
@@ -240,8 +272,8 @@ void DoCompress(const std::string& filename, const CodecInOut& io,
         if (fabs(params.intensity_target - 255.0f) < 1e-3) {
           params.intensity_target = 80.0;
         }
-        distance = ButteraugliDistance(ib1, ib2, params, jxl::GetJxlCms(),
-                                       &distmap, inner_pool);
+        distance = ButteraugliDistance(*linear1, *linear2, params,
+                                       jxl::GetJxlCms(), &distmap, inner_pool);
         // Ensure pixels in range 0-1
         s->distance_2 += ComputeDistance2(ib1, ib2, jxl::GetJxlCms());
       } else {
@@ -255,7 +287,13 @@ void DoCompress(const std::string& filename, const CodecInOut& io,
       s->distance_p_norm +=
           ComputeDistanceP(distmap, ButteraugliParams(), Args()->error_pnorm) *
           input_pixels;
-      s->ssimulacra2 += ComputeSSIMULACRA2(ib1, ib2).Score() * input_pixels;
+      // SSIMULACRA2 blends the alpha channel before the conversion.
+      const bool has_alpha = ib1.HasAlpha() || ib2.HasAlpha();
+      s->ssimulacra2 += ComputeSSIMULACRA2(has_alpha ? ib1 : *linear1,
+                                           has_alpha ? ib2 : *linear2,
+                                           inner_pool)
+                            .Score() *
+                        input_pixels;
       s->max_distance = std::max(s->max_distance, distance);
       s->distances.push_back(distance);
       max_distance = std::max(max_distance, distance);
@@ -693,12 +731,16 @@ struct StatPrinter {
         t.stats.total_input_pixels / (1000000.0 * t.stats.total_time_decode);
     if (Args()->print_details_csv) {
       printf("%s,%s,%" PRIdS ",%" PRIdS ",%" PRIdS
-             ",%.8f,%.8f,%.8f,%.8f,%.8f,%.8f,%.8f,%.8f",
+             ",%.8f,%.8f,%.8f,%.8f,%.8f,%.8f,%.8f,%.8f,%" PRIuS ",%" PRIuS
+             ",%" PRIuS ",%" PRIuS ",%" PRIuS ",%" PRIuS,
              (*methods_)[t.idx_method].c_str(),
              FileBaseName((*fnames_)[t.idx_image]).c_str(),
              t.stats.total_errors, t.stats.total_compressed_size, pixels,
              enc_mps, dec_mps, comp_bpp, t.stats.max_distance, psnr, p_norm,
-             bpp_p_norm, adj_comp_bpp);
+             bpp_p_norm, adj_comp_bpp, t.stats.max_encode_peak_bytes,
+             t.stats.total_encode_allocations, t.stats.max_encode_peak_rss,
+             t.stats.max_decode_peak_bytes, t.stats.total_decode_allocations,
+             t.stats.max_decode_peak_rss);
       for (float m : t.stats.extra_metrics) {
         printf(",%.8f", m);
       }
@@ -717,10 +759,16 @@ struct StatPrinter {
       printf(
           "error:%" PRIdS "    size:%8" PRIdS "    pixels:%9" PRIdS
           "    enc_speed:%8.8f    dec_speed:%8.8f    bpp:%10.8f    dist:%10.8f"
-          "    psnr:%10.8f    p:%10.8f    bppp:%10.8f    qabpp:%10.8f ",
+          "    psnr:%10.8f    p:%10.8f    bppp:%10.8f    qabpp:%10.8f"
+          "    enc_mem:%" PRIuS "    enc_allocs:%" PRIuS "    enc_rss:%" PRIuS
+          "    dec_mem:%" PRIuS "    dec_allocs:%" PRIuS "    dec_rss:%" PRIuS
+          " ",
           t.stats.total_errors, t.stats.total_compressed_size, pixels, enc_mps,
           dec_mps, comp_bpp, t.stats.max_distance, psnr, p_norm, bpp_p_norm,
-          adj_comp_bpp);
+          adj_comp_bpp, t.stats.max_encode_peak_bytes,
+          t.stats.total_encode_allocations, t.stats.max_encode_peak_rss,
+          t.stats.max_decode_peak_bytes, t.stats.total_decode_allocations,
+          t.stats.max_decode_peak_rss);
       for (size_t i = 0; i < t.stats.extra_metrics.size(); i++) {
         printf(" %s:%.8f", (*extra_metrics_names_)[i].c_str(),
                t.stats.extra_metrics[i]);
@@ -812,6 +860,20 @@ class Benchmark {
   // Return the exit code of the program.
   static int Run() {
     int ret = EXIT_SUCCESS;
+    if (!Args()->trace_file.empty()) {
+      if (!JXL_PROFILER_ENABLED) {
+        fprintf(stderr,
+                "--trace_file requires a build with JPEGXL_ENABLE_PROFILER.\n");
+        return EXIT_FAILURE;
+      }
+      PROFILER_ENABLE_TRACE();
+    }
+    if (Args()->profiler_counters && !PROFILER_ENABLE_COUNTERS()) {
+      fprintf(stderr,
+              "--profiler_counters requires a build with "
+              "JPEGXL_ENABLE_PROFILER and access to perf events.\n");
+      return EXIT_FAILURE;
+    }
     {
       PROFILER_FUNC;
 
@@ -841,6 +903,11 @@ class Benchmark {
     }
 
     // Must have exited profiler zone above before calling.
+    if (!Args()->trace_file.empty() &&
+        !PROFILER_WRITE_TRACE(Args()->trace_file.c_str())) {
+      fprintf(stderr, "Failed to write %s.\n", Args()->trace_file.c_str());
+      ret = EXIT_FAILURE;
+    }
     if (Args()->profiler) {
       PROFILER_PRINT_RESULTS();
     }
@@ -1101,7 +1168,8 @@ class Benchmark {
       // Print CSV header
       printf(
           "method,image,error,size,pixels,enc_speed,dec_speed,"
-          "bpp,dist,psnr,p,bppp,qabpp");
+          "bpp,dist,psnr,p,bppp,qabpp,enc_mem,enc_allocs,enc_rss,dec_mem,"
+          "dec_allocs,dec_rss");
       for (const std::string& s : extra_metrics_names) {
         printf(",%s", s.c_str());
       }
@@ -1153,6 +1221,10 @@ int BenchmarkMain(int argc, const char** argv) {
     fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
     return 1;
   }
+  if (Args()->decode_throughput) return RunDecodeBenchmark();
+  if (Args()->progressive_timeline) return RunProgressiveBenchmark();
+  if (Args()->thread_scaling) return RunThreadScalingBenchmark();
+  if (Args()->concurrency) return RunConcurrencyBenchmark();
   return Benchmark::Run();
 }
 
@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+# Copyright (c) the JPEG XL Project Authors. All rights reserved.
+#
+# Use of this source code is governed by a BSD-style
+# license that can be found in the LICENSE file.
+
+
+"""corpus_benchmark.py: Benchmark a corpus and detect regressions.
+
+Runs benchmark_xl with --print_details_csv over the images and codecs of a
+corpus manifest, writes the results as JSON and optionally compares them with
+the JSON of a previous run, failing if a codec got larger, slower, used more
+memory or lost quality beyond the given tolerances.
+
+The manifest is a JSON object:
+  {
+    "images": ["photos/*.png", "screenshots/*.png"],
+    "codecs": ["jxl:d1", "jxl:d0:e3"],
+    "benchmark_args": ["--num_threads=0", "--encode_reps=3"]
+  }
+where the image patterns are relative to the manifest and the optional
+benchmark_args are passed to every benchmark_xl run.
+"""
+
+import argparse
+import csv
+import io
+import json
+import os
+import subprocess
+import sys
+
+# CSV columns of benchmark_xl --print_details_csv and their JSON names.
+COLUMNS = [
+    ('error', 'errors', int),
+    ('size', 'bytes', int),
+    ('pixels', 'pixels', int),
+    ('enc_speed', 'enc_mps', float),
+    ('dec_speed', 'dec_mps', float),
+    ('bpp', 'bpp', float),
+    ('dist', 'max_distance', float),
+    ('psnr', 'psnr', float),
+    ('p', 'pnorm', float),
+    ('enc_mem', 'enc_peak_bytes', int),
+    ('dec_mem', 'dec_peak_bytes', int),
+]
+
+# Other columns that are not extra metrics.
+OTHER_COLUMNS = ['method', 'image', 'bppp', 'qabpp', 'enc_allocs', 'enc_rss',
+                 'dec_allocs', 'dec_rss']
+
+# For each compared metric: JSON name, tolerance option, and whether larger
+# values are better.
+CHECKS = [
+    ('bytes', 'size_tolerance', False),
+    ('enc_mps', 'speed_tolerance', True),
+    ('dec_mps', 'speed_tolerance', True),
+    ('enc_peak_bytes', 'memory_tolerance', False),
+    ('dec_peak_bytes', 'memory_tolerance', False),
+    ('max_distance', 'quality_tolerance', False),
+    ('pnorm', 'quality_tolerance', False),
+]
+
+
+def ParseDetailsCsv(output):
+  """Returns the rows of the --print_details_csv table in `output`."""
+  lines = output.splitlines()
+  for start, line in enumerate(lines):
+    if line.startswith('method,image,'):
+      break
+  else:
+    raise ValueError('benchmark_xl printed no CSV details')
+  num_fields = lines[start].count(',')
+  table = []
+  for line in lines[start:]:
+    if line.count(',') != num_fields:
+      break
+    table.append(line)
+  rows = []
+  for row in csv.DictReader(io.StringIO('\n'.join(table))):
+    result = {'codec': row['method'], 'image': row['image']}
+    for column, name, parse in COLUMNS:
+      result[name] = parse(row[column])
+    known = set(OTHER_COLUMNS + [c[0] for c in COLUMNS])
+    for column, value in row.items():
+      if column not in known:
+        result.setdefault('extra_metrics', {})[column] = float(value)
+    rows.append(result)
+  return rows
+
+
+def RunBenchmark(benchmark_xl, pattern, codecs, args):
+  cmd = [benchmark_xl, '--print_details_csv', '--input=' + pattern,
+         '--codec=' + ','.join(codecs)] + args
+  print(' '.join(cmd), file=sys.stderr)
+  output = subprocess.run(cmd, check=True, stdout=subprocess.PIPE,
+                          universal_newlines=True).stdout
+  return ParseDetailsCsv(output)
+
+
+def Totals(images):
+  """Aggregates the per-image results of one codec."""
+  totals = {
+      'errors': sum(r['errors'] for r in images),
+      'bytes': sum(r['bytes'] for r in images),
+      'pixels': sum(r['pixels'] for r in images),
+      'max_distance': max(r['max_distance'] for r in images),
+      'enc_peak_bytes': max(r['enc_peak_bytes'] for r in images),
+      'dec_peak_bytes': max(r['dec_peak_bytes'] for r in images),
+  }
+  # Speeds are total pixels over total time, other averages are weighted by
+  # the number of pixels.
+  for speed in ('enc_mps', 'dec_mps'):
+    seconds = sum(r['pixels'] / r[speed] for r in images if r[speed] > 0)
+    totals[speed] = totals['pixels'] / seconds if seconds > 0 else 0.0
+  for metric in ('psnr', 'pnorm'):
+    totals[metric] = (sum(r[metric] * r['pixels'] for r in images) /
+                      max(totals['pixels'], 1))
+  totals['bpp'] = totals['bytes'] * 8.0 / max(totals['pixels'], 1)
+  return totals
+
+
+def Compare(baseline, current, tolerances):
+  """Returns a description of each regression of `current` over `baseline`."""
+  regressions = []
+  for codec, totals in sorted(current['totals'].items()):
+    if codec not in baseline['totals']:
+      continue
+    base = baseline['totals'][codec]
+    if totals['errors'] > base['errors']:
+      regressions.append('%s: errors %d -> %d' %
+                         (codec, base['errors'], totals['errors']))
+    for metric, tolerance_name, larger_is_better in CHECKS:
+      old, new = base[metric], totals[metric]
+      if old == 0:
+        continue
+      change = (new - old) / old
+      if larger_is_better:
+        change = -change
+      if change > tolerances[tolerance_name]:
+        regressions.append('%s: %s %g -> %g (%+.2f%%)' %
+                           (codec, metric, old, new, 100.0 * (new - old) / old))
+  return regressions
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument('--benchmark_xl', default='build/tools/benchmark_xl',
+                      help='path of the benchmark_xl binary')
+  parser.add_argument('--manifest', required=True,
+                      help='JSON corpus manifest')
+  parser.add_argument('--output', help='JSON file to write the results to')
+  parser.add_argument('--baseline',
+                      help='JSON results of a previous run to compare with')
+  parser.add_argument('--size_tolerance', type=float, default=0.002,
+                      help='allowed relative increase of the size')
+  parser.add_argument('--speed_tolerance', type=float, default=0.1,
+                      help='allowed relative decrease of the speeds')
+  parser.add_argument('--memory_tolerance', type=float, default=0.1,
+                      help='allowed relative increase of the peak memory')
+  parser.add_argument('--quality_tolerance', type=float, default=0.01,
+                      help='allowed relative increase of the distances')
+  args = parser.parse_args()
+
+  with open(args.manifest) as f:
+    manifest = json.load(f)
+  manifest_dir = os.path.dirname(os.path.abspath(args.manifest))
+  images = []
+  for pattern in manifest['images']:
+    images += RunBenchmark(args.benchmark_xl,
+                           os.path.join(manifest_dir, pattern),
+                           manifest['codecs'],
+                           manifest.get('benchmark_args', []))
+
+  results = {'images': images, 'totals': {}}
+  for codec in manifest['codecs']:
+    rows = [r for r in images if r['codec'] == codec]
+    if rows:
+      results['totals'][codec] = Totals(rows)
+
+  if args.output:
+    with open(args.output, 'w') as f:
+      json.dump(results, f, indent=2, sort_keys=True)
+  for codec, totals in sorted(results['totals'].items()):
+    print('%-24s %12d bytes %8.4f bpp %9.3f enc MP/s %9.3f dec MP/s '
+          '%7.3f max dist' % (codec, totals['bytes'], totals['bpp'],
+                              totals['enc_mps'], totals['dec_mps'],
+                              totals['max_distance']))
+
+  if args.baseline:
+    with open(args.baseline) as f:
+      baseline = json.load(f)
+    regressions = Compare(baseline, results, vars(args))
+    for regression in regressions:
+      print('REGRESSION ' + regression)
+    if regressions:
+      sys.exit(1)
+
+
+if __name__ == '__main__':
+  main()
@@ -51,14 +51,14 @@ Status RunButteraugli(const char* pathname1, const char* pathname2,
                       const std::string& distmap_filename,
                       const std::string& raw_distmap_filename,
                       const std::string& colorspace_hint, double p,
-                      float intensity_target) {
+                      float intensity_target, size_t num_threads) {
   jxl::extras::ColorHints color_hints;
   if (!colorspace_hint.empty()) {
     color_hints.Add("color_space", colorspace_hint);
   }
 
   CodecInOut io1;
-  ThreadPoolInternal pool(4);
+  ThreadPoolInternal pool(num_threads);
   if (!jxl::SetFromFile(pathname1, color_hints, &io1, &pool)) {
     fprintf(stderr, "Failed to read image from %s\n", pathname1);
     return false;
@@ -123,6 +123,7 @@ int main(int argc, char** argv) {
             "  [--intensity_target <intensity_target>]\n"
             "  [--colorspace <colorspace_hint>]\n"
             "  [--pnorm <pth norm>]\n"
+            "  [--num_threads <num_threads>]\n"
             "NOTE: images get converted to linear sRGB for butteraugli. Images"
             " without attached profiles (such as ppm or pfm) are interpreted"
             " as nonlinear sRGB. The hint format is RGB_D65_SRG_Rel_Lin for"
@@ -136,6 +137,7 @@ int main(int argc, char** argv) {
   std::string colorspace;
   double p = 3;
   float intensity_target = 80.0;  // sRGB intensity target.
+  size_t num_threads = 4;
   for (int i = 3; i < argc; i++) {
     if (std::string(argv[i]) == "--distmap" && i + 1 < argc) {
       distmap = argv[++i];
@@ -152,6 +154,13 @@ int main(int argc, char** argv) {
         fprintf(stderr, "Failed to parse pnorm \"%s\".\n", argv[i]);
         return 1;
       }
+    } else if (std::string(argv[i]) == "--num_threads" && i + 1 < argc) {
+      char* end;
+      num_threads = strtoul(argv[++i], &end, 10);
+      if (end == argv[i] || *end != '\0') {
+        fprintf(stderr, "Failed to parse num_threads \"%s\".\n", argv[i]);
+        return 1;
+      }
     } else {
       fprintf(stderr, "Unrecognized flag \"%s\".\n", argv[i]);
       return 1;
@@ -159,5 +168,5 @@ int main(int argc, char** argv) {
   }
 
   return !RunButteraugli(argv[1], argv[2], distmap, raw_distmap, colorspace, p,
-                         intensity_target);
+                         intensity_target, num_threads);
 }
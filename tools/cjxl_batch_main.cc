@@ -0,0 +1,149 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Encodes many images to JPEG XL, several at a time. JPEG files are
+// transcoded losslessly unless --lossless_jpeg=0. All encoders share one
+// thread pool, so that both the files and the groups of each file are
+// processed in parallel, and each file is read and written while others are
+// being encoded.
+
+#include <jxl/encode.h>
+#include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lib/extras/dec/color_hints.h"
+#include "lib/extras/dec/decode.h"
+#include "lib/extras/enc/jxl.h"
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/base/span.h"
+#include "tools/batch_io.h"
+#include "tools/file_io.h"
+
+namespace {
+
+void PrintUsage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options] OUTPUT_DIR INPUT...\n"
+          "Writes OUTPUT_DIR/INPUT.jxl for each input. An INPUT directory "
+          "stands for\nthe files in it.\n"
+          "Options:\n"
+          "  --input_list=FILE  Also reads the inputs from FILE, one per "
+          "line.\n"
+          "  --num_threads=N    Threads of the shared pool (default: all).\n"
+          "  --num_workers=N    Files encoded at once (default: all cores).\n"
+          "  --max_memory_mb=N  Bound on the JPEG bytes and decoded pixels "
+          "in flight,\n"
+          "                     in MiB (default: 1024).\n"
+          "  --effort=N         Encoder effort, 1-9 (default: 7).\n"
+          "  --distance=D       Butteraugli distance of non-JPEG inputs "
+          "(default: 1.0,\n"
+          "                     0 is lossless).\n"
+          "  --lossless_jpeg=0  Decodes JPEG inputs to pixels instead of "
+          "transcoding them.\n",
+          program);
+}
+
+bool IsJPG(const std::vector<uint8_t>& bytes) {
+  return bytes.size() >= 2 && bytes[0] == 0xFF && bytes[1] == 0xD8;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t num_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
+  size_t num_workers = std::thread::hardware_concurrency();
+  size_t max_memory_mb = 1024;
+  size_t effort = 7;
+  float distance = 1.0f;
+  size_t lossless_jpeg = 1;
+  std::string input_list;
+  int first_positional = 1;
+  for (; first_positional < argc; first_positional++) {
+    const char* arg = argv[first_positional];
+    if (strncmp(arg, "--", 2) != 0) break;
+    using jpegxl::tools::ParseBatchFlag;
+    if (!ParseBatchFlag(arg, "--num_threads", &num_threads) &&
+        !ParseBatchFlag(arg, "--num_workers", &num_workers) &&
+        !ParseBatchFlag(arg, "--max_memory_mb", &max_memory_mb) &&
+        !ParseBatchFlag(arg, "--effort", &effort) &&
+        !ParseBatchFlag(arg, "--distance", &distance) &&
+        !ParseBatchFlag(arg, "--lossless_jpeg", &lossless_jpeg) &&
+        !ParseBatchFlag(arg, "--input_list", &input_list)) {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (first_positional >= argc || effort < 1 || effort > 9 ||
+      distance < 0 || lossless_jpeg > 1) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  const std::string output_dir = argv[first_positional];
+  std::vector<std::string> inputs;
+  for (int i = first_positional + 1; i < argc; i++) {
+    if (!jpegxl::tools::AddBatchInput(argv[i], &inputs)) return EXIT_FAILURE;
+  }
+  if (!input_list.empty() &&
+      !jpegxl::tools::AddBatchInputList(input_list.c_str(), &inputs)) {
+    return EXIT_FAILURE;
+  }
+  if (inputs.empty()) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(
+      /*memory_manager=*/nullptr, num_threads);
+  jxl::extras::JXLCompressParams params;
+  params.runner = JxlThreadParallelRunner;
+  params.runner_opaque = runner.get();
+  params.distance = distance;
+  params.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, effort);
+
+  const auto read = [&](size_t index, jxl::extras::PackedPixelFile* ppf,
+                        std::vector<uint8_t>* jpeg_bytes) {
+    const char* input = inputs[index].c_str();
+    std::vector<uint8_t> bytes;
+    if (!jpegxl::tools::ReadFile(input, &bytes)) {
+      fprintf(stderr, "Failed to read %s\n", input);
+      return false;
+    }
+    if (lossless_jpeg && IsJPG(bytes)) {
+      jpeg_bytes->swap(bytes);
+      return true;
+    }
+    if (!jxl::extras::DecodeBytes(jxl::Span<const uint8_t>(bytes),
+                                  jxl::extras::ColorHints(), ppf) ||
+        ppf->frames.empty()) {
+      fprintf(stderr, "Failed to decode %s\n", input);
+      return false;
+    }
+    return true;
+  };
+  const auto write = [&](size_t index, const std::vector<uint8_t>& compressed) {
+    const std::string path =
+        jpegxl::tools::BatchOutputPath(output_dir, inputs[index], ".jxl");
+    if (!jpegxl::tools::WriteFile(path.c_str(), compressed)) {
+      fprintf(stderr, "Failed to write %s\n", path.c_str());
+      return false;
+    }
+    return true;
+  };
+  const size_t num_files = inputs.size();
+  const size_t num_failures = jxl::extras::EncodeBatchJXL(
+      params, num_files, num_workers, max_memory_mb << 20, read, write);
+  if (num_failures != 0) {
+    fprintf(stderr, "%zu of %zu files failed.\n", num_failures, num_files);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -20,7 +20,9 @@
 #include <stdint.h>
 
 #include <cmath>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <sstream>
@@ -40,6 +42,7 @@
 #include "lib/extras/time.h"
 #include "lib/jxl/base/override.h"
 #include "lib/jxl/base/printf_macros.h"
+#include "lib/jxl/base/profiler.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/exif.h"
 #include "tools/args.h"
@@ -107,6 +110,13 @@ struct CompressArgs {
                             "(default: use only if needed).\n",
                             &container, &ParseOverride, 1);
 
+    cmdline->AddOptionValue(
+        '\0', "tile_size", "N",
+        "Encodes images larger than N x N pixels as one frame per tile of "
+        "N x N\npixels, followed by a tile index box, so that the encoder "
+        "only holds one\ntile at a time (default: 0, no tiles).",
+        &tile_size, &ParseUnsigned, 2);
+
     cmdline->AddOptionValue(
         '\0', "jpeg_store_metadata", "0|1",
         ("If --lossless_jpeg=1, store JPEG reconstruction "
@@ -256,6 +266,21 @@ struct CompressArgs {
                            "No output file will be written (for benchmarking)",
                            &disable_output, &SetBooleanTrue, 1);
 
+    cmdline->AddOptionFlag(
+        '\0', "streaming_input",
+        "Maps the PGM/PPM/PFM/PAM input file into memory and passes its "
+        "pixels to the encoder one group at a time, instead of reading and "
+        "converting the whole file first. For APNG and GIF input, passes "
+        "each frame to the encoder as soon as it is decoded instead.",
+        &streaming_input, &SetBooleanTrue, 2);
+
+    cmdline->AddOptionValue(
+        '\0', "trace_file", "FILENAME",
+        "If specified, writes the timeline of the profiler zones of each "
+        "thread to this file in the Chrome trace event format. Requires a "
+        "build with JPEGXL_ENABLE_PROFILER.",
+        &trace_file, &ParseString, 2);
+
     cmdline->AddOptionValue(
         '\0', "photon_noise_iso", "3200",
         "Adds noise to the image emulating photographic film noise. "
@@ -435,8 +460,10 @@ struct CompressArgs {
   // Common flags.
   bool version = false;
   jxl::Override container = jxl::Override::kDefault;
+  size_t tile_size = 0;
   bool quiet = false;
   bool disable_output = false;
+  bool streaming_input = false;
 
   const char* file_in = nullptr;
   const char* file_out = nullptr;
@@ -450,6 +477,7 @@ struct CompressArgs {
   int32_t num_threads = -1;
   size_t num_reps = 1;
   float intensity_target = 0;
+  std::string trace_file;
 
   // Whether to perform lossless transcoding with kVarDCT or kJPEG encoding.
   // If true, attempts to load JPEG coefficients instead of pixels.
@@ -566,11 +594,28 @@ bool IsJPG(const std::vector<uint8_t>& image_data) {
           image_data[1] == 0xD8);
 }
 
+bool IsPNGOrGIF(const std::vector<uint8_t>& image_data) {
+  return image_data.size() >= 4 &&
+         (memcmp(image_data.data(), "\x89PNG", 4) == 0 ||
+          memcmp(image_data.data(), "GIF8", 4) == 0);
+}
+
+// Returns whether the file `path` starts like a PNG or GIF file.
+bool HasPNGOrGIFSignature(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (!file) return false;
+  std::vector<uint8_t> signature(4);
+  const size_t num_read = fread(signature.data(), 1, signature.size(), file);
+  fclose(file);
+  signature.resize(num_read);
+  return IsPNGOrGIF(signature);
+}
+
 // TODO(tfish): Replace with non-C-API library function.
 // Implementation is in extras/.
 jxl::Status GetPixeldata(const std::vector<uint8_t>& image_data,
                          const jxl::extras::ColorHints& color_hints,
-                         jxl::extras::PackedPixelFile& ppf,
+                         size_t num_threads, jxl::extras::PackedPixelFile& ppf,
                          jxl::extras::Codec& codec) {
   // Any valid encoding is larger (ensures codecs can read the first few bytes).
   constexpr size_t kMinBytes = 9;
@@ -602,7 +647,10 @@ jxl::Status GetPixeldata(const std::vector<uint8_t>& image_data,
     }
 #endif
 #if JPEGXL_ENABLE_EXR
-    if (jxl::extras::DecodeImageEXR(encoded, color_hints, &ppf)) {
+    jxl::extras::EXRDecompressParams exr_params;
+    exr_params.num_threads = num_threads;
+    if (jxl::extras::DecodeImageEXR(encoded, color_hints, &ppf,
+                                    /*constraints=*/nullptr, &exr_params)) {
       return jxl::extras::Codec::kEXR;
     }
 #endif
@@ -616,6 +664,53 @@ jxl::Status GetPixeldata(const std::vector<uint8_t>& image_data,
   return true;
 }
 
+// Decodes the APNG or GIF `image_data` into `ppf` and passes each frame to the
+// encoder as soon as it is decoded, so that the decoded frames are not all in
+// memory at the same time. Prints the mode before the first frame if
+// `print_mode`. Returns the number of encoded frames in `num_frames`.
+jxl::Status EncodeFramesAsDecoded(const std::vector<uint8_t>& image_data,
+                                  const CompressArgs& args,
+                                  const jxl::extras::JXLCompressParams& params,
+                                  bool print_mode,
+                                  jxl::extras::PackedPixelFile* ppf,
+                                  std::vector<uint8_t>* compressed,
+                                  size_t* num_frames) {
+  *ppf = jxl::extras::PackedPixelFile();
+  ppf->info.orientation = JXL_ORIENT_IDENTITY;
+  jxl::extras::JXLFrameEncoder encoder(params, *ppf);
+  const auto on_frame = [&](jxl::extras::PackedFrame&& frame) -> jxl::Status {
+    if (encoder.num_frames() == 0) {
+      if (!ppf->metadata.exif.empty()) {
+        jxl::InterpretExif(ppf->metadata.exif, &ppf->info.orientation);
+      }
+      if (print_mode) {
+        PrintMode(*ppf, /*decode_mps=*/0, image_data.size(), args);
+      }
+    }
+    if (!encoder.AddFrame(std::move(frame))) {
+      return JXL_FAILURE("Failed to encode frame.");
+    }
+    return true;
+  };
+  jxl::Span<const uint8_t> encoded(image_data);
+  bool decoded = false;
+#if JPEGXL_ENABLE_APNG
+  if (image_data[0] == 0x89) {
+    decoded = jxl::extras::DecodeImageAPNG(encoded, args.color_hints, ppf,
+                                           /*constraints=*/nullptr, on_frame);
+  }
+#endif
+#if JPEGXL_ENABLE_GIF
+  if (image_data[0] == 'G') {
+    decoded = jxl::extras::DecodeImageGIF(encoded, args.color_hints, ppf,
+                                          /*constraints=*/nullptr, on_frame);
+  }
+#endif
+  if (!decoded) return JXL_FAILURE("Codecs failed to decode input.");
+  *num_frames = encoder.num_frames();
+  return encoder.Finish(compressed);
+}
+
 using flag_check_fn = std::function<std::string(int64_t)>;
 using flag_check_float_fn = std::function<std::string(float)>;
 
@@ -915,9 +1010,9 @@ void ProcessFlags(const jxl::extras::Codec codec,
                     JXL_ENC_FRAME_SETTING_JPEG_COMPRESS_BOXES, params);
   }
   // Set per-frame options.
-  for (size_t num_frame = 0; num_frame < ppf.frames.size(); ++num_frame) {
-    if (num_frame < args->frame_indexing.size() &&
-        args->frame_indexing[num_frame] == '1') {
+  for (size_t num_frame = 0; num_frame < args->frame_indexing.size();
+       ++num_frame) {
+    if (args->frame_indexing[num_frame] == '1') {
       int64_t value = 1;
       params->options.emplace_back(
           jxl::extras::JXLOption(JXL_ENC_FRAME_INDEX_BOX, value, num_frame));
@@ -925,6 +1020,7 @@ void ProcessFlags(const jxl::extras::Codec codec,
   }
   // Copy over the rest of the non-option params.
   params->use_container = args->container == jxl::Override::kOn;
+  params->tile_size = args->tile_size;
   params->jpeg_store_metadata = args->jpeg_store_metadata;
   params->intensity_target = args->intensity_target;
   params->override_bitdepth = args->override_bitdepth;
@@ -978,6 +1074,21 @@ int main(int argc, char** argv) {
             "Encoding will be performed, but the result will be discarded.\n");
   }
 
+  if (!args.trace_file.empty()) {
+    if (!JXL_PROFILER_ENABLED) {
+      std::cerr << "--trace_file requires a build with JPEGXL_ENABLE_PROFILER."
+                << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    PROFILER_ENABLE_TRACE();
+  }
+
+  size_t num_worker_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
+  int64_t flag_num_worker_threads = args.num_threads;
+  if (flag_num_worker_threads > -1) {
+    num_worker_threads = flag_num_worker_threads;
+  }
+
   // Loading the input.
   // Depending on flags-settings, we want to either load a JPEG and
   // faithfully convert it to JPEG XL, or load (JPEG or non-JPEG)
@@ -988,7 +1099,14 @@ int main(int argc, char** argv) {
   std::vector<uint8_t>* jpeg_bytes = nullptr;
   double decode_mps = 0;
   size_t pixels = 0;
-  if (!jpegxl::tools::ReadFile(args.file_in, &image_data)) {
+  jxl::extras::ChunkedPNMDecoder chunked_pnm;
+  // Under --streaming_input, APNG and GIF frames are encoded as they are
+  // decoded, in the encoding loop below.
+  const bool streaming_frames =
+      args.streaming_input && jpegxl::tools::HasPNGOrGIFSignature(args.file_in);
+  size_t num_frames = 0;
+  if ((!args.streaming_input || streaming_frames) &&
+      !jpegxl::tools::ReadFile(args.file_in, &image_data)) {
     std::cerr << "Reading image data failed." << std::endl;
     exit(EXIT_FAILURE);
   }
@@ -997,13 +1115,22 @@ int main(int argc, char** argv) {
   ProcessFlags(codec, ppf, jpeg_bytes, &cmdline, &args, &params);
   if (!args.lossless_jpeg) {
     const double t0 = jxl::Now();
-    jxl::Status status =
-        jpegxl::tools::GetPixeldata(image_data, args.color_hints, ppf, codec);
+    jxl::Status status = true;
+    if (streaming_frames) {
+      codec = image_data[0] == 'G' ? jxl::extras::Codec::kGIF
+                                   : jxl::extras::Codec::kPNG;
+    } else if (args.streaming_input) {
+      status = chunked_pnm.Init(args.file_in, args.color_hints, &ppf);
+      codec = jxl::extras::Codec::kPNM;
+    } else {
+      status = jpegxl::tools::GetPixeldata(image_data, args.color_hints,
+                                           num_worker_threads, ppf, codec);
+    }
     if (!status) {
       std::cerr << "Getting pixel data failed." << std::endl;
       exit(EXIT_FAILURE);
     }
-    if (ppf.frames.empty()) {
+    if (ppf.frames.empty() && !args.streaming_input) {
       std::cerr << "No frames on input file." << std::endl;
       exit(EXIT_FAILURE);
     }
@@ -1033,15 +1160,13 @@ int main(int argc, char** argv) {
     jxl::InterpretExif(ppf.metadata.exif, &ppf.info.orientation);
   }
 
-  if (!args.quiet) {
-    PrintMode(ppf, decode_mps, image_data.size(), args);
+  if (!args.quiet && !streaming_frames) {
+    PrintMode(ppf, decode_mps,
+              args.streaming_input ? chunked_pnm.file_size()
+                                   : image_data.size(),
+              args);
   }
 
-  size_t num_worker_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
-  int64_t flag_num_worker_threads = args.num_threads;
-  if (flag_num_worker_threads > -1) {
-    num_worker_threads = flag_num_worker_threads;
-  }
   JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(
       /*memory_manager=*/nullptr, num_worker_threads);
   params.runner = JxlThreadParallelRunner;
@@ -1051,7 +1176,19 @@ int main(int argc, char** argv) {
   std::vector<uint8_t> compressed;
   for (size_t num_rep = 0; num_rep < args.num_reps; ++num_rep) {
     const double t0 = jxl::Now();
-    if (!EncodeImageJXL(params, ppf, jpeg_bytes, &compressed)) {
+    bool ok;
+    if (streaming_frames) {
+      ok = jpegxl::tools::EncodeFramesAsDecoded(
+          image_data, args, params, !args.quiet && num_rep == 0, &ppf,
+          &compressed, &num_frames);
+      pixels = ppf.info.xsize * ppf.info.ysize;
+    } else if (args.streaming_input) {
+      ok = EncodeImageJXL(params, ppf, chunked_pnm.GetInputSource(),
+                          &compressed);
+    } else {
+      ok = EncodeImageJXL(params, ppf, jpeg_bytes, &compressed);
+    }
+    if (!ok) {
       fprintf(stderr, "EncodeImageJXL() failed.\n");
       return EXIT_FAILURE;
     }
@@ -1076,12 +1213,20 @@ int main(int argc, char** argv) {
     if (!args.lossless_jpeg) {
       const double bpp =
           static_cast<double>(compressed.size() * jxl::kBitsPerByte) / pixels;
-      fprintf(stderr, "(%.3f bpp%s).\n", bpp / ppf.frames.size(),
-              ppf.frames.size() == 1 ? "" : "/frame");
+      if (!streaming_frames) {
+        num_frames = args.streaming_input ? 1 : ppf.frames.size();
+      }
+      fprintf(stderr, "(%.3f bpp%s).\n", bpp / num_frames,
+              num_frames == 1 ? "" : "/frame");
       JXL_CHECK(stats.Print(num_worker_threads));
     } else {
       fprintf(stderr, "\n");
     }
   }
+  if (!args.trace_file.empty() &&
+      !PROFILER_WRITE_TRACE(args.trace_file.c_str())) {
+    std::cerr << "Could not write trace file." << std::endl;
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,140 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Decodes many JPEG XL files, several at a time. All decoders share one
+// thread pool, so that both the files and the groups of each file are
+// processed in parallel, and each file is read and written while others are
+// being decoded.
+
+#include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lib/extras/dec/jxl.h"
+#include "lib/extras/enc/encode.h"
+#include "lib/extras/packed_image.h"
+#include "tools/batch_io.h"
+#include "tools/file_io.h"
+
+namespace {
+
+void PrintUsage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options] OUTPUT_DIR INPUT.jxl...\n"
+          "Writes OUTPUT_DIR/INPUT.png, or the extension of --output_ext, for "
+          "each input,\nwith -N appended for each frame of formats without "
+          "animations. An INPUT\ndirectory stands for the files in it.\n"
+          "Options:\n"
+          "  --input_list=FILE  Also reads the inputs from FILE, one per "
+          "line.\n"
+          "  --output_ext=EXT   Output format (default: .png).\n"
+          "  --num_threads=N    Threads of the shared pool (default: all).\n"
+          "  --num_workers=N    Files decoded at once (default: all cores).\n"
+          "  --max_memory_mb=N  Bound on the decoded pixels in flight, in MiB "
+          "(default: 1024).\n",
+          program);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t num_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
+  size_t num_workers = std::thread::hardware_concurrency();
+  size_t max_memory_mb = 1024;
+  std::string output_ext = ".png";
+  std::string input_list;
+  int first_positional = 1;
+  for (; first_positional < argc; first_positional++) {
+    const char* arg = argv[first_positional];
+    if (strncmp(arg, "--", 2) != 0) break;
+    using jpegxl::tools::ParseBatchFlag;
+    if (!ParseBatchFlag(arg, "--num_threads", &num_threads) &&
+        !ParseBatchFlag(arg, "--num_workers", &num_workers) &&
+        !ParseBatchFlag(arg, "--max_memory_mb", &max_memory_mb) &&
+        !ParseBatchFlag(arg, "--output_ext", &output_ext) &&
+        !ParseBatchFlag(arg, "--input_list", &input_list)) {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (first_positional >= argc) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (output_ext[0] != '.') output_ext = "." + output_ext;
+  const std::unique_ptr<jxl::extras::Encoder> format_encoder =
+      jxl::extras::Encoder::FromExtension(output_ext);
+  if (!format_encoder) {
+    fprintf(stderr, "Can't write files with the extension %s\n",
+            output_ext.c_str());
+    return EXIT_FAILURE;
+  }
+  const std::string output_dir = argv[first_positional];
+  std::vector<std::string> inputs;
+  for (int i = first_positional + 1; i < argc; i++) {
+    if (!jpegxl::tools::AddBatchInput(argv[i], &inputs)) return EXIT_FAILURE;
+  }
+  if (!input_list.empty() &&
+      !jpegxl::tools::AddBatchInputList(input_list.c_str(), &inputs)) {
+    return EXIT_FAILURE;
+  }
+  if (inputs.empty()) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(
+      /*memory_manager=*/nullptr, num_threads);
+  jxl::extras::JXLDecompressParams dparams;
+  dparams.runner = JxlThreadParallelRunner;
+  dparams.runner_opaque = runner.get();
+  dparams.accepted_formats = format_encoder->AcceptedFormats();
+
+  const auto read = [&](size_t index, std::vector<uint8_t>* compressed) {
+    if (!jpegxl::tools::ReadFile(inputs[index].c_str(), compressed)) {
+      fprintf(stderr, "Failed to read %s\n", inputs[index].c_str());
+      return false;
+    }
+    return true;
+  };
+  const auto write = [&](size_t index,
+                         const jxl::extras::PackedPixelFile& ppf) {
+    // Encode only reads the encoder, so that the workers can share it.
+    jxl::extras::EncodedImage encoded;
+    if (!format_encoder->Encode(ppf, &encoded)) {
+      fprintf(stderr, "Failed to encode %s\n", inputs[index].c_str());
+      return false;
+    }
+    const std::string path =
+        jpegxl::tools::BatchOutputPath(output_dir, inputs[index], "");
+    const size_t num_frames = encoded.bitstreams.size();
+    for (size_t i = 0; i < num_frames; ++i) {
+      const std::string frame_path =
+          num_frames == 1 ? path + output_ext
+                          : path + "-" + std::to_string(i) + output_ext;
+      if (!jpegxl::tools::WriteFile(frame_path.c_str(),
+                                    encoded.bitstreams[i])) {
+        fprintf(stderr, "Failed to write %s\n", frame_path.c_str());
+        return false;
+      }
+    }
+    return true;
+  };
+  const size_t num_files = inputs.size();
+  const size_t num_failures = jxl::extras::DecodeBatchJXL(
+      dparams, num_files, num_workers, max_memory_mb << 20, read, write);
+  if (num_failures != 0) {
+    fprintf(stderr, "%zu of %zu files failed.\n", num_failures, num_files);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -16,17 +16,22 @@
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <vector>
 
 #include "lib/extras/dec/decode.h"
 #include "lib/extras/dec/jxl.h"
+#if JPEGXL_ENABLE_APNG
+#include "lib/extras/enc/apng.h"
+#endif
 #include "lib/extras/enc/encode.h"
 #include "lib/extras/enc/pnm.h"
 #include "lib/extras/packed_image.h"
 #include "lib/extras/time.h"
 #include "lib/jxl/base/printf_macros.h"
+#include "lib/jxl/base/profiler.h"
 #include "tools/cmdline.h"
 #include "tools/codec_config.h"
 #include "tools/file_io.h"
@@ -119,6 +124,15 @@ struct DecompressArgs {
                            &use_sjpeg, &SetBooleanTrue);
 #endif
 
+#if JPEGXL_ENABLE_APNG
+    cmdline->AddOptionFlag(
+        '\0', "parallel_png",
+        "For PNG output, compresses groups of rows in parallel while the rest "
+        "of the image is decoded. The file is slightly larger. Animations are "
+        "compressed as usual.",
+        &parallel_png, &SetBooleanTrue);
+#endif
+
     cmdline->AddOptionFlag('\0', "norender_spotcolors",
                            "Disables rendering spot colors.",
                            &render_spotcolors, &SetBooleanFalse);
@@ -153,6 +167,13 @@ struct DecompressArgs {
                            "Print total number of decoded bytes.",
                            &print_read_bytes, &SetBooleanTrue);
 
+    cmdline->AddOptionValue(
+        '\0', "trace_file", "FILENAME",
+        "If specified, writes the timeline of the profiler zones of each "
+        "thread to this file in the Chrome trace event format. Requires a "
+        "build with JPEGXL_ENABLE_PROFILER.",
+        &trace_file, &ParseString);
+
     cmdline->AddOptionFlag('\0', "quiet", "Silence output (except for errors).",
                            &quiet, &SetBooleanTrue);
   }
@@ -170,6 +191,11 @@ struct DecompressArgs {
           "Invalid flag value for --num_threads: must be -1, 0 or positive.\n");
       return false;
     }
+    if (!trace_file.empty() && !JXL_PROFILER_ENABLED) {
+      fprintf(stderr,
+              "--trace_file requires a build with JPEGXL_ENABLE_PROFILER.\n");
+      return false;
+    }
     return true;
   }
 
@@ -187,11 +213,13 @@ struct DecompressArgs {
   bool pixels_to_jpeg = false;
   size_t jpeg_quality = 95;
   bool use_sjpeg = false;
+  bool parallel_png = false;
   bool render_spotcolors = true;
   std::string preview_out;
   std::string icc_out;
   std::string orig_icc_out;
   std::string metadata_out;
+  std::string trace_file;
   bool print_read_bytes = false;
   bool quiet = false;
   // References (ids) of specific options to check if they were matched.
@@ -260,13 +288,18 @@ bool DecompressJxlReconstructJPEG(const jpegxl::tools::DecompressArgs& args,
   return true;
 }
 
+using FramePixelCallback =
+    decltype(jxl::extras::JXLDecompressParams::frame_pixel_callback);
+
 bool DecompressJxlToPackedPixelFile(
     const jpegxl::tools::DecompressArgs& args,
     const std::vector<uint8_t>& compressed,
-    const std::vector<JxlPixelFormat>& accepted_formats, void* runner,
+    const std::vector<JxlPixelFormat>& accepted_formats,
+    const FramePixelCallback& frame_pixel_callback, void* runner,
     jxl::extras::PackedPixelFile* ppf, size_t* decoded_bytes,
     jpegxl::tools::SpeedStats* stats) {
   jxl::extras::JXLDecompressParams dparams;
+  dparams.frame_pixel_callback = frame_pixel_callback;
   dparams.max_downsampling = args.downsampling;
   dparams.accepted_formats = accepted_formats;
   dparams.display_nits = args.display_nits;
@@ -327,6 +360,9 @@ int main(int argc, const char* argv[]) {
     fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
     return EXIT_FAILURE;
   }
+  if (!args.trace_file.empty()) {
+    PROFILER_ENABLE_TRACE();
+  }
 
   std::vector<uint8_t> compressed;
   // Reading compressed JPEG XL input
@@ -433,12 +469,33 @@ int main(int argc, const char* argv[]) {
       }
       accepted_formats = encoder->AcceptedFormats();
     }
+    FramePixelCallback frame_pixel_callback;
+#if JPEGXL_ENABLE_APNG
+    // Set by the decoder, which gives it the pixels as they are decoded.
+    std::unique_ptr<jxl::extras::ParallelPNGEncoder> png_encoder;
+    if (args.parallel_png && codec == jxl::extras::Codec::kPNG) {
+      frame_pixel_callback = [&png_encoder](
+                                 const jxl::extras::PackedPixelFile& ppf,
+                                 const JxlPixelFormat& format)
+          -> jxl::extras::JXLPixelCallback {
+        png_encoder.reset();
+        if (ppf.info.have_animation) return nullptr;
+        png_encoder = jxl::make_unique<jxl::extras::ParallelPNGEncoder>(
+            ppf.info, format);
+        jxl::extras::ParallelPNGEncoder* encoder = png_encoder.get();
+        return [encoder](size_t x, size_t y, size_t num_pixels,
+                         const void* pixels) {
+          encoder->SetPixels(x, y, num_pixels, pixels);
+        };
+      };
+    }
+#endif
     jxl::extras::PackedPixelFile ppf;
     size_t decoded_bytes = 0;
     for (size_t i = 0; i < num_reps; ++i) {
       if (!DecompressJxlToPackedPixelFile(args, compressed, accepted_formats,
-                                          runner.get(), &ppf, &decoded_bytes,
-                                          &stats)) {
+                                          frame_pixel_callback, runner.get(),
+                                          &ppf, &decoded_bytes, &stats)) {
         fprintf(stderr, "DecompressJxlToPackedPixelFile failed\n");
         return EXIT_FAILURE;
       }
@@ -459,9 +516,28 @@ int main(int argc, const char* argv[]) {
       encoder->SetOption("jpeg_encoder", "sjpeg");
     }
 #endif
-    jxl::extras::EncodedImage encoded_image;
+#if JPEGXL_ENABLE_EXR
     if (encoder) {
-      if (!encoder->Encode(ppf, &encoded_image)) {
+      encoder->SetOption("num_threads", std::to_string(num_worker_threads));
+    }
+#endif
+    jxl::extras::EncodedImage encoded_image;
+#if JPEGXL_ENABLE_APNG
+    if (png_encoder) {
+      encoded_image.bitstreams.resize(1);
+      // Fails if the input was truncated, then the image is encoded below.
+      if (!png_encoder->Finish(ppf, &encoded_image.bitstreams[0])) {
+        encoded_image.bitstreams.clear();
+      }
+    }
+    if (encoder && args.parallel_png) {
+      encoder->SetOption("parallel_deflate", "1");
+    }
+#endif
+    jxl::ThreadPool pool(JxlThreadParallelRunner, runner.get());
+    if (encoder && encoded_image.bitstreams.empty()) {
+      if (!encoder->Encode(ppf, &encoded_image,
+                           args.parallel_png ? &pool : nullptr)) {
         fprintf(stderr, "Encode failed\n");
         return EXIT_FAILURE;
       }
@@ -490,5 +566,10 @@ int main(int argc, const char* argv[]) {
   if (!args.quiet) {
     stats.Print(num_worker_threads);
   }
+  if (!args.trace_file.empty() &&
+      !PROFILER_WRITE_TRACE(args.trace_file.c_str())) {
+    fprintf(stderr, "Failed to write %s.\n", args.trace_file.c_str());
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
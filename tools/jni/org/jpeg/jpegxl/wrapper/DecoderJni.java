@@ -15,6 +15,12 @@ import java.nio.Buffer;
 class DecoderJni {
   private static native void nativeGetBasicInfo(int[] context, Buffer data);
   private static native void nativeGetPixels(int[] context, Buffer data, Buffer pixels, Buffer icc);
+  private static native long nativeCreate(int numThreads);
+  private static native void nativeDestroy(long handle);
+  private static native void nativeReset(long handle, int[] context);
+  private static native void nativeSetOutput(
+      long handle, int[] context, Buffer pixels, Buffer icc);
+  private static native void nativeProcess(long handle, int[] context, Buffer data);
 
   static Status makeStatus(int statusCode) {
     switch (statusCode) {
@@ -24,6 +30,8 @@ class DecoderJni {
         return Status.INVALID_STREAM;
       case 1:
         return Status.NOT_ENOUGH_INPUT;
+      case 2:
+        return Status.NEED_OUTPUT_BUFFER;
       default:
         throw new IllegalStateException("Unknown status code");
     }
@@ -68,6 +76,64 @@ class DecoderJni {
     return makeStatus(context[0]);
   }
 
+  /** Create a decoder handle; returns 0 on failure. */
+  static long create(int numThreads) {
+    return nativeCreate(numThreads);
+  }
+
+  static void destroy(long handle) {
+    nativeDestroy(handle);
+  }
+
+  /** Start decoding a new image; zero crop size means no cropping. */
+  static Status reset(long handle, PixelFormat pixelFormat, int downsampling, int cropX0,
+      int cropY0, int cropWidth, int cropHeight) {
+    int[] context = {
+        pixelFormat.ordinal(), downsampling, cropX0, cropY0, cropWidth, cropHeight};
+    nativeReset(handle, context);
+    return makeStatus(context[0]);
+  }
+
+  /** Set the buffers of the decoded image; icc may be null. */
+  static Status setOutput(long handle, Buffer pixels, Buffer icc) {
+    if (!pixels.isDirect()) {
+      throw new IllegalArgumentException("pixels must be direct buffer");
+    }
+    if (icc != null && !icc.isDirect()) {
+      throw new IllegalArgumentException("icc must be direct buffer");
+    }
+    int[] context = new int[1];
+    nativeSetOutput(handle, context, pixels, icc);
+    return makeStatus(context[0]);
+  }
+
+  /**
+   * Decode the bytes between the position and the limit of data, and advance the position past
+   * the consumed bytes.
+   */
+  static StreamInfo process(long handle, Buffer data, boolean lastChunk) {
+    if (!data.isDirect()) {
+      throw new IllegalArgumentException("data must be direct buffer");
+    }
+    int[] context = new int[8];
+    context[0] = data.position();
+    context[1] = data.limit();
+    context[2] = lastChunk ? 1 : 0;
+    nativeProcess(handle, context, data);
+    if (context[1] < 0) {
+      throw new IllegalStateException("JNI has returned negative size");
+    }
+    data.position(data.position() + context[1]);
+    StreamInfo result = new StreamInfo();
+    result.status = makeStatus(context[0]);
+    result.width = context[3];
+    result.height = context[4];
+    result.pixelsSize = context[5];
+    result.iccSize = context[6];
+    result.alphaBits = context[7];
+    return result;
+  }
+
   /** Utility library, disable object construction. */
   private DecoderJni() {}
 }
@@ -114,6 +114,93 @@ public class DecoderTest {
     }
   }
 
+  static ByteBuffer makeFlippedSimpleImage() {
+    ByteBuffer data = makeSimpleImage();
+    data.flip();
+    return data;
+  }
+
+  static void testNativeDecoderReuse() {
+    try (NativeDecoder decoder = new NativeDecoder(2)) {
+      for (int i = 0; i < 3; ++i) {
+        ImageData imageData = decoder.decode(makeFlippedSimpleImage(), PixelFormat.RGBA_8888);
+        checkSimpleImageData(imageData);
+        if (imageData.pixels.limit() != SIMPLE_IMAGE_DIM * SIMPLE_IMAGE_DIM * 4) {
+          throw new IllegalStateException("Unexpected pixels size");
+        }
+      }
+    }
+  }
+
+  static void testNativeDecoderStreaming() {
+    final int chunkSize = 5;
+    ByteBuffer data = ByteBuffer.allocateDirect(SIMPLE_IMAGE_BYTES.length);
+    data.flip();
+    int offset = 0;
+    try (NativeDecoder decoder = new NativeDecoder(0)) {
+      decoder.reset(PixelFormat.RGB_888);
+      Status status = Status.NOT_ENOUGH_INPUT;
+      while (status != Status.OK) {
+        if (status == Status.NEED_OUTPUT_BUFFER) {
+          decoder.setOutput(ByteBuffer.allocateDirect(decoder.getPixelsSize()), null);
+        } else if (status == Status.NOT_ENOUGH_INPUT) {
+          if (offset == SIMPLE_IMAGE_BYTES.length) {
+            throw new IllegalStateException("Unexpected end of input");
+          }
+          // Keeps the bytes that were not consumed and appends the next chunk.
+          data.compact();
+          int length = Math.min(chunkSize, SIMPLE_IMAGE_BYTES.length - offset);
+          data.put(SIMPLE_IMAGE_BYTES, offset, length);
+          offset += length;
+          data.flip();
+        } else {
+          throw new IllegalStateException("Unexpected status " + status);
+        }
+        status = decoder.process(data, offset == SIMPLE_IMAGE_BYTES.length);
+      }
+      StreamInfo streamInfo = decoder.getStreamInfo();
+      if (streamInfo.width != SIMPLE_IMAGE_DIM || streamInfo.height != SIMPLE_IMAGE_DIM) {
+        throw new IllegalStateException("Invalid width / height");
+      }
+    }
+  }
+
+  static void testNativeDecoderCrop() {
+    try (NativeDecoder decoder = new NativeDecoder(2)) {
+      decoder.reset(PixelFormat.RGBA_8888, 1, 0, 0, 100, 50);
+      if (decoder.process(makeFlippedSimpleImage(), true) != Status.NEED_OUTPUT_BUFFER) {
+        throw new IllegalStateException("Unexpected decoding error");
+      }
+      StreamInfo streamInfo = decoder.getStreamInfo();
+      if (streamInfo.width != 100 || streamInfo.height != 50) {
+        throw new IllegalStateException("Invalid width / height");
+      }
+      if (decoder.getPixelsSize() != 100 * 50 * 4) {
+        throw new IllegalStateException("Unexpected pixels size");
+      }
+    }
+  }
+
+  static void testNativeDecoderDownsampling() {
+    try (NativeDecoder decoder = new NativeDecoder(2)) {
+      decoder.reset(PixelFormat.RGBA_8888, 8, 0, 0, 0, 0);
+      ByteBuffer data = makeFlippedSimpleImage();
+      if (decoder.process(data, true) != Status.NEED_OUTPUT_BUFFER) {
+        throw new IllegalStateException("Unexpected decoding error");
+      }
+      StreamInfo streamInfo = decoder.getStreamInfo();
+      final int dim = SIMPLE_IMAGE_DIM / 8;
+      if (streamInfo.width != dim || streamInfo.height != dim
+          || decoder.getPixelsSize() != dim * dim * 4) {
+        throw new IllegalStateException("Invalid width / height");
+      }
+      decoder.setOutput(ByteBuffer.allocateDirect(decoder.getPixelsSize()), null);
+      if (decoder.process(data, true) != Status.OK) {
+        throw new IllegalStateException("Unexpected decoding error");
+      }
+    }
+  }
+
   // Simple executable to avoid extra dependencies.
   public static void main(String[] args) {
     testRgba();
@@ -123,5 +210,9 @@ public class DecoderTest {
     testGetInfoNoAlpha();
     testGetInfoAlpha();
     testNotEnoughInput();
+    testNativeDecoderReuse();
+    testNativeDecoderStreaming();
+    testNativeDecoderCrop();
+    testNativeDecoderDownsampling();
   }
 }
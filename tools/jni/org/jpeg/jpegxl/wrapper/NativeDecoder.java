@@ -0,0 +1,147 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+package org.jpeg.jpegxl.wrapper;
+
+import java.nio.Buffer;
+import java.nio.ByteBuffer;
+
+/**
+ * Long-lived JPEG XL decoder with its own thread pool.
+ *
+ * Unlike {@link Decoder}, which creates a decoder for each call and parses the stream twice, an
+ * instance is reused for many images, accepts the stream in chunks and decodes directly from and
+ * into direct buffers. An instance is not thread-safe.
+ *
+ * Usage: {@link #reset}, then {@link #process} until it returns {@link Status#NEED_OUTPUT_BUFFER},
+ * {@link #setOutput} with buffers of the sizes of {@link #getStreamInfo}, and {@link #process}
+ * again until it returns {@link Status#OK}.
+ */
+public class NativeDecoder implements AutoCloseable {
+  private long handle;
+  private StreamInfo streamInfo;
+
+  /**
+   * @param numThreads number of worker threads; 0 decodes in the calling thread
+   */
+  public NativeDecoder(int numThreads) {
+    if (numThreads < 0) {
+      throw new IllegalArgumentException("numThreads must not be negative");
+    }
+    handle = DecoderJni.create(numThreads);
+    if (handle == 0) {
+      throw new IllegalStateException("Failed to create decoder");
+    }
+  }
+
+  /** Starts decoding a whole image at full resolution. */
+  public void reset(PixelFormat pixelFormat) {
+    reset(pixelFormat, 1, 0, 0, 0, 0);
+  }
+
+  /**
+   * Starts decoding a new image.
+   *
+   * @param downsampling 1, 2, 4 or 8; the output is that many times smaller in each dimension
+   * @param cropWidth width of the decoded region at (cropX0, cropY0), with cropHeight; 0 for
+   *     both decodes the whole image. A region can't be combined with downsampling.
+   */
+  public void reset(PixelFormat pixelFormat, int downsampling, int cropX0, int cropY0,
+      int cropWidth, int cropHeight) {
+    checkOpen();
+    streamInfo = null;
+    Status status = DecoderJni.reset(
+        handle, pixelFormat, downsampling, cropX0, cropY0, cropWidth, cropHeight);
+    if (status != Status.OK) {
+      throw new IllegalArgumentException("Invalid decoding settings");
+    }
+  }
+
+  /**
+   * Decodes the bytes of data between its position and its limit, and advances the position past
+   * the bytes that were consumed. The remaining bytes must be given again, at the start of the
+   * next chunk.
+   *
+   * @param lastChunk whether the stream ends at the limit
+   * @return {@link Status#NOT_ENOUGH_INPUT} if more input is needed, {@link
+   *     Status#NEED_OUTPUT_BUFFER} if {@link #setOutput} should be called, {@link Status#OK} once
+   *     the image is decoded or {@link Status#INVALID_STREAM}
+   */
+  public Status process(Buffer data, boolean lastChunk) {
+    checkOpen();
+    StreamInfo info = DecoderJni.process(handle, data, lastChunk);
+    if (info.status != Status.NOT_ENOUGH_INPUT && info.status != Status.INVALID_STREAM) {
+      if (info.width < 0 || info.height < 0 || info.pixelsSize < 0 || info.iccSize < 0) {
+        throw new IllegalStateException("JNI has returned negative size");
+      }
+      streamInfo = info;
+    }
+    return info.status;
+  }
+
+  /**
+   * Information about the output image, available once {@link #process} has returned {@link
+   * Status#NEED_OUTPUT_BUFFER}; the dimensions are those after cropping or downsampling.
+   */
+  public StreamInfo getStreamInfo() {
+    if (streamInfo == null) {
+      throw new IllegalStateException("Stream information is not decoded yet");
+    }
+    return streamInfo;
+  }
+
+  /** Size of the pixels buffer needed by {@link #setOutput}. */
+  public int getPixelsSize() {
+    return getStreamInfo().pixelsSize;
+  }
+
+  /** Size of the ICC profile buffer needed by {@link #setOutput}. */
+  public int getIccSize() {
+    return getStreamInfo().iccSize;
+  }
+
+  /**
+   * Sets the direct buffers that receive the pixels and the ICC profile of the current image.
+   *
+   * @param icc may be null if the ICC profile is not needed
+   */
+  public void setOutput(Buffer pixels, Buffer icc) {
+    checkOpen();
+    if (DecoderJni.setOutput(handle, pixels, icc) != Status.OK) {
+      throw new IllegalArgumentException("Output buffers are too small");
+    }
+  }
+
+  /** Decodes a whole image that is in data. */
+  public ImageData decode(Buffer data, PixelFormat pixelFormat) {
+    reset(pixelFormat);
+    Status status = process(data, true);
+    if (status != Status.NEED_OUTPUT_BUFFER) {
+      throw new IllegalStateException("Decoding failed");
+    }
+    Buffer pixels = ByteBuffer.allocateDirect(getPixelsSize());
+    Buffer icc = ByteBuffer.allocateDirect(getIccSize());
+    setOutput(pixels, icc);
+    if (process(data, true) != Status.OK) {
+      throw new IllegalStateException("Decoding failed");
+    }
+    return new ImageData(streamInfo.width, streamInfo.height, pixels, icc, pixelFormat);
+  }
+
+  /** Releases the decoder and its threads. */
+  @Override
+  public void close() {
+    if (handle != 0) {
+      DecoderJni.destroy(handle);
+      handle = 0;
+    }
+  }
+
+  private void checkOpen() {
+    if (handle == 0) {
+      throw new IllegalStateException("Decoder is closed");
+    }
+  }
+}
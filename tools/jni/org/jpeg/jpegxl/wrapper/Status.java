@@ -13,5 +13,8 @@ public enum Status {
   NOT_ENOUGH_INPUT,
 
   /** Stream is corrupted. */
-  INVALID_STREAM
+  INVALID_STREAM,
+
+  /** Stream information is known, output buffers should be set to continue. */
+  NEED_OUTPUT_BUFFER
 }
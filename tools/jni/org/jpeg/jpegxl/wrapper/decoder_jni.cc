@@ -7,7 +7,9 @@
 
 #include <jni.h>
 #include <jxl/decode.h>
+#include <jxl/decode_cxx.h>
 #include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
 
 #include <cstdlib>
 
@@ -32,7 +34,12 @@ bool BufferToSpan(JNIEnv* env, jobject buffer, uint8_t** data, size_t* size) {
   return StaticCast(env->GetDirectBufferCapacity(buffer), size);
 }
 
-enum class Status { OK = 0, FATAL_ERROR = -1, NOT_ENOUGH_INPUT = 1 };
+enum class Status {
+  OK = 0,
+  FATAL_ERROR = -1,
+  NOT_ENOUGH_INPUT = 1,
+  NEED_OUTPUT_BUFFER = 2
+};
 
 bool IsOk(Status status) { return status == Status::OK; }
 
@@ -174,6 +181,181 @@ Status DoDecode(JNIEnv* env, jobject data_buffer, size_t* info_pixels_size,
   return Status::OK;
 }
 
+// A decoder and its thread pool, reused for many images. The input and output
+// buffers are direct buffers whose memory the decoder reads and writes in
+// place.
+struct DecoderHandle {
+  JxlDecoderPtr dec;
+  JxlThreadParallelRunnerPtr runner;
+
+  // Settings of the current image.
+  size_t pixel_format = 0;
+  uint32_t downsampling = 1;
+  uint32_t crop_x0 = 0;
+  uint32_t crop_y0 = 0;
+  uint32_t crop_xsize = 0;
+  uint32_t crop_ysize = 0;
+
+  // Set once the color encoding is decoded.
+  bool have_info = false;
+  JxlBasicInfo info = {};
+  size_t xsize = 0;
+  size_t ysize = 0;
+  size_t pixels_size = 0;
+  size_t icc_size = 0;
+
+  // The output buffers, with global references that keep them from being
+  // collected while the decoder writes to them.
+  jobject pixels_ref = nullptr;
+  uint8_t* pixels = nullptr;
+  size_t pixels_capacity = 0;
+  jobject icc_ref = nullptr;
+  uint8_t* icc = nullptr;
+  size_t icc_capacity = 0;
+  bool icc_written = false;
+};
+
+DecoderHandle* ToHandle(jlong handle) {
+  return reinterpret_cast<DecoderHandle*>(static_cast<intptr_t>(handle));
+}
+
+void ReleaseOutput(JNIEnv* env, DecoderHandle* handle) {
+  if (handle->pixels_ref != nullptr) env->DeleteGlobalRef(handle->pixels_ref);
+  if (handle->icc_ref != nullptr) env->DeleteGlobalRef(handle->icc_ref);
+  handle->pixels_ref = nullptr;
+  handle->pixels = nullptr;
+  handle->pixels_capacity = 0;
+  handle->icc_ref = nullptr;
+  handle->icc = nullptr;
+  handle->icc_capacity = 0;
+}
+
+Status ResetHandle(JNIEnv* env, DecoderHandle* handle) {
+  ReleaseOutput(env, handle);
+  handle->have_info = false;
+  handle->icc_written = false;
+  JxlDecoder* dec = handle->dec.get();
+  JxlDecoderResetKeepBuffers(dec);
+  if (JxlDecoderSetParallelRunner(dec, JxlThreadParallelRunner,
+                                  handle->runner.get()) != JXL_DEC_SUCCESS) {
+    return FAILURE("Failed to set parallel runner");
+  }
+  if (JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE |
+                                         JXL_DEC_COLOR_ENCODING) !=
+      JXL_DEC_SUCCESS) {
+    return FAILURE("Failed to subscribe for events");
+  }
+  return Status::OK;
+}
+
+Status MaybeWriteICC(DecoderHandle* handle) {
+  if (!handle->have_info || handle->icc == nullptr || handle->icc_written) {
+    return Status::OK;
+  }
+  handle->icc_written = true;
+  if (handle->icc_size == 0) return Status::OK;
+  if (handle->icc_capacity < handle->icc_size) {
+    return FAILURE("ICC buffer is too small");
+  }
+  JxlPixelFormat format = ToPixelFormat(handle->pixel_format);
+  if (JxlDecoderGetColorAsICCProfile(handle->dec.get(), &format,
+                                     JXL_COLOR_PROFILE_TARGET_DATA, handle->icc,
+                                     handle->icc_size) != JXL_DEC_SUCCESS) {
+    return FAILURE("Failed to get ICC");
+  }
+  return Status::OK;
+}
+
+// Decodes `data_size` bytes of input, of which the first `*consumed` are
+// marked as consumed. The bytes that are not consumed must be given again at
+// the start of the next input.
+Status ProcessInput(DecoderHandle* handle, const uint8_t* data,
+                    size_t data_size, bool close_input, size_t* consumed) {
+  JxlDecoder* dec = handle->dec.get();
+  *consumed = 0;
+  if (JxlDecoderSetInput(dec, data, data_size) != JXL_DEC_SUCCESS) {
+    return FAILURE("Failed to set input");
+  }
+  if (close_input) JxlDecoderCloseInput(dec);
+  JxlPixelFormat format = ToPixelFormat(handle->pixel_format);
+  Status status = Status::OK;
+  for (;;) {
+    JxlDecoderStatus event = JxlDecoderProcessInput(dec);
+    if (event == JXL_DEC_NEED_MORE_INPUT) {
+      status = Status::NOT_ENOUGH_INPUT;
+      break;
+    } else if (event == JXL_DEC_BASIC_INFO) {
+      if (JxlDecoderGetBasicInfo(dec, &handle->info) != JXL_DEC_SUCCESS) {
+        status = FAILURE("Failed to get basic info");
+        break;
+      }
+      const JxlBasicInfo& info = handle->info;
+      handle->xsize = info.xsize;
+      handle->ysize = info.ysize;
+      if (handle->crop_xsize != 0 || handle->crop_ysize != 0) {
+        if (JxlDecoderSetCropRegion(dec, handle->crop_x0, handle->crop_y0,
+                                    handle->crop_xsize, handle->crop_ysize) !=
+            JXL_DEC_SUCCESS) {
+          status = FAILURE("Failed to set crop region");
+          break;
+        }
+        handle->xsize = handle->crop_xsize;
+        handle->ysize = handle->crop_ysize;
+      } else if (handle->downsampling != 1) {
+        if (JxlDecoderSetOutputDownsampling(dec, handle->downsampling) !=
+            JXL_DEC_SUCCESS) {
+          status = FAILURE("Failed to set downsampling");
+          break;
+        }
+        const size_t factor = handle->downsampling;
+        handle->xsize = (info.xsize + factor - 1) / factor;
+        handle->ysize = (info.ysize + factor - 1) / factor;
+      }
+    } else if (event == JXL_DEC_COLOR_ENCODING) {
+      if (JxlDecoderImageOutBufferSize(dec, &format, &handle->pixels_size) !=
+          JXL_DEC_SUCCESS) {
+        status = FAILURE("Failed to get pixels size");
+        break;
+      }
+      if (JxlDecoderGetICCProfileSize(dec, &format,
+                                      JXL_COLOR_PROFILE_TARGET_DATA,
+                                      &handle->icc_size) != JXL_DEC_SUCCESS) {
+        handle->icc_size = 0;
+      }
+      handle->have_info = true;
+      if (handle->pixels == nullptr) {
+        // Stops here to let the caller allocate the output.
+        status = Status::NEED_OUTPUT_BUFFER;
+        break;
+      }
+      status = MaybeWriteICC(handle);
+      if (!IsOk(status)) break;
+    } else if (event == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      if (handle->pixels == nullptr) {
+        status = Status::NEED_OUTPUT_BUFFER;
+        break;
+      }
+      if (handle->pixels_capacity < handle->pixels_size) {
+        status = FAILURE("Pixels buffer is too small");
+        break;
+      }
+      if (JxlDecoderSetImageOutBuffer(dec, &format, handle->pixels,
+                                      handle->pixels_size) != JXL_DEC_SUCCESS) {
+        status = FAILURE("Failed to set out buffer");
+        break;
+      }
+    } else if (event == JXL_DEC_FULL_IMAGE || event == JXL_DEC_SUCCESS) {
+      status = Status::OK;
+      break;
+    } else {
+      status = FAILURE("Unexpected notification");
+      break;
+    }
+  }
+  *consumed = data_size - JxlDecoderReleaseInput(dec);
+  return status;
+}
+
 }  // namespace
 
 #ifdef __cplusplus
@@ -266,6 +448,189 @@ JNIEXPORT void JNICALL Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeGetPixels(
   env->SetIntArrayRegion(ctx, 0, 1, context);
 }
 
+/**
+ * Create a decoder handle, to decode many images with the same decoder and
+ * thread pool.
+ *
+ * @param num_threads [in] Number of worker threads, 0 to decode in the calling
+ *                         thread
+ * @return handle; 0 on failure
+ */
+JNIEXPORT jlong JNICALL Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeCreate(
+    JNIEnv* env, jobject /* jobj */, jint num_threads) {
+  if (num_threads < 0) return 0;
+  DecoderHandle* handle = new DecoderHandle();
+  handle->dec = JxlDecoderMake(nullptr);
+  handle->runner = JxlThreadParallelRunnerMake(nullptr, num_threads);
+  if (!handle->dec || !handle->runner || !IsOk(ResetHandle(env, handle))) {
+    delete handle;
+    return 0;
+  }
+  return static_cast<jlong>(reinterpret_cast<intptr_t>(handle));
+}
+
+/**
+ * Destroy a decoder handle.
+ *
+ * @param handle [in] Handle returned by nativeCreate
+ */
+JNIEXPORT void JNICALL Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeDestroy(
+    JNIEnv* env, jobject /* jobj */, jlong handle) {
+  if (handle == 0) return;
+  ReleaseOutput(env, ToHandle(handle));
+  delete ToHandle(handle);
+}
+
+/**
+ * Start decoding a new image.
+ *
+ * @param handle [in] Handle returned by nativeCreate
+ * @param ctx {in_pixel_format_out_status, downsampling, crop_x0, crop_y0,
+ *             crop_width, crop_height} tuple; a crop of zero width and height
+ *             decodes the whole image
+ */
+JNIEXPORT void JNICALL Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeReset(
+    JNIEnv* env, jobject /* jobj */, jlong handle, jintArray ctx) {
+  jint context[6] = {0};
+  env->GetIntArrayRegion(ctx, 0, 6, context);
+  DecoderHandle* h = ToHandle(handle);
+
+  Status status = Status::OK;
+
+  if (IsOk(status)) {
+    if (!StaticCast(context[0], &h->pixel_format) ||
+        h->pixel_format > kLastPixelFormat) {
+      status = FAILURE("Unrecognized pixel format");
+    }
+  }
+
+  if (IsOk(status)) {
+    bool ok = true;
+    ok &= StaticCast(context[1], &h->downsampling);
+    ok &= StaticCast(context[2], &h->crop_x0);
+    ok &= StaticCast(context[3], &h->crop_y0);
+    ok &= StaticCast(context[4], &h->crop_xsize);
+    ok &= StaticCast(context[5], &h->crop_ysize);
+    if (!ok) status = FAILURE("Invalid value");
+  }
+
+  if (IsOk(status)) status = ResetHandle(env, h);
+
+  context[0] = static_cast<int>(status);
+  env->SetIntArrayRegion(ctx, 0, 1, context);
+}
+
+/**
+ * Set the buffers that receive the pixels and the ICC profile of the current
+ * image. They are referenced until the image is decoded or the handle is
+ * reset.
+ *
+ * @param handle [in] Handle returned by nativeCreate
+ * @param ctx {out_status} tuple
+ * @param pixels [out] Buffer to place pixels to
+ * @param icc [out] Buffer to place ICC profile to; may be null
+ */
+JNIEXPORT void JNICALL Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeSetOutput(
+    JNIEnv* env, jobject /* jobj */, jlong handle, jintArray ctx,
+    jobject pixels_buffer, jobject icc_buffer) {
+  jint context[1] = {0};
+  DecoderHandle* h = ToHandle(handle);
+  ReleaseOutput(env, h);
+
+  Status status = Status::OK;
+
+  if (IsOk(status)) {
+    if (pixels_buffer == nullptr ||
+        !BufferToSpan(env, pixels_buffer, &h->pixels, &h->pixels_capacity)) {
+      status = FAILURE("Failed to access pixels buffer");
+    }
+  }
+
+  if (IsOk(status)) {
+    if (!BufferToSpan(env, icc_buffer, &h->icc, &h->icc_capacity)) {
+      status = FAILURE("Failed to access ICC buffer");
+    }
+  }
+
+  if (IsOk(status)) {
+    h->pixels_ref = env->NewGlobalRef(pixels_buffer);
+    if (icc_buffer != nullptr) h->icc_ref = env->NewGlobalRef(icc_buffer);
+    if (h->have_info && h->pixels_capacity < h->pixels_size) {
+      status = FAILURE("Pixels buffer is too small");
+    }
+  }
+
+  if (IsOk(status)) {
+    status = MaybeWriteICC(h);
+  }
+
+  if (!IsOk(status)) ReleaseOutput(env, h);
+
+  context[0] = static_cast<int>(status);
+  env->SetIntArrayRegion(ctx, 0, 1, context);
+}
+
+/**
+ * Decode the next chunk of input of the current image.
+ *
+ * @param handle [in] Handle returned by nativeCreate
+ * @param ctx {in_position_out_status, in_limit_out_consumed, in_last_chunk,
+ *             out_width, out_height, pixels_size, icc_size, alpha_bits} tuple;
+ *             the sizes are those of the output, after cropping or
+ *             downsampling, and are set once the status is not
+ *             "not enough input"
+ * @param data [in] Buffer with encoded JXL stream, read between the position
+ *                  and the limit
+ */
+JNIEXPORT void JNICALL Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeProcess(
+    JNIEnv* env, jobject /* jobj */, jlong handle, jintArray ctx,
+    jobject data_buffer) {
+  jint context[8] = {0};
+  env->GetIntArrayRegion(ctx, 0, 3, context);
+  DecoderHandle* h = ToHandle(handle);
+
+  uint8_t* data = nullptr;
+  size_t data_size = 0;
+  size_t position = 0;
+  size_t limit = 0;
+  size_t consumed = 0;
+
+  Status status = Status::OK;
+
+  if (IsOk(status)) {
+    if (data_buffer == nullptr ||
+        !BufferToSpan(env, data_buffer, &data, &data_size) ||
+        !StaticCast(context[0], &position) || !StaticCast(context[1], &limit) ||
+        position > limit || limit > data_size) {
+      status = FAILURE("Failed to access data buffer");
+    }
+  }
+
+  if (IsOk(status)) {
+    status = ProcessInput(h, data + position, limit - position,
+                          /*close_input=*/context[2] != 0, &consumed);
+  }
+
+  if (status == Status::OK) ReleaseOutput(env, h);
+
+  if (h->have_info) {
+    bool ok = true;
+    ok &= StaticCast(h->xsize, context + 3);
+    ok &= StaticCast(h->ysize, context + 4);
+    ok &= StaticCast(h->pixels_size, context + 5);
+    ok &= StaticCast(h->icc_size, context + 6);
+    ok &= StaticCast(h->info.alpha_bits, context + 7);
+    if (!ok && status != Status::FATAL_ERROR) status = FAILURE("Invalid value");
+  }
+
+  context[0] = static_cast<int>(status);
+  if (!StaticCast(consumed, context + 1)) {
+    context[0] = static_cast<int>(FAILURE("Invalid value"));
+    context[1] = 0;
+  }
+  env->SetIntArrayRegion(ctx, 0, 8, context);
+}
+
 #undef FAILURE
 
 #ifdef __cplusplus
@@ -36,6 +36,59 @@ JNIEXPORT void JNICALL Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeGetPixels(
     JNIEnv* env, jobject /*jobj*/, jintArray ctx, jobject data_buffer,
     jobject pixels_buffer, jobject icc_buffer);
 
+/**
+ * Create a decoder handle, to decode many images with the same decoder and
+ * thread pool.
+ *
+ * @param num_threads [in] Number of worker threads, 0 to decode in the calling
+ *                         thread
+ * @return handle; 0 on failure
+ */
+JNIEXPORT jlong JNICALL Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeCreate(
+    JNIEnv* env, jobject /*jobj*/, jint num_threads);
+
+/**
+ * Destroy a decoder handle.
+ *
+ * @param handle [in] Handle returned by nativeCreate
+ */
+JNIEXPORT void JNICALL Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeDestroy(
+    JNIEnv* env, jobject /*jobj*/, jlong handle);
+
+/**
+ * Start decoding a new image.
+ *
+ * @param handle [in] Handle returned by nativeCreate
+ * @param ctx {in_pixel_format_out_status, downsampling, crop_x0, crop_y0,
+ *             crop_width, crop_height} tuple
+ */
+JNIEXPORT void JNICALL Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeReset(
+    JNIEnv* env, jobject /*jobj*/, jlong handle, jintArray ctx);
+
+/**
+ * Set the buffers that receive the pixels and the ICC profile.
+ *
+ * @param handle [in] Handle returned by nativeCreate
+ * @param ctx {out_status} tuple
+ * @param pixels [out] Buffer to place pixels to
+ * @param icc [out] Buffer to place ICC profile to; may be null
+ */
+JNIEXPORT void JNICALL Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeSetOutput(
+    JNIEnv* env, jobject /*jobj*/, jlong handle, jintArray ctx,
+    jobject pixels_buffer, jobject icc_buffer);
+
+/**
+ * Decode the next chunk of input.
+ *
+ * @param handle [in] Handle returned by nativeCreate
+ * @param ctx {in_position_out_status, in_limit_out_consumed, in_last_chunk,
+ *             out_width, out_height, pixels_size, icc_size, alpha_bits} tuple
+ * @param data [in] Buffer with encoded JXL stream
+ */
+JNIEXPORT void JNICALL Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeProcess(
+    JNIEnv* env, jobject /*jobj*/, jlong handle, jintArray ctx,
+    jobject data_buffer);
+
 #ifdef __cplusplus
 }
 #endif
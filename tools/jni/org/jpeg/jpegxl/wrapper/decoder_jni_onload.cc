@@ -16,6 +16,17 @@ static char* kGetBasicInfoSig = const_cast<char*>("([ILjava/nio/Buffer;)V");
 static char* kGetPixelsName = const_cast<char*>("nativeGetPixels");
 static char* kGetPixelsInfoSig = const_cast<char*>(
     "([ILjava/nio/Buffer;Ljava/nio/Buffer;Ljava/nio/Buffer;)V");
+static char* kCreateName = const_cast<char*>("nativeCreate");
+static char* kCreateSig = const_cast<char*>("(I)J");
+static char* kDestroyName = const_cast<char*>("nativeDestroy");
+static char* kDestroySig = const_cast<char*>("(J)V");
+static char* kResetName = const_cast<char*>("nativeReset");
+static char* kResetSig = const_cast<char*>("(J[I)V");
+static char* kSetOutputName = const_cast<char*>("nativeSetOutput");
+static char* kSetOutputSig =
+    const_cast<char*>("(J[ILjava/nio/Buffer;Ljava/nio/Buffer;)V");
+static char* kProcessName = const_cast<char*>("nativeProcess");
+static char* kProcessSig = const_cast<char*>("(J[ILjava/nio/Buffer;)V");
 
 #define JXL_JNI_METHOD(NAME) \
   (reinterpret_cast<void*>(  \
@@ -23,9 +34,14 @@ static char* kGetPixelsInfoSig = const_cast<char*>(
 
 static const JNINativeMethod kDecoderMethods[] = {
     {kGetBasicInfoName, kGetBasicInfoSig, JXL_JNI_METHOD(GetBasicInfo)},
-    {kGetPixelsName, kGetPixelsInfoSig, JXL_JNI_METHOD(GetPixels)}};
+    {kGetPixelsName, kGetPixelsInfoSig, JXL_JNI_METHOD(GetPixels)},
+    {kCreateName, kCreateSig, JXL_JNI_METHOD(Create)},
+    {kDestroyName, kDestroySig, JXL_JNI_METHOD(Destroy)},
+    {kResetName, kResetSig, JXL_JNI_METHOD(Reset)},
+    {kSetOutputName, kSetOutputSig, JXL_JNI_METHOD(SetOutput)},
+    {kProcessName, kProcessSig, JXL_JNI_METHOD(Process)}};
 
-static const size_t kNumDecoderMethods = 2;
+static const size_t kNumDecoderMethods = 7;
 
 #undef JXL_JNI_METHOD
 
@@ -114,5 +114,51 @@ bool SpeedStats::Print(size_t worker_threads) {
   return true;
 }
 
+void ThreadScaling::NotifyElapsed(size_t num_threads, double elapsed_seconds) {
+  if (num_threads != 0 && elapsed_seconds > 0.0) {
+    measurements_.push_back({num_threads, elapsed_seconds});
+  }
+}
+
+double ThreadScaling::SingleThreaded() const {
+  for (const Measurement& m : measurements_) {
+    if (m.num_threads == 1) return m.elapsed_seconds;
+  }
+  return 0.0;
+}
+
+double ThreadScaling::SerialFraction() const {
+  const double t1 = SingleThreaded();
+  if (t1 == 0.0) return 0.0;
+  // elapsed(n) - t1 / n = serial * t1 * (1 - 1 / n) is linear in serial.
+  double numerator = 0.0;
+  double denominator = 0.0;
+  for (const Measurement& m : measurements_) {
+    const double parallel = t1 * (1.0 - 1.0 / m.num_threads);
+    numerator += (m.elapsed_seconds - t1 / m.num_threads) * parallel;
+    denominator += parallel * parallel;
+  }
+  if (denominator == 0.0) return 0.0;
+  return std::min(std::max(numerator / denominator, 0.0), 1.0);
+}
+
+void ThreadScaling::Print(const char* name) const {
+  const double t1 = SingleThreaded();
+  if (t1 == 0.0) return;
+  printf("%s\n%8s %11s %8s %10s %11s\n", name, "threads", "ms", "speedup",
+         "efficiency", "Karp-Flatt");
+  for (const Measurement& m : measurements_) {
+    const double speedup = t1 / m.elapsed_seconds;
+    const double n = m.num_threads;
+    printf("%8" PRIu64 " %11.3f %8.2f %9.1f%%", static_cast<uint64_t>(n),
+           m.elapsed_seconds * 1E3, speedup, speedup / n * 100.0);
+    if (m.num_threads > 1) {
+      printf(" %11.3f", (1.0 / speedup - 1.0 / n) / (1.0 - 1.0 / n));
+    }
+    printf("\n");
+  }
+  printf("Estimated serial fraction: %.3f\n", SerialFraction());
+}
+
 }  // namespace tools
 }  // namespace jpegxl
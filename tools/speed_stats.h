@@ -55,6 +55,35 @@ class SpeedStats {
   size_t file_size_ = 0;
 };
 
+// Elapsed times of the same work with different numbers of threads, and how
+// well it scales.
+class ThreadScaling {
+ public:
+  // Adds a measurement, typically the central tendency of a SpeedStats.
+  void NotifyElapsed(size_t num_threads, double elapsed_seconds);
+
+  // Returns the fraction of the single-threaded time that does not get faster
+  // with more threads, as a least squares fit of Amdahl's law
+  // elapsed(n) = elapsed(1) * (serial + (1 - serial) / n), clamped to [0, 1].
+  // Returns 0 without a single-threaded and a multi-threaded measurement.
+  double SerialFraction() const;
+
+  // Prints the speedup, efficiency and Karp-Flatt metric (the serial fraction
+  // estimated from that thread count alone) of each measurement, relative to
+  // the single-threaded one, followed by SerialFraction().
+  void Print(const char* name) const;
+
+ private:
+  // Elapsed time with one thread, 0 if not measured.
+  double SingleThreaded() const;
+
+  struct Measurement {
+    size_t num_threads;
+    double elapsed_seconds;
+  };
+  std::vector<Measurement> measurements_;
+};
+
 }  // namespace tools
 }  // namespace jpegxl
 
@@ -26,76 +26,251 @@ Design:
 
 #include <stdio.h>
 
+#include <algorithm>
 #include <cmath>
 
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "tools/ssimulacra2.cc"
+#include <hwy/aligned_allocator.h>
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+#include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/enc_color_management.h"
 #include "lib/jxl/enc_xyb.h"
 #include "lib/jxl/gauss_blur.h"
 #include "lib/jxl/image_ops.h"
 
+// The row functions below use separate multiplications and additions, in the
+// order of the scalar expressions they replace, so that the scores are the same
+// as those of a scalar implementation without fused multiply-adds. They process
+// whole vectors, reading and writing the padding of the image rows.
+HWY_BEFORE_NAMESPACE();
+namespace ssimulacra2 {
+namespace HWY_NAMESPACE {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Abs;
+using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::Div;
+using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::Sub;
+
+// out = in1 * in2.
+void MultiplyRow(const float* JXL_RESTRICT in1, const float* JXL_RESTRICT in2,
+                 float* JXL_RESTRICT out, size_t xsize) {
+  const HWY_FULL(float) d;
+  for (size_t x = 0; x < xsize; x += Lanes(d)) {
+    Store(Mul(Load(d, in1 + x), Load(d, in2 + x)), d, out + x);
+  }
+}
+
+// See MakePositiveXYB.
+void MakePositiveXYBRow(float* JXL_RESTRICT row_x, float* JXL_RESTRICT row_y,
+                        float* JXL_RESTRICT row_b, size_t xsize) {
+  const HWY_FULL(float) d;
+  const auto b_offset = Set(d, 0.55f);
+  const auto x_scale = Set(d, 14.f);
+  const auto x_offset = Set(d, 0.42f);
+  const auto y_offset = Set(d, 0.01f);
+  for (size_t x = 0; x < xsize; x += Lanes(d)) {
+    const auto y = Load(d, row_y + x);
+    Store(Add(Sub(Load(d, row_b + x), y), b_offset), d, row_b + x);
+    Store(Add(Mul(Load(d, row_x + x), x_scale), x_offset), d, row_x + x);
+    Store(Add(y, y_offset), d, row_y + x);
+  }
+}
+
+// row = alpha * row + (1 - alpha) * bg.
+void AlphaBlendRow(const float* JXL_RESTRICT alpha, float bg,
+                   float* JXL_RESTRICT row, size_t xsize) {
+  const HWY_FULL(float) d;
+  const auto one = Set(d, 1.f);
+  const auto background = Set(d, bg);
+  for (size_t x = 0; x < xsize; x += Lanes(d)) {
+    const auto a = Load(d, alpha + x);
+    Store(Add(Mul(a, Load(d, row + x)), Mul(Sub(one, a), background)), d,
+          row + x);
+  }
+}
+
+// The SSIM' quotient num_m * num_s / denom_s of SSIMMap, for each pixel.
+void SSIMRow(const float* JXL_RESTRICT row_m1, const float* JXL_RESTRICT row_m2,
+             const float* JXL_RESTRICT row_s11,
+             const float* JXL_RESTRICT row_s22,
+             const float* JXL_RESTRICT row_s12, float kC2, size_t xsize,
+             float* JXL_RESTRICT quotient) {
+  const HWY_FULL(float) d;
+  const auto one = Set(d, 1.f);
+  const auto two = Set(d, 2.f);
+  const auto c2 = Set(d, kC2);
+  for (size_t x = 0; x < xsize; x += Lanes(d)) {
+    const auto mu1 = Load(d, row_m1 + x);
+    const auto mu2 = Load(d, row_m2 + x);
+    const auto mu11 = Mul(mu1, mu1);
+    const auto mu22 = Mul(mu2, mu2);
+    const auto mu12 = Mul(mu1, mu2);
+    /* Correction applied compared to the original SSIM formula, which has:
+
+         luma_err = 2 * mu1 * mu2 / (mu1^2 + mu2^2)
+                  = 1 - (mu1 - mu2)^2 / (mu1^2 + mu2^2)
+
+       The denominator causes error in the darks (low mu1 and mu2) to weigh
+       more than error in the brights (high mu1 and mu2). This would make
+       sense if values correspond to linear luma. However, the actual values
+       are either gamma-compressed luma (which supposedly is already
+       perceptually uniform) or chroma (where weighing green more than red
+       or blue more than yellow does not make any sense at all). So it is
+       better to simply drop this denominator.
+    */
+    const auto diff = Sub(mu1, mu2);
+    const auto num_m = Sub(one, Mul(diff, diff));
+    const auto num_s = Add(Mul(two, Sub(Load(d, row_s12 + x), mu12)), c2);
+    const auto denom_s = Add(Add(Sub(Load(d, row_s11 + x), mu11),
+                                 Sub(Load(d, row_s22 + x), mu22)),
+                             c2);
+    Store(Div(Mul(num_m, num_s), denom_s), d, quotient + x);
+  }
+}
+
+// The distances |img - mu| of EdgeDiffMap of both images, for each pixel.
+void EdgeRow(const float* JXL_RESTRICT row1, const float* JXL_RESTRICT rowm1,
+             const float* JXL_RESTRICT row2, const float* JXL_RESTRICT rowm2,
+             size_t xsize, float* JXL_RESTRICT edge1,
+             float* JXL_RESTRICT edge2) {
+  const HWY_FULL(float) d;
+  for (size_t x = 0; x < xsize; x += Lanes(d)) {
+    Store(Abs(Sub(Load(d, row1 + x), Load(d, rowm1 + x))), d, edge1 + x);
+    Store(Abs(Sub(Load(d, row2 + x), Load(d, rowm2 + x))), d, edge2 + x);
+  }
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace ssimulacra2
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace ssimulacra2 {
+
+HWY_EXPORT(MultiplyRow);
+HWY_EXPORT(MakePositiveXYBRow);
+HWY_EXPORT(AlphaBlendRow);
+HWY_EXPORT(SSIMRow);
+HWY_EXPORT(EdgeRow);
+
+void MultiplyRow(const float* JXL_RESTRICT in1, const float* JXL_RESTRICT in2,
+                 float* JXL_RESTRICT out, size_t xsize) {
+  HWY_DYNAMIC_DISPATCH(MultiplyRow)(in1, in2, out, xsize);
+}
+
+void MakePositiveXYBRow(float* JXL_RESTRICT row_x, float* JXL_RESTRICT row_y,
+                        float* JXL_RESTRICT row_b, size_t xsize) {
+  HWY_DYNAMIC_DISPATCH(MakePositiveXYBRow)(row_x, row_y, row_b, xsize);
+}
+
+void AlphaBlendRow(const float* JXL_RESTRICT alpha, float bg,
+                   float* JXL_RESTRICT row, size_t xsize) {
+  HWY_DYNAMIC_DISPATCH(AlphaBlendRow)(alpha, bg, row, xsize);
+}
+
+void SSIMRow(const float* JXL_RESTRICT row_m1, const float* JXL_RESTRICT row_m2,
+             const float* JXL_RESTRICT row_s11,
+             const float* JXL_RESTRICT row_s22,
+             const float* JXL_RESTRICT row_s12, float kC2, size_t xsize,
+             float* JXL_RESTRICT quotient) {
+  HWY_DYNAMIC_DISPATCH(SSIMRow)
+  (row_m1, row_m2, row_s11, row_s22, row_s12, kC2, xsize, quotient);
+}
+
+void EdgeRow(const float* JXL_RESTRICT row1, const float* JXL_RESTRICT rowm1,
+             const float* JXL_RESTRICT row2, const float* JXL_RESTRICT rowm2,
+             size_t xsize, float* JXL_RESTRICT edge1,
+             float* JXL_RESTRICT edge2) {
+  HWY_DYNAMIC_DISPATCH(EdgeRow)(row1, rowm1, row2, rowm2, xsize, edge1, edge2);
+}
+
+}  // namespace ssimulacra2
+
 namespace {
 
 using jxl::Image3F;
 using jxl::ImageF;
+using jxl::ThreadPool;
 
 static const float kC2 = 0.0009f;
 static const int kNumScales = 6;
 
-Image3F Downsample(const Image3F& in, size_t fx, size_t fy) {
+// Runs `func(y)` for each row y < ysize, in parallel.
+template <class Func>
+void ForEachRow(ThreadPool* pool, size_t ysize, const Func& func,
+                const char* caller) {
+  JXL_CHECK(jxl::RunOnPool(
+      pool, 0, static_cast<uint32_t>(ysize), ThreadPool::NoInit,
+      [&](const uint32_t y, size_t /*thread*/) { func(y); }, caller));
+}
+
+Image3F Downsample(const Image3F& in, size_t fx, size_t fy, ThreadPool* pool) {
   const size_t out_xsize = (in.xsize() + fx - 1) / fx;
   const size_t out_ysize = (in.ysize() + fy - 1) / fy;
   Image3F out(out_xsize, out_ysize);
   const float normalize = 1.0f / (fx * fy);
-  for (size_t c = 0; c < 3; ++c) {
-    for (size_t oy = 0; oy < out_ysize; ++oy) {
-      float* JXL_RESTRICT row_out = out.PlaneRow(c, oy);
-      for (size_t ox = 0; ox < out_xsize; ++ox) {
-        float sum = 0.0f;
-        for (size_t iy = 0; iy < fy; ++iy) {
-          for (size_t ix = 0; ix < fx; ++ix) {
-            const size_t x = std::min(ox * fx + ix, in.xsize() - 1);
-            const size_t y = std::min(oy * fy + iy, in.ysize() - 1);
-            sum += in.PlaneRow(c, y)[x];
+  ForEachRow(
+      pool, out_ysize,
+      [&](size_t oy) {
+        for (size_t c = 0; c < 3; ++c) {
+          float* JXL_RESTRICT row_out = out.PlaneRow(c, oy);
+          for (size_t ox = 0; ox < out_xsize; ++ox) {
+            float sum = 0.0f;
+            for (size_t iy = 0; iy < fy; ++iy) {
+              for (size_t ix = 0; ix < fx; ++ix) {
+                const size_t x = std::min(ox * fx + ix, in.xsize() - 1);
+                const size_t y = std::min(oy * fy + iy, in.ysize() - 1);
+                sum += in.PlaneRow(c, y)[x];
+              }
+            }
+            row_out[ox] = sum * normalize;
           }
         }
-        row_out[ox] = sum * normalize;
-      }
-    }
-  }
+      },
+      "SSIMULACRA2Downsample");
   return out;
 }
 
-void Multiply(const Image3F& a, const Image3F& b, Image3F* mul) {
-  for (size_t c = 0; c < 3; ++c) {
-    for (size_t y = 0; y < a.ysize(); ++y) {
-      const float* JXL_RESTRICT in1 = a.PlaneRow(c, y);
-      const float* JXL_RESTRICT in2 = b.PlaneRow(c, y);
-      float* JXL_RESTRICT out = mul->PlaneRow(c, y);
-      for (size_t x = 0; x < a.xsize(); ++x) {
-        out[x] = in1[x] * in2[x];
-      }
-    }
-  }
+void Multiply(const Image3F& a, const Image3F& b, ThreadPool* pool,
+              Image3F* mul) {
+  ForEachRow(
+      pool, a.ysize(),
+      [&](size_t y) {
+        for (size_t c = 0; c < 3; ++c) {
+          ssimulacra2::MultiplyRow(a.ConstPlaneRow(c, y), b.ConstPlaneRow(c, y),
+                                   mul->PlaneRow(c, y), a.xsize());
+        }
+      },
+      "SSIMULACRA2Multiply");
 }
 
 // Temporary storage for Gaussian blur, reused for multiple images.
 class Blur {
  public:
-  Blur(const size_t xsize, const size_t ysize)
-      : rg_(jxl::CreateRecursiveGaussian(1.5)), temp_(xsize, ysize) {}
+  Blur(const size_t xsize, const size_t ysize, ThreadPool* pool)
+      : rg_(jxl::CreateRecursiveGaussian(1.5)),
+        temp_(xsize, ysize),
+        pool_(pool) {}
 
+  // The rows and columns are blurred in parallel, with the same result as
+  // without a pool.
   void operator()(const ImageF& in, ImageF* JXL_RESTRICT out) {
-    jxl::ThreadPool* null_pool = nullptr;
-    FastGaussian(rg_, in, null_pool, &temp_, out);
+    FastGaussian(rg_, in, pool_, &temp_, out);
   }
 
-  Image3F operator()(const Image3F& in) {
-    Image3F out(in.xsize(), in.ysize());
-    operator()(in.Plane(0), &out.Plane(0));
-    operator()(in.Plane(1), &out.Plane(1));
-    operator()(in.Plane(2), &out.Plane(2));
-    return out;
+  void operator()(const Image3F& in, Image3F* out) {
+    out->ShrinkTo(in.xsize(), in.ysize());
+    operator()(in.Plane(0), &out->Plane(0));
+    operator()(in.Plane(1), &out->Plane(1));
+    operator()(in.Plane(2), &out->Plane(2));
   }
 
   // Allows reusing across scales.
@@ -106,6 +281,7 @@ class Blur {
  private:
   hwy::AlignedUniquePtr<jxl::RecursiveGaussian> rg_;
   ImageF temp_;
+  ThreadPool* pool_;
 };
 
 double tothe4th(double x) {
@@ -113,43 +289,27 @@ double tothe4th(double x) {
   x *= x;
   return x;
 }
+
+// The sums below are accumulated in the order of the pixels of each plane, so
+// only the planes are processed in parallel, to keep the scores independent of
+// the number of threads.
 void SSIMMap(const Image3F& m1, const Image3F& m2, const Image3F& s11,
-             const Image3F& s22, const Image3F& s12, double* plane_averages) {
+             const Image3F& s22, const Image3F& s12, ThreadPool* pool,
+             double* plane_averages) {
   const double onePerPixels = 1.0 / (m1.ysize() * m1.xsize());
-  for (size_t c = 0; c < 3; ++c) {
+  const auto process_plane = [&](const uint32_t c, size_t /*thread*/) {
+    hwy::AlignedFreeUniquePtr<float[]> quotient =
+        hwy::AllocateAligned<float>(m1.PixelsPerRow());
     double sum1[2] = {0.0};
     for (size_t y = 0; y < m1.ysize(); ++y) {
-      const float* JXL_RESTRICT row_m1 = m1.PlaneRow(c, y);
-      const float* JXL_RESTRICT row_m2 = m2.PlaneRow(c, y);
-      const float* JXL_RESTRICT row_s11 = s11.PlaneRow(c, y);
-      const float* JXL_RESTRICT row_s22 = s22.PlaneRow(c, y);
-      const float* JXL_RESTRICT row_s12 = s12.PlaneRow(c, y);
+      ssimulacra2::SSIMRow(m1.ConstPlaneRow(c, y), m2.ConstPlaneRow(c, y),
+                           s11.ConstPlaneRow(c, y), s22.ConstPlaneRow(c, y),
+                           s12.ConstPlaneRow(c, y), kC2, m1.xsize(),
+                           quotient.get());
       for (size_t x = 0; x < m1.xsize(); ++x) {
-        float mu1 = row_m1[x];
-        float mu2 = row_m2[x];
-        float mu11 = mu1 * mu1;
-        float mu22 = mu2 * mu2;
-        float mu12 = mu1 * mu2;
-        /* Correction applied compared to the original SSIM formula, which has:
-
-             luma_err = 2 * mu1 * mu2 / (mu1^2 + mu2^2)
-                      = 1 - (mu1 - mu2)^2 / (mu1^2 + mu2^2)
-
-           The denominator causes error in the darks (low mu1 and mu2) to weigh
-           more than error in the brights (high mu1 and mu2). This would make
-           sense if values correspond to linear luma. However, the actual values
-           are either gamma-compressed luma (which supposedly is already
-           perceptually uniform) or chroma (where weighing green more than red
-           or blue more than yellow does not make any sense at all). So it is
-           better to simply drop this denominator.
-        */
-        float num_m = 1.0 - (mu1 - mu2) * (mu1 - mu2);
-        float num_s = 2 * (row_s12[x] - mu12) + kC2;
-        float denom_s = (row_s11[x] - mu11) + (row_s22[x] - mu22) + kC2;
-
         // Use 1 - SSIM' so it becomes an error score instead of a quality
         // index. This makes it make sense to compute an L_4 norm.
-        double d = 1.0 - (num_m * num_s / denom_s);
+        double d = 1.0 - quotient[x];
         d = std::max(d, 0.0);
         sum1[0] += d;
         sum1[1] += tothe4th(d);
@@ -157,23 +317,27 @@ void SSIMMap(const Image3F& m1, const Image3F& m2, const Image3F& s11,
     }
     plane_averages[c * 2] = onePerPixels * sum1[0];
     plane_averages[c * 2 + 1] = sqrt(sqrt(onePerPixels * sum1[1]));
-  }
+  };
+  JXL_CHECK(jxl::RunOnPool(pool, 0, 3, ThreadPool::NoInit, process_plane,
+                           "SSIMULACRA2SSIMMap"));
 }
 
 void EdgeDiffMap(const Image3F& img1, const Image3F& mu1, const Image3F& img2,
-                 const Image3F& mu2, double* plane_averages) {
+                 const Image3F& mu2, ThreadPool* pool,
+                 double* plane_averages) {
   const double onePerPixels = 1.0 / (img1.ysize() * img1.xsize());
-  for (size_t c = 0; c < 3; ++c) {
+  const auto process_plane = [&](const uint32_t c, size_t /*thread*/) {
+    hwy::AlignedFreeUniquePtr<float[]> edge1 =
+        hwy::AllocateAligned<float>(img1.PixelsPerRow());
+    hwy::AlignedFreeUniquePtr<float[]> edge2 =
+        hwy::AllocateAligned<float>(img1.PixelsPerRow());
     double sum1[4] = {0.0};
     for (size_t y = 0; y < img1.ysize(); ++y) {
-      const float* JXL_RESTRICT row1 = img1.PlaneRow(c, y);
-      const float* JXL_RESTRICT row2 = img2.PlaneRow(c, y);
-      const float* JXL_RESTRICT rowm1 = mu1.PlaneRow(c, y);
-      const float* JXL_RESTRICT rowm2 = mu2.PlaneRow(c, y);
+      ssimulacra2::EdgeRow(img1.ConstPlaneRow(c, y), mu1.ConstPlaneRow(c, y),
+                           img2.ConstPlaneRow(c, y), mu2.ConstPlaneRow(c, y),
+                           img1.xsize(), edge1.get(), edge2.get());
       for (size_t x = 0; x < img1.xsize(); ++x) {
-        double d1 = (1.0 + std::abs(row2[x] - rowm2[x])) /
-                        (1.0 + std::abs(row1[x] - rowm1[x])) -
-                    1.0;
+        double d1 = (1.0 + edge2[x]) / (1.0 + edge1[x]) - 1.0;
 
         // d1 > 0: distorted has an edge where original is smooth
         //         (indicating ringing, color banding, blockiness, etc)
@@ -192,7 +356,9 @@ void EdgeDiffMap(const Image3F& img1, const Image3F& mu1, const Image3F& img2,
     plane_averages[c * 4 + 1] = sqrt(sqrt(onePerPixels * sum1[1]));
     plane_averages[c * 4 + 2] = onePerPixels * sum1[2];
     plane_averages[c * 4 + 3] = sqrt(sqrt(onePerPixels * sum1[3]));
-  }
+  };
+  JXL_CHECK(jxl::RunOnPool(pool, 0, 3, ThreadPool::NoInit, process_plane,
+                           "SSIMULACRA2EdgeDiffMap"));
 }
 
 /* Get all components in more or less 0..1 range
@@ -207,31 +373,27 @@ void EdgeDiffMap(const Image3F& img1, const Image3F& mu1, const Image3F& img2,
    The maximum pixel-wise difference has to be <= 1 for the ssim formula to make
    sense.
 */
-void MakePositiveXYB(jxl::Image3F& img) {
-  for (size_t y = 0; y < img.ysize(); ++y) {
-    float* JXL_RESTRICT rowY = img.PlaneRow(1, y);
-    float* JXL_RESTRICT rowB = img.PlaneRow(2, y);
-    float* JXL_RESTRICT rowX = img.PlaneRow(0, y);
-    for (size_t x = 0; x < img.xsize(); ++x) {
-      rowB[x] = (rowB[x] - rowY[x]) + 0.55f;
-      rowX[x] = rowX[x] * 14.f + 0.42f;
-      rowY[x] += 0.01f;
-    }
-  }
+void MakePositiveXYB(jxl::Image3F& img, ThreadPool* pool) {
+  ForEachRow(
+      pool, img.ysize(),
+      [&](size_t y) {
+        ssimulacra2::MakePositiveXYBRow(img.PlaneRow(0, y), img.PlaneRow(1, y),
+                                        img.PlaneRow(2, y), img.xsize());
+      },
+      "SSIMULACRA2MakePositiveXYB");
 }
 
-void AlphaBlend(jxl::ImageBundle& img, float bg) {
-  for (size_t y = 0; y < img.ysize(); ++y) {
-    float* JXL_RESTRICT r = img.color()->PlaneRow(0, y);
-    float* JXL_RESTRICT g = img.color()->PlaneRow(1, y);
-    float* JXL_RESTRICT b = img.color()->PlaneRow(2, y);
-    const float* JXL_RESTRICT a = img.alpha()->Row(y);
-    for (size_t x = 0; x < img.xsize(); ++x) {
-      r[x] = a[x] * r[x] + (1.f - a[x]) * bg;
-      g[x] = a[x] * g[x] + (1.f - a[x]) * bg;
-      b[x] = a[x] * b[x] + (1.f - a[x]) * bg;
-    }
-  }
+void AlphaBlend(jxl::ImageBundle& img, float bg, ThreadPool* pool) {
+  ForEachRow(
+      pool, img.ysize(),
+      [&](size_t y) {
+        const float* JXL_RESTRICT a = img.alpha()->Row(y);
+        for (size_t c = 0; c < 3; ++c) {
+          ssimulacra2::AlphaBlendRow(a, bg, img.color()->PlaneRow(c, y),
+                                     img.xsize());
+        }
+      },
+      "SSIMULACRA2AlphaBlend");
 }
 
 }  // namespace
@@ -420,7 +582,8 @@ double Msssim::Score() const {
 }
 
 Msssim ComputeSSIMULACRA2(const jxl::ImageBundle& orig,
-                          const jxl::ImageBundle& dist, float bg) {
+                          const jxl::ImageBundle& dist, float bg,
+                          jxl::ThreadPool* pool) {
   Msssim msssim;
 
   jxl::Image3F img1(orig.xsize(), orig.ysize());
@@ -429,64 +592,76 @@ Msssim ComputeSSIMULACRA2(const jxl::ImageBundle& orig,
   jxl::ImageBundle orig2 = orig.Copy();
   jxl::ImageBundle dist2 = dist.Copy();
 
-  if (orig.HasAlpha()) AlphaBlend(orig2, bg);
-  if (dist.HasAlpha()) AlphaBlend(dist2, bg);
+  if (orig.HasAlpha()) AlphaBlend(orig2, bg, pool);
+  if (dist.HasAlpha()) AlphaBlend(dist2, bg, pool);
   orig2.ClearExtraChannels();
   dist2.ClearExtraChannels();
 
-  JXL_CHECK(orig2.TransformTo(jxl::ColorEncoding::LinearSRGB(orig2.IsGray()),
-                              jxl::GetJxlCms()));
-  JXL_CHECK(dist2.TransformTo(jxl::ColorEncoding::LinearSRGB(dist2.IsGray()),
-                              jxl::GetJxlCms()));
+  if (!orig2.IsLinearSRGB()) {
+    JXL_CHECK(orig2.TransformTo(jxl::ColorEncoding::LinearSRGB(orig2.IsGray()),
+                                jxl::GetJxlCms(), pool));
+  }
+  if (!dist2.IsLinearSRGB()) {
+    JXL_CHECK(dist2.TransformTo(jxl::ColorEncoding::LinearSRGB(dist2.IsGray()),
+                                jxl::GetJxlCms(), pool));
+  }
 
-  jxl::ToXYB(orig2, nullptr, &img1, jxl::GetJxlCms(), nullptr);
-  jxl::ToXYB(dist2, nullptr, &img2, jxl::GetJxlCms(), nullptr);
-  MakePositiveXYB(img1);
-  MakePositiveXYB(img2);
+  jxl::ToXYB(orig2, pool, &img1, jxl::GetJxlCms(), nullptr);
+  jxl::ToXYB(dist2, pool, &img2, jxl::GetJxlCms(), nullptr);
+  MakePositiveXYB(img1, pool);
+  MakePositiveXYB(img2, pool);
 
+  // Allocated once at the first scale and shrunk for the next ones.
   Image3F mul(img1.xsize(), img1.ysize());
-  Blur blur(img1.xsize(), img1.ysize());
+  Image3F sigma1_sq(img1.xsize(), img1.ysize());
+  Image3F sigma2_sq(img1.xsize(), img1.ysize());
+  Image3F sigma12(img1.xsize(), img1.ysize());
+  Image3F mu1(img1.xsize(), img1.ysize());
+  Image3F mu2(img1.xsize(), img1.ysize());
+  Blur blur(img1.xsize(), img1.ysize(), pool);
 
   for (int scale = 0; scale < kNumScales; scale++) {
     if (img1.xsize() < 8 || img1.ysize() < 8) {
       break;
     }
     if (scale) {
-      orig2.SetFromImage(Downsample(*orig2.color(), 2, 2),
+      orig2.SetFromImage(Downsample(*orig2.color(), 2, 2, pool),
                          jxl::ColorEncoding::LinearSRGB(orig2.IsGray()));
-      dist2.SetFromImage(Downsample(*dist2.color(), 2, 2),
+      dist2.SetFromImage(Downsample(*dist2.color(), 2, 2, pool),
                          jxl::ColorEncoding::LinearSRGB(dist2.IsGray()));
       img1.ShrinkTo(orig2.xsize(), orig2.ysize());
       img2.ShrinkTo(orig2.xsize(), orig2.ysize());
-      jxl::ToXYB(orig2, nullptr, &img1, jxl::GetJxlCms(), nullptr);
-      jxl::ToXYB(dist2, nullptr, &img2, jxl::GetJxlCms(), nullptr);
-      MakePositiveXYB(img1);
-      MakePositiveXYB(img2);
+      jxl::ToXYB(orig2, pool, &img1, jxl::GetJxlCms(), nullptr);
+      jxl::ToXYB(dist2, pool, &img2, jxl::GetJxlCms(), nullptr);
+      MakePositiveXYB(img1, pool);
+      MakePositiveXYB(img2, pool);
     }
     mul.ShrinkTo(img1.xsize(), img1.ysize());
     blur.ShrinkTo(img1.xsize(), img1.ysize());
 
-    Multiply(img1, img1, &mul);
-    Image3F sigma1_sq = blur(mul);
+    Multiply(img1, img1, pool, &mul);
+    blur(mul, &sigma1_sq);
 
-    Multiply(img2, img2, &mul);
-    Image3F sigma2_sq = blur(mul);
+    Multiply(img2, img2, pool, &mul);
+    blur(mul, &sigma2_sq);
 
-    Multiply(img1, img2, &mul);
-    Image3F sigma12 = blur(mul);
+    Multiply(img1, img2, pool, &mul);
+    blur(mul, &sigma12);
 
-    Image3F mu1 = blur(img1);
-    Image3F mu2 = blur(img2);
+    blur(img1, &mu1);
+    blur(img2, &mu2);
 
     MsssimScale sscale;
-    SSIMMap(mu1, mu2, sigma1_sq, sigma2_sq, sigma12, sscale.avg_ssim);
-    EdgeDiffMap(img1, mu1, img2, mu2, sscale.avg_edgediff);
+    SSIMMap(mu1, mu2, sigma1_sq, sigma2_sq, sigma12, pool, sscale.avg_ssim);
+    EdgeDiffMap(img1, mu1, img2, mu2, pool, sscale.avg_edgediff);
     msssim.scales.push_back(sscale);
   }
   return msssim;
 }
 
 Msssim ComputeSSIMULACRA2(const jxl::ImageBundle& orig,
-                          const jxl::ImageBundle& distorted) {
-  return ComputeSSIMULACRA2(orig, distorted, 0.5f);
+                          const jxl::ImageBundle& distorted,
+                          jxl::ThreadPool* pool) {
+  return ComputeSSIMULACRA2(orig, distorted, 0.5f, pool);
 }
+#endif  // HWY_ONCE
@@ -8,6 +8,7 @@
 
 #include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/image_bundle.h"
 
 struct MsssimScale {
@@ -23,10 +24,13 @@ struct Msssim {
 
 // Computes the SSIMULACRA 2 score between reference image 'orig' and
 // distorted image 'distorted'. In case of alpha transparency, assume
-// a gray background if intensity 'bg' (in range 0..1).
+// a gray background if intensity 'bg' (in range 0..1). The score does not
+// depend on the number of threads of 'pool'.
 Msssim ComputeSSIMULACRA2(const jxl::ImageBundle &orig,
-                          const jxl::ImageBundle &distorted, float bg);
+                          const jxl::ImageBundle &distorted, float bg,
+                          jxl::ThreadPool *pool = nullptr);
 Msssim ComputeSSIMULACRA2(const jxl::ImageBundle &orig,
-                          const jxl::ImageBundle &distorted);
+                          const jxl::ImageBundle &distorted,
+                          jxl::ThreadPool *pool = nullptr);
 
 #endif  // TOOLS_SSIMULACRA2_H_
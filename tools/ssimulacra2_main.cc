@@ -9,6 +9,7 @@
 #include "lib/jxl/color_management.h"
 #include "lib/jxl/enc_color_management.h"
 #include "tools/ssimulacra2.h"
+#include "tools/thread_pool_internal.h"
 
 int PrintUsage(char** argv) {
   fprintf(stderr, "Usage: %s orig.png distorted.png\n", argv[0]);
@@ -41,29 +42,30 @@ int PrintUsage(char** argv) {
 int main(int argc, char** argv) {
   if (argc != 3) return PrintUsage(argv);
 
+  jpegxl::tools::ThreadPoolInternal pool;
   jxl::CodecInOut io1;
   jxl::CodecInOut io2;
-  JXL_CHECK(SetFromFile(argv[1], jxl::extras::ColorHints(), &io1));
+  JXL_CHECK(SetFromFile(argv[1], jxl::extras::ColorHints(), &io1, &pool));
 
   if (io1.xsize() < 8 || io1.ysize() < 8) {
     fprintf(stderr, "Minimum image size is 8x8 pixels\n");
     return 1;
   }
 
-  JXL_CHECK(SetFromFile(argv[2], jxl::extras::ColorHints(), &io2));
+  JXL_CHECK(SetFromFile(argv[2], jxl::extras::ColorHints(), &io2, &pool));
   if (io1.xsize() != io2.xsize() || io1.ysize() != io2.ysize()) {
     fprintf(stderr, "Image size mismatch\n");
     return 1;
   }
 
   if (!io1.Main().HasAlpha()) {
-    Msssim msssim = ComputeSSIMULACRA2(io1.Main(), io2.Main());
+    Msssim msssim = ComputeSSIMULACRA2(io1.Main(), io2.Main(), &pool);
     printf("%.8f\n", msssim.Score());
   } else {
     // in case of alpha transparency: blend against dark and bright backgrounds
     // and return the worst of both scores
-    Msssim msssim0 = ComputeSSIMULACRA2(io1.Main(), io2.Main(), 0.1f);
-    Msssim msssim1 = ComputeSSIMULACRA2(io1.Main(), io2.Main(), 0.9f);
+    Msssim msssim0 = ComputeSSIMULACRA2(io1.Main(), io2.Main(), 0.1f, &pool);
+    Msssim msssim1 = ComputeSSIMULACRA2(io1.Main(), io2.Main(), 0.9f, &pool);
     printf("%.8f\n", std::min(msssim0.Score(), msssim1.Score()));
   }
   return 0;
@@ -9,14 +9,39 @@
 #include <jxl/decode_cxx.h>
 #include <jxl/thread_parallel_runner_cxx.h>
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
 #include <vector>
 
+#ifdef __EMSCRIPTEN__
+#include <emscripten/threading.h>
+#endif
+
+// Size of the pthread pool that is spawned with the module, see
+// PTHREAD_POOL_SIZE in CMakeLists.txt; creating more threads would wait for a
+// new Web Worker to be loaded.
+#ifndef JXL_WASM_THREAD_POOL_SIZE
+#define JXL_WASM_THREAD_POOL_SIZE 4
+#endif
+
 extern "C" {
 
 namespace {
 
+size_t NumWorkerThreads(uint32_t num_threads) {
+  if (num_threads == 0) {
+#ifdef __EMSCRIPTEN__
+    // navigator.hardwareConcurrency
+    const int num_cores = emscripten_num_logical_cores();
+#else
+    const int num_cores = JXL_WASM_THREAD_POOL_SIZE + 1;
+#endif
+    num_threads = std::max(num_cores - 1, 1);
+  }
+  return std::min<size_t>(num_threads, JXL_WASM_THREAD_POOL_SIZE);
+}
+
 struct DecoderInstancePrivate {
   // Due to "Standard Layout" rules it is guaranteed that address of the entity
   // and its first non-static member are the same.
@@ -34,7 +59,8 @@ struct DecoderInstancePrivate {
 
 }  // namespace
 
-DecoderInstance* jxlCreateInstance(bool want_sdr, uint32_t display_nits) {
+DecoderInstance* jxlCreateInstance(bool want_sdr, uint32_t display_nits,
+                                   uint32_t num_threads) {
   DecoderInstancePrivate* self = new DecoderInstancePrivate();
 
   if (!self) {
@@ -55,7 +81,8 @@ DecoderInstance* jxlCreateInstance(bool want_sdr, uint32_t display_nits) {
     return reinterpret_cast<DecoderInstance*>(code);
   };
 
-  self->thread_pool = JxlThreadParallelRunnerMake(nullptr, 4);
+  self->thread_pool =
+      JxlThreadParallelRunnerMake(nullptr, NumWorkerThreads(num_threads));
   void* runner = self->thread_pool.get();
 
   auto status =
@@ -164,6 +191,7 @@ uint32_t jxlProcessInput(DecoderInstance* instance, const uint8_t* input,
         return report_error(-7, "Tried to realloc pixels");
       }
       instance->pixels = reinterpret_cast<uint8_t*>(malloc(self->pixels_size));
+      instance->pixels_size = self->pixels_size;
     } else if (JXL_DEC_NEED_IMAGE_OUT_BUFFER == status) {
       if (!self->info.pixels) {
         release_input();
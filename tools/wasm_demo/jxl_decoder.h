@@ -14,12 +14,20 @@ extern "C" {
 typedef struct DecoderInstance {
   uint32_t width = 0;
   uint32_t height = 0;
+  // RGBA pixels, without padding between rows, as expected by ImageData; they
+  // are updated in place by each flush, so that JS can view them directly in
+  // the heap instead of copying them out.
   uint8_t* pixels = nullptr;
+  uint32_t pixels_size = 0;
 
   // The rest is opaque.
 } DecoderInstance;
 
 /*
+  num_threads is the number of worker threads of the decoder; 0 selects one
+  less than the number of logical cores, as the calling worker only waits for
+  them, and at most the size of the pre-spawned pthread pool of the module.
+
   Returns (as uint32_t):
     0 - OOM
     1 - JxlDecoderSetParallelRunner failed
@@ -27,7 +35,8 @@ typedef struct DecoderInstance {
     3 - JxlDecoderSetProgressiveDetail failed
     >=4 - OK
  */
-DecoderInstance* jxlCreateInstance(bool want_sdr, uint32_t display_nits);
+DecoderInstance* jxlCreateInstance(bool want_sdr, uint32_t display_nits,
+                                   uint32_t num_threads);
 
 void jxlDestroyInstance(DecoderInstance* instance);
 
@@ -41,6 +50,13 @@ void jxlDestroyInstance(DecoderInstance* instance);
 uint32_t jxlProcessInput(DecoderInstance* instance, const uint8_t* input,
                          size_t input_size);
 
+/*
+  Renders the progressive step decoded so far into pixels.
+
+  Returns (as uint32_t):
+    0 - OK (pixels are updated)
+    >=1 - error
+ */
 uint32_t jxlFlush(DecoderInstance* instance);
 
 }  // extern "C"
@@ -40,7 +40,7 @@ let crossJxl = new Uint8Array([
 
 function testSdr() {
   let decoder = jxlModule._jxlCreateInstance(
-      /* wantSdr */ true, /* displayNits */ 100);
+      /* wantSdr */ true, /* displayNits */ 100, /* numThreads */ 0);
   assertTrue(isAddress(decoder), 'create decoder instance');
   let encoded = splinesJxl;
   let buffer = jxlModule._malloc(encoded.length);
@@ -52,10 +52,12 @@ function testSdr() {
   let w = jxlModule.HEAP32[decoder >> 2];
   let h = jxlModule.HEAP32[(decoder + 4) >> 2];
   let pixelData = jxlModule.HEAP32[(decoder + 8) >> 2];
+  let pixelsSize = jxlModule.HEAP32[(decoder + 12) >> 2];
 
   assertTrue(pixelData, 'output allocated');
   assertTrue(h === 320, 'output height');
   assertTrue(w === 320, 'output width ');
+  assertTrue(pixelsSize === w * h * 4, 'output size');
 
   jxlModule._jxlDestroyInstance(decoder);
   jxlModule._free(buffer);
@@ -63,7 +65,7 @@ function testSdr() {
 
 function testRegular() {
   let decoder = jxlModule._jxlCreateInstance(
-      /* wantSdr */ false, /* displayNits */ 100);
+      /* wantSdr */ false, /* displayNits */ 100, /* numThreads */ 2);
   assertTrue(isAddress(decoder), 'create decoder instance');
   let encoded = splinesJxl;
   let buffer = jxlModule._malloc(encoded.length);
@@ -86,7 +88,7 @@ function testRegular() {
 
 function testChunks() {
   let decoder = jxlModule._jxlCreateInstance(
-      /* wantSdr */ false, /* displayNits */ 100);
+      /* wantSdr */ false, /* displayNits */ 100, /* numThreads */ 2);
   assertTrue(isAddress(decoder), 'create decoder instance');
   let encoded = splinesJxl;
   let buffer = jxlModule._malloc(encoded.length);